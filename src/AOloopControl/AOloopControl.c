@@ -37,6 +37,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -72,7 +73,11 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #include <sys/mman.h>
 #include <err.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 //#include <ncurses.h>
 #include <semaphore.h>
 
@@ -119,6 +124,13 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define DM2DM_OFFLOAD_SEMINDEX 6     // input stream semaphore used by AOloopControl_dm2dm_offloadM
+#define DM2DM_OFFLOAD_GPULOOPNB 80   // cudacomp semaphore names loop number for offload MVM
+#define WFSZP_RESYNC 1000           // WFS zero point loops: full recompute after this many delta updates
+#define SIG2MCOEFF_BATCH 256        // AOloopControl_sig2Modecoeff: frames per GEMM
+#define SIG2MCOEFF_CHUNK (256L*1024*1024) // AOloopControl_sig2Modecoeff: bytes per input chunk read from file
+#define OLMODES_RECONNECT_NBITER 1000 // ComputeOpenLoopModes: iterations between connection attempts to missing modevalPF / autogain stream
+
 
 
 /* =============================================================================================== */
@@ -301,6 +313,35 @@ static long aoconfIDlog0 = -1;
 static long aoconfIDlog1 = -1;
 
 int *WFS_active_map; // used to map WFS pixels into active array
+static long *WFS_active_index = NULL; // active WFS pixels (mask > 0.5), built by AOloopControl_loadconfigure
+static float *WFS_active_vect = NULL; // active WFS pixels of imWFS2, gathered for CPU control matrix multiply
+
+// control matrix restricted to active WFS pixels (CPU path)
+typedef struct
+{
+    float *cm;
+    void *q;           // reduced precision copy of cm (INT8 or BF16)
+    float *scale;      // INT8 scale factor per row
+    long NBelem;       // allocated size of cm and q [elements]
+    long NBrow;        // allocated size of scale [elements]
+    long ID;           // control matrix from which buffer was built
+    long long cnt0;
+    int precision;
+    long m;            // rows
+    long nact;         // active WFS pixels
+} AOLOOPCONTROL_CMBUFF;
+
+// two buffers: CMbuff[CMbuff_active] is used by the loop, the other one is the standby copy prepared by AOloopControl_CMhotswap_thread
+// CMbuff_active is only written by the loop process, CMbuff_ready only set by the hot swap thread; both published with __atomic release/acquire
+static AOLOOPCONTROL_CMBUFF CMbuff[2] = {
+    { NULL, NULL, NULL, 0, 0, -1, -1, CMPRECISION_FP32, 0, 0 },
+    { NULL, NULL, NULL, 0, 0, -1, -1, CMPRECISION_FP32, 0, 0 }
+};
+static int CMbuff_active = 0;
+static int CMbuff_ready = 0; // 1 when standby buffer is ready to be swapped in
+static volatile int CM_hotswap_running = 0;
+static pthread_t CM_hotswap_thread;
+static float *DMmodes_arrayf = NULL; // DM scratch for set_DM_modes and set_DM_modesRM, sizeDM elements
 int *DM_active_map; // used to map DM actuators into active array
 static long aoconfID_meas_act_active;
 static long aoconfID_imWFS2_active[100];
@@ -353,6 +394,13 @@ long LOOPNUMBER = 0; // current loop index
 int AOloopcontrol_meminit = 0;
 static int AOlooploadconf_init = 0;
 
+int loadcreateshm_log = 0;
+FILE *loadcreateshm_fplog = NULL;
+int loadcreateshm_fastpath = 1;
+
+static struct timespec loadconf_t0;    // AOloopControl_loadconfigure start
+static struct timespec loadconf_tstep; // AOloopControl_loadconfigure last step end
+
 #define AOconfname "/tmp/AOconf.shm"
 AOLOOPCONTROL_CONF *AOconf; // configuration - this can be an array
 
@@ -508,6 +556,24 @@ int_fast8_t AOloopControl_AutoTuneGains_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_looptiming_stats */
+int_fast8_t AOloopControl_looptiming_stats_cli() {
+    if(CLI_checkarg(1,1)+CLI_checkarg(2,3)==0) {
+        AOloopControl_looptiming_stats(LOOPNUMBER, data.cmdargtoken[1].val.numf, data.cmdargtoken[2].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_dm2dm_offloadM */
+int_fast8_t AOloopControl_dm2dm_offloadM_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,3)+CLI_checkarg(4,1)+CLI_checkarg(5,1)+CLI_checkarg(6,1)==0) {
+        AOloopControl_dm2dm_offloadM(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_dm2dm_offload */
 int_fast8_t AOloopControl_dm2dm_offload_cli() {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,1)+CLI_checkarg(4,1)+CLI_checkarg(5,1)==0) {
@@ -782,6 +848,15 @@ int_fast8_t AOloopControl_scanGainBlock_cli() {
     else    return 1;
 }
 
+/** @brief CLI function for AOloopControl_scanGainBlock_multiplex */
+int_fast8_t AOloopControl_scanGainBlock_multiplex_cli() {
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,1)+CLI_checkarg(3,2)==0) {
+        AOloopControl_scanGainBlock_multiplex(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numl);
+        return 0;
+    }
+    else    return 1;
+}
+
 
 
 /* =============================================================================================== */
@@ -790,6 +865,16 @@ int_fast8_t AOloopControl_scanGainBlock_cli() {
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+/** @brief CLI function for AOloopControl_OptimizePSF_LO_SPSA */
+int_fast8_t AOloopControl_OptimizePSF_LO_SPSA_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,1)+CLI_checkarg(8,1)==0)   {
+        AOloopControl_OptimizePSF_LO_SPSA(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.numf);
+        return 0;
+    }
+    else        return 1;
+}
+
 /** @brief CLI function for AOloopControl_DMmodulateAB */
 int_fast8_t AOloopControl_DMmodulateAB_cli()
 {
@@ -1001,6 +1086,10 @@ int_fast8_t init_AOloopControl()
 
     RegisterCLIcommand("aolrun", __FILE__, AOloopControl_run, "run AO loop", "no arg", "aolrun", "int AOloopControl_run()");
 
+    RegisterCLIcommand("aoltimingstats", __FILE__, AOloopControl_looptiming_stats_cli, "loop per-stage timing percentiles and outliers", "<threshold [us]> <output file>", "aoltimingstats 500 looptiming.txt", "int AOloopControl_looptiming_stats(long loop, float thresholdus, const char *fname)");
+
+    RegisterCLIcommand("aolrtsched", __FILE__, AOloopControl_RTsched_status, "real-time scheduling status of all loops", "no arg", "aolrtsched", "int AOloopControl_RTsched_status()");
+
     RegisterCLIcommand("aolzpwfsloop",__FILE__, AOloopControl_WFSzpupdate_loop_cli, "WFS zero point offset loop", "<dm offset [shared mem]> <zonal resp M [shared mem]> <nominal WFS reference>  <modified WFS reference>", "aolzpwfsloop dmZP zrespM wfszp", "int AOloopControl_WFSzpupdate_loop(char *IDzpdm_name, char *IDzrespM_name, char *IDwfszp_name)");
 
     RegisterCLIcommand("aolzpwfscloop", __FILE__, AOloopControl_WFSzeropoint_sum_update_loop_cli, "WFS zero point offset loop: combine multiple input channels", "<name prefix> <number of channels> <wfsref0> <wfsref>", "aolzpwfscloop wfs2zpoffset 4 wfsref0 wfsref", "int AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, char *ID_WFSzp_name, int NBzp, char *IDwfsref0_name, char *IDwfsref_name)");
@@ -1009,7 +1098,7 @@ int_fast8_t init_AOloopControl()
 
     RegisterCLIcommand("aolmc2dmfilt", __FILE__, AOloopControl_GPUmodecoeffs2dm_filt_loop_cli, "convert mode coefficients to DM map", "<mode coeffs> <DMmodes> <sem trigg number> <out> <GPUindex> <loopnb> <offloadMode>", "aolmc2dmfilt aolmodeval DMmodesC 2 dmmapc 0.2 1 2 1", "int AOloopControl_GPUmodecoeffs2dm_filt_loop(char *modecoeffs_name, char *DMmodes_name, int semTrigg, char *out_name, int GPUindex, long loop, long offloadMode)");
 
-    RegisterCLIcommand("aolsig2mcoeff", __FILE__, AOloopControl_sig2Modecoeff_cli, "convert signals to mode coeffs", "<signal data cube> <reference> <Modes data cube> <output image>", "aolsig2mcoeff wfsdata wfsref wfsmodes outim", "long AOloopControl_sig2Modecoeff(char *WFSim_name, char *IDwfsref_name, char *WFSmodes_name, char *outname)");
+    RegisterCLIcommand("aolsig2mcoeff", __FILE__, AOloopControl_sig2Modecoeff_cli, "convert signals to mode coeffs", "<signal data cube or FITS file> <reference> <Modes data cube> <output image or .fits file>", "aolsig2mcoeff wfsdata wfsref wfsmodes outim", "long AOloopControl_sig2Modecoeff(char *WFSim_name, char *IDwfsref_name, char *WFSmodes_name, char *outname)");
 
 
 
@@ -1208,6 +1297,8 @@ int_fast8_t init_AOloopControl()
 
     RegisterCLIcommand("aolscangainb", __FILE__, AOloopControl_scanGainBlock_cli, "scan gain for block", "<blockNB> <NBAOsteps> <gainstart> <gainend> <NBgainpts>", "aolscangainb", "int AOloopControl_scanGainBlock(long NBblock, long NBstep, float gainStart, float gainEnd, long NBgain)");
 
+    RegisterCLIcommand("aolscangainbm", __FILE__, AOloopControl_scanGainBlock_multiplex_cli, "multiplexed gain scan, all blocks", "<NBAOsteps> <relative dither> <NBcycle>", "aolscangainbm 2000 0.2 3", "int AOloopControl_scanGainBlock_multiplex(long NBstep, float dither, long NBcycle)");
+
     RegisterCLIcommand("aolmkwfsres", __FILE__, AOloopControl_computeWFSresidualimage_cli, "compute WFS residual real time", "<loopnb> <averaging coeff image>", "aolmkwfsres 2 coeffim", "long AOloopControl_computeWFSresidualimage(long loop, char *IDalpha_name)");
 
 
@@ -1216,12 +1307,16 @@ int_fast8_t init_AOloopControl()
 
     RegisterCLIcommand("aolautotunegains", __FILE__, AOloopControl_AutoTuneGains_cli, "compute optimal gains", "<loop #> <gain stream> <gaincoeff> <NBsamples>", "aolautotunegains 0 autogain 0.1 20000", "long AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float GainCoeff, long NBsamples)");
 
-    RegisterCLIcommand("aoldm2dmoffload", __FILE__, AOloopControl_dm2dm_offload_cli, "slow offload from dm to dm", "<streamin> <streamout> <timestep[sec]> <offloadcoeff> <multcoeff>", "aoldm2dmoffload dmin dmout 0.5 -0.01 0.999", "long AOloopControl_dm2dm_offload(const char *streamin, const char *streamout, float twait, float offcoeff, float multcoeff)");
+    RegisterCLIcommand("aoldm2dmoffload", __FILE__, AOloopControl_dm2dm_offload_cli, "slow offload from dm to dm, on input update, decimated", "<streamin> <streamout> <min timestep[sec]> <offloadcoeff> <multcoeff>", "aoldm2dmoffload dmin dmout 0.5 -0.01 0.999", "long AOloopControl_dm2dm_offload(const char *streamin, const char *streamout, float twait, float offcoeff, float multcoeff)");
+
+    RegisterCLIcommand("aoldm2dmoffloadM", __FILE__, AOloopControl_dm2dm_offloadM_cli, "slow offload from dm to dm through projection matrix (NULL: identity), on input update, decimated", "<streamin> <streamout> <matrix> <min timestep[sec]> <offloadcoeff> <multcoeff>", "aoldm2dmoffloadM dmin dmout dm2dmM 0.5 -0.01 0.999", "long AOloopControl_dm2dm_offloadM(const char *streamin, const char *streamout, const char *IDmatrix_name, float twait, float offcoeff, float multcoeff)");
 
     RegisterCLIcommand("aolautotune",  __FILE__, AOloopControl_AutoTune, "auto tuning of loop parameters", "no arg", "aolautotune", "int_fast8_t AOloopControl_AutoTune()");
 
     RegisterCLIcommand("aolset", __FILE__, AOloopControl_setparam_cli, "set parameter", "<parameter> <value>" , "aolset", "int AOloopControl_setparam(long loop, const char *key, double value)");
 
+    RegisterCLIcommand("aoloptpsflo", __FILE__, AOloopControl_OptimizePSF_LO_SPSA_cli, "optimize PSF sharpness with LO modes (SPSA)", "<PSF stream> <modes> <dmstream> <delay [frames]> <NBframes ave> <NBiter> <probe ampl> <gain>", "aoloptpsflo psfstream LOmodes dm00disp04 2 10 100 0.01 1.0","int AOloopControl_OptimizePSF_LO_SPSA(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes, long NBiter, float ampl, float gain)");
+
     RegisterCLIcommand("aoldmmodAB", __FILE__, AOloopControl_DMmodulateAB_cli, "module DM with linear combination of probes A and B", "<probeA> <probeB> <dmstream> <WFS resp mat> <WFS ref stream> <delay [sec]> <NB probes>", "aoldmmodAB probeA probeB wfsrespmat wfsref 0.1 6","int AOloopControl_DMmodulateAB(const char *IDprobeA_name, const char *IDprobeB_name, const char *IDdmstream_name, const char *IDrespmat_name, const char *IDwfsrefstream_name, double delay, long NBprobes)");
 
 
@@ -1447,21 +1542,171 @@ char* AOloopControl_readParam_string(char *paramname, char* defaultValue, FILE *
 
 
 
+/**
+ * ## Purpose
+ * 
+ * Write parameter value (float) to conf/param_paramname.txt
+ * 
+ * Used instead of system("echo ...") from real-time processes, which would fork.
+ * 
+ */
+int AOloopControl_writeParam_float(const char *paramname, float value)
+{
+	FILE *fp;
+	char fname[200];
+	
+	sprintf(fname, "./conf/param_%s.txt", paramname);
+	if((fp=fopen(fname, "w"))==NULL)
+	{
+		printERROR(__FILE__,__func__,__LINE__, "Cannot write parameter file");
+		return(-1);
+	}
+	fprintf(fp, "%6.4f\n", value);
+	fclose(fp);
+	
+	return(0);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 
 
 
 
 
+/** @brief Logs time spent in AOloopControl_loadconfigure step that just completed, and total */
+static void AOloopControl_loadconf_steptime(FILE *fplog, const char *stepname)
+{
+    struct timespec tn, dtstep, dttot;
+
+    clock_gettime(CLOCK_REALTIME, &tn);
+    dtstep = info_time_diff(loadconf_tstep, tn);
+    dttot = info_time_diff(loadconf_t0, tn);
+    fprintf(fplog, "TIMING  %-40s %10.3f ms    total %10.3f ms\n", stepname, 1.0e3*dtstep.tv_sec + 1.0e-6*dtstep.tv_nsec, 1.0e3*dttot.tv_sec + 1.0e-6*dttot.tv_nsec);
+    fflush(fplog);
+    loadconf_tstep = tn;
+}
 
 
 
+/**
+ * @brief Starts background read of FITS files loaded by AOloopControl_loadconfigure
+ *
+ * List and order follow AOloopControl_loadconfigure. File names must be identical to the ones
+ * passed to the loadcreate functions.\n
+ * - ./conf/param_loadNBthread.txt   : number of reading threads (0: no prefetch)
+ * - ./conf/param_loadprefetchMB.txt : maximum buffered size [MB]
+ */
+static long AOloopControl_loadconf_prefetch(long loop, int level, FILE *fplog)
+{
+    char **name;
+    char **fname;
+    long NBfile = 0;
+    long NBblock = 1;
+    long NBfilemax;
+    long kk;
+    long NBqueued;
+    int NBthread;
+    long maxMB;
+    FILE *fp;
+
+    NBthread = AOloopControl_readParam_int("loadNBthread", 4, fplog);
+    maxMB = AOloopControl_readParam_int("loadprefetchMB", 4096, fplog);
+    if(NBthread < 1)
+        return(0);
 
+    if((level >= 10)&&((fp = fopen("conf/param_NBmodeblocks.txt", "r")) != NULL))
+    {
+        if((fscanf(fp, "%50ld", &NBblock) != 1)||(NBblock < 1))
+            NBblock = 1;
+        fclose(fp);
+    }
 
+    NBfilemax = 12 + 5*NBblock;
+    name = (char**) malloc(sizeof(char*)*NBfilemax);
+    fname = (char**) malloc(sizeof(char*)*NBfilemax);
+    for(kk=0; kk<NBfilemax; kk++)
+    {
+        name[kk] = (char*) malloc(sizeof(char)*200);
+        fname[kk] = (char*) malloc(sizeof(char)*200);
+    }
 
+    sprintf(name[NBfile], "aol%ld_wfsdark", loop);
+    sprintf(fname[NBfile++], "./conf/shmim_wfsdark.fits");
+    sprintf(name[NBfile], "aol%ld_wfsref0", loop);
+    sprintf(fname[NBfile++], "./conf/shmim_wfsref0.fits");
+    sprintf(name[NBfile], "aol%ld_wfsref", loop);
+    sprintf(fname[NBfile++], "./conf/shmim_wfsref.fits");
 
+    if(level >= 10)
+    {
+        sprintf(name[NBfile], "aol%ld_wfsmask", loop);
+        sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+        NBfile++;
+        sprintf(name[NBfile], "aol%ld_dmmask", loop);
+        sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+        NBfile++;
+        sprintf(name[NBfile], "%s", AOconf[loop].respMname);
+        sprintf(fname[NBfile++], "conf/shmim_respM.fits");
+        sprintf(name[NBfile], "%s", AOconf[loop].contrMname);
+        sprintf(fname[NBfile++], "conf/shmim_contrM.fits");
+        sprintf(name[NBfile], "aol%ld_contrMc", loop);
+        sprintf(fname[NBfile++], "conf/shmim_contrMc.fits");
+        sprintf(name[NBfile], "aol%ld_contrMcact", loop);
+        sprintf(fname[NBfile++], "conf/shmim_contrMcact_00.fits");
+        sprintf(name[NBfile], "aol%ld_gainb", loop);
+        sprintf(fname[NBfile++], "conf/shmim_gainb.fits");
+        sprintf(name[NBfile], "aol%ld_multfb", loop);
+        sprintf(fname[NBfile++], "conf/shmim_multfb.fits");
+        sprintf(name[NBfile], "aol%ld_limitb", loop);
+        sprintf(fname[NBfile++], "conf/shmim_limitb.fits");
+
+        for(kk=0; kk<NBblock; kk++)
+        {
+            sprintf(name[NBfile], "aol%ld_DMmodes%02ld", loop, kk);
+            sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+            NBfile++;
+            sprintf(name[NBfile], "aol%ld_respM%02ld", loop, kk);
+            sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+            NBfile++;
+            sprintf(name[NBfile], "aol%ld_contrM%02ld", loop, kk);
+            sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+            NBfile++;
+            sprintf(name[NBfile], "aol%ld_contrMc%02ld", loop, kk);
+            sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+            NBfile++;
+            sprintf(name[NBfile], "aol%ld_contrMcact%02ld_00", loop, kk);
+            sprintf(fname[NBfile], "conf/%s.fits", name[NBfile]);
+            NBfile++;
+        }
+    }
 
+    NBqueued = AOloopControl_IOtools_loadcreate_prefetch(NBfile, name, fname, NBthread, maxMB);
+    fprintf(fplog, "prefetch: %ld / %ld files queued, %d threads, %ld MB max\n", NBqueued, NBfile, NBthread, maxMB);
 
+    for(kk=0; kk<NBfilemax; kk++)
+    {
+        free(name[kk]);
+        free(fname[kk]);
+    }
+    free(name);
+    free(fname);
 
+    return(NBqueued);
+}
 
 
 
@@ -1517,6 +1762,8 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
     CORE_logFunctionCall( AOLOOPCONTROL_logfunc_level, AOLOOPCONTROL_logfunc_level_max, 0, __FUNCTION__, __LINE__, "");
 #endif
 
+    clock_gettime(CLOCK_REALTIME, &loadconf_t0);
+    loadconf_tstep = loadconf_t0;
 
 	// Create logfile for this function
 	//
@@ -1538,6 +1785,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 	fprintf(fplog, "\n\n============== 1.1. Initialize memory ===================\n\n");
     if(AOloopcontrol_meminit==0)
         AOloopControl_InitializeMemory(0);
+    AOloopControl_loadconf_steptime(fplog, "1.1 initialize memory");
 
 
 
@@ -1688,6 +1936,26 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 
     // TOTAL image done in separate thread ?
     AOconf[loop].AOLCOMPUTE_TOTAL_ASYNC = AOloopControl_readParam_int("COMPUTE_TOTAL_ASYNC", 1, fplog);
+
+    // pixel streaming: multiply each WFS slice by control matrix as it is read out ?
+    AOconf[loop].PIXSTREAMpipe = AOloopControl_readParam_int("PIXSTREAMpipe", 0, fplog);
+
+    // stored precision of control matrix in CPU multiply: 0 = FP32, 1 = BF16, 2 = INT8 (per-row scale)
+    AOconf[loop].CMprecision = AOloopControl_readParam_int("CMprecision", CMPRECISION_FP32, fplog);
+
+    // new control matrix prepared/uploaded in background and swapped at frame boundary (no loop stall) ?
+    AOconf[loop].CMhotswap = AOloopControl_readParam_int("CMhotswap", 0, fplog);
+
+    // GPU matrix multiply transfers: 0 = compute threads + semaphores, 1 = pinned async copies + events, 2 = 1 launched as CUDA graph
+    AOconf[loop].GPUasync = AOloopControl_readParam_int("GPUasync", 0, fplog);
+    AOconf[loop].GPUbalance = AOloopControl_readParam_int("GPUbalance", 0, fplog);
+    AOconf[loop].GPUfailover = AOloopControl_readParam_int("GPUfailover", 0, fplog);
+    AOconf[loop].GPUfailovercnt = 0;
+
+    // GPU MVM reads camera stream in place (mapped pinned memory), dark/normalization folded into MVM ?
+    AOconf[loop].GPUzerocopy = AOloopControl_readParam_int("GPUzerocopy", 0, fplog);
+    AOconf[loop].GPUzerocopyON = 0;
+    AOconf[loop].WFScnttorn = 0;
  
 
     /** ### 1.8. Read CMatrix mult mode
@@ -1716,6 +1984,31 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 
     aoconfID_looptiming = AOloopControl_IOtools_2Dloadcreate_shmim(name, " ", NBtimers, 1, 0.0);
 
+    // per-stage timing ring (aol<loop>_looptimingring), created when loop starts
+    AOconf[loop].looptimingNBrow = AOloopControl_readParam_int("looptimingNBrow", 10000, fplog);
+    AOconf[loop].looptimingoutlus = AOloopControl_readParam_float("looptimingoutlus", 0.0, fplog); // 0: 2 loop periods
+
+    // status snapshot read by monitors (aolmon, aolstatusstats), published every statsnapNBframe iterations
+    AOconf[loop].statsnapNBframe = AOloopControl_readParam_int("statsnapNBframe", 1000, fplog);
+    AOconf[loop].statsnapindex = 0;
+    AOconf[loop].statsnapcnt = 0;
+
+    // WFS residual images computed by main loop instead of separate aolmkwfsres process
+    AOconf[loop].WFSresinloop = AOloopControl_readParam_int("WFSresinloop", 0, fplog);
+    AOconf[loop].WFSresdecim = AOloopControl_readParam_int("WFSresdecim", 1, fplog);
+    if(AOconf[loop].WFSresdecim < 1)
+        AOconf[loop].WFSresdecim = 1;
+    AOconf[loop].WFSresalpha = AOloopControl_readParam_float("WFSresalpha", 0.01, fplog);
+
+    // 1: report name lookups and heap allocations in main loop steady state
+    AOconf[loop].RTcheck = AOloopControl_readParam_int("RTcheck", 0, fplog);
+    AOconf[loop].RTcheckNBviol = 0;
+
+    // streams matching their load stamp are attached without reading the FITS file
+    loadcreateshm_fastpath = AOloopControl_readParam_int("loadfastpath", 1, fplog);
+
+    AOloopControl_loadconf_steptime(fplog, "1. configuration parameters");
+
 
 
 
@@ -1754,6 +2047,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
     AOconf[loop].sizeWFS = AOconf[loop].sizexWFS*AOconf[loop].sizeyWFS;
 
     fprintf(fplog, "WFS stream size = %ld x %ld\n", AOconf[loop].sizexWFS, AOconf[loop].sizeyWFS);
+    AOloopControl_loadconf_steptime(fplog, "2.1 connect to existing streams");
 
 
 
@@ -1783,6 +2077,9 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
      
 	fprintf(fplog, "\n\n============== 2.2. Read file to stream or connect to existing stream  ===================\n\n");
 
+    // independent FITS files read in background, in the order they are loaded below
+    AOloopControl_loadconf_prefetch(loop, level, fplog);
+
     if(sprintf(name, "aol%ld_wfsdark", loop) < 1)
         printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
     sprintf(fname, "./conf/shmim_wfsdark.fits");
@@ -1840,6 +2137,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 
         copy_image_ID(name1, name, 1);
     }
+    AOloopControl_loadconf_steptime(fplog, "2.2 WFS streams");
 
 
 
@@ -1910,6 +2208,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 	fprintf(fplog, "stream %s loaded as ID = %ld\n", AOconf[loop].DMmodesname, aoconfID_DMmodes);
 	AOconf[loop].NBDMmodes = data.image[aoconfID_DMmodes].md[0].size[2];
 	printf("NBmodes = %ld\n", AOconf[loop].NBDMmodes);
+    AOloopControl_loadconf_steptime(fplog, "2.3 connect to DM");
 	
 	
 	
@@ -2057,6 +2356,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 
         fprintf(fplog, "stream %s loaded as ID = %ld, size %ld %ld %ld\n", AOconf[loop].DMmodesname, aoconfID_DMmodes, AOconf[loop].sizexDM, AOconf[loop].sizeyDM, AOconf[loop].NBDMmodes);
     }
+    AOloopControl_loadconf_steptime(fplog, "3. DM modes");
 
 
 
@@ -2129,6 +2429,42 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
             if(data.image[aoconfID_wfsmask].array.F[ii]>0.5)
                 AOconf[loop].activeWFScnt++;
 
+        // compacted index of active WFS pixels, used by CPU control matrix multiply
+        free(WFS_active_index);
+        free(WFS_active_vect);
+        WFS_active_index = (long*) malloc(sizeof(long)*(AOconf[loop].activeWFScnt+1));
+        WFS_active_vect = (float*) malloc(sizeof(float)*(AOconf[loop].activeWFScnt+1));
+        {
+            long ii1 = 0;
+            for(ii=0; ii<AOconf[loop].sizexWFS*AOconf[loop].sizeyWFS; ii++)
+                if(data.image[aoconfID_wfsmask].array.F[ii]>0.5)
+                    WFS_active_index[ii1++] = ii;
+        }
+
+        // scratch used in loop, allocated here so that steady state does not allocate
+        {
+            long nact = (AOconf[loop].activeWFScnt > 0) ? AOconf[loop].activeWFScnt : AOconf[loop].sizexWFS*AOconf[loop].sizeyWFS;
+            long sizeDM = AOconf[loop].sizexDM*AOconf[loop].sizeyDM;
+            int b;
+
+            for(b=0; b<2; b++)
+            {
+                CMbuff[b].ID = -1;
+                CMbuff[b].NBrow = (AOconf[loop].NBDMmodes > sizeDM) ? AOconf[loop].NBDMmodes : sizeDM;
+                CMbuff[b].NBelem = CMbuff[b].NBrow*nact;
+                free(CMbuff[b].cm);
+                free(CMbuff[b].q);
+                free(CMbuff[b].scale);
+                CMbuff[b].cm = (float*) malloc(sizeof(float)*CMbuff[b].NBelem);
+                CMbuff[b].q = malloc(sizeof(uint16_t)*CMbuff[b].NBelem); // large enough for INT8 and BF16
+                CMbuff[b].scale = (float*) malloc(sizeof(float)*CMbuff[b].NBrow);
+            }
+            __atomic_store_n(&CMbuff_ready, 0, __ATOMIC_RELEASE);
+
+            free(DMmodes_arrayf);
+            DMmodes_arrayf = (float*) malloc(sizeof(float)*sizeDM);
+        }
+
         if(sprintf(name, "aol%ld_dmmask", loop) < 1)
             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
         if(sprintf(fname, "conf/%s.fits", name) < 1)
@@ -2245,6 +2581,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 			for(m=mstart; m<(mstart+AOconf[loop].NBmodes_block[kk]); m++)
 				AOconf[loop].modeBlockIndex[m] = kk;
 			mstart += AOconf[loop].NBmodes_block[kk];
+			AOconf[loop].modeclipcnt_block[kk] = 0;
 
 
             if(sprintf(name, "aol%ld_respM%02ld", loop, kk) < 1)
@@ -2295,6 +2632,7 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
         }
     }
     free(sizearray);
+    AOloopControl_loadconf_steptime(fplog, "4. modal streams and matrices");
 
 
 
@@ -2339,6 +2677,16 @@ int_fast8_t AOloopControl_loadconfigure(long loop, int mode, int level)
 
     AOconf[loop].init = 1;
 
+    AOloopControl_IOtools_loadcreate_prefetch_free();
+    AOloopControl_loadconf_steptime(fplog, "5. block offsets, done");
+    {
+        struct timespec tn;
+
+        clock_gettime(CLOCK_REALTIME, &tn);
+        tdiff = info_time_diff(loadconf_t0, tn);
+        printf("loop %ld configuration loaded in %.3f s (timing: logdir/loadconf.log)\n", loop, 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec);
+    }
+
     loadcreateshm_log = 0;
     fclose(fplog);
 
@@ -2507,6 +2855,8 @@ int_fast8_t AOloopControl_InitializeMemory(int mode)
             AOconf[loop].complatency_frame = 0.2;
             AOconf[loop].wfsmextrlatency = 0.0003;
             AOconf[loop].wfsmextrlatency_frame = 0.6;
+
+            memset(AOconf[loop].RTsched, 0, sizeof(AOLOOPCONTROL_RTSCHED)*AOLRTSCHED_NBROLE);
         }
     }
     else
@@ -2619,10 +2969,14 @@ int_fast8_t AOloopControl_InitializeMemory(int mode)
 // args:
 //  DM offset channel (shared memory)
 //  zonal resp matrix (shared memory)
-//  nominal wfs reference without offset (shared memory)
-//  wfs reference to be updated (shared memory)
+//  WFS zero point offset to be updated (shared memory)
 //
-// computation triggered on semaphore wait on semaphore #1 of DM offset
+// computation triggered on semaphore #1 of DM offset, pending posts are drained so that
+// a burst of DM offset updates is projected once.
+// Offset is kept across iterations and updated with the DM offset change: only actuators
+// that moved are projected (saxpy) when few change, full cblas_sgemv otherwise and every
+// WFSZP_RESYNC updates to bound round-off drift. Full projection on GPU if variable
+// WFSZPGPU is set (device index).
 //
 // will run until SIGUSR1 received
 //
@@ -2632,12 +2986,23 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
     uint32_t dmxsize, dmysize, dmxysize;
     long wfsxsize, wfsysize, wfsxysize;
     long IDtmp;
-    long elem, act;
+    long act;
     long zpcnt = 0;
     long zpcnt0;
-    int semval;
+    long NBactchanged;
+    long nbdelta = 0;
+    float *dmprev;
+    float *dmnew;
+    long *actchanged;
     struct timespec t1;
     struct timespec t2;
+    struct timespec semwaitts;
+    int GPUdevice = -1;
+#ifdef HAVE_CUDA
+    long IDvar;
+    int_fast8_t GPUstatus[100];
+    int_fast8_t gpustatus;
+#endif
 
 
 
@@ -2683,6 +3048,19 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
 
     IDtmp = create_2Dimage_ID("wfsrefoffset", wfsxsize, wfsysize);
 
+    dmprev = (float*) calloc(dmxysize, sizeof(float));
+    dmnew = (float*) malloc(sizeof(float)*dmxysize);
+    actchanged = (long*) malloc(sizeof(long)*dmxysize);
+
+#ifdef HAVE_CUDA
+    IDvar = variable_ID("WFSZPGPU");
+    if(IDvar != -1)
+    {
+        GPUdevice = (int) (data.variable[IDvar].value.f);
+        GPU_loop_MultMat_setup(0, IDzrespM_name, IDzpdm_name, data.image[IDtmp].name, 1, &GPUdevice, 1, 1, 1, DM2DM_OFFLOAD_GPULOOPNB+1);
+    }
+#endif
+
 
     zpcnt0 = 0;
 
@@ -2696,15 +3074,27 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
 
     while(data.signal_USR1==0)
     {
-        memset(data.image[IDtmp].array.F, '\0', sizeof(float)*wfsxysize);
+        while((zpcnt0 == data.image[IDzpdm].md[0].cnt0)&&(data.signal_USR1==0))
+        {
+            clock_gettime(CLOCK_REALTIME, &semwaitts);
+            semwaitts.tv_nsec += 1000000; // 1 ms, cnt0 also checked in case writer does not post #1
+            if(semwaitts.tv_nsec >= 1000000000)
+            {
+                semwaitts.tv_sec++;
+                semwaitts.tv_nsec -= 1000000000;
+            }
+            sem_timedwait(data.image[IDzpdm].semptr[1], &semwaitts);
+        }
+        if(data.signal_USR1 == 1)
+            break;
 
-        while(zpcnt0 == data.image[IDzpdm].md[0].cnt0)
-            usleep(10);
+        // coalesce: drain posts accumulated during previous projection, wait for write to complete
+        while(sem_trywait(data.image[IDzpdm].semptr[1])==0) {}
+        while(data.image[IDzpdm].md[0].write == 1)
+            usleep(2);
 
         zpcnt0 = data.image[IDzpdm].md[0].cnt0;
-
-        // TO BE DONE
-        //  sem_wait(data.image[IDzpdm].semptr[1]);
+        memcpy(dmnew, data.image[IDzpdm].array.F, sizeof(float)*dmxysize);
 
 
         printf("WFS zero point offset update  # %8ld       (%s -> %s)  ", zpcnt, data.image[IDzpdm].name, data.image[IDwfszp].name);
@@ -2713,20 +3103,37 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
 
         clock_gettime(CLOCK_REALTIME, &t1);
 
-# ifdef _OPENMP
-        #pragma omp parallel for private(elem)
-# endif
+        NBactchanged = 0;
         for(act=0; act<dmxysize; act++)
-            for(elem=0; elem<wfsxysize; elem++)
-                data.image[IDtmp].array.F[elem] += data.image[IDzpdm].array.F[act]*data.image[IDzrespM].array.F[act*wfsxysize+elem];
+            if(dmnew[act] != dmprev[act])
+                actchanged[NBactchanged++] = act;
 
+        if(GPUdevice >= 0)
+        {
+#ifdef HAVE_CUDA
+            gpustatus = 0;
+            GPU_loop_MultMat_execute(0, &gpustatus, &GPUstatus[0], 1.0, 0.0, 0);
+#endif
+        }
+        else if((zpcnt == 0)||(4*NBactchanged > dmxysize)||(nbdelta >= WFSZP_RESYNC))
+        {
+            cblas_sgemv(CblasRowMajor, CblasTrans, dmxysize, wfsxysize, 1.0, data.image[IDzrespM].array.F, wfsxysize, dmnew, 1, 0.0, data.image[IDtmp].array.F, 1);
+            nbdelta = 0;
+        }
+        else
+        {
+            for(act=0; act<NBactchanged; act++)
+                cblas_saxpy(wfsxysize, dmnew[actchanged[act]]-dmprev[actchanged[act]], data.image[IDzrespM].array.F + actchanged[act]*wfsxysize, 1, data.image[IDtmp].array.F, 1);
+            nbdelta++;
+        }
+        memcpy(dmprev, dmnew, sizeof(float)*dmxysize);
 
 
         clock_gettime(CLOCK_REALTIME, &t2);
         tdiff = info_time_diff(t1, t2);
         tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        printf(" [ %10.3f ms]\n", 1e3*tdiffv);
+        printf(" [ %10.3f ms  %5ld act]\n", 1e3*tdiffv, NBactchanged);
         fflush(stdout);
 
 
@@ -2737,12 +3144,18 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
         data.image[IDwfszp].md[0].cnt0 ++;
         data.image[IDwfszp].md[0].write = 0;
 
-        //        sem_getvalue(data.image[IDwfszp].semptr[0], &semval);
-        //        if(semval<SEMAPHORE_MAXVAL)
-        //            COREMOD_MEMORY_image_set_sempost(IDwfszp_name, 0);
         zpcnt++;
     }
 
+#ifdef HAVE_CUDA
+    if(GPUdevice >= 0)
+        GPU_loop_MultMat_free(0);
+#endif
+
+    free(dmprev);
+    free(dmnew);
+    free(actchanged);
+
     return 0;
 }
 
@@ -2754,33 +3167,39 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
 // watch semaphore 1 on output (IDwfsref_name) -> sum all channels to update WFS zero point
 // runs in separate process from RT computation
 //
-//
+// Sum is kept in double precision; each channel's last applied content is kept so that only
+// channels with a new cnt0 are applied, as (new - last) deltas. A channel being written is
+// left for the next pass, so that a burst of channel updates is published once.
+// Full re-sum when reference IDwfsref0 changes and every WFSZP_RESYNC updates.
 //
 int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *ID_WFSzp_name, int NBzp, const char *IDwfsref0_name, const char *IDwfsref_name)
 {
     long wfsxsize, wfsysize, wfsxysize;
     long IDwfsref, IDwfsref0;
     long *IDwfszparray;
-    long cntsumold;
+    uint64_t *zpcnt;
+    uint64_t wfsref0cnt;
+    double *zpsum;
+    float *zplast;
+    long nbdelta = 0;
     int RT_priority = 95; //any number from 0-99
-    struct sched_param schedpar;
     long nsecwait = 10000; // 10 us
     struct timespec semwaitts;
     long ch;
-    long IDtmp;
     long ii;
     char name[200];
     int semval;
 
 
 
-    schedpar.sched_priority = RT_priority;
 #ifndef __MACH__
     if(seteuid(euid_called) != 0) //This goes up to maximum privileges
         printERROR(__FILE__, __func__, __LINE__, "seteuid() returns non-zero value");
+#endif
 
-    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
+    AOloopControl_RTsched_set(loopnb, AOLRTSCHED_WFSZP, RT_priority);
 
+#ifndef __MACH__
     if(seteuid(euid_real) != 0) //Go back to normal privileges
         printERROR(__FILE__, __func__, __LINE__, "seteuid() returns non-zero value");
 #endif
@@ -2789,7 +3208,6 @@ int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *
     wfsxsize = data.image[IDwfsref].md[0].size[0];
     wfsysize = data.image[IDwfsref].md[0].size[1];
     wfsxysize = wfsxsize*wfsysize;
-    IDtmp = create_2Dimage_ID("wfsrefoffset", wfsxsize, wfsysize);
     IDwfsref0 = image_ID(IDwfsref0_name);
 
     if(data.image[IDwfsref].md[0].sem > 1) // drive semaphore #1 to zero
@@ -2801,6 +3219,9 @@ int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *
     }
 
     IDwfszparray = (long*) malloc(sizeof(long)*NBzp);
+    zpcnt = (uint64_t*) malloc(sizeof(uint64_t)*NBzp);
+    zpsum = (double*) malloc(sizeof(double)*wfsxysize);
+    zplast = (float*) calloc((size_t) NBzp*wfsxysize, sizeof(float));
     // create / read the zero point WFS channels
     for(ch=0; ch<NBzp; ch++)
     {
@@ -2810,38 +3231,82 @@ int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *
         AOloopControl_IOtools_2Dloadcreate_shmim(name, "", wfsxsize, wfsysize, 0.0);
         COREMOD_MEMORY_image_set_createsem(name, 10);
         IDwfszparray[ch] = image_ID(name);
+        zpcnt[ch] = data.image[IDwfszparray[ch]].md[0].cnt0 - 1; // applied on first pass
     }
+    wfsref0cnt = data.image[IDwfsref0].md[0].cnt0 - 1;
 
 
-    cntsumold = 0;
     for(;;)
     {
+        int changed = 0;
+        int resync = 0;
+
         if (clock_gettime(CLOCK_REALTIME, &semwaitts) == -1) {
             perror("clock_gettime");
             exit(EXIT_FAILURE);
         }
         semwaitts.tv_nsec += nsecwait;
         if(semwaitts.tv_nsec >= 1000000000)
+        {
             semwaitts.tv_sec = semwaitts.tv_sec + 1;
+            semwaitts.tv_nsec -= 1000000000;
+        }
 
         sem_timedwait(data.image[IDwfsref].semptr[1], &semwaitts);
 
-        long cntsum = 0;
-        for(ch=0; ch<NBzp; ch++)
-            cntsum += data.image[IDwfszparray[ch]].md[0].cnt0;
-
-
+        if((data.image[IDwfsref0].md[0].cnt0 != wfsref0cnt)||(nbdelta >= WFSZP_RESYNC))
+        {
+            if(data.image[IDwfsref0].md[0].write == 1)
+                continue;
+            wfsref0cnt = data.image[IDwfsref0].md[0].cnt0;
+            resync = 1;
+        }
 
-        if(cntsum != cntsumold)
+        if(resync == 1)
         {
-            memcpy(data.image[IDtmp].array.F, data.image[IDwfsref0].array.F, sizeof(float)*wfsxysize);
+            for(ii=0; ii<wfsxysize; ii++)
+                zpsum[ii] = data.image[IDwfsref0].array.F[ii];
+            for(ch=0; ch<NBzp; ch++)
+            {
+                float *zpch = zplast + ch*wfsxysize;
+
+                if(data.image[IDwfszparray[ch]].md[0].write == 0)
+                {
+                    zpcnt[ch] = data.image[IDwfszparray[ch]].md[0].cnt0;
+                    memcpy(zpch, data.image[IDwfszparray[ch]].array.F, sizeof(float)*wfsxysize);
+                }
+                for(ii=0; ii<wfsxysize; ii++)
+                    zpsum[ii] += zpch[ii];
+            }
+            nbdelta = 0;
+            changed = 1;
+        }
+        else
             for(ch=0; ch<NBzp; ch++)
+            {
+                float *zpch = zplast + ch*wfsxysize;
+                float *zpin = data.image[IDwfszparray[ch]].array.F;
+
+                if((data.image[IDwfszparray[ch]].md[0].cnt0 == zpcnt[ch])||(data.image[IDwfszparray[ch]].md[0].write == 1))
+                    continue;
+                zpcnt[ch] = data.image[IDwfszparray[ch]].md[0].cnt0;
+
                 for(ii=0; ii<wfsxysize; ii++)
-                    data.image[IDtmp].array.F[ii] += data.image[IDwfszparray[ch]].array.F[ii];
+                {
+                    float v = zpin[ii];
+
+                    zpsum[ii] += v - zpch[ii];
+                    zpch[ii] = v;
+                }
+                changed = 1;
+            }
 
+        if(changed == 1)
+        {
             // copy results to IDwfsref
             data.image[IDwfsref].md[0].write = 1;
-            memcpy(data.image[IDwfsref].array.F, data.image[IDtmp].array.F, sizeof(float)*wfsxysize);
+            for(ii=0; ii<wfsxysize; ii++)
+                data.image[IDwfsref].array.F[ii] = (float) zpsum[ii];
             data.image[IDwfsref].md[0].cnt0 ++;
             data.image[IDwfsref].md[0].write = 0;
 
@@ -2849,11 +3314,14 @@ int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *
             if(semval<SEMAPHORE_MAXVAL)
                 COREMOD_MEMORY_image_set_sempost(IDwfsref_name, 0);
 
-            cntsumold = cntsum;
+            nbdelta++;
         }
     }
 
     free(IDwfszparray);
+    free(zpcnt);
+    free(zpsum);
+    free(zplast);
 
 
     return(0);
@@ -2863,293 +3331,1375 @@ int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *
 
 
 
-/**
- * ## Purpose
- * 
- * Main AO loop function
- * 
- * 
- * ## Details
- * 
- */ 
-int_fast8_t AOloopControl_run()
-{
-    FILE *fp;
-    char fname[200];
-    long loop;
-    int vOK;
-    long ii;
-    long ID;
-    long j, m;
-    struct tm *uttime;
-    time_t t;
-    struct timespec *thetime = (struct timespec *)malloc(sizeof(struct timespec));
-    char logfname[1000];
-    char command[1000];
-    int r;
-    int RT_priority = 90; //any number from 0-99
-    struct sched_param schedpar;
-    double a;
-    long cnttest;
-    float tmpf1;
-
+/* =============================================================================================== */
+/** @name AOloopControl - real-time scheduling
+ *
+ * Each real-time process/thread calls AOloopControl_RTsched_set() with its role.\n
+ * CPU sets are read from ./conf/param_RTcpus_<role>.txt (list format, e.g. "4-7,10").\n
+ * If missing for main/helper roles, and isolated CPUs exist (isolcpus), loop number n is assigned isolated CPUs
+ * [n*RTcpusPerLoop, (n+1)*RTcpusPerLoop[, first one for main thread, others for helper threads.\n
+ * Assignments are recorded in AOconf[loop].RTsched[] and reported by AOloopControl_RTsched_status().
+ */
+/* =============================================================================================== */
 
-    struct timespec t1;
-    struct timespec t2;
-    struct timespec tdiff;
-    int semval;
+static const char *AOloopControl_RTsched_rolename[AOLRTSCHED_NBROLE] = {"main", "helper", "modefilt", "dmfilt", "wfszp", "autogain"};
 
 
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    // r = seteuid(euid_called); //This goes up to maximum privileges
-    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
-    // r = seteuid(euid_real);//Go back to normal privileges
-#endif
+/** @brief Parses CPU list (e.g. "2-5,8") into cpu set, returns number of CPUs */
+static int AOloopControl_RTsched_parsecpulist(const char *cpulist, cpu_set_t *cpuset)
+{
+    const char *ptr = cpulist;
+    char *endptr;
+    long c, c0, c1;
+    int nbcpu = 0;
 
+    CPU_ZERO(cpuset);
+    while(*ptr != '\0')
+    {
+        c0 = strtol(ptr, &endptr, 10);
+        if(endptr == ptr)
+            break;
+        ptr = endptr;
+        c1 = c0;
+        if(*ptr == '-')
+        {
+            ptr++;
+            c1 = strtol(ptr, &endptr, 10);
+            if(endptr == ptr)
+                break;
+            ptr = endptr;
+        }
+        for(c=c0; (c<=c1)&&(c<CPU_SETSIZE); c++)
+            if((c >= 0)&&(CPU_ISSET(c, cpuset) == 0))
+            {
+                CPU_SET(c, cpuset);
+                nbcpu++;
+            }
+        if(*ptr != ',')
+            break;
+        ptr++;
+    }
 
+    return(nbcpu);
+}
 
-    loop = LOOPNUMBER;
 
 
+/** @brief Writes cpu set in list format (e.g. "2-5,8") */
+static void AOloopControl_RTsched_cpulist(const cpu_set_t *cpuset, char *cpulist, size_t len)
+{
+    int c, c0;
+    size_t n = 0;
 
-    if(AOloopcontrol_meminit==0)
-        AOloopControl_InitializeMemory(0);
+    cpulist[0] = '\0';
+    for(c=0; c<CPU_SETSIZE; c++)
+    {
+        if(CPU_ISSET(c, cpuset) == 0)
+            continue;
+        c0 = c;
+        while((c+1 < CPU_SETSIZE)&&(CPU_ISSET(c+1, cpuset)))
+            c++;
+        if(n < len)
+        {
+            if(c > c0)
+                n += snprintf(cpulist+n, len-n, "%s%d-%d", (n>0) ? "," : "", c0, c);
+            else
+                n += snprintf(cpulist+n, len-n, "%s%d", (n>0) ? "," : "", c0);
+        }
+    }
+}
 
 
-	/** ### STEP 1: Setting up 
-	 * 
-	 * Load arrays
-	 * */
-    printf("SETTING UP...\n");
-    AOloopControl_loadconfigure(LOOPNUMBER, 1, 10);
 
-	
+/** @brief Reads CPU list for role from ./conf/param_RTcpus_<role>.txt, returns number of CPUs (0 if not specified) */
+static int AOloopControl_RTsched_readconf(int role, cpu_set_t *cpuset)
+{
+    FILE *fp;
+    char fname[200];
+    char cpulist[AOLRTSCHED_CPULISTLEN];
+    int nbcpu = 0;
+
+    sprintf(fname, "./conf/param_RTcpus_%s.txt", AOloopControl_RTsched_rolename[role]);
+    if((fp = fopen(fname, "r")) == NULL)
+        return(0);
+    if(fscanf(fp, "%63s", cpulist) == 1)
+        nbcpu = AOloopControl_RTsched_parsecpulist(cpulist, cpuset);
+    fclose(fp);
 
+    return(nbcpu);
+}
 
 
-    // pixel streaming ?
-    COMPUTE_PIXELSTREAMING = 1;
 
-    if(AOconf[loop].GPUall == 0)
-        COMPUTE_PIXELSTREAMING = 0;
+/** @brief Reads isolated CPUs (isolcpus kernel parameter), returns number of CPUs */
+static int AOloopControl_RTsched_isolated(cpu_set_t *cpuset)
+{
+    FILE *fp;
+    char cpulist[1024];
+    int nbcpu = 0;
+
+    CPU_ZERO(cpuset);
+    if((fp = fopen("/sys/devices/system/cpu/isolated", "r")) == NULL)
+        return(0);
+    if(fscanf(fp, "%1023s", cpulist) == 1)
+        nbcpu = AOloopControl_RTsched_parsecpulist(cpulist, cpuset);
+    fclose(fp);
 
+    return(nbcpu);
+}
 
-    printf("============ pixel streaming ? =============\n");
-    fflush(stdout);
 
-    if(COMPUTE_PIXELSTREAMING == 1)
-        aoconfID_pixstream_wfspixindex = load_fits("pixstream_wfspixindex.fits", "pixstream", 1);
 
-    if(aoconfID_pixstream_wfspixindex == -1)
-        COMPUTE_PIXELSTREAMING = 0;
-    else
+/**
+ * @brief Default CPU set for role: slice of isolated CPUs allocated to loop
+ *
+ * Only main and helper roles are assigned. Returns number of CPUs (0 if no assignment).
+ */
+static int AOloopControl_RTsched_autolayout(long loop, int role, cpu_set_t *cpuset)
+{
+    cpu_set_t isolset;
+    int nbisol;
+    int nper;
+    int c, k;
+    int nbcpu = 0;
+
+    CPU_ZERO(cpuset);
+    if((role != AOLRTSCHED_MAIN)&&(role != AOLRTSCHED_HELPER))
+        return(0);
+    if((nbisol = AOloopControl_RTsched_isolated(&isolset)) == 0)
+        return(0);
+
+    nper = AOloopControl_readParam_int("RTcpusPerLoop", 4, NULL);
+    if((nper < 1)||((loop+1)*nper > nbisol))
     {
-        printf("Testing data type\n");
-        fflush(stdout);
-        if(data.image[aoconfID_pixstream_wfspixindex].md[0].atype != _DATATYPE_UINT16)
-            COMPUTE_PIXELSTREAMING = 0;
+        printf("WARNING: loop %ld : not enough isolated CPUs (%d) for %d CPUs per loop -> not pinned\n", loop, nbisol, nper);
+        return(0);
     }
 
-    if(COMPUTE_PIXELSTREAMING == 1)
-    {
-        long xsize = data.image[aoconfID_pixstream_wfspixindex].md[0].size[0];
-        long ysize = data.image[aoconfID_pixstream_wfspixindex].md[0].size[1];
-        PIXSTREAM_NBSLICES = 0;
-        for(ii=0; ii<xsize*ysize; ii++)
-            if(data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii] > PIXSTREAM_NBSLICES)
-                PIXSTREAM_NBSLICES = data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii];
-        PIXSTREAM_NBSLICES++;
-        printf("PIXEL STREAMING:   %d image slices\n", PIXSTREAM_NBSLICES);
-    }
+    k = 0;
+    for(c=0; c<CPU_SETSIZE; c++)
+        if(CPU_ISSET(c, &isolset))
+        {
+            if((k >= loop*nper)&&(k < (loop+1)*nper))
+            {
+                // first CPU of slice runs main thread, remaining ones (if any) helper threads
+                if( ((role == AOLRTSCHED_MAIN)&&(k == loop*nper)) || ((role == AOLRTSCHED_HELPER)&&((k > loop*nper)||(nper == 1))) )
+                {
+                    CPU_SET(c, cpuset);
+                    nbcpu++;
+                }
+            }
+            k++;
+        }
 
+    return(nbcpu);
+}
 
 
-    printf("============ FORCE pixel streaming = 0\n");
-    fflush(stdout);
-    COMPUTE_PIXELSTREAMING = 0; // TEST
 
+/** @brief Checks CPU set against isolated CPUs and against other loops' slots, prints warnings */
+static void AOloopControl_RTsched_check(long loop, int role, const cpu_set_t *cpuset)
+{
+    cpu_set_t isolset;
+    cpu_set_t cpuset1;
+    cpu_set_t cpusetand;
+    char fname[200];
+    long loop1;
+    int role1;
+    int c;
+
+    if(AOloopControl_RTsched_isolated(&isolset) > 0)
+        for(c=0; c<CPU_SETSIZE; c++)
+            if(CPU_ISSET(c, cpuset) && (CPU_ISSET(c, &isolset) == 0))
+                printf("WARNING: loop %ld %s : cpu %d is not isolated\n", loop, AOloopControl_RTsched_rolename[role], c);
 
-    printf("GPU0 = %d\n", AOconf[loop].GPU0);
-    if(AOconf[loop].GPU0>1)
+    for(loop1=0; loop1<NB_AOloopcontrol; loop1++)
     {
-        uint8_t k;
-        for(k=0; k<AOconf[loop].GPU0; k++)
-            printf("stream %2d      GPUset0 = %2d\n", (int) k, GPUset0[k]);
+        if(loop1 == loop)
+            continue;
+        for(role1=0; role1<AOLRTSCHED_NBROLE; role1++)
+        {
+            if(AOconf[loop1].RTsched[role1].tid <= 0)
+                continue;
+            sprintf(fname, "/proc/%d", AOconf[loop1].RTsched[role1].tid);
+            if(access(fname, F_OK) != 0)
+                continue;
+            if(AOloopControl_RTsched_parsecpulist(AOconf[loop1].RTsched[role1].cpulist, &cpuset1) == 0)
+                continue;
+            CPU_AND(&cpusetand, &cpuset1, cpuset);
+            if(CPU_COUNT(&cpusetand) > 0)
+                printf("WARNING: loop %ld %s shares CPU(s) with loop %ld %s (%s)\n", loop, AOloopControl_RTsched_rolename[role],
+                       loop1, AOloopControl_RTsched_rolename[role1], AOconf[loop1].RTsched[role1].cpulist);
+        }
     }
+}
 
-    printf("GPU1 = %d\n", AOconf[loop].GPU1);
-    if(AOconf[loop].GPU1>1)
+
+
+/**
+ * @brief Sets real-time priority and CPU affinity of calling thread according to its role in loop
+ *
+ * @param[in] loop        loop index
+ * @param[in] role        thread role (AOLRTSCHED_MAIN, _HELPER, _MODEFILT, _DMFILT, _WFSZP, _AUTOGAIN)
+ * @param[in] RT_priority SCHED_FIFO priority (0-99)
+ */
+int_fast8_t AOloopControl_RTsched_set(long loop, int role, int RT_priority)
+{
+    struct sched_param schedpar;
+    cpu_set_t cpuset;
+    int nbcpu;
+
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(1);
+
+    if(AOloopControl_readParam_int("RTmlock", 0, NULL) == 1)
+        AOloopControl_RTmemlock();
+
+    AOconf[loop].RTsched[role].tid = (int) syscall(SYS_gettid);
+    AOconf[loop].RTsched[role].priority = RT_priority;
+    AOconf[loop].RTsched[role].nbthread = 1;
+    AOconf[loop].RTsched[role].cpulist[0] = '\0';
+
+#ifndef __MACH__
+    schedpar.sched_priority = RT_priority;
+    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
+
+    if((nbcpu = AOloopControl_RTsched_readconf(role, &cpuset)) == 0)
+        nbcpu = AOloopControl_RTsched_autolayout(loop, role, &cpuset);
+
+    if(nbcpu > 0)
     {
-        uint8_t k;
-        for(k=0; k<AOconf[loop].GPU1; k++)
-            printf("stream %2d      GPUset1 = %2d\n", (int) k, GPUset1[k]);
+        if(sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) != 0)
+            printERROR(__FILE__, __func__, __LINE__, "sched_setaffinity() returns non-zero value");
+        else
+        {
+            AOloopControl_RTsched_cpulist(&cpuset, AOconf[loop].RTsched[role].cpulist, AOLRTSCHED_CPULISTLEN);
+            AOloopControl_RTsched_check(loop, role, &cpuset);
+        }
     }
+#endif
 
+    printf("RTSCHED loop %ld %-8s : tid %d  priority %d  cpus %s\n", loop, AOloopControl_RTsched_rolename[role],
+           AOconf[loop].RTsched[role].tid, RT_priority, (AOconf[loop].RTsched[role].cpulist[0] == '\0') ? "(not pinned)" : AOconf[loop].RTsched[role].cpulist);
 
+    return(0);
+}
 
 
 
+/**
+ * @brief Pins all threads of the process, except calling thread, to helper CPU set
+ *
+ * Called from the main loop once helper threads (GPU feeders, OpenMP pool) have been created.
+ */
+int_fast8_t AOloopControl_RTsched_pinhelpers(long loop)
+{
+    cpu_set_t cpuset;
+    DIR *dir;
+    struct dirent *entry;
+    int tid, tid1;
+    int nbcpu;
+    int nbthread = 0;
 
 
+    if((nbcpu = AOloopControl_RTsched_readconf(AOLRTSCHED_HELPER, &cpuset)) == 0)
+        nbcpu = AOloopControl_RTsched_autolayout(loop, AOLRTSCHED_HELPER, &cpuset);
 
-    vOK = 1;
-    if(AOconf[loop].init_wfsref0==0)
+    tid = (int) syscall(SYS_gettid);
+    AOconf[loop].RTsched[AOLRTSCHED_HELPER].tid = tid;
+    AOconf[loop].RTsched[AOLRTSCHED_HELPER].priority = AOconf[loop].RTsched[AOLRTSCHED_MAIN].priority;
+    AOconf[loop].RTsched[AOLRTSCHED_HELPER].cpulist[0] = '\0';
+
+    if((dir = opendir("/proc/self/task")) == NULL)
     {
-        printf("ERROR: CANNOT RUN LOOP WITHOUT WFS REFERENCE\n");
-        vOK = 0;
+        printERROR(__FILE__, __func__, __LINE__, "cannot open /proc/self/task");
+        return(-1);
     }
-    if(AOconf[loop].init_CM==0)
+    while((entry = readdir(dir)) != NULL)
     {
-        printf("ERROR: CANNOT RUN LOOP WITHOUT CONTROL MATRIX\n");
-        vOK = 0;
+        if(entry->d_name[0] == '.')
+            continue;
+        tid1 = atoi(entry->d_name);
+        if(tid1 == tid)
+            continue;
+        if(nbcpu > 0)
+            if(sched_setaffinity(tid1, sizeof(cpu_set_t), &cpuset) != 0)
+                continue;
+        nbthread++;
+    }
+    closedir(dir);
+
+    AOconf[loop].RTsched[AOLRTSCHED_HELPER].nbthread = nbthread;
+    if(nbcpu > 0)
+    {
+        AOloopControl_RTsched_cpulist(&cpuset, AOconf[loop].RTsched[AOLRTSCHED_HELPER].cpulist, AOLRTSCHED_CPULISTLEN);
+        AOloopControl_RTsched_check(loop, AOLRTSCHED_HELPER, &cpuset);
     }
 
-	aoconfcnt0_wfsref_current = data.image[aoconfID_wfsref].md[0].cnt0;
-	aoconfcnt0_contrM_current = data.image[aoconfID_contrM].md[0].cnt0;
+    printf("RTSCHED loop %ld %-8s : %d threads  cpus %s\n", loop, AOloopControl_RTsched_rolename[AOLRTSCHED_HELPER], nbthread,
+           (nbcpu > 0) ? AOconf[loop].RTsched[AOLRTSCHED_HELPER].cpulist : "(not pinned)");
 
-    AOconf[loop].initmapping = 0;
-    AOconf[loop].init_CMc = 0;
-    clock_gettime(CLOCK_REALTIME, &t1);
+    return(0);
+}
 
 
-    if(vOK==1)
-    {
-        AOconf[loop].kill = 0;
-        AOconf[loop].on = 0;
-        AOconf[loop].DMprimaryWriteON = 0;
-        AOconf[loop].DMfilteredWriteON = 0;
-        AOconf[loop].ARPFon = 0;
-        printf("entering loop ...\n");
-        fflush(stdout);
 
-        int timerinit = 0;
+/** @brief Prints real-time scheduling status of all loops: which CPUs run what */
+int_fast8_t AOloopControl_RTsched_status()
+{
+    cpu_set_t isolset;
+    cpu_set_t cpuset;
+    char cpulist[1024];
+    char fname[200];
+    long loop;
+    int role;
+    int c;
+    int alive;
 
-        while( AOconf[loop].kill == 0)
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(1);
+
+    AOloopControl_RTsched_isolated(&isolset);
+    AOloopControl_RTsched_cpulist(&isolset, cpulist, 1024);
+    printf("isolated CPUs : %s\n\n", (cpulist[0] == '\0') ? "none" : cpulist);
+
+    printf("LOOP  NAME                  ROLE        TID  PRIO  NBTHR  CPUS\n");
+    for(loop=0; loop<NB_AOloopcontrol; loop++)
+        for(role=0; role<AOLRTSCHED_NBROLE; role++)
         {
-            if(timerinit==1)
+            if(AOconf[loop].RTsched[role].tid <= 0)
+                continue;
+            sprintf(fname, "/proc/%d", AOconf[loop].RTsched[role].tid);
+            alive = (access(fname, F_OK) == 0);
+            printf("%4ld  %-20s  %-8s  %6d  %4d  %5d  %-16s %s\n", loop, AOconf[loop].name, AOloopControl_RTsched_rolename[role],
+                   AOconf[loop].RTsched[role].tid, AOconf[loop].RTsched[role].priority, AOconf[loop].RTsched[role].nbthread,
+                   (AOconf[loop].RTsched[role].cpulist[0] == '\0') ? "-" : AOconf[loop].RTsched[role].cpulist, alive ? "" : "[not running]");
+        }
+
+    printf("\n");
+    for(c=0; c<CPU_SETSIZE; c++)
+    {
+        int nb = 0;
+
+        for(loop=0; loop<NB_AOloopcontrol; loop++)
+            for(role=0; role<AOLRTSCHED_NBROLE; role++)
             {
-                clock_gettime(CLOCK_REALTIME, &t1);
-                printf("timer init\n");
+                if(AOconf[loop].RTsched[role].tid <= 0)
+                    continue;
+                sprintf(fname, "/proc/%d", AOconf[loop].RTsched[role].tid);
+                if(access(fname, F_OK) != 0)
+                    continue;
+                if(AOloopControl_RTsched_parsecpulist(AOconf[loop].RTsched[role].cpulist, &cpuset) == 0)
+                    continue;
+                if(CPU_ISSET(c, &cpuset) == 0)
+                    continue;
+                if(nb == 0)
+                    printf("cpu %3d %s:", c, CPU_ISSET(c, &isolset) ? "(isolated)" : "          ");
+                printf("  loop%ld-%s", loop, AOloopControl_RTsched_rolename[role]);
+                nb++;
             }
-            clock_gettime(CLOCK_REALTIME, &t2);
-
-            tdiff = info_time_diff(t1, t2);
-            double tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        if(nb > 1)
+            printf("   <- SHARED");
+        if(nb > 0)
+            printf("\n");
+    }
 
-            printf(" WAITING     %20.3lf sec         \r", tdiffv);
-            fflush(stdout);
-            usleep(1000);
+    return(0);
+}
 
 
-            timerinit = 0;
-            while(AOconf[loop].on == 1)
-            {
-                if(timerinit==0)
-                {
-#ifdef _PRINT_TEST
-                    printf("TEST - Read first image\n");
-                    fflush(stdout);
-#endif
 
-                    //      Read_cam_frame(loop, 0, AOconf[loop].WFSnormalize, 0, 1);
-                    clock_gettime(CLOCK_REALTIME, &t1);
-                    timerinit = 1;
 
-#ifdef _PRINT_TEST
-                    printf("\n");
-                    printf("LOOP CLOSED  ");
-                    fflush(stdout);
-#endif
-                }
+/* =============================================================================================== */
+/** @name AOloopControl - real-time memory
+ *
+ * Steady state of real-time loops should not allocate, look up streams by name, or page fault.\n
+ * AOloopControl_RTmemlock() locks memory of the process (parameter RTmlock, default 0: requires CAP_IPC_LOCK or sufficient RLIMIT_MEMLOCK).\n
+ * With parameter RTcheck = 1, name lookups and heap allocations in the main loop thread are counted after the first
+ * iteration (warm-up: lazy GPU and mapping setup) and reported.
+ * Heap allocations are counted exactly if compiled with -DAOLOOPCONTROL_RTCHECK (malloc interposed),
+ * otherwise net heap growth is detected.
+ */
+/* =============================================================================================== */
 
-#ifdef _PRINT_TEST
-                printf("TEST - Start AO compute\n");
-                fflush(stdout);
-#endif
+#define RTCHECK_NBPRINT_MAX 100
 
-                AOcompute(loop, AOconf[loop].WFSnormalize);
+static long long RTcheck_NBlookup = 0;
+static long long RTcheck_NBalloc0 = 0;
+static size_t RTcheck_heapinuse = 0;
 
-#ifdef _PRINT_TEST
-                printf("TEST - exiting AOcompute\n");
-                fflush(stdout);
-#endif
+#ifdef AOLOOPCONTROL_RTCHECK
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
 
+static __thread int RTcheck_armed = 0; // 1 in main loop thread during steady state
+static long long RTcheck_NBalloc = 0;
 
-                AOconf[loop].status = 12; // 12
-                clock_gettime(CLOCK_REALTIME, &tnow);
-                tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
-                tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-                data.image[aoconfID_looptiming].array.F[12] = tdiffv;
+void *malloc(size_t size)
+{
+    if(RTcheck_armed == 1)
+        RTcheck_NBalloc++;
+    return(__libc_malloc(size));
+}
 
-#ifdef _PRINT_TEST
-                printf("TEST -  CMMODE = %d\n", AOconf[loop].CMMODE);
-                fflush(stdout);
-#endif
+void *calloc(size_t nmemb, size_t size)
+{
+    if(RTcheck_armed == 1)
+        RTcheck_NBalloc++;
+    return(__libc_calloc(nmemb, size));
+}
 
-                if(AOconf[loop].CMMODE==0)  // 2-step : WFS -> mode coeffs -> DM act
-                {
-#ifdef _PRINT_TEST
-                    printf("TEST -  DMprimaryWriteON = %d\n", AOconf[loop].DMprimaryWriteON);
-                    fflush(stdout);
+void *realloc(void *ptr, size_t size)
+{
+    if(RTcheck_armed == 1)
+        RTcheck_NBalloc++;
+    return(__libc_realloc(ptr, size));
+}
 #endif
 
-                    if(AOconf[loop].DMprimaryWriteON==1) // if Writing to DM
-                    {
-#ifdef _PRINT_TEST
-                        printf("TEST -  gain = %f\n", AOconf[loop].gain);
-                        fflush(stdout);
-#endif
 
-                        if(fabs(AOconf[loop].gain)>1.0e-6)
-                            set_DM_modes(loop);
-                    }
 
-                }
-                else // 1 step: WFS -> DM act
-                {
-                    if(AOconf[loop].DMprimaryWriteON==1) // if Writing to DM
-                    {
-                        data.image[aoconfID_dmC].md[0].write = 1;
+/** @brief Heap memory in use [byte] */
+static size_t AOloopControl_RTcheck_heapinuse()
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+    struct mallinfo2 mi = mallinfo2();
+    return(mi.uordblks + mi.hblkhd);
+#elif defined(__GLIBC__)
+    struct mallinfo mi = mallinfo();
+    return((size_t) mi.uordblks + mi.hblkhd);
+#else
+    return(0);
+#endif
+}
 
-                        for(ii=0; ii<AOconf[loop].sizeDM; ii++)//TEST
-                        {
-                            if(isnan(data.image[aoconfID_meas_act].array.F[ii])!=0)
-                            {
-                                printf("image aol2_meas_act  element %ld is NAN -> replacing by 0\n", ii);
-                                data.image[aoconfID_meas_act].array.F[ii] = 0.0;
-                            }
-                        }
 
 
+/**
+ * @brief Locks process memory, current and future
+ *
+ * Freed heap memory is kept in process (no trimming, no mmap for large blocks) so that it stays locked.
+ */
+int_fast8_t AOloopControl_RTmemlock()
+{
+#ifndef __MACH__
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
 
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        printf("WARNING: mlockall() failed : %s  (requires CAP_IPC_LOCK or sufficient RLIMIT_MEMLOCK)\n", strerror(errno));
+        return(-1);
+    }
+#endif
 
-                        AOconf[loop].status = 13; // enforce limits
-                        clock_gettime(CLOCK_REALTIME, &tnow);
-                        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
-                        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-                        data.image[aoconfID_looptiming].array.F[13] = tdiffv;
+    return(0);
+}
 
 
-                        for(ii=0; ii<AOconf[loop].sizeDM; ii++)
-                        {
-                            data.image[aoconfID_dmC].array.F[ii] -= AOconf[loop].gain * data.image[aoconfID_meas_act].array.F[ii];
 
-                            data.image[aoconfID_dmC].array.F[ii] *= AOconf[loop].mult;
+/** @brief Starts steady state check of loop iteration (name lookups, heap allocations) */
+void AOloopControl_RTcheck_arm(long loop)
+{
+    RTcheck_NBlookup = COREMOD_MEMORY_image_ID_NBlookup();
+#ifdef AOLOOPCONTROL_RTCHECK
+    RTcheck_NBalloc0 = RTcheck_NBalloc;
+    RTcheck_armed = 1;
+#else
+    RTcheck_heapinuse = AOloopControl_RTcheck_heapinuse();
+#endif
+}
 
-                            if(data.image[aoconfID_dmC].array.F[ii] > AOconf[loop].maxlimit)
-                                data.image[aoconfID_dmC].array.F[ii] = AOconf[loop].maxlimit;
-                            if(data.image[aoconfID_dmC].array.F[ii] < -AOconf[loop].maxlimit)
-                                data.image[aoconfID_dmC].array.F[ii] = -AOconf[loop].maxlimit;
-                        }
 
 
-                        AOconf[loop].status = 14; // write to DM
-                        clock_gettime(CLOCK_REALTIME, &tnow);
-                        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
-                        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-                        data.image[aoconfID_looptiming].array.F[14] = tdiffv;
+/** @brief Ends steady state check of loop iteration, reports name lookups and heap allocations */
+void AOloopControl_RTcheck_verify(long loop)
+{
+    long long NBlookup;
+    long long NBalloc = 0;
+    size_t heapinuse = 0;
+
+#ifdef AOLOOPCONTROL_RTCHECK
+    RTcheck_armed = 0;
+    NBalloc = RTcheck_NBalloc - RTcheck_NBalloc0;
+#else
+    heapinuse = AOloopControl_RTcheck_heapinuse();
+    if(heapinuse > RTcheck_heapinuse)
+        NBalloc = 1;
+#endif
+    NBlookup = COREMOD_MEMORY_image_ID_NBlookup() - RTcheck_NBlookup;
+
+    if((NBlookup == 0)&&(NBalloc == 0))
+        return;
+
+    AOconf[loop].RTcheckNBviol++;
+    if(AOconf[loop].RTcheckNBviol <= RTCHECK_NBPRINT_MAX)
+    {
+#ifdef AOLOOPCONTROL_RTCHECK
+        printf("RTCHECK loop %ld iteration %lld : %lld name lookup(s), %lld heap allocation(s)\n", loop, (long long) AOconf[loop].cnt, NBlookup, NBalloc);
+#else
+        printf("RTCHECK loop %ld iteration %lld : %lld name lookup(s), heap grew by %ld byte\n", loop, (long long) AOconf[loop].cnt, NBlookup, (long) (heapinuse - RTcheck_heapinuse));
+#endif
+        if(AOconf[loop].RTcheckNBviol == RTCHECK_NBPRINT_MAX)
+            printf("RTCHECK loop %ld : further reports suppressed, see AOconf[%ld].RTcheckNBviol\n", loop, loop);
+    }
+}
+
+
+
+
+/* =============================================================================================== */
+/** @name AOloopControl - per-stage loop timing
+ *
+ * Time stamps (TSC) are taken at the end of each stage of the main loop (AOloopControl_looptiming_mark()).\n
+ * Stage durations [us] are written once per iteration in shared memory ring aol<loop>_looptimingring:
+ * one row per iteration, columns AOLTIMING_WAIT ... AOLTIMING_DMWRITE, total, loop iteration index.
+ * cnt1 is the last row written.\n
+ * Iterations with total exceeding the outlier threshold are also copied to aol<loop>_looptimingoutl,
+ * which is only overwritten by other outliers.
+ */
+/* =============================================================================================== */
+
+static uint64_t looptiming_tsc[AOLTIMING_NBSTAGE+1]; // index 0 is iteration start, index k+1 is end of stage k
+static double looptiming_tsc2us = 0.0;               // TSC ticks to microsecond
+static double looptiming_outlierus = 0.0;            // outlier threshold [us]
+static long aoconfID_looptimingring = -1;
+static long aoconfID_looptimingoutl = -1;
+
+// status snapshot accumulators (main loop)
+static double statsnap_stageus[AOLTIMING_NBSTAGE];
+static double statsnap_iterus = 0.0;
+static double statsnap_iterusmax = 0.0;
+static long statsnap_NBframe = 0;
+static int statsnap_tinit = 0;
+static struct timespec statsnap_t0;
+
+
+
+static inline uint64_t AOloopControl_looptiming_TSC()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return((uint64_t) __rdtsc());
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec);
+#endif
+}
+
+
+
+/**
+ * @brief Creates timing ring and outlier streams, calibrates TSC
+ *
+ * @param[in] loop   loop index
+ * @param[in] NBrow  number of iterations in ring
+ * @param[in] outlierus  outlier threshold [us], 0 for 2 loop periods
+ */
+int_fast8_t AOloopControl_looptiming_init(long loop, long NBrow, float outlierus)
+{
+    char name[200];
+    uint32_t sizearray[2];
+    struct timespec ts0, ts1;
+    uint64_t tsc0, tsc1;
+    double dt;
+
+
+    // calibrate TSC against monotonic clock
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    tsc0 = AOloopControl_looptiming_TSC();
+    usleep(20000);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    tsc1 = AOloopControl_looptiming_TSC();
+    dt = 1.0e6*(ts1.tv_sec-ts0.tv_sec) + 1.0e-3*(ts1.tv_nsec-ts0.tv_nsec);
+    looptiming_tsc2us = dt/(tsc1-tsc0);
+
+    if(outlierus > 0.0)
+        looptiming_outlierus = outlierus;
+    else
+        looptiming_outlierus = 2.0e6/AOconf[loop].loopfrequ;
+
+    sizearray[0] = AOLTIMING_NBCOL;
+    sizearray[1] = NBrow;
+    if(sprintf(name, "aol%ld_looptimingring", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    aoconfID_looptimingring = create_image_ID(name, 2, sizearray, _DATATYPE_DOUBLE, 1, 0);
+
+    sizearray[1] = AOLTIMING_NBOUTLIER;
+    if(sprintf(name, "aol%ld_looptimingoutl", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    aoconfID_looptimingoutl = create_image_ID(name, 2, sizearray, _DATATYPE_DOUBLE, 1, 0);
+    data.image[aoconfID_looptimingoutl].md[0].cnt1 = AOLTIMING_NBOUTLIER-1;
+
+    printf("LOOP TIMING: %.3f TSC ticks / us, ring %ld iterations, outlier threshold %.1f us\n", 1.0/looptiming_tsc2us, NBrow, looptiming_outlierus);
+
+    AOloopControl_looptiming_start();
+
+    return(0);
+}
+
+
+
+/** @brief Marks start of iteration */
+void AOloopControl_looptiming_start()
+{
+    looptiming_tsc[0] = AOloopControl_looptiming_TSC();
+}
+
+
+
+/** @brief Marks end of stage (AOLTIMING_WAIT ... AOLTIMING_DMWRITE) */
+void AOloopControl_looptiming_mark(int stage)
+{
+    looptiming_tsc[stage+1] = AOloopControl_looptiming_TSC();
+}
+
+
+
+/**
+ * @brief Accumulates iteration timing, publishes status snapshot every statsnapNBframe iterations
+ *
+ * The snapshot is written to the inactive copy AOconf[loop].statsnap[1-statsnapindex], which is then made current.
+ * Block statistics are copied from values averaged by the modal filtering process (AOconf blockave_*).
+ *
+ * @param[in] loop  loop index
+ * @param[in] row   stage durations of current iteration, as written in timing ring
+ */
+static void AOloopControl_statsnap_accumulate(long loop, const double *row)
+{
+    AOLOOPCONTROL_STATUSSNAP *snap;
+    struct timespec t1;
+    int index;
+    int k;
+    long block;
+    long NBblock;
+
+
+    if(AOconf[loop].statsnapNBframe < 1)
+        return;
+
+    if(statsnap_tinit == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &statsnap_t0);
+        statsnap_tinit = 1;
+    }
+
+    for(k=0; k<AOLTIMING_NBSTAGE; k++)
+        statsnap_stageus[k] += row[k];
+    statsnap_iterus += row[AOLTIMING_NBSTAGE];
+    if(row[AOLTIMING_NBSTAGE] > statsnap_iterusmax)
+        statsnap_iterusmax = row[AOLTIMING_NBSTAGE];
+    statsnap_NBframe++;
+
+    if(statsnap_NBframe < AOconf[loop].statsnapNBframe)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    index = 1 - AOconf[loop].statsnapindex;
+    snap = &AOconf[loop].statsnap[index];
+
+    snap->seq++;
+    __sync_synchronize();
+
+    snap->loopcnt = AOconf[loop].cnt;
+    snap->NBframe = statsnap_NBframe;
+    snap->tspan = 1.0*(t1.tv_sec-statsnap_t0.tv_sec) + 1.0e-9*(t1.tv_nsec-statsnap_t0.tv_nsec);
+
+    snap->on = AOconf[loop].on;
+    snap->ARPFon = AOconf[loop].ARPFon;
+    snap->gain = AOconf[loop].gain;
+    snap->maxlimit = AOconf[loop].maxlimit;
+    snap->WFStotalflux = AOconf[loop].WFStotalflux;
+
+    snap->loopfrequ = (snap->tspan > 0.0) ? statsnap_NBframe/snap->tspan : 0.0;
+    for(k=0; k<AOLTIMING_NBSTAGE; k++)
+        snap->stageus[k] = statsnap_stageus[k]/statsnap_NBframe;
+    snap->iterus = statsnap_iterus/statsnap_NBframe;
+    snap->iterusmax = statsnap_iterusmax;
+    snap->complatency_frame = (snap->iterus > 0.0) ? 1.0 - snap->stageus[AOLTIMING_WAIT]/snap->iterus : 0.0;
+    snap->hardwlatency_frame = AOconf[loop].hardwlatency_frame;
+    snap->wfsmextrlatency_frame = AOconf[loop].wfsmextrlatency_frame;
+
+    NBblock = AOconf[loop].DMmodesNBblock;
+    if(NBblock > AOLSTATSNAP_NBBLOCK)
+        NBblock = AOLSTATSNAP_NBBLOCK;
+    snap->NBDMmodes = AOconf[loop].NBDMmodes;
+    snap->DMmodesNBblock = NBblock;
+    for(block=0; block<NBblock; block++)
+    {
+        snap->NBmodes_block[block] = AOconf[loop].NBmodes_block[block];
+        snap->indexmaxMB[block] = AOconf[loop].indexmaxMB[block];
+        snap->gainb[block] = (aoconfID_gainb != -1) ? data.image[aoconfID_gainb].array.F[block] : 0.0;
+        snap->limitb[block] = (aoconfID_limitb != -1) ? data.image[aoconfID_limitb].array.F[block] : 0.0;
+        snap->multfb[block] = (aoconfID_multfb != -1) ? data.image[aoconfID_multfb].array.F[block] : 0.0;
+        snap->blockave_Crms[block] = AOconf[loop].blockave_Crms[block];
+        snap->blockave_OLrms[block] = AOconf[loop].blockave_OLrms[block];
+        snap->blockave_WFSrms[block] = AOconf[loop].blockave_WFSrms[block];
+        snap->blockave_limFrac[block] = AOconf[loop].blockave_limFrac[block];
+    }
+    snap->ALLave_Crms = AOconf[loop].ALLave_Crms;
+    snap->ALLave_OLrms = AOconf[loop].ALLave_OLrms;
+    snap->ALLave_WFSrms = AOconf[loop].ALLave_WFSrms;
+    snap->ALLave_limFrac = AOconf[loop].ALLave_limFrac;
+
+    __sync_synchronize();
+    snap->seq++;
+    AOconf[loop].statsnapindex = index;
+    AOconf[loop].statsnapcnt++;
+
+    for(k=0; k<AOLTIMING_NBSTAGE; k++)
+        statsnap_stageus[k] = 0.0;
+    statsnap_iterus = 0.0;
+    statsnap_iterusmax = 0.0;
+    statsnap_NBframe = 0;
+    statsnap_t0 = t1;
+}
+
+
+
+/**
+ * @brief Writes stage durations of current iteration to ring, and starts next iteration
+ *
+ * Stages not marked during the iteration (e.g. fused in pipelined mode) are reported with zero duration.
+ */
+void AOloopControl_looptiming_commit(long loop)
+{
+    double *row;
+    uint64_t tsc;
+    long NBrow;
+    long rowindex;
+    int k;
+
+
+    if(aoconfID_looptimingring == -1)
+        return;
+
+    NBrow = data.image[aoconfID_looptimingring].md[0].size[1];
+    rowindex = (data.image[aoconfID_looptimingring].md[0].cnt0 + 1) % NBrow;
+
+    data.image[aoconfID_looptimingring].md[0].write = 1;
+    row = data.image[aoconfID_looptimingring].array.D + rowindex*AOLTIMING_NBCOL;
+    tsc = looptiming_tsc[0];
+    for(k=0; k<AOLTIMING_NBSTAGE; k++)
+    {
+        if(looptiming_tsc[k+1] < tsc) // stage not marked this iteration
+            looptiming_tsc[k+1] = tsc;
+        row[k] = looptiming_tsc2us*(looptiming_tsc[k+1]-tsc);
+        tsc = looptiming_tsc[k+1];
+    }
+    row[AOLTIMING_NBSTAGE] = looptiming_tsc2us*(tsc-looptiming_tsc[0]);
+    row[AOLTIMING_NBSTAGE+1] = AOconf[loop].cnt;
+    data.image[aoconfID_looptimingring].md[0].cnt1 = rowindex;
+    data.image[aoconfID_looptimingring].md[0].cnt0++;
+    data.image[aoconfID_looptimingring].md[0].write = 0;
+
+    AOloopControl_statsnap_accumulate(loop, row);
+
+    if(row[AOLTIMING_NBSTAGE] > looptiming_outlierus)
+    {
+        long outlindex = (data.image[aoconfID_looptimingoutl].md[0].cnt1 + 1) % AOLTIMING_NBOUTLIER;
+
+        data.image[aoconfID_looptimingoutl].md[0].write = 1;
+        memcpy(data.image[aoconfID_looptimingoutl].array.D + outlindex*AOLTIMING_NBCOL, row, sizeof(double)*AOLTIMING_NBCOL);
+        data.image[aoconfID_looptimingoutl].md[0].cnt1 = outlindex;
+        data.image[aoconfID_looptimingoutl].md[0].cnt0++;
+        data.image[aoconfID_looptimingoutl].md[0].write = 0;
+        COREMOD_MEMORY_image_set_sempost_byID(aoconfID_looptimingoutl, -1);
+    }
+
+    // next iteration starts at end of this one
+    looptiming_tsc[0] = tsc;
+}
+
+
+
+/**
+ * @brief Loop timing summary: percentiles of each stage, and outliers
+ *
+ * Reads shared memory streams aol<loop>_looptimingring and aol<loop>_looptimingoutl.
+ *
+ * @param[in] loop         loop index
+ * @param[in] thresholdus  iterations with total time above threshold [us] are listed as outliers
+ * @param[in] fname        output file (stage statistics and outliers), NULL or "NULL" for none
+ */
+int_fast8_t AOloopControl_looptiming_stats(long loop, float thresholdus, const char *fname)
+{
+    static const char *stagename[AOLTIMING_NBSTAGE+1] = {"wait", "read", "dark", "normalize", "MVM", "modefilt", "DMwrite", "TOTAL"};
+    const double pclevel[5] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    FILE *fp = NULL;
+    char name[200];
+    long IDring, IDoutl;
+    long NBrow;
+    long NBvalid;
+    long row;
+    double *array;
+    int k, pc;
+
+
+    if(sprintf(name, "aol%ld_looptimingring", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    if((IDring = image_ID(name)) == -1)
+        IDring = read_sharedmem_image(name);
+    if(IDring == -1)
+    {
+        printf("ERROR: stream %s not found - loop timing not running ?\n", name);
+        return(-1);
+    }
+
+    NBrow = data.image[IDring].md[0].size[1];
+    NBvalid = data.image[IDring].md[0].cnt0;
+    if(NBvalid > NBrow)
+        NBvalid = NBrow;
+    if(NBvalid == 0)
+    {
+        printf("no iteration recorded\n");
+        return(0);
+    }
+
+    if((fname != NULL)&&(strcmp(fname, "NULL") != 0))
+        if((fp = fopen(fname, "w")) == NULL)
+            printERROR(__FILE__, __func__, __LINE__, "cannot create output file");
+
+    printf("LOOP %ld TIMING  [us]   %ld iterations\n", loop, NBvalid);
+    printf("%-10s  %9s  %9s  %9s  %9s  %9s  %9s\n", "stage", "mean", "p50", "p90", "p99", "p99.9", "max");
+    if(fp != NULL)
+        fprintf(fp, "# stage  mean  p50  p90  p99  p99.9  max  [us]  (%ld iterations)\n", NBvalid);
+
+    array = (double*) malloc(sizeof(double)*NBvalid);
+    for(k=0; k<AOLTIMING_NBSTAGE+1; k++)
+    {
+        double mean = 0.0;
+
+        for(row=0; row<NBvalid; row++)
+        {
+            array[row] = data.image[IDring].array.D[row*AOLTIMING_NBCOL+k];
+            mean += array[row];
+        }
+        mean /= NBvalid;
+        quick_sort_double(array, NBvalid);
+
+        printf("%-10s  %9.2f", stagename[k], mean);
+        if(fp != NULL)
+            fprintf(fp, "%-10s  %9.2f", stagename[k], mean);
+        for(pc=0; pc<5; pc++)
+        {
+            long index = (long) (pclevel[pc]*(NBvalid-1) + 0.5);
+            printf("  %9.2f", array[index]);
+            if(fp != NULL)
+                fprintf(fp, "  %9.2f", array[index]);
+        }
+        printf("\n");
+        if(fp != NULL)
+            fprintf(fp, "\n");
+    }
+    free(array);
+
+
+    // outliers: ring and outlier capture stream
+    if(sprintf(name, "aol%ld_looptimingoutl", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    if((IDoutl = image_ID(name)) == -1)
+        IDoutl = read_sharedmem_image(name);
+
+    printf("\nOUTLIERS (total > %.1f us)\n", thresholdus);
+    printf("%12s  %9s  %-10s   wait/read/dark/normalize/MVM/modefilt/DMwrite\n", "iteration", "total", "dominant");
+    if(fp != NULL)
+        fprintf(fp, "# OUTLIERS  iteration  total  wait  read  dark  normalize  MVM  modefilt  DMwrite  [us]\n");
+    {
+        long IDarray[2] = {IDoutl, IDring};
+        long NBarray[2];
+        long NBoutl;
+        long row1;
+        int a;
+
+        NBoutl = 0;
+        if(IDoutl != -1)
+        {
+            NBoutl = data.image[IDoutl].md[0].cnt0;
+            if(NBoutl > AOLTIMING_NBOUTLIER)
+                NBoutl = AOLTIMING_NBOUTLIER;
+        }
+        NBarray[0] = NBoutl;
+        NBarray[1] = NBvalid;
+
+        for(a=0; a<2; a++)
+            for(row=0; row<NBarray[a]; row++)
+            {
+                double *rowptr = data.image[IDarray[a]].array.D + row*AOLTIMING_NBCOL;
+                int kmax = 0;
+                int listed = 0;
+
+                if(rowptr[AOLTIMING_NBSTAGE] <= thresholdus)
+                    continue;
+                if(a == 1) // skip ring entries already listed from outlier capture
+                    for(row1=0; row1<NBoutl; row1++)
+                        if(data.image[IDoutl].array.D[row1*AOLTIMING_NBCOL+AOLTIMING_NBSTAGE+1] == rowptr[AOLTIMING_NBSTAGE+1])
+                            listed = 1;
+                if(listed == 1)
+                    continue;
+
+                for(k=1; k<AOLTIMING_NBSTAGE; k++)
+                    if(rowptr[k] > rowptr[kmax])
+                        kmax = k;
+
+                printf("%12.0f  %9.2f  %-10s  ", rowptr[AOLTIMING_NBSTAGE+1], rowptr[AOLTIMING_NBSTAGE], stagename[kmax]);
+                if(fp != NULL)
+                    fprintf(fp, "%12.0f  %9.2f", rowptr[AOLTIMING_NBSTAGE+1], rowptr[AOLTIMING_NBSTAGE]);
+                for(k=0; k<AOLTIMING_NBSTAGE; k++)
+                {
+                    printf(" %6.1f", rowptr[k]);
+                    if(fp != NULL)
+                        fprintf(fp, "  %9.2f", rowptr[k]);
+                }
+                printf("\n");
+                if(fp != NULL)
+                    fprintf(fp, "\n");
+            }
+    }
+
+    if(fp != NULL)
+        fclose(fp);
+
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Copy control matrix rows restricted to active WFS pixels, and quantize if requested
+ */
+static void AOloopControl_CMcompact(long IDcm, long m, long nact, long sizeWFS, int precision, float *cm, void *cm_q, float *cm_scale)
+{
+    long i, k;
+
+    for(i=0; i<m; i++)
+        for(k=0; k<nact; k++)
+            cm[i*nact+k] = data.image[IDcm].array.F[i*sizeWFS + ((nact == sizeWFS) ? k : WFS_active_index[k])];
+
+    if(precision == CMPRECISION_INT8)
+        AOloopControl_CMquantize_INT8(cm, m, nact, (int8_t*) cm_q, cm_scale);
+    if(precision == CMPRECISION_BF16)
+        AOloopControl_CMquantize_BF16(cm, m, nact, (uint16_t*) cm_q);
+}
+
+
+
+/**
+ * @brief Record control matrix swap in loop telemetry
+ */
+static void AOloopControl_CMhotswap_record(long loop, long CMcnt0)
+{
+    AOconf[loop].CMswapcnt++;
+    AOconf[loop].CMswaploopcnt = AOconf[loop].cnt;
+    AOconf[loop].CMswapCMcnt0 = CMcnt0;
+}
+
+
+
+/**
+ * @brief Swap standby control matrix in (CPU path), called at frame boundary by loop process
+ */
+static void AOloopControl_CMhotswap_swap(long loop)
+{
+    int active = 1 - __atomic_load_n(&CMbuff_active, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(&CMbuff_active, active, __ATOMIC_RELEASE);
+    AOloopControl_CMhotswap_record(loop, (long) CMbuff[active].cnt0);
+
+    // hot swap thread may now fill the previously active buffer
+    __atomic_store_n(&CMbuff_ready, 0, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * @brief Control matrix hot swap thread (CPU path)
+ *
+ * Polls the control matrix currently in use. When it is updated (cnt0), a compacted/quantized copy is built in the standby
+ * buffer while the loop keeps running on the active copy. The copy is discarded and restarted if the matrix is written during the copy.
+ */
+static void *AOloopControl_CMhotswap_thread(void *ptr)
+{
+    long loop = *((long*) ptr);
+    long IDcm, m, nact;
+    int precision;
+    long long cnt;
+    AOLOOPCONTROL_CMBUFF *cmactive;
+    AOLOOPCONTROL_CMBUFF *cmstandby;
+
+    while(CM_hotswap_running == 1)
+    {
+        if(__atomic_load_n(&CMbuff_ready, __ATOMIC_ACQUIRE) != 0)
+        {
+            usleep(1000);
+            continue;
+        }
+        // index only changes while CMbuff_ready == 1
+        cmactive = &CMbuff[__atomic_load_n(&CMbuff_active, __ATOMIC_ACQUIRE)];
+        cmstandby = &CMbuff[1 - __atomic_load_n(&CMbuff_active, __ATOMIC_ACQUIRE)];
+
+        IDcm = cmactive->ID;
+        if((IDcm == -1)||((long long) data.image[IDcm].md[0].cnt0 == cmactive->cnt0)||(data.image[IDcm].md[0].write == 1))
+        {
+            usleep(1000);
+            continue;
+        }
+
+        cnt = data.image[IDcm].md[0].cnt0;
+        m = cmactive->m;
+        nact = cmactive->nact;
+        precision = cmactive->precision;
+
+        if((m*nact > cmstandby->NBelem)||(m > cmstandby->NBrow))
+        {
+            free(cmstandby->cm);
+            free(cmstandby->q);
+            free(cmstandby->scale);
+            cmstandby->NBelem = m*nact;
+            cmstandby->NBrow = m;
+            cmstandby->cm = (float*) malloc(sizeof(float)*cmstandby->NBelem);
+            cmstandby->q = malloc(sizeof(uint16_t)*cmstandby->NBelem);
+            cmstandby->scale = (float*) malloc(sizeof(float)*cmstandby->NBrow);
+        }
+
+        AOloopControl_CMcompact(IDcm, m, nact, AOconf[loop].sizeWFS, precision, cmstandby->cm, cmstandby->q, cmstandby->scale);
+
+        if((data.image[IDcm].md[0].write == 1)||((long long) data.image[IDcm].md[0].cnt0 != cnt))
+            continue; // matrix changed during copy: retry
+
+        cmstandby->ID = IDcm;
+        cmstandby->cnt0 = cnt;
+        cmstandby->precision = precision;
+        cmstandby->m = m;
+        cmstandby->nact = nact;
+
+        __atomic_store_n(&CMbuff_ready, 1, __ATOMIC_RELEASE);
+    }
+
+    return(NULL);
+}
+
+
+
+
+/**
+ * ## Purpose
+ * 
+ * Main AO loop function
+ * 
+ * 
+ * ## Details
+ * 
+ */ 
+int_fast8_t AOloopControl_run()
+{
+    FILE *fp;
+    char fname[200];
+    long loop;
+    int vOK;
+    long ii;
+    long ID;
+    long j, m;
+    struct tm *uttime;
+    time_t t;
+    struct timespec *thetime = (struct timespec *)malloc(sizeof(struct timespec));
+    char logfname[1000];
+    char command[1000];
+    int r;
+    int RT_priority = 90; //any number from 0-99
+    double a;
+    long cnttest;
+    float tmpf1;
+
+
+    struct timespec t1;
+    struct timespec t2;
+    struct timespec tdiff;
+    int semval;
+
+
+
+    loop = LOOPNUMBER;
+
+
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(0);
+
+    // r = seteuid(euid_called); //This goes up to maximum privileges
+    AOloopControl_RTsched_set(loop, AOLRTSCHED_MAIN, RT_priority);
+    // r = seteuid(euid_real);//Go back to normal privileges
+
+
+	/** ### STEP 1: Setting up 
+	 * 
+	 * Load arrays
+	 * */
+    printf("SETTING UP...\n");
+    AOloopControl_loadconfigure(LOOPNUMBER, 1, 10);
+
+	
+
+
+
+    // pixel streaming ?
+    COMPUTE_PIXELSTREAMING = 1;
+
+    if(AOconf[loop].GPUall == 0)
+        COMPUTE_PIXELSTREAMING = 0;
+
+
+    printf("============ pixel streaming ? =============\n");
+    fflush(stdout);
+
+    if(COMPUTE_PIXELSTREAMING == 1)
+        aoconfID_pixstream_wfspixindex = load_fits("pixstream_wfspixindex.fits", "pixstream", 1);
+
+    if(aoconfID_pixstream_wfspixindex == -1)
+        COMPUTE_PIXELSTREAMING = 0;
+    else
+    {
+        printf("Testing data type\n");
+        fflush(stdout);
+        if(data.image[aoconfID_pixstream_wfspixindex].md[0].atype != _DATATYPE_UINT16)
+            COMPUTE_PIXELSTREAMING = 0;
+    }
+
+    if(COMPUTE_PIXELSTREAMING == 1)
+    {
+        long xsize = data.image[aoconfID_pixstream_wfspixindex].md[0].size[0];
+        long ysize = data.image[aoconfID_pixstream_wfspixindex].md[0].size[1];
+        PIXSTREAM_NBSLICES = 0;
+        for(ii=0; ii<xsize*ysize; ii++)
+            if(data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii] > PIXSTREAM_NBSLICES)
+                PIXSTREAM_NBSLICES = data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii];
+        PIXSTREAM_NBSLICES++;
+        printf("PIXEL STREAMING:   %d image slices\n", PIXSTREAM_NBSLICES);
+    }
+
+
+
+    printf("============ FORCE pixel streaming = 0\n");
+    fflush(stdout);
+    COMPUTE_PIXELSTREAMING = 0; // TEST
+
+
+    printf("GPU0 = %d\n", AOconf[loop].GPU0);
+    if(AOconf[loop].GPU0>1)
+    {
+        uint8_t k;
+        for(k=0; k<AOconf[loop].GPU0; k++)
+            printf("stream %2d      GPUset0 = %2d\n", (int) k, GPUset0[k]);
+    }
+
+    printf("GPU1 = %d\n", AOconf[loop].GPU1);
+    if(AOconf[loop].GPU1>1)
+    {
+        uint8_t k;
+        for(k=0; k<AOconf[loop].GPU1; k++)
+            printf("stream %2d      GPUset1 = %2d\n", (int) k, GPUset1[k]);
+    }
+
+
+
+
+
+
+
+
+    vOK = 1;
+    if(AOconf[loop].init_wfsref0==0)
+    {
+        printf("ERROR: CANNOT RUN LOOP WITHOUT WFS REFERENCE\n");
+        vOK = 0;
+    }
+    if(AOconf[loop].init_CM==0)
+    {
+        printf("ERROR: CANNOT RUN LOOP WITHOUT CONTROL MATRIX\n");
+        vOK = 0;
+    }
+
+	aoconfcnt0_wfsref_current = data.image[aoconfID_wfsref].md[0].cnt0;
+	aoconfcnt0_contrM_current = data.image[aoconfID_contrM].md[0].cnt0;
+
+    AOconf[loop].initmapping = 0;
+    AOconf[loop].init_CMc = 0;
+    clock_gettime(CLOCK_REALTIME, &t1);
+
+
+    if(vOK==1)
+    {
+        AOconf[loop].kill = 0;
+        AOconf[loop].on = 0;
+        AOconf[loop].DMprimaryWriteON = 0;
+        AOconf[loop].DMfilteredWriteON = 0;
+        AOconf[loop].ARPFon = 0;
+        // CPU control matrix hot swap: standby matrix prepared in background
+        if((AOconf[loop].CMhotswap == 1)&&(AOconf[loop].GPU0 == 0)&&(CM_hotswap_running == 0))
+        {
+            static long CMhotswap_loop;
+
+            CMhotswap_loop = loop;
+            __atomic_store_n(&CMbuff_ready, 0, __ATOMIC_RELEASE);
+            CM_hotswap_running = 1;
+            if(pthread_create(&CM_hotswap_thread, NULL, AOloopControl_CMhotswap_thread, (void*) &CMhotswap_loop) != 0)
+            {
+                printERROR(__FILE__, __func__, __LINE__, "cannot create control matrix hot swap thread");
+                CM_hotswap_running = 0;
+            }
+        }
+
+        printf("entering loop ...\n");
+        fflush(stdout);
+
+        int timerinit = 0;
+        int helperspinned = 0;
+
+        while( AOconf[loop].kill == 0)
+        {
+            if(timerinit==1)
+            {
+                clock_gettime(CLOCK_REALTIME, &t1);
+                printf("timer init\n");
+            }
+            clock_gettime(CLOCK_REALTIME, &t2);
+
+            tdiff = info_time_diff(t1, t2);
+            double tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+            printf(" WAITING     %20.3lf sec         \r", tdiffv);
+            fflush(stdout);
+            usleep(1000);
+
+
+            timerinit = 0;
+            while(AOconf[loop].on == 1)
+            {
+                if(timerinit==0)
+                {
+#ifdef _PRINT_TEST
+                    printf("TEST - Read first image\n");
+                    fflush(stdout);
+#endif
+
+                    //      Read_cam_frame(loop, 0, AOconf[loop].WFSnormalize, 0, 1);
+                    clock_gettime(CLOCK_REALTIME, &t1);
+                    timerinit = 1;
+
+                    if(aoconfID_looptimingring == -1)
+                        AOloopControl_looptiming_init(loop, AOconf[loop].looptimingNBrow, AOconf[loop].looptimingoutlus);
+                    else
+                        AOloopControl_looptiming_start();
+
+#ifdef _PRINT_TEST
+                    printf("\n");
+                    printf("LOOP CLOSED  ");
+                    fflush(stdout);
+#endif
+                }
+
+#ifdef _PRINT_TEST
+                printf("TEST - Start AO compute\n");
+                fflush(stdout);
+#endif
+
+                if((helperspinned == 1)&&(AOconf[loop].RTcheck == 1)) // steady state check, after first iteration
+                    AOloopControl_RTcheck_arm(loop);
+
+                AOcompute(loop, AOconf[loop].WFSnormalize);
+
+                if(helperspinned == 0) // helper threads are created in first AOcompute call
+                {
+                    AOloopControl_RTsched_pinhelpers(loop);
+                    helperspinned = 1;
+                }
+
+#ifdef _PRINT_TEST
+                printf("TEST - exiting AOcompute\n");
+                fflush(stdout);
+#endif
+
+
+                AOconf[loop].status = 12; // 12
+                clock_gettime(CLOCK_REALTIME, &tnow);
+                tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+                tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+                data.image[aoconfID_looptiming].array.F[12] = tdiffv;
+
+#ifdef _PRINT_TEST
+                printf("TEST -  CMMODE = %d\n", AOconf[loop].CMMODE);
+                fflush(stdout);
+#endif
+
+                if(AOconf[loop].CMMODE==0)  // 2-step : WFS -> mode coeffs -> DM act
+                {
+#ifdef _PRINT_TEST
+                    printf("TEST -  DMprimaryWriteON = %d\n", AOconf[loop].DMprimaryWriteON);
+                    fflush(stdout);
+#endif
+
+                    if(AOconf[loop].DMprimaryWriteON==1) // if Writing to DM
+                    {
+#ifdef _PRINT_TEST
+                        printf("TEST -  gain = %f\n", AOconf[loop].gain);
+                        fflush(stdout);
+#endif
+
+                        if(fabs(AOconf[loop].gain)>1.0e-6)
+                            set_DM_modes(loop);
+                    }
+
+                }
+                else // 1 step: WFS -> DM act
+                {
+                    if(AOconf[loop].DMprimaryWriteON==1) // if Writing to DM
+                    {
+                        data.image[aoconfID_dmC].md[0].write = 1;
+
+                        for(ii=0; ii<AOconf[loop].sizeDM; ii++)//TEST
+                        {
+                            if(isnan(data.image[aoconfID_meas_act].array.F[ii])!=0)
+                            {
+                                printf("image aol2_meas_act  element %ld is NAN -> replacing by 0\n", ii);
+                                data.image[aoconfID_meas_act].array.F[ii] = 0.0;
+                            }
+                        }
+
+
+
+
+                        AOconf[loop].status = 13; // enforce limits
+                        clock_gettime(CLOCK_REALTIME, &tnow);
+                        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+                        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+                        data.image[aoconfID_looptiming].array.F[13] = tdiffv;
+
+
+                        for(ii=0; ii<AOconf[loop].sizeDM; ii++)
+                        {
+                            data.image[aoconfID_dmC].array.F[ii] -= AOconf[loop].gain * data.image[aoconfID_meas_act].array.F[ii];
+
+                            data.image[aoconfID_dmC].array.F[ii] *= AOconf[loop].mult;
+
+                            if(data.image[aoconfID_dmC].array.F[ii] > AOconf[loop].maxlimit)
+                                data.image[aoconfID_dmC].array.F[ii] = AOconf[loop].maxlimit;
+                            if(data.image[aoconfID_dmC].array.F[ii] < -AOconf[loop].maxlimit)
+                                data.image[aoconfID_dmC].array.F[ii] = -AOconf[loop].maxlimit;
+                        }
+
+
+                        AOconf[loop].status = 14; // write to DM
+                        clock_gettime(CLOCK_REALTIME, &tnow);
+                        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+                        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+                        data.image[aoconfID_looptiming].array.F[14] = tdiffv;
 
 
 
@@ -3173,6 +4723,10 @@ int_fast8_t AOloopControl_run()
                         AOconf[loop].DMupdatecnt ++;
                     }
                 }
+                AOloopControl_looptiming_mark(AOLTIMING_DMWRITE);
+                AOloopControl_looptiming_commit(loop);
+                if((helperspinned == 1)&&(AOconf[loop].RTcheck == 1))
+                    AOloopControl_RTcheck_verify(loop);
 
                 AOconf[loop].status = 18; // 18
                 clock_gettime(CLOCK_REALTIME, &tnow);
@@ -3188,35 +4742,245 @@ int_fast8_t AOloopControl_run()
 
 
 
-                data.image[aoconfIDlogdata].md[0].cnt0 = AOconf[loop].cnt;
-                data.image[aoconfIDlogdata].array.F[0] = AOconf[loop].gain;
+                data.image[aoconfIDlogdata].md[0].cnt0 = AOconf[loop].cnt;
+                data.image[aoconfIDlogdata].array.F[0] = AOconf[loop].gain;
+
+
+                if(AOconf[loop].cnt == AOconf[loop].cntmax)
+                    AOconf[loop].on = 0;
+            }
+
+        }
+
+        if(CM_hotswap_running == 1)
+        {
+            CM_hotswap_running = 0;
+            pthread_join(CM_hotswap_thread, NULL);
+        }
+    }
+
+    free(thetime);
+
+    return(0);
+}
+
+
+
+
+
+
+
+int_fast8_t ControlMatrixMultiply( float *cm_array, float *imarray, long m, long n, float *outvect)
+{
+    long i;
+
+    cblas_sgemv (CblasRowMajor, CblasNoTrans, m, n, 1.0, cm_array, n, imarray, 1, 0.0, outvect, 1);
+
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Quantize control matrix to INT8, one scale factor per row (mode or actuator)
+ * 
+ * scale[i] = max_k |cm[i,k]| / 127, cm[i,k] ~ scale[i] * qarray[i,k]
+ */
+int_fast8_t AOloopControl_CMquantize_INT8(const float *cm_array, long m, long n, int8_t *qarray, float *scale)
+{
+    long i, k;
+
+    for(i=0; i<m; i++)
+    {
+        float vmax = 0.0;
+        float scaleinv;
+
+        for(k=0; k<n; k++)
+            if(fabsf(cm_array[i*n+k]) > vmax)
+                vmax = fabsf(cm_array[i*n+k]);
+
+        scale[i] = vmax/127.0;
+        scaleinv = (vmax > 0.0) ? 127.0/vmax : 0.0;
+        for(k=0; k<n; k++)
+            qarray[i*n+k] = (int8_t) lrintf(cm_array[i*n+k]*scaleinv);
+    }
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Convert control matrix to BF16 (upper 16 bits of IEEE float, round to nearest even)
+ */
+int_fast8_t AOloopControl_CMquantize_BF16(const float *cm_array, long m, long n, uint16_t *qarray)
+{
+    long ii;
+
+    for(ii=0; ii<m*n; ii++)
+    {
+        uint32_t u;
+
+        memcpy(&u, &cm_array[ii], sizeof(uint32_t));
+        u += 0x7fff + ((u >> 16) & 1);
+        qarray[ii] = (uint16_t) (u >> 16);
+    }
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Matrix-vector multiply, INT8 matrix with per-row scale, FP32 accumulation
+ */
+HOTKERNEL int_fast8_t ControlMatrixMultiply_INT8(const int8_t *qarray, const float *scale, const float *imarray, long m, long n, float *outvect)
+{
+    long i;
+
+# ifdef _OPENMP
+    #pragma omp parallel for num_threads(8) schedule(static) if (m*n > OMP_NELEMENT_LIMIT)
+# endif
+    for(i=0; i<m; i++)
+    {
+        const int8_t *row = qarray + i*n;
+        float acc = 0.0;
+        long k;
+
+        #pragma omp simd reduction(+:acc)
+        for(k=0; k<n; k++)
+            acc += (float) row[k] * imarray[k];
+        outvect[i] = acc*scale[i];
+    }
+
+    return(0);
+}
+
+
 
+/**
+ * @brief Matrix-vector multiply, BF16 matrix, FP32 accumulation
+ */
+HOTKERNEL int_fast8_t ControlMatrixMultiply_BF16(const uint16_t *qarray, const float *imarray, long m, long n, float *outvect)
+{
+    long i;
 
-                if(AOconf[loop].cnt == AOconf[loop].cntmax)
-                    AOconf[loop].on = 0;
-            }
+# ifdef _OPENMP
+    #pragma omp parallel for num_threads(8) schedule(static) if (m*n > OMP_NELEMENT_LIMIT)
+# endif
+    for(i=0; i<m; i++)
+    {
+        const uint16_t *row = qarray + i*n;
+        float acc = 0.0;
+        long k;
 
+        #pragma omp simd reduction(+:acc)
+        for(k=0; k<n; k++)
+        {
+            union { uint32_t u; float f; } v;
+            v.u = ((uint32_t) row[k]) << 16;
+            acc += v.f * imarray[k];
         }
+        outvect[i] = acc;
     }
 
-    free(thetime);
-
     return(0);
 }
 
 
 
 
+/**
+ * @brief Multiply imWFS2 by control matrix, over active WFS pixels only (CPU)
+ * 
+ * Active pixels (WFS_active_index) are gathered into a contiguous vector, and the control matrix is kept compacted to match:
+ * rows are restricted to active pixels, rebuilt whenever the matrix stream is updated (cnt0).\n
+ * The compacted matrix is stored in the precision selected by AOconf[loop].CMprecision (CMPRECISION_FP32, _BF16 or _INT8);
+ * reduced precision modes accumulate in FP32.\n
+ * Falls back to the full-width FP32 multiply if all pixels are active and hot swap is off.\n
+ * With hot swap (AOconf[loop].CMhotswap = 1), an updated matrix is compacted by AOloopControl_CMhotswap_thread into a standby
+ * buffer and swapped in here, at the start of the next frame.
+ * 
+ * @param[in]  loop     loop index
+ * @param[in]  IDcm     control matrix (sizeWFS x m, WFS pixel index fastest)
+ * @param[in]  m        number of output elements
+ * @param[out] outvect  output vector
+ */
+static int_fast8_t ControlMatrixMultiply_active(long loop, long IDcm, long m, float *outvect)
+{
+    long nact = AOconf[loop].activeWFScnt;
+    long sizeWFS = AOconf[loop].sizeWFS;
+    int precision = AOconf[loop].CMprecision;
+    float *vect;
+    AOLOOPCONTROL_CMBUFF *cmbuff;
+    long k;
 
+    if((WFS_active_index == NULL)||(nact == 0))
+        nact = sizeWFS;
 
+    // with hot swap, matrix stream may be rewritten while loop runs: always multiply from private copy
+    if((nact == sizeWFS)&&(precision == CMPRECISION_FP32)&&(AOconf[loop].CMhotswap == 0))
+        return(ControlMatrixMultiply(data.image[IDcm].array.F, data.image[aoconfID_imWFS2].array.F, m, sizeWFS, outvect));
 
-int_fast8_t ControlMatrixMultiply( float *cm_array, float *imarray, long m, long n, float *outvect)
-{
-    long i;
+    if(__atomic_load_n(&CMbuff_ready, __ATOMIC_ACQUIRE) == 1)
+    {
+        cmbuff = &CMbuff[1 - CMbuff_active];
+        if((cmbuff->ID == IDcm)&&(cmbuff->precision == precision)&&(cmbuff->m == m)&&(cmbuff->nact == nact))
+            AOloopControl_CMhotswap_swap(loop);
+        else
+            __atomic_store_n(&CMbuff_ready, 0, __ATOMIC_RELEASE); // prepared for another matrix configuration: discard
+    }
+    cmbuff = &CMbuff[CMbuff_active];
 
-    cblas_sgemv (CblasRowMajor, CblasNoTrans, m, n, 1.0, cm_array, n, imarray, 1, 0.0, outvect, 1);
+    // new matrix content is handled by hot swap thread if running, otherwise rebuilt here
+    if((IDcm != cmbuff->ID)||(precision != cmbuff->precision)||(m != cmbuff->m)||(nact != cmbuff->nact)
+            ||((CM_hotswap_running == 0)&&((long long) data.image[IDcm].md[0].cnt0 != cmbuff->cnt0)))
+    {
+        printf("COMPACTING CONTROL MATRIX %s : %ld -> %ld pixels, precision %s\n", data.image[IDcm].md[0].name, sizeWFS, nact,
+               (precision == CMPRECISION_INT8) ? "INT8" : ((precision == CMPRECISION_BF16) ? "BF16" : "FP32"));
+        fflush(stdout);
 
-    return(0);
+        // buffers are allocated by AOloopControl_loadconfigure, grown here only if matrix is larger than expected
+        if((m*nact > cmbuff->NBelem)||(m > cmbuff->NBrow))
+        {
+            printf("WARNING: control matrix %s larger than preallocated buffer -> allocating\n", data.image[IDcm].md[0].name);
+            free(cmbuff->cm);
+            free(cmbuff->q);
+            free(cmbuff->scale);
+            cmbuff->NBelem = m*nact;
+            cmbuff->NBrow = m;
+            cmbuff->cm = (float*) malloc(sizeof(float)*cmbuff->NBelem);
+            cmbuff->q = malloc(sizeof(uint16_t)*cmbuff->NBelem);
+            cmbuff->scale = (float*) malloc(sizeof(float)*cmbuff->NBrow);
+        }
+
+        cmbuff->cnt0 = data.image[IDcm].md[0].cnt0;
+        AOloopControl_CMcompact(IDcm, m, nact, sizeWFS, precision, cmbuff->cm, cmbuff->q, cmbuff->scale);
+
+        cmbuff->m = m;
+        cmbuff->nact = nact;
+        cmbuff->precision = precision;
+        cmbuff->ID = IDcm;
+    }
+
+    if(nact == sizeWFS)
+        vect = data.image[aoconfID_imWFS2].array.F;
+    else
+    {
+        for(k=0; k<nact; k++)
+            WFS_active_vect[k] = data.image[aoconfID_imWFS2].array.F[WFS_active_index[k]];
+        vect = WFS_active_vect;
+    }
+
+    switch ( precision ) {
+    case CMPRECISION_INT8 :
+        return(ControlMatrixMultiply_INT8((int8_t*) cmbuff->q, cmbuff->scale, vect, m, nact, outvect));
+    case CMPRECISION_BF16 :
+        return(ControlMatrixMultiply_BF16((uint16_t*) cmbuff->q, vect, m, nact, outvect));
+    default :
+        return(ControlMatrixMultiply(cmbuff->cm, vect, m, nact, outvect));
+    }
 }
 
 
@@ -3244,96 +5008,575 @@ int_fast8_t set_DM_modes(long loop)
         float *arrayf;
         long i, j, k;
 
-        arrayf = (float*) malloc(sizeof(float)*AOconf[loop].sizeDM);
+        if(DMmodes_arrayf == NULL) // normally allocated by AOloopControl_loadconfigure
+            DMmodes_arrayf = (float*) malloc(sizeof(float)*AOconf[loop].sizeDM);
+        arrayf = DMmodes_arrayf;
+
+        for(j=0; j<AOconf[loop].sizeDM; j++)
+            arrayf[j] = 0.0;
+
+        for(i=0; i<AOconf[loop].sizeDM; i++)
+            for(k=0; k < AOconf[loop].NBDMmodes; k++)
+                arrayf[i] += data.image[aoconfID_cmd_modes].array.F[k] * data.image[aoconfID_DMmodes].array.F[k*AOconf[loop].sizeDM+i];
+
+        data.image[aoconfID_dmC].md[0].write = 1;
+        memcpy (data.image[aoconfID_dmC].array.F, arrayf, sizeof(float)*AOconf[loop].sizeDM);
+        if(data.image[aoconfID_dmC].md[0].sem > 0)
+        {
+            sem_getvalue(data.image[aoconfID_dmC].semptr[0], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[aoconfID_dmC].semptr[0]);
+        }
+        data.image[aoconfID_dmC].md[0].cnt0++;
+        data.image[aoconfID_dmC].md[0].write = 0;
+    }
+    else
+    {
+#ifdef HAVE_CUDA
+
+
+        GPU_loop_MultMat_async(1, AOconf[loop].GPUasync);
+        GPU_loop_MultMat_balance(1, AOconf[loop].GPUbalance);
+        GPU_loop_MultMat_tunefile("./conf/GPUtune.txt");
+        GPU_loop_MultMat_failover(1, AOconf[loop].GPUfailover, 4);
+        GPU_loop_MultMat_setup(1, data.image[aoconfID_DMmodes].name, data.image[aoconfID_cmd_modes].name, data.image[aoconfID_dmC].name, AOconf[loop].GPU1, GPUset1, 1, AOconf[loop].GPUusesem, 1, loop);
+        AOconf[loop].status = 12;
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[aoconfID_looptiming].array.F[12] = tdiffv;
+
+        GPU_loop_MultMat_execute(1, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], 1.0, 0.0, 1);
+#endif
+    }
+
+    if(aoconfID_dmdisp!=-1)
+        if(data.image[aoconfID_dmdisp].md[0].sem > 1)
+        {
+            sem_getvalue(data.image[aoconfID_dmdisp].semptr[1], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[aoconfID_dmdisp].semptr[1]);
+        }
+
+    AOconf[loop].DMupdatecnt ++;
+
+    return(0);
+}
+
+
+
+
+
+
+
+
+int_fast8_t set_DM_modesRM(long loop)
+{
+    long k;
+    long i, j;
+    float *arrayf;
+
+
+    if(DMmodes_arrayf == NULL) // normally allocated by AOloopControl_loadconfigure
+        DMmodes_arrayf = (float*) malloc(sizeof(float)*AOconf[loop].sizeDM);
+    arrayf = DMmodes_arrayf;
+
+    for(j=0; j<AOconf[loop].sizeDM; j++)
+        arrayf[j] = 0.0;
+
+    for(k=0; k < AOconf[loop].NBDMmodes; k++)
+    {
+        for(i=0; i<AOconf[loop].sizeDM; i++)
+            arrayf[i] += data.image[aoconfID_cmd_modesRM].array.F[k] * data.image[aoconfID_DMmodes].array.F[k*AOconf[loop].sizeDM+i];
+    }
+
+
+    data.image[aoconfID_dmRM].md[0].write = 1;
+    memcpy (data.image[aoconfID_dmRM].array.F, arrayf, sizeof(float)*AOconf[loop].sizeDM);
+    data.image[aoconfID_dmRM].md[0].cnt0++;
+    data.image[aoconfID_dmRM].md[0].write = 0;
+
+    AOconf[loop].DMupdatecnt ++;
+
+    return(0);
+}
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/*  Pixel streaming pipeline: control matrix multiply overlapped with WFS slice readout            */
+/* =============================================================================================== */
+
+static int   pixstreampipe_init = 0;
+static long  pixstreampipe_NBslice = 0;
+static long *pixstreampipe_nbpix = NULL;         // number of pixels in each slice
+static long *pixstreampipe_pixoffset = NULL;     // offset of slice in pixstreampipe_pixindex
+static long *pixstreampipe_pixindex = NULL;      // WFS pixel indices, grouped by slice
+static float *pixstreampipe_CM = NULL;           // control matrix, packed by slice (row-major m x nbpix[slice] blocks)
+static float *pixstreampipe_CMref = NULL;        // control matrix x WFS reference
+static float *pixstreampipe_wslice = NULL;       // dark-subtracted slice pixels
+static float *pixstreampipe_acc = NULL;          // accumulated partial products
+static long  pixstreampipe_m = 0;                // number of output elements (modes or actuators)
+static long  pixstreampipe_IDcm = -1;
+static long  pixstreampipe_IDout = -1;
+static long  pixstreampipe_IDdark = -1;
+static long long pixstreampipe_cmcnt0 = -1;
+static long long pixstreampipe_refcnt0 = -1;
+
+
+
+
+/**
+ * @brief Set up pixel streaming pipeline
+ * 
+ * Pixel -> slice map is read from image "pixstream" (file pixstream_wfspixindex.fits, UINT16, slice index of each WFS pixel,
+ * as written by COREMOD_MEMORY_PixMapDecode_U).
+ * 
+ * @return 0 if OK, -1 if pipeline cannot run (loop then uses the full-frame path)
+ */
+static int AOcompute_pixstream_setup(long loop)
+{
+	long ii, slice;
+	long sizeWFS = AOconf[loop].sizeWFS;
+	char dname[200];
+	
+	if(AOconf[loop].GPU0 != 0)
+	{
+		printf("PIXEL STREAMING PIPELINE: CPU only (GPU0 = %d) -> disabled\n", (int) AOconf[loop].GPU0);
+		return(-1);
+	}
+	if(data.image[aoconfID_wfsim].md[0].naxis != 2)
+	{
+		printf("PIXEL STREAMING PIPELINE: WFS stream must be 2D -> disabled\n");
+		return(-1);
+	}
+	if((data.image[aoconfID_wfsim].md[0].atype != _DATATYPE_UINT16)&&(data.image[aoconfID_wfsim].md[0].atype != _DATATYPE_FLOAT))
+	{
+		printf("PIXEL STREAMING PIPELINE: WFS data type not supported -> disabled\n");
+		return(-1);
+	}
+	
+	if((aoconfID_pixstream_wfspixindex = image_ID("pixstream")) == -1)
+		aoconfID_pixstream_wfspixindex = load_fits("pixstream_wfspixindex.fits", "pixstream", 1);
+	if(aoconfID_pixstream_wfspixindex == -1)
+	{
+		printf("PIXEL STREAMING PIPELINE: no pixel slice map -> disabled\n");
+		return(-1);
+	}
+	if((data.image[aoconfID_pixstream_wfspixindex].md[0].atype != _DATATYPE_UINT16)||((long) data.image[aoconfID_pixstream_wfspixindex].md[0].nelement != sizeWFS))
+	{
+		printf("PIXEL STREAMING PIPELINE: pixel slice map must be UINT16, %ld pixels -> disabled\n", sizeWFS);
+		return(-1);
+	}
+	
+	if(AOconf[loop].CMMODE == 0)
+	{
+		pixstreampipe_IDcm = aoconfID_contrM;
+		pixstreampipe_IDout = aoconfID_meas_modes;
+		pixstreampipe_m = AOconf[loop].NBDMmodes;
+	}
+	else
+	{
+		if(aoconfID_meas_act==-1)
+		{
+			uint32_t sizearray[2];
+			char imname[200];
+			
+			sizearray[0] = AOconf[loop].sizexDM;
+			sizearray[1] = AOconf[loop].sizeyDM;
+			if(sprintf(imname, "aol%ld_meas_act", LOOPNUMBER) < 1)
+				printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+			aoconfID_meas_act = create_image_ID(imname, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+			COREMOD_MEMORY_image_set_createsem(imname, 10);
+		}
+		pixstreampipe_IDcm = aoconfID_contrMc;
+		pixstreampipe_IDout = aoconfID_meas_act;
+		pixstreampipe_m = AOconf[loop].sizeDM;
+	}
+	if(pixstreampipe_IDcm == -1)
+	{
+		printf("PIXEL STREAMING PIPELINE: no control matrix -> disabled\n");
+		return(-1);
+	}
+	
+	if(sprintf(dname, "aol%ld_wfsdark", loop) < 1)
+		printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+	pixstreampipe_IDdark = image_ID(dname);
+	
+	
+	// group pixels by slice
+	pixstreampipe_NBslice = 0;
+	for(ii=0; ii<sizeWFS; ii++)
+		if(data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii] >= pixstreampipe_NBslice)
+			pixstreampipe_NBslice = data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii] + 1;
+	
+	pixstreampipe_nbpix = (long*) calloc(pixstreampipe_NBslice, sizeof(long));
+	pixstreampipe_pixoffset = (long*) calloc(pixstreampipe_NBslice+1, sizeof(long));
+	pixstreampipe_pixindex = (long*) malloc(sizeof(long)*sizeWFS);
+	
+	for(ii=0; ii<sizeWFS; ii++)
+		pixstreampipe_nbpix[data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii]]++;
+	for(slice=0; slice<pixstreampipe_NBslice; slice++)
+		pixstreampipe_pixoffset[slice+1] = pixstreampipe_pixoffset[slice] + pixstreampipe_nbpix[slice];
+	for(slice=0; slice<pixstreampipe_NBslice; slice++)
+		pixstreampipe_nbpix[slice] = 0;
+	for(ii=0; ii<sizeWFS; ii++)
+	{
+		slice = data.image[aoconfID_pixstream_wfspixindex].array.UI16[ii];
+		pixstreampipe_pixindex[pixstreampipe_pixoffset[slice] + pixstreampipe_nbpix[slice]] = ii;
+		pixstreampipe_nbpix[slice]++;
+	}
+	
+	pixstreampipe_CM = (float*) malloc(sizeof(float)*pixstreampipe_m*sizeWFS);
+	pixstreampipe_CMref = (float*) malloc(sizeof(float)*pixstreampipe_m);
+	pixstreampipe_acc = (float*) malloc(sizeof(float)*pixstreampipe_m);
+	pixstreampipe_wslice = (float*) malloc(sizeof(float)*sizeWFS);
+	pixstreampipe_cmcnt0 = -1;
+	pixstreampipe_refcnt0 = -1;
+	
+	// slices are signaled on semaphore 2, start from 0
+	if(data.image[aoconfID_wfsim].md[0].sem > 2)
+	{
+		int semval;
+		
+		sem_getvalue(data.image[aoconfID_wfsim].semptr[2], &semval);
+		for(ii=0; ii<semval; ii++)
+			sem_trywait(data.image[aoconfID_wfsim].semptr[2]);
+	}
+	
+	printf("PIXEL STREAMING PIPELINE: %ld slices, %ld x %ld control matrix (%s) -> %s\n", pixstreampipe_NBslice, pixstreampipe_m, sizeWFS, data.image[pixstreampipe_IDcm].md[0].name, data.image[pixstreampipe_IDout].md[0].name);
+	fflush(stdout);
+	
+	return(0);
+}
+
+
+
+
+/**
+ * @brief Repack control matrix by slice, and recompute CM x WFS reference, if either has changed
+ */
+static void AOcompute_pixstream_updateCM(long loop)
+{
+	long sizeWFS = AOconf[loop].sizeWFS;
+	long slice, i, k;
+	
+	if((long long) data.image[pixstreampipe_IDcm].md[0].cnt0 != pixstreampipe_cmcnt0)
+	{
+		pixstreampipe_cmcnt0 = data.image[pixstreampipe_IDcm].md[0].cnt0;
+		pixstreampipe_refcnt0 = -1;
+		
+		for(slice=0; slice<pixstreampipe_NBslice; slice++)
+		{
+			long nbpix = pixstreampipe_nbpix[slice];
+			long *pixindex = pixstreampipe_pixindex + pixstreampipe_pixoffset[slice];
+			float *CMslice = pixstreampipe_CM + pixstreampipe_m*pixstreampipe_pixoffset[slice];
+			
+			for(i=0; i<pixstreampipe_m; i++)
+				for(k=0; k<nbpix; k++)
+					CMslice[i*nbpix+k] = data.image[pixstreampipe_IDcm].array.F[i*sizeWFS + pixindex[k]];
+		}
+	}
+	
+	if((long long) data.image[aoconfID_wfsref].md[0].cnt0 != pixstreampipe_refcnt0)
+	{
+		pixstreampipe_refcnt0 = data.image[aoconfID_wfsref].md[0].cnt0;
+		ControlMatrixMultiply(data.image[pixstreampipe_IDcm].array.F, data.image[aoconfID_wfsref].array.F, pixstreampipe_m, sizeWFS, pixstreampipe_CMref);
+	}
+}
+
+
+
+
+/**
+ * @brief Read WFS frame slice by slice and accumulate control matrix product as slices arrive
+ * 
+ * Replaces Read_cam_frame + reference subtraction + CM multiply when AOconf[loop].PIXSTREAMpipe = 1. \n
+ * WFS writer protocol (as in COREMOD_MEMORY_PixMapDecode_U): after writing slice s, cnt1 = s and semaphore 2 is posted;
+ * cnt0 is incremented when the last slice is written.\n
+ * Normalization is linear, so each slice only needs dark subtraction: \n
+ *     out = CM.(w/(T+floor) - T/(T+floor) ref) = 1/(T+floor) sum_slice CM[:,slice].w[slice]  - T/(T+floor) CM.ref \n
+ * with total flux T known after the last slice. Only the final scaling is left after readout.
+ * 
+ * @return 0 if OK, -1 if pipeline is not available
+ */
+static int AOcompute_pixstream(long loop, int normalize)
+{
+	long sizeWFS = AOconf[loop].sizeWFS;
+	uint64_t cnt0start;
+	long snext = 0;
+	long ii, k;
+	double IMTOTAL = 0.0;
+	float totalinv;
+	IMAGE *wfsim;
+	
+	if(pixstreampipe_init == 0)
+	{
+		if(AOcompute_pixstream_setup(loop) != 0)
+		{
+			AOconf[loop].PIXSTREAMpipe = 0;
+			return(-1);
+		}
+		pixstreampipe_init = 1;
+	}
+	AOcompute_pixstream_updateCM(loop);
+	
+	wfsim = &data.image[aoconfID_wfsim];
+	
+	AOconf[loop].status = 20;  // 020: WAIT FOR IMAGE
+	clock_gettime(CLOCK_REALTIME, &tnow);
+	tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+	tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+	data.image[aoconfID_looptiming].array.F[20] = tdiffv;
+	
+	cnt0start = AOconf[loop].WFScnt;
+	data.image[aoconfID_imWFS0].md[0].write = 1;
+	while(snext < pixstreampipe_NBslice)
+	{
+		uint64_t cnt0 = __atomic_load_n(&wfsim->md[0].cnt0, __ATOMIC_ACQUIRE);
+		uint64_t cnt1 = __atomic_load_n(&wfsim->md[0].cnt1, __ATOMIC_ACQUIRE);
+		long slast;      // last slice available
+		long slice;
+		
+		if(cnt0 != cnt0start)
+			slast = pixstreampipe_NBslice-1;
+		else if(cnt1 < (uint64_t) (pixstreampipe_NBslice-1))
+			slast = (long) cnt1;
+		else
+			slast = -1;  // previous frame complete, new frame not started
+		
+		if(slast < snext)
+		{
+			if(wfsim->md[0].sem > 2)
+			{
+				struct timespec ts;
+				
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_nsec += 1000000;
+				if(ts.tv_nsec >= 1000000000)
+				{
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				sem_timedwait(wfsim->semptr[2], &ts);
+			}
+			continue;
+		}
+		
+		if(snext == 0) // first slice: starting point for the loop
+		{
+			AOconf[loop].status = 1;
+			clock_gettime(CLOCK_REALTIME, &tnow);
+			tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+			tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+			data.image[aoconfID_looptiming].array.F[0] = tdiffv;
+			data.image[aoconfID_looptiming].md[0].atime.ts = tnow;
+			AOconf[loop].status = 5; // 5 MULTIPLYING BY CONTROL MATRIX -> MODE VALUES
+		}
+		
+		for(slice=snext; slice<=slast; slice++)
+		{
+			long nbpix = pixstreampipe_nbpix[slice];
+			long *pixindex = pixstreampipe_pixindex + pixstreampipe_pixoffset[slice];
+			float *imWFS0 = data.image[aoconfID_imWFS0].array.F;
+			
+			for(k=0; k<nbpix; k++)
+			{
+				long pix = pixindex[k];
+				float val;
+				
+				if(wfsim->md[0].atype == _DATATYPE_UINT16)
+					val = (float) wfsim->array.UI16[pix];
+				else
+					val = wfsim->array.F[pix];
+				if(pixstreampipe_IDdark != -1)
+					val -= data.image[pixstreampipe_IDdark].array.F[pix];
+				
+				imWFS0[pix] = val;
+				pixstreampipe_wslice[k] = val;
+				if(aoconfID_wfsmask != -1)
+					IMTOTAL += val*data.image[aoconfID_wfsmask].array.F[pix];
+				else
+					IMTOTAL += val;
+			}
+			
+			if(nbpix > 0)
+				cblas_sgemv(CblasRowMajor, CblasNoTrans, pixstreampipe_m, nbpix, 1.0, pixstreampipe_CM + pixstreampipe_m*pixstreampipe_pixoffset[slice], nbpix, pixstreampipe_wslice, 1, (slice==0) ? 0.0 : 1.0, pixstreampipe_acc, 1);
+			else if(slice == 0)
+				memset(pixstreampipe_acc, 0, sizeof(float)*pixstreampipe_m);
+		}
+		snext = slast+1;
+	}
+	AOconf[loop].WFScnt = wfsim->md[0].cnt0;
+	
+	
+	// final scaling
+	AOconf[loop].WFStotalflux = IMTOTAL;
+	if(normalize==1)
+	{
+		totalinv = 1.0/(AOconf[loop].WFStotalflux + AOconf[loop].WFSnormfloor*AOconf[loop].sizeWFS);
+		normfloorcoeff = AOconf[loop].WFStotalflux / (AOconf[loop].WFStotalflux + AOconf[loop].WFSnormfloor*AOconf[loop].sizeWFS);
+	}
+	else
+	{
+		totalinv = 1.0;
+		normfloorcoeff = 1.0;
+	}
+	GPU_alpha = totalinv;
+	GPU_beta = -normfloorcoeff;
+	
+	data.image[pixstreampipe_IDout].md[0].write = 1;
+	for(k=0; k<pixstreampipe_m; k++)
+		data.image[pixstreampipe_IDout].array.F[k] = totalinv*pixstreampipe_acc[k] - normfloorcoeff*pixstreampipe_CMref[k];
+	COREMOD_MEMORY_image_set_sempost_byID(pixstreampipe_IDout, -1);
+	data.image[pixstreampipe_IDout].md[0].cnt0 ++;
+	data.image[pixstreampipe_IDout].md[0].write = 0;
+	if(pixstreampipe_IDout != aoconfID_meas_modes) // CMMODE = 1: meas_modes counter still triggers downstream processes
+	{
+		COREMOD_MEMORY_image_set_sempost_byID(aoconfID_meas_modes, -1);
+		data.image[aoconfID_meas_modes].md[0].cnt0 ++;
+	}
+	
+	
+	// telemetry streams, updated after the output is posted
+	COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0, -1);
+	data.image[aoconfID_imWFS0].md[0].cnt0 ++;
+	data.image[aoconfID_imWFS0].md[0].write = 0;
+	
+	if(aoconfID_imWFS0tot != -1)
+	{
+		data.image[aoconfID_imWFS0tot].array.F[0] = IMTOTAL;
+		COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0tot, -1);
+		data.image[aoconfID_imWFS0tot].md[0].cnt0 ++;
+	}
+	
+	data.image[aoconfID_imWFS1].md[0].write = 1;
+	data.image[aoconfID_imWFS2].md[0].write = 1;
+	for(ii=0; ii<sizeWFS; ii++)
+	{
+		data.image[aoconfID_imWFS1].array.F[ii] = data.image[aoconfID_imWFS0].array.F[ii]*totalinv;
+		data.image[aoconfID_imWFS2].array.F[ii] = data.image[aoconfID_imWFS1].array.F[ii] - normfloorcoeff*data.image[aoconfID_wfsref].array.F[ii];
+	}
+	COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS1, -1);
+	data.image[aoconfID_imWFS1].md[0].cnt0 ++;
+	data.image[aoconfID_imWFS1].md[0].write = 0;
+	COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS2, -1);
+	data.image[aoconfID_imWFS2].md[0].cnt0 ++;
+	data.image[aoconfID_imWFS2].md[0].write = 0;
+	
+	return(0);
+}
+
 
-        for(j=0; j<AOconf[loop].sizeDM; j++)
-            arrayf[j] = 0.0;
 
-        for(i=0; i<AOconf[loop].sizeDM; i++)
-            for(k=0; k < AOconf[loop].NBDMmodes; k++)
-                arrayf[i] += data.image[aoconfID_cmd_modes].array.F[k] * data.image[aoconfID_DMmodes].array.F[k*AOconf[loop].sizeDM+i];
 
-        data.image[aoconfID_dmC].md[0].write = 1;
-        memcpy (data.image[aoconfID_dmC].array.F, arrayf, sizeof(float)*AOconf[loop].sizeDM);
-        if(data.image[aoconfID_dmC].md[0].sem > 0)
-        {
-            sem_getvalue(data.image[aoconfID_dmC].semptr[0], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[aoconfID_dmC].semptr[0]);
-        }
-        data.image[aoconfID_dmC].md[0].cnt0++;
-        data.image[aoconfID_dmC].md[0].write = 0;
+/**
+ * @brief Modal filter kernel for one block of modes: gain, limit and mult factor, in a single branchless pass
+ *
+ * cmd = mult_blk * mult[k] * clip( cmd - gain_blk * gain[k] * meas, limit_blk * limit[k] )\n
+ * Also updates RMS and average of measured mode values, and counts mode values at limit.
+ *
+ * @return sum of squared measured mode values
+ */
+static inline float AOcompute_modefilt_block(const float * restrict meas, float * restrict cmd, float * restrict rms, float * restrict ave,
+        const float * restrict gain, const float * restrict limit, const float * restrict mult,
+        float blkgain, float blklimit, float blkmult, long n, long *NBclip)
+{
+    float rmssum = 0.0;
+    long nclip = 0;
+    long k;
 
-        free(arrayf);
-    }
-    else
+    #pragma omp simd reduction(+:rmssum,nclip)
+    for(k=0; k<n; k++)
     {
-#ifdef HAVE_CUDA
-
-
-        GPU_loop_MultMat_setup(1, data.image[aoconfID_DMmodes].name, data.image[aoconfID_cmd_modes].name, data.image[aoconfID_dmC].name, AOconf[loop].GPU1, GPUset1, 1, AOconf[loop].GPUusesem, 1, loop);
-        AOconf[loop].status = 12;
-        clock_gettime(CLOCK_REALTIME, &tnow);
-        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-        data.image[aoconfID_looptiming].array.F[12] = tdiffv;
+        float mval = meas[k];
+        float limitval = blklimit*limit[k];
+        float cval = cmd[k] - blkgain*gain[k]*mval;
+        float cvalclip = (cval < -limitval) ? -limitval : cval; // compiles to min/max, vectorizes without -ffast-math
+        cvalclip = (cvalclip > limitval) ? limitval : cvalclip;
 
-        GPU_loop_MultMat_execute(1, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], 1.0, 0.0, 1);
-#endif
+        rmssum += mval*mval;
+        rms[k] = 0.99f*rms[k] + 0.01f*mval*mval;
+        ave[k] = 0.99f*ave[k] + 0.01f*mval;
+        nclip += (cvalclip != cval);
+        cmd[k] = cvalclip*blkmult*mult[k];
     }
+    *NBclip = nclip;
 
-    if(aoconfID_dmdisp!=-1)
-        if(data.image[aoconfID_dmdisp].md[0].sem > 1)
-        {
-            sem_getvalue(data.image[aoconfID_dmdisp].semptr[1], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[aoconfID_dmdisp].semptr[1]);
-        }
-
-    AOconf[loop].DMupdatecnt ++;
-
-    return(0);
+    return(rmssum);
 }
 
 
 
-
-
-
-
-
-int_fast8_t set_DM_modesRM(long loop)
+/**
+ * @brief Apply modal gains, limits and mult factors to measured mode values (CMMODE = 0)
+ *
+ * Modes of a block are contiguous (AOloopControl_loadconfigure), so block gain, limit and mult are combined with loop
+ * scalars once per block, and per-mode arrays are processed as contiguous vectors (AOcompute_modefilt_block).\n
+ * Number of mode values at limit is accumulated per block in AOconf[loop].modeclipcnt_block[].
+ */
+static void AOcompute_applygains(long loop)
 {
-    long k;
-    long i, j;
-    float *arrayf;
-
-
-    arrayf = (float*) malloc(sizeof(float)*AOconf[loop].sizeDM);
-
-    for(j=0; j<AOconf[loop].sizeDM; j++)
-        arrayf[j] = 0.0;
+    AOconf[loop].status = 11; // 11 MULTIPLYING BY GAINS
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+    tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+    data.image[aoconfID_looptiming].array.F[11] = tdiffv;
 
-    for(k=0; k < AOconf[loop].NBDMmodes; k++)
+    if(AOconf[loop].CMMODE==0)
     {
-        for(i=0; i<AOconf[loop].sizeDM; i++)
-            arrayf[i] += data.image[aoconfID_cmd_modesRM].array.F[k] * data.image[aoconfID_DMmodes].array.F[k*AOconf[loop].sizeDM+i];
-    }
+        long block;
+        long mstart = 0;
+        long NBclip;
+        float rmssum = 0.0;
 
+        for(block=0; block<AOconf[loop].DMmodesNBblock; block++)
+        {
+            long n = AOconf[loop].NBmodes_block[block];
 
-    data.image[aoconfID_dmRM].md[0].write = 1;
-    memcpy (data.image[aoconfID_dmRM].array.F, arrayf, sizeof(float)*AOconf[loop].sizeDM);
-    data.image[aoconfID_dmRM].md[0].cnt0++;
-    data.image[aoconfID_dmRM].md[0].write = 0;
-
-    free(arrayf);
-    AOconf[loop].DMupdatecnt ++;
+            if(mstart+n > AOconf[loop].NBDMmodes)
+                n = AOconf[loop].NBDMmodes - mstart;
+            if(n <= 0)
+                break;
 
-    return(0);
-}
+            rmssum += AOcompute_modefilt_block(data.image[aoconfID_meas_modes].array.F + mstart, data.image[aoconfID_cmd_modes].array.F + mstart,
+                                               data.image[aoconfID_RMS_modes].array.F + mstart, data.image[aoconfID_AVE_modes].array.F + mstart,
+                                               data.image[aoconfID_DMmode_GAIN].array.F + mstart, data.image[aoconfID_LIMIT_modes].array.F + mstart,
+                                               data.image[aoconfID_MULTF_modes].array.F + mstart,
+                                               AOconf[loop].gain * data.image[aoconfID_gainb].array.F[block],
+                                               AOconf[loop].maxlimit * data.image[aoconfID_limitb].array.F[block],
+                                               AOconf[loop].mult * data.image[aoconfID_multfb].array.F[block],
+                                               n, &NBclip);
+            AOconf[loop].modeclipcnt_block[block] += NBclip;
+            mstart += n;
+        }
 
+        for(; mstart<AOconf[loop].NBDMmodes; mstart++) // modes not covered by block sizes, if any
+        {
+            block = AOconf[loop].modeBlockIndex[mstart];
+            rmssum += AOcompute_modefilt_block(data.image[aoconfID_meas_modes].array.F + mstart, data.image[aoconfID_cmd_modes].array.F + mstart,
+                                               data.image[aoconfID_RMS_modes].array.F + mstart, data.image[aoconfID_AVE_modes].array.F + mstart,
+                                               data.image[aoconfID_DMmode_GAIN].array.F + mstart, data.image[aoconfID_LIMIT_modes].array.F + mstart,
+                                               data.image[aoconfID_MULTF_modes].array.F + mstart,
+                                               AOconf[loop].gain * data.image[aoconfID_gainb].array.F[block],
+                                               AOconf[loop].maxlimit * data.image[aoconfID_limitb].array.F[block],
+                                               AOconf[loop].mult * data.image[aoconfID_multfb].array.F[block],
+                                               1, &NBclip);
+            AOconf[loop].modeclipcnt_block[block] += NBclip;
+        }
 
+        AOconf[loop].RMSmodes = rmssum;
+        AOconf[loop].RMSmodesCumul += AOconf[loop].RMSmodes;
+        AOconf[loop].RMSmodesCumulcnt ++;
 
+        data.image[aoconfID_cmd_modes].md[0].cnt0 ++;
+    }
+    AOloopControl_looptiming_mark(AOLTIMING_MODEFILT);
+}
 
 
 
@@ -3368,9 +5611,21 @@ int_fast8_t AOcompute(long loop, int normalize)
     int slice;
     int semnb;
     int semval;
+#ifdef HAVE_CUDA
+    long CMswapcnt0; // control matrix counter of hot swapped matrix, -1 if no swap
+#endif
 
 	
 
+	// pipelined mode: CM multiply overlapped with WFS slice readout
+	if(AOconf[loop].PIXSTREAMpipe == 1)
+		if(AOcompute_pixstream(loop, normalize) == 0)
+		{
+			AOloopControl_looptiming_mark(AOLTIMING_MVM); // wait, read, dark and normalize are fused in MVM stage
+			AOcompute_applygains(loop);
+			return(0);
+		}
+
     // waiting for dark-subtracted image
     AOconf[loop].status = 19;  //  19: WAITING FOR IMAGE
     clock_gettime(CLOCK_REALTIME, &tnow);
@@ -3415,6 +5670,7 @@ int_fast8_t AOcompute(long loop, int normalize)
         data.image[aoconfID_imWFS2].md[0].cnt0 ++;
         data.image[aoconfID_imWFS2].md[0].write = 0;
     }
+    AOloopControl_looptiming_mark(AOLTIMING_NORM);
 
 
     AOconf[loop].status = 5; // 5 MULTIPLYING BY CONTROL MATRIX -> MODE VALUES
@@ -3544,7 +5800,7 @@ int_fast8_t AOcompute(long loop, int normalize)
 #endif
 
             data.image[aoconfID_meas_modes].md[0].write = 1;
-            ControlMatrixMultiply( data.image[aoconfID_contrM].array.F, data.image[aoconfID_imWFS2].array.F, AOconf[loop].NBDMmodes, AOconf[loop].sizeWFS, data.image[aoconfID_meas_modes].array.F);
+            ControlMatrixMultiply_active(loop, aoconfID_contrM, AOconf[loop].NBDMmodes, data.image[aoconfID_meas_modes].array.F);
             COREMOD_MEMORY_image_set_sempost_byID(aoconfID_meas_modes, -1);
             data.image[aoconfID_meas_modes].md[0].cnt0 ++;
             data.image[aoconfID_meas_modes].md[0].write = 0;
@@ -3557,7 +5813,7 @@ int_fast8_t AOcompute(long loop, int normalize)
 #endif
 
             data.image[aoconfID_meas_modes].md[0].write = 1;
-            ControlMatrixMultiply( data.image[aoconfID_contrMc].array.F, data.image[aoconfID_imWFS2].array.F, AOconf[loop].sizeDM, AOconf[loop].sizeWFS, data.image[aoconfID_meas_act].array.F);
+            ControlMatrixMultiply_active(loop, aoconfID_contrMc, AOconf[loop].sizeDM, data.image[aoconfID_meas_act].array.F);
             data.image[aoconfID_meas_modes].md[0].cnt0 ++;
             COREMOD_MEMORY_image_set_sempost_byID(aoconfID_meas_modes, -1);
             data.image[aoconfID_meas_modes].md[0].cnt0 ++;
@@ -3576,10 +5832,22 @@ int_fast8_t AOcompute(long loop, int normalize)
 
             initWFSref_GPU[PIXSTREAM_SLICE] = 1; // default: do not re-compute reference output
 
+            GPU_loop_MultMat_async(0, AOconf[loop].GPUasync);
+            GPU_loop_MultMat_balance(0, AOconf[loop].GPUbalance);
+            GPU_loop_MultMat_tunefile("./conf/GPUtune.txt");
+            GPU_loop_MultMat_failover(0, AOconf[loop].GPUfailover, 4);
+
+            // control matrix hot swap: matrix uploaded in background is swapped in here, at frame boundary
+            CMswapcnt0 = -1;
+            if(GPU_loop_MultMat_CMhotswap(0, (AOconf[loop].CMhotswap == 1) ? 2 : 0) == 0)
+                if((CMswapcnt0 = GPU_loop_MultMat_CMswap(0)) != -1)
+                    AOloopControl_CMhotswap_record(loop, CMswapcnt0);
+
             if(AOconf[loop].GPUall == 1)
             {
-                // TEST IF contrM or wfsref have changed
-                if((data.image[aoconfID_wfsref].md[0].cnt0 != aoconfcnt0_wfsref_current) || (data.image[aoconfID_contrM].md[0].cnt0 != aoconfcnt0_contrM_current))
+                // TEST IF contrM or wfsref have changed (with hot swap: when new contrM is swapped in)
+                if((data.image[aoconfID_wfsref].md[0].cnt0 != aoconfcnt0_wfsref_current) || (CMswapcnt0 != -1)
+                        || ((AOconf[loop].CMhotswap == 0) && (data.image[aoconfID_contrM].md[0].cnt0 != aoconfcnt0_contrM_current)))
 					{
 						printf("NEW wfsref [%10ld] or contrM [%10ld]\n", data.image[aoconfID_wfsref].md[0].cnt0, data.image[aoconfID_contrM].md[0].cnt0);
 						aoconfcnt0_wfsref_current = data.image[aoconfID_wfsref].md[0].cnt0;
@@ -3612,6 +5880,20 @@ int_fast8_t AOcompute(long loop, int normalize)
             else
                 GPU_loop_MultMat_setup(0, data.image[aoconfID_contrM].name, data.image[aoconfID_imWFS2].name, data.image[aoconfID_meas_modes].name, AOconf[loop].GPU0, GPUset0, 0, AOconf[loop].GPUusesem, 1, loop);
 
+            // zero-copy: next frames are read by GPU from camera stream, Read_cam_frame only waits for them
+            if((AOconf[loop].GPUzerocopy == 1)&&(AOconf[loop].GPUall == 1))
+            {
+                char dname[200];
+
+                if(sprintf(dname, "aol%ld_wfsdark", loop) < 1)
+                    printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                AOconf[loop].GPUzerocopyON = (GPU_loop_MultMat_zerocopy(0, data.image[aoconfID_wfsim].name, dname, (aoconfID_wfsmask != -1) ? data.image[aoconfID_wfsmask].name : "", normalize, AOconf[loop].WFSnormfloor) == 0) ? 1 : 0;
+                if(AOconf[loop].GPUzerocopyON == 0)
+                    AOconf[loop].GPUzerocopy = 0; // not supported by this configuration: do not retry
+            }
+            else
+                AOconf[loop].GPUzerocopyON = 0;
+
             initWFSref_GPU[PIXSTREAM_SLICE] = 1;
 
             AOconf[loop].status = 6; // 6 execute
@@ -3625,6 +5907,13 @@ int_fast8_t AOcompute(long loop, int normalize)
                 GPU_loop_MultMat_execute(0, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], GPU_alpha, GPU_beta, 1);
             else
                 GPU_loop_MultMat_execute(0, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], 1.0, 0.0, 1);
+            AOconf[loop].GPUfailovercnt = GPU_loop_MultMat_failover_count(0);
+
+            if(AOconf[loop].GPUzerocopyON == 1)
+            {
+                Read_cam_frame_zerocopy_end(loop); // result already published: torn frames are counted, not recomputed
+                AOconf[loop].WFStotalflux = GPU_loop_MultMat_zerocopy_flux(0);
+            }
         }
         else // direct pixel -> actuators linear transformation
         {
@@ -3675,9 +5964,20 @@ int_fast8_t AOcompute(long loop, int normalize)
                 }
 
                 // look for updated control matrix or reference
+                GPU_loop_MultMat_async(0, AOconf[loop].GPUasync);
+                GPU_loop_MultMat_balance(0, AOconf[loop].GPUbalance);
+                GPU_loop_MultMat_tunefile("./conf/GPUtune.txt");
+                GPU_loop_MultMat_failover(0, AOconf[loop].GPUfailover, 4);
+
+                CMswapcnt0 = -1;
+                if(GPU_loop_MultMat_CMhotswap(0, (AOconf[loop].CMhotswap == 1) ? 2 : 0) == 0)
+                    if((CMswapcnt0 = GPU_loop_MultMat_CMswap(0)) != -1)
+                        AOloopControl_CMhotswap_record(loop, CMswapcnt0);
+
                 if(AOconf[loop].GPUall == 1) // (**)
                 {
-                    if(data.image[aoconfID_contrMcact[PIXSTREAM_SLICE]].md[0].cnt0 != contrMcactcnt0[PIXSTREAM_SLICE])
+                    if(((AOconf[loop].CMhotswap == 0) && (data.image[aoconfID_contrMcact[PIXSTREAM_SLICE]].md[0].cnt0 != contrMcactcnt0[PIXSTREAM_SLICE]))
+                            || (CMswapcnt0 != -1))
                     {
                         printf("NEW CONTROL MATRIX DETECTED (%s) -> RECOMPUTE REFERENCE x MATRIX\n", data.image[aoconfID_contrMcact[PIXSTREAM_SLICE]].md[0].name);
                         fflush(stdout);
@@ -3728,6 +6028,7 @@ int_fast8_t AOcompute(long loop, int normalize)
                     GPU_loop_MultMat_execute(0, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], GPU_alpha, GPU_beta, 1);
                 else
                     GPU_loop_MultMat_execute(0, &AOconf[loop].status, &AOconf[loop].GPUstatus[0], 1.0, 0.0, 1);
+                AOconf[loop].GPUfailovercnt = GPU_loop_MultMat_failover_count(0);
 
                 // re-map output vector
                 data.image[aoconfID_meas_act].md[0].write = 1;
@@ -3747,63 +6048,8 @@ int_fast8_t AOcompute(long loop, int normalize)
 #endif
     }
 
-    AOconf[loop].status = 11; // 11 MULTIPLYING BY GAINS
-    clock_gettime(CLOCK_REALTIME, &tnow);
-    tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
-    tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-    data.image[aoconfID_looptiming].array.F[11] = tdiffv;
-
-    if(AOconf[loop].CMMODE==0)
-    {
-		int block;
-		long k;
-		
-		
-        AOconf[loop].RMSmodes = 0;
-        for(k=0; k<AOconf[loop].NBDMmodes; k++)
-            AOconf[loop].RMSmodes += data.image[aoconfID_meas_modes].array.F[k]*data.image[aoconfID_meas_modes].array.F[k];
-
-        AOconf[loop].RMSmodesCumul += AOconf[loop].RMSmodes;
-        AOconf[loop].RMSmodesCumulcnt ++;
-
-	
-
-        for(k=0; k<AOconf[loop].NBDMmodes; k++)
-        {	
-            data.image[aoconfID_RMS_modes].array.F[k] = 0.99*data.image[aoconfID_RMS_modes].array.F[k] + 0.01*data.image[aoconfID_meas_modes].array.F[k]*data.image[aoconfID_meas_modes].array.F[k];
-            data.image[aoconfID_AVE_modes].array.F[k] = 0.99*data.image[aoconfID_AVE_modes].array.F[k] + 0.01*data.image[aoconfID_meas_modes].array.F[k];
-			
-			
-			// apply gain
-            
-            data.image[aoconfID_cmd_modes].array.F[k] -= AOconf[loop].gain * data.image[aoconfID_gainb].array.F[AOconf[loop].modeBlockIndex[k]] * data.image[aoconfID_DMmode_GAIN].array.F[k] * data.image[aoconfID_meas_modes].array.F[k];
-
-
-			// apply limits
-			
-			float limitval;
-			limitval = AOconf[loop].maxlimit * data.image[aoconfID_limitb].array.F[AOconf[loop].modeBlockIndex[k]] * data.image[aoconfID_LIMIT_modes].array.F[k];
-            
-            if(data.image[aoconfID_cmd_modes].array.F[k] < -limitval)
-                data.image[aoconfID_cmd_modes].array.F[k] = -limitval;
-
-            if(data.image[aoconfID_cmd_modes].array.F[k] > limitval)
-                data.image[aoconfID_cmd_modes].array.F[k] = limitval;
-
-
-			// apply mult factor
-			
-            data.image[aoconfID_cmd_modes].array.F[k] *= AOconf[loop].mult * data.image[aoconfID_multfb].array.F[AOconf[loop].modeBlockIndex[k]] * data.image[aoconfID_MULTF_modes].array.F[k];
-
-            
-            
-            // update total gain
-            //     data.image[aoconfID_DMmode_GAIN].array.F[k+AOconf[loop].NBDMmodes] = AOconf[loop].gain * data.image[aoconfID_DMmode_GAIN].array.F[k];
-        }
-
-
-        data.image[aoconfID_cmd_modes].md[0].cnt0 ++;
-    }
+    AOloopControl_looptiming_mark(AOLTIMING_MVM);
+    AOcompute_applygains(loop);
 
     return(0);
 }
@@ -3970,14 +6216,10 @@ int_fast8_t AOloopControl_GPUmodecoeffs2dm_filt_loop(const char *modecoeffs_name
 
 
     int RT_priority = 80; //any number from 0-99
-    struct sched_param schedpar;
 
 
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    sched_setscheduler(0, SCHED_FIFO, &schedpar);
-#endif
+    AOloopControl_RTsched_set(loop, AOLRTSCHED_DMFILT, RT_priority);
 
 
     // read AO loop gain, mult
@@ -4056,105 +6298,391 @@ int_fast8_t AOloopControl_GPUmodecoeffs2dm_filt_loop(const char *modecoeffs_name
             data.image[IDc].md[0].write = 0;
             data.image[IDc].md[0].cnt0++;
         }
-        AOconf[loop].statusM = 20;
+        AOconf[loop].statusM = 20;
+    }
+
+
+
+    free(GPUsetM);
+
+#endif
+
+    return(0);
+}
+
+
+
+
+
+// frame batch projection: cbuf[k*NBmodes+m] = modes[m].frame[k]/tot(frame[k]) - mref[m], one GEMM per batch
+static void AOloopControl_sig2Modecoeff_batch(const float *frames, long nb, long wfssize, const float *modes, long NBmodes, const float *mref, float *cbuf, double *mcoeff_ave, double *mcoeff_rms)
+{
+    long k;
+
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, nb, NBmodes, wfssize, 1.0, frames, wfssize, modes, wfssize, 0.0, cbuf, NBmodes);
+
+# ifdef _OPENMP
+    #pragma omp parallel for if (nb*wfssize>OMP_NELEMENT_LIMIT)
+# endif
+    for(k=0; k<nb; k++)
+    {
+        double totim = 0.0;
+        float invtot;
+        long ii, m;
+
+        for(ii=0; ii<wfssize; ii++)
+            totim += frames[k*wfssize+ii];
+        invtot = (float) (1.0/totim);
+        for(m=0; m<NBmodes; m++)
+            cbuf[k*NBmodes+m] = cbuf[k*NBmodes+m]*invtot - mref[m];
+    }
+
+    for(k=0; k<nb; k++)
+    {
+        long m;
+
+        for(m=0; m<NBmodes; m++)
+        {
+            mcoeff_ave[m] += cbuf[k*NBmodes+m];
+            mcoeff_rms[m] += cbuf[k*NBmodes+m]*cbuf[k*NBmodes+m];
+        }
+    }
+}
+
+
+typedef struct
+{
+    FITS_SLICEREADER *rd;
+    long k0;
+    long NBslice;
+    float *buf;
+    int status;
+} AOLOOPCONTROL_SIG2M_READ;
+
+static void *AOloopControl_sig2Modecoeff_read_thread(void *ptr)
+{
+    AOLOOPCONTROL_SIG2M_READ *sr = (AOLOOPCONTROL_SIG2M_READ*) ptr;
+
+    sr->status = fits_slicereader_read(sr->rd, sr->k0, sr->NBslice, sr->buf);
+
+    return NULL;
+}
+
+
+//
+// assumes the WFS mode basis is already orthogonall
+// removes reference from each frame (input frames and reference are left unchanged)
+//
+// frames are projected by batches of SIG2MCOEFF_BATCH with one GEMM (cuBLAS if variable SIG2MGPU is set to a GPU index)
+// if WFSim_name is not an image in memory, it is read from FITS file WFSim_name in chunks of SIG2MCOEFF_CHUNK bytes,
+// next chunk read while current chunk is processed
+// if outname ends with ".fits", coefficients are written incrementally to that file as a NBmodes x 1 x NBframes cube,
+// otherwise to image outname (NBframes x NBmodes)
+//
+long AOloopControl_sig2Modecoeff(const char *WFSim_name, const char *IDwfsref_name, const char *WFSmodes_name, const char *outname)
+{
+    long IDout = -1;
+    long IDwfs, IDmodes, IDwfsref;
+    long wfsxsize, wfsysize, wfssize, NBmodes, NBframes;
+    double totref;
+    long ii, m, kk;
+    FILE *fp;
+    double *mcoeff_ave;
+    double *mcoeff_rms;
+    float *refn;
+    float *mref;
+    float *cbuf;
+    long chunk;
+    long k0;
+    int err = 0;
+    int fileout = 0;
+    FITS_SLICEREADER *rd = NULL;
+    FITS_SLICEWRITER *wr = NULL;
+    float *buf[2];
+    AOLOOPCONTROL_SIG2M_READ sr[2];
+    int c = 0;
+    size_t len;
+#ifdef HAVE_CUDA
+    long IDvar;
+#endif
+
+
+    IDmodes = image_ID(WFSmodes_name);
+    IDwfsref = image_ID(IDwfsref_name);
+    IDwfs = image_ID(WFSim_name);
+    if(IDwfs != -1)
+    {
+        wfsxsize = data.image[IDwfs].md[0].size[0];
+        wfsysize = data.image[IDwfs].md[0].size[1];
+        NBframes = data.image[IDwfs].md[0].size[2];
+    }
+    else
+    {
+        long naxis;
+        uint32_t naxes[3];
+
+        if((rd = fits_slicereader_open(WFSim_name, &naxis, naxes)) == NULL)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "input signal cube not in memory and not a readable FITS file");
+            return(-1);
+        }
+        wfsxsize = naxes[0];
+        wfsysize = naxes[1];
+        NBframes = naxes[2];
+    }
+    wfssize = wfsxsize*wfsysize;
+
+    if((IDmodes == -1)||(IDwfsref == -1)||(data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1] != wfssize)||(data.image[IDwfsref].md[0].nelement != wfssize))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "WFS modes / reference missing or size mismatch");
+        if(rd != NULL)
+            fits_slicereader_close(rd);
+        return(-1);
+    }
+    NBmodes = data.image[IDmodes].md[0].size[2];
+
+    mcoeff_ave = (double*) calloc(NBmodes, sizeof(double));
+    mcoeff_rms = (double*) calloc(NBmodes, sizeof(double));
+    refn = (float*) malloc(sizeof(float)*wfssize);
+    mref = (float*) malloc(sizeof(float)*NBmodes);
+
+
+    totref = 0.0;
+    for(ii=0; ii<wfssize; ii++)
+        totref += data.image[IDwfsref].array.F[ii];
+    for(ii=0; ii<wfssize; ii++)
+        refn[ii] = data.image[IDwfsref].array.F[ii]/totref;
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, NBmodes, wfssize, 1.0, data.image[IDmodes].array.F, wfssize, refn, 1, 0.0, mref, 1);
+    free(refn);
+
+
+    len = strlen(outname);
+    if((len > 5)&&(strcmp(outname+len-5, ".fits") == 0))
+    {
+        fileout = 1;
+        if((wr = fits_slicewriter_open(outname, NBmodes, 1, NBframes)) == NULL)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "cannot create output file");
+            err = -1;
+        }
+    }
+    else
+        IDout = create_2Dimage_ID(outname, NBframes, NBmodes);
+
+
+    chunk = SIG2MCOEFF_BATCH;
+    if(rd != NULL) // file input: chunk = whole number of batches
+    {
+        chunk = SIG2MCOEFF_CHUNK/(sizeof(float)*wfssize)/SIG2MCOEFF_BATCH*SIG2MCOEFF_BATCH;
+        if(chunk < SIG2MCOEFF_BATCH)
+            chunk = SIG2MCOEFF_BATCH;
+    }
+    if(chunk > NBframes)
+        chunk = NBframes;
+    cbuf = (float*) malloc(sizeof(float)*chunk*NBmodes);
+
+    if(rd != NULL)
+    {
+        buf[0] = (float*) malloc(sizeof(float)*wfssize*chunk);
+        buf[1] = (float*) malloc(sizeof(float)*wfssize*chunk);
+        if((buf[0]==NULL)||(buf[1]==NULL)||(cbuf==NULL))
+        {
+            printERROR(__FILE__, __func__, __LINE__, "malloc error");
+            exit(0);
+        }
+        sr[0].rd = rd;
+        sr[0].k0 = 0;
+        sr[0].NBslice = chunk;
+        sr[0].buf = buf[0];
+        AOloopControl_sig2Modecoeff_read_thread(&sr[0]);
     }
 
+#ifdef HAVE_CUDA
+    // GPU: raw projections of in-memory cube, normalization applied below
+    IDvar = variable_ID("SIG2MGPU");
+    if((IDvar != -1)&&(IDwfs != -1)&&(fileout == 0)&&(err == 0))
+    {
+        long IDraw;
 
+        if(CUDACOMP_extractModesBatch(WFSim_name, WFSmodes_name, "", "_sig2mcoeff_raw", (int) (data.variable[IDvar].value.f), SIG2MCOEFF_BATCH) == 0)
+        {
+            IDraw = image_ID("_sig2mcoeff_raw");
+            for(kk=0; kk<NBframes; kk++)
+            {
+                double totim = 0.0;
 
-    free(GPUsetM);
+                for(ii=0; ii<wfssize; ii++)
+                    totim += data.image[IDwfs].array.F[kk*wfssize+ii];
+                for(m=0; m<NBmodes; m++)
+                {
+                    float coeff = data.image[IDraw].array.F[kk*NBmodes+m]/totim - mref[m];
 
+                    data.image[IDout].array.F[m*NBframes+kk] = coeff;
+                    mcoeff_ave[m] += coeff;
+                    mcoeff_rms[m] += coeff*coeff;
+                }
+            }
+            delete_image_ID("_sig2mcoeff_raw");
+            k0 = NBframes; // done
+        }
+        else
+            k0 = 0;
+    }
+    else
+        k0 = 0;
+#else
+    k0 = 0;
 #endif
 
-    return(0);
-}
+    for(; (k0<NBframes)&&(err==0); k0+=chunk)
+    {
+        long nb = (k0+chunk < NBframes) ? chunk : NBframes-k0;
+        const float *frames;
+        pthread_t thread;
+        int readahead = 0;
+        long b0;
 
+        if(rd != NULL)
+        {
+            if(sr[c].status != 0)
+            {
+                printERROR(__FILE__, __func__, __LINE__, "read error");
+                err = -1;
+                break;
+            }
+            if(k0+chunk < NBframes)
+            {
+                sr[1-c].rd = rd;
+                sr[1-c].k0 = k0+chunk;
+                sr[1-c].NBslice = (k0+2*chunk < NBframes) ? chunk : NBframes-k0-chunk;
+                sr[1-c].buf = buf[1-c];
+                if(pthread_create(&thread, NULL, AOloopControl_sig2Modecoeff_read_thread, &sr[1-c]) == 0)
+                    readahead = 1;
+                else
+                    AOloopControl_sig2Modecoeff_read_thread(&sr[1-c]);
+            }
+            frames = buf[c];
+        }
+        else
+            frames = data.image[IDwfs].array.F + k0*wfssize;
 
+        for(b0=0; b0<nb; b0+=SIG2MCOEFF_BATCH)
+        {
+            long bn = (b0+SIG2MCOEFF_BATCH < nb) ? SIG2MCOEFF_BATCH : nb-b0;
 
+            AOloopControl_sig2Modecoeff_batch(frames + b0*wfssize, bn, wfssize, data.image[IDmodes].array.F, NBmodes, mref, cbuf + b0*NBmodes, mcoeff_ave, mcoeff_rms);
+        }
 
+        if(fileout == 1)
+        {
+            if(fits_slicewriter_write(wr, k0, nb, cbuf) != 0)
+            {
+                printERROR(__FILE__, __func__, __LINE__, "write error");
+                err = -1;
+            }
+        }
+        else
+            for(m=0; m<NBmodes; m++)
+                for(kk=0; kk<nb; kk++)
+                    data.image[IDout].array.F[m*NBframes+k0+kk] = cbuf[kk*NBmodes+m];
 
-//
-// assumes the WFS mode basis is already orthogonall
-// removes reference from each frame
-//
-long AOloopControl_sig2Modecoeff(const char *WFSim_name, const char *IDwfsref_name, const char *WFSmodes_name, const char *outname)
-{
-    long IDout;
-    long IDwfs, IDmodes, IDwfsref;
-    long wfsxsize, wfsysize, wfssize, NBmodes, NBframes;
-    double totref;
-    float coeff;
-    long ii, m, kk;
-    FILE *fp;
-    double *mcoeff_ave;
-    double *mcoeff_rms;
+        if(readahead == 1)
+            pthread_join(thread, NULL);
+        c = 1-c;
+    }
 
+    if(rd != NULL)
+    {
+        free(buf[0]);
+        free(buf[1]);
+        fits_slicereader_close(rd);
+    }
+    if((wr != NULL)&&(fits_slicewriter_close(wr) != 0))
+        err = -1;
+    free(cbuf);
+    free(mref);
 
-    IDwfs = image_ID(WFSim_name);
-    wfsxsize = data.image[IDwfs].md[0].size[0];
-    wfsysize = data.image[IDwfs].md[0].size[1];
-    NBframes = data.image[IDwfs].md[0].size[2];
-    wfssize = wfsxsize*wfsysize;
 
+    if(err == 0)
+    {
+        fp  = fopen("mode_stats.txt", "w");
+        for(m=0; m<NBmodes; m++)
+        {
+            mcoeff_rms[m] = sqrt( mcoeff_rms[m]/NBframes );
+            mcoeff_ave[m] /= NBframes;
+            fprintf(fp, "%4ld  %12g %12g\n", m, mcoeff_ave[m], mcoeff_rms[m]);
+        }
+        fclose(fp);
+    }
 
+    free(mcoeff_ave);
+    free(mcoeff_rms);
 
+    return((err == 0) ? IDout : -1);
+}
 
-    IDwfsref = image_ID(IDwfsref_name);
 
-    IDmodes = image_ID(WFSmodes_name);
-    NBmodes = data.image[IDmodes].md[0].size[2];
 
-    mcoeff_ave = (double*) malloc(sizeof(double)*NBmodes);
-    mcoeff_rms = (double*) malloc(sizeof(double)*NBmodes);
 
+/**
+ * @brief Delays and interpolation weight for fractional frame latency
+ *
+ * DM state at WFS measurement time = (1-alpha) * command[n-latency0] + alpha * command[n-latency1].\n
+ * Latency is clamped to circular buffer size.
+ */
+static void AOloopControl_OLmodes_latencyweights(float framelatency, long bsize, long *framelatency0, long *framelatency1, float *alpha)
+{
+    if(framelatency < 0.0)
+        framelatency = 0.0;
+    if(framelatency > bsize-2)
+    {
+        printf("WARNING: frame latency %f exceeds circular buffer size %ld -> clamped\n", framelatency, bsize);
+        framelatency = bsize-2;
+    }
+    *framelatency0 = (long) framelatency;
+    *framelatency1 = *framelatency0 + 1;
+    *alpha = framelatency - *framelatency0;
+}
 
 
-    IDout = create_2Dimage_ID(outname, NBframes, NBmodes);
 
-    totref = 0.0;
+/**
+ * @brief Open loop mode reconstruction, single pass over modes
+ *
+ * Stores current filtered DM command in circular buffer slot, interpolates delayed DM state with precomputed weights,
+ * and subtracts it from WFS measurement. If pfC0 != NULL, also interpolates delayed prediction and computes prediction residual.
+ */
+static void AOloopControl_OLmodes_update(long NBmodes, float w0, float w1,
+        const float * restrict modeval, const float * restrict dmnowfilt,
+        float *dmC, const float *dmC0, const float *dmC1,
+        float * restrict dmsync, float * restrict olmodes,
+        const float *pfC0, const float *pfC1, float * restrict pfsync, float * restrict pfres)
+{
+    long m;
 
-    for(ii=0; ii<wfssize; ii++)
-        totref += data.image[IDwfsref].array.F[ii];
-    for(ii=0; ii<wfssize; ii++)
-        data.image[IDwfsref].array.F[ii] /= totref;
+    // current slot is written first: with latency < 1 frame, dmC0 points to it
+    memcpy(dmC, dmnowfilt, sizeof(float)*NBmodes);
 
-    for(kk=0; kk<NBframes; kk++)
+    if(pfC0 == NULL)
     {
-		double totim = 0.0;
-		
-        for(ii=0; ii<wfssize; ii++)
-            totim += data.image[IDwfs].array.F[kk*wfssize+ii];
-        for(ii=0; ii<wfssize; ii++)
-        {
-            data.image[IDwfs].array.F[kk*wfssize+ii] /= totim;
-            data.image[IDwfs].array.F[kk*wfssize+ii] -= data.image[IDwfsref].array.F[ii];
-        }
-
-
+        #pragma omp simd
         for(m=0; m<NBmodes; m++)
         {
-            coeff = 0.0;
-            for(ii=0; ii<wfssize; ii++)
-                coeff += data.image[IDmodes].array.F[m*wfssize+ii] * data.image[IDwfs].array.F[kk*wfssize+ii];
-            data.image[IDout].array.F[m*NBframes+kk] = coeff;
-            mcoeff_ave[m] += coeff;
-            mcoeff_rms[m] += coeff*coeff;
+            dmsync[m] = w0*dmC0[m] + w1*dmC1[m];
+            olmodes[m] = modeval[m] - dmsync[m];
         }
     }
-
-
-    fp  = fopen("mode_stats.txt", "w");
-    for(m=0; m<NBmodes; m++)
+    else
     {
-        mcoeff_rms[m] = sqrt( mcoeff_rms[m]/NBframes );
-        mcoeff_ave[m] /= NBframes;
-        fprintf(fp, "%4ld  %12g %12g\n", m, mcoeff_ave[m], mcoeff_rms[m]);
+        #pragma omp simd
+        for(m=0; m<NBmodes; m++)
+        {
+            dmsync[m] = w0*dmC0[m] + w1*dmC1[m];
+            olmodes[m] = modeval[m] - dmsync[m];
+            pfsync[m] = w0*pfC0[m] + w1*pfC1[m];
+            pfres[m] = olmodes[m] - pfsync[m];
+        }
     }
-    fclose(fp);
-
-    free(mcoeff_ave);
-    free(mcoeff_rms);
-
-    return(IDout);
 }
 
 
@@ -4184,7 +6712,8 @@ long AOloopControl_sig2Modecoeff(const char *WFSim_name, const char *IDwfsref_na
  * - aol_wfsresm_ave
  * - aol_wfsres_rms
  * 
- * 
+ * @note With parameter WFSresinloop = 1, the main loop computes the same streams in its normalization pass
+ * (Read_cam_frame, averaged streams every WFSresdecim frames with coefficient WFSresalpha), and this process is not needed.
  * 
  */
 
@@ -4421,19 +6950,19 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 
 	long IDautogain = -1; // automatic gain input
 	long long autogainCnt = 0;
+	int autotunegains_last = 0; // AUTOTUNE_GAINS_ON at previous iteration
+	int ARPFon_last = 0; // ARPFon at previous iteration
+	long modevalPFretry = 0; // iterations since last connection attempt to modevalPF
+	long autogainretry = 0; // iterations since last connection attempt to autogain
 
     float coeff;
 
     int RT_priority = 80; //any number from 0-99
-    struct sched_param schedpar;
 
 	long long loopPFcnt;
 	FILE *fptest;
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    sched_setscheduler(0, SCHED_FIFO, &schedpar);
-#endif
+    AOloopControl_RTsched_set(loop, AOLRTSCHED_MODEFILT, RT_priority);
 
 
 
@@ -4711,9 +7240,7 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 
 
     framelatency = AOconf[loop].hardwlatency_frame + AOconf[loop].wfsmextrlatency_frame;
-    framelatency0 = (long) framelatency;
-    framelatency1 = framelatency0 + 1;
-    alpha = framelatency - framelatency0;
+    AOloopControl_OLmodes_latencyweights(framelatency, modeval_bsize, &framelatency0, &framelatency1, &alpha);
 
     // initialize arrays
     data.image[IDmodevalDM].md[0].write = 1;
@@ -4836,10 +7363,18 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
         {
             if(IDmodevalPF==-1)
             {
-                if(sprintf(imname, "aol%ld_modevalPF", loop) < 1)
-                    printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                // connect to prediction stream when ARPF is turned on, then retry every OLMODES_RECONNECT_NBITER iterations until stream exists
+                // steady state (stream connected) does no name lookup
+                if((ARPFon_last == 0)||(modevalPFretry >= OLMODES_RECONNECT_NBITER))
+                {
+                    if(sprintf(imname, "aol%ld_modevalPF", loop) < 1)
+                        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-                IDmodevalPF = read_sharedmem_image(imname);
+                    IDmodevalPF = read_sharedmem_image(imname);
+                    modevalPFretry = 0;
+                }
+                else
+                    modevalPFretry++;
             }
             else
             {
@@ -4881,6 +7416,7 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 		{ 
 			memcpy(data.image[IDmodevalDMnow].array.F, data.image[IDmodevalDMcorr].array.F, sizeof(float)*NBmodes);
 		}
+		ARPFon_last = AOconf[loop].ARPFon;
 
 
 
@@ -4949,13 +7485,19 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 
 		if(AOconf[loop].AUTOTUNE_GAINS_ON==1)
 		{
-			// CONNECT to auto gain input
+			// CONNECT to auto gain input when auto gain is turned on, then retry every OLMODES_RECONNECT_NBITER iterations until stream exists
 			if(IDautogain == -1)
 			{
-				if(sprintf(imname, "aol%ld_autogain", loop) < 1)
-					printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+				if((autotunegains_last == 0)||(autogainretry >= OLMODES_RECONNECT_NBITER))
+				{
+					if(sprintf(imname, "aol%ld_autogain", loop) < 1)
+						printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-				IDautogain = read_sharedmem_image(imname);				
+					IDautogain = read_sharedmem_image(imname);
+					autogainretry = 0;
+				}
+				else
+					autogainretry++;
 			}
 			
 			if(IDautogain != -1)
@@ -4980,8 +7522,7 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 					printf("     Setting  global gain = %f\n", maxGainVal);
 					AOconf[loop].gain = maxGainVal;
 
-					sprintf(command, "echo \"%6.4f\" > conf/param_loopgain.txt", AOconf[loop].gain);
-					system(command);
+					AOloopControl_writeParam_float("loopgain", AOconf[loop].gain);
 
 
 					
@@ -4999,8 +7540,8 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 						data.image[aoconfID_gainb].array.F[block] = maxGainVal/AOconf[loop].gain;
 
 						
-						sprintf(command, "echo \"%6.4f\" > conf/param_gainb%02ld.txt", data.image[aoconfID_gainb].array.F[block], block);
-						system(command);
+						sprintf(command, "gainb%02ld", block);
+						AOloopControl_writeParam_float(command, data.image[aoconfID_gainb].array.F[block]);
 					}
 					
 					// Set individual gain
@@ -5064,6 +7605,7 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
             data.image[aoconfID_limitb].md[0].write = 0;
             */
 		}
+		autotunegains_last = AOconf[loop].AUTOTUNE_GAINS_ON;
 
 
 
@@ -5120,26 +7662,17 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
         AOconf[loop].statusM = 6;
 
         //
-        // update current location of dm correction circular buffer
+        // update DM correction circular buffer, then compute in a single pass over modes:
+        //   DM state at time of WFS measurement (interpolated between two delayed commands, precomputed weights)
+        //   open loop state = most recent WFS reading - time-lagged DM
+        //   if ARPF on: time-lagged prediction and prediction residual
         //
-        data.image[IDmodevalDM_C].md[0].write = 1;
-        for(m=0; m<NBmodes; m++)
-            data.image[IDmodevalDM_C].array.F[modevalDMindex*NBmodes+m] = data.image[IDmodevalDMnowfilt].array.F[m];
-        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalDM_C, -1);
-        data.image[IDmodevalDM_C].md[0].cnt1 = modevalDMindex;
-        data.image[IDmodevalDM_C].md[0].cnt0++;
-        data.image[IDmodevalDM_C].md[0].write = 0;
-
-
-
-        AOconf[loop].statusM1 = 6;
-
-
+        if(AOconf[loop].hardwlatency_frame + AOconf[loop].wfsmextrlatency_frame != framelatency)
+        {
+            framelatency = AOconf[loop].hardwlatency_frame + AOconf[loop].wfsmextrlatency_frame;
+            AOloopControl_OLmodes_latencyweights(framelatency, modeval_bsize, &framelatency0, &framelatency1, &alpha);
+        }
 
-        //
-        // COMPUTE DM STATE AT TIME OF WFS MEASUREMENT
-        // LINEAR INTERPOLATION BETWEEN NEAREST TWO VALUES
-        //
         modevalDMindex0 = modevalDMindex - framelatency0;
         if(modevalDMindex0<0)
             modevalDMindex0 += modeval_bsize;
@@ -5147,20 +7680,6 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
         if(modevalDMindex1<0)
             modevalDMindex1 += modeval_bsize;
 
-        data.image[IDmodevalDM].md[0].write = 1;
-        for(m=0; m<NBmodes; m++)
-            data.image[IDmodevalDM].array.F[m] = (1.0-alpha)*data.image[IDmodevalDM_C].array.F[modevalDMindex0*NBmodes+m] + alpha*data.image[IDmodevalDM_C].array.F[modevalDMindex1*NBmodes+m];
-        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalDM, -1);
-        data.image[IDmodevalDM].md[0].cnt0++;
-        data.image[IDmodevalDM].md[0].write = 0;
-
-
-		if(AOconf[loop].ARPFon==1)
-		{
-		//
-        // COMPUTE OPEN LOOP PREDICTION AT TIME OF WFS MEASUREMENT
-        // LINEAR INTERPOLATION BETWEEN NEAREST TWO VALUES
-        //
         modevalPFindex0 = modevalPFindex - framelatency0;
         if(modevalPFindex0<0)
             modevalPFindex0 += modeval_bsize;
@@ -5168,41 +7687,55 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
         if(modevalPFindex1<0)
             modevalPFindex1 += modeval_bsize;
 
-        data.image[IDmodevalPFsync].md[0].write = 1;
-        for(m=0; m<NBmodes; m++)
-            data.image[IDmodevalPFsync].array.F[m] = (1.0-alpha)*data.image[IDmodevalPF_C].array.F[modevalPFindex0*NBmodes+m] + alpha*data.image[IDmodevalPF_C].array.F[modevalPFindex1*NBmodes+m];
-        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalPFsync, -1);
-        data.image[IDmodevalPFsync].md[0].cnt0++;
-        data.image[IDmodevalPFsync].md[0].write = 0;
-		}
+        data.image[IDmodevalDM_C].md[0].write = 1;
+        data.image[IDmodevalDM].md[0].write = 1;
+        data.image[IDout].md[0].write = 1;
+        if(AOconf[loop].ARPFon==1)
+        {
+            data.image[IDmodevalPFsync].md[0].write = 1;
+            data.image[IDmodevalPFres].md[0].write = 1;
+        }
+
+        AOloopControl_OLmodes_update(NBmodes, 1.0-alpha, alpha,
+                                     data.image[IDmodeval].array.F, data.image[IDmodevalDMnowfilt].array.F,
+                                     data.image[IDmodevalDM_C].array.F + modevalDMindex*NBmodes,
+                                     data.image[IDmodevalDM_C].array.F + modevalDMindex0*NBmodes,
+                                     data.image[IDmodevalDM_C].array.F + modevalDMindex1*NBmodes,
+                                     data.image[IDmodevalDM].array.F, data.image[IDout].array.F,
+                                     (AOconf[loop].ARPFon==1) ? data.image[IDmodevalPF_C].array.F + modevalPFindex0*NBmodes : NULL,
+                                     data.image[IDmodevalPF_C].array.F + modevalPFindex1*NBmodes,
+                                     data.image[IDmodevalPFsync].array.F, data.image[IDmodevalPFres].array.F);
+
+        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalDM_C, -1);
+        data.image[IDmodevalDM_C].md[0].cnt1 = modevalDMindex;
+        data.image[IDmodevalDM_C].md[0].cnt0++;
+        data.image[IDmodevalDM_C].md[0].write = 0;
+
+        AOconf[loop].statusM1 = 6;
 
+        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalDM, -1);
+        data.image[IDmodevalDM].md[0].cnt0++;
+        data.image[IDmodevalDM].md[0].write = 0;
 
+        if(AOconf[loop].ARPFon==1)
+        {
+            COREMOD_MEMORY_image_set_sempost_byID(IDmodevalPFsync, -1);
+            data.image[IDmodevalPFsync].md[0].cnt0++;
+            data.image[IDmodevalPFsync].md[0].write = 0;
+        }
 
         AOconf[loop].statusM1 = 7;
 
-        //
-        // OPEN LOOP STATE = most recent WFS reading - time-lagged DM
-        //
-        data.image[IDout].md[0].write = 1;
-        for(m=0; m<NBmodes; m++)
-            data.image[IDout].array.F[m] = data.image[IDmodeval].array.F[m] - data.image[IDmodevalDM].array.F[m];
         COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
         data.image[IDout].md[0].cnt0++;
         data.image[IDout].md[0].write = 0;
 
-
-		if(AOconf[loop].ARPFon==1)
-		{
-		//
-        // OPEN LOOP PREDICTION RESIDUAL = most recent OL - time-lagged PF
-        //
-        data.image[IDmodevalPFres].md[0].write = 1;
-        for(m=0; m<NBmodes; m++)
-            data.image[IDmodevalPFres].array.F[m] = data.image[IDout].array.F[m] - data.image[IDmodevalPFsync].array.F[m];
-        COREMOD_MEMORY_image_set_sempost_byID(IDmodevalPFres, -1);
-        data.image[IDmodevalPFres].md[0].cnt0++;
-        data.image[IDmodevalPFres].md[0].write = 0;
-		}
+        if(AOconf[loop].ARPFon==1)
+        {
+            COREMOD_MEMORY_image_set_sempost_byID(IDmodevalPFres, -1);
+            data.image[IDmodevalPFres].md[0].cnt0++;
+            data.image[IDmodevalPFres].md[0].write = 0;
+        }
 
 
 
@@ -5298,83 +7831,47 @@ long AOloopControl_ComputeOpenLoopModes(long loop)
 int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float GainCoeff, long NBsamples)
 {
     long IDmodevalOL;
-    long IDmodeval;
-    long IDmodeval_dm;
-    long IDmodeval_dm_now;
-    long IDmodeval_dm_now_filt;
-
     long NBmodes;
     char imname[200];
     long m;
-    double diff1, diff2, diff3, diff4;
-    float *array_mvalOL1;
-    float *array_mvalOL2;
-    float *array_mvalOL3;
-    float *array_mvalOL4;
-    double *array_sig1;
-    double *array_sig2;
-    double *array_sig3;
-    double *array_sig4;
+
+    float *mvalOLhist; // last 4 open loop mode values, circular : 4 x NBmodes
+    double *ave0;      // running moments, exponential forgetting over NBsamples frames
+    double *sig0;
+    double *sig1;
+    double *sig2;
+    double *sig4;
     float *array_sig;
     float *array_asq;
-    long double *ave0;
-    long double *sig0;
-    long double *sig1;
-    long double *sig2;
-    long double *sig3;
-    long double *sig4;
     float *stdev;
 
-    float gain;
-    long NBgain;
-    long kk;
-    float *errarray;
     float mingain = 0.01;
     float maxgain = 0.3;
-    float gainfactstep = 1.02;
-    float *gainval_array;
-    float *gainval1_array;
-    float *gainval2_array;
 
     long long cnt = 0;
+    long cntstart = 10;
+    long cntpub = 0;
     float latency;
     FILE *fp;
 
     int RT_priority = 80; //any number from 0-99
-    struct sched_param schedpar;
-
 
     long IDout;
     uint32_t *sizearray;
 
     float gain0; // corresponds to evolution timescale
-    long cntstart;
-
-
 
     long IDblk;
     float *modegain;
     float *modemult;
-
-
     float *NOISEfactor;
-    long IDsync;
 
-
-    int TESTMODE = 1;
-    int TEST_m = 30;
-    FILE *fptest;
-    
     long iter;
     float GainCoeff1 = 1.0;
-    
-    
 
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    sched_setscheduler(0, SCHED_FIFO, &schedpar);
-#endif
+
+    AOloopControl_RTsched_set(loop, AOLRTSCHED_AUTOGAIN, RT_priority);
 
 
     printf("AUTO GAIN\n");
@@ -5391,10 +7888,6 @@ int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float
 
 
 
-    gain0 = 1.0/(AOconf[loop].loopfrequ*AOconf[loop].AUTOTUNEGAINS_evolTimescale);
-
-
-
 
     // CONNECT to arrays holding gain, limit, and multf values for blocks
 
@@ -5438,28 +7931,6 @@ int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float
     IDmodevalOL = read_sharedmem_image(imname);
     NBmodes = data.image[IDmodevalOL].md[0].size[0];
 
-    if(sprintf(imname, "aol%ld_modeval", loop) < 1) // measured from WFS
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-    IDmodeval = read_sharedmem_image(imname);
-
-    if(sprintf(imname, "aol%ld_modeval_dm", loop) < 1) // measured from WFS
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-    IDmodeval_dm = read_sharedmem_image(imname);
-
-    if(sprintf(imname, "aol%ld_modeval_dm_now", loop) < 1) // current modal DM correction
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-    IDmodeval_dm_now = read_sharedmem_image(imname);
-
-    if(sprintf(imname, "aol%ld_modeval_dm_now_filt", loop) < 1) // current modal DM correction, filtered
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-    IDmodeval_dm_now_filt = read_sharedmem_image(imname);
-
-
-
 
     // blocks
     if(sprintf(imname, "aol%ld_mode_blknb", loop) < 1) // block indices
@@ -5474,214 +7945,137 @@ int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float
 
 
 
-
-
     sizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
     sizearray[0] = NBmodes;
     sizearray[1] = 1;
     IDout = create_image_ID(IDout_name, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
-    COREMOD_MEMORY_image_set_createsem(IDout_name, 10);
-    free(sizearray);
-
-
-
-
-    // last open loop move values
-    array_mvalOL1 = (float*) malloc(sizeof(float)*NBmodes);
-    array_mvalOL2 = (float*) malloc(sizeof(float)*NBmodes);
-    array_mvalOL3 = (float*) malloc(sizeof(float)*NBmodes);
-    array_mvalOL4 = (float*) malloc(sizeof(float)*NBmodes);
-    array_sig1 = (double*) malloc(sizeof(double)*NBmodes);
-    array_sig2 = (double*) malloc(sizeof(double)*NBmodes);
-    array_sig3 = (double*) malloc(sizeof(double)*NBmodes);
-    array_sig4 = (double*) malloc(sizeof(double)*NBmodes);
-
-    array_sig = (float*) malloc(sizeof(float)*NBmodes);
-    array_asq = (float*) malloc(sizeof(float)*NBmodes);
-    ave0 = (long double*) malloc(sizeof(long double)*NBmodes);
-    sig0 = (long double*) malloc(sizeof(long double)*NBmodes);
-    sig1 = (long double*) malloc(sizeof(long double)*NBmodes);
-    sig2 = (long double*) malloc(sizeof(long double)*NBmodes);
-    sig3 = (long double*) malloc(sizeof(long double)*NBmodes);
-    sig4 = (long double*) malloc(sizeof(long double)*NBmodes);
-    stdev = (float*) malloc(sizeof(float)*NBmodes);
-
-
-    gainval_array = (float*) malloc(sizeof(float)*NBgain);
-    gainval1_array = (float*) malloc(sizeof(float)*NBgain);
-    gainval2_array = (float*) malloc(sizeof(float)*NBgain);
-
-    errarray = (float*) malloc(sizeof(float)*NBgain);
-
-
-
-	iter = 0;
-    for(;;)
-    {
-
-        // write gain, mult into arrays
-        for(m=0; m<NBmodes; m++)
-        {
-            unsigned short block;
-
-            block = data.image[IDblk].array.UI16[m];
-            modegain[m] = AOconf[loop].gain * data.image[aoconfID_gainb].array.F[block] * data.image[aoconfID_DMmode_GAIN].array.F[m];
-            modemult[m] = AOconf[loop].mult * data.image[aoconfID_multfb].array.F[block] * data.image[aoconfID_MULTF_modes].array.F[m];
-            NOISEfactor[m] = 1.0 + modemult[m]*modemult[m]*modegain[m]*modegain[m]/(1.0-modemult[m]*modemult[m]);
-        }
-
-
-
-
-
-
-
-        // prepare gain array
-        latency = AOconf[loop].hardwlatency_frame + AOconf[loop].wfsmextrlatency_frame;
-        //printf("latency = %f frame\n", latency);
-        NBgain = 0;
-        gain = mingain;
-        while(gain<maxgain)
-        {
-            gain *= gainfactstep;
-            NBgain++;
-        }
-
-
-        kk = 0;
-        gain = mingain;
-        while(kk<NBgain)
-        {
-            gainval_array[kk] = gain;
-            gainval1_array[kk] = (latency + 1.0/gain)*(latency + 1.0/(gain+gain0));
-            gainval2_array[kk] = (gain/(1.0-gain));
-
-            //printf("gain   %4ld  %12f   %12f  %12f\n", kk, gainval_array[kk], gainval1_array[kk], gainval2_array[kk]);
-            gain *= gainfactstep;
-            kk++;
-        }
-
+    COREMOD_MEMORY_image_set_createsem(IDout_name, 10);
+    free(sizearray);
 
 
-        // drive sem5 to zero
-        while(sem_trywait(data.image[IDmodevalOL].semptr[5])==0) {}
 
+    mvalOLhist = (float*) calloc(4*NBmodes, sizeof(float));
+    ave0 = (double*) calloc(NBmodes, sizeof(double));
+    sig0 = (double*) calloc(NBmodes, sizeof(double));
+    sig1 = (double*) calloc(NBmodes, sizeof(double));
+    sig2 = (double*) calloc(NBmodes, sizeof(double));
+    sig4 = (double*) calloc(NBmodes, sizeof(double));
+    array_sig = (float*) malloc(sizeof(float)*NBmodes);
+    array_asq = (float*) malloc(sizeof(float)*NBmodes);
+    stdev = (float*) malloc(sizeof(float)*NBmodes);
 
 
-        for(m=0; m<NBmodes; m++)
-        {
-            array_mvalOL1[m] = 0.0;
-            array_mvalOL2[m] = 0.0;
-            array_sig1[m] = 0.0;
-            array_sig2[m] = 0.0;
-            ave0[m] = 0.0;
-            sig0[m] = 0.0;
-            sig1[m] = 0.0;
-            sig2[m] = 0.0;
-            sig3[m] = 0.0;
-            sig4[m] = 0.0;
-            stdev[m] = 0.0;
-        }
+    // drive sem5 to zero
+    while(sem_trywait(data.image[IDmodevalOL].semptr[5])==0) {}
 
 
+	iter = 0;
+    for(;;)
+    {
+        const float *mvalOL;
+        float *mval1, *mval2, *mval4;
+        double coeff;
 
+        sem_wait(data.image[IDmodevalOL].semptr[5]);
+        mvalOL = data.image[IDmodevalOL].array.F;
 
-        if(TESTMODE==1)
-            fptest = fopen("test_autotunegain.dat", "w");
+        // frames cnt-1, cnt-2, cnt-4 in circular history
+        mval1 = mvalOLhist + ((cnt+3) % 4)*NBmodes;
+        mval2 = mvalOLhist + ((cnt+2) % 4)*NBmodes;
+        mval4 = mvalOLhist + (cnt % 4)*NBmodes;
 
-        cnt = 0;
-        cntstart = 10;
-        while(cnt<AOconf[loop].AUTOTUNEGAINS_NBsamples)
+        if(cnt > cntstart)
         {
-            sem_wait(data.image[IDmodevalOL].semptr[5]);
-
-
-            data.image[IDout].md[0].write = 1;
+            // running moments : cumulative average over first NBsamples frames, then exponential forgetting
+            if(cnt - cntstart < AOconf[loop].AUTOTUNEGAINS_NBsamples)
+                coeff = 1.0/(cnt - cntstart);
+            else
+                coeff = 1.0/AOconf[loop].AUTOTUNEGAINS_NBsamples;
 
+# ifdef _OPENMP
+            #pragma omp simd
+# endif
             for(m=0; m<NBmodes; m++)
             {
-                diff1 = data.image[IDmodevalOL].array.F[m] - array_mvalOL1[m];
-                diff2 = data.image[IDmodevalOL].array.F[m] - array_mvalOL2[m];
-                diff3 = data.image[IDmodevalOL].array.F[m] - array_mvalOL3[m];
-                diff4 = data.image[IDmodevalOL].array.F[m] - array_mvalOL4[m];
-                array_mvalOL4[m] = array_mvalOL3[m];
-                array_mvalOL3[m] = array_mvalOL2[m];
-                array_mvalOL2[m] = array_mvalOL1[m];
-                array_mvalOL1[m] = data.image[IDmodevalOL].array.F[m];
-
-                if(cnt>cntstart)
-                {
-                    ave0[m] += data.image[IDmodevalOL].array.F[m];
-                    sig0[m] += data.image[IDmodevalOL].array.F[m]*data.image[IDmodevalOL].array.F[m];
-                    sig1[m] += diff1*diff1;
-                    sig2[m] += diff2*diff2;
-                    sig3[m] += diff3*diff3;
-                    sig4[m] += diff4*diff4;
-                }
+                double v = mvalOL[m];
+                double diff1 = v - mval1[m];
+                double diff2 = v - mval2[m];
+                double diff4 = v - mval4[m];
+
+                ave0[m] += coeff*(v - ave0[m]);
+                sig0[m] += coeff*(v*v - sig0[m]);
+                sig1[m] += coeff*(diff1*diff1 - sig1[m]);
+                sig2[m] += coeff*(diff2*diff2 - sig2[m]);
+                sig4[m] += coeff*(diff4*diff4 - sig4[m]);
             }
+        }
+        memcpy(mval4, mvalOL, sizeof(float)*NBmodes); // oldest slot becomes newest
+        cnt++;
+        cntpub++;
 
-            if(TESTMODE==1)
-                fprintf(fptest, "%5lld %+12.10f %+12.10f %+12.10f %+12.10f %+12.10f\n", cnt, data.image[IDmodeval].array.F[TEST_m], data.image[IDmodevalOL].array.F[TEST_m], data.image[IDmodeval_dm].array.F[TEST_m], data.image[IDmodeval_dm_now].array.F[TEST_m], data.image[IDmodeval_dm_now_filt].array.F[TEST_m]);
+        if((cnt <= cntstart + 4)||(cntpub < AOconf[loop].AUTOTUNEGAINS_NBsamples))
+            continue;
+        cntpub = 0;
 
-            cnt++;
+
+        // write gain, mult into arrays
+        for(m=0; m<NBmodes; m++)
+        {
+            unsigned short block;
+
+            block = data.image[IDblk].array.UI16[m];
+            modegain[m] = AOconf[loop].gain * data.image[aoconfID_gainb].array.F[block] * data.image[aoconfID_DMmode_GAIN].array.F[m];
+            modemult[m] = AOconf[loop].mult * data.image[aoconfID_multfb].array.F[block] * data.image[aoconfID_MULTF_modes].array.F[m];
+            NOISEfactor[m] = 1.0 + modemult[m]*modemult[m]*modegain[m]*modegain[m]/(1.0-modemult[m]*modemult[m]);
         }
-        if(TESTMODE==1)
-            fclose(fptest);
 
-		
+        latency = AOconf[loop].hardwlatency_frame + AOconf[loop].wfsmextrlatency_frame;
+        gain0 = 1.0/(AOconf[loop].loopfrequ*AOconf[loop].AUTOTUNEGAINS_evolTimescale);
 
 		GainCoeff1 = 1.0/(iter+1);
 		if(GainCoeff1 < AOconf[loop].AUTOTUNEGAINS_updateGainCoeff)
 			GainCoeff1 = AOconf[loop].AUTOTUNEGAINS_updateGainCoeff;
-		
+
 
         data.image[IDout].md[0].write = 1;
         for(m=0; m<NBmodes; m++)
         {
-            long kkmin;
-            float errmin;
-
-            ave0[m] /= cnt-cntstart;
-            sig0[m] /= cnt-cntstart;
-            array_sig1[m] = sig1[m]/(cnt-cntstart);
-            array_sig2[m] = sig2[m]/(cnt-cntstart);
-            array_sig3[m] = sig3[m]/(cnt-cntstart);
-            array_sig4[m] = sig4[m]/(cnt-cntstart);
-
-
-            //		array_asq[m] = (array_sig2[m]-array_sig1[m])/3.0;
-            //        array_asq[m] = (array_sig4[m]-array_sig1[m])/15.0;
+            double a, sg, glo, ghi, g;
+            int it;
 
             // This formula is compatible with astromgrid, which alternates between patterns
-            array_asq[m] = (array_sig4[m]-array_sig2[m])/12.0;
+            array_asq[m] = (sig4[m]-sig2[m])/12.0;
             if(array_asq[m]<0.0)
                 array_asq[m] = 0.0;
 
-            //array_sig[m] = (4.0*array_sig1[m] - array_sig2[m])/6.0;
-
             // This formula is compatible with astromgrid, which alternates between patterns
-            array_sig[m] = (4.0*array_sig2[m] - array_sig4[m])/6.0;
+            array_sig[m] = (4.0*sig2[m] - sig4[m])/6.0;
 
             stdev[m] = sig0[m] - NOISEfactor[m]*array_sig[m] - ave0[m]*ave0[m];
             if(stdev[m]<0.0)
                 stdev[m] = 0.0;
             stdev[m] = sqrt(stdev[m]);
 
-            for(kk=0; kk<NBgain; kk++)
-                errarray[kk] = array_asq[m] * gainval1_array[kk] + array_sig[m] * gainval2_array[kk];
+            // residual err(g) = asq (latency + 1/g)(latency + 1/(g+gain0)) + sig g/(1-g) is convex for 0<g<1 :
+            // optimal gain is the root of d err / dg, found by bisection in [mingain, maxgain]
+            a = array_asq[m];
+            sg = array_sig[m];
+            glo = mingain;
+            ghi = maxgain;
+            for(it=0; it<24; it++)
+            {
+                double derr;
 
-            errmin = errarray[0];
-            kkmin = 0;
+                g = 0.5*(glo+ghi);
+                derr = - a*(latency + 1.0/(g+gain0))/(g*g) - a*(latency + 1.0/g)/((g+gain0)*(g+gain0)) + sg/((1.0-g)*(1.0-g));
+                if(derr > 0.0)
+                    ghi = g;
+                else
+                    glo = g;
+            }
+            g = 0.5*(glo+ghi);
 
-            for(kk=0; kk<NBgain; kk++)
-                if(errarray[kk]<errmin)
-                {
-                    errmin = errarray[kk];
-                    kkmin = kk;
-                }
-			
-			
-            data.image[IDout].array.F[m] = (1.0-GainCoeff1) * data.image[IDout].array.F[m]   +  GainCoeff1 * gainval_array[kkmin];
+            data.image[IDout].array.F[m] = (1.0-GainCoeff1) * data.image[IDout].array.F[m]   +  GainCoeff1 * g;
         }
 
         COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
@@ -5700,34 +8094,21 @@ int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float
 
         fp = fopen("optgain.dat", "w");
         for(m=0; m<NBmodes; m++)
-            fprintf(fp, "%5ld   %+12.10f %12.10f %12.10f %12.10f %12.10f   %6.4f  %16.14f %16.14f  %6.2f\n", m, (float) ave0[m], (float) sig0[m], stdev[m], sqrt(array_asq[m]), sqrt(array_sig[m]), data.image[IDout].array.F[m], array_sig1[m], array_sig4[m], NOISEfactor[m]);
+            fprintf(fp, "%5ld   %+12.10f %12.10f %12.10f %12.10f %12.10f   %6.4f  %16.14f %16.14f  %6.2f\n", m, (float) ave0[m], (float) sig0[m], stdev[m], sqrt(array_asq[m]), sqrt(array_sig[m]), data.image[IDout].array.F[m], sig1[m], sig4[m], NOISEfactor[m]);
         fclose(fp);
-        
+
         printf("[%8ld]  %8ld   %8.6f -> %8.6f\n", iter, AOconf[loop].AUTOTUNEGAINS_NBsamples, AOconf[loop].AUTOTUNEGAINS_updateGainCoeff, GainCoeff1);
-        
+
         iter++;
 
     }
 
-    free(gainval_array);
-    free(gainval1_array);
-    free(gainval2_array);
-    free(errarray);
-
-    free(array_mvalOL1);
-    free(array_mvalOL2);
-    free(array_mvalOL3);
-    free(array_mvalOL4);
+    free(mvalOLhist);
     free(ave0);
     free(sig0);
     free(sig1);
     free(sig2);
-    free(sig3);
     free(sig4);
-    free(array_sig1);
-    free(array_sig2);
-    free(array_sig3);
-    free(array_sig4);
     free(array_sig);
     free(array_asq);
 
@@ -5749,42 +8130,170 @@ int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float
 
 
 
-long AOloopControl_dm2dm_offload(const char *streamin, const char *streamout, float twait, float offcoeff, float multcoeff)
+/**
+ * @brief DM to DM offload, semaphore driven
+ *
+ * Leaky integrator, state kept across iterations and written to streamout:\n
+ * state = multcoeff x (state + offcoeff x P(streamin))\n
+ * P is identity (streamin and streamout same size) or matrix IDmatrix_name (xsize_out x ysize_out x NBact_in),
+ * computed with cblas_sgemv, or on GPU if variable DM2DMGPU is set (device index).\n
+ * Wakes on streamin semaphore DM2DM_OFFLOAD_SEMINDEX, decimation : at most one update per twait [sec] (0: every input update).
+ */
+long AOloopControl_dm2dm_offloadM(const char *streamin, const char *streamout, const char *IDmatrix_name, float twait, float offcoeff, float multcoeff)
 {
-    long IDin, IDout;
+    long IDin, IDout, IDmat = -1;
     long cnt = 0;
-    long xsize, ysize, xysize;
+    long NBin, NBout;
     long ii;
-    //long IDtmp;
+    float *state;
+    float *proj;
+    long long cntin, cntinold;
+    struct timespec tnow, tlast, tdiff, semwaitts;
+    double tdiffv;
+#ifdef HAVE_CUDA
+    int GPUdevice = -1;
+    long IDproj = -1;
+    long IDvar;
+    char name[200];
+    int_fast8_t GPUstatus[100];
+    int_fast8_t gpustatus;
+#endif
 
 
     IDin = image_ID(streamin);
     IDout = image_ID(streamout);
+    if((IDin == -1)||(IDout == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input or output stream missing");
+        return(-1);
+    }
+    NBin = data.image[IDin].md[0].nelement;
+    NBout = data.image[IDout].md[0].nelement;
+
+    if(strcmp(IDmatrix_name, "NULL") != 0)
+    {
+        IDmat = image_ID(IDmatrix_name);
+        if((IDmat == -1)||(data.image[IDmat].md[0].nelement != NBin*NBout))
+        {
+            printERROR(__FILE__, __func__, __LINE__, "offload matrix missing or wrong size");
+            return(-1);
+        }
+    }
+    else if(NBin != NBout)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input and output streams size mismatch, offload matrix required");
+        return(-1);
+    }
+
+    state = (float*) malloc(sizeof(float)*NBout);
+    proj = (float*) malloc(sizeof(float)*NBout);
+    memcpy(state, data.image[IDout].array.F, sizeof(float)*NBout);
+
+#ifdef HAVE_CUDA
+    IDvar = variable_ID("DM2DMGPU");
+    if((IDvar != -1)&&(IDmat != -1))
+    {
+        uint32_t *sizearray;
+
+        GPUdevice = (int) (data.variable[IDvar].value.f);
+        sprintf(name, "%s_offproj", streamout);
+        sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        sizearray[0] = data.image[IDout].md[0].size[0];
+        sizearray[1] = (data.image[IDout].md[0].naxis > 1) ? data.image[IDout].md[0].size[1] : 1;
+        IDproj = create_image_ID(name, 2, sizearray, _DATATYPE_FLOAT, 0, 0);
+        free(sizearray);
+        GPU_loop_MultMat_setup(0, IDmatrix_name, streamin, name, 1, &GPUdevice, 1, 1, 1, DM2DM_OFFLOAD_GPULOOPNB);
+    }
+#endif
 
-    xsize = data.image[IDin].md[0].size[0];
-    ysize = data.image[IDin].md[0].size[1];
-    xysize = xsize*ysize;
+    COREMOD_MEMORY_image_set_createsem(streamin, 10);
+    COREMOD_MEMORY_image_set_semflush(streamin, DM2DM_OFFLOAD_SEMINDEX);
+    cntinold = data.image[IDin].md[0].cnt0;
+    clock_gettime(CLOCK_REALTIME, &tlast);
 
     while(1)
     {
-        printf("%8ld : offloading   %s -> %s\n", cnt, streamin, streamout);
+        // wake on input update, or at end of decimation interval if update pending
+        if(data.image[IDin].md[0].cnt0 != cntinold)
+        {
+            semwaitts = tlast;
+            semwaitts.tv_sec += (long) twait;
+            semwaitts.tv_nsec += (long) (1.0e9*(twait-(long) twait));
+            if(semwaitts.tv_nsec >= 1000000000)
+            {
+                semwaitts.tv_sec++;
+                semwaitts.tv_nsec -= 1000000000;
+            }
+        }
+        else
+        {
+            clock_gettime(CLOCK_REALTIME, &semwaitts);
+            semwaitts.tv_sec += 1;
+        }
+        sem_timedwait(data.image[IDin].semptr[DM2DM_OFFLOAD_SEMINDEX], &semwaitts);
+
+        if((data.signal_INT == 1)||(data.signal_TERM == 1))
+            break;
+
+        cntin = data.image[IDin].md[0].cnt0;
+        if(cntin == cntinold)
+            continue;
+
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(tlast, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        if(tdiffv < twait) // decimation: only latest input update used at end of interval
+            continue;
+        tlast = tnow;
+        cntinold = cntin;
+
+        if(IDmat == -1)
+            memcpy(proj, data.image[IDin].array.F, sizeof(float)*NBout);
+#ifdef HAVE_CUDA
+        else if(GPUdevice >= 0)
+        {
+            gpustatus = 0;
+            GPU_loop_MultMat_execute(0, &gpustatus, &GPUstatus[0], 1.0, 0.0, 0);
+            memcpy(proj, data.image[IDproj].array.F, sizeof(float)*NBout);
+        }
+#endif
+        else
+            cblas_sgemv(CblasColMajor, CblasNoTrans, NBout, NBin, 1.0, data.image[IDmat].array.F, NBout, data.image[IDin].array.F, 1, 0.0, proj, 1);
+
+        # ifdef _OPENMP
+        #pragma omp simd
+        # endif
+        for(ii=0; ii<NBout; ii++)
+            state[ii] = multcoeff*(state[ii] + offcoeff*proj[ii]);
 
         data.image[IDout].md[0].write = 1;
-        for(ii=0; ii<xysize; ii++)
-            data.image[IDout].array.F[ii] = multcoeff*(data.image[IDout].array.F[ii] + offcoeff*data.image[IDin].array.F[ii]);
+        memcpy(data.image[IDout].array.F, state, sizeof(float)*NBout);
         COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
         data.image[IDout].md[0].cnt0++;
         data.image[IDout].md[0].write = 0;
 
-        usleep((long) (1000000.0*twait));
         cnt++;
     }
 
+#ifdef HAVE_CUDA
+    if(GPUdevice >= 0)
+        GPU_loop_MultMat_free(0);
+#endif
+    free(state);
+    free(proj);
+
     return(IDout);
 }
 
 
 
+long AOloopControl_dm2dm_offload(const char *streamin, const char *streamout, float twait, float offcoeff, float multcoeff)
+{
+    return(AOloopControl_dm2dm_offloadM(streamin, streamout, "NULL", twait, offcoeff, multcoeff));
+}
+
+
+
 
 
 
@@ -6503,6 +9012,203 @@ int_fast8_t AOloopControl_scanGainBlock(long NBblock, long NBstep, float gainSta
 
 
 
+/**
+ * @brief Run loop for NBstep frames, accumulate residual modal variance per block
+ *
+ * Mode values are sampled from aol_DMmode_meas as the loop process updates it, first NBskip frames discarded (gain transient).
+ */
+static void AOloopControl_scanGainBlock_runstep(long loop, long NBstep, long NBskip, long NBblock, double *sum, double *sum2, double *blockvar)
+{
+    long m, b;
+    long cnt = 0;
+    uint64_t cnt0;
+    long NBmodes = AOconf[loop].NBDMmodes;
+
+    for(m=0; m<NBmodes; m++)
+    {
+        sum[m] = 0.0;
+        sum2[m] = 0.0;
+    }
+
+    AOconf[loop].cntmax = AOconf[loop].cnt + NBstep;
+    AOconf[loop].RMSmodesCumul = 0.0;
+    AOconf[loop].RMSmodesCumulcnt = 0;
+    cnt0 = data.image[aoconfID_meas_modes].md[0].cnt0;
+    AOconf[loop].on = 1;
+
+    while(AOconf[loop].on==1)
+    {
+        if((data.image[aoconfID_meas_modes].md[0].cnt0 != cnt0)&&(data.image[aoconfID_meas_modes].md[0].write == 0))
+        {
+            cnt0 = data.image[aoconfID_meas_modes].md[0].cnt0;
+            if(AOconf[loop].cnt + NBstep < AOconf[loop].cntmax + NBskip) // gain transient
+                continue;
+            for(m=0; m<NBmodes; m++)
+            {
+                double v = data.image[aoconfID_meas_modes].array.F[m];
+                sum[m] += v;
+                sum2[m] += v*v;
+            }
+            cnt++;
+        }
+        else
+            usleep(20);
+    }
+
+    for(b=0; b<NBblock; b++)
+        blockvar[b] = 0.0;
+    if(cnt>0)
+        for(m=0; m<NBmodes; m++)
+        {
+            double ave = sum[m]/cnt;
+            b = AOconf[loop].modeBlockIndex[m];
+            if(b<NBblock)
+                blockvar[b] += sum2[m]/cnt - ave*ave;
+        }
+}
+
+
+// block gains written through set_modeblock_gain, combined CM rebuilt once (CMMODE=1)
+static void AOloopControl_scanGainBlock_apply(long loop, long NBblock, const float *gain)
+{
+    long b;
+
+    for(b=0; b<NBblock; b++)
+        AOloopControl_set_modeblock_gain(loop, b, gain[b], ((b==NBblock-1)&&(AOconf[loop].CMMODE==1)) ? 1 : 0);
+}
+
+
+/**
+ * @brief Multiplexed gain scan: all blocks dithered simultaneously with orthogonal patterns
+ *
+ * Each cycle runs one reference step at the current gains, then P steps (P = power of 2 > NBblock) with block b gain
+ * multiplied by (1 + dither*H[s][b+1]), H Walsh-Hadamard matrix. Patterns are orthogonal, so the slope of each block's
+ * residual variance (modal PSD integral) is separated from others' dithers; curvature comes from the reference step.\n
+ * Gains move to the estimated minimum (clamped to 2x dither), NBcycle times. Cost is NBcycle*(P+1)*NBstep frames,
+ * independent of gain sampling, against NBblock*NBgain*NBstep for sequential scans.
+ */
+int_fast8_t AOloopControl_scanGainBlock_multiplex(long NBstep, float dither, long NBcycle)
+{
+    long NBblock;
+    long P, s, b, cycle;
+    float *gain0;
+    float *gain;
+    double *J;
+    double *sum;
+    double *sum2;
+    long NBskip;
+
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(1);
+
+    if(aoconfID_gainb == -1)
+    {
+        char imname[200];
+        if(sprintf(imname, "aol%ld_gainb", LOOPNUMBER) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+        aoconfID_gainb = read_sharedmem_image(imname);
+    }
+    if(aoconfID_meas_modes == -1)
+    {
+        char imname[200];
+        if(sprintf(imname, "aol%ld_DMmode_meas", LOOPNUMBER) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+        aoconfID_meas_modes = read_sharedmem_image(imname);
+    }
+
+    NBblock = AOconf[LOOPNUMBER].DMmodesNBblock;
+    if((NBblock<2)||(aoconfID_gainb==-1)||(aoconfID_meas_modes==-1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "multiplexed scan requires >1 mode blocks, aol_gainb and aol_DMmode_meas");
+        return -1;
+    }
+    if((dither<=0.0)||(dither>=0.5))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "relative dither amplitude should be in ]0, 0.5[");
+        return -1;
+    }
+
+    P = 1;
+    while(P<NBblock+1)
+        P *= 2;
+    NBskip = NBstep/5;
+
+    gain0 = (float*) malloc(sizeof(float)*NBblock);
+    gain = (float*) malloc(sizeof(float)*NBblock);
+    J = (double*) malloc(sizeof(double)*(P+1)*NBblock);
+    sum = (double*) malloc(sizeof(double)*AOconf[LOOPNUMBER].NBDMmodes);
+    sum2 = (double*) malloc(sizeof(double)*AOconf[LOOPNUMBER].NBDMmodes);
+
+    for(b=0; b<NBblock; b++)
+        gain0[b] = data.image[aoconfID_gainb].array.F[b];
+
+    printf("Multiplexed gain scan: %ld blocks, %ld patterns x %ld frames, dither %.3f, %ld cycles\n", NBblock, P, NBstep, dither, NBcycle);
+
+    for(cycle=0; cycle<NBcycle; cycle++)
+    {
+        for(s=0; s<P+1; s++)
+        {
+            for(b=0; b<NBblock; b++)
+            {
+                gain[b] = gain0[b];
+                if(s>0) // Walsh-Hadamard row s-1, column b+1 (column 0 is constant)
+                    gain[b] *= 1.0 + dither*((__builtin_popcountl((s-1)&(b+1))&1) ? -1.0 : 1.0);
+            }
+            AOloopControl_scanGainBlock_apply(LOOPNUMBER, NBblock, gain);
+            AOloopControl_scanGainBlock_runstep(LOOPNUMBER, NBstep, NBskip, NBblock, sum, sum2, J + s*NBblock);
+        }
+
+        printf("cycle %ld\n", cycle);
+        for(b=0; b<NBblock; b++)
+        {
+            double slope = 0.0;
+            double mean = 0.0;
+            double curv;
+            double delta;
+
+            for(s=1; s<P+1; s++)
+            {
+                double h = (__builtin_popcountl((s-1)&(b+1))&1) ? -1.0 : 1.0;
+                slope += h*J[s*NBblock+b];
+                mean += J[s*NBblock+b];
+            }
+            slope /= P*dither;
+            mean /= P;
+            curv = (mean - J[b])/(dither*dither);
+
+            if(curv > 0.0)
+                delta = -0.5*slope/curv;
+            else
+                delta = (slope > 0.0) ? -dither : dither;
+            if(delta > 2.0*dither)
+                delta = 2.0*dither;
+            if(delta < -2.0*dither)
+                delta = -2.0*dither;
+
+            printf("   block %2ld  gain %6.4f -> %6.4f   var %10.8lf  slope %+10.3e  curv %+10.3e\n", b, gain0[b], gain0[b]*(1.0+delta), J[b], slope, curv);
+            gain0[b] *= 1.0 + delta;
+            if(gain0[b] < 0.0)
+                gain0[b] = 0.0;
+        }
+    }
+
+    AOloopControl_scanGainBlock_apply(LOOPNUMBER, NBblock, gain0);
+
+    free(gain0);
+    free(gain);
+    free(J);
+    free(sum);
+    free(sum2);
+
+    return(0);
+}
+
+
+
+
 
 
 
@@ -6517,68 +9223,195 @@ int_fast8_t AOloopControl_scanGainBlock(long NBblock, long NBstep, float gainSta
 
 
 
-// optimize LO - uses simulated downhill simplex
-int_fast8_t AOloopControl_OptimizePSF_LO(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes)
+// write DM shape dm0 + sum_m coeff[m]*mode[m] to stream
+static void AOloopControl_OptimizePSF_LO_applyDM(long IDdmstream, long IDmodes, const float *dm0, const float *coeff, long NBmodes, long dmsize)
 {
-    long IDmodes;
-    long IDdmstream;
-    long IDdm;
-//    long psfxsize, psfysize;
-    long dmxsize, dmysize;
-    long NBmodes;
-    long mode;
-    double ampl;
-    double x;
-    long ii, jj;
+    long ii, m;
 
-    long IDdmbest;
-    long IDpsfarray;
+    data.image[IDdmstream].md[0].write = 1;
+    memcpy(data.image[IDdmstream].array.F, dm0, sizeof(float)*dmsize);
+    for(m=0; m<NBmodes; m++)
+    {
+        const float *mode = data.image[IDmodes].array.F + m*dmsize;
+        float c = coeff[m];
 
+        #pragma omp simd
+        for(ii=0; ii<dmsize; ii++)
+            data.image[IDdmstream].array.F[ii] += c*mode[ii];
+    }
+    COREMOD_MEMORY_image_set_sempost_byID(IDdmstream, -1);
+    data.image[IDdmstream].md[0].cnt0++;
+    data.image[IDdmstream].md[0].write = 0;
+}
 
-    ampl = 0.01; // modulation amplitude
 
- //   IDpsf = image_ID(psfstream_name);
-    IDmodes = image_ID(IDmodes_name);
-    IDdmstream = image_ID(dmstream_name);
+// PSF sharpness sum(I^2)/sum(I)^2 of PSF stream averaged over NBframes new frames, after skipping delayframe frames
+static double AOloopControl_OptimizePSF_LO_metric(long IDpsf, long delayframe, long NBframes, float *psfave)
+{
+    long psfsize = data.image[IDpsf].md[0].size[0]*data.image[IDpsf].md[0].size[1];
+    uint64_t cnt0;
+    long frame;
+    long ii;
+    double s1 = 0.0;
+    double s2 = 0.0;
+
+    for(ii=0; ii<psfsize; ii++)
+        psfave[ii] = 0.0;
 
-//    psfxsize = data.image[IDpsf].md[0].size[0];
-//    psfysize = data.image[IDpsf].md[0].size[1];
+    cnt0 = data.image[IDpsf].md[0].cnt0;
+    for(frame=0; frame<delayframe+NBframes; frame++)
+    {
+        const float *psf;
 
-    IDdmbest = create_2Dimage_ID("dmbest", dmxsize, dmysize);
-    IDdm = create_2Dimage_ID("dmcurr", dmxsize, dmysize);
+        while(((data.image[IDpsf].md[0].cnt0 == cnt0)||(data.image[IDpsf].md[0].write == 1))&&(data.signal_USR1==0))
+            usleep(10);
+        if(data.signal_USR1==1)
+            break;
+        cnt0 = data.image[IDpsf].md[0].cnt0;
 
-    dmxsize = data.image[IDdm].md[0].size[0];
-    dmysize = data.image[IDdm].md[0].size[1];
+        if(frame<delayframe)
+            continue;
+        psf = data.image[IDpsf].array.F;
+        if(data.image[IDpsf].md[0].naxis==3) // circular buffer: last written slice
+            psf += data.image[IDpsf].md[0].cnt1*psfsize;
+        for(ii=0; ii<psfsize; ii++)
+            psfave[ii] += psf[ii];
+    }
 
-    NBmodes = data.image[IDmodes].md[0].size[2];
+    for(ii=0; ii<psfsize; ii++)
+    {
+        s1 += psfave[ii];
+        s2 += psfave[ii]*psfave[ii];
+    }
+
+    return( (s1>0.0) ? s2/(s1*s1) : 0.0 );
+}
+
+
+/**
+ * @brief Optimize PSF by simultaneous perturbation stochastic approximation (SPSA) on modal DM offsets
+ *
+ * All NBmodes modes are perturbed at each iteration by +/- c_k along a random sign vector D, PSF sharpness measured for
+ * both signs (NBframes PSF frames averaged, delayframe frames skipped after each DM update). Gradient estimate is
+ * (J+ - J-)/(2 c_k) * D on the metric normalized to its initial value, so each iteration costs two measurements
+ * regardless of the number of modes.\n
+ * Standard SPSA sequences: c_k = ampl/(k+1)^0.101, a_k = gain*ampl^2*((1+A)/(k+1+A))^0.602, A = NBiter/10.
+ * With ampl chosen to change the metric by a few %, gain ~ 1 gives steps of order ampl at start.
+ * Final modal coefficients written to image "optpsfcoeff", DM left at optimized shape.
+ */
+int_fast8_t AOloopControl_OptimizePSF_LO_SPSA(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes, long NBiter, float ampl, float gain)
+{
+    long IDpsf, IDmodes, IDdmstream, IDcoeff;
+    long dmsize, psfsize;
+    long NBmodes;
+    long k, m;
+    float *dm0;
+    float *psfave;
+    float *coeff;
+    float *coefftest;
+    float *delta;
+    double J0, Jp, Jm;
+    double A;
 
-    for(ii=0; ii<dmxsize*dmysize; ii++)
-        data.image[IDdmbest].array.F[ii] = data.image[IDdm].array.F[ii];
 
+    IDpsf = image_ID(psfstream_name);
+    IDmodes = image_ID(IDmodes_name);
+    IDdmstream = image_ID(dmstream_name);
+    if((IDpsf==-1)||(IDmodes==-1)||(IDdmstream==-1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input image/stream missing");
+        return -1;
+    }
 
-    for(mode=0; mode<NBmodes; mode ++)
+    dmsize = data.image[IDdmstream].md[0].size[0]*data.image[IDdmstream].md[0].size[1];
+    if(data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1] != dmsize)
     {
-        for(x=-ampl; x<1.01*ampl; x += ampl)
-        {
-            // apply DM pattern
-            for(ii=0; ii<dmxsize*dmysize; ii++)
-                data.image[IDdm].array.F[ii] = data.image[IDdmbest].array.F[ii]+ampl*data.image[IDmodes].array.F[dmxsize*dmysize*mode+ii];
+        printERROR(__FILE__, __func__, __LINE__, "modes and DM stream sizes do not match");
+        return -1;
+    }
+    NBmodes = (data.image[IDmodes].md[0].naxis==3) ? data.image[IDmodes].md[0].size[2] : 1;
+    psfsize = data.image[IDpsf].md[0].size[0]*data.image[IDpsf].md[0].size[1];
+    if(NBframes<1)
+        NBframes = 1;
+
+    dm0 = (float*) malloc(sizeof(float)*dmsize);
+    psfave = (float*) malloc(sizeof(float)*psfsize);
+    coeff = (float*) malloc(sizeof(float)*NBmodes);
+    coefftest = (float*) malloc(sizeof(float)*NBmodes);
+    delta = (float*) malloc(sizeof(float)*NBmodes);
+    if((dm0==NULL)||(psfave==NULL)||(coeff==NULL)||(coefftest==NULL)||(delta==NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+
+    memcpy(dm0, data.image[IDdmstream].array.F, sizeof(float)*dmsize);
+    for(m=0; m<NBmodes; m++)
+        coeff[m] = 0.0;
+    srand(time(NULL));
+
+    AOloopControl_OptimizePSF_LO_applyDM(IDdmstream, IDmodes, dm0, coeff, NBmodes, dmsize);
+    J0 = AOloopControl_OptimizePSF_LO_metric(IDpsf, delayframe, NBframes, psfave);
+    printf("SPSA PSF optimization: %ld modes, %ld iterations, initial metric %g\n", NBmodes, NBiter, J0);
+    if(J0 <= 0.0)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "PSF metric is zero");
+        J0 = 1.0;
+    }
+
+    A = 0.1*NBiter;
+    for(k=0; (k<NBiter)&&(data.signal_USR1==0); k++)
+    {
+        double ck = ampl/pow(k+1.0, 0.101);
+        double ak = gain*ampl*ampl*pow((1.0+A)/(k+1.0+A), 0.602);
+        double g;
 
-            data.image[IDdmstream].md[0].write = 1;
-            memcpy(data.image[IDdmstream].array.F, data.image[IDdm].array.F, sizeof(float)*dmxsize*dmysize);
-            data.image[IDdmstream].md[0].cnt0++;
-            data.image[IDdmstream].md[0].write = 0;
+        for(m=0; m<NBmodes; m++)
+            delta[m] = (rand()&1) ? 1.0 : -1.0;
 
+        for(m=0; m<NBmodes; m++)
+            coefftest[m] = coeff[m] + ck*delta[m];
+        AOloopControl_OptimizePSF_LO_applyDM(IDdmstream, IDmodes, dm0, coefftest, NBmodes, dmsize);
+        Jp = AOloopControl_OptimizePSF_LO_metric(IDpsf, delayframe, NBframes, psfave)/J0;
 
+        for(m=0; m<NBmodes; m++)
+            coefftest[m] = coeff[m] - ck*delta[m];
+        AOloopControl_OptimizePSF_LO_applyDM(IDdmstream, IDmodes, dm0, coefftest, NBmodes, dmsize);
+        Jm = AOloopControl_OptimizePSF_LO_metric(IDpsf, delayframe, NBframes, psfave)/J0;
 
-        }
+        g = (Jp - Jm)/(2.0*ck);
+        for(m=0; m<NBmodes; m++)
+            coeff[m] += ak*g*delta[m]; // ascent: 1/delta[m] = delta[m]
+
+        printf("  iter %4ld   metric %8.5f   c_k %8.2e   a_k*g %+9.2e\n", k, 0.5*(Jp+Jm), ck, ak*g);
     }
 
+    AOloopControl_OptimizePSF_LO_applyDM(IDdmstream, IDmodes, dm0, coeff, NBmodes, dmsize);
+
+    IDcoeff = image_ID("optpsfcoeff");
+    if(IDcoeff!=-1)
+        delete_image_ID("optpsfcoeff");
+    IDcoeff = create_2Dimage_ID("optpsfcoeff", NBmodes, 1);
+    memcpy(data.image[IDcoeff].array.F, coeff, sizeof(float)*NBmodes);
+
+    free(dm0);
+    free(psfave);
+    free(coeff);
+    free(coefftest);
+    free(delta);
 
     return(0);
 }
 
 
+// optimize LO modes
+// delayframe : PSF frames skipped after each DM update, NBframes : PSF frames averaged per measurement
+int_fast8_t AOloopControl_OptimizePSF_LO(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes)
+{
+    return(AOloopControl_OptimizePSF_LO_SPSA(psfstream_name, IDmodes_name, dmstream_name, delayframe, NBframes, 100, 0.01, 1.0));
+}
+
+
 //
 // modulate using linear combination of two probes A and B
 //
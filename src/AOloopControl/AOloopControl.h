@@ -23,10 +23,109 @@
 #define MAXNBMODES 10000	// maximum number of control modes
 #define MAX_NUMBER_TIMER 100
 
+// stored precision of control matrix (CPU multiply)
+#define CMPRECISION_FP32 0
+#define CMPRECISION_BF16 1
+#define CMPRECISION_INT8 2
+
+// real-time thread roles (AOloopControl_RTsched_set)
+#define AOLRTSCHED_NBROLE 6
+#define AOLRTSCHED_MAIN 0      // main loop thread (aolrun)
+#define AOLRTSCHED_HELPER 1    // main loop helper threads: GPU feeders, OpenMP
+#define AOLRTSCHED_MODEFILT 2  // open loop modes computation, modal filtering
+#define AOLRTSCHED_DMFILT 3    // mode coefficients to DM, filtered
+#define AOLRTSCHED_WFSZP 4     // WFS zero point update
+#define AOLRTSCHED_AUTOGAIN 5  // gain auto-tuning
+
+#define AOLRTSCHED_CPULISTLEN 64
+
+// main loop stages, timed by AOloopControl_looptiming_mark()
+#define AOLTIMING_WAIT 0      // wait for WFS frame
+#define AOLTIMING_READ 1      // copy WFS frame
+#define AOLTIMING_DARK 2      // dark subtraction and image total
+#define AOLTIMING_NORM 3      // normalization, reference subtraction
+#define AOLTIMING_MVM 4       // control matrix multiplication
+#define AOLTIMING_MODEFILT 5  // mode gains, limits and filtering
+#define AOLTIMING_DMWRITE 6   // DM write
+#define AOLTIMING_NBSTAGE 7
+#define AOLTIMING_NBCOL (AOLTIMING_NBSTAGE+2) // stages, total, iteration index
+#define AOLTIMING_NBOUTLIER 1000 // size of outlier capture stream
+
+#define AOLSTATSNAP_NBBLOCK 100 // max number of blocks in status snapshot
+
 
 // logging
-static int loadcreateshm_log = 0; // 1 if results should be logged in ASCII file
-static FILE *loadcreateshm_fplog;
+extern int loadcreateshm_log;      // 1 if results should be logged in ASCII file
+extern FILE *loadcreateshm_fplog;
+extern int loadcreateshm_fastpath; // 1 if streams matching their load stamp are not reloaded
+
+
+
+
+/**
+ * Real-time scheduling of one thread role
+ *
+ * @ingroup AOloopControl_AOLOOPCONTROL_CONF
+ */
+typedef struct
+{
+    int tid;                                /**< thread ID, 0 if unused */
+    int priority;                           /**< SCHED_FIFO priority */
+    int nbthread;                           /**< number of threads */
+    char cpulist[AOLRTSCHED_CPULISTLEN];    /**< CPU set, list format (e.g. "4-7,10"), empty if not pinned */
+} AOLOOPCONTROL_RTSCHED;
+
+
+
+
+/**
+ * Loop status snapshot, published by main loop every statsnapNBframe iterations
+ *
+ * Two copies are held in AOconf: the main loop fills the inactive copy and then flips statsnapindex,
+ * so that monitoring processes read a consistent snapshot without touching arrays written by the loop.
+ * seq is odd while the copy is being written.
+ *
+ * @ingroup AOloopControl_AOLOOPCONTROL_CONF
+ */
+typedef struct
+{
+    volatile uint64_t seq;                    /**< incremented before and after writing */
+    uint64_t loopcnt;                         /**< loop iteration counter at publication */
+    long NBframe;                             /**< number of iterations averaged */
+    double tspan;                             /**< time spanned by snapshot [s] */
+
+    int on;                                   /**< loop on/off */
+    int ARPFon;                               /**< predictive control on/off */
+    float gain;                               /**< loop gain */
+    float maxlimit;                           /**< maximum mode value */
+    float WFStotalflux;                       /**< WFS image total */
+
+    // timing
+    float loopfrequ;                          /**< loop frequency measured over snapshot [Hz] */
+    double stageus[AOLTIMING_NBSTAGE];        /**< average stage durations (AOLTIMING_WAIT ... AOLTIMING_DMWRITE) [us] */
+    double iterus;                            /**< average iteration time [us] */
+    double iterusmax;                         /**< maximum iteration time [us] */
+    float complatency_frame;                  /**< computation latency (non-wait fraction of iteration) [frame] */
+    float hardwlatency_frame;                 /**< hardware latency [frame] */
+    float wfsmextrlatency_frame;              /**< WFS mode extraction latency [frame] */
+
+    // blocks
+    long NBDMmodes;
+    long DMmodesNBblock;
+    long NBmodes_block[AOLSTATSNAP_NBBLOCK];
+    long indexmaxMB[AOLSTATSNAP_NBBLOCK];
+    float gainb[AOLSTATSNAP_NBBLOCK];
+    float limitb[AOLSTATSNAP_NBBLOCK];
+    float multfb[AOLSTATSNAP_NBBLOCK];
+    float blockave_Crms[AOLSTATSNAP_NBBLOCK];   /**< correction RMS */
+    float blockave_OLrms[AOLSTATSNAP_NBBLOCK];  /**< open loop RMS */
+    float blockave_WFSrms[AOLSTATSNAP_NBBLOCK]; /**< WFS residual RMS */
+    float blockave_limFrac[AOLSTATSNAP_NBBLOCK];/**< number of mode coefficients at limit per step */
+    float ALLave_Crms;
+    float ALLave_OLrms;
+    float ALLave_WFSrms;
+    float ALLave_limFrac;
+} AOLOOPCONTROL_STATUSSNAP;
 
 
 
@@ -113,6 +212,7 @@ typedef struct
     uint_fast32_t sizeWFS_active[100];        /**< Only takes into account WFS pixels in use/active for each slice */
     uint_fast64_t WFScnt;                     /**< WFS stream counter 0 value at WFS image read */
     uint_fast64_t WFScntRM;                   /**< WFS stream counter 0 value at WFS image read (RM acqu mode) */
+    uint_fast64_t WFScnttorn;                 /**< Number of WFS frames still torn after seqlock retries, or overwritten during zero-copy GPU read */
 
     int_fast8_t WFSnormalize;                 /**< 1 if each WFS frame should be normalized to 1 */
     float WFSnormfloor;                       /**< normalized by dividing by (total + AOconf[loop].WFSnormfloor)*AOconf[loop].WFSsize */
@@ -151,6 +251,7 @@ typedef struct
     uint_fast16_t NBmodes_block[100];         /**< number of modes within each block (computed from files by AOloopControl_loadconfigure) */
     uint_fast16_t modeBlockIndex[MAXNBMODES]; /**< block index to which each mode belongs (computed by AOloopControl_loadconfigure) */
     uint_fast16_t indexmaxMB[maxNBMB]; 
+    unsigned long long modeclipcnt_block[maxNBMB]; /**< cumulative number of mode values at limit, per block (main loop, CMMODE = 0) */
 
 	uint_fast16_t NBDMmodes;
 
@@ -199,6 +300,9 @@ typedef struct
 	///@{  	
     int_fast8_t ARPFon; // 1 if auto-regressive predictive filter is ON
 	float ARPFgain; 
+	long PFbuildNBblock; // number of PF blocks built in-process (aolPFbuildall)
+	float PFbuildtime[100]; // last filter rebuild time per PF block [s]
+	long PFbuildcnt[100]; // number of filter rebuilds per PF block
     ///@}
 	/* =============================================================================================== */
 
@@ -220,7 +324,31 @@ typedef struct
             
     int_fast8_t GPUall; // 1 if scaling computations done by GPU
     int_fast8_t GPUusesem; // 1 if using semaphores to control GPU
-    int_fast8_t AOLCOMPUTE_TOTAL_ASYNC; // 1 if performing image total in separate thread (runs faster, but image total dates from last frame)
+    int_fast8_t GPUasync; // GPU MVM transfers: 0 = compute threads + semaphores, 1 = pinned async copies + events, 2 = 1 + CUDA graph
+    int_fast8_t GPUbalance; // 1: partition control matrix across GPUs according to measured device throughput
+    long GPUfailover; // GPU MVM watchdog deadline [us]: stalled/failed GPU partition recomputed on CPU (0 = disabled)
+    long GPUfailovercnt; // number of GPU failures detected by watchdog (alarm if > 0)
+    int_fast8_t GPUzerocopy; // 1 if GPU MVM reads camera stream directly (requires GPUall = 1, CMMODE = 0, FLOAT camera stream)
+    int_fast8_t GPUzerocopyON; // 1 while zero-copy path is active: Read_cam_frame does not copy/dark-subtract frame
+    int_fast8_t AOLCOMPUTE_TOTAL_ASYNC; // not used: image total is computed in the dark subtraction pass (Read_cam_frame)
+    int_fast8_t PIXSTREAMpipe; // 1 if control matrix multiply is pipelined with WFS slice readout (CPU only)
+    int_fast8_t CMprecision; // control matrix stored precision in CPU multiply (CMPRECISION_FP32, _BF16, _INT8)
+    AOLOOPCONTROL_RTSCHED RTsched[AOLRTSCHED_NBROLE]; // real-time priority and CPU set of each thread role
+    long looptimingNBrow; // number of iterations in per-stage timing ring
+    float looptimingoutlus; // per-stage timing outlier capture threshold [us], 0 for 2 loop periods
+    long statsnapNBframe; // status snapshot publication interval [frame], 0 = disabled
+    int_fast8_t WFSresinloop; // 1 if WFS residual streams (aol<loop>_wfsres*) are computed in Read_cam_frame normalization pass
+    long WFSresdecim; // in-loop WFS residual: averaged streams (wfsres_ave, wfsresm_ave, wfsres_rms) updated every WFSresdecim frames
+    float WFSresalpha; // in-loop WFS residual: averaging coefficient per update
+    AOLOOPCONTROL_STATUSSNAP statsnap[2]; // status snapshot, double-buffered
+    volatile int statsnapindex; // copy of statsnap holding latest snapshot
+    uint64_t statsnapcnt; // number of snapshots published
+    int_fast8_t RTcheck; // 1 if main loop steady state is checked for name lookups and heap allocations
+    long RTcheckNBviol; // number of main loop iterations with name lookup or heap allocation (RTcheck = 1)
+    int_fast8_t CMhotswap; // 1 if new control matrix is prepared in background (standby buffer) and swapped at frame boundary
+    long CMswapcnt; // number of control matrix hot swaps
+    uint_fast64_t CMswaploopcnt; // loop iteration (cnt) of last control matrix swap
+    long CMswapCMcnt0; // control matrix stream counter (cnt0) of matrix swapped in
   
 	/* =============================================================================================== */
     
@@ -347,12 +475,57 @@ int_fast8_t AOloopControl_WFSzpupdate_loop(const char *IDzpdm_name, const char *
 
 int_fast8_t AOloopControl_WFSzeropoint_sum_update_loop(long loopnb, const char *ID_WFSzp_name, int NBzp, const char *IDwfsref0_name, const char *IDwfsref_name);
 
+/** @brief Sets real-time priority and CPU affinity of calling thread */
+int_fast8_t AOloopControl_RTsched_set(long loop, int role, int RT_priority);
+
+/** @brief Pins helper threads of main loop process */
+int_fast8_t AOloopControl_RTsched_pinhelpers(long loop);
+
+/** @brief Prints real-time scheduling status */
+int_fast8_t AOloopControl_RTsched_status();
+
+/** @brief Locks process memory */
+int_fast8_t AOloopControl_RTmemlock();
+
+/** @brief Starts steady state check of loop iteration */
+void AOloopControl_RTcheck_arm(long loop);
+
+/** @brief Ends steady state check of loop iteration */
+void AOloopControl_RTcheck_verify(long loop);
+
+/** @brief Creates per-stage timing streams */
+int_fast8_t AOloopControl_looptiming_init(long loop, long NBrow, float outlierus);
+
+/** @brief Marks start of loop iteration */
+void AOloopControl_looptiming_start();
+
+/** @brief Marks end of loop stage */
+void AOloopControl_looptiming_mark(int stage);
+
+/** @brief Writes iteration stage durations to timing ring */
+void AOloopControl_looptiming_commit(long loop);
+
+/** @brief Per-stage timing percentiles and outliers */
+int_fast8_t AOloopControl_looptiming_stats(long loop, float thresholdus, const char *fname);
+
 /** @brief Main loop function */
 int_fast8_t AOloopControl_run();
 
 
 int_fast8_t ControlMatrixMultiply( float *cm_array, float *imarray, long m, long n, float *outvect);
 
+/** @brief Quantize control matrix to INT8 with one scale factor per row */
+int_fast8_t AOloopControl_CMquantize_INT8(const float *cm_array, long m, long n, int8_t *qarray, float *scale);
+
+/** @brief Convert control matrix to BF16 */
+int_fast8_t AOloopControl_CMquantize_BF16(const float *cm_array, long m, long n, uint16_t *qarray);
+
+/** @brief Matrix-vector multiply, INT8 matrix, FP32 accumulation */
+int_fast8_t ControlMatrixMultiply_INT8(const int8_t *qarray, const float *scale, const float *imarray, long m, long n, float *outvect);
+
+/** @brief Matrix-vector multiply, BF16 matrix, FP32 accumulation */
+int_fast8_t ControlMatrixMultiply_BF16(const uint16_t *qarray, const float *imarray, long m, long n, float *outvect);
+
 /** @brief Sends modal commands to DM by matrix-vector multiplication */
 int_fast8_t set_DM_modes(long loop);
 
@@ -373,6 +546,8 @@ long AOloopControl_ComputeOpenLoopModes(long loop);
 
 int_fast8_t AOloopControl_AutoTuneGains(long loop, const char *IDout_name, float GainCoeff, long NBsamples);
 
+long AOloopControl_dm2dm_offloadM(const char *streamin, const char *streamout, const char *IDmatrix_name, float twait, float offcoeff, float multcoeff);
+
 long AOloopControl_dm2dm_offload(const char *streamin, const char *streamout, float twait, float offcoeff, float multcoeff);
 
 
@@ -488,6 +663,8 @@ int_fast8_t AOloopControl_set_modeblock_gain(long loop, long blocknb, float gain
 
 int_fast8_t AOloopControl_scanGainBlock(long NBblock, long NBstep, float gainStart, float gainEnd, long NBgain);
 
+int_fast8_t AOloopControl_scanGainBlock_multiplex(long NBstep, float dither, long NBcycle);
+
 
 
 
@@ -503,6 +680,8 @@ int_fast8_t AOloopControl_scanGainBlock(long NBblock, long NBstep, float gainSta
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+int_fast8_t AOloopControl_OptimizePSF_LO_SPSA(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes, long NBiter, float ampl, float gain);
+
 int_fast8_t AOloopControl_OptimizePSF_LO(const char *psfstream_name, const char *IDmodes_name, const char *dmstream_name, long delayframe, long NBframes);
 
 int_fast8_t AOloopControl_DMmodulateAB(const char *IDprobeA_name, const char *IDprobeB_name, const char *IDdmstream_name, const char *IDrespmat_name, const char *IDwfsrefstream_name, double delay, long NBprobes);
@@ -28,6 +28,7 @@
 #include <sched.h>
 #include <ncurses.h>
 #include <semaphore.h>
+#include <pthread.h>
 
 #include <fitsio.h>
 
@@ -46,6 +47,10 @@
 
 #include "AOloopControl_DM/AOloopControl_DM.h"
 
+#ifdef HAVE_CUDA
+#include "cudacomp/cudacomp.h"
+#endif
+
 #ifdef __MACH__
 #include <mach/mach_time.h>
 #define CLOCK_REALTIME 0
@@ -71,13 +76,12 @@ extern DATA data;
 int wcol, wrow; // window size
 
 
-struct timespec semwaitts;
-
-
 
 
 
 #define DMSTROKE100 0.7 // um displacement for 100V
+#define DMCOMB_NBDMMAX 10 // max number of DMs combined in one process
+#define DMCOMB_RESYNC_PERIODUS 100000 // full channel re-summation period [us] (bounds round-off drift of incremental sum)
 
 long NB_DMindex = 9;
 
@@ -91,6 +95,235 @@ int dmturb_loaded = 0;
 int SMturbfd;
 
 
+// wfsref offset computation, runs in its own thread: never delays DM output
+typedef struct
+{
+    long DMindex;
+    long IDin;                   // weighted sum of non-loop channels = projection input
+    int GPUdevice;               // -1 if CPU
+    long IDgpuout;               // GPU MVM result, copied to wfsref output once complete
+    sem_t trigsem;               // posted by DM combine loop when non-loop channel changes
+    volatile int ON;
+} DMCOMB_WFSREF;
+
+static DMCOMB_WFSREF dmcombwfsref[DMCOMB_NBDMMAX];
+
+// multi-DM combiner (AOloopControl_DM_CombineChannels_multi): one thread per DM in same process
+typedef struct
+{
+    long DMindex;
+    long xsize;
+    long ysize;
+    int NBchannel;
+    int AveMode;
+    int dm2dm_mode;
+    char dm2dm_DMmodes[200];
+    char dm2dm_outdisp[200];
+    int wfsrefmode;
+    char wfsref_WFSRespMat[200];
+    char wfsref_out[200];
+    int voltmode;
+    char IDvolt_name[200];
+    float DClevel;
+    float maxvolt;
+} DMCOMB_ARGS;
+
+static pthread_mutex_t dmcomb_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes image table changes across DM threads
+static int dmcomb_GPUclaimed = 0;                                 // GPU projections: one DM per process
+
+#define DMCOMB_GPUINDEX_DM2DM 0     // cudacomp MVM index used for dm2dm
+#define DMCOMB_GPUINDEX_WFSREF 2    // cudacomp MVM index used for wfsref
+#define DMCOMB_GPULOOPNB 90         // cudacomp semaphore names: loop number offset, distinct from AO loops
+
+#define DMVOLT2DAC (16384.0/300.0)  // DAC units per volt
+#define DMVOLTLUT_NBPTMAX 64        // disp->V calibration table: max number of points per actuator (fixed stream size)
+
+
+
+
+
+/**
+ * @brief Apply change of one DM channel to cached channel sum
+ *
+ * sum += gain x chan - gain_old x cache, then cache <- chan
+ */
+HOTKERNEL static void AOloopControl_DM_CombineChannels_delta(float * restrict sum, float * restrict cache, const float * restrict chan, float gain, float gain_old, long n)
+{
+    long ii;
+
+    #pragma omp simd
+    for(ii=0; ii<n; ii++)
+    {
+        float v = chan[ii];
+
+        sum[ii] += gain*v - gain_old*cache[ii];
+        cache[ii] = v;
+    }
+}
+
+
+
+/**
+ * @brief Full weighted sum of cached DM channels
+ */
+HOTKERNEL static void AOloopControl_DM_CombineChannels_sum(float * restrict sum, const float * restrict cache, const float *gain, int NBchannel, long n)
+{
+    long ii;
+    int ch;
+
+    #pragma omp simd
+    for(ii=0; ii<n; ii++)
+        sum[ii] = gain[0]*cache[ii];
+
+    for(ch=1; ch<NBchannel; ch++)
+    {
+        const float * restrict cachech = cache + ch*n;
+        float g = gain[ch];
+
+        #pragma omp simd
+        for(ii=0; ii<n; ii++)
+            sum[ii] += g*cachech[ii];
+    }
+}
+
+
+
+/**
+ * @brief DM to DM offload: out = mult x (out + coeff x in)
+ */
+HOTKERNEL static void AOloopControl_DM_offload_apply(float * restrict out, const float * restrict in, float coeff, float mult, long n)
+{
+    long ii;
+
+    #pragma omp simd
+    for(ii=0; ii<n; ii++)
+        out[ii] = mult*(out[ii] + coeff*in[ii]);
+}
+
+
+
+/**
+ * @brief Per-actuator piecewise-linear displacement to DAC conversion
+ *
+ * lut[ii*DMVOLTLUT_NBPTMAX+k] is actuator ii voltage at displacement disp0 + k/invstep, k < NBpt.
+ * Displacement clipped to table range, voltage clipped to [0, maxvolt].
+ */
+HOTKERNEL static void AOloopControl_DM_disp2V_LUT(unsigned short int * restrict volt, const float * restrict disp, const float * restrict lut, long NBpt, float disp0, float invstep, float maxvolt, long n)
+{
+    long ii;
+    const float xmax = (float) (NBpt-1);
+
+    #pragma omp simd
+    for(ii=0; ii<n; ii++)
+    {
+        float x = (disp[ii]-disp0)*invstep;
+        long k;
+        float v;
+
+        x = (x < 0.0f) ? 0.0f : x;
+        x = (x > xmax) ? xmax : x;
+        k = (long) x;
+        k = (k > NBpt-2) ? NBpt-2 : k;
+        v = lut[ii*DMVOLTLUT_NBPTMAX+k] + (x-k)*(lut[ii*DMVOLTLUT_NBPTMAX+k+1]-lut[ii*DMVOLTLUT_NBPTMAX+k]);
+        v = (v > maxvolt) ? maxvolt : v;
+        v = (v < 0.0f) ? 0.0f : v;
+        volt[ii] = (unsigned short int) (v*DMVOLT2DAC);
+    }
+}
+
+
+
+/**
+ * @brief wfsref offset thread: wfsref_out = RespMat x (weighted sum of non-loop channels)
+ *
+ * Waits for trigger from DM combine loop, recomputes (GPU if available) then sleeps to enforce wfsref_dtmin.
+ * Pending trigger received during computation is processed at next iteration.
+ */
+static void *AOloopControl_DM_wfsref_thread(void *ptr)
+{
+    DMCOMB_WFSREF *wr = (DMCOMB_WFSREF*) ptr;
+    long DMindex = wr->DMindex;
+    long sizexy = dmdispcombconf[DMindex].xysize;
+    long sizexywfsref = dmdispcombconf[DMindex].xsizewfsref*dmdispcombconf[DMindex].ysizewfsref;
+    long IDout = dmdispcombconf[DMindex].ID_wfsref_out;
+    long IDRM = dmdispcombconf[DMindex].ID_wfsref_RespMat;
+    float *in = data.image[wr->IDin].array.F;
+    long ch, ii, kk;
+    struct timespec t0, t1;
+    long dtus;
+#ifdef HAVE_CUDA
+    int_fast8_t status;
+    int_fast8_t GPUstatus[100];
+#endif
+
+    while(1)
+    {
+        sem_wait(&wr->trigsem);
+        if(wr->ON == 0)
+            break;
+
+        clock_gettime(CLOCK_REALTIME, &t0);
+
+        data.image[wr->IDin].md[0].write = 1;
+        memset(in, 0, sizeof(float)*sizexy);
+        for(ch=0; ch<dmdispcombconf[DMindex].NBchannel; ch++)
+        {
+            const float * restrict chptr = data.image[dmdispcombconf[DMindex].dmdispID[ch]].array.F;
+            float g = (ch == 0) ? 1.0 : dmdispcombconf[DMindex].dmdispgain[ch];
+
+            if(ch == dmdispcombconf[DMindex].wfsref_loopchan) // loop channel excluded
+                continue;
+
+            #pragma omp simd
+            for(ii=0; ii<sizexy; ii++)
+                in[ii] += g*chptr[ii];
+        }
+        data.image[wr->IDin].md[0].cnt0++;
+        data.image[wr->IDin].md[0].write = 0;
+
+#ifdef HAVE_CUDA
+        if(wr->GPUdevice >= 0)
+        {
+            status = 0;
+            GPU_loop_MultMat_execute(DMCOMB_GPUINDEX_WFSREF, &status, &GPUstatus[0], 1.0, 0.0, 0);
+
+            data.image[IDout].md[0].write = 1;
+            memcpy(data.image[IDout].array.F, data.image[wr->IDgpuout].array.F, sizeof(float)*sizexywfsref);
+            COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+            data.image[IDout].md[0].cnt0++;
+            data.image[IDout].md[0].write = 0;
+        }
+        else
+#endif
+        {
+            float * restrict out = data.image[IDout].array.F;
+
+            data.image[IDout].md[0].write = 1;
+            memset(out, 0, sizeof(float)*sizexywfsref);
+            for(kk=0; kk<sizexy; kk++)
+            {
+                const float * restrict RM = data.image[IDRM].array.F + kk*sizexywfsref;
+                float v = in[kk];
+
+                #pragma omp simd
+                for(ii=0; ii<sizexywfsref; ii++)
+                    out[ii] += v*RM[ii];
+            }
+            data.image[IDout].md[0].cnt0++;
+            data.image[IDout].md[0].write = 0;
+            sem_post(data.image[IDout].semptr[0]);
+        }
+        dmdispcombconf[DMindex].wfsrefcnt++;
+
+        // rate limit
+        clock_gettime(CLOCK_REALTIME, &t1);
+        dtus = (long) (1.0e6*(t1.tv_sec - t0.tv_sec) + 1.0e-3*(t1.tv_nsec - t0.tv_nsec));
+        if(dtus < dmdispcombconf[DMindex].wfsref_dtmin)
+            usleep(dmdispcombconf[DMindex].wfsref_dtmin - dtus);
+    }
+
+    pthread_exit(NULL);
+}
 
 
 
@@ -158,6 +391,16 @@ int_fast8_t AOloopControl_DM_CombineChannels_cli()
     return 1;
 }
 
+int_fast8_t AOloopControl_DM_CombineChannels_multi_cli(){
+    if(CLI_checkarg(1,3)==0){
+        AOloopControl_DM_CombineChannels_multi(data.cmdargtoken[1].val.string);
+        return 0;}    else        return 1;}
+
+int_fast8_t AOloopControl_DM_setoffload_cli(){
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,1)==0){
+        AOloopControl_DM_setoffload(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf);
+        return 0;}    else        return 1;}
+
 int_fast8_t AOloopControl_DM_dmdispcomboff_cli(){
         if(CLI_checkarg(1,2)==0){
         AOloopControl_DM_dmdispcomboff(data.cmdargtoken[1].val.numl);
@@ -228,6 +471,21 @@ int_fast8_t AOloopControl_DM_setTrigSem_cli() {
         AOloopControl_DM_setTrigSem(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl);
         return 0;}    else        return 1;}
 
+int_fast8_t AOloopControl_DM_setTrigDelay_cli() {
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,1)+CLI_checkarg(3,1)+CLI_checkarg(4,2)==0) {
+        AOloopControl_DM_setTrigDelay(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numl);
+        return 0;}    else        return 1;}
+
+int_fast8_t AOloopControl_DM_setwfsref_cli() {
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,2)==0) {
+        AOloopControl_DM_setwfsref(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl);
+        return 0;}    else        return 1;}
+
+int_fast8_t AOloopControl_DM_setvoltLUT_cli() {
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,3)+CLI_checkarg(3,1)+CLI_checkarg(4,1)==0) {
+        AOloopControl_DM_setvoltLUT(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numf);
+        return 0;}    else        return 1;}
+
 
 
 
@@ -250,6 +508,16 @@ int_fast8_t AOloopControl_DM_dmturb2im_cli(){
         AOloopControl_DM_dmturb(data.cmdargtoken[1].val.numl, 1, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl);
         return 0;}    else        return 1;}
 
+int_fast8_t AOloopControl_DM_dmturb_stream_cli(){
+    if(CLI_checkarg(1,2)==0){
+        AOloopControl_DM_dmturb_stream(data.cmdargtoken[1].val.numl);
+        return 0;}    else        return 1;}
+
+int_fast8_t AOloopControl_DM_dmturb_layer_cli(){
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,1)+CLI_checkarg(4,1)+CLI_checkarg(5,1)==0){
+        AOloopControl_DM_dmturb_layer(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numf);
+        return 0;}    else        return 1;}
+
 int_fast8_t AOloopControl_DM_dmturboff_cli(){
     if(CLI_checkarg(1,2)==0){
         AOloopControl_DM_dmturboff(data.cmdargtoken[1].val.numl);
@@ -348,6 +616,24 @@ int init_AOloopControl_DM()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int NBchannel, int AveMode, int dm2dm_mode, const char *dm2dm_DMmodes, const char *dm2dm_outdisp, int wfsrefmode, const char *wfsref_WFSRespMat, const char *wfsref_out, int voltmode, const char *IDvolt_name, float DClevel, float maxvolt)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"aolcontrolDMcombmulti");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_CombineChannels_multi_cli;
+    strcpy(data.cmd[data.NBcmd].info,"combine channels of several DMs in single process (one thread per DM), one aolcontrolDMcomb argument line per DM in file");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DM list file>");
+    strcpy(data.cmd[data.NBcmd].example,"aolcontrolDMcombmulti ./conf/dmcomb.txt");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_CombineChannels_multi(const char *fname)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"aolsetdmoffload");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_setoffload_cli;
+    strcpy(data.cmd[data.NBcmd].info,"offload DM channel sum to other DM channel from combine loop: out = mult x (out + coeff x in), DMout -1 to turn off");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <DMout> <channel> <min interval [us]> <offloadcoeff> <multcoeff>");
+    strcpy(data.cmd[data.NBcmd].example,"aolsetdmoffload 1 0 2 500000 -0.01 0.999");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setoffload(long DMindex, long DMindexout, int chan, long dtmin, float offcoeff, float multcoeff)");
+    data.NBcmd++;
+
     strcpy(data.cmd[data.NBcmd].key,"aoloopcontroldmcomboff");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp =  AOloopControl_DM_dmdispcomboff_cli;
@@ -442,8 +728,8 @@ int init_AOloopControl_DM()
 	strcpy(data.cmd[data.NBcmd].key,"aolsetdmTrigMode");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp = AOloopControl_DM_setTrigMode_cli;
-    strcpy(data.cmd[data.NBcmd].info,"set DM trigger mode (0:std, 1:use single channel)");
-    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <TrigMode [0, 1]>");
+    strcpy(data.cmd[data.NBcmd].info,"set DM trigger mode (0:std, 1:use single channel, 2:single channel, release at fixed delay after channel atime)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <TrigMode [0, 1, 2]>");
     strcpy(data.cmd[data.NBcmd].example,"aolsetdmTrigMode 0 1");
     strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setTrigMode(long DMindex, int mode)");
     data.NBcmd++;
@@ -466,6 +752,33 @@ int init_AOloopControl_DM()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setTrigSem(long DMindex, int sem)");
     data.NBcmd++;
 
+	strcpy(data.cmd[data.NBcmd].key,"aolsetdmTrigDelay");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_setTrigDelay_cli;
+    strcpy(data.cmd[data.NBcmd].info,"set TrigMode 2 release delay after trigger channel atime, computation lead time, late frame policy (0:write, 1:drop)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <delay [us]> <lead [us]> <late policy [0, 1]>");
+    strcpy(data.cmd[data.NBcmd].example,"aolsetdmTrigDelay 0 300.0 20.0 0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setTrigDelay(long DMindex, float delayus, float leadus, int latepolicy)");
+    data.NBcmd++;
+
+	strcpy(data.cmd[data.NBcmd].key,"aolsetdmwfsref");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_setwfsref_cli;
+    strcpy(data.cmd[data.NBcmd].info,"set wfsref offset loop channel (excluded, -1 if none) and minimum update interval [us]");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <loop channel> <min interval [us]>");
+    strcpy(data.cmd[data.NBcmd].example,"aolsetdmwfsref 0 3 10000");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setwfsref(long DMindex, int loopchan, long dtmin)");
+    data.NBcmd++;
+
+	strcpy(data.cmd[data.NBcmd].key,"aolsetdmvoltLUT");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_setvoltLUT_cli;
+    strcpy(data.cmd[data.NBcmd].info,"set per-actuator disp->V calibration table (cube, one slice [V] per displacement point), \"none\" to revert to sqrt law");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <LUT cube> <disp first slice [um]> <disp last slice [um]>");
+    strcpy(data.cmd[data.NBcmd].example,"aolsetdmvoltLUT 0 dmcalib 0.0 1.5");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_setvoltLUT(long DMindex, const char *IDlut_name, float disp0, float disp1)");
+    data.NBcmd++;
+
 
 
 
@@ -504,6 +817,24 @@ int init_AOloopControl_DM()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_dmturb(long DMindex, int mode, const char *IDout_name, long NBsamples)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"aoloopcontroldmturbstream");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_dmturb_stream_cli;
+    strcpy(data.cmd[data.NBcmd].info,"DM turbulence, streaming multi-layer generator (no master screen, non-repeating)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)>");
+    strcpy(data.cmd[data.NBcmd].example,"aoloopcontroldmturbstream 0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_dmturb_stream(long DMindex)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"aoloopcontroldmturblayer");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOloopControl_DM_dmturb_layer_cli;
+    strcpy(data.cmd[data.NBcmd].info,"set streaming turbulence layer (weight, wind speed coeff, direction)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<DMindex (0-9)> <layer> <weight> <wspeed coeff> <angle [rad]>");
+    strcpy(data.cmd[data.NBcmd].example,"aoloopcontroldmturblayer 0 1 0.5 2.0 0.3");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOloopControl_DM_dmturb_layer(long DMindex, long layer, double weight, double wspeedcoeff, double angle)");
+    data.NBcmd++;
+
     strcpy(data.cmd[data.NBcmd].key,"aoloopcontroldmturboff");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp =  AOloopControl_DM_dmturboff_cli;
@@ -614,6 +945,24 @@ static struct timespec time_diff(struct timespec start, struct timespec end)
 }
 
 
+/** @brief Add ns nanoseconds (may be negative) to ts */
+static void timespec_addns(struct timespec *ts, long ns)
+{
+    ts->tv_sec += ns / 1000000000L;
+    ts->tv_nsec += ns % 1000000000L;
+    if(ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+    else if(ts->tv_nsec < 0)
+    {
+        ts->tv_sec--;
+        ts->tv_nsec += 1000000000L;
+    }
+}
+
+
 
 
 // local copy of function in module AtmosphericTurbulence
@@ -774,6 +1123,7 @@ static int AOloopControl_DM_createconf()
 {
     int result;
     int ch;
+    int lutbuff;
     char fname[200];
     long DMindex;
     char errstr[200];
@@ -828,6 +1178,34 @@ static int AOloopControl_DM_createconf()
 			dmdispcombconf[DMindex].TrigMode = 0;
 			dmdispcombconf[DMindex].TrigChan = 0;
 			dmdispcombconf[DMindex].TrigSem = 0;
+			dmdispcombconf[DMindex].TrigDelay = 0;
+			dmdispcombconf[DMindex].TrigLead = 20000; // 20 us
+			dmdispcombconf[DMindex].TrigLatePolicy = 0;
+			dmdispcombconf[DMindex].latecnt = 0;
+			dmdispcombconf[DMindex].dropcnt = 0;
+			dmdispcombconf[DMindex].tlatency = 0.0;
+
+            dmdispcombconf[DMindex].wfsref_loopchan = -1;
+            dmdispcombconf[DMindex].wfsref_dtmin = 10000; // 100 Hz
+            dmdispcombconf[DMindex].wfsrefcnt = 0;
+
+            dmdispcombconf[DMindex].offloadmode = 0;
+            dmdispcombconf[DMindex].offloadDMindex = 0;
+            dmdispcombconf[DMindex].offloadchan = 0;
+            dmdispcombconf[DMindex].offload_dtmin = 0;
+            dmdispcombconf[DMindex].offloadcoeff = 0.0;
+            dmdispcombconf[DMindex].offloadmult = 1.0;
+            dmdispcombconf[DMindex].offloadcnt = 0;
+
+            dmdispcombconf[DMindex].voltLUTmode = 0;
+            dmdispcombconf[DMindex].voltLUTbuff = 0;
+            for(lutbuff=0; lutbuff<2; lutbuff++)
+            {
+                dmdispcombconf[DMindex].voltLUT_NBpt[lutbuff] = 0;
+                dmdispcombconf[DMindex].voltLUT_disp0[lutbuff] = 0.0;
+                dmdispcombconf[DMindex].voltLUT_invstep[lutbuff] = 0.0;
+            }
+            dmdispcombconf[DMindex].voltLUTcnt = 0;
 
 
             dmdispcombconf[DMindex].IDdisp = -1;
@@ -921,11 +1299,39 @@ int AOloopControl_DM_disp2V(long DMindex)
 {
     long ii;
     float volt;
+    static long IDvoltLUT[DM_NUMBER_CHANMAX];
+    static int voltLUTinit = 0;
+    char name[200];
+    int lutbuff;
+
+
+    // connect to calibration table (fixed size stream, two buffers)
+    if((voltLUTinit == 0)||((dmdispcombconf[DMindex].voltLUTmode==1)&&(IDvoltLUT[DMindex] == -1)))
+    {
+        pthread_mutex_lock(&dmcomb_mutex);
+        if(voltLUTinit == 0)
+        {
+            for(ii=0; ii<DM_NUMBER_CHANMAX; ii++)
+                IDvoltLUT[ii] = -1;
+            voltLUTinit = 1;
+        }
+        if(dmdispcombconf[DMindex].voltLUTmode==1)
+        {
+            sprintf(name, "dm%02ldvoltLUT", DMindex);
+            IDvoltLUT[DMindex] = image_ID(name);
+            if(IDvoltLUT[DMindex] == -1)
+                IDvoltLUT[DMindex] = read_sharedmem_image(name);
+        }
+        pthread_mutex_unlock(&dmcomb_mutex);
+    }
 
 
 	data.image[dmdispcombconf[DMindex].IDvolt].md[0].write = 1;
 		
-	if(dmdispcombconf[DMindex].voltON==1)
+	lutbuff = __atomic_load_n(&dmdispcombconf[DMindex].voltLUTbuff, __ATOMIC_ACQUIRE);
+	if((dmdispcombconf[DMindex].voltON==1)&&(dmdispcombconf[DMindex].voltLUTmode==1)&&(IDvoltLUT[DMindex]!=-1))
+        AOloopControl_DM_disp2V_LUT(data.image[dmdispcombconf[DMindex].IDvolt].array.UI16, data.image[dmdispcombconf[DMindex].IDdisp].array.F, data.image[IDvoltLUT[DMindex]].array.F + lutbuff*DMVOLTLUT_NBPTMAX*dmdispcombconf[DMindex].xysize, dmdispcombconf[DMindex].voltLUT_NBpt[lutbuff], dmdispcombconf[DMindex].voltLUT_disp0[lutbuff], dmdispcombconf[DMindex].voltLUT_invstep[lutbuff], dmdispcombconf[DMindex].MAXVOLT, dmdispcombconf[DMindex].xysize);
+	else if(dmdispcombconf[DMindex].voltON==1)
 		{
 			for(ii=0; ii<dmdispcombconf[DMindex].xysize; ii++)
 				{
@@ -1008,6 +1414,7 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     struct sched_param schedpar;
     int r;
     long sizexy;
+    struct timespec semwaitts; // local: CombineChannels_multi runs one instance per thread
     float *dmdispptr;
     float *dmdispptr_array[20];
     long IDdispt;
@@ -1021,7 +1428,6 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     long IDtmpoutdm;
     long kk;
     long sizexywfsref;
-    long IDtmpoutref;
     long cntch;
     
 	long IDvar;
@@ -1032,12 +1438,42 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     
     // timing
     struct timespec ttrig;
+    struct timespec tdeadline;   // TrigMode 2 release time
+    struct timespec twake;
+    struct timespec twrite;
+    struct timespec tframe;      // TrigMode 2 trigger channel atime
+    long IDtrig;
+    sem_t *trigsemptr;
     struct timespec t1;
     struct timespec tnow;
 	struct timespec tdiff;
 	double tdiffv;
     
     int DMupdate;
+
+    // incremental channel summation
+    float *dmdispsum;                            // weighted sum of channels
+    float *dmdispcache;                          // channel values included in dmdispsum
+    float dmdispsumgain[DM_NUMBER_CHANMAX];      // channel gains included in dmdispsum
+    long long dmdispsumcnt[DM_NUMBER_CHANMAX];   // channel counters included in dmdispsum
+    long NBupdate = 0;
+    struct timespec tresync;                     // time of last full re-summation
+    long long cntch1;
+    float gainch;
+
+    // offload to other DM channel
+    long IDoffload = -1;
+    long offloadtarget = -1;     // DMindex*100+channel connected to IDoffload
+    struct timespec toffload;
+
+    // dm2dm and wfsref projections
+    int DMGPUdevice = -1;        // GPU device for projections (variable DMGPU), -1 if CPU
+    int wfsrefupdate;
+    pthread_t wfsrefthread;
+#ifdef HAVE_CUDA
+    int_fast8_t GPUstatus[100];
+    int_fast8_t gpustatus;
+#endif
     
     
     
@@ -1048,12 +1484,31 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     }
     
     
+    // setup is serialized with other DM threads (image table), released before loop
+    pthread_mutex_lock(&dmcomb_mutex);
+
     printf("Setting up DM #%ld\n", DMindex); 
     
     list_variable_ID();
     IDvar = variable_ID("DMTWAIT");
     if(IDvar!=-1)
 		DMtwaitus = (long) (data.variable[IDvar].value.f);
+
+#ifdef HAVE_CUDA
+    IDvar = variable_ID("DMGPU");
+    if(IDvar!=-1)
+        DMGPUdevice = (int) (data.variable[IDvar].value.f);
+    if(DMGPUdevice >= 0)
+    {
+        if(dmcomb_GPUclaimed == 1)
+        {
+            printf("DM %ld: GPU projections already used by other DM in this process -> CPU\n", DMindex);
+            DMGPUdevice = -1;
+        }
+        else
+            dmcomb_GPUclaimed = 1;
+    }
+#endif
     
     
     
@@ -1179,9 +1634,12 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
                 printERROR(__FILE__,__func__,__LINE__, errstr);
                 exit(0);
             }
-        printf("Creating image %s   %ld x %ld\n", "_tmpoutref", dmdispcombconf[DMindex].xsizewfsref, dmdispcombconf[DMindex].ysizewfsref);
-        fflush(stdout);
-        IDtmpoutref = create_2Dimage_ID("_tmpoutref", dmdispcombconf[DMindex].xsizewfsref, dmdispcombconf[DMindex].ysizewfsref);
+        if(data.image[dmdispcombconf[DMindex].ID_wfsref_RespMat].md[0].size[2] != xsize*ysize)
+            {
+                sprintf(errstr, "image \"%s\" should have z axis = %ld", wfsref_WFSRespMat, xsize*ysize);
+                printERROR(__FILE__,__func__,__LINE__, errstr);
+                exit(0);
+            }
         sizexywfsref = dmdispcombconf[DMindex].xsizewfsref*dmdispcombconf[DMindex].ysizewfsref;
 		
        COREMOD_MEMORY_image_set_createsem(wfsref_out, 10);
@@ -1212,6 +1670,9 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     IDdispt = create_image_ID(name, naxis, size, _DATATYPE_FLOAT, 0, 0);
     dmdispptr = data.image[IDdispt].array.F;
 
+    dmdispsum = (float*) malloc(sizeof(float)*sizexy);
+    dmdispcache = (float*) malloc(sizeof(float)*sizexy*dmdispcombconf[DMindex].NBchannel);
+
     if(dmdispcombconf[DMindex].voltmode==1)
     {
         IDvolt = image_ID(dmdispcombconf[DMindex].voltname);
@@ -1235,7 +1696,41 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
             dmdispcombconf[DMindex].IDvolt = image_ID(dmdispcombconf[DMindex].voltname);
     }
 
+    // projections: GPU setup, wfsref thread
+    // GPU MVM writes to local buffers: result is copied and published to output streams when complete
+#ifdef HAVE_CUDA
+    if(DMGPUdevice >= 0)
+    {
+        if(dm2dm_mode == 1)
+        {
+            sprintf(name, "dm%02lddisp", DMindex);
+            GPU_loop_MultMat_setup(DMCOMB_GPUINDEX_DM2DM, dm2dm_DMmodes, name, "_tmpoutdm", 1, &DMGPUdevice, 1, 1, 1, DMCOMB_GPULOOPNB+DMindex);
+        }
+    }
+#endif
+    if(wfsrefmode == 1)
+    {
+        sprintf(name, "dm%02lddispwfsrefin", DMindex);
+        dmcombwfsref[DMindex].IDin = create_image_ID(name, naxis, size, _DATATYPE_FLOAT, 0, 0);
+        dmcombwfsref[DMindex].DMindex = DMindex;
+        dmcombwfsref[DMindex].GPUdevice = DMGPUdevice;
+        dmcombwfsref[DMindex].IDgpuout = -1;
+#ifdef HAVE_CUDA
+        if(DMGPUdevice >= 0)
+        {
+            sprintf(sname, "_dm%02ldwfsrefgpuout", DMindex);
+            dmcombwfsref[DMindex].IDgpuout = create_2Dimage_ID(sname, dmdispcombconf[DMindex].xsizewfsref, dmdispcombconf[DMindex].ysizewfsref);
+            GPU_loop_MultMat_setup(DMCOMB_GPUINDEX_WFSREF, wfsref_WFSRespMat, name, sname, 1, &DMGPUdevice, 1, 1, 1, DMCOMB_GPULOOPNB+DMindex);
+        }
+#endif
+        dmcombwfsref[DMindex].ON = 1;
+        sem_init(&dmcombwfsref[DMindex].trigsem, 0, 0);
+        pthread_create(&wfsrefthread, NULL, AOloopControl_DM_wfsref_thread, (void*) &dmcombwfsref[DMindex]);
+    }
+
     cntsumold = 0;
+    clock_gettime(CLOCK_REALTIME, &tdeadline);
+    tframe = tdeadline;
 
     
     dmdispcombconf[0].status = 1;
@@ -1288,6 +1783,9 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
     
     
     list_image_ID();
+    clock_gettime(CLOCK_REALTIME, &toffload);
+
+    pthread_mutex_unlock(&dmcomb_mutex);
     
     
     while(dmdispcombconf[DMindex].ON == 1)
@@ -1304,7 +1802,10 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
 		}
 		semwaitts.tv_nsec += dmdispcombconf[DMindex].nsecwait;
 		if(semwaitts.tv_nsec >= 1000000000)
+		{
 			semwaitts.tv_sec = semwaitts.tv_sec + 1;
+			semwaitts.tv_nsec -= 1000000000;
+		}
 
 
 		DMupdate = 0;
@@ -1328,13 +1829,57 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
         }
         else
 		{
-			sem_timedwait(data.image[dmdispcombconf[DMindex].dmdispID[dmdispcombconf[DMindex].TrigChan]].semptr[dmdispcombconf[DMindex].dmdispID[dmdispcombconf[DMindex].TrigSem]], &semwaitts);
-			cnt = data.image[dmdispcombconf[DMindex].dmdispID[dmdispcombconf[DMindex].TrigChan]].md[0].cnt0;
+			IDtrig = dmdispcombconf[DMindex].dmdispID[dmdispcombconf[DMindex].TrigChan];
+			trigsemptr = data.image[IDtrig].semptr[dmdispcombconf[DMindex].TrigSem];
+
+			sem_timedwait(trigsemptr, &semwaitts);
+			cnt = data.image[IDtrig].md[0].cnt0;
 			if(cnt!=cntold)
 				{
 					DMupdate = 1;
 					cntold=cnt;
 				}
+
+			//
+			// TrigMode 2: release at fixed delay after trigger channel atime (WFS frame time, set by channel writer)
+			// wait until TrigLead before release; newer frame arriving meanwhile supersedes pending one (merged)
+			//
+			if((DMupdate==1)&&(dmdispcombconf[DMindex].TrigMode==2))
+			{
+				tframe = data.image[IDtrig].md[0].atime.ts;
+				if(tframe.tv_sec == 0) // atime not set by writer
+					clock_gettime(CLOCK_REALTIME, &tframe);
+				tdeadline = tframe;
+				timespec_addns(&tdeadline, dmdispcombconf[DMindex].TrigDelay);
+				twake = tdeadline;
+				timespec_addns(&twake, -dmdispcombconf[DMindex].TrigLead);
+
+				while(sem_timedwait(trigsemptr, &twake) == 0)
+				{
+					cnt = data.image[IDtrig].md[0].cnt0;
+					if(cnt!=cntold)
+					{
+						cntold = cnt;
+						dmdispcombconf[DMindex].dropcnt++;
+						tframe = data.image[IDtrig].md[0].atime.ts;
+						if(tframe.tv_sec == 0)
+							clock_gettime(CLOCK_REALTIME, &tframe);
+						tdeadline = tframe;
+						timespec_addns(&tdeadline, dmdispcombconf[DMindex].TrigDelay);
+						twake = tdeadline;
+						timespec_addns(&twake, -dmdispcombconf[DMindex].TrigLead);
+					}
+				}
+
+				clock_gettime(CLOCK_REALTIME, &tnow);
+				tdiff = time_diff(tdeadline, tnow);
+				if((tdiff.tv_sec >= 0)&&(dmdispcombconf[DMindex].TrigLatePolicy==1)) // late, drop: channel values merged in next update
+				{
+					dmdispcombconf[DMindex].latecnt++;
+					dmdispcombconf[DMindex].dropcnt++;
+					DMupdate = 0;
+				}
+			}
         }
         
             
@@ -1345,12 +1890,42 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
             dmdispcombconf[0].status = 3;
             cnt++;
 
-            memcpy (data.image[IDdispt].array.F, dmdispptr_array[0], sizeof(float)*sizexy);
-            for(ch=1; ch<dmdispcombconf[DMindex].NBchannel; ch++)
+            // channel 0 has unity gain
+            // only channels with new counter or gain are applied, as delta to cached sum
+            // full sum at first update, then every DMCOMB_RESYNC_PERIODUS (round-off drift, writes without counter update)
+            NBupdate++;
+            wfsrefupdate = 0;
+            if(NBupdate > 1)
+                tdiff = time_diff(tresync, ttrig);
+            if((NBupdate == 1)||(1.0e6*tdiff.tv_sec + 1.0e-3*tdiff.tv_nsec > DMCOMB_RESYNC_PERIODUS))
+            {
+                tresync = ttrig;
+                wfsrefupdate = 1;
+                for(ch=0; ch<dmdispcombconf[DMindex].NBchannel; ch++)
+                {
+                    dmdispsumcnt[ch] = data.image[dmdispcombconf[DMindex].dmdispID[ch]].md[0].cnt0;
+                    dmdispsumgain[ch] = (ch == 0) ? 1.0 : dmdispcombconf[DMindex].dmdispgain[ch];
+                    memcpy(dmdispcache + ch*sizexy, dmdispptr_array[ch], sizeof(float)*sizexy);
+                }
+                AOloopControl_DM_CombineChannels_sum(dmdispsum, dmdispcache, dmdispsumgain, dmdispcombconf[DMindex].NBchannel, sizexy);
+            }
+            else
             {
-                for(ii=0; ii<sizexy; ii++)
-                    dmdispptr[ii] += dmdispcombconf[DMindex].dmdispgain[ch]*dmdispptr_array[ch][ii];
+                for(ch=0; ch<dmdispcombconf[DMindex].NBchannel; ch++)
+                {
+                    cntch1 = data.image[dmdispcombconf[DMindex].dmdispID[ch]].md[0].cnt0; // read before data: concurrent write is caught at next update
+                    gainch = (ch == 0) ? 1.0 : dmdispcombconf[DMindex].dmdispgain[ch];
+                    if((cntch1 != dmdispsumcnt[ch])||(gainch != dmdispsumgain[ch]))
+                    {
+                        AOloopControl_DM_CombineChannels_delta(dmdispsum, dmdispcache + ch*sizexy, dmdispptr_array[ch], gainch, dmdispsumgain[ch], sizexy);
+                        dmdispsumcnt[ch] = cntch1;
+                        dmdispsumgain[ch] = gainch;
+                        if(ch != dmdispcombconf[DMindex].wfsref_loopchan)
+                            wfsrefupdate = 1;
+                    }
+                }
             }
+            memcpy(dmdispptr, dmdispsum, sizeof(float)*sizexy);
 
             dmdispcombconf[DMindex].status = 4;
 
@@ -1377,8 +1952,20 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
             }
             dmdispcombconf[DMindex].status = 6;
 
+            if(dmdispcombconf[DMindex].TrigMode==2) // hold until release time
+            {
+                clock_gettime(CLOCK_REALTIME, &tnow);
+                tdiff = time_diff(tdeadline, tnow);
+                if(tdiff.tv_sec >= 0)
+                    dmdispcombconf[DMindex].latecnt++;
+                else
+                    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &tdeadline, NULL);
+            }
+
+            clock_gettime(CLOCK_REALTIME, &twrite);
             data.image[dmdispcombconf[DMindex].IDdisp].md[0].write = 1;
             memcpy (data.image[dmdispcombconf[DMindex].IDdisp].array.F,data.image[IDdispt].array.F, sizeof(float)*data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement);
+            data.image[dmdispcombconf[DMindex].IDdisp].md[0].atime.ts = twrite;
             data.image[dmdispcombconf[DMindex].IDdisp].md[0].cnt0++;
             data.image[dmdispcombconf[DMindex].IDdisp].md[0].write = 0;            
  
@@ -1392,63 +1979,18 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
  
  
  
-            if(dm2dm_mode==1)
-            {
-                memset(data.image[IDtmpoutdm].array.F, '\0', sizeof(float)*sizexyDMout);
-                for(kk=0;kk<data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement;kk++)
-                    {
-                        for(ii=0;ii<sizexyDMout;ii++)
-                            data.image[IDtmpoutdm].array.F[ii] += data.image[dmdispcombconf[DMindex].IDdisp].array.F[kk] * data.image[dmdispcombconf[DMindex].ID_dm2dm_DMmodes].array.F[kk*sizexyDMout+ii];
-                    }
-                
-                data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 1;
-                memcpy (data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].array.F,data.image[IDtmpoutdm].array.F, sizeof(float)*sizexyDMout);
-                data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].cnt0++;
-                data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 0;            
-                sem_post(data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].semptr[0]);                
-            }
-            
-            if(wfsrefmode==1)
-            {
-                memset(data.image[IDtmpoutref].array.F, '\0', sizeof(float)*sizexywfsref);
-                list_image_ID();
-                printf("kkmax = %ld\n", data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement);
-                printf("iimax = %ld\n", sizexywfsref);
-                printf("ID RespMat = %ld  (%ld)\n", dmdispcombconf[DMindex].ID_wfsref_RespMat, (data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement-1)*sizexywfsref + sizexywfsref-1);
-                fflush(stdout);
-                save_fits(wfsref_WFSRespMat, "!_test_wfsref_WFSRespMat.fits");
-                for(kk=0;kk<data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement;kk++)
-                    {
-                        printf("(%ld %g) ", kk, data.image[dmdispcombconf[DMindex].IDdisp].array.F[kk]);
-                        for(ii=0;ii<sizexywfsref;ii++)
-                            data.image[IDtmpoutref].array.F[ii] += data.image[dmdispcombconf[DMindex].IDdisp].array.F[kk] * data.image[dmdispcombconf[DMindex].ID_wfsref_RespMat].array.F[kk*sizexywfsref+ii];
-                    }
-                printf("\n");
-                printf("Updating Zero Point  %ld <- %ld\n", dmdispcombconf[DMindex].ID_wfsref_out, IDtmpoutref);
-                fflush(stdout);   
-                data.image[dmdispcombconf[DMindex].ID_wfsref_out].md[0].write = 1;
-                memcpy (data.image[dmdispcombconf[DMindex].ID_wfsref_out].array.F,data.image[IDtmpoutref].array.F, sizeof(float)*sizexywfsref);
-                data.image[dmdispcombconf[DMindex].ID_wfsref_out].md[0].cnt0++;
-                data.image[dmdispcombconf[DMindex].ID_wfsref_out].md[0].write = 0;            
-                sem_post(data.image[dmdispcombconf[DMindex].ID_wfsref_out].semptr[0]);   
-                printf("Done\n");
-                fflush(stdout);
-            }
-            
-            
+            // primary output first: DM voltage
             dmdispcombconf[DMindex].status = 7;
 
-			
 			clock_gettime(CLOCK_REALTIME, &t1);
 			if(dmdispcombconf[DMindex].voltmode==1)
+			{
+				data.image[dmdispcombconf[DMindex].IDvolt].md[0].atime.ts = twrite;
 				AOloopControl_DM_disp2V(DMindex);
-			
+			}
 
             dmdispcombconf[DMindex].status = 8;
 
-            cntsumold = cntsum;
-            dmdispcombconf[DMindex].updatecnt++;
-            
             clock_gettime(CLOCK_REALTIME, &tnow);
             tdiff = time_diff(ttrig, tnow);
 			tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
@@ -1457,6 +1999,93 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
 			tdiff = time_diff(t1, tnow);
 			tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 			dmdispcombconf[DMindex].time_disp2V = tdiffv;
+
+			dmdispcombconf[DMindex].twrite = twrite;
+			if(dmdispcombconf[DMindex].TrigMode==2)
+			{
+				tdiff = time_diff(tframe, twrite);
+				dmdispcombconf[DMindex].tlatency = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+			}
+
+
+            if(dm2dm_mode==1)
+            {
+#ifdef HAVE_CUDA
+                if(DMGPUdevice >= 0)
+                {
+                    gpustatus = 0;
+                    GPU_loop_MultMat_execute(DMCOMB_GPUINDEX_DM2DM, &gpustatus, &GPUstatus[0], 1.0, 0.0, 0);
+
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 1;
+                    memcpy(data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].array.F, data.image[IDtmpoutdm].array.F, sizeof(float)*sizexyDMout);
+                    COREMOD_MEMORY_image_set_sempost_byID(dmdispcombconf[DMindex].ID_dm2dm_outdisp, -1);
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].cnt0++;
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 0;
+                }
+                else
+#endif
+                {
+                    memset(data.image[IDtmpoutdm].array.F, '\0', sizeof(float)*sizexyDMout);
+                    for(kk=0;kk<data.image[dmdispcombconf[DMindex].IDdisp].md[0].nelement;kk++)
+                        {
+                            for(ii=0;ii<sizexyDMout;ii++)
+                                data.image[IDtmpoutdm].array.F[ii] += data.image[dmdispcombconf[DMindex].IDdisp].array.F[kk] * data.image[dmdispcombconf[DMindex].ID_dm2dm_DMmodes].array.F[kk*sizexyDMout+ii];
+                        }
+
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 1;
+                    memcpy (data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].array.F,data.image[IDtmpoutdm].array.F, sizeof(float)*sizexyDMout);
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].cnt0++;
+                    data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].md[0].write = 0;
+                    sem_post(data.image[dmdispcombconf[DMindex].ID_dm2dm_outdisp].semptr[0]);
+                }
+            }
+
+            // offload to other DM channel, same tick as output, at most every offload_dtmin
+            if(dmdispcombconf[DMindex].offloadmode == 1)
+            {
+                tdiff = time_diff(toffload, tnow);
+                if(1.0e6*tdiff.tv_sec + 1.0e-3*tdiff.tv_nsec >= dmdispcombconf[DMindex].offload_dtmin)
+                {
+                    toffload = tnow;
+                    if(offloadtarget != dmdispcombconf[DMindex].offloadDMindex*100 + dmdispcombconf[DMindex].offloadchan)
+                    {
+                        pthread_mutex_lock(&dmcomb_mutex);
+                        sprintf(name, "dm%02lddisp%02d", dmdispcombconf[DMindex].offloadDMindex, dmdispcombconf[DMindex].offloadchan);
+                        IDoffload = image_ID(name);
+                        if(IDoffload == -1)
+                            IDoffload = read_sharedmem_image(name);
+                        pthread_mutex_unlock(&dmcomb_mutex);
+                        if((IDoffload != -1)&&(data.image[IDoffload].md[0].nelement != sizexy))
+                        {
+                            printf("DM %ld: offload target %s size mismatch -> offload off\n", DMindex, name);
+                            IDoffload = -1;
+                        }
+                        if(IDoffload == -1)
+                            dmdispcombconf[DMindex].offloadmode = 0;
+                        offloadtarget = dmdispcombconf[DMindex].offloadDMindex*100 + dmdispcombconf[DMindex].offloadchan;
+                    }
+                    if(IDoffload != -1)
+                    {
+                        data.image[IDoffload].md[0].write = 1;
+                        AOloopControl_DM_offload_apply(data.image[IDoffload].array.F, dmdispsum, dmdispcombconf[DMindex].offloadcoeff, dmdispcombconf[DMindex].offloadmult, sizexy);
+                        data.image[IDoffload].md[0].cnt0++;
+                        data.image[IDoffload].md[0].write = 0;
+                        COREMOD_MEMORY_image_set_sempost_byID(IDoffload, -1);
+                        dmdispcombconf[DMindex].offloadcnt++;
+                    }
+                }
+            }
+
+            // wfsref: lazy (non-loop channel changed), computed in background thread, at most one pending request
+            if((wfsrefmode==1)&&(wfsrefupdate==1))
+            {
+                sem_getvalue(&dmcombwfsref[DMindex].trigsem, &semval);
+                if(semval == 0)
+                    sem_post(&dmcombwfsref[DMindex].trigsem);
+            }
+
+            cntsumold = cntsum;
+            dmdispcombconf[DMindex].updatecnt++;
         }
     
          if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
@@ -1468,10 +2097,34 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
 
 
 
+    if(wfsrefmode == 1)
+    {
+        dmcombwfsref[DMindex].ON = 0;
+        sem_post(&dmcombwfsref[DMindex].trigsem);
+        pthread_join(wfsrefthread, NULL);
+        sem_destroy(&dmcombwfsref[DMindex].trigsem);
+    }
+#ifdef HAVE_CUDA
+    if(DMGPUdevice >= 0)
+    {
+        if(dm2dm_mode == 1)
+            GPU_loop_MultMat_free(DMCOMB_GPUINDEX_DM2DM);
+        if(wfsrefmode == 1)
+            GPU_loop_MultMat_free(DMCOMB_GPUINDEX_WFSREF);
+    }
+#endif
+
+#ifdef HAVE_CUDA
+    if(DMGPUdevice >= 0)
+        dmcomb_GPUclaimed = 0;
+#endif
+
     printf("LOOP STOPPED\n");
     fflush(stdout);
 
     free(size);
+    free(dmdispsum);
+    free(dmdispcache);
  
 
     return 0;
@@ -1479,6 +2132,69 @@ int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int N
 
 
 
+static void *AOloopControl_DM_CombineChannels_thread(void *ptr)
+{
+    DMCOMB_ARGS *a = (DMCOMB_ARGS*) ptr;
+
+    AOloopControl_DM_CombineChannels(a->DMindex, a->xsize, a->ysize, a->NBchannel, a->AveMode, a->dm2dm_mode, a->dm2dm_DMmodes, a->dm2dm_outdisp, a->wfsrefmode, a->wfsref_WFSRespMat, a->wfsref_out, a->voltmode, a->IDvolt_name, a->DClevel, a->maxvolt);
+
+    return NULL;
+}
+
+
+
+//
+// Run several DM combiners in a single process, one thread per DM
+// fname: one line per DM, same arguments as AOloopControl_DM_CombineChannels:
+// DMindex xsize ysize NBchannel AveMode dm2dm_mode DMmodes outdisp wfsrefmode WFSRespMat wfsrefout voltmode dmvoltname DClevel maxvolt
+// lines starting with # are ignored
+// DM to DM offload set with AOloopControl_DM_setoffload
+//
+int AOloopControl_DM_CombineChannels_multi(const char *fname)
+{
+    FILE *fp;
+    char line[2000];
+    DMCOMB_ARGS *args;
+    pthread_t *thread;
+    long NBDM = 0;
+    long k;
+
+
+    args = (DMCOMB_ARGS*) malloc(sizeof(DMCOMB_ARGS)*DMCOMB_NBDMMAX);
+    thread = (pthread_t*) malloc(sizeof(pthread_t)*DMCOMB_NBDMMAX);
+
+    if((fp = fopen(fname, "r")) == NULL)
+    {
+        printf("ERROR: cannot open file \"%s\"\n", fname);
+        free(args);
+        free(thread);
+        return -1;
+    }
+    while((fgets(line, 2000, fp) != NULL)&&(NBDM < DMCOMB_NBDMMAX))
+    {
+        DMCOMB_ARGS *a = &args[NBDM];
+
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "%ld %ld %ld %d %d %d %199s %199s %d %199s %199s %d %199s %f %f", &a->DMindex, &a->xsize, &a->ysize, &a->NBchannel, &a->AveMode, &a->dm2dm_mode, a->dm2dm_DMmodes, a->dm2dm_outdisp, &a->wfsrefmode, a->wfsref_WFSRespMat, a->wfsref_out, &a->voltmode, a->IDvolt_name, &a->DClevel, &a->maxvolt) == 15)
+            NBDM++;
+    }
+    fclose(fp);
+
+    printf("Combining %ld DMs in single process\n", NBDM);
+    for(k=0; k<NBDM; k++)
+        pthread_create(&thread[k], NULL, AOloopControl_DM_CombineChannels_thread, (void*) &args[k]);
+    for(k=0; k<NBDM; k++)
+        pthread_join(thread[k], NULL);
+
+    free(args);
+    free(thread);
+
+    return 0;
+}
+
+
+
 int AOloopControl_DM_dmdispcomboff(long DMindex)
 {
     AOloopControl_DM_loadconf();
@@ -1585,14 +2301,23 @@ int AOloopControl_DM_dmdispcombstatus(long DMindex)
 
 		
 		
-		if(dmdispcombconf[DMindex].TrigMode==1)
+		if(dmdispcombconf[DMindex].TrigMode>0)
 			attron(A_BOLD);
         printw("\n");
         printw("=========== TRIGGER MODE = %d ====================================\n", dmdispcombconf[DMindex].TrigMode); 		
 		printw("TrigChan          = %10d      DM trigger channel\n", dmdispcombconf[DMindex].TrigChan);
 		printw("TrigSem           = %10d      DM trigger semaphore\n", dmdispcombconf[DMindex].TrigSem);
+		if(dmdispcombconf[DMindex].TrigMode==2)
+		{
+			printw("TrigDelay         = %10.3f us   release delay after trigger channel atime\n", 1.0e-3*dmdispcombconf[DMindex].TrigDelay);
+			printw("TrigLead          = %10.3f us   computation lead time\n", 1.0e-3*dmdispcombconf[DMindex].TrigLead);
+			printw("TrigLatePolicy    = %10d      (0: write, 1: drop)\n", dmdispcombconf[DMindex].TrigLatePolicy);
+			printw("latency           = %10.3f us   atime -> write\n", dmdispcombconf[DMindex].tlatency*1.0e6);
+			printw("late frames       = %10ld\n", dmdispcombconf[DMindex].latecnt);
+			printw("dropped frames    = %10ld\n", dmdispcombconf[DMindex].dropcnt);
+		}
 		printw("================================================================\n");
-		if(dmdispcombconf[DMindex].TrigMode==1)
+		if(dmdispcombconf[DMindex].TrigMode>0)
 			attroff(A_BOLD);
         printw("\n");     
 
@@ -1754,6 +2479,135 @@ int AOloopControl_DM_setTrigSem(long DMindex, int sem)
 }
 
 
+int AOloopControl_DM_setTrigDelay(long DMindex, float delayus, float leadus, int latepolicy)
+{
+    AOloopControl_DM_loadconf();
+    dmdispcombconf[DMindex].TrigDelay = (long) (1000.0*delayus);
+    dmdispcombconf[DMindex].TrigLead = (long) (1000.0*leadus);
+    dmdispcombconf[DMindex].TrigLatePolicy = latepolicy;
+    dmdispcombconf[DMindex].latecnt = 0;
+    dmdispcombconf[DMindex].dropcnt = 0;
+	AOloopControl_printDMconf();
+
+    return 0;
+}
+
+
+int AOloopControl_DM_setoffload(long DMindex, long DMindexout, int chan, long dtmin, float offcoeff, float multcoeff)
+{
+    AOloopControl_DM_loadconf();
+    dmdispcombconf[DMindex].offloadmode = 0;
+    if(DMindexout >= 0)
+    {
+        dmdispcombconf[DMindex].offloadDMindex = DMindexout;
+        dmdispcombconf[DMindex].offloadchan = chan;
+        dmdispcombconf[DMindex].offload_dtmin = dtmin;
+        dmdispcombconf[DMindex].offloadcoeff = offcoeff;
+        dmdispcombconf[DMindex].offloadmult = multcoeff;
+        dmdispcombconf[DMindex].offloadmode = 1;
+    }
+	AOloopControl_printDMconf();
+
+    return 0;
+}
+
+
+int AOloopControl_DM_setwfsref(long DMindex, int loopchan, long dtmin)
+{
+    AOloopControl_DM_loadconf();
+    dmdispcombconf[DMindex].wfsref_loopchan = loopchan;
+    dmdispcombconf[DMindex].wfsref_dtmin = dtmin;
+	AOloopControl_printDMconf();
+
+    return 0;
+}
+
+
+//
+// IDlut_name : xsize x ysize x NBpt cube, slice k = actuator voltages [V] at displacement disp0 + k*(disp1-disp0)/(NBpt-1) [um]
+// table is stored actuator-major in shared memory stream dm<DMindex>voltLUT (DMVOLTLUT_NBPTMAX x xysize x 2), read by disp2V
+// new table is written to the buffer (slice) not in use, then disp2V is switched to it: no glitch or torn table during update
+//
+int AOloopControl_DM_setvoltLUT(long DMindex, const char *IDlut_name, float disp0, float disp1)
+{
+    long IDlut, IDvoltLUT;
+    long NBpt, xysize;
+    long ii, k;
+    int lutbuff;
+    float *lut;
+    uint32_t *sizearray;
+    char name[200];
+    char errstr[200];
+
+
+    AOloopControl_DM_loadconf();
+
+    if(strcmp(IDlut_name, "none") == 0)
+    {
+        dmdispcombconf[DMindex].voltLUTmode = 0;
+        AOloopControl_printDMconf();
+        return 0;
+    }
+
+    xysize = dmdispcombconf[DMindex].xysize;
+    IDlut = image_ID(IDlut_name);
+    if(IDlut == -1)
+    {
+        sprintf(errstr, "image \"%s\" does not exist", IDlut_name);
+        printERROR(__FILE__,__func__,__LINE__, errstr);
+        return -1;
+    }
+    if((data.image[IDlut].md[0].naxis != 3)||(data.image[IDlut].md[0].size[0]*data.image[IDlut].md[0].size[1] != xysize)||(data.image[IDlut].md[0].size[2] < 2)||(data.image[IDlut].md[0].size[2] > DMVOLTLUT_NBPTMAX)||(disp1 <= disp0))
+    {
+        sprintf(errstr, "image \"%s\" should be %ld x %ld x NBpt (1<NBpt<=%d), with disp1 > disp0", IDlut_name, dmdispcombconf[DMindex].xsize, dmdispcombconf[DMindex].ysize, DMVOLTLUT_NBPTMAX);
+        printERROR(__FILE__,__func__,__LINE__, errstr);
+        return -1;
+    }
+    NBpt = data.image[IDlut].md[0].size[2];
+
+    sprintf(name, "dm%02ldvoltLUT", DMindex);
+    IDvoltLUT = image_ID(name);
+    if(IDvoltLUT == -1)
+        IDvoltLUT = read_sharedmem_image(name);
+    if((IDvoltLUT != -1)&&(data.image[IDvoltLUT].md[0].nelement != 2*DMVOLTLUT_NBPTMAX*xysize))
+    {
+        sprintf(errstr, "stream \"%s\" has wrong size, remove it and restart DM combine", name);
+        printERROR(__FILE__,__func__,__LINE__, errstr);
+        return -1;
+    }
+    if(IDvoltLUT == -1)
+    {
+        sizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+        sizearray[0] = DMVOLTLUT_NBPTMAX;
+        sizearray[1] = xysize;
+        sizearray[2] = 2;
+        IDvoltLUT = create_image_ID(name, 3, sizearray, _DATATYPE_FLOAT, 1, 0);
+        free(sizearray);
+    }
+
+    // fill buffer not read by disp2V, then switch
+    lutbuff = 1 - dmdispcombconf[DMindex].voltLUTbuff;
+    lut = data.image[IDvoltLUT].array.F + lutbuff*DMVOLTLUT_NBPTMAX*xysize;
+    data.image[IDvoltLUT].md[0].write = 1;
+    for(ii=0; ii<xysize; ii++)
+        for(k=0; k<NBpt; k++)
+            lut[ii*DMVOLTLUT_NBPTMAX+k] = data.image[IDlut].array.F[k*xysize+ii];
+    dmdispcombconf[DMindex].voltLUT_NBpt[lutbuff] = NBpt;
+    dmdispcombconf[DMindex].voltLUT_disp0[lutbuff] = disp0;
+    dmdispcombconf[DMindex].voltLUT_invstep[lutbuff] = (NBpt-1)/(disp1-disp0);
+    __atomic_store_n(&dmdispcombconf[DMindex].voltLUTbuff, lutbuff, __ATOMIC_RELEASE);
+    data.image[IDvoltLUT].md[0].cnt0++;
+    data.image[IDvoltLUT].md[0].write = 0;
+
+    dmdispcombconf[DMindex].voltLUTcnt++;
+    __atomic_store_n(&dmdispcombconf[DMindex].voltLUTmode, 1, __ATOMIC_RELEASE);
+
+    AOloopControl_printDMconf();
+
+    return 0;
+}
+
+
 
 
 
@@ -1805,6 +2659,7 @@ int AOloopControl_DMturb_createconf()
     long IDc1;
     char name[200];
     long DMindex;
+    int layer;
     char errstr[200];
 
 	printf("ENTERING FUNCTION AOloopControl_DMturb_createconf\n");
@@ -1875,6 +2730,14 @@ int AOloopControl_DMturb_createconf()
             dmturbconf[DMindex].tint = 100; // [us]
             
             dmturbconf[DMindex].simtime = 0.0; // sec
+
+            dmturbconf[DMindex].NBlayer = 1;
+            for(layer=0; layer<DMTURB_NBLAYERMAX; layer++)
+            {
+                dmturbconf[DMindex].layer_weight[layer] = 1.0;
+                dmturbconf[DMindex].layer_wspeedcoeff[layer] = 1.0;
+                dmturbconf[DMindex].layer_angle[layer] = 1.0; // [rad]
+            }
         }
         dmturb_loaded = 1;
 
@@ -1992,8 +2855,32 @@ int AOloopControl_DM_dmturb_tint(long DMindex, long tint)
 
 
 
+int AOloopControl_DM_dmturb_layer(long DMindex, long layer, double weight, double wspeedcoeff, double angle)
+{
+	if( dmturb_loaded == 0 )
+		AOloopControl_DMturb_createconf();
+
+    if((layer<0)||(layer>=DMTURB_NBLAYERMAX))
+    {
+        printf("layer index %ld out of range (max %d layers)\n", layer, DMTURB_NBLAYERMAX);
+        return -1;
+    }
+    dmturbconf[DMindex].layer_weight[layer] = weight;
+    dmturbconf[DMindex].layer_wspeedcoeff[layer] = wspeedcoeff;
+    dmturbconf[DMindex].layer_angle[layer] = angle;
+    if(layer >= dmturbconf[DMindex].NBlayer)
+        dmturbconf[DMindex].NBlayer = layer+1;
+    AOloopControl_DM_dmturb_printstatus(DMindex);
+
+    return 0;
+}
+
+
+
 int AOloopControl_DM_dmturb_printstatus(long DMindex)
 {
+    int layer;
+
 	if( dmturb_loaded == 0 )
 		AOloopControl_DMturb_createconf();
 //    AOloopControl_DMturb_loadconf(DMindex);
@@ -2014,6 +2901,10 @@ int AOloopControl_DM_dmturb_printstatus(long DMindex)
     printf("LOcoeff =  %.2f\n", dmturbconf[DMindex].LOcoeff);
     printf("Requested uptdate frequ = %.2f kHz\n", 0.001/(1.0e-6*dmturbconf[DMindex].tint));
     printf("\n");
+    printf("streaming mode layers: %d\n", dmturbconf[DMindex].NBlayer);
+    for(layer=0; layer<dmturbconf[DMindex].NBlayer; layer++)
+        printf("   layer %d   weight = %5.2f   wspeed = %6.2f m/s   angle = %5.2f rad\n", layer, dmturbconf[DMindex].layer_weight[layer], dmturbconf[DMindex].wspeed*dmturbconf[DMindex].layer_wspeedcoeff[layer], dmturbconf[DMindex].layer_angle[layer]);
+    printf("\n");
     printf("\n");
 
     return(0);
@@ -2387,6 +3278,304 @@ int AOloopControl_DM_dmturb(long DMindex, int mode, const char *IDout_name, long
 
 
 
+//
+// streaming (infinite screen) turbulence
+//
+// screen(x,y) = Re sum_layers sum_ij A_ij exp(i (kx_i (x+X) + ky_j (y+Y)))
+// kx, ky : DMTURB_STREAM_NBK log-spaced, randomly jittered (non-commensurate -> no repetition) frequencies per axis,
+// +/- kmin..DM Nyquist, shared by all layers. Each layer has independent von Karman amplitudes and its own (X,Y) offset.
+// Separable exponentials: per update, NBk x NBk phasor update per layer + two small matrix products, evaluated at actuator positions
+//
+int AOloopControl_DM_dmturb_stream(long DMindex)
+{
+    float DMsizeM = 10.0; // DM size in meter
+    double L0 = 20.0;     // outer scale [m], as master screen
+    double sigLO = 2.0;   // [m] low order filter kernel width, as master screen
+    long NBk = DMTURB_STREAM_NBK;
+    long DM_Xsize, DM_Ysize, DM_XYsize;
+    long ii, jj, ii1, i, j, n;
+    int layer;
+    char name[200];
+    long IDturb;
+
+    double kmin, kmax, k0;
+    double *kx, *ky, *dkx, *dky;
+    double e0, e1;
+    double psd;
+    float *Are, *Aim;            // layer amplitudes [layer][i][j]
+    float *Glo;                  // low order transfer function
+    float *Pxre, *Pxim;          // exp(i kx_i x_ii) [i][ii]
+    float *Pyre, *Pyim;          // exp(i ky_j y_jj) [j][jj]
+    float *Bre, *Bim;            // current combined amplitudes
+    float *Tre, *Tim;            // B x Py [i][jj]
+    float *ure, *uim, *wre, *wim;
+    double layerX[DMTURB_NBLAYERMAX];
+    double layerY[DMTURB_NBLAYERMAX];
+    double wspeed, angle;
+
+    struct timespec tlast;
+    struct timespec tdiff;
+    struct timespec tdiff1;
+    double tdiff1v;
+
+    float ave;
+    double RMSval;
+    long RMSvalcnt;
+    double x, y, r;
+    double x1, fx1;
+    double coeff = 0.0;
+
+
+	if( dmturb_loaded == 0 )
+		AOloopControl_DMturb_createconf();
+	AOloopControl_DM_loadconf();
+
+    DM_Xsize = dmdispcombconf[DMindex].xsize;
+    DM_Ysize = dmdispcombconf[DMindex].ysize;
+    DM_XYsize = DM_Xsize*DM_Ysize;
+    sprintf(name, "dm%02lddisp10", DMindex);
+    read_sharedmem_image(name);
+    IDturb = create_2Dimage_ID("turbs", DM_Xsize, DM_Ysize);
+
+    kx = (double*) malloc(sizeof(double)*NBk);
+    ky = (double*) malloc(sizeof(double)*NBk);
+    dkx = (double*) malloc(sizeof(double)*NBk);
+    dky = (double*) malloc(sizeof(double)*NBk);
+    Are = (float*) malloc(sizeof(float)*DMTURB_NBLAYERMAX*NBk*NBk);
+    Aim = (float*) malloc(sizeof(float)*DMTURB_NBLAYERMAX*NBk*NBk);
+    Glo = (float*) malloc(sizeof(float)*NBk*NBk);
+    Pxre = (float*) malloc(sizeof(float)*NBk*DM_Xsize);
+    Pxim = (float*) malloc(sizeof(float)*NBk*DM_Xsize);
+    Pyre = (float*) malloc(sizeof(float)*NBk*DM_Ysize);
+    Pyim = (float*) malloc(sizeof(float)*NBk*DM_Ysize);
+    Bre = (float*) malloc(sizeof(float)*NBk*NBk);
+    Bim = (float*) malloc(sizeof(float)*NBk*NBk);
+    Tre = (float*) malloc(sizeof(float)*NBk*DM_Ysize);
+    Tim = (float*) malloc(sizeof(float)*NBk*DM_Ysize);
+    ure = (float*) malloc(sizeof(float)*NBk);
+    uim = (float*) malloc(sizeof(float)*NBk);
+    wre = (float*) malloc(sizeof(float)*NBk);
+    wim = (float*) malloc(sizeof(float)*NBk);
+
+
+    // frequencies: NBk/2 log-spaced bins per sign, random position within bin
+    kmin = 2.0*M_PI/(10.0*DMsizeM);
+    kmax = M_PI*DM_Xsize/DMsizeM;
+    k0 = 2.0*M_PI/L0;
+    for(n=0; n<NBk/2; n++)
+    {
+        e0 = kmin*pow(kmax/kmin, 1.0*n/(NBk/2));
+        e1 = kmin*pow(kmax/kmin, 1.0*(n+1)/(NBk/2));
+        kx[2*n] = e0 + (e1-e0)*ran1();
+        kx[2*n+1] = -(e0 + (e1-e0)*ran1());
+        ky[2*n] = e0 + (e1-e0)*ran1();
+        ky[2*n+1] = -(e0 + (e1-e0)*ran1());
+        dkx[2*n] = dkx[2*n+1] = e1-e0;
+        dky[2*n] = dky[2*n+1] = e1-e0;
+    }
+
+    // von Karman amplitudes, independent per layer
+    for(layer=0; layer<DMTURB_NBLAYERMAX; layer++)
+    {
+        for(i=0; i<NBk; i++)
+            for(j=0; j<NBk; j++)
+            {
+                psd = pow(kx[i]*kx[i] + ky[j]*ky[j] + k0*k0, -11.0/6.0);
+                Are[(layer*NBk+i)*NBk+j] = sqrt(psd*dkx[i]*dky[j])*gauss();
+                Aim[(layer*NBk+i)*NBk+j] = sqrt(psd*dkx[i]*dky[j])*gauss();
+            }
+        layerX[layer] = DMsizeM*layer*10.0*ran1();
+        layerY[layer] = DMsizeM*layer*10.0*ran1();
+    }
+
+    for(i=0; i<NBk; i++)
+        for(j=0; j<NBk; j++)
+            Glo[i*NBk+j] = exp(-0.5*(kx[i]*kx[i] + ky[j]*ky[j])*sigLO*sigLO);
+
+    for(i=0; i<NBk; i++)
+    {
+        for(ii=0; ii<DM_Xsize; ii++)
+        {
+            Pxre[i*DM_Xsize+ii] = cos(kx[i]*DMsizeM*ii/DM_Xsize);
+            Pxim[i*DM_Xsize+ii] = sin(kx[i]*DMsizeM*ii/DM_Xsize);
+        }
+        for(jj=0; jj<DM_Ysize; jj++)
+        {
+            Pyre[i*DM_Ysize+jj] = cos(ky[i]*DMsizeM*jj/DM_Ysize);
+            Pyim[i*DM_Ysize+jj] = sin(ky[i]*DMsizeM*jj/DM_Ysize);
+        }
+    }
+
+
+    clock_gettime(CLOCK_REALTIME, &dmturbconf[DMindex].tstart);
+    dmturbconf[DMindex].tend = dmturbconf[DMindex].tstart;
+    dmturbconf[DMindex].cnt = 0;
+    dmturbconf[DMindex].on = 1;
+
+    while(dmturbconf[DMindex].on == 1) // computation loop
+    {
+        usleep(dmturbconf[DMindex].tint);
+
+        tlast = dmturbconf[DMindex].tend;
+        clock_gettime(CLOCK_REALTIME, &dmturbconf[DMindex].tend);
+        tdiff = time_diff(dmturbconf[DMindex].tstart, dmturbconf[DMindex].tend);
+        tdiff1 = time_diff(tlast, dmturbconf[DMindex].tend);
+        tdiff1v = 1.0*tdiff1.tv_sec + 1.0e-9*tdiff1.tv_nsec;
+        dmturbconf[DMindex].simtime = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+
+        // combined amplitudes at current layer positions
+        memset(Bre, 0, sizeof(float)*NBk*NBk);
+        memset(Bim, 0, sizeof(float)*NBk*NBk);
+        for(layer=0; layer<dmturbconf[DMindex].NBlayer; layer++)
+        {
+            float lw = dmturbconf[DMindex].layer_weight[layer];
+
+            wspeed = dmturbconf[DMindex].wspeed*dmturbconf[DMindex].layer_wspeedcoeff[layer];
+            angle = dmturbconf[DMindex].layer_angle[layer];
+            layerX[layer] += wspeed*tdiff1v*cos(angle); // [m]
+            layerY[layer] += wspeed*tdiff1v*sin(angle); // [m]
+
+            for(i=0; i<NBk; i++)
+            {
+                ure[i] = lw*cos(kx[i]*layerX[layer]);
+                uim[i] = lw*sin(kx[i]*layerX[layer]);
+                wre[i] = cos(ky[i]*layerY[layer]);
+                wim[i] = sin(ky[i]*layerY[layer]);
+            }
+
+            for(i=0; i<NBk; i++)
+            {
+                const float * restrict ar = Are + (layer*NBk+i)*NBk;
+                const float * restrict ai = Aim + (layer*NBk+i)*NBk;
+                float * restrict br = Bre + i*NBk;
+                float * restrict bi = Bim + i*NBk;
+
+                #pragma omp simd
+                for(j=0; j<NBk; j++)
+                {
+                    float pr = ure[i]*wre[j] - uim[i]*wim[j];
+                    float pi = ure[i]*wim[j] + uim[i]*wre[j];
+
+                    br[j] += ar[j]*pr - ai[j]*pi;
+                    bi[j] += ar[j]*pi + ai[j]*pr;
+                }
+            }
+        }
+
+        // low order attenuation
+        for(n=0; n<NBk*NBk; n++)
+        {
+            float g = 1.0 - (1.0-dmturbconf[DMindex].LOcoeff)*Glo[n];
+
+            Bre[n] *= g;
+            Bim[n] *= g;
+        }
+
+        // T = B Py
+        memset(Tre, 0, sizeof(float)*NBk*DM_Ysize);
+        memset(Tim, 0, sizeof(float)*NBk*DM_Ysize);
+        for(i=0; i<NBk; i++)
+            for(j=0; j<NBk; j++)
+            {
+                float br = Bre[i*NBk+j];
+                float bi = Bim[i*NBk+j];
+                const float * restrict pyr = Pyre + j*DM_Ysize;
+                const float * restrict pyi = Pyim + j*DM_Ysize;
+                float * restrict tr = Tre + i*DM_Ysize;
+                float * restrict ti = Tim + i*DM_Ysize;
+
+                #pragma omp simd
+                for(jj=0; jj<DM_Ysize; jj++)
+                {
+                    tr[jj] += br*pyr[jj] - bi*pyi[jj];
+                    ti[jj] += br*pyi[jj] + bi*pyr[jj];
+                }
+            }
+
+        // screen = Re(Px^T T)
+        for(jj=0; jj<DM_Ysize; jj++)
+        {
+            float * restrict out = data.image[IDturb].array.F + jj*DM_Xsize;
+
+            for(ii=0; ii<DM_Xsize; ii++)
+                out[ii] = 0.0;
+            for(i=0; i<NBk; i++)
+            {
+                float tr = Tre[i*DM_Ysize+jj];
+                float ti = Tim[i*DM_Ysize+jj];
+                const float * restrict pxr = Pxre + i*DM_Xsize;
+                const float * restrict pxi = Pxim + i*DM_Xsize;
+
+                #pragma omp simd
+                for(ii=0; ii<DM_Xsize; ii++)
+                    out[ii] += pxr[ii]*tr - pxi[ii]*ti;
+            }
+        }
+
+
+        // remove average, scale to requested RMS (same servo as master screen mode)
+        ave = 0.0;
+        for(ii1=0; ii1<DM_XYsize; ii1++)
+            ave += data.image[IDturb].array.F[ii1];
+        ave /= DM_XYsize;
+
+        RMSval = 0.0;
+        RMSvalcnt = 0;
+        for(ii=0; ii<DM_Xsize; ii++)
+            for(jj=0; jj<DM_Ysize; jj++)
+            {
+                ii1 = DM_Xsize*jj+ii;
+                x = 0.5*DM_Xsize - 0.5 - ii;
+                y = 0.5*DM_Ysize - 0.5 - jj;
+                r = sqrt(x*x+y*y);
+                if(r<DM_Xsize*0.5-1.0)
+                {
+                    RMSval += (data.image[IDturb].array.F[ii1]-ave)*(data.image[IDturb].array.F[ii1]-ave);
+                    RMSvalcnt++;
+                }
+            }
+        RMSval = sqrt(RMSval/RMSvalcnt);
+
+        if(coeff == 0.0)
+            coeff = dmturbconf[DMindex].ampl/RMSval;
+        for(ii1=0; ii1<DM_XYsize; ii1++)
+            data.image[IDturb].array.F[ii1] = coeff*(data.image[IDturb].array.F[ii1]-ave);
+
+        x1 = log10(coeff*RMSval/dmturbconf[DMindex].ampl);
+        fx1 = 1.0 + 50.0*exp(-5.0*x1*x1);
+        coeff /= pow(10.0,x1/fx1);
+
+        sprintf(name, "dm%02lddisp10", DMindex);
+        copy_image_ID("turbs", name, 0);
+        dmturbconf[DMindex].cnt++;
+    }
+
+    free(kx);
+    free(ky);
+    free(dkx);
+    free(dky);
+    free(Are);
+    free(Aim);
+    free(Glo);
+    free(Pxre);
+    free(Pxim);
+    free(Pyre);
+    free(Pyim);
+    free(Bre);
+    free(Bim);
+    free(Tre);
+    free(Tim);
+    free(ure);
+    free(uim);
+    free(wre);
+    free(wim);
+
+    return(0);
+}
+
+
+
 /* =============================================================================================== */
 /* =============================================================================================== */
 /*                                                                                                 */
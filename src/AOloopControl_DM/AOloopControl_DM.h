@@ -8,6 +8,9 @@
 
 #define DM_NUMBER_CHANMAX 20 // max number of channel per DM
 
+#define DMTURB_NBLAYERMAX 10   // max number of layers, streaming turbulence
+#define DMTURB_STREAM_NBK 32   // streaming turbulence: number of spatial frequencies per axis
+
 
 
 
@@ -44,6 +47,14 @@ typedef struct
 	int TrigMode; // 0 (std) : any channel update triggers disp update, 1: use specific channel and semaphore
 	int TrigChan; // if TrigMode = 1, use this channel for trigger
 	int TrigSem;  // if TrigMode = 1, use this semaphore for trigger
+	// TrigMode = 2: as 1, DM output released at TrigDelay after trigger channel atime
+	long TrigDelay;      // [ns] release delay after trigger channel atime
+	long TrigLead;       // [ns] computation starts at release time - TrigLead; newer frames received before are merged
+	int TrigLatePolicy;  // 0: write late frame immediately, 1: drop late frame
+	long latecnt;        // number of late frames
+	long dropcnt;        // number of dropped (superseded or late) frames
+	double tlatency;     // [s] trigger channel atime -> write
+	struct timespec twrite; // last output write time (also written to output atime)
 	
 
 	long nsecwait; // inner wait loop duration, interrupted if sem[1] of disp posted
@@ -75,6 +86,24 @@ typedef struct
     char wfsref_RespMat_name[200];
     long ID_wfsref_out;
     char wfsref_out_name[200];
+    int wfsref_loopchan;  // channel excluded from wfsref projection (-1: none), changes of other channels trigger recomputation
+    long wfsref_dtmin;    // minimum interval between wfsref recomputations [us]
+    long wfsrefcnt;       // number of wfsref recomputations
+
+    int offloadmode;      // 1 if channel sum offloaded to other DM channel from combine loop
+    long offloadDMindex;  // offload target DM
+    int offloadchan;      // offload target channel
+    long offload_dtmin;   // minimum interval between offloads [us], 0: every update
+    float offloadcoeff;   // out = offloadmult x (out + offloadcoeff x in)
+    float offloadmult;
+    long offloadcnt;
+
+    int voltLUTmode;      // 1 if per-actuator disp->V calibration table is used (stream dm<DMindex>voltLUT), 0: sqrt law
+    int voltLUTbuff;      // table buffer (slice of dm<DMindex>voltLUT) read by disp2V, switched once other buffer is written
+    long voltLUT_NBpt[2];    // per buffer: number of displacement points in table
+    float voltLUT_disp0[2];  // per buffer: displacement of first table point [um]
+    float voltLUT_invstep[2]; // per buffer: inverse displacement step [1/um]
+    long voltLUTcnt;      // incremented when table is updated
 
     int status;
     long moninterval; // [us]
@@ -99,6 +128,12 @@ typedef struct
 
     double simtime;
 
+    // streaming mode (AOloopControl_DM_dmturb_stream) layers
+    int NBlayer;
+    double layer_weight[DMTURB_NBLAYERMAX];
+    double layer_wspeedcoeff[DMTURB_NBLAYERMAX]; // layer wind speed = wspeed x coeff
+    double layer_angle[DMTURB_NBLAYERMAX];       // wind direction [rad]
+
     struct timespec tstart;
     struct timespec tend;
 
@@ -159,6 +194,8 @@ int AOloopControl_DM_disp2V(long DMindex);
 int AOloopControl_DM_CombineChannels(long DMindex, long xsize, long ysize, int NBchannel, int AveMode, int dm2dm_mode, const char *dm2dm_DMmodes, const char *dm2dm_outdisp, int wfsrefmode, const char *wfsref_WFSRespMat, const char *wfsref_out, int voltmode, const char *IDvolt_name, float DClevel, float maxvolt);
 
 
+int AOloopControl_DM_CombineChannels_multi(const char *fname);
+
 int AOloopControl_DM_dmdispcomboff(long DMindex);
 
 int AOloopControl_DM_dmtrigoff(long DMindex);
@@ -197,6 +234,14 @@ int AOloopControl_DM_setTrigChan(long DMindex, int chan);
 
 int AOloopControl_DM_setTrigSem(long DMindex, int sem);
 
+int AOloopControl_DM_setTrigDelay(long DMindex, float delayus, float leadus, int latepolicy);
+
+int AOloopControl_DM_setoffload(long DMindex, long DMindexout, int chan, long dtmin, float offcoeff, float multcoeff);
+
+int AOloopControl_DM_setwfsref(long DMindex, int loopchan, long dtmin);
+
+int AOloopControl_DM_setvoltLUT(long DMindex, const char *IDlut_name, float disp0, float disp1);
+
 
 
 /* =============================================================================================== */
@@ -223,10 +268,14 @@ int AOloopControl_DM_dmturb_LOcoeff(long DMindex, double LOcoeff);
 
 int AOloopControl_DM_dmturb_tint(long DMindex, long tint);
 
+int AOloopControl_DM_dmturb_layer(long DMindex, long layer, double weight, double wspeedcoeff, double angle);
+
 int AOloopControl_DM_dmturb_printstatus(long DMindex);
 
 int AOloopControl_DM_dmturb(long DMindex, int mode, const char *IDout_name, long NBsamples);
 
+int AOloopControl_DM_dmturb_stream(long DMindex);
+
 
 
 /* =============================================================================================== */
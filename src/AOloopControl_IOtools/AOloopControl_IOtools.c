@@ -61,6 +61,7 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #include <fitsio.h>
 
 #include "CLIcore.h"
+#include "ImageStreamIO/ImageStreamIO.h"
 #include "00CORE/00CORE.h"
 #include "COREMOD_memory/COREMOD_memory.h"
 #include "COREMOD_iofits/COREMOD_iofits.h"
@@ -73,6 +74,10 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #include "AOloopControl/AOloopControl.h"
 #include "AOloopControl_IOtools/AOloopControl_IOtools.h"
 
+#ifdef HAVE_CUDA
+#include "cudacomp/cudacomp.h"
+#endif
+
 
 
 /* =============================================================================================== */
@@ -88,6 +93,16 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define READCAM_TILESIZE 4096     // pixels per tile in fused dark subtraction (16 kB of float output)
+#define READCAM_NBTILE_OMP 16     // minimum number of tiles to split dark subtraction over threads
+
+#define AVESTREAM_MAXNB 16        // maximum number of input streams per AveStream process
+
+#define FRAMEDELAY_TILESIZE 4096  // pixels per tile in frameDelay FIR
+#define FRAMEDELAY_NBTILE_OMP 16  // minimum number of tiles to split FIR over threads
+
+#define READCAM_FUTEXTIMEOUTUS 100000  // futex wait timeout [us], after which Read_cam_frame falls back to the semaphore
+
 
 
 
@@ -105,6 +120,7 @@ extern long aoconfID_imWFS0tot;          // declared in AOloopControl.c
 extern long aoconfID_imWFS1;             // declared in AOloopControl.c
 extern long aoconfID_wfsdark;            // declared in AOloopControl.c
 extern long aoconfID_wfsmask;            // declared in AOloopControl.c
+extern long aoconfID_wfsref;             // declared in AOloopControl.c
 
 extern uint8_t WFSatype;                 // declared in AOloopControl.c
 
@@ -112,15 +128,6 @@ extern long aoconfID_looptiming;         // declared in AOloopControl.c
 
 
 
-static sem_t AOLCOMPUTE_TOTAL_ASYNC_sem_name;
-
-static long long imtotalcnt;
-static int AOLCOMPUTE_DARK_SUBTRACT_THREADinit = 0;
-static int COMPUTE_DARK_SUBTRACT_NBTHREADS = 1;
-static sem_t AOLCOMPUTE_DARK_SUBTRACT_sem_name[32];
-static sem_t AOLCOMPUTE_DARK_SUBTRACT_RESULT_sem_name[32];
-
-
 static int avcamarraysInit = 0;
 static unsigned short *arrayutmp;
 
@@ -130,6 +137,10 @@ static long Average_cam_frames_nelem = 1;
 
 
 static float *arrayftmp;
+static int Read_cam_frame_latindex = -2; // latency reader index in WFS stream, -2 if not yet registered
+static long Read_cam_frame_IDwfsres[5] = {-1, -1, -1, -1, -1}; // in-loop WFS residual: wfsres, wfsres_ave, wfsresm, wfsresm_ave, wfsres_rms
+static long Read_cam_frame_wfsrescnt = 0; // frames since last averaged residual update
+static uint64_t Read_cam_frame_zcseq = 0; // WFS stream seqlock value when zero-copy frame was handed to GPU
 
 
 // TIMING
@@ -139,11 +150,6 @@ static double tdiffv;
 
 extern int PIXSTREAM_SLICE;
 
-static long ti; // thread index
-
-static int AOLCOMPUTE_TOTAL_ASYNC_THREADinit = 0;
-static int AOLCOMPUTE_TOTAL_INIT = 0; // toggles to 1 AFTER total for first image is computed
-
 
 extern float normfloorcoeff;
 
@@ -245,6 +251,16 @@ int_fast8_t AOloopControl_IOtools_AveStream_cli() {
 }
 
 
+/** @brief CLI function for AOloopControl_IOtools_AveStreamMulti */
+int_fast8_t AOloopControl_IOtools_AveStreamMulti_cli() {
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,1)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0) {
+        AOloopControl_IOtools_AveStreamMulti(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl);
+        return 0;
+    }
+    else return 1;
+}
+
+
 /** @brief CLI function for AOloopControl_frameDelay */
 int_fast8_t AOloopControl_IOtools_frameDelay_cli()
 {
@@ -256,6 +272,53 @@ int_fast8_t AOloopControl_IOtools_frameDelay_cli()
 }
 
 
+/** @brief CLI function for AOloopControl_frameDelayGPU */
+int_fast8_t AOloopControl_IOtools_frameDelayGPU_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,5)+CLI_checkarg(4,2)+CLI_checkarg(5,2)==0)    {
+        AOloopControl_IOtools_frameDelayGPU(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl);
+        return 0;
+    }
+    else        return 1;
+}
+
+
+/** @brief CLI function for AOloopControl_IOtools_streamReplay */
+int_fast8_t AOloopControl_IOtools_streamReplay_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,3)+CLI_checkarg(4,1)+CLI_checkarg(5,1)+CLI_checkarg(6,2)==0) {
+        AOloopControl_IOtools_streamReplay(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numl);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_IOtools_streamRecord */
+int_fast8_t AOloopControl_IOtools_streamRecord_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,3)+CLI_checkarg(5,3)+CLI_checkarg(6,3)==0) {
+        AOloopControl_IOtools_streamRecord(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.string, data.cmdargtoken[6].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_IOtools_eventStream */
+int_fast8_t AOloopControl_IOtools_eventStream_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,2)+CLI_checkarg(8,2)+CLI_checkarg(9,2)==0) {
+        AOloopControl_IOtools_eventStream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numl, data.cmdargtoken[8].val.numl, data.cmdargtoken[9].val.numl);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_IOtools_viewStream */
+int_fast8_t AOloopControl_IOtools_viewStream_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,2)==0) {
+        AOloopControl_IOtools_viewStream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numl);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_stream3Dto2D */
 int_fast8_t AOloopControl_IOtools_stream3Dto2D_cli() {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0) {
@@ -306,6 +369,8 @@ int_fast8_t init_AOloopControl_IOtools()
 
     RegisterCLIcommand("cropshim", __FILE__, AOloopControl_IOtools_camimage_extract2D_sharedmem_loop_cli, "crop shared mem image", "<input image> <optional dark> <output image> <sizex> <sizey> <xstart> <ystart>" , "cropshim imin null imout 32 32 153 201", "int AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(char *in_name, const char *dark_name, char *out_name, long size_x, long size_y, long xstart, long ystart)");
 
+    RegisterCLIcommand("aoleventstream", __FILE__, AOloopControl_IOtools_eventStream_cli, "bin photon events into time/wavelength resolved frames", "<input event stream> <output stream> <xsize> <ysize> <NBlambda> <time bin [us]> <gate start [us]> <gate end [us]> <sem trigger>" , "aoleventstream mkidev mkidim 140 146 1 500 0 0 2", "long AOloopControl_IOtools_eventStream(const char *in_name, const char *out_name, long xsize, long ysize, long NBlambda, long dt_us, long gate0_us, long gate1_us, int insem)");
+
 
 
 
@@ -319,8 +384,18 @@ int_fast8_t init_AOloopControl_IOtools()
 
     RegisterCLIcommand("aveACshmim", __FILE__, AOloopControl_IOtools_AveStream_cli, "average and AC shared mem image", "<input image> <coeff> <output image ave> <output AC> <output RMS>" , "aveACshmim imin 0.01 outave outAC outRMS", "int AOloopControl_IOtools_AveStream(char *IDname, double alpha, char *IDname_out_ave, char *IDname_out_AC, char *IDname_out_RMS)");
 
+    RegisterCLIcommand("aveACshmimm", __FILE__, AOloopControl_IOtools_AveStreamMulti_cli, "average and AC of several shared mem images, decimated AC/RMS output", "<input images, comma-separated> <coeff> <AC decimation> <RMS decimation>" , "aveACshmimm imA,imB 0.01 1 100", "int AOloopControl_IOtools_AveStreamMulti(const char *IDname_list, double alpha, long ACdecim, long RMSdecim)");
+
     RegisterCLIcommand("aolframedelay", __FILE__, AOloopControl_IOtools_frameDelay_cli, "introduce temporal delay", "<in> <temporal kernel> <out> <sem index>","aolframedelay in kern out 0","long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem)");
 
+    RegisterCLIcommand("aolframedelaygpu", __FILE__, AOloopControl_IOtools_frameDelayGPU_cli, "introduce temporal delay, FIR on GPU", "<in> <temporal kernel> <out> <sem index> <GPU index>","aolframedelaygpu in kern out 0 0","long AOloopControl_IOtools_frameDelayGPU(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem, int GPUindex)");
+
+    RegisterCLIcommand("aolstreamreplay", __FILE__, AOloopControl_IOtools_streamReplay_cli, "replay recorded frames into stream with recorded timing", "<frames [3D im]> <timing [2D im] or NULL> <out stream> <speed factor> <frequ [Hz] if no timing> <NB loops>", "aolstreamreplay wfsrec wfsrect aol0_wfsim 1.0 2000.0 1", "long AOloopControl_IOtools_streamReplay(const char *IDcube_name, const char *IDtime_name, const char *IDout_name, float speed, float frequ, long NBloop)");
+
+    RegisterCLIcommand("aolstreamrecord", __FILE__, AOloopControl_IOtools_streamRecord_cli, "record stream frames and timing", "<in stream> <sem index> <NB frames> <reference stream or NULL> <out frames [3D im]> <out timing [2D im]>", "aolstreamrecord aol0_dmC 3 10000 aol0_wfsim dmCrec dmCrect", "long AOloopControl_IOtools_streamRecord(const char *IDin_name, long insem, long NBframe, const char *IDref_name, const char *IDout_name, const char *IDtime_name)");
+
+    RegisterCLIcommand("aolviewstream", __FILE__, AOloopControl_IOtools_viewStream_cli, "zero-copy view of contiguous stream region", "<input stream> <view stream> <offset [element]> <sizex> <sizey> <sizez> <sem trigger>" , "aolviewstream in3dim slice2 8192 64 64 1 1", "long AOloopControl_IOtools_viewStream(const char *in_name, const char *out_name, long offset, long size_x, long size_y, long size_z, int insem)");
+
     RegisterCLIcommand("aolstream3Dto2D", __FILE__, AOloopControl_IOtools_stream3Dto2D_cli, "remaps 3D cube into 2D image", "<input 3D stream> <output 2D stream> <# cols> <sem trigger>" , "aolstream3Dto2D in3dim out2dim 4 1", "long AOloopControl_IOtools_stream3Dto2D(const char *in_name, const char *out_name, int NBcols, int insem)");
 
 
@@ -337,6 +412,268 @@ int_fast8_t init_AOloopControl_IOtools()
 
 
 
+/**
+ * @brief Replays recorded frames into a stream, with recorded timing
+ *
+ * Frame k of IDcube_name is written to IDout_name at time (t[k]-t[0])/speed after replay start,
+ * where t is column 0 of the timing image written by AOloopControl_IOtools_streamRecord().
+ * If IDtime_name is "NULL", frames are written at fixed frequency frequ.
+ * The output stream is created if it does not exist, otherwise its size and type must match the recorded frames.
+ *
+ * On each write, md[0].atime is set to the write time and md[0].cnt1 to the frame index, so that
+ * downstream recordings can be matched to replayed frames.
+ *
+ * @param[in]  IDcube_name  recorded frames [3D image]
+ * @param[in]  IDtime_name  recorded timing [2D image, AOLIOTOOLS_REC_NBCOL x NBframe], or "NULL"
+ * @param[in]  IDout_name   output stream (e.g. aol0_wfsim)
+ * @param[in]  speed        replay speed factor (1.0: recorded timing)
+ * @param[in]  frequ        frame rate if no timing image [Hz]
+ * @param[in]  NBloop       number of passes through recorded frames
+ */
+long AOloopControl_IOtools_streamReplay(const char *IDcube_name, const char *IDtime_name, const char *IDout_name, float speed, float frequ, long NBloop)
+{
+    long IDcube, IDtime, IDout;
+    long NBframe;
+    long framesize;
+    long loopiter, k;
+    uint8_t atype;
+    double *tframe;
+    struct timespec tstart;
+    struct timespec twrite;
+    double tloop;
+    double tlate = 0.0; // maximum write time error [s]
+
+
+    IDcube = image_ID(IDcube_name);
+    if(IDcube == -1)
+    {
+        printf("ERROR: image \"%s\" not found\n", IDcube_name);
+        return(-1);
+    }
+    atype = data.image[IDcube].md[0].atype;
+    NBframe = data.image[IDcube].md[0].size[2];
+    framesize = TYPESIZE[atype]*data.image[IDcube].md[0].size[0]*data.image[IDcube].md[0].size[1];
+
+    if(speed <= 0.0)
+        speed = 1.0;
+
+    // frame times relative to first frame [s]
+    tframe = (double*) malloc(sizeof(double)*(NBframe+1));
+    IDtime = -1;
+    if(strcmp(IDtime_name, "NULL") != 0)
+        IDtime = image_ID(IDtime_name);
+    if(IDtime != -1)
+    {
+        if((data.image[IDtime].md[0].size[0] != AOLIOTOOLS_REC_NBCOL)||(data.image[IDtime].md[0].size[1] < NBframe)||(data.image[IDtime].md[0].atype != _DATATYPE_DOUBLE))
+        {
+            printf("ERROR: timing image \"%s\" should be double, %d x %ld\n", IDtime_name, AOLIOTOOLS_REC_NBCOL, NBframe);
+            free(tframe);
+            return(-1);
+        }
+        for(k=0; k<NBframe; k++)
+            tframe[k] = (data.image[IDtime].array.D[k*AOLIOTOOLS_REC_NBCOL] - data.image[IDtime].array.D[0])/speed;
+        // period between passes: average recorded frame interval
+        tframe[NBframe] = (NBframe>1) ? tframe[NBframe-1]*NBframe/(NBframe-1) : tframe[0];
+    }
+    else
+    {
+        if(frequ <= 0.0)
+        {
+            printf("ERROR: frequency must be > 0 if no timing image\n");
+            free(tframe);
+            return(-1);
+        }
+        for(k=0; k<NBframe+1; k++)
+            tframe[k] = 1.0*k/(frequ*speed);
+    }
+
+    IDout = image_ID(IDout_name);
+    if(IDout == -1)
+        IDout = read_sharedmem_image(IDout_name);
+    if(IDout == -1)
+    {
+        uint32_t sizearray[2];
+
+        sizearray[0] = data.image[IDcube].md[0].size[0];
+        sizearray[1] = data.image[IDcube].md[0].size[1];
+        IDout = create_image_ID(IDout_name, 2, sizearray, atype, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(IDout_name, 10);
+    }
+    else if((data.image[IDout].md[0].atype != atype)||(data.image[IDout].md[0].size[0] != data.image[IDcube].md[0].size[0])||(data.image[IDout].md[0].size[1] != data.image[IDcube].md[0].size[1]))
+    {
+        printf("ERROR: stream \"%s\" size or type does not match recorded frames\n", IDout_name);
+        free(tframe);
+        return(-1);
+    }
+
+    printf("Replaying %ld frames x %ld into \"%s\", duration %.3f s per pass\n", NBframe, NBloop, IDout_name, tframe[NBframe]);
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    tloop = 0.0;
+    for(loopiter=0; loopiter<NBloop; loopiter++)
+    {
+        for(k=0; k<NBframe; k++)
+        {
+            struct timespec tnow;
+            double tdeadline = tloop + tframe[k];
+            double t;
+
+            // sleep to 200 us before deadline, then spin
+            for(;;)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &tnow);
+                t = 1.0*(tnow.tv_sec-tstart.tv_sec) + 1.0e-9*(tnow.tv_nsec-tstart.tv_nsec);
+                if(t >= tdeadline)
+                    break;
+                if(tdeadline - t > 2.0e-4)
+                    usleep((long) (1.0e6*(tdeadline-t) - 200.0));
+            }
+            if(t - tdeadline > tlate)
+                tlate = t - tdeadline;
+
+            data.image[IDout].md[0].write = 1;
+            memcpy(data.image[IDout].array.UI8, data.image[IDcube].array.UI8 + k*framesize, framesize);
+            clock_gettime(CLOCK_REALTIME, &twrite);
+            data.image[IDout].md[0].atime.ts = twrite;
+            data.image[IDout].md[0].cnt1 = k;
+            COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+            data.image[IDout].md[0].cnt0++;
+            data.image[IDout].md[0].write = 0;
+
+            if(data.signal_USR1 == 1)
+                break;
+        }
+        if(data.signal_USR1 == 1)
+            break;
+        tloop += tframe[NBframe];
+    }
+
+    printf("Replay done, max write delay = %.1f us\n", 1.0e6*tlate);
+
+    free(tframe);
+
+    return(IDout);
+}
+
+
+
+
+/**
+ * @brief Records stream frames and timing
+ *
+ * Waits for NBframe updates of IDin_name (semaphore insem, or cnt0 polling if stream has no semaphore),
+ * and copies each frame into IDout_name [3D image, same type as input].
+ * Timing image IDtime_name [2D double image, AOLIOTOOLS_REC_NBCOL x NBframe], one row per frame :
+ *   - 0 : frame time [s] : input md[0].atime, or arrival time if the writer does not set atime
+ *   - 1 : input cnt0
+ *   - 2 : reference stream cnt1 (replayed frame index, see AOloopControl_IOtools_streamReplay()), -1 if none
+ *   - 3 : latency from reference stream md[0].atime to frame arrival [us], 0 if none
+ *
+ * Recording aol<loop>_dmC with aol<loop>_wfsim as reference while replaying WFS frames gives the loop latency per frame.
+ */
+long AOloopControl_IOtools_streamRecord(const char *IDin_name, long insem, long NBframe, const char *IDref_name, const char *IDout_name, const char *IDtime_name)
+{
+    long IDin, IDref, IDout, IDtime;
+    long framesize;
+    long k;
+    uint64_t cnt;
+    uint32_t sizearray[3];
+    double latsum = 0.0;
+    double latmax = 0.0;
+
+
+    IDin = image_ID(IDin_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(IDin_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: stream \"%s\" not found\n", IDin_name);
+        return(-1);
+    }
+    framesize = TYPESIZE[data.image[IDin].md[0].atype]*data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+
+    IDref = -1;
+    if(strcmp(IDref_name, "NULL") != 0)
+    {
+        IDref = image_ID(IDref_name);
+        if(IDref == -1)
+            IDref = read_sharedmem_image(IDref_name);
+    }
+
+    sizearray[0] = data.image[IDin].md[0].size[0];
+    sizearray[1] = data.image[IDin].md[0].size[1];
+    sizearray[2] = NBframe;
+    IDout = create_image_ID(IDout_name, 3, sizearray, data.image[IDin].md[0].atype, 0, 0);
+
+    sizearray[0] = AOLIOTOOLS_REC_NBCOL;
+    sizearray[1] = NBframe;
+    IDtime = create_image_ID(IDtime_name, 2, sizearray, _DATATYPE_DOUBLE, 0, 0);
+
+    if((data.image[IDin].md[0].sem > 0)&&(insem < data.image[IDin].md[0].sem))
+        COREMOD_MEMORY_image_set_semflush(IDin_name, insem);
+
+    printf("Recording %ld frames from \"%s\"\n", NBframe, IDin_name);
+    fflush(stdout);
+
+    cnt = data.image[IDin].md[0].cnt0;
+    for(k=0; k<NBframe; k++)
+    {
+        struct timespec tnow;
+        double *row = data.image[IDtime].array.D + k*AOLIOTOOLS_REC_NBCOL;
+
+        if((data.image[IDin].md[0].sem == 0)||(insem >= data.image[IDin].md[0].sem))
+        {
+            while(cnt == data.image[IDin].md[0].cnt0) // test if new frame exists
+                usleep(2);
+            cnt = data.image[IDin].md[0].cnt0;
+        }
+        else
+            sem_wait(data.image[IDin].semptr[insem]);
+
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        memcpy(data.image[IDout].array.UI8 + k*framesize, data.image[IDin].array.UI8, framesize);
+
+        if(data.image[IDin].md[0].atime.ts.tv_sec != 0)
+            row[0] = 1.0*data.image[IDin].md[0].atime.ts.tv_sec + 1.0e-9*data.image[IDin].md[0].atime.ts.tv_nsec;
+        else
+            row[0] = 1.0*tnow.tv_sec + 1.0e-9*tnow.tv_nsec;
+        row[1] = data.image[IDin].md[0].cnt0;
+
+        if(IDref != -1)
+        {
+            struct timespec tref = data.image[IDref].md[0].atime.ts;
+
+            row[2] = data.image[IDref].md[0].cnt1;
+            row[3] = 1.0e6*(tnow.tv_sec-tref.tv_sec) + 1.0e-3*(tnow.tv_nsec-tref.tv_nsec);
+            latsum += row[3];
+            if(row[3] > latmax)
+                latmax = row[3];
+        }
+        else
+        {
+            row[2] = -1.0;
+            row[3] = 0.0;
+        }
+
+        if(data.signal_USR1 == 1)
+        {
+            NBframe = k+1;
+            break;
+        }
+    }
+
+    if(IDref != -1)
+        printf("Latency from \"%s\" : average %.2f us, max %.2f us\n", IDref_name, latsum/NBframe, latmax);
+    printf("Recorded %ld frames\n", NBframe);
+
+    return(IDout);
+}
+
+
+
+
+
 
 
 
@@ -419,6 +756,15 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
         atypeout = atype;
 
 
+    // full-row band without dark or mask: zero-copy view of input stream
+    if((IDdark==-1)&&(IDmask==-1)&&(xstart==0)&&(size_x==data.image[IDin].md[0].size[0])&&(data.image[IDin].md[0].shared==1))
+    {
+        free(sizeout);
+        AOloopControl_IOtools_viewStream(in_name, out_name, ystart*size_x, size_x, size_y, 1, -1);
+        return 0;
+    }
+
+
     // Create shared memory output image
     IDout = create_image_ID(out_name, 2, sizeout, atypeout, 1, 0);
 
@@ -431,7 +777,7 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
             usleep(10); // OK FOR NOW (NOT USED BY FAST WFS)
             if(data.image[IDin].md[0].cnt0!=cnt0)
             {
-                data.image[IDout].md[0].write = 1;
+                ImageStreamIO_write_begin(&data.image[IDout]);
                 cnt0 = data.image[IDin].md[0].cnt0;
                 if(atypeout == _DATATYPE_UINT16)
                 {
@@ -473,8 +819,8 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
                         for(ii=0; ii<sizeoutxy; ii++)
                             data.image[IDout].array.F[ii] *= data.image[IDmask].array.F[ii];
                 }
+                ImageStreamIO_write_end(&data.image[IDout]);
                 data.image[IDout].md[0].cnt0 = cnt0;
-                data.image[IDout].md[0].write = 0;
             }
         }
         break;
@@ -484,7 +830,7 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
             usleep(50); // OK FOR NOW (NOT USED BY FAST WFS)
             if(data.image[IDin].md[0].cnt0!=cnt0)
             {
-                data.image[IDout].md[0].write = 1;
+                ImageStreamIO_write_begin(&data.image[IDout]);
                 cnt0 = data.image[IDin].md[0].cnt0;
                 if(IDdark==-1)
                 {
@@ -511,8 +857,8 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
                     for(ii=0; ii<sizeoutxy; ii++)
                         data.image[IDout].array.F[ii] *= data.image[IDmask].array.F[ii];
 
+                ImageStreamIO_write_end(&data.image[IDout]);
                 data.image[IDout].md[0].cnt0 = cnt0;
-                data.image[IDout].md[0].write = 0;
             }
         }
         break;
@@ -529,120 +875,421 @@ int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *
 
 
 
+/* decode events into output pixel index (-1 if outside frame or gate) and time bin */
+static inline void AOloopControl_IOtools_eventStream_decode(const EVENT_UI8_UI8_UI16_UI8 *restrict ev, long NBev, int32_t *restrict pix, int32_t *restrict tbin, int32_t xsize, int32_t ysize, int32_t NBlambda, int32_t gate0, int32_t gate1, int32_t dtbin)
+{
+    long i;
 
+# ifdef _OPENMP
+    #pragma omp simd
+# endif
+    for(i=0; i<NBev; i++)
+    {
+        int32_t x = ev[i].xpix;
+        int32_t y = ev[i].ypix;
+        int32_t t = ev[i].dtus;
+        int32_t lb = (ev[i].lambda_index * NBlambda) >> 8;
+        int valid = (x < xsize) & (y < ysize) & (t >= gate0) & (t < gate1);
+
+        pix[i] = valid ? (lb*ysize + y)*xsize + x : -1;
+        tbin[i] = valid ? (t - gate0)/dtbin : 0;
+    }
+}
 
 
 
+/**
+ * @brief Bins photon events into time and wavelength resolved frames
+ *
+ * Input in_name is an EVENT_UI8_UI8_UI16_UI8 circular buffer (see ImageStruct.h): on each input update, the last slice written
+ * (md[0].cnt1, md[0].cnt2 events) is processed. Slices overwritten before being read are counted as dropped.\n
+ * Events with dtus in the time gate [gate0_us, gate1_us[ are binned into output frames of dt_us [us] each (one frame for the whole gate if dt_us <= 0),
+ * so that each slice produces (gate1_us-gate0_us)/dt_us frames. Gate is [0, 65536[ if gate1_us <= gate0_us.\n
+ * Output out_name : float, xsize x ysize (x NBlambda if NBlambda > 1), photon counts. lambda_index is mapped to NBlambda bins.
+ * Each frame is published with cnt1 = time bin index in slice and atime = slice atime + bin start.\n
+ * Frames are cleared sparsely (only pixels hit in the previous frame), so the cost per frame scales with the number of events.
+ * Never returns.
+ */
+long AOloopControl_IOtools_eventStream(const char *in_name, const char *out_name, long xsize, long ysize, long NBlambda, long dt_us, long gate0_us, long gate1_us, int insem)
+{
+    long IDin, IDout;
+    uint32_t sizearray[3];
+    long naxis;
+    long NBevmax, NBslice;
+    long NBtbin;
+    int32_t *pix, *tbin, *order, *dirty;
+    long *tcount;
+    long NBdirty = 0;
+    uint64_t cnt;
+    uint64_t slicenext;
+    long NBdropped = 0;
 
 
+    IDin = image_ID(in_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(in_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: stream \"%s\" not found\n", in_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].atype != _DATATYPE_EVENT_UI8_UI8_UI16_UI8)
+    {
+        printf("ERROR: stream \"%s\" is not an event stream\n", in_name);
+        return(-1);
+    }
 
-static void *compute_function_imtotal( void *ptr )
-{
-    long ii;
-    long nelem;
-    int semval;
-	float IMTOTAL;
-	
-
-	printf("TEST - =========== ENTERING compute_function_imtotal ===================\n");
-	fflush(stdout);
+    NBevmax = data.image[IDin].md[0].size[0];
+    NBslice = 1;
+    if(data.image[IDin].md[0].naxis == 3)
+        NBslice = data.image[IDin].md[0].size[2];
 
+    if((xsize < 1)||(xsize > 256)||(ysize < 1)||(ysize > 256))
+    {
+        printf("ERROR: frame size %ld x %ld out of range [1-256]\n", xsize, ysize);
+        return(-1);
+    }
+    if(NBlambda < 1)
+        NBlambda = 1;
+    if(NBlambda > 256)
+        NBlambda = 256;
+    if(gate1_us <= gate0_us)
+    {
+        gate0_us = 0;
+        gate1_us = 65536;
+    }
+    if(dt_us <= 0)
+        dt_us = gate1_us - gate0_us;
+    NBtbin = (gate1_us - gate0_us + dt_us - 1)/dt_us;
 
-    nelem = data.image[aoconfID_imWFS0].md[0].size[0]*data.image[aoconfID_imWFS0].md[0].size[1];
+    sizearray[0] = xsize;
+    sizearray[1] = ysize;
+    sizearray[2] = NBlambda;
+    naxis = 2;
+    if(NBlambda > 1)
+        naxis = 3;
+    IDout = create_image_ID(out_name, naxis, sizearray, _DATATYPE_FLOAT, 1, 0);
+    memset(data.image[IDout].array.F, 0, sizeof(float)*data.image[IDout].md[0].nelement);
+
+    pix = (int32_t*) malloc(sizeof(int32_t)*NBevmax);
+    tbin = (int32_t*) malloc(sizeof(int32_t)*NBevmax);
+    order = (int32_t*) malloc(sizeof(int32_t)*NBevmax);
+    dirty = (int32_t*) malloc(sizeof(int32_t)*NBevmax);
+    tcount = (long*) malloc(sizeof(long)*(NBtbin+1));
+
+    if((insem >= 0)&&(insem < data.image[IDin].md[0].sem))
+        COREMOD_MEMORY_image_set_semflush(in_name, insem);
+
+    printf("Event stream \"%s\" -> \"%s\" : %ld time bins of %ld us per slice, gate [%ld, %ld[ us\n", in_name, out_name, NBtbin, dt_us, gate0_us, gate1_us);
+    fflush(stdout);
 
-    for(;;)
+    cnt = data.image[IDin].md[0].cnt0;
+    slicenext = 0;
+    if(cnt > 0)
+        slicenext = (data.image[IDin].md[0].cnt1 + 1) % NBslice;
+    while(1)
     {
-		#ifdef _PRINT_TEST
-		printf("TEST - Waiting for semaphore\n");
-		fflush(stdout);
-		#endif
-
-        sem_wait(&AOLCOMPUTE_TOTAL_ASYNC_sem_name);
-
-		#ifdef _PRINT_TEST
-		printf("TEST - COMPUTING TOTAL FOR IMAGE ID %ld : %s\n", aoconfID_imWFS0, data.image[aoconfID_imWFS0].md[0].name);
-		fflush(stdout);
-		#endif
-	
-		imtotalcnt++;
-		
-        data.image[aoconfID_imWFS0tot].md[0].write = 1;
-        IMTOTAL = 0.0;
-        if(aoconfID_wfsmask!=-1)
+        const EVENT_UI8_UI8_UI16_UI8 *ev;
+        struct timespec t0;
+        long slice, NBev, i, b;
+
+        if((insem < 0)||(insem >= data.image[IDin].md[0].sem))
         {
-            for(ii=0; ii<nelem; ii++)
-                IMTOTAL += data.image[aoconfID_imWFS0].array.F[ii]*data.image[aoconfID_wfsmask].array.F[ii];
+            while(cnt == data.image[IDin].md[0].cnt0) // test if new slice exists
+                usleep(2);
+            cnt = data.image[IDin].md[0].cnt0;
         }
         else
+            sem_wait(data.image[IDin].semptr[insem]);
+
+        slice = data.image[IDin].md[0].cnt1;
+        NBev = data.image[IDin].md[0].cnt2;
+        t0 = data.image[IDin].md[0].atime.ts;
+        if(NBev > NBevmax)
+            NBev = NBevmax;
+        if((uint64_t) slice != slicenext)
         {
-            for(ii=0; ii<nelem; ii++)
-                IMTOTAL += data.image[aoconfID_imWFS0].array.F[ii];
+            NBdropped += (slice - (long) slicenext + NBslice) % NBslice;
+            printf("WARNING: event stream \"%s\" : %ld slices dropped total\n", in_name, NBdropped);
+        }
+        slicenext = (slice + 1) % NBslice;
+        ev = data.image[IDin].array.event1121 + slice*NBevmax;
+
+        AOloopControl_IOtools_eventStream_decode(ev, NBev, pix, tbin, xsize, ysize, NBlambda, gate0_us, gate1_us, dt_us);
+
+        // counting sort by time bin, gated events dropped
+        memset(tcount, 0, sizeof(long)*(NBtbin+1));
+        for(i=0; i<NBev; i++)
+            if(pix[i] >= 0)
+                tcount[tbin[i]+1]++;
+        for(b=0; b<NBtbin; b++)
+            tcount[b+1] += tcount[b];
+        for(i=0; i<NBev; i++)
+            if(pix[i] >= 0)
+                order[tcount[tbin[i]]++] = pix[i];
+        for(b=NBtbin; b>0; b--)
+            tcount[b] = tcount[b-1];
+        tcount[0] = 0;
+
+        for(b=0; b<NBtbin; b++)
+        {
+            long nb = tcount[b+1] - tcount[b];
+            const int32_t *bpix = order + tcount[b];
+            float *out = data.image[IDout].array.F;
+            long tns;
+
+            ImageStreamIO_write_begin(&data.image[IDout]);
+            for(i=0; i<NBdirty; i++)
+                out[dirty[i]] = 0.0;
+            for(i=0; i<nb; i++)
+                out[bpix[i]] += 1.0;
+            memcpy(dirty, bpix, sizeof(int32_t)*nb);
+            NBdirty = nb;
+
+            tns = t0.tv_nsec + 1000*(gate0_us + b*dt_us);
+            data.image[IDout].md[0].atime.ts.tv_sec = t0.tv_sec + tns/1000000000;
+            data.image[IDout].md[0].atime.ts.tv_nsec = tns%1000000000;
+            data.image[IDout].md[0].cnt1 = b;
+            ImageStreamIO_write_end(&data.image[IDout]);
+            data.image[IDout].md[0].cnt0++;
+            ImageStreamIO_sempost(&data.image[IDout], -1);
         }
-        data.image[aoconfID_imWFS0tot].array.F[0] = IMTOTAL;
-        
-        AOconf[LOOPNUMBER].WFStotalflux = IMTOTAL;
-        
-        COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0tot, -1);
-        data.image[aoconfID_imWFS0tot].md[0].cnt0++;
-        data.image[aoconfID_imWFS0tot].md[0].write = 0;
     }
 
+    free(pix);
+    free(tbin);
+    free(order);
+    free(dirty);
+    free(tcount);
+
+    return(IDout);
 }
 
 
 
 
-static void *compute_function_dark_subtract( void *ptr )
-{
-    long ii, iistart, iiend;
-    long nelem;
-    long *index;
-    int sval;
-    long threadindex;
-    int semval;
 
 
-    nelem = data.image[aoconfID_imWFS0].md[0].size[0]*data.image[aoconfID_imWFS0].md[0].size[1];
-    index = (long*) ptr;
-    threadindex = *index;
 
-    iistart = (long) ((threadindex)*nelem/COMPUTE_DARK_SUBTRACT_NBTHREADS);
-    iiend = (long) ((threadindex+1)*nelem/COMPUTE_DARK_SUBTRACT_NBTHREADS);
 
-    while(1)
+
+
+
+/* fused dark subtraction + total, one tile of READCAM_TILESIZE pixels. mask = NULL for unmasked total */
+#define READCAM_DARKSUB_TILE(NAME, TYPE)                                           \
+static inline float NAME(const TYPE *in, const float *dark, const float *mask, float *out, long n) \
+{                                                                                  \
+    long ii;                                                                       \
+    float total = 0.0;                                                             \
+                                                                                   \
+    if(mask == NULL)                                                               \
+    {                                                                              \
+        _Pragma("omp simd reduction(+:total)")                                     \
+        for(ii=0; ii<n; ii++)                                                      \
+        {                                                                          \
+            float val = ((float) in[ii]) - dark[ii];                               \
+            out[ii] = val;                                                         \
+            total += val;                                                          \
+        }                                                                          \
+    }                                                                              \
+    else                                                                           \
+    {                                                                              \
+        _Pragma("omp simd reduction(+:total)")                                     \
+        for(ii=0; ii<n; ii++)                                                      \
+        {                                                                          \
+            float val = ((float) in[ii]) - dark[ii];                               \
+            out[ii] = val;                                                         \
+            total += val*mask[ii];                                                 \
+        }                                                                          \
+    }                                                                              \
+    return total;                                                                  \
+}
+
+READCAM_DARKSUB_TILE(Read_cam_frame_darksub_tile_UI16, uint16_t)
+READCAM_DARKSUB_TILE(Read_cam_frame_darksub_tile_SI16, int16_t)
+READCAM_DARKSUB_TILE(Read_cam_frame_darksub_tile_F, float)
+
+
+
+/**
+ * @brief Dark subtract WFS frame and compute its (masked) total in a single pass
+ * 
+ * Frame is processed in tiles of READCAM_TILESIZE pixels, so that input, dark, mask and output of a tile stay in L1/L2 cache.\n
+ * Tiles are distributed over threads if the frame has at least READCAM_NBTILE_OMP tiles.\n
+ * Tile totals are accumulated in double precision.
+ * 
+ * @param[in]  in      raw frame (UINT16, INT16 or FLOAT)
+ * @param[in]  atype   raw frame data type
+ * @param[in]  dark    dark frame
+ * @param[in]  mask    pixel weights for total, NULL for none
+ * @param[out] out     dark-subtracted frame
+ * @param[in]  nelem   number of pixels
+ * 
+ * @return frame total
+ */
+HOTKERNEL static double Read_cam_frame_darksub(const void *in, uint8_t atype, const float *dark, const float *mask, float *out, long nelem)
+{
+    long NBtile = (nelem + READCAM_TILESIZE - 1)/READCAM_TILESIZE;
+    long tile;
+    double total = 0.0;
+
+# ifdef _OPENMP
+    #pragma omp parallel for num_threads(8) schedule(static) reduction(+:total) if (NBtile >= READCAM_NBTILE_OMP)
+# endif
+    for(tile=0; tile<NBtile; tile++)
     {
-        sem_wait(&AOLCOMPUTE_DARK_SUBTRACT_sem_name[threadindex]);
+        long ii0 = tile*READCAM_TILESIZE;
+        long n = (ii0 + READCAM_TILESIZE > nelem) ? nelem - ii0 : READCAM_TILESIZE;
+        const float *masktile = (mask == NULL) ? NULL : mask + ii0;
 
-        switch ( WFSatype ) {
+        switch ( atype ) {
         case _DATATYPE_UINT16 :
-            for(ii=iistart; ii<iiend; ii++)
-                data.image[aoconfID_imWFS0].array.F[ii] = ((float) arrayutmp[ii]) - data.image[Average_cam_frames_IDdark].array.F[ii];
+            total += Read_cam_frame_darksub_tile_UI16((const uint16_t*) in + ii0, dark + ii0, masktile, out + ii0, n);
             break;
-        case _DATATYPE_FLOAT :
-            for(ii=iistart; ii<iiend; ii++)
-                data.image[aoconfID_imWFS0].array.F[ii] = ((float) arrayftmp[ii]) - data.image[Average_cam_frames_IDdark].array.F[ii];
+        case _DATATYPE_INT16 :
+            total += Read_cam_frame_darksub_tile_SI16((const int16_t*) in + ii0, dark + ii0, masktile, out + ii0, n);
             break;
-        default :
-            printf("ERROR: WFS data type not recognized\n");
-            exit(0);
+        case _DATATYPE_FLOAT :
+            total += Read_cam_frame_darksub_tile_F((const float*) in + ii0, dark + ii0, masktile, out + ii0, n);
             break;
         }
+    }
+
+    return total;
+}
+
+
+
+
+
+
+
+
+
+
+
+
 
-        sem_getvalue(&AOLCOMPUTE_DARK_SUBTRACT_RESULT_sem_name[threadindex], &semval);
-        if(semval<SEMAPHORE_MAXVAL)
-            sem_post(&AOLCOMPUTE_DARK_SUBTRACT_RESULT_sem_name[threadindex]);
+/* in-loop WFS residual streams (AOconf[loop].WFSresinloop = 1), same names as AOloopControl_computeWFSresidualimage outputs */
+static void Read_cam_frame_wfsres_setup(long loop)
+{
+    const char *suffix[5] = {"wfsres", "wfsres_ave", "wfsresm", "wfsresm_ave", "wfsres_rms"};
+    uint32_t sizearray[2];
+    char imname[200];
+    int i;
+
+    sizearray[0] = AOconf[loop].sizexWFS;
+    sizearray[1] = AOconf[loop].sizeyWFS;
+    for(i=0; i<5; i++)
+    {
+        if(sprintf(imname, "aol%ld_%s", loop, suffix[i]) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+        Read_cam_frame_IDwfsres[i] = image_ID(imname);
+        if(Read_cam_frame_IDwfsres[i] == -1)
+            Read_cam_frame_IDwfsres[i] = read_sharedmem_image(imname);
+        if((Read_cam_frame_IDwfsres[i] == -1)||(data.image[Read_cam_frame_IDwfsres[i]].md[0].nelement != AOconf[loop].sizeWFS))
+        {
+            Read_cam_frame_IDwfsres[i] = create_image_ID(imname, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+            COREMOD_MEMORY_image_set_createsem(imname, 10);
+        }
+        memset(data.image[Read_cam_frame_IDwfsres[i]].array.F, 0, sizeof(float)*AOconf[loop].sizeWFS);
     }
+    Read_cam_frame_wfsrescnt = 0;
+}
+
+
+
+/*
+ * fused normalization and WFS residual, single pass over dark-subtracted frame in :
+ *   norm = in*scale (skipped if norm = NULL), res = in*scale - ref, resm = res*mask
+ *   if doave = 1 : ave, avem = ave*mask and rms EWMA updates with coefficient alpha
+ * mask = NULL for unmasked
+ */
+HOTKERNEL static void Read_cam_frame_normres(const float *restrict in, float *restrict norm, float scale, const float *restrict ref, const float *restrict mask,
+                                   float *restrict res, float *restrict resm, float *restrict ave, float *restrict avem, float *restrict rms, float alpha, int doave, long nelem)
+{
+    long ii;
+
+# ifdef _OPENMP
+    #pragma omp parallel for simd num_threads(8) if (nelem>OMP_NELEMENT_LIMIT)
+# endif
+    for(ii=0; ii<nelem; ii++)
+    {
+        float v = in[ii]*scale;
+        float r = v - ref[ii];
+        float m = (mask != NULL) ? mask[ii] : 1.0f;
+
+        if(norm != NULL)
+            norm[ii] = v;
+        res[ii] = r;
+        resm[ii] = r*m;
+        if(doave == 1)
+        {
+            float a = (1.0f-alpha)*ave[ii] + alpha*r;
 
+            ave[ii] = a;
+            avem[ii] = a*m;
+            rms[ii] = (1.0f-alpha)*rms[ii] + alpha*(r-a)*(r-a);
+        }
+    }
 }
 
 
 
+/* fused normalization + residual pass and publication of residual streams */
+static void Read_cam_frame_wfsres(long loop, float *norm, float totalinv)
+{
+    long nelem = AOconf[loop].sizeWFS;
+    int doave;
+    int i;
+
+    if(Read_cam_frame_IDwfsres[0] == -1)
+        Read_cam_frame_wfsres_setup(loop);
+
+    Read_cam_frame_wfsrescnt++;
+    doave = (Read_cam_frame_wfsrescnt >= AOconf[loop].WFSresdecim);
+    if(doave == 1)
+        Read_cam_frame_wfsrescnt = 0;
+
+    for(i=0; i<5; i++)
+        data.image[Read_cam_frame_IDwfsres[i]].md[0].write = 1;
+    Read_cam_frame_normres(data.image[aoconfID_imWFS0].array.F, norm, totalinv, data.image[aoconfID_wfsref].array.F,
+                           (aoconfID_wfsmask != -1) ? data.image[aoconfID_wfsmask].array.F : NULL,
+                           data.image[Read_cam_frame_IDwfsres[0]].array.F, data.image[Read_cam_frame_IDwfsres[2]].array.F,
+                           data.image[Read_cam_frame_IDwfsres[1]].array.F, data.image[Read_cam_frame_IDwfsres[3]].array.F,
+                           data.image[Read_cam_frame_IDwfsres[4]].array.F, AOconf[loop].WFSresalpha, doave, nelem);
+    for(i=0; i<5; i++)
+    {
+        long ID = Read_cam_frame_IDwfsres[i];
 
+        if((doave == 1)||(i == 0)||(i == 2))
+        {
+            data.image[ID].md[0].cnt0++;
+            COREMOD_MEMORY_image_set_sempost_byID(ID, -1);
+        }
+        data.image[ID].md[0].write = 0;
+    }
+}
 
 
 
 
+/**
+ * @brief Ends seqlock read of zero-copy WFS frame, called after GPU MVM that reads camera stream in place
+ *
+ * @return 1 if camera process overwrote frame while GPU was reading it (counted in WFScnttorn), 0 otherwise
+ */
+int_fast8_t Read_cam_frame_zerocopy_end(long loop)
+{
+    if(ImageStreamIO_read_retry(&data.image[aoconfID_wfsim], Read_cam_frame_zcseq) == 1)
+    {
+        AOconf[loop].WFScnttorn++;
+        return(1);
+    }
 
+    return(0);
+}
 
 
 
@@ -660,25 +1307,14 @@ static void *compute_function_dark_subtract( void *ptr )
 
 int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode, int InitSem)
 {
-    long imcnt;
     long ii;
     double totalinv;
-    char name[200];
     int slice;
-    char *ptrv;
-    long double tmplv1;
-    double tmpf;
-    long IDdark;
-    char dname[200];
     long nelem;
-    pthread_t thread_computetotal_id;
-    pthread_t thread_dark_subtract[20];
-    float resulttotal;
-    int sval0, sval;
-    void *status = 0;
+    double IMTOTAL;
     long i;
     int semval;
-    int s;
+    uint64_t cntlast;
 
     int semindex = 0;
 
@@ -746,16 +1382,25 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
     fflush(stdout);
 #endif
 
-    if(data.image[aoconfID_wfsim].md[0].sem==0)
+    if(RM==0)
+        cntlast = AOconf[loop].WFScnt;
+    else
+        cntlast = AOconf[loop].WFScntRM;
+
+    if((data.image[aoconfID_wfsim].md[0].futex==1) // spin, then block on cnt0
+            && (ImageStreamIO_futexwait(&data.image[aoconfID_wfsim], cntlast, READCAM_FUTEXTIMEOUTUS) == 0))
     {
-        if(RM==0)
-            while(AOconf[loop].WFScnt==data.image[aoconfID_wfsim].md[0].cnt0) // test if new frame exists
-                usleep(5);
-        else
-            while(AOconf[loop].WFScntRM==data.image[aoconfID_wfsim].md[0].cnt0) // test if new frame exists
-                usleep(5);
+        // new frame, semaphore posted by writer is drained below
+        sem_getvalue(data.image[aoconfID_wfsim].semptr[semindex], &semval);
+        for(i=0; i<semval; i++)
+            sem_trywait(data.image[aoconfID_wfsim].semptr[semindex]);
     }
-    else
+    else if(data.image[aoconfID_wfsim].md[0].sem <= semindex) // no semaphore: poll cnt0
+    {
+        while(cntlast == data.image[aoconfID_wfsim].md[0].cnt0) // test if new frame exists
+            usleep(5);
+    }
+    else // futex timed out (writer may not wake futex readers) or not supported by stream
     {
 #ifdef _PRINT_TEST
         printf("TEST - waiting on semindex = %d\n", semindex);
@@ -775,11 +1420,39 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
 #endif
     }
 
+    if(RM==0)
+        AOloopControl_looptiming_mark(AOLTIMING_WAIT);
+
+    if(Read_cam_frame_latindex == -2)
+        Read_cam_frame_latindex = ImageStreamIO_latency_reader_open(&data.image[aoconfID_wfsim], "aolRead_cam");
+    if(Read_cam_frame_latindex >= 0)
+        ImageStreamIO_latency_record(&data.image[aoconfID_wfsim], Read_cam_frame_latindex);
+
     if(RM==0)
         AOconf[loop].status = 0;  // LOAD IMAGE
 
     AOconf[loop].statusM = 0;
 
+    // zero-copy GPU input: frame is read in place by GPU_loop_MultMat_execute (dark, flux and normalization done there)
+    // frame is checked against seqlock by Read_cam_frame_zerocopy_end once GPU is done with it
+    if((RM==0)&&(AOconf[loop].GPUzerocopyON==1))
+    {
+        Read_cam_frame_zcseq = ImageStreamIO_read_begin(&data.image[aoconfID_wfsim]);
+        AOconf[loop].WFScnt = data.image[aoconfID_wfsim].md[0].cnt0;
+        PIXSTREAM_SLICE = data.image[aoconfID_wfsim].md[0].cnt1;
+
+        AOconf[loop].status = 1;
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[aoconfID_looptiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[aoconfID_looptiming].array.F[0] = tdiffv;
+        data.image[aoconfID_looptiming].md[0].atime.ts = tnow;
+
+        AOloopControl_looptiming_mark(AOLTIMING_READ);
+        AOloopControl_looptiming_mark(AOLTIMING_DARK);
+        return(0);
+    }
+
 
     slice = 0;
     if(data.image[aoconfID_wfsim].md[0].naxis==3) // ring buffer
@@ -789,22 +1462,24 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
             slice = data.image[aoconfID_wfsim].md[0].size[2];
     }
 
+    // copy frame, repeated if camera process overwrites it during copy (seqlock)
     switch (WFSatype) {
     case _DATATYPE_FLOAT :
-        ptrv = (char*) data.image[aoconfID_wfsim].array.F;
-        ptrv += sizeof(float)*slice* AOconf[loop].sizeWFS;
-        memcpy(arrayftmp, ptrv,  sizeof(float)*AOconf[loop].sizeWFS);
+        if(ImageStreamIO_read_consistent(&data.image[aoconfID_wfsim], arrayftmp, sizeof(float)*slice*AOconf[loop].sizeWFS, sizeof(float)*AOconf[loop].sizeWFS, 10) == 1)
+            AOconf[loop].WFScnttorn++;
         break;
     case _DATATYPE_UINT16 :
-        ptrv = (char*) data.image[aoconfID_wfsim].array.UI16;
-        ptrv += sizeof(unsigned short)*slice* AOconf[loop].sizeWFS;
-        memcpy (arrayutmp, ptrv, sizeof(unsigned short)*AOconf[loop].sizeWFS);
+    case _DATATYPE_INT16 :  // same size, interpreted as signed in dark subtraction
+        if(ImageStreamIO_read_consistent(&data.image[aoconfID_wfsim], arrayutmp, sizeof(unsigned short)*slice*AOconf[loop].sizeWFS, sizeof(unsigned short)*AOconf[loop].sizeWFS, 10) == 1)
+            AOconf[loop].WFScnttorn++;
         break;
     default :
         printf("ERROR: DATA TYPE NOT SUPPORTED\n");
         exit(0);
         break;
     }
+    if(RM==0)
+        AOloopControl_looptiming_mark(AOLTIMING_READ);
     if(RM==0)
         AOconf[loop].WFScnt = data.image[aoconfID_wfsim].md[0].cnt0;
     else
@@ -832,114 +1507,16 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
     fflush(stdout);
 #endif
 
-    // Dark subtract and compute total
-
-    if((loop==0)||(RM == 1)) // single thread, in CPU
-    {
-        switch ( WFSatype ) {
-        case _DATATYPE_UINT16 :
-# ifdef _OPENMP
-            #pragma omp parallel num_threads(8) if (Average_cam_frames_nelem>OMP_NELEMENT_LIMIT)
-        {
-# endif
-
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for(ii=0; ii<Average_cam_frames_nelem; ii++)
-                data.image[aoconfID_imWFS0].array.F[ii] = ((float) arrayutmp[ii]) - data.image[Average_cam_frames_IDdark].array.F[ii];
-# ifdef _OPENMP
-        }
-# endif
-        break;
-        case _DATATYPE_FLOAT :
-# ifdef _OPENMP
-            #pragma omp parallel num_threads(8) if (Average_cam_frames_nelem>OMP_NELEMENT_LIMIT)
-        {
-# endif
-
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for(ii=0; ii<Average_cam_frames_nelem; ii++)
-                data.image[aoconfID_imWFS0].array.F[ii] = arrayftmp[ii] - data.image[Average_cam_frames_IDdark].array.F[ii];
-# ifdef _OPENMP
-        }
-# endif
-        break;
-        default :
-            printf("ERROR: WFS data type not recognized\n");
-            exit(0);
-            break;
-        }
-
-        for(s=0; s<data.image[aoconfID_imWFS0].md[0].sem; s++)
-        {
-            sem_getvalue(data.image[aoconfID_imWFS0].semptr[s], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[aoconfID_imWFS0].semptr[s]);
-        }
-    }
-    else
-    {
-#ifdef _PRINT_TEST
-        printf("TEST - DARK SUBTRACT - START  (init = %d, %d threads)\n", AOLCOMPUTE_DARK_SUBTRACT_THREADinit, COMPUTE_DARK_SUBTRACT_NBTHREADS);
-        fflush(stdout);
-#endif
-
-        if(AOLCOMPUTE_DARK_SUBTRACT_THREADinit==0)
-        {
-#ifdef _PRINT_TEST
-            printf("TEST - DARK SUBTRACT - CREATE %d THREADS\n", COMPUTE_DARK_SUBTRACT_NBTHREADS);
-            fflush(stdout);
-#endif
-
-            ti = 0;
-
-            while(ti<COMPUTE_DARK_SUBTRACT_NBTHREADS)
-            {
-                pthread_create( &thread_dark_subtract[ti], NULL, compute_function_dark_subtract, (void*) &ti);
-                sem_init(&AOLCOMPUTE_DARK_SUBTRACT_sem_name[ti], 0, 0);
-                sem_init(&AOLCOMPUTE_DARK_SUBTRACT_RESULT_sem_name[ti], 0, 0);
-                usleep(100);
-                ti++;
-            }
-            AOLCOMPUTE_DARK_SUBTRACT_THREADinit = 1;
-        }
-
-
-        for(ti=0; ti<COMPUTE_DARK_SUBTRACT_NBTHREADS; ti++)
-        {
-            sem_getvalue(&AOLCOMPUTE_DARK_SUBTRACT_sem_name[ti], &sval0);
-            if(sval0<SEMAPHORE_MAXVAL)
-                sem_post(&AOLCOMPUTE_DARK_SUBTRACT_sem_name[ti]);
-
-            sem_getvalue(&AOLCOMPUTE_DARK_SUBTRACT_sem_name[ti], &sval);
-
-#ifdef _PRINT_TEST
-            printf("TEST - DARK SUBTRACT - WAITING ON THREAD %ld\n", ti);
-            fflush(stdout);
-#endif
-            sem_wait(&AOLCOMPUTE_DARK_SUBTRACT_RESULT_sem_name[ti]);
-        }
+    // Dark subtract and compute total, single pass
+    IMTOTAL = Read_cam_frame_darksub((WFSatype == _DATATYPE_FLOAT) ? (void*) arrayftmp : (void*) arrayutmp, WFSatype,
+                                     data.image[Average_cam_frames_IDdark].array.F,
+                                     (aoconfID_wfsmask != -1) ? data.image[aoconfID_wfsmask].array.F : NULL,
+                                     data.image[aoconfID_imWFS0].array.F, Average_cam_frames_nelem);
+    if(RM==0)
+        AOloopControl_looptiming_mark(AOLTIMING_DARK);
 
-        for(s=0; s<data.image[aoconfID_imWFS0].md[0].sem; s++)
-        {
-            sem_getvalue(data.image[aoconfID_imWFS0].semptr[s], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[aoconfID_imWFS0].semptr[s]);
-        }
-#ifdef _PRINT_TEST
-        printf("TEST - DARK SUBTRACT - END\n");
-        fflush(stdout);
-#endif
-    }
+    COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0, -1);
 
-    //  if(IDdark!=-1)
-    // {
-    //    for(ii=0; ii<AOconf[loop].sizeWFS; ii++)
-    //       data.image[aoconfID_imWFS0].array.F[ii] -= data.image[IDdark].array.F[ii];
-    //}
     AOconf[loop].statusM = 2;
     if(RM==0)
     {
@@ -950,75 +1527,13 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
         data.image[aoconfID_looptiming].array.F[2] = tdiffv;
     }
 
-#ifdef _PRINT_TEST
-    printf("TEST - NORMALIZE = %d\n", normalize);
-    fflush(stdout);
-#endif
-
-
-    // Normalize
     if(normalize==1)
     {
-        if((AOconf[loop].AOLCOMPUTE_TOTAL_ASYNC==0)||(AOLCOMPUTE_TOTAL_INIT==0)||(RM == 1)) // do it in main thread
-        {
-			float IMTOTAL;
-			
-            nelem = data.image[aoconfID_imWFS0].md[0].size[0]*data.image[aoconfID_imWFS0].md[0].size[1];
-            IMTOTAL = 0.0;
-            if(aoconfID_wfsmask!=-1)
-            {
-                for(ii=0; ii<nelem; ii++)
-                    IMTOTAL += data.image[aoconfID_imWFS0].array.F[ii]*data.image[aoconfID_wfsmask].array.F[ii];
-            }
-            else
-            {
-                for(ii=0; ii<nelem; ii++)
-                    IMTOTAL += data.image[aoconfID_imWFS0].array.F[ii];
-            }
-
-            //            AOconf[loop].WFStotalflux = arith_image_total(data.image[aoconfID_imWFS0].name);
-            AOconf[loop].WFStotalflux = IMTOTAL;
-
-            AOLCOMPUTE_TOTAL_INIT = 1;
-            //            IMTOTAL = AOconf[loop].WFStotalflux;
-            if(aoconfID_imWFS0tot!=-1)
-            {
-                data.image[aoconfID_imWFS0tot].array.F[0] = IMTOTAL;
-                COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0tot, -1);
-                //                sem_getvalue(data.image[aoconfID_imWFS0tot].semptr[0], &semval);
-                //               if(semval<SEMAPHORE_MAXVAL)
-                //                  sem_post(data.image[aoconfID_imWFS0tot].semptr[0]);
-            }
-        }
-        else  // do it in other threads
+        AOconf[loop].WFStotalflux = IMTOTAL;
+        if(aoconfID_imWFS0tot!=-1)
         {
-			#ifdef _PRINT_TEST
-			printf("TEST - compute total in separate thread  AOLCOMPUTE_TOTAL_ASYNC_THREADinit = %d\n", AOLCOMPUTE_TOTAL_ASYNC_THREADinit);
-			fflush(stdout);
-			#endif
-			
-           // AOconf[loop].WFStotalflux = data.image[aoconfID_imWFS0tot].array.F[0]; // from last loop
-            if(AOLCOMPUTE_TOTAL_ASYNC_THREADinit==0)
-            {
-				
-				printf("Starting Image Total Thread \n");
-				fflush(stdout);
-				
-				
-                pthread_create( &thread_computetotal_id, NULL, compute_function_imtotal, NULL);
-                AOLCOMPUTE_TOTAL_ASYNC_THREADinit = 1;
-                imtotalcnt = 0;
-                sem_init(&AOLCOMPUTE_TOTAL_ASYNC_sem_name, 0, 0);
-            }
-            sem_getvalue(&AOLCOMPUTE_TOTAL_ASYNC_sem_name, &semval);
-            
-            #ifdef _PRINT_TEST
-			printf("TEST - semaphore = %d / %d\n", semval, SEMAPHORE_MAXVAL);	
-			fflush(stdout);
-			#endif
-			data.image[aoconfID_imWFS0tot].md[0].cnt1 = imtotalcnt;
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(&AOLCOMPUTE_TOTAL_ASYNC_sem_name);
+            data.image[aoconfID_imWFS0tot].array.F[0] = IMTOTAL;
+            COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS0tot, -1);
         }
     }
 
@@ -1055,7 +1570,20 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
 
 
 
-    if( ((AOconf[loop].GPUall==0)&&(RM==0)) || (RM==1))  // normalize WFS image by totalinv
+    if( (RM==0)&&(AOconf[loop].WFSresinloop==1)&&(aoconfID_wfsref!=-1) )  // normalize WFS image and compute residual in one pass
+    {
+        if(AOconf[loop].GPUall==0)
+        {
+            data.image[aoconfID_imWFS1].md[0].write = 1;
+            Read_cam_frame_wfsres(loop, data.image[aoconfID_imWFS1].array.F, totalinv);
+            COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS1, -1);
+            data.image[aoconfID_imWFS1].md[0].cnt0 ++;
+            data.image[aoconfID_imWFS1].md[0].write = 0;
+        }
+        else // normalization done by GPU
+            Read_cam_frame_wfsres(loop, NULL, totalinv);
+    }
+    else if( ((AOconf[loop].GPUall==0)&&(RM==0)) || (RM==1))  // normalize WFS image by totalinv
     {
 #ifdef _PRINT_TEST
         printf("TEST - Normalize [%d]: IMTOTAL = %g    totalinv = %g\n", AOconf[loop].WFSnormalize, data.image[aoconfID_imWFS0tot].array.F[0], totalinv);
@@ -1075,37 +1603,343 @@ int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode
                 data.image[aoconfID_imWFS1].array.F[ii] = data.image[aoconfID_imWFS0].array.F[ii]*totalinv;
 # ifdef _OPENMP
         }
-# endif
-        COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS1, -1);
-        data.image[aoconfID_imWFS1].md[0].cnt0 ++;
-        data.image[aoconfID_imWFS1].md[0].write = 0;
+# endif
+        COREMOD_MEMORY_image_set_sempost_byID(aoconfID_imWFS1, -1);
+        data.image[aoconfID_imWFS1].md[0].cnt0 ++;
+        data.image[aoconfID_imWFS1].md[0].write = 0;
+    }
+
+#ifdef _PRINT_TEST
+    printf("TEST - READ CAM DONE\n");
+    fflush(stdout);
+#endif
+
+
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/* =============================================================================================== */
+/** @name AOloopControl_IOtools - 2. LOAD DATA STREAMS     
+ *  Load 2D and 3D shared memory images */
+/* =============================================================================================== */
+/* =============================================================================================== */
+
+
+
+
+//
+// Load stamps : after a FITS file is loaded into a stream, file identity (inode, size, mtime), stream
+// inode and stream cnt0 are written to SHAREDMEMDIR/<name>.im.loadstamp. If all still match at next
+// load, the stream already holds the file content and is attached without reading the file.
+// Writers other than the loader are expected to increment cnt0.
+//
+
+static int loadstamp_make(const char *name, const char *fname, char *stamp, size_t len)
+{
+    struct stat fst, sst;
+    char shmname[500];
+
+    if(stat(fname, &fst) != 0)
+        return(-1);
+    if(snprintf(shmname, 500, "%s/%s.im.shm", SHAREDMEMDIR, name) >= 500)
+        return(-1);
+    if(stat(shmname, &sst) != 0)
+        return(-1);
+
+    if(snprintf(stamp, len, "%s %lu %ld %ld %ld %lu", fname, (unsigned long) fst.st_ino, (long) fst.st_size,
+                (long) fst.st_mtim.tv_sec, (long) fst.st_mtim.tv_nsec, (unsigned long) sst.st_ino) >= (int) len)
+        return(-1);
+
+    return(0);
+}
+
+
+// returns 1 if stream <name> holds content of fname. cnt0 not checked if ID = -1
+static int loadstamp_match(const char *name, const char *fname, long ID)
+{
+    char stamp[500];
+    char stamp1[500];
+    char sname[500];
+    unsigned long long cnt0;
+    FILE *fp;
+    int match = 0;
+
+    if(loadcreateshm_fastpath == 0)
+        return(0);
+    if(loadstamp_make(name, fname, stamp, 500) != 0)
+        return(0);
+    if(snprintf(sname, 500, "%s/%s.im.loadstamp", SHAREDMEMDIR, name) >= 500)
+        return(0);
+    if((fp = fopen(sname, "r")) == NULL)
+        return(0);
+    if((fgets(stamp1, 500, fp) != NULL)&&(fscanf(fp, "%llu", &cnt0) == 1))
+    {
+        stamp1[strcspn(stamp1, "\n")] = '\0';
+        if(strcmp(stamp, stamp1) == 0)
+            if((ID == -1)||((data.image[ID].md[0].shared == 1)&&(data.image[ID].md[0].cnt0 == cnt0)))
+                match = 1;
+    }
+    fclose(fp);
+
+    return(match);
+}
+
+
+static void loadstamp_write(const char *name, const char *fname, long ID)
+{
+    char stamp[500];
+    char sname[500];
+    FILE *fp;
+
+    if(snprintf(sname, 500, "%s/%s.im.loadstamp", SHAREDMEMDIR, name) >= 500)
+        return;
+    if(loadstamp_make(name, fname, stamp, 500) != 0)
+    {
+        unlink(sname);
+        return;
+    }
+    if((fp = fopen(sname, "w")) == NULL)
+        return;
+    fprintf(fp, "%s\n%llu\n", stamp, (unsigned long long) data.image[ID].md[0].cnt0);
+    fclose(fp);
+}
+
+
+
+
+//
+// Prefetch : FITS files are read into private buffers by a pool of threads while the caller
+// proceeds. Threads only use the thread-safe COREMOD_iofits readers, images are created by the caller
+// when the buffer is taken. Total buffered size is bounded.
+//
+
+typedef struct
+{
+    char name[200];
+    char fname[200];
+    int status;         // 0: pending, 1: reading, 2: ready, 3: not prefetched, 4: taken
+    long naxis;
+    uint32_t size[3];
+    size_t nbbyte;
+    float *array;
+} LOADPREFETCH_ENTRY;
+
+static LOADPREFETCH_ENTRY *loadprefetch_entry = NULL;
+static long loadprefetch_NBentry = 0;
+static long loadprefetch_next = 0;
+static size_t loadprefetch_budget = 0;
+static pthread_t *loadprefetch_thread = NULL;
+static int loadprefetch_NBthread = 0;
+static pthread_mutex_t loadprefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loadprefetch_cond = PTHREAD_COND_INITIALIZER;
+
+
+static void *loadprefetch_worker(void *ptr)
+{
+    (void) ptr;
+
+    for(;;)
+    {
+        LOADPREFETCH_ENTRY *pe;
+        long i;
+        int ok = 0;
+        size_t nbbyte = sizeof(float);
+
+        pthread_mutex_lock(&loadprefetch_mutex);
+        while((loadprefetch_next < loadprefetch_NBentry)&&(loadprefetch_entry[loadprefetch_next].status != 0))
+            loadprefetch_next++;
+        if(loadprefetch_next >= loadprefetch_NBentry)
+        {
+            pthread_mutex_unlock(&loadprefetch_mutex);
+            break;
+        }
+        pe = &loadprefetch_entry[loadprefetch_next++];
+        pe->status = 1;
+        pthread_mutex_unlock(&loadprefetch_mutex);
+
+        if(read_fits_imsize(pe->fname, &pe->naxis, pe->size, NULL, NULL) == 0)
+        {
+            for(i=0; i<3; i++)
+                nbbyte *= pe->size[i];
+
+            pthread_mutex_lock(&loadprefetch_mutex);
+            if(nbbyte <= loadprefetch_budget)
+            {
+                loadprefetch_budget -= nbbyte;
+                pe->nbbyte = nbbyte;
+                ok = 1;
+            }
+            pthread_mutex_unlock(&loadprefetch_mutex);
+        }
+
+        if(ok == 1)
+        {
+            pe->array = (float*) malloc(pe->nbbyte);
+            if((pe->array == NULL)||(load_fits_array_float(pe->fname, pe->array, (long) (pe->nbbyte/sizeof(float))) != 0))
+            {
+                free(pe->array);
+                pe->array = NULL;
+                ok = 0;
+            }
+        }
+
+        pthread_mutex_lock(&loadprefetch_mutex);
+        if(ok == 0)
+        {
+            loadprefetch_budget += pe->nbbyte; // 0 if not reserved
+            pe->nbbyte = 0;
+        }
+        pe->status = (ok == 1) ? 2 : 3;
+        pthread_cond_broadcast(&loadprefetch_cond);
+        pthread_mutex_unlock(&loadprefetch_mutex);
     }
 
-#ifdef _PRINT_TEST
-    printf("TEST - READ CAM DONE\n");
-    fflush(stdout);
-#endif
+    return(NULL);
+}
 
 
-    return(0);
+// returns ID of local image tmpname holding prefetched fname content, -1 if not prefetched
+static long loadprefetch_take(const char *fname, const char *tmpname)
+{
+    long i;
+    long ID = -1;
+    LOADPREFETCH_ENTRY *pe = NULL;
+
+    pthread_mutex_lock(&loadprefetch_mutex);
+    for(i=0; i<loadprefetch_NBentry; i++)
+        if((loadprefetch_entry[i].status != 4)&&(strcmp(loadprefetch_entry[i].fname, fname) == 0))
+        {
+            pe = &loadprefetch_entry[i];
+            break;
+        }
+    if(pe != NULL)
+        while((pe->status == 0)||(pe->status == 1))
+            pthread_cond_wait(&loadprefetch_cond, &loadprefetch_mutex);
+    pthread_mutex_unlock(&loadprefetch_mutex);
+
+    if((pe == NULL)||(pe->status != 2))
+        return(-1);
+
+    ID = create_image_ID(tmpname, pe->naxis, pe->size, _DATATYPE_FLOAT, 0, 0);
+    memcpy(data.image[ID].array.F, pe->array, pe->nbbyte);
+
+    pthread_mutex_lock(&loadprefetch_mutex);
+    free(pe->array);
+    pe->array = NULL;
+    loadprefetch_budget += pe->nbbyte;
+    pe->status = 4;
+    pthread_mutex_unlock(&loadprefetch_mutex);
+
+    return(ID);
+}
+
+
+// FITS file to local image tmpname, from prefetch buffer if available
+static long loadcreate_readfits(const char *fname, const char *tmpname)
+{
+    long ID;
+
+    if((ID = loadprefetch_take(fname, tmpname)) == -1)
+        ID = load_fits(fname, tmpname, 3);
+
+    return(ID);
 }
 
 
 
 
+/**
+ * @brief Starts background read of FITS files fname[i], to be loaded in streams name[i]
+ *
+ * Files whose load stamp matches stream content are skipped. Buffers are taken by the
+ * xDloadcreate_shmim functions; at most maxMB MB are buffered at any time.
+ * Call AOloopControl_IOtools_loadcreate_prefetch_free() when loading is complete.
+ * Returns number of files queued.
+ */
+long AOloopControl_IOtools_loadcreate_prefetch(long NBfile, char **name, char **fname, int NBthread, long maxMB)
+{
+    long i;
+    long NBqueued = 0;
+
+    AOloopControl_IOtools_loadcreate_prefetch_free();
+    if((NBfile < 1)||(NBthread < 1))
+        return(0);
+
+    loadprefetch_entry = (LOADPREFETCH_ENTRY*) calloc(NBfile, sizeof(LOADPREFETCH_ENTRY));
+    if(loadprefetch_entry == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "calloc error");
+        exit(0);
+    }
+    for(i=0; i<NBfile; i++)
+    {
+        strncpy(loadprefetch_entry[i].name, name[i], 199);
+        strncpy(loadprefetch_entry[i].fname, fname[i], 199);
+        if(loadstamp_match(name[i], fname[i], -1) == 1)
+            loadprefetch_entry[i].status = 3;
+        else
+            NBqueued++;
+    }
+    loadprefetch_NBentry = NBfile;
+    loadprefetch_next = 0;
+    loadprefetch_budget = (size_t) maxMB*1024*1024;
+
+    if(NBthread > NBqueued)
+        NBthread = (int) NBqueued;
+    loadprefetch_thread = (pthread_t*) malloc(sizeof(pthread_t)*(NBthread+1));
+    loadprefetch_NBthread = 0;
+    for(i=0; i<NBthread; i++)
+        if(pthread_create(&loadprefetch_thread[loadprefetch_NBthread], NULL, loadprefetch_worker, NULL) == 0)
+            loadprefetch_NBthread++;
+
+    if((loadprefetch_NBthread == 0)&&(NBqueued > 0)) // no thread: nothing will be prefetched
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create prefetch threads");
+        for(i=0; i<NBfile; i++)
+            loadprefetch_entry[i].status = 3;
+        return(0);
+    }
 
+    return(NBqueued);
+}
 
 
+/** @brief Waits for prefetch threads, releases buffers not taken */
+void AOloopControl_IOtools_loadcreate_prefetch_free()
+{
+    long i;
 
+    pthread_mutex_lock(&loadprefetch_mutex);
+    loadprefetch_next = loadprefetch_NBentry; // no new read
+    pthread_mutex_unlock(&loadprefetch_mutex);
+
+    for(i=0; i<loadprefetch_NBthread; i++)
+        pthread_join(loadprefetch_thread[i], NULL);
+    free(loadprefetch_thread);
+    loadprefetch_thread = NULL;
+    loadprefetch_NBthread = 0;
+
+    for(i=0; i<loadprefetch_NBentry; i++)
+        free(loadprefetch_entry[i].array);
+    free(loadprefetch_entry);
+    loadprefetch_entry = NULL;
+    loadprefetch_NBentry = 0;
+    loadprefetch_next = 0;
+}
 
 
 
-/* =============================================================================================== */
-/* =============================================================================================== */
-/** @name AOloopControl_IOtools - 2. LOAD DATA STREAMS     
- *  Load 2D and 3D shared memory images */
-/* =============================================================================================== */
-/* =============================================================================================== */
 
 
 
@@ -1117,6 +1951,7 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
     int sizeOK;
     uint32_t *sizearray;
 	long ii;
+    struct timespec tload0, tload1;
 
     int loadcreatestatus = -1;
     // value of loadcreatestatus :
@@ -1126,6 +1961,7 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
     // 3 : FITS image <fname> has wrong size -> do nothing
     // 4 : FITS image <fname> does not exist, stream <name> exists -> do nothing
     // 5 : FITS image <fname> does not exist, stream <name> does not exist -> create empty stream
+    // 6 : stream content matches FITS image <fname> (load stamp) -> not reloaded
 
 
 
@@ -1134,6 +1970,7 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
     CORE_logFunctionCall( AOLOOPCONTROL_logfunc_level, AOLOOPCONTROL_logfunc_level_max, 0, __FUNCTION__, __LINE__, "");
 #endif
 
+    clock_gettime(CLOCK_REALTIME, &tload0);
 
     ID = image_ID(name);
     sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
@@ -1186,11 +2023,13 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
         printf("ERROR: could not load/create %s\n", name);
         exit(0);
     }
+    else if((CreateSMim == 0)&&(loadstamp_match(name, fname, ID) == 1))
+        loadcreatestatus = 6;
     else
     {
         long ID1;
 
-        ID1 = load_fits(fname, "tmp2Dim", 3);
+        ID1 = loadcreate_readfits(fname, "tmp2Dim");
         
         if(ID1!=-1)
         {
@@ -1200,6 +2039,7 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
                 memcpy(data.image[ID].array.F, data.image[ID1].array.F, sizeof(float)*xsize*ysize);
                 printf("loaded file \"%s\" to shared memory \"%s\"\n", fname, name);
                 loadcreatestatus = 2;
+                loadstamp_write(name, fname, ID);
             }
             else
             {
@@ -1241,10 +2081,16 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
         case 5 :
             fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: FITS image does not exist, stream does not exist -> create empty stream\n", fname, name);
             break;
+        case 6 :
+            fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: stream matches FITS image load stamp -> not reloaded\n", fname, name);
+            break;
         default:
             fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: UNKNOWN ERROR CODE\n", fname, name);
             break;
         }
+        clock_gettime(CLOCK_REALTIME, &tload1);
+        tdiff = info_time_diff(tload0, tload1);
+        fprintf(loadcreateshm_fplog, "    %-30s %10.3f ms\n", name, 1.0e3*tdiff.tv_sec + 1.0e-6*tdiff.tv_nsec);
     }
 
 
@@ -1267,12 +2113,13 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
 long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fname, long xsize, long ysize, long zsize, float DefaultValue)
 {
     long ID;
-    int CreateSMim;
+    int CreateSMim = 0;
     int sizeOK;
     uint32_t *sizearray;
     long ID1;
     int creashmimfromFITS = 0;
     long ii;
+    struct timespec tload0, tload1;
 
     int loadcreatestatus = -1;
     // value of loadcreatestatus :
@@ -1283,6 +2130,7 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
     // 4 : FITS image <fname> does not exist, stream <name> exists -> do nothing
     // 5 : FITS image <fname> does not exist, stream <name> does not exist -> create empty stream
     // 6 : stream exists, size is correct
+    // 7 : stream content matches FITS image <fname> (load stamp) -> not reloaded
 
 
 
@@ -1291,6 +2139,7 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
     CORE_logFunctionCall( AOLOOPCONTROL_logfunc_level, AOLOOPCONTROL_logfunc_level_max, 0, __FUNCTION__, __LINE__, "");
 #endif
 
+    clock_gettime(CLOCK_REALTIME, &tload0);
 
     printf("-------- ENTERING AOloopControl_3Dloadcreate_shmim   name = %s ----------\n", name);
     fflush(stdout);
@@ -1381,7 +2230,13 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
         exit(0);
     }
 
-    ID1 = load_fits(fname, "tmp3Dim", 3);
+    if((ID != -1)&&(CreateSMim == 0)&&(loadstamp_match(name, fname, ID) == 1))
+    {
+        ID1 = -1;
+        loadcreatestatus = 7;
+    }
+    else
+        ID1 = loadcreate_readfits(fname, "tmp3Dim");
     printf("        AOloopControl_3Dloadcreate_shmim: ===== ID1 = %ld\n", ID1);
     fflush(stdout);
     if(ID1!=-1)
@@ -1412,6 +2267,7 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
                 fflush(stdout);
 
                 loadcreatestatus = 1;
+                loadstamp_write(name, fname, ID);
             }
             else
             {
@@ -1431,10 +2287,11 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
             fflush(stdout);
 
             loadcreatestatus = 2;
+            loadstamp_write(name, fname, ID);
         }
         delete_image_ID("tmp3Dim");
     }
-    else
+    else if(loadcreatestatus != 7)
     {
         if(CreateSMim==0)
             loadcreatestatus = 4;
@@ -1464,10 +2321,16 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
         case 5 :
             fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: FITS image does not exist, stream does not exist -> create empty stream\n", fname, name);
             break;
+        case 7 :
+            fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: stream matches FITS image load stamp -> not reloaded\n", fname, name);
+            break;
         default:
             fprintf(loadcreateshm_fplog, "LOADING FITS FILE %s TO STREAM %s: UNKNOWN ERROR CODE\n", fname, name);
             break;
         }
+        clock_gettime(CLOCK_REALTIME, &tload1);
+        tdiff = info_time_diff(tload0, tload1);
+        fprintf(loadcreateshm_fplog, "    %-30s %10.3f ms\n", name, 1.0e3*tdiff.tv_sec + 1.0e-6*tdiff.tv_nsec);
     }
 
 
@@ -1495,6 +2358,159 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+typedef struct
+{
+    long IDin;
+    long IDout_ave;
+    long IDout_AC;
+    long IDout_RMS;
+    long nelem;
+    uint64_t cnt0old;
+    long cnt;       // frames processed
+    float *ave;     // running average
+    float *rms;     // running variance
+} AVESTREAM_STAGE;
+
+
+
+/* fused average / variance update, AC written to ACout unless NULL */
+static inline void AOloopControl_IOtools_AveStream_update(const float *restrict in, float *restrict ave, float *restrict rms, float *restrict ACout, long n, float alpha)
+{
+    long ii;
+    float beta = 1.0-alpha;
+
+    if(ACout == NULL)
+    {
+        #pragma omp simd
+        for(ii=0; ii<n; ii++)
+        {
+            float a = beta*ave[ii] + alpha*in[ii];
+            float d = in[ii] - a;
+
+            ave[ii] = a;
+            rms[ii] = beta*rms[ii] + alpha*d*d;
+        }
+    }
+    else
+    {
+        #pragma omp simd
+        for(ii=0; ii<n; ii++)
+        {
+            float a = beta*ave[ii] + alpha*in[ii];
+            float d = in[ii] - a;
+
+            ave[ii] = a;
+            rms[ii] = beta*rms[ii] + alpha*d*d;
+            ACout[ii] = d;
+        }
+    }
+}
+
+
+
+/* copies array (unless NULL) to stream and posts its semaphores */
+static void AOloopControl_IOtools_AveStream_publish(long ID, const float *array, long nelem)
+{
+    data.image[ID].md[0].write = 1;
+    if(array != NULL)
+        memcpy(data.image[ID].array.F, array, sizeof(float)*nelem);
+    data.image[ID].md[0].cnt0++;
+    data.image[ID].md[0].write = 0;
+    COREMOD_MEMORY_image_set_sempost_byID(ID, -1);
+}
+
+
+
+static int AOloopControl_IOtools_AveStream_setup(AVESTREAM_STAGE *st, const char *IDname, const char *IDname_out_ave, const char *IDname_out_AC, const char *IDname_out_RMS)
+{
+    uint32_t *sizearray;
+
+    st->IDin = image_ID(IDname);
+    if(st->IDin == -1)
+    {
+        printf("ERROR: image \"%s\" not found\n", IDname);
+        return(-1);
+    }
+    if(data.image[st->IDin].md[0].atype != _DATATYPE_FLOAT)
+    {
+        printf("ERROR: image \"%s\" should be float\n", IDname);
+        return(-1);
+    }
+
+    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+    sizearray[0] = data.image[st->IDin].md[0].size[0];
+    sizearray[1] = data.image[st->IDin].md[0].size[1];
+    st->nelem = sizearray[0]*sizearray[1];
+
+    st->IDout_ave = create_image_ID(IDname_out_ave, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_createsem(IDname_out_ave, 10);
+
+    st->IDout_AC = create_image_ID(IDname_out_AC, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_createsem(IDname_out_AC, 10);
+
+    st->IDout_RMS = create_image_ID(IDname_out_RMS, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_createsem(IDname_out_RMS, 10);
+
+    free(sizearray);
+
+    st->ave = (float*) calloc(st->nelem, sizeof(float));
+    st->rms = (float*) calloc(st->nelem, sizeof(float));
+    st->cnt0old = 0;
+    st->cnt = 0;
+
+    return(0);
+}
+
+
+
+/* polls all stages, never returns */
+static void AOloopControl_IOtools_AveStream_run(AVESTREAM_STAGE *st, int NBstage, double alpha, long ACdecim, long RMSdecim)
+{
+    long delayus = 10;
+    int k;
+
+    if(ACdecim < 1)
+        ACdecim = 1;
+    if(RMSdecim < 1)
+        RMSdecim = 1;
+
+    for(;;)
+    {
+        int NBnew = 0;
+
+        for(k=0; k<NBstage; k++)
+        {
+            uint64_t cnt0 = data.image[st[k].IDin].md[0].cnt0;
+            int pubAC, pubRMS;
+
+            if(cnt0 == st[k].cnt0old)
+                continue;
+
+            st[k].cnt++;
+            pubAC = (st[k].cnt % ACdecim == 0);
+            pubRMS = (st[k].cnt % RMSdecim == 0);
+
+            if(pubAC)
+                data.image[st[k].IDout_AC].md[0].write = 1;
+            AOloopControl_IOtools_AveStream_update(data.image[st[k].IDin].array.F, st[k].ave, st[k].rms, pubAC ? data.image[st[k].IDout_AC].array.F : NULL, st[k].nelem, (float) alpha);
+
+            AOloopControl_IOtools_AveStream_publish(st[k].IDout_ave, st[k].ave, st[k].nelem);
+            if(pubAC)
+                AOloopControl_IOtools_AveStream_publish(st[k].IDout_AC, NULL, st[k].nelem);
+            if(pubRMS)
+                AOloopControl_IOtools_AveStream_publish(st[k].IDout_RMS, st[k].rms, st[k].nelem);
+
+            st[k].cnt0old = cnt0;
+            NBnew++;
+        }
+
+        if(NBnew == 0)
+            usleep(delayus);
+    }
+}
+
+
+
 /**
  * ## Purpose
  * 
@@ -1523,68 +2539,73 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
  * IDname_out_RMS	CHAR*
  * 			Stream name for output RMS component
  * 
- * 
+ * All outputs are published every frame, see AOloopControl_IOtools_AveStreamMulti() for decimated output.
  * 
  */
 
 int_fast8_t AOloopControl_IOtools_AveStream(const char *IDname, double alpha, const char *IDname_out_ave, const char *IDname_out_AC, const char *IDname_out_RMS)
 {
-    long IDin;
-    long IDout_ave;
-    long IDout_AC, IDout_RMS;
-    long xsize, ysize;
-    uint32_t *sizearray;
-    long cnt0old = 0;
-    long delayus = 10;
-
-
-
-
-    IDin = image_ID(IDname);
-    xsize = data.image[IDin].md[0].size[0];
-    ysize = data.image[IDin].md[0].size[1];
+    AVESTREAM_STAGE st;
 
-    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
-    sizearray[0] = xsize;
-    sizearray[1] = ysize;
-
-    IDout_ave = create_image_ID(IDname_out_ave, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
-    COREMOD_MEMORY_image_set_createsem(IDname_out_ave, 10);
+    if(AOloopControl_IOtools_AveStream_setup(&st, IDname, IDname_out_ave, IDname_out_AC, IDname_out_RMS) != 0)
+        return(-1);
 
-    IDout_AC = create_image_ID(IDname_out_AC, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
-    COREMOD_MEMORY_image_set_createsem(IDname_out_ave, 10);
+    AOloopControl_IOtools_AveStream_run(&st, 1, alpha, 1, 1);
 
-    IDout_RMS = create_image_ID(IDname_out_RMS, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
-    COREMOD_MEMORY_image_set_createsem(IDname_out_RMS, 10);
+    return(0);
+}
 
 
-    free(sizearray);
 
-    for(;;)
+/**
+ * @brief Averages several input streams in one process, with decimated AC and RMS output
+ *
+ * Same computation as AOloopControl_IOtools_AveStream() for each input stream <name>,
+ * with outputs <name>_ave, <name>_AC and <name>_RMS.\n
+ * All inputs are polled by a single loop. The average is published every frame, AC every ACdecim frames
+ * and RMS every RMSdecim frames (average and RMS are updated every frame).
+ *
+ * @param[in]  IDname_list  comma-separated input streams (up to AVESTREAM_MAXNB)
+ * @param[in]  alpha        averaging coefficient
+ * @param[in]  ACdecim      AC output decimation
+ * @param[in]  RMSdecim     RMS output decimation
+ */
+int_fast8_t AOloopControl_IOtools_AveStreamMulti(const char *IDname_list, double alpha, long ACdecim, long RMSdecim)
+{
+    AVESTREAM_STAGE st[AVESTREAM_MAXNB];
+    char list[1000];
+    char name_ave[200];
+    char name_AC[200];
+    char name_RMS[200];
+    char *name;
+    char *saveptr;
+    int NBstage = 0;
+
+    strncpy(list, IDname_list, 999);
+    list[999] = '\0';
+
+    for(name = strtok_r(list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr))
     {
-        if(data.image[IDin].md[0].cnt0 != cnt0old)
+        if(NBstage == AVESTREAM_MAXNB)
         {
-            data.image[IDout_ave].md[0].write = 1;
-            data.image[IDout_AC].md[0].write = 1;
-            data.image[IDout_RMS].md[0].write = 1;
-            uint_fast64_t ii;
-            for(ii=0; ii<xsize*ysize; ii++)
-            {
-                data.image[IDout_ave].array.F[ii] = (1.0-alpha)*data.image[IDout_ave].array.F[ii] + alpha * data.image[IDin].array.F[ii];
-                data.image[IDout_RMS].array.F[ii] = (1.0-alpha)*data.image[IDout_RMS].array.F[ii] + alpha * (data.image[IDin].array.F[ii] - data.image[IDout_ave].array.F[ii]) * (data.image[IDin].array.F[ii] - data.image[IDout_ave].array.F[ii]);
-                data.image[IDout_AC].array.F[ii] = data.image[IDin].array.F[ii] - data.image[IDout_ave].array.F[ii];
-            }
-            data.image[IDout_ave].md[0].cnt0++;
-            data.image[IDout_AC].md[0].cnt0++;
-            data.image[IDout_RMS].md[0].cnt0++;
-            data.image[IDout_ave].md[0].write = 0;
-            data.image[IDout_AC].md[0].write = 0;
-            data.image[IDout_RMS].md[0].write = 0;
-            cnt0old = data.image[IDin].md[0].cnt0;
+            printf("ERROR: more than %d input streams\n", AVESTREAM_MAXNB);
+            return(-1);
         }
-        usleep(delayus);
+        sprintf(name_ave, "%s_ave", name);
+        sprintf(name_AC, "%s_AC", name);
+        sprintf(name_RMS, "%s_RMS", name);
+        if(AOloopControl_IOtools_AveStream_setup(&st[NBstage], name, name_ave, name_AC, name_RMS) != 0)
+            return(-1);
+        NBstage++;
+    }
+
+    if(NBstage == 0)
+    {
+        printf("ERROR: no input stream\n");
+        return(-1);
     }
 
+    AOloopControl_IOtools_AveStream_run(st, NBstage, alpha, ACdecim, RMSdecim);
 
     return(0);
 }
@@ -1593,7 +2614,41 @@ int_fast8_t AOloopControl_IOtools_AveStream(const char *IDname, double alpha, co
 
 
 
-long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem)
+/* FIR over one tile: out = sum_t tapw[t] * hist[tapslot[t]], current frame copied into hist[slot] first */
+static inline void AOloopControl_IOtools_frameDelay_tile(const float *restrict in, float *restrict hist, long xysize, long slot, long NBtap, const long *tapslot, const float *tapw, float *restrict out, long n)
+{
+    long ii, t;
+
+    memcpy(hist + slot*xysize, in, sizeof(float)*n);
+
+    if(NBtap == 0)
+    {
+        memset(out, 0, sizeof(float)*n);
+        return;
+    }
+
+    {
+        const float *restrict h = hist + tapslot[0]*xysize;
+        float w = tapw[0];
+
+        #pragma omp simd
+        for(ii=0; ii<n; ii++)
+            out[ii] = w*h[ii];
+    }
+    for(t=1; t<NBtap; t++)
+    {
+        const float *restrict h = hist + tapslot[t]*xysize;
+        float w = tapw[t];
+
+        #pragma omp simd
+        for(ii=0; ii<n; ii++)
+            out[ii] += w*h[ii];
+    }
+}
+
+
+
+static long AOloopControl_IOtools_frameDelay_run(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem, int GPUindex)
 {
     long IDout;
     long IDin;
@@ -1603,19 +2658,27 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
     long xsize, ysize;
     long kindex = 0;
     long cnt;
-    long framesize;
-    long IDtmp;
     long xysize;
     float eps=1.0e-8;
-    long ii, jj, kk, k1;
+    long kk;
     uint32_t *sizearray;
+    long NBtap = 0;
+    long *tapk;        // kernel index of non-zero taps
+    long *tapslot;     // history slot of non-zero taps for current frame
+    float *tapw;
+    uint64_t kcnt0 = 0;
+    int kinit = 0;
+    long NBtile;
+#ifdef HAVE_CUDA
+    CUDACOMP_FIRCONF fir;
+    fir.init = 0;
+#endif
 
 
 
     IDin = image_ID(IDin_name);
     xsize = data.image[IDin].md[0].size[0];
     ysize = data.image[IDin].md[0].size[1];
-    IDtmp = create_2Dimage_ID("_tmpfr", xsize, ysize);
     xysize = xsize*ysize;
 
     printf("xsize = %ld\n", xsize);
@@ -1631,8 +2694,9 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
     printf("ksize = %ld\n", ksize);
     fflush(stdout);
 
-
-    IDbuff = create_3Dimage_ID("_tmpbuff", xsize, ysize, ksize);
+    tapk = (long*) malloc(sizeof(long)*ksize);
+    tapslot = (long*) malloc(sizeof(long)*ksize);
+    tapw = (float*) malloc(sizeof(float)*ksize);
 
     sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
     sizearray[0] = xsize;
@@ -1641,8 +2705,22 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
     COREMOD_MEMORY_image_set_createsem(IDout_name, 10);
     free(sizearray);
 
+    IDbuff = -1;
+    if(GPUindex >= 0)
+    {
+#ifdef HAVE_CUDA
+        if(CUDACOMP_FIR_setup(&fir, GPUindex, xysize, ksize) != 0)
+            printf("WARNING: GPU setup failed, using CPU\n");
+#else
+        printf("WARNING: compiled without CUDA, using CPU\n");
+#endif
+    }
+#ifdef HAVE_CUDA
+    if(fir.init == 0)
+#endif
+        IDbuff = create_3Dimage_ID("_tmpbuff", xsize, ysize, ksize);
 
-    framesize = sizeof(float)*xsize*ysize;
+    NBtile = (xysize + FRAMEDELAY_TILESIZE - 1)/FRAMEDELAY_TILESIZE;
 
 
     kindex = 0;
@@ -1650,6 +2728,8 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
 
     for(;;)
     {
+        long t;
+
         if(data.image[IDin].md[0].sem==0)
         {
             while(cnt==data.image[IDin].md[0].cnt0) // test if new frame exists
@@ -1659,37 +2739,60 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
         else
             sem_wait(data.image[IDin].semptr[insem]);
 
-        char *ptr0;
-
-        ptr0 = (char*) data.image[IDbuff].array.F;
-        ptr0 += kindex*framesize;
-
-        data.image[IDbuff].md[0].write = 1;
-        memcpy((void*) ptr0, data.image[IDin].array.F, framesize);
-        data.image[IDbuff].md[0].cnt0++;
-        data.image[IDbuff].md[0].write = 0;
+        // non-zero taps, updated when kernel changes
+        if((kinit == 0)||(data.image[IDkern].md[0].cnt0 != kcnt0))
+        {
+            kcnt0 = data.image[IDkern].md[0].cnt0;
+            NBtap = 0;
+            for(kk=0; kk<ksize; kk++)
+                if(fabs(data.image[IDkern].array.F[kk])>eps)
+                {
+                    tapk[NBtap] = kk;
+                    tapw[NBtap] = data.image[IDkern].array.F[kk];
+                    NBtap++;
+                }
+            kinit = 1;
+        }
+        for(t=0; t<NBtap; t++)
+        {
+            long k1 = kindex-tapk[t];
+            if(k1<0)
+                k1 += ksize;
+            tapslot[t] = k1;
+        }
 
 
         data.image[IDout].md[0].write = 1;
 
-        for(ii=0; ii<xysize; ii++)
-            data.image[IDtmp].array.F[ii] = 0.0;
-        for(kk=0; kk<ksize; kk++)
+#ifdef HAVE_CUDA
+        if(fir.init == 1)
+        {
+            if(CUDACOMP_FIR_execute(&fir, data.image[IDin].array.F, kindex, NBtap, tapslot, tapw, data.image[IDout].array.F) != 0)
+                exit(0);
+        }
+        else
+#endif
         {
-            if(fabs(data.image[IDkern].array.F[kk])>eps)
+            long tile;
+
+            data.image[IDbuff].md[0].write = 1;
+# ifdef _OPENMP
+            #pragma omp parallel for num_threads(8) schedule(static) if (NBtile >= FRAMEDELAY_NBTILE_OMP)
+# endif
+            for(tile=0; tile<NBtile; tile++)
             {
-                k1 = kindex-kk;
-                if(k1<0)
-                    k1 += ksize;
+                long ii0 = tile*FRAMEDELAY_TILESIZE;
+                long n = (ii0 + FRAMEDELAY_TILESIZE > xysize) ? xysize - ii0 : FRAMEDELAY_TILESIZE;
 
-                for(ii=0; ii<xysize; ii++)
-                    data.image[IDtmp].array.F[ii] += data.image[IDkern].array.F[kk] * data.image[IDbuff].array.F[k1*xysize + ii];
+                AOloopControl_IOtools_frameDelay_tile(data.image[IDin].array.F + ii0, data.image[IDbuff].array.F + ii0, xysize, kindex, NBtap, tapslot, tapw, data.image[IDout].array.F + ii0, n);
             }
+            data.image[IDbuff].md[0].cnt0++;
+            data.image[IDbuff].md[0].write = 0;
         }
-        memcpy(data.image[IDout].array.F, data.image[IDtmp].array.F, framesize);
-        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+
         data.image[IDout].md[0].cnt0++;
         data.image[IDout].md[0].write = 0;
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
 
 
         kindex++;
@@ -1697,12 +2800,104 @@ long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_
             kindex = 0;
     }
 
+#ifdef HAVE_CUDA
+    CUDACOMP_FIR_free(&fir);
+#endif
+    free(tapk);
+    free(tapslot);
+    free(tapw);
 
     return IDout;
 }
 
 
 
+long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem)
+{
+    return(AOloopControl_IOtools_frameDelay_run(IDin_name, IDkern_name, IDout_name, insem, -1));
+}
+
+
+
+/**
+ * @brief Temporal kernel applied to input stream, optionally computed on GPU
+ *
+ * Same as AOloopControl_IOtools_frameDelay(), with frame history and FIR on GPU GPUindex (if >= 0 and compiled with CUDA).\n
+ * Worth it for large frames and long kernels, where the CPU FIR is memory-bandwidth bound.
+ */
+long AOloopControl_IOtools_frameDelayGPU(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem, int GPUindex)
+{
+    return(AOloopControl_IOtools_frameDelay_run(IDin_name, IDkern_name, IDout_name, insem, GPUindex));
+}
+
+
+
+
+/**
+ * @brief Zero-copy view of a contiguous region of a stream
+ *
+ * Creates view stream out_name on input stream in_name (see ImageStreamIO_createView()): the view data is input
+ * elements offset to offset + size_x*size_y*size_z - 1, read in place by the view readers. 2D view if size_z < 2.\n
+ * The region must be contiguous in the input: z-slice range (offset = k*xsize*ysize), full-row band (offset = j*xsize) or reshape.\n
+ * Relays every input update (semaphore insem, or cnt0 polling if insem < 0 or stream has no semaphore) to the view
+ * counters and semaphores. Never returns unless the view cannot be created.
+ */
+long AOloopControl_IOtools_viewStream(const char *in_name, const char *out_name, long offset, long size_x, long size_y, long size_z, int insem)
+{
+    long IDin;
+    IMAGE view;
+    uint32_t sizearray[3];
+    long naxis;
+    uint64_t cnt;
+
+
+    IDin = image_ID(in_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(in_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: stream \"%s\" not found\n", in_name);
+        return(-1);
+    }
+
+    sizearray[0] = size_x;
+    sizearray[1] = size_y;
+    sizearray[2] = size_z;
+    naxis = 2;
+    if(size_z > 1)
+        naxis = 3;
+
+    memset(&view, 0, sizeof(IMAGE));
+    if(ImageStreamIO_createView(&view, out_name, in_name, offset, naxis, sizearray, 0) == -1)
+    {
+        printf("ERROR: cannot create view \"%s\" on stream \"%s\"\n", out_name, in_name);
+        return(-1);
+    }
+    view.used = 1;
+
+    if((insem >= 0)&&(insem < data.image[IDin].md[0].sem))
+        COREMOD_MEMORY_image_set_semflush(in_name, insem);
+
+    cnt = data.image[IDin].md[0].cnt0;
+    while(1)
+    {
+        if((insem < 0)||(insem >= data.image[IDin].md[0].sem))
+        {
+            while(cnt == data.image[IDin].md[0].cnt0) // test if new frame exists
+                usleep(2);
+            cnt = data.image[IDin].md[0].cnt0;
+        }
+        else
+            sem_wait(data.image[IDin].semptr[insem]);
+
+        ImageStreamIO_view_update(&view);
+    }
+
+    return(0);
+}
+
+
+
 
 long AOloopControl_IOtools_stream3Dto2D(const char *in_name, const char *out_name, int NBcols, int insem)
 {
@@ -14,6 +14,8 @@
 #ifndef _AOLOOPCONTROL_IOTOOLS_H
 #define _AOLOOPCONTROL_IOTOOLS_H
 
+#define AOLIOTOOLS_REC_NBCOL 4 // stream recording timing columns: time, cnt0, reference cnt1, latency
+
 
 
 /** @brief Initialize command line interface. */
@@ -32,15 +34,15 @@ int_fast8_t init_AOloopControl_IOtools();
 
 int_fast8_t AOloopControl_IOtools_camimage_extract2D_sharedmem_loop(const char *in_name, const char *dark_name, const char *out_name, long size_x, long size_y, long xstart, long ystart);
 
-/** @brief compute sum of image pixels */
-static void *compute_function_imtotal( void *ptr );
-
-/** @brief Subtract dark */
-static void *compute_function_dark_subtract( void *ptr );
+/** @brief Bins photon events into time and wavelength resolved frames */
+long AOloopControl_IOtools_eventStream(const char *in_name, const char *out_name, long xsize, long ysize, long NBlambda, long dt_us, long gate0_us, long gate1_us, int insem);
 
 /** @brief Read image from WFS camera */
 int_fast8_t Read_cam_frame(long loop, int RM, int normalize, int PixelStreamMode, int InitSem);
 
+/** @brief Checks zero-copy WFS frame was not overwritten while read in place by GPU */
+int_fast8_t Read_cam_frame_zerocopy_end(long loop);
+
 
 
 
@@ -61,6 +63,12 @@ long AOloopControl_IOtools_2Dloadcreate_shmim(const char *name, const char *fnam
 /** @brief Load 3D image in shared memory */
 long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fname, long xsize, long ysize, long zsize, float DefaultValue);
 
+/** @brief Background read of FITS files consumed by the loadcreate functions */
+long AOloopControl_IOtools_loadcreate_prefetch(long NBfile, char **name, char **fname, int NBthread, long maxMB);
+
+/** @brief Releases prefetch threads and buffers */
+void AOloopControl_IOtools_loadcreate_prefetch_free();
+
 
 
 
@@ -78,12 +86,27 @@ long AOloopControl_IOtools_3Dloadcreate_shmim(const char *name, const char *fnam
 /** @brief Average data stream */
 int_fast8_t AOloopControl_IOtools_AveStream(const char *IDname, double alpha, const char *IDname_out_ave, const char *IDname_out_AC, const char *IDname_out_RMS);
 
+/** @brief Average several data streams, decimated AC and RMS output */
+int_fast8_t AOloopControl_IOtools_AveStreamMulti(const char *IDname_list, double alpha, long ACdecim, long RMSdecim);
+
 /** @brief Induces temporal offset between input and output streams */
 long AOloopControl_IOtools_frameDelay(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem);
 
+/** @brief Induces temporal offset between input and output streams, FIR on GPU */
+long AOloopControl_IOtools_frameDelayGPU(const char *IDin_name, const char *IDkern_name, const char *IDout_name, int insem, int GPUindex);
+
+/** @brief Zero-copy view of a contiguous region of a stream */
+long AOloopControl_IOtools_viewStream(const char *in_name, const char *out_name, long offset, long size_x, long size_y, long size_z, int insem);
+
 /** @brief Re-arrange a 3D cube into an array of images into a single 2D frame */
 long AOloopControl_IOtools_stream3Dto2D(const char *in_name, const char *out_name, int NBcols, int insem);
 
+/** @brief Replays recorded frames into stream with recorded timing */
+long AOloopControl_IOtools_streamReplay(const char *IDcube_name, const char *IDtime_name, const char *IDout_name, float speed, float frequ, long NBloop);
+
+/** @brief Records stream frames and timing */
+long AOloopControl_IOtools_streamRecord(const char *IDin_name, long insem, long NBframe, const char *IDref_name, const char *IDout_name, const char *IDtime_name);
+
 
 
 #endif
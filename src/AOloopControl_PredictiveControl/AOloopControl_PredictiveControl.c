@@ -34,6 +34,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <gsl/gsl_cblas.h>
 
 #ifdef __MACH__
 #include <mach/mach_time.h>
@@ -86,6 +87,8 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define PFBUILD_MAXBLOCK 100 // max number of PF blocks, size of AOconf PFbuild arrays
+
 
 
 
@@ -107,6 +110,8 @@ extern long LOOPNUMBER; // current loop index
 
 extern AOLOOPCONTROL_CONF *AOconf; // declared in AOloopControl.c
 
+extern int AOloopcontrol_meminit;
+
 
 
 
@@ -156,6 +161,15 @@ int_fast8_t AOloopControl_PredictiveControl_testPredictiveFilter_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_PredictiveControl_builPFloop_all */
+int_fast8_t AOloopControl_PredictiveControl_builPFloop_all_cli() {
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,1)==0) {
+        AOloopControl_PredictiveControl_builPFloop_all(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numf);
+        return 0;
+    }
+    else return 1;
+}
+
 
 int_fast8_t AOloopControl_PredictiveControl_setPFsimpleAve_cli() {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,1)==0) {
@@ -195,6 +209,8 @@ int_fast8_t init_AOloopControl_PredictiveControl()
 
     RegisterCLIcommand("aolPFwatchin",__FILE__, AOloopControl_PredictiveControl_builPFloop_WatchInput_cli, "watch telemetry for predictive filter input", "<loop #> <PFblock #>", "aolPFwatchin 0 2", "long AOloopControl_builPFloop_WatchInput(long loop, long PFblock)");
 
+    RegisterCLIcommand("aolPFbuildall",__FILE__, AOloopControl_PredictiveControl_builPFloop_all_cli, "watch telemetry and build predictive filters of all blocks in parallel", "<loop #> <NB PFblocks> <NB threads> <regularization>", "aolPFbuildall 0 10 8 0.0001", "long AOloopControl_PredictiveControl_builPFloop_all(long loop, long NBPFblock, long NBthread, float RegEps)");
+
     RegisterCLIcommand("aolmappfilt", __FILE__, AOloopControl_PredictiveControl_mapPredictiveFilter_cli, "map/search predictive filter", "<input coeffs> <mode number> <delay [frames]>", "aolmkapfilt coeffim 23 2.4", "long AOloopControl_mapPredictiveFilter(char *IDmodecoeff_name, long modeout, double delayfr)");
 
     RegisterCLIcommand("aolmkpfilt", __FILE__, AOloopControl_PredictiveControl_testPredictiveFilter_cli, "test predictive filter", "<trace im> <mode number> <delay [frames]> <filter size> <out filter name>", "aolmkpfilt traceim 23 2.4 20 filt23","long AOloopControl_testPredictiveFilter(char *IDtrace_name, long mode, double delayfr, long filtsize, char *IDfilt_name, double SVDeps)");
@@ -622,6 +638,303 @@ long AOloopControl_PredictiveControl_builPFloop_WatchInput(long loop, long PFblo
     return (IDout);
 }
 
+
+
+
+/**
+ * @brief Solve A X = B in place for symmetric positive definite A (n x n), B is n x m, row-major
+ *
+ * Cholesky factorization, A is overwritten. Returns -1 if A is not positive definite.
+ */
+static int PredictiveControl_cholesky_solve(double *A, double *B, long n, long m)
+{
+    long i, j, k;
+
+    for(j=0; j<n; j++)
+    {
+        double val = A[j*n+j];
+
+        for(k=0; k<j; k++)
+            val -= A[j*n+k]*A[j*n+k];
+        if(val <= 0.0)
+            return(-1);
+        A[j*n+j] = sqrt(val);
+
+        for(i=j+1; i<n; i++)
+        {
+            val = A[i*n+j];
+            for(k=0; k<j; k++)
+                val -= A[i*n+k]*A[j*n+k];
+            A[i*n+j] = val/A[j*n+j];
+        }
+    }
+
+    // forward (L y = b) and back (L' x = y) substitution
+    for(i=0; i<n; i++)
+    {
+        for(k=0; k<i; k++)
+            for(j=0; j<m; j++)
+                B[i*m+j] -= A[i*n+k]*B[k*m+j];
+        for(j=0; j<m; j++)
+            B[i*m+j] /= A[i*n+i];
+    }
+    for(i=n-1; i>=0; i--)
+    {
+        for(k=i+1; k<n; k++)
+            for(j=0; j<m; j++)
+                B[i*m+j] -= A[k*n+i]*B[k*m+j];
+        for(j=0; j<m; j++)
+            B[i*m+j] /= A[i*n+i];
+    }
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Compute predictive filter for one block from telemetry, regularized least squares
+ *
+ * tbuff    : block telemetry, NBspl samples x NBmode (average removed)
+ * PFout    : output filter, NBmode x (NBmode*PForder), same layout as LINARFILTERPRED_Build_LinPredictor
+ *
+ * Uses only private buffers, safe to run concurrently for several blocks.
+ */
+static int PredictiveControl_computeBlockFilter(const float *tbuff, long NBspl, long NBmode, long PForder, float PFlag, float RegEps, float gain, float *PFout)
+{
+    long n = NBmode*PForder;
+    long lag = (long) PFlag;
+    float alpha = PFlag - lag;
+    long NBmvec = NBspl - PForder - lag - 1;
+    double *X, *Y, *A, *B;
+    double trace;
+    long m, dt, pix, ii;
+    int ret;
+
+    if(NBmvec < n)
+        return(-1);
+
+    X = (double*) malloc(sizeof(double)*NBmvec*n);
+    Y = (double*) malloc(sizeof(double)*NBmvec*NBmode);
+    A = (double*) malloc(sizeof(double)*n*n);
+    B = (double*) malloc(sizeof(double)*n*NBmode);
+    if((X==NULL)||(Y==NULL)||(A==NULL)||(B==NULL))
+    {
+        free(X);
+        free(Y);
+        free(A);
+        free(B);
+        return(-1);
+    }
+
+    for(m=0; m<NBmvec; m++)
+    {
+        long k0 = m + PForder - 1; // dt=0 index
+
+        for(dt=0; dt<PForder; dt++)
+            for(pix=0; pix<NBmode; pix++)
+                X[m*n + dt*NBmode + pix] = tbuff[(k0-dt)*NBmode + pix];
+        for(pix=0; pix<NBmode; pix++)
+            Y[m*NBmode + pix] = (1.0-alpha)*tbuff[(k0+lag)*NBmode + pix] + alpha*tbuff[(k0+lag+1)*NBmode + pix];
+    }
+
+    // normal equations : (X'X + eps tr(X'X)/n Id) W = X'Y
+    cblas_dsyrk(CblasRowMajor, CblasLower, CblasTrans, n, NBmvec, 1.0, X, n, 0.0, A, n);
+    trace = 0.0;
+    for(ii=0; ii<n; ii++)
+        trace += A[ii*n+ii];
+    for(ii=0; ii<n; ii++)
+        A[ii*n+ii] += RegEps*trace/n;
+
+    cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, n, NBmode, NBmvec, 1.0, X, n, Y, NBmode, 0.0, B, NBmode);
+
+    ret = PredictiveControl_cholesky_solve(A, B, n, NBmode);
+    if(ret == 0)
+    {
+        long PFpix;
+
+        for(PFpix=0; PFpix<NBmode; PFpix++)
+            for(ii=0; ii<n; ii++)
+                PFout[PFpix*n + ii] = (1.0-gain)*PFout[PFpix*n + ii] + gain*B[ii*NBmode + PFpix];
+    }
+
+    free(X);
+    free(Y);
+    free(A);
+    free(B);
+
+    return(ret);
+}
+
+
+
+/**
+ * @brief Watch telemetry buffers and build filters for all PF blocks in-process, blocks computed in parallel
+ *
+ * Replaces one aolPFwatchin + external mkARpfilt per block. On each new telemetry buffer, all blocks (parameters in
+ * conf/param_PFblock_xxx.txt) are distributed to NBthread worker threads; each block filter is written to aolN_outPFbxxx
+ * as soon as it is computed, and its rebuild time reported in AOconf[loop].PFbuildtime[].
+ */
+long AOloopControl_PredictiveControl_builPFloop_all(long loop, long NBPFblock, long NBthread, float RegEps)
+{
+    long IDinb0, IDinb1, IDinb;
+    char imname[500];
+    char fname[500];
+    FILE *fp;
+    long cnt0_old, cnt1_old;
+    long xysize, zsize;
+    long PFblockStart[PFBUILD_MAXBLOCK];
+    long PFblockSize[PFBUILD_MAXBLOCK];
+    long PFblockOrder[PFBUILD_MAXBLOCK];
+    float PFblockLag[PFBUILD_MAXBLOCK];
+    float PFblockdgain[PFBUILD_MAXBLOCK];
+    long IDPFout[PFBUILD_MAXBLOCK];
+    float *tbuff[PFBUILD_MAXBLOCK];
+    uint32_t *imsizearray;
+    long blk, ii, kk;
+    long NBupdate = 0;
+
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(1);
+
+    if(NBPFblock > PFBUILD_MAXBLOCK)
+        NBPFblock = PFBUILD_MAXBLOCK;
+    if(NBthread < 1)
+        NBthread = 1;
+
+    if(sprintf(imname, "aol%ld_modeval_ol_logbuff0", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDinb0 = read_sharedmem_image(imname);
+    if(sprintf(imname, "aol%ld_modeval_ol_logbuff1", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDinb1 = read_sharedmem_image(imname);
+    if((IDinb0==-1)||(IDinb1==-1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot connect to telemetry buffers");
+        return(-1);
+    }
+
+    xysize = data.image[IDinb0].md[0].size[0]*data.image[IDinb0].md[0].size[1];
+    zsize = data.image[IDinb0].md[0].size[2];
+
+    for(blk=0; blk<NBPFblock; blk++)
+    {
+        long PFblockEnd;
+
+        if(sprintf(fname, "conf/param_PFblock_%03ld.txt", blk) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+        if((fp = fopen(fname, "r"))==NULL)
+        {
+            printf("ERROR: File \"%s\" NOT FOUND\n", fname);
+            exit(0);
+        }
+        if(fscanf(fp, "%50ld %50ld %50ld %50f %50f\n", &PFblockStart[blk], &PFblockEnd, &PFblockOrder[blk], &PFblockLag[blk], &PFblockdgain[blk]) != 5)
+            printERROR(__FILE__, __func__, __LINE__, "Cannot read parameters from file");
+        fclose(fp);
+        PFblockSize[blk] = PFblockEnd - PFblockStart[blk];
+
+        if((PFblockSize[blk] < 1)||(PFblockEnd > xysize))
+        {
+            printf("ERROR: PF block %ld mode range %ld-%ld invalid\n", blk, PFblockStart[blk], PFblockEnd);
+            exit(0);
+        }
+
+        tbuff[blk] = (float*) malloc(sizeof(float)*zsize*PFblockSize[blk]);
+
+        // output filter stream, same as mkARpfilt in LOOPmode
+        if(sprintf(imname, "aol%ld_outPFb%ld", loop, blk) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        IDPFout[blk] = image_ID(imname);
+        if(IDPFout[blk] == -1)
+            IDPFout[blk] = read_sharedmem_image(imname);
+        if((IDPFout[blk] == -1)||(data.image[IDPFout[blk]].md[0].nelement != PFblockSize[blk]*PFblockSize[blk]*PFblockOrder[blk]))
+        {
+            imsizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+            imsizearray[0] = PFblockSize[blk]*PFblockOrder[blk];
+            imsizearray[1] = PFblockSize[blk];
+            IDPFout[blk] = create_image_ID(imname, 2, imsizearray, _DATATYPE_FLOAT, 1, 1);
+            free(imsizearray);
+            COREMOD_MEMORY_image_set_semflush(imname, -1);
+        }
+
+        AOconf[loop].PFbuildtime[blk] = 0.0;
+        AOconf[loop].PFbuildcnt[blk] = 0;
+    }
+    AOconf[loop].PFbuildNBblock = NBPFblock;
+
+    printf("PF build : %ld blocks, %ld threads\n", NBPFblock, NBthread);
+    fflush(stdout);
+
+
+    cnt0_old = data.image[IDinb0].md[0].cnt0;
+    cnt1_old = data.image[IDinb1].md[0].cnt0;
+
+    while(data.signal_USR1 == 0)
+    {
+        IDinb = -1;
+        if(data.image[IDinb0].md[0].cnt0 != cnt0_old)
+        {
+            cnt0_old = data.image[IDinb0].md[0].cnt0;
+            IDinb = IDinb0;
+        }
+        if(data.image[IDinb1].md[0].cnt0 != cnt1_old)
+        {
+            cnt1_old = data.image[IDinb1].md[0].cnt0;
+            IDinb = IDinb1;
+        }
+
+        if(IDinb == -1)
+        {
+            usleep(10000);
+            continue;
+        }
+
+        // copy block telemetry, average removed : buffer may be overwritten while filters are computed
+        for(blk=0; blk<NBPFblock; blk++)
+            for(ii=0; ii<PFblockSize[blk]; ii++)
+            {
+                double ave = 0.0;
+
+                for(kk=0; kk<zsize; kk++)
+                    ave += data.image[IDinb].array.F[kk*xysize + ii + PFblockStart[blk]];
+                ave /= zsize;
+                for(kk=0; kk<zsize; kk++)
+                    tbuff[blk][kk*PFblockSize[blk] + ii] = data.image[IDinb].array.F[kk*xysize + ii + PFblockStart[blk]] - ave;
+            }
+
+# ifdef _OPENMP
+        #pragma omp parallel for num_threads(NBthread) schedule(dynamic,1)
+# endif
+        for(blk=0; blk<NBPFblock; blk++)
+        {
+            struct timespec t0, t1;
+            long IDout = IDPFout[blk];
+            float gain = (NBupdate == 0) ? 1.0 : PFblockdgain[blk];
+
+            clock_gettime(CLOCK_REALTIME, &t0);
+
+            data.image[IDout].md[0].write = 1;
+            if(PredictiveControl_computeBlockFilter(tbuff[blk], zsize, PFblockSize[blk], PFblockOrder[blk], PFblockLag[blk], RegEps, gain, data.image[IDout].array.F) != 0)
+                printf("WARNING: PF block %ld filter not updated\n", blk);
+            COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+            data.image[IDout].md[0].cnt0++;
+            data.image[IDout].md[0].write = 0;
+
+            clock_gettime(CLOCK_REALTIME, &t1);
+            AOconf[loop].PFbuildtime[blk] = (float) ((t1.tv_sec - t0.tv_sec) + 1.0e-9*(t1.tv_nsec - t0.tv_nsec));
+            AOconf[loop].PFbuildcnt[blk]++;
+        }
+        NBupdate++;
+    }
+
+    for(blk=0; blk<NBPFblock; blk++)
+        free(tbuff[blk]);
+
+    return(NBupdate);
+}
+
 /**
  * 
  * DecayCoeff is betweeen 0 and 1
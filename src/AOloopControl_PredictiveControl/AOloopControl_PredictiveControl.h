@@ -34,6 +34,9 @@ double AOloopControl_PredictiveControl_testPredictiveFilter(const char *IDtrace_
 
 long AOloopControl_PredictiveControl_builPFloop_WatchInput(long loop, long PFblock);
 
+/** @brief Watch telemetry and build filters of all PF blocks in parallel (in-process) */
+long AOloopControl_PredictiveControl_builPFloop_all(long loop, long NBPFblock, long NBthread, float RegEps);
+
 /** @brief Set predictive filter to simple average of previous measures */
 long AOloopControl_PredictiveControl_setPFsimpleAve(char *IDPF_name, float DecayCoeff);
 
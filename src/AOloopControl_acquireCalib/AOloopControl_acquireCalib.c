@@ -69,10 +69,12 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #include "info/info.h"
 
 #include "statistic/statistic.h"
+#include "linopt_imtools/linopt_imtools.h"
 
 #include "AOloopControl/AOloopControl.h"
 #include "AOloopControl_IOtools/AOloopControl_IOtools.h"
 #include "AOloopControl_acquireCalib/AOloopControl_acquireCalib.h"
+#include "AOloopControl_computeCalib/AOloopControl_computeCalib.h"
 
 
 /* =============================================================================================== */
@@ -88,6 +90,8 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define RMREFINE_SEMINDEX 7   // imWFS2 semaphore used by AOloopControl_acquireCalib_RMrefine
+
 
 
 
@@ -155,6 +159,24 @@ int_fast8_t AOloopControl_acquireCalib_RespMatrix_Fast_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_RespMatrix_Fast_stream */
+int_fast8_t AOloopControl_acquireCalib_RespMatrix_Fast_stream_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,1)+CLI_checkarg(7,1)+CLI_checkarg(8,2)+CLI_checkarg(9,3)==0) {
+        AOloopControl_acquireCalib_RespMatrix_Fast_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.numl, data.cmdargtoken[9].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_acquireCalib_RMrefine */
+int_fast8_t AOloopControl_acquireCalib_RMrefine_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,1)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,1)+CLI_checkarg(7,1)+CLI_checkarg(8,2)==0) {
+        AOloopControl_acquireCalib_RMrefine(LOOPNUMBER, data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numf, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.numl);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_Measure_WFSrespC */
 int_fast8_t AOloopControl_acquireCalib_Measure_WFSrespC_cli() {
     if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,4)+CLI_checkarg(6,5)+CLI_checkarg(7,2)+CLI_checkarg(8,2)+CLI_checkarg(9,2)==0) {
@@ -239,6 +261,10 @@ int_fast8_t init_AOloopControl_acquireCalib()
 
     RegisterCLIcommand("aolmRMfast", __FILE__, AOloopControl_acquireCalib_RespMatrix_Fast_cli, "acquire fast modal response matrix", "<modes> <dm RM stream> <WFS stream> <sem trigger> <hardware latency [s]> <loop frequ [Hz]> <ampl [um]> <outname>", "aolmRMfast DMmodes aol0_dmRM aol0_wfsim 4 0.00112 2000.0 0.03 rm000", "long AOloopControl_acquireCalib_RespMatrix_Fast(char *DMmodes_name, char *dmRM_name, char *imWFS_name, long semtrig, float HardwareLag, float loopfrequ, float ampl, char *outname)");
 
+    RegisterCLIcommand("aolmRMfaststream", __FILE__, AOloopControl_acquireCalib_RespMatrix_Fast_stream_cli, "acquire fast modal response matrix, streaming accumulation", "<modes> <dm RM stream> <WFS stream> <sem trigger> <hardware latency [s]> <loop frequ [Hz]> <ampl [um]> <NBcycle (0=until USR1)> <outname>", "aolmRMfaststream DMmodes aol0_dmRM aol0_wfsim 4 0.00112 2000.0 0.03 100 rm000", "long AOloopControl_acquireCalib_RespMatrix_Fast_stream(char *DMmodes_name, char *dmRM_name, char *imWFS_name, long semtrig, float HardwareLag, float loopfrequ, float ampl, long NBcycle, char *outname)");
+
+    RegisterCLIcommand("aolRMrefine", __FILE__, AOloopControl_acquireCalib_RMrefine_cli, "closed-loop background RM refinement with probe modes (lock-in)", "<probe DM channel> <ampl [um]> <half period [frame]> <NB periods per mode> <latency [frame]> <gain> <SVDlim (<=0: no CM update)> <NBcycle (0=until USR1)>", "aolRMrefine dm00disp06 0.005 2 50 2 0.2 0.01 0", "long AOloopControl_acquireCalib_RMrefine(long loop, const char *dmprobe_name, float ampl, long halfperiod, long NBperiod, long lagfr, float gain, float SVDlim, long NBcycle)");
+
     RegisterCLIcommand("aolmeasWFSrespC",__FILE__, AOloopControl_acquireCalib_Measure_WFSrespC_cli, "measure WFS resp to DM patterns", "<delay frames [long]> <DMcommand delay us [long]> <nb frames per position [long]> <nb frames excluded [long]> <input DM patter cube [string]> <output response [string]> <normalize flag> <AOinitMode> <NBcycle>", "aolmeasWFSrespC 2 135 20 0 dmmodes wfsresp 1 0 5", "long AOloopControl_acquireCalib_Measure_WFSrespC(long loop, long delayfr, long delayRM1us, long NBave, long NBexcl, char *IDpokeC_name, char *IDoutC_name, int normalize, int AOinitMode, long NBcycle);");
 
     RegisterCLIcommand("aolmeaslWFSrespC",__FILE__, AOloopControl_acquireCalib_Measure_WFS_linResponse_cli, "measure linear WFS response to DM patterns", "<ampl [um]> <delay frames [long]> <DMcommand delay us [long]> <nb frames per position [long]> <nb frames excluded [long]> <input DM patter cube [string]> <output response [string]> <output reference [string]> <normalize flag> <AOinitMode> <NBcycle>", "aolmeasWFSrespC 0.05 2 135 20 0 dmmodes wfsresp wfsref 1 0 5", "long AOloopControl_acquireCalib_Measure_WFS_linResponse(long loop, float ampl, long delayfr, long delayRM1us, long NBave, long NBexcl, char *IDpokeC_name, char *IDrespC_name, char *IDwfsref_name, int normalize, int AOinitMode, long NBcycle)");
@@ -1813,26 +1839,486 @@ long AOloopControl_acquireCalib_RespMatrix_Fast(const char *DMmodes_name, const
 
 
 
+//
+// Measure fast Modal response matrix, accumulating as frames arrive
+//
+// Same poke sequence as AOloopControl_acquireCalib_RespMatrix_Fast (+/- per mode, poke aligned
+// to mid-frame with HardwareLag_frac), but cycled NBcycle times (NBcycle<=0 : until USR1 signal).
+// Each WFS frame is demodulated on arrival: frame index j belongs to poke step j-HardwareLag_int,
+// and is added (+ poke) or subtracted (- poke) into the accumulator of its mode.
+// Memory usage does not depend on NBcycle. outname is a shared stream updated after each cycle.
+//
+// HardwareLag [s]
+//
+// ampl [um]
+//
+
+long AOloopControl_acquireCalib_RespMatrix_Fast_stream(const char *DMmodes_name, const char *dmRM_name, const char *imWFS_name, long semtrig, float HardwareLag, float loopfrequ, float ampl, long NBcycle, const char *outname)
+{
+    long IDout;
+    long IDmodes;
+    long IDdmRM;
+    long IDwfs;
+    long ii, kk;
+
+    long HardwareLag_int;
+    float HardwareLag_frac;
+    float WFSperiod;
+
+    long NBmodes;
+    long dmxsize, dmysize, dmxysize, wfsxsize, wfsysize, wfsxysize;
+    long twait;
+    uint32_t *sizearray;
+
+    int RT_priority = 80; //any number from 0-99
+    struct sched_param schedpar;
+
+    double *accarray;   // accumulated (+) - (-) WFS frames, per mode
+    long *cntarray;     // number of +/- pairs accumulated, per mode
+    float *dmpoke;
+    long NBstep;        // poke steps per cycle
+    long cycle;
+    long step;          // poke step index since start
+    long frame;         // WFS frame index since start
+    long NBstepmax;
+
+
+
+    WFSperiod = 1.0/loopfrequ;
+    HardwareLag_int = (long) (HardwareLag/WFSperiod);
+    HardwareLag_frac = HardwareLag - WFSperiod*HardwareLag_int; // [s]
+
+    twait = (long) (1.0e6 * ( (0.5*WFSperiod) - HardwareLag_frac ) );
+
+
+    IDmodes = image_ID(DMmodes_name);
+    dmxsize = data.image[IDmodes].md[0].size[0];
+    dmysize = data.image[IDmodes].md[0].size[1];
+    NBmodes = data.image[IDmodes].md[0].size[2];
+    dmxysize = dmxsize*dmysize;
+    NBstep = 2*NBmodes;
+
+    IDdmRM = image_ID(dmRM_name);
+
+    IDwfs = image_ID(imWFS_name);
+    wfsxsize = data.image[IDwfs].md[0].size[0];
+    wfsysize = data.image[IDwfs].md[0].size[1];
+    wfsxysize = wfsxsize*wfsysize;
+
+
+    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+    sizearray[0] = wfsxsize;
+    sizearray[1] = wfsysize;
+    sizearray[2] = NBmodes;
+    IDout = image_ID(outname);
+    if(IDout == -1)
+        IDout = create_image_ID(outname, 3, sizearray, _DATATYPE_FLOAT, 1, 0);
+    free(sizearray);
+    COREMOD_MEMORY_image_set_createsem(outname, 10);
+
+    accarray = (double*) calloc(NBmodes*wfsxysize, sizeof(double));
+    cntarray = (long*) calloc(NBmodes, sizeof(long));
+    dmpoke = (float*) malloc(sizeof(float)*dmxysize);
+    if((accarray==NULL)||(cntarray==NULL)||(dmpoke==NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+
+    schedpar.sched_priority = RT_priority;
+#ifndef __MACH__
+    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
+#endif
+
+    // flush semaphore
+    while(sem_trywait(data.image[IDwfs].semptr[semtrig])==0) {}
+
+
+    // NBstepmax : total number of poke steps, followed by HardwareLag_int+1 zero pokes to collect the last responses
+    if(NBcycle > 0)
+        NBstepmax = NBcycle*NBstep;
+    else
+        NBstepmax = -1;
+
+    step = 0;
+    frame = 0;
+    cycle = 0;
+    for(;;)
+    {
+        long fstep = frame - HardwareLag_int; // poke step seen by this frame
+        int pokeON;
+
+        sem_wait(data.image[IDwfs].semptr[semtrig]);
+
+        // demodulate incoming frame
+        if((fstep >= 0) && ((NBstepmax < 0) || (fstep < NBstepmax)))
+        {
+            long pstep = fstep % NBstep;
+            long mode = pstep/2;
+            double *acc = accarray + mode*wfsxysize;
+            const float *wfsin = data.image[IDwfs].array.F;
+
+            if(pstep % 2 == 0)
+            {
+                for(ii=0; ii<wfsxysize; ii++)
+                    acc[ii] += wfsin[ii];
+            }
+            else
+            {
+                for(ii=0; ii<wfsxysize; ii++)
+                    acc[ii] -= wfsin[ii];
+                cntarray[mode]++;
+            }
+
+            // end of cycle : update output
+            if(pstep == NBstep-1)
+            {
+                data.image[IDout].md[0].write = 1;
+                for(kk=0; kk<NBmodes; kk++)
+                {
+                    float coeff = 1.0/ampl/cntarray[kk];
+
+                    for(ii=0; ii<wfsxysize; ii++)
+                        data.image[IDout].array.F[kk*wfsxysize + ii] = (float) (coeff * accarray[kk*wfsxysize + ii]);
+                }
+                COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+                data.image[IDout].md[0].cnt0++;
+                data.image[IDout].md[0].write = 0;
+                cycle++;
+
+                if((NBstepmax >= 0) && (fstep == NBstepmax-1))
+                    break;
+            }
+        }
+        frame++;
+
+        if((NBstepmax < 0) && (data.signal_USR1 == 1)) // stop at end of current cycle
+            NBstepmax = (step/NBstep + 1)*NBstep;
+
+        usleep(twait);
+
+        // apply next poke (zero once sequence complete)
+        pokeON = ((NBstepmax < 0) || (step < NBstepmax));
+        if(pokeON)
+        {
+            long pstep = step % NBstep;
+            float coeff = (pstep % 2 == 0) ? ampl : -ampl;
+            const float *modein = data.image[IDmodes].array.F + (pstep/2)*dmxysize;
+
+            for(ii=0; ii<dmxysize; ii++)
+                dmpoke[ii] = coeff * modein[ii];
+        }
+        else
+            memset(dmpoke, 0, sizeof(float)*dmxysize);
+
+        data.image[IDdmRM].md[0].write = 1;
+        memcpy(data.image[IDdmRM].array.F, dmpoke, sizeof(float)*dmxysize);
+        COREMOD_MEMORY_image_set_sempost_byID(IDdmRM, -1);
+        data.image[IDdmRM].md[0].cnt0++;
+        data.image[IDdmRM].md[0].write = 0;
+        step++;
+    }
+
+    // leave DM at zero
+    data.image[IDdmRM].md[0].write = 1;
+    memset(data.image[IDdmRM].array.F, 0, sizeof(float)*dmxysize);
+    COREMOD_MEMORY_image_set_sempost_byID(IDdmRM, -1);
+    data.image[IDdmRM].md[0].cnt0++;
+    data.image[IDdmRM].md[0].write = 0;
+
+    printf("%ld cycles accumulated\n", cycle);
+
+    free(accarray);
+    free(cntarray);
+    free(dmpoke);
+
+    return(IDout);
+}
+
+
+
+/**
+ * @brief Recomputes combined control matrices aolN_contrMc and aolN_contrMcact from RMrefine_CM, copied in place
+ */
+static int AOloopControl_acquireCalib_RMrefine_updateCMc(long loop)
+{
+    long IDwfsmask, IDdmmask, IDcmc, IDcmcact, IDcmcloop, IDcmcactloop;
+    char name[200];
+    char wfsmaskname[200];
+    char dmmaskname[200];
+
+    if(sprintf(wfsmaskname, "aol%ld_wfsmask", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    if(sprintf(dmmaskname, "aol%ld_dmmask", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDwfsmask = read_sharedmem_image(wfsmaskname);
+    IDdmmask = read_sharedmem_image(dmmaskname);
+
+    if(sprintf(name, "aol%ld_contrMc", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDcmcloop = read_sharedmem_image(name);
+    if(sprintf(name, "aol%ld_contrMcact", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDcmcactloop = read_sharedmem_image(name);
+
+    if((IDwfsmask == -1)||(IDdmmask == -1)||(IDcmcloop == -1)||(IDcmcactloop == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot connect to masks or combined control matrices");
+        return(-1);
+    }
+
+    if(image_ID("RMrefine_CMc") != -1)
+        delete_image_ID("RMrefine_CMc");
+    AOloopControl_computeCalib_compute_CombinedControlMatrix("RMrefine_CM", AOconf[loop].DMmodesname, wfsmaskname, dmmaskname, "RMrefine_CMc", "RMrefine_CMcact");
+    IDcmc = image_ID("RMrefine_CMc");
+    IDcmcact = image_ID("RMrefine_CMcact_00");
+
+    if((IDcmc == -1)||(IDcmcact == -1)
+            ||(data.image[IDcmc].md[0].nelement != data.image[IDcmcloop].md[0].nelement)
+            ||(data.image[IDcmcact].md[0].nelement != data.image[IDcmcactloop].md[0].nelement))
+    {
+        printf("WARNING: combined control matrix size mismatch, aol%ld_contrMc not updated\n", loop);
+        return(-1);
+    }
+
+    data.image[IDcmcloop].md[0].write = 1;
+    memcpy(data.image[IDcmcloop].array.F, data.image[IDcmc].array.F, sizeof(float)*data.image[IDcmc].md[0].nelement);
+    COREMOD_MEMORY_image_set_sempost_byID(IDcmcloop, -1);
+    data.image[IDcmcloop].md[0].cnt0++;
+    data.image[IDcmcloop].md[0].write = 0;
+
+    data.image[IDcmcactloop].md[0].write = 1;
+    memcpy(data.image[IDcmcactloop].array.F, data.image[IDcmcact].array.F, sizeof(float)*data.image[IDcmcact].md[0].nelement);
+    COREMOD_MEMORY_image_set_sempost_byID(IDcmcactloop, -1);
+    data.image[IDcmcactloop].md[0].cnt0++;
+    data.image[IDcmcactloop].md[0].write = 0;
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Background response matrix refinement while the loop is closed
+ *
+ * Each control mode k (aolN_DMmodes) is in turn injected in the probe DM channel as a square wave of amplitude ampl
+ * (halfperiod frames per sign, NBperiod periods). The loop partially corrects the probe, so the WFS response is referenced
+ * to the total mode amplitude actually on the DM (aolN_dmdisp projected on mode k), lagfr frames earlier:
+ *
+ *   RMest[k] = sum( s(t-lagfr) imWFS2(t) ) / sum( s(t-lagfr) c_k(t-lagfr) )      s : +1/-1 probe reference
+ *
+ * aolN_respM[k] <- (1-gain) aolN_respM[k] + gain RMest[k]. After each cycle over all modes, if SVDlim > 0, the control
+ * matrix is recomputed from the refined RM with AOloopControl_computeCalib_compute_ControlMatrix() (same conditioning as aolcmmake,
+ * SVDlim = eigenvalue limit) and written to aolN_contrM, where the loop picks it up through CM hot swap.
+ * In combined matrix mode (CMMODE = 1), aolN_contrMc and aolN_contrMcact are also recomputed (AOloopControl_computeCalib_compute_CombinedControlMatrix()).
+ * Runs NBcycle cycles (NBcycle < 1 : until USR1 signal).
+ */
+long AOloopControl_acquireCalib_RMrefine(long loop, const char *dmprobe_name, float ampl, long halfperiod, long NBperiod, long lagfr, float gain, float SVDlim, long NBcycle)
+{
+    long IDprobe, IDmodes, IDrespM, IDcontrM, IDwfs, IDdmdisp;
+    long NBmodes, sizeDM, sizeWFS;
+    long ii, k, t, cycle;
+    long NBframe;
+    float *cbuff;     // ring buffer of mode amplitude on DM, lagfr+1 frames
+    int *sbuff;       // ring buffer of probe sign
+    double *accW;
+    float *RMest;
+    float *mnorm;
+    struct timespec semwaitts;
+    char name[200];
+
+
+    if(AOloopcontrol_meminit==0)
+        AOloopControl_InitializeMemory(1);
+
+    IDprobe = image_ID(dmprobe_name);
+    if(IDprobe == -1)
+        IDprobe = read_sharedmem_image(dmprobe_name);
+    IDmodes = read_sharedmem_image(AOconf[loop].DMmodesname);
+    IDrespM = read_sharedmem_image(AOconf[loop].respMname);
+    IDcontrM = read_sharedmem_image(AOconf[loop].contrMname);
+    IDdmdisp = read_sharedmem_image(AOconf[loop].dmdispname);
+    if(sprintf(name, "aol%ld_imWFS2", loop) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    IDwfs = read_sharedmem_image(name);
+
+    if((IDprobe==-1)||(IDmodes==-1)||(IDrespM==-1)||(IDcontrM==-1)||(IDdmdisp==-1)||(IDwfs==-1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot connect to loop streams");
+        return(-1);
+    }
+    if(data.image[IDwfs].md[0].sem <= RMREFINE_SEMINDEX)
+    {
+        printf("ERROR: stream %s has %d semaphores, need > %d\n", name, (int) data.image[IDwfs].md[0].sem, RMREFINE_SEMINDEX);
+        return(-1);
+    }
+
+    sizeDM = data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1];
+    NBmodes = data.image[IDmodes].md[0].size[2];
+    sizeWFS = data.image[IDwfs].md[0].size[0]*data.image[IDwfs].md[0].size[1];
+
+    if((data.image[IDrespM].md[0].nelement != NBmodes*sizeWFS)||(data.image[IDprobe].md[0].nelement != sizeDM)||(data.image[IDdmdisp].md[0].nelement != sizeDM))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "stream sizes do not match");
+        return(-1);
+    }
 
+    if(halfperiod < 1)
+        halfperiod = 1;
+    if(lagfr < 0)
+        lagfr = 0;
+    NBframe = 2*halfperiod*NBperiod;
 
+    cbuff = (float*) malloc(sizeof(float)*(lagfr+1));
+    sbuff = (int*) malloc(sizeof(int)*(lagfr+1));
+    accW = (double*) malloc(sizeof(double)*sizeWFS);
+    RMest = (float*) malloc(sizeof(float)*sizeWFS);
+    mnorm = (float*) malloc(sizeof(float)*NBmodes);
 
+    for(k=0; k<NBmodes; k++)
+    {
+        double val = 0.0;
 
+        for(ii=0; ii<sizeDM; ii++)
+            val += data.image[IDmodes].array.F[k*sizeDM+ii]*data.image[IDmodes].array.F[k*sizeDM+ii];
+        mnorm[k] = (val > 0.0) ? 1.0/val : 0.0;
+    }
 
+    COREMOD_MEMORY_image_set_semflush(name, RMREFINE_SEMINDEX);
 
+    cycle = 0;
+    while(((NBcycle < 1)||(cycle < NBcycle))&&(data.signal_USR1 == 0))
+    {
+        for(k=0; (k<NBmodes)&&(data.signal_USR1 == 0); k++)
+        {
+            const float *mode = data.image[IDmodes].array.F + k*sizeDM;
+            double accc = 0.0;
 
+            memset(accW, 0, sizeof(double)*sizeWFS);
 
+            for(t=0; t<NBframe+lagfr+1; t++)
+            {
+                int sgn = ((t/halfperiod) % 2 == 0) ? 1 : -1;
+                long tb = t % (lagfr+1);
+                double val;
+
+                if(t >= NBframe) // collect last responses with probe off
+                    sgn = 0;
+
+                // apply probe
+                data.image[IDprobe].md[0].write = 1;
+                for(ii=0; ii<sizeDM; ii++)
+                    data.image[IDprobe].array.F[ii] = sgn*ampl*mode[ii];
+                COREMOD_MEMORY_image_set_sempost_byID(IDprobe, -1);
+                data.image[IDprobe].md[0].cnt0++;
+                data.image[IDprobe].md[0].write = 0;
+
+                // wait for next WFS frame
+                if(clock_gettime(CLOCK_REALTIME, &semwaitts) == -1)
+                {
+                    perror("clock_gettime");
+                    exit(EXIT_FAILURE);
+                }
+                semwaitts.tv_sec += 1;
+                if(sem_timedwait(data.image[IDwfs].semptr[RMREFINE_SEMINDEX], &semwaitts) != 0)
+                {
+                    t--;
+                    if(data.signal_USR1 == 1)
+                        break;
+                    continue;
+                }
 
+                // mode amplitude on DM, stored with probe sign; ring slot tb is reused after lagfr+1 frames
+                val = 0.0;
+                for(ii=0; ii<sizeDM; ii++)
+                    val += data.image[IDdmdisp].array.F[ii]*mode[ii];
+                cbuff[tb] = (float) (val*mnorm[k]);
+                sbuff[tb] = sgn;
 
+                // demodulate WFS frame against probe reference lagfr frames earlier
+                if(t >= lagfr)
+                {
+                    long tb0 = (t-lagfr) % (lagfr+1);
+                    int s0 = sbuff[tb0];
 
+                    if(s0 != 0)
+                    {
+                        const float *wfsin = data.image[IDwfs].array.F;
 
+                        for(ii=0; ii<sizeWFS; ii++)
+                            accW[ii] += s0*wfsin[ii];
+                        accc += s0*cbuff[tb0];
+                    }
+                }
+            }
 
+            if(data.signal_USR1 == 1) // interrupted, discard partial measurement
+                break;
 
+            if(fabs(accc) < 0.1*NBframe*ampl) // insufficient probe amplitude on DM
+            {
+                printf("mode %4ld : probe amplitude on DM too small (%g), skipping\n", k, accc/NBframe);
+                continue;
+            }
 
+            for(ii=0; ii<sizeWFS; ii++)
+                RMest[ii] = (float) (accW[ii]/accc);
 
+            data.image[IDrespM].md[0].write = 1;
+            for(ii=0; ii<sizeWFS; ii++)
+                data.image[IDrespM].array.F[k*sizeWFS+ii] = (1.0-gain)*data.image[IDrespM].array.F[k*sizeWFS+ii] + gain*RMest[ii];
+            COREMOD_MEMORY_image_set_sempost_byID(IDrespM, -1);
+            data.image[IDrespM].md[0].cnt0++;
+            data.image[IDrespM].md[0].write = 0;
+        }
 
+        // probe off
+        data.image[IDprobe].md[0].write = 1;
+        memset(data.image[IDprobe].array.F, 0, sizeof(float)*sizeDM);
+        COREMOD_MEMORY_image_set_sempost_byID(IDprobe, -1);
+        data.image[IDprobe].md[0].cnt0++;
+        data.image[IDprobe].md[0].write = 0;
 
+        if((SVDlim > 0.0)&&(data.signal_USR1 == 0))
+        {
+            long IDcm;
 
+            if(image_ID("RMrefine_CM") != -1)
+                delete_image_ID("RMrefine_CM");
+            if(image_ID("RMrefine_VT") != -1)
+                delete_image_ID("RMrefine_VT");
+            AOloopControl_computeCalib_compute_ControlMatrix(loop, 0, AOconf[loop].respMname, "RMrefine_CM", "RMrefine_VT", 0.0, 0, SVDlim);
+            IDcm = image_ID("RMrefine_CM");
 
+            if((IDcm != -1)&&(data.image[IDcm].md[0].nelement == data.image[IDcontrM].md[0].nelement))
+            {
+                // CM hot swap : loop picks up new matrix on cnt0 change
+                data.image[IDcontrM].md[0].write = 1;
+                memcpy(data.image[IDcontrM].array.F, data.image[IDcm].array.F, sizeof(float)*data.image[IDcm].md[0].nelement);
+                COREMOD_MEMORY_image_set_sempost_byID(IDcontrM, -1);
+                data.image[IDcontrM].md[0].cnt0++;
+                data.image[IDcontrM].md[0].write = 0;
+                printf("cycle %ld : control matrix updated\n", cycle);
+
+                if(AOconf[loop].CMMODE == 1)
+                    AOloopControl_acquireCalib_RMrefine_updateCMc(loop);
+            }
+        }
+        cycle++;
+    }
 
+    // probe off
+    data.image[IDprobe].md[0].write = 1;
+    memset(data.image[IDprobe].array.F, 0, sizeof(float)*sizeDM);
+    COREMOD_MEMORY_image_set_sempost_byID(IDprobe, -1);
+    data.image[IDprobe].md[0].cnt0++;
+    data.image[IDprobe].md[0].write = 0;
 
+    free(cbuff);
+    free(sbuff);
+    free(accW);
+    free(RMest);
+    free(mnorm);
 
+    return(cycle);
+}
@@ -70,6 +70,12 @@ int_fast8_t AOloopControl_acquireCalib_Measure_Resp_Matrix(long loop, long NbAve
 
 long AOloopControl_acquireCalib_RespMatrix_Fast(const char *DMmodes_name, const char *dmRM_name, const char *imWFS_name, long semtrig, float HardwareLag, float loopfrequ, float ampl, const char *outname);
 
+/** @brief Fast modal response matrix, frames demodulated on arrival into +/- accumulators (constant memory) */
+long AOloopControl_acquireCalib_RespMatrix_Fast_stream(const char *DMmodes_name, const char *dmRM_name, const char *imWFS_name, long semtrig, float HardwareLag, float loopfrequ, float ampl, long NBcycle, const char *outname);
+
+/** @brief Closed-loop background RM refinement: probe modes demodulated from WFS telemetry (lock-in), CM pushed for hot swap */
+long AOloopControl_acquireCalib_RMrefine(long loop, const char *dmprobe_name, float ampl, long halfperiod, long NBperiod, long lagfr, float gain, float SVDlim, long NBcycle);
+
 
 
 
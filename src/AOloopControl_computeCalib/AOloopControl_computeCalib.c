@@ -96,6 +96,11 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 
 #define MAX_MBLOCK 20
 
+#define MEDIANFILT_PIXBLOCK 256    // ProcessZrespM_medianfilt: pixels per tile (per poke)
+#define MEDIANFILT_SORTNET_MAX 32  // ProcessZrespM_medianfilt: max number of matrices for sorting network, selection above
+#define MEDIANFILT_REFPIXBLOCK 16  // ProcessZrespM_medianfilt: pixels per block, WFS reference
+#define HADAMARD_FWHT_PIXBLOCK 256 // WFS pixels per fast Walsh-Hadamard transform block (vector width x cache)
+
 # ifdef _OPENMP
 # include <omp.h>
 #define OMP_NELEMENT_LIMIT 1000000
@@ -217,6 +222,22 @@ int_fast8_t AOloopControl_computeCalib_computeCM_cli() {
     } else return 1;
 }
 
+/** @brief CLI function for AOloopControl_computeCalib_update_ControlMatrix */
+int_fast8_t AOloopControl_computeCalib_update_ControlMatrix_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,3)+CLI_checkarg(5,3)+CLI_checkarg(6,2)==0) {
+        AOloopControl_computeCalib_update_ControlMatrix(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.string, data.cmdargtoken[6].val.numl);
+        return 0;
+    } else return 1;
+}
+
+/** @brief CLI function for AOloopControl_computeCalib_CMprecision_report */
+int_fast8_t AOloopControl_computeCalib_CMprecision_report_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,3)==0) {
+        AOloopControl_computeCalib_CMprecision_report(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string);
+        return 0;
+    } else return 1;
+}
+
 /** @brief CLI function for AOloopControl_loadCM */
 int_fast8_t AOloopControl_computeCalib_loadCM_cli() {
     if(CLI_checkarg(1,3)==0) {
@@ -235,6 +256,24 @@ int_fast8_t AOloopControl_computeCalib_mkHadamardModes_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_computeCalib_mkRandomPokeModes */
+int_fast8_t AOloopControl_computeCalib_mkRandomPokeModes_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,3)==0) {
+        AOloopControl_computeCalib_mkRandomPokeModes(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
+/** @brief CLI function for AOloopControl_computeCalib_RandomPoke_decodeRM */
+int_fast8_t AOloopControl_computeCalib_RandomPoke_decodeRM_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,3)==0) {
+        AOloopControl_computeCalib_RandomPoke_decodeRM(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_Hadamard_decodeRM */
 int_fast8_t AOloopControl_computeCalib_Hadamard_decodeRM_cli() {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,3)==0) {
@@ -327,6 +366,10 @@ int_fast8_t init_AOloopControl_computeCalib()
 
     RegisterCLIcommand("aolHaddec", __FILE__, AOloopControl_computeCalib_Hadamard_decodeRM_cli, "decode Hadamard matrix", "<input RM> <Hadamard matrix> <DMpix index frame> <output RM>", "aolHaddec imRMh Hmat pixiind imRM", "long AOloopControl_computeCalib_Hadamard_decodeRM(char *inname, char *Hmatname, char *indexname, char *outname)");
 
+    RegisterCLIcommand("aolmkRpoke", __FILE__, AOloopControl_computeCalib_mkRandomPokeModes_cli, "make multiplexed random +/-1 poke sequence", "<DM pixel mask> <NBpoke> <output poke cube>", "aolmkRpoke dm50mask 4096 rpokec", "long AOloopControl_computeCalib_mkRandomPokeModes(const char *DMmask_name, long NBpoke, const char *outname)");
+
+    RegisterCLIcommand("aolRpokedec", __FILE__, AOloopControl_computeCalib_RandomPoke_decodeRM_cli, "decode RM acquired with multiplexed poke sequence", "<input RM> <poke cube> <DM pixel mask> <output RM>", "aolRpokedec imRMr rpokec dm50mask imRM", "long AOloopControl_computeCalib_RandomPoke_decodeRM(const char *inname, const char *pokename, const char *DMmask_name, const char *outname)");
+
     RegisterCLIcommand("aolmkslact",__FILE__, AOloopControl_computeCalib_mkSlavedAct_cli, "create slaved actuators map based on proximity", "<maskRM> <distance> <outslact>", "aolmkslact DMmaskRM 2.5 DMslavedact", "long AOloopControl_computeCalib_mkSlavedAct(char *IDmaskRM_name, float pixrad, char *IDout_name)");
 
     RegisterCLIcommand("aolmklodmmodes",__FILE__, AOloopControl_computeCalib_mkloDMmodes_cli, "make low order DM modes", "<output modes> <sizex> <sizey> <max CPA> <delta CPA> <cx> <cy> <r0> <r1> <masking mode>", "aolmklodmmodes modes 50 50 5.0 0.8 1", "long AOloopControl_computeCalib_mkloDMmodes(char *ID_name, long msizex, long msizey, float CPAmax, float deltaCPA, double xc, double yx, double r0, double r1, int MaskMode)");
@@ -349,6 +392,10 @@ int_fast8_t init_AOloopControl_computeCalib()
 
 
 
+    RegisterCLIcommand("aolcmupdate",__FILE__, AOloopControl_computeCalib_update_ControlMatrix_cli, "incremental control matrix update for removed WFS pixels / modes", "<RespMatrix> <ContrMatrix> <Ainv> <pixel mask (0=remove) or none> <mode mask (0=remove) or none> <validate>", "aolcmupdate respm cmat cmatAinv wfsmask none 1", "long AOloopControl_computeCalib_update_ControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *IDAinv_name, const char *IDpixmask_name, const char *IDmodemask_name, int validate)");
+
+    RegisterCLIcommand("aolcmprecision",__FILE__, AOloopControl_computeCalib_CMprecision_report_cli, "report control matrix accuracy in reduced precision (BF16, INT8)", "<RespMatrix> <ContrMatrix> <output report file>", "aolcmprecision respm cmat cmat_precision.txt", "int_fast8_t AOloopControl_computeCalib_CMprecision_report(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *fname)");
+
     RegisterCLIcommand("aolloadcm", __FILE__, AOloopControl_computeCalib_loadCM_cli, "load new control matrix from file", "<fname>", "aolloadcm cm32.fits", "long AOloopControl_computeCalib_loadCM(long loop, const char *CMfname)");
 
 
@@ -508,6 +555,130 @@ long AOloopControl_computeCalib_mkHadamardModes(const char *DMmask_name, const c
 
 
 
+/** @brief In-place inverse of square matrix (row-major, size N), Gauss-Jordan with partial pivoting. Returns -1 if singular */
+static int AOloopControl_computeCalib_invert_matrix_double(double *M, long N)
+{
+    long i, j, k;
+    long *perm = (long*) malloc(sizeof(long)*N);
+    int ret = 0;
+
+    for(k=0; k<N; k++)
+    {
+        long piv = k;
+        double vmax = fabs(M[k*N+k]);
+        double d;
+
+        for(i=k+1; i<N; i++)
+            if(fabs(M[i*N+k]) > vmax)
+            {
+                vmax = fabs(M[i*N+k]);
+                piv = i;
+            }
+        perm[k] = piv;
+        if(vmax < 1.0e-300)
+        {
+            ret = -1;
+            break;
+        }
+        if(piv != k)
+            for(j=0; j<N; j++)
+            {
+                double tmp = M[k*N+j];
+                M[k*N+j] = M[piv*N+j];
+                M[piv*N+j] = tmp;
+            }
+
+        d = 1.0/M[k*N+k];
+        M[k*N+k] = 1.0;
+        for(j=0; j<N; j++)
+            M[k*N+j] *= d;
+        for(i=0; i<N; i++)
+            if(i != k)
+            {
+                double f = M[i*N+k];
+                M[i*N+k] = 0.0;
+                for(j=0; j<N; j++)
+                    M[i*N+j] -= f*M[k*N+j];
+            }
+    }
+
+    // undo column permutation
+    if(ret == 0)
+        for(k=N-1; k>=0; k--)
+            if(perm[k] != k)
+                for(i=0; i<N; i++)
+                {
+                    double tmp = M[i*N+k];
+                    M[i*N+k] = M[i*N+perm[k]];
+                    M[i*N+perm[k]] = tmp;
+                }
+
+    free(perm);
+    return(ret);
+}
+
+
+
+
+/**
+ * @brief Check if Hadamard matrix image is Sylvester (natural) ordered: H[j][i] = (-1)^popcount(i&j)
+ *
+ * This is the matrix built by AOloopControl_computeCalib_mkHadamardModes, which can be applied as fast Walsh-Hadamard transform
+ */
+static int AOloopControl_computeCalib_Hadamard_isSylvester(long IDhad, long N)
+{
+    long i, j;
+
+    if((N < 1)||((N & (N-1)) != 0))
+        return 0;
+
+    for(j=0; j<N; j++)
+        for(i=0; i<N; i++)
+        {
+            float v = (__builtin_popcountl((unsigned long) (i & j)) & 1) ? -1.0 : 1.0;
+            if(fabs(data.image[IDhad].array.F[j*N+i] - v) > 0.01)
+                return 0;
+        }
+
+    return 1;
+}
+
+
+
+/**
+ * @brief In-place fast Walsh-Hadamard transform (Sylvester order) along frame axis
+ *
+ * buf[k*stride+ii] : frame k, pixel ii (ii<np). Butterflies vectorized across pixels
+ */
+static void AOloopControl_computeCalib_FWHT(float *buf, long N, long stride, long np)
+{
+    long h, i, j, ii;
+
+    for(h=1; h<N; h*=2)
+        for(i=0; i<N; i+=2*h)
+            for(j=i; j<i+h; j++)
+            {
+                float * restrict a = buf + j*stride;
+                float * restrict b = buf + (j+h)*stride;
+
+                #pragma omp simd
+                for(ii=0; ii<np; ii++)
+                {
+                    float x = a[ii];
+                    float y = b[ii];
+
+                    a[ii] = x + y;
+                    b[ii] = x - y;
+                }
+            }
+}
+
+
+
+//
+// Hmatname : Sylvester ordered matrix (from mkHadamardModes) is decoded with fast Walsh-Hadamard transform (O(N log N) per pixel)
+// other (masked, permuted) matrices use explicit product
+//
 long AOloopControl_computeCalib_Hadamard_decodeRM(const char *inname, const char *Hmatname, const char *indexname, const char *outname)
 {
     long IDin, IDhad, IDout, IDindex;
@@ -537,6 +708,50 @@ long AOloopControl_computeCalib_Hadamard_decodeRM(const char *inname, const char
     zsizeout = data.image[IDindex].md[0].size[0]*data.image[IDindex].md[0].size[1];
     IDout = create_3Dimage_ID(outname, sizexwfs, sizeywfs, zsizeout);
 
+    if(AOloopControl_computeCalib_Hadamard_isSylvester(IDhad, NBframes) == 1)
+    {
+        long NBblock = (sizewfs + HADAMARD_FWHT_PIXBLOCK - 1)/HADAMARD_FWHT_PIXBLOCK;
+
+        printf("Sylvester Hadamard matrix -> fast Walsh-Hadamard transform decode, %ld pixel blocks\n", NBblock);
+        fflush(stdout);
+
+# ifdef _OPENMP
+        #pragma omp parallel private(kk,kk1,ii)
+        {
+# endif
+        float *buf = (float*) malloc(sizeof(float)*NBframes*HADAMARD_FWHT_PIXBLOCK);
+        long blk;
+
+# ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(blk=0; blk<NBblock; blk++)
+        {
+            long ii0 = blk*HADAMARD_FWHT_PIXBLOCK;
+            long np = (sizewfs-ii0 < HADAMARD_FWHT_PIXBLOCK) ? sizewfs-ii0 : HADAMARD_FWHT_PIXBLOCK;
+
+            for(kk1=0; kk1<NBframes; kk1++)
+                memcpy(buf + kk1*HADAMARD_FWHT_PIXBLOCK, data.image[IDin].array.F + kk1*sizewfs + ii0, sizeof(float)*np);
+
+            AOloopControl_computeCalib_FWHT(buf, NBframes, HADAMARD_FWHT_PIXBLOCK, np);
+
+            for(kk=0; kk<zsizeout; kk++)
+            {
+                long kk0 = (long) (data.image[IDindex].array.F[kk]+0.1);
+
+                if(kk0 > -1)
+                    for(ii=0; ii<np; ii++)
+                        data.image[IDout].array.F[kk*sizewfs+ii0+ii] = buf[kk0*HADAMARD_FWHT_PIXBLOCK+ii]/NBframes;
+            }
+        }
+        free(buf);
+# ifdef _OPENMP
+        }
+# endif
+
+        return(IDout);
+    }
+
     long kk0;
 # ifdef _OPENMP
     #pragma omp parallel for private(kk0,kk1,ii)
@@ -571,6 +786,161 @@ long AOloopControl_computeCalib_Hadamard_decodeRM(const char *inname, const char
 
 
 
+//
+// Multiplexed random poke sequence: NBpoke patterns of random +1/-1 values over the active actuators
+// (DMmask > 0.5). Use as RMpokeCube (aolmeaszrm), then decode with AOloopControl_computeCalib_RandomPoke_decodeRM.
+// NBpoke >= number of active actuators is required; larger NBpoke trades acquisition time for SNR
+// (each actuator is poked in every frame, noise per actuator ~ 1/sqrt(NBpoke)).
+//
+long AOloopControl_computeCalib_mkRandomPokeModes(const char *DMmask_name, long NBpoke, const char *outname)
+{
+    long IDmask, IDout;
+    long xsize, ysize, xysize;
+    long ii, k;
+    long cnt = 0;
+
+
+    IDmask = image_ID(DMmask_name);
+    xsize = data.image[IDmask].md[0].size[0];
+    ysize = data.image[IDmask].md[0].size[1];
+    xysize = xsize*ysize;
+
+    for(ii=0; ii<xysize; ii++)
+        if(data.image[IDmask].array.F[ii]>0.5)
+            cnt++;
+
+    if(NBpoke < cnt)
+        printf("WARNING: NBpoke (%ld) < number of active actuators (%ld) : RM cannot be decoded\n", NBpoke, cnt);
+
+    IDout = create_3Dimage_ID(outname, xsize, ysize, NBpoke);
+    for(k=0; k<NBpoke; k++)
+        for(ii=0; ii<xysize; ii++)
+            if(data.image[IDmask].array.F[ii]>0.5)
+                data.image[IDout].array.F[k*xysize+ii] = (ran1() > 0.5) ? 1.0 : -1.0;
+
+    printf("%ld random poke patterns, %ld actuators\n", NBpoke, cnt);
+
+    return(IDout);
+}
+
+
+
+//
+// Decode RM measured with a multiplexed poke sequence (least squares)
+//
+// inname   : measured response, one WFS frame per poke pattern
+// pokename : poke sequence (DM frames)
+// outname  : zonal RM, one WFS frame per DM actuator (inactive actuators set to zero)
+//
+// RM = transpose(P) x inv(P x transpose(P)), P = active actuators x pokes
+//
+long AOloopControl_computeCalib_RandomPoke_decodeRM(const char *inname, const char *pokename, const char *DMmask_name, const char *outname)
+{
+    long IDin, IDpoke, IDmask, IDout;
+    long wfsxsize, wfsysize, wfssize;
+    long dmxysize;
+    long NBpoke, NBact;
+    long ii, k, a, a1;
+    long *actarray;
+    double *G;
+    float *Pm;
+    float *R;
+    float *outbuff;
+
+
+    IDin = image_ID(inname);
+    IDpoke = image_ID(pokename);
+    IDmask = image_ID(DMmask_name);
+
+    wfsxsize = data.image[IDin].md[0].size[0];
+    wfsysize = data.image[IDin].md[0].size[1];
+    wfssize = wfsxsize*wfsysize;
+    NBpoke = data.image[IDin].md[0].size[2];
+    dmxysize = data.image[IDmask].md[0].size[0]*data.image[IDmask].md[0].size[1];
+
+    if(data.image[IDpoke].md[0].size[2] != NBpoke)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "number of poke patterns does not match number of WFS frames");
+        return(-1);
+    }
+
+    actarray = (long*) malloc(sizeof(long)*dmxysize);
+    NBact = 0;
+    for(ii=0; ii<dmxysize; ii++)
+        if(data.image[IDmask].array.F[ii]>0.5)
+            actarray[NBact++] = ii;
+
+    if(NBpoke < NBact)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "fewer poke patterns than active actuators");
+        free(actarray);
+        return(-1);
+    }
+
+    // P (NBact x NBpoke)
+    Pm = (float*) malloc(sizeof(float)*NBact*NBpoke);
+    for(a=0; a<NBact; a++)
+        for(k=0; k<NBpoke; k++)
+            Pm[a*NBpoke+k] = data.image[IDpoke].array.F[k*dmxysize+actarray[a]];
+
+    // G = inv(P x transpose(P))
+    G = (double*) malloc(sizeof(double)*NBact*NBact);
+# ifdef _OPENMP
+    #pragma omp parallel for private(a1,k)
+# endif
+    for(a=0; a<NBact; a++)
+        for(a1=0; a1<NBact; a1++)
+        {
+            double val = 0.0;
+
+            for(k=0; k<NBpoke; k++)
+                val += Pm[a*NBpoke+k]*Pm[a1*NBpoke+k];
+            G[a*NBact+a1] = val;
+        }
+    if(AOloopControl_computeCalib_invert_matrix_double(G, NBact) != 0)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "poke sequence is singular");
+        free(actarray);
+        free(Pm);
+        free(G);
+        return(-1);
+    }
+
+    // R = G x P  (NBact x NBpoke)
+    R = (float*) malloc(sizeof(float)*NBact*NBpoke);
+# ifdef _OPENMP
+    #pragma omp parallel for private(a1,k)
+# endif
+    for(a=0; a<NBact; a++)
+        for(k=0; k<NBpoke; k++)
+        {
+            double val = 0.0;
+
+            for(a1=0; a1<NBact; a1++)
+                val += G[a*NBact+a1]*Pm[a1*NBpoke+k];
+            R[a*NBpoke+k] = (float) val;
+        }
+    free(G);
+    free(Pm);
+
+    // RM (active actuators) = R x measured (NBpoke x wfssize)
+    outbuff = (float*) malloc(sizeof(float)*NBact*wfssize);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, NBact, wfssize, NBpoke, 1.0, R, NBpoke, data.image[IDin].array.F, wfssize, 0.0, outbuff, wfssize);
+    free(R);
+
+    IDout = create_3Dimage_ID(outname, wfsxsize, wfsysize, dmxysize);
+    for(a=0; a<NBact; a++)
+        memcpy(data.image[IDout].array.F + actarray[a]*wfssize, outbuff + a*wfssize, sizeof(float)*wfssize);
+
+    free(outbuff);
+    free(actarray);
+
+    return(IDout);
+}
+
+
+
+
 // make low order DM modes
 long AOloopControl_computeCalib_mkloDMmodes(const char *ID_name, long msizex, long msizey, float CPAmax, float deltaCPA, double xc, double yc, double r0, double r1, int MaskMode)
 {
@@ -1208,6 +1578,103 @@ int_fast8_t AOloopControl_computeCalib_Process_zrespM(long loop, const char *IDz
 
 
 
+/**
+ * @brief Sort each column of buf (NBrow rows, np columns, row stride) with odd-even transposition network
+ *
+ * Branch-free compare-exchange between adjacent rows, vectorized across columns (pixels). Used for small NBrow
+ */
+static void AOloopControl_computeCalib_sortnet_columns(float *buf, long NBrow, long stride, long np)
+{
+    long pass, k, ii;
+
+    for(pass=0; pass<NBrow; pass++)
+        for(k=pass%2; k+1<NBrow; k+=2)
+        {
+            float * restrict a = buf + k*stride;
+            float * restrict b = buf + (k+1)*stride;
+
+            #pragma omp simd
+            for(ii=0; ii<np; ii++)
+            {
+                float x = a[ii];
+                float y = b[ii];
+
+                a[ii] = (x < y) ? x : y;
+                b[ii] = (x < y) ? y : x;
+            }
+        }
+}
+
+
+
+/**
+ * @brief Partial sort (quickselect): on return a[k] is k-th smallest, a[0..k-1] <= a[k] <= a[k+1..n-1]
+ */
+static void AOloopControl_computeCalib_select_float(float *a, long n, long k)
+{
+    long lo = 0;
+    long hi = n-1;
+
+    while(hi > lo)
+    {
+        long mid = lo + (hi-lo)/2;
+        float pivot;
+        float tmp;
+        long i, j;
+
+        // median of 3 pivot
+        if(a[mid] < a[lo]) { tmp = a[mid]; a[mid] = a[lo]; a[lo] = tmp; }
+        if(a[hi] < a[lo]) { tmp = a[hi]; a[hi] = a[lo]; a[lo] = tmp; }
+        if(a[hi] < a[mid]) { tmp = a[hi]; a[hi] = a[mid]; a[mid] = tmp; }
+        pivot = a[mid];
+
+        i = lo;
+        j = hi;
+        while(i <= j)
+        {
+            while(a[i] < pivot)
+                i++;
+            while(a[j] > pivot)
+                j--;
+            if(i <= j)
+            {
+                tmp = a[i];
+                a[i] = a[j];
+                a[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            break;
+    }
+}
+
+
+
+/**
+ * @brief Mean of elements of rank kmin to kmax-1 (a is reordered), O(n)
+ */
+static double AOloopControl_computeCalib_trimmedmean_float(float *a, long n, long kmin, long kmax)
+{
+    double ave = 0.0;
+    long k;
+
+    AOloopControl_computeCalib_select_float(a, n, kmin);
+    if(kmax < n)
+        AOloopControl_computeCalib_select_float(a+kmin, n-kmin, kmax-kmin);
+    for(k=kmin; k<kmax; k++)
+        ave += a[k];
+
+    return(ave/(kmax-kmin));
+}
+
+
+
 // CANDIDATE FOR RETIREMENT
 //
 // median-averages multiple response matrices to create a better one
@@ -1228,10 +1695,8 @@ int_fast8_t AOloopControl_computeCalib_ProcessZrespM_medianfilt(long loop, const
     long *IDzresp_array;
     long ii;
     double fluxpos, fluxneg;
-    float *pixvalarray;
     long k, kmin, kmax, kband;
     long IDzrm;
-    float ave;
     long *IDWFSrefc_array;
     long IDWFSref;
     long IDWFSmap, IDDMmap;
@@ -1373,32 +1838,65 @@ int_fast8_t AOloopControl_computeCalib_ProcessZrespM_medianfilt(long loop, const
     kmin = kband;
     kmax = NBmat-kband;
 
+    // trimmed mean across matrices for each (poke, pixel)
+    // tiles of MEDIANFILT_PIXBLOCK pixels, transposed (matrix-major) so that rows can be sorted across pixels
+    {
+        long NBblock = (sizeWFS + MEDIANFILT_PIXBLOCK - 1)/MEDIANFILT_PIXBLOCK;
+        long tile;
+
 # ifdef _OPENMP
-    #pragma omp parallel for private(ii,kmat,ave,k,pixvalarray)
+        #pragma omp parallel private(ii,kmat,k)
+        {
 # endif
-    for(poke=0; poke<NBpoke; poke++)
-    {
-        printf("\r act %ld / %ld        ", poke, NBpoke);
-        fflush(stdout);
+        float *buf = (float*) malloc(sizeof(float)*NBmat*MEDIANFILT_PIXBLOCK);
+        float *pixval = (float*) malloc(sizeof(float)*NBmat);
+        double *acc = (double*) malloc(sizeof(double)*MEDIANFILT_PIXBLOCK);
 
-        if((pixvalarray = (float*) malloc(sizeof(float)*NBmat))==NULL)
+        if((buf==NULL)||(pixval==NULL)||(acc==NULL))
         {
-            printf("ERROR: cannot allocate pixvalarray, size = %ld\n", (long) NBmat);
+            printf("ERROR: cannot allocate median filter buffers, NBmat = %ld\n", (long) NBmat);
             exit(0);
         }
 
-        for(ii=0; ii<sizeWFS; ii++)
+# ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(tile=0; tile<NBpoke*NBblock; tile++)
         {
+            long poke1 = tile / NBblock;
+            long ii0 = (tile % NBblock)*MEDIANFILT_PIXBLOCK;
+            long np = (sizeWFS-ii0 < MEDIANFILT_PIXBLOCK) ? sizeWFS-ii0 : MEDIANFILT_PIXBLOCK;
+
             for(kmat=0; kmat<NBmat; kmat++)
-                pixvalarray[kmat] = data.image[IDzresp_array[kmat]].array.F[poke*sizeWFS+ii] ;
-            quick_sort_float(pixvalarray, kmat);
-            ave = 0.0;
-            for(k=kmin; k<kmax; k++)
-                ave += pixvalarray[k];
-            ave /= (kmax-kmin);
-            data.image[IDzrm].array.F[poke*sizeWFS+ii] = ave/rmampl;
+                memcpy(buf + kmat*MEDIANFILT_PIXBLOCK, data.image[IDzresp_array[kmat]].array.F + poke1*sizeWFS + ii0, sizeof(float)*np);
+
+            if(NBmat <= MEDIANFILT_SORTNET_MAX)
+            {
+                AOloopControl_computeCalib_sortnet_columns(buf, NBmat, MEDIANFILT_PIXBLOCK, np);
+                for(ii=0; ii<np; ii++)
+                    acc[ii] = 0.0;
+                for(k=kmin; k<kmax; k++)
+                    for(ii=0; ii<np; ii++)
+                        acc[ii] += buf[k*MEDIANFILT_PIXBLOCK+ii];
+                for(ii=0; ii<np; ii++)
+                    data.image[IDzrm].array.F[poke1*sizeWFS+ii0+ii] = acc[ii]/(kmax-kmin)/rmampl;
+            }
+            else
+            {
+                for(ii=0; ii<np; ii++)
+                {
+                    for(kmat=0; kmat<NBmat; kmat++)
+                        pixval[kmat] = buf[kmat*MEDIANFILT_PIXBLOCK+ii];
+                    data.image[IDzrm].array.F[poke1*sizeWFS+ii0+ii] = AOloopControl_computeCalib_trimmedmean_float(pixval, NBmat, kmin, kmax)/rmampl;
+                }
+            }
         }
-        free(pixvalarray);
+        free(buf);
+        free(pixval);
+        free(acc);
+# ifdef _OPENMP
+        }
+# endif
     }
 
     printf("\n");
@@ -1410,37 +1908,49 @@ int_fast8_t AOloopControl_computeCalib_ProcessZrespM_medianfilt(long loop, const
     kmax = NBmat*NBpoke-kband;
 
 
+    // WFS reference: trimmed mean over all matrices and pokes, selection (O(n)) per pixel
+    // blocks of MEDIANFILT_REFPIXBLOCK pixels gathered from contiguous memory
+    {
+        long NBblock = (sizeWFS + MEDIANFILT_REFPIXBLOCK - 1)/MEDIANFILT_REFPIXBLOCK;
+        long NBval = NBmat*NBpoke;
+        long blk;
+
 # ifdef _OPENMP
-    #pragma omp parallel for private(poke,kmat,pixvalarray,ave,k)
+        #pragma omp parallel private(ii,kmat,poke)
+        {
 # endif
-    for(ii=0; ii<sizeWFS; ii++)
-    {
-        printf("\r wfs pix %ld / %ld        ", ii, sizeWFS);
-        fflush(stdout);
-        if((pixvalarray = (float*) malloc(sizeof(float)*NBmat*NBpoke))==NULL)
+        float *vals = (float*) malloc(sizeof(float)*NBval*MEDIANFILT_REFPIXBLOCK);
+
+        if(vals==NULL)
         {
-            printf("ERROR: cannot allocate pixvalarray, size = %ld x %ld\n", (long) NBmat, (long) NBpoke);
+            printf("ERROR: cannot allocate pixvalarray, size = %ld x %ld x %d\n", (long) NBmat, (long) NBpoke, MEDIANFILT_REFPIXBLOCK);
             exit(0);
         }
 
-        for(poke=0; poke<NBpoke; poke++)
-            for(kmat=0; kmat<NBmat; kmat++)
-                pixvalarray[kmat*NBpoke+poke] = data.image[IDWFSrefc_array[kmat]].array.F[poke*sizeWFS+ii] ;
-
+# ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(blk=0; blk<NBblock; blk++)
+        {
+            long ii0 = blk*MEDIANFILT_REFPIXBLOCK;
+            long np = (sizeWFS-ii0 < MEDIANFILT_REFPIXBLOCK) ? sizeWFS-ii0 : MEDIANFILT_REFPIXBLOCK;
 
-        quick_sort_float(pixvalarray, NBpoke*NBmat);
+            for(kmat=0; kmat<NBmat; kmat++)
+                for(poke=0; poke<NBpoke; poke++)
+                {
+                    const float *src = data.image[IDWFSrefc_array[kmat]].array.F + poke*sizeWFS + ii0;
 
-        ave = 0.0;
-        for(k=kmin; k<kmax; k++)
-            ave += pixvalarray[k];
-        ave /= (kmax-kmin);
-        data.image[IDWFSref].array.F[ii] = ave;
+                    for(ii=0; ii<np; ii++)
+                        vals[ii*NBval + kmat*NBpoke+poke] = src[ii];
+                }
 
-        //printf("free pixvalarray : %ld x %ld\n", NBmat, NBpoke);
-        //fflush(stdout);
-        free(pixvalarray);
-        //printf("done\n");
-        //fflush(stdout);
+            for(ii=0; ii<np; ii++)
+                data.image[IDWFSref].array.F[ii0+ii] = AOloopControl_computeCalib_trimmedmean_float(vals + ii*NBval, NBval, kmin, kmax);
+        }
+        free(vals);
+# ifdef _OPENMP
+        }
+# endif
     }
     free(IDzresp_array);
     free(IDWFSrefc_array);
@@ -1900,6 +2410,81 @@ long AOloopControl_computeCalib_DMslaveExt(const char *IDin_name, const char *ID
  *
  */
 
+/** @brief FNV-1a hash update */
+static uint64_t AOloopControl_computeCalib_hash_bytes(uint64_t hash, const void *buf, size_t nbbytes)
+{
+    const unsigned char *ptr = (const unsigned char*) buf;
+    size_t i;
+
+    for(i=0; i<nbbytes; i++)
+    {
+        hash ^= ptr[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/** @brief hash update with image size and content (no-op if image does not exist) */
+static uint64_t AOloopControl_computeCalib_hash_image(uint64_t hash, const char *IDname)
+{
+    long ID = image_ID(IDname);
+
+    if(ID == -1)
+        return hash;
+
+    hash = AOloopControl_computeCalib_hash_bytes(hash, IDname, strlen(IDname));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, data.image[ID].md[0].size, sizeof(uint32_t)*data.image[ID].md[0].naxis);
+    if(data.image[ID].md[0].atype == _DATATYPE_FLOAT)
+        hash = AOloopControl_computeCalib_hash_bytes(hash, data.image[ID].array.F, sizeof(float)*data.image[ID].md[0].nelement);
+
+    return hash;
+}
+
+
+/**
+ * @brief Hash of the inputs of the DM modes computation in mkModes (fmodes2ball)
+ *
+ * Covers parameters, DM masks, slaved actuators, extra modes and zonal response used for the low order fit.
+ */
+static uint64_t AOloopControl_computeCalib_mkModes_DMhash(long msizex, long msizey, float CPAmax, float deltaCPA, double xc, double yc, double r0, double r1, int MaskMode, float SVDlim)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    FILE *fp;
+
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &msizex, sizeof(long));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &msizey, sizeof(long));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &CPAmax, sizeof(float));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &deltaCPA, sizeof(float));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &xc, sizeof(double));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &yc, sizeof(double));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &r0, sizeof(double));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &r1, sizeof(double));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &MaskMode, sizeof(int));
+    hash = AOloopControl_computeCalib_hash_bytes(hash, &SVDlim, sizeof(float));
+
+    hash = AOloopControl_computeCalib_hash_image(hash, "dmmaskRM");
+    hash = AOloopControl_computeCalib_hash_image(hash, "dmslaved");
+    hash = AOloopControl_computeCalib_hash_image(hash, "emodes");
+    hash = AOloopControl_computeCalib_hash_image(hash, "extrablockM");
+    hash = AOloopControl_computeCalib_hash_image(hash, "zrespM");
+    hash = AOloopControl_computeCalib_hash_image(hash, "RMMmodes");
+    hash = AOloopControl_computeCalib_hash_image(hash, "RMMresp");
+
+    if((fp = fopen("./conf/param_extrablockIndex.txt", "r")) != NULL)
+    {
+        long extrablockIndex = -1;
+
+        if(fscanf(fp, "%50ld", &extrablockIndex) == 1)
+            hash = AOloopControl_computeCalib_hash_bytes(hash, &extrablockIndex, sizeof(long));
+        fclose(fp);
+    }
+
+    return hash;
+}
+
+
+
 long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long msizey, float CPAmax, float deltaCPA, double xc, double yc, double r0, double r1, int MaskMode, int BlockNB, float SVDlim)
 {
     FILE *fp;
@@ -1970,8 +2555,7 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
     long cnt;
 
 
-    int reuse;
-    long IDSVDmodein, IDSVDmode1, IDSVDcoeff, IDSVDmask;
+    long IDSVDcoeff, IDSVDmask;
     long m1;
     long IDnewmodeC;
 
@@ -2130,6 +2714,25 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
     COMPUTE_DM_MODES = 0;
     ID2b = image_ID("fmodes2ball");
 
+    // DM modes cache : inputs hash stored with ./mkmodestmp/fmodes2ball.fits
+    uint64_t DMmodes_hash = AOloopControl_computeCalib_mkModes_DMhash(msizex, msizey, CPAmax, deltaCPA, xc, yc, r0, r1, MaskMode, SVDlim);
+    if(ID2b == -1)
+    {
+        unsigned long long hash0 = 0;
+
+        if((fp = fopen("./mkmodestmp/fmodes2ball.hash", "r")) != NULL)
+        {
+            if(fscanf(fp, "%llx", &hash0) != 1)
+                hash0 = 0;
+            fclose(fp);
+        }
+        if((hash0 == (unsigned long long) DMmodes_hash) && (file_exists("./mkmodestmp/fmodes2ball.fits") == 1) && (file_exists("./mkmodestmp/NBblocks.txt") == 1))
+        {
+            printf("DM modes inputs unchanged (hash %016llx) -> loading cached DM modes\n", hash0);
+            ID2b = load_fits("./mkmodestmp/fmodes2ball.fits", "fmodes2ball", 1);
+        }
+    }
+
     if(ID2b == -1)
         COMPUTE_DM_MODES = 1;
 
@@ -2843,7 +3446,6 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
         IDSVDmask = create_2Dimage_ID("SVDmask", msizex, msizey);
         for(ii=0; ii<msizexy; ii++)
             data.image[IDSVDmask].array.F[ii] = data.image[IDmaskRM].array.F[ii];
-        IDSVDmodein = create_2Dimage_ID("SVDmodein", msizex, msizey);
 
         mok = (int*) malloc(sizeof(int)*NBmm);
         for(m=0; m<NBmm; m++)
@@ -2853,47 +3455,47 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
         {
             for(m=0; m<MBLOCK_NBmode[mblock]; m++)
                 mok[m] = 1;
-            for(mblock0=0; mblock0<mblock; mblock0++)
+            if(mblock > 0)
             {
-                reuse = 0;
-                for(m=0; m<MBLOCK_NBmode[mblock]; m++)
-                {
-                    //  printf("STEP 4: REMOVING BLOCK %ld from   block %ld mode %ld/%ld      ", mblock0, mblock, m, MBLOCK_NBmode[mblock]);
-                    //  fflush(stdout);
-
-                    for(ii=0; ii<msizexy; ii++)
-                        data.image[IDSVDmodein].array.F[ii] = data.image[MBLOCK_ID[mblock]].array.F[m*msizexy+ii];
+                // span of previous blocks removed in one blocked Gram-Schmidt pass
+                long NBref = 0;
+                long IDref;
+                long IDSVDmodeout;
 
+                for(mblock0=0; mblock0<mblock; mblock0++)
+                {
                     if(sprintf(imname, "fmodes1_%02ld", mblock0) < 1)
                         printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                    NBref += data.image[image_ID(imname)].md[0].size[2];
+                }
+                IDref = create_3Dimage_ID("SVDmoderef", msizex, msizey, NBref);
+                NBref = 0;
+                for(mblock0=0; mblock0<mblock; mblock0++)
+                {
+                    long IDb;
 
-                    linopt_imtools_image_fitModes("SVDmodein", imname, "SVDmask", 1.0e-2, "modecoeff", reuse);
+                    if(sprintf(imname, "fmodes1_%02ld", mblock0) < 1)
+                        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                    IDb = image_ID(imname);
+                    memcpy(data.image[IDref].array.F+NBref*msizexy, data.image[IDb].array.F, sizeof(float)*msizexy*data.image[IDb].md[0].size[2]);
+                    NBref += data.image[IDb].md[0].size[2];
+                }
 
+                linopt_imtools_modes_orthogonalize(data.image[MBLOCK_ID[mblock]].name, "SVDmask", "SVDmoderef", "SVDmodeout", 0.0, 0);
+                IDSVDmodeout = image_ID("SVDmodeout");
+                memcpy(data.image[MBLOCK_ID[mblock]].array.F, data.image[IDSVDmodeout].array.F, sizeof(float)*msizexy*MBLOCK_NBmode[mblock]);
+                delete_image_ID("SVDmodeout");
+                delete_image_ID("SVDmoderef");
 
-                    reuse = 1;
-                    linopt_imtools_image_construct(imname, "modecoeff", "SVDmode1");
-                    IDSVDmode1 = image_ID("SVDmode1");
-                    delete_image_ID("modecoeff");
+                for(m=0; m<MBLOCK_NBmode[mblock]; m++)
+                {
                     value1 = 0.0;
                     for(ii=0; ii<msizexy; ii++)
-                    {
-                        data.image[MBLOCK_ID[mblock]].array.F[m*msizexy+ii] -= data.image[IDSVDmode1].array.F[ii];;
                         value1 += data.image[MBLOCK_ID[mblock]].array.F[m*msizexy+ii]*data.image[MBLOCK_ID[mblock]].array.F[m*msizexy+ii];
-                    }
-                    delete_image_ID("SVDmode1");
-
                     rms = sqrt(value1/totm);
                     float rmslim0 = 0.01;
-                    if(rms>rmslim0)
-                    {
-                        //       for(ii=0; ii<msizexy; ii++)
-                        //         data.image[MBLOCK_ID[mblock]].array.F[m*msizexy+ii] /= rms;
-                    }
-                    else
+                    if(rms<=rmslim0)
                         mok[m] = 0;
-
-                    //                    printf("->  %12g (%g %g)\n", rms, value1, totm);
-                    //					fflush(stdout);
                 }
             }
             cnt = 0;
@@ -2933,7 +3535,6 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
         }
 
         delete_image_ID("SVDmask");
-        delete_image_ID("SVDmodein");
 
         free(mok);
 
@@ -3066,6 +3667,12 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
             }
         }
         save_fits("fmodes2ball", "!./mkmodestmp/fmodes2ball.fits");
+
+        if((fp = fopen("./mkmodestmp/fmodes2ball.hash", "w")) != NULL)
+        {
+            fprintf(fp, "%016llx\n", (unsigned long long) DMmodes_hash);
+            fclose(fp);
+        }
     }
     else
     {
@@ -3312,10 +3919,6 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
             /// Input: fmodesWFS0all (corresponding to fmodes2ball)
             /// Output -> fmodesWFS1all / fmodes3all
 
-            IDSVDmask = create_2Dimage_ID("SVDmask", wfsxsize, wfsysize);
-            for(ii=0; ii<wfssize; ii++)
-                data.image[IDSVDmask].array.F[ii] = 1.0;
-            IDSVDmodein = create_2Dimage_ID("SVDmodein", wfsxsize, wfsysize);
 
             mok = (int*) malloc(sizeof(int)*NBmm);
             for(m=0; m<NBmm; m++)
@@ -3345,57 +3948,68 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
 
 
                 // REMOVE WFS MODES FROM PREVIOUS BLOCKS
+                // WFS and DM modes concatenated, inner product over WFS part only : DM modes follow WFS modes combinations
 
-                for(mblock0=0; mblock0<mblock; mblock0++)
+                if(mblock > 0)
                 {
+                    long NBref = 0;
+                    long IDref, IDin, IDcmask, IDout;
+                    long vsize = wfssize + msizexy;
+                    long IDmwfs;
 
-                    reuse = 0;
-                    for(m=0; m<MBLOCK_NBmode[mblock]; m++)
+                    for(mblock0=0; mblock0<mblock; mblock0++)
                     {
-                        if(sprintf(imname, "fmodesWFS0_%02ld", mblock) < 1)
-                            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-                        long IDmwfs = image_ID(imname);
-
-                        if(sprintf(imnameDM, "fmodes2b_%02ld", mblock) < 1)
+                        if(sprintf(imname, "fmodesWFS0_%02ld", mblock0) < 1)
                             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                        NBref += data.image[image_ID(imname)].md[0].size[2];
+                    }
 
-                        IDm = image_ID(imnameDM);
-
-
-                        for(ii=0; ii<wfsxsize*wfsysize; ii++)
-                            data.image[IDSVDmodein].array.F[ii] = data.image[IDmwfs].array.F[m*wfssize+ii];
+                    IDcmask = create_2Dimage_ID("SVDmaskc", vsize, 1);
+                    for(ii=0; ii<wfssize; ii++)
+                        data.image[IDcmask].array.F[ii] = 1.0;
 
+                    IDref = create_3Dimage_ID("SVDmoderef", vsize, 1, NBref);
+                    NBref = 0;
+                    for(mblock0=0; mblock0<mblock; mblock0++)
+                    {
                         if(sprintf(imname, "fmodesWFS0_%02ld", mblock0) < 1)
                             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
                         if(sprintf(imnameDM, "fmodes2b_%02ld", mblock0) < 1)
                             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                        IDmwfs = image_ID(imname);
+                        IDm = image_ID(imnameDM);
+                        for(m=0; m<data.image[IDmwfs].md[0].size[2]; m++)
+                        {
+                            memcpy(data.image[IDref].array.F+(NBref+m)*vsize, data.image[IDmwfs].array.F+m*wfssize, sizeof(float)*wfssize);
+                            memcpy(data.image[IDref].array.F+(NBref+m)*vsize+wfssize, data.image[IDm].array.F+m*msizexy, sizeof(float)*msizexy);
+                        }
+                        NBref += data.image[IDmwfs].md[0].size[2];
+                    }
 
-                        linopt_imtools_image_fitModes("SVDmodein", imname, "SVDmask", 1.0e-2, "modecoeff", reuse);
-                        IDSVDcoeff = image_ID("modecoeff");
-                        reuse = 1;
-                        linopt_imtools_image_construct(imname, "modecoeff", "SVDmode1");
-                        linopt_imtools_image_construct(imnameDM, "modecoeff", "SVDmode1DM");
-                        IDSVDmode1 = image_ID("SVDmode1");
+                    if(sprintf(imname, "fmodesWFS0_%02ld", mblock) < 1)
+                        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                    if(sprintf(imnameDM, "fmodes2b_%02ld", mblock) < 1)
+                        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+                    IDmwfs = image_ID(imname);
+                    IDm = image_ID(imnameDM);
+                    IDin = create_3Dimage_ID("SVDmodeinc", vsize, 1, MBLOCK_NBmode[mblock]);
+                    for(m=0; m<MBLOCK_NBmode[mblock]; m++)
+                    {
+                        memcpy(data.image[IDin].array.F+m*vsize, data.image[IDmwfs].array.F+m*wfssize, sizeof(float)*wfssize);
+                        memcpy(data.image[IDin].array.F+m*vsize+wfssize, data.image[IDm].array.F+m*msizexy, sizeof(float)*msizexy);
+                    }
 
-                        long IDSVDmode1DM = image_ID("SVDmode1DM");
+                    linopt_imtools_modes_orthogonalize("SVDmodeinc", "SVDmaskc", "SVDmoderef", "SVDmodeoutc", 0.0, 0);
+                    IDout = image_ID("SVDmodeoutc");
 
-                        delete_image_ID("modecoeff");
+                    for(m=0; m<MBLOCK_NBmode[mblock]; m++)
+                    {
+                        memcpy(data.image[IDmwfs].array.F+m*wfssize, data.image[IDout].array.F+m*vsize, sizeof(float)*wfssize);
+                        memcpy(data.image[IDm].array.F+m*msizexy, data.image[IDout].array.F+m*vsize+wfssize, sizeof(float)*msizexy);
 
                         value1 = 0.0;
                         for(ii=0; ii<wfssize; ii++)
-                        {
-                            data.image[IDmwfs].array.F[m*wfssize+ii] -= data.image[IDSVDmode1].array.F[ii];
                             value1 += data.image[IDmwfs].array.F[m*wfssize+ii]*data.image[IDmwfs].array.F[m*wfssize+ii];
-                        }
-                        for(ii=0; ii<msizexy; ii++)
-                            data.image[IDm].array.F[m*msizexy+ii] -= data.image[IDSVDmode1DM].array.F[ii];
-
-
-                        delete_image_ID("SVDmode1");
-                        delete_image_ID("SVDmode1DM");
-
                         rms = sqrt(value1/wfssize);
 
                         if(rms<rmsarray[m]*rmslim1)
@@ -3404,6 +4018,11 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
                         }
                         printf("RMS RATIO  %3ld :   %12g\n", m, rms/rmsarray[m]);
                     }
+
+                    delete_image_ID("SVDmodeoutc");
+                    delete_image_ID("SVDmodeinc");
+                    delete_image_ID("SVDmoderef");
+                    delete_image_ID("SVDmaskc");
                 }
 
                 cnt = 0;
@@ -3504,9 +4123,7 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
                 MBLOCK_NBmode[mblock] = cnt;
                 free(rmsarray);
             }
-            delete_image_ID("SVDmask");
-            delete_image_ID("SVDmodein");
-
+    
             printf("STEP 0020\n");
             fflush(stdout);//TEST
 
@@ -3696,6 +4313,9 @@ long AOloopControl_computeCalib_mkModes(const char *ID_name, long msizex, long m
                 long ID_VTmatrix = image_ID("SVD_VTm");
 
 
+# ifdef _OPENMP
+                #pragma omp parallel for private(ii,value1,value1cnt,rms)
+# endif
                 for(kk=0; kk<cnt; kk++) /// eigen mode index
                 {
                     long kk1;
@@ -4294,6 +4914,115 @@ long AOloopControl_computeCalib_mkModes_Simple(const char *IDin_name, long NBmbl
 
 
 
+/**
+ * @brief Estimates control matrix accuracy in reduced precision (BF16, INT8) relative to FP32
+ *
+ * Test vectors are the response matrix columns: for each mode k, y = CM R_k is computed in FP32, BF16 and INT8.\n
+ * Reports RMS error of reduced precision results relative to RMS of FP32 result, per mode and overall, with the INT8 per-mode scale.\n
+ * Run on request (aolcmprecision) before selecting loop parameter CMprecision; the loop quantizes its own copy of the matrix.
+ *
+ * @param[in] ID_Rmatrix_name   response matrix (n pixels x m modes)
+ * @param[in] ID_Cmatrix_name   control matrix, same size
+ * @param[in] fname             output report file
+ */
+int_fast8_t AOloopControl_computeCalib_CMprecision_report(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *fname)
+{
+    FILE *fp;
+    long IDrm, IDcm;
+    long m, n;
+    int8_t *cmq8;
+    uint16_t *cmbf16;
+    float *q8scale;
+    float *outF, *outQ8, *outBF16;
+    long k, kk;
+    double errQ8tot = 0.0;
+    double errBF16tot = 0.0;
+    double reftot = 0.0;
+
+    IDrm = image_ID(ID_Rmatrix_name);
+    IDcm = image_ID(ID_Cmatrix_name);
+    if((IDrm == -1)||(IDcm == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "response or control matrix missing");
+        return(-1);
+    }
+    n = data.image[IDrm].md[0].size[0]*data.image[IDrm].md[0].size[1];
+    m = data.image[IDrm].md[0].size[2];
+    if(data.image[IDcm].md[0].nelement != m*n)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "response and control matrix sizes do not match");
+        return(-1);
+    }
+
+    cmq8 = (int8_t*) malloc(sizeof(int8_t)*m*n);
+    cmbf16 = (uint16_t*) malloc(sizeof(uint16_t)*m*n);
+    q8scale = (float*) malloc(sizeof(float)*m);
+    outF = (float*) malloc(sizeof(float)*m);
+    outQ8 = (float*) malloc(sizeof(float)*m);
+    outBF16 = (float*) malloc(sizeof(float)*m);
+
+    AOloopControl_CMquantize_INT8(data.image[IDcm].array.F, m, n, cmq8, q8scale);
+    AOloopControl_CMquantize_BF16(data.image[IDcm].array.F, m, n, cmbf16);
+
+    if((fp = fopen(fname, "w")) == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create precision report file");
+        fp = stdout;
+    }
+    fprintf(fp, "# control matrix reduced precision accuracy, test vector = response of mode k\n");
+    fprintf(fp, "# col 1: mode index\n");
+    fprintf(fp, "# col 2: RMS FP32 result\n");
+    fprintf(fp, "# col 3: BF16 relative RMS error\n");
+    fprintf(fp, "# col 4: INT8 relative RMS error\n");
+    fprintf(fp, "# col 5: INT8 scale\n");
+
+    for(k=0; k<m; k++)
+    {
+        float *vect = data.image[IDrm].array.F + k*n;
+        double ref = 0.0;
+        double errQ8 = 0.0;
+        double errBF16 = 0.0;
+
+        ControlMatrixMultiply(data.image[IDcm].array.F, vect, m, n, outF);
+        ControlMatrixMultiply_INT8(cmq8, q8scale, vect, m, n, outQ8);
+        ControlMatrixMultiply_BF16(cmbf16, vect, m, n, outBF16);
+
+        for(kk=0; kk<m; kk++)
+        {
+            ref += outF[kk]*outF[kk];
+            errQ8 += (outQ8[kk]-outF[kk])*(outQ8[kk]-outF[kk]);
+            errBF16 += (outBF16[kk]-outF[kk])*(outBF16[kk]-outF[kk]);
+        }
+        reftot += ref;
+        errQ8tot += errQ8;
+        errBF16tot += errBF16;
+
+        if(ref > 0.0)
+            fprintf(fp, "%5ld  %12g  %12g  %12g  %12g\n", k, sqrt(ref/m), sqrt(errBF16/ref), sqrt(errQ8/ref), q8scale[k]);
+        else
+            fprintf(fp, "%5ld  %12g  %12g  %12g  %12g\n", k, 0.0, 0.0, 0.0, q8scale[k]);
+    }
+
+    if(reftot > 0.0)
+    {
+        fprintf(fp, "# TOTAL   BF16 %g   INT8 %g\n", sqrt(errBF16tot/reftot), sqrt(errQ8tot/reftot));
+        printf("CM PRECISION   relative RMS error   BF16 %g   INT8 %g\n", sqrt(errBF16tot/reftot), sqrt(errQ8tot/reftot));
+    }
+    if(fp != stdout)
+        fclose(fp);
+
+    free(cmq8);
+    free(cmbf16);
+    free(q8scale);
+    free(outF);
+    free(outQ8);
+    free(outBF16);
+
+    return(0);
+}
+
+
+
 /** \brief Computes control matrix using SVD
  *
  *        Conventions:
@@ -4594,6 +5323,14 @@ int_fast8_t AOloopControl_computeCalib_compute_ControlMatrix(long loop, long NB_
         {
             save_fits(ID_Cmatrix_name, "!cmat.fits");
 
+            // factorization cache for incremental updates (AOloopControl_computeCalib_update_ControlMatrix)
+            // cmatAinv = diag(CPAcoeff) x inverse(DtraD) x diag(CPAcoeff), so that cmat = cmatAinv x transpose(RM)
+            long IDAinv = create_2Dimage_ID("cmatAinv", m, m);
+            for(ii1=0; ii1<m; ii1++)
+                for(jj1=0; jj1<m; jj1++)
+                    data.image[IDAinv].array.F[jj1*m+ii1] = (float) (CPAcoeff[ii1]*gsl_matrix_get(matrix_DtraDinv, ii1, jj1)*CPAcoeff[jj1]);
+            save_fits("cmatAinv", "!cmat_Ainv.fits");
+
             if(sprintf(command, "echo \"%ld\" > ./cmat.NB_MODES_RM.txt", NBMODES_REMOVED_EIGENVLIM) < 1)
                 printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
@@ -4643,6 +5380,294 @@ int_fast8_t AOloopControl_computeCalib_compute_ControlMatrix(long loop, long NB_
 
 
 
+//
+// Incremental update of control matrix computed by AOloopControl_computeCalib_compute_ControlMatrix
+//
+// Uses the cached factorization Ainv (cmat_Ainv.fits), such that CM = Ainv x transpose(RM):
+//
+// WFS pixels removed (pixel mask = 0), rank-k downdate of transpose(RM) x RM (Woodbury):
+//   P = CM[:, pix]   Dr = RM[pix, :]   S = I - Dr x P
+//   CM  <- CM0 + P x inv(S) x (Dr x CM0)      (CM0 : CM with columns pix zeroed)
+//   Ainv <- Ainv + P x inv(S) x transpose(P)
+//
+// Modes removed (mode mask = 0), block elimination from Ainv:
+//   CM[K,:]  <- CM[K,:] - Ainv[K,J] x inv(Ainv[J,J]) x CM[J,:]
+//   Ainv[K,K] <- Ainv[K,K] - Ainv[K,J] x inv(Ainv[J,J]) x Ainv[J,K]
+//   CM[J,:], RM modes J, Ainv rows/cols J set to 0 (matrix sizes unchanged)
+//
+// RM, CM and Ainv are updated in place, so that updates can be chained.
+// Exact if no eigenmode was truncated in compute_ControlMatrix, otherwise first order in the truncated space.
+// validate = 1 : compare to direct product Ainv x transpose(RM) after update
+//
+long AOloopControl_computeCalib_update_ControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *IDAinv_name, const char *IDpixmask_name, const char *IDmodemask_name, int validate)
+{
+    long ID_Rmatrix, ID_Cmatrix, IDAinv, IDpixmask, IDmodemask;
+    long m, n;
+    long ii, kk, j;
+    long *pixlist;
+    long *modelist;
+    long NBpix = 0;
+    long NBmode = 0;
+    float *RM, *CM, *Ainv;
+
+
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    ID_Cmatrix = image_ID(ID_Cmatrix_name);
+    IDAinv = image_ID(IDAinv_name);
+    if((ID_Rmatrix == -1)||(ID_Cmatrix == -1)||(IDAinv == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "RM, CM or Ainv missing");
+        return(-1);
+    }
+
+    n = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+    m = data.image[ID_Rmatrix].md[0].size[2];
+
+    if((data.image[ID_Cmatrix].md[0].nelement != n*m)||(data.image[IDAinv].md[0].nelement != m*m))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "RM, CM and Ainv sizes do not match");
+        return(-1);
+    }
+    RM = data.image[ID_Rmatrix].array.F;
+    CM = data.image[ID_Cmatrix].array.F;
+    Ainv = data.image[IDAinv].array.F;
+
+    pixlist = (long*) malloc(sizeof(long)*n);
+    modelist = (long*) malloc(sizeof(long)*m);
+
+    // pixels to remove : masked, and still active in CM
+    IDpixmask = image_ID(IDpixmask_name);
+    if(IDpixmask != -1)
+    {
+        if(data.image[IDpixmask].md[0].nelement != n)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "pixel mask size does not match RM");
+            free(pixlist);
+            free(modelist);
+            return(-1);
+        }
+        for(ii=0; ii<n; ii++)
+            if(data.image[IDpixmask].array.F[ii] < 0.5)
+            {
+                int active = 0;
+
+                for(kk=0; kk<m; kk++)
+                    if((CM[kk*n+ii] != 0.0)||(RM[kk*n+ii] != 0.0))
+                    {
+                        active = 1;
+                        break;
+                    }
+                if(active == 1)
+                    pixlist[NBpix++] = ii;
+            }
+    }
+
+    IDmodemask = image_ID(IDmodemask_name);
+    if(IDmodemask != -1)
+    {
+        if(data.image[IDmodemask].md[0].nelement != m)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "mode mask size does not match RM");
+            free(pixlist);
+            free(modelist);
+            return(-1);
+        }
+        for(kk=0; kk<m; kk++)
+            if((data.image[IDmodemask].array.F[kk] < 0.5)&&(Ainv[kk*m+kk] != 0.0))
+                modelist[NBmode++] = kk;
+    }
+
+    printf("CM update : %ld pixels, %ld modes removed  (m = %ld, n = %ld)\n", NBpix, NBmode, m, n);
+    fflush(stdout);
+
+
+    if(NBpix > 0)
+    {
+        long k = NBpix;
+        double *P = (double*) malloc(sizeof(double)*m*k);    // m x k
+        double *S = (double*) malloc(sizeof(double)*k*k);    // k x k
+        float *Dr = (float*) malloc(sizeof(float)*k*m);      // k x m
+        float *T = (float*) malloc(sizeof(float)*k*n);       // k x n
+        float *W = (float*) malloc(sizeof(float)*m*k);       // m x k
+
+        for(kk=0; kk<m; kk++)
+            for(j=0; j<k; j++)
+            {
+                P[kk*k+j] = CM[kk*n+pixlist[j]];
+                Dr[j*m+kk] = RM[kk*n+pixlist[j]];
+            }
+
+        // S = I - Dr x P
+        for(j=0; j<k; j++)
+        {
+            long j1;
+
+            for(j1=0; j1<k; j1++)
+            {
+                double val = (j==j1) ? 1.0 : 0.0;
+
+                for(kk=0; kk<m; kk++)
+                    val -= Dr[j*m+kk]*P[kk*k+j1];
+                S[j*k+j1] = val;
+            }
+        }
+        if(AOloopControl_computeCalib_invert_matrix_double(S, k) != 0)
+        {
+            printf("ERROR: removing pixels makes response matrix rank-deficient - full recompute required\n");
+            free(P);
+            free(S);
+            free(Dr);
+            free(T);
+            free(W);
+            free(pixlist);
+            free(modelist);
+            return(-1);
+        }
+
+        // W = P x inv(S)
+        for(kk=0; kk<m; kk++)
+            for(j=0; j<k; j++)
+            {
+                long j1;
+                double val = 0.0;
+
+                for(j1=0; j1<k; j1++)
+                    val += P[kk*k+j1]*S[j1*k+j];
+                W[kk*k+j] = (float) val;
+            }
+
+        // remove pixels from RM and CM
+        for(kk=0; kk<m; kk++)
+            for(j=0; j<k; j++)
+            {
+                CM[kk*n+pixlist[j]] = 0.0;
+                RM[kk*n+pixlist[j]] = 0.0;
+            }
+
+        // CM += W x (Dr x CM0)
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, k, n, m, 1.0, Dr, m, CM, n, 0.0, T, n);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0, W, k, T, n, 1.0, CM, n);
+
+        // Ainv += W x transpose(P)
+# ifdef _OPENMP
+        #pragma omp parallel for private(j)
+# endif
+        for(kk=0; kk<m; kk++)
+        {
+            long kk1;
+
+            for(kk1=0; kk1<m; kk1++)
+            {
+                double val = 0.0;
+
+                for(j=0; j<k; j++)
+                    val += W[kk*k+j]*P[kk1*k+j];
+                Ainv[kk*m+kk1] += (float) val;
+            }
+        }
+
+        free(P);
+        free(S);
+        free(Dr);
+        free(T);
+        free(W);
+    }
+
+
+    if(NBmode > 0)
+    {
+        long k = NBmode;
+        double *AJJ = (double*) malloc(sizeof(double)*k*k);
+        float *B = (float*) malloc(sizeof(float)*m*k);     // Ainv[:,J] x inv(Ainv[J,J])
+        float *CJ = (float*) malloc(sizeof(float)*k*n);
+        float *AJ = (float*) malloc(sizeof(float)*k*m);
+
+        for(j=0; j<k; j++)
+        {
+            long j1;
+
+            for(j1=0; j1<k; j1++)
+                AJJ[j*k+j1] = Ainv[modelist[j]*m+modelist[j1]];
+        }
+        if(AOloopControl_computeCalib_invert_matrix_double(AJJ, k) != 0)
+        {
+            printf("ERROR: cannot invert Ainv sub-matrix - full recompute required\n");
+            free(AJJ);
+            free(B);
+            free(CJ);
+            free(AJ);
+            free(pixlist);
+            free(modelist);
+            return(-1);
+        }
+
+        for(kk=0; kk<m; kk++)
+            for(j=0; j<k; j++)
+            {
+                long j1;
+                double val = 0.0;
+
+                for(j1=0; j1<k; j1++)
+                    val += Ainv[kk*m+modelist[j1]]*AJJ[j1*k+j];
+                B[kk*k+j] = (float) val;
+            }
+
+        for(j=0; j<k; j++)
+        {
+            memcpy(CJ + j*n, CM + modelist[j]*n, sizeof(float)*n);
+            memcpy(AJ + j*m, Ainv + modelist[j]*m, sizeof(float)*m);
+        }
+
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, -1.0, B, k, CJ, n, 1.0, CM, n);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, m, k, -1.0, B, k, AJ, m, 1.0, Ainv, m);
+
+        for(j=0; j<k; j++)
+        {
+            memset(CM + modelist[j]*n, 0, sizeof(float)*n);
+            memset(RM + modelist[j]*n, 0, sizeof(float)*n);
+            for(kk=0; kk<m; kk++)
+            {
+                Ainv[modelist[j]*m+kk] = 0.0;
+                Ainv[kk*m+modelist[j]] = 0.0;
+            }
+        }
+
+        free(AJJ);
+        free(B);
+        free(CJ);
+        free(AJ);
+    }
+
+
+    if(validate == 1)
+    {
+        float *CMcheck = (float*) malloc(sizeof(float)*m*n);
+        double errmax = 0.0;
+        double vmax = 0.0;
+
+        // Ainv x transpose(RM), RM stored as m x n row-major
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, m, 1.0, Ainv, m, RM, n, 0.0, CMcheck, n);
+        for(ii=0; ii<m*n; ii++)
+        {
+            if(fabs(CMcheck[ii]-CM[ii]) > errmax)
+                errmax = fabs(CMcheck[ii]-CM[ii]);
+            if(fabs(CMcheck[ii]) > vmax)
+                vmax = fabs(CMcheck[ii]);
+        }
+        printf("CM update validation : max abs deviation = %g  (relative %g)\n", errmax, (vmax > 0.0) ? errmax/vmax : 0.0);
+        free(CMcheck);
+    }
+
+    free(pixlist);
+    free(modelist);
+
+    return(ID_Cmatrix);
+}
+
+
+
+
+
 //
 // computes combined control matrix
 //
@@ -4723,48 +5748,17 @@ long AOloopControl_computeCalib_compute_CombinedControlMatrix(const char *IDcmat
     free(sizearray);
 
 
-    printf("PREPARE MATRIX MULT\n");
-    fflush(stdout);
-
-
-
-    // init matrix_Mc
-    matrix_Mc = (float*) malloc(sizeof(float)*sizeWFS*sizeDM);
-    memcpy(matrix_Mc, data.image[IDcmatc].array.F, sizeof(float)*sizeWFS*sizeDM);
-
-    // copy modal control matrix to matrix_cmp
-    IDcmat = image_ID(IDcmat_name);
-    matrix_cmp = (float*) malloc(sizeof(float)*sizeWFS*NBDMmodes);
-    memcpy(matrix_cmp, data.image[IDcmat].array.F, sizeof(float)*sizeWFS*NBDMmodes);
-
-    // copy modes matrix to matrix_DMmodes
-    matrix_DMmodes = (float*) malloc(sizeof(float)*NBDMmodes*sizeDM);
-    memcpy(matrix_DMmodes, data.image[IDmodes].array.F, sizeof(float)*NBDMmodes*sizeDM);
-
     printf("START MATRIX MULT\n");
     fflush(stdout);
 
+    IDcmat = image_ID(IDcmat_name);
+    matrix_cmp = data.image[IDcmat].array.F;
+    matrix_DMmodes = data.image[IDmodes].array.F;
+    matrix_Mc = data.image[IDcmatc].array.F;
 
-
-    // computing combine matrix (full size)
-    //# ifdef _OPENMP
-    //   #pragma omp parallel shared(matrix_Mc, matrix_cmp, matrix_DMmodes ,chunk) private( mode, act, wfselem)
-    //  {
-    //        #pragma omp for schedule (static)
-    //# endif
-    for(mode=0; mode<NBDMmodes; mode++)
-    {
-        for(act=0; act<sizeDM; act++)
-        {
-            for(wfselem=0; wfselem<sizeWFS; wfselem++)
-                matrix_Mc[act*sizeWFS+wfselem] += matrix_cmp[mode*sizeWFS+wfselem]*matrix_DMmodes[mode*sizeDM+act];
-        }
-    }
-    //# ifdef _OPENMP
-    //    }
-    //# endif
-    memcpy(data.image[IDcmatc].array.F, matrix_Mc, sizeof(float)*sizeWFS*sizeDM);
-    free(matrix_cmp);
+    // computing combine matrix (full size), written directly into IDcmatc
+    // Mc [sizeDM x sizeWFS] = transpose(DMmodes) [sizeDM x NBDMmodes] x cmat [NBDMmodes x sizeWFS]   (row-major)
+    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, sizeDM, sizeWFS, NBDMmodes, 1.0, matrix_DMmodes, sizeDM, matrix_cmp, sizeWFS, 0.0, matrix_Mc, sizeWFS);
 
     printf("REDUCE MATRIX SIZE\n");
     fflush(stdout);
@@ -4838,24 +5832,42 @@ long AOloopControl_computeCalib_compute_CombinedControlMatrix(const char *IDcmat
         if(sprintf(imname, "%s_%02d", IDcmatc_active_name, slice) < 1)
             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-        IDcmatc_active[slice] = create_2Dimage_ID(imname, sizeWFS_active[slice], sizeDM_active);
-        for(act_active=0; act_active<sizeDM_active; act_active++)
+        // write in place if matrix already exists with same size (e.g. shared memory stream used by loop)
+        IDcmatc_active[slice] = image_ID(imname);
+        if(IDcmatc_active[slice] != -1)
+            if((data.image[IDcmatc_active[slice]].md[0].naxis != 2)||(data.image[IDcmatc_active[slice]].md[0].atype != _DATATYPE_FLOAT)||(data.image[IDcmatc_active[slice]].md[0].size[0] != sizeWFS_active[slice])||(data.image[IDcmatc_active[slice]].md[0].size[1] != sizeDM_active))
+            {
+                delete_image_ID(imname);
+                IDcmatc_active[slice] = -1;
+            }
+        if(IDcmatc_active[slice] == -1)
+            IDcmatc_active[slice] = create_2Dimage_ID(imname, sizeWFS_active[slice], sizeDM_active);
+
+        data.image[IDcmatc_active[slice]].md[0].write = 1;
         {
-            for(wfselem_active=0; wfselem_active<sizeWFS_active[slice]; wfselem_active++)
+            float *outF = data.image[IDcmatc_active[slice]].array.F;
+            long NBwfsact = sizeWFS_active[slice];
+            const int *wfsmap = WFS_active_map + slice*sizeWFS;
+
+# ifdef _OPENMP
+            #pragma omp parallel for private(wfselem_active)
+# endif
+            for(act_active=0; act_active<sizeDM_active; act_active++)
             {
-                act = DM_active_map[act_active];
-                wfselem = WFS_active_map[slice*sizeWFS+wfselem_active];
-                data.image[IDcmatc_active[slice]].array.F[act_active*sizeWFS_active[slice]+wfselem_active] = matrix_Mc[act*sizeWFS+wfselem];
+                const float *Mcrow = matrix_Mc + DM_active_map[act_active]*sizeWFS;
+
+                for(wfselem_active=0; wfselem_active<NBwfsact; wfselem_active++)
+                    outF[act_active*NBwfsact+wfselem_active] = Mcrow[wfsmap[wfselem_active]];
             }
         }
+        COREMOD_MEMORY_image_set_sempost_byID(IDcmatc_active[slice], -1);
+        data.image[IDcmatc_active[slice]].md[0].cnt0++;
+        data.image[IDcmatc_active[slice]].md[0].write = 0;
         printf("PIXEL SLICE %d     Keeping only active pixels / actuators : %ld x %ld   ->   %ld x %ld\n", slice, sizeWFS, sizeDM, sizeWFS_active[slice], sizeDM_active);
 
 
     }
 
-    free(matrix_Mc);
-    free(matrix_DMmodes);
-
 
 
     clock_gettime(CLOCK_REALTIME, &t2);
@@ -40,6 +40,12 @@ long AOloopControl_computeCalib_mkHadamardModes(const char *DMmask_name, const c
 
 long AOloopControl_computeCalib_Hadamard_decodeRM(const char *inname, const char *Hmatname, const char *indexname, const char *outname);
 
+/** @brief Multiplexed random +/-1 poke sequence over active actuators */
+long AOloopControl_computeCalib_mkRandomPokeModes(const char *DMmask_name, long NBpoke, const char *outname);
+
+/** @brief Least-squares decode of RM acquired with multiplexed poke sequence */
+long AOloopControl_computeCalib_RandomPoke_decodeRM(const char *inname, const char *pokename, const char *DMmask_name, const char *outname);
+
 
 long AOloopControl_computeCalib_mkloDMmodes(const char *ID_name, long msizex, long msizey, float CPAmax, float deltaCPA, double xc, double yc, double r0, double r1, int MaskMode);
 
@@ -77,6 +83,14 @@ long AOloopControl_computeCalib_mkModes_Simple(const char *IDin_name, long NBmbl
 int_fast8_t AOloopControl_computeCalib_compute_ControlMatrix(long loop, long NB_MODE_REMOVED, const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *ID_VTmatrix_name, double Beta, long NB_MODE_REMOVED_STEP, float eigenvlim);
 
 
+/** @brief Incremental CM update for removed WFS pixels / modes using cached factorization (cmat_Ainv.fits) */
+long AOloopControl_computeCalib_update_ControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *IDAinv_name, const char *IDpixmask_name, const char *IDmodemask_name, int validate);
+
+
+/** @brief Reports control matrix accuracy in reduced precision (BF16, INT8) relative to FP32 */
+int_fast8_t AOloopControl_computeCalib_CMprecision_report(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, const char *fname);
+
+
 long AOloopControl_computeCalib_compute_CombinedControlMatrix(const char *IDcmat_name, const char *IDmodes_name, const char* IDwfsmask_name, const char *IDdmmask_name, const char *IDcmatc_name, const char *IDcmatc_active_name);
 
 
@@ -35,6 +35,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sched.h>
 #include <pthread.h>
 
 #ifdef __MACH__
@@ -61,6 +63,7 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 
 
 #include <fitsio.h>
+#include <gsl/gsl_cblas.h>
 
 #include "CLIcore.h"
 #include "00CORE/00CORE.h"
@@ -91,6 +94,9 @@ int clock_gettime(int clk_id, struct mach_timespec *t) {
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define PERFTEST_BENCHMARK_FORMAT 1   // benchmark JSON report format version
+#define PERFTEST_BENCHMARK_NBBIN 50   // latency histogram bins
+
 
 
 
@@ -190,6 +196,15 @@ int_fast8_t AOcontrolLoop_perfTest_TestSystemLatency_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_perfTest_benchmark */
+int_fast8_t AOloopControl_perfTest_benchmark_cli() {
+    if(CLI_checkarg(1,5)+CLI_checkarg(2,5)+CLI_checkarg(3,5)+CLI_checkarg(4,1)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,2)+CLI_checkarg(8,2)+CLI_checkarg(9,3)==0) {
+        AOloopControl_perfTest_benchmark(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numl, data.cmdargtoken[8].val.numl, data.cmdargtoken[9].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_TestDMmodeResp */
 int_fast8_t AOloopControl_perfTest_TestDMmodeResp_cli() {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,1)+CLI_checkarg(4,1)+CLI_checkarg(5,1)+CLI_checkarg(6,1)+CLI_checkarg(7,1)+CLI_checkarg(8,2)+CLI_checkarg(9,4)+CLI_checkarg(10,4)+CLI_checkarg(11,4)+CLI_checkarg(12,3)==0) {
@@ -208,6 +223,15 @@ int_fast8_t AOloopControl_perfTest_TestDMmodes_Recovery_cli() {
     else return 1;
 }
 
+/** @brief CLI function for AOloopControl_TestDMmodes_FreqMux */
+int_fast8_t AOloopControl_perfTest_TestDMmodes_FreqMux_cli() {
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,1)+CLI_checkarg(3,4)+CLI_checkarg(4,4)+CLI_checkarg(5,4)+CLI_checkarg(6,2)+CLI_checkarg(7,2)+CLI_checkarg(8,2)+CLI_checkarg(9,3)+CLI_checkarg(10,3)==0) {
+        AOloopControl_perfTest_TestDMmodes_FreqMux(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.string, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numl, data.cmdargtoken[8].val.numl, data.cmdargtoken[9].val.string, data.cmdargtoken[10].val.string);
+        return 0;
+    }
+    else return 1;
+}
+
 /** @brief CLI function for AOloopControl_blockstats */
 int_fast8_t AOloopControl_perfTest_blockstats_cli() {
     if(CLI_checkarg(1,2)+CLI_checkarg(2,5)==0) {
@@ -319,17 +343,21 @@ int_fast8_t init_AOloopControl_perfTest()
 
     RegisterCLIcommand("aoltestlat", __FILE__, AOcontrolLoop_perfTest_TestSystemLatency_cli, "test system latency", "<dm stream> <wfs stream> <ampl [um]> <NBiter>", "aoltestlat dmC wfsim 0.1 5000", "long AOcontrolLoop_perfTest_TestSystemLatency(char *dmname, char *wfsname, float OPDamp, long NBiter)");
 
+    RegisterCLIcommand("aolbenchmark", __FILE__, AOloopControl_perfTest_benchmark_cli, "latency benchmark suite, JSON report", "<DM channel (none to skip)> <DM combined stream (none to skip)> <WFS stream (none to skip)> <ampl [um]> <NB latency iter> <NB microbenchmark iter> <MVM NB rows> <MVM NB cols> <output JSON>", "aolbenchmark dm00disp03 dm00disp wfsim 0.1 100 10000 2000 8000 bench.json", "long AOloopControl_perfTest_benchmark(const char *dmchname, const char *dmdispname, const char *wfsname, float OPDamp, long NBlatiter, long NBiter, long mvmNBrow, long mvmNBcol, const char *foutname)");
+
     RegisterCLIcommand("aoltestmresp", __FILE__, AOloopControl_perfTest_TestDMmodeResp_cli, "Measure system response for a single mode", "<DM modes [3D im]> <mode #> <ampl [um]> <fmin [Hz]> <fmax [Hz]> <fstep> <meas. time [sec]> <time step [us]> <DM mask> <DM in [2D stream]> <DM out [2D stream]>  <output [2D im]>", "aoltestmresp DMmodesC 5 0.05 10.0 100.0 1.2 1.0 1000 dmmask dmdisp3 dmC out", "long AOloopControl_perfTest_TestDMmodeResp(char *DMmodes_name, long index, float ampl, float fmin, float fmax, float fmultstep, float avetime, long dtus, char *DMmask_name, char *DMstream_in_name, char *DMstream_out_name, char *IDout_name)");
 
     RegisterCLIcommand("aoltestdmrec", __FILE__, AOloopControl_perfTest_TestDMmodes_Recovery_cli, "Test system DM modes recovery", "<DM modes [3D im]> <ampl [um]> <DM mask [2D im]> <DM in [2D stream]> <DM out [2D stream]> <meas out [2D stream]> <lag time [us]>  <NB averages [long]>  <out ave [2D im]> <out rms [2D im]> <out meas ave [2D im]> <out meas rms [2D im]>", "aoltestdmrec DMmodesC 0.05 DMmask dmsisp2 dmoutr 2000  20 outave outrms outmave outmrms", "long AOloopControl_perfTest_TestDMmodes_Recovery(char *DMmodes_name, float ampl, char *DMmask_name, char *DMstream_in_name, char *DMstream_out_name, char *DMstream_meas_name, long tlagus, long NBave, char *IDout_name, char *IDoutrms_name, char *IDoutmeas_name, char *IDoutmeasrms_name)");
 
+    RegisterCLIcommand("aoltestdmfmux", __FILE__, AOloopControl_perfTest_TestDMmodes_FreqMux_cli, "frequency-multiplexed DM modes response (all modes at once, distinct frequencies)", "<DM modes [3D im]> <ampl [um]> <DM mask [2D im]> <DM in [2D stream]> <DM out [2D stream]> <period [frame]> <NB periods> <NB runs> <out resp [3D im]> <out file>", "aoltestdmfmux DMmodesC 0.01 DMmask dmdisp2 dmoutr 256 8 4 outresp mresp.txt", "long AOloopControl_perfTest_TestDMmodes_FreqMux(const char *DMmodes_name, float ampl, const char *DMmask_name, const char *DMstream_in_name, const char *DMstream_out_name, long NBpt, long NBperiod, long NBrot, const char *IDout_name, const char *foutname)");
+
     RegisterCLIcommand("aolresetrms", __FILE__, AOloopControl_perfTest_resetRMSperf, "reset RMS performance monitor", "no arg", "aolresetrms", "int AOloopControl_perfTest_resetRMSperf()");
 
     RegisterCLIcommand("aolinjectmode",__FILE__, AOloopControl_perfTest_InjectMode_cli, "inject single mode error into RM channel", "<index> <ampl>", "aolinjectmode 20 0.1", "int AOloopControl_perfTest_InjectMode()");
 
     RegisterCLIcommand("aolstatusstats", __FILE__, AOloopControl_perfTest_statusStats_cli, "measures distribution of status values", "<update flag [int]>", "aolstatusstats 0", "int AOloopControl_perfTest_statusStats(int updateconf)");
 
-    RegisterCLIcommand("aolmon", __FILE__, AOloopControl_perfTest_loopMonitor_cli, "monitor loop", "<frequ> <Nbcols>", "aolmon 10.0 3", "int AOloopControl_perfTest_loopMonitor(long loop, double frequ)");
+    RegisterCLIcommand("aolmon", __FILE__, AOloopControl_perfTest_loopMonitor_cli, "monitor loop (Nbcols = 0: loop status snapshot only)", "<frequ> <Nbcols>", "aolmon 10.0 3", "int AOloopControl_perfTest_loopMonitor(long loop, double frequ)");
 
     RegisterCLIcommand("aolblockstats", __FILE__, AOloopControl_perfTest_blockstats_cli, "measures mode stats per block", "<loopnb> <outim>", "aolblockstats 2 outstats", "long AOloopControl_perfTest_blockstats(long loop, const char *IDout_name)");
 
@@ -361,6 +389,53 @@ int_fast8_t init_AOloopControl_perfTest()
 
 
 
+/**
+ * @brief Copies latest loop status snapshot
+ *
+ * The snapshot is published by the main loop every statsnapNBframe iterations (AOconf[loop].statsnap).
+ * Copy is retried if the main loop overwrites it while it is being read.
+ *
+ * @param[in]  loop  loop index
+ * @param[out] snap  snapshot copy
+ *
+ * @return 0 if snapshot copied, -1 if no snapshot available
+ */
+int_fast8_t AOloopControl_perfTest_statsnap_read(long loop, AOLOOPCONTROL_STATUSSNAP *snap)
+{
+    int iter;
+
+
+    if(AOconf[loop].statsnapcnt == 0)
+        return(-1);
+
+    for(iter=0; iter<100; iter++)
+    {
+        int index = AOconf[loop].statsnapindex;
+        uint64_t seq0 = AOconf[loop].statsnap[index].seq;
+
+        if((seq0 & 1) == 0)
+        {
+            __sync_synchronize();
+            memcpy(snap, (void*) &AOconf[loop].statsnap[index], sizeof(AOLOOPCONTROL_STATUSSNAP));
+            __sync_synchronize();
+            if(AOconf[loop].statsnap[index].seq == seq0)
+                return(0);
+        }
+        usleep(10);
+    }
+
+    return(-1);
+}
+
+
+
+
+/**
+ * @brief Prints loop status
+ *
+ * Loop state, timing and block statistics are read from the status snapshot published by the main loop.
+ * Individual mode values are read from streams only if nbcol > 0.
+ */
 int_fast8_t AOloopControl_perfTest_printloopstatus(long loop, long nbcol, long IDmodeval_dm, long IDmodeval, long IDmodevalave, long IDmodevalrms, long ksize)
 {
     long k, kmin, kmax;
@@ -371,113 +446,102 @@ int_fast8_t AOloopControl_perfTest_printloopstatus(long loop, long nbcol, long I
     char imname[200];
 
     long IDblknb;
+    AOLOOPCONTROL_STATUSSNAP snap;
 
 
     printw("    loop number %ld    ", loop);
 
+    if(AOloopControl_perfTest_statsnap_read(loop, &snap) == -1)
+    {
+        printw("no status snapshot (loop not started, or statsnapNBframe = 0)\n");
+        return(0);
+    }
 
-    if(AOconf[loop].on == 1)
+    if(snap.on == 1)
         printw("loop is ON     ");
     else
         printw("loop is OFF    ");
 
-    /*  if(AOconf[loop].logon == 1)
-          printw("log is ON   ");
-      else
-          printw("log is OFF  ");
-
-    */
-
-
-    if(sprintf(imname, "aol%ld_mode_blknb", loop) < 1) // block indices
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-    IDblknb = image_ID(imname);
-
-    if(IDblknb==-1)
-        IDblknb = read_sharedmem_image(imname);
-
-
-
-    if(aoconfID_LIMIT_modes == -1)
-    {
-        if(sprintf(imname, "aol%ld_DMmode_LIMIT", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-        aoconfID_LIMIT_modes = read_sharedmem_image(imname);
-    }
-
+    printw("   SNAPSHOT = %llu (%ld frames)  ", (unsigned long long) AOconf[loop].statsnapcnt, snap.NBframe);
 
-    printw("   STATUS = %3d  ", AOconf[loop].status);
-
-    kmax = (wrow-28)*(nbcol);
-
-	printw("IMAGE TOTAL = %10f\n", AOconf[loop].WFStotalflux);
-    printw("    Gain = %5.3f   maxlim = %5.3f     GPU = %d    kmax=%ld\n", AOconf[loop].gain, AOconf[loop].maxlimit, AOconf[loop].GPU0, kmax);
-    printw("    DMprimWrite = %d   Predictive control state: %d        ARPF gain = %5.3f   AUTOTUNE LIM = %d (perc = %.2f %%  delta = %.3f nm mcoeff=%4.2f) GAIN = %d\n", AOconf[loop].DMprimaryWriteON, AOconf[loop].ARPFon, AOconf[loop].ARPFgain, AOconf[loop].AUTOTUNE_LIMITS_ON, AOconf[loop].AUTOTUNE_LIMITS_perc, 1000.0*AOconf[loop].AUTOTUNE_LIMITS_delta, AOconf[loop].AUTOTUNE_LIMITS_mcoeff, AOconf[loop].AUTOTUNE_GAINS_ON);
-    printw(" TIMIMNG :  lfr = %9.3f Hz    hw lat = %5.3f fr   comp lat = %5.3f fr  wfs extr lat = %5.3f fr\n", AOconf[loop].loopfrequ, AOconf[loop].hardwlatency_frame, AOconf[loop].complatency_frame, AOconf[loop].wfsmextrlatency_frame);
-//    nbl++;
-//    nbl++;
-//    nbl++;
-    printw("loop iteration CNT : %lld\n", AOconf[loop].cnt);
-//    nbl++;
+    printw("IMAGE TOTAL = %10f\n", snap.WFStotalflux);
+    printw("    Gain = %5.3f   maxlim = %5.3f     GPU = %d\n", snap.gain, snap.maxlimit, AOconf[loop].GPU0);
+    printw("    DMprimWrite = %d   Predictive control state: %d        ARPF gain = %5.3f   AUTOTUNE LIM = %d (perc = %.2f %%  delta = %.3f nm mcoeff=%4.2f) GAIN = %d\n", AOconf[loop].DMprimaryWriteON, snap.ARPFon, AOconf[loop].ARPFgain, AOconf[loop].AUTOTUNE_LIMITS_ON, AOconf[loop].AUTOTUNE_LIMITS_perc, 1000.0*AOconf[loop].AUTOTUNE_LIMITS_delta, AOconf[loop].AUTOTUNE_LIMITS_mcoeff, AOconf[loop].AUTOTUNE_GAINS_ON);
+    printw(" TIMIMNG :  lfr = %9.3f Hz    hw lat = %5.3f fr   comp lat = %5.3f fr  wfs extr lat = %5.3f fr\n", snap.loopfrequ, snap.hardwlatency_frame, snap.complatency_frame, snap.wfsmextrlatency_frame);
+    printw(" STAGES [us] : wait %7.1f  read %6.1f  dark %6.1f  norm %6.1f  MVM %6.1f  modefilt %6.1f  DMwrite %6.1f  | iter %7.1f  max %7.1f\n",
+           snap.stageus[AOLTIMING_WAIT], snap.stageus[AOLTIMING_READ], snap.stageus[AOLTIMING_DARK], snap.stageus[AOLTIMING_NORM],
+           snap.stageus[AOLTIMING_MVM], snap.stageus[AOLTIMING_MODEFILT], snap.stageus[AOLTIMING_DMWRITE], snap.iterus, snap.iterusmax);
+    printw("loop iteration CNT : %llu\n", (unsigned long long) snap.loopcnt);
 
     printw("\n");
-//    nbl++;
 
-    printw("=========== %6ld modes, %3ld blocks ================|------------ Telemetry [nm] ----------------|    |     LIMITS         |\n", AOconf[loop].NBDMmodes, AOconf[loop].DMmodesNBblock);
-//    nbl++;
+    printw("=========== %6ld modes, %3ld blocks ================|------------ Telemetry [nm] ----------------|    |     LIMITS         |\n", snap.NBDMmodes, snap.DMmodesNBblock);
     printw("BLOCK  #modes [ min - max ]    gain   limit   multf  |       dmC     Input  ->       WFS   Ratio  |    | hits/step    perc  |\n");
-//    nbl++;
     printw("\n");
-//    nbl++;
 
-    for(k=0; k<AOconf[loop].DMmodesNBblock; k++)
+    for(k=0; k<snap.DMmodesNBblock; k++)
     {
         if(k==0)
             kmin = 0;
         else
-            kmin = AOconf[loop].indexmaxMB[k-1];
+            kmin = snap.indexmaxMB[k-1];
 
         attron(A_BOLD);
         printw("%3ld", k);
         attroff(A_BOLD);
 
-        printw("    %4ld [ %4ld - %4ld ]   %5.3f  %7.5f  %5.3f", AOconf[loop].NBmodes_block[k], kmin, AOconf[loop].indexmaxMB[k]-1, data.image[aoconfID_gainb].array.F[k], data.image[aoconfID_limitb].array.F[k], data.image[aoconfID_multfb].array.F[k]);
-        printw("  |  %8.2f  %8.2f  ->  %8.2f", 1000.0*AOconf[loop].blockave_Crms[k], 1000.0*AOconf[loop].blockave_OLrms[k], 1000.0*AOconf[loop].blockave_WFSrms[k]);
+        printw("    %4ld [ %4ld - %4ld ]   %5.3f  %7.5f  %5.3f", snap.NBmodes_block[k], kmin, snap.indexmaxMB[k]-1, snap.gainb[k], snap.limitb[k], snap.multfb[k]);
+        printw("  |  %8.2f  %8.2f  ->  %8.2f", 1000.0*snap.blockave_Crms[k], 1000.0*snap.blockave_OLrms[k], 1000.0*snap.blockave_WFSrms[k]);
 
         attron(A_BOLD);
-        printw("   %5.3f  ", AOconf[loop].blockave_WFSrms[k]/AOconf[loop].blockave_OLrms[k]);
+        printw("   %5.3f  ", snap.blockave_WFSrms[k]/snap.blockave_OLrms[k]);
         attroff(A_BOLD);
 
-        if( AOconf[loop].blockave_limFrac[k] > 0.01 )
+        if( snap.blockave_limFrac[k] > 0.01 )
             attron(A_BOLD | COLOR_PAIR(2));
 
-        printw("| %2ld | %9.3f  %6.2f\% |\n", k, AOconf[loop].blockave_limFrac[k],  100.0*AOconf[loop].blockave_limFrac[k]/AOconf[loop].NBmodes_block[k]);
+        printw("| %2ld | %9.3f  %6.2f%% |\n", k, snap.blockave_limFrac[k],  100.0*snap.blockave_limFrac[k]/snap.NBmodes_block[k]);
         attroff(A_BOLD | COLOR_PAIR(2));
-
-//        nbl++;
     }
 
 
     printw("\n");
-//    nbl++;
 
-    printw(" ALL   %4ld                                        ", AOconf[loop].NBDMmodes);
-    printw("  |  %8.2f  %8.2f  ->  %8.2f", 1000.0*AOconf[loop].ALLave_Crms, 1000.0*AOconf[loop].ALLave_OLrms, 1000.0*AOconf[loop].ALLave_WFSrms);
+    printw(" ALL   %4ld                                        ", snap.NBDMmodes);
+    printw("  |  %8.2f  %8.2f  ->  %8.2f", 1000.0*snap.ALLave_Crms, 1000.0*snap.ALLave_OLrms, 1000.0*snap.ALLave_WFSrms);
 
     attron(A_BOLD);
-    printw("   %5.3f  ", AOconf[loop].ALLave_WFSrms/AOconf[loop].ALLave_OLrms);
+    printw("   %5.3f  ", snap.ALLave_WFSrms/snap.ALLave_OLrms);
     attroff(A_BOLD);
 
-    printw("| %2ld | %9.3f  %6.2f\% |\n", k, AOconf[loop].ALLave_limFrac,  100.0*AOconf[loop].ALLave_limFrac/AOconf[loop].NBDMmodes);
+    printw("| %2ld | %9.3f  %6.2f%% |\n", k, snap.ALLave_limFrac,  100.0*snap.ALLave_limFrac/snap.NBDMmodes);
 
     printw("\n");
-//    nbl++;
 
-    //printw("            MODAL RMS (ALL MODES) : %6.4lf     AVERAGE :  %8.6lf       ( %20g / %8lld )\n", sqrt(AOconf[loop].RMSmodes), sqrt(AOconf[loop].RMSmodesCumul/AOconf[loop].RMSmodesCumulcnt), AOconf[loop].RMSmodesCumul, AOconf[loop].RMSmodesCumulcnt);
 
 
+    // individual modes, read from streams
+    if(nbcol < 1)
+        return(0);
+
+    if(sprintf(imname, "aol%ld_mode_blknb", loop) < 1) // block indices
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+    IDblknb = image_ID(imname);
+
+    if(IDblknb==-1)
+        IDblknb = read_sharedmem_image(imname);
+
+    if(aoconfID_LIMIT_modes == -1)
+    {
+        if(sprintf(imname, "aol%ld_DMmode_LIMIT", loop) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+
+        aoconfID_LIMIT_modes = read_sharedmem_image(imname);
+    }
+
+    kmax = (wrow-30)*(nbcol);
+
     print_header(" [ gain 1000xlimit  mult ] MODES [nm]    DM correction -- WFS value -- WFS average -- WFS RMS     ", '-');
  //   nbl++;
 
@@ -566,13 +630,13 @@ int_fast8_t AOloopControl_perfTest_loopMonitor(long loop, double frequ, long nbc
 {
     char name[200];
     // DM mode values
-    long IDmodeval_dm;
+    long IDmodeval_dm = -1;
 
     // WFS modes values
-    long IDmodeval;
-    long ksize;
-    long IDmodevalave;
-    long IDmodevalrms;
+    long IDmodeval = -1;
+    long ksize = 0;
+    long IDmodevalave = -1;
+    long IDmodevalrms = -1;
     char fname[200];
 
 
@@ -582,93 +646,95 @@ int_fast8_t AOloopControl_perfTest_loopMonitor(long loop, double frequ, long nbc
     printf("MEMORY HAS BEEN INITIALIZED\n");
     fflush(stdout);
 
-    // load arrays that are required
-    if(aoconfID_cmd_modes==-1)
+    // mode value streams are only read for individual modes display (nbcol > 0)
+    if(nbcol > 0)
     {
-        if(sprintf(name, "aol%ld_DMmode_cmd", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
-
-        aoconfID_cmd_modes = read_sharedmem_image(name);
-    }
+        // load arrays that are required
+        if(aoconfID_cmd_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_cmd", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_meas_modes==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_meas", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_cmd_modes = read_sharedmem_image(name);
+        }
 
-        aoconfID_meas_modes = read_sharedmem_image(name);
-    }
+        if(aoconfID_meas_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_meas", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
+            aoconfID_meas_modes = read_sharedmem_image(name);
+        }
 
-    if(aoconfID_RMS_modes==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_RMS", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-        aoconfID_RMS_modes = read_sharedmem_image(name);
-    }
+        if(aoconfID_RMS_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_RMS", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_AVE_modes==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_AVE", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_RMS_modes = read_sharedmem_image(name);
+        }
 
-        aoconfID_AVE_modes = read_sharedmem_image(name);
-    }
+        if(aoconfID_AVE_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_AVE", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
+            aoconfID_AVE_modes = read_sharedmem_image(name);
+        }
 
-    // blocks
-    if(aoconfID_gainb == -1)
-    {
-        if(sprintf(name, "aol%ld_gainb", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-        aoconfID_gainb = read_sharedmem_image(name);
-    }
+        // blocks
+        if(aoconfID_gainb == -1)
+        {
+            if(sprintf(name, "aol%ld_gainb", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_multfb == -1)
-    {
-        if(sprintf(name, "aol%ld_multfb", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_gainb = read_sharedmem_image(name);
+        }
 
-        aoconfID_multfb = read_sharedmem_image(name);
-    }
+        if(aoconfID_multfb == -1)
+        {
+            if(sprintf(name, "aol%ld_multfb", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_limitb == -1)
-    {
-        if(sprintf(name, "aol%ld_limitb", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_multfb = read_sharedmem_image(name);
+        }
 
-        aoconfID_limitb = read_sharedmem_image(name);
-    }
+        if(aoconfID_limitb == -1)
+        {
+            if(sprintf(name, "aol%ld_limitb", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
+            aoconfID_limitb = read_sharedmem_image(name);
+        }
 
-    // individual modes
 
-    if(aoconfID_DMmode_GAIN==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_GAIN", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        // individual modes
 
-        aoconfID_DMmode_GAIN = read_sharedmem_image(name);
-    }
+        if(aoconfID_DMmode_GAIN==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_GAIN", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_LIMIT_modes==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_LIMIT", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_DMmode_GAIN = read_sharedmem_image(name);
+        }
 
-        aoconfID_LIMIT_modes = read_sharedmem_image(name);
-    }
+        if(aoconfID_LIMIT_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_LIMIT", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    if(aoconfID_MULTF_modes==-1)
-    {
-        if(sprintf(name, "aol%ld_DMmode_MULTF", loop) < 1)
-            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+            aoconfID_LIMIT_modes = read_sharedmem_image(name);
+        }
 
-        aoconfID_MULTF_modes = read_sharedmem_image(name);
-    }
+        if(aoconfID_MULTF_modes==-1)
+        {
+            if(sprintf(name, "aol%ld_DMmode_MULTF", loop) < 1)
+                printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
+            aoconfID_MULTF_modes = read_sharedmem_image(name);
+        }
 
 
 
@@ -676,32 +742,33 @@ int_fast8_t AOloopControl_perfTest_loopMonitor(long loop, double frequ, long nbc
 
 
 
-    // real-time DM mode value
 
-    if(sprintf(fname, "aol%ld_modeval_dm_now", loop) < 1)
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        // real-time DM mode value
 
-    IDmodeval_dm = read_sharedmem_image(fname);
+        if(sprintf(fname, "aol%ld_modeval_dm_now", loop) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    // real-time WFS mode value
-    if(sprintf(fname, "aol%ld_modeval", loop) < 1)
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        IDmodeval_dm = read_sharedmem_image(fname);
 
-    IDmodeval = read_sharedmem_image(fname);
+        // real-time WFS mode value
+        if(sprintf(fname, "aol%ld_modeval", loop) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    // averaged WFS residual modes, computed by CUDACOMP_extractModesLoop
-    if(sprintf(fname, "aol%ld_modeval_ave", loop) < 1)
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        IDmodeval = read_sharedmem_image(fname);
 
-    IDmodevalave = read_sharedmem_image(fname);
-    ksize = data.image[IDmodevalave].md[0].size[1]; // number of averaging line, each line is 2x averaged of previous line
+        // averaged WFS residual modes, computed by CUDACOMP_extractModesLoop
+        if(sprintf(fname, "aol%ld_modeval_ave", loop) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
-    // averaged WFS residual modes RMS, computed by CUDACOMP_extractModesLoop
-    if(sprintf(fname, "aol%ld_modeval_rms", loop) < 1)
-        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        IDmodevalave = read_sharedmem_image(fname);
+        ksize = data.image[IDmodevalave].md[0].size[1]; // number of averaging line, each line is 2x averaged of previous line
 
-    IDmodevalrms = read_sharedmem_image(fname);
+        // averaged WFS residual modes RMS, computed by CUDACOMP_extractModesLoop
+        if(sprintf(fname, "aol%ld_modeval_rms", loop) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
+        IDmodevalrms = read_sharedmem_image(fname);
+    }
 
 
 
@@ -771,6 +838,10 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
     float loopfrequ_measured, complatency_measured, wfsmextrlatency_measured;
     float complatency_frame_measured, wfsmextrlatency_frame_measured;
 
+    // main loop timing is read from status snapshot if published, instead of sampling main loop status
+    AOLOOPCONTROL_STATUSSNAP snap;
+    int snapOK = 0;
+
 
     FILE *fp;
 
@@ -878,6 +949,12 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
         statusgpucnt2[st] = 0;
     }
 
+    if(AOloopControl_perfTest_statsnap_read(LOOPNUMBER, &snap) == 0)
+    {
+        snapOK = 1;
+        printf("Main loop timing from status snapshot\n");
+    }
+
 
     if(sprintf(imname, "aol%ld_wfsim", LOOPNUMBER) < 1)
         printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
@@ -900,10 +977,13 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
 		int stM;
 		
         usleep((long) (usec0 + usec1*(1.0*k/NBkiter)));
-        st = AOconf[LOOPNUMBER].status;
+        if(snapOK == 0)
+        {
+            st = AOconf[LOOPNUMBER].status;
+            if(st<statusmax)
+                statuscnt[st]++;
+        }
         stM = AOconf[LOOPNUMBER].statusM;
-        if(st<statusmax)
-            statuscnt[st]++;
         if(stM<statusmax)
             statusMcnt[stM]++;
         for(gpu=0; gpu<AOconf[LOOPNUMBER].GPU0; gpu++)
@@ -930,6 +1010,7 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
     printf("Loop freq = %8.2f Hz   -> single interation = %8.3f us\n", 1.0*loopcnt/tdiffv, loopiterus);
     printf("Number of iterations    loop: %10lld   wfs: %lld   dmC : %lld\n", loopcnt, wfsimcnt, dmCcnt);
     printf("MISSED FRAMES = %lld    fraction = %7.4f %%\n", wfsimcnt-loopcnt, 100.0*(wfsimcnt-loopcnt)/wfsimcnt);
+    printf("TORN WFS FRAMES = %llu  (cumulative)\n", (unsigned long long) AOconf[LOOPNUMBER].WFScnttorn);
 
     printf("\n");
 
@@ -940,7 +1021,14 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
         AOconf[LOOPNUMBER].loopfrequ = loopfrequ_measured;
 
 	// Primary control matrix computation latency
-    complatency_frame_measured = 1.0-1.0*statuscnt[20]/NBkiter;
+    if(snapOK == 1)
+    {
+        if(AOloopControl_perfTest_statsnap_read(LOOPNUMBER, &snap) == -1)
+            printERROR(__FILE__, __func__, __LINE__, "cannot read status snapshot");
+        complatency_frame_measured = snap.complatency_frame;
+    }
+    else
+        complatency_frame_measured = 1.0-1.0*statuscnt[20]/NBkiter;
     if(updateconf==1)
         AOconf[LOOPNUMBER].complatency_frame = complatency_frame_measured;
 
@@ -1008,8 +1096,19 @@ int_fast8_t AOloopControl_perfTest_statusStats(int updateconf)
 
 
 
-    for(st=0; st<statusmax; st++)
-        printf("STATUS %2d     %5.2f %%    [   %6ld  /  %6ld  ]   [ %9.3f us] %s\n", st, 100.0*statuscnt[st]/NBkiter, statuscnt[st], NBkiter, loopiterus*statuscnt[st]/NBkiter , statusdef[st]);
+    if(snapOK == 1)
+    {
+        static const char *stagename[AOLTIMING_NBSTAGE] = {"WAIT FOR IMAGE", "READ IMAGE", "DARK SUBTRACT / IMAGE TOTAL", "NORMALIZE / SUBTRACT REFERENCE", "CONTROL MATRIX MULTIPLICATION", "MODE GAINS, LIMITS AND FILTERING", "DM WRITE"};
+
+        printf("STATUS SNAPSHOT: %ld frames, iteration %9.3f us (max %9.3f us)\n", snap.NBframe, snap.iterus, snap.iterusmax);
+        for(st=0; st<AOLTIMING_NBSTAGE; st++)
+            printf("STAGE  %2d     %5.2f %%    [ %9.3f us] %s\n", st, 100.0*snap.stageus[st]/snap.iterus, snap.stageus[st], stagename[st]);
+    }
+    else
+    {
+        for(st=0; st<statusmax; st++)
+            printf("STATUS %2d     %5.2f %%    [   %6ld  /  %6ld  ]   [ %9.3f us] %s\n", st, 100.0*statuscnt[st]/NBkiter, statuscnt[st], NBkiter, loopiterus*statuscnt[st]/NBkiter , statusdef[st]);
+    }
 
 
 
@@ -1534,6 +1633,16 @@ int_fast8_t AOcontrolLoop_perfTest_TestSystemLatency(const char *dmname, char *w
 
     quick_sort_float(latencyarray, NBiter);
 
+    // sorted latency samples [s], kept in memory for AOloopControl_perfTest_benchmark
+    {
+        long IDlat;
+
+        if(image_ID("_hardwlatency") != -1)
+            delete_image_ID("_hardwlatency");
+        IDlat = create_2Dimage_ID("_hardwlatency", NBiter, 1);
+        memcpy(data.image[IDlat].array.F, latencyarray, sizeof(float)*NBiter);
+    }
+
     printf("AVERAGE LATENCY = %8.3f ms   %f frames\n", latencyave*1000.0, latencystepave);
     printf("min / max over %ld measurements: %8.3f ms / %8.3f ms\n", NBiter, minlatency*1000.0, maxlatency*1000.0);
 
@@ -1543,7 +1652,7 @@ int_fast8_t AOcontrolLoop_perfTest_TestSystemLatency(const char *dmname, char *w
     if(system(command) != 0)
         printERROR(__FILE__, __func__, __LINE__, "system() returns non-zero value");
 
-    if(sprintf(command, "echo %f %f %f %f %f > timinstats/hardwlatencyStats.txt", latencyarray[NBiter/2], latencyave, minlatency, maxlatency, latencystepave) < 1)
+    if(sprintf(command, "echo %f %f %f %f %f > timingstats/hardwlatencyStats.txt", latencyarray[NBiter/2], latencyave, minlatency, maxlatency, latencystepave) < 1)
         printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
 
     if(system(command) != 0)
@@ -2395,17 +2504,49 @@ int_fast8_t AOloopControl_perfTest_AnalyzeRM_sensitivity(const char *IDdmmodes_n
 
 
 
+//
+// periodic modal sequence: slice kk = sum over modes m of ampl[m] * sin(2 pi cycles[m] kk/NBpt + pha0[m]) * mode m
+//
+static void AOloopControl_perfTest_synthModeSeq(long IDout, long IDmodes, long NBpt, long NBmodes, const float *ampl, const float *cycles, const float *pha0)
+{
+    long xysize;
+    long ii, kk;
+    long m;
+
+
+    xysize = data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1];
+
+# ifdef _OPENMP
+    #pragma omp parallel for private(ii,m)
+# endif
+    for(kk=0; kk<NBpt; kk++)
+    {
+        for(ii=0; ii<xysize; ii++)
+            data.image[IDout].array.F[kk*xysize+ii] = 0.0;
+
+        for(m=0; m<NBmodes; m++)
+        {
+            float coeff = ampl[m] * sin(2.0*M_PI*cycles[m]*kk/NBpt+pha0[m]);
+
+            for(ii=0; ii<xysize; ii++)
+                data.image[IDout].array.F[kk*xysize+ii] += coeff * data.image[IDmodes].array.F[m*xysize+ii];
+        }
+    }
+}
+
+
+
+
 //
 // create dynamic test sequence
 //
 long AOloopControl_perfTest_mkTestDynamicModeSeq(const char *IDname_out, long NBpt, long NBmodes)
 {
     long IDout;
-    long xsize, ysize, xysize;
-    long ii, kk;
-    float ampl0;
-    float ampl;
-    float pha0;
+    long xsize, ysize;
+    float *ampl;
+    float *cycles;
+    float *pha0;
     char name[200];
     long m;
 
@@ -2421,24 +2562,663 @@ long AOloopControl_perfTest_mkTestDynamicModeSeq(const char *IDname_out, long NB
     }
     xsize = data.image[aoconfID_DMmodes].md[0].size[0];
     ysize = data.image[aoconfID_DMmodes].md[0].size[1];
-    xysize = xsize*ysize;
 
     IDout = create_3Dimage_ID(IDname_out, xsize, ysize, NBpt);
 
-    for(kk=0; kk<NBpt; kk++)
+    // all modes at sequence period, phase-shifted
+    ampl = (float*) malloc(sizeof(float)*NBmodes);
+    cycles = (float*) malloc(sizeof(float)*NBmodes);
+    pha0 = (float*) malloc(sizeof(float)*NBmodes);
+    for(m=0; m<NBmodes; m++)
     {
-        for(ii=0; ii<xysize; ii++)
-            data.image[IDout].array.F[kk*xysize+ii] = 0.0;
+        ampl[m] = 1.0;
+        cycles[m] = 1.0;
+        pha0[m] = M_PI*(1.0*m/NBmodes);
+    }
+
+    AOloopControl_perfTest_synthModeSeq(IDout, aoconfID_DMmodes, NBpt, NBmodes, ampl, cycles, pha0);
 
+    free(ampl);
+    free(cycles);
+    free(pha0);
+
+    return(IDout);
+}
+
+
+
+
+/**
+ * @brief Frequency-multiplexed modal response
+ *
+ * All modes are injected simultaneously, each at a distinct temporal frequency: mode m at h(m) cycles per NBpt frames,
+ * with h(m) = 1 + (m + r*NBmodes/NBrot) % NBmodes in run r (0 <= r < NBrot).
+ * The sequence (see AOloopControl_perfTest_mkTestDynamicModeSeq) is written to the DM input stream one slice per DM output frame,
+ * and NBperiod periods of the DM output are recorded after one settling period.
+ * Recorded frames are decomposed in modes, and each mode coefficient time series is demodulated at all injection frequencies.
+ *
+ * Each run measures every mode at one frequency; NBrot runs sample the modal transfer functions at NBrot frequencies.
+ *
+ * @param[in] DMmodes_name       DM modes [3D image]
+ * @param[in] ampl               amplitude per mode [um]
+ * @param[in] DMmask_name        DM mask
+ * @param[in] DMstream_in_name   DM input stream
+ * @param[in] DMstream_out_name  DM output stream
+ * @param[in] NBpt               sequence period [frame], > 2 x number of modes
+ * @param[in] NBperiod           number of periods recorded per run
+ * @param[in] NBrot              number of runs (frequency assignments)
+ * @param[out] IDout_name        response amplitude [NBmodes x NBmodes x NBrot]: output mode (x) at frequency of injected mode (y)
+ * @param[in] foutname           ASCII output: run, mode, harmonic, frequency [Hz], gain, phase [rad]
+ */
+long AOloopControl_perfTest_TestDMmodes_FreqMux(const char *DMmodes_name, float ampl, const char *DMmask_name, const char *DMstream_in_name, const char *DMstream_out_name, long NBpt, long NBperiod, long NBrot, const char *IDout_name, const char *foutname)
+{
+    long IDout;
+    long IDmodes, IDdmin, IDdmout;
+    long IDseq, IDdmtmp, IDcoeff;
+    long dmxsize, dmysize, dmsize, NBmodes;
+    long NBrec;
+    float *amplarray;
+    float *cycles;
+    float *pha0;
+    float *phase;
+    long *harm;
+    float *recarray;
+    float *coeffarray;
+    float *costab;
+    float *sintab;
+    float SVDeps = 1.0e-3;
+    int SVDreuse = 0;
+    long r, m, k;
+    FILE *fp;
+
+
+    IDmodes = image_ID(DMmodes_name);
+    IDdmin = image_ID(DMstream_in_name);
+    IDdmout = image_ID(DMstream_out_name);
+
+    if((IDmodes==-1)||(IDdmin==-1)||(IDdmout==-1)||(image_ID(DMmask_name)==-1))
+    {
+        printf("ERROR: missing input image\n");
+        return(-1);
+    }
+
+    dmxsize = data.image[IDmodes].md[0].size[0];
+    dmysize = data.image[IDmodes].md[0].size[1];
+    dmsize = dmxsize*dmysize;
+    NBmodes = data.image[IDmodes].md[0].size[2];
+
+    if((data.image[IDdmin].md[0].size[0]*data.image[IDdmin].md[0].size[1] != dmsize)||(data.image[IDdmout].md[0].size[0]*data.image[IDdmout].md[0].size[1] != dmsize))
+    {
+        printf("ERROR: DM stream size does not match size of \"%s\" (%ld x %ld)\n", DMmodes_name, dmxsize, dmysize);
+        return(-1);
+    }
+
+    if(NBpt <= 2*NBmodes)
+    {
+        printf("ERROR: sequence period NBpt = %ld must exceed 2 x number of modes (%ld)\n", NBpt, NBmodes);
+        return(-1);
+    }
+
+    if(NBrot < 1)
+        NBrot = 1;
+    if(NBperiod < 1)
+        NBperiod = 1;
+    NBrec = NBperiod*NBpt;
+
+    amplarray = (float*) malloc(sizeof(float)*NBmodes);
+    cycles = (float*) malloc(sizeof(float)*NBmodes);
+    pha0 = (float*) malloc(sizeof(float)*NBmodes);
+    phase = (float*) malloc(sizeof(float)*NBmodes);
+    harm = (long*) malloc(sizeof(long)*NBmodes);
+    recarray = (float*) malloc(sizeof(float)*NBrec*dmsize);
+    coeffarray = (float*) malloc(sizeof(float)*NBmodes*NBrec);
+    costab = (float*) malloc(sizeof(float)*NBpt);
+    sintab = (float*) malloc(sizeof(float)*NBpt);
+    if((recarray==NULL)||(coeffarray==NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot allocate recording buffer");
+        exit(0);
+    }
+
+    for(k=0; k<NBpt; k++)
+    {
+        costab[k] = cos(2.0*M_PI*k/NBpt);
+        sintab[k] = sin(2.0*M_PI*k/NBpt);
+    }
+
+    IDseq = create_3Dimage_ID("_tmpfmuxseq", dmxsize, dmysize, NBpt);
+    IDdmtmp = create_2Dimage_ID("_tmpdm", dmxsize, dmysize);
+    {
+        uint32_t sizearray[3];
+
+        sizearray[0] = NBmodes;
+        sizearray[1] = NBmodes;
+        sizearray[2] = NBrot;
+        IDout = create_image_ID(IDout_name, 3, sizearray, _DATATYPE_FLOAT, 0, 0);
+    }
+
+    if((fp = fopen(foutname, "w"))==NULL)
+    {
+        printf("ERROR: cannot create file \"%s\"\n", foutname);
+        exit(0);
+    }
+    fprintf(fp, "# col 1 : run\n");
+    fprintf(fp, "# col 2 : mode index\n");
+    fprintf(fp, "# col 3 : harmonic (cycles per %ld frames)\n", NBpt);
+    fprintf(fp, "# col 4 : frequency [Hz]\n");
+    fprintf(fp, "# col 5 : gain\n");
+    fprintf(fp, "# col 6 : phase [rad]\n");
+    fprintf(fp, "\n");
+
+    printf("Initialize SVD ... ");
+    fflush(stdout);
+    linopt_imtools_image_fitModes("_tmpdm", DMmodes_name, DMmask_name, SVDeps, "dmcoeffs", SVDreuse);
+    delete_image_ID("dmcoeffs");
+    SVDreuse = 1;
+    printf("done\n");
+    fflush(stdout);
+
+    for(r=0; r<NBrot; r++)
+    {
+        struct timespec t0, t1;
+        long cntdmout;
+        double framerate;
+
+        // frequency assignment, Schroeder phases to limit peak excursion
         for(m=0; m<NBmodes; m++)
         {
-            ampl0 = 1.0;
-            pha0 = M_PI*(1.0*m/NBmodes);
-            ampl = ampl0 * sin(2.0*M_PI*(1.0*kk/NBpt)+pha0);
-            for(ii=0; ii<xysize; ii++)
-                data.image[IDout].array.F[kk*xysize+ii] += ampl * data.image[aoconfID_DMmodes].array.F[m*xysize+ii];
+            harm[m] = 1 + (m + r*NBmodes/NBrot) % NBmodes;
+            amplarray[m] = ampl;
+            cycles[m] = 1.0*harm[m];
+            pha0[m] = 0.5*M_PI - M_PI*harm[m]*(harm[m]-1)/NBmodes; // cos(phase), demodulation reference
+        }
+        AOloopControl_perfTest_synthModeSeq(IDseq, IDmodes, NBpt, NBmodes, amplarray, cycles, pha0);
+
+
+        // PLAY AND RECORD, one slice per DM output frame
+        cntdmout = data.image[IDdmout].md[0].cnt0;
+        clock_gettime(CLOCK_REALTIME, &t0);
+        t1 = t0;
+        for(k=0; k<(NBperiod+1)*NBpt; k++)
+        {
+            data.image[IDdmin].md[0].write = 1;
+            memcpy(data.image[IDdmin].array.F, data.image[IDseq].array.F + (k%NBpt)*dmsize, sizeof(float)*dmsize);
+            COREMOD_MEMORY_image_set_sempost_byID(IDdmin, -1);
+            data.image[IDdmin].md[0].cnt0++;
+            data.image[IDdmin].md[0].write = 0;
+
+            while(cntdmout==data.image[IDdmout].md[0].cnt0)
+                usleep(5);
+            cntdmout = data.image[IDdmout].md[0].cnt0;
+
+            if(k==NBpt)
+                clock_gettime(CLOCK_REALTIME, &t0);
+            if(k>=NBpt)
+                memcpy(recarray + (k-NBpt)*dmsize, data.image[IDdmout].array.F, sizeof(float)*dmsize);
+        }
+        clock_gettime(CLOCK_REALTIME, &t1);
+
+        // ZERO DM
+        data.image[IDdmin].md[0].write = 1;
+        memset(data.image[IDdmin].array.F, 0, sizeof(float)*dmsize);
+        COREMOD_MEMORY_image_set_sempost_byID(IDdmin, -1);
+        data.image[IDdmin].md[0].cnt0++;
+        data.image[IDdmin].md[0].write = 0;
+
+        tdiff = info_time_diff(t0, t1);
+        framerate = (NBrec-1)/(1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec);
+        printf("run %ld / %ld : %ld frames recorded at %.2f Hz\n", r, NBrot, NBrec, framerate);
+        fflush(stdout);
+
+
+        // DECOMPOSE IN MODES
+        for(k=0; k<NBrec; k++)
+        {
+            memcpy(data.image[IDdmtmp].array.F, recarray + k*dmsize, sizeof(float)*dmsize);
+            linopt_imtools_image_fitModes("_tmpdm", DMmodes_name, DMmask_name, SVDeps, "dmcoeffs", SVDreuse);
+            IDcoeff = image_ID("dmcoeffs");
+            for(m=0; m<NBmodes; m++)
+                coeffarray[m*NBrec+k] = data.image[IDcoeff].array.F[m];
+            delete_image_ID("dmcoeffs");
+        }
+
+
+        // DEMODULATE: output mode m1 at injection frequency of mode m
+# ifdef _OPENMP
+        #pragma omp parallel for private(k)
+# endif
+        for(m=0; m<NBmodes; m++)
+        {
+            long m1;
+
+            for(m1=0; m1<NBmodes; m1++)
+            {
+                double re = 0.0;
+                double im = 0.0;
+                float *coeff = coeffarray + m1*NBrec;
+                long n = 0;
+
+                for(k=0; k<NBrec; k++)
+                {
+                    // demodulate at 2 pi h k/NBpt, injection phase removed below
+                    re += coeff[k]*costab[n];
+                    im -= coeff[k]*sintab[n];
+                    n += harm[m];
+                    if(n>=NBpt)
+                        n -= NBpt;
+                }
+                data.image[IDout].array.F[r*NBmodes*NBmodes + m*NBmodes + m1] = 2.0*sqrt(re*re+im*im)/(NBrec*ampl);
+
+                if(m1==m)
+                {
+                    double pha = atan2(im, re) - (pha0[m] - 0.5*M_PI);
+
+                    phase[m] = atan2(sin(pha), cos(pha));
+                }
+            }
         }
+
+        for(m=0; m<NBmodes; m++)
+            fprintf(fp, "%3ld  %5ld  %5ld  %12.4f  %10.6f  %+8.5f\n", r, m, harm[m], framerate*harm[m]/NBpt, data.image[IDout].array.F[r*NBmodes*NBmodes + m*NBmodes + m], phase[m]);
     }
 
+    fclose(fp);
+
+    delete_image_ID("_tmpfmuxseq");
+    delete_image_ID("_tmpdm");
+
+    free(amplarray);
+    free(cycles);
+    free(pha0);
+    free(phase);
+    free(harm);
+    free(recarray);
+    free(coeffarray);
+    free(costab);
+    free(sintab);
+
     return(IDout);
 }
+
+
+
+
+
+
+/* =============================================================================================== */
+/** @name AOloopControl_perfTest - BENCHMARK SUITE                                                  */
+/* =============================================================================================== */
+
+
+static int perfTest_cmpdouble(const void *a, const void *b)
+{
+    double da = *((const double*) a);
+    double db = *((const double*) b);
+
+    return (da > db) - (da < db);
+}
+
+
+static double perfTest_timediff_us(const struct timespec *t0, const struct timespec *t1)
+{
+    return 1.0e6*(t1->tv_sec - t0->tv_sec) + 1.0e-3*(t1->tv_nsec - t0->tv_nsec);
+}
+
+
+/**
+ * @brief Write latency statistics and histogram of samples [us] as JSON object member
+ *
+ * samples array is sorted in place
+ */
+static void perfTest_json_latency(FILE *fp, const char *name, double *samples, long NBsample, int last)
+{
+    double ave = 0.0;
+    double rms = 0.0;
+    double vmin, vmax, binsize;
+    long hist[PERFTEST_BENCHMARK_NBBIN];
+    long i;
+
+    fprintf(fp, "    \"%s\": {\n", name);
+    fprintf(fp, "      \"unit\": \"us\",\n");
+    fprintf(fp, "      \"samples\": %ld", NBsample);
+    if(NBsample < 1)
+    {
+        fprintf(fp, "\n    }%s\n", last ? "" : ",");
+        return;
+    }
+
+    qsort(samples, NBsample, sizeof(double), perfTest_cmpdouble);
+    for(i=0; i<NBsample; i++)
+    {
+        ave += samples[i];
+        rms += samples[i]*samples[i];
+    }
+    ave /= NBsample;
+    rms = sqrt(fabs(rms/NBsample - ave*ave));
+    vmin = samples[0];
+    vmax = samples[NBsample-1];
+
+    fprintf(fp, ",\n      \"mean\": %.3f,\n      \"stddev\": %.3f,\n", ave, rms);
+    fprintf(fp, "      \"min\": %.3f,\n      \"p50\": %.3f,\n      \"p90\": %.3f,\n      \"p99\": %.3f,\n      \"p999\": %.3f,\n      \"max\": %.3f,\n",
+            vmin, samples[NBsample/2], samples[(long) (0.9*(NBsample-1))], samples[(long) (0.99*(NBsample-1))], samples[(long) (0.999*(NBsample-1))], vmax);
+
+    for(i=0; i<PERFTEST_BENCHMARK_NBBIN; i++)
+        hist[i] = 0;
+    binsize = (vmax - vmin)/PERFTEST_BENCHMARK_NBBIN;
+    for(i=0; i<NBsample; i++)
+    {
+        long bin = (binsize > 0.0) ? (long) ((samples[i]-vmin)/binsize) : 0;
+
+        if(bin >= PERFTEST_BENCHMARK_NBBIN)
+            bin = PERFTEST_BENCHMARK_NBBIN-1;
+        hist[bin]++;
+    }
+    fprintf(fp, "      \"histogram\": { \"start\": %.3f, \"binsize\": %.4f, \"counts\": [", vmin, binsize);
+    for(i=0; i<PERFTEST_BENCHMARK_NBBIN; i++)
+        fprintf(fp, "%s%ld", (i==0) ? "" : ", ", hist[i]);
+    fprintf(fp, "] }\n    }%s\n", last ? "" : ",");
+}
+
+
+/**
+ * @brief Write system description (host, kernel, CPU frequencies and governors, affinity, GPUs) as JSON object member
+ */
+static void perfTest_json_sysinfo(FILE *fp)
+{
+    struct utsname unamebuf;
+    cpu_set_t cpuset;
+    long ncpu, cpu;
+    char fname[200];
+    char line[200];
+    FILE *fpin;
+    int first;
+
+    uname(&unamebuf);
+    fprintf(fp, "  \"system\": {\n");
+    fprintf(fp, "    \"hostname\": \"%s\",\n", unamebuf.nodename);
+    fprintf(fp, "    \"kernel\": \"%s %s\",\n", unamebuf.release, unamebuf.version);
+    fprintf(fp, "    \"machine\": \"%s\",\n", unamebuf.machine);
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    fprintf(fp, "    \"ncpu\": %ld,\n", ncpu);
+
+    // isolated CPUs
+    line[0] = '\0';
+    if((fpin = fopen("/sys/devices/system/cpu/isolated", "r")) != NULL)
+    {
+        if(fgets(line, 200, fpin) == NULL)
+            line[0] = '\0';
+        fclose(fpin);
+        line[strcspn(line, "\n")] = '\0';
+    }
+    fprintf(fp, "    \"isolated\": \"%s\",\n", line);
+
+    // affinity of benchmark process
+    CPU_ZERO(&cpuset);
+    sched_getaffinity(0, sizeof(cpu_set_t), &cpuset);
+    fprintf(fp, "    \"affinity\": [");
+    first = 1;
+    for(cpu=0; cpu<ncpu; cpu++)
+        if(CPU_ISSET(cpu, &cpuset))
+        {
+            fprintf(fp, "%s%ld", first ? "" : ", ", cpu);
+            first = 0;
+        }
+    fprintf(fp, "],\n");
+
+    // per CPU current frequency and governor
+    fprintf(fp, "    \"cpufreq\": [");
+    for(cpu=0; cpu<ncpu; cpu++)
+    {
+        long freqkHz = -1;
+        char governor[100] = "";
+
+        if(sprintf(fname, "/sys/devices/system/cpu/cpu%ld/cpufreq/scaling_cur_freq", cpu) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        if((fpin = fopen(fname, "r")) != NULL)
+        {
+            if(fscanf(fpin, "%ld", &freqkHz) != 1)
+                freqkHz = -1;
+            fclose(fpin);
+        }
+        if(sprintf(fname, "/sys/devices/system/cpu/cpu%ld/cpufreq/scaling_governor", cpu) < 1)
+            printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+        if((fpin = fopen(fname, "r")) != NULL)
+        {
+            if(fscanf(fpin, "%99s", governor) != 1)
+                governor[0] = '\0';
+            fclose(fpin);
+        }
+        fprintf(fp, "%s\n      { \"cpu\": %ld, \"kHz\": %ld, \"governor\": \"%s\" }", (cpu==0) ? "" : ",", cpu, freqkHz, governor);
+    }
+    fprintf(fp, "\n    ],\n");
+
+    // GPUs, as reported by driver tool (empty if not available)
+    fprintf(fp, "    \"gpu\": [");
+    first = 1;
+    if((fpin = popen("nvidia-smi --query-gpu=index,name,clocks.sm,clocks.mem,clocks.max.sm --format=csv,noheader,nounits 2>/dev/null", "r")) != NULL)
+    {
+        while(fgets(line, 200, fpin) != NULL)
+        {
+            line[strcspn(line, "\n\"")] = '\0';
+            fprintf(fp, "%s\n      \"%s\"", first ? "" : ",", line);
+            first = 0;
+        }
+        pclose(fpin);
+    }
+    fprintf(fp, "%s],\n", first ? "" : "\n    ");
+
+    // real-time settings of loop threads
+    fprintf(fp, "    \"RTsched\": [");
+    if(AOloopcontrol_meminit == 1)
+    {
+        int role;
+
+        for(role=0; role<AOLRTSCHED_NBROLE; role++)
+            fprintf(fp, "%s{ \"role\": %d, \"tid\": %d, \"priority\": %d, \"cpulist\": \"%s\" }", (role==0) ? "" : ", ", role, AOconf[LOOPNUMBER].RTsched[role].tid, AOconf[LOOPNUMBER].RTsched[role].priority, AOconf[LOOPNUMBER].RTsched[role].cpulist);
+    }
+    fprintf(fp, "]\n  },\n");
+}
+
+
+
+/**
+ * @brief Latency benchmark suite
+ *
+ * Runs, and reports in a versioned JSON file :
+ * - system description : kernel, CPU frequencies / governors, affinity, GPU clocks
+ * - CPU MVM microbenchmark : synthetic mvmNBrow x mvmNBcol matrix (NBiter samples)
+ * - DM combine microbenchmark : write to DM channel dmchname, time until combined stream dmdispname is updated (NBiter samples)
+ * - system latency : AOcontrolLoop_perfTest_TestSystemLatency DM -> WFS (NBlatiter samples)
+ *
+ * Stream arguments set to "none" skip the corresponding test.
+ */
+long AOloopControl_perfTest_benchmark(const char *dmchname, const char *dmdispname, const char *wfsname, float OPDamp, long NBlatiter, long NBiter, long mvmNBrow, long mvmNBcol, const char *foutname)
+{
+    FILE *fp;
+    double *samples;
+    struct timespec t0, t1;
+    time_t tnowsec;
+    char timestr[100];
+    long iter, ii;
+    int dotest_comb, dotest_lat;
+    long IDdmch = -1;
+    long IDdmdisp = -1;
+    long NBsamplemax;
+
+
+    dotest_comb = ((strcmp(dmchname, "none") != 0)&&(strcmp(dmdispname, "none") != 0));
+    dotest_lat = ((strcmp(dmchname, "none") != 0)&&(strcmp(wfsname, "none") != 0));
+
+    if(strcmp(dmchname, "none") != 0)
+    {
+        IDdmch = image_ID(dmchname);
+        if(IDdmch == -1)
+            IDdmch = read_sharedmem_image(dmchname);
+        if(IDdmch == -1)
+        {
+            printf("ERROR: cannot connect to DM channel %s\n", dmchname);
+            return(-1);
+        }
+    }
+    if(dotest_comb)
+    {
+        IDdmdisp = image_ID(dmdispname);
+        if(IDdmdisp == -1)
+            IDdmdisp = read_sharedmem_image(dmdispname);
+        if(IDdmdisp == -1)
+        {
+            printf("ERROR: cannot connect to DM stream %s\n", dmdispname);
+            return(-1);
+        }
+    }
+    if(dotest_lat)
+    {
+        if(image_ID(wfsname) == -1)
+            read_sharedmem_image(wfsname);
+        if(image_ID(wfsname) == -1)
+        {
+            printf("ERROR: cannot connect to WFS stream %s\n", wfsname);
+            return(-1);
+        }
+    }
+
+    NBsamplemax = (NBiter > NBlatiter) ? NBiter : NBlatiter;
+    if(NBsamplemax < 1)
+        NBsamplemax = 1;
+    samples = (double*) malloc(sizeof(double)*NBsamplemax);
+
+    if((fp = fopen(foutname, "w")) == NULL)
+    {
+        printf("ERROR: cannot create file \"%s\"\n", foutname);
+        free(samples);
+        return(-1);
+    }
+
+    tnowsec = time(NULL);
+    strftime(timestr, 100, "%Y-%m-%dT%H:%M:%SZ", gmtime(&tnowsec));
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"format\": %d,\n", PERFTEST_BENCHMARK_FORMAT);
+    fprintf(fp, "  \"package\": \"%s\",\n", PACKAGE_NAME);
+    fprintf(fp, "  \"version\": \"%s\",\n", PACKAGE_VERSION);
+    fprintf(fp, "  \"date\": \"%s\",\n", timestr);
+    perfTest_json_sysinfo(fp);
+
+    fprintf(fp, "  \"parameters\": { \"NBiter\": %ld, \"NBlatiter\": %ld, \"mvmNBrow\": %ld, \"mvmNBcol\": %ld, \"ampl\": %g, \"dmch\": \"%s\", \"dmdisp\": \"%s\", \"wfs\": \"%s\" },\n",
+            NBiter, NBlatiter, mvmNBrow, mvmNBcol, OPDamp, dmchname, dmdispname, wfsname);
+    fprintf(fp, "  \"results\": {\n");
+
+
+    // ===================== CPU MVM =====================
+    {
+        float *matrix, *vecin, *vecout;
+
+        printf("MVM benchmark %ld x %ld ...\n", mvmNBrow, mvmNBcol);
+        fflush(stdout);
+        matrix = (float*) malloc(sizeof(float)*mvmNBrow*mvmNBcol);
+        vecin = (float*) malloc(sizeof(float)*mvmNBcol);
+        vecout = (float*) malloc(sizeof(float)*mvmNBrow);
+        for(ii=0; ii<mvmNBrow*mvmNBcol; ii++)
+            matrix[ii] = ran1()-0.5;
+
+        for(iter=0; iter<NBiter; iter++)
+        {
+            for(ii=0; ii<mvmNBcol; ii++)
+                vecin[ii] = ran1()-0.5;
+            clock_gettime(CLOCK_REALTIME, &t0);
+            cblas_sgemv(CblasRowMajor, CblasNoTrans, mvmNBrow, mvmNBcol, 1.0, matrix, mvmNBcol, vecin, 1, 0.0, vecout, 1);
+            clock_gettime(CLOCK_REALTIME, &t1);
+            samples[iter] = perfTest_timediff_us(&t0, &t1);
+        }
+        perfTest_json_latency(fp, "mvm_cpu", samples, NBiter, 0);
+
+        free(matrix);
+        free(vecin);
+        free(vecout);
+    }
+
+
+    // ===================== DM COMBINE =====================
+    {
+        long NBsample = 0;
+
+        if(dotest_comb)
+        {
+            long dmsize = data.image[IDdmch].md[0].nelement;
+            float *dmch0;
+
+            printf("DM combine benchmark %s -> %s ...\n", dmchname, dmdispname);
+            fflush(stdout);
+
+            dmch0 = (float*) malloc(sizeof(float)*dmsize);
+            memcpy(dmch0, data.image[IDdmch].array.F, sizeof(float)*dmsize);
+
+            for(iter=0; iter<NBiter; iter++)
+            {
+                uint64_t cnt0 = data.image[IDdmdisp].md[0].cnt0;
+                double dt = 0.0;
+
+                clock_gettime(CLOCK_REALTIME, &t0);
+                data.image[IDdmch].md[0].write = 1;
+                for(ii=0; ii<dmsize; ii++)
+                    data.image[IDdmch].array.F[ii] = dmch0[ii] + ((iter % 2 == 0) ? OPDamp : 0.0);
+                COREMOD_MEMORY_image_set_sempost_byID(IDdmch, -1);
+                data.image[IDdmch].md[0].cnt0++;
+                data.image[IDdmch].md[0].write = 0;
+
+                while((data.image[IDdmdisp].md[0].cnt0 == cnt0)&&(dt < 1.0e5))
+                {
+                    clock_gettime(CLOCK_REALTIME, &t1);
+                    dt = perfTest_timediff_us(&t0, &t1);
+                }
+                if(dt < 1.0e5) // combined stream updated within 100 ms
+                {
+                    clock_gettime(CLOCK_REALTIME, &t1);
+                    samples[NBsample] = perfTest_timediff_us(&t0, &t1);
+                    NBsample++;
+                }
+            }
+
+            data.image[IDdmch].md[0].write = 1;
+            memcpy(data.image[IDdmch].array.F, dmch0, sizeof(float)*dmsize);
+            COREMOD_MEMORY_image_set_sempost_byID(IDdmch, -1);
+            data.image[IDdmch].md[0].cnt0++;
+            data.image[IDdmch].md[0].write = 0;
+            free(dmch0);
+        }
+        perfTest_json_latency(fp, "dm_combine", samples, NBsample, 0);
+    }
+
+
+    // ===================== SYSTEM LATENCY =====================
+    {
+        long NBsample = 0;
+
+        if(dotest_lat && (NBlatiter > 0))
+        {
+            long IDlat;
+
+            printf("System latency benchmark %s -> %s ...\n", dmchname, wfsname);
+            fflush(stdout);
+
+            AOcontrolLoop_perfTest_TestSystemLatency(dmchname, (char*) wfsname, OPDamp, NBlatiter);
+            IDlat = image_ID("_hardwlatency");
+            if(IDlat != -1)
+            {
+                NBsample = data.image[IDlat].md[0].nelement;
+                for(ii=0; ii<NBsample; ii++)
+                    samples[ii] = 1.0e6*data.image[IDlat].array.F[ii];
+            }
+        }
+        perfTest_json_latency(fp, "dm_to_wfs", samples, NBsample, 1);
+    }
+
+    fprintf(fp, "  }\n}\n");
+    fclose(fp);
+    free(samples);
+
+    printf("Benchmark report written to %s\n", foutname);
+
+    return(0);
+}
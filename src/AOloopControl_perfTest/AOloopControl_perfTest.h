@@ -30,6 +30,8 @@ int_fast8_t init_AOloopControl_perfTest();
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+int_fast8_t AOloopControl_perfTest_statsnap_read(long loop, AOLOOPCONTROL_STATUSSNAP *snap);
+
 int_fast8_t AOloopControl_perfTest_printloopstatus(long loop, long nbcol, long IDmodeval_dm, long IDmodeval, long IDmodevalave, long IDmodevalrms, long ksize);
 
 int_fast8_t AOloopControl_perfTest_loopMonitor(long loop, double frequ, long nbcol);
@@ -44,6 +46,9 @@ int_fast8_t AOcontrolLoop_perfTest_TestDMSpeed(const char *dmname, long delayus,
 
 int_fast8_t AOcontrolLoop_perfTest_TestSystemLatency(const char *dmname, char *wfsname, float OPDamp, long NBiter);
 
+/** @brief Latency benchmark suite (MVM, DM combine, DM to WFS latency), versioned JSON report */
+long AOloopControl_perfTest_benchmark(const char *dmchname, const char *dmdispname, const char *wfsname, float OPDamp, long NBlatiter, long NBiter, long mvmNBrow, long mvmNBcol, const char *foutname);
+
 long AOloopControl_perfTest_blockstats(long loop, const char *IDout_name);
 
 int_fast8_t AOloopControl_perfTest_InjectMode( long index, float ampl );
@@ -52,6 +57,8 @@ long AOloopControl_perfTest_TestDMmodeResp(const char *DMmodes_name, long index,
 
 long AOloopControl_perfTest_TestDMmodes_Recovery(const char *DMmodes_name, float ampl, const char *DMmask_name, const char *DMstream_in_name, const char *DMstream_out_name, const char *DMstream_meas_name, long tlagus, long NBave, const char *IDout_name, const char *IDoutrms_name, const char *IDoutmeas_name, const char *IDoutmeasrms_name);
 
+long AOloopControl_perfTest_TestDMmodes_FreqMux(const char *DMmodes_name, float ampl, const char *DMmask_name, const char *DMstream_in_name, const char *DMstream_out_name, long NBpt, long NBperiod, long NBrot, const char *IDout_name, const char *foutname);
+
 long AOloopControl_perfTesT_mkTestDynamicModeSeq(const char *IDname_out, long NBpt, long NBmodes);
 
 int_fast8_t AOloopControl_perfTest_AnalyzeRM_sensitivity(const char *IDdmmodes_name, const char *IDdmmask_name, const char *IDwfsref_name, const char *IDwfsresp_name, const char *IDwfsmask_name, float amplimitnm, float lambdanm, const char *foutname);
@@ -22,11 +22,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
 
 
 /// External libraries
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_multimin.h>
+#include <gsl/gsl_cblas.h>
 
 #include <fitsio.h>
 
@@ -75,17 +78,31 @@ static char flogcomment[200];
 static int WDIR_INIT = 0;
 
 
+// linearized pyramid WFS model (see AOsystSim_WFSsim_Pyramid_linearize)
+static int PYRLIN_mode = 0;          // 0: full Fourier model, 1: linear model, 2: linear, full model every PYRLIN_NBupdate frames
+static long PYRLIN_NBupdate = 100;
+static long PYRLIN_cnt = 0;
+static long PYRLIN_arraysize = 0;
+static long PYRLIN_NBact = 0;         // number of active pupil pixels
+static long *PYRLIN_pixindex = NULL;  // active pupil pixel index
+static float *PYRLIN_pha0 = NULL;     // reference phase at active pixels
+static float *PYRLIN_I0 = NULL;       // reference WFS image
+static float *PYRLIN_G = NULL;        // response matrix, arraysize^2 x NBact, [1/rad]
+static float *PYRLIN_dpha = NULL;
+static float *PYRLIN_Ilin = NULL;
+static double PYRLIN_gain = 1.0;      // optical gain, updated in mode 2
+
+
 
 // non-null pixels in DM influence function (to speed up computing time)
-int DMifpixarray_init = 0;
-float *DMifpixarray_val;
-long *DMifpixarray_index; // which actuator
-long *DMifpixarray_pixindex; // which pixel
-long DMifpixarray_NBpix;
-long DMifpixarray_NBpix0;
-long *dmifpixactarray;
-long *dmifpixactarray_dmact;
-long *dmifpixactarray_ii;
+// DM influence functions, sparse (CSR, one row per DM map pixel), see AOsystSim_DMshape
+static long DMifCSR_IDdmifc = -1;     // source cube, checked with creation time and cnt0
+static double DMifCSR_ctime = 0.0;
+static uint64_t DMifCSR_cnt0 = 0;
+static long DMifCSR_NBpix = 0;        // number of DM map pixels
+static long *DMifCSR_rowptr = NULL;   // NBpix+1
+static long *DMifCSR_act = NULL;      // actuator index
+static float *DMifCSR_val = NULL;     // influence function value
         
 
 long NBprobesG = 3;
@@ -143,6 +160,16 @@ int_fast8_t AOsystSim_PyrWFS_cli(){
         AOsystSim_PyrWFS(data.cmdargtoken[1].val.string);
         return 0;    }    else        return 1;}
 
+int_fast8_t AOsystSim_WFSsim_Pyramid_linearize_cli(){
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,1)+CLI_checkarg(3,2)+CLI_checkarg(4,1)==0)    {
+        AOsystSim_WFSsim_Pyramid_linearize(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numf);
+        return 0;    }    else        return 1;}
+
+int_fast8_t AOsystSim_WFSsim_Pyramid_setmodel_cli(){
+  if(CLI_checkarg(1,2)+CLI_checkarg(2,2)==0)    {
+        AOsystSim_WFSsim_Pyramid_setmodel(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl);
+        return 0;    }    else        return 1;}
+
 int_fast8_t AOsystSim_DM_cli(){
   if(CLI_checkarg(1,5)==0)    {
         AOsystSim_DM(data.cmdargtoken[1].val.string);
@@ -216,6 +243,24 @@ int init_AOsystSim()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AOsystSim_PyrWFS(const char *CONF_FNAME)");
     data.NBcmd++;
 	
+    strcpy(data.cmd[data.NBcmd].key,"AOsimPyrlin");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOsystSim_WFSsim_Pyramid_linearize_cli;
+    strcpy(data.cmd[data.NBcmd].info,"build linearized pyramid WFS model around input complex field");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input WF complex> <modulation radius> <modulation points> <poke amplitude [rad]>");
+    strcpy(data.cmd[data.NBcmd].example,"AOsimPyrlin wfc 0.0 1 0.1");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOsystSim_WFSsim_Pyramid_linearize(const char *inWFc_name, double modampl, long modnbpts, double pokeampl)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"AOsimPyrmodel");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AOsystSim_WFSsim_Pyramid_setmodel_cli;
+    strcpy(data.cmd[data.NBcmd].info,"select pyramid WFS model: 0 full, 1 linear, 2 linear + full every N frames");
+    strcpy(data.cmd[data.NBcmd].syntax,"<mode> <N>");
+    strcpy(data.cmd[data.NBcmd].example,"AOsimPyrmodel 2 100");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AOsystSim_WFSsim_Pyramid_setmodel(int mode, long NBupdate)");
+    data.NBcmd++;
+
     strcpy(data.cmd[data.NBcmd].key,"AOsimDM");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp = AOsystSim_DM_cli;
@@ -293,6 +338,36 @@ int init_AOsystSim()
 
 
 
+//
+// free-running frame pacing on absolute deadlines (CLOCK_MONOTONIC)
+// computation time does not accumulate into the period; if a deadline is already past,
+// the frame is counted as overrun and the schedule restarts from now
+//
+static void AOsystSim_waitnextframe(struct timespec *tnext, long periodus, long *NBoverrun)
+{
+    struct timespec tnow;
+
+    tnext->tv_nsec += periodus*1000;
+    while(tnext->tv_nsec >= 1000000000)
+    {
+        tnext->tv_nsec -= 1000000000;
+        tnext->tv_sec++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    if((tnow.tv_sec > tnext->tv_sec)||((tnow.tv_sec == tnext->tv_sec)&&(tnow.tv_nsec > tnext->tv_nsec)))
+    {
+        (*NBoverrun)++;
+        *tnext = tnow;
+        return;
+    }
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, tnext, NULL) == EINTR) {}
+}
+
+
+
+
 int AOsystSim_run(int syncmode, long DMindex, long delayus)
 {
     long arraysize = 128;
@@ -337,6 +412,11 @@ int AOsystSim_run(int syncmode, long DMindex, long delayus)
     char imnameamp[200];
     char imnamepha[200];
     long index;
+    long IDwfc;
+    long IDdh;
+    struct timespec tnext;
+    long NBoverrun = 0;
+    long NBoverrun0 = 0;
 
     puprad = pupradcoeff*arraysize;
     dmrad = dmradcoeff*arraysize;
@@ -619,26 +699,22 @@ int AOsystSim_run(int syncmode, long DMindex, long delayus)
 
     save_fits("dhmask", "!AOsystSim_wdir/dhmask.fits");
 
+    // loop buffers, allocated once
+    IDdh = create_image_ID(imdhname, 2, dhsizearray, _DATATYPE_FLOAT, 1, 0);
+    IDwfc = create_2DCimage_ID("_tmpwfc", arraysize, arraysize);
+
+    clock_gettime(CLOCK_MONOTONIC, &tnext);
+
     iter = 0;
     for(;;)
     {
-		long IDdh;
 		long IDre, IDim;
+		long IDwfa, IDwfp;
 		
-        //        printf("ITERATION %6ld   \n", iter);
-        //      fflush(stdout);
         sprintf(name, "dm%02lddisp", DMindex);
-        printf("Compute DM shape ...\n");
-        fflush(stdout);
         AOsystSim_DMshape(name, "dmifc", "dm2Ddisp");
-        printf("done\n");
-        fflush(stdout);
 
-        printf("Computing propagation ...\n");
-        fflush(stdout);
         OptSystProp_run(optsystsim, 0, 0, optsystsim[0].NBelem, "./testconf/", 1);
-        printf("done\n");
-        fflush(stdout);
 
         // PYWFS code
         index = 2;
@@ -649,9 +725,14 @@ int AOsystSim_run(int syncmode, long DMindex, long delayus)
         if(sprintf(imnamepha, "WFpha0_%03ld", index) < 1)
             printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
         
-        mk_complex_from_amph(imnameamp, imnamepha, "_tmpwfc", 0);
+        IDwfa = image_ID(imnameamp);
+        IDwfp = image_ID(imnamepha);
+        for(ii=0; ii<arraysize*arraysize; ii++)
+        {
+            data.image[IDwfc].array.CF[ii].re = data.image[IDwfa].array.F[ii]*cos(data.image[IDwfp].array.F[ii]);
+            data.image[IDwfc].array.CF[ii].im = data.image[IDwfa].array.F[ii]*sin(data.image[IDwfp].array.F[ii]);
+        }
         AOsystSim_WFSsim_Pyramid("_tmpwfc", "aosimwfsim", 0.0, 1);
-        delete_image_ID("_tmpwfc");
 
         COREMOD_MEMORY_image_set_sempost("aosimwfsim", 0);
 
@@ -668,7 +749,6 @@ int AOsystSim_run(int syncmode, long DMindex, long delayus)
         // CREATE DARK HOLE FIELD
         IDre = image_ID("psfre0");
         IDim = image_ID("psfim0");
-        IDdh = create_image_ID(imdhname, 2, dhsizearray, _DATATYPE_FLOAT, 1, 0);
         data.image[IDdh].md[0].write = 1;
         for(ii=0; ii<dhxsize; ii++)
             for(jj=0; jj<dhysize; jj++)
@@ -690,9 +770,13 @@ int AOsystSim_run(int syncmode, long DMindex, long delayus)
         case 2 :
             COREMOD_MEMORY_image_set_semwait_OR_IDarray(IDarray, 2);
             break;
-        default :
-            printf("WAITING %ld us\n", delayus);
-            usleep(delayus);
+        default : // free-running, one frame every delayus
+            AOsystSim_waitnextframe(&tnext, delayus, &NBoverrun);
+            if((NBoverrun != NBoverrun0)&&(iter%1000 == 0))
+            {
+                printf("iter %ld : %ld frames missed %ld us deadline\n", iter, NBoverrun, delayus);
+                NBoverrun0 = NBoverrun;
+            }
             break;
         }
 
@@ -2582,7 +2666,7 @@ int AOsystSim_mkWF(const char *CONF_FNAME)
 /* =============================================================================================== */
 
 
-int AOsystSim_WFSsim_Pyramid(const char *inWFc_name, const char *outWFSim_name, double modampl, long modnbpts)
+static int AOsystSim_WFSsim_Pyramid_full(const char *inWFc_name, const char *outWFSim_name, double modampl, long modnbpts)
 {
     long ID_inWFc, ID_outWFSim;
     long arraysize;
@@ -2604,6 +2688,7 @@ int AOsystSim_WFSsim_Pyramid(const char *inWFc_name, const char *outWFSim_name,
     double PYRMOD_rad;
     double xc, yc, PA;
     long ID_outWFSim_tmp;
+    long IDpyrmask, IDbuf;
     
     int ret;
     
@@ -2703,74 +2788,310 @@ int AOsystSim_WFSsim_Pyramid(const char *inWFc_name, const char *outWFSim_name,
     }
 
 
-    data.image[ID_outWFSim].md[0].write = 1;
-    for(ii=0; ii<arraysize2; ii++)
-        data.image[ID_outWFSim_tmp].array.F[ii] = 0.0;
+    // pyramid operator: complex focal plane masks, one per modulation point, in FFT (non-centered) order
+    // rebuilt only if missing or if size / number of modulation points changed
+    IDpyrmask = image_ID("pyrmaskc");
+    if(IDpyrmask!=-1)
+        if((data.image[IDpyrmask].md[0].size[0]!=arraysize)||(data.image[IDpyrmask].md[0].size[2]!=PYRMOD_nbpts))
+        {
+            delete_image_ID("pyrmaskc");
+            delete_image_ID("pyrwfsbufc");
+            IDpyrmask = -1;
+        }
+    if(IDpyrmask==-1)
+    {
+        imsize = (uint32_t*) malloc(sizeof(uint32_t)*3);
+        imsize[0] = arraysize;
+        imsize[1] = arraysize;
+        imsize[2] = PYRMOD_nbpts;
+        IDpyrmask = create_image_ID("pyrmaskc", 3, imsize, _DATATYPE_COMPLEX_FLOAT, 0, 0);
+        create_image_ID("pyrwfsbufc", 3, imsize, _DATATYPE_COMPLEX_FLOAT, 0, 0);
+        free(imsize);
+
+        for(pmodpt=0; pmodpt<PYRMOD_nbpts; pmodpt++)
+        {
+            sprintf(pnamea, "pyramp_%03ld", pmodpt);
+            sprintf(pnamep, "pyrpha_%03ld", pmodpt);
+            IDpyramp = image_ID(pnamea);
+            IDpyrpha = image_ID(pnamep);
+            for(ii=0; ii<arraysize; ii++)
+                for(jj=0; jj<arraysize; jj++)
+                {
+                    long index = ((jj+arraysize/2)%arraysize)*arraysize + (ii+arraysize/2)%arraysize;
+                    float amp = data.image[IDpyramp].array.F[index];
+                    float pha = data.image[IDpyrpha].array.F[index];
 
+                    data.image[IDpyrmask].array.CF[pmodpt*arraysize2+jj*arraysize+ii].re = amp*cos(pha);
+                    data.image[IDpyrmask].array.CF[pmodpt*arraysize2+jj*arraysize+ii].im = amp*sin(pha);
+                }
+        }
+    }
+    IDbuf = image_ID("pyrwfsbufc");
+
+
+    // focal plane field (FFT order), shared by all modulation points
+    for(ii=0; ii<arraysize; ii++)
+        for(jj=0; jj<arraysize; jj++)
+            data.image[ID_inWFccp].array.CF[jj*arraysize+ii] = data.image[ID_inWFc].array.CF[((jj+arraysize/2)%arraysize)*arraysize + (ii+arraysize/2)%arraysize];
+    FFT_do2dfft_byID(ID_inWFccp, ID_inWFccp, -1);
+    fft_gpu_sync("pyrwfcin");
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for private(ii)
+# endif
     for(pmodpt=0; pmodpt<PYRMOD_nbpts; pmodpt++)
+        for(ii=0; ii<arraysize2; ii++)
+        {
+            complex_float a = data.image[ID_inWFccp].array.CF[ii];
+            complex_float m = data.image[IDpyrmask].array.CF[pmodpt*arraysize2+ii];
+
+            data.image[IDbuf].array.CF[pmodpt*arraysize2+ii].re = a.re*m.re - a.im*m.im;
+            data.image[IDbuf].array.CF[pmodpt*arraysize2+ii].im = a.re*m.im + a.im*m.re;
+        }
+
+    // all modulation points in one batched transform
+    FFT_do2dfft_byID(IDbuf, IDbuf, -1);
+    fft_gpu_sync("pyrwfsbufc");
+
+    // incoherent sum, centered output
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for private(ii, pmodpt)
+# endif
+    for(jj=0; jj<arraysize; jj++)
+        for(ii=0; ii<arraysize; ii++)
+        {
+            double v = 0.0;
+            for(pmodpt=0; pmodpt<PYRMOD_nbpts; pmodpt++)
+            {
+                complex_float c = data.image[IDbuf].array.CF[pmodpt*arraysize2+jj*arraysize+ii];
+                v += c.re*c.re + c.im*c.im;
+            }
+            data.image[ID_outWFSim_tmp].array.F[((jj+arraysize/2)%arraysize)*arraysize + (ii+arraysize/2)%arraysize] = v/PYRMOD_nbpts;
+        }
+
+    data.image[ID_outWFSim].md[0].write = 1;
+    memcpy(data.image[ID_outWFSim].array.F, data.image[ID_outWFSim_tmp].array.F, sizeof(float)*arraysize*arraysize);
+    data.image[ID_outWFSim].md[0].cnt0++;
+    data.image[ID_outWFSim].md[0].write = 0;
+
+    return (0);
+}
+
+
+
+
+
+
+// linear model output in PYRLIN_Ilin : I0 + gain * G.(pha-pha0)
+static void AOsystSim_WFSsim_Pyramid_linapply(long ID_inWFc, double gain)
+{
+    long act;
+    long arraysize2 = PYRLIN_arraysize*PYRLIN_arraysize;
+
+    for(act=0; act<PYRLIN_NBact; act++)
     {
-		long IDa, IDp;
-		
-		
-        memcpy(data.image[ID_inWFccp].array.CF, data.image[ID_inWFc].array.CF, sizeof(complex_float)*arraysize*arraysize);
+        complex_float c = data.image[ID_inWFc].array.CF[PYRLIN_pixindex[act]];
+        double dpha = atan2(c.im, c.re) - PYRLIN_pha0[act];
 
+        dpha -= 2.0*M_PI*floor(dpha/(2.0*M_PI)+0.5);
+        PYRLIN_dpha[act] = (float) dpha;
+    }
 
+    memcpy(PYRLIN_Ilin, PYRLIN_I0, sizeof(float)*arraysize2);
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, arraysize2, PYRLIN_NBact, (float) gain, PYRLIN_G, PYRLIN_NBact, PYRLIN_dpha, 1, 1.0, PYRLIN_Ilin, 1);
+}
 
-        permut("pyrwfcin");
-        do2dfft("pyrwfcin","pyrpsfcin");
-        permut("pyrpsfcin");
-        mk_amph_from_complex("pyrpsfcin", "pyrpsfa", "pyrpsfp", 0);
-        delete_image_ID("pyrpsfcin");
 
-        sprintf(pnamea, "pyramp_%03ld", pmodpt);
-        sprintf(pnamep, "pyrpha_%03ld", pmodpt);
-        IDpyramp = image_ID(pnamea);
-        IDpyrpha = image_ID(pnamep);
-        IDa = image_ID("pyrpsfa");
-        IDp = image_ID("pyrpsfp");
 
-        for(ii=0; ii<arraysize2; ii++)
+//
+// Builds linearized pyramid model around complex field inWFc_name
+// response to phase is measured by push-pull (+/- pokeampl [rad]) on each pupil pixel with non-zero amplitude
+// Memory : 4 x arraysize^2 x NBact bytes for response matrix
+//
+int AOsystSim_WFSsim_Pyramid_linearize(const char *inWFc_name, double modampl, long modnbpts, double pokeampl)
+{
+    long ID_inWFc, IDtmp, IDout;
+    long arraysize, arraysize2;
+    long ii, act;
+    uint32_t *imsize;
+
+
+    ID_inWFc = image_ID(inWFc_name);
+    arraysize = data.image[ID_inWFc].md[0].size[0];
+    arraysize2 = arraysize*arraysize;
+
+    free(PYRLIN_pixindex);
+    free(PYRLIN_pha0);
+    free(PYRLIN_I0);
+    free(PYRLIN_G);
+    free(PYRLIN_dpha);
+    free(PYRLIN_Ilin);
+
+    PYRLIN_NBact = 0;
+    for(ii=0; ii<arraysize2; ii++)
+        if((data.image[ID_inWFc].array.CF[ii].re != 0.0)||(data.image[ID_inWFc].array.CF[ii].im != 0.0))
+            PYRLIN_NBact++;
+
+    PYRLIN_arraysize = arraysize;
+    PYRLIN_pixindex = (long*) malloc(sizeof(long)*PYRLIN_NBact);
+    PYRLIN_pha0 = (float*) malloc(sizeof(float)*PYRLIN_NBact);
+    PYRLIN_dpha = (float*) malloc(sizeof(float)*PYRLIN_NBact);
+    PYRLIN_I0 = (float*) malloc(sizeof(float)*arraysize2);
+    PYRLIN_Ilin = (float*) malloc(sizeof(float)*arraysize2);
+    PYRLIN_G = (float*) malloc(sizeof(float)*arraysize2*PYRLIN_NBact);
+    if(PYRLIN_G == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+        exit(0);
+    }
+
+    act = 0;
+    for(ii=0; ii<arraysize2; ii++)
+        if((data.image[ID_inWFc].array.CF[ii].re != 0.0)||(data.image[ID_inWFc].array.CF[ii].im != 0.0))
         {
-            data.image[IDa].array.F[ii] *= data.image[IDpyramp].array.F[ii];
-            data.image[IDp].array.F[ii] += data.image[IDpyrpha].array.F[ii];
+            PYRLIN_pixindex[act] = ii;
+            PYRLIN_pha0[act] = atan2(data.image[ID_inWFc].array.CF[ii].im, data.image[ID_inWFc].array.CF[ii].re);
+            act++;
         }
 
+    printf("Linearizing pyramid WFS : %ld pupil pixels\n", PYRLIN_NBact);
+    fflush(stdout);
 
-        mk_complex_from_amph("pyrpsfa", "pyrpsfp", "pyrpsfc", 0);
-        delete_image_ID("pyrpsfa");
-        delete_image_ID("pyrpsfp");
+    imsize = (uint32_t*) malloc(sizeof(uint32_t)*2);
+    imsize[0] = arraysize;
+    imsize[1] = arraysize;
+    IDtmp = create_image_ID("pyrlin_wfc", 2, imsize, _DATATYPE_COMPLEX_FLOAT, 0, 0);
+    free(imsize);
+    memcpy(data.image[IDtmp].array.CF, data.image[ID_inWFc].array.CF, sizeof(complex_float)*arraysize2);
 
-        permut("pyrpsfc");
-        do2dfft("pyrpsfc","pyrwfs_pupc");
-        delete_image_ID("pyrpsfc");
-        permut("pyrwfs_pupc");
-        mk_amph_from_complex("pyrwfs_pupc", "pyrwfs_pupa", "pyrwfs_pupp", 0);
+    AOsystSim_WFSsim_Pyramid_full("pyrlin_wfc", "pyrlin_wfsim", modampl, modnbpts);
+    IDout = image_ID("pyrlin_wfsim");
+    memcpy(PYRLIN_I0, data.image[IDout].array.F, sizeof(float)*arraysize2);
 
-        delete_image_ID("pyrwfs_pupp");
-        delete_image_ID("pyrwfs_pupc");
+    for(act=0; act<PYRLIN_NBact; act++)
+    {
+        long index = PYRLIN_pixindex[act];
+        complex_float c0 = data.image[ID_inWFc].array.CF[index];
+        float cp = cos(pokeampl);
+        float sp = sin(pokeampl);
 
-        IDa = image_ID("pyrwfs_pupa");
+        printf("\r  %6ld / %6ld  ", act, PYRLIN_NBact);
+        fflush(stdout);
 
+        data.image[IDtmp].array.CF[index].re = c0.re*cp - c0.im*sp;
+        data.image[IDtmp].array.CF[index].im = c0.re*sp + c0.im*cp;
+        AOsystSim_WFSsim_Pyramid_full("pyrlin_wfc", "pyrlin_wfsim", modampl, modnbpts);
         for(ii=0; ii<arraysize2; ii++)
-            data.image[ID_outWFSim_tmp].array.F[ii] += data.image[IDa].array.F[ii]*data.image[IDa].array.F[ii]/PYRMOD_nbpts;
-        delete_image_ID("pyrwfs_pupa");
+            PYRLIN_G[ii*PYRLIN_NBact+act] = data.image[IDout].array.F[ii];
+
+        data.image[IDtmp].array.CF[index].re = c0.re*cp + c0.im*sp;
+        data.image[IDtmp].array.CF[index].im = -c0.re*sp + c0.im*cp;
+        AOsystSim_WFSsim_Pyramid_full("pyrlin_wfc", "pyrlin_wfsim", modampl, modnbpts);
+        for(ii=0; ii<arraysize2; ii++)
+            PYRLIN_G[ii*PYRLIN_NBact+act] = (PYRLIN_G[ii*PYRLIN_NBact+act] - data.image[IDout].array.F[ii])/(2.0*pokeampl);
+
+        data.image[IDtmp].array.CF[index] = c0;
     }
-    memcpy(data.image[ID_outWFSim].array.F, data.image[ID_outWFSim_tmp].array.F, sizeof(float)*arraysize*arraysize);
+    printf("\n");
+
+    delete_image_ID("pyrlin_wfc");
+    delete_image_ID("pyrlin_wfsim");
+
+    PYRLIN_gain = 1.0;
+    PYRLIN_cnt = 0;
+
+    return(0);
+}
+
+
+
+//
+// mode 0 : full Fourier model
+// mode 1 : linear model (requires AOsystSim_WFSsim_Pyramid_linearize)
+// mode 2 : linear model, full model every NBupdate frames to update optical gain
+//
+int AOsystSim_WFSsim_Pyramid_setmodel(int mode, long NBupdate)
+{
+    PYRLIN_mode = mode;
+    if(NBupdate > 0)
+        PYRLIN_NBupdate = NBupdate;
+    PYRLIN_cnt = 0;
+
+    return(0);
+}
+
+
+
+int AOsystSim_WFSsim_Pyramid(const char *inWFc_name, const char *outWFSim_name, double modampl, long modnbpts)
+{
+    long ID_inWFc, ID_outWFSim;
+    long arraysize, arraysize2;
+    long ii;
+    uint32_t *imsize;
+
+
+    ID_inWFc = image_ID(inWFc_name);
+    arraysize = data.image[ID_inWFc].md[0].size[0];
+    arraysize2 = arraysize*arraysize;
+
+    if((PYRLIN_mode == 0)||(PYRLIN_G == NULL)||(PYRLIN_arraysize != arraysize))
+        return(AOsystSim_WFSsim_Pyramid_full(inWFc_name, outWFSim_name, modampl, modnbpts));
+
+    if((PYRLIN_mode == 2)&&(PYRLIN_cnt%PYRLIN_NBupdate == 0))
+    {
+        double num = 0.0;
+        double denom = 0.0;
+
+        AOsystSim_WFSsim_Pyramid_full(inWFc_name, outWFSim_name, modampl, modnbpts);
+        ID_outWFSim = image_ID(outWFSim_name);
+
+        // optical gain : least-squares fit of full model response to linear response
+        AOsystSim_WFSsim_Pyramid_linapply(ID_inWFc, 1.0);
+        for(ii=0; ii<arraysize2; ii++)
+        {
+            double vlin = PYRLIN_Ilin[ii] - PYRLIN_I0[ii];
+            num += (data.image[ID_outWFSim].array.F[ii] - PYRLIN_I0[ii])*vlin;
+            denom += vlin*vlin;
+        }
+        if(denom > 0.0)
+            PYRLIN_gain = num/denom;
+        PYRLIN_cnt++;
+
+        return(0);
+    }
+
+    ID_outWFSim = image_ID(outWFSim_name);
+    if(ID_outWFSim==-1)
+    {
+        imsize = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        imsize[0] = arraysize;
+        imsize[1] = arraysize;
+        ID_outWFSim = create_image_ID(outWFSim_name, 2, imsize, _DATATYPE_FLOAT, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(outWFSim_name, 7);
+        free(imsize);
+    }
+
+    AOsystSim_WFSsim_Pyramid_linapply(ID_inWFc, PYRLIN_gain);
+
+    data.image[ID_outWFSim].md[0].write = 1;
+    memcpy(data.image[ID_outWFSim].array.F, PYRLIN_Ilin, sizeof(float)*arraysize2);
     data.image[ID_outWFSim].md[0].cnt0++;
     data.image[ID_outWFSim].md[0].write = 0;
+    PYRLIN_cnt++;
 
-    return (0);
+    return(0);
 }
 
 
 
 
 
-
 int AOsystSim_runWFS(long index, const char *IDout_name)
 {
     long cnt0;
-    long IDinamp;
+    long IDinamp, IDinpha;
+    long IDwfc;
+    long arraysize;
     char imnameamp[200];
     char imnamepha[200];
     int ret;
@@ -2778,19 +3099,28 @@ int AOsystSim_runWFS(long index, const char *IDout_name)
     ret = sprintf(imnameamp, "WFamp0_%03ld", index);
     ret = sprintf(imnamepha, "WFpha0_%03ld", index);
     IDinamp = image_ID(imnameamp);
+    IDinpha = image_ID(imnamepha);
+    arraysize = data.image[IDinamp].md[0].size[0];
+    IDwfc = image_ID("_tmpwfc");
+    if(IDwfc==-1)
+        IDwfc = create_2DCimage_ID("_tmpwfc", arraysize, arraysize);
 
     cnt0 = 0;
 
     while(1)
     {
+        long ii;
+
         while(cnt0 == data.image[IDinamp].md[0].cnt0)
             usleep(50);
         cnt0 = data.image[IDinamp].md[0].cnt0;
 
-        mk_complex_from_amph(imnameamp, imnamepha, "_tmpwfc", 0);
+        for(ii=0; ii<arraysize*arraysize; ii++)
+        {
+            data.image[IDwfc].array.CF[ii].re = data.image[IDinamp].array.F[ii]*cos(data.image[IDinpha].array.F[ii]);
+            data.image[IDwfc].array.CF[ii].im = data.image[IDinamp].array.F[ii]*sin(data.image[IDinpha].array.F[ii]);
+        }
         AOsystSim_WFSsim_Pyramid("_tmpwfc", IDout_name, 0.0, 1);
-
-        delete_image_ID("_tmpwfc");
     }
 
 
@@ -3165,8 +3495,11 @@ int AOsystSim_PyrWFS(const char *CONF_FNAME)
                             jj1 = jj*OUTBINFACT+j + outoffset;
                             tmpval += data.image[IDpyrpupi].array.F[jj1*ARRAYSIZE+ii1];
                         }
-                    data.image[IDout].array.F[jj*OUTARRAYSIZE+ii] = fast_poisson(tmpval) + WFSCAMRON*gauss();
+                    data.image[IDout].array.F[jj*OUTARRAYSIZE+ii] = tmpval;
                 }
+            // photon and readout noise
+            statistic_noise_poisson(data.image[IDout].array.F, data.image[IDout].array.F, OUTARRAYSIZE*OUTARRAYSIZE);
+            statistic_noise_gauss(data.image[IDout].array.F, data.image[IDout].array.F, OUTARRAYSIZE*OUTARRAYSIZE, WFSCAMRON);
 			
 			
 					
@@ -3244,14 +3577,18 @@ int AOsystSim_PyrWFS(const char *CONF_FNAME)
  *
  */
 
+//
+// DM map = SUM_act dmctrl[act] x dmifc[act]
+// the influence cube is converted once to a sparse matrix with one row per map pixel (values > eps),
+// rebuilt only if the cube changes; rows are independent, so the product runs in parallel
+//
 int AOsystSim_DMshape(const char *IDdmctrl_name, const char *IDdmifc_name, const char *IDdm_name)
 {
     long IDdmctrl, IDdmifc, IDdm;
     long dmsizex, dmsizey, DMnbact;
-    long ii, jj;
+    long ii;
     double eps=1.0e-12;
-    long k;
-    long kk;
+    long dmact;
 
     IDdmctrl = image_ID(IDdmctrl_name);
 
@@ -3261,71 +3598,57 @@ int AOsystSim_DMshape(const char *IDdmctrl_name, const char *IDdmifc_name, const
     DMnbact = data.image[IDdmifc].md[0].size[2];
 
   
-    if(DMifpixarray_init==0)
+    if((DMifCSR_IDdmifc != IDdmifc)||(DMifCSR_ctime != data.image[IDdmifc].md[0].creation_time)||(DMifCSR_cnt0 != data.image[IDdmifc].md[0].cnt0)||(DMifCSR_NBpix != dmsizex*dmsizey))
     {
-		long dmact;
-		
-        DMifpixarray_NBpix = 0.0;
-        for(dmact=0; dmact<DMnbact; dmact++)
-            for(ii=0; ii<dmsizex*dmsizey; ii++)
-                if(fabs(data.image[IDdmifc].array.F[dmact*dmsizex*dmsizey+ii])>eps)
-                    DMifpixarray_NBpix++;
-        
-        dmifpixactarray = (long*) malloc(sizeof(long)*DMifpixarray_NBpix);
-        dmifpixactarray_dmact = (long*) malloc(sizeof(long)*DMifpixarray_NBpix);
-        dmifpixactarray_ii = (long*) malloc(sizeof(long)*DMifpixarray_NBpix);
-        
-        
-        
-        DMifpixarray_NBpix = 0.0;
+        long NBnz = 0;
+        long kk;
+        float *dmif = data.image[IDdmifc].array.F;
+
+        free(DMifCSR_rowptr);
+        free(DMifCSR_act);
+        free(DMifCSR_val);
+
+        DMifCSR_NBpix = dmsizex*dmsizey;
+        DMifCSR_rowptr = (long*) calloc(DMifCSR_NBpix+1, sizeof(long));
+
         for(dmact=0; dmact<DMnbact; dmact++)
             for(ii=0; ii<dmsizex*dmsizey; ii++)
-                if(fabs(data.image[IDdmifc].array.F[dmact*dmsizex*dmsizey+ii])>eps)
-                    {
-                        dmifpixactarray[DMifpixarray_NBpix] = dmact*dmsizex*dmsizey+ii;
-                        dmifpixactarray_dmact[DMifpixarray_NBpix] = dmact;
-                        dmifpixactarray_ii[DMifpixarray_NBpix] = ii;
-                        DMifpixarray_NBpix++;
-                    }
-        
-        if(DMifpixarray_val!=NULL)
-            {
-                printf("WARNING: array DMifpixarray_val is not NULL");
-                fflush(stdout);
-            }
-        if((DMifpixarray_val = (float*) malloc(sizeof(float)*DMifpixarray_NBpix))==NULL)
-            {
-                printf("ERROR: could not allocate array DMifpixarray_val\n");
-                exit(0);
-            }
-       
-        DMifpixarray_index = (long*) malloc(sizeof(long)*DMifpixarray_NBpix);
-        DMifpixarray_pixindex = (long*) malloc(sizeof(long)*DMifpixarray_NBpix);
-        DMifpixarray_NBpix0 = DMifpixarray_NBpix;
-        DMifpixarray_init = 1;
-    }
-       
-       
-/*    DMifpixarray_NBpix = 0;
-    for(dmact=0; dmact<DMnbact; dmact++)
-        for(ii=0; ii<dmsizex*dmsizey; ii++)
-            if(fabs(data.image[IDdmifc].array.F[dmact*dmsizex*dmsizey+ii])>eps)
+                if(fabs(dmif[dmact*dmsizex*dmsizey+ii])>eps)
                 {
-                    DMifpixarray_val[DMifpixarray_NBpix] = data.image[IDdmifc].array.F[dmact*dmsizex*dmsizey+ii];
-                    DMifpixarray_index[DMifpixarray_NBpix] = dmact;
-                    DMifpixarray_pixindex[DMifpixarray_NBpix] = ii;
-                    DMifpixarray_NBpix++;
+                    DMifCSR_rowptr[ii+1]++;
+                    NBnz++;
                 }
-*/                
-                
-    for(kk=0;kk<DMifpixarray_NBpix0;kk++)
-    {
-        DMifpixarray_val[kk] = data.image[IDdmifc].array.F[dmifpixactarray[kk]];
-        DMifpixarray_index[kk] = dmifpixactarray_dmact[kk];
-        DMifpixarray_pixindex[kk] = dmifpixactarray_ii[kk];
+        for(ii=0; ii<DMifCSR_NBpix; ii++)
+            DMifCSR_rowptr[ii+1] += DMifCSR_rowptr[ii];
+
+        DMifCSR_act = (long*) malloc(sizeof(long)*NBnz);
+        if((DMifCSR_val = (float*) malloc(sizeof(float)*NBnz))==NULL)
+        {
+            printf("ERROR: could not allocate array DMifCSR_val\n");
+            exit(0);
+        }
+
+        // fill rows in actuator order
+        {
+            long *rowfill = (long*) malloc(sizeof(long)*DMifCSR_NBpix);
+            memcpy(rowfill, DMifCSR_rowptr, sizeof(long)*DMifCSR_NBpix);
+            for(dmact=0; dmact<DMnbact; dmact++)
+                for(ii=0; ii<dmsizex*dmsizey; ii++)
+                    if(fabs(dmif[dmact*dmsizex*dmsizey+ii])>eps)
+                    {
+                        kk = rowfill[ii]++;
+                        DMifCSR_act[kk] = dmact;
+                        DMifCSR_val[kk] = dmif[dmact*dmsizex*dmsizey+ii];
+                    }
+            free(rowfill);
+        }
+
+        DMifCSR_IDdmifc = IDdmifc;
+        DMifCSR_ctime = data.image[IDdmifc].md[0].creation_time;
+        DMifCSR_cnt0 = data.image[IDdmifc].md[0].cnt0;
+
+        printf("DM influence functions : %ld non-zero / %ld pix\n", NBnz, DMnbact*dmsizex*dmsizey);
     }
-    
-  //  printf("Used pix = %ld / %ld\n", DMifpixarray_NBpix, DMnbact*dmsizex*dmsizey);
   
    
     IDdm = image_ID(IDdm_name);
@@ -3333,18 +3656,18 @@ int AOsystSim_DMshape(const char *IDdmctrl_name, const char *IDdmifc_name, const
         IDdm = create_2Dimage_ID(IDdm_name, dmsizex, dmsizey);
    
  
-    for(ii=0; ii<dmsizex*dmsizey; ii++)
-        data.image[IDdm].array.F[ii] = 0.0;
-/*
-    for(dmact=0; dmact<DMnbact; dmact++)
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static)
+# endif
+    for(ii=0; ii<DMifCSR_NBpix; ii++)
     {
-        for(ii=0; ii<dmsizex*dmsizey; ii++)
-            data.image[IDdm].array.F[ii] += data.image[IDdmctrl].array.F[dmact]*data.image[IDdmifc].array.F[dmact*dmsizex*dmsizey+jj*dmsizex+ii];
-    }
-*/
+        long kk;
+        float v = 0.0;
 
-    for(k=0;k<DMifpixarray_NBpix;k++)
-        data.image[IDdm].array.F[DMifpixarray_pixindex[k]] += data.image[IDdmctrl].array.F[DMifpixarray_index[k]] * DMifpixarray_val[k];
+        for(kk=DMifCSR_rowptr[ii]; kk<DMifCSR_rowptr[ii+1]; kk++)
+            v += data.image[IDdmctrl].array.F[DMifCSR_act[kk]] * DMifCSR_val[kk];
+        data.image[IDdm].array.F[ii] = v;
+    }
     
     return (0);
 }
@@ -4109,8 +4432,7 @@ int AOsystSim_coroLOWFS(const char *CONF_FNAME)
 		// loc_  for local files (not shared)
         mk_complex_from_amph("aosim_wfa", "aosim_wfp", "loc_aosim_wfc", 0);
         permut("loc_aosim_wfc");
-        do2dfft("loc_aosim_wfc", "loc_aosim_fc0");
-        permut("loc_aosim_fc0");
+        do2dfft_shift("loc_aosim_wfc", "loc_aosim_fc0");
         mk_amph_from_complex("loc_aosim_fc0", "aosim_foc0_amp", "aosim_foc0_pha", 1);
         delete_image_ID("loc_aosim_wfc");
         delete_image_ID("loc_aosim_fc0");
@@ -4165,8 +4487,7 @@ int AOsystSim_coroLOWFS(const char *CONF_FNAME)
 		// COMPUTE foc2
 		mk_complex_from_amph("aosim_pup1t_amp", "aosim_pup1t_pha", "loc_aosim_pup1t_c", 0);
         permut("loc_aosim_pup1t_c");
-        do2dfft("loc_aosim_pup1t_c", "loc_aosim_foc2_c");
-        permut("loc_aosim_foc2_c");
+        do2dfft_shift("loc_aosim_pup1t_c", "loc_aosim_foc2_c");
         mk_amph_from_complex("loc_aosim_foc2_c", "aosim_foc2_amp", "aosim_foc2_pha", 1);
         delete_image_ID("loc_aosim_pup1t_c");
         delete_image_ID("loc_aosim_foc2_c");
@@ -4192,8 +4513,7 @@ int AOsystSim_coroLOWFS(const char *CONF_FNAME)
 		// COMPUTE foclowfs
 		mk_complex_from_amph("aosim_pup1r_amp", "aosim_pup1r_pha", "loc_aosim_pup1r_c", 0);
         permut("loc_aosim_pup1r_c");
-        do2dfft("loc_aosim_pup1r_c", "loc_aosim_foc1r_c");
-        permut("loc_aosim_foc1r_c");
+        do2dfft_shift("loc_aosim_pup1r_c", "loc_aosim_foc1r_c");
         mk_amph_from_complex("loc_aosim_foc1r_c", "aosim_foclowfs_amp", "aosim_foclowfs_pha", 1);
         delete_image_ID("loc_aosim_pup1r_c");
         delete_image_ID("loc_aosim_foc1r_c");
@@ -4413,6 +4733,7 @@ long AOsystSim_FPWFS_imsimul(double probeamp, double sepx, double sepy, double c
     long IDwfA; // probe A
     long IDwfB; // probe B
     long IDwf;
+    long IDwfc;
     long IDpsfC; // PSF cube
     long pr;
     long IDa;
@@ -4489,19 +4810,50 @@ long AOsystSim_FPWFS_imsimul(double probeamp, double sepx, double sepy, double c
     probeBphaseoffset = 1.0*M_PI/2.0; // 0.8
 
 
-    for(ii=0; ii<size; ii++)
-        for(jj=0; jj<size; jj++)
+    // sum of cosines over the (CPAx,CPAy) grid is separable:
+    // SUM cos(u+v) = Cx.Cy - Sx.Sy , SUM sin(u+v) = Sx.Cy + Cx.Sy
+    // with Cx(ii) = SUM_CPAx cos(pi x CPAx), Sx(ii) = SUM_CPAx sin(pi x CPAx) (same for y)
+    {
+        double *Cx = (double*) calloc(size, sizeof(double));
+        double *Sx = (double*) calloc(size, sizeof(double));
+        double *Cy = (double*) calloc(size, sizeof(double));
+        double *Sy = (double*) calloc(size, sizeof(double));
+
+        for(ii=0; ii<size; ii++)
         {
             x = (1.0*ii-0.5*size)/puprad;
-            y = (1.0*jj-0.5*size)/puprad;
             for(CPAx=CPAxmin; CPAx<CPAxmax; CPAx += CPAstep)
-                for(CPAy=CPAymin; CPAy<CPAymax; CPAy += CPAstep)
-                {
-                    data.image[IDwfA].array.F[jj*size+ii] += probeAmultcoeff*probeamp*CPAstep*CPAstep*cos(M_PI*(x*CPAx+y*CPAy));
-                    data.image[IDwfB].array.F[jj*size+ii] += probeBmultcoeff*probeamp*CPAstep*CPAstep*cos(M_PI*(x*CPAx+y*CPAy)+probeBphaseoffset);
-                }
+            {
+                Cx[ii] += cos(M_PI*x*CPAx);
+                Sx[ii] += sin(M_PI*x*CPAx);
+            }
+        }
+        for(jj=0; jj<size; jj++)
+        {
+            y = (1.0*jj-0.5*size)/puprad;
+            for(CPAy=CPAymin; CPAy<CPAymax; CPAy += CPAstep)
+            {
+                Cy[jj] += cos(M_PI*y*CPAy);
+                Sy[jj] += sin(M_PI*y*CPAy);
+            }
         }
 
+        for(ii=0; ii<size; ii++)
+            for(jj=0; jj<size; jj++)
+            {
+                double sumcos = Cx[ii]*Cy[jj] - Sx[ii]*Sy[jj];
+                double sumsin = Sx[ii]*Cy[jj] + Cx[ii]*Sy[jj];
+
+                data.image[IDwfA].array.F[jj*size+ii] += probeAmultcoeff*probeamp*CPAstep*CPAstep*sumcos;
+                data.image[IDwfB].array.F[jj*size+ii] += probeBmultcoeff*probeamp*CPAstep*CPAstep*(sumcos*cos(probeBphaseoffset) - sumsin*sin(probeBphaseoffset));
+            }
+
+        free(Cx);
+        free(Sx);
+        free(Cy);
+        free(Sy);
+    }
+
     // DM gain error
     for(ii=0; ii<size; ii++)
         for(jj=0; jj<size; jj++)
@@ -4530,6 +4882,8 @@ long AOsystSim_FPWFS_imsimul(double probeamp, double sepx, double sepy, double c
     save_fl_fits("pupa", "!AOsystSim_wdir/pupa.fits");
 
 
+    // all probe fields in one cube, transformed with a single batched FFT
+    IDwfc = create_3DCimage_ID("wfc", size, size, NBprobesG);
     for(pr=0; pr<NBprobesG; pr++)
     {
         if(pr==0)
@@ -4549,22 +4903,35 @@ long AOsystSim_FPWFS_imsimul(double probeamp, double sepx, double sepy, double c
         sprintf(fname, "!AOsystSim_wdir/DMprobe%02ld.fits", pr);
         save_fl_fits("wf", fname);
 
-        mk_complex_from_amph("pupa", "wf", "wfc", 0);
-        permut("wfc");
-        do2dfft("wfc", "imc");
-        permut("imc");
-        mk_amph_from_complex("imc", "ima", "imp", 0);
-        delete_image_ID("imc");
-        delete_image_ID("imp");
-        IDa = image_ID("ima");
-        for(ii=0; ii<size*size; ii++)
-        {
-            data.image[IDpsfC].array.F[pr*size*size+ii] = data.image[IDa].array.F[ii]*data.image[IDa].array.F[ii];
-            tot1 += data.image[IDpsfC].array.F[pr*size*size+ii];
-        }
-        delete_image_ID("ima");
+        // pupil field, quadrant-swapped (permut)
+        for(ii=0; ii<size; ii++)
+            for(jj=0; jj<size; jj++)
+            {
+                long index = ((jj+size/2)%size)*size + (ii+size/2)%size;
+                double amp = data.image[IDpupa].array.F[index];
+
+                data.image[IDwfc].array.CF[pr*size*size+jj*size+ii].re = amp*cos(data.image[IDwf].array.F[index]);
+                data.image[IDwfc].array.CF[pr*size*size+jj*size+ii].im = amp*sin(data.image[IDwf].array.F[index]);
+            }
     }
 
+    do2dfft_shift("wfc", "imc");
+    delete_image_ID("wfc");
+    fft_gpu_sync("imc");
+    IDa = image_ID("imc");
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for reduction(+:tot1)
+# endif
+    for(ii=0; ii<size*size*NBprobesG; ii++)
+    {
+        complex_float c = data.image[IDa].array.CF[ii];
+
+        data.image[IDpsfC].array.F[ii] = c.re*c.re + c.im*c.im;
+        tot1 += data.image[IDpsfC].array.F[ii];
+    }
+    delete_image_ID("imc");
+
     // ADD COMPANIONS
     printf("Adding companions\n");
     fflush(stdout);
@@ -4672,9 +5039,7 @@ long AOsystSim_FPWFS_imsimul(double probeamp, double sepx, double sepy, double c
     put_poisson_noise("psfCcrop", "psfCcropn");
     // add readout noise
     ID = image_ID("psfCcropn");
-    for(ii1=0; ii1<xsize; ii1++)
-        for(jj1=0; jj1<ysize; jj1++)
-            data.image[ID].array.F[jj1*xsize+ii1] += RON * gauss();
+    statistic_noise_gauss(data.image[ID].array.F, data.image[ID].array.F, xsize*ysize, RON);
 
 
     save_fl_fits("psfCcrop", "!AOsystSim_wdir/psfCcrop.fits");
@@ -4849,8 +5214,7 @@ int AOsystSim_FPWFS_mkprobes(const char *IDprobeA_name, const char *IDprobeB_nam
 
     mk_complex_from_amph("pupa", "pupp", "pupc", 0);
     permut("pupc");
-    do2dfft("pupc","focc");
-    permut("focc");
+    do2dfft_shift("pupc", "focc");
     mk_amph_from_complex("focc","foca","focp", 0);
     save_fits("pupa", "!AOsystSim_wdir/test_pupa.fits");
     save_fits("pupp", "!AOsystSim_wdir/test_pupp_A.fits");
@@ -4868,8 +5232,7 @@ int AOsystSim_FPWFS_mkprobes(const char *IDprobeA_name, const char *IDprobeB_nam
             data.image[ID].array.F[(jj+(imsize-dmysize)/2)*imsize+(ii+(imsize-dmxsize)/2)] = data.image[IDdmB].array.F[jj*dmxsize+ii];
     mk_complex_from_amph("pupa", "pupp", "pupc", 0);
     permut("pupc");
-    do2dfft("pupc","focc");
-    permut("focc");
+    do2dfft_shift("pupc", "focc");
     mk_amph_from_complex("focc","foca","focp", 0);
     save_fits("pupp", "!AOsystSim_wdir/test_pupp_B.fits");
     save_fits("foca", "!AOsystSim_wdir/test_foca_B.fits");
@@ -4885,8 +5248,7 @@ int AOsystSim_FPWFS_mkprobes(const char *IDprobeA_name, const char *IDprobeB_nam
             data.image[ID].array.F[(jj+(imsize-dmysize)/2)*imsize+(ii+(imsize-dmxsize)/2)] = -data.image[IDdmA].array.F[jj*dmxsize+ii];
     mk_complex_from_amph("pupa", "pupp", "pupc", 0);
     permut("pupc");
-    do2dfft("pupc","focc");
-    permut("focc");
+    do2dfft_shift("pupc", "focc");
     mk_amph_from_complex("focc","foca","focp", 0);
     save_fits("pupp", "!AOsystSim_wdir/test_pupp_mA.fits");
     save_fits("foca", "!AOsystSim_wdir/test_foca_mA.fits");
@@ -4902,8 +5264,7 @@ int AOsystSim_FPWFS_mkprobes(const char *IDprobeA_name, const char *IDprobeB_nam
             data.image[ID].array.F[(jj+(imsize-dmysize)/2)*imsize+(ii+(imsize-dmxsize)/2)] = -data.image[IDdmB].array.F[jj*dmxsize+ii];
     mk_complex_from_amph("pupa", "pupp", "pupc", 0);
     permut("pupc");
-    do2dfft("pupc","focc");
-    permut("focc");
+    do2dfft_shift("pupc", "focc");
     mk_amph_from_complex("focc","foca","focp", 0);
     save_fits("pupp", "!AOsystSim_wdir/test_pupp_mB.fits");
     save_fits("foca", "!AOsystSim_wdir/test_foca_mB.fits");
@@ -4921,8 +5282,7 @@ int AOsystSim_FPWFS_mkprobes(const char *IDprobeA_name, const char *IDprobeB_nam
             data.image[ID].array.F[(jj+(imsize-dmysize)/2)*imsize+(ii+(imsize-dmxsize)/2)] = 0.0;
     mk_complex_from_amph("pupa", "pupp", "pupc", 0);
     permut("pupc");
-    do2dfft("pupc","focc");
-    permut("focc");
+    do2dfft_shift("pupc", "focc");
     mk_amph_from_complex("focc","foca","focp", 0);
     save_fits("pupp", "!AOsystSim_wdir/test_pupp_00.fits");
     save_fits("foca", "!AOsystSim_wdir/test_foca_00.fits");
@@ -216,6 +216,10 @@ int AOsystSim_mkWF(const char *CONF_FNAME);
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+int AOsystSim_WFSsim_Pyramid_linearize(const char *inWFc_name, double modampl, long modnbpts, double pokeampl);
+
+int AOsystSim_WFSsim_Pyramid_setmodel(int mode, long NBupdate);
+
 int AOsystSim_WFSsim_Pyramid(const char *inWFc_name, const char *outWFSim_name, double modampl, long modnbpts);
 
 int AOsystSim_runWFS(long index, const char *IDout_name);
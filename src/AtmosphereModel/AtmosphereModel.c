@@ -80,6 +80,25 @@ static float *RH;
 static float dens0;
 
 
+// per-wavelength altitude tables of Lorentz-Lorenz sum and absorption coefficient
+// (both linear in species densities), rebuilt when the density model changes
+#define ATMMODEL_NTABLE_NB 8
+
+#define ATMMODEL_RPATH_NBLANE 16    // wavelengths integrated in lock-step by AtmosphereModel_RefractionPath_batch
+#define ATMMODEL_RPATH_CHUNK 128    // wavelengths per altitude table block
+typedef struct
+{
+    long version;
+    float lambda;
+    long lastuse;
+    double *LL;
+    double *abs;
+} ATMMODEL_NTABLE;
+static ATMMODEL_NTABLE ATMMODEL_ntable[ATMMODEL_NTABLE_NB];
+static long ATMMODEL_ntable_version = 1;
+static long ATMMODEL_ntable_cnt = 0;
+
+
 
 
 
@@ -240,6 +259,17 @@ int_fast8_t AtmosphereModel_Create_from_CONF_cli()
 }
 
 
+int_fast8_t AtmosphereModel_RefractionGrid_mkfile_cli()
+{
+    if(CLI_checkarg(1,1)+CLI_checkarg(2,1)+CLI_checkarg(3,2)+CLI_checkarg(4,1)+CLI_checkarg(5,1)+CLI_checkarg(6,2)+CLI_checkarg(7,3)==0)
+        AtmosphereModel_RefractionGrid_mkfile(data.cmdargtoken[1].val.numf, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.string);
+    else
+        return 1;
+
+    return 0;
+}
+
+
 int_fast8_t init_AtmosphereModel()
 {
     strcpy(data.module[data.NBmodule].name, __FILE__);
@@ -282,6 +312,15 @@ int_fast8_t init_AtmosphereModel()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AtmosphereModel_Create_from_CONF(const char *CONFFILE, float slambda)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"atmrefractgrid");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AtmosphereModel_RefractionGrid_mkfile_cli;
+    strcpy(data.cmd[data.NBcmd].info,"refraction/transmission grid vs wavelength and zenith angle (current atmosphere model)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<lambda0> <lambda1> <NBlambda> <Zangle0 [rad]> <Zangle1 [rad]> <NBZangle> <output file>");
+    strcpy(data.cmd[data.NBcmd].example,"atmrefractgrid 0.5e-6 2.5e-6 201 0.0 1.2 61 refractgrid.txt");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int AtmosphereModel_RefractionGrid_mkfile(double lambda0, double lambda1, long NBlambda, double Zangle0, double Zangle1, long NBZangle, const char *fname)");
+    data.NBcmd++;
+
 
     return 0;
 }
@@ -3210,7 +3249,7 @@ double AirMixture_N(double lambda, double dens_N2, double dens_O2, double dens_A
 // computes N = (n-1)
 // absorption coefficient stored in v_ABSCOEFF variable
 //
-float AtmosphereModel_stdAtmModel_N(float alt, float lambda, int mode)
+static float AtmosphereModel_stdAtmModel_N_direct(float alt, float lambda, int mode)
 {
     float dens;
     float val;
@@ -3237,7 +3276,9 @@ float AtmosphereModel_stdAtmModel_N(float alt, float lambda, int mode)
 
     i = (long) (alt/10.0);
     if(i>9998)
-        i = 9999;
+        i = 9998;
+    if(i<0)
+        i = 0;
     ifrac = 1.0*alt/10.0 - i;
 
     if(ifrac<0)
@@ -3317,6 +3358,184 @@ float AtmosphereModel_stdAtmModel_N(float alt, float lambda, int mode)
 
 
 
+//
+// fills LL and absorption altitude tables (10000 points) for wavelength lambda
+// species contributions are obtained from AirMixture_N at Loschmidt density, one species at a time
+// not thread-safe (AirMixture_N updates static search indices and v_ABSCOEFF)
+//
+static void AtmosphereModel_stdAtmModel_ntable_fill(double lambda, double *LLarray, double *absarray)
+{
+    double D0 = 2.6867805e25/1e6; // [cm-3]
+    double dens[14];
+    double g[14], a[14];
+    float *dptr[14];
+    double n, vabs0;
+    int k, s;
+    long i;
+
+    // same species order as AirMixture_N arguments
+    dptr[0] = densN2;
+    dptr[1] = densO2;
+    dptr[2] = densAr;
+    dptr[3] = densH2O;
+    dptr[4] = densCO2;
+    dptr[5] = densNe;
+    dptr[6] = densHe;
+    dptr[7] = densCH4;
+    dptr[8] = densKr;
+    dptr[9] = densH2;
+    dptr[10] = densO3;
+    dptr[11] = densN;
+    dptr[12] = densO;
+    dptr[13] = densH;
+
+    vabs0 = v_ABSCOEFF;
+    for(s=0; s<14; s++)
+    {
+        for(k=0; k<14; k++)
+            dens[k] = 0.0;
+        dens[s] = D0;
+        v_ABSCOEFF = 0.0;
+        n = 1.0 + AirMixture_N(lambda, dens[0], dens[1], dens[2], dens[3], dens[4], dens[5], dens[6], dens[7], dens[8], dens[9], dens[10], dens[11], dens[12], dens[13]);
+        g[s] = (n*n-1.0)/(n*n+2.0)/D0;
+        a[s] = v_ABSCOEFF/D0;
+    }
+    v_ABSCOEFF = vabs0;
+
+    for(i=0; i<10000; i++)
+    {
+        double LL = 0.0;
+        double abscoeff = 0.0;
+
+        for(s=0; s<14; s++)
+        {
+            LL += g[s]*dptr[s][i];
+            abscoeff += a[s]*dptr[s][i];
+        }
+        LLarray[i] = LL;
+        absarray[i] = abscoeff;
+    }
+}
+
+
+
+//
+// returns cached LL and absorption altitude tables for wavelength lambda
+//
+static ATMMODEL_NTABLE *AtmosphereModel_stdAtmModel_ntable(float lambda)
+{
+    ATMMODEL_NTABLE *tab;
+    int k;
+
+    ATMMODEL_ntable_cnt++;
+
+    tab = &ATMMODEL_ntable[0];
+    for(k=0; k<ATMMODEL_NTABLE_NB; k++)
+    {
+        if((ATMMODEL_ntable[k].version == ATMMODEL_ntable_version)&&(ATMMODEL_ntable[k].lambda == lambda))
+        {
+            ATMMODEL_ntable[k].lastuse = ATMMODEL_ntable_cnt;
+            return(&ATMMODEL_ntable[k]);
+        }
+        if(ATMMODEL_ntable[k].lastuse < tab->lastuse)
+            tab = &ATMMODEL_ntable[k];
+    }
+
+    if(tab->LL == NULL)
+    {
+        tab->LL = (double*) malloc(sizeof(double)*10000);
+        tab->abs = (double*) malloc(sizeof(double)*10000);
+    }
+
+    AtmosphereModel_stdAtmModel_ntable_fill(lambda, tab->LL, tab->abs);
+
+    tab->version = ATMMODEL_ntable_version;
+    tab->lambda = lambda;
+    tab->lastuse = ATMMODEL_ntable_cnt;
+
+    return(tab);
+}
+
+
+
+//
+// alt [m]
+// lambda [m]
+//
+// computes N = (n-1)
+// absorption coefficient stored in v_ABSCOEFF variable
+// mode 1 (testing) prints species densities
+//
+float AtmosphereModel_stdAtmModel_N(float alt, float lambda, int mode)
+{
+    ATMMODEL_NTABLE *tab;
+    long i;
+    double ifrac;
+    double LL;
+
+    if(mode != 0)
+        return(AtmosphereModel_stdAtmModel_N_direct(alt, lambda, mode));
+
+    tab = AtmosphereModel_stdAtmModel_ntable(lambda);
+
+    i = (long) (alt/10.0);
+    if(i>9998)
+        i = 9998;
+    if(i<0)
+        i = 0;
+    ifrac = 1.0*alt/10.0 - i;
+    if(ifrac<0)
+        ifrac = 0.0;
+    if(ifrac>1.0)
+        ifrac = 1.0;
+
+    LL = (1.0-ifrac)*tab->LL[i] + ifrac*tab->LL[i+1];
+    v_ABSCOEFF = (1.0-ifrac)*tab->abs[i] + ifrac*tab->abs[i+1];
+
+    return((float) (sqrt((2.0*LL+1.0)/(1.0-LL)) - 1.0));
+}
+
+
+
+//
+// N = (n-1) at NBpt altitudes alt[] [m], single wavelength lambda [m]
+// absorption coefficient of last altitude stored in v_ABSCOEFF variable
+//
+int AtmosphereModel_stdAtmModel_N_batch(const float *alt, long NBpt, float lambda, float *N)
+{
+    ATMMODEL_NTABLE *tab;
+    long k;
+
+    if(NBpt < 1)
+        return(0);
+
+    tab = AtmosphereModel_stdAtmModel_ntable(lambda);
+
+    for(k=0; k<NBpt; k++)
+    {
+        long i = (long) (alt[k]/10.0);
+        double ifrac, LL;
+
+        if(i>9998)
+            i = 9998;
+        if(i<0)
+            i = 0;
+        ifrac = 1.0*alt[k]/10.0 - i;
+        if(ifrac<0)
+            ifrac = 0.0;
+        if(ifrac>1.0)
+            ifrac = 1.0;
+        LL = (1.0-ifrac)*tab->LL[i] + ifrac*tab->LL[i+1];
+        N[k] = (float) (sqrt((2.0*LL+1.0)/(1.0-LL)) - 1.0);
+        if(k == NBpt-1)
+            v_ABSCOEFF = (1.0-ifrac)*tab->abs[i] + ifrac*tab->abs[i+1];
+    }
+
+    return(0);
+}
+
+
+
 
 
 
@@ -3800,6 +4019,7 @@ int AtmosphereModel_build_stdAtmModel(const char *fname)
 
     free(TotPart0);
 
+    ATMMODEL_ntable_version++;
 
     AtmosphereModel_save_stdAtmModel(fname);
 
@@ -3860,6 +4080,8 @@ int AtmosphereModel_load_stdAtmModel(const char *fname)
 
     fclose(fp);
 
+    ATMMODEL_ntable_version++;
+
     return 0;
 }
 
@@ -4169,10 +4391,27 @@ int AtmosphereModel_Create_from_CONF(const char *CONFFILE, float slambda)
 	// refractive angle as a function of wavelength
 	printf("Computing refraction angle ... \n");
 	fflush(stdout);
-	fp = fopen("RefractAngle.dat", "w");
-	for(l=0.5e-6;l<10.0e-6;l*=1.0+1e-3)
-		fprintf(fp, "%20.18f  %.6f\n", l, AtmosphereModel_RefractionPath(l, ZenithAngle, 0));
-	fclose(fp);
+	{
+		double *larray, *rarray;
+		double Zangle = ZenithAngle;
+		long NBl = 0;
+
+		for(l=0.5e-6;l<10.0e-6;l*=1.0+1e-3)
+			NBl++;
+		larray = (double*) malloc(sizeof(double)*NBl);
+		rarray = (double*) malloc(sizeof(double)*NBl);
+		NBl = 0;
+		for(l=0.5e-6;l<10.0e-6;l*=1.0+1e-3)
+			larray[NBl++] = l;
+		AtmosphereModel_RefractionPath_batch(larray, NBl, &Zangle, 1, rarray, NULL);
+
+		fp = fopen("RefractAngle.dat", "w");
+		for(li=0; li<NBl; li++)
+			fprintf(fp, "%20.18f  %.6f\n", larray[li], rarray[li]);
+		fclose(fp);
+		free(larray);
+		free(rarray);
+	}
 	printf("done\n");
 	fflush(stdout);
 
@@ -4303,4 +4542,321 @@ double AtmosphereModel_RefractionPath(double lambda, double Zangle, int WritePat
 
 
 
+//
+// integrates NBl <= ATMMODEL_RPATH_NBLANE wavelengths through the atmosphere for one zenith angle
+// same scheme as AtmosphereModel_RefractionPath(), wavelengths advance in lock-step
+// LL, abs : altitude tables of lane 0, lanes are 10000 apart
+//
+static void AtmosphereModel_RefractionPath_lanes(const double *LL, const double *abs, int NBl, double Zangle, double *refract, double *transm)
+{
+    double lstep = 20.0; // beam distance step [m]
+    double Re = 6371000.0; // Earth radius [m]
+    double x0[ATMMODEL_RPATH_NBLANE], y0[ATMMODEL_RPATH_NBLANE];
+    double n0[ATMMODEL_RPATH_NBLANE], alpha[ATMMODEL_RPATH_NBLANE], h1[ATMMODEL_RPATH_NBLANE];
+    double flux[ATMMODEL_RPATH_NBLANE], Zangle0[ATMMODEL_RPATH_NBLANE];
+    int active[ATMMODEL_RPATH_NBLANE]; // 1 while iterating on launch angle
+    int run[ATMMODEL_RPATH_NBLANE];    // 1 while below top of atmosphere
+    int NBactive, NBrun;
+    long iter = 0;
+    int k;
+
+    for(k=0; k<NBl; k++)
+    {
+        Zangle0[k] = Zangle;
+        active[k] = 1;
+        flux[k] = 1.0;
+    }
+    NBactive = NBl;
+
+    while((iter<20)&&(NBactive>0))
+    {
+        for(k=0; k<NBl; k++)
+        {
+            long i = (long) (SiteAlt/10.0);
+            double ifrac, LL0;
+
+            if(i>9998)
+                i = 9998;
+            if(i<0)
+                i = 0;
+            ifrac = SiteAlt/10.0 - i;
+            if(ifrac<0)
+                ifrac = 0.0;
+            if(ifrac>1.0)
+                ifrac = 1.0;
+            LL0 = (1.0-ifrac)*LL[10000*k+i] + ifrac*LL[10000*k+i+1];
+
+            x0[k] = 0.0;
+            y0[k] = 0.0;
+            alpha[k] = Zangle0[k];
+            n0[k] = sqrt((2.0*LL0+1.0)/(1.0-LL0));
+            h1[k] = 0.0;
+            run[k] = active[k];
+            if(active[k] == 1)
+                flux[k] = 1.0;
+        }
+
+        NBrun = NBactive;
+        while(NBrun>0)
+        {
+            #pragma omp simd
+            for(k=0; k<NBl; k++)
+                if(run[k] == 1)
+                {
+                    double x1 = x0[k] + lstep*sin(alpha[k]);
+                    double y1 = y0[k] + lstep*cos(alpha[k]);
+                    double yc = y1 + SiteAlt + Re;
+                    double hk = sqrt(x1*x1 + yc*yc) - Re;
+                    long i = (long) (hk/10.0);
+                    double ifrac, LLk, n1, alphae;
+
+                    if(i>9998)
+                        i = 9998;
+                    if(i<0)
+                        i = 0;
+                    ifrac = hk/10.0 - i;
+                    if(ifrac<0)
+                        ifrac = 0.0;
+                    if(ifrac>1.0)
+                        ifrac = 1.0;
+                    LLk = (1.0-ifrac)*LL[10000*k+i] + ifrac*LL[10000*k+i+1];
+                    n1 = sqrt((2.0*LLk+1.0)/(1.0-LLk));
+                    flux[k] *= exp(-lstep*((1.0-ifrac)*abs[10000*k+i] + ifrac*abs[10000*k+i+1]));
+
+                    alphae = atan2(x1, yc);
+                    alpha[k] = asin(n0[k]*sin(alpha[k]-alphae)/n1) + alphae;
+
+                    n0[k] = n1;
+                    x0[k] = x1;
+                    y0[k] = y1;
+                    h1[k] = hk;
+                }
+
+            NBrun = 0;
+            for(k=0; k<NBl; k++)
+            {
+                if(h1[k] >= 99000.0)
+                    run[k] = 0;
+                NBrun += run[k];
+            }
+        }
+
+        for(k=0; k<NBl; k++)
+            if(active[k] == 1)
+            {
+                double offsetangle = alpha[k]-Zangle;
+
+                Zangle0[k] -= offsetangle;
+                if(!(fabs(offsetangle/M_PI*180.0*3600.0) > 0.00001))
+                {
+                    active[k] = 0;
+                    NBactive--;
+                }
+            }
+        iter++;
+    }
+
+    for(k=0; k<NBl; k++)
+    {
+        refract[k] = (Zangle-Zangle0[k])/M_PI*180.0*3600.0;
+        if(transm != NULL)
+            transm[k] = flux[k];
+    }
+}
+
+
+
+//
+// refraction [arcsec] and transmission for NBlambda wavelengths [m] x NBZangle zenith angles [rad]
+// output arrays index : iz*NBlambda + il (transm may be NULL)
+// wavelengths are integrated in lock-step groups, groups and zenith angles are distributed over threads
+//
+int AtmosphereModel_RefractionPath_batch(const double *lambda, long NBlambda, const double *Zangle, long NBZangle, double *refract, double *transm)
+{
+    double *LLarray;
+    double *absarray;
+    long l0;
+
+    if((NBlambda < 1)||(NBZangle < 1))
+        return(0);
+
+    LLarray = (double*) malloc(sizeof(double)*10000*ATMMODEL_RPATH_CHUNK);
+    absarray = (double*) malloc(sizeof(double)*10000*ATMMODEL_RPATH_CHUNK);
+    if((LLarray == NULL)||(absarray == NULL))
+    {
+        printf("ERROR: AtmosphereModel_RefractionPath_batch: malloc error\n");
+        free(LLarray);
+        free(absarray);
+        return(1);
+    }
+
+    for(l0=0; l0<NBlambda; l0+=ATMMODEL_RPATH_CHUNK)
+    {
+        long nl = NBlambda-l0;
+        long ngroup, task;
+        long il;
+
+        if(nl > ATMMODEL_RPATH_CHUNK)
+            nl = ATMMODEL_RPATH_CHUNK;
+
+        for(il=0; il<nl; il++)
+            AtmosphereModel_stdAtmModel_ntable_fill(lambda[l0+il], LLarray+10000*il, absarray+10000*il);
+
+        ngroup = (nl+ATMMODEL_RPATH_NBLANE-1)/ATMMODEL_RPATH_NBLANE;
+
+        # ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+        # endif
+        for(task=0; task<ngroup*NBZangle; task++)
+        {
+            long iz = task/ngroup;
+            long g = task%ngroup;
+            long il0 = g*ATMMODEL_RPATH_NBLANE;
+            int NBl = ATMMODEL_RPATH_NBLANE;
+
+            if(il0+NBl > nl)
+                NBl = nl-il0;
+
+            AtmosphereModel_RefractionPath_lanes(LLarray+10000*il0, absarray+10000*il0, NBl, Zangle[iz], refract+iz*NBlambda+l0+il0, (transm == NULL) ? NULL : transm+iz*NBlambda+l0+il0);
+        }
+    }
+
+    free(LLarray);
+    free(absarray);
+
+    return(0);
+}
+
+
+
+//
+// refraction lookup grid, uniform in wavelength and zenith angle
+//
+ATMMODEL_REFRACTGRID *AtmosphereModel_RefractionGrid_create(double lambda0, double lambda1, long NBlambda, double Zangle0, double Zangle1, long NBZangle)
+{
+    ATMMODEL_REFRACTGRID *grid;
+    double *lambda;
+    double *Zangle;
+    long i;
+
+    if((NBlambda < 2)||(NBZangle < 2)||!(lambda1 > lambda0)||!(Zangle1 > Zangle0))
+    {
+        printf("ERROR: refraction grid needs at least 2x2 points and increasing ranges\n");
+        return(NULL);
+    }
+
+    grid = (ATMMODEL_REFRACTGRID*) malloc(sizeof(ATMMODEL_REFRACTGRID));
+    grid->lambda0 = lambda0;
+    grid->lambda1 = lambda1;
+    grid->NBlambda = NBlambda;
+    grid->Zangle0 = Zangle0;
+    grid->Zangle1 = Zangle1;
+    grid->NBZangle = NBZangle;
+    grid->refract = (double*) malloc(sizeof(double)*NBlambda*NBZangle);
+    grid->transm = (double*) malloc(sizeof(double)*NBlambda*NBZangle);
+
+    lambda = (double*) malloc(sizeof(double)*NBlambda);
+    Zangle = (double*) malloc(sizeof(double)*NBZangle);
+    for(i=0; i<NBlambda; i++)
+        lambda[i] = lambda0 + (lambda1-lambda0)*i/(NBlambda-1);
+    for(i=0; i<NBZangle; i++)
+        Zangle[i] = Zangle0 + (Zangle1-Zangle0)*i/(NBZangle-1);
+
+    if(AtmosphereModel_RefractionPath_batch(lambda, NBlambda, Zangle, NBZangle, grid->refract, grid->transm) != 0)
+    {
+        AtmosphereModel_RefractionGrid_free(grid);
+        grid = NULL;
+    }
+
+    free(lambda);
+    free(Zangle);
+
+    return(grid);
+}
+
+
+
+// bilinear interpolation of refraction [arcsec], clamped to grid range
+double AtmosphereModel_RefractionGrid_interp(const ATMMODEL_REFRACTGRID *grid, double lambda, double Zangle)
+{
+    double x = (lambda-grid->lambda0)/(grid->lambda1-grid->lambda0)*(grid->NBlambda-1);
+    double y = (Zangle-grid->Zangle0)/(grid->Zangle1-grid->Zangle0)*(grid->NBZangle-1);
+    long ix, iy;
+    double *r;
+
+    if(x < 0.0)
+        x = 0.0;
+    if(x > grid->NBlambda-1)
+        x = grid->NBlambda-1;
+    if(y < 0.0)
+        y = 0.0;
+    if(y > grid->NBZangle-1)
+        y = grid->NBZangle-1;
+    ix = (long) x;
+    iy = (long) y;
+    if(ix > grid->NBlambda-2)
+        ix = grid->NBlambda-2;
+    if(iy > grid->NBZangle-2)
+        iy = grid->NBZangle-2;
+    x -= ix;
+    y -= iy;
+
+    r = grid->refract + iy*grid->NBlambda + ix;
+
+    return((1.0-y)*((1.0-x)*r[0] + x*r[1]) + y*((1.0-x)*r[grid->NBlambda] + x*r[grid->NBlambda+1]));
+}
+
+
+
+/// ASCII output, one line per grid point : lambda[m] Zangle[rad] refraction[arcsec] transmission
+int AtmosphereModel_RefractionGrid_save(const ATMMODEL_REFRACTGRID *grid, const char *fname)
+{
+    FILE *fp;
+    long il, iz;
+
+    fp = fopen(fname, "w");
+    if(fp == NULL)
+    {
+        printf("ERROR: cannot create file \"%s\"\n", fname);
+        return(1);
+    }
+    fprintf(fp, "# %ld wavelengths [%g %g] m   %ld zenith angles [%g %g] rad\n", grid->NBlambda, grid->lambda0, grid->lambda1, grid->NBZangle, grid->Zangle0, grid->Zangle1);
+    fprintf(fp, "#  1:lambda[m]  2:Zangle[rad]  3:refraction[arcsec]  4:transmission\n");
+    for(iz=0; iz<grid->NBZangle; iz++)
+        for(il=0; il<grid->NBlambda; il++)
+            fprintf(fp, "%20.18f  %.10f  %.6f  %.8f\n", grid->lambda0 + (grid->lambda1-grid->lambda0)*il/(grid->NBlambda-1), grid->Zangle0 + (grid->Zangle1-grid->Zangle0)*iz/(grid->NBZangle-1), grid->refract[iz*grid->NBlambda+il], grid->transm[iz*grid->NBlambda+il]);
+    fclose(fp);
+
+    return(0);
+}
+
+
+
+void AtmosphereModel_RefractionGrid_free(ATMMODEL_REFRACTGRID *grid)
+{
+    if(grid == NULL)
+        return;
+    free(grid->refract);
+    free(grid->transm);
+    free(grid);
+}
+
+
+
+int AtmosphereModel_RefractionGrid_mkfile(double lambda0, double lambda1, long NBlambda, double Zangle0, double Zangle1, long NBZangle, const char *fname)
+{
+    ATMMODEL_REFRACTGRID *grid;
+    int ret;
+
+    grid = AtmosphereModel_RefractionGrid_create(lambda0, lambda1, NBlambda, Zangle0, Zangle1, NBZangle);
+    if(grid == NULL)
+        return(1);
+    ret = AtmosphereModel_RefractionGrid_save(grid, fname);
+    AtmosphereModel_RefractionGrid_free(grid);
+
+    return(ret);
+}
+
+
+
 
@@ -4,6 +4,7 @@
 
 double AirMixture_N(double lambda, double dens_N2, double dens_O2, double dens_Ar, double dens_H2O, double dens_CO2, double dens_Ne, double dens_He, double dens_CH4, double dens_Kr, double dens_H2, double dens_O3, double dens_N, double dens_O, double dens_H);
 float AtmosphereModel_stdAtmModel_N(float alt, float lambdaum, int mode);
+int AtmosphereModel_stdAtmModel_N_batch(const float *alt, long NBpt, float lambda, float *N);
 double AtmosphereModel_H2O_Saturation(double T);
 
 int AtmosphereModel_save_stdAtmModel(const char *fname);
@@ -16,6 +17,26 @@ int AtmosphereModel_Create_from_CONF(const char *CONFFILE, float slambda);
 
 double AtmosphereModel_RefractionPath(double lambda, double Zangle, int WritePath);
 
+// refraction lookup grid, index iz*NBlambda + il
+typedef struct
+{
+    double lambda0;     // [m]
+    double lambda1;
+    long NBlambda;
+    double Zangle0;     // [rad]
+    double Zangle1;
+    long NBZangle;
+    double *refract;    // [arcsec]
+    double *transm;
+} ATMMODEL_REFRACTGRID;
+
+int AtmosphereModel_RefractionPath_batch(const double *lambda, long NBlambda, const double *Zangle, long NBZangle, double *refract, double *transm);
+ATMMODEL_REFRACTGRID *AtmosphereModel_RefractionGrid_create(double lambda0, double lambda1, long NBlambda, double Zangle0, double Zangle1, long NBZangle);
+double AtmosphereModel_RefractionGrid_interp(const ATMMODEL_REFRACTGRID *grid, double lambda, double Zangle);
+int AtmosphereModel_RefractionGrid_save(const ATMMODEL_REFRACTGRID *grid, const char *fname);
+void AtmosphereModel_RefractionGrid_free(ATMMODEL_REFRACTGRID *grid);
+int AtmosphereModel_RefractionGrid_mkfile(double lambda0, double lambda1, long NBlambda, double Zangle0, double Zangle1, long NBZangle, const char *fname);
+
 
 
 
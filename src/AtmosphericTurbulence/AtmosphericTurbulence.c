@@ -12,6 +12,8 @@
  */
  
  
+#define _GNU_SOURCE  // sincosf
+
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -21,8 +23,12 @@
 #include <math.h>
 #include <assert.h>
 
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 
 
@@ -48,6 +54,7 @@ int clock_gettime(int clk_id, struct timespec *t){
 
 
 #include "CLIcore.h"
+#include "00CORE/00CORE.h"
 #include "COREMOD_memory/COREMOD_memory.h"
 #include "COREMOD_arith/COREMOD_arith.h"
 
@@ -79,6 +86,11 @@ int clock_gettime(int clk_id, struct timespec *t){
 
 #define PI 3.14159265358979323846264338328
 
+#define LINPRED_FFTBATCH 32     // frames per batched FFT in AtmosphericTurbulence_Build_LinPredictor_Kernel
+#define LINPRED_FILTCMAX 2.0e8  // max filtC element count expanded from kernel
+#define ATMTURB_PSFBATCH 32     // frames per batched FFT in measure_wavefront_series_expoframes
+#define ATMTURB_PREFETCH_NBTHREAD 4  // file reader threads in frame_select_PSF
+
 
 extern DATA data;
 
@@ -179,6 +191,11 @@ int CONF_WAVEFRONT_AMPLITUDE;
 float CONF_FRESNEL_PROPAGATION_BIN;
 
 
+// ------------ LAYER COMPRESSION ---------------------------------------------
+double CONF_LAYER_COMPRESS_ERROR = 0.0; // max phase variance [rad2] at ref wavelength, 0 = no compression
+double CONF_LAYER_COMPRESS_TIME = 0.0;  // time horizon for wind mismatch [s], 0 = TIME_SPAN
+
+
 
 
 
@@ -279,6 +296,17 @@ int_fast8_t AtmosphericTurbulence_Build_LinPredictor_Full_cli()
 }
 
 
+int_fast8_t AtmosphericTurbulence_Build_LinPredictor_Kernel_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,2)+CLI_checkarg(4,1)+CLI_checkarg(5,2)+CLI_checkarg(6,1)+CLI_checkarg(7,1)+CLI_checkarg(8,3)==0)
+    {
+        AtmosphericTurbulence_Build_LinPredictor_Kernel(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numf, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.string);
+    }
+    else
+        return(1);
+}
+
+
 int_fast8_t AtmosphericTurbulence_Apply_LinPredictor_Full_cli()
 {
     if(CLI_checkarg(1,2)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,3)+CLI_checkarg(7,3)==0)
@@ -417,6 +445,15 @@ int init_AtmosphericTurbulence()
     strcpy(data.cmd[data.NBcmd].Ccall,"int AtmosphericTurbulence_Build_LinPredictor_Full(const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, double SVDeps, double Rlambda)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"atmturbwfpredictk");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = AtmosphericTurbulence_Build_LinPredictor_Kernel_cli;
+    strcpy(data.cmd[data.NBcmd].info,"build translation-invariant linear predictor kernel from wavefront series (FFT correlations)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input WF series (cube)> <mask image> <predictor order> <predictor time lag> <kernel radius> <SVD eps> <RegLambda> <output kernel name>");
+    strcpy(data.cmd[data.NBcmd].example,"atmturbwfpredictk wfin wfmask 20 3.5 8 0.001 0.0 wfpkern");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long AtmosphericTurbulence_Build_LinPredictor_Kernel(const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, long krad, double SVDeps, double RegLambda, const char *IDkern_name)");
+    data.NBcmd++;
+
     strcpy(data.cmd[data.NBcmd].key,"atmturbwfpapply");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp = AtmosphericTurbulence_Apply_LinPredictor_Full_cli;
@@ -659,6 +696,83 @@ long make_AtmosphericTurbulence_vonKarmanWind(long vKsize, float pixscale, float
 // innerscale and outerscale in pixel
 // von Karman spectrum
 //
+//
+// Random turbulence spectrum for master screens, written directly in FFT (non-centered) order
+// amplitude = gauss() / (f^2 + f0^2)^(power/2), uniform random phase, zero at f=0 and (RLIMMODE=1) below rlim
+// INNERscale_f0 > 0 applies inner scale cutoff exp(-f^2/f_i^2/2) to amplitude
+//
+// Rows are filled in parallel, each from its own generator seeded from data.rndgen, so that
+// the result does not depend on the number of threads
+//
+static long AtmosphericTurbulence_mk_screen_spectrum(const char *IDout_name, long size, double power, double OUTERscale_f0, double INNERscale_f0, int RLIMMODE, double rlim, long WFprecision)
+{
+    long IDout;
+    long jj;
+    unsigned long seed0;
+
+
+    if(WFprecision==0)
+        IDout = create_2DCimage_ID(IDout_name, size, size);
+    else
+        IDout = create_2DCimage_ID_double(IDout_name, size, size);
+
+    seed0 = gsl_rng_get(data.rndgen);
+
+#ifdef _OPENMP
+    #pragma omp parallel
+    {
+#endif
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_rand);
+
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for(jj=0; jj<size; jj++)
+    {
+        long ii;
+        double dy = 1.0*((jj+size/2)%size) - size/2;
+
+        gsl_rng_set(rng, seed0 + 7919*jj);
+        for(ii=0; ii<size; ii++)
+        {
+            double dx = 1.0*((ii+size/2)%size) - size/2;
+            double r2 = dx*dx + dy*dy;
+            double pha = 2.0*M_PI*gsl_rng_uniform(rng);
+            double amp = gsl_ran_gaussian(rng, 1.0);
+
+            if((r2 == 0.0) || ((RLIMMODE == 1) && (sqrt(r2) < rlim)))
+                amp = 0.0;
+            else
+            {
+                if(INNERscale_f0 > 0.0)
+                    amp *= exp(-0.5*r2/INNERscale_f0/INNERscale_f0); // power -> amplitude : sqrt
+                amp /= pow(r2 + OUTERscale_f0*OUTERscale_f0, 0.5*power);
+            }
+
+            if(WFprecision==0)
+            {
+                data.image[IDout].array.CF[jj*size+ii].re = amp*cos(pha);
+                data.image[IDout].array.CF[jj*size+ii].im = amp*sin(pha);
+            }
+            else
+            {
+                data.image[IDout].array.CD[jj*size+ii].re = amp*cos(pha);
+                data.image[IDout].array.CD[jj*size+ii].im = amp*sin(pha);
+            }
+        }
+    }
+
+    gsl_rng_free(rng);
+#ifdef _OPENMP
+    }
+#endif
+
+    return(IDout);
+}
+
+
+
+
 int make_master_turbulence_screen(const char *ID_name1, const char *ID_name2, long size, float outerscale, float innerscale, long WFprecision)
 {
     long ID,ii,jj;
@@ -670,10 +784,8 @@ int make_master_turbulence_screen(const char *ID_name1, const char *ID_name2, lo
     int OUTERSCALE_MODE = 1; // 1 if outer scale
     double OUTERscale_f0;
     double INNERscale_f0;
-    double dx, dy, r;
     double rlim = 0.0;
     int RLIMMODE = 0;
-    double iscoeff;
 
 
     printf("Make turbulence screen, precision = %ld\n", WFprecision);
@@ -698,107 +810,7 @@ int make_master_turbulence_screen(const char *ID_name1, const char *ID_name2, lo
     OUTERscale_f0 = 1.0*size/outerscale; // [1/pix] in F plane
     INNERscale_f0 = (5.92/(2.0*M_PI))*size/innerscale;
 
-    if(WFprecision==0)
-        make_rnd("tmppha", size, size, "");
-    else
-        make_rnd_double("tmppha", size, size, "");
-
-
-
-    arith_image_cstmult("tmppha", 2.0*PI,"tmppha1");
-    delete_image_ID("tmppha");
-    //  make_dist("tmpd",size,size,size/2,size/2);
-	if(WFprecision==0)
-		ID = create_2Dimage_ID("tmpd",size, size);
-	else
-		ID = create_2Dimage_ID_double("tmpd",size, size);
-
-    if(WFprecision==0)
-    {
-        for(ii=0; ii<size; ii++)
-            for(jj=0; jj<size; jj++)
-            {
-                dx = 1.0*ii-size/2;
-                dy = 1.0*jj-size/2;
-
-                if(RLIMMODE==1)
-                {
-                    r = sqrt(dx*dx + dy*dy);
-                    if(r<rlim)
-                        data.image[ID].array.F[jj*size+ii] = 0.0;
-                    else
-                        data.image[ID].array.F[jj*size+ii] = sqrt(dx*dx + dy*dy + OUTERscale_f0*OUTERscale_f0);
-                }
-                else
-                    data.image[ID].array.F[jj*size+ii] = sqrt(dx*dx + dy*dy + OUTERscale_f0*OUTERscale_f0);
-            }
-    }
-    else
-    {
-        for(ii=0; ii<size; ii++)
-            for(jj=0; jj<size; jj++)
-            {
-                dx = 1.0*ii-size/2;
-                dy = 1.0*jj-size/2;
-
-                if(RLIMMODE==1)
-                {
-                    r = sqrt(dx*dx + dy*dy);
-                    if(r<rlim)
-                        data.image[ID].array.D[jj*size+ii] = 0.0;
-                    else
-                        data.image[ID].array.D[jj*size+ii] = sqrt(dx*dx + dy*dy + OUTERscale_f0*OUTERscale_f0);
-                }
-                else
-                    data.image[ID].array.D[jj*size+ii] = sqrt(dx*dx + dy*dy + OUTERscale_f0*OUTERscale_f0);
-            }
-    }
-
-
-
-    if(WFprecision==0)
-        make_rnd("tmpg", size, size, "-gauss");
-    else
-        make_rnd_double("tmpg", size, size, "-gauss");
-
-
-	
-
-    ID = image_ID("tmpg");
-    if(WFprecision==0)
-	{
-		for(ii=0; ii<size; ii++)
-			for(jj=0; jj<size; jj++)
-			{
-				dx = 1.0*ii-size/2;
-				dy = 1.0*jj-size/2;
-				iscoeff = exp(-(dx*dx+dy*dy)/INNERscale_f0/INNERscale_f0);
-				data.image[ID].array.F[jj*size+ii] *= sqrt(iscoeff); // power -> amplitude : sqrt
-			}
-	}
-	else
-	{
-		for(ii=0; ii<size; ii++)
-			for(jj=0; jj<size; jj++)
-			{
-				dx = 1.0*ii-size/2;
-				dy = 1.0*jj-size/2;
-				iscoeff = exp(-(dx*dx+dy*dy)/INNERscale_f0/INNERscale_f0);
-				data.image[ID].array.D[jj*size+ii] *= sqrt(iscoeff); // power -> amplitude : sqrt
-			}
-	}
-
-
-    arith_image_cstpow("tmpd", 11.0/6.0, "tmpd1");
-    delete_image_ID("tmpd");
-    arith_image_div("tmpg", "tmpd1", "tmpamp");
-    delete_image_ID("tmpg");
-    delete_image_ID("tmpd1");
-    arith_set_pixel("tmpamp", 0.0, size/2, size/2);
-    mk_complex_from_amph("tmpamp", "tmppha1", "tmpc", 0);
-    delete_image_ID("tmpamp");
-    delete_image_ID("tmppha1");
-    permut("tmpc");
+    AtmosphericTurbulence_mk_screen_spectrum("tmpc", size, 11.0/6.0, OUTERscale_f0, INNERscale_f0, RLIMMODE, rlim, WFprecision);
 
     do2dfft("tmpc","tmpcf");
     delete_image_ID("tmpc");
@@ -885,22 +897,7 @@ int make_master_turbulence_screen_pow(const char *ID_name1, const char *ID_name2
     long cnt;
     long Dlim = 3;
 
-    make_rnd("tmppha",size,size,"");
-    arith_image_cstmult("tmppha",2.0*PI,"tmppha1");
-    delete_image_ID("tmppha");
-    make_dist("tmpd",size,size,size/2,size/2);
-    make_rnd("tmpg",size,size,"-gauss");
-
-    arith_image_cstpow("tmpd",power,"tmpd1");
-    delete_image_ID("tmpd");
-    arith_image_div("tmpg","tmpd1","tmpamp");
-    delete_image_ID("tmpg");
-    delete_image_ID("tmpd1");
-    arith_set_pixel("tmpamp",0.0,size/2,size/2);
-    mk_complex_from_amph("tmpamp","tmppha1","tmpc", 0);
-    delete_image_ID("tmpamp");
-    delete_image_ID("tmppha1");
-    permut("tmpc");
+    AtmosphericTurbulence_mk_screen_spectrum("tmpc", size, power, 0.0, 0.0, 0, 0.0, 0);
     do2dfft("tmpc","tmpcf");
     delete_image_ID("tmpc");
     mk_reim_from_complex("tmpcf","tmpo1","tmpo2", 0);
@@ -1423,6 +1420,22 @@ int AtmosphericTurbulence_ReadConf()
     read_config_parameter(CONFFILE, KEYWORD, CONTENT);
     CONF_FRESNEL_PROPAGATION_BIN = atof(CONTENT);
 
+    // ------------ LAYER COMPRESSION (optional) --------------
+
+    strcpy(KEYWORD,"LAYER_COMPRESS_ERROR");
+    if(read_config_parameter_exists(CONFFILE, KEYWORD)==1)
+    {
+        read_config_parameter(CONFFILE, KEYWORD, CONTENT);
+        CONF_LAYER_COMPRESS_ERROR = atof(CONTENT);
+    }
+
+    strcpy(KEYWORD,"LAYER_COMPRESS_TIME");
+    if(read_config_parameter_exists(CONFFILE, KEYWORD)==1)
+    {
+        read_config_parameter(CONFFILE, KEYWORD, CONTENT);
+        CONF_LAYER_COMPRESS_TIME = atof(CONTENT);
+    }
+
     // ------------ POSTPROCESSING --------------
  
 
@@ -1449,6 +1462,359 @@ int AtmosphericTurbulence_ReadConf()
 
 
 
+//
+// Equivalent layer of original layers [k0,k1) (sorted by altitude)
+// Cn2 is summed, altitude preserves the Cn2 h^(5/3) moment (isoplanatic angle),
+// wind vector, outer/inner scales and wind fluctuations are Cn2-weighted averages
+//
+static void AtmosphericTurbulence_equivlayer(long k0, long k1, double h0, const double *ALT, const double *CN2, const double *SPD, const double *DIR, double *eqalt, double *eqcn2, double *eqvx, double *eqvy)
+{
+    long k;
+    double w = 0.0;
+    double hm = 0.0;
+    double vx = 0.0;
+    double vy = 0.0;
+
+    for(k=k0; k<k1; k++)
+    {
+        w += CN2[k];
+        hm += CN2[k]*pow(fabs(ALT[k]-h0), 5.0/3.0);
+        vx += CN2[k]*SPD[k]*cos(DIR[k]);
+        vy += CN2[k]*SPD[k]*sin(DIR[k]);
+    }
+    *eqcn2 = w;
+    *eqalt = h0 + pow(hm/w, 3.0/5.0);
+    *eqvx = vx/w;
+    *eqvy = vy/w;
+}
+
+
+
+//
+// Phase variance [rad2] between layers [k0,k1) and their equivalent layer
+// Each layer k contributes 6.88 w_k (d_k/r0)^(5/3), where w_k is its Cn2 fraction and d_k the
+// decorrelation distance : wind mismatch over Tspan, plus altitude mismatch along source direction theta
+// and Fresnel scale sqrt(lambdaF dh) if lambdaF>0
+//
+static double AtmosphericTurbulence_equivlayer_err(long k0, long k1, double h0, const double *ALT, const double *CN2, const double *SPD, const double *DIR, double CN2total, double r0, double theta, double Tspan, double lambdaF)
+{
+    long k;
+    double eqalt, eqcn2, eqvx, eqvy;
+    double err = 0.0;
+
+    AtmosphericTurbulence_equivlayer(k0, k1, h0, ALT, CN2, SPD, DIR, &eqalt, &eqcn2, &eqvx, &eqvy);
+    for(k=k0; k<k1; k++)
+    {
+        double dvx = SPD[k]*cos(DIR[k]) - eqvx;
+        double dvy = SPD[k]*sin(DIR[k]) - eqvy;
+        double dh = fabs(ALT[k]-eqalt);
+        double d;
+
+        d = sqrt(dvx*dvx+dvy*dvy)*Tspan + dh*theta;
+        if(lambdaF>0.0)
+            d += sqrt(lambdaF*dh);
+        err += 6.88*CN2[k]/CN2total*pow(d/r0, 5.0/3.0);
+    }
+
+    return(err);
+}
+
+
+
+//
+// Greedy merging of altitude-adjacent layers into equivalent layers
+// At each step the pair adding the least phase variance is merged, as long as the total stays below errmax
+// Layer arrays are overwritten by the equivalent layers, returns new number of layers
+// Achieved phase variance [rad2] is written to errout
+//
+static long AtmosphericTurbulence_compress_layers(long NBlayer, double h0, double *ALT, double *CN2, double *SPD, double *DIR, double *OUTERSCALE, double *INNERSCALE, double *SIGMAWSPEED, double *LWIND, double r0, double theta, double Tspan, double lambdaF, double errmax, double *errout)
+{
+    long *gstart;
+    double *gerr;
+    double *tmparray;
+    long NBgroup;
+    long g, k;
+    double CN2total = 0.0;
+    double errtot = 0.0;
+    double *parray[4];
+
+    for(k=0; k<NBlayer; k++)
+        CN2total += CN2[k];
+
+    // group g covers original layers [gstart[g], gstart[g+1])
+    gstart = (long*) malloc(sizeof(long)*(NBlayer+1));
+    gerr = (double*) malloc(sizeof(double)*NBlayer);
+    for(g=0; g<NBlayer; g++)
+    {
+        gstart[g] = g;
+        gerr[g] = 0.0;
+    }
+    gstart[NBlayer] = NBlayer;
+    NBgroup = NBlayer;
+
+    while(NBgroup>1)
+    {
+        long gbest = -1;
+        double dbest = 0.0;
+        double ebest = 0.0;
+
+        for(g=0; g<NBgroup-1; g++)
+        {
+            double e = AtmosphericTurbulence_equivlayer_err(gstart[g], gstart[g+2], h0, ALT, CN2, SPD, DIR, CN2total, r0, theta, Tspan, lambdaF);
+            double de = e - gerr[g] - gerr[g+1];
+
+            if((gbest==-1)||(de<dbest))
+            {
+                gbest = g;
+                dbest = de;
+                ebest = e;
+            }
+        }
+        if(errtot+dbest > errmax)
+            break;
+
+        errtot += dbest;
+        gerr[gbest] = ebest;
+        for(g=gbest+1; g<NBgroup-1; g++)
+        {
+            gerr[g] = gerr[g+1];
+            gstart[g] = gstart[g+1];
+        }
+        gstart[NBgroup-1] = gstart[NBgroup];
+        NBgroup--;
+    }
+
+    // Cn2-weighted average of remaining layer parameters
+    parray[0] = OUTERSCALE;
+    parray[1] = INNERSCALE;
+    parray[2] = SIGMAWSPEED;
+    parray[3] = LWIND;
+    tmparray = (double*) malloc(sizeof(double)*NBgroup);
+    for(k=0; k<4; k++)
+    {
+        for(g=0; g<NBgroup; g++)
+        {
+            long l;
+            double w = 0.0;
+            double v = 0.0;
+
+            for(l=gstart[g]; l<gstart[g+1]; l++)
+            {
+                w += CN2[l];
+                v += CN2[l]*parray[k][l];
+            }
+            tmparray[g] = v/w;
+        }
+        for(g=0; g<NBgroup; g++)
+            parray[k][g] = tmparray[g];
+    }
+    free(tmparray);
+
+    // group order is increasing, so equivalent layer g can be written in place of layer g
+    for(g=0; g<NBgroup; g++)
+    {
+        double eqalt, eqcn2, eqvx, eqvy;
+
+        AtmosphericTurbulence_equivlayer(gstart[g], gstart[g+1], h0, ALT, CN2, SPD, DIR, &eqalt, &eqcn2, &eqvx, &eqvy);
+        ALT[g] = eqalt;
+        CN2[g] = eqcn2;
+        SPD[g] = sqrt(eqvx*eqvx+eqvy*eqvy);
+        DIR[g] = atan2(eqvy, eqvx);
+    }
+
+    free(gstart);
+    free(gerr);
+
+    *errout = errtot;
+
+    return(NBgroup);
+}
+
+
+
+//
+// Adds shifted layer IDlayer (periodic, sampled at position xpos,ypos) to phase IDpha
+// If IDamp > -1, complex amplitude IDamp is multiplied by exp(i phase)
+// If IDspha > -1, same for science wavelength with phase multiplied by Scoeff
+//
+// The shift is uniform over the frame, so interpolation weights are computed once and applied
+// separably (vertical pass into row buffer, then horizontal pass). bicubic = 1 uses the Catmull-Rom kernel.
+// Rows are processed in parallel.
+//
+static void AtmosphericTurbulence_addlayer(long IDlayer, double xpos, double ypos, int bicubic, long IDpha, long IDamp, double Scoeff, long IDspha, long IDsamp)
+{
+    long Nx = data.image[IDlayer].md[0].size[0];
+    long Ny = data.image[IDlayer].md[0].size[1];
+    long nx = data.image[IDpha].md[0].size[0];
+    long ny = data.image[IDpha].md[0].size[1];
+    int ntap, toff;
+    double xm, ym, fx, fy;
+    double wx[4], wy[4];
+    long i0, j0;
+    long *colindex;
+    long ii, jj;
+
+
+    xm = fmod(xpos, 1.0*Nx);
+    if(xm < 0.0)
+        xm += Nx;
+    ym = fmod(ypos, 1.0*Ny);
+    if(ym < 0.0)
+        ym += Ny;
+    i0 = (long) xm;
+    j0 = (long) ym;
+    fx = xm - i0;
+    fy = ym - j0;
+
+    if(bicubic == 1)
+    {
+        ntap = 4;
+        toff = -1;
+        wx[0] = ((-0.5*fx + 1.0)*fx - 0.5)*fx;
+        wx[1] = (1.5*fx - 2.5)*fx*fx + 1.0;
+        wx[2] = ((-1.5*fx + 2.0)*fx + 0.5)*fx;
+        wx[3] = (0.5*fx - 0.5)*fx*fx;
+        wy[0] = ((-0.5*fy + 1.0)*fy - 0.5)*fy;
+        wy[1] = (1.5*fy - 2.5)*fy*fy + 1.0;
+        wy[2] = ((-1.5*fy + 2.0)*fy + 0.5)*fy;
+        wy[3] = (0.5*fy - 0.5)*fy*fy;
+    }
+    else
+    {
+        ntap = 2;
+        toff = 0;
+        wx[0] = 1.0-fx;
+        wx[1] = fx;
+        wy[0] = 1.0-fy;
+        wy[1] = fy;
+    }
+
+    // master screen columns used by output row, including interpolation taps
+    colindex = (long*) malloc(sizeof(long)*(nx+ntap));
+    for(ii=0; ii<nx+ntap-1; ii++)
+    {
+        long i1 = (i0 + toff + ii) % Nx;
+        if(i1 < 0)
+            i1 += Nx;
+        colindex[ii] = i1;
+    }
+
+
+#ifdef _OPENMP
+    #pragma omp parallel for private(ii)
+#endif
+    for(jj=0; jj<ny; jj++)
+    {
+        double *rowbuf;
+        long rowoff[4];
+        int t;
+
+        rowbuf = (double*) malloc(sizeof(double)*(nx+ntap));
+        for(t=0; t<ntap; t++)
+        {
+            long j1 = (j0 + toff + jj + t) % Ny;
+            if(j1 < 0)
+                j1 += Ny;
+            rowoff[t] = j1*Nx;
+        }
+
+        // vertical pass
+        if(data.image[IDlayer].md[0].atype == _DATATYPE_FLOAT)
+        {
+            float *pl = data.image[IDlayer].array.F;
+            for(ii=0; ii<nx+ntap-1; ii++)
+            {
+                double v = 0.0;
+                for(t=0; t<ntap; t++)
+                    v += wy[t]*pl[rowoff[t]+colindex[ii]];
+                rowbuf[ii] = v;
+            }
+        }
+        else
+        {
+            double *pl = data.image[IDlayer].array.D;
+            for(ii=0; ii<nx+ntap-1; ii++)
+            {
+                double v = 0.0;
+                for(t=0; t<ntap; t++)
+                    v += wy[t]*pl[rowoff[t]+colindex[ii]];
+                rowbuf[ii] = v;
+            }
+        }
+
+        // horizontal pass, accumulate
+        for(ii=0; ii<nx; ii++)
+        {
+            double value = 0.0;
+            long index = jj*nx+ii;
+            double re, im, cv, sv;
+
+            for(t=0; t<ntap; t++)
+                value += wx[t]*rowbuf[ii+t];
+
+            if(data.image[IDpha].md[0].atype == _DATATYPE_FLOAT)
+            {
+                data.image[IDpha].array.F[index] += value;
+                if(IDamp != -1)
+                {
+                    cv = cos(value);
+                    sv = sin(value);
+                    re = data.image[IDamp].array.CF[index].re;
+                    im = data.image[IDamp].array.CF[index].im;
+                    data.image[IDamp].array.CF[index].re = re*cv-im*sv;
+                    data.image[IDamp].array.CF[index].im = re*sv+im*cv;
+                }
+                if(IDspha != -1)
+                {
+                    data.image[IDspha].array.F[index] += value*Scoeff;
+                    if(IDsamp != -1)
+                    {
+                        cv = cos(value*Scoeff);
+                        sv = sin(value*Scoeff);
+                        re = data.image[IDsamp].array.CF[index].re;
+                        im = data.image[IDsamp].array.CF[index].im;
+                        data.image[IDsamp].array.CF[index].re = re*cv-im*sv;
+                        data.image[IDsamp].array.CF[index].im = re*sv+im*cv;
+                    }
+                }
+            }
+            else
+            {
+                data.image[IDpha].array.D[index] += value;
+                if(IDamp != -1)
+                {
+                    cv = cos(value);
+                    sv = sin(value);
+                    re = data.image[IDamp].array.CD[index].re;
+                    im = data.image[IDamp].array.CD[index].im;
+                    data.image[IDamp].array.CD[index].re = re*cv-im*sv;
+                    data.image[IDamp].array.CD[index].im = re*sv+im*cv;
+                }
+                if(IDspha != -1)
+                {
+                    data.image[IDspha].array.D[index] += value*Scoeff;
+                    if(IDsamp != -1)
+                    {
+                        cv = cos(value*Scoeff);
+                        sv = sin(value*Scoeff);
+                        re = data.image[IDsamp].array.CD[index].re;
+                        im = data.image[IDsamp].array.CD[index].im;
+                        data.image[IDsamp].array.CD[index].re = re*cv-im*sv;
+                        data.image[IDsamp].array.CD[index].im = re*sv+im*cv;
+                    }
+                }
+            }
+        }
+        free(rowbuf);
+    }
+
+    free(colindex);
+}
+
+
+
+
+
 // compmode = 0 : compute atmosphere model only, no turbulence
 // compmode = 1 : full computation
 
@@ -1543,7 +1909,7 @@ int make_AtmosphericTurbulence_wavefront_series(float slambdaum, long WFprecisio
     long frame;
     long NBFRAMES;
     double fl1, fl2, fl3, fl4, fl5, fl6, fl7, fl8;
-    long ii, jj, iim, jjm, ii1, jj1;
+    long ii, jj, ii1, jj1;
     double value;
     double coeff = 0.0;
 
@@ -1585,9 +1951,7 @@ int make_AtmosphericTurbulence_wavefront_series(float slambdaum, long WFprecisio
     double P, T, TC, Pw, CO2ppm, denstot, xtot;
     double LoschmidtConstant =  2.6867805e25;
     double logD;
-    double x;
     long i0,i1;
-    double iimf, jjmf, iifrac, jjfrac, value_re, value_im;
     double pha;
 
     int r;
@@ -1625,16 +1989,6 @@ int make_AtmosphericTurbulence_wavefront_series(float slambdaum, long WFprecisio
 
 
 	int BICUBIC = 1; // 0 if bilinear
-	double a00, a01, a02, a03;
-	double a10, a11, a12, a13;
-	double a20, a21, a22, a23;
-	double a30, a31, a32, a33;
-	double p00, p01, p02, p03;
-	double p10, p11, p12, p13;
-	double p20, p21, p22, p23;
-	double p30, p31, p32, p33;
-	long iim0, iim1, iim2, iim3, jjm0, jjm1, jjm2, jjm3;
-	double x2, x3, y, y2, y3;
 	
 	FILE *fpxypos;
 
@@ -2049,10 +2403,31 @@ int make_AtmosphericTurbulence_wavefront_series(float slambdaum, long WFprecisio
     }
 
 
+    if((CONF_LAYER_COMPRESS_ERROR>0.0)&&(NBLAYERS>1))
+    {
+        double r0m, Tspan, lambdaF, errlc;
+        long NBLAYERS0 = NBLAYERS;
+
+        r0m = CONF_LAMBDA/(CONF_SEEING/3600.0/180.0*PI);
+        Tspan = CONF_LAYER_COMPRESS_TIME;
+        if(Tspan<=0.0)
+            Tspan = CONF_TIME_SPAN;
+        lambdaF = 0.0;
+        if(CONF_FRESNEL_PROPAGATION==1)
+            lambdaF = CONF_LAMBDA;
+
+        NBLAYERS = AtmosphericTurbulence_compress_layers(NBLAYERS, SiteAlt, LAYER_ALT, LAYER_CN2, LAYER_SPD, LAYER_DIR, LAYER_OUTERSCALE, LAYER_INNERSCALE, LAYER_SIGMAWSPEED, LAYER_LWIND, r0m, sqrt(CONF_SOURCE_Xpos*CONF_SOURCE_Xpos+CONF_SOURCE_Ypos*CONF_SOURCE_Ypos), Tspan, lambdaF, CONF_LAYER_COMPRESS_ERROR, &errlc);
+
+        printf("Layer compression : %ld -> %ld layers, phase error = %g rad2 (%.3f nm RMS at %.3f um), bound = %g rad2\n", NBLAYERS0, NBLAYERS, errlc, sqrt(errlc)/(2.0*PI)*CONF_LAMBDA*1.0e9, CONF_LAMBDA*1.0e6, CONF_LAYER_COMPRESS_ERROR);
+        for(layer=0; layer<NBLAYERS; layer++)
+            printf("Equivalent layer %ld : alt = %f m   CN2 = %f   V = %f m/s   Angle = %f rad   outerscale = %f m    innerscale = %f m  sigmaWind = %f m/s  Lwind = %f m\n", layer, LAYER_ALT[layer], LAYER_CN2[layer], LAYER_SPD[layer], LAYER_DIR[layer], LAYER_OUTERSCALE[layer], LAYER_INNERSCALE[layer], LAYER_SIGMAWSPEED[layer], LAYER_LWIND[layer]);
+    }
 
 
 
-    SLAYER_ALT = (double*) malloc(NBLAYERS*sizeof(double));
+
+
+    SLAYER_ALT = (double*) malloc(NBLAYERS*sizeof(double));
     SLAYER_CN2 = (double*) malloc(NBLAYERS*sizeof(double));
     NBSLAYERS = NBLAYERS;
     for(layer=0; layer<NBSLAYERS; layer++)
@@ -2782,661 +3157,11 @@ int make_AtmosphericTurbulence_wavefront_series(float slambdaum, long WFprecisio
                 yrefm = yref-naxes_MASTER[1];
 
 
-                /* make wavefront */
-                if(WFprecision == 0) // floating point precision
-                {
-                   if(BICUBIC==0)            
-                   {
-					   // bilinear interpolation
-						for(ii=0; ii<naxes[0]; ii++)
-						for(jj=0; jj<naxes[1]; jj++)
-                        {
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-                            iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-                            iifrac = iimf-iim;
-                            jjfrac = jjmf-jjm;
-                            iim1 = iim+1;
-                            jjm1 = jjm+1;
-                            if(iim==CONF_MASTER_SIZE)
-                                iim = 0;
-                            if(jjm==CONF_MASTER_SIZE)
-                                jjm = 0;
-                            if(iim1>CONF_MASTER_SIZE-1)
-                                iim1 -= CONF_MASTER_SIZE;
-                            if(jjm1>CONF_MASTER_SIZE-1)
-                                jjm1 -= CONF_MASTER_SIZE;
-
-                            value = (1.0-iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim];
-                            value += (1.0-iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim];
-                            value += (iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1];
-                            value += (iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim1];
-
-                            data.image[ID_array1].array.F[jj*naxes[0]+ii] += value;
-                            if(CONF_WAVEFRONT_AMPLITUDE==1)
-                            {
-                                re = data.image[ID_array2].array.CF[jj*naxes[0]+ii].re;
-                                im = data.image[ID_array2].array.CF[jj*naxes[0]+ii].im;
-                                data.image[ID_array2].array.CF[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-                                data.image[ID_array2].array.CF[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-                            }
-                        }
-                   
-						//fpxypos = fopen("xypos.log", "a");
-						//fprintf(fpxypos, "%5ld %4ld    %10.8f %10.8f      %5ld %10.8f %5ld %10.8f    %10.8f %10.8f  %.18g        %.18g   %.18g   %.18g   %.18g\n", vindex, layer, xpos[layer], ypos[layer], iim, iifrac, jjm, jjfrac, 1.0*iim+iifrac, 1.0*jjm+jjfrac, value, data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim], data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim], data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1], data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim1]);
-						//fclose(fpxypos);
-					}
-					else 
-					{
-						// bicubic interpolation
-						for(ii=0; ii<naxes[0]; ii++)
-                        for(jj=0; jj<naxes[1]; jj++)
-                        {
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-							
-							iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-							
-							x = iimf-iim;
-                            y = jjmf-jjm;
-                            
-                            
-                            iim0 = iim - 1;
-                            iim1 = iim;
-                            iim2 = iim + 1;
-                            iim3 = iim + 2;
-							if(iim1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(iim2>CONF_MASTER_SIZE-1)
-								iim2 -= CONF_MASTER_SIZE;
-							if(iim3>CONF_MASTER_SIZE-1)
-								iim3 -= CONF_MASTER_SIZE;
-							if(iim0<0)
-								iim0 += CONF_MASTER_SIZE;
-								
-                            jjm0 = jjm - 1;
-                            jjm1 = jjm;
-                            jjm2 = jjm + 1;
-                            jjm3 = jjm + 2;
-							if(jjm1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(jjm2>CONF_MASTER_SIZE-1)
-								jjm2 -= CONF_MASTER_SIZE;
-							if(jjm3>CONF_MASTER_SIZE-1)
-								jjm3 -= CONF_MASTER_SIZE;
-							if(jjm0<0)
-								jjm0 += CONF_MASTER_SIZE;
-							
-							/*assert(iim0>=0);
-							assert(iim1>=0);
-							assert(iim2>=0);
-							assert(iim3>=0);
-							assert(iim0<CONF_MASTER_SIZE);
-							assert(iim1<CONF_MASTER_SIZE);
-							assert(iim2<CONF_MASTER_SIZE);
-							assert(iim3<CONF_MASTER_SIZE);
-							assert(jjm0>=0);
-							assert(jjm1>=0);
-							assert(jjm2>=0);
-							assert(jjm3>=0);
-							assert(jjm0<CONF_MASTER_SIZE);
-							assert(jjm1<CONF_MASTER_SIZE);
-							assert(jjm2<CONF_MASTER_SIZE);
-							assert(jjm3<CONF_MASTER_SIZE);
-							*/
-							
-							p00 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim0];
-							p01 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim0];
-							p02 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim0];
-							p03 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim0];
-
-							p10 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim1];
-							p11 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1];
-							p12 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim1];
-							p13 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim1];
-
-							p20 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim2];
-							p21 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim2];
-							p22 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim2];
-							p23 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim2];
-
-							p30 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim3];
-							p31 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim3];
-							p32 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim3];
-							p33 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim3];
-							
-							
-							a00 = p11;
-							a01 = -.5*p10 + .5*p12;
-							a02 = p10 - 2.5*p11 + 2*p12 - .5*p13;
-							a03 = -.5*p10 + 1.5*p11 - 1.5*p12 + .5*p13;
-							a10 = -.5*p01 + .5*p21;
-							a11 = .25*p00 - .25*p02 - .25*p20 + .25*p22;
-							a12 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + .5*p20 - 1.25*p21 + p22 - .25*p23;
-							a13 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .25*p20 + .75*p21 - .75*p22 + .25*p23;
-							a20 = p01 - 2.5*p11 + 2*p21 - .5*p31;
-							a21 = -.5*p00 + .5*p02 + 1.25*p10 - 1.25*p12 - p20 + p22 + .25*p30 - .25*p32;
-							a22 = p00 - 2.5*p01 + 2*p02 - .5*p03 - 2.5*p10 + 6.25*p11 - 5*p12 + 1.25*p13 + 2*p20 - 5*p21 + 4*p22 - p23 - .5*p30 + 1.25*p31 - p32 + .25*p33;
-							a23 = -.5*p00 + 1.5*p01 - 1.5*p02 + .5*p03 + 1.25*p10 - 3.75*p11 + 3.75*p12 - 1.25*p13 - p20 + 3*p21 - 3*p22 + p23 + .25*p30 - .75*p31 + .75*p32 - .25*p33;
-							a30 = -.5*p01 + 1.5*p11 - 1.5*p21 + .5*p31;
-							a31 = .25*p00 - .25*p02 - .75*p10 + .75*p12 + .75*p20 - .75*p22 - .25*p30 + .25*p32;
-							a32 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + 1.5*p10 - 3.75*p11 + 3*p12 - .75*p13 - 1.5*p20 + 3.75*p21 - 3*p22 + .75*p23 + .5*p30 - 1.25*p31 + p32 - .25*p33;
-							a33 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .75*p10 + 2.25*p11 - 2.25*p12 + .75*p13 + .75*p20 - 2.25*p21 + 2.25*p22 - .75*p23 - .25*p30 + .75*p31 - .75*p32 + .25*p33;
-							
-							x2 = x*x;
-							x3 = x2*x;
-							y2 = y*y;
-							y3 = y2*y;
-							
-							value = (a00 + a01 * y + a02 * y2 + a03 * y3) + (a10 + a11 * y + a12 * y2 + a13 * y3) * x + (a20 + a21 * y + a22 * y2 + a23 * y3) * x2 + (a30 + a31 * y + a32 * y2 + a33 * y3) * x3;							
-						
-						
-							data.image[ID_array1].array.F[jj*naxes[0]+ii] += value;
-							if(CONF_WAVEFRONT_AMPLITUDE==1)
-                            {
-                                re = data.image[ID_array2].array.CF[jj*naxes[0]+ii].re;
-                                im = data.image[ID_array2].array.CF[jj*naxes[0]+ii].im;
-                                data.image[ID_array2].array.CF[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-                                data.image[ID_array2].array.CF[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-                            }
-
-						
-						//fpxypos = fopen("xypos3.log", "a");
-						//fprintf(fpxypos, "%5ld %4ld    %10.8f %10.8f      %5ld %10.8f %5ld %10.8f    %10.8f %10.8f  %.18g        %.18g   %.18g   %.18g   %.18g\n", vindex, layer, xpos[layer], ypos[layer], iim, x, jjm, y, 1.0*iim+x, 1.0*jjm+y, value, data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim], data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim], data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1], data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim1]);
-						//fclose(fpxypos);
-						}
-					}
-					
-                }
-                else // double precision
-                {
-                   if(BICUBIC==0)                
-                   {
-					   // bilinear interpolation
-					   for(ii=0; ii<naxes[0]; ii++)
-                       for(jj=0; jj<naxes[1]; jj++)
-                        {
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-                            iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-                            iifrac = iimf-iim;
-                            jjfrac = jjmf-jjm;
-                            iim1 = iim+1;
-                            jjm1 = jjm+1;
-                            if(iim==CONF_MASTER_SIZE)
-                                iim = 0;
-                            if(jjm==CONF_MASTER_SIZE)
-                                jjm = 0;
-                            if(iim1>CONF_MASTER_SIZE-1)
-                                iim1 -= CONF_MASTER_SIZE;
-                            if(jjm1>CONF_MASTER_SIZE-1)
-                                jjm1 -= CONF_MASTER_SIZE;
-
-                            value = (1.0-iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.D[jjm*naxes_MASTER[0]+iim];
-                            value += (1.0-iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim];
-                            value += (iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim1];
-                            value += (iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.D[jjm*naxes_MASTER[0]+iim1];
-
-                            data.image[ID_array1].array.D[jj*naxes[0]+ii] += value;
-                            if(CONF_WAVEFRONT_AMPLITUDE==1)
-                            {
-                                re = data.image[ID_array2].array.CD[jj*naxes[0]+ii].re;
-                                im = data.image[ID_array2].array.CD[jj*naxes[0]+ii].im;
-                                data.image[ID_array2].array.CD[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-                                data.image[ID_array2].array.CD[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-                            }
-                        }
-					}
-					else
-					{
-						// bicubic interpolation
-						for(ii=0; ii<naxes[0]; ii++)
-                        for(jj=0; jj<naxes[1]; jj++)
-                        {
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-							
-							iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-							
-							x = iimf-iim;
-                            y = jjmf-jjm;
-                            
-                            
-                            iim0 = iim - 1;
-                            iim1 = iim;
-                            iim2 = iim + 1;
-                            iim3 = iim + 2;
-							if(iim1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(iim2>CONF_MASTER_SIZE-1)
-								iim2 -= CONF_MASTER_SIZE;
-							if(iim3>CONF_MASTER_SIZE-1)
-								iim3 -= CONF_MASTER_SIZE;
-							if(iim0<0)
-								iim0 += CONF_MASTER_SIZE;
-								
-                            jjm0 = jjm - 1;
-                            jjm1 = jjm;
-                            jjm2 = jjm + 1;
-                            jjm3 = jjm + 2;
-							if(jjm1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(jjm2>CONF_MASTER_SIZE-1)
-								jjm2 -= CONF_MASTER_SIZE;
-							if(jjm3>CONF_MASTER_SIZE-1)
-								jjm3 -= CONF_MASTER_SIZE;
-							if(jjm0<0)
-								jjm0 += CONF_MASTER_SIZE;
-
-							/*assert(iim0>=0);
-							assert(iim1>=0);
-							assert(iim2>=0);
-							assert(iim3>=0);
-							assert(iim0<CONF_MASTER_SIZE);
-							assert(iim1<CONF_MASTER_SIZE);
-							assert(iim2<CONF_MASTER_SIZE);
-							assert(iim3<CONF_MASTER_SIZE);
-							assert(jjm0>=0);
-							assert(jjm1>=0);
-							assert(jjm2>=0);
-							assert(jjm3>=0);
-							assert(jjm0<CONF_MASTER_SIZE);
-							assert(jjm1<CONF_MASTER_SIZE);
-							assert(jjm2<CONF_MASTER_SIZE);
-							assert(jjm3<CONF_MASTER_SIZE);
-					*/
-							p00 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim0];
-							p01 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim0];
-							p02 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim0];
-							p03 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim0];
-
-							p10 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim1];
-							p11 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim1];
-							p12 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim1];
-							p13 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim1];
-
-							p20 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim2];
-							p21 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim2];
-							p22 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim2];
-							p23 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim2];
-
-							p30 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim3];
-							p31 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim3];
-							p32 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim3];
-							p33 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim3];
-							
-							
-							a00 = p11;
-							a01 = -.5*p10 + .5*p12;
-							a02 = p10 - 2.5*p11 + 2*p12 - .5*p13;
-							a03 = -.5*p10 + 1.5*p11 - 1.5*p12 + .5*p13;
-							a10 = -.5*p01 + .5*p21;
-							a11 = .25*p00 - .25*p02 - .25*p20 + .25*p22;
-							a12 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + .5*p20 - 1.25*p21 + p22 - .25*p23;
-							a13 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .25*p20 + .75*p21 - .75*p22 + .25*p23;
-							a20 = p01 - 2.5*p11 + 2*p21 - .5*p31;
-							a21 = -.5*p00 + .5*p02 + 1.25*p10 - 1.25*p12 - p20 + p22 + .25*p30 - .25*p32;
-							a22 = p00 - 2.5*p01 + 2*p02 - .5*p03 - 2.5*p10 + 6.25*p11 - 5*p12 + 1.25*p13 + 2*p20 - 5*p21 + 4*p22 - p23 - .5*p30 + 1.25*p31 - p32 + .25*p33;
-							a23 = -.5*p00 + 1.5*p01 - 1.5*p02 + .5*p03 + 1.25*p10 - 3.75*p11 + 3.75*p12 - 1.25*p13 - p20 + 3*p21 - 3*p22 + p23 + .25*p30 - .75*p31 + .75*p32 - .25*p33;
-							a30 = -.5*p01 + 1.5*p11 - 1.5*p21 + .5*p31;
-							a31 = .25*p00 - .25*p02 - .75*p10 + .75*p12 + .75*p20 - .75*p22 - .25*p30 + .25*p32;
-							a32 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + 1.5*p10 - 3.75*p11 + 3*p12 - .75*p13 - 1.5*p20 + 3.75*p21 - 3*p22 + .75*p23 + .5*p30 - 1.25*p31 + p32 - .25*p33;
-							a33 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .75*p10 + 2.25*p11 - 2.25*p12 + .75*p13 + .75*p20 - 2.25*p21 + 2.25*p22 - .75*p23 - .25*p30 + .75*p31 - .75*p32 + .25*p33;
-							
-							x2 = x*x;
-							x3 = x2*x;
-							y2 = y*y;
-							y3 = y2*y;
-							
-							value = (a00 + a01 * y + a02 * y2 + a03 * y3) + (a10 + a11 * y + a12 * y2 + a13 * y3) * x + (a20 + a21 * y + a22 * y2 + a23 * y3) * x2 + (a30 + a31 * y + a32 * y2 + a33 * y3) * x3;							
-						
-					
-							data.image[ID_array1].array.D[jj*naxes[0]+ii] += value;
-							if(CONF_WAVEFRONT_AMPLITUDE==1)
-							{
-								re = data.image[ID_array2].array.CD[jj*naxes[0]+ii].re;
-								im = data.image[ID_array2].array.CD[jj*naxes[0]+ii].im;
-								data.image[ID_array2].array.CD[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-								data.image[ID_array2].array.CD[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-							}
-						}
-					}
-                }
-
-
-
-                /* make swavefront */
+                /* make wavefront (and swavefront) */
                 if(CONF_MAKE_SWAVEFRONT==1)
-                {
-                    if(WFprecision == 0)
-                    {
-						if(BICUBIC==0)
-						{   
-							for(ii=0; ii<naxes[0]; ii++)
-                            for(jj=0; jj<naxes[1]; jj++)
-                            {
-                                iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                                jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-                                iim = (long) (iimf);
-                                jjm = (long) (jjmf);
-                                iifrac = iimf-iim;
-                                jjfrac = jjmf-jjm;
-                                iim1 = iim+1;
-                                jjm1 = jjm+1;
-                                if(iim==CONF_MASTER_SIZE)
-                                    iim = 0;
-                                if(jjm==CONF_MASTER_SIZE)
-                                    jjm = 0;
-                                if(iim1>CONF_MASTER_SIZE-1)
-                                    iim1 -= CONF_MASTER_SIZE;
-                                if(jjm1>CONF_MASTER_SIZE-1)
-                                    jjm1 -= CONF_MASTER_SIZE;
-
-                                value = (1.0-iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim];
-                                value += (1.0-iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim];
-                                value += (iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1];
-                                value += (iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.F[jjm*naxes_MASTER[0]+iim1];
-
-                                value *= Scoeff;  // multiplicative coeff to go from ref lambda to science lambda
-
-                                data.image[ID_sarray1].array.F[jj*naxes[0]+ii] += value;
-
-                                if(CONF_WAVEFRONT_AMPLITUDE==1)
-                                {
-                                    re = data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].re;
-                                    im = data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].im;
-                                    data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-                                    data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-                                }
-                            }
-						}
-						else
-						{
-							// bicubic interpolation
-							for(ii=0; ii<naxes[0]; ii++)
-							for(jj=0; jj<naxes[1]; jj++)
-							{
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-							
-							iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-							
-							x = iimf-iim;
-                            y = jjmf-jjm;
-                            
-                            
-                            iim0 = iim - 1;
-                            iim1 = iim;
-                            iim2 = iim + 1;
-                            iim3 = iim + 2;
-							if(iim1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(iim2>CONF_MASTER_SIZE-1)
-								iim2 -= CONF_MASTER_SIZE;
-							if(iim3>CONF_MASTER_SIZE-1)
-								iim3 -= CONF_MASTER_SIZE;
-							if(iim0<0)
-								iim0 += CONF_MASTER_SIZE;
-								
-                            jjm0 = jjm - 1;
-                            jjm1 = jjm;
-                            jjm2 = jjm + 1;
-                            jjm3 = jjm + 2;
-							if(jjm1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(jjm2>CONF_MASTER_SIZE-1)
-								jjm2 -= CONF_MASTER_SIZE;
-							if(jjm3>CONF_MASTER_SIZE-1)
-								jjm3 -= CONF_MASTER_SIZE;
-							if(jjm0<0)
-								jjm0 += CONF_MASTER_SIZE;
-
-							/*assert(iim0>=0);
-							assert(iim1>=0);
-							assert(iim2>=0);
-							assert(iim3>=0);
-							assert(iim0<CONF_MASTER_SIZE);
-							assert(iim1<CONF_MASTER_SIZE);
-							assert(iim2<CONF_MASTER_SIZE);
-							assert(iim3<CONF_MASTER_SIZE);
-							assert(jjm0>=0);
-							assert(jjm1>=0);
-							assert(jjm2>=0);
-							assert(jjm3>=0);
-							assert(jjm0<CONF_MASTER_SIZE);
-							assert(jjm1<CONF_MASTER_SIZE);
-							assert(jjm2<CONF_MASTER_SIZE);
-							assert(jjm3<CONF_MASTER_SIZE);
-					*/
-							p00 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim0];
-							p01 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim0];
-							p02 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim0];
-							p03 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim0];
-
-							p10 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim1];
-							p11 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim1];
-							p12 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim1];
-							p13 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim1];
-
-							p20 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim2];
-							p21 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim2];
-							p22 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim2];
-							p23 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim2];
-
-							p30 = data.image[ID_TML[layer]].array.F[jjm0*naxes_MASTER[0]+iim3];
-							p31 = data.image[ID_TML[layer]].array.F[jjm1*naxes_MASTER[0]+iim3];
-							p32 = data.image[ID_TML[layer]].array.F[jjm2*naxes_MASTER[0]+iim3];
-							p33 = data.image[ID_TML[layer]].array.F[jjm3*naxes_MASTER[0]+iim3];
-							
-							
-							a00 = p11;
-							a01 = -.5*p10 + .5*p12;
-							a02 = p10 - 2.5*p11 + 2*p12 - .5*p13;
-							a03 = -.5*p10 + 1.5*p11 - 1.5*p12 + .5*p13;
-							a10 = -.5*p01 + .5*p21;
-							a11 = .25*p00 - .25*p02 - .25*p20 + .25*p22;
-							a12 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + .5*p20 - 1.25*p21 + p22 - .25*p23;
-							a13 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .25*p20 + .75*p21 - .75*p22 + .25*p23;
-							a20 = p01 - 2.5*p11 + 2*p21 - .5*p31;
-							a21 = -.5*p00 + .5*p02 + 1.25*p10 - 1.25*p12 - p20 + p22 + .25*p30 - .25*p32;
-							a22 = p00 - 2.5*p01 + 2*p02 - .5*p03 - 2.5*p10 + 6.25*p11 - 5*p12 + 1.25*p13 + 2*p20 - 5*p21 + 4*p22 - p23 - .5*p30 + 1.25*p31 - p32 + .25*p33;
-							a23 = -.5*p00 + 1.5*p01 - 1.5*p02 + .5*p03 + 1.25*p10 - 3.75*p11 + 3.75*p12 - 1.25*p13 - p20 + 3*p21 - 3*p22 + p23 + .25*p30 - .75*p31 + .75*p32 - .25*p33;
-							a30 = -.5*p01 + 1.5*p11 - 1.5*p21 + .5*p31;
-							a31 = .25*p00 - .25*p02 - .75*p10 + .75*p12 + .75*p20 - .75*p22 - .25*p30 + .25*p32;
-							a32 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + 1.5*p10 - 3.75*p11 + 3*p12 - .75*p13 - 1.5*p20 + 3.75*p21 - 3*p22 + .75*p23 + .5*p30 - 1.25*p31 + p32 - .25*p33;
-							a33 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .75*p10 + 2.25*p11 - 2.25*p12 + .75*p13 + .75*p20 - 2.25*p21 + 2.25*p22 - .75*p23 - .25*p30 + .75*p31 - .75*p32 + .25*p33;
-							
-							x2 = x*x;
-							x3 = x2*x;
-							y2 = y*y;
-							y3 = y2*y;
-							
-							value = (a00 + a01 * y + a02 * y2 + a03 * y3) + (a10 + a11 * y + a12 * y2 + a13 * y3) * x + (a20 + a21 * y + a22 * y2 + a23 * y3) * x2 + (a30 + a31 * y + a32 * y2 + a33 * y3) * x3;							
-						
-						
-							value *= Scoeff;  // multiplicative coeff to go from ref lambda to science lambda
-						
-							data.image[ID_sarray1].array.F[jj*naxes[0]+ii] += value;
-						
-							if(CONF_WAVEFRONT_AMPLITUDE==1)
-							{
-								re = data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].re;
-								im = data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].im;
-								data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-								data.image[ID_sarray2].array.CF[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-							}
-							}
-						}
-                    }
-                    else // double precision
-                    {
-						if(BICUBIC==0)
-						{   
-							for(ii=0; ii<naxes[0]; ii++)
-                            for(jj=0; jj<naxes[1]; jj++)
-                            {
-                                iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                                jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-                                iim = (long) (iimf);
-                                jjm = (long) (jjmf);
-                                iifrac = iimf-iim;
-                                jjfrac = jjmf-jjm;
-                                iim1 = iim+1;
-                                jjm1 = jjm+1;
-                                if(iim==CONF_MASTER_SIZE)
-                                    iim = 0;
-                                if(jjm==CONF_MASTER_SIZE)
-                                    jjm = 0;
-                                if(iim1>CONF_MASTER_SIZE-1)
-                                    iim1 -= CONF_MASTER_SIZE;
-                                if(jjm1>CONF_MASTER_SIZE-1)
-                                    jjm1 -= CONF_MASTER_SIZE;
-
-                                value = (1.0-iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.D[jjm*naxes_MASTER[0]+iim];
-                                value += (1.0-iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim];
-                                value += (iifrac)*(jjfrac)*data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim1];
-                                value += (iifrac)*(1.0-jjfrac)*data.image[ID_TML[layer]].array.D[jjm*naxes_MASTER[0]+iim1];
-
-                                value *= Scoeff;  // multiplicative coeff to go from ref lambda to science lambda
-
-                                data.image[ID_sarray1].array.D[jj*naxes[0]+ii] += value;
-
-                                if(CONF_WAVEFRONT_AMPLITUDE==1)
-                                {
-                                    re = data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].re;
-                                    im = data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].im;
-                                    data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-                                    data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-                                }
-                            }
-                        }
-                        else
-                        {
-							// bicubic interpolation
-							for(ii=0; ii<naxes[0]; ii++)
-							for(jj=0; jj<naxes[1]; jj++)
-							{
-                            iimf = fmod((xpos[layer]+ii), 1.0*naxes_MASTER[0]);
-                            jjmf = fmod((ypos[layer]+jj), 1.0*naxes_MASTER[1]);
-							
-							iim = (long) (iimf);
-                            jjm = (long) (jjmf);
-							
-							x = iimf-iim;
-                            y = jjmf-jjm;
-                            
-                            
-                            iim0 = iim - 1;
-                            iim1 = iim;
-                            iim2 = iim + 1;
-                            iim3 = iim + 2;
-							if(iim1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(iim2>CONF_MASTER_SIZE-1)
-								iim2 -= CONF_MASTER_SIZE;
-							if(iim3>CONF_MASTER_SIZE-1)
-								iim3 -= CONF_MASTER_SIZE;
-							if(iim0<0)
-								iim0 += CONF_MASTER_SIZE;
-								
-                            jjm0 = jjm - 1;
-                            jjm1 = jjm;
-                            jjm2 = jjm + 1;
-                            jjm3 = jjm + 2;
-							if(jjm1>CONF_MASTER_SIZE-1)
-								iim1 -= CONF_MASTER_SIZE;
-							if(jjm2>CONF_MASTER_SIZE-1)
-								jjm2 -= CONF_MASTER_SIZE;
-							if(jjm3>CONF_MASTER_SIZE-1)
-								jjm3 -= CONF_MASTER_SIZE;
-							if(jjm0<0)
-								jjm0 += CONF_MASTER_SIZE;
-
-							/*assert(iim0>=0);
-							assert(iim1>=0);
-							assert(iim2>=0);
-							assert(iim3>=0);
-							assert(iim0<CONF_MASTER_SIZE);
-							assert(iim1<CONF_MASTER_SIZE);
-							assert(iim2<CONF_MASTER_SIZE);
-							assert(iim3<CONF_MASTER_SIZE);
-							assert(jjm0>=0);
-							assert(jjm1>=0);
-							assert(jjm2>=0);
-							assert(jjm3>=0);
-							assert(jjm0<CONF_MASTER_SIZE);
-							assert(jjm1<CONF_MASTER_SIZE);
-							assert(jjm2<CONF_MASTER_SIZE);
-							assert(jjm3<CONF_MASTER_SIZE);
-							*/
-
-					
-							p00 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim0];
-							p01 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim0];
-							p02 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim0];
-							p03 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim0];
-
-							p10 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim1];
-							p11 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim1];
-							p12 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim1];
-							p13 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim1];
-
-							p20 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim2];
-							p21 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim2];
-							p22 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim2];
-							p23 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim2];
-
-							p30 = data.image[ID_TML[layer]].array.D[jjm0*naxes_MASTER[0]+iim3];
-							p31 = data.image[ID_TML[layer]].array.D[jjm1*naxes_MASTER[0]+iim3];
-							p32 = data.image[ID_TML[layer]].array.D[jjm2*naxes_MASTER[0]+iim3];
-							p33 = data.image[ID_TML[layer]].array.D[jjm3*naxes_MASTER[0]+iim3];
-							
-							
-							a00 = p11;
-							a01 = -.5*p10 + .5*p12;
-							a02 = p10 - 2.5*p11 + 2*p12 - .5*p13;
-							a03 = -.5*p10 + 1.5*p11 - 1.5*p12 + .5*p13;
-							a10 = -.5*p01 + .5*p21;
-							a11 = .25*p00 - .25*p02 - .25*p20 + .25*p22;
-							a12 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + .5*p20 - 1.25*p21 + p22 - .25*p23;
-							a13 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .25*p20 + .75*p21 - .75*p22 + .25*p23;
-							a20 = p01 - 2.5*p11 + 2*p21 - .5*p31;
-							a21 = -.5*p00 + .5*p02 + 1.25*p10 - 1.25*p12 - p20 + p22 + .25*p30 - .25*p32;
-							a22 = p00 - 2.5*p01 + 2*p02 - .5*p03 - 2.5*p10 + 6.25*p11 - 5*p12 + 1.25*p13 + 2*p20 - 5*p21 + 4*p22 - p23 - .5*p30 + 1.25*p31 - p32 + .25*p33;
-							a23 = -.5*p00 + 1.5*p01 - 1.5*p02 + .5*p03 + 1.25*p10 - 3.75*p11 + 3.75*p12 - 1.25*p13 - p20 + 3*p21 - 3*p22 + p23 + .25*p30 - .75*p31 + .75*p32 - .25*p33;
-							a30 = -.5*p01 + 1.5*p11 - 1.5*p21 + .5*p31;
-							a31 = .25*p00 - .25*p02 - .75*p10 + .75*p12 + .75*p20 - .75*p22 - .25*p30 + .25*p32;
-							a32 = -.5*p00 + 1.25*p01 - p02 + .25*p03 + 1.5*p10 - 3.75*p11 + 3*p12 - .75*p13 - 1.5*p20 + 3.75*p21 - 3*p22 + .75*p23 + .5*p30 - 1.25*p31 + p32 - .25*p33;
-							a33 = .25*p00 - .75*p01 + .75*p02 - .25*p03 - .75*p10 + 2.25*p11 - 2.25*p12 + .75*p13 + .75*p20 - 2.25*p21 + 2.25*p22 - .75*p23 - .25*p30 + .75*p31 - .75*p32 + .25*p33;
-							
-							x2 = x*x;
-							x3 = x2*x;
-							y2 = y*y;
-							y3 = y2*y;
-							
-							value = (a00 + a01 * y + a02 * y2 + a03 * y3) + (a10 + a11 * y + a12 * y2 + a13 * y3) * x + (a20 + a21 * y + a22 * y2 + a23 * y3) * x2 + (a30 + a31 * y + a32 * y2 + a33 * y3) * x3;							
-						
-						
-							value *= Scoeff;  // multiplicative coeff to go from ref lambda to science lambda
-						
-							data.image[ID_sarray1].array.D[jj*naxes[0]+ii] += value;
-						
-							if(CONF_WAVEFRONT_AMPLITUDE==1)
-							{
-								re = data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].re;
-								im = data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].im;
-								data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].re = re*cos(value)-im*sin(value);
-								data.image[ID_sarray2].array.CD[jj*naxes[0]+ii].im = re*sin(value)+im*cos(value);
-							}
-							}
-						}
-                    }
-                }
+                    AtmosphericTurbulence_addlayer(ID_TML[layer], xpos[layer], ypos[layer], BICUBIC, ID_array1, (CONF_WAVEFRONT_AMPLITUDE==1) ? ID_array2 : -1, Scoeff, ID_sarray1, (CONF_WAVEFRONT_AMPLITUDE==1) ? ID_sarray2 : -1);
+                else
+                    AtmosphericTurbulence_addlayer(ID_TML[layer], xpos[layer], ypos[layer], BICUBIC, ID_array1, (CONF_WAVEFRONT_AMPLITUDE==1) ? ID_array2 : -1, Scoeff, -1, -1);
             }
            
             
@@ -5043,6 +4768,60 @@ int AtmosphericTurbulence_mkTestTTseq(double dt, long NBpts, long NBblocks, doub
 
 
 
+//
+// masks WF series in place and removes piston over mask from each frame
+//
+static void AtmosphericTurbulence_LinPredictor_WFprep(long ID_WFin, long ID_WFmask)
+{
+	long xsize, ysize, zsize, xysize;
+	long ii, jj, kk;
+	double tot, totm;
+
+	xsize = data.image[ID_WFin].md[0].size[0];
+	ysize = data.image[ID_WFin].md[0].size[1];
+	zsize = data.image[ID_WFin].md[0].size[2];
+	xysize = xsize*ysize;
+
+	totm = 0.0;
+	for(ii=0;ii<xsize;ii++)
+		for(jj=0;jj<ysize;jj++)
+			if(data.image[ID_WFmask].array.F[jj*xsize+ii] > 0.5)
+				totm += 1.0;
+
+	for(kk=0;kk<zsize;kk++)
+	{
+		tot = 0.0;
+		for(ii=0;ii<xsize;ii++)
+		{
+			for(jj=0;jj<ysize;jj++)
+			{
+				data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii] *= data.image[ID_WFmask].array.F[jj*xsize+ii];
+				tot += data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii];
+			}
+		}
+		for(ii=0;ii<xsize;ii++)
+			for(jj=0;jj<ysize;jj++)
+				if(data.image[ID_WFmask].array.F[jj*xsize+ii] > 0.5)
+					data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii] -= tot/totm;
+	}
+}
+
+
+
+// space-time autocorrelation R_tau(dx,dy) from inverse-transformed cross-spectra cube (R_-tau(d) = R_tau(-d))
+static double AtmosphericTurbulence_LinPredictor_Rcorr(long IDS, long tau, long dx, long dy, long xpsize, long ypsize)
+{
+	if(tau<0)
+	{
+		tau = -tau;
+		dx = -dx;
+		dy = -dy;
+	}
+	return(data.image[IDS].array.CD[tau*xpsize*ypsize + ((dy+ypsize)%ypsize)*xpsize + (dx+xpsize)%xpsize].re);
+}
+
+
+
 //
 // build full predictor (all pixels of WF)
 //
@@ -5109,27 +4888,7 @@ int AtmosphericTurbulence_Build_LinPredictor_Full(const char *WFin_name, const c
 
 
 	// PRE_PROCESS WAVEFRONTS : REMOVE PISTON TERM
-
-	totm = 0.0;
-	for(ii=0;ii<xsize;ii++)
-		for(jj=0;jj<ysize;jj++)
-			if(data.image[ID_WFmask].array.F[jj*xsize+ii] > 0.5)
-				totm += 1.0;
-
-	for(kk=0;kk<zsize;kk++)
-	{
-		tot = 0.0;
-		for(ii=0;ii<xsize;ii++)
-			for(jj=0;jj<ysize;jj++)
-			{
-				data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii] *= data.image[ID_WFmask].array.F[jj*xsize+ii];
-				tot += data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii];
-			}
-			for(ii=0;ii<xsize;ii++)
-				for(jj=0;jj<ysize;jj++)
-					if(data.image[ID_WFmask].array.F[jj*xsize+ii] > 0.5)
-						data.image[ID_WFin].array.F[kk*xysize+jj*xsize+ii] -= tot/totm;
-		}
+	AtmosphericTurbulence_LinPredictor_WFprep(ID_WFin, ID_WFmask);
 	if(Save==1)
 		save_fits(WFin_name, "!wfinm.fits");
 	
@@ -5293,6 +5052,255 @@ int AtmosphericTurbulence_Build_LinPredictor_Full(const char *WFin_name, const c
 
 
 
+//
+// build translation-invariant predictor as a 2D kernel (radius krad, PForder time steps)
+//
+// prediction at pixel p :  sum_dt sum_d K[dt,d] WF(p+d, t-dt)   (d offsets within krad, same convention as 2DKernelExtract)
+// normal equations only involve the space-time autocorrelation R_tau(d) of the masked, piston-removed WF series
+// R_tau is assembled from zero-padded FFTs (FFT_do2dfft_byID, cuFFT if available), so system size is PForder x NBoffset instead of PForder x NBpix
+// pupil edge band is ignored in the covariance (stationary approximation)
+// RegLambda is relative to mean diagonal of covariance matrix
+// kernel written to IDkern_name (as 2DKernelExtract), also expanded into filtC (as Build_LinPredictor_Full output) if small enough
+//
+long AtmosphericTurbulence_Build_LinPredictor_Kernel(const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, long krad, double SVDeps, double RegLambda, const char *IDkern_name)
+{
+	long ID_WFin, ID_WFmask;
+	long xsize, ysize, zsize, xysize;
+	long xpsize, ypsize, xypsize; // padded size
+	long NBtau, tau, lag;
+	long NBoff, off, off1;
+	long *offarray_x;
+	long *offarray_y;
+	long NBk, k, k1;
+	long IDbuf, IDS, IDmatA, IDmatAinv, IDkern, IDfiltC;
+	uint32_t sizearray[3];
+	double *ringre, *ringim;
+	double *bvec, *kvec;
+	complex_double *cptr;
+	long t0, t, kk, nb, ii, jj, dt, dt1, slot, slot1;
+	long xksize, yksize;
+	long NBpix, PFpix, pix, dii, djj;
+	long *pixarray_x;
+	long *pixarray_y;
+	float alpha;
+	double tr;
+	struct timespec tstart, tend;
+
+
+	ID_WFin = image_ID(WFin_name);
+	ID_WFmask = image_ID(WFmask_name);
+	if((ID_WFin==-1)||(ID_WFmask==-1)||(data.image[ID_WFin].md[0].naxis!=3))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input WF cube or mask missing");
+		return(-1);
+	}
+	clock_gettime(CLOCK_REALTIME, &tstart);
+
+	xsize = data.image[ID_WFin].md[0].size[0];
+	ysize = data.image[ID_WFin].md[0].size[1];
+	zsize = data.image[ID_WFin].md[0].size[2];
+	xysize = xsize*ysize;
+
+	lag = (long) PFlag;
+	alpha = PFlag - lag;
+	NBtau = PForder + lag + 1;
+	if(zsize < 2*NBtau)
+	{
+		printERROR(__FILE__,__func__,__LINE__,"WF series too short for predictor order and lag");
+		return(-1);
+	}
+
+	AtmosphericTurbulence_LinPredictor_WFprep(ID_WFin, ID_WFmask);
+
+
+	// kernel offsets
+	offarray_x = (long*) malloc(sizeof(long)*(2*krad+1)*(2*krad+1));
+	offarray_y = (long*) malloc(sizeof(long)*(2*krad+1)*(2*krad+1));
+	NBoff = 0;
+	for(djj=-krad; djj<=krad; djj++)
+		for(dii=-krad; dii<=krad; dii++)
+			if(dii*dii+djj*djj<krad*krad)
+			{
+				offarray_x[NBoff] = dii;
+				offarray_y[NBoff] = djj;
+				NBoff++;
+			}
+	NBk = NBoff*PForder;
+	printf("NBoff = %ld   NBk = %ld\n", NBoff, NBk);
+
+
+	// cross-spectra S_tau = sum_t conj(FFT(WF_t)) FFT(WF_t+tau)
+	xpsize = xsize + 2*krad;
+	ypsize = ysize + 2*krad;
+	xypsize = xpsize*ypsize;
+
+	sizearray[0] = xpsize;
+	sizearray[1] = ypsize;
+	sizearray[2] = LINPRED_FFTBATCH;
+	IDbuf = create_image_ID("_PFk_fftbuf", 3, sizearray, _DATATYPE_COMPLEX_DOUBLE, 0, 0);
+	sizearray[2] = NBtau;
+	IDS = create_image_ID("_PFk_S", 3, sizearray, _DATATYPE_COMPLEX_DOUBLE, 0, 0);
+	memset(data.image[IDS].array.CD, 0, sizeof(complex_double)*xypsize*NBtau);
+
+	ringre = (double*) malloc(sizeof(double)*xypsize*NBtau);
+	ringim = (double*) malloc(sizeof(double)*xypsize*NBtau);
+
+	for(t0=0; t0<zsize; t0+=LINPRED_FFTBATCH)
+	{
+		nb = (zsize-t0 < LINPRED_FFTBATCH) ? zsize-t0 : LINPRED_FFTBATCH;
+		memset(data.image[IDbuf].array.CD, 0, sizeof(complex_double)*xypsize*LINPRED_FFTBATCH);
+		for(kk=0; kk<nb; kk++)
+			for(jj=0; jj<ysize; jj++)
+				for(ii=0; ii<xsize; ii++)
+					data.image[IDbuf].array.CD[kk*xypsize+jj*xpsize+ii].re = data.image[ID_WFin].array.F[(t0+kk)*xysize+jj*xsize+ii];
+		if(FFT_do2dfft_byID(IDbuf, IDbuf, -1)==-1)
+			break;
+
+		for(kk=0; kk<nb; kk++)
+		{
+			t = t0+kk;
+			slot = t%NBtau;
+			cptr = data.image[IDbuf].array.CD + kk*xypsize;
+			for(ii=0; ii<xypsize; ii++)
+			{
+				ringre[slot*xypsize+ii] = cptr[ii].re;
+				ringim[slot*xypsize+ii] = cptr[ii].im;
+			}
+
+			# ifdef _OPENMP
+			#pragma omp parallel for private(slot1, ii)
+			# endif
+			for(tau=0; tau<NBtau; tau++)
+			{
+				if(tau>t)
+					continue;
+				slot1 = (t-tau)%NBtau;
+				for(ii=0; ii<xypsize; ii++)
+				{
+					// conj(W_t-tau) * W_t
+					data.image[IDS].array.CD[tau*xypsize+ii].re += ringre[slot1*xypsize+ii]*ringre[slot*xypsize+ii] + ringim[slot1*xypsize+ii]*ringim[slot*xypsize+ii];
+					data.image[IDS].array.CD[tau*xypsize+ii].im += ringre[slot1*xypsize+ii]*ringim[slot*xypsize+ii] - ringim[slot1*xypsize+ii]*ringre[slot*xypsize+ii];
+				}
+			}
+		}
+		printf("\r  frame %6ld / %6ld   ", t0+nb, zsize);
+		fflush(stdout);
+	}
+	printf("\n");
+	free(ringre);
+	free(ringim);
+	delete_image_ID("_PFk_fftbuf");
+
+	// R_tau(d) = sum_t sum_q WF(q,t) WF(q+d,t+tau) / (zsize-tau)
+	FFT_do2dfft_byID(IDS, IDS, 1);
+	for(tau=0; tau<NBtau; tau++)
+		for(ii=0; ii<xypsize; ii++)
+			data.image[IDS].array.CD[tau*xypsize+ii].re /= 1.0*xypsize*(zsize-tau);
+
+
+	// normal equations
+	// A[(dt1,d1),(dt,d)] = R_(dt1-dt)(d-d1)
+	// b[(dt,d)] = (1-alpha) R_(dt+lag)(-d) + alpha R_(dt+lag+1)(-d)
+	IDmatA = create_2Dimage_ID("PFkmatA", NBk, NBk);
+	bvec = (double*) malloc(sizeof(double)*NBk);
+	kvec = (double*) malloc(sizeof(double)*NBk);
+
+	for(dt1=0; dt1<PForder; dt1++)
+		for(off1=0; off1<NBoff; off1++)
+		{
+			k1 = dt1*NBoff+off1;
+			for(dt=0; dt<PForder; dt++)
+				for(off=0; off<NBoff; off++)
+				{
+					k = dt*NBoff+off;
+					data.image[IDmatA].array.F[k1*NBk+k] = AtmosphericTurbulence_LinPredictor_Rcorr(IDS, dt1-dt, offarray_x[off]-offarray_x[off1], offarray_y[off]-offarray_y[off1], xpsize, ypsize);
+				}
+			bvec[k1] = (1.0-alpha)*AtmosphericTurbulence_LinPredictor_Rcorr(IDS, dt1+lag, -offarray_x[off1], -offarray_y[off1], xpsize, ypsize) + alpha*AtmosphericTurbulence_LinPredictor_Rcorr(IDS, dt1+lag+1, -offarray_x[off1], -offarray_y[off1], xpsize, ypsize);
+		}
+	delete_image_ID("_PFk_S");
+
+	tr = 0.0;
+	for(k=0; k<NBk; k++)
+		tr += data.image[IDmatA].array.F[k*NBk+k];
+	for(k=0; k<NBk; k++)
+		data.image[IDmatA].array.F[k*NBk+k] += RegLambda*tr/NBk;
+
+
+	printf("Compute kernel\n");
+	fflush(stdout);
+
+	#ifdef HAVE_MAGMA
+		CUDACOMP_magma_compute_SVDpseudoInverse("PFkmatA", "PFkmatAinv", SVDeps, 100000, "PFk_VTmat", 0);
+	#else
+		linopt_compute_SVDpseudoInverse("PFkmatA", "PFkmatAinv", SVDeps, 100000, "PFk_VTmat");
+	#endif
+	IDmatAinv = image_ID("PFkmatAinv");
+
+	for(k1=0; k1<NBk; k1++)
+	{
+		kvec[k1] = 0.0;
+		for(k=0; k<NBk; k++)
+			kvec[k1] += data.image[IDmatAinv].array.F[k1*NBk+k]*bvec[k];
+	}
+
+	xksize = 2*krad+1;
+	yksize = 2*krad+1;
+	IDkern = create_3Dimage_ID(IDkern_name, xksize, yksize, PForder);
+	for(dt=0; dt<PForder; dt++)
+		for(off=0; off<NBoff; off++)
+			data.image[IDkern].array.F[dt*xksize*yksize + (offarray_y[off]+krad)*xksize + offarray_x[off]+krad] = kvec[dt*NBoff+off];
+
+
+	// expand into full filter
+	NBpix = 0;
+	for(ii=0; ii<xysize; ii++)
+		if(data.image[ID_WFmask].array.F[ii] > 0.5)
+			NBpix++;
+	if(1.0*NBpix*NBpix*PForder < LINPRED_FILTCMAX)
+	{
+		pixarray_x = (long*) malloc(sizeof(long)*NBpix);
+		pixarray_y = (long*) malloc(sizeof(long)*NBpix);
+		NBpix = 0;
+		for(ii=0;ii<xsize;ii++)
+			for(jj=0;jj<ysize;jj++)
+				if(data.image[ID_WFmask].array.F[jj*xsize+ii] > 0.5)
+				{
+					pixarray_x[NBpix] = ii;
+					pixarray_y[NBpix] = jj;
+					NBpix++;
+				}
+
+		IDfiltC = create_3Dimage_ID("filtC", NBpix, NBpix, PForder);
+		for(PFpix=0; PFpix<NBpix; PFpix++)
+			for(pix=0; pix<NBpix; pix++)
+			{
+				dii = pixarray_x[pix]-pixarray_x[PFpix];
+				djj = pixarray_y[pix]-pixarray_y[PFpix];
+				if(dii*dii+djj*djj<krad*krad)
+					for(dt=0; dt<PForder; dt++)
+						data.image[IDfiltC].array.F[dt*NBpix*NBpix + PFpix*NBpix + pix] = data.image[IDkern].array.F[dt*xksize*yksize + (djj+krad)*xksize + dii+krad];
+			}
+		free(pixarray_x);
+		free(pixarray_y);
+	}
+	else
+		printf("NBpix = %ld : filtC not created, use kernel %s\n", NBpix, IDkern_name);
+
+	free(bvec);
+	free(kvec);
+	free(offarray_x);
+	free(offarray_y);
+
+	clock_gettime(CLOCK_REALTIME, &tend);
+	printf("Kernel predictor computed in %.3f s\n", 1.0*(tend.tv_sec-tstart.tv_sec) + 1.0e-9*(tend.tv_nsec-tstart.tv_nsec));
+
+	return(IDkern);
+}
+
+
+
+
+
 //
 // extract translation-invariant kernel from predictive AR filter and expand into individual filters
 //
@@ -6619,27 +6627,175 @@ int AtmosphericTurbulence_Test_LinPredictor(long NB_WFstep, double WFphaNoise, c
 
 
 
+//
+// background file prefetch : files loaded in order by NBthread threads into NBslot buffers (nelement floats each)
+// consumer takes file i (blocks until loaded), then releases it to free the slot
+//
+typedef struct
+{
+    char **fname;
+    long NBfile;
+    long nelement;
+    int NBslot;
+    float **buf;
+    long *slotfile;    // file index in slot
+    int *slotstatus;   // 0 free, 1 loading, 2 ready, -1 read error
+    long next;         // next file to load
+    long consumed;     // files released
+    int stop;
+    int NBthread;
+    pthread_t *thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ATMTURB_PREFETCH;
+
+
+static void *AtmosphericTurbulence_prefetch_worker(void *ptr)
+{
+    ATMTURB_PREFETCH *pf = (ATMTURB_PREFETCH*) ptr;
+    long i;
+    int slot, r;
+
+    pthread_mutex_lock(&pf->mutex);
+    while(pf->stop == 0)
+    {
+        if((pf->next < pf->NBfile)&&(pf->next < pf->consumed + pf->NBslot))
+        {
+            i = pf->next++;
+            slot = i % pf->NBslot;
+            pf->slotfile[slot] = i;
+            pf->slotstatus[slot] = 1;
+            pthread_mutex_unlock(&pf->mutex);
+
+            r = load_fits_array_float(pf->fname[i], pf->buf[slot], pf->nelement);
+
+            pthread_mutex_lock(&pf->mutex);
+            pf->slotstatus[slot] = (r == 0) ? 2 : -1;
+            pthread_cond_broadcast(&pf->cond);
+        }
+        else
+            pthread_cond_wait(&pf->cond, &pf->mutex);
+    }
+    pthread_mutex_unlock(&pf->mutex);
+
+    return(NULL);
+}
+
+
+static ATMTURB_PREFETCH *AtmosphericTurbulence_prefetch_start(char **fname, long NBfile, long nelement, int NBslot, int NBthread)
+{
+    ATMTURB_PREFETCH *pf;
+    int s;
+
+    pf = (ATMTURB_PREFETCH*) malloc(sizeof(ATMTURB_PREFETCH));
+    pf->fname = fname;
+    pf->NBfile = NBfile;
+    pf->nelement = nelement;
+    pf->NBslot = NBslot;
+    pf->buf = (float**) malloc(sizeof(float*)*NBslot);
+    pf->slotfile = (long*) malloc(sizeof(long)*NBslot);
+    pf->slotstatus = (int*) malloc(sizeof(int)*NBslot);
+    for(s=0; s<NBslot; s++)
+    {
+        pf->buf[s] = (float*) malloc(sizeof(float)*nelement);
+        if(pf->buf[s] == NULL)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"malloc error");
+            exit(0);
+        }
+        pf->slotfile[s] = -1;
+        pf->slotstatus[s] = 0;
+    }
+    pf->next = 0;
+    pf->consumed = 0;
+    pf->stop = 0;
+    pthread_mutex_init(&pf->mutex, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+
+    pf->NBthread = NBthread;
+    pf->thread = (pthread_t*) malloc(sizeof(pthread_t)*NBthread);
+    for(s=0; s<NBthread; s++)
+        pthread_create(&pf->thread[s], NULL, AtmosphericTurbulence_prefetch_worker, (void*) pf);
+
+    return(pf);
+}
+
+
+// returns buffer holding file i, NULL if it could not be read
+static float *AtmosphericTurbulence_prefetch_take(ATMTURB_PREFETCH *pf, long i)
+{
+    int slot = i % pf->NBslot;
+    float *ptr;
+
+    pthread_mutex_lock(&pf->mutex);
+    while((pf->slotfile[slot] != i)||(pf->slotstatus[slot] < 2 && pf->slotstatus[slot] != -1))
+        pthread_cond_wait(&pf->cond, &pf->mutex);
+    ptr = (pf->slotstatus[slot] == 2) ? pf->buf[slot] : NULL;
+    pthread_mutex_unlock(&pf->mutex);
+
+    return(ptr);
+}
+
+
+static void AtmosphericTurbulence_prefetch_release(ATMTURB_PREFETCH *pf, long i)
+{
+    pthread_mutex_lock(&pf->mutex);
+    pf->slotstatus[i % pf->NBslot] = 0;
+    pf->consumed = i+1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->mutex);
+}
+
+
+static void AtmosphericTurbulence_prefetch_stop(ATMTURB_PREFETCH *pf)
+{
+    int s;
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->mutex);
+    for(s=0; s<pf->NBthread; s++)
+        pthread_join(pf->thread[s], NULL);
+
+    for(s=0; s<pf->NBslot; s++)
+        free(pf->buf[s]);
+    free(pf->buf);
+    free(pf->slotfile);
+    free(pf->slotstatus);
+    free(pf->thread);
+    pthread_mutex_destroy(&pf->mutex);
+    pthread_cond_destroy(&pf->cond);
+    free(pf);
+}
+
+
+
+
+//
+// exposure frames from wavefront series
+// phase files are prefetched while the previous one is processed, PSFs computed by batches of ATMTURB_PSFBATCH frames
+// (single batched FFT, cached plan), quadrant swap applied once per exposure
+//
 int measure_wavefront_series_expoframes(float etime, const char *outfile)
 {
     float FOCAL_SCALE;
     float tmp,tmp1;
-    long ID,IDpsf,IDamp,IDpha;
+    long IDpsf,IDamp;
     long tspan;
     FILE *fp;
     char command[200];
     float frac = 0.5;
 
     long ID_array1;
-    float amp,pha;
 
     char fnameamp[200];
-    char fnamepha[200];
     char fname[200];
+    char **fnamepha;
 
     long naxes[3];
-    long frame;
     long NBFRAMES;
-    long ii,jj;
+    long ii;
     float etime_left;
     long frame_number;
     double *xcenter;
@@ -6649,6 +6805,11 @@ int measure_wavefront_series_expoframes(float etime, const char *outfile)
     long zoomfactor = 2;
     long naxesout[2];
     long xoffset, yoffset;
+    long xysize, xysizeout;
+    long frame0, NBb, kk;
+    float *phaarray;
+    float *amparray;
+    ATMTURB_PREFETCH *pf;
 
 	double SLAMBDA = 1.65e-6;
 
@@ -6666,19 +6827,20 @@ int measure_wavefront_series_expoframes(float etime, const char *outfile)
     FOCAL_SCALE = CONF_LAMBDA/CONF_WFsize/CONF_PUPIL_SCALE/PI*180.0*3600.0*zoomfactor; /* in arcsecond per pixel */
     printf("Scale is %f arcsecond per pixel (%ld pixels)\n",FOCAL_SCALE, CONF_WFsize);
 
-    ID = image_ID("ST_pa");
-    if (ID==-1)
+    IDamp = image_ID("ST_pa");
+    if (IDamp==-1)
         {
             printf("ERROR: pupil amplitude map not loaded");
             exit(0);
         }
  
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    IDamp = ID;
+    naxes[0] = data.image[IDamp].md[0].size[0];
+    naxes[1] = data.image[IDamp].md[0].size[1];
+    xysize = naxes[0]*naxes[1];
 
     naxesout[0] = naxes[0]*zoomfactor;
     naxesout[1] = naxes[1]*zoomfactor;
+    xysizeout = naxesout[0]*naxesout[1];
     xoffset = (naxesout[0]-naxes[0])/2;
     yoffset = (naxesout[1]-naxes[1])/2;
 
@@ -6686,7 +6848,8 @@ int measure_wavefront_series_expoframes(float etime, const char *outfile)
     NBFRAMES = (long) (CONF_TIME_SPAN/CONF_WFTIME_STEP);
     naxes[2] = NBFRAMES;
 
-    ID_array1 = create_2DCimage_ID("array1", naxesout[0], naxesout[1]);
+    // complex amplitude batch, zero outside pupil footprint
+    ID_array1 = create_3DCimage_ID("array1", naxesout[0], naxesout[1], ATMTURB_PSFBATCH);
 
     IDpsf = create_2Dimage_ID("PSF", naxesout[0], naxesout[1]);
     frame_number = 0;
@@ -6709,85 +6872,120 @@ int measure_wavefront_series_expoframes(float etime, const char *outfile)
     fclose(fp);
 
 
+    fnamepha = (char**) malloc(sizeof(char*)*CONF_NB_TSPAN);
+    for(tspan=0; tspan<CONF_NB_TSPAN; tspan++)
+    {
+        fnamepha[tspan] = (char*) malloc(sizeof(char)*200);
+        sprintf(fnamepha[tspan],"%s%8ld.%09ld.pha.fits", CONF_SWF_FILE_PREFIX, tspan, (long) (1.0e12*SLAMBDA+0.5));
+        replace_char(fnamepha[tspan],' ','0');
+    }
+    pf = AtmosphericTurbulence_prefetch_start(fnamepha, CONF_NB_TSPAN, xysize*NBFRAMES, 2, 1);
+
+
     for(tspan=0; tspan<CONF_NB_TSPAN; tspan++)
     {
         printf("%ld/%ld\n", tspan, CONF_NB_TSPAN);
-        sprintf(fnamepha,"%s%8ld.%09ld.pha.fits", CONF_SWF_FILE_PREFIX, tspan, (long) (1.0e12*SLAMBDA+0.5));
-        replace_char(fnamepha,' ','0');
-        sprintf(fnameamp,"%s%8ld.%09ld.amp.fits", CONF_SWF_FILE_PREFIX, tspan, (long) (1.0e12*SLAMBDA+0.5));
-        replace_char(fnameamp,' ','0');
-        IDpha = load_fits(fnamepha, "wfpha", 1);
+        phaarray = AtmosphericTurbulence_prefetch_take(pf, tspan);
+        if(phaarray==NULL)
+        {
+            printf("ERROR: cannot read file %s\n", fnamepha[tspan]);
+            exit(0);
+        }
+        amparray = data.image[IDamp].array.F;
         if(amplitude_on==1)
         {
             printf("reading amp\n");
             fflush(stdout);
+            sprintf(fnameamp,"%s%8ld.%09ld.amp.fits", CONF_SWF_FILE_PREFIX, tspan, (long) (1.0e12*SLAMBDA+0.5));
+            replace_char(fnameamp,' ','0');
             IDamp = load_fits(fnameamp, "wfamp", 1);
         }
 
-        for(frame=0; frame<NBFRAMES; frame++)
+        for(frame0=0; frame0<NBFRAMES; frame0+=ATMTURB_PSFBATCH)
         {
-            if(amplitude_on==1)
-                for(ii=0; ii<naxes[0]; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                    {
-                        amp = data.image[IDamp].array.F[frame*naxes[0]*naxes[1]+jj*naxes[0]+ii];
-                        pha = data.image[IDpha].array.F[frame*naxes[0]*naxes[1]+jj*naxes[0]+ii];
-                        data.image[ID_array1].array.CF[(jj+yoffset)*naxesout[0]+ii+xoffset].re = amp*cos(pha);
-                        data.image[ID_array1].array.CF[(jj+yoffset)*naxesout[0]+ii+xoffset].im = amp*sin(pha);
-                    }
-            else
-                for(ii=0; ii<naxes[0]; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                    {
-                        amp = data.image[IDamp].array.F[jj*naxes[0]+ii];
-                        pha = data.image[IDpha].array.F[frame*naxes[0]*naxes[1]+jj*naxes[0]+ii];
-                        data.image[ID_array1].array.CF[(jj+yoffset)*naxesout[0]+ii+xoffset].re = amp*cos(pha);
-                        data.image[ID_array1].array.CF[(jj+yoffset)*naxesout[0]+ii+xoffset].im = amp*sin(pha);
-                    }
+            NBb = (NBFRAMES-frame0 < ATMTURB_PSFBATCH) ? NBFRAMES-frame0 : ATMTURB_PSFBATCH;
 
-            do2dfft("array1","im_c");
-            permut("im_c");
-            ID=image_ID("im_c");
-            for(ii=0; ii<naxesout[0]; ii++)
-                for(jj=0; jj<naxesout[1]; jj++)
+            # ifdef _OPENMP
+            #pragma omp parallel for
+            # endif
+            for(kk=0; kk<NBb; kk++)
+            {
+                long ii1, jj;
+                const float *pha = phaarray + (frame0+kk)*xysize;
+                const float *amp = (amplitude_on==1) ? data.image[IDamp].array.F + (frame0+kk)*xysize : amparray;
+                complex_float *out = data.image[ID_array1].array.CF + kk*xysizeout;
+
+                // previous batch left its transform in place
+                memset(out, 0, sizeof(complex_float)*xysizeout);
+                for(jj=0; jj<naxes[1]; jj++)
                 {
-                    data.image[IDpsf].array.F[jj*naxesout[0]+ii] += (data.image[ID].array.CF[jj*naxesout[0]+ii].re*data.image[ID].array.CF[jj*naxesout[0]+ii].re+data.image[ID].array.CF[jj*naxesout[0]+ii].im*data.image[ID].array.CF[jj*naxesout[0]+ii].im);
+                    #pragma omp simd
+                    for(ii1=0; ii1<naxes[0]; ii1++)
+                    {
+                        float s, c;
+                        sincosf(pha[jj*naxes[0]+ii1], &s, &c);
+                        out[(jj+yoffset)*naxesout[0]+ii1+xoffset].re = amp[jj*naxes[0]+ii1]*c;
+                        out[(jj+yoffset)*naxesout[0]+ii1+xoffset].im = amp[jj*naxes[0]+ii1]*s;
+                    }
                 }
-            delete_image_ID("im_c");
+            }
 
-            etime_left -= CONF_WFTIME_STEP;
-            if(etime_left<0)
+            FFT_do2dfft_byID(ID_array1, ID_array1, -1);
+
+            for(kk=0; kk<NBb; kk++)
             {
-                sprintf(fname,"!PSF%04ld.fits",frame_number);
-                save_fl_fits("PSF",fname);
-                gauss_filter("PSF","PSFg",3,10);
-                center_PSF("PSFg", xcenter, ycenter, naxesout[0]/2);
-                tmp = measure_FWHM("PSFg",xcenter[0],ycenter[0],1.0,naxesout[0]/2);
-                printf("%ld FWHM %f arcseconds (%f pixels)\n",frame_number,FOCAL_SCALE*tmp,tmp);
-                tmp1 = measure_enc_NRJ("PSF", xcenter[0], ycenter[0], frac);
-                printf("Encircled energy (%f) is %f arcseconds\n", frac, tmp1*FOCAL_SCALE);
-                delete_image_ID("PSFg");
-                if((fp=fopen(outfile,"a"))==NULL)
+                const complex_float *psfc = data.image[ID_array1].array.CF + kk*xysizeout;
+
+                # ifdef _OPENMP
+                #pragma omp parallel for simd
+                # endif
+                for(ii=0; ii<xysizeout; ii++)
+                    data.image[IDpsf].array.F[ii] += psfc[ii].re*psfc[ii].re + psfc[ii].im*psfc[ii].im;
+
+                etime_left -= CONF_WFTIME_STEP;
+                if(etime_left<0)
                 {
-                    printf("Cannot open file %s\n",outfile);
-                    exit(0);
-                }
-                fprintf(fp,"%ld %f %f %f %f\n",frame_number,FOCAL_SCALE*tmp,2.0*FOCAL_SCALE*tmp1,xcenter[0],ycenter[0]);
-                fclose(fp);
+                    permut("PSF");
+                    sprintf(fname,"!PSF%04ld.fits",frame_number);
+                    save_fl_fits("PSF",fname);
+                    gauss_filter("PSF","PSFg",3,10);
+                    center_PSF("PSFg", xcenter, ycenter, naxesout[0]/2);
+                    tmp = measure_FWHM("PSFg",xcenter[0],ycenter[0],1.0,naxesout[0]/2);
+                    printf("%ld FWHM %f arcseconds (%f pixels)\n",frame_number,FOCAL_SCALE*tmp,tmp);
+                    tmp1 = measure_enc_NRJ("PSF", xcenter[0], ycenter[0], frac);
+                    printf("Encircled energy (%f) is %f arcseconds\n", frac, tmp1*FOCAL_SCALE);
+                    delete_image_ID("PSFg");
+                    if((fp=fopen(outfile,"a"))==NULL)
+                    {
+                        printf("Cannot open file %s\n",outfile);
+                        exit(0);
+                    }
+                    fprintf(fp,"%ld %f %f %f %f\n",frame_number,FOCAL_SCALE*tmp,2.0*FOCAL_SCALE*tmp1,xcenter[0],ycenter[0]);
+                    fclose(fp);
 
-                arith_image_zero("PSF");
-                etime_left = etime;
-                frame_number++;
-                printf("Working on frame %ld\n",frame_number);
+                    arith_image_zero("PSF");
+                    etime_left = etime;
+                    frame_number++;
+                    printf("Working on frame %ld\n",frame_number);
+                }
             }
-
         }
-        delete_image_ID("wfamp");
-        delete_image_ID("wfpha");
+        AtmosphericTurbulence_prefetch_release(pf, tspan);
+        if(amplitude_on==1)
+        {
+            delete_image_ID("wfamp");
+            IDamp = image_ID("ST_pa");
+        }
     }
+    AtmosphericTurbulence_prefetch_stop(pf);
+    for(tspan=0; tspan<CONF_NB_TSPAN; tspan++)
+        free(fnamepha[tspan]);
+    free(fnamepha);
+
     free(xcenter);
     free(ycenter);
     delete_image_ID("array1");
+    permut("PSF");
     save_fl_fits("PSF","!PSF");
     tmp = measure_FWHM("PSF", 1.0*naxesout[0]/2, 1.0*naxesout[1]/2,1.0, naxesout[0]/2);
     printf("FWHM = %f arcseconds (%f pixels)\n", FOCAL_SCALE*tmp, tmp);
@@ -6801,6 +6999,35 @@ int measure_wavefront_series_expoframes(float etime, const char *outfile)
 
 
 
+// co-add tmppsf into image IDname, offset by center difference (running max center kept as reference)
+static void AtmosphericTurbulence_frame_select_coadd(const char *IDname, int first, float xc, float yc, float *Xcenter, float *Ycenter)
+{
+    char nname[200];
+
+    if(first)
+    {
+        copy_image_ID("tmppsf", IDname, 0);
+        *Xcenter = xc;
+        *Ycenter = yc;
+    }
+    else
+    {
+        sprintf(nname, "n%s", IDname);
+        basic_add(IDname, "tmppsf", nname, *Xcenter-xc, *Ycenter-yc);
+        if(*Xcenter<xc)
+            *Xcenter = xc;
+        if(*Ycenter<yc)
+            *Ycenter = yc;
+        delete_image_ID(IDname);
+        chname_image_ID(nname, IDname);
+    }
+}
+
+
+//
+// single pass over PSF files, prefetched by ATMTURB_PREFETCH_NBTHREAD threads
+// selection limits computed from the log values before any file is read
+//
 int frame_select_PSF(const char *logfile, long NBfiles, float frac)
 {
     /* logfile has the following format:
@@ -6813,23 +7040,28 @@ int frame_select_PSF(const char *logfile, long NBfiles, float frac)
        PSFccse: coadded PSF with centering and selection on Enc.ener.(frac= fraction of the frames kept)
     */
     FILE *fp;
-    int OK;
-    long i;
+    long i, ii;
     float *FWHM;
     float *ENCE;
     float *xcen;
     float *ycen;
-    char fname[200];
-    float Xcenter,Ycenter;
+    float *sortarray;
+    char **fname;
     float Xcenter_c,Ycenter_c;
     float Xcenter_cc,Ycenter_cc;
     float Xcenter_ccsf,Ycenter_ccsf;
     float Xcenter_ccse,Ycenter_ccse;
-    float limit;
-    long cnt;
+    float limitf, limite;
+    long cntf, cnte;
     float fwhm1,fwhm2,fwhm3,fwhm4;
     float ence1,ence2,ence3,ence4;
     float fs = 0.01128;
+    long naxis;
+    uint32_t naxes[3];
+    long nelement;
+    long IDtmp, IDc;
+    float *psfarray;
+    ATMTURB_PREFETCH *pf;
 
     Xcenter_c = 128;
     Ycenter_c = 128;
@@ -6838,8 +7070,9 @@ int frame_select_PSF(const char *logfile, long NBfiles, float frac)
     ENCE = (float*) malloc(sizeof(float)*NBfiles);
     xcen = (float*) malloc(sizeof(float)*NBfiles);
     ycen = (float*) malloc(sizeof(float)*NBfiles);
+    sortarray = (float*) malloc(sizeof(float)*NBfiles);
+    fname = (char**) malloc(sizeof(char*)*NBfiles);
 
-    /* make PSFc */
     if((fp=fopen(logfile,"r"))==NULL)
     {
         printf("ERROR: cannot open file \"%s\"\n",logfile);
@@ -6847,158 +7080,83 @@ int frame_select_PSF(const char *logfile, long NBfiles, float frac)
     }
     for(i=0; i<NBfiles; i++)
     {
-        if(fscanf(fp,"%s %f %f %f %f\n",fname,&FWHM[i],&ENCE[i],&xcen[i],&ycen[i])!=5)
+        fname[i] = (char*) malloc(sizeof(char)*200);
+        if(fscanf(fp,"%s %f %f %f %f\n",fname[i],&FWHM[i],&ENCE[i],&xcen[i],&ycen[i])!=5)
         {
             printf("ERROR: fscanf, %s line %d\n",__FILE__,__LINE__);
             exit(0);
         }
-
-        if(i==0)
-            load_fits(fname, "PSFc", 1);
-        else
-        {
-            load_fits(fname, "tmppsf", 1);
-            execute_arith("PSFc=PSFc+tmppsf");
-            delete_image_ID("tmppsf");
-        }
     }
     fclose(fp);
 
-    /* make PSFcc */
-    Xcenter = 0.0;
-    Ycenter = 0.0;
-    if((fp=fopen(logfile,"r"))==NULL)
+    memcpy(sortarray, FWHM, sizeof(float)*NBfiles);
+    quick_sort_float(sortarray, NBfiles);
+    limitf = sortarray[(long) (frac*NBfiles)];
+    memcpy(sortarray, ENCE, sizeof(float)*NBfiles);
+    quick_sort_float(sortarray, NBfiles);
+    limite = sortarray[(long) (frac*NBfiles)];
+    free(sortarray);
+
+    if(read_fits_imsize(fname[0], &naxis, naxes, NULL, NULL)!=0)
     {
-        printf("ERROR: cannot open file \"%s\"\n",logfile);
+        printf("ERROR: cannot read file \"%s\"\n", fname[0]);
         exit(0);
     }
+    nelement = (long) naxes[0]*naxes[1]*naxes[2];
+    IDtmp = create_2Dimage_ID("tmppsf", naxes[0], naxes[1]);
+
+    pf = AtmosphericTurbulence_prefetch_start(fname, NBfiles, nelement, 2*ATMTURB_PREFETCH_NBTHREAD, ATMTURB_PREFETCH_NBTHREAD);
+
+    Xcenter_cc = 0.0;
+    Ycenter_cc = 0.0;
+    Xcenter_ccsf = 0.0;
+    Ycenter_ccsf = 0.0;
+    Xcenter_ccse = 0.0;
+    Ycenter_ccse = 0.0;
+    cntf = 0;
+    cnte = 0;
     for(i=0; i<NBfiles; i++)
     {
-        if(fscanf(fp,"%s %f %f %f %f\n",fname,&FWHM[i],&ENCE[i],&xcen[i],&ycen[i])!=5)
+        psfarray = AtmosphericTurbulence_prefetch_take(pf, i);
+        if(psfarray==NULL)
         {
-            printf("ERROR: fscanf, %s line %d\n",__FILE__,__LINE__);
+            printf("ERROR: cannot read file \"%s\"\n", fname[i]);
             exit(0);
         }
+        memcpy(data.image[IDtmp].array.F, psfarray, sizeof(float)*nelement);
+        AtmosphericTurbulence_prefetch_release(pf, i);
 
+        /* PSFc */
         if(i==0)
-        {
-            load_fits(fname, "PSFcc", 1);
-            Xcenter = xcen[0];
-            Ycenter = ycen[0];
-        }
+            copy_image_ID("tmppsf", "PSFc", 0);
         else
         {
-            load_fits(fname, "tmppsf" , 1);
-            basic_add("PSFcc","tmppsf","nPSFcc",Xcenter-xcen[i],Ycenter-ycen[i]);
-            if(Xcenter<xcen[i])
-                Xcenter = xcen[i];
-            if(Ycenter<ycen[i])
-                Ycenter = ycen[i];
-            delete_image_ID("PSFcc");
-            delete_image_ID("tmppsf");
-            chname_image_ID("nPSFcc","PSFcc");
-        }
-    }
-    fclose(fp);
-    Xcenter_cc = Xcenter;
-    Ycenter_cc = Ycenter;
-
-    /* make PSFccsf */
-    quick_sort_float(FWHM, NBfiles);
-    limit = FWHM[(long) (frac*NBfiles)];
-    Xcenter = 0.0;
-    Ycenter = 0.0;
-    if((fp=fopen(logfile,"r"))==NULL)
-    {
-        printf("ERROR: cannot open file \"%s\"\n",logfile);
-        exit(0);
-    }
-    OK = 0;
-    cnt = 0;
-    for(i=0; i<NBfiles; i++)
-    {
-        if(fscanf(fp,"%s %f %f %f %f\n",fname,&FWHM[i],&ENCE[i],&xcen[i],&ycen[i])!=5)
-        {
-            printf("ERROR: fscanf, %s line %d\n",__FILE__,__LINE__);
-            exit(0);
+            IDc = image_ID("PSFc");
+            for(ii=0; ii<nelement; ii++)
+                data.image[IDc].array.F[ii] += data.image[IDtmp].array.F[ii];
         }
 
-        if(FWHM[i]<limit)
-        {
-            cnt++;
-            if(OK==0)
-            {
-                load_fits(fname, "PSFccsf", 1);
-                Xcenter = xcen[i];
-                Ycenter = ycen[i];
-                OK=1;
-            }
-            else
-            {
-                load_fits(fname, "tmppsf", 1);
-                basic_add("PSFccsf","tmppsf","nPSFccsf",Xcenter-xcen[i],Ycenter-ycen[i]);
-                if(Xcenter<xcen[i])
-                    Xcenter = xcen[i];
-                if(Ycenter<ycen[i])
-                    Ycenter = ycen[i];
-                delete_image_ID("PSFccsf");
-                delete_image_ID("tmppsf");
-                chname_image_ID("nPSFccsf","PSFccsf");
-            }
-        }
-    }
-    fclose(fp);
-    printf("PSFccsf: %ld frames kept\n",cnt);
-    Xcenter_ccsf = Xcenter;
-    Ycenter_ccsf = Ycenter;
-
-    /* make PSFccse */
-    quick_sort_float(ENCE, NBfiles);
-    limit = ENCE[(long) (frac*NBfiles)];
-    Xcenter = 0.0;
-    Ycenter = 0.0;
-    if((fp=fopen(logfile,"r"))==NULL)
-    {
-        printf("ERROR: cannot open file \"%s\"\n",logfile);
-        exit(0);
-    }
-    OK = 0;
-    cnt = 0;
-    for(i=0; i<NBfiles; i++)
-    {
-        if(fscanf(fp,"%s %f %f %f %f\n",fname,&FWHM[i],&ENCE[i],&xcen[i],&ycen[i])!=5)
+        /* PSFcc */
+        AtmosphericTurbulence_frame_select_coadd("PSFcc", i==0, xcen[i], ycen[i], &Xcenter_cc, &Ycenter_cc);
+
+        /* PSFccsf */
+        if(FWHM[i]<limitf)
         {
-            printf("ERROR: fscanf, %s line %d\n",__FILE__,__LINE__);
-            exit(0);
+            AtmosphericTurbulence_frame_select_coadd("PSFccsf", cntf==0, xcen[i], ycen[i], &Xcenter_ccsf, &Ycenter_ccsf);
+            cntf++;
         }
-        if(ENCE[i]<limit)
+
+        /* PSFccse */
+        if(ENCE[i]<limite)
         {
-            cnt++;
-            if(OK==0)
-            {
-                load_fits(fname, "PSFccse", 1);
-                Xcenter = xcen[i];
-                Ycenter = ycen[i];
-                OK=1;
-            }
-            else
-            {
-                load_fits(fname, "tmppsf", 1);
-                basic_add("PSFccse","tmppsf","nPSFccse",Xcenter-xcen[i],Ycenter-ycen[i]);
-                if(Xcenter<xcen[i])
-                    Xcenter = xcen[i];
-                if(Ycenter<ycen[i])
-                    Ycenter = ycen[i];
-                delete_image_ID("PSFccse");
-                delete_image_ID("tmppsf");
-                chname_image_ID("nPSFccse","PSFccse");
-            }
+            AtmosphericTurbulence_frame_select_coadd("PSFccse", cnte==0, xcen[i], ycen[i], &Xcenter_ccse, &Ycenter_ccse);
+            cnte++;
         }
     }
-    fclose(fp);
-    printf("PSFccse : %ld frames kept\n",cnt);
-    Xcenter_ccse = Xcenter;
-    Ycenter_ccse = Ycenter;
+    AtmosphericTurbulence_prefetch_stop(pf);
+    delete_image_ID("tmppsf");
+    printf("PSFccsf: %ld frames kept\n",cntf);
+    printf("PSFccse : %ld frames kept\n",cnte);
 
 
     /* quality evaluation */
@@ -7016,6 +7174,9 @@ int frame_select_PSF(const char *logfile, long NBfiles, float frac)
     printf("PSFccsf:  %f %f\n",fwhm3*fs,2.0*ence3*fs);
     printf("PSFccse:  %f %f\n",fwhm4*fs,2.0*ence4*fs);
 
+    for(i=0; i<NBfiles; i++)
+        free(fname[i]);
+    free(fname);
     free(FWHM);
     free(ENCE);
     free(xcen);
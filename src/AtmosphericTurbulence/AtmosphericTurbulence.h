@@ -27,6 +27,7 @@ int measure_wavefront_series(float factor);
 int AtmosphericTurbulence_mkTestTTseq(double dt, long NBpts, long NBblocks, double measnoise, int ACCnmode, double ACCnoise, int MODE);
 
 int AtmosphericTurbulence_Build_LinPredictor_Full(const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, double SVDeps, double RegLambda);
+long AtmosphericTurbulence_Build_LinPredictor_Kernel(const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, long krad, double SVDeps, double RegLambda, const char *IDkern_name);
 int AtmosphericTurbulence_Apply_LinPredictor_Full(int MODE, const char *WFin_name, const char *WFmask_name, int PForder, float PFlag, const char *WFoutp_name, const char *WFoutf_name);
 long AtmosphericTurbulence_LinPredictor_filt_2DKernelExtract(const char *IDfilt_name, const char *IDmask_name, long krad, const char *IDkern_name);
 long AtmosphericTurbulence_LinPredictor_filt_Expand(const char *IDfilt_name, const char *IDmask_name);
@@ -164,6 +164,47 @@ int CLIexecuteCMDready = 0;
 char calctmpimname[200];
 char CLIstartupfilename[200] = "CLIstartup.txt";
 
+// command key hash index (open addressing), rebuilt when data.NBcmd changes
+static long *CLIcmdhash = NULL;
+static long CLIcmdhash_size = 0;
+static long CLIcmdhash_NBcmd = -1;
+
+// batch execution: no readline history, nesting depth of active scripts
+#define CLI_BATCH_MAXDEPTH 8
+static int CLIbatchdepth = 0;
+
+// job server: lines prefixed with '&' are queued and run by a background executor
+#define CLI_JOB_MAX 1024
+#define CLI_JOB_LINEMAX 1024
+#define CLI_JOB_QUEUED 0
+#define CLI_JOB_RUNNING 1
+#define CLI_JOB_DONE 2
+#define CLI_JOB_FAILED 3
+
+typedef struct
+{
+    long ID;          // -1 if slot is free
+    int status;
+    char line[CLI_JOB_LINEMAX];
+    struct timespec tsubmit;
+    struct timespec tstart;
+    struct timespec tend;
+} CLIJOB;
+
+static CLIJOB CLIjob[CLI_JOB_MAX];
+static long CLIjob_next = 0;      // slot receiving next submission
+static long CLIjob_run = 0;       // slot of next job to execute
+static long CLIjob_NBpending = 0; // queued + running
+static long CLIjob_IDnext = 1;
+static int CLIjob_threadON = 0;
+static pthread_t CLIjob_thread;
+static pthread_mutex_t CLIjob_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t CLIjob_cond = PTHREAD_COND_INITIALIZER;
+
+// serializes command execution between readline/fifo input and the job executor
+static pthread_mutex_t CLIexec_mutex;
+static __thread int CLIexec_held = 0; // exec lock depth held by calling thread
+
 
 
 
@@ -198,6 +239,8 @@ int command_line( int argc, char **argv);
 
 /// CLI commands
 static int_fast8_t exitCLI();
+static int_fast8_t CLI_execute_line();
+static int_fast8_t CLI_execute_cmdline(char *cmdline, int addhist);
 static int_fast8_t help();
 
 static int_fast8_t list_commands();
@@ -301,6 +344,30 @@ int_fast8_t exitCLI()
 
 
 
+// kernel variant selected by HOTKERNEL runtime dispatch on this host
+static const char *CLI_cpudispatch_variant()
+{
+#if defined(HOTKERNEL_DISPATCH)
+    __builtin_cpu_init();
+# if HOTKERNEL_DISPATCH == 2
+    if(__builtin_cpu_supports("x86-64-v4"))
+        return("x86-64-v4 (AVX-512)");
+    if(__builtin_cpu_supports("x86-64-v3"))
+        return("x86-64-v3 (AVX2, FMA)");
+# else
+    if(__builtin_cpu_supports("avx512f"))
+        return("avx512f");
+    if(__builtin_cpu_supports("avx2"))
+        return("avx2");
+# endif
+    return("default");
+#else
+    return("compile-time target (no runtime dispatch)");
+#endif
+}
+
+
+
 static int_fast8_t printInfo()
 {
     float f1;
@@ -340,6 +407,7 @@ static int_fast8_t printInfo()
 # ifdef _OPENMP
     printf("OPENMP   : Compiled by an OpenMP-compliant implementation.\n");
 # endif
+    printf("KERNELS  : %s\n", CLI_cpudispatch_variant());
     printf("CFITSIO  : version %f\n", fits_get_version(&f1));
     printf("\n");
     
@@ -451,10 +519,249 @@ int_fast8_t cfits_usleep_cli()
 }
 
 
+int_fast8_t CLI_execute_script_cli()
+{
+  if(CLI_checkarg(1,3)==0)
+    {
+      CLI_execute_script(data.cmdargtoken[1].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
 
 
 
-static int_fast8_t CLI_execute_line()
+static uint64_t CLI_cmdkey_hash(const char *key)
+{
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+
+    while(*key)
+    {
+        h ^= (unsigned char) *key++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+static int CLI_cmdhash_rebuild()
+{
+    long size = 64;
+    long i, k;
+
+    while(size < 2*(long) data.NBcmd)
+        size *= 2;
+
+    if(size != CLIcmdhash_size)
+    {
+        free(CLIcmdhash);
+        CLIcmdhash = (long*) malloc(sizeof(long)*size);
+        if(CLIcmdhash == NULL)
+        {
+            CLIcmdhash_size = 0;
+            CLIcmdhash_NBcmd = -1;
+            printERROR(__FILE__,__func__,__LINE__,"malloc error");
+            return -1;
+        }
+        CLIcmdhash_size = size;
+    }
+    for(k=0; k<size; k++)
+        CLIcmdhash[k] = -1;
+
+    // insert in registration order; first registration of a key wins
+    for(i=0; i<(long) data.NBcmd; i++)
+    {
+        k = (long) (CLI_cmdkey_hash(data.cmd[i].key) & (uint64_t) (size-1));
+        while(CLIcmdhash[k] != -1)
+        {
+            if(strcmp(data.cmd[CLIcmdhash[k]].key, data.cmd[i].key) == 0)
+                break;
+            k = (k+1) & (size-1);
+        }
+        if(CLIcmdhash[k] == -1)
+            CLIcmdhash[k] = i;
+    }
+    CLIcmdhash_NBcmd = (long) data.NBcmd;
+
+    return 0;
+}
+
+
+/**
+ * @brief Index of command key in data.cmd, -1 if not found
+ *
+ * Modules may append to data.cmd directly, so the index is rebuilt whenever data.NBcmd changes.
+ */
+long CLI_cmd_index(const char *key)
+{
+    long k;
+
+    if(CLIcmdhash_NBcmd != (long) data.NBcmd)
+        if(CLI_cmdhash_rebuild() != 0)
+        {
+            for(k=0; k<(long) data.NBcmd; k++)
+                if(strcmp(key, data.cmd[k].key) == 0)
+                    return k;
+            return -1;
+        }
+
+    k = (long) (CLI_cmdkey_hash(key) & (uint64_t) (CLIcmdhash_size-1));
+    while(CLIcmdhash[k] != -1)
+    {
+        if(strcmp(key, data.cmd[CLIcmdhash[k]].key) == 0)
+            return CLIcmdhash[k];
+        k = (k+1) & (CLIcmdhash_size-1);
+    }
+
+    return -1;
+}
+
+
+
+
+/**
+ * @brief Execute a command script in batch mode
+ *
+ * The whole file is read and split into lines up front. Command keys are resolved before
+ * execution so that a misspelled command aborts the script before anything runs.
+ * Lines are then executed in order without readline history; execution stops at the first
+ * line that fails to parse or has no effect.
+ * Image names cannot be resolved ahead of time as earlier lines may create them.
+ *
+ * @return number of lines executed, -1 on error
+ */
+long CLI_execute_script(const char *fname)
+{
+    FILE *fp;
+    char *buffer;
+    char **cmdline;
+    long *cmdlineno;
+    long fsize;
+    long NBline = 0;
+    long NBexec = 0;
+    long lineno = 0;
+    long i;
+    char *ptr;
+    char *scratch;
+    char cmdkey[200];
+    int err = 0;
+
+
+    if(CLIbatchdepth >= CLI_BATCH_MAXDEPTH)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"script nesting too deep");
+        return -1;
+    }
+
+    if((fp = fopen(fname, "r")) == NULL)
+    {
+        sprintf(cmdkey, "cannot open file \"%.150s\"", fname);
+        printERROR(__FILE__,__func__,__LINE__,cmdkey);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    buffer = (char*) malloc(fsize+1);
+    scratch = (char*) malloc(fsize+2);
+    cmdline = (char**) malloc(sizeof(char*)*(fsize/2+2));
+    cmdlineno = (long*) malloc(sizeof(long)*(fsize/2+2));
+    if((buffer==NULL)||(scratch==NULL)||(cmdline==NULL)||(cmdlineno==NULL))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc error");
+        exit(0);
+    }
+    if(fread(buffer, 1, fsize, fp) != (size_t) fsize)
+        printERROR(__FILE__,__func__,__LINE__,"fread() returns short count");
+    buffer[fsize] = '\0';
+    fclose(fp);
+
+
+    // pre-parse: split lines, skip blank lines and comments, resolve command keys
+    ptr = buffer;
+    while(*ptr != '\0')
+    {
+        char *eol = strchr(ptr, '\n');
+        char *end;
+
+        lineno++;
+        if(eol != NULL)
+            *eol = '\0';
+        end = ptr + strlen(ptr);
+        while((end > ptr) && ((end[-1]=='\r')||(end[-1]==' ')||(end[-1]=='\t')))
+            *(--end) = '\0';
+        while((*ptr==' ')||(*ptr=='\t'))
+            ptr++;
+
+        if((*ptr != '\0')&&(*ptr != '#'))
+        {
+            if(*ptr != '!')
+            {
+                size_t len = strcspn(ptr, " ");
+                char *eq = strchr(ptr, '=');
+
+                if(len > sizeof(cmdkey)-1)
+                    len = sizeof(cmdkey)-1;
+                strncpy(cmdkey, ptr, len);
+                cmdkey[len] = '\0';
+                // single-token lines may be expressions or assignments
+                if((CLI_cmd_index(cmdkey) == -1) && (eq == NULL) && (ptr[len] != '\0'))
+                {
+                    printf("%s:%ld: unknown command \"%s\"\n", fname, lineno, cmdkey);
+                    err = 1;
+                }
+            }
+            cmdline[NBline] = ptr;
+            cmdlineno[NBline] = lineno;
+            NBline++;
+        }
+
+        if(eol == NULL)
+            break;
+        ptr = eol+1;
+    }
+
+
+    if(err == 0)
+    {
+        CLIbatchdepth++;
+        for(i=0; i<NBline; i++)
+        {
+            // command lines are tokenized in place
+            strcpy(scratch, cmdline[i]);
+            data.CMDexecuted = 0;
+            CLI_execute_cmdline(scratch, 0);
+            if((data.parseerror != 0)||(data.CMDexecuted == 0))
+            {
+                printf("%s:%ld: execution stopped at \"%s\"\n", fname, cmdlineno[i], cmdline[i]);
+                break;
+            }
+            NBexec++;
+        }
+        CLIbatchdepth--;
+        data.CMDexecuted = 1;
+    }
+
+    free(cmdlineno);
+    free(cmdline);
+    free(scratch);
+    free(buffer);
+
+    if(err != 0)
+        return -1;
+
+    return NBexec;
+}
+
+
+
+
+
+static int_fast8_t CLI_execute_line_core(char *line, int addhist)
 {
     long i, j;
     char *cmdargstring;
@@ -462,7 +769,7 @@ static int_fast8_t CLI_execute_line()
     FILE *fp;
     time_t t;
     struct tm *uttime;
-    struct timespec *thetime = (struct timespec *)malloc(sizeof(struct timespec));
+    struct timespec thetime;
     char command[200];
     
 
@@ -493,7 +800,7 @@ static int_fast8_t CLI_execute_line()
         {
             t = time(NULL);
             uttime = gmtime(&t);
-            clock_gettime(CLOCK_REALTIME, thetime);
+            clock_gettime(CLOCK_REALTIME, &thetime);
 
             sprintf(data.CLIlogname, "%s/logdir/%04d%02d%02d/%04d%02d%02d_CLI-%s.log", getenv("HOME"), 1900+uttime->tm_year, 1+uttime->tm_mon, uttime->tm_mday, 1900+uttime->tm_year, 1+uttime->tm_mon, uttime->tm_mday, data.processname);
 
@@ -508,7 +815,7 @@ static int_fast8_t CLI_execute_line()
             }
             else
             {
-                fprintf(fp, "%04d/%02d/%02d %02d:%02d:%02d.%09ld %10s %6ld %s\n", 1900+uttime->tm_year, 1+uttime->tm_mon, uttime->tm_mday, uttime->tm_hour, uttime->tm_min, uttime->tm_sec, thetime->tv_nsec, data.processname, (long) getpid(), line);
+                fprintf(fp, "%04d/%02d/%02d %02d:%02d:%02d.%09ld %10s %6ld %s\n", 1900+uttime->tm_year, 1+uttime->tm_mon, uttime->tm_mday, uttime->tm_hour, uttime->tm_min, uttime->tm_sec, thetime.tv_nsec, data.processname, (long) getpid(), line);
                 fclose(fp);
             }
         }
@@ -531,7 +838,6 @@ static int_fast8_t CLI_execute_line()
             {
                 sprintf(str,"%s\n", cmdargstring);
                 yy_scan_string(str);
-                data.calctmp_imindex = 0;
                 yyparse ();
             }
             cmdargstring = strtok (NULL, " ");
@@ -585,18 +891,340 @@ static int_fast8_t CLI_execute_line()
             data.CMDexecuted = 1;
 
 
-        add_history(line);
+        if(addhist == 1)
+            add_history(line);
 
     }
 
-	free(thetime);
-	
     return(0);
 }
 
 
 
 
+static double CLI_job_dt(struct timespec *t0, struct timespec *t1)
+{
+    return 1.0*(t1->tv_sec - t0->tv_sec) + 1.0e-9*(t1->tv_nsec - t0->tv_nsec);
+}
+
+
+static void *CLI_job_executor(void *arg)
+{
+    char cmdline[CLI_JOB_LINEMAX];
+    long slot;
+    int CMDexecuted_save, parseerror_save;
+    int status;
+
+    (void) arg;
+    for(;;)
+    {
+        pthread_mutex_lock(&CLIjob_mutex);
+        while(CLIjob[CLIjob_run].ID == -1 || CLIjob[CLIjob_run].status != CLI_JOB_QUEUED)
+            pthread_cond_wait(&CLIjob_cond, &CLIjob_mutex);
+        slot = CLIjob_run;
+        CLIjob[slot].status = CLI_JOB_RUNNING;
+        clock_gettime(CLOCK_REALTIME, &CLIjob[slot].tstart);
+        strcpy(cmdline, CLIjob[slot].line);
+        pthread_mutex_unlock(&CLIjob_mutex);
+
+        pthread_mutex_lock(&CLIexec_mutex);
+        CMDexecuted_save = data.CMDexecuted;
+        parseerror_save = data.parseerror;
+        data.CMDexecuted = 0;
+        CLIexec_held++;
+        CLI_execute_line_core(cmdline, 0);
+        CLIexec_held--;
+        if((data.parseerror != 0)||(data.CMDexecuted == 0))
+            status = CLI_JOB_FAILED;
+        else
+            status = CLI_JOB_DONE;
+        data.CMDexecuted = CMDexecuted_save;
+        data.parseerror = parseerror_save;
+        pthread_mutex_unlock(&CLIexec_mutex);
+
+        pthread_mutex_lock(&CLIjob_mutex);
+        CLIjob[slot].status = status;
+        clock_gettime(CLOCK_REALTIME, &CLIjob[slot].tend);
+        CLIjob_run = (CLIjob_run+1) % CLI_JOB_MAX;
+        CLIjob_NBpending--;
+        pthread_cond_broadcast(&CLIjob_cond);
+        pthread_mutex_unlock(&CLIjob_mutex);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Queue command line for background execution
+ *
+ * Syntax: [ID] <command line>. Without ID, the next free ID is assigned.
+ * Jobs run in submission order on a single executor thread; command
+ * functions and the image table are not reentrant, so concurrency comes from the
+ * OpenMP-parallel functions themselves while the CLI remains free to accept
+ * input and answer status queries.
+ *
+ * @return job ID, -1 on error
+ */
+static long CLI_job_submit(const char *cmdline)
+{
+    long ID = -1;
+    long k;
+    char *endptr;
+
+    while(*cmdline==' ')
+        cmdline++;
+    if((*cmdline >= '0')&&(*cmdline <= '9'))
+    {
+        ID = strtol(cmdline, &endptr, 10);
+        cmdline = endptr;
+        while(*cmdline==' ')
+            cmdline++;
+    }
+    if(*cmdline == '\0')
+    {
+        printERROR(__FILE__,__func__,__LINE__,"empty job command line");
+        return -1;
+    }
+    if(strlen(cmdline) > CLI_JOB_LINEMAX-1)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"job command line too long");
+        return -1;
+    }
+
+    pthread_mutex_lock(&CLIjob_mutex);
+    if(CLIjob_threadON == 0)
+    {
+        // first submission: clear job table and start executor
+        for(k=0; k<CLI_JOB_MAX; k++)
+            CLIjob[k].ID = -1;
+        if(pthread_create(&CLIjob_thread, NULL, CLI_job_executor, NULL) != 0)
+        {
+            pthread_mutex_unlock(&CLIjob_mutex);
+            printERROR(__FILE__,__func__,__LINE__,"cannot create job executor thread");
+            return -1;
+        }
+        pthread_detach(CLIjob_thread);
+        CLIjob_threadON = 1;
+    }
+    if(CLIjob_NBpending == CLI_JOB_MAX)
+    {
+        pthread_mutex_unlock(&CLIjob_mutex);
+        printERROR(__FILE__,__func__,__LINE__,"job queue full");
+        return -1;
+    }
+    if(ID == -1)
+        ID = CLIjob_IDnext;
+    for(k=0; k<CLI_JOB_MAX; k++)
+        if((CLIjob[k].ID == ID)&&(CLIjob[k].status <= CLI_JOB_RUNNING))
+        {
+            pthread_mutex_unlock(&CLIjob_mutex);
+            printERROR(__FILE__,__func__,__LINE__,"job ID already pending");
+            return -1;
+        }
+    if(ID >= CLIjob_IDnext)
+        CLIjob_IDnext = ID+1;
+
+    CLIjob[CLIjob_next].ID = ID;
+    CLIjob[CLIjob_next].status = CLI_JOB_QUEUED;
+    strcpy(CLIjob[CLIjob_next].line, cmdline);
+    clock_gettime(CLOCK_REALTIME, &CLIjob[CLIjob_next].tsubmit);
+    CLIjob_next = (CLIjob_next+1) % CLI_JOB_MAX;
+    CLIjob_NBpending++;
+    pthread_cond_broadcast(&CLIjob_cond);
+    pthread_mutex_unlock(&CLIjob_mutex);
+
+    printf("JOB %ld QUEUED\n", ID);
+    fflush(stdout);
+
+    return ID;
+}
+
+
+/**
+ * @brief Report or wait for jobs
+ *
+ * Syntax: (empty) lists all jobs, <ID> reports one job, "wait [ID]" blocks until
+ * job ID (or all pending jobs) has completed.
+ */
+static int CLI_job_query(const char *arg)
+{
+    const char *statusstr[] = {"QUEUED", "RUNNING", "DONE", "FAILED"};
+    struct timespec tnow;
+    long ID = -1;
+    long k;
+    int waitmode = 0;
+    int pending;
+
+    while(*arg==' ')
+        arg++;
+    if(strncmp(arg, "wait", 4) == 0)
+    {
+        waitmode = 1;
+        arg += 4;
+        while(*arg==' ')
+            arg++;
+    }
+    if((*arg >= '0')&&(*arg <= '9'))
+        ID = atol(arg);
+
+    pthread_mutex_lock(&CLIjob_mutex);
+    if((waitmode == 1)&&(CLIexec_held > 0))
+    {
+        pthread_mutex_unlock(&CLIjob_mutex);
+        printERROR(__FILE__,__func__,__LINE__,"cannot wait for jobs from a script or job");
+        return -1;
+    }
+    if(waitmode == 1)
+    {
+        do
+        {
+            pending = 0;
+            if(CLIjob_threadON == 1)
+                for(k=0; k<CLI_JOB_MAX; k++)
+                    if((CLIjob[k].ID != -1)&&((ID == -1)||(CLIjob[k].ID == ID))&&(CLIjob[k].status <= CLI_JOB_RUNNING))
+                        pending = 1;
+            if(pending == 1)
+                pthread_cond_wait(&CLIjob_cond, &CLIjob_mutex);
+        } while(pending == 1);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    if(CLIjob_threadON == 1)
+        for(k=0; k<CLI_JOB_MAX; k++)
+        {
+            CLIJOB *job = &CLIjob[(CLIjob_next+k) % CLI_JOB_MAX]; // oldest first
+            double twait, trun;
+
+            if((job->ID == -1)||((ID != -1)&&(job->ID != ID)))
+                continue;
+            switch(job->status) {
+            case CLI_JOB_QUEUED:
+                twait = CLI_job_dt(&job->tsubmit, &tnow);
+                trun = 0.0;
+                break;
+            case CLI_JOB_RUNNING:
+                twait = CLI_job_dt(&job->tsubmit, &job->tstart);
+                trun = CLI_job_dt(&job->tstart, &tnow);
+                break;
+            default:
+                twait = CLI_job_dt(&job->tsubmit, &job->tstart);
+                trun = CLI_job_dt(&job->tstart, &job->tend);
+                break;
+            }
+            printf("JOB %6ld  %-8s  wait %10.3f s  run %10.3f s  %s\n", job->ID, statusstr[job->status], twait, trun, job->line);
+        }
+    pthread_mutex_unlock(&CLIjob_mutex);
+    fflush(stdout);
+
+    return 0;
+}
+
+
+// 1 if token (not a number) appears in line after the command key
+static int CLI_job_lineuses(const char *jobline, const char *token)
+{
+    const char *ptr = jobline;
+    size_t len = strlen(token);
+    int first = 1;
+
+    while(*ptr != '\0')
+    {
+        size_t tlen;
+
+        while(*ptr == ' ')
+            ptr++;
+        tlen = strcspn(ptr, " ");
+        if((first == 0)&&(tlen == len)&&(strncmp(ptr, token, len) == 0))
+            return 1;
+        first = 0;
+        ptr += tlen;
+    }
+    return 0;
+}
+
+
+// block until no queued or running job refers to an argument of cmdline
+static void CLI_job_waitdeps(const char *cmdline)
+{
+    char tokens[CLI_JOB_LINEMAX];
+    char *tok, *saveptr;
+    long k;
+    int pending;
+
+    if(strlen(cmdline) > CLI_JOB_LINEMAX-1)
+        return;
+
+    pthread_mutex_lock(&CLIjob_mutex);
+    // a thread holding the exec lock (scripts, jobs) must not wait on the executor
+    if((CLIjob_threadON == 0)||(CLIexec_held > 0))
+    {
+        pthread_mutex_unlock(&CLIjob_mutex);
+        return;
+    }
+    do
+    {
+        pending = 0;
+        strcpy(tokens, cmdline);
+        tok = strtok_r(tokens, " ", &saveptr);
+        if(tok != NULL)
+            tok = strtok_r(NULL, " ", &saveptr); // skip command key
+        for(; (tok != NULL)&&(pending == 0); tok = strtok_r(NULL, " ", &saveptr))
+        {
+            if(((tok[0]>='0')&&(tok[0]<='9'))||(tok[0]=='-')||(tok[0]=='.'))
+                continue;
+            for(k=0; k<CLI_JOB_MAX; k++)
+                if((CLIjob[k].ID != -1)&&(CLIjob[k].status <= CLI_JOB_RUNNING)&&(CLI_job_lineuses(CLIjob[k].line, tok) == 1))
+                {
+                    pending = 1;
+                    break;
+                }
+        }
+        if(pending == 1)
+            pthread_cond_wait(&CLIjob_cond, &CLIjob_mutex);
+    } while(pending == 1);
+    pthread_mutex_unlock(&CLIjob_mutex);
+}
+
+
+static int_fast8_t CLI_execute_cmdline(char *cmdline, int addhist)
+{
+    int_fast8_t ret;
+
+    if(cmdline[0]=='&')
+    {
+        CLI_job_submit(cmdline+1);
+        if(addhist == 1)
+            add_history(cmdline);
+        data.CMDexecuted = 1;
+        return 0;
+    }
+    if(cmdline[0]=='%')
+    {
+        CLI_job_query(cmdline+1);
+        data.CMDexecuted = 1;
+        return 0;
+    }
+
+    CLI_job_waitdeps(cmdline);
+    pthread_mutex_lock(&CLIexec_mutex);
+    CLIexec_held++;
+    ret = CLI_execute_line_core(cmdline, addhist);
+    CLIexec_held--;
+    pthread_mutex_unlock(&CLIexec_mutex);
+
+    return ret;
+}
+
+
+static int_fast8_t CLI_execute_line()
+{
+    return CLI_execute_cmdline(line, 1);
+}
+
+
+
+
 
 
 
@@ -807,6 +1435,7 @@ int_fast8_t main(int argc, char *argv[])
 # ifdef _OPENMP
     printf("Running with openMP, max threads = %d  (defined by environment variable OMP_NUM_THREADS)\n", omp_get_max_threads());
 # endif
+    printf("Hot kernels : %s\n", CLI_cpudispatch_variant());
 
 
 
@@ -1131,11 +1760,17 @@ void * xmalloc (int size)
 +-----------------------------------------------------------------------------*/
 void main_init()
 {
-
   long tmplong;
   int i;
   struct timeval t1;
+  pthread_mutexattr_t execmutexattr;
+
 
+  // recursive: scripts execute command lines from within a command
+  pthread_mutexattr_init(&execmutexattr);
+  pthread_mutexattr_settype(&execmutexattr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&CLIexec_mutex, &execmutexattr);
+  pthread_mutexattr_destroy(&execmutexattr);
    
   /* initialization of the data structure 
    */
@@ -1344,6 +1979,15 @@ void main_init()
   strcpy(data.cmd[data.NBcmd].Ccall,"usleep(long tus)");
   data.NBcmd++;
 
+  strcpy(data.cmd[data.NBcmd].key,"exec");
+  strcpy(data.cmd[data.NBcmd].module,__FILE__);
+  data.cmd[data.NBcmd].fp = CLI_execute_script_cli;
+  strcpy(data.cmd[data.NBcmd].info,"execute command script in batch mode");
+  strcpy(data.cmd[data.NBcmd].syntax,"<script file>");
+  strcpy(data.cmd[data.NBcmd].example,"exec run.txt");
+  strcpy(data.cmd[data.NBcmd].Ccall,"long CLI_execute_script(const char *fname)");
+  data.NBcmd++;
+
   
 
   init_modules();
@@ -1457,6 +2101,9 @@ int re_alloc()
             data.image[i].memsize = 0;
             data.image[i].semptr = NULL;
             data.image[i].semlog = NULL;
+            data.image[i].ring = NULL;
+            data.image[i].mdlegacy = NULL;
+            data.image[i].latency = NULL;
         }
     }
 
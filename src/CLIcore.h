@@ -34,6 +34,18 @@
 
 #define PI 3.14159265358979323846264338328
 
+// runtime ISA dispatch for hot kernels : compile with -DCPUDISPATCH (see configure_highperf)
+// kernels tagged HOTKERNEL are built for several targets, variant selected at load time (ifunc), reported at startup
+#if defined(CPUDISPATCH) && defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+#define HOTKERNEL_DISPATCH 2
+#define HOTKERNEL __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#elif defined(CPUDISPATCH) && defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 6)
+#define HOTKERNEL_DISPATCH 1
+#define HOTKERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define HOTKERNEL
+#endif
+
 /// Size of array CLICOREVARRAY
 #define SZ_CLICOREVARRAY 1000
 
@@ -148,6 +160,9 @@ typedef struct
 int CLI_checkarg(int argnum, int argtype);
 int CLI_checkarg_noerrmsg(int argnum, int argtype);
 
+long CLI_cmd_index(const char *key);
+long CLI_execute_script(const char *fname);
+
 
 
 
@@ -1061,111 +1061,406 @@ double arith_image_max(const char *ID_name)
 
 
 
-double arith_image_percentile(const char *ID_name, double fraction)
+/* ------------------------------------------------------------------------- */
+/* percentiles                                                               */
+/* ------------------------------------------------------------------------- */
+
+//
+// Percentiles are obtained by selection instead of sorting : introselect (quickselect with median of 3
+// pivot, falling back to sort if partitioning degenerates). Several percentiles are selected
+// recursively, each selection splitting the array for the next ones.
+// Large arrays use a parallel histogram to locate the bins holding the requested ranks, and only
+// the few elements in these bins are then selected.
+//
+// Percentile value for fraction f in an array of n elements is the element of rank (long) (f*n),
+// clamped to [0, n-1].
+//
+
+#define ARITH_PERCENTILE_NBBIN 65536
+#define ARITH_PERCENTILE_HISTO_LIMIT 4000000
+#define ARITH_PERCENTILE_TASK_LIMIT 100000
+
+
+
+// places element of rank k (within lo..hi inclusive) at a[k], smaller before, larger after
+HOTKERNEL static void arith_select_double(double *a, long lo, long hi, long k)
 {
-  long ID;
-  long ii;
-  double value = 0;
-  long *arrayL = NULL;
-  float *arrayF = NULL;
-  double *array_D = NULL;
-  unsigned short *array_U = NULL;
-  long nelement;
-  int atype;
-  int atypeOK = 1; 
-  
-  ID = image_ID(ID_name);
-  atype = data.image[ID].md[0].atype;
+    long i, j, mid;
+    double pivot, tmp;
+    int depth = 0;
+    long n;
 
-  nelement = data.image[ID].md[0].nelement;
-  
+    for(n = hi-lo+1; n > 1; n /= 2)
+        depth += 2;
 
-  switch (atype) {
+    while(hi > lo)
+    {
+        if(hi-lo < 16)
+        {
+            for(i=lo+1; i<=hi; i++)
+            {
+                tmp = a[i];
+                for(j=i; (j>lo)&&(a[j-1]>tmp); j--)
+                    a[j] = a[j-1];
+                a[j] = tmp;
+            }
+            return;
+        }
 
-  case _DATATYPE_UINT8 :
-    arrayL = (long*) malloc(sizeof(long)*nelement);
-    if(arrayL==NULL)
-      {
-		printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-       exit(0);
-      }
-    arrayL[0] = 0;
-    for (ii = 0; ii < nelement; ii++) 
-      arrayL[ii] = (long) data.image[ID].array.UI8[ii];
-    quick_sort_long(arrayL, nelement);
-    value = (double) arrayL[(long) (fraction*nelement)];
-    free(arrayL);
-    break;
+        if(depth-- == 0)
+        {
+            quick_sort_double(a+lo, hi-lo+1);
+            return;
+        }
 
-  case _DATATYPE_INT32 :
-    arrayL = (long*) malloc(sizeof(long)*nelement);
-    if(arrayL==NULL)
-      {
-	printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-	exit(0);
-      }
-    arrayL[0] = 0;   
-    for (ii = 0; ii < nelement; ii++) 
-      arrayL[ii] = (long) data.image[ID].array.SI32[ii];
-    quick_sort_long(arrayL, nelement);
-    value = (double) arrayL[(long) (fraction*nelement)];
-    free(arrayL);    
-    break;
+        mid = lo + (hi-lo)/2;
+        if(a[mid] < a[lo]) { tmp = a[mid]; a[mid] = a[lo]; a[lo] = tmp; }
+        if(a[hi] < a[lo])  { tmp = a[hi];  a[hi] = a[lo];  a[lo] = tmp; }
+        if(a[hi] < a[mid]) { tmp = a[hi];  a[hi] = a[mid]; a[mid] = tmp; }
+        pivot = a[mid];
 
-  case _DATATYPE_FLOAT :
-    arrayF = (float*) malloc(sizeof(float)*nelement);
-    if(arrayF==NULL)
-      {
-	printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-       exit(0);
-      }
-    arrayF[0] = 0.0;
-    for (ii = 0; ii < nelement; ii++) 
-      arrayF[ii] = data.image[ID].array.F[ii];
-    value = (double) arrayF[(long) (fraction*nelement)];
-    free(arrayF);   
-    break;
+        i = lo;
+        j = hi;
+        while(i <= j)
+        {
+            while(a[i] < pivot)
+                i++;
+            while(a[j] > pivot)
+                j--;
+            if(i <= j)
+            {
+                tmp = a[i];
+                a[i] = a[j];
+                a[j] = tmp;
+                i++;
+                j--;
+            }
+        }
 
-  case _DATATYPE_DOUBLE :
-    array_D = (double*) malloc(sizeof(double)*nelement);
-    if(array_D==NULL)
-      {
-	printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-	exit(0);
-      }
-    array_D[0] = 0.0;
-    for (ii = 0; ii < nelement; ii++) 
-      array_D[ii] = data.image[ID].array.D[ii];
-    quick_sort_double(array_D, nelement);
-    value = array_D[(long) (fraction*nelement)];
-    free(array_D);    
-    break;
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            return;
+    }
+}
 
-  case _DATATYPE_UINT16 :
-    array_U = (unsigned short*) malloc(sizeof(unsigned short)*nelement);
-    if(array_U==NULL)
-      {
-	printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-	exit(0);
-      }
-    array_U[0] = 0.0;
-    for (ii = 0; ii < nelement; ii++) 
-      array_U[ii] = data.image[ID].array.UI16[ii];
-    quick_sort_ushort(array_U, nelement);
-    value = array_U[(long) (fraction*nelement)];
-    free(array_U);    
-    break;
 
-  default:
-    printERROR(__FILE__,__func__,__LINE__,"Image type not supported");
-    atypeOK = 0;
-    break;
-  }
 
-  if(atypeOK == 0)
-    exit(0);
+// selects sorted, distinct ranks ks[kl..kh] within a[lo..hi]
+static void arith_multiselect_double(double *a, long lo, long hi, const long *ks, long kl, long kh)
+{
+    long km, k;
 
-  return(value);
+    if(kl > kh)
+        return;
+
+    km = (kl+kh)/2;
+    k = ks[km];
+    arith_select_double(a, lo, hi, k);
+
+# ifdef _OPENMP
+    #pragma omp task if (k-lo > ARITH_PERCENTILE_TASK_LIMIT)
+# endif
+    arith_multiselect_double(a, lo, k-1, ks, kl, km-1);
+
+    arith_multiselect_double(a, k+1, hi, ks, km+1, kh);
+
+# ifdef _OPENMP
+    #pragma omp taskwait
+# endif
+}
+
+
+
+#ifdef _OPENMP
+// values vk of sorted, distinct ranks ks, using parallel histogram
+HOTKERNEL static void arith_percentiles_histo(const double *a, long n, const long *ks, long NBk, double *vk)
+{
+    double vmin = a[0];
+    double vmax = a[0];
+    double scale;
+    long *histo;
+    long *slot;
+    long *kbin, *krank;
+    long *slotoff, *slotpos;
+    long NBslot = 0;
+    long NBcand = 0;
+    double *cand;
+    long ii, b, cum, kk;
+
+    #pragma omp parallel for reduction(min:vmin) reduction(max:vmax)
+    for(ii=0; ii<n; ii++)
+    {
+        if(a[ii] < vmin)
+            vmin = a[ii];
+        if(a[ii] > vmax)
+            vmax = a[ii];
+    }
+
+    if(!(vmax > vmin))
+    {
+        for(kk=0; kk<NBk; kk++)
+            vk[kk] = vmin;
+        return;
+    }
+    scale = ARITH_PERCENTILE_NBBIN/(vmax-vmin);
+
+    histo = (long*) calloc(ARITH_PERCENTILE_NBBIN, sizeof(long));
+    #pragma omp parallel private(b)
+    {
+        long *histoloc = (long*) calloc(ARITH_PERCENTILE_NBBIN, sizeof(long));
+
+        #pragma omp for
+        for(ii=0; ii<n; ii++)
+        {
+            b = (long) ((a[ii]-vmin)*scale);
+            if(b > ARITH_PERCENTILE_NBBIN-1)
+                b = ARITH_PERCENTILE_NBBIN-1;
+            histoloc[b]++;
+        }
+        #pragma omp critical
+        {
+            for(b=0; b<ARITH_PERCENTILE_NBBIN; b++)
+                histo[b] += histoloc[b];
+        }
+        free(histoloc);
+    }
+
+    // bin and rank within bin of each requested rank
+    kbin = (long*) malloc(sizeof(long)*NBk);
+    krank = (long*) malloc(sizeof(long)*NBk);
+    slot = (long*) malloc(sizeof(long)*ARITH_PERCENTILE_NBBIN);
+    slotoff = (long*) malloc(sizeof(long)*(NBk+1));
+    slotpos = (long*) malloc(sizeof(long)*NBk);
+    cum = 0;
+    kk = 0;
+    for(b=0; b<ARITH_PERCENTILE_NBBIN; b++)
+    {
+        slot[b] = -1;
+        while((kk < NBk)&&(ks[kk] < cum+histo[b]))
+        {
+            if(slot[b] == -1)
+            {
+                slot[b] = NBslot;
+                slotoff[NBslot] = NBcand;
+                slotpos[NBslot] = NBcand;
+                NBcand += histo[b];
+                NBslot++;
+            }
+            kbin[kk] = b;
+            krank[kk] = ks[kk] - cum;
+            kk++;
+        }
+        cum += histo[b];
+    }
+    slotoff[NBslot] = NBcand;
+
+    // gather elements of selected bins
+    cand = (double*) malloc(sizeof(double)*NBcand);
+    #pragma omp parallel for private(b)
+    for(ii=0; ii<n; ii++)
+    {
+        long s, p;
+
+        b = (long) ((a[ii]-vmin)*scale);
+        if(b > ARITH_PERCENTILE_NBBIN-1)
+            b = ARITH_PERCENTILE_NBBIN-1;
+        s = slot[b];
+        if(s != -1)
+        {
+            #pragma omp atomic capture
+            p = slotpos[s]++;
+            cand[p] = a[ii];
+        }
+    }
+
+    for(kk=0; kk<NBk; kk++)
+    {
+        long s = slot[kbin[kk]];
+        long off = slotoff[s];
+
+        arith_select_double(cand+off, 0, slotoff[s+1]-off-1, krank[kk]);
+        vk[kk] = cand[off+krank[kk]];
+    }
+
+    free(cand);
+    free(slotpos);
+    free(slotoff);
+    free(slot);
+    free(krank);
+    free(kbin);
+    free(histo);
+}
+#endif
+
+
+
+static int arith_cmp_long(const void *p1, const void *p2)
+{
+    long v1 = *((const long*) p1);
+    long v2 = *((const long*) p2);
+
+    return((v1 > v2) - (v1 < v2));
+}
+
+
+
+//
+// computes NBfrac percentiles of array (nelement values) in one pass
+// array is used as work buffer : its content is reordered
+//
+int arith_array_percentiles(double *array, long nelement, const double *fractions, long NBfrac, double *values)
+{
+    long *ks;
+    double *vk;
+    long NBk = 0;
+    long i, j;
+
+    if((nelement < 1)||(NBfrac < 1))
+        return(1);
+
+    ks = (long*) malloc(sizeof(long)*NBfrac);
+    vk = (double*) malloc(sizeof(double)*NBfrac);
+    if((ks==NULL)||(vk==NULL))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+        exit(0);
+    }
+
+    for(i=0; i<NBfrac; i++)
+    {
+        long k = (long) (fractions[i]*nelement);
+
+        if(k > nelement-1)
+            k = nelement-1;
+        if(k < 0)
+            k = 0;
+        ks[i] = k;
+    }
+    qsort(ks, NBfrac, sizeof(long), arith_cmp_long);
+    for(i=0; i<NBfrac; i++)
+        if((NBk == 0)||(ks[i] != ks[NBk-1]))
+            ks[NBk++] = ks[i];
+
+#ifdef _OPENMP
+    if((nelement > ARITH_PERCENTILE_HISTO_LIMIT)&&(omp_get_max_threads() > 1))
+        arith_percentiles_histo(array, nelement, ks, NBk, vk);
+    else
+#endif
+    {
+# ifdef _OPENMP
+        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
+        #pragma omp single
+# endif
+        arith_multiselect_double(array, 0, nelement-1, ks, 0, NBk-1);
+
+        for(j=0; j<NBk; j++)
+            vk[j] = array[ks[j]];
+    }
+
+    for(i=0; i<NBfrac; i++)
+    {
+        long k = (long) (fractions[i]*nelement);
+
+        if(k > nelement-1)
+            k = nelement-1;
+        if(k < 0)
+            k = 0;
+        for(j=0; ks[j] != k; j++) {}
+        values[i] = vk[j];
+    }
+
+    free(ks);
+    free(vk);
+
+    return(0);
+}
+
+
+
+// image values as double array (to be freed by caller), NULL if image type not supported
+static double *arith_image_todouble(long ID)
+{
+    long nelement = data.image[ID].md[0].nelement;
+    double *array;
+    long ii;
+
+    switch(data.image[ID].md[0].atype) {
+    case _DATATYPE_UINT8 :
+    case _DATATYPE_INT8 :
+    case _DATATYPE_UINT16 :
+    case _DATATYPE_INT16 :
+    case _DATATYPE_UINT32 :
+    case _DATATYPE_INT32 :
+    case _DATATYPE_UINT64 :
+    case _DATATYPE_INT64 :
+    case _DATATYPE_FLOAT :
+    case _DATATYPE_DOUBLE :
+        break;
+    default :
+        return(NULL);
+    }
+
+    array = (double*) malloc(sizeof(double)*nelement);
+    if(array==NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+        exit(0);
+    }
+
+# ifdef _OPENMP
+    #pragma omp parallel for if (nelement>OMP_NELEMENT_LIMIT)
+# endif
+    for(ii=0; ii<nelement; ii++)
+    {
+        switch(data.image[ID].md[0].atype) {
+        case _DATATYPE_UINT8 :  array[ii] = data.image[ID].array.UI8[ii]; break;
+        case _DATATYPE_INT8 :   array[ii] = data.image[ID].array.SI8[ii]; break;
+        case _DATATYPE_UINT16 : array[ii] = data.image[ID].array.UI16[ii]; break;
+        case _DATATYPE_INT16 :  array[ii] = data.image[ID].array.SI16[ii]; break;
+        case _DATATYPE_UINT32 : array[ii] = data.image[ID].array.UI32[ii]; break;
+        case _DATATYPE_INT32 :  array[ii] = data.image[ID].array.SI32[ii]; break;
+        case _DATATYPE_UINT64 : array[ii] = data.image[ID].array.UI64[ii]; break;
+        case _DATATYPE_INT64 :  array[ii] = data.image[ID].array.SI64[ii]; break;
+        case _DATATYPE_FLOAT :  array[ii] = data.image[ID].array.F[ii]; break;
+        case _DATATYPE_DOUBLE : array[ii] = data.image[ID].array.D[ii]; break;
+        }
+    }
+
+    return(array);
+}
+
+
+
+int arith_image_percentiles(const char *ID_name, const double *fractions, long NBfrac, double *values)
+{
+    long ID;
+    double *array;
+
+    ID = image_ID(ID_name);
+    array = arith_image_todouble(ID);
+    if(array == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"Image type not supported");
+        exit(0);
+    }
+    arith_array_percentiles(array, data.image[ID].md[0].nelement, fractions, NBfrac, values);
+    free(array);
+
+    return(0);
+}
+
+
+
+double arith_image_percentile(const char *ID_name, double fraction)
+{
+    double value = 0.0;
+
+    arith_image_percentiles(ID_name, &fraction, 1, &value);
+
+    return(value);
 }
 
 
@@ -1259,6 +1554,283 @@ long arith_image_dy(const char *ID_name, const char *IDout_name)
 
 
 
+/* ------------------------------------------------------------------------- */
+/* type-specialized elementwise kernels                                      */
+/* ------------------------------------------------------------------------- */
+
+#ifdef _OPENMP
+#define ARITH_EXPR_SIMD _Pragma("omp simd")
+#define ARITH_OMP_FOR_SIMD _Pragma("omp for simd")
+#define ARITH_OMP_FOR _Pragma("omp for")
+#define ARITH_OMP_FOR_SIMD_COLLAPSE2 _Pragma("omp for simd collapse(2)")
+#else
+#define ARITH_EXPR_SIMD
+#define ARITH_OMP_FOR_SIMD
+#define ARITH_OMP_FOR
+#define ARITH_OMP_FOR_SIMD_COLLAPSE2
+#endif
+
+// functions evaluated inline, AEXPR_FN_PTR goes through function pointer
+#define AEXPR_FN_PTR       0
+#define AEXPR_FN_SIN       1
+#define AEXPR_FN_COS       2
+#define AEXPR_FN_TAN       3
+#define AEXPR_FN_ASIN      4
+#define AEXPR_FN_ACOS      5
+#define AEXPR_FN_ATAN      6
+#define AEXPR_FN_EXP       7
+#define AEXPR_FN_LOG       8
+#define AEXPR_FN_LOG10     9
+#define AEXPR_FN_SQRT     10
+#define AEXPR_FN_CBRT     11
+#define AEXPR_FN_CEIL     12
+#define AEXPR_FN_FLOOR    13
+#define AEXPR_FN_FABS     14
+#define AEXPR_FN_SINH     15
+#define AEXPR_FN_COSH     16
+#define AEXPR_FN_TANH     17
+#define AEXPR_FN_POSITIVE 18
+#define AEXPR_FN_ATAN2    19
+#define AEXPR_FN_TRUNC    20
+
+// binary functions evaluated inline
+#define AEXPR_FN2_PTR  0
+#define AEXPR_FN2_ADD  1
+#define AEXPR_FN2_SUB  2
+#define AEXPR_FN2_MULT 3
+#define AEXPR_FN2_DIV  4
+#define AEXPR_FN2_MIN  5
+#define AEXPR_FN2_MAX  6
+
+
+static int arith_fncode1(double (*f)(double))
+{
+    if((f == sin)||(f == Psin))           return(AEXPR_FN_SIN);
+    if((f == cos)||(f == Pcos))           return(AEXPR_FN_COS);
+    if((f == tan)||(f == Ptan))           return(AEXPR_FN_TAN);
+    if((f == asin)||(f == Pasin))         return(AEXPR_FN_ASIN);
+    if((f == acos)||(f == Pacos))         return(AEXPR_FN_ACOS);
+    if((f == atan)||(f == Patan))         return(AEXPR_FN_ATAN);
+    if((f == exp)||(f == Pexp))           return(AEXPR_FN_EXP);
+    if((f == log)||(f == Pln))            return(AEXPR_FN_LOG);
+    if((f == log10)||(f == Plog))         return(AEXPR_FN_LOG10);
+    if((f == sqrt)||(f == Psqrt))         return(AEXPR_FN_SQRT);
+    if(f == cbrt)                         return(AEXPR_FN_CBRT);
+    if((f == ceil)||(f == Pceil))         return(AEXPR_FN_CEIL);
+    if((f == floor)||(f == Pfloor))       return(AEXPR_FN_FLOOR);
+    if((f == fabs)||(f == Pfabs))         return(AEXPR_FN_FABS);
+    if((f == sinh)||(f == Psinh))         return(AEXPR_FN_SINH);
+    if((f == cosh)||(f == Pcosh))         return(AEXPR_FN_COSH);
+    if((f == tanh)||(f == Ptanh))         return(AEXPR_FN_TANH);
+    if(f == Ppositive)                    return(AEXPR_FN_POSITIVE);
+
+    return(AEXPR_FN_PTR);
+}
+
+
+
+static int arith_fncode2(double (*f)(double, double))
+{
+    if(f == Padd)   return(AEXPR_FN2_ADD);
+    if(f == Psub)   return(AEXPR_FN2_SUB);
+    if(f == Pmult)  return(AEXPR_FN2_MULT);
+    if(f == Pdiv)   return(AEXPR_FN2_DIV);
+    if(f == Pminv)  return(AEXPR_FN2_MIN);
+    if(f == Pmaxv)  return(AEXPR_FN2_MAX);
+
+    return(AEXPR_FN2_PTR);
+}
+
+
+
+//
+// unary kernel : known functions are called directly inside simd loops so the compiler can use vector
+// math (libmvec with glibc and -ffast-math), others go through the function pointer.
+// Must be called from inside a parallel region (or serially).
+//
+#define ARITH_KCASE1(code, func) case code : ARITH_OMP_FOR_SIMD for(ii=0; ii<nelement; ii++) out[ii] = func((double) in[ii]); break;
+
+#define ARITH_DEFINE_KERNEL_1_1(NAME, TIN, TOUT) \
+HOTKERNEL static void NAME(const TIN *restrict in, TOUT *restrict out, long nelement, int fn, double (*pt2function)(double)) \
+{ \
+    long ii; \
+    switch(fn) { \
+    ARITH_KCASE1(AEXPR_FN_SIN, sin) \
+    ARITH_KCASE1(AEXPR_FN_COS, cos) \
+    ARITH_KCASE1(AEXPR_FN_TAN, tan) \
+    ARITH_KCASE1(AEXPR_FN_ASIN, asin) \
+    ARITH_KCASE1(AEXPR_FN_ACOS, acos) \
+    ARITH_KCASE1(AEXPR_FN_ATAN, atan) \
+    ARITH_KCASE1(AEXPR_FN_EXP, exp) \
+    ARITH_KCASE1(AEXPR_FN_LOG, log) \
+    ARITH_KCASE1(AEXPR_FN_LOG10, log10) \
+    ARITH_KCASE1(AEXPR_FN_SQRT, sqrt) \
+    ARITH_KCASE1(AEXPR_FN_CBRT, cbrt) \
+    ARITH_KCASE1(AEXPR_FN_CEIL, ceil) \
+    ARITH_KCASE1(AEXPR_FN_FLOOR, floor) \
+    ARITH_KCASE1(AEXPR_FN_FABS, fabs) \
+    ARITH_KCASE1(AEXPR_FN_SINH, sinh) \
+    ARITH_KCASE1(AEXPR_FN_COSH, cosh) \
+    ARITH_KCASE1(AEXPR_FN_TANH, tanh) \
+    ARITH_KCASE1(AEXPR_FN_POSITIVE, Ppositive) \
+    default : \
+        ARITH_OMP_FOR \
+        for(ii=0; ii<nelement; ii++) \
+            out[ii] = pt2function((double) in[ii]); \
+        break; \
+    } \
+}
+
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_UI8,  uint8_t,  float)
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_SI16, int16_t,  float)
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_UI16, uint16_t, float)
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_SI32, int32_t,  float)
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_F,    float,    float)
+ARITH_DEFINE_KERNEL_1_1(arith_kernel_1_1_D,    double,   double)
+
+
+
+//
+// binary kernel over nslice slices of xysize elements
+// stride2 = xysize for same-size images, 0 to apply a 2D image to each slice of a cube
+//
+#define ARITH_KCASE2(code, func) case code : \
+    ARITH_OMP_FOR_SIMD_COLLAPSE2 \
+    for(kk=0; kk<nslice; kk++) \
+        for(ii=0; ii<xysize; ii++) \
+            out[kk*xysize+ii] = func((double) in1[kk*xysize+ii], (double) in2[kk*stride2+ii]); \
+    break;
+
+#define ARITH_DEFINE_KERNEL_2_1(NAME, TIN1, TIN2, TOUT) \
+HOTKERNEL static void NAME(const TIN1 *restrict in1, const TIN2 *restrict in2, TOUT *restrict out, long nslice, long xysize, long stride2, int fn, double (*pt2function)(double, double)) \
+{ \
+    long ii, kk; \
+    switch(fn) { \
+    ARITH_KCASE2(AEXPR_FN2_ADD, Padd) \
+    ARITH_KCASE2(AEXPR_FN2_SUB, Psub) \
+    ARITH_KCASE2(AEXPR_FN2_MULT, Pmult) \
+    ARITH_KCASE2(AEXPR_FN2_DIV, Pdiv) \
+    ARITH_KCASE2(AEXPR_FN2_MIN, Pminv) \
+    ARITH_KCASE2(AEXPR_FN2_MAX, Pmaxv) \
+    ARITH_KCASE2(AEXPR_FN2_PTR, pt2function) \
+    } \
+}
+
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_UI8_UI8,   uint8_t,  uint8_t,  float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_SI16_SI16, int16_t,  int16_t,  float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_UI16_UI16, uint16_t, uint16_t, float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_SI32_SI32, int32_t,  int32_t,  float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_SI32_F,    int32_t,  float,    float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_UI16_F,    uint16_t, float,    float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_F_F,       float,    float,    float)
+ARITH_DEFINE_KERNEL_2_1(arith_kernel_2_1_D_D,       double,   double,   double)
+
+
+
+// image ID -> image IDout (already allocated, same size, FLOAT or DOUBLE for DOUBLE input)
+static void arith_image_function_1_1_kernel(long ID, long IDout, double (*pt2function)(double))
+{
+    long nelement = data.image[ID].md[0].nelement;
+    int fn = arith_fncode1(pt2function);
+
+# ifdef _OPENMP
+    #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
+    {
+# endif
+        switch(data.image[ID].md[0].atype) {
+        case _DATATYPE_UINT8 :
+            arith_kernel_1_1_UI8(data.image[ID].array.UI8, data.image[IDout].array.F, nelement, fn, pt2function);
+            break;
+        case _DATATYPE_INT16 :
+            arith_kernel_1_1_SI16(data.image[ID].array.SI16, data.image[IDout].array.F, nelement, fn, pt2function);
+            break;
+        case _DATATYPE_UINT16 :
+            arith_kernel_1_1_UI16(data.image[ID].array.UI16, data.image[IDout].array.F, nelement, fn, pt2function);
+            break;
+        case _DATATYPE_INT32 :
+            arith_kernel_1_1_SI32(data.image[ID].array.SI32, data.image[IDout].array.F, nelement, fn, pt2function);
+            break;
+        case _DATATYPE_FLOAT :
+            arith_kernel_1_1_F(data.image[ID].array.F, data.image[IDout].array.F, nelement, fn, pt2function);
+            break;
+        case _DATATYPE_DOUBLE :
+            arith_kernel_1_1_D(data.image[ID].array.D, data.image[IDout].array.D, nelement, fn, pt2function);
+            break;
+        }
+# ifdef _OPENMP
+    }
+# endif
+}
+
+
+
+// images ID1, ID2 -> image IDout, returns 1 if type combination is not supported
+static int arith_image_function_2_1_kernel(long ID1, long ID2, long IDout, long nslice, long xysize, long stride2, double (*pt2function)(double, double))
+{
+    int atype1 = data.image[ID1].md[0].atype;
+    int atype2 = data.image[ID2].md[0].atype;
+    int fn = arith_fncode2(pt2function);
+    long nelement = nslice*xysize;
+    int combo = -1;
+
+    if((atype1==_DATATYPE_UINT8)&&(atype2==_DATATYPE_UINT8))
+        combo = 0;
+    if((atype1==_DATATYPE_INT16)&&(atype2==_DATATYPE_INT16))
+        combo = 1;
+    if((atype1==_DATATYPE_UINT16)&&(atype2==_DATATYPE_UINT16))
+        combo = 2;
+    if((atype1==_DATATYPE_INT32)&&(atype2==_DATATYPE_INT32))
+        combo = 3;
+    if((atype1==_DATATYPE_INT32)&&(atype2==_DATATYPE_FLOAT))
+        combo = 4;
+    if((atype1==_DATATYPE_UINT16)&&(atype2==_DATATYPE_FLOAT))
+        combo = 5;
+    if((atype1==_DATATYPE_FLOAT)&&(atype2==_DATATYPE_FLOAT))
+        combo = 6;
+    if((atype1==_DATATYPE_DOUBLE)&&(atype2==_DATATYPE_DOUBLE))
+        combo = 7;
+    if(combo == -1)
+        return(1);
+
+# ifdef _OPENMP
+    #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
+    {
+# endif
+        switch(combo) {
+        case 0 :
+            arith_kernel_2_1_UI8_UI8(data.image[ID1].array.UI8, data.image[ID2].array.UI8, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 1 :
+            arith_kernel_2_1_SI16_SI16(data.image[ID1].array.SI16, data.image[ID2].array.SI16, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 2 :
+            arith_kernel_2_1_UI16_UI16(data.image[ID1].array.UI16, data.image[ID2].array.UI16, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 3 :
+            arith_kernel_2_1_SI32_SI32(data.image[ID1].array.SI32, data.image[ID2].array.SI32, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 4 :
+            arith_kernel_2_1_SI32_F(data.image[ID1].array.SI32, data.image[ID2].array.F, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 5 :
+            arith_kernel_2_1_UI16_F(data.image[ID1].array.UI16, data.image[ID2].array.F, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 6 :
+            arith_kernel_2_1_F_F(data.image[ID1].array.F, data.image[ID2].array.F, data.image[IDout].array.F, nslice, xysize, stride2, fn, pt2function);
+            break;
+        case 7 :
+            arith_kernel_2_1_D_D(data.image[ID1].array.D, data.image[ID2].array.D, data.image[IDout].array.D, nslice, xysize, stride2, fn, pt2function);
+            break;
+        }
+# ifdef _OPENMP
+    }
+# endif
+
+    return(0);
+}
+
+
+
 /* ------------------------------------------------------------------------- */
 /* Functions for bison / flex                                                */
 /* im : image 													
@@ -1278,8 +1850,6 @@ int arith_image_function_im_im__d_d(const char *ID_name, const char *ID_out, dou
     long IDout;
     uint32_t *naxes = NULL;
     long naxis;
-    long ii;
-    long nelement;
     int atype, atypeout;
     long i;
 
@@ -1314,50 +1884,7 @@ int arith_image_function_im_im__d_d(const char *ID_name, const char *ID_out, dou
     IDout = create_image_ID(ID_out, naxis, naxes, atypeout, data.SHARED_DFT, data.NBKEWORD_DFT);
     free(naxes);
 
-    nelement = data.image[ID].md[0].nelement;
-
-
-# ifdef _OPENMP
-    #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-    {
-# endif
-
-
-        if(atype == _DATATYPE_UINT8)
-        {
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for (ii = 0; ii < nelement; ii++)
-                data.image[IDout].array.F[ii] = (float) pt2function((double) (data.image[ID].array.UI8[ii]));
-        }
-        if(atype == _DATATYPE_INT32)
-        {
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for (ii = 0; ii < nelement; ii++)
-                data.image[IDout].array.F[ii] = (float) pt2function((double) (data.image[ID].array.SI32[ii]));
-        }
-        if(atype == _DATATYPE_FLOAT)
-        {
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for (ii = 0; ii < nelement; ii++)
-                data.image[IDout].array.F[ii] = (float) pt2function((double) (data.image[ID].array.F[ii]));
-        }
-        if(atype == _DATATYPE_DOUBLE)
-        {
-# ifdef _OPENMP
-            #pragma omp for
-# endif
-            for (ii = 0; ii < nelement; ii++)
-                data.image[IDout].array.D[ii] = pt2function(data.image[ID].array.D[ii]);
-        }
-# ifdef _OPENMP
-    }
-# endif
+    arith_image_function_1_1_kernel(ID, IDout, pt2function);
 
 
     if(data.Debug>0)
@@ -1581,81 +2108,7 @@ int arith_image_function_imdd_im__ddd_d(const char *ID_name, double v0, double v
 
 int arith_image_function_1_1_byID(long ID, long IDout, double (*pt2function)(double))
 {
-  uint32_t *naxes = NULL;
-  long naxis;
-  long ii;
-  long nelement;
-  int atype, atypeout;
-  long i;
-
-  //  printf("arith_image_function_1_1\n");
-
-  atype = data.image[ID].md[0].atype;
-  naxis=data.image[ID].md[0].naxis;
-  naxes = (uint32_t*) malloc(sizeof(uint32_t)*naxis);
-  if(naxes==NULL)
-     {
-       printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-       exit(0);
-     }
-
-
-  for(i=0;i<naxis;i++)
-    {
-      naxes[i] = data.image[ID].md[0].size[i];
-    }
-  
-
-  atypeout = _DATATYPE_FLOAT;
-  if(atype == _DATATYPE_DOUBLE)
-    atypeout = _DATATYPE_DOUBLE;
-
-  free(naxes);
-
-  nelement = data.image[ID].md[0].nelement;
- 
- 
-  # ifdef _OPENMP
-  #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT) 
-  {
-  # endif
-
-
-  if(atype == _DATATYPE_UINT8)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.UI8[ii]));
-    }
-  if(atype == _DATATYPE_INT32)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.SI32[ii]));
-    }
-  if(atype == _DATATYPE_FLOAT)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-      	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.F[ii]));
-    }
-  if(atype == _DATATYPE_DOUBLE)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.D[ii] = (double) pt2function((double) (data.image[ID].array.D[ii]));
-    }
-  # ifdef _OPENMP
-  }
-  # endif
+  arith_image_function_1_1_kernel(ID, IDout, pt2function);
 
   return(0);
 }
@@ -1667,8 +2120,6 @@ int arith_image_function_1_1(const char *ID_name, const char *ID_out, double (*p
   long IDout;
   uint32_t *naxes = NULL;
   long naxis;
-  long ii;
-  long nelement;
   int atype, atypeout;
   long i;
 
@@ -1698,50 +2149,7 @@ int arith_image_function_1_1(const char *ID_name, const char *ID_out, double (*p
   IDout = create_image_ID(ID_out, naxis, naxes, atypeout, data.SHARED_DFT, data.NBKEWORD_DFT);
   free(naxes);
 
-  nelement = data.image[ID].md[0].nelement;
- 
- 
-  # ifdef _OPENMP
-  #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT) 
-  {
-  # endif
-
-
-  if(atype == _DATATYPE_UINT8)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.UI8[ii]));
-    }
-  if(atype == _DATATYPE_INT32)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.SI32[ii]));
-    }
-  if(atype == _DATATYPE_FLOAT)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-      	data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID].array.F[ii]));
-    }
-  if(atype == _DATATYPE_DOUBLE)
-    {
-      # ifdef _OPENMP
-      #pragma omp for
-      # endif
-      for (ii = 0; ii < nelement; ii++)
-	data.image[IDout].array.D[ii] = (double) pt2function((double) (data.image[ID].array.D[ii]));
-    }
-  # ifdef _OPENMP
-  }
-  # endif
+  arith_image_function_1_1_kernel(ID, IDout, pt2function);
 
   return(0);
 }
@@ -2020,7 +2428,6 @@ int arith_image_function_2_1(const char *ID_name1, const char *ID_name2, const c
 {
   long ID1,ID2;
   long IDout;
-  long ii, kk;
   uint32_t *naxes = NULL; // input, output
   uint32_t *naxes2 = NULL; 
   long nelement1, nelement2, nelement;
@@ -2109,165 +2516,31 @@ int arith_image_function_2_1(const char *ID_name1, const char *ID_name2, const c
 				op3D2Dto3D = 1;
 				xysize = naxes[0]*naxes[1];
 				printf("input : 3D im, 2D im -> output : 3D im\n");
-				fflush(stdout);
-				list_image_ID();
-			}
-	}
-  
-  
-  nelement = nelement1;
-  if(op3D2Dto3D == 0)
-	if(nelement1!=nelement2)
-    {
-      n = snprintf(errmsg, SBUFFERSIZE, "images %s and %s have different number of elements ( %ld %ld )\n", ID_name1, ID_name2, nelement1, nelement2);
-      if(n >= SBUFFERSIZE) 
-		printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-      printERROR(__FILE__,__func__,__LINE__,errmsg);
-      exit(0);
-    }
-
-	//list_image_ID();
-
-
-
-  # ifdef _OPENMP
-  #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-  {  
-  # endif
-
-  if( (atype1==_DATATYPE_UINT8) && (atype2==_DATATYPE_UINT8) )  // CHAR CHAR -> FLOAT
-    {
-
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (ii = 0; ii < nelement; ii++)
-			data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID1].array.UI8[ii]),(double) (data.image[ID2].array.UI8[ii]));
-	
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.F[kk*xysize+ii] = pt2function((double) (data.image[ID1].array.UI8[kk*xysize+ii]), (double) (data.image[ID2].array.UI8[ii]));
-		
-    }
-
-  if( (atype1==_DATATYPE_INT32) && (atype2==_DATATYPE_INT32) )  // INT INT -> FLOAT
+				fflush(stdout);
+				list_image_ID();
+			}
+	}
+  
+  
+  nelement = nelement1;
+  if(op3D2Dto3D == 0)
+	if(nelement1!=nelement2)
     {
-   //  # ifdef _OPENMP
-    //  #pragma omp for
-    //  # endif
-	
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-     for (ii = 0; ii < nelement; ii++)
-		data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID1].array.SI32[ii]),(double) (data.image[ID2].array.SI32[ii]));
-
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.F[kk*xysize+ii] = pt2function((double) (data.image[ID1].array.SI32[kk*xysize+ii]), (double) (data.image[ID2].array.SI32[ii]));
-    }
-
-  if( (atype1==_DATATYPE_INT32) && (atype2==_DATATYPE_FLOAT) )  // INT FLOAT -> FLOAT
-    {
-     //# ifdef _OPENMP
-     // #pragma omp for
-     // # endif
-      
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-     for (ii = 0; ii < nelement; ii++)
-		data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID1].array.SI32[ii]),(double) (data.image[ID2].array.F[ii]));
-
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.F[kk*xysize+ii] = pt2function((double) (data.image[ID1].array.SI32[kk*xysize+ii]), (double) (data.image[ID2].array.F[ii]));
-    }
-
-  if( (atype1==_DATATYPE_UINT16) && (atype2==_DATATYPE_FLOAT) )  // INT FLOAT -> FLOAT
-    {
-     //# ifdef _OPENMP
-     // #pragma omp for
-     // # endif
-      
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-     for (ii = 0; ii < nelement; ii++)
-		data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID1].array.UI16[ii]),(double) (data.image[ID2].array.F[ii]));
-
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.F[kk*xysize+ii] = pt2function((double) (data.image[ID1].array.UI16[kk*xysize+ii]), (double) (data.image[ID2].array.F[ii]));
+      n = snprintf(errmsg, SBUFFERSIZE, "images %s and %s have different number of elements ( %ld %ld )\n", ID_name1, ID_name2, nelement1, nelement2);
+      if(n >= SBUFFERSIZE) 
+		printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
+      printERROR(__FILE__,__func__,__LINE__,errmsg);
+      exit(0);
     }
 
+	//list_image_ID();
 
 
-  if( (atype1==_DATATYPE_FLOAT) && (atype2==_DATATYPE_FLOAT) )  // FLOAT FLOAT -> FLOAT
-    {
-     // # ifdef _OPENMP
-     // #pragma omp for
-     // # endif
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-      for (ii = 0; ii < nelement; ii++)
-		data.image[IDout].array.F[ii] = pt2function((double) (data.image[ID1].array.F[ii]),(double) (data.image[ID2].array.F[ii]));
-
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.F[kk*xysize+ii] = pt2function((double) (data.image[ID1].array.F[kk*xysize+ii]), (double) (data.image[ID2].array.F[ii]));
-    }
-
-  if( (atype1==_DATATYPE_DOUBLE) && (atype2==_DATATYPE_DOUBLE) ) // DOUBLE DOUBLE -> DOUBLE
-    {
-    // # ifdef _OPENMP
-    //  #pragma omp for
-    //  # endif
-	if(op3D2Dto3D == 0)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-      for (ii = 0; ii < nelement; ii++)
-		data.image[IDout].array.D[ii] = (double) pt2function((double) (data.image[ID1].array.D[ii]),(double) (data.image[ID2].array.D[ii]));
-
-	if(op3D2Dto3D == 1)
-	# ifdef _OPENMP
-    #pragma omp for
-    # endif
-		for (kk = 0; kk < naxes[2]; kk++)
-			for (ii = 0; ii < xysize; ii++)
-				data.image[IDout].array.D[kk*xysize+ii] = (double) pt2function((double) (data.image[ID1].array.D[kk*xysize+ii]), (double) (data.image[ID2].array.D[ii]));
-    }
 
-  # ifdef _OPENMP
-  }
-  # endif
+  if(op3D2Dto3D == 0)
+    arith_image_function_2_1_kernel(ID1, ID2, IDout, 1, nelement, nelement, pt2function);
+  else
+    arith_image_function_2_1_kernel(ID1, ID2, IDout, naxes[2], xysize, 0, pt2function);
 	
 	  free(naxes);
 	    free(naxes2);
@@ -3268,6 +3541,697 @@ int arith_image_trunc_inplace_byID(long ID, double f1, double f2) { arith_image_
 
 
 
+/* ------------------------------------------------------------------------- */
+/* fused image expressions (bison / flex)                                    */
+/* ------------------------------------------------------------------------- */
+
+//
+// Image expressions parsed on the command line are stored as a tree of nodes, registered under the
+// temporary image name the parser hands back. Nothing is computed until a real image is needed
+// (arith_expr_materialize), then the whole tree is evaluated in one pass over the output, block by
+// block : no intermediate images, and operator/function dispatch happens once per block.
+//
+
+#define ARITH_EXPR_BLOCK 1024
+
+// node / instruction codes
+#define AEXPR_IMAGE  0
+#define AEXPR_CST    1
+#define AEXPR_ADD    2
+#define AEXPR_SUB    3
+#define AEXPR_MUL    4
+#define AEXPR_DIV    5
+#define AEXPR_POWC   6   // x^c, same convention as arith_image_cstpow
+#define AEXPR_F1     7
+#define AEXPR_F2C    8   // f(x, c0)
+#define AEXPR_F3C    9   // f(x, c0, c1)
+#define AEXPR_ADDC  10
+#define AEXPR_SUBC  11   // x - c
+#define AEXPR_CSUB  12   // c - x
+#define AEXPR_MULC  13
+#define AEXPR_DIVC  14   // x / c
+#define AEXPR_CDIV  15   // c / x
+
+
+typedef struct
+{
+    char name[200];   // registered name, empty if none
+    int op;
+    long a, b;        // child nodes
+    long ID;          // image (AEXPR_IMAGE)
+    double c0, c1;
+    int fn;
+    double (*f1)(double);
+    double (*f2)(double, double);
+    double (*f3)(double, double, double);
+} ARITH_EXPR_NODE;
+
+typedef struct
+{
+    int code;
+    long ID;
+    int bcast;        // 2D image applied to each slice of 3D output
+    double c0, c1;
+    int fn;
+    double (*f1)(double);
+    double (*f2)(double, double);
+    double (*f3)(double, double, double);
+} ARITH_EXPR_INSTR;
+
+
+static ARITH_EXPR_NODE *aexpr_node = NULL;
+static long aexpr_NBnode = 0;
+static long aexpr_NBnodemax = 0;
+
+
+
+void arith_expr_reset()
+{
+    aexpr_NBnode = 0;
+}
+
+
+
+static long aexpr_newnode(int op)
+{
+    long n;
+
+    if(aexpr_NBnode == aexpr_NBnodemax)
+    {
+        aexpr_NBnodemax = 2*aexpr_NBnodemax + 16;
+        aexpr_node = (ARITH_EXPR_NODE*) realloc(aexpr_node, sizeof(ARITH_EXPR_NODE)*aexpr_NBnodemax);
+        if(aexpr_node == NULL)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"realloc() error");
+            exit(0);
+        }
+    }
+    n = aexpr_NBnode++;
+    memset(&aexpr_node[n], 0, sizeof(ARITH_EXPR_NODE));
+    aexpr_node[n].op = op;
+    aexpr_node[n].a = -1;
+    aexpr_node[n].b = -1;
+    aexpr_node[n].ID = -1;
+
+    return(n);
+}
+
+
+
+static long aexpr_findname(const char *name)
+{
+    long n;
+
+    for(n=aexpr_NBnode-1; n>=0; n--)
+        if(strcmp(aexpr_node[n].name, name) == 0)
+            return(n);
+
+    return(-1);
+}
+
+
+
+static void aexpr_register(long node, const char *name)
+{
+    long n;
+
+    for(n=0; n<aexpr_NBnode; n++)
+        if(strcmp(aexpr_node[n].name, name) == 0)
+            aexpr_node[n].name[0] = '\0';
+    strncpy(aexpr_node[node].name, name, 199);
+}
+
+
+
+// node for registered expression or real (non-complex) image, -1 if not supported
+static long aexpr_fromname(const char *name)
+{
+    long n, ID;
+    int atype;
+
+    if((n = aexpr_findname(name)) != -1)
+        return(n);
+
+    ID = image_ID(name);
+    if(ID == -1)
+        return(-1);
+    atype = data.image[ID].md[0].atype;
+    if((atype == _DATATYPE_COMPLEX_FLOAT)||(atype == _DATATYPE_COMPLEX_DOUBLE)||(atype > _DATATYPE_COMPLEX_DOUBLE))
+        return(-1);
+
+    n = aexpr_newnode(AEXPR_IMAGE);
+    aexpr_node[n].ID = ID;
+
+    return(n);
+}
+
+
+
+static long aexpr_cst(double v)
+{
+    long n = aexpr_newnode(AEXPR_CST);
+
+    aexpr_node[n].c0 = v;
+    return(n);
+}
+
+
+
+//
+// image op image -> ID_out (op = '+', '-', '*', '/')
+//
+int arith_expr_imim(int op, const char *IDa_name, const char *IDb_name, const char *ID_out)
+{
+    long na, nb, n;
+
+    na = aexpr_fromname(IDa_name);
+    nb = aexpr_fromname(IDb_name);
+    if((na == -1)||(nb == -1))
+    {
+        arith_expr_materialize(IDa_name);
+        arith_expr_materialize(IDb_name);
+        switch(op) {
+        case '+' : arith_image_add(IDa_name, IDb_name, ID_out); break;
+        case '-' : arith_image_sub(IDa_name, IDb_name, ID_out); break;
+        case '*' : arith_image_mult(IDa_name, IDb_name, ID_out); break;
+        case '/' : arith_image_div(IDa_name, IDb_name, ID_out); break;
+        }
+        return(0);
+    }
+
+    switch(op) {
+    case '+' : n = aexpr_newnode(AEXPR_ADD); break;
+    case '-' : n = aexpr_newnode(AEXPR_SUB); break;
+    case '*' : n = aexpr_newnode(AEXPR_MUL); break;
+    default  : n = aexpr_newnode(AEXPR_DIV); break;
+    }
+    aexpr_node[n].a = na;
+    aexpr_node[n].b = nb;
+    aexpr_register(n, ID_out);
+
+    return(0);
+}
+
+
+
+//
+// image op constant -> ID_out (op = '+', '-', '*', '/', '^')
+// if cstfirst = 1, computes constant op image
+//
+int arith_expr_imcst(int op, const char *ID_name, double v, int cstfirst, const char *ID_out)
+{
+    long na, n;
+
+    na = aexpr_fromname(ID_name);
+    if(na == -1)
+    {
+        arith_expr_materialize(ID_name);
+        switch(op) {
+        case '+' : arith_image_cstadd(ID_name, v, ID_out); break;
+        case '-' :
+            if(cstfirst == 1)
+                arith_image_cstsubm(ID_name, v, ID_out);
+            else
+                arith_image_cstsub(ID_name, v, ID_out);
+            break;
+        case '*' : arith_image_cstmult(ID_name, v, ID_out); break;
+        case '/' :
+            if(cstfirst == 1)
+                arith_image_cstdiv1(ID_name, v, ID_out);
+            else
+                arith_image_cstdiv(ID_name, v, ID_out);
+            break;
+        case '^' : arith_image_cstpow(ID_name, v, ID_out); break;
+        }
+        return(0);
+    }
+
+    if(op == '^')
+    {
+        n = aexpr_newnode(AEXPR_POWC);
+        aexpr_node[n].a = na;
+        aexpr_node[n].c0 = v;
+    }
+    else
+    {
+        switch(op) {
+        case '+' : n = aexpr_newnode(AEXPR_ADD); break;
+        case '-' : n = aexpr_newnode(AEXPR_SUB); break;
+        case '*' : n = aexpr_newnode(AEXPR_MUL); break;
+        default  : n = aexpr_newnode(AEXPR_DIV); break;
+        }
+        if(cstfirst == 1)
+        {
+            aexpr_node[n].b = na;
+            aexpr_node[n].a = aexpr_cst(v);
+        }
+        else
+        {
+            aexpr_node[n].a = na;
+            aexpr_node[n].b = aexpr_cst(v);
+        }
+    }
+    aexpr_register(n, ID_out);
+
+    return(0);
+}
+
+
+
+int arith_expr_func_im(double (*pt2function)(double), const char *ID_name, const char *ID_out)
+{
+    long na, n;
+
+    na = aexpr_fromname(ID_name);
+    if(na == -1)
+    {
+        arith_expr_materialize(ID_name);
+        arith_image_function_im_im__d_d(ID_name, ID_out, pt2function);
+        return(0);
+    }
+    n = aexpr_newnode(AEXPR_F1);
+    aexpr_node[n].a = na;
+    aexpr_node[n].fn = arith_fncode1(pt2function);
+    aexpr_node[n].f1 = pt2function;
+    aexpr_register(n, ID_out);
+
+    return(0);
+}
+
+
+
+int arith_expr_func_imd(double (*pt2function)(double, double), const char *ID_name, double v0, const char *ID_out)
+{
+    long na, n;
+
+    na = aexpr_fromname(ID_name);
+    if(na == -1)
+    {
+        arith_expr_materialize(ID_name);
+        arith_image_function_imd_im__dd_d(ID_name, v0, ID_out, pt2function);
+        return(0);
+    }
+    n = aexpr_newnode(AEXPR_F2C);
+    aexpr_node[n].a = na;
+    aexpr_node[n].c0 = v0;
+    aexpr_node[n].fn = (pt2function == atan2) ? AEXPR_FN_ATAN2 : AEXPR_FN_PTR;
+    aexpr_node[n].f2 = pt2function;
+    aexpr_register(n, ID_out);
+
+    return(0);
+}
+
+
+
+int arith_expr_func_imdd(double (*pt2function)(double, double, double), const char *ID_name, double v0, double v1, const char *ID_out)
+{
+    long na, n;
+
+    na = aexpr_fromname(ID_name);
+    if(na == -1)
+    {
+        arith_expr_materialize(ID_name);
+        arith_image_function_imdd_im__ddd_d(ID_name, v0, v1, ID_out, pt2function);
+        return(0);
+    }
+    n = aexpr_newnode(AEXPR_F3C);
+    aexpr_node[n].a = na;
+    aexpr_node[n].c0 = v0;
+    aexpr_node[n].c1 = v1;
+    aexpr_node[n].fn = (pt2function == Ptrunc) ? AEXPR_FN_TRUNC : AEXPR_FN_PTR;
+    aexpr_node[n].f3 = pt2function;
+    aexpr_register(n, ID_out);
+
+    return(0);
+}
+
+
+
+// postfix program, constant operands folded into instruction, returns stack depth
+static int aexpr_compile(long n, ARITH_EXPR_INSTR *prog, long *NBinstr)
+{
+    ARITH_EXPR_NODE *nd = &aexpr_node[n];
+    ARITH_EXPR_INSTR *in;
+    int da, db;
+
+    if((nd->op == AEXPR_IMAGE)||(nd->op == AEXPR_CST))
+    {
+        in = &prog[(*NBinstr)++];
+        memset(in, 0, sizeof(ARITH_EXPR_INSTR));
+        in->code = nd->op;
+        in->ID = nd->ID;
+        in->c0 = nd->c0;
+        return(1);
+    }
+
+    if((nd->op >= AEXPR_ADD)&&(nd->op <= AEXPR_DIV))
+    {
+        int opc;
+
+        if(aexpr_node[nd->b].op == AEXPR_CST)
+        {
+            const int codes[4] = {AEXPR_ADDC, AEXPR_SUBC, AEXPR_MULC, AEXPR_DIVC};
+
+            da = aexpr_compile(nd->a, prog, NBinstr);
+            opc = codes[nd->op - AEXPR_ADD];
+            in = &prog[(*NBinstr)++];
+            memset(in, 0, sizeof(ARITH_EXPR_INSTR));
+            in->code = opc;
+            in->c0 = aexpr_node[nd->b].c0;
+            return(da);
+        }
+        if(aexpr_node[nd->a].op == AEXPR_CST)
+        {
+            const int codes[4] = {AEXPR_ADDC, AEXPR_CSUB, AEXPR_MULC, AEXPR_CDIV};
+
+            db = aexpr_compile(nd->b, prog, NBinstr);
+            opc = codes[nd->op - AEXPR_ADD];
+            in = &prog[(*NBinstr)++];
+            memset(in, 0, sizeof(ARITH_EXPR_INSTR));
+            in->code = opc;
+            in->c0 = aexpr_node[nd->a].c0;
+            return(db);
+        }
+
+        da = aexpr_compile(nd->a, prog, NBinstr);
+        db = aexpr_compile(nd->b, prog, NBinstr);
+        in = &prog[(*NBinstr)++];
+        memset(in, 0, sizeof(ARITH_EXPR_INSTR));
+        in->code = nd->op;
+        return((da > db+1) ? da : db+1);
+    }
+
+    // unary : AEXPR_POWC, AEXPR_F1, AEXPR_F2C, AEXPR_F3C
+    da = aexpr_compile(nd->a, prog, NBinstr);
+    in = &prog[(*NBinstr)++];
+    in->code = nd->op;
+    in->ID = -1;
+    in->bcast = 0;
+    in->c0 = nd->c0;
+    in->c1 = nd->c1;
+    in->fn = nd->fn;
+    in->f1 = nd->f1;
+    in->f2 = nd->f2;
+    in->f3 = nd->f3;
+
+    return(da);
+}
+
+
+
+static void aexpr_load(double *restrict dst, long ID, long offset, long n)
+{
+    long k;
+
+    switch(data.image[ID].md[0].atype) {
+    case _DATATYPE_FLOAT :
+        {
+            const float *restrict src = data.image[ID].array.F + offset;
+            ARITH_EXPR_SIMD
+            for(k=0; k<n; k++)
+                dst[k] = src[k];
+        }
+        break;
+    case _DATATYPE_DOUBLE :
+        {
+            const double *restrict src = data.image[ID].array.D + offset;
+            ARITH_EXPR_SIMD
+            for(k=0; k<n; k++)
+                dst[k] = src[k];
+        }
+        break;
+    case _DATATYPE_UINT8 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.UI8[offset+k];
+        break;
+    case _DATATYPE_INT8 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.SI8[offset+k];
+        break;
+    case _DATATYPE_UINT16 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.UI16[offset+k];
+        break;
+    case _DATATYPE_INT16 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.SI16[offset+k];
+        break;
+    case _DATATYPE_UINT32 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.UI32[offset+k];
+        break;
+    case _DATATYPE_INT32 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.SI32[offset+k];
+        break;
+    case _DATATYPE_UINT64 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.UI64[offset+k];
+        break;
+    case _DATATYPE_INT64 :
+        for(k=0; k<n; k++)
+            dst[k] = data.image[ID].array.SI64[offset+k];
+        break;
+    }
+}
+
+
+
+static void aexpr_func1(double *restrict x, long n, int fn, double (*f1)(double))
+{
+    long k;
+
+    switch(fn) {
+    case AEXPR_FN_SIN :      ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = sin(x[k]); break;
+    case AEXPR_FN_COS :      ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = cos(x[k]); break;
+    case AEXPR_FN_TAN :      ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = tan(x[k]); break;
+    case AEXPR_FN_ASIN :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = asin(x[k]); break;
+    case AEXPR_FN_ACOS :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = acos(x[k]); break;
+    case AEXPR_FN_ATAN :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = atan(x[k]); break;
+    case AEXPR_FN_EXP :      ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = exp(x[k]); break;
+    case AEXPR_FN_LOG :      ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = log(x[k]); break;
+    case AEXPR_FN_LOG10 :    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = log10(x[k]); break;
+    case AEXPR_FN_SQRT :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = sqrt(x[k]); break;
+    case AEXPR_FN_CBRT :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = cbrt(x[k]); break;
+    case AEXPR_FN_CEIL :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = ceil(x[k]); break;
+    case AEXPR_FN_FLOOR :    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = floor(x[k]); break;
+    case AEXPR_FN_FABS :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = fabs(x[k]); break;
+    case AEXPR_FN_SINH :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = sinh(x[k]); break;
+    case AEXPR_FN_COSH :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = cosh(x[k]); break;
+    case AEXPR_FN_TANH :     ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = tanh(x[k]); break;
+    case AEXPR_FN_POSITIVE : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = (x[k] > 0.0) ? 1.0 : 0.0; break;
+    default :
+        for(k=0; k<n; k++)
+            x[k] = f1(x[k]);
+        break;
+    }
+}
+
+
+
+//
+// evaluates expression registered as ID_name into image ID_name
+// if ID_name is not an expression, returns its image ID
+//
+long arith_expr_materialize(const char *ID_name)
+{
+    long node;
+    long n, i;
+    long NBinstr = 0;
+    ARITH_EXPR_INSTR *prog;
+    int depth;
+    long IDref = -1;
+    long nelement, xysize, nslice, NBblk_slice, NBblk;
+    long IDout;
+    int atypeout = _DATATYPE_FLOAT;
+    uint32_t *naxes;
+    long naxis;
+
+    node = aexpr_findname(ID_name);
+    if(node == -1)
+        return(image_ID(ID_name));
+
+    prog = (ARITH_EXPR_INSTR*) malloc(sizeof(ARITH_EXPR_INSTR)*2*aexpr_NBnode);
+    depth = aexpr_compile(node, prog, &NBinstr);
+
+    // output geometry : largest input image
+    for(i=0; i<NBinstr; i++)
+        if(prog[i].code == AEXPR_IMAGE)
+        {
+            if((IDref == -1)||(data.image[prog[i].ID].md[0].nelement > data.image[IDref].md[0].nelement))
+                IDref = prog[i].ID;
+            if(data.image[prog[i].ID].md[0].atype == _DATATYPE_DOUBLE)
+                atypeout = _DATATYPE_DOUBLE;
+        }
+
+    nelement = data.image[IDref].md[0].nelement;
+    naxis = data.image[IDref].md[0].naxis;
+    xysize = nelement;
+    for(i=0; i<NBinstr; i++)
+        if(prog[i].code == AEXPR_IMAGE)
+        {
+            long nel = data.image[prog[i].ID].md[0].nelement;
+
+            if(nel != nelement)
+            {
+                if((naxis == 3)&&(nel == data.image[IDref].md[0].size[0]*data.image[IDref].md[0].size[1]))
+                {
+                    prog[i].bcast = 1;
+                    xysize = nel;
+                }
+                else
+                {
+                    printERROR(__FILE__,__func__,__LINE__,"image sizes do not match");
+                    free(prog);
+                    data.parseerror = 1;
+                    return(-1);
+                }
+            }
+        }
+
+    naxes = (uint32_t*) malloc(sizeof(uint32_t)*naxis);
+    for(i=0; i<naxis; i++)
+        naxes[i] = data.image[IDref].md[0].size[i];
+    IDout = create_image_ID(ID_name, naxis, naxes, atypeout, data.SHARED_DFT, data.NBKEWORD_DFT);
+    free(naxes);
+
+    // the name now refers to a real image
+    aexpr_node[node].name[0] = '\0';
+
+    nslice = nelement/xysize;
+    NBblk_slice = (xysize + ARITH_EXPR_BLOCK - 1)/ARITH_EXPR_BLOCK;
+    NBblk = nslice*NBblk_slice;
+
+# ifdef _OPENMP
+    #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT) private(n, i)
+    {
+# endif
+    double *stack = (double*) malloc(sizeof(double)*depth*ARITH_EXPR_BLOCK);
+    long blk;
+
+# ifdef _OPENMP
+    #pragma omp for schedule(static)
+# endif
+    for(blk=0; blk<NBblk; blk++)
+    {
+        long offset = (blk % NBblk_slice)*ARITH_EXPR_BLOCK;
+        long base = (blk / NBblk_slice)*xysize + offset;
+        long k;
+        int sp = 0;
+        double *restrict x;
+        double *restrict y;
+
+        n = xysize - offset;
+        if(n > ARITH_EXPR_BLOCK)
+            n = ARITH_EXPR_BLOCK;
+
+        for(i=0; i<NBinstr; i++)
+        {
+            const ARITH_EXPR_INSTR *in = &prog[i];
+            double c0 = in->c0;
+            double c1 = in->c1;
+
+            x = stack + (sp-1)*ARITH_EXPR_BLOCK;
+            y = stack + sp*ARITH_EXPR_BLOCK;
+            switch(in->code) {
+            case AEXPR_IMAGE :
+                aexpr_load(y, in->ID, in->bcast ? offset : base, n);
+                sp++;
+                break;
+            case AEXPR_CST :
+                ARITH_EXPR_SIMD for(k=0; k<n; k++) y[k] = c0;
+                sp++;
+                break;
+            case AEXPR_ADD :
+                y = x;
+                x = stack + (sp-2)*ARITH_EXPR_BLOCK;
+                ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] += y[k];
+                sp--;
+                break;
+            case AEXPR_SUB :
+                y = x;
+                x = stack + (sp-2)*ARITH_EXPR_BLOCK;
+                ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] -= y[k];
+                sp--;
+                break;
+            case AEXPR_MUL :
+                y = x;
+                x = stack + (sp-2)*ARITH_EXPR_BLOCK;
+                ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] *= y[k];
+                sp--;
+                break;
+            case AEXPR_DIV :
+                y = x;
+                x = stack + (sp-2)*ARITH_EXPR_BLOCK;
+                ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] /= y[k];
+                sp--;
+                break;
+            case AEXPR_ADDC : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] += c0; break;
+            case AEXPR_SUBC : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] -= c0; break;
+            case AEXPR_CSUB : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = c0 - x[k]; break;
+            case AEXPR_MULC : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] *= c0; break;
+            case AEXPR_DIVC : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] /= c0; break;
+            case AEXPR_CDIV : ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = c0 / x[k]; break;
+            case AEXPR_POWC :
+                if(fabs(c0) == 2.0)
+                {
+                    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] *= x[k];
+                }
+                else
+                {
+                    c0 = fabs(c0);
+                    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = pow(x[k], c0);
+                }
+                break;
+            case AEXPR_F1 :
+                aexpr_func1(x, n, in->fn, in->f1);
+                break;
+            case AEXPR_F2C :
+                if(in->fn == AEXPR_FN_ATAN2)
+                {
+                    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = atan2(x[k], c0);
+                }
+                else
+                    for(k=0; k<n; k++) x[k] = in->f2(x[k], c0);
+                break;
+            case AEXPR_F3C :
+                if(in->fn == AEXPR_FN_TRUNC)
+                {
+                    ARITH_EXPR_SIMD for(k=0; k<n; k++) x[k] = (x[k] > c1) ? c1 : ((x[k] < c0) ? c0 : x[k]);
+                }
+                else
+                    for(k=0; k<n; k++) x[k] = in->f3(x[k], c0, c1);
+                break;
+            }
+        }
+
+        x = stack;
+        if(atypeout == _DATATYPE_FLOAT)
+        {
+            float *restrict out = data.image[IDout].array.F + base;
+            ARITH_EXPR_SIMD for(k=0; k<n; k++) out[k] = (float) x[k];
+        }
+        else
+        {
+            double *restrict out = data.image[IDout].array.D + base;
+            ARITH_EXPR_SIMD for(k=0; k<n; k++) out[k] = x[k];
+        }
+    }
+
+    free(stack);
+# ifdef _OPENMP
+    }
+# endif
+
+    free(prog);
+
+    return(IDout);
+}
+
+
+
+
+
 int isoperand(const char *word)
 {
   int value = 0;
@@ -28,6 +28,8 @@ double arith_image_mean(const char *ID_name);
 double arith_image_min(const char *ID_name);
 double arith_image_max(const char *ID_name);
 
+int arith_array_percentiles(double *array, long nelement, const double *fractions, long NBfrac, double *values);
+int arith_image_percentiles(const char *ID_name, const double *fractions, long NBfrac, double *values);
 double arith_image_percentile(const char *ID_name, double fraction);
 double arith_image_median(const char *ID_name);
 
@@ -119,12 +121,48 @@ int arith_image_tanh_inplace(const char *ID_name);
 
 
 /* Functions for bison / flex    */ 
+/* elementwise math wrappers */
+double Pacos(double a);
+double Pasin(double a);
+double Patan(double a);
+double Pceil(double a);
+double Pcos(double a);
+double Pcosh(double a);
+double Pexp(double a);
+double Pfabs(double a);
+double Pfloor(double a);
+double Pln(double a);
+double Plog(double a);
+double Psqrt(double a);
+double Psin(double a);
+double Psinh(double a);
+double Ptan(double a);
+double Ptanh(double a);
+double Pfmod(double a, double b);
+double Ppow(double a, double b);
+double Padd(double a, double b);
+double Psubm(double a, double b);
+double Psub(double a, double b);
+double Pmult(double a, double b);
+double Pdiv(double a, double b);
+double Pdiv1(double a, double b);
+double Pminv(double a, double b);
+double Pmaxv(double a, double b);
 double Ppositive(double a);
 double Ptrunc(double a, double b, double c);
 int arith_image_function_im_im__d_d(const char *ID_name, const char *ID_out, double (*pt2function)(double));
 int arith_image_function_imd_im__dd_d(const char *ID_name, double v0, const char *ID_out, double (*pt2function)(double, double));
 int arith_image_function_imdd_im__ddd_d(const char *ID_name, double v0, double v1, const char *ID_out, double (*pt2function)(double, double, double));
 
+/* fused expressions : result registered as ID_out, evaluated by arith_expr_materialize */
+void arith_expr_reset();
+int arith_expr_imim(int op, const char *IDa_name, const char *IDb_name, const char *ID_out);
+int arith_expr_imcst(int op, const char *ID_name, double v, int cstfirst, const char *ID_out);
+int arith_expr_func_im(double (*pt2function)(double), const char *ID_name, const char *ID_out);
+int arith_expr_func_imd(double (*pt2function)(double, double), const char *ID_name, double v0, const char *ID_out);
+int arith_expr_func_imdd(double (*pt2function)(double, double, double), const char *ID_name, double v0, double v1, const char *ID_out);
+long arith_expr_materialize(const char *ID_name);
+
 
 /* ------------------------------------------------------------------------- */
 /* predefined functions    image, image  -> image                                                    */
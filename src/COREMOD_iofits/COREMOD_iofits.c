@@ -17,12 +17,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 
 #include "CLIcore.h"
 #include "00CORE/00CORE.h"
 #include "COREMOD_iofits/COREMOD_iofits.h"
 #include "COREMOD_memory/COREMOD_memory.h"
+#include "ImageStreamIO/ImageStreamIO.h"
 
 
 #define SBUFFERSIZE 1000
@@ -401,6 +405,881 @@ int data_type_code(int bitpix)
 
 
 
+//
+// Direct path for simple uncompressed FITS files (primary HDU only, no scaling) :
+//   BITPIX -32 <-> FLOAT, -64 <-> DOUBLE, 16 with BZERO=32768 <-> UINT16, 16 (save only) <- INT16
+// Data is read / written as one block and byte-swapped in place by a parallel pass.
+// Local images are mapped from the file (private mapping, ImageStreamIO_arraymap) : on big-endian
+// hosts data is never copied, on little-endian hosts pages are copied only when swapped.
+// Anything else falls back to cfitsio.
+//
+
+#define IOFITS_BLOCK 2880
+#define IOFITS_RAW_MAXHEADERBLOCK 10000
+#define IOFITS_RAW_CHUNK 8388608            // write buffer size [byte]
+
+
+static int iofits_littleendian()
+{
+    uint16_t one = 1;
+
+    return(*((uint8_t*) &one) == 1);
+}
+
+
+
+// FITS (big-endian) <-> host, in place
+// flipsign : toggle 16-bit sign bit (BZERO = 32768 unsigned), 1 : FITS -> host, 2 : host -> FITS
+static void iofits_swap(void *array, long nelement, int typesize, int flipsign)
+{
+    long ii;
+
+    if(typesize == 2)
+    {
+        uint16_t *a = (uint16_t*) array;
+        uint16_t flip = (flipsign != 0) ? 0x8000 : 0;
+
+        if(iofits_littleendian())
+        {
+            // sign bit toggled in host byte order
+            uint16_t preflip = (flipsign == 2) ? 0x8000 : 0;
+            uint16_t postflip = (flipsign == 1) ? 0x8000 : 0;
+
+# ifdef _OPENMP
+            #pragma omp parallel for simd if (nelement > 1000000)
+# endif
+            for(ii=0; ii<nelement; ii++)
+                a[ii] = __builtin_bswap16(a[ii] ^ preflip) ^ postflip;
+        }
+        else if(flip != 0)
+            for(ii=0; ii<nelement; ii++)
+                a[ii] ^= flip;
+        return;
+    }
+
+    if(!iofits_littleendian())
+        return;
+
+    if(typesize == 4)
+    {
+        uint32_t *a = (uint32_t*) array;
+
+# ifdef _OPENMP
+        #pragma omp parallel for simd if (nelement > 1000000)
+# endif
+        for(ii=0; ii<nelement; ii++)
+            a[ii] = __builtin_bswap32(a[ii]);
+    }
+    if(typesize == 8)
+    {
+        uint64_t *a = (uint64_t*) array;
+
+# ifdef _OPENMP
+        #pragma omp parallel for simd if (nelement > 1000000)
+# endif
+        for(ii=0; ii<nelement; ii++)
+            a[ii] = __builtin_bswap64(a[ii]);
+    }
+}
+
+
+
+// value field of header card as string, NULL if card has no value
+static const char *iofits_cardvalue(const char *card, const char *keyword)
+{
+    size_t n = strlen(keyword);
+    size_t i;
+
+    if(strncmp(card, keyword, n) != 0)
+        return(NULL);
+    for(i=n; i<8; i++)
+        if(card[i] != ' ')
+            return(NULL);
+    if((card[8] != '=')||(card[9] != ' '))
+        return(NULL);
+
+    return(card+10);
+}
+
+
+
+// parses primary header, returns 0 if file qualifies for direct read
+static int iofits_raw_header(int fd, int *bitpix, long *naxis, uint32_t *naxes, double *bscale, double *bzero, off_t *dataoffset)
+{
+    char block[IOFITS_BLOCK+1];
+    char card[81];
+    long b, c;
+    int simple = 0;
+    int end = 0;
+
+    *bitpix = 0;
+    *naxis = -1;
+    *bscale = 1.0;
+    *bzero = 0.0;
+    naxes[0] = naxes[1] = naxes[2] = 1;
+
+    for(b=0; (b<IOFITS_RAW_MAXHEADERBLOCK)&&(end==0); b++)
+    {
+        if(pread(fd, block, IOFITS_BLOCK, (off_t) b*IOFITS_BLOCK) != IOFITS_BLOCK)
+            return(-1);
+
+        for(c=0; c<IOFITS_BLOCK/80; c++)
+        {
+            const char *v;
+
+            memcpy(card, block+80*c, 80);
+            card[80] = '\0';
+
+            if((b == 0)&&(c == 0))
+            {
+                v = iofits_cardvalue(card, "SIMPLE");
+                if(v == NULL)
+                    return(-1);
+                while(*v == ' ')
+                    v++;
+                simple = (*v == 'T');
+                continue;
+            }
+
+            if((strncmp(card, "END", 3) == 0)&&(strspn(card+3, " ") == 77))
+            {
+                end = 1;
+                break;
+            }
+
+            if((v = iofits_cardvalue(card, "BITPIX")) != NULL)
+                *bitpix = (int) strtol(v, NULL, 10);
+            else if((v = iofits_cardvalue(card, "NAXIS")) != NULL)
+                *naxis = strtol(v, NULL, 10);
+            else if((strncmp(card, "NAXIS", 5) == 0)&&(card[5] >= '1')&&(card[5] <= '9')&&(card[6] == ' ')&&(card[8] == '='))
+            {
+                int i = card[5]-'1';
+
+                if(i > 2)
+                    return(-1);
+                naxes[i] = (uint32_t) strtol(card+10, NULL, 10);
+            }
+            else if((v = iofits_cardvalue(card, "BSCALE")) != NULL)
+                *bscale = strtod(v, NULL);
+            else if((v = iofits_cardvalue(card, "BZERO")) != NULL)
+                *bzero = strtod(v, NULL);
+            else if((v = iofits_cardvalue(card, "ZIMAGE")) != NULL)
+                return(-1);
+        }
+    }
+
+    if((simple == 0)||(end == 0)||(*naxis < 1)||(*naxis > 3))
+        return(-1);
+    *dataoffset = (off_t) b*IOFITS_BLOCK;
+
+    return(0);
+}
+
+
+
+// pread / write of large blocks (single call limited to ~2GB)
+static int iofits_preadall(int fd, void *buf, size_t nbbyte, off_t offset)
+{
+    char *p = (char*) buf;
+
+    while(nbbyte > 0)
+    {
+        ssize_t r = pread(fd, p, nbbyte, offset);
+
+        if(r <= 0)
+            return(-1);
+        p += r;
+        offset += r;
+        nbbyte -= (size_t) r;
+    }
+    return(0);
+}
+
+static int iofits_writeall(int fd, const void *buf, size_t nbbyte)
+{
+    const char *p = (const char*) buf;
+
+    while(nbbyte > 0)
+    {
+        ssize_t r = write(fd, p, nbbyte);
+
+        if(r <= 0)
+            return(-1);
+        p += r;
+        nbbyte -= (size_t) r;
+    }
+    return(0);
+}
+
+
+
+// returns image ID, -1 if file does not qualify (caller uses cfitsio)
+static long load_fits_raw(const char *file_name, const char *ID_name)
+{
+    int fd;
+    int bitpix;
+    long naxis, i;
+    uint32_t naxes[3];
+    double bscale, bzero;
+    off_t dataoffset;
+    uint8_t atype;
+    int typesize;
+    int flipsign = 0;
+    long nelement;
+    struct stat st;
+    long ID;
+    int existed;
+
+
+    // cfitsio extended file name syntax or compressed file
+    if((strchr(file_name, '[') != NULL)||(file_name[0] == '!')||(strstr(file_name, ".gz") != NULL)||(strstr(file_name, ".fz") != NULL))
+        return(-1);
+
+    fd = open(file_name, O_RDONLY);
+    if(fd == -1)
+        return(-1);
+
+    if((iofits_raw_header(fd, &bitpix, &naxis, naxes, &bscale, &bzero, &dataoffset) != 0)||(bscale != 1.0))
+    {
+        close(fd);
+        return(-1);
+    }
+    if((bitpix == -32)&&(bzero == 0.0))
+    {
+        atype = _DATATYPE_FLOAT;
+        typesize = 4;
+    }
+    else if((bitpix == -64)&&(bzero == 0.0))
+    {
+        atype = _DATATYPE_DOUBLE;
+        typesize = 8;
+    }
+    else if((bitpix == 16)&&(bzero == 32768.0))
+    {
+        atype = _DATATYPE_UINT16;
+        typesize = 2;
+        flipsign = 1;
+    }
+    else
+    {
+        close(fd);
+        return(-1);
+    }
+
+    nelement = 1;
+    for(i=0; i<naxis; i++)
+        nelement *= naxes[i];
+    if((fstat(fd, &st) != 0)||(st.st_size < dataoffset + (off_t) nelement*typesize))
+    {
+        close(fd);
+        return(-1);
+    }
+
+    printf("[%ld", (long) naxes[0]);
+    for(i=1; i<naxis; i++)
+        printf(",%ld", (long) naxes[i]);
+    printf("] %d %f %f\n", bitpix, bscale, bzero);
+    fflush(stdout);
+
+    existed = (image_ID(ID_name) != -1);
+    ID = create_image_ID_flags(ID_name, naxis, naxes, atype, data.SHARED_DFT, data.NBKEWORD_DFT, IMAGE_FLAG_NOZERO);
+
+    if((existed == 1)||(data.image[ID].md[0].shared == 1)||(ImageStreamIO_arraymap(&data.image[ID], fd, dataoffset) != 0))
+        if(iofits_preadall(fd, data.image[ID].array.UI8, (size_t) nelement*typesize, dataoffset) != 0)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "read error");
+            close(fd);
+            return(ID);
+        }
+    close(fd);
+
+    iofits_swap(data.image[ID].array.UI8, nelement, typesize, flipsign);
+
+    return(ID);
+}
+
+
+
+static int iofits_writecard(char *header, int *NBcard, const char *keyword, const char *value, const char *comment)
+{
+    char card[82];
+
+    snprintf(card, 82, "%-8.8s= %20s / %-47.47s", keyword, value, comment);
+    memcpy(header + 80*(*NBcard), card, 80);
+    (*NBcard)++;
+
+    return(0);
+}
+
+
+
+// writes FLOAT, DOUBLE, UINT16, INT16 image to new file file_name (no '!' prefix)
+// returns 0 if written, -1 if image does not qualify (caller uses cfitsio)
+static int save_fits_raw(long ID, const char *file_name)
+{
+    char header[IOFITS_BLOCK];
+    char value[32];
+    char keyword[16];
+    int NBcard = 0;
+    int bitpix, typesize;
+    int flipsign = 0;
+    long naxis, nelement, i;
+    size_t nbbyte, pad;
+    int fd;
+    int err = 0;
+
+    switch(data.image[ID].md[0].atype) {
+    case _DATATYPE_FLOAT:
+        bitpix = -32;
+        typesize = 4;
+        break;
+    case _DATATYPE_DOUBLE:
+        bitpix = -64;
+        typesize = 8;
+        break;
+    case _DATATYPE_UINT16:
+        bitpix = 16;
+        typesize = 2;
+        flipsign = 1;
+        break;
+    case _DATATYPE_INT16:
+        bitpix = 16;
+        typesize = 2;
+        break;
+    default:
+        return(-1);
+    }
+    naxis = data.image[ID].md[0].naxis;
+    if((naxis < 1)||(naxis > 3))
+        return(-1);
+
+    memset(header, ' ', IOFITS_BLOCK);
+    iofits_writecard(header, &NBcard, "SIMPLE", "T", "file does conform to FITS standard");
+    snprintf(value, 32, "%d", bitpix);
+    iofits_writecard(header, &NBcard, "BITPIX", value, "number of bits per data pixel");
+    snprintf(value, 32, "%ld", naxis);
+    iofits_writecard(header, &NBcard, "NAXIS", value, "number of data axes");
+    nelement = 1;
+    for(i=0; i<naxis; i++)
+    {
+        snprintf(keyword, 16, "NAXIS%ld", i+1);
+        snprintf(value, 32, "%ld", (long) data.image[ID].md[0].size[i]);
+        iofits_writecard(header, &NBcard, keyword, value, "length of data axis");
+        nelement *= data.image[ID].md[0].size[i];
+    }
+    iofits_writecard(header, &NBcard, "EXTEND", "T", "FITS dataset may contain extensions");
+    if(flipsign == 1)
+    {
+        iofits_writecard(header, &NBcard, "BZERO", "32768", "offset data range to that of unsigned short");
+        iofits_writecard(header, &NBcard, "BSCALE", "1", "default scaling factor");
+    }
+    memcpy(header + 80*NBcard, "END", 3);
+
+    fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create file");
+        return(-1);
+    }
+    if(iofits_writeall(fd, header, IOFITS_BLOCK) != 0)
+        err = 1;
+
+    nbbyte = (size_t) nelement*typesize;
+    if((!iofits_littleendian())&&(flipsign == 0))
+    {
+        // native byte order : data region written as is
+        if((err == 0)&&(iofits_writeall(fd, data.image[ID].array.UI8, nbbyte) != 0))
+            err = 1;
+    }
+    else
+    {
+        char *buf = (char*) malloc(IOFITS_RAW_CHUNK);
+        size_t off;
+
+        for(off=0; (off<nbbyte)&&(err==0); off+=IOFITS_RAW_CHUNK)
+        {
+            size_t n = (nbbyte-off < IOFITS_RAW_CHUNK) ? nbbyte-off : IOFITS_RAW_CHUNK;
+
+            memcpy(buf, data.image[ID].array.UI8 + off, n);
+            iofits_swap(buf, n/typesize, typesize, 2*flipsign);
+            if(iofits_writeall(fd, buf, n) != 0)
+                err = 1;
+        }
+        free(buf);
+    }
+
+    pad = (IOFITS_BLOCK - nbbyte % IOFITS_BLOCK) % IOFITS_BLOCK;
+    memset(header, 0, IOFITS_BLOCK);
+    if((err == 0)&&(iofits_writeall(fd, header, pad) != 0))
+        err = 1;
+    if(close(fd) != 0)
+        err = 1;
+
+    if(err == 1)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "write error");
+        return(-1);
+    }
+
+    return(0);
+}
+
+
+
+
+
+
+//
+// Thread-safe reads into caller arrays (no image created, cfitsio status kept local).
+// cfitsio calls are serialized if the library was not built reentrant.
+//
+
+static pthread_mutex_t iofits_cfitsio_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void iofits_cfitsio_lock()
+{
+    if(fits_is_reentrant() == 0)
+        pthread_mutex_lock(&iofits_cfitsio_mutex);
+}
+
+static void iofits_cfitsio_unlock()
+{
+    if(fits_is_reentrant() == 0)
+        pthread_mutex_unlock(&iofits_cfitsio_mutex);
+}
+
+
+
+/**
+ * Reads image size of primary HDU, and optionally value of header keyword (keyvalue : FLEN_VALUE chars,
+ * empty string if keyword is missing). keyword may be NULL.
+ * Returns 0 if OK, FITSIO error code otherwise.
+ */
+int read_fits_imsize(const char *file_name, long *naxis, uint32_t *naxes, const char *keyword, char *keyvalue)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    int naxisi = 0;
+    long naxesl[3] = {1, 1, 1};
+    long i;
+
+    iofits_cfitsio_lock();
+    fits_open_file(&fptr, file_name, READONLY, &status);
+    fits_get_img_dim(fptr, &naxisi, &status);
+    if((status == 0)&&((naxisi < 1)||(naxisi > 3)))
+        status = BAD_NAXIS;
+    fits_get_img_size(fptr, 3, naxesl, &status);
+    if((keyword != NULL)&&(status == 0))
+    {
+        int kstatus = 0;
+
+        if(fits_read_keyword(fptr, keyword, keyvalue, NULL, &kstatus) != 0)
+            keyvalue[0] = '\0';
+    }
+    if(fptr != NULL)
+    {
+        int cstatus = 0;
+        fits_close_file(fptr, &cstatus);
+    }
+    iofits_cfitsio_unlock();
+
+    *naxis = naxisi;
+    for(i=0; i<3; i++)
+        naxes[i] = (uint32_t) ((i < naxisi) ? naxesl[i] : 1);
+
+    return(status);
+}
+
+
+
+/**
+ * Reads primary HDU data of file_name into float array (nelement values, scaling applied).
+ * Simple uncompressed float files are read directly, others through cfitsio.
+ * Returns 0 if OK.
+ */
+int load_fits_array_float(const char *file_name, float *array, long nelement)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    int nulval = 0;
+    int anynul = 0;
+    int fd;
+
+    if((strchr(file_name, '[') == NULL)&&((fd = open(file_name, O_RDONLY)) != -1))
+    {
+        int bitpix;
+        long naxis, i, n;
+        uint32_t naxes[3];
+        double bscale, bzero;
+        off_t dataoffset;
+        int ok = 0;
+
+        if((iofits_raw_header(fd, &bitpix, &naxis, naxes, &bscale, &bzero, &dataoffset) == 0)
+                &&(bitpix == -32)&&(bscale == 1.0)&&(bzero == 0.0))
+        {
+            n = 1;
+            for(i=0; i<naxis; i++)
+                n *= naxes[i];
+            if((n == nelement)&&(iofits_preadall(fd, array, sizeof(float)*nelement, dataoffset) == 0))
+            {
+                iofits_swap(array, nelement, 4, 0);
+                ok = 1;
+            }
+        }
+        close(fd);
+        if(ok == 1)
+            return(0);
+    }
+
+    iofits_cfitsio_lock();
+    fits_open_file(&fptr, file_name, READONLY, &status);
+    fits_read_img(fptr, TFLOAT, 1, nelement, &nulval, array, &anynul, &status);
+    if(fptr != NULL)
+    {
+        int cstatus = 0;
+        fits_close_file(fptr, &cstatus);
+    }
+    iofits_cfitsio_unlock();
+
+    return(status);
+}
+
+
+
+
+
+
+//
+// Slice streaming : read / write a cube a few slices at a time, without holding it in memory.
+// Reads and writes at explicit offsets, so distinct slice ranges may be processed from several threads.
+//
+
+struct FITS_SLICEREADER
+{
+    int fd;                  // direct access, -1 if cfitsio is used
+    fitsfile *fptr;
+    pthread_mutex_t mutex;   // serializes cfitsio access to fptr
+    int bitpix;
+    int typesize;
+    double bscale;
+    double bzero;
+    off_t dataoffset;
+    long slicesize;          // pixels per slice
+    long NBslice;
+};
+
+struct FITS_SLICEWRITER
+{
+    int fd;
+    off_t dataoffset;
+    long slicesize;
+    long NBslice;
+};
+
+
+
+/**
+ * Opens FITS cube file_name for slice streaming. naxis and naxes (3 values) receive the image size;
+ * a 2D image is a single slice. Any BITPIX and scaling is accepted, values are returned as float.
+ * Returns NULL if the file cannot be opened.
+ */
+FITS_SLICEREADER *fits_slicereader_open(const char *file_name, long *naxis, uint32_t *naxes)
+{
+    FITS_SLICEREADER *rd;
+    long naxisl;
+    int status = 0;
+
+    rd = (FITS_SLICEREADER*) malloc(sizeof(FITS_SLICEREADER));
+    if(rd == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+    rd->fd = -1;
+    rd->fptr = NULL;
+    pthread_mutex_init(&rd->mutex, NULL);
+
+    if((strchr(file_name, '[') == NULL)&&((rd->fd = open(file_name, O_RDONLY)) != -1))
+    {
+        if(iofits_raw_header(rd->fd, &rd->bitpix, &naxisl, naxes, &rd->bscale, &rd->bzero, &rd->dataoffset) == 0)
+            rd->typesize = ((rd->bitpix < 0) ? -rd->bitpix : rd->bitpix)/8;
+        else
+        {
+            close(rd->fd);
+            rd->fd = -1;
+        }
+    }
+
+    if(rd->fd == -1)
+    {
+        int naxisi = 0;
+        long naxesl[3] = {1, 1, 1};
+        long i;
+
+        iofits_cfitsio_lock();
+        fits_open_file(&rd->fptr, file_name, READONLY, &status);
+        fits_get_img_dim(rd->fptr, &naxisi, &status);
+        if((status == 0)&&((naxisi < 1)||(naxisi > 3)))
+            status = BAD_NAXIS;
+        fits_get_img_size(rd->fptr, 3, naxesl, &status);
+        if((status != 0)&&(rd->fptr != NULL))
+        {
+            int cstatus = 0;
+            fits_close_file(rd->fptr, &cstatus);
+        }
+        iofits_cfitsio_unlock();
+
+        if(status != 0)
+        {
+            pthread_mutex_destroy(&rd->mutex);
+            free(rd);
+            return(NULL);
+        }
+        naxisl = naxisi;
+        for(i=0; i<3; i++)
+            naxes[i] = (uint32_t) ((i < naxisi) ? naxesl[i] : 1);
+    }
+
+    *naxis = naxisl;
+    rd->slicesize = (long) naxes[0]*naxes[1];
+    rd->NBslice = naxes[2];
+
+    if(rd->fd != -1)
+        posix_fadvise(rd->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return(rd);
+}
+
+
+
+/**
+ * Reads NBslice slices starting at slice k0 into array (float, BSCALE/BZERO applied).
+ * Returns 0 if OK.
+ */
+int fits_slicereader_read(FITS_SLICEREADER *rd, long k0, long NBslice, float *array)
+{
+    long nelement = NBslice*rd->slicesize;
+    long ii;
+    void *buf;
+
+    if((k0 < 0)||(k0+NBslice > rd->NBslice))
+        return(-1);
+
+    if(rd->fd == -1)
+    {
+        int status = 0;
+        int anynul = 0;
+        float nulval = 0.0;
+
+        pthread_mutex_lock(&rd->mutex);
+        iofits_cfitsio_lock();
+        fits_read_img(rd->fptr, TFLOAT, (LONGLONG) k0*rd->slicesize+1, (LONGLONG) nelement, &nulval, array, &anynul, &status);
+        iofits_cfitsio_unlock();
+        pthread_mutex_unlock(&rd->mutex);
+
+        return(status);
+    }
+
+    // raw bytes of up to 4 byte types are converted in place, from the end of array
+    if(rd->typesize <= 4)
+        buf = (char*) array + sizeof(float)*nelement - (size_t) rd->typesize*nelement;
+    else if((buf = malloc((size_t) rd->typesize*nelement)) == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+    if(iofits_preadall(rd->fd, buf, (size_t) rd->typesize*nelement, rd->dataoffset + (off_t) k0*rd->slicesize*rd->typesize) != 0)
+    {
+        if(rd->typesize > 4)
+            free(buf);
+        return(-1);
+    }
+    iofits_swap(buf, nelement, rd->typesize, 0);
+
+    switch(rd->bitpix) {
+    case 8:
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = (float) ((uint8_t*) buf)[ii];
+        break;
+    case 16:
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = (float) ((int16_t*) buf)[ii];
+        break;
+    case 32:
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = (float) ((int32_t*) buf)[ii];
+        break;
+    case 64:
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = (float) ((int64_t*) buf)[ii];
+        break;
+    case -64:
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = (float) ((double*) buf)[ii];
+        break;
+    }
+    if(rd->typesize > 4)
+        free(buf);
+
+    if((rd->bscale != 1.0)||(rd->bzero != 0.0))
+    {
+        float bscale = (float) rd->bscale;
+        float bzero = (float) rd->bzero;
+
+        for(ii=0; ii<nelement; ii++)
+            array[ii] = bscale*array[ii] + bzero;
+    }
+
+    return(0);
+}
+
+
+
+void fits_slicereader_close(FITS_SLICEREADER *rd)
+{
+    if(rd->fd != -1)
+        close(rd->fd);
+    if(rd->fptr != NULL)
+    {
+        int status = 0;
+
+        iofits_cfitsio_lock();
+        fits_close_file(rd->fptr, &status);
+        iofits_cfitsio_unlock();
+    }
+    pthread_mutex_destroy(&rd->mutex);
+    free(rd);
+}
+
+
+
+/**
+ * Creates float cube file_name (overwritten if it exists) to be filled by fits_slicewriter_write.
+ * Returns NULL if the file cannot be created.
+ */
+FITS_SLICEWRITER *fits_slicewriter_open(const char *file_name, uint32_t xsize, uint32_t ysize, uint32_t zsize)
+{
+    FITS_SLICEWRITER *wr;
+    char header[IOFITS_BLOCK];
+    char value[32];
+    int NBcard = 0;
+
+    memset(header, ' ', IOFITS_BLOCK);
+    iofits_writecard(header, &NBcard, "SIMPLE", "T", "file does conform to FITS standard");
+    iofits_writecard(header, &NBcard, "BITPIX", "-32", "number of bits per data pixel");
+    iofits_writecard(header, &NBcard, "NAXIS", "3", "number of data axes");
+    snprintf(value, 32, "%ld", (long) xsize);
+    iofits_writecard(header, &NBcard, "NAXIS1", value, "length of data axis");
+    snprintf(value, 32, "%ld", (long) ysize);
+    iofits_writecard(header, &NBcard, "NAXIS2", value, "length of data axis");
+    snprintf(value, 32, "%ld", (long) zsize);
+    iofits_writecard(header, &NBcard, "NAXIS3", value, "length of data axis");
+    iofits_writecard(header, &NBcard, "EXTEND", "T", "FITS dataset may contain extensions");
+    memcpy(header + 80*NBcard, "END", 3);
+
+    wr = (FITS_SLICEWRITER*) malloc(sizeof(FITS_SLICEWRITER));
+    if(wr == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+    wr->fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if((wr->fd == -1)||(iofits_writeall(wr->fd, header, IOFITS_BLOCK) != 0))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create file");
+        if(wr->fd != -1)
+            close(wr->fd);
+        free(wr);
+        return(NULL);
+    }
+    wr->dataoffset = IOFITS_BLOCK;
+    wr->slicesize = (long) xsize*ysize;
+    wr->NBslice = zsize;
+
+    return(wr);
+}
+
+
+
+/**
+ * Writes NBslice slices starting at slice k0. Returns 0 if OK.
+ */
+int fits_slicewriter_write(FITS_SLICEWRITER *wr, long k0, long NBslice, const float *array)
+{
+    long nelement = NBslice*wr->slicesize;
+    off_t offset = wr->dataoffset + (off_t) sizeof(float)*k0*wr->slicesize;
+    char *buf;
+    long off;
+    int err = 0;
+
+    if((k0 < 0)||(k0+NBslice > wr->NBslice))
+        return(-1);
+
+    buf = (char*) malloc(IOFITS_RAW_CHUNK);
+    if(buf == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+    for(off=0; (off<(long) sizeof(float)*nelement)&&(err==0); off+=IOFITS_RAW_CHUNK)
+    {
+        size_t n = ((long) sizeof(float)*nelement-off < IOFITS_RAW_CHUNK) ? (size_t) sizeof(float)*nelement-off : IOFITS_RAW_CHUNK;
+        const char *p = buf;
+        off_t o = offset + off;
+
+        memcpy(buf, (const char*) array + off, n);
+        iofits_swap(buf, n/sizeof(float), sizeof(float), 0);
+        while(n > 0)
+        {
+            ssize_t r = pwrite(wr->fd, p, n, o);
+
+            if(r <= 0)
+            {
+                err = 1;
+                break;
+            }
+            p += r;
+            o += r;
+            n -= (size_t) r;
+        }
+    }
+    free(buf);
+
+    return(err == 0) ? 0 : -1;
+}
+
+
+
+/**
+ * Pads data to a full FITS block and closes the file. Returns 0 if OK.
+ */
+int fits_slicewriter_close(FITS_SLICEWRITER *wr)
+{
+    off_t end = wr->dataoffset + (off_t) sizeof(float)*wr->NBslice*wr->slicesize;
+    off_t pad = (IOFITS_BLOCK - end % IOFITS_BLOCK) % IOFITS_BLOCK;
+    int err = 0;
+
+    // zero-filled padding; slices never written read as zero
+    if(ftruncate(wr->fd, end + pad) != 0)
+        err = 1;
+    if(close(wr->fd) != 0)
+        err = 1;
+    free(wr);
+
+    if(err == 1)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "write error");
+        return(-1);
+    }
+
+    return(0);
+}
+
+
+
+
+
+
 /// if errcode = 0, do not show error messages
 /// errcode = 1: print error, continue
 /// errcode = 2: exit program at error
@@ -437,6 +1316,10 @@ long load_fits(const char *file_name, const char *ID_name, int errcode)
     naxes[1] = 0;
     naxes[2] = 0;
 
+    // simple uncompressed native-type file : direct read
+    ID = load_fits_raw(file_name, ID_name);
+    if(ID != -1)
+        return(ID);
 
 
 
@@ -1572,6 +2455,7 @@ int save_fits_atomic(const char *ID_name, const char *file_name)
 		char command[2000];
 		
         atype = data.image[ID].md[0].atype;
+        if(save_fits_raw(ID, fnametmp) != 0)
         switch(atype) {
         case _DATATYPE_UINT8:
             save_ush_fits(ID_name, savename);
@@ -1690,72 +2574,66 @@ int break_cube(const char *ID_name)
 
 int images_to_cube(const char *img_name, long nbframes, const char *cube_name)
 {
-    long ID,ID1;
+    long ID;
     long frame;
     char imname[SBUFFERSIZE];
     uint32_t naxes[2];
-    long ii,jj;
-    uint32_t xsize, ysize;
+    long *IDframe;
+    long xysize;
     int n;
 
-    frame = 0;
-    n = snprintf(imname,SBUFFERSIZE,"%s%05ld", img_name, frame);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-
-    ID1 = image_ID(imname);
-    if(ID1==-1)
+    // images looked up first, frames then copied in parallel
+    IDframe = (long*) malloc(sizeof(long)*nbframes);
+    for(frame=0; frame<nbframes; frame++)
     {
-        n = snprintf(errormessage_iofits,SBUFFERSIZE,"Image \"%s\" does not exist",imname);
+        n = snprintf(imname,SBUFFERSIZE,"%s%05ld", img_name, frame);
         if(n >= SBUFFERSIZE)
             printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-        printERROR(__FILE__,__func__,__LINE__,errormessage_iofits);
-        exit(0);
-    }
-    naxes[0] = data.image[ID1].md[0].size[0];
-    naxes[1] = data.image[ID1].md[0].size[1];
-    xsize = naxes[0];
-    ysize = naxes[1];
-
-    printf("SIZE = %ld %ld %ld\n", (long) naxes[0], (long) naxes[1], (long) nbframes);
-    fflush(stdout);
-    ID = create_3Dimage_ID(cube_name,naxes[0],naxes[1],nbframes);
-    for (ii = 0; ii < naxes[0]; ii++)
-        for (jj = 0; jj < naxes[1]; jj++)
-            data.image[ID].array.F[frame*naxes[0]*naxes[1]+(jj*naxes[0]+ii)] = data.image[ID1].array.F[jj*naxes[0]+ii];
+        IDframe[frame] = image_ID(imname);
 
-    for(frame=1; frame<nbframes; frame++)
-    {
-        n = snprintf(imname,SBUFFERSIZE,"%s%05ld",img_name,frame);
-        printf("Adding image %s -> %ld/%ld ... ",img_name,frame,nbframes);
-        fflush(stdout);
-        if(n >= SBUFFERSIZE)
-            printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-        ID1 = image_ID(imname);
-        if(ID1==-1)
+        if(IDframe[frame]==-1)
         {
+            if(frame == 0)
+            {
+                n = snprintf(errormessage_iofits,SBUFFERSIZE,"Image \"%s\" does not exist",imname);
+                if(n >= SBUFFERSIZE)
+                    printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
+                printERROR(__FILE__,__func__,__LINE__,errormessage_iofits);
+                exit(0);
+            }
             n = snprintf(errormessage_iofits,SBUFFERSIZE,"Image \"%s\" does not exist - skipping",imname);
             if(n >= SBUFFERSIZE)
                 printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
             printERROR(__FILE__,__func__,__LINE__,errormessage_iofits);
+            continue;
         }
-        else
+
+        if(frame == 0)
         {
-            naxes[0] = data.image[ID1].md[0].size[0];
-            naxes[1] = data.image[ID1].md[0].size[1];
-            if((xsize != naxes[0])||(ysize != naxes[1]))
-            {
-                printERROR(__FILE__,__func__,__LINE__,"Image has wrong size");
-                exit(0);
-            }
-            for (ii = 0; ii < naxes[0]; ii++)
-                for (jj = 0; jj < naxes[1]; jj++)
-                    data.image[ID].array.F[frame*naxes[0]*naxes[1]+(jj*naxes[0]+ii)] = data.image[ID1].array.F[jj*naxes[0]+ii];
+            naxes[0] = data.image[IDframe[0]].md[0].size[0];
+            naxes[1] = data.image[IDframe[0]].md[0].size[1];
+        }
+        else if((data.image[IDframe[frame]].md[0].size[0] != naxes[0])||(data.image[IDframe[frame]].md[0].size[1] != naxes[1]))
+        {
+            printERROR(__FILE__,__func__,__LINE__,"Image has wrong size");
+            exit(0);
         }
-        printf("Done\n");
-        fflush(stdout);
     }
 
+    printf("SIZE = %ld %ld %ld\n", (long) naxes[0], (long) naxes[1], (long) nbframes);
+    fflush(stdout);
+    ID = create_3Dimage_ID(cube_name,naxes[0],naxes[1],nbframes);
+    xysize = (long) naxes[0]*naxes[1];
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+# endif
+    for(frame=0; frame<nbframes; frame++)
+        if(IDframe[frame] != -1)
+            memcpy(data.image[ID].array.F + frame*xysize, data.image[IDframe[frame]].array.F, sizeof(float)*xysize);
+
+    free(IDframe);
+
     return(0);
 }
 
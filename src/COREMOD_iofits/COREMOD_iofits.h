@@ -18,6 +18,21 @@ int data_type_code(int bitpix);
 
 long load_fits(const char *file_name, const char *ID_name, int errcode); 
 
+int read_fits_imsize(const char *file_name, long *naxis, uint32_t *naxes, const char *keyword, char *keyvalue);
+
+int load_fits_array_float(const char *file_name, float *array, long nelement);
+
+typedef struct FITS_SLICEREADER FITS_SLICEREADER;
+typedef struct FITS_SLICEWRITER FITS_SLICEWRITER;
+
+FITS_SLICEREADER *fits_slicereader_open(const char *file_name, long *naxis, uint32_t *naxes);
+int fits_slicereader_read(FITS_SLICEREADER *rd, long k0, long NBslice, float *array);
+void fits_slicereader_close(FITS_SLICEREADER *rd);
+
+FITS_SLICEWRITER *fits_slicewriter_open(const char *file_name, uint32_t xsize, uint32_t ysize, uint32_t zsize);
+int fits_slicewriter_write(FITS_SLICEWRITER *wr, long k0, long NBslice, const float *array);
+int fits_slicewriter_close(FITS_SLICEWRITER *wr);
+
 int save_db_fits(const char *ID_name, const char *file_name);
 
 int save_fl_fits(const char *ID_name, const char *file_name);
@@ -17,6 +17,7 @@
 #define _GNU_SOURCE
 
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <malloc.h>
 #include <stdio.h>
@@ -34,10 +35,16 @@
 #include <errno.h>
 
 #include <semaphore.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <fcntl.h> // for open
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <unistd.h> // for close
 
 
@@ -79,6 +86,8 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 # ifdef _OPENMP
 # include <omp.h>
 #define OMP_NELEMENT_LIMIT 1000000
+#define OMP_NELEMENT_LIMIT_TRANSC 16384  // sin/cos/atan2 kernels: more work per element, threads pay off earlier
+#define MKCPLX_BLOCKSIZE 256             // elements per block in amplitude/phase -> re/im kernels
 # endif
 
 #define STYPESIZE 10
@@ -104,6 +113,44 @@ static int listim_scr_wrow;
 static int listim_scr_wcol;
 
 
+// IMAGE AND VARIABLE INDEX
+// open-addressing hash table: slot holds ID, NAMEINDEX_EMPTY or NAMEINDEX_DELETED
+#define NAMEINDEX_EMPTY   -1
+#define NAMEINDEX_DELETED -2
+
+typedef struct {
+    long *slot;
+    long size;       // number of slots (power of 2), 0 if not allocated
+    long NBdeleted;  // number of deleted slots
+} NAMEINDEX;
+
+typedef struct {
+    long *ID;        // stack of free IDs
+    long NB;         // number of IDs in stack
+    long NBmax;      // size of data array when stack was built
+} IDFREELIST;
+
+// KEYWORD INDEX
+// per-image open-addressing hash table on keyword names: slot holds keyword index or NAMEINDEX_EMPTY
+#define KWINDEX_MINNBKW 8  // images with fewer keywords are scanned linearly
+
+typedef struct {
+    IMAGE_KEYWORD *kw;  // keyword array index was built for, NULL if not built
+    long NBkw;
+    long *slot;
+    long size;          // number of slots (power of 2)
+} KWINDEX;
+
+static NAMEINDEX imageindex = { NULL, 0, 0 };
+static NAMEINDEX variableindex = { NULL, 0, 0 };
+static IDFREELIST imagefreelist = { NULL, 0, 0 };
+static IDFREELIST variablefreelist = { NULL, 0, 0 };
+static int IMAGE_LASTACCESS_UPDATE = 1; // 1 if image_ID() updates md[0].last_access
+static long long IMAGE_ID_NBlookup = 0; // number of image_ID() calls, see COREMOD_MEMORY_image_ID_NBlookup()
+static KWINDEX *kwindex = NULL;      // one entry per image ID
+static long kwindex_NB = 0;
+
+
 extern DATA data;
 
 
@@ -152,6 +199,26 @@ static long tret; // thread return value
 /* =============================================================================================== */
 
 
+int_fast8_t COREMOD_MEMORY_set_lastaccess_update_cli()
+{
+    if(CLI_checkarg(1,2)==0)
+        COREMOD_MEMORY_set_lastaccess_update((int) data.cmdargtoken[1].val.numl);
+    else
+        return 1;
+}
+
+
+
+int_fast8_t COREMOD_MEMORY_image_pool_cli()
+{
+    if(CLI_checkarg(1,2)==0)
+        COREMOD_MEMORY_image_pool((int) data.cmdargtoken[1].val.numl);
+    else
+        return 1;
+}
+
+
+
 int_fast8_t delete_image_ID_cli()
 {
     long i = 1;
@@ -402,6 +469,70 @@ int_fast8_t create_image_shared_cli() // default precision
 
 
 
+/// create ring buffer stream in shared memory, default precision
+int_fast8_t create_image_shared_ring_cli()
+{
+    uint32_t *imsize;
+
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0)
+    {
+        imsize = (uint32_t*) malloc(sizeof(uint32_t)*3);
+        imsize[0] = data.cmdargtoken[2].val.numl;
+        imsize[1] = data.cmdargtoken[3].val.numl;
+        imsize[2] = data.cmdargtoken[4].val.numl;
+        switch(data.precision) {
+        case 0:
+            create_image_ID_flags(data.cmdargtoken[1].val.string, 3, imsize, _DATATYPE_FLOAT, 1, data.NBKEWORD_DFT, IMAGE_FLAG_RING);
+            break;
+        case 1:
+            create_image_ID_flags(data.cmdargtoken[1].val.string, 3, imsize, _DATATYPE_DOUBLE, 1, data.NBKEWORD_DFT, IMAGE_FLAG_RING);
+            break;
+        }
+        free(imsize);
+    }
+    else
+        return 1;
+}
+
+
+
+
+/// create image in shared memory with creation flags (IMAGE_FLAG_*), default precision
+int_fast8_t create_image_shared_flags_cli()
+{
+    uint32_t *imsize;
+    long naxis = 0;
+    long i;
+
+
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,2)+CLI_checkarg(3,2)==0)
+    {
+        naxis = 0;
+        imsize = (uint32_t*) malloc(sizeof(uint32_t)*5);
+        i = 3;
+        while(data.cmdargtoken[i].type==2)
+        {
+            imsize[naxis] = data.cmdargtoken[i].val.numl;
+            naxis++;
+            i++;
+        }
+        switch(data.precision) {
+        case 0:
+            create_image_ID_flags(data.cmdargtoken[1].val.string, naxis, imsize, _DATATYPE_FLOAT, 1, data.NBKEWORD_DFT, (uint16_t) data.cmdargtoken[2].val.numl);
+            break;
+        case 1:
+            create_image_ID_flags(data.cmdargtoken[1].val.string, naxis, imsize, _DATATYPE_DOUBLE, 1, data.NBKEWORD_DFT, (uint16_t) data.cmdargtoken[2].val.numl);
+            break;
+        }
+        free(imsize);
+    }
+    else
+        return 1;
+}
+
+
+
+
 int_fast8_t create_ushort_image_shared_cli() // default precision
 {
     uint32_t *imsize;
@@ -570,6 +701,18 @@ int_fast8_t COREMOD_MEMORY_cp2shm_cli()
 
 
 
+int_fast8_t COREMOD_MEMORY_streamstatus_cli()
+{
+	if(CLI_checkarg(1,5)+CLI_checkarg(2,2)+CLI_checkarg(3,2)==0)
+    {
+        COREMOD_MEMORY_streamstatus(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 int_fast8_t memory_monitor_cli()
 {
   memory_monitor(data.cmdargtoken[1].val.string);
@@ -755,8 +898,8 @@ int_fast8_t COREMOD_MEMORY_image_set_sempost_cli()
 
 int_fast8_t COREMOD_MEMORY_image_set_sempost_loop_cli()
 {
-    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,2)==0)
-        COREMOD_MEMORY_image_set_sempost_loop(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl);
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0)
+        COREMOD_MEMORY_image_set_sempost_loop(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl);
     else
         return 1;
 }
@@ -779,6 +922,14 @@ int_fast8_t COREMOD_MEMORY_image_set_semflush_cli()
         return 1;
 }
 
+int_fast8_t COREMOD_MEMORY_image_set_futex_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)==0)
+        COREMOD_MEMORY_image_set_futex(data.cmdargtoken[1].val.string, (int) data.cmdargtoken[2].val.numl);
+    else
+        return 1;
+}
+
 
 
 
@@ -842,6 +993,30 @@ int_fast8_t COREMOD_MEMORY_streamAve_cli()
 }
 
 
+int_fast8_t COREMOD_MEMORY_streamGraph_cli()
+{
+	if(CLI_checkarg(1,3)+CLI_checkarg(2,2)==0)
+    {
+        COREMOD_MEMORY_streamGraph(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+int_fast8_t COREMOD_MEMORY_streamStats_cli()
+{
+	if(CLI_checkarg(1,4)+CLI_checkarg(2,5)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,1)==0)
+    {
+        COREMOD_MEMORY_streamStats(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 
 
 int_fast8_t COREMOD_MEMORY_image_streamupdateloop_cli()
@@ -872,9 +1047,9 @@ int_fast8_t COREMOD_MEMORY_image_streamupdateloop_semtrig_cli()
 
 int_fast8_t COREMOD_MEMORY_streamDelay_cli()
 {
-    if(CLI_checkarg(1,4)+CLI_checkarg(2,5)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0)
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,5)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)==0)
     {
-        COREMOD_MEMORY_streamDelay(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl);
+        COREMOD_MEMORY_streamDelay(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl);
         return 0;
     }
     else
@@ -910,6 +1085,18 @@ int_fast8_t COREMOD_MEMORY_SaveAll_sequ_cli()
 }
 
 
+int_fast8_t COREMOD_MEMORY_SaveAll_sequ_async_cli()
+{
+	 if(CLI_checkarg(1,5)+CLI_checkarg(2,4)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)==0)
+    {
+        COREMOD_MEMORY_SaveAll_sequ_async(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 
 int_fast8_t COREMOD_MEMORY_image_NETWORKtransmit_cli()
 {
@@ -935,6 +1122,30 @@ int_fast8_t COREMOD_MEMORY_image_NETWORKreceive_cli()
 }
 
 
+int_fast8_t COREMOD_MEMORY_image_NETWORKtransmit_multi_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,3)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)==0)
+    {
+        COREMOD_MEMORY_image_NETWORKtransmit_multi(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+int_fast8_t COREMOD_MEMORY_image_NETWORKreceive_multi_cli()
+{
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)==0)
+    {
+        COREMOD_MEMORY_image_NETWORKreceive_multi(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 
 int_fast8_t COREMOD_MEMORY_PixMapDecode_U_cli()
 {
@@ -1000,6 +1211,30 @@ int_fast8_t COREMOD_MEMORY_logshim_set_logexit_cli()
 
 
 
+int_fast8_t COREMOD_MEMORY_sharedMem_tlog_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,3)+CLI_checkarg(4,2)+CLI_checkarg(5,2)==0)
+    {
+        COREMOD_MEMORY_sharedMem_tlog(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+int_fast8_t COREMOD_MEMORY_tlog_extract_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,1)+CLI_checkarg(3,1)+CLI_checkarg(4,3)==0)
+    {
+        COREMOD_MEMORY_tlog_extract(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.string);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 int_fast8_t COREMOD_MEMORY_sharedMem_2Dim_log_cli()
 {
 
@@ -1043,11 +1278,17 @@ int_fast8_t init_COREMOD_memory()
 /* =============================================================================================== */
 
     RegisterCLIcommand("mmon", __FILE__, memory_monitor_cli, "Monitor memory content", "terminal tty name", "mmon /dev/pts/4", "int memory_monitor(const char *ttyname)");
+
+    RegisterCLIcommand("streamstatus", __FILE__, COREMOD_MEMORY_streamstatus_cli, "live stream rate, bandwidth and attached processes, refreshes mmon and writes JSON", "<JSON file, NULL for none> <period [ms]> <attach all shm streams (0/1)>", "streamstatus /dev/shm/streamstatus.json 500 1", "long COREMOD_MEMORY_streamstatus(const char *fname, long dtms, int allshm)");
     
     RegisterCLIcommand("rm", __FILE__, delete_image_ID_cli, "remove image(s)", "list of images", "rm im1 im4", "int delete_image_ID(char* imname)");
      
     RegisterCLIcommand("rmall", __FILE__, clearall, "remove all images", "no argument", "rmall", "int clearall()");
     
+    RegisterCLIcommand("impool", __FILE__, COREMOD_MEMORY_image_pool_cli, "start (1) / end (0) local image pool scope: recycle data arrays of deleted images", "<mode [0/1]>", "impool 1", "int COREMOD_MEMORY_image_pool(int mode)");
+    
+    RegisterCLIcommand("imlastaccess", __FILE__, COREMOD_MEMORY_set_lastaccess_update_cli, "update image last access time on lookup", "<mode [0/1]>", "imlastaccess 0", "int COREMOD_MEMORY_set_lastaccess_update(int mode)");
+    
 
 
 /* =============================================================================================== */
@@ -1099,6 +1340,10 @@ int_fast8_t init_COREMOD_memory()
    
     RegisterCLIcommand("creaimshm", __FILE__, create_image_shared_cli, "create image in shared mem, default precision", "<name> <xsize> <ysize> <opt: zsize>", "creaimshm imname 512 512", "long create_image_ID(const char *name, long naxis, uint32_t *size, uint8_t atype, 0, 10)");
     
+    RegisterCLIcommand("creaimshmring", __FILE__, create_image_shared_ring_cli, "create ring buffer stream in shared mem, default precision", "<name> <xsize> <ysize> <NBslot>", "creaimshmring imname 120 120 1000", "long create_image_ID_flags(const char *name, 3, uint32_t *size, uint8_t atype, 1, 10, IMAGE_FLAG_RING)");
+    
+    RegisterCLIcommand("creaimshmflags", __FILE__, create_image_shared_flags_cli, "create image in shared mem with creation flags: 1 ring, 2 huge pages, 4 + 256*node NUMA binding, 32 latency instrumentation", "<name> <flags> <xsize> <ysize> <opt: zsize>", "creaimshmflags imname 262 512 512", "long create_image_ID_flags(const char *name, long naxis, uint32_t *size, uint8_t atype, 1, 10, uint16_t flags)");
+    
     RegisterCLIcommand("creaushortimshm", __FILE__, create_ushort_image_shared_cli, "create unsigned short image in shared mem", "<name> <xsize> <ysize> <opt: zsize>", "creaushortimshm imname 512 512", "long create_image_ID(const char *name, long naxis, long *size, _DATATYPE_UINT16, 0, 10)");
     
     RegisterCLIcommand("crea3dim", __FILE__, create_3Dimage_float, "creates 3D image, single precision", "<name> <xsize> <ysize> <zsize>", "crea3dim imname 512 512 100", "long create_image_ID(const char *name, long naxis, long *size, _DATATYPE_FLOAT, 0, 10)");
@@ -1201,12 +1446,14 @@ int_fast8_t init_COREMOD_memory()
 
     RegisterCLIcommand("imsetsempost", __FILE__, COREMOD_MEMORY_image_set_sempost_cli, "post image semaphore. If sem index = -1, post all semaphores", "<image> <sem index>", "imsetsempost im1 2", "long COREMOD_MEMORY_image_set_sempost(const char *IDname, long index)");  
 
-    RegisterCLIcommand("imsetsempostl", __FILE__, COREMOD_MEMORY_image_set_sempost_loop_cli, "post image semaphore loop. If sem index = -1, post all semaphores", "<image> <sem index> <time interval [us]>", "imsetsempost im1 2", "long COREMOD_MEMORY_image_set_sempost(const char *IDname, long index, long dtus)");
+    RegisterCLIcommand("imsetsempostl", __FILE__, COREMOD_MEMORY_image_set_sempost_loop_cli, "post image semaphore loop. If sem index = -1, post all semaphores", "<image> <sem index> <time interval [us]> <timing mode (0:sleep, 1:sleep+spin)>", "imsetsempostl im1 2 1000 0", "long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long dtus, int timingmode)");
     
     RegisterCLIcommand("imsetsemwait", __FILE__, COREMOD_MEMORY_image_set_semwait_cli, "wait image semaphore", "<image>", "imsetsemwait im1", "long COREMOD_MEMORY_image_set_semwait(const char *IDname)");   
 
     RegisterCLIcommand("imsetsemflush", __FILE__, COREMOD_MEMORY_image_set_semflush_cli, "flush image semaphore", "<image> <sem index>", "imsetsemflush im1 0", "long COREMOD_MEMORY_image_set_semflush(const char *IDname, long index)");
 
+    RegisterCLIcommand("imsetfutex", __FILE__, COREMOD_MEMORY_image_set_futex_cli, "set image futex wakeup mode (readers wait on cnt0)", "<image> <mode [0/1]>", "imsetfutex im1 1", "long COREMOD_MEMORY_image_set_futex(const char *IDname, int mode)");
+
 
 /* =============================================================================================== */
 /* =============================================================================================== */
@@ -1216,20 +1463,26 @@ int_fast8_t init_COREMOD_memory()
 /* =============================================================================================== */
 /* =============================================================================================== */
 
-    RegisterCLIcommand("creaimstream", __FILE__ , COREMOD_MEMORY_image_streamupdateloop_cli, "create 2D image stream from 3D cube", "<image3d in> <image2d out> <interval [us]> <NBcubes> <period> <offsetus> <sync stream name> <semtrig> <timing mode>", "creaimstream imcube imstream 1000 3 3 154 ircam1 3 0", "long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDoutname, long usperiod, long NBcubes, long period, long offsetus, const char *IDsync_name, int semtrig, int timingmode)");
+    RegisterCLIcommand("creaimstream", __FILE__ , COREMOD_MEMORY_image_streamupdateloop_cli, "create 2D image stream from 3D cube", "<image3d in> <image2d out> <interval [us]> <NBcubes> <period> <offsetus> <sync stream name> <semtrig> <timing mode (0:sleep, 1:sleep+spin)>", "creaimstream imcube imstream 1000 3 3 154 ircam1 3 0", "long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDoutname, long usperiod, long NBcubes, long period, long offsetus, const char *IDsync_name, int semtrig, int timingmode)");
     
     RegisterCLIcommand("creaimstreamstrig", __FILE__, COREMOD_MEMORY_image_streamupdateloop_semtrig_cli, "create 2D image stream from 3D cube, use other stream to synchronize", "<image3d in> <image2d out> <period [int]> <delay [us]> <sync stream> <sync sem index> <timing mode>", "creaimstreamstrig imcube outstream 3 152 streamsync 3 0", "long COREMOD_MEMORY_image_streamupdateloop_semtrig(const char *IDinname, const char *IDoutname, long period, long offsetus, const char *IDsync_name, int semtrig, int timingmode)"); 
 
-    RegisterCLIcommand("streamdelay", __FILE__, COREMOD_MEMORY_streamDelay_cli, "delay 2D image stream", "<image2d in> <image2d out> <delay [us]> <resolution [us]>", "streamdelay instream outstream 1000 10", "long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus)");
+    RegisterCLIcommand("streamdelay", __FILE__, COREMOD_MEMORY_streamDelay_cli, "delay image stream", "<image in> <image out> <delay [us]> <resolution [us]> <interpolate [0/1]>", "streamdelay instream outstream 1000 10 0", "long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus, int interp)");
 
     RegisterCLIcommand("imsaveallsnap", __FILE__, COREMOD_MEMORY_SaveAll_snapshot_cli, "save all images in directory", "<directory>", "imsaveallsnap dir1", "long COREMOD_MEMORY_SaveAll_snapshot(const char *dirname)");
     
     RegisterCLIcommand("imsaveallseq", __FILE__, COREMOD_MEMORY_SaveAll_sequ_cli, "save all images in directory - sequence", "<directory> <trigger image name> <trigger semaphore> <NB frames>", "imsaveallsequ dir1 im1 3 20", "long COREMOD_MEMORY_SaveAll_sequ(const char *dirname, const char *IDtrig_name, long semtrig, long NBframes)");
     
+    RegisterCLIcommand("imsaveallseqasync", __FILE__, COREMOD_MEMORY_SaveAll_sequ_async_cli, "save all images in directory - sequence, streamed to disk by asynchronous writers", "<directory> <trigger image name> <trigger semaphore> <NB frames> <queue depth [frames]>", "imsaveallseqasync dir1 im1 3 20000 1000", "long COREMOD_MEMORY_SaveAll_sequ_async(const char *dirname, const char *IDtrig_name, long semtrig, long NBframes, long NBslot)");
+    
     RegisterCLIcommand("imnetwtransmit", __FILE__, COREMOD_MEMORY_image_NETWORKtransmit_cli, "transmit image over network", "<image> <IP addr> <port [long]> <sync mode [int]>", "imnetwtransmit im1 127.0.0.1 0 8888 0", "long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr, int port, int mode)");
     
     RegisterCLIcommand("imnetwreceive", __FILE__, COREMOD_MEMORY_image_NETWORKreceive_cli, "receive image(s) over network. mode=1 uses counter instead of semaphore", "<port [long]> <mode [int]> <RT priority>", "imnetwreceive 8887 0 80", "long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority)");
     
+    RegisterCLIcommand("imnetwtransmitmux", __FILE__, COREMOD_MEMORY_image_NETWORKtransmit_multi_cli, "transmit several image streams over a single network connection", "<comma-separated stream list> <IP addr> <port [long]> <batch wait [us]> <encode: 0=raw, 1=sparse delta> <RT priority>", "imnetwtransmitmux im1,im2,im3 127.0.0.1 8888 0 1 80", "long COREMOD_MEMORY_image_NETWORKtransmit_multi(const char *IDnamelist, const char *IPaddr, int port, long batchus, int encode, int RT_priority)");
+    
+    RegisterCLIcommand("imnetwreceivemux", __FILE__, COREMOD_MEMORY_image_NETWORKreceive_multi_cli, "receive several image streams over a single network connection", "<port [long]> <RT priority>", "imnetwreceivemux 8888 80", "long COREMOD_MEMORY_image_NETWORKreceive_multi(int port, int RT_priority)");
+    
     RegisterCLIcommand("impixdecodeU", __FILE__, COREMOD_MEMORY_PixMapDecode_U_cli, "decode image stream", "<in stream> <xsize [long]> <ysize [long]> <nbpix per slice [ASCII file]> <decode map> <out stream> <out image slice index [FITS]>", "impixdecodeU streamin 120 120 pixsclienb.txt decmap outim outsliceindex.fits", "COREMOD_MEMORY_PixMapDecode_U(const char *inputstream_name, uint32_t xsizeim, uint32_t ysizeim, const char* NBpix_fname, const char* IDmap_name, const char *IDout_name, const char *IDout_pixslice_fname)");
     
     RegisterCLIcommand("streamdiff", __FILE__, COREMOD_MEMORY_streamDiff_cli, "compute difference between two image streams", "<in stream 0> <in stream 1> <out stream> <optional mask> <sem trigger index>", "streamdiff stream0 stream1 null outstream 3", "long COREMOD_MEMORY_streamDiff(const char *IDstream0_name, const char *IDstream1_name, const char *IDstreamout_name, long semtrig)");
@@ -1238,6 +1491,10 @@ int_fast8_t init_COREMOD_memory()
 
 	RegisterCLIcommand("streamave", __FILE__, COREMOD_MEMORY_streamAve_cli, "averages stream", "<instream> <NBave> <mode, 1 for single local instance, 0 for loop> <outstream>", "streamave instream 100 0 outstream", "long COREMODE_MEMORY_streamAve(const char *IDstream_name, int NBave, int mode, const char *IDout_name)");
 
+	RegisterCLIcommand("streamstats", __FILE__, COREMOD_MEMORY_streamStats_cli, "running per-pixel statistics of stream (mean, var, min, max, ewma)", "<instream> <outstream prefix> <decimation> <NBframes, 0 for cumulative> <EWMA gain>", "streamstats instream dark_ 100 10000 0.01", "long COREMOD_MEMORY_streamStats(const char *IDstream_name, const char *IDout_prefix, long decimation, long NBframes, double ewmagain)");
+
+	RegisterCLIcommand("streamgraph", __FILE__, COREMOD_MEMORY_streamGraph_cli, "run graph of stream operators (source/diff/halfdiff/ave/delay/publish) in one thread", "<graph file> <CPU, -1 for none>", "streamgraph wfsgraph.txt 5", "long COREMOD_MEMORY_streamGraph(const char *fname, int cpu)");
+
 
 /* =============================================================================================== */
 /* =============================================================================================== */
@@ -1249,6 +1506,10 @@ int_fast8_t init_COREMOD_memory()
 
 
     RegisterCLIcommand("shmimstreamlog", __FILE__, COREMOD_MEMORY_sharedMem_2Dim_log_cli, "logs shared memory stream (run in current directory)", "<shm image> <cubesize [long]> <logdir>", "shmimstreamlog wfscamim 10000 /media/data", "long COREMOD_MEMORY_sharedMem_2Dim_log(const char *IDname, uint32_t zsize, const char *logdir, const char *IDlogdata_name)");
+
+    RegisterCLIcommand("shmimstreamtlog", __FILE__, COREMOD_MEMORY_sharedMem_tlog_cli, "logs stream to compressed indexed telemetry file (.tlog)", "<stream> <blocksize [long]> <logdir> <compression 0=none 1=shuffle/RLE> <writer CPU, -1 for none>", "shmimstreamtlog wfscamim 1000 /media/data 1 7", "long COREMOD_MEMORY_sharedMem_tlog(const char *IDname, uint32_t blocksize, const char *logdir, int compression, int cpu)");
+
+    RegisterCLIcommand("tlogextract", __FILE__, COREMOD_MEMORY_tlog_extract_cli, "extract time range from .tlog file into 3D image", "<tlog file> <start time [s]> <end time [s]> <output image>", "tlogextract wfscamim_01:02:03.000000000.tlog 1500000000.0 1500000010.0 imc", "long COREMOD_MEMORY_tlog_extract(const char *fname, double tstart, double tend, const char *IDout_name)");
     
     RegisterCLIcommand("shmimslogstat", __FILE__, COREMOD_MEMORY_logshim_printstatus_cli, "print log shared memory stream status", "<shm image>", "shmimslogstat wfscamim", "int COREMOD_MEMORY_logshim_printstatus(const char *IDname)");
     
@@ -1370,162 +1631,375 @@ long compute_variable_memory()
 
 
 
-long image_ID(const char *name) /* ID number corresponding to a name */
-{
-    long i,ID;
-    int found;
-    long tmp = 0;
-    struct timespec timenow;
+/* 
+ * IMAGE AND VARIABLE INDEX
+ * 
+ * Hash index on image and variable names, and stack of free IDs, so that lookup, create and delete are O(1).
+ * Image index is maintained by create_image_ID, read_sharedmem_image, delete_image_ID and chname_image_ID.
+ * Variable index is maintained by create_variable_*ID and delete_variable_ID.
+ * Hash table size is kept at least 2x the number of entries in data.image (data.variable).
+ * Index and free list are rebuilt by scanning data.image (data.variable) after reallocation.
+ * Rebuilds only occur on insert and remove (create, delete, rename), so that lookups (image_ID) are read-only
+ * and can be called concurrently from multiple threads while no image is created or deleted.
+ */
 
-    i = 0;
-    found = 0;
-    while(found == 0)
+static uint32_t nameindex_hash(const char *name)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    
+    while(*name != '\0')
     {
-        if(data.image[i].used == 1)
-        {
-            if((strncmp(name,data.image[i].name,strlen(name))==0)&&(data.image[i].name[strlen(name)]=='\0'))
-            {
-                found = 1;
-                tmp = i;
-                clock_gettime(CLOCK_REALTIME, &timenow);
-                data.image[i].md[0].last_access = 1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec;
-            }
-        }
-        i++;
-        if(i == data.NB_MAX_IMAGE)
-        {
-            found = 1;
-            tmp = -1;
-        }
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
     }
-    ID = tmp;
-
-    return(tmp);
+    
+    return(hash);
 }
 
 
-long image_ID_noaccessupdate(const char *name) /* ID number corresponding to a name */
-{
-    long i,ID;
-    int found;
-    long tmp = 0;
-
-    i = 0;
-    found = 0;
-    while(found == 0)
-    {
-        if(data.image[i].used == 1)
-        {
-            if((strncmp(name,data.image[i].name,strlen(name))==0)&&(data.image[i].name[strlen(name)]=='\0'))
-            {
-                found = 1;
-                tmp = i;
-            }
-        }
-        i++;
-        if(i == data.NB_MAX_IMAGE)
-        {
-            found = 1;
-            tmp = -1;
-        }
-    }
-    ID = tmp;
 
-    return(tmp);
+/* name and used flag of entry ID in data.image (type 0) or data.variable (type 1) */
+static const char *nameindex_name(int type, long ID)
+{
+    if(type == 0)
+        return data.image[ID].name;
+    else
+        return data.variable[ID].name;
 }
 
+static int nameindex_used(int type, long ID)
+{
+    if(type == 0)
+        return (data.image[ID].used == 1);
+    else
+        return (data.variable[ID].used == 1);
+}
 
-long variable_ID(const char *name) /* ID number corresponding to a name */
+static long nameindex_NBmax(int type)
 {
-    long i,ID;
-    int found;
-    long tmp = -1;
+    if(type == 0)
+        return data.NB_MAX_IMAGE;
+    else
+        return data.NB_MAX_VARIABLE;
+}
 
-    i = 0;
-    found = 0;
-    while(found == 0)
-    {
-        if(data.variable[i].used == 1)
-        {
-            if((strncmp(name,data.variable[i].name,strlen(name))==0)&&(data.variable[i].name[strlen(name)]=='\0'))
-            {
-                found = 1;
-                tmp = i;
-            }
-        }
-        i++;
-        if(i == data.NB_MAX_VARIABLE)
-        {
-            found = 1;
-            tmp = -1;
-        }
-    }
-    ID = tmp;
 
-    /*  if(tmp==-1) printf("error : no variable named \"%s\" in memory\n", name);*/
-    return(tmp);
+
+static void nameindex_add(NAMEINDEX *index, int type, long ID)
+{
+    long mask = index->size-1;
+    long k = nameindex_hash(nameindex_name(type, ID)) & mask;
+    
+    while(index->slot[k] >= 0)
+        k = (k+1) & mask;
+    if(index->slot[k] == NAMEINDEX_DELETED)
+        index->NBdeleted--;
+    index->slot[k] = ID;
 }
 
 
 
-long next_avail_image_ID() /* next available ID number */
+static void nameindex_rebuild(NAMEINDEX *index, int type)
 {
+    long NBmax = nameindex_NBmax(type);
+    long size = 64;
     long i;
-    long ID = -1;
-
-# ifdef _OPENMP
-    #pragma omp critical
+    
+    while(size < 2*NBmax)
+        size *= 2;
+    
+    if(size != index->size)
     {
-#endif
-        for (i=0; i<data.NB_MAX_IMAGE; i++)
+        free(index->slot);
+        index->slot = (long*) malloc(sizeof(long)*size);
+        if(index->slot == NULL)
         {
-            if(data.image[i].used == 0)
-            {
-                ID = i;
-                data.image[ID].used = 1;
-                break;
-            }
+            printERROR(__FILE__, __func__, __LINE__, "memory allocation error");
+            exit(0);
         }
-# ifdef _OPENMP
+        index->size = size;
     }
-# endif
+    for(i=0; i<size; i++)
+        index->slot[i] = NAMEINDEX_EMPTY;
+    index->NBdeleted = 0;
+    
+    for(i=0; i<NBmax; i++)
+        if(nameindex_used(type, i))
+            nameindex_add(index, type, i);
+}
 
-    if(ID==-1)
-        {
-			printf("ERROR: ran out of image IDs - cannot allocate new ID\n");
-			printf("NB_MAX_IMAGE should be increased above current value (%ld)\n", data.NB_MAX_IMAGE);
-			exit(0);
-		}
 
-    return(ID);
+
+/* rebuild index if data array has been reallocated or too many deleted slots */
+static void nameindex_check(NAMEINDEX *index, int type)
+{
+    if( (index->size < 2*nameindex_NBmax(type)) || (index->NBdeleted > index->size/4) )
+        nameindex_rebuild(index, type);
 }
 
 
 
-long next_avail_variable_ID() /* next available ID number */
+/* read-only: does not rebuild index (table may be undersized after data array reallocation until next insert) */
+static long nameindex_find(NAMEINDEX *index, int type, const char *name)
 {
-    long i;
-    long ID = -1;
-    int found = 0;
-
-    for (i=0; i<data.NB_MAX_VARIABLE; i++)
-    {
-        if((data.variable[i].used == 0)&&(found == 0))
-        {
-            ID = i;
-            found = 1;
-        }
-    }
-    if(ID==-1)
+    long mask;
+    long k;
+    
+    if(index->size == 0) // nothing inserted yet
+        return(-1);
+    mask = index->size-1;
+    k = nameindex_hash(name) & mask;
+    while(index->slot[k] != NAMEINDEX_EMPTY)
     {
-        ID = data.NB_MAX_VARIABLE;
+        long ID = index->slot[k];
+        
+        if(ID >= 0)
+            if(nameindex_used(type, ID) && (strcmp(name, nameindex_name(type, ID)) == 0))
+                return(ID);
+        k = (k+1) & mask;
     }
-    return(ID);
+    
+    return(-1);
 }
 
 
 
-
+/* add ID to index once its name is set */
+static void nameindex_insert(NAMEINDEX *index, int type, long ID)
+{
+    nameindex_check(index, type);
+    nameindex_add(index, type, ID);
+}
+
+
+
+/* remove ID from index, must be called before its name is changed or used flag is cleared */
+static void nameindex_remove(NAMEINDEX *index, int type, long ID)
+{
+    long mask;
+    long k;
+    
+    nameindex_check(index, type);
+    mask = index->size-1;
+    k = nameindex_hash(nameindex_name(type, ID)) & mask;
+    while(index->slot[k] != NAMEINDEX_EMPTY)
+    {
+        if(index->slot[k] == ID)
+        {
+            index->slot[k] = NAMEINDEX_DELETED;
+            index->NBdeleted++;
+            break;
+        }
+        k = (k+1) & mask;
+    }
+}
+
+
+
+/* refill free ID stack from data array, lowest ID on top */
+static void freelist_rebuild(IDFREELIST *freelist, int type)
+{
+    long NBmax = nameindex_NBmax(type);
+    long i;
+    
+    if(NBmax != freelist->NBmax)
+    {
+        free(freelist->ID);
+        freelist->ID = (long*) malloc(sizeof(long)*NBmax);
+        if(freelist->ID == NULL)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "memory allocation error");
+            exit(0);
+        }
+        freelist->NBmax = NBmax;
+    }
+    freelist->NB = 0;
+    for(i=NBmax-1; i>=0; i--)
+        if(!nameindex_used(type, i))
+            freelist->ID[freelist->NB++] = i;
+}
+
+
+
+/* pop free ID, -1 if none available */
+static long freelist_pop(IDFREELIST *freelist, int type)
+{
+    long ID;
+    
+    if(freelist->NBmax != nameindex_NBmax(type))
+        freelist_rebuild(freelist, type);
+    
+    while(1)
+    {
+        if(freelist->NB == 0)
+        {
+            freelist_rebuild(freelist, type); // recover IDs released outside of delete functions
+            if(freelist->NB == 0)
+                return(-1);
+        }
+        ID = freelist->ID[--freelist->NB];
+        if(!nameindex_used(type, ID))
+            return(ID);
+    }
+}
+
+
+
+static void freelist_push(IDFREELIST *freelist, int type, long ID)
+{
+    if(freelist->NBmax != nameindex_NBmax(type))
+        freelist_rebuild(freelist, type);
+    else if(freelist->NB < freelist->NBmax)
+        freelist->ID[freelist->NB++] = ID;
+}
+
+
+
+static void image_ID_index_insert(long ID)
+{
+    nameindex_insert(&imageindex, 0, ID);
+}
+
+static void image_ID_index_remove(long ID)
+{
+    nameindex_remove(&imageindex, 0, ID);
+}
+
+static void variable_ID_index_insert(long ID)
+{
+    nameindex_insert(&variableindex, 1, ID);
+}
+
+static void variable_ID_index_remove(long ID)
+{
+    nameindex_remove(&variableindex, 1, ID);
+}
+
+
+
+
+long image_ID(const char *name) /* ID number corresponding to a name */
+{
+    long ID;
+    struct timespec timenow;
+
+    IMAGE_ID_NBlookup++;
+    ID = nameindex_find(&imageindex, 0, name);
+    if((ID != -1)&&(IMAGE_LASTACCESS_UPDATE == 1))
+    {
+        clock_gettime(CLOCK_REALTIME, &timenow);
+        data.image[ID].md[0].last_access = 1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec;
+    }
+
+    return(ID);
+}
+
+
+long image_ID_noaccessupdate(const char *name) /* ID number corresponding to a name */
+{
+    IMAGE_ID_NBlookup++;
+    return(nameindex_find(&imageindex, 0, name));
+}
+
+
+
+/**
+ * @brief Number of image name lookups (image_ID, image_ID_noaccessupdate) since start
+ * 
+ * Real-time code compares successive values to check that no name lookup occurs in steady state.
+ */
+long long COREMOD_MEMORY_image_ID_NBlookup()
+{
+    return(IMAGE_ID_NBlookup);
+}
+
+
+
+/**
+ * @brief Start or end local image pool scope
+ * 
+ * Within a pool scope, data arrays of deleted local images are kept and reused by images created later with the same size class.\n
+ * Scopes can be nested, pooled memory is released when the outermost scope ends. See ImageStreamIO_pool_begin().
+ * 
+ * @param[in] mode  1: start scope, 0: end scope
+ */
+int_fast8_t COREMOD_MEMORY_image_pool(int mode)
+{
+    if(mode == 1)
+        ImageStreamIO_pool_begin();
+    else
+        ImageStreamIO_pool_end();
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Select if image_ID() updates image last access time
+ * 
+ * Skipping the update avoids a clock_gettime call and a write to shared memory on each image lookup.
+ * 
+ * @param[in] mode  1: update last_access (default), 0: do not update
+ */
+int_fast8_t COREMOD_MEMORY_set_lastaccess_update(int mode)
+{
+    IMAGE_LASTACCESS_UPDATE = mode;
+    
+    return(0);
+}
+
+
+long variable_ID(const char *name) /* ID number corresponding to a name */
+{
+    /*  if(tmp==-1) printf("error : no variable named \"%s\" in memory\n", name);*/
+    return(nameindex_find(&variableindex, 1, name));
+}
+
+
+
+long next_avail_image_ID() /* next available ID number */
+{
+    long ID = -1;
+
+# ifdef _OPENMP
+    #pragma omp critical
+    {
+#endif
+        ID = freelist_pop(&imagefreelist, 0);
+        if(ID != -1)
+            data.image[ID].used = 1;
+# ifdef _OPENMP
+    }
+# endif
+
+    if(ID==-1)
+        {
+			printf("ERROR: ran out of image IDs - cannot allocate new ID\n");
+			printf("NB_MAX_IMAGE should be increased above current value (%ld)\n", data.NB_MAX_IMAGE);
+			exit(0);
+		}
+
+    return(ID);
+}
+
+
+
+long next_avail_variable_ID() /* next available ID number */
+{
+    long ID = -1;
+
+    ID = freelist_pop(&variablefreelist, 1);
+    if(ID==-1)
+    {
+        ID = data.NB_MAX_VARIABLE;
+    }
+    return(ID);
+}
+
+
+
+
 int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
 {
     long ID;
@@ -1538,7 +2012,9 @@ int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
 
     if (ID!=-1)
     {
+        image_ID_index_remove(ID);
         data.image[ID].used = 0;
+        freelist_push(&imagefreelist, 0, ID);
 
         for(s=0; s<data.image[ID].md[0].sem; s++)
             sem_close(data.image[ID].semptr[s]);
@@ -1549,6 +2025,7 @@ int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
 
         if(data.image[ID].md[0].shared == 1)
         {
+            int hugetlbfs = 0;
 
             if(data.image[ID].semlog!=NULL)
             {
@@ -1556,15 +2033,10 @@ int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
                 data.image[ID].semlog = NULL;
             }
 
-            if (munmap(data.image[ID].md, data.image[ID].memsize) == -1) {
-                printf("unmapping ID %ld : %p  %ld\n", ID, data.image[ID].md, data.image[ID].memsize);
-                perror("Error un-mmapping the file");
-            }
-            close(data.image[ID].shmfd);
-            data.image[ID].md = NULL;
-            data.image[ID].kw = NULL;
-            data.image[ID].shmfd = -1;
-            data.image[ID].memsize = 0;
+            if(data.image[ID].md[0].hugepage == 2)
+                hugetlbfs = 1;
+
+            ImageStreamIO_shmrelease(&data.image[ID]);
 
 
             sprintf(command, "rm /dev/shm/sem.%s_sem*", imname);
@@ -1577,69 +2049,21 @@ int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
 
             sprintf(command, "rm %s/%s.im.shm", SHAREDMEMDIR, imname);
             r = system(command);
+
+            if(hugetlbfs == 1) // stream file is a link to hugetlbfs
+            {
+                sprintf(fname, "%s/%s.im.shm", HUGEPAGEDIR, imname);
+                remove(fname);
+            }
         }
         else
         {
-            if(data.image[ID].md[0].atype == _DATATYPE_UINT8)
-            {
-                if(data.image[ID].array.UI8 == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.UI8);
-                data.image[ID].array.UI8 = NULL;
-            }
-            if(data.image[ID].md[0].atype == _DATATYPE_INT32)
-            {
-                if(data.image[ID].array.SI32 == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.SI32);
-                data.image[ID].array.SI32 = NULL;
-            }
-            if(data.image[ID].md[0].atype == _DATATYPE_FLOAT)
-            {
-                if(data.image[ID].array.F == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.F);
-                data.image[ID].array.F = NULL;
-            }
-            if(data.image[ID].md[0].atype == _DATATYPE_DOUBLE)
-            {
-                if(data.image[ID].array.D == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.D);
-                data.image[ID].array.D = NULL;
-            }
-            if(data.image[ID].md[0].atype == _DATATYPE_COMPLEX_FLOAT)
-            {
-                if(data.image[ID].array.CF == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.CF);
-                data.image[ID].array.CF = NULL;
-            }
-            if(data.image[ID].md[0].atype == _DATATYPE_COMPLEX_DOUBLE)
+            if(data.image[ID].array.UI8 == NULL)
             {
-                if(data.image[ID].array.CD == NULL)
-                {
-                    printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
-                    exit(0);
-                }
-                free(data.image[ID].array.CD);
-                data.image[ID].array.CD = NULL;
+                printERROR(__FILE__,__func__,__LINE__,"data array pointer is null\n");
+                exit(0);
             }
+            ImageStreamIO_arrayfree(&data.image[ID]); // all data types, returns array to pool if pooled
 			
             if(data.image[ID].md == NULL)
             {
@@ -1656,6 +2080,18 @@ int_fast8_t delete_image_ID(const char* imname) /* deletes an ID */
                 data.image[ID].kw = NULL;
             }
 
+            if(data.image[ID].ring!=NULL)
+            {
+                free(data.image[ID].ring);
+                data.image[ID].ring = NULL;
+            }
+
+            if(data.image[ID].latency!=NULL)
+            {
+                free(data.image[ID].latency);
+                data.image[ID].latency = NULL;
+            }
+
         }
         //free(data.image[ID].logstatus);
         /*      free(data.image[ID].size);*/
@@ -1699,7 +2135,9 @@ int_fast8_t delete_variable_ID(const char* varname) /* deletes a variable ID */
     ID = variable_ID(varname);
     if (ID!=-1)
     {
+        variable_ID_index_remove(ID);
         data.variable[ID].used = 0;
+        freelist_push(&variablefreelist, 1, ID);
         /*      free(data.variable[ID].name);*/
     }
     else
@@ -1880,105 +2318,235 @@ void *save_fits_function( void *ptr )
 
 
 
-long image_write_keyword_L(const char *IDname, const char *kname, long value, const char *comment)
-{
-    long ID;
-    long kw, NBkw, kw0;
-
-    ID = image_ID(IDname);
-    NBkw = data.image[ID].md[0].NBkw;
+/*
+ * KEYWORD INDEX
+ *
+ * Keyword name lookup through a per-image hash index (FNV-1a, as the image index), built on first lookup.
+ * Other processes may write keywords of a shared stream: a hit is verified against the keyword name, and a miss
+ * falls back to a linear scan, rebuilding the index if the keyword is found. Lookups are exact (16-char names).
+ * If a name appears in several entries, the last entry is used.
+ */
 
-    kw = 0;
-    while((data.image[ID].kw[kw].type!='N')&&(kw<NBkw))
-        kw++;
-    kw0 = kw;
+static int kwindex_match(IMAGE_KEYWORD *kw, const char *kname)
+{
+    return( (kw->type != 'N') && (strncmp(kw->name, kname, 16) == 0) );
+}
 
-    if(kw0==NBkw)
-    {
-        printf("ERROR: no available keyword entry\n");
-        exit(0);
-    }
-    else
-    {
-        strcpy(data.image[ID].kw[kw].name, kname);
-        data.image[ID].kw[kw].type = 'L';
-        data.image[ID].kw[kw].value.numl = value;
-        strcpy(data.image[ID].kw[kw].comment, comment);
-    }
 
-    return(kw0);
-}
 
-long image_write_keyword_D(const char *IDname, const char *kname, double value, const char *comment)
+static uint32_t kwindex_hash(const char *kname)
 {
-    long ID;
-    long kw, NBkw, kw0;
+    char name[17];
+    
+    strncpy(name, kname, 16);
+    name[16] = '\0';
+    
+    return(nameindex_hash(name));
+}
 
-    ID = image_ID(IDname);
-    NBkw = data.image[ID].md[0].NBkw;
 
-    kw = 0;
-    while((data.image[ID].kw[kw].type!='N')&&(kw<NBkw))
-        kw++;
-    kw0 = kw;
 
-    if(kw0==NBkw)
-    {
-        printf("ERROR: no available keyword entry\n");
-        exit(0);
-    }
-    else
+static void kwindex_add(KWINDEX *index, long kw)
+{
+    long mask = index->size-1;
+    long k = kwindex_hash(index->kw[kw].name) & mask;
+    
+    while(index->slot[k] != NAMEINDEX_EMPTY)
     {
-        strcpy(data.image[ID].kw[kw].name, kname);
-        data.image[ID].kw[kw].type = 'D';
-        data.image[ID].kw[kw].value.numf = value;
-        strcpy(data.image[ID].kw[kw].comment, comment);
+        if(strncmp(index->kw[index->slot[k]].name, index->kw[kw].name, 16) == 0)
+            break;
+        k = (k+1) & mask;
     }
-
-    return(kw0);
+    index->slot[k] = kw;
 }
 
-long image_write_keyword_S(const char *IDname, const char *kname, const char *value, const char *comment)
-{
-    long ID;
-    long kw, NBkw, kw0;
-
-    ID = image_ID(IDname);
-    NBkw = data.image[ID].md[0].NBkw;
 
-    kw = 0;
-    while((data.image[ID].kw[kw].type!='N')&&(kw<NBkw))
-        kw++;
-    kw0 = kw;
 
-    if(kw0==NBkw)
+static void kwindex_rebuild(long ID)
+{
+    KWINDEX *index;
+    long NBkw = data.image[ID].md[0].NBkw;
+    long size = 16;
+    long i;
+    
+    if(kwindex_NB < data.NB_MAX_IMAGE)
     {
-        printf("ERROR: no available keyword entry\n");
-        exit(0);
+        kwindex = (KWINDEX*) realloc(kwindex, sizeof(KWINDEX)*data.NB_MAX_IMAGE);
+        if(kwindex == NULL)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "memory allocation error");
+            exit(0);
+        }
+        memset(kwindex+kwindex_NB, 0, sizeof(KWINDEX)*(data.NB_MAX_IMAGE-kwindex_NB));
+        kwindex_NB = data.NB_MAX_IMAGE;
     }
-    else
+    index = &kwindex[ID];
+    
+    while(size < 2*NBkw)
+        size *= 2;
+    if(size != index->size)
     {
-        strcpy(data.image[ID].kw[kw].name, kname);
-        data.image[ID].kw[kw].type = 'D';
-        strcpy(data.image[ID].kw[kw].value.valstr, value);
-        strcpy(data.image[ID].kw[kw].comment, comment);
+        free(index->slot);
+        index->slot = (long*) malloc(sizeof(long)*size);
+        if(index->slot == NULL)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "memory allocation error");
+            exit(0);
+        }
+        index->size = size;
     }
-
-    return(kw0);
+    for(i=0; i<size; i++)
+        index->slot[i] = NAMEINDEX_EMPTY;
+    
+    index->kw = data.image[ID].kw;
+    index->NBkw = NBkw;
+    for(i=0; i<NBkw; i++)
+        if(index->kw[i].type != 'N')
+            kwindex_add(index, i);
 }
 
 
 
-
-long image_list_keywords(const char *IDname)
+/**
+ * @brief Index of keyword kname in image ID, -1 if not found
+ */
+long image_keyword_slot(long ID, const char *kname)
 {
-    long ID;
-    long kw, NBkw;
-
-    ID = image_ID(IDname);
-
-    for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
-    {
+    long NBkw = data.image[ID].md[0].NBkw;
+    long kw;
+    KWINDEX *index;
+    
+    if(NBkw >= KWINDEX_MINNBKW)
+    {
+        if( (ID >= kwindex_NB) || (kwindex[ID].kw != data.image[ID].kw) || (kwindex[ID].NBkw != NBkw) )
+            kwindex_rebuild(ID);
+        index = &kwindex[ID];
+        
+        long mask = index->size-1;
+        long k = kwindex_hash(kname) & mask;
+        while(index->slot[k] != NAMEINDEX_EMPTY)
+        {
+            kw = index->slot[k];
+            if(kwindex_match(&data.image[ID].kw[kw], kname))
+                return(kw);
+            k = (k+1) & mask;
+        }
+    }
+    
+    // small image, or keyword written by another process since index was built
+    for(kw=NBkw-1; kw>=0; kw--)
+        if(kwindex_match(&data.image[ID].kw[kw], kname))
+        {
+            if(NBkw >= KWINDEX_MINNBKW)
+                kwindex_rebuild(ID);
+            return(kw);
+        }
+    
+    return(-1);
+}
+
+
+
+/* slot of keyword kname, or first free slot with name and type set if not found */
+static long image_keyword_slot_create(long ID, const char *kname, char type, const char *comment)
+{
+    long NBkw = data.image[ID].md[0].NBkw;
+    long kw;
+    
+    kw = image_keyword_slot(ID, kname);
+    if(kw == -1)
+    {
+        kw = 0;
+        while((kw<NBkw)&&(data.image[ID].kw[kw].type!='N'))
+            kw++;
+        if(kw==NBkw)
+        {
+            printf("ERROR: no available keyword entry\n");
+            exit(0);
+        }
+        strncpy(data.image[ID].kw[kw].name, kname, 16);
+        data.image[ID].kw[kw].type = type;
+        if( (NBkw >= KWINDEX_MINNBKW) && (ID < kwindex_NB) && (kwindex[ID].kw == data.image[ID].kw) )
+            kwindex_add(&kwindex[ID], kw);
+    }
+    data.image[ID].kw[kw].type = type;
+    strncpy(data.image[ID].kw[kw].comment, comment, 80);
+    data.image[ID].kw[kw].comment[79] = '\0';
+    
+    return(kw);
+}
+
+
+
+/**
+ * @brief Keyword handle: pointer to keyword kname of image IDname, created with type and comment if not present
+ * 
+ * Resolve once, then update value in place (e.g. kwp->value.numf = exptime) : no name lookup per frame.
+ * Pointer is valid until the image is deleted or re-imported.
+ */
+IMAGE_KEYWORD *image_keyword_handle(const char *IDname, const char *kname, char type, const char *comment)
+{
+    long ID;
+    
+    ID = image_ID(IDname);
+    if(ID == -1)
+        return(NULL);
+    
+    return(&data.image[ID].kw[image_keyword_slot_create(ID, kname, type, comment)]);
+}
+
+
+
+/* write functions update keyword kname in place if present, otherwise use first free entry */
+
+long image_write_keyword_L(const char *IDname, const char *kname, long value, const char *comment)
+{
+    long ID;
+    long kw0;
+
+    ID = image_ID(IDname);
+    kw0 = image_keyword_slot_create(ID, kname, 'L', comment);
+    data.image[ID].kw[kw0].value.numl = value;
+
+    return(kw0);
+}
+
+long image_write_keyword_D(const char *IDname, const char *kname, double value, const char *comment)
+{
+    long ID;
+    long kw0;
+
+    ID = image_ID(IDname);
+    kw0 = image_keyword_slot_create(ID, kname, 'D', comment);
+    data.image[ID].kw[kw0].value.numf = value;
+
+    return(kw0);
+}
+
+long image_write_keyword_S(const char *IDname, const char *kname, const char *value, const char *comment)
+{
+    long ID;
+    long kw0;
+
+    ID = image_ID(IDname);
+    kw0 = image_keyword_slot_create(ID, kname, 'S', comment);
+    strncpy(data.image[ID].kw[kw0].value.valstr, value, 16);
+
+    return(kw0);
+}
+
+
+
+
+long image_list_keywords(const char *IDname)
+{
+    long ID;
+    long kw, NBkw;
+
+    ID = image_ID(IDname);
+
+    for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
+    {
         if(data.image[ID].kw[kw].type=='L')
             printf("%18s  %20ld %s\n", data.image[ID].kw[kw].name, data.image[ID].kw[kw].value.numl, data.image[ID].kw[kw].comment);
         if(data.image[ID].kw[kw].type=='D')
@@ -1996,18 +2564,18 @@ long image_list_keywords(const char *IDname)
 long image_read_keyword_D(const char *IDname, const char *kname, double *val)
 {
     long ID;
-    long kw, NBkw, kw0;
+    long kw, kw0;
 
     ID = image_ID(IDname);
-    kw0 = -1;
-    for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
-    {
-        if((data.image[ID].kw[kw].type=='D')&&(strncmp(kname, data.image[ID].kw[kw].name ,strlen(kname))==0))
-        {
-            kw0 = kw;
-            *val = data.image[ID].kw[kw].value.numf;
-        }
-    }
+    kw0 = image_keyword_slot(ID, kname);
+    if( (kw0 != -1) && (data.image[ID].kw[kw0].type != 'D') )
+        kw0 = -1;
+    if(kw0 == -1) // prefix match
+        for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
+            if((data.image[ID].kw[kw].type=='D')&&(strncmp(kname, data.image[ID].kw[kw].name ,strlen(kname))==0))
+                kw0 = kw;
+    if(kw0 != -1)
+        *val = data.image[ID].kw[kw0].value.numf;
 
     return(kw0);
 }
@@ -2016,18 +2584,18 @@ long image_read_keyword_D(const char *IDname, const char *kname, double *val)
 long image_read_keyword_L(const char *IDname, const char *kname, long *val)
 {
     long ID;
-    long kw, NBkw, kw0;
+    long kw, kw0;
 
     ID = image_ID(IDname);
-    kw0 = -1;
-    for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
-    {
-        if((data.image[ID].kw[kw].type=='L')&&(strncmp(kname, data.image[ID].kw[kw].name ,strlen(kname))==0))
-        {
-            kw0 = kw;
-            *val = data.image[ID].kw[kw].value.numl;
-        }
-    }
+    kw0 = image_keyword_slot(ID, kname);
+    if( (kw0 != -1) && (data.image[ID].kw[kw0].type != 'L') )
+        kw0 = -1;
+    if(kw0 == -1) // prefix match
+        for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
+            if((data.image[ID].kw[kw].type=='L')&&(strncmp(kname, data.image[ID].kw[kw].name ,strlen(kname))==0))
+                kw0 = kw;
+    if(kw0 != -1)
+        *val = data.image[ID].kw[kw0].value.numl;
 
     return(kw0);
 }
@@ -2141,11 +2709,44 @@ long read_sharedmem_image(const char *name)
 	long ID = -1;
 	IMAGE *image;
 	
-	ID = next_avail_image_ID();
+	ID = image_ID(name);
+	if(ID != -1)
+	{
+		if(data.image[ID].md[0].shared == 1)
+		{
+			if(ImageStreamIO_shmunchanged(&data.image[ID]) == 1) // already attached, stream unchanged
+				return(ID);
+			
+			// stream re-created: release old mapping, attach again with same ID
+			long s;
+			
+			for(s=0; s<data.image[ID].md[0].sem; s++)
+				sem_close(data.image[ID].semptr[s]);
+			free(data.image[ID].semptr);
+			data.image[ID].semptr = NULL;
+			if(data.image[ID].semlog != NULL)
+			{
+				sem_close(data.image[ID].semlog);
+				data.image[ID].semlog = NULL;
+			}
+			ImageStreamIO_shmrelease(&data.image[ID]);
+			image_ID_index_remove(ID);
+		}
+		else // local image with same name: no second entry with the same name
+			return(ID);
+	}
+	
+	if(ID == -1)
+		ID = next_avail_image_ID();
 	
 	image = &data.image[ID];
 	if(ImageStreamIO_read_sharedmem_image_toIMAGE(name, image)==-1)
+	{
+		freelist_push(&imagefreelist, 0, ID);
 		ID = -1;
+	}
+	else
+		image_ID_index_insert(ID);
 
     if(MEM_MONITOR == 1)
 		list_image_ID_ncurses();
@@ -2177,6 +2778,18 @@ long read_sharedmem_image(const char *name)
 /* creates an image ID */
 /* all images should be created by this function */
 long create_image_ID(const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw)
+{
+    return create_image_ID_flags(name, naxis, size, atype, shared, NBkw, 0);
+}
+
+
+
+/**
+ * @brief Create image ID with creation flags
+ * 
+ * See ImageStreamIO_createIm_flags() for flags (IMAGE_FLAG_*)
+ */
+long create_image_ID_flags(const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw, uint16_t flags)
 {
     long ID;
     long i,ii;
@@ -2202,7 +2815,8 @@ long create_image_ID(const char *name, long naxis, uint32_t *size, uint8_t atype
     if(image_ID(name) == -1)
     {
         ID = next_avail_image_ID();
-        ImageStreamIO_createIm(&data.image[ID], name, naxis, size, atype, shared, NBkw);
+        ImageStreamIO_createIm_flags(&data.image[ID], name, naxis, size, atype, shared, NBkw, flags);
+        image_ID_index_insert(ID);
     }
     else
     {
@@ -2493,6 +3107,8 @@ long create_variable_ID(const char *name, double value)
         data.variable[ID].used = 1;
         data.variable[ID].type = 0; /** floating point double */
         strcpy(data.variable[ID].name,name);
+        if(i2==-1)
+            variable_ID_index_insert(ID);
         data.variable[ID].value.f = value;
 
     }
@@ -2528,6 +3144,8 @@ long create_variable_long_ID(const char *name, long value)
         data.variable[ID].used = 1;
         data.variable[ID].type = 1; /** long */
         strcpy(data.variable[ID].name,name);
+        if(i2==-1)
+            variable_ID_index_insert(ID);
         data.variable[ID].value.l = value;
 
     }
@@ -2564,6 +3182,8 @@ long create_variable_string_ID(const char *name, const char *value)
         data.variable[ID].used = 1;
         data.variable[ID].type = 2; /** string */
         strcpy(data.variable[ID].name,name);
+        if(i2==-1)
+            variable_ID_index_insert(ID);
         strcpy(data.variable[ID].value.s, value);
     }
 
@@ -2678,7 +3298,7 @@ long copy_image_ID(const char *name, const char *newname, int shared)
             exit(0);
         }
     }
-    data.image[IDout].md[0].write = 1;
+    ImageStreamIO_write_begin(&data.image[IDout]);
 
 
     if(atype == _DATATYPE_UINT8)
@@ -2730,9 +3350,9 @@ long copy_image_ID(const char *name, const char *newname, int shared)
     
 
     
-    COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
-    data.image[IDout].md[0].write = 0;
+    ImageStreamIO_write_end(&data.image[IDout]);
     data.image[IDout].md[0].cnt0++;
+    COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
 
     free(size);
 
@@ -2751,7 +3371,12 @@ long chname_image_ID(const char *ID_name, const char *new_name)
     if((image_ID(new_name)==-1)&&(variable_ID(new_name)==-1))
     {
         ID = image_ID(ID_name);
-        strcpy(data.image[ID].name, new_name);
+        if(ID != -1)
+        {
+            image_ID_index_remove(ID);
+            strcpy(data.image[ID].name, new_name);
+            image_ID_index_insert(ID);
+        }
         //      if ( Debug > 0 ) { printf("change image name %s -> %s\n",ID_name,new_name);}
     }
     else
@@ -2825,7 +3450,7 @@ long COREMOD_MEMORY_cp2shm(const char *IDname, const char *IDshmname)
     //data.image[IDshm].md[0].nelement = data.image[ID].md[0].nelement;
     //printf("======= %ld %ld ============\n", data.image[ID].md[0].nelement, data.image[IDshm].md[0].nelement);
 
-	data.image[IDshm].md[0].write = 1;
+	ImageStreamIO_write_begin(&data.image[IDshm]);
 
     switch (atype) {
 		
@@ -2895,9 +3520,9 @@ long COREMOD_MEMORY_cp2shm(const char *IDname, const char *IDshmname)
         printf("data type not supported\n");
         break;
     }
-    COREMOD_MEMORY_image_set_sempost_byID(IDshm, -1);
+	ImageStreamIO_write_end(&data.image[IDshm]);
 	data.image[IDshm].md[0].cnt0++;
-	data.image[IDshm].md[0].write = 0;
+    COREMOD_MEMORY_image_set_sempost_byID(IDshm, -1);
 
     return(0);
 }
@@ -2925,6 +3550,159 @@ long COREMOD_MEMORY_cp2shm(const char *IDname, const char *IDshmname)
 
 
 
+/* =============================================================================================== */
+/*  Live stream accounting: update rate, write bandwidth, attached processes                       */
+/* =============================================================================================== */
+
+typedef struct
+{
+	uint64_t cnt0;           /**< cnt0 at last sample */
+	double   t;              /**< time of last sample [s], CLOCK_MONOTONIC, 0 if not sampled */
+	double   rate;           /**< update rate [Hz] */
+	double   Bps;            /**< bytes written per second */
+	long     nproc;          /**< number of processes mapping the stream, -1 if unknown */
+	long     pidstamp;       /**< last pid counted (avoids counting a process twice) */
+} STREAMSTATUS;
+
+static STREAMSTATUS *streamstatus = NULL;
+
+
+
+/** @brief Bytes written by one stream update
+ * 
+ * 3D streams are assumed to be written one slice per update (rolling buffer, ring buffer).
+ */
+static uint64_t COREMOD_MEMORY_streamstatus_framebytes(long ID)
+{
+	uint64_t nbbyte = data.image[ID].md[0].nelement * TYPESIZE[data.image[ID].md[0].atype];
+	
+	if((data.image[ID].md[0].naxis == 3)&&(data.image[ID].md[0].size[2]>0))
+		nbbyte /= data.image[ID].md[0].size[2];
+	
+	return(nbbyte);
+}
+
+
+
+/** @brief Count processes (other than this one) mapping each shared stream
+ * 
+ * Scans /proc/<pid>/maps for files named <stream>.im.shm (in SHAREDMEMDIR or HUGEPAGEDIR).
+ */
+static void COREMOD_MEMORY_streamstatus_scanproc()
+{
+	DIR *d;
+	struct dirent *dir;
+	long i;
+	long mypid = (long) getpid();
+	
+	for(i=0; i<data.NB_MAX_IMAGE; i++)
+	{
+		streamstatus[i].nproc = -1;
+		streamstatus[i].pidstamp = 0;
+		if((data.image[i].used==1)&&(data.image[i].md[0].shared==1))
+			streamstatus[i].nproc = 0;
+	}
+	
+	if((d = opendir("/proc")) == NULL)
+		return;
+	
+	while((dir = readdir(d)) != NULL)
+	{
+		char fname[300];
+		char line[1000];
+		FILE *fp;
+		long pid = atol(dir->d_name);
+		
+		if((pid<=0)||(pid==mypid))
+			continue;
+		
+		sprintf(fname, "/proc/%ld/maps", pid);
+		if((fp = fopen(fname, "r")) == NULL)
+			continue;
+		
+		while(fgets(line, sizeof(line), fp) != NULL)
+		{
+			char *pend = strstr(line, ".im.shm");
+			char *pstart;
+			char name[200];
+			long ID;
+			
+			if(pend == NULL)
+				continue;
+			pstart = pend;
+			while((pstart>line)&&(*(pstart-1)!='/'))
+				pstart--;
+			if((pend-pstart<=0)||(pend-pstart>=(long) sizeof(name)))
+				continue;
+			
+			memcpy(name, pstart, pend-pstart);
+			name[pend-pstart] = '\0';
+			ID = image_ID(name);
+			if((ID != -1)&&(streamstatus[ID].nproc != -1)&&(streamstatus[ID].pidstamp != pid))
+			{
+				streamstatus[ID].nproc++;
+				streamstatus[ID].pidstamp = pid;
+			}
+		}
+		fclose(fp);
+	}
+	closedir(d);
+}
+
+
+
+/** @brief Update live metrics of all images in memory
+ * 
+ * Rates are computed from cnt0 increments since the previous call.
+ * 
+ * @param[in]  scanproc   1 to recount attached processes (scans /proc, slow)
+ */
+static void COREMOD_MEMORY_streamstatus_update(int scanproc)
+{
+	struct timespec tnow;
+	double t;
+	long i;
+	
+	if(streamstatus == NULL)
+		streamstatus = (STREAMSTATUS*) calloc(data.NB_MAX_IMAGE, sizeof(STREAMSTATUS));
+	
+	clock_gettime(CLOCK_MONOTONIC, &tnow);
+	t = 1.0*tnow.tv_sec + 1.0e-9*tnow.tv_nsec;
+	
+	for(i=0; i<data.NB_MAX_IMAGE; i++)
+	{
+		uint64_t cnt0;
+		
+		if(data.image[i].used == 0)
+		{
+			streamstatus[i].t = 0.0;
+			continue;
+		}
+		
+		cnt0 = data.image[i].md[0].cnt0;
+		if((streamstatus[i].t > 0.0)&&(cnt0 >= streamstatus[i].cnt0)&&(t > streamstatus[i].t))
+		{
+			streamstatus[i].rate = (cnt0 - streamstatus[i].cnt0)/(t - streamstatus[i].t);
+			streamstatus[i].Bps = streamstatus[i].rate * COREMOD_MEMORY_streamstatus_framebytes(i);
+		}
+		else
+		{
+			// first sample, or stream re-created
+			streamstatus[i].rate = 0.0;
+			streamstatus[i].Bps = 0.0;
+			streamstatus[i].nproc = -1;
+		}
+		streamstatus[i].cnt0 = cnt0;
+		streamstatus[i].t = t;
+	}
+	
+	if(scanproc == 1)
+		COREMOD_MEMORY_streamstatus_scanproc();
+}
+
+
+
+
 int_fast8_t init_list_image_ID_ncurses(const char *termttyname)
 {
     int wrow, wcol;
@@ -2974,7 +3752,7 @@ int_fast8_t list_image_ID_ncurses()
     sizeb = compute_image_memory();
 
 
-    printw("INDEX    NAME         SIZE                    TYPE        SIZE  [percent]    LAST ACCESS\n");
+    printw("INDEX    NAME         SIZE                    TYPE        SIZE  [percent]    LAST ACCESS       RATE [Hz]    WRITE   NPROC\n");
     printw("\n");
 
     for (i=0; i<data.NB_MAX_IMAGE; i++)
@@ -3053,11 +3831,20 @@ int_fast8_t list_image_ID_ncurses()
             if(timediff<0.01)
             {
                 attron(COLOR_PAIR(4));
-                printw("%15.9f\n", timediff);
+                printw("%15.9f", timediff);
                 attroff(COLOR_PAIR(4));
             }
             else
-                printw("%15.9f\n", timediff);
+                printw("%15.9f", timediff);
+
+            // live metrics, updated by COREMOD_MEMORY_streamstatus()
+            if((streamstatus != NULL)&&(streamstatus[i].t > 0.0))
+            {
+                printw("  %12.1f %8.1f MB/s", streamstatus[i].rate, streamstatus[i].Bps/1048576.0);
+                if(streamstatus[i].nproc >= 0)
+                    printw("  %4ld", streamstatus[i].nproc);
+            }
+            printw("\n");
         }
         else
         {
@@ -3132,6 +3919,139 @@ void close_list_image_ID_ncurses( void )
 
 
 
+/** @brief Write live stream metrics to JSON file
+ * 
+ * File is written to <fname>.tmp then renamed, so that readers never see a partial file.\n
+ * footprint_B is the number of bytes moved through caches per update: frame written once, read by each attached process.
+ */
+static int COREMOD_MEMORY_streamstatus_JSON(const char *fname)
+{
+	FILE *fp;
+	char fnametmp[500];
+	struct timespec tnow;
+	long i;
+	int first = 1;
+	
+	snprintf(fnametmp, sizeof(fnametmp), "%s.tmp", fname);
+	if((fp = fopen(fnametmp, "w")) == NULL)
+	{
+		sprintf(errmsg_memory, "Cannot create file \"%s\"", fnametmp);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
+	
+	clock_gettime(CLOCK_REALTIME, &tnow);
+	fprintf(fp, "{\n\"time\": %ld.%09ld,\n\"memory_B\": %lld,\n\"streams\": [\n", (long) tnow.tv_sec, (long) tnow.tv_nsec, (long long) compute_image_memory());
+	for(i=0; i<data.NB_MAX_IMAGE; i++)
+	{
+		uint64_t framebytes;
+		long nproc;
+		int j;
+		
+		if(data.image[i].used == 0)
+			continue;
+		
+		framebytes = COREMOD_MEMORY_streamstatus_framebytes(i);
+		nproc = streamstatus[i].nproc;
+		
+		fprintf(fp, "%s  {\"name\": \"%s\", \"shared\": %d, \"atype\": %d, \"size\": [", first ? "" : ",\n", data.image[i].md[0].name, (int) data.image[i].md[0].shared, (int) data.image[i].md[0].atype);
+		for(j=0; j<data.image[i].md[0].naxis; j++)
+			fprintf(fp, "%s%ld", (j==0) ? "" : ", ", (long) data.image[i].md[0].size[j]);
+		fprintf(fp, "], \"framebytes\": %lu, \"memsize_B\": %lu, \"cnt0\": %lu, \"rate_Hz\": %.3f, \"write_Bps\": %.0f, \"nproc\": %ld, \"futexwaiters\": %u, \"footprint_B\": %lu}",
+			(unsigned long) framebytes, (unsigned long) data.image[i].memsize, (unsigned long) data.image[i].md[0].cnt0,
+			streamstatus[i].rate, streamstatus[i].Bps, nproc, (unsigned int) data.image[i].md[0].futexwaiters,
+			(unsigned long) (framebytes*(1 + ((nproc>0) ? nproc : 0))));
+		first = 0;
+	}
+	fprintf(fp, "\n]\n}\n");
+	fclose(fp);
+	
+	if(rename(fnametmp, fname) != 0)
+	{
+		sprintf(errmsg_memory, "Cannot rename \"%s\" to \"%s\"", fnametmp, fname);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+
+
+/**
+ * @brief Live stream accounting: update rate, write bandwidth, attached processes
+ * 
+ * Every dtms, updates metrics for all images in memory, refreshes memory monitor (if on) and writes them to a JSON file.\n
+ * Attached processes are recounted every second.\n
+ * Stops on SIGINT / SIGTERM.
+ * 
+ * @param[in]  fname    JSON output file, "NULL" for none
+ * @param[in]  dtms     update period [ms]
+ * @param[in]  allshm   1 to first attach all streams found in SHAREDMEMDIR
+ */
+long COREMOD_MEMORY_streamstatus(const char *fname, long dtms, int allshm)
+{
+	long iter = 0;
+	long scanperiod;
+	
+	if(dtms < 1)
+		dtms = 1;
+	scanperiod = 1000/dtms;
+	if(scanperiod < 1)
+		scanperiod = 1;
+	
+	if(allshm == 1)
+	{
+		DIR *d;
+		struct dirent *dir;
+		
+		if((d = opendir(SHAREDMEMDIR)) != NULL)
+		{
+			while((dir = readdir(d)) != NULL)
+			{
+				char name[200];
+				size_t len = strlen(dir->d_name);
+				
+				if((len<=7)||(len>=sizeof(name)+7)||(strcmp(dir->d_name+len-7, ".im.shm")!=0))
+					continue;
+				memcpy(name, dir->d_name, len-7);
+				name[len-7] = '\0';
+				if(image_ID(name) == -1)
+					read_sharedmem_image(name);
+			}
+			closedir(d);
+		}
+	}
+	
+	if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+		perror("sigaction");
+		exit(EXIT_FAILURE);
+	}
+	if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+		perror("sigaction");
+		exit(EXIT_FAILURE);
+	}
+	
+	COREMOD_MEMORY_streamstatus_update(1);
+	while((data.signal_INT == 0)&&(data.signal_TERM == 0))
+	{
+		usleep(1000*dtms);
+		iter++;
+		COREMOD_MEMORY_streamstatus_update((iter % scanperiod == 0) ? 1 : 0);
+		
+		if(MEM_MONITOR == 1)
+			list_image_ID_ncurses();
+		
+		if(strcmp(fname, "NULL") != 0)
+			if(COREMOD_MEMORY_streamstatus_JSON(fname) != 0)
+				break;
+	}
+	
+	return(iter);
+}
+
+
+
 
 
 
@@ -3223,7 +4143,35 @@ int_fast8_t list_image_ID_ofp(FILE *fo)
 
             timediff = (1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec) - data.image[i].md[0].last_access;
 
-            fprintf(fo, "%15.9f\n", timediff);
+            fprintf(fo, "%15.9f", timediff);
+            
+            if(data.image[i].ring != NULL)
+            {
+                int r;
+                long NBreader = 0;
+                
+                for(r=0; r<RING_NBREADER_MAX; r++)
+                    if(data.image[i].ring->reader[r].used == 1)
+                        NBreader++;
+                fprintf(fo, "   RING %ld slots  windex %ld  %ld reader(s)", (long) data.image[i].ring->NBslot, (long) data.image[i].ring->writeindex, NBreader);
+            }
+            
+            if(data.image[i].md[0].shared==1)
+            {
+                int node;
+                
+                if(data.image[i].md[0].hugepage == 2)
+                    fprintf(fo, "   HUGETLB");
+                if(data.image[i].md[0].hugepage == 1)
+                    fprintf(fo, "   THP");
+                
+                node = ImageStreamIO_datanode(&data.image[i]);
+                if(data.image[i].md[0].numanode >= 0)
+                    fprintf(fo, "   NUMA %d (bound %d)", node, (int) data.image[i].md[0].numanode);
+                else if(node >= 0)
+                    fprintf(fo, "   NUMA %d", node);
+            }
+            fprintf(fo, "\n");
         }
     fprintf(fo, "\n");
 
@@ -3423,7 +4371,138 @@ int_fast8_t list_variable_ID_file(const char *fname)
 
 
 
-int_fast8_t mk_complex_from_reim(const char *re_name, const char *im_name, const char *out_name, int sharedmem)
+//
+// amplitude/phase <-> real/imaginary kernels
+// strided access so the same kernel serves interleaved complex arrays (stride 2) and separate planes (stride 1)
+// element k is read before being written: in-place conversion (output buffers = input buffers) is safe
+// written as omp simd loops so that sin/cos/atan2 map to glibc vector variants (libmvec) with -O2 -fopenmp -ffast-math
+// cos and sin are computed in separate loops over MKCPLX_BLOCKSIZE elements: a fused pair is turned into scalar sincos
+//
+
+static void mk_amph2reim_F(const float *am, const float *ph, float *re, float *im, long sinp, long sout, long nelement)
+{
+    long ii0;
+
+# ifdef _OPENMP
+    #pragma omp parallel for if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
+# endif
+    for(ii0=0; ii0<nelement; ii0+=MKCPLX_BLOCKSIZE)
+    {
+        float c[MKCPLX_BLOCKSIZE];
+        float s[MKCPLX_BLOCKSIZE];
+        long nb = (nelement-ii0 < MKCPLX_BLOCKSIZE) ? nelement-ii0 : MKCPLX_BLOCKSIZE;
+        long k;
+
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+            c[k] = cosf(ph[(ii0+k)*sinp]);
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+            s[k] = sinf(ph[(ii0+k)*sinp]);
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+        {
+            float a = am[(ii0+k)*sinp];
+            re[(ii0+k)*sout] = a*c[k];
+            im[(ii0+k)*sout] = a*s[k];
+        }
+    }
+}
+
+static void mk_amph2reim_D(const double *am, const double *ph, double *re, double *im, long sinp, long sout, long nelement)
+{
+    long ii0;
+
+# ifdef _OPENMP
+    #pragma omp parallel for if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
+# endif
+    for(ii0=0; ii0<nelement; ii0+=MKCPLX_BLOCKSIZE)
+    {
+        double c[MKCPLX_BLOCKSIZE];
+        double s[MKCPLX_BLOCKSIZE];
+        long nb = (nelement-ii0 < MKCPLX_BLOCKSIZE) ? nelement-ii0 : MKCPLX_BLOCKSIZE;
+        long k;
+
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+            c[k] = cos(ph[(ii0+k)*sinp]);
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+            s[k] = sin(ph[(ii0+k)*sinp]);
+        #pragma omp simd
+        for(k=0; k<nb; k++)
+        {
+            double a = am[(ii0+k)*sinp];
+            re[(ii0+k)*sout] = a*c[k];
+            im[(ii0+k)*sout] = a*s[k];
+        }
+    }
+}
+
+static void mk_reim2amph_F(const float *re, const float *im, float *am, float *ph, long sinp, long sout, long nelement)
+{
+    long ii;
+
+# ifdef _OPENMP
+    #pragma omp parallel for simd if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
+# endif
+    for(ii=0; ii<nelement; ii++)
+    {
+        float r = re[ii*sinp];
+        float i = im[ii*sinp];
+        am[ii*sout] = sqrtf(r*r + i*i);
+        ph[ii*sout] = atan2f(i, r);
+    }
+}
+
+static void mk_reim2amph_D(const double *re, const double *im, double *am, double *ph, long sinp, long sout, long nelement)
+{
+    long ii;
+
+# ifdef _OPENMP
+    #pragma omp parallel for simd if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
+# endif
+    for(ii=0; ii<nelement; ii++)
+    {
+        double r = re[ii*sinp];
+        double i = im[ii*sinp];
+        am[ii*sout] = sqrt(r*r + i*i);
+        ph[ii*sout] = atan2(i, r);
+    }
+}
+
+
+// output image: existing image reused if type and size match (no allocation for per-frame calls), re-created otherwise
+static long mk_complex_conv_outimage(const char *name, long naxis, uint32_t *naxes, uint8_t atype, long nelement, int sharedmem)
+{
+    long ID;
+
+    ID = image_ID(name);
+    if(ID != -1)
+    {
+        if((data.image[ID].md[0].atype == atype)&&(data.image[ID].md[0].nelement == nelement)&&(data.image[ID].md[0].naxis == naxis))
+            return(ID);
+        delete_image_ID(name);
+    }
+
+    return(create_image_ID(name, naxis, naxes, atype, sharedmem, data.NBKEWORD_DFT));
+}
+
+
+// mark output image updated
+static void mk_complex_conv_outupdate(long ID, int sharedmem)
+{
+    if(sharedmem==1)
+        COREMOD_MEMORY_image_set_sempost_byID(ID, -1);
+    data.image[ID].md[0].cnt0++;
+    data.image[ID].md[0].write = 0;
+}
+
+
+
+
+
+int_fast8_t mk_complex_from_reim(const char *re_name, const char *im_name, const char *out_name, int sharedmem)
 {
     long IDre,IDim,IDout;
     uint32_t *naxes = NULL;
@@ -3537,89 +4616,48 @@ int_fast8_t mk_complex_from_amph(const char *am_name, const char *ph_name, const
     if((atype_am == _DATATYPE_FLOAT)&&(atype_ph == _DATATYPE_FLOAT))
     {
         atype_out = _DATATYPE_COMPLEX_FLOAT;
-        IDout = create_image_ID(out_name, naxis, naxes, atype_out, sharedmem, data.NBKEWORD_DFT);
-        
+        IDout = mk_complex_conv_outimage(out_name, naxis, naxes, atype_out, nelement, sharedmem);
         data.image[IDout].md[0].write = 1;
-# ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-        {
-            #pragma omp for
-# endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                data.image[IDout].array.CF[ii].re = data.image[IDam].array.F[ii]*((float) cos(data.image[IDph].array.F[ii]));
-                data.image[IDout].array.CF[ii].im = data.image[IDam].array.F[ii]*((float) sin(data.image[IDph].array.F[ii]));
-            }
-# ifdef _OPENMP
-        }
-# endif
-        data.image[IDout].md[0].cnt0++;
-        data.image[IDout].md[0].write = 0;
-
+        mk_amph2reim_F(data.image[IDam].array.F, data.image[IDph].array.F, &data.image[IDout].array.CF[0].re, &data.image[IDout].array.CF[0].im, 1, 2, nelement);
+        mk_complex_conv_outupdate(IDout, sharedmem);
     }
-    else if((atype_am == _DATATYPE_FLOAT)&&(atype_ph == _DATATYPE_DOUBLE))
+    else if((atype_am == _DATATYPE_DOUBLE)&&(atype_ph == _DATATYPE_DOUBLE))
     {
         atype_out = _DATATYPE_COMPLEX_DOUBLE;
-        IDout = create_image_ID(out_name, naxis, naxes, atype_out, sharedmem, data.NBKEWORD_DFT);
+        IDout = mk_complex_conv_outimage(out_name, naxis, naxes, atype_out, nelement, sharedmem);
         data.image[IDout].md[0].write = 1;
-# ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-        {
-            #pragma omp for
-# endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                data.image[IDout].array.CD[ii].re = data.image[IDam].array.F[ii]*cos(data.image[IDph].array.D[ii]);
-                data.image[IDout].array.CD[ii].im = data.image[IDam].array.F[ii]*sin(data.image[IDph].array.D[ii]);
-            }
-# ifdef _OPENMP
-        }
-# endif
-        data.image[IDout].md[0].cnt0++;
-        data.image[IDout].md[0].write = 0;
+        mk_amph2reim_D(data.image[IDam].array.D, data.image[IDph].array.D, &data.image[IDout].array.CD[0].re, &data.image[IDout].array.CD[0].im, 1, 2, nelement);
+        mk_complex_conv_outupdate(IDout, sharedmem);
     }
-    else if((atype_am == _DATATYPE_DOUBLE)&&(atype_ph == _DATATYPE_FLOAT))
+    else if((atype_am == _DATATYPE_FLOAT)&&(atype_ph == _DATATYPE_DOUBLE))
     {
         atype_out = _DATATYPE_COMPLEX_DOUBLE;
-        IDout = create_image_ID(out_name, naxis, naxes, atype_out, sharedmem, data.NBKEWORD_DFT);
+        IDout = mk_complex_conv_outimage(out_name, naxis, naxes, atype_out, nelement, sharedmem);
         data.image[IDout].md[0].write = 1;
 # ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-        {
-            #pragma omp for
+        #pragma omp parallel for simd if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
 # endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                data.image[IDout].array.CD[ii].re = data.image[IDam].array.D[ii]*cos(data.image[IDph].array.F[ii]);
-                data.image[IDout].array.CD[ii].im = data.image[IDam].array.D[ii]*sin(data.image[IDph].array.F[ii]);
-            }
-# ifdef _OPENMP
+        for(ii=0; ii<nelement; ii++)
+        {
+            data.image[IDout].array.CD[ii].re = data.image[IDam].array.F[ii]*cos(data.image[IDph].array.D[ii]);
+            data.image[IDout].array.CD[ii].im = data.image[IDam].array.F[ii]*sin(data.image[IDph].array.D[ii]);
         }
-# endif
-        data.image[IDout].md[0].cnt0++;
-        data.image[IDout].md[0].write = 0;
-
+        mk_complex_conv_outupdate(IDout, sharedmem);
     }
-    else if((atype_am == _DATATYPE_DOUBLE)&&(atype_ph == _DATATYPE_DOUBLE))
+    else if((atype_am == _DATATYPE_DOUBLE)&&(atype_ph == _DATATYPE_FLOAT))
     {
         atype_out = _DATATYPE_COMPLEX_DOUBLE;
-        IDout = create_image_ID(out_name, naxis, naxes, atype_out, sharedmem, data.NBKEWORD_DFT);
+        IDout = mk_complex_conv_outimage(out_name, naxis, naxes, atype_out, nelement, sharedmem);
         data.image[IDout].md[0].write = 1;
 # ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT)
-        {
-            #pragma omp for
+        #pragma omp parallel for simd if (nelement>OMP_NELEMENT_LIMIT_TRANSC)
 # endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                data.image[IDout].array.CD[ii].re = data.image[IDam].array.D[ii]*cos(data.image[IDph].array.D[ii]);
-                data.image[IDout].array.CD[ii].im = data.image[IDam].array.D[ii]*sin(data.image[IDph].array.D[ii]);
-            }
-# ifdef _OPENMP
+        for(ii=0; ii<nelement; ii++)
+        {
+            data.image[IDout].array.CD[ii].re = data.image[IDam].array.D[ii]*cos(data.image[IDph].array.F[ii]);
+            data.image[IDout].array.CD[ii].im = data.image[IDam].array.D[ii]*sin(data.image[IDph].array.F[ii]);
         }
-# endif
-        data.image[IDout].md[0].cnt0++;
-        data.image[IDout].md[0].write = 0;
+        mk_complex_conv_outupdate(IDout, sharedmem);
     }
     else
     {
@@ -3737,10 +4775,7 @@ int_fast8_t mk_amph_from_complex(const char *in_name, const char *am_name, const
     uint32_t naxes[3];
     long naxis;
     long nelement;
-    long ii;
     long i;
-    float amp_f,pha_f;
-    double amp_d,pha_d;
     uint8_t atype;
     int n;
 
@@ -3754,65 +4789,23 @@ int_fast8_t mk_amph_from_complex(const char *in_name, const char *am_name, const
 
     if(atype == _DATATYPE_COMPLEX_FLOAT) // single precision
     {
-        IDam = create_image_ID(am_name, naxis, naxes,  _DATATYPE_FLOAT, sharedmem, data.NBKEWORD_DFT);
-        IDph = create_image_ID(ph_name, naxis, naxes,  _DATATYPE_FLOAT, sharedmem, data.NBKEWORD_DFT);
+        IDam = mk_complex_conv_outimage(am_name, naxis, naxes, _DATATYPE_FLOAT, nelement, sharedmem);
+        IDph = mk_complex_conv_outimage(ph_name, naxis, naxes, _DATATYPE_FLOAT, nelement, sharedmem);
         data.image[IDam].md[0].write = 1;
         data.image[IDph].md[0].write = 1;
-# ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT) private(ii,amp_f,pha_f)
-        {
-            #pragma omp for
-# endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                amp_f = (float) sqrt(data.image[IDin].array.CF[ii].re*data.image[IDin].array.CF[ii].re + data.image[IDin].array.CF[ii].im*data.image[IDin].array.CF[ii].im);
-                pha_f = (float) atan2(data.image[IDin].array.CF[ii].im,data.image[IDin].array.CF[ii].re);
-                data.image[IDam].array.F[ii] = amp_f;
-                data.image[IDph].array.F[ii] = pha_f;
-            }
-# ifdef _OPENMP
-        }
-# endif
-		if(sharedmem==1)
-		{
-			COREMOD_MEMORY_image_set_sempost_byID(IDam, -1);
-			COREMOD_MEMORY_image_set_sempost_byID(IDph, -1);
-        }
-        data.image[IDam].md[0].cnt0++;
-        data.image[IDph].md[0].cnt0++;
-        data.image[IDam].md[0].write = 0;
-        data.image[IDph].md[0].write = 0;
+        mk_reim2amph_F(&data.image[IDin].array.CF[0].re, &data.image[IDin].array.CF[0].im, data.image[IDam].array.F, data.image[IDph].array.F, 2, 1, nelement);
+        mk_complex_conv_outupdate(IDam, sharedmem);
+        mk_complex_conv_outupdate(IDph, sharedmem);
     }
     else if(atype == _DATATYPE_COMPLEX_DOUBLE) // double precision
     {
-        IDam = create_image_ID(am_name, naxis, naxes, _DATATYPE_DOUBLE, sharedmem, data.NBKEWORD_DFT);
-        IDph = create_image_ID(ph_name, naxis, naxes, _DATATYPE_DOUBLE, sharedmem, data.NBKEWORD_DFT);
+        IDam = mk_complex_conv_outimage(am_name, naxis, naxes, _DATATYPE_DOUBLE, nelement, sharedmem);
+        IDph = mk_complex_conv_outimage(ph_name, naxis, naxes, _DATATYPE_DOUBLE, nelement, sharedmem);
         data.image[IDam].md[0].write = 1;
         data.image[IDph].md[0].write = 1;
-# ifdef _OPENMP
-        #pragma omp parallel if (nelement>OMP_NELEMENT_LIMIT) private(ii,amp_d,pha_d)
-        {
-            #pragma omp for
-# endif
-            for(ii=0; ii<nelement; ii++)
-            {
-                amp_d = sqrt(data.image[IDin].array.CD[ii].re*data.image[IDin].array.CD[ii].re + data.image[IDin].array.CD[ii].im*data.image[IDin].array.CD[ii].im);
-                pha_d = atan2(data.image[IDin].array.CD[ii].im,data.image[IDin].array.CD[ii].re);
-                data.image[IDam].array.D[ii] = amp_d;
-                data.image[IDph].array.D[ii] = pha_d;
-            }
-# ifdef _OPENMP
-        }
-# endif
-		if(sharedmem==1)
-		{
-			COREMOD_MEMORY_image_set_sempost_byID(IDam, -1);
-			COREMOD_MEMORY_image_set_sempost_byID(IDph, -1);
-        }
-        data.image[IDam].md[0].cnt0++;
-        data.image[IDph].md[0].cnt0++;
-        data.image[IDam].md[0].write = 0;
-        data.image[IDph].md[0].write = 0;
+        mk_reim2amph_D(&data.image[IDin].array.CD[0].re, &data.image[IDin].array.CD[0].im, data.image[IDam].array.D, data.image[IDph].array.D, 2, 1, nelement);
+        mk_complex_conv_outupdate(IDam, sharedmem);
+        mk_complex_conv_outupdate(IDph, sharedmem);
     }
     else
     {
@@ -3829,20 +4822,90 @@ int_fast8_t mk_amph_from_complex(const char *in_name, const char *am_name, const
 
 
 
+//
+// direct plane-to-plane conversions (no complex temporary) if both inputs have the same type
+// output names may be the input names (in-place), e.g. mk_reim_from_amph("wf", "ph", "wf", "ph", 0)
+//
 int_fast8_t mk_reim_from_amph(const char *am_name, const char *ph_name, const char *re_out_name, const char *im_out_name, int sharedmem)
 {
-    mk_complex_from_amph(am_name, ph_name, "Ctmp", 0);
-    mk_reim_from_complex("Ctmp", re_out_name, im_out_name, sharedmem);
-    delete_image_ID("Ctmp");
+    long IDam, IDph, IDre, IDim;
+    uint32_t naxes[3];
+    long naxis;
+    long nelement;
+    long i;
+    uint8_t atype;
+
+    IDam = image_ID(am_name);
+    IDph = image_ID(ph_name);
+    atype = data.image[IDam].md[0].atype;
+
+    if((atype != data.image[IDph].md[0].atype)||((atype != _DATATYPE_FLOAT)&&(atype != _DATATYPE_DOUBLE)))
+    {
+        mk_complex_from_amph(am_name, ph_name, "Ctmp", 0);
+        mk_reim_from_complex("Ctmp", re_out_name, im_out_name, sharedmem);
+        delete_image_ID("Ctmp");
+        return(0);
+    }
+
+    naxis = data.image[IDam].md[0].naxis;
+    for(i=0; i<naxis; i++)
+        naxes[i] = data.image[IDam].md[0].size[i];
+    nelement = data.image[IDam].md[0].nelement;
+
+    IDre = mk_complex_conv_outimage(re_out_name, naxis, naxes, atype, nelement, sharedmem);
+    IDim = mk_complex_conv_outimage(im_out_name, naxis, naxes, atype, nelement, sharedmem);
+    IDam = image_ID(am_name); // outputs created before inputs could be re-indexed
+    IDph = image_ID(ph_name);
+    data.image[IDre].md[0].write = 1;
+    data.image[IDim].md[0].write = 1;
+    if(atype == _DATATYPE_FLOAT)
+        mk_amph2reim_F(data.image[IDam].array.F, data.image[IDph].array.F, data.image[IDre].array.F, data.image[IDim].array.F, 1, 1, nelement);
+    else
+        mk_amph2reim_D(data.image[IDam].array.D, data.image[IDph].array.D, data.image[IDre].array.D, data.image[IDim].array.D, 1, 1, nelement);
+    mk_complex_conv_outupdate(IDre, sharedmem);
+    mk_complex_conv_outupdate(IDim, sharedmem);
 
     return(0);
 }
 
 int_fast8_t mk_amph_from_reim(const char *re_name, const char *im_name, const char *am_out_name, const char *ph_out_name, int sharedmem)
 {
-    mk_complex_from_reim(re_name, im_name, "Ctmp", 0);
-    mk_amph_from_complex("Ctmp",am_out_name, ph_out_name, sharedmem);
-    delete_image_ID("Ctmp");
+    long IDre, IDim, IDam, IDph;
+    uint32_t naxes[3];
+    long naxis;
+    long nelement;
+    long i;
+    uint8_t atype;
+
+    IDre = image_ID(re_name);
+    IDim = image_ID(im_name);
+    atype = data.image[IDre].md[0].atype;
+
+    if((atype != data.image[IDim].md[0].atype)||((atype != _DATATYPE_FLOAT)&&(atype != _DATATYPE_DOUBLE)))
+    {
+        mk_complex_from_reim(re_name, im_name, "Ctmp", 0);
+        mk_amph_from_complex("Ctmp", am_out_name, ph_out_name, sharedmem);
+        delete_image_ID("Ctmp");
+        return(0);
+    }
+
+    naxis = data.image[IDre].md[0].naxis;
+    for(i=0; i<naxis; i++)
+        naxes[i] = data.image[IDre].md[0].size[i];
+    nelement = data.image[IDre].md[0].nelement;
+
+    IDam = mk_complex_conv_outimage(am_out_name, naxis, naxes, atype, nelement, sharedmem);
+    IDph = mk_complex_conv_outimage(ph_out_name, naxis, naxes, atype, nelement, sharedmem);
+    IDre = image_ID(re_name);
+    IDim = image_ID(im_name);
+    data.image[IDam].md[0].write = 1;
+    data.image[IDph].md[0].write = 1;
+    if(atype == _DATATYPE_FLOAT)
+        mk_reim2amph_F(data.image[IDre].array.F, data.image[IDim].array.F, data.image[IDam].array.F, data.image[IDph].array.F, 1, 1, nelement);
+    else
+        mk_reim2amph_D(data.image[IDre].array.D, data.image[IDim].array.D, data.image[IDam].array.D, data.image[IDph].array.D, 1, 1, nelement);
+    mk_complex_conv_outupdate(IDam, sharedmem);
+    mk_complex_conv_outupdate(IDph, sharedmem);
 
     return(0);
 }
@@ -4010,15 +5073,133 @@ long COREMOD_MEMORY_check_3Dsize(const char *IDname, uint32_t xsize, uint32_t ys
 
 
 
+/*
+ * Cube transpose : tiles of ROTCUBE_TILE x ROTCUBE_TILE elements, made of ROTCUBE_KERNEL x ROTCUBE_KERNEL blocks
+ * loaded into a local array and stored transposed (kept in vector registers by the compiler for 4- and 8-byte types).
+ * Other types are copied element by element within the same tiles.
+ */
+
+#define ROTCUBE_TILE   32   // tile side [element]
+#define ROTCUBE_KERNEL 8    // register block side [element]
+
+
+#define ROTCUBE_TRANSPOSE2D(NAME, TYPE)                                                    \
+static void NAME(const TYPE *restrict in, long instride, TYPE *restrict out, long outstride, long nrow, long ncol) \
+{                                                                                          \
+    long i0, j0, i, j;                                                                     \
+                                                                                           \
+    for(j0=0; j0<ncol; j0+=ROTCUBE_TILE)                                                   \
+        for(i0=0; i0<nrow; i0+=ROTCUBE_TILE)                                               \
+        {                                                                                  \
+            long i1 = (i0+ROTCUBE_TILE < nrow) ? i0+ROTCUBE_TILE : nrow;                   \
+            long j1 = (j0+ROTCUBE_TILE < ncol) ? j0+ROTCUBE_TILE : ncol;                   \
+            long ib, jb;                                                                   \
+                                                                                           \
+            for(jb=j0; jb+ROTCUBE_KERNEL<=j1; jb+=ROTCUBE_KERNEL)                          \
+                for(ib=i0; ib+ROTCUBE_KERNEL<=i1; ib+=ROTCUBE_KERNEL)                      \
+                {                                                                          \
+                    TYPE r[ROTCUBE_KERNEL][ROTCUBE_KERNEL];                                \
+                                                                                           \
+                    for(i=0; i<ROTCUBE_KERNEL; i++)                                        \
+                        for(j=0; j<ROTCUBE_KERNEL; j++)                                    \
+                            r[j][i] = in[(ib+i)*instride + jb+j];                          \
+                    for(j=0; j<ROTCUBE_KERNEL; j++)                                        \
+                        for(i=0; i<ROTCUBE_KERNEL; i++)                                    \
+                            out[(jb+j)*outstride + ib+i] = r[j][i];                        \
+                }                                                                          \
+            /* tile edges */                                                               \
+            for(j=j0; j<j1; j++)                                                           \
+                for(i=i0; i<i1; i++)                                                       \
+                    if( (j >= j0+(j1-j0)/ROTCUBE_KERNEL*ROTCUBE_KERNEL) || (i >= i0+(i1-i0)/ROTCUBE_KERNEL*ROTCUBE_KERNEL) ) \
+                        out[j*outstride + i] = in[i*instride + j];                         \
+        }                                                                                  \
+}
+
+ROTCUBE_TRANSPOSE2D(rotate_cube_transpose2D_4, uint32_t)
+ROTCUBE_TRANSPOSE2D(rotate_cube_transpose2D_8, uint64_t)
+
+
+
+/* transpose nrow x ncol matrix, strides in elements of typesize bytes */
+static void rotate_cube_transpose2D(const char *in, long instride, char *out, long outstride, long nrow, long ncol, int typesize)
+{
+    long i0, j0, i, j;
+
+    if(typesize == 4)
+        rotate_cube_transpose2D_4((const uint32_t*) in, instride, (uint32_t*) out, outstride, nrow, ncol);
+    else if(typesize == 8)
+        rotate_cube_transpose2D_8((const uint64_t*) in, instride, (uint64_t*) out, outstride, nrow, ncol);
+    else
+        for(j0=0; j0<ncol; j0+=ROTCUBE_TILE)
+            for(i0=0; i0<nrow; i0+=ROTCUBE_TILE)
+                for(j=j0; (j<j0+ROTCUBE_TILE)&&(j<ncol); j++)
+                    for(i=i0; (i<i0+ROTCUBE_TILE)&&(i<nrow); i++)
+                        memcpy(out + (j*outstride + i)*typesize, in + (i*instride + j)*typesize, typesize);
+}
+
+
+
+/*
+ * Transpose slices k0 to k0+nz-1 of cube in[z][y][x] into output slices o0 to o0+nb-1, stored in out
+ *   orientation 0 : out[x][y][z], output slice index = x
+ *   orientation 1 : out[y][z][x], output slice index = y
+ * in points to slice k0, out to output slice o0.
+ */
+static void rotate_cube_block(const char *in, char *out, long xsize, long ysize, long zsize, long k0, long nz, long o0, long nb, int orientation, int typesize)
+{
+    long xysize = xsize*ysize;
+    long n;
+
+    if(orientation == 0)
+    {
+        // one task per (y, tile of input slices)
+        long NBtile = (nz+ROTCUBE_TILE-1)/ROTCUBE_TILE;
+
+# ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic) if (xysize*nz > OMP_NELEMENT_LIMIT)
+# endif
+        for(n=0; n<ysize*NBtile; n++)
+        {
+            long jj = n / NBtile;
+            long z0 = (n % NBtile)*ROTCUBE_TILE;
+            long z1 = (z0+ROTCUBE_TILE < nz) ? z0+ROTCUBE_TILE : nz;
+
+            rotate_cube_transpose2D(in + (z0*xysize + jj*xsize + o0)*typesize, xysize, out + (jj*zsize + k0 + z0)*typesize, ysize*zsize, z1-z0, nb, typesize);
+        }
+    }
+    else
+    {
+        // rows of x are contiguous in input and output
+# ifdef _OPENMP
+        #pragma omp parallel for if (xysize*nz > OMP_NELEMENT_LIMIT)
+# endif
+        for(n=0; n<nb; n++)
+        {
+            long kk;
+
+            for(kk=0; kk<nz; kk++)
+                memcpy(out + (n*zsize + k0 + kk)*xsize*typesize, in + (kk*xysize + (o0+n)*xsize)*typesize, xsize*typesize);
+        }
+    }
+}
+
+
+
+/**
+ * @brief Rotate cube axes
+ *
+ * orientation 0 : swap x and z axes, 1 : swap y and z axes.\n
+ * Tiled, multithreaded transpose, any data type.
+ */
 int_fast8_t rotate_cube(const char *ID_name, const char *ID_out_name, int orientation)
 {
     /* 0 is from x axis */
     /* 1 is from y axis */
     long ID,IDout;
     uint32_t xsize, ysize, zsize;
-    uint32_t xsize1, ysize1, zsize1;
-    uint32_t ii, jj, kk;
+    uint32_t sizeout[3];
     uint8_t atype;
+    int typesize;
     int n;
 
     ID = image_ID(ID_name);
@@ -4037,57 +5218,8 @@ int_fast8_t rotate_cube(const char *ID_name, const char *ID_out_name, int orient
     ysize = data.image[ID].md[0].size[1];
     zsize = data.image[ID].md[0].size[2];
 
-    if(atype == _DATATYPE_FLOAT) // single precision
-    {
-        if(orientation==0)
-        {
-            xsize1 = zsize;
-            ysize1 = ysize;
-            zsize1 = xsize;
-            IDout = create_3Dimage_ID_float(ID_out_name,xsize1,ysize1,zsize1);
-            for(ii=0; ii<xsize1; ii++)
-                for(jj=0; jj<ysize1; jj++)
-                    for(kk=0; kk<zsize1; kk++)
-                        data.image[IDout].array.F[kk*ysize1*xsize1+jj*xsize1+ii] = data.image[ID].array.F[ii*xsize*ysize+jj*xsize+kk];
-        }
-        else
-        {
-            xsize1 = xsize;
-            ysize1 = zsize;
-            zsize1 = ysize;
-            IDout = create_3Dimage_ID_float(ID_out_name,xsize1,ysize1,zsize1);
-            for(ii=0; ii<xsize1; ii++)
-                for(jj=0; jj<ysize1; jj++)
-                    for(kk=0; kk<zsize1; kk++)
-                        data.image[IDout].array.F[kk*ysize1*xsize1+jj*xsize1+ii] = data.image[ID].array.F[jj*xsize*ysize+kk*xsize+ii];
-        }
-    }
-    else if(atype == _DATATYPE_DOUBLE)
-    {
-        if(orientation==0)
-        {
-            xsize1 = zsize;
-            ysize1 = ysize;
-            zsize1 = xsize;
-            IDout = create_3Dimage_ID_double(ID_out_name,xsize1,ysize1,zsize1);
-            for(ii=0; ii<xsize1; ii++)
-                for(jj=0; jj<ysize1; jj++)
-                    for(kk=0; kk<zsize1; kk++)
-                        data.image[IDout].array.D[kk*ysize1*xsize1+jj*xsize1+ii] = data.image[ID].array.D[ii*xsize*ysize+jj*xsize+kk];
-        }
-        else
-        {
-            xsize1 = xsize;
-            ysize1 = zsize;
-            zsize1 = ysize;
-            IDout = create_3Dimage_ID_double(ID_out_name,xsize1,ysize1,zsize1);
-            for(ii=0; ii<xsize1; ii++)
-                for(jj=0; jj<ysize1; jj++)
-                    for(kk=0; kk<zsize1; kk++)
-                        data.image[IDout].array.D[kk*ysize1*xsize1+jj*xsize1+ii] = data.image[ID].array.D[jj*xsize*ysize+kk*xsize+ii];
-        }
-    }
-    else
+    typesize = TYPESIZE[atype];
+    if(typesize == 0)
     {
         n = snprintf(errmsg_memory,SBUFFERSIZE,"Wrong image type(s)\n");
         if(n >= SBUFFERSIZE)
@@ -4097,22 +5229,148 @@ int_fast8_t rotate_cube(const char *ID_name, const char *ID_out_name, int orient
         exit(0);
     }
 
-    return(0);
-}
-
-
-
-
-
+    if(orientation==0)
+    {
+        sizeout[0] = zsize;
+        sizeout[1] = ysize;
+        sizeout[2] = xsize;
+    }
+    else
+    {
+        sizeout[0] = xsize;
+        sizeout[1] = zsize;
+        sizeout[2] = ysize;
+    }
+    IDout = create_image_ID_flags(ID_out_name, 3, sizeout, atype, 0, data.NBKEWORD_DFT, IMAGE_FLAG_NOZERO);
 
+    rotate_cube_block((const char*) data.image[ID].array.UI8, (char*) data.image[IDout].array.UI8, xsize, ysize, zsize, 0, zsize, 0, sizeout[2], orientation, typesize);
 
+    return(0);
+}
 
 
 
-/* =============================================================================================== */
-/* =============================================================================================== */
-/*                                                                                                 */
-/* 11. SET IMAGE FLAGS / COUNTERS                                                                  */
+/**
+ * @brief Rotate axes of a FITS cube too large to be held in memory
+ *
+ * Same as rotate_cube() (orientation 0 : swap x and z, 1 : swap y and z), float output.\n
+ * Output is built in slabs of output slices. For each slab, input is streamed in chunks of slices. Both slab and chunk use up to MBmax/2 Mbyte.
+ * The input file is read once per output slab.
+ *
+ * @return 0 if OK, -1 if files cannot be read / written
+ */
+int rotate_cube_fits(const char *file_in, const char *file_out, int orientation, long MBmax)
+{
+    FITS_SLICEREADER *rd;
+    FITS_SLICEWRITER *wr;
+    long naxis;
+    uint32_t naxes[3] = {1, 1, 1};
+    long xsize, ysize, zsize;
+    uint32_t sizeout[3];
+    long slicein, sliceout;
+    long Zb, Nb;
+    float *inbuf, *slab;
+    long o0, k0;
+    int err = 0;
+
+    if((rd = fits_slicereader_open(file_in, &naxis, naxes)) == NULL)
+        return(-1);
+    if(naxis != 3)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input is not a cube");
+        fits_slicereader_close(rd);
+        return(-1);
+    }
+    xsize = naxes[0];
+    ysize = naxes[1];
+    zsize = naxes[2];
+    if(orientation==0)
+    {
+        sizeout[0] = zsize;
+        sizeout[1] = ysize;
+        sizeout[2] = xsize;
+    }
+    else
+    {
+        sizeout[0] = xsize;
+        sizeout[1] = zsize;
+        sizeout[2] = ysize;
+    }
+    if((wr = fits_slicewriter_open(file_out, sizeout[0], sizeout[1], sizeout[2])) == NULL)
+    {
+        fits_slicereader_close(rd);
+        return(-1);
+    }
+
+    slicein = xsize*ysize;
+    sliceout = (long) sizeout[0]*sizeout[1];
+    Zb = (long) (MBmax*524288/sizeof(float)) / slicein;
+    Nb = (long) (MBmax*524288/sizeof(float)) / sliceout;
+    if(Zb < 1)
+        Zb = 1;
+    if(Zb > zsize)
+        Zb = zsize;
+    if(Nb < 1)
+        Nb = 1;
+    if(Nb > sizeout[2])
+        Nb = sizeout[2];
+
+    inbuf = (float*) malloc(sizeof(float)*Zb*slicein);
+    slab = (float*) malloc(sizeof(float)*Nb*sliceout);
+    if((inbuf == NULL)||(slab == NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+
+    printf("rotate_cube_fits : %ld output slab(s) of %ld slices, input chunks of %ld slices\n", (sizeout[2]+Nb-1)/Nb, Nb, Zb);
+    fflush(stdout);
+
+    for(o0=0; (o0<sizeout[2])&&(err==0); o0+=Nb)
+    {
+        long nb = (o0+Nb < sizeout[2]) ? Nb : sizeout[2]-o0;
+
+        for(k0=0; (k0<zsize)&&(err==0); k0+=Zb)
+        {
+            long nz = (k0+Zb < zsize) ? Zb : zsize-k0;
+
+            if(fits_slicereader_read(rd, k0, nz, inbuf) != 0)
+                err = 1;
+            else
+                rotate_cube_block((const char*) inbuf, (char*) slab, xsize, ysize, zsize, k0, nz, o0, nb, orientation, sizeof(float));
+        }
+        if((err == 0)&&(fits_slicewriter_write(wr, o0, nb, slab) != 0))
+            err = 1;
+    }
+
+    free(inbuf);
+    free(slab);
+    fits_slicereader_close(rd);
+    if(fits_slicewriter_close(wr) != 0)
+        err = 1;
+
+    if(err == 1)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "read / write error");
+        return(-1);
+    }
+
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/* =============================================================================================== */
+/*                                                                                                 */
+/* 11. SET IMAGE FLAGS / COUNTERS                                                                  */
 /*                                                                                                 */
 /* =============================================================================================== */
 /* =============================================================================================== */
@@ -4203,58 +5461,18 @@ long COREMOD_MEMORY_image_set_sempost(const char *IDname, long index)
     if(ID==-1)
         ID = read_sharedmem_image(IDname);
 
-    if(index<0)
-    {
-        for(s=0; s<data.image[ID].md[0].sem; s++)
-        {
-            sem_getvalue(data.image[ID].semptr[s], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[ID].semptr[s]);
-        }
-    }
-    else
-    {
-        if(index>data.image[ID].md[0].sem-1)
-            printf("ERROR: image %s semaphore # %ld does no exist\n", IDname, index);
-        else
-        {
-            sem_getvalue(data.image[ID].semptr[index], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[ID].semptr[index]);
-        }
-    }
+    ImageStreamIO_sempost(&data.image[ID], index);
 
     return(ID);
 }
 
 //
 // if index = -1, post all semaphores
+// also wakes readers waiting on cnt0 in futex mode
 //
 long COREMOD_MEMORY_image_set_sempost_byID(long ID, long index)
 {
-    long s;
-    int semval;
-
-    if(index<0)
-    {
-        for(s=0; s<data.image[ID].md[0].sem; s++)
-        {
-            sem_getvalue(data.image[ID].semptr[s], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[ID].semptr[s]);
-        }
-    }
-    else
-    {
-        if(index>data.image[ID].md[0].sem-1)
-            printf("ERROR: image ID %ld semaphore # %ld does no exist\n", ID, index);
-        else
-        {
-            sem_getvalue(data.image[ID].semptr[index], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[ID].semptr[index]);
-        }
-    }
+    ImageStreamIO_sempost(&data.image[ID], index);
 
     return(ID);
 }
@@ -4286,13 +5504,137 @@ long COREMOD_MEMORY_image_set_sempost_excl_byID(long ID, long index)
 
 
 
+//
+// absolute-deadline pacing for synthetic stream rates
+// deadlines advance by exactly one period (no drift), CLOCK_MONOTONIC clock_nanosleep(TIMER_ABSTIME) up to
+// spinns before the deadline, busy-wait for the remainder if spinns > 0
+// achieved period statistics printed every statperiod_s seconds
+//
+#define COREMOD_MEMORY_PACER_SPINNS 50000   // default spin-wait tail [ns] for timingmode 1
+
+typedef struct
+{
+    struct timespec next;      // next deadline
+    struct timespec tlast;     // last wake-up time
+    long periodns;
+    long spinns;
+    long statcnt;              // ticks since last statistics report
+    long statNBtick;           // ticks per report
+    long overrun;              // deadlines missed by more than one period
+    double sumdt;
+    double sumdt2;
+    double maxdev;
+} COREMOD_MEMORY_PACER;
+
+
+static inline void COREMOD_MEMORY_pacer_addns(struct timespec *t, long ns)
+{
+    t->tv_nsec += ns;
+    while(t->tv_nsec >= 1000000000)
+    {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+    while(t->tv_nsec < 0)
+    {
+        t->tv_nsec += 1000000000;
+        t->tv_sec--;
+    }
+}
+
+static inline double COREMOD_MEMORY_pacer_diffns(struct timespec t1, struct timespec t0)
+{
+    return(1.0e9*(t1.tv_sec - t0.tv_sec) + 1.0*(t1.tv_nsec - t0.tv_nsec));
+}
+
+
+static void COREMOD_MEMORY_pacer_init(COREMOD_MEMORY_PACER *pacer, long periodns, long spinns, double statperiod_s)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pacer->next);
+    pacer->tlast = pacer->next;
+    pacer->periodns = (periodns>0) ? periodns : 1;
+    pacer->spinns = (spinns < pacer->periodns) ? spinns : pacer->periodns;
+    pacer->statNBtick = (long) (1.0e9*statperiod_s/pacer->periodns);
+    if(pacer->statNBtick < 1)
+        pacer->statNBtick = 1;
+    pacer->statcnt = 0;
+    pacer->overrun = 0;
+    pacer->sumdt = 0.0;
+    pacer->sumdt2 = 0.0;
+    pacer->maxdev = 0.0;
+}
+
+
+static void COREMOD_MEMORY_pacer_wait(COREMOD_MEMORY_PACER *pacer, const char *name)
+{
+    struct timespec tnow;
+    struct timespec tsleep;
+    double dt, dev;
+
+    COREMOD_MEMORY_pacer_addns(&pacer->next, pacer->periodns);
+
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    if(COREMOD_MEMORY_pacer_diffns(tnow, pacer->next) > pacer->periodns) // too late: restart schedule from now
+    {
+        pacer->overrun++;
+        pacer->next = tnow;
+    }
+    else
+    {
+        tsleep = pacer->next;
+        COREMOD_MEMORY_pacer_addns(&tsleep, -pacer->spinns);
+#ifndef __MACH__
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsleep, NULL) == EINTR) {}
+#else
+        dt = COREMOD_MEMORY_pacer_diffns(tsleep, tnow);
+        if(dt > 0.0)
+            usleep((long) (1.0e-3*dt));
+#endif
+        if(pacer->spinns > 0)
+            do {
+                clock_gettime(CLOCK_MONOTONIC, &tnow);
+            } while(COREMOD_MEMORY_pacer_diffns(tnow, pacer->next) < 0.0);
+        else
+            clock_gettime(CLOCK_MONOTONIC, &tnow);
+    }
+
+    dt = COREMOD_MEMORY_pacer_diffns(tnow, pacer->tlast);
+    pacer->tlast = tnow;
+    dev = fabs(dt - pacer->periodns);
+    pacer->sumdt += dt;
+    pacer->sumdt2 += dt*dt;
+    if(dev > pacer->maxdev)
+        pacer->maxdev = dev;
+    pacer->statcnt++;
+
+    if(pacer->statcnt == pacer->statNBtick)
+    {
+        double ave = pacer->sumdt/pacer->statcnt;
+        double rms = sqrt(fabs(pacer->sumdt2/pacer->statcnt - ave*ave));
+
+        printf("%s period: target %.3f us  mean %.3f us  jitter rms %.3f us  max %.3f us  overruns %ld\n",
+               name, 1.0e-3*pacer->periodns, 1.0e-3*ave, 1.0e-3*rms, 1.0e-3*pacer->maxdev, pacer->overrun);
+        fflush(stdout);
+        pacer->statcnt = 0;
+        pacer->overrun = 0;
+        pacer->sumdt = 0.0;
+        pacer->sumdt2 = 0.0;
+        pacer->maxdev = 0.0;
+    }
+}
+
+
+
+
 // if index < 0, post all semaphores
+// timingmode 0 : absolute deadlines, 1 : absolute deadlines + spin-wait tail (us precision, one core busy)
 
-long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long dtus)
+long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long dtus, int timingmode)
 {
     long ID;
     long s;
     int semval;
+    COREMOD_MEMORY_PACER pacer;
 
 
     ID = image_ID(IDname);
@@ -4300,6 +5642,7 @@ long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long
     if(ID==-1)
         ID = read_sharedmem_image(IDname);
 
+    COREMOD_MEMORY_pacer_init(&pacer, 1000*dtus, (timingmode==1) ? COREMOD_MEMORY_PACER_SPINNS : 0, 10.0);
 
 	while(1)
 	{
@@ -4323,7 +5666,7 @@ long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long
                 sem_post(data.image[ID].semptr[index]);
         }
     }
-    sleep(dtus);
+    COREMOD_MEMORY_pacer_wait(&pacer, IDname);
 	}
     return(ID);
 }
@@ -4350,6 +5693,62 @@ long COREMOD_MEMORY_image_set_semwait(const char *IDname, long index)
 
 
 
+/**
+ * @brief Wait until stream cnt0 differs from cnt0last
+ * 
+ * Uses futex wait if enabled on the stream (md[0].futex = 1).\n
+ * Otherwise waits on the highest index semaphore, which real-time consumers usually leave free, or polls cnt0 if stream has no semaphore.\n
+ * Writers that post semaphores without waking futex readers are thus not missed.
+ * 
+ * @param[in]  ID         stream
+ * @param[in]  cnt0last   last cnt0 value seen by the reader
+ * @param[in]  timeoutus  timeout [us], no timeout if < 0
+ * 
+ * @return 0 if a new frame is available, 1 if timed out or interrupted by signal
+ */
+static int COREMOD_MEMORY_image_waitframe(long ID, uint64_t cnt0last, long timeoutus)
+{
+    long semindex = data.image[ID].md[0].sem - 1;
+    struct timespec ts;
+    struct timespec tnow;
+
+    if(data.image[ID].md[0].futex == 1)
+        return(ImageStreamIO_futexwait(&data.image[ID], cnt0last, timeoutus));
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(timeoutus >= 0)
+        COREMOD_MEMORY_pacer_addns(&ts, 1000*timeoutus);
+
+    while(data.image[ID].md[0].cnt0 == cnt0last)
+    {
+#ifndef __MACH__
+        if(semindex >= 0)
+        {
+            int semr;
+
+            if(timeoutus < 0)
+                semr = sem_wait(data.image[ID].semptr[semindex]);
+            else
+                semr = sem_timedwait(data.image[ID].semptr[semindex], &ts);
+            if((semr == -1)&&(data.image[ID].md[0].cnt0 == cnt0last))
+                return(1);
+            continue;
+        }
+#endif
+        usleep(5);
+        if(timeoutus >= 0)
+        {
+            clock_gettime(CLOCK_REALTIME, &tnow);
+            if(COREMOD_MEMORY_pacer_diffns(tnow, ts) > 0.0)
+                return(1);
+        }
+    }
+
+    return(0);
+}
+
+
+
 // only works for sem0
 void *waitforsemID(void *ID)
 {
@@ -4447,90 +5846,343 @@ long COREMOD_MEMORY_image_set_semflush_IDarray(long *IDarray, long NB_ID)
 
 
 
-/// set semaphore value to 0
-// if index <0, flush all image semaphores
-long COREMOD_MEMORY_image_set_semflush(const char *IDname, long index)
-{
-    long ID;
-    int semval;
-    long i;
-    long s;
-
-    ID = image_ID(IDname);
-    if(ID==-1)
-        ID = read_sharedmem_image(IDname);
-
-    if(index<0)
-    {
-        for(s=0; s<data.image[ID].md[0].sem; s++)
-        {
-            sem_getvalue(data.image[ID].semptr[s], &semval);
-            for(i=0; i<semval; i++)
-                sem_trywait(data.image[ID].semptr[s]);
-        }
-    }
-    else
-    {
-        if(index>data.image[ID].md[0].sem-1)
-            printf("ERROR: image %s semaphore # %ld does not exist\n", IDname, index);
-        else
-        {
-            s = index;
-            sem_getvalue(data.image[ID].semptr[s], &semval);
-            for(i=0; i<semval; i++)
-                sem_trywait(data.image[ID].semptr[s]);
-
-        }
-    }
-
-    return(ID);
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+/* =============================================================================================== */
+/*  Persistent multi-stream waiter                                                                 */
+/* =============================================================================================== */
 
+#ifdef __linux__
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+#ifndef FUTEX_32
+#define FUTEX_32 2
+#endif
 
+/* matches struct futex_waitv (linux >= 5.16) */
+typedef struct
+{
+	uint64_t val;
+	uint64_t uaddr;
+	uint32_t flags;
+	uint32_t reserved;
+} STREAMWAITSET_FUTEXV;
+#endif
 
-/* =============================================================================================== */
-/* =============================================================================================== */
-/*                                                                                                 */
-/* 13. SIMPLE OPERATIONS ON STREAMS                                                                */
-/*                                                                                                 */
-/* =============================================================================================== */
-/* =============================================================================================== */
 
+struct STREAMWAITSET
+{
+	long NBstream;
+	long *ID;              /**< image IDs, sorted by decreasing priority */
+	int *priority;
+	long *index;           /**< position of stream in caller's array */
+	uint64_t *cnt0last;
+	int usewaitv;          /**< 1 while futex_waitv is available */
+#ifdef __linux__
+	STREAMWAITSET_FUTEXV *waitv;
+#endif
+};
 
 
 
-//
-// compute difference between two 2D streams
-// triggers on stream0
-//
-long COREMOD_MEMORY_streamDiff(const char *IDstream0_name, const char *IDstream1_name, const char *IDstreammask_name, const char *IDstreamout_name, long semtrig)
+/**
+ * @brief Create persistent waiter on a set of streams
+ * 
+ * Streams are scanned in decreasing priority order (stable for equal priorities).
+ * Only frames written after creation are reported.
+ * 
+ * @param[in]  IDarray    image IDs
+ * @param[in]  priority   priority per stream, higher first. NULL for array order
+ * @param[in]  NB_ID      number of streams
+ * 
+ * @return waiter, NULL on error
+ */
+STREAMWAITSET *COREMOD_MEMORY_streamwaitset_create(long *IDarray, int *priority, long NB_ID)
 {
-	long ID0, ID1, IDout;
-	uint32_t xsize, ysize, xysize;
-	long ii;
-	uint32_t *arraysize;
-	long long cnt;
-	long IDmask; // optional 
+	STREAMWAITSET *ws;
+	long i, j;
 	
-	ID0 = image_ID(IDstream0_name);
-	ID1 = image_ID(IDstream1_name);
-	IDmask = image_ID(IDstreammask_name);
+	if((NB_ID<1)||(NB_ID>STREAMWAITSET_NBSTREAM_MAX))
+	{
+		sprintf(errmsg_memory, "number of streams %ld out of range [1-%d]", NB_ID, STREAMWAITSET_NBSTREAM_MAX);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(NULL);
+	}
 	
-	xsize = data.image[ID0].md[0].size[0];
+	ws = (STREAMWAITSET*) calloc(1, sizeof(STREAMWAITSET));
+	ws->NBstream = NB_ID;
+	ws->ID = (long*) malloc(sizeof(long)*NB_ID);
+	ws->priority = (int*) malloc(sizeof(int)*NB_ID);
+	ws->index = (long*) malloc(sizeof(long)*NB_ID);
+	ws->cnt0last = (uint64_t*) malloc(sizeof(uint64_t)*NB_ID);
+	
+	// insertion sort, stable
+	for(i=0; i<NB_ID; i++)
+	{
+		int prio = (priority==NULL) ? 0 : priority[i];
+		
+		j = i;
+		while((j>0)&&(ws->priority[j-1] < prio))
+		{
+			ws->ID[j] = ws->ID[j-1];
+			ws->priority[j] = ws->priority[j-1];
+			ws->index[j] = ws->index[j-1];
+			j--;
+		}
+		ws->ID[j] = IDarray[i];
+		ws->priority[j] = prio;
+		ws->index[j] = i;
+	}
+	
+	for(i=0; i<NB_ID; i++)
+		ws->cnt0last[i] = __atomic_load_n(&data.image[ws->ID[i]].md[0].cnt0, __ATOMIC_ACQUIRE);
+	
+#ifdef __linux__
+	ws->usewaitv = 1;
+	ws->waitv = (STREAMWAITSET_FUTEXV*) calloc(NB_ID, sizeof(STREAMWAITSET_FUTEXV));
+	for(i=0; i<NB_ID; i++)
+	{
+		// futex word is low 32 bits of cnt0, address by offset: cnt0 is a member of a packed struct
+		uint32_t *ptr = (uint32_t*) ((char*) data.image[ws->ID[i]].md + offsetof(IMAGE_METADATA, cnt0));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+		ptr++;
+#endif
+		ws->waitv[i].uaddr = (uint64_t) (uintptr_t) ptr;
+		ws->waitv[i].flags = FUTEX_32;
+	}
+#endif
+	
+	return(ws);
+}
+
+
+
+/**
+ * @brief Wait until at least one stream of the set has a new frame
+ * 
+ * Blocks on all stream counters with a single futex_waitv() call. 
+ * If the kernel does not support it (< 5.16), falls back to polling with 10us sleeps.
+ * 
+ * @param[in]  ws         waiter
+ * @param[in]  timeoutus  timeout [us], no timeout if < 0
+ * @param[out] fired      indices (in caller's array) of streams with new frames, by decreasing priority. May be NULL
+ * 
+ * @return number of streams with new frames, 0 if timed out
+ */
+long COREMOD_MEMORY_streamwaitset_wait(STREAMWAITSET *ws, long timeoutus, long *fired)
+{
+	struct timespec tstart;
+	struct timespec tnow;
+	long i;
+	long NBfired;
+	int spin;
+	
+	clock_gettime(CLOCK_MONOTONIC, &tstart);
+	
+	while(1)
+	{
+		for(spin=0; spin<FUTEX_SPINLOOP; spin++)
+		{
+			NBfired = 0;
+			for(i=0; i<ws->NBstream; i++)
+			{
+				uint64_t cnt0;
+				
+				ImageStreamIO_legacy_pull(&data.image[ws->ID[i]]);
+				cnt0 = __atomic_load_n(&data.image[ws->ID[i]].md[0].cnt0, __ATOMIC_ACQUIRE);
+				if(cnt0 != ws->cnt0last[i])
+				{
+					ws->cnt0last[i] = cnt0;
+					if(fired!=NULL)
+						fired[NBfired] = ws->index[i];
+					NBfired++;
+				}
+			}
+			if(NBfired>0)
+				return(NBfired);
+		}
+		
+		long dtus = -1;
+		if(timeoutus >= 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &tnow);
+			dtus = timeoutus - (long) ((tnow.tv_sec - tstart.tv_sec)*1000000 + (tnow.tv_nsec - tstart.tv_nsec)/1000);
+			if(dtus <= 0)
+				return(0);
+		}
+		
+#ifdef __linux__
+		if(ws->usewaitv == 1)
+		{
+			struct timespec ts;
+			struct timespec *tsptr = NULL;
+			
+			if(dtus >= 0)
+			{
+				// futex_waitv takes an absolute timeout
+				ts.tv_sec = tnow.tv_sec + dtus/1000000;
+				ts.tv_nsec = tnow.tv_nsec + (dtus%1000000)*1000;
+				if(ts.tv_nsec >= 1000000000)
+				{
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000;
+				}
+				tsptr = &ts;
+			}
+			
+			for(i=0; i<ws->NBstream; i++)
+			{
+				__atomic_fetch_add(&data.image[ws->ID[i]].md[0].futexwaiters, 1, __ATOMIC_SEQ_CST);
+				ws->waitv[i].val = (uint32_t) ws->cnt0last[i];
+			}
+			if(syscall(SYS_futex_waitv, ws->waitv, (unsigned int) ws->NBstream, 0, tsptr, CLOCK_MONOTONIC) == -1)
+				if(errno == ENOSYS)
+				{
+					printf("WARNING: futex_waitv not supported, stream wait set falls back to polling\n");
+					ws->usewaitv = 0;
+				}
+			for(i=0; i<ws->NBstream; i++)
+				__atomic_fetch_sub(&data.image[ws->ID[i]].md[0].futexwaiters, 1, __ATOMIC_SEQ_CST);
+		}
+		else
+			usleep(10);
+#else
+		usleep(10);
+#endif
+	}
+	
+	return(0);
+}
+
+
+
+/**
+ * @brief Free stream waiter
+ */
+int COREMOD_MEMORY_streamwaitset_free(STREAMWAITSET *ws)
+{
+	if(ws == NULL)
+		return(0);
+	
+	free(ws->ID);
+	free(ws->priority);
+	free(ws->index);
+	free(ws->cnt0last);
+#ifdef __linux__
+	free(ws->waitv);
+#endif
+	free(ws);
+	
+	return(0);
+}
+
+
+
+/**
+ * @brief Set futex wakeup mode
+ * 
+ * mode = 1: readers supporting it (e.g. Read_cam_frame) block on cnt0 instead of waiting on a semaphore\n
+ * mode = 0: semaphore wait (default)
+ */
+long COREMOD_MEMORY_image_set_futex(const char *IDname, int mode)
+{
+    long ID;
+
+    ID = image_ID(IDname);
+    if(ID==-1)
+        ID = read_sharedmem_image(IDname);
+
+    if(ID!=-1)
+        data.image[ID].md[0].futex = (uint8_t) mode;
+
+    return(ID);
+}
+
+
+
+/// set semaphore value to 0
+// if index <0, flush all image semaphores
+long COREMOD_MEMORY_image_set_semflush(const char *IDname, long index)
+{
+    long ID;
+    int semval;
+    long i;
+    long s;
+
+    ID = image_ID(IDname);
+    if(ID==-1)
+        ID = read_sharedmem_image(IDname);
+
+    if(index<0)
+    {
+        for(s=0; s<data.image[ID].md[0].sem; s++)
+        {
+            sem_getvalue(data.image[ID].semptr[s], &semval);
+            for(i=0; i<semval; i++)
+                sem_trywait(data.image[ID].semptr[s]);
+        }
+    }
+    else
+    {
+        if(index>data.image[ID].md[0].sem-1)
+            printf("ERROR: image %s semaphore # %ld does not exist\n", IDname, index);
+        else
+        {
+            s = index;
+            sem_getvalue(data.image[ID].semptr[s], &semval);
+            for(i=0; i<semval; i++)
+                sem_trywait(data.image[ID].semptr[s]);
+
+        }
+    }
+
+    return(ID);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/* =============================================================================================== */
+/*                                                                                                 */
+/* 13. SIMPLE OPERATIONS ON STREAMS                                                                */
+/*                                                                                                 */
+/* =============================================================================================== */
+/* =============================================================================================== */
+
+
+
+
+//
+// compute difference between two 2D streams
+// triggers on stream0
+//
+long COREMOD_MEMORY_streamDiff(const char *IDstream0_name, const char *IDstream1_name, const char *IDstreammask_name, const char *IDstreamout_name, long semtrig)
+{
+	long ID0, ID1, IDout;
+	uint32_t xsize, ysize, xysize;
+	long ii;
+	uint32_t *arraysize;
+	long long cnt;
+	long IDmask; // optional 
+	
+	ID0 = image_ID(IDstream0_name);
+	ID1 = image_ID(IDstream1_name);
+	IDmask = image_ID(IDstreammask_name);
+	
+	xsize = data.image[ID0].md[0].size[0];
 	ysize = data.image[ID0].md[0].size[1];	
 	xysize = xsize*ysize;
 	
@@ -4807,64 +6459,708 @@ long COREMOD_MEMORY_streamAve(const char *IDstream_name, int NBave, int mode, co
 
 
 
-/** @brief takes a 3Dimage(s) (circular buffer(s)) and writes slices to a 2D image with time interval specified in us
- *
- *
- *
+/**
+ * @brief Convert nelement pixels of type atype to float
  */
-long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDoutname, long usperiod, long NBcubes, long period, long offsetus, const char *IDsync_name, int semtrig, int timingmode)
+static void COREMOD_MEMORY_tofloat(const void *in, uint8_t atype, float *out, uint64_t nelement)
 {
-    long *IDin;
-    long cubeindex;
-    char imname[200];
-    long IDsync;
-    long long cntsync;
-    long pcnt = 0;
-    long offsetfr = 0;
-    long offsetfrcnt = 0;
-    int cntDelayMode = 0;
-
-    long IDout;
-    long kk;
-    uint32_t *arraysize;
-    long naxis;
-    uint8_t atype;
-    char *ptr0s; // source start 3D array ptr
-    char *ptr0; // source
-    char *ptr1; // dest
-    long framesize;
-    int semval;
-
-    int RT_priority = 80; //any number from 0-99
-    struct sched_param schedpar;
-
-    long twait1;
-    struct timespec t0;
-    struct timespec t1;
-    double tdiffv;
-    struct timespec tdiff;
-
-    int SyncSlice = 0;
+	uint64_t ii;
+	
+	switch ( atype )
+	{
+		case _DATATYPE_UINT8 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const uint8_t*) in)[ii];
+		break;
+		case _DATATYPE_INT8 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const int8_t*) in)[ii];
+		break;
+		case _DATATYPE_UINT16 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const uint16_t*) in)[ii];
+		break;
+		case _DATATYPE_INT16 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const int16_t*) in)[ii];
+		break;
+		case _DATATYPE_UINT32 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const uint32_t*) in)[ii];
+		break;
+		case _DATATYPE_INT32 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const int32_t*) in)[ii];
+		break;
+		case _DATATYPE_UINT64 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const uint64_t*) in)[ii];
+		break;
+		case _DATATYPE_INT64 :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const int64_t*) in)[ii];
+		break;
+		case _DATATYPE_FLOAT :
+		memcpy(out, in, sizeof(float)*nelement);
+		break;
+		case _DATATYPE_DOUBLE :
+		for(ii=0;ii<nelement;ii++)
+			out[ii] = ((const double*) in)[ii];
+		break;
+	}
+}
 
 
 
+/**
+ * @brief Find or create float output stream for COREMOD_MEMORY_streamStats()
+ */
+static long COREMOD_MEMORY_streamStats_output(const char *prefix, const char *suffix, long IDin)
+{
+	char name[200];
+	long ID;
+	uint32_t imsize[3]; // aligned copy of md[0].size (packed member)
+	
+	sprintf(name, "%s%s", prefix, suffix);
+	ID = image_ID(name);
+	if(ID==-1)
+	{
+		memcpy(imsize, data.image[IDin].md[0].size, sizeof(uint32_t)*3);
+		ID = create_image_ID(name, data.image[IDin].md[0].naxis, imsize, _DATATYPE_FLOAT, 1, 0);
+		COREMOD_MEMORY_image_set_createsem(name, 10);
+	}
+	else if((data.image[ID].md[0].atype != _DATATYPE_FLOAT)||(data.image[ID].md[0].nelement != data.image[IDin].md[0].nelement))
+	{
+		sprintf(errmsg_memory, "Image \"%s\" exists with wrong size or type", name);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		exit(0);
+	}
+	
+	return(ID);
+}
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
-#endif
 
 
-    if(NBcubes<1)
-    {
-        printf("ERROR: invalid number of input cubes, needs to be >0");
-        return(-1);
+/**
+ * @brief Continuous per-pixel statistics of a stream
+ * 
+ * For each input frame, updates per pixel running mean and variance (Welford), min, max and exponentially weighted moving average.
+ * Results are written every decimation frames to streams <prefix>mean, <prefix>var, <prefix>min, <prefix>max and <prefix>ewma.
+ * 
+ * @param[in]  IDstream_name   input stream
+ * @param[in]  IDout_prefix    output stream name prefix
+ * @param[in]  decimation      number of input frames between output updates
+ * @param[in]  NBframes        statistics window: mean, var, min and max are reset every NBframes. 0 = cumulative
+ * @param[in]  ewmagain        EWMA gain, 0 < gain <= 1
+ */
+long COREMOD_MEMORY_streamStats(const char *IDstream_name, const char *IDout_prefix, long decimation, long NBframes, double ewmagain)
+{
+	long IDin;
+	long IDmean, IDvar, IDmin, IDmax, IDewma;
+	uint8_t atype;
+	uint64_t nelement;
+	uint64_t ii;
+	size_t framesize;
+	char *framebuff;  // raw copy of input frame
+	float *x;         // input frame converted to float
+	double *mean;
+	double *M2;
+	float *vmin;
+	float *vmax;
+	float *ewma;
+	long n = 0;       // number of frames in statistics
+	long ndec = 0;
+	int ewmainit = 0;
+	uint64_t cnt0old;
+	float gain;
+	
+	IDin = image_ID(IDstream_name);
+	if(IDin==-1)
+	{
+		sprintf(errmsg_memory, "Image \"%s\" does not exist", IDstream_name);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
+	atype = data.image[IDin].md[0].atype;
+	nelement = data.image[IDin].md[0].nelement;
+	framesize = (size_t) TYPESIZE[atype]*nelement;
+	if((framesize == 0)||(atype == _DATATYPE_COMPLEX_FLOAT)||(atype == _DATATYPE_COMPLEX_DOUBLE))
+	{
+		printERROR(__FILE__, __func__, __LINE__, "wrong data type");
+		return(-1);
+	}
+	if(decimation<1)
+		decimation = 1;
+	if((ewmagain<=0.0)||(ewmagain>1.0))
+		ewmagain = 1.0;
+	gain = ewmagain;
+	
+	IDmean = COREMOD_MEMORY_streamStats_output(IDout_prefix, "mean", IDin);
+	IDvar  = COREMOD_MEMORY_streamStats_output(IDout_prefix, "var",  IDin);
+	IDmin  = COREMOD_MEMORY_streamStats_output(IDout_prefix, "min",  IDin);
+	IDmax  = COREMOD_MEMORY_streamStats_output(IDout_prefix, "max",  IDin);
+	IDewma = COREMOD_MEMORY_streamStats_output(IDout_prefix, "ewma", IDin);
+	
+	framebuff = (char*) malloc(framesize);
+	x = (float*) malloc(sizeof(float)*nelement);
+	mean = (double*) malloc(sizeof(double)*nelement);
+	M2 = (double*) malloc(sizeof(double)*nelement);
+	vmin = (float*) malloc(sizeof(float)*nelement);
+	vmax = (float*) malloc(sizeof(float)*nelement);
+	ewma = (float*) malloc(sizeof(float)*nelement);
+	if((framebuff==NULL)||(x==NULL)||(mean==NULL)||(M2==NULL)||(vmin==NULL)||(vmax==NULL)||(ewma==NULL))
+	{
+		printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+		exit(0);
+	}
+	
+	if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
     }
-
-
-
-    IDin = (long*) malloc(sizeof(long)*NBcubes);
-    SyncSlice = 0;
+    if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+	
+	cnt0old = data.image[IDin].md[0].cnt0;
+	while((data.signal_INT == 0)&&(data.signal_TERM == 0))
+	{
+		if(COREMOD_MEMORY_image_waitframe(IDin, cnt0old, 100000) != 0)
+			continue;
+		cnt0old = data.image[IDin].md[0].cnt0;
+		ImageStreamIO_read_consistent(&data.image[IDin], framebuff, 0, framesize, 10);
+		
+		COREMOD_MEMORY_tofloat(framebuff, atype, x, nelement);
+		
+		if(n==0)
+		{
+			for(ii=0;ii<nelement;ii++)
+			{
+				mean[ii] = x[ii];
+				M2[ii] = 0.0;
+				vmin[ii] = x[ii];
+				vmax[ii] = x[ii];
+			}
+			n = 1;
+		}
+		else
+		{
+			// Welford update, branch-free inner loop over contiguous arrays
+			double invn;
+			
+			n++;
+			invn = 1.0/n;
+			for(ii=0;ii<nelement;ii++)
+			{
+				double d = x[ii] - mean[ii];
+				mean[ii] += d*invn;
+				M2[ii] += d*(x[ii] - mean[ii]);
+				vmin[ii] = (x[ii]<vmin[ii]) ? x[ii] : vmin[ii];
+				vmax[ii] = (x[ii]>vmax[ii]) ? x[ii] : vmax[ii];
+			}
+		}
+		
+		if(ewmainit==0)
+		{
+			memcpy(ewma, x, sizeof(float)*nelement);
+			ewmainit = 1;
+		}
+		else
+			for(ii=0;ii<nelement;ii++)
+				ewma[ii] += gain*(x[ii]-ewma[ii]);
+		
+		ndec++;
+		if(ndec>=decimation)
+		{
+			double invn1 = (n>1) ? 1.0/(n-1) : 0.0;
+			
+			ndec = 0;
+			
+			ImageStreamIO_write_begin(&data.image[IDmean]);
+			for(ii=0;ii<nelement;ii++)
+				data.image[IDmean].array.F[ii] = mean[ii];
+			data.image[IDmean].md[0].cnt0++;
+			ImageStreamIO_write_end(&data.image[IDmean]);
+			
+			ImageStreamIO_write_begin(&data.image[IDvar]);
+			for(ii=0;ii<nelement;ii++)
+				data.image[IDvar].array.F[ii] = M2[ii]*invn1;
+			data.image[IDvar].md[0].cnt0++;
+			ImageStreamIO_write_end(&data.image[IDvar]);
+			
+			ImageStreamIO_write_begin(&data.image[IDmin]);
+			memcpy(data.image[IDmin].array.F, vmin, sizeof(float)*nelement);
+			data.image[IDmin].md[0].cnt0++;
+			ImageStreamIO_write_end(&data.image[IDmin]);
+			
+			ImageStreamIO_write_begin(&data.image[IDmax]);
+			memcpy(data.image[IDmax].array.F, vmax, sizeof(float)*nelement);
+			data.image[IDmax].md[0].cnt0++;
+			ImageStreamIO_write_end(&data.image[IDmax]);
+			
+			ImageStreamIO_write_begin(&data.image[IDewma]);
+			memcpy(data.image[IDewma].array.F, ewma, sizeof(float)*nelement);
+			data.image[IDewma].md[0].cnt0++;
+			ImageStreamIO_write_end(&data.image[IDewma]);
+			
+			COREMOD_MEMORY_image_set_sempost_byID(IDmean, -1);
+			COREMOD_MEMORY_image_set_sempost_byID(IDvar, -1);
+			COREMOD_MEMORY_image_set_sempost_byID(IDmin, -1);
+			COREMOD_MEMORY_image_set_sempost_byID(IDmax, -1);
+			COREMOD_MEMORY_image_set_sempost_byID(IDewma, -1);
+		}
+		
+		if((NBframes>0)&&(n>=NBframes))
+			n = 0;
+	}
+	
+	free(framebuff);
+	free(x);
+	free(mean);
+	free(M2);
+	free(vmin);
+	free(vmax);
+	free(ewma);
+	
+	return(IDmean);
+}
+
+
+
+
+/* =============================================================================================== */
+/*  Stream graph: chained stream operators in a single process                                     */
+/* =============================================================================================== */
+
+#define STREAMGRAPH_NBNODE_MAX 64
+
+#define STREAMGRAPH_OP_SOURCE   0
+#define STREAMGRAPH_OP_DIFF     1
+#define STREAMGRAPH_OP_HALFDIFF 2
+#define STREAMGRAPH_OP_AVE      3
+#define STREAMGRAPH_OP_DELAY    4
+
+typedef struct
+{
+	char name[80];
+	int op;
+	int in[3];             /**< input node indices, -1 if unused */
+	long param;            /**< NBave (ave), delay in frames (delay) */
+	uint32_t size[2];
+	uint64_t nelement;
+	float *buff;           /**< current output frame */
+	float *work;           /**< accumulator (ave), frame ring (delay) */
+	char *raw;             /**< raw input copy (source) */
+	long cnt;
+	int updated;           /**< 1 if output changed at this tick */
+	long IDsrc;            /**< input stream (source) */
+	long IDpub;            /**< published stream, -1 if internal */
+} STREAMGRAPH_NODE;
+
+
+
+static int COREMOD_MEMORY_streamGraph_findnode(STREAMGRAPH_NODE *node, int NBnode, const char *name)
+{
+	int n;
+	
+	for(n=0; n<NBnode; n++)
+		if(strcmp(node[n].name, name)==0)
+			return(n);
+	
+	sprintf(errmsg_memory, "stream graph: node \"%s\" not declared before use", name);
+	printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+	return(-1);
+}
+
+
+
+/**
+ * @brief Run a graph of stream operators in a single thread
+ *
+ * Graph is read from a text file, one declaration per line, inputs declared before use:
+ *
+ *     source   <node> <stream>              input stream; first source triggers graph evaluation\n
+ *     diff     <node> <in0> <in1> [mask]    (in0 - in1) [* mask]\n
+ *     halfdiff <node> <in>                  first half - second half of frame (y axis)\n
+ *     ave      <node> <in> <NBave>          average of NBave consecutive frames\n
+ *     delay    <node> <in> <NBframe>        frame received NBframe updates earlier\n
+ *     publish  <node> <stream>              write node output to shared memory stream
+ *
+ * On each trigger frame, sources are copied once (torn-free) and the graph is evaluated in declaration order.
+ * A node is evaluated only if one of its inputs changed. Intermediate results stay in process memory;
+ * only published nodes are written to shared memory and posted.
+ *
+ * @param[in]  fname   graph file
+ * @param[in]  cpu     CPU to pin to, -1 for no pinning
+ */
+long COREMOD_MEMORY_streamGraph(const char *fname, int cpu)
+{
+	STREAMGRAPH_NODE node[STREAMGRAPH_NBNODE_MAX];
+	int NBnode = 0;
+	int n;
+	FILE *fp;
+	char line[500];
+	char w0[80], w1[80], w2[80], w3[80], w4[80];
+	int nw;
+	int lineno = 0;
+	int trig = -1;
+	uint64_t cnt0old;
+	uint64_t ii;
+	long long NBtick = 0;
+	int err = 0;
+	
+	if((fp=fopen(fname, "r"))==NULL)
+	{
+		sprintf(errmsg_memory, "Cannot open file \"%s\"", fname);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
+	
+	memset(node, 0, sizeof(node));
+	while((err==0)&&(fgets(line, sizeof(line), fp)!=NULL))
+	{
+		STREAMGRAPH_NODE *nd;
+		
+		lineno++;
+		nw = sscanf(line, "%79s %79s %79s %79s %79s", w0, w1, w2, w3, w4);
+		if((nw<=0)||(w0[0]=='#'))
+			continue;
+		
+		if(strcmp(w0, "publish")==0)
+		{
+			if(nw<3)
+				err = 1;
+			else if((n = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w1)) == -1)
+				err = 1;
+			else
+			{
+				node[n].IDpub = image_ID(w2);
+				if(node[n].IDpub==-1)
+				{
+					node[n].IDpub = create_image_ID(w2, 2, node[n].size, _DATATYPE_FLOAT, 1, 0);
+					COREMOD_MEMORY_image_set_createsem(w2, 10);
+				}
+				if((data.image[node[n].IDpub].md[0].atype != _DATATYPE_FLOAT)||(data.image[node[n].IDpub].md[0].nelement != node[n].nelement))
+				{
+					sprintf(errmsg_memory, "stream graph line %d: stream %s exists with wrong size or type", lineno, w2);
+					printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+					err = 1;
+				}
+			}
+			continue;
+		}
+		
+		if(NBnode==STREAMGRAPH_NBNODE_MAX)
+		{
+			printERROR(__FILE__, __func__, __LINE__, "stream graph: too many nodes");
+			err = 1;
+			break;
+		}
+		nd = &node[NBnode];
+		strncpy(nd->name, w1, sizeof(nd->name)-1);
+		nd->in[0] = nd->in[1] = nd->in[2] = -1;
+		nd->IDpub = -1;
+		nd->IDsrc = -1;
+		
+		if((strcmp(w0, "source")==0)&&(nw>=3))
+		{
+			nd->op = STREAMGRAPH_OP_SOURCE;
+			nd->IDsrc = image_ID(w2);
+			if(nd->IDsrc==-1)
+				nd->IDsrc = read_sharedmem_image(w2);
+			if(nd->IDsrc==-1)
+			{
+				sprintf(errmsg_memory, "stream graph line %d: stream %s does not exist", lineno, w2);
+				printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+				err = 1;
+				break;
+			}
+			nd->size[0] = data.image[nd->IDsrc].md[0].size[0];
+			nd->size[1] = (data.image[nd->IDsrc].md[0].naxis>1) ? data.image[nd->IDsrc].md[0].size[1] : 1;
+			nd->raw = (char*) malloc(TYPESIZE[data.image[nd->IDsrc].md[0].atype]*nd->size[0]*nd->size[1]);
+			if(trig==-1)
+				trig = NBnode;
+		}
+		else if((strcmp(w0, "diff")==0)&&(nw>=4))
+		{
+			nd->op = STREAMGRAPH_OP_DIFF;
+			nd->in[0] = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w2);
+			nd->in[1] = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w3);
+			if(nw>=5)
+				nd->in[2] = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w4);
+			if((nd->in[0]==-1)||(nd->in[1]==-1)||((nw>=5)&&(nd->in[2]==-1)))
+				err = 1;
+			else
+			{
+				nd->size[0] = node[nd->in[0]].size[0];
+				nd->size[1] = node[nd->in[0]].size[1];
+				if( (node[nd->in[1]].nelement != node[nd->in[0]].nelement)
+						|| ((nd->in[2]!=-1)&&(node[nd->in[2]].nelement != node[nd->in[0]].nelement)) )
+				{
+					sprintf(errmsg_memory, "stream graph line %d: input sizes do not match", lineno);
+					printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+					err = 1;
+				}
+			}
+		}
+		else if((strcmp(w0, "halfdiff")==0)&&(nw>=3))
+		{
+			nd->op = STREAMGRAPH_OP_HALFDIFF;
+			if((nd->in[0] = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w2)) == -1)
+				err = 1;
+			else
+			{
+				nd->size[0] = node[nd->in[0]].size[0];
+				nd->size[1] = node[nd->in[0]].size[1]/2;
+			}
+		}
+		else if(((strcmp(w0, "ave")==0)||(strcmp(w0, "delay")==0))&&(nw>=4))
+		{
+			nd->op = (strcmp(w0, "ave")==0) ? STREAMGRAPH_OP_AVE : STREAMGRAPH_OP_DELAY;
+			nd->param = atol(w3);
+			if((nd->in[0] = COREMOD_MEMORY_streamGraph_findnode(node, NBnode, w2)) == -1)
+				err = 1;
+			else
+			{
+				nd->size[0] = node[nd->in[0]].size[0];
+				nd->size[1] = node[nd->in[0]].size[1];
+			}
+			if(nd->param<1)
+				nd->param = 1;
+		}
+		else
+		{
+			sprintf(errmsg_memory, "stream graph line %d: cannot parse \"%s\"", lineno, w0);
+			printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+			err = 1;
+		}
+		
+		if(err==0)
+		{
+			nd->nelement = (uint64_t) nd->size[0]*nd->size[1];
+			nd->buff = (float*) calloc(nd->nelement, sizeof(float));
+			if(nd->op==STREAMGRAPH_OP_AVE)
+				nd->work = (float*) calloc(nd->nelement, sizeof(float));
+			if(nd->op==STREAMGRAPH_OP_DELAY)
+				nd->work = (float*) calloc(nd->nelement*(nd->param+1), sizeof(float));
+		}
+		NBnode++;
+	}
+	fclose(fp);
+	
+	if((err==0)&&(trig==-1))
+	{
+		printERROR(__FILE__, __func__, __LINE__, "stream graph: no source");
+		err = 1;
+	}
+	
+	if(err==0)
+	{
+		printf("Stream graph %s : %d node(s), triggered by %s\n", fname, NBnode, data.image[node[trig].IDsrc].md[0].name);
+		fflush(stdout);
+		
+#ifndef __MACH__
+		if(cpu >= 0)
+		{
+			cpu_set_t cpuset;
+			
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu, &cpuset);
+			if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+				printf("WARNING: cannot pin stream graph to CPU %d\n", cpu);
+		}
+#endif
+		
+		if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+			perror("sigaction");
+			exit(EXIT_FAILURE);
+		}
+		if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+			perror("sigaction");
+			exit(EXIT_FAILURE);
+		}
+		
+		cnt0old = data.image[node[trig].IDsrc].md[0].cnt0;
+	}
+		
+	while((err==0)&&(data.signal_INT == 0)&&(data.signal_TERM == 0))
+	{
+		if(COREMOD_MEMORY_image_waitframe(node[trig].IDsrc, cnt0old, 100000) != 0)
+			continue;
+		cnt0old = data.image[node[trig].IDsrc].md[0].cnt0;
+		NBtick++;
+		
+		for(n=0; n<NBnode; n++)
+		{
+			STREAMGRAPH_NODE *nd = &node[n];
+			float *in0 = (nd->in[0]!=-1) ? node[nd->in[0]].buff : NULL;
+			float *in1 = (nd->in[1]!=-1) ? node[nd->in[1]].buff : NULL;
+			int inupdated = 0;
+			
+			if( ((nd->in[0]!=-1)&&(node[nd->in[0]].updated==1))
+					|| ((nd->in[1]!=-1)&&(node[nd->in[1]].updated==1))
+					|| ((nd->in[2]!=-1)&&(node[nd->in[2]].updated==1)) )
+				inupdated = 1;
+			
+			nd->updated = 0;
+			switch(nd->op)
+			{
+				case STREAMGRAPH_OP_SOURCE :
+				{
+					IMAGE *img = &data.image[nd->IDsrc];
+					
+					ImageStreamIO_read_consistent(img, nd->raw, 0, TYPESIZE[img->md[0].atype]*nd->nelement, 10);
+					COREMOD_MEMORY_tofloat(nd->raw, img->md[0].atype, nd->buff, nd->nelement);
+					nd->updated = 1;
+					break;
+				}
+				
+				case STREAMGRAPH_OP_DIFF :
+				if(inupdated==1)
+				{
+					if(nd->in[2]==-1)
+						for(ii=0; ii<nd->nelement; ii++)
+							nd->buff[ii] = in0[ii] - in1[ii];
+					else
+					{
+						float *mask = node[nd->in[2]].buff;
+						for(ii=0; ii<nd->nelement; ii++)
+							nd->buff[ii] = (in0[ii] - in1[ii]) * mask[ii];
+					}
+					nd->updated = 1;
+				}
+				break;
+				
+				case STREAMGRAPH_OP_HALFDIFF :
+				if(inupdated==1)
+				{
+					for(ii=0; ii<nd->nelement; ii++)
+						nd->buff[ii] = in0[ii] - in0[nd->nelement+ii];
+					nd->updated = 1;
+				}
+				break;
+				
+				case STREAMGRAPH_OP_AVE :
+				if(inupdated==1)
+				{
+					for(ii=0; ii<nd->nelement; ii++)
+						nd->work[ii] += in0[ii];
+					nd->cnt++;
+					if(nd->cnt==nd->param)
+					{
+						float coeff = 1.0/nd->param;
+						
+						for(ii=0; ii<nd->nelement; ii++)
+						{
+							nd->buff[ii] = nd->work[ii]*coeff;
+							nd->work[ii] = 0.0;
+						}
+						nd->cnt = 0;
+						nd->updated = 1;
+					}
+				}
+				break;
+				
+				case STREAMGRAPH_OP_DELAY :
+				if(inupdated==1)
+				{
+					long nslot = nd->param+1;
+					
+					memcpy(nd->work + nd->nelement*(nd->cnt % nslot), in0, sizeof(float)*nd->nelement);
+					if(nd->cnt >= nd->param)
+					{
+						memcpy(nd->buff, nd->work + nd->nelement*((nd->cnt - nd->param) % nslot), sizeof(float)*nd->nelement);
+						nd->updated = 1;
+					}
+					nd->cnt++;
+				}
+				break;
+			}
+			
+			if((nd->updated==1)&&(nd->IDpub!=-1))
+			{
+				IMAGE *img = &data.image[nd->IDpub];
+				
+				ImageStreamIO_write_begin(img);
+				memcpy(img->array.F, nd->buff, sizeof(float)*nd->nelement);
+				img->md[0].cnt0++;
+				ImageStreamIO_write_end(img);
+				ImageStreamIO_sempost(img, -1);
+			}
+		}
+	}
+	
+	if(err==0)
+		printf("Stream graph: %lld trigger(s) processed\n", NBtick);
+	
+	for(n=0; n<NBnode; n++)
+	{
+		free(node[n].buff);
+		free(node[n].work);
+		free(node[n].raw);
+	}
+	
+	return((err==0) ? NBtick : -1);
+}
+
+
+
+
+/** @brief takes a 3Dimage(s) (circular buffer(s)) and writes slices to a 2D image with time interval specified in us
+ *
+ *
+ *
+ */
+long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDoutname, long usperiod, long NBcubes, long period, long offsetus, const char *IDsync_name, int semtrig, int timingmode)
+{
+    long *IDin;
+    long cubeindex;
+    char imname[200];
+    long IDsync;
+    long long cntsync;
+    long pcnt = 0;
+    long offsetfr = 0;
+    long offsetfrcnt = 0;
+    int cntDelayMode = 0;
+
+    long IDout;
+    long kk;
+    uint32_t *arraysize;
+    long naxis;
+    uint8_t atype;
+    char *ptr0s; // source start 3D array ptr
+    char *ptr0; // source
+    char *ptr1; // dest
+    long framesize;
+    int semval;
+
+    int RT_priority = 80; //any number from 0-99
+    struct sched_param schedpar;
+
+    COREMOD_MEMORY_PACER pacer;
+
+    int SyncSlice = 0;
+
+
+
+
+    schedpar.sched_priority = RT_priority;
+#ifndef __MACH__
+    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
+#endif
+
+
+    if(NBcubes<1)
+    {
+        printf("ERROR: invalid number of input cubes, needs to be >0");
+        return(-1);
+    }
+
+
+
+    IDin = (long*) malloc(sizeof(long)*NBcubes);
+    SyncSlice = 0;
     if(NBcubes==1)
     {
         IDin[0] = image_ID(IDinname);
@@ -4921,7 +7217,7 @@ long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDo
     if(NBcubes>1)
         cntsync = data.image[IDsync].md[0].cnt0;
 
-    twait1 = usperiod;
+    COREMOD_MEMORY_pacer_init(&pacer, 1000*usperiod, (timingmode==1) ? COREMOD_MEMORY_PACER_SPINNS : 0, 10.0);
     kk = 0;
     cntDelayMode = 0;
 
@@ -5028,8 +7324,6 @@ long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDo
 
 
 
-        clock_gettime(CLOCK_REALTIME, &t0);
-
         ptr0 = ptr0s + kk*framesize;
         data.image[IDout].md[0].write = 1;
         memcpy((void *) ptr1, (void *) ptr0, framesize);
@@ -5045,23 +7339,7 @@ long COREMOD_MEMORY_image_streamupdateloop(const char *IDinname, const char *IDo
 
 
         if(SyncSlice==0)
-        {
-            usleep(twait1);
-
-            clock_gettime(CLOCK_REALTIME, &t1);
-            tdiff = info_time_diff(t0, t1);
-            tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-
-            if(tdiffv<1.0e-6*usperiod)
-                twait1 ++;
-            else
-                twait1 --;
-
-            if(twait1<0)
-                twait1 = 0;
-            if(twait1>usperiod)
-                twait1 = usperiod;
-        }
+            COREMOD_MEMORY_pacer_wait(&pacer, IDoutname);
         else
         {
             sem_wait(data.image[IDsync].semptr[semtrig]);
@@ -5239,130 +7517,221 @@ long COREMOD_MEMORY_image_streamupdateloop_semtrig(const char *IDinname, const c
 
 
 /** 
+ * @brief Time-delayed copy of a stream
  * 
- * IDout_name is a time-delayed copy of IDin_name
+ * IDout_name is a time-delayed copy of IDin_name.\n
+ * Input frames are copied (memcpy) into a ring buffer of delayus/dtus+2 slots, time-stamped on arrival.
+ * The loop blocks on the input stream (futex if enabled, semaphore otherwise) until either a new input frame arrives or the next output is due.\n
+ * interp = 0 : each input frame is written to the output delayus after its arrival\n
+ * interp = 1 : output is updated every dtus, linearly interpolated between the two input frames bracketing (time - delayus).
+ * Interpolation applies to float and double streams, other types use the nearest frame.
  * 
+ * @param[in]  IDin_name   input stream
+ * @param[in]  IDout_name  output stream, created with input size and type if it does not exist
+ * @param[in]  delayus     delay [us]
+ * @param[in]  dtus        time resolution [us], also minimum input frame spacing held in ring buffer
+ * @param[in]  interp      1 for linear interpolation
  */ 
 
-long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus)
+long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus, int interp)
 {
-	long IDimc;
 	long IDin, IDout;
-	uint32_t xsize, ysize, xysize;
 	long zsize;
-	long kkin;
-	long cnt0, cnt0old;
-	long ii;
-	struct timespec *t0array;
+	long typesize;
+	size_t framesize;
+	char *ringbuff;
+	double *tarray;
+	uint64_t nin = 0;   // frames written to ring
+	uint64_t nout = 0;  // oldest frame still needed in ring
+	uint64_t nheld = UINT64_MAX; // frame held at output (interp mode)
+	uint64_t cnt0old;
 	struct timespec tnow;
-	double tdiffv;
-	struct timespec tdiff;
-	uint32_t *arraytmp;
-	long cntskip = 0;
-	long kkout;
-	long kk;
+	double tnowv;
+	double tdue;
+	double tnexttick;
+	double delay, dt;
+	long long NBdrop = 0;
+	uint64_t ii;
+	uint32_t imsize[3]; // aligned copy of md[0].size (packed member)
 	  
 	IDin = image_ID(IDin_name);
-	xsize = data.image[IDin].md[0].size[0];
-	ysize = data.image[IDin].md[0].size[1];
-	zsize = (long) (delayus/dtus);
-	if(zsize<1)
-		zsize = 1;
-	xysize = xsize*ysize;
+	if(IDin == -1)
+	{
+		sprintf(errmsg_memory, "Image \"%s\" does not exist", IDin_name);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
 	
-	t0array = (struct timespec*) malloc(sizeof(struct timespec)*zsize);
+	if(dtus<1)
+		dtus = 1;
+	zsize = delayus/dtus + 2;
+	delay = 1.0e-6*delayus;
+	dt = 1.0e-6*dtus;
 	
-	IDimc = create_3Dimage_ID("_tmpc", xsize, ysize, zsize);
+	typesize = TYPESIZE[data.image[IDin].md[0].atype];
+	framesize = (size_t) typesize*data.image[IDin].md[0].nelement;
 	
-	list_image_ID();
+	ringbuff = (char*) malloc(framesize*zsize);
+	tarray = (double*) malloc(sizeof(double)*zsize);
+	if((ringbuff==NULL)||(tarray==NULL))
+	{
+		printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+		exit(0);
+	}
 	
 	IDout = image_ID(IDout_name);
     if(IDout==-1) // CREATE IT
     {
-		arraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
-		arraytmp[0] = xsize;
-		arraytmp[1] = ysize;
-        IDout = create_image_ID(IDout_name, 2, arraytmp, _DATATYPE_FLOAT, 1, 0);
+        memcpy(imsize, data.image[IDin].md[0].size, sizeof(uint32_t)*3);
+        IDout = create_image_ID(IDout_name, data.image[IDin].md[0].naxis, imsize, data.image[IDin].md[0].atype, 1, 0);
         COREMOD_MEMORY_image_set_createsem(IDout_name, 10);
-		free(arraytmp);
     }
+    if((data.image[IDout].md[0].atype != data.image[IDin].md[0].atype)||(data.image[IDout].md[0].nelement != data.image[IDin].md[0].nelement))
+    {
+		sprintf(errmsg_memory, "Image \"%s\" does not match size/type of \"%s\"", IDout_name, IDin_name);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		free(ringbuff);
+		free(tarray);
+		return(-1);
+	}
     
+    printf("ring buffer : %ld slots x %ld bytes\n", zsize, (long) framesize);
+    fflush(stdout);
     
-	kkin = 0;
-	kkout = 0;
 	cnt0old = data.image[IDin].md[0].cnt0;
-
 	clock_gettime(CLOCK_REALTIME, &tnow);
-	for(kk=0;kk<zsize;kk++)
-		t0array[kk] = tnow;
-		
+	tnexttick = 1.0*tnow.tv_sec + 1.0e-9*tnow.tv_nsec + dt;
 	
 	while(1)
 	{
-		// has new frame arrived ?
-		cnt0 = data.image[IDin].md[0].cnt0;
-		if(cnt0!=cnt0old)
+		clock_gettime(CLOCK_REALTIME, &tnow);
+		tnowv = 1.0*tnow.tv_sec + 1.0e-9*tnow.tv_nsec;
+		
+		// time at which output is next updated
+		if(interp==0)
+			tdue = (nout<nin) ? tarray[nout%zsize] + delay : tnowv + dt;
+		else
+			tdue = tnexttick;
+		
+		if(tdue > tnowv)
 		{
-			clock_gettime(CLOCK_REALTIME, &t0array[kkin]);
-			for(ii=0;ii<xysize;ii++)
-				data.image[IDimc].array.F[kkin*xysize+ii] = data.image[IDin].array.F[ii];
-			kkin++;
-			if(kkin==zsize)
-				kkin = 0;
-			cnt0old = cnt0;		
-			printf("New frame detected: %ld  ->  %ld\n", cnt0, kkin);
-			fflush(stdout);
+			if(COREMOD_MEMORY_image_waitframe(IDin, cnt0old, (long) (1.0e6*(tdue-tnowv))) == 0)
+			{
+				// new input frame
+				long slot;
+				
+				if(nin-nout == (uint64_t) zsize)
+				{
+					nout++;
+					NBdrop++;
+					if(NBdrop == 1)
+						printf("WARNING: input faster than resolution, ring buffer full - dropping oldest frames\n");
+				}
+				slot = nin % zsize;
+				cnt0old = data.image[IDin].md[0].cnt0;
+				ImageStreamIO_read_consistent(&data.image[IDin], ringbuff + framesize*slot, 0, framesize, 10);
+				clock_gettime(CLOCK_REALTIME, &tnow);
+				tarray[slot] = 1.0*tnow.tv_sec + 1.0e-9*tnow.tv_nsec;
+				nin++;
+			}
+			continue;
 		}
 		
-		clock_gettime(CLOCK_REALTIME, &tnow);
-		
-		
-		cntskip = 0;
-		tdiff = info_time_diff(t0array[kkout], tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-		
-	//	printf("tdiff = %f us   ", tdiffv*1e6);
-	//	fflush(stdout);
-		while((tdiffv>1.0e-6*delayus)&&(cntskip<zsize))
+		if(interp==0)
+		{
+			// output most recent frame due, skipping older ones
+			while((nout+1<nin)&&(tarray[(nout+1)%zsize]+delay <= tnowv))
+				nout++;
+			
+			if(nout<nin)
 			{
-				cntskip++;				
-				kkout++;
-				if(kkout==zsize)
-					kkout = 0;
-				tdiff = info_time_diff(t0array[kkout], tnow);
-				tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+				ImageStreamIO_write_begin(&data.image[IDout]);
+				memcpy(data.image[IDout].array.UI8, ringbuff + framesize*(nout%zsize), framesize);
+				data.image[IDout].md[0].cnt1 = 0;
+				data.image[IDout].md[0].cnt0++;
+				ImageStreamIO_write_end(&data.image[IDout]);
+				COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+				nout++;
 			}
-	//	printf("cntskip = %ld\n", cntskip);
-	//	fflush(stdout);
-		
-		if(cntskip>0)
+		}
+		else
 		{
-		//	printf("Updating %s  %ld\n", IDout_name, IDout);
+			double target = tnowv - delay;
 			
-			data.image[IDout].md[0].write = 1;
-			for(ii=0;ii<xysize;ii++)
-				data.image[IDout].array.F[ii] = data.image[IDimc].array.F[kkout*xysize+ii];	
+			tnexttick += dt;
+			if(tnexttick < tnowv)
+				tnexttick = tnowv + dt;
+			
+			// keep oldest frame bracketing target
+			while((nout+1<nin)&&(tarray[(nout+1)%zsize] <= target))
+				nout++;
 			
-			COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);;
-			data.image[IDout].md[0].cnt0++;
-			data.image[IDout].md[0].write = 0;
+			if((nout<nin)&&(tarray[nout%zsize] <= target))
+			{
+				char *f0 = ringbuff + framesize*(nout%zsize);
+				char *f1 = f0;
+				double a = 0.0;
+				
+				if(nout+1<nin)
+				{
+					f1 = ringbuff + framesize*((nout+1)%zsize);
+					a = (target - tarray[nout%zsize]) / (tarray[(nout+1)%zsize] - tarray[nout%zsize]);
+					nheld = UINT64_MAX;
+				}
+				
+				if(nheld != nout) // held frame only needs to be written once
+				{
+					if(nout+1 == nin)
+						nheld = nout;
+					
+					ImageStreamIO_write_begin(&data.image[IDout]);
+					switch(data.image[IDin].md[0].atype)
+					{
+						case _DATATYPE_FLOAT :
+						{
+							float *pout = data.image[IDout].array.F;
+							float *p0 = (float*) f0;
+							float *p1 = (float*) f1;
+							float a1 = a;
+							
+							for(ii=0; ii<data.image[IDout].md[0].nelement; ii++)
+								pout[ii] = p0[ii] + a1*(p1[ii]-p0[ii]);
+							break;
+						}
+						case _DATATYPE_DOUBLE :
+						{
+							double *pout = data.image[IDout].array.D;
+							double *p0 = (double*) f0;
+							double *p1 = (double*) f1;
+							
+							for(ii=0; ii<data.image[IDout].md[0].nelement; ii++)
+								pout[ii] = p0[ii] + a*(p1[ii]-p0[ii]);
+							break;
+						}
+						default :
+							memcpy(data.image[IDout].array.UI8, (a<0.5) ? f0 : f1, framesize);
+							break;
+					}
+					data.image[IDout].md[0].cnt1 = 0;
+					data.image[IDout].md[0].cnt0++;
+					ImageStreamIO_write_end(&data.image[IDout]);
+					COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+				}
+			}
 		}
-		
-	
-		usleep(dtus);
 	}
 	
-	delete_image_ID("_tmpc");
+	free(ringbuff);
+	free(tarray);
 	
-	free(t0array);
-	
-	return(0);
+	return(IDout);
 }
 
 
 
 
 
+
 //
 // save all current images/stream onto file
 //
@@ -5376,7 +7745,6 @@ long COREMOD_MEMORY_SaveAll_snapshot(const char *dirname)
 	char fnamecp[500];
 	long ID;
 	char command[500];
-	int ret;
 	
 	
 	for (i=0; i<data.NB_MAX_IMAGE; i++)
@@ -5396,7 +7764,8 @@ long COREMOD_MEMORY_SaveAll_snapshot(const char *dirname)
 		
 	
 	sprintf(command, "mkdir -p %s", dirname);
-	ret = system(command);
+	if(system(command) != 0)
+		printERROR(__FILE__, __func__, __LINE__, "system() returns non-zero value");
 	
 	// create array for each image
 	for(i=0;i<imcnt;i++)
@@ -5534,6 +7903,150 @@ long COREMOD_MEMORY_SaveAll_sequ(const char *dirname, const char *IDtrig_name, l
 
 
 
+/**
+ * @brief Save all images at each trigger, streamed to disk through asynchronous writers
+ *
+ * For each image, frames are appended to <dirname>/<name>_out.dat (raw, native byte order).
+ * <dirname>/<name>_out.txt describes size and type, and lists for every trigger the trigger counter
+ * and the record index in the .dat file, or -1 if the frame was dropped because the writer queue was full.
+ *
+ * @param[in]  dirname      output directory
+ * @param[in]  IDtrig_name  trigger stream
+ * @param[in]  semtrig      trigger semaphore index
+ * @param[in]  NBframes     number of frames
+ * @param[in]  NBslot       writer queue depth [frames]
+ */
+long COREMOD_MEMORY_SaveAll_sequ_async(const char *dirname, const char *IDtrig_name, long semtrig, long NBframes, long NBslot)
+{
+	long *IDarray;
+	ASYNCWRITER **awarray;
+	size_t *framesize;
+	long *recindex;    // next record index, per image
+	char **statarray;  // record index per frame, per image  (-1 if dropped)
+	long i;
+	long imcnt = 0;
+	char fname[500];
+	char command[500];
+	int ret;
+	long IDtrig;
+	long frame;
+	long NBdroptot = 0;
+	long *trigcnt;
+	
+	IDtrig = image_ID(IDtrig_name);
+	if(IDtrig==-1)
+	{
+		sprintf(errmsg_memory, "Image \"%s\" does not exist", IDtrig_name);
+		printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+		return(-1);
+	}
+	
+	for (i=0; i<data.NB_MAX_IMAGE; i++)
+       if(data.image[i].used==1)
+		imcnt++;
+    
+    IDarray = (long*) malloc(sizeof(long)*imcnt);
+    awarray = (ASYNCWRITER**) malloc(sizeof(ASYNCWRITER*)*imcnt);
+    framesize = (size_t*) malloc(sizeof(size_t)*imcnt);
+    recindex = (long*) calloc(imcnt, sizeof(long));
+    statarray = (char**) malloc(sizeof(char*)*imcnt);
+    trigcnt = (long*) malloc(sizeof(long)*NBframes);
+    
+    imcnt = 0;
+    for (i=0; i<data.NB_MAX_IMAGE; i++)
+       if(data.image[i].used==1)
+		{
+			IDarray[imcnt] = i;
+			imcnt++;
+		}
+	
+	sprintf(command, "mkdir -p %s", dirname);
+	ret = system(command);
+	
+	for(i=0;i<imcnt;i++)
+	{
+		IMAGE_METADATA *md = data.image[IDarray[i]].md;
+		
+		framesize[i] = (size_t) TYPESIZE[md[0].atype]*md[0].nelement;
+		statarray[i] = (char*) calloc(NBframes, sizeof(char));
+		sprintf(fname, "./%s/%s_out.dat", dirname, md[0].name);
+		awarray[i] = COREMOD_MEMORY_asyncwriter_open(fname, framesize[i], NBslot);
+		if(awarray[i]==NULL)
+			exit(0);
+	}
+	
+	printf("Streaming %ld image(s) to %s\n", imcnt, dirname);
+	fflush(stdout);
+	
+	// drive semaphore to zero
+	while(sem_trywait(data.image[IDtrig].semptr[semtrig])==0) {}
+	
+	for(frame=0; frame<NBframes; frame++)
+	{
+		sem_wait(data.image[IDtrig].semptr[semtrig]);
+		trigcnt[frame] = data.image[IDtrig].md[0].cnt0;
+		for(i=0;i<imcnt;i++)
+			if(COREMOD_MEMORY_asyncwriter_submit(awarray[i], data.image[IDarray[i]].array.UI8, framesize[i]) == 0)
+				statarray[i][frame] = 1;
+	}
+	
+	for(i=0;i<imcnt;i++)
+	{
+		IMAGE_METADATA *md = data.image[IDarray[i]].md;
+		long NBdrop;
+		FILE *fp;
+		int axis;
+		
+		NBdrop = COREMOD_MEMORY_asyncwriter_close(awarray[i]);
+		
+		sprintf(fname, "./%s/%s_out.txt", dirname, md[0].name);
+		if((fp = fopen(fname, "w")) == NULL)
+		{
+			sprintf(errmsg_memory, "Cannot create file \"%s\"", fname);
+			printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+			continue;
+		}
+		fprintf(fp, "# image     %s\n", md[0].name);
+		fprintf(fp, "# atype     %d\n", md[0].atype);
+		fprintf(fp, "# size     ");
+		for(axis=0; axis<md[0].naxis; axis++)
+			fprintf(fp, " %u", md[0].size[axis]);
+		fprintf(fp, "\n");
+		fprintf(fp, "# frames    %ld\n", NBframes);
+		fprintf(fp, "# dropped   %ld\n", NBdrop);
+		fprintf(fp, "# frame  trigcnt0  record\n");
+		for(frame=0; frame<NBframes; frame++)
+		{
+			fprintf(fp, "%6ld  %10ld  %6ld\n", frame, trigcnt[frame], (statarray[i][frame]==1) ? recindex[i] : -1);
+			if(statarray[i][frame]==1)
+				recindex[i]++;
+		}
+		fclose(fp);
+		
+		if(NBdrop != 0)
+		{
+			printf("WARNING: %s : %ld frame(s) dropped, see %s\n", md[0].name, NBdrop, fname);
+			NBdroptot += (NBdrop>0) ? NBdrop : 0;
+		}
+		free(statarray[i]);
+	}
+	
+    free(IDarray);
+    free(awarray);
+    free(framesize);
+    free(recindex);
+    free(statarray);
+    free(trigcnt);
+    
+	return(NBdroptot);
+}
+
+
+
+
+
+
+
 
 
 
@@ -5544,6 +8057,51 @@ long COREMOD_MEMORY_SaveAll_sequ(const char *dirname, const char *IDtrig_name, l
 
 
 
+/**
+ * @brief Send all bytes described by an iovec array
+ * 
+ * sendmsg() may return after a partial write; the iovec array is advanced
+ * and the call repeated until everything is sent. The array is modified.
+ * 
+ * @return total number of bytes sent, -1 on error
+ */
+static long COREMOD_MEMORY_sendmsg_all(int fds, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    long total = 0;
+    ssize_t rs;
+    
+    while(iovcnt>0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        
+        rs = sendmsg(fds, &msg, 0);
+        if(rs < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return(-1);
+        }
+        total += rs;
+        
+        while((iovcnt>0)&&((size_t) rs >= iov[0].iov_len))
+        {
+            rs -= iov[0].iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt>0)
+        {
+            iov[0].iov_base = (char*) iov[0].iov_base + rs;
+            iov[0].iov_len -= rs;
+        }
+    }
+    
+    return(total);
+}
+
 
 
 
@@ -5577,7 +8135,7 @@ long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr
     int NBslices;
     TCP_BUFFER_METADATA *frame_md;
     long framesize1; // pixel data + metadata
-    char *buff; // transmit buffer
+    struct iovec iov[2];
 
     schedpar.sched_priority = RT_priority;
     #ifndef __MACH__
@@ -5755,7 +8313,6 @@ long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr
 
     frame_md = (TCP_BUFFER_METADATA*) malloc(sizeof(TCP_BUFFER_METADATA));
     framesize1 = framesize + sizeof(TCP_BUFFER_METADATA);
-    buff = (char*) malloc(sizeof(char)*framesize1);
 
     oldslice = 0;
     sockOK = 1;
@@ -5821,11 +8378,13 @@ long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr
             }*/
 
             ptr1 = ptr0 + framesize*slice; //data.image[ID].md[0].cnt1; // frame that was just written
-            memcpy(buff, ptr1, framesize);
-            
-            memcpy(buff+framesize, frame_md, sizeof(TCP_BUFFER_METADATA));
 
-            rs = send(fds_client, buff, framesize1, 0);
+            // gather pixel data and metadata in a single sendmsg, without intermediate copy
+            iov[0].iov_base = ptr1;
+            iov[0].iov_len = framesize;
+            iov[1].iov_base = frame_md;
+            iov[1].iov_len = sizeof(TCP_BUFFER_METADATA);
+            rs = COREMOD_MEMORY_sendmsg_all(fds_client, iov, 2);
 
             if ( rs != framesize1)
             {
@@ -5850,8 +8409,6 @@ long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr
         iter++;
     }
 
-    free(buff);
-	
     close(fds_client);
     printf("port %d closed\n", port);
     fflush(stdout);
@@ -5869,6 +8426,77 @@ long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr
 
 
 
+/**
+ * @brief Find or create local image matching received stream metadata
+ * 
+ * Reuses image (local or shared memory) if name, size and type match,
+ * otherwise (re)creates it.
+ * 
+ * @return image ID
+ */
+static long COREMOD_MEMORY_NETWORKreceive_image(IMAGE_METADATA *imgmd)
+{
+    long ID;
+	int OKim;
+	int axis;
+	uint32_t imsize[3]; // aligned copy of imgmd[0].size (packed member)
+	
+	// is image already in memory ?
+	OKim = 0;
+	
+	ID = image_ID(imgmd[0].name);
+	if(ID==-1)
+	{
+		// is it in shared memory ?
+		ID = read_sharedmem_image(imgmd[0].name);
+	}	
+	
+	list_image_ID();
+	
+	if(ID == -1)
+		OKim = 0;
+	else
+	{
+		OKim = 1;
+		if(imgmd[0].naxis != data.image[ID].md[0].naxis)
+			OKim = 0;
+		if(OKim==1)
+			{
+				for(axis=0;axis<imgmd[0].naxis;axis++)
+					if(imgmd[0].size[axis] != data.image[ID].md[0].size[axis])
+						OKim = 0;
+			}
+		if(imgmd[0].atype != data.image[ID].md[0].atype)
+			OKim = 0;
+			
+		if(OKim==0)
+			{
+				delete_image_ID(imgmd[0].name);
+				ID = -1;
+			}
+	}
+	
+
+
+	if(OKim==0)
+	{
+		printf("IMAGE %s HAS TO BE CREATED\n", imgmd[0].name);
+		memcpy(imsize, imgmd[0].size, sizeof(uint32_t)*3);
+		ID = create_image_ID(imgmd[0].name, imgmd[0].naxis, imsize, imgmd[0].atype, imgmd[0].shared, 0);
+		printf("Created image stream %s - shared = %d\n", imgmd[0].name, imgmd[0].shared);
+    }
+    else
+		printf("REUSING EXISTING IMAGE %s\n", imgmd[0].name);
+    
+    
+	COREMOD_MEMORY_image_set_createsem(imgmd[0].name, 10);
+
+    return(ID);
+}
+
+
+
+
 long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority)
 {
     struct sockaddr_in sock_server, sock_client;
@@ -5890,8 +8518,6 @@ long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority)
     int socketOpen = 1; // 0 if socket is closed
     int semval;
     int semnb;
-	int OKim;
-	int axis;
 	
 	
     imgmd = (IMAGE_METADATA*) malloc(sizeof(IMAGE_METADATA));
@@ -5975,54 +8601,7 @@ long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority)
     }
 
 
-	// is image already in memory ?
-	OKim = 0;
-	
-	ID = image_ID(imgmd[0].name);
-	if(ID==-1)
-	{
-		// is it in shared memory ?
-		ID = read_sharedmem_image(imgmd[0].name);
-	}	
-	
-	list_image_ID();
-	
-	if(ID == -1)
-		OKim = 0;
-	else
-	{
-		OKim = 1;
-		if(imgmd[0].naxis != data.image[ID].md[0].naxis)
-			OKim = 0;
-		if(OKim==1)
-			{
-				for(axis=0;axis<imgmd[0].naxis;axis++)
-					if(imgmd[0].size[axis] != data.image[ID].md[0].size[axis])
-						OKim = 0;
-			}
-		if(imgmd[0].atype != data.image[ID].md[0].atype)
-			OKim = 0;
-			
-		if(OKim==0)
-			{
-				delete_image_ID(imgmd[0].name);
-				ID = -1;
-			}
-	}
-	
-
-
-	if(OKim==0)
-	{
-		printf("IMAGE %s HAS TO BE CREATED\n", imgmd[0].name);
-		ID = create_image_ID(imgmd[0].name, imgmd[0].naxis, imgmd[0].size, imgmd[0].atype, imgmd[0].shared, 0);
-		printf("Created image stream %s - shared = %d\n", imgmd[0].name, imgmd[0].shared);
-    }
-    else
-		printf("REUSING EXISTING IMAGE %s\n", imgmd[0].name);
-    
-    
-	COREMOD_MEMORY_image_set_createsem(imgmd[0].name, 10);
+    ID = COREMOD_MEMORY_NETWORKreceive_image(imgmd);
 
     xsize = data.image[ID].md[0].size[0];
     ysize = data.image[ID].md[0].size[1];
@@ -6223,102 +8802,248 @@ long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority)
 
 
 
-//
-// pixel decode for unsigned short
-// sem0, cnt0 gets updated at each full frame
-// sem1 gets updated for each slice
-// cnt1 contains the slice index that was just written
-//
-long COREMOD_MEMORY_PixMapDecode_U(const char *inputstream_name, uint32_t xsizeim, uint32_t ysizeim, const char* NBpix_fname, const char* IDmap_name, const char *IDout_name, const char *IDout_pixslice_fname)
+/**
+ * @brief Encode changed words of a frame as sparse runs
+ * 
+ * Compares live frame with shadow copy (last frame sent) and writes runs of
+ * changed 32-bit words to enc as (offset, nbword, values...). Unchanged gaps
+ * shorter than a run header are merged into the surrounding run.
+ * Shadow is updated to match live, whether or not the encoding fits.
+ * 
+ * @return number of words needed for encoding (may exceed encmax, in which case enc is incomplete)
+ */
+static long COREMOD_MEMORY_sparse_encode(const uint32_t *live, uint32_t *shadow, long nbword, uint32_t *enc, long encmax)
 {
-    long IDout = -1;
-    long IDin;
-    long IDmap;
-    long slice, sliceii;
-    long oldslice = 0;
-    long NBslice;
-    long *nbpixslice;
-    uint32_t xsizein, ysizein;
-    FILE *fp;
-    uint32_t *sizearray;
-    long IDout_pixslice;
-    int loopOK;
-    long ii;
-    long cnt = 0;
-//    int RT_priority = 80; //any number from 0-99
+    long i = 0;
+    long n = 0;
+    
+    while(i<nbword)
+    {
+        long run0, hdr, gap, trail;
+        
+        if(live[i] == shadow[i])
+        {
+            i++;
+            continue;
+        }
+        
+        run0 = i;
+        hdr = n;
+        n += 2;
+        gap = 0;
+        while(i<nbword)
+        {
+            uint32_t w = live[i];
+            
+            if(w != shadow[i])
+            {
+                shadow[i] = w;
+                gap = 0;
+            }
+            else
+            {
+                gap++;
+                if(gap>2)
+                    break;
+            }
+            if(n<encmax)
+                enc[n] = w;
+            n++;
+            i++;
+        }
+        trail = (gap>2) ? 2 : gap;
+        n -= trail;
+        if(hdr+1<encmax)
+        {
+            enc[hdr] = run0;
+            enc[hdr+1] = i - run0 - trail;
+        }
+    }
+    
+    return(n);
+}
 
-    struct sched_param schedpar;
-    struct timespec ts;
-    long scnt;
-    int semval;
-    long long iter;
-    int r;
-    long tmpl0, tmpl1;
-    int semr;
 
-    double *dtarray;
-    struct timespec *tarray;
-    long slice1;
 
+/**
+ * @brief Apply sparse runs produced by COREMOD_MEMORY_sparse_encode() to frame
+ * 
+ * @return 0 if OK, -1 if encoding is inconsistent with frame size
+ */
+static int COREMOD_MEMORY_sparse_decode(const uint32_t *enc, long nbenc, uint32_t *frame, long nbword)
+{
+    long p = 0;
+    
+    while(p+2<=nbenc)
+    {
+        uint32_t offset = enc[p];
+        uint32_t len = enc[p+1];
+        
+        if(((long) offset+len>nbword)||(p+2+(long) len>nbenc))
+            return(-1);
+        memcpy(frame+offset, enc+p+2, sizeof(uint32_t)*len);
+        p += 2+len;
+    }
+    
+    return((p==nbenc) ? 0 : -1);
+}
 
 
 
-    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
 
-    IDin = image_ID(inputstream_name);
-    IDmap = image_ID(IDmap_name);
+/**
+ * @brief Transmit several image streams over a single multiplexed TCP link
+ * 
+ * IDnamelist is a comma-separated list of streams. After the handshake
+ * (number of streams, then one IMAGE_METADATA per stream), each frame is sent
+ * as a TCP_MUX_HEADER followed by the pixel data of the slice just written.
+ * 
+ * Streams are polled on cnt0. All frames found ready in one polling pass are
+ * gathered (header + data, no copy) into a single sendmsg() call, so that
+ * under load several frames share one system call and TCP segment train.
+ * If batchus > 0, the transmitter waits up to batchus microseconds after the
+ * first ready frame for other streams to update before sending.
+ * 
+ * If encode = 1, each frame is compared with the last frame sent for the same
+ * slice, and only changed runs of 32-bit words are sent (sparse delta), unless
+ * this is larger than the raw frame. The first frame of each slice is sent raw.
+ * 
+ * To be received by COREMOD_MEMORY_image_NETWORKreceive_multi().
+ */
+long COREMOD_MEMORY_image_NETWORKtransmit_multi(const char *IDnamelist, const char *IPaddr, int port, long batchus, int encode, int RT_priority)
+{
+    struct sockaddr_in sock_server;
+    int fds_client;
+    int flag = 1;
+    char namelist[NETWORK_MUX_NBSTREAM_MAX*80];
+    char *name;
+    char *saveptr;
+    long IDarray[NETWORK_MUX_NBSTREAM_MAX];
+    uint32_t NBstream = 0;
+    long framesize[NETWORK_MUX_NBSTREAM_MAX];
+    uint32_t NBslices[NETWORK_MUX_NBSTREAM_MAX];
+    uint64_t cnt[NETWORK_MUX_NBSTREAM_MAX];
+    int ready[NETWORK_MUX_NBSTREAM_MAX];
+    TCP_MUX_HEADER header[NETWORK_MUX_NBSTREAM_MAX];
+    struct iovec iov[2*NETWORK_MUX_NBSTREAM_MAX];
+    int iovcnt;
+    uint32_t s;
+    uint32_t NBready;
+    long nbbyte;
+    int sockOK;
+    struct sched_param schedpar;
+    struct timespec t0, t1;
+    long long framecnt = 0;
+    long long msgcnt = 0;
+    uint32_t *shadow[NETWORK_MUX_NBSTREAM_MAX]; // last frames sent, per stream
+    char *shadowOK[NETWORK_MUX_NBSTREAM_MAX];   // 1 if slice has been sent
+    uint32_t *encbuff[NETWORK_MUX_NBSTREAM_MAX];
+    long long rawbytecnt = 0;
+    long long sentbytecnt = 0;
 
-    xsizein = data.image[IDin].md[0].size[0];
-    ysizein = data.image[IDin].md[0].size[1];
+    schedpar.sched_priority = RT_priority;
+    #ifndef __MACH__
+    sched_setscheduler(0, SCHED_FIFO, &schedpar);
+    #endif
 
-    if(xsizein != data.image[IDmap].md[0].size[0])
+    strncpy(namelist, IDnamelist, sizeof(namelist)-1);
+    namelist[sizeof(namelist)-1] = '\0';
+    for(name = strtok_r(namelist, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr))
     {
-        printf("ERROR: xsize for %s (%d) does not match xsize for %s (%d)\n", inputstream_name, xsizein, IDmap_name, data.image[IDmap].md[0].size[0]);
-        exit(0);
+        if(NBstream == NETWORK_MUX_NBSTREAM_MAX)
+        {
+            printf("ERROR: too many streams (max %d)\n", NETWORK_MUX_NBSTREAM_MAX);
+            exit(0);
+        }
+        IDarray[NBstream] = image_ID(name);
+        if(IDarray[NBstream] == -1)
+            IDarray[NBstream] = read_sharedmem_image(name);
+        if(IDarray[NBstream] == -1)
+        {
+            sprintf(errmsg_memory, "Image \"%s\" does not exist", name);
+            printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+            exit(0);
+        }
+        NBstream++;
     }
-    if(ysizein != data.image[IDmap].md[0].size[1])
+    if(NBstream == 0)
     {
-        printf("ERROR: xsize for %s (%d) does not match xsize for %s (%d)\n", inputstream_name, ysizein, IDmap_name, data.image[IDmap].md[0].size[1]);
+        printERROR(__FILE__, __func__, __LINE__, "no stream to transmit");
         exit(0);
     }
-    sizearray[0] = xsizeim;
-    sizearray[1] = ysizeim;
-    IDout = create_image_ID(IDout_name, 2, sizearray, data.image[IDin].md[0].atype, 1, 0);
-    COREMOD_MEMORY_image_set_createsem(IDout_name, 10); // create 10 semaphores
-    IDout_pixslice = create_image_ID("outpixsl", 2, sizearray, _DATATYPE_UINT16, 0, 0);
-
-    NBslice = data.image[IDin].md[0].size[2];
-
-    dtarray = (double*) malloc(sizeof(double)*NBslice);
-    tarray = (struct timespec *) malloc(sizeof(struct timespec)*NBslice);
 
+    for(s=0; s<NBstream; s++)
+    {
+        IMAGE_METADATA *md = data.image[IDarray[s]].md;
+        
+        NBslices[s] = 1;
+        if(md[0].naxis>2)
+            if(md[0].size[2]>1)
+                NBslices[s] = md[0].size[2];
+        framesize[s] = (long) (data.image[IDarray[s]].md[0].nelement / NBslices[s]) * TYPESIZE[md[0].atype];
+        if(framesize[s] == 0)
+        {
+            printf("ERROR: WRONG DATA TYPE\n");
+            exit(0);
+        }
+        cnt[s] = md[0].cnt0;
+        
+        shadow[s] = NULL;
+        shadowOK[s] = NULL;
+        encbuff[s] = NULL;
+        if((encode==1)&&(framesize[s]%sizeof(uint32_t)==0))
+        {
+            shadow[s] = (uint32_t*) malloc(framesize[s]*NBslices[s]);
+            shadowOK[s] = (char*) calloc(NBslices[s], sizeof(char));
+            encbuff[s] = (uint32_t*) malloc(framesize[s]);
+            if((shadow[s]==NULL)||(shadowOK[s]==NULL)||(encbuff[s]==NULL))
+            {
+                printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+                exit(0);
+            }
+        }
+        printf("stream %2u  %-32s  frame size = %ld%s\n", s, md[0].name, framesize[s], (shadow[s]==NULL) ? "" : "  (sparse delta)");
+    }
+    fflush(stdout);
 
-    nbpixslice = (long*) malloc(sizeof(long)*NBslice);
-    if((fp=fopen(NBpix_fname,"r"))==NULL)
+    if ( (fds_client=socket(PF_INET, SOCK_STREAM, IPPROTO_TCP))<0)
     {
-        printf("ERROR : cannot open file \"%s\"\n", NBpix_fname);
+        printf("ERROR creating socket\n");
         exit(0);
     }
 
-    for(slice=0; slice<NBslice; slice++)
-        r = fscanf(fp, "%ld %ld %ld\n", &tmpl0, &nbpixslice[slice], &tmpl1);
-    fclose(fp);
-
-    for(slice=0; slice<NBslice; slice++)
-        printf("Slice %5ld   : %5ld pix\n", slice, nbpixslice[slice]);
-
-
+    if (setsockopt(fds_client, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int)) < 0)
+    {
+        printf("ERROR setsockopt\n");
+        exit(0);
+    }
 
+    memset((char *) &sock_server, 0, sizeof(sock_server));
+    sock_server.sin_family = AF_INET;
+    sock_server.sin_port = htons(port);
+    sock_server.sin_addr.s_addr = inet_addr(IPaddr);
 
-    for(slice=0; slice<NBslice; slice++)
+    if (connect(fds_client, (struct sockaddr *) &sock_server, sizeof(sock_server)) < 0)
     {
-        sliceii = slice*data.image[IDmap].md[0].size[0]*data.image[IDmap].md[0].size[1];
-        for(ii=0; ii<nbpixslice[slice]; ii++)
-            data.image[IDout_pixslice].array.UI16[ data.image[IDmap].array.UI16[sliceii + ii] ] = (unsigned short) slice;
+        perror("Error  connect() failed ");
+        printf("port = %d\n", port);
+        exit(0);
     }
 
-    save_fits("outpixsl", IDout_pixslice_fname);
-    delete_image_ID("outpixsl");
+    // handshake : number of streams, followed by metadata of each stream
+    iov[0].iov_base = &NBstream;
+    iov[0].iov_len = sizeof(uint32_t);
+    for(s=0; s<NBstream; s++)
+    {
+        iov[s+1].iov_base = data.image[IDarray[s]].md;
+        iov[s+1].iov_len = sizeof(IMAGE_METADATA);
+    }
+    nbbyte = sizeof(uint32_t) + NBstream*sizeof(IMAGE_METADATA);
+    if (COREMOD_MEMORY_sendmsg_all(fds_client, iov, NBstream+1) != nbbyte)
+    {
+        perror("socket send error ");
+        exit(0);
+    }
 
     if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
         perror("sigaction");
@@ -6328,774 +9053,2264 @@ long COREMOD_MEMORY_PixMapDecode_U(const char *inputstream_name, uint32_t xsizei
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    if (sigaction(SIGBUS, &data.sigact, NULL) == -1) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaction(SIGABRT, &data.sigact, NULL) == -1) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaction(SIGHUP, &data.sigact, NULL) == -1) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
     if (sigaction(SIGPIPE, &data.sigact, NULL) == -1) {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
 
-
-    iter = 0;
-    loopOK = 1;
-    while(loopOK == 1)
+    sockOK = 1;
+    while(sockOK==1)
     {
-        if(data.image[IDin].md[0].sem==0)
-        {
-            while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
-                usleep(5);
-            cnt = data.image[IDin].md[0].cnt0;
-        }
-        else
-        {
-            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-                perror("clock_gettime");
-                exit(EXIT_FAILURE);
-            }
-            ts.tv_sec += 1;
-            #ifndef __MACH__
-            semr = sem_timedwait(data.image[IDin].semptr[0], &ts);
-            #else
-            alarm(1);
-            semr = sem_wait(data.image[IDin].semptr[0]);
-            #endif
+        NBready = 0;
+        for(s=0; s<NBstream; s++)
+            ready[s] = 0;
 
-            if(iter == 0)
+        // gather ready frames, optionally waiting up to batchus for more
+        do {
+            for(s=0; s<NBstream; s++)
+                if((ready[s]==0)&&(data.image[IDarray[s]].md[0].cnt0 != cnt[s]))
+                {
+                    if(NBready==0)
+                        clock_gettime(CLOCK_REALTIME, &t0);
+                    ready[s] = 1;
+                    NBready++;
+                }
+            
+            if(NBready==0)
+                usleep(5);
+            else if((batchus>0)&&(NBready<NBstream))
             {
-                sem_getvalue(data.image[IDin].semptr[0], &semval);
-                for(scnt=0; scnt<semval; scnt++)
-                    sem_trywait(data.image[IDin].semptr[0]);
+                clock_gettime(CLOCK_REALTIME, &t1);
+                if( (t1.tv_sec-t0.tv_sec)*1000000 + (t1.tv_nsec-t0.tv_nsec)/1000 >= batchus )
+                    break;
+                usleep(5);
             }
-        }
-
-        if(semr==0)
-        {
-            slice = data.image[IDin].md[0].cnt1;
-            if(slice>oldslice+1)
-                slice = oldslice+1;
-
-            if(oldslice==NBslice-1)
-                slice = 0;
-
-            //   clock_gettime(CLOCK_REALTIME, &tarray[slice]);
-            //  dtarray[slice] = 1.0*tarray[slice].tv_sec + 1.0e-9*tarray[slice].tv_nsec;
-            data.image[IDout].md[0].write = 1;
+            else
+                break;
+            
+            if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_PIPE==1))
+                break;
+        } while(1);
 
-            if(slice<NBslice)
+        iovcnt = 0;
+        nbbyte = 0;
+        for(s=0; s<NBstream; s++)
+            if(ready[s]==1)
             {
-                sliceii = slice*data.image[IDmap].md[0].size[0]*data.image[IDmap].md[0].size[1];
-                for(ii=0; ii<nbpixslice[slice]; ii++)
-                    data.image[IDout].array.UI16[data.image[IDmap].array.UI16[sliceii + ii] ] = data.image[IDin].array.UI16[sliceii + ii];
+                IMAGE *img = &data.image[IDarray[s]];
+                
+                header[s].stream = s;
+                header[s].cnt0 = img->md[0].cnt0;
+                header[s].cnt1 = img->md[0].cnt1;
+                header[s].slice = 0;
+                if((NBslices[s]>1)&&(header[s].cnt1>=0)&&(header[s].cnt1<NBslices[s]))
+                    header[s].slice = header[s].cnt1;
+                header[s].nbbyte = framesize[s];
+                header[s].encoding = NETWORK_MUX_ENCODING_RAW;
+                header[s].pad = 0;
+                cnt[s] = header[s].cnt0;
+
+                iov[iovcnt].iov_base = &header[s];
+                iov[iovcnt].iov_len = sizeof(TCP_MUX_HEADER);
+                iovcnt++;
+                iov[iovcnt].iov_base = (char*) img->array.UI8 + framesize[s]*header[s].slice;
+                iov[iovcnt].iov_len = framesize[s];
+                
+                if(shadow[s] != NULL)
+                {
+                    long nbword = framesize[s]/sizeof(uint32_t);
+                    uint32_t *shadowslice = shadow[s] + nbword*header[s].slice;
+                    
+                    if(shadowOK[s][header[s].slice] == 0)
+                    {
+                        memcpy(shadowslice, iov[iovcnt].iov_base, framesize[s]);
+                        shadowOK[s][header[s].slice] = 1;
+                    }
+                    else
+                    {
+                        long nbenc = COREMOD_MEMORY_sparse_encode((uint32_t*) iov[iovcnt].iov_base, shadowslice, nbword, encbuff[s], nbword);
+                        
+                        if(nbenc < nbword)
+                        {
+                            header[s].encoding = NETWORK_MUX_ENCODING_SPARSE;
+                            header[s].nbbyte = sizeof(uint32_t)*nbenc;
+                            iov[iovcnt].iov_base = encbuff[s];
+                            iov[iovcnt].iov_len = header[s].nbbyte;
+                        }
+                    }
+                    // send shadow copy, consistent with what the receiver will hold
+                    if(header[s].encoding == NETWORK_MUX_ENCODING_RAW)
+                        iov[iovcnt].iov_base = shadowslice;
+                }
+                iovcnt++;
+                nbbyte += sizeof(TCP_MUX_HEADER) + header[s].nbbyte;
+                rawbytecnt += sizeof(TCP_MUX_HEADER) + framesize[s];
             }
-            //     printf("[%ld] ", slice); //TEST
 
-            if(slice==NBslice-1)   //if(slice<oldslice)
+        if(iovcnt>0)
+        {
+            if(COREMOD_MEMORY_sendmsg_all(fds_client, iov, iovcnt) != nbbyte)
             {
-                sem_getvalue(data.image[IDout].semptr[0], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDout].semptr[0]);
-
-                sem_getvalue(data.image[IDout].semptr[1], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDout].semptr[1]);
-
-                sem_getvalue(data.image[IDout].semptr[4], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDout].semptr[4]);
-
-                sem_getvalue(data.image[IDout].semptr[5], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDout].semptr[5]);
-
-                sem_getvalue(data.image[IDout].semlog, &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDout].semlog);
-             
-                data.image[IDout].md[0].cnt0 ++;
-
-                //     printf("[[ Timimg [us] :   ");
-                //  for(slice1=1;slice1<NBslice;slice1++)
-                //      {
-                //              dtarray[slice1] -= dtarray[0];
-                //           printf("%6ld ", (long) (1.0e6*dtarray[slice1]));
-                //      }
-                // printf("]]");
-                //  printf("\n");//TEST
-                // fflush(stdout);
+                perror("socket send error ");
+                sockOK = 0;
             }
-
-            data.image[IDout].md[0].cnt1 = slice;
-            
-            sem_getvalue(data.image[IDout].semptr[2], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDout].semptr[2]);
-            
-            sem_getvalue(data.image[IDout].semptr[3], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDout].semptr[3]);
-            
-            data.image[IDout].md[0].write = 0;
-
-            oldslice = slice;
+            framecnt += NBready;
+            msgcnt++;
+            sentbytecnt += nbbyte;
         }
 
         if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
-            loopOK = 0;
+            sockOK = 0;
+    }
 
-        iter++;
+    close(fds_client);
+    printf("port %d closed - %lld frames sent in %lld messages\n", port, framecnt, msgcnt);
+    if(rawbytecnt>0)
+        printf("%lld bytes sent, %lld bytes raw  (ratio %.3f)\n", sentbytecnt, rawbytecnt, 1.0*sentbytecnt/rawbytecnt);
+    fflush(stdout);
+
+    for(s=0; s<NBstream; s++)
+    {
+        free(shadow[s]);
+        free(shadowOK[s]);
+        free(encbuff[s]);
     }
 
-    free(nbpixslice);
-    free(sizearray);
-    free(dtarray);
-    free(tarray);
-    
-    return(IDout);
+    return(IDarray[0]);
 }
 
 
 
 
+/**
+ * @brief Receive image streams sent by COREMOD_MEMORY_image_NETWORKtransmit_multi()
+ * 
+ * Pixel data is received directly into the destination stream, between
+ * ImageStreamIO_write_begin() and ImageStreamIO_write_end().
+ */
+long COREMOD_MEMORY_image_NETWORKreceive_multi(int port, int RT_priority)
+{
+    struct sockaddr_in sock_server, sock_client;
+    int fds_server, fds_client;
+    socklen_t slen_client;
+    int flag = 1;
+    int MAXPENDING = 5;
+    uint32_t NBstream;
+    uint32_t s;
+    IMAGE_METADATA imgmd;
+    long IDarray[NETWORK_MUX_NBSTREAM_MAX];
+    long framesize[NETWORK_MUX_NBSTREAM_MAX];
+    uint32_t NBslices[NETWORK_MUX_NBSTREAM_MAX];
+    TCP_MUX_HEADER header;
+    ssize_t recvsize;
+    int socketOpen;
+    struct sched_param schedpar;
+    long long framecnt = 0;
+    long framesizemax = 0;
+    uint32_t *encbuff;
 
+    schedpar.sched_priority = RT_priority;
+    #ifndef __MACH__
+    sched_setscheduler(0, SCHED_FIFO, &schedpar);
+    #endif
 
-
-
-
-
-
-
-
-
-/* =============================================================================================== */
-/* =============================================================================================== */
-/*                                                                                                 */
-/* 14. DATA LOGGING                                                                                */
-/*                                                                                                 */
-/* =============================================================================================== */
-/* =============================================================================================== */
-
-
-
-/// creates logshimconf shared memory and loads it
-LOGSHIM_CONF* COREMOD_MEMORY_logshim_create_SHMconf(const char *logshimname)
-{
-    int SM_fd;
-    size_t sharedsize = 0; // shared memory size in bytes
-    char SM_fname[200];
-    int result;
-    LOGSHIM_CONF *map;
-
-    sharedsize = sizeof(LOGSHIM_CONF);
-
-    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, logshimname);
-    
-    SM_fd = open(SM_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
-    if (SM_fd == -1) {
-		printf("File \"%s\"\n", SM_fname);
-		fflush(stdout);
-        perror("Error opening file for writing");
+    if((fds_server=socket(PF_INET, SOCK_STREAM, IPPROTO_TCP))==-1)
+    {
+        printf("ERROR creating socket\n");
         exit(0);
     }
 
-    result = lseek(SM_fd, sharedsize-1, SEEK_SET);
-    if (result == -1) {
-        close(SM_fd);
-        printERROR(__FILE__,__func__,__LINE__,"Error calling lseek() to 'stretch' the file");
+    if (setsockopt(fds_server, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int)) < 0)
+    {
+        printf("ERROR setsockopt\n");
         exit(0);
     }
 
-    result = write(SM_fd, "", 1);
-    if (result != 1) {
-        close(SM_fd);
-        perror("Error writing last byte of the file");
+    memset((char*) &sock_server, 0, sizeof(sock_server));
+    sock_server.sin_family = AF_INET;
+    sock_server.sin_port = htons(port);
+    sock_server.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if( bind(fds_server , (struct sockaddr*)&sock_server, sizeof(sock_server) ) == -1)
+    {
+        printf("ERROR binding socket, port %d\n", port);
         exit(0);
     }
 
-    map = (LOGSHIM_CONF*) mmap(0, sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-    if (map == MAP_FAILED) {
-        close(SM_fd);
-        perror("Error mmapping the file");
+    if (listen(fds_server, MAXPENDING) < 0)
+    {
+        printf("ERROR listen socket\n");
         exit(0);
     }
 
-    map[0].on = 0;
-    map[0].cnt = 0;
-    map[0].filecnt = 0;
-    map[0].interval = 1;
-    map[0].logexit = 0;
-    strcpy(map[0].fname, SM_fname);
-
-    return(map);
-}
-
-
-
-// IDname is name of image logged
-int_fast8_t COREMOD_MEMORY_logshim_printstatus(const char *IDname)
-{
-    LOGSHIM_CONF* map;
-    char SM_fname[200];
-    int SM_fd;
-    struct stat file_stat;
+    slen_client = sizeof(sock_client);
+    if ((fds_client = accept(fds_server, (struct sockaddr *) &sock_client, &slen_client)) == -1)
+    {
+        printf("ERROR accept socket\n");
+        exit(0);
+    }
 
-    // read shared mem
-    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
-    printf("Importing mmap file \"%s\"\n",SM_fname);
+    printf("Client connected\n");
+    fflush(stdout);
 
-    SM_fd = open(SM_fname, O_RDWR);
-    if(SM_fd==-1)
+    if(recv(fds_client, &NBstream, sizeof(uint32_t), MSG_WAITALL) != sizeof(uint32_t))
     {
-        printf("Cannot import file - continuing\n");
+        printf("ERROR receiving number of streams\n");
         exit(0);
     }
-    else
+    if((NBstream == 0)||(NBstream > NETWORK_MUX_NBSTREAM_MAX))
     {
-        fstat(SM_fd, &file_stat);
-        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+        printf("ERROR: invalid number of streams %u\n", NBstream);
+        exit(0);
+    }
 
-        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-        if (map == MAP_FAILED) {
-            close(SM_fd);
-            perror("Error mmapping the file");
+    for(s=0; s<NBstream; s++)
+    {
+        if(recv(fds_client, &imgmd, sizeof(IMAGE_METADATA), MSG_WAITALL) != sizeof(IMAGE_METADATA))
+        {
+            printf("ERROR receiving image metadata\n");
             exit(0);
         }
+        IDarray[s] = COREMOD_MEMORY_NETWORKreceive_image(&imgmd);
+        
+        NBslices[s] = 1;
+        if(imgmd.naxis>2)
+            if(imgmd.size[2]>1)
+                NBslices[s] = imgmd.size[2];
+        framesize[s] = (long) (data.image[IDarray[s]].md[0].nelement / NBslices[s]) * TYPESIZE[data.image[IDarray[s]].md[0].atype];
+        printf("stream %2u  %-32s  frame size = %ld\n", s, imgmd.name, framesize[s]);
+        if(framesize[s]>framesizemax)
+            framesizemax = framesize[s];
+    }
+    fflush(stdout);
+    
+    encbuff = (uint32_t*) malloc(framesizemax);
+    if(encbuff == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+        exit(0);
+    }
 
-        printf("LOG   on = %d\n", map[0].on);
-        printf("    cnt  = %lld\n", map[0].cnt);
-        printf(" filecnt = %lld\n", map[0].filecnt);
-        printf("interval = %ld\n", map[0].interval);
-        printf("logexit  = %d\n", map[0].logexit);
-
-        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
-            printf("unmapping %s\n", SM_fname);
-            perror("Error un-mmapping the file");
-        }
-        close(SM_fd);
+    if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGPIPE, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
     }
-    return(0);
-}
 
+    socketOpen = 1;
+    while(socketOpen==1)
+    {
+        IMAGE *img;
+        
+        recvsize = recv(fds_client, &header, sizeof(TCP_MUX_HEADER), MSG_WAITALL);
+        if(recvsize != sizeof(TCP_MUX_HEADER))
+        {
+            if(recvsize < 0)
+                printf("ERROR recv()\n");
+            break;
+        }
+        
+        if((header.stream>=NBstream)||(header.slice>=NBslices[header.stream])
+            ||((header.encoding==NETWORK_MUX_ENCODING_RAW)&&((long) header.nbbyte != framesize[header.stream]))
+            ||((header.encoding==NETWORK_MUX_ENCODING_SPARSE)&&(((long) header.nbbyte >= framesize[header.stream])||(header.nbbyte%sizeof(uint32_t)!=0)))
+            ||(header.encoding>NETWORK_MUX_ENCODING_SPARSE))
+        {
+            printf("ERROR: inconsistent frame header (stream %u, slice %u, %lu bytes)\n", header.stream, header.slice, (unsigned long) header.nbbyte);
+            break;
+        }
+        
+        img = &data.image[IDarray[header.stream]];
+        
+        if(header.encoding == NETWORK_MUX_ENCODING_SPARSE)
+        {
+            // receive runs first, so that stream is only locked while they are applied
+            recvsize = recv(fds_client, encbuff, header.nbbyte, MSG_WAITALL);
+            if(recvsize != (ssize_t) header.nbbyte)
+            {
+                printf("ERROR recv()\n");
+                break;
+            }
+            ImageStreamIO_write_begin(img);
+            if(COREMOD_MEMORY_sparse_decode(encbuff, header.nbbyte/sizeof(uint32_t), (uint32_t*) ((char*) img->array.UI8 + framesize[header.stream]*header.slice), framesize[header.stream]/sizeof(uint32_t)) != 0)
+                recvsize = -1;
+        }
+        else
+        {
+            ImageStreamIO_write_begin(img);
+            recvsize = recv(fds_client, (char*) img->array.UI8 + framesize[header.stream]*header.slice, header.nbbyte, MSG_WAITALL);
+        }
+        img->md[0].cnt1 = header.slice;
+        img->md[0].cnt0++;
+        ImageStreamIO_write_end(img);
+        
+        if(recvsize != (ssize_t) header.nbbyte)
+        {
+            printf("ERROR recv() / decode\n");
+            break;
+        }
+        ImageStreamIO_sempost(img, -1);
+        framecnt++;
 
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+            socketOpen = 0;
+    }
 
+    free(encbuff);
 
+    close(fds_client);
+    close(fds_server);
+    printf("port %d closed - %lld frames received\n", port, framecnt);
+    fflush(stdout);
 
+    return(IDarray[0]);
+}
 
 
 
 
 
 
+/** pixel copy (dst <- src) in decode plan, before merging into runs */
+typedef struct
+{
+    uint32_t dst;
+    uint32_t src;
+} PIXMAP_PAIR;
 
+static int PixMapDecode_compare_dst(const void *a, const void *b)
+{
+    uint32_t d0 = ((const PIXMAP_PAIR*) a)->dst;
+    uint32_t d1 = ((const PIXMAP_PAIR*) b)->dst;
 
+    return((d0>d1) - (d0<d1));
+}
 
 
 
-// set the on field in logshim
-// IDname is name of image logged
-int_fast8_t COREMOD_MEMORY_logshim_set_on(const char *IDname, int setv)
+/**
+ * @brief Decode one slice according to precomputed plan
+ *
+ * Plan is a list of runs (dst, src, len), sorted by destination, where consecutive pixels
+ * in both input and output have been merged. Runs of length 1 are copied directly, longer runs with memcpy.
+ */
+static void PixMapDecode_slice(uint16_t *out, const uint16_t *in, const uint32_t *rundst, const uint32_t *runsrc, const uint32_t *runlen, long NBrun)
 {
-    LOGSHIM_CONF* map;
-    char SM_fname[200];
-    int SM_fd;
-    struct stat file_stat;
-
-    // read shared mem
-    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
-    printf("Importing mmap file \"%s\"\n",SM_fname);
+    long r;
 
-    SM_fd = open(SM_fname, O_RDWR);
-    if(SM_fd==-1)
+    for(r=0; r<NBrun; r++)
     {
-        printf("Cannot import file - continuing\n");
-        exit(0);
+        if(runlen[r]==1)
+            out[rundst[r]] = in[runsrc[r]];
+        else
+            memcpy(out+rundst[r], in+runsrc[r], sizeof(uint16_t)*runlen[r]);
     }
-    else
-    {
-        fstat(SM_fd, &file_stat);
-        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+}
 
-        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-        if (map == MAP_FAILED) {
-            close(SM_fd);
-            perror("Error mmapping the file");
-            exit(0);
-        }
 
-        map[0].on = setv;
 
-        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
-            printf("unmapping %s\n", SM_fname);
-            perror("Error un-mmapping the file");
+/**
+ * @brief Publish decoded slice: cnt1 and per-slice semaphores, plus full frame semaphores and cnt0 on last slice
+ */
+static void PixMapDecode_post(long IDout, long slice, long NBslice)
+{
+    int semval;
+    int s;
+    static const int semframe[] = {0, 1, 4, 5};
+
+    if(slice==NBslice-1)
+    {
+        for(s=0; s<4; s++)
+        {
+            sem_getvalue(data.image[IDout].semptr[semframe[s]], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[IDout].semptr[semframe[s]]);
         }
-        close(SM_fd);
+
+        sem_getvalue(data.image[IDout].semlog, &semval);
+        if(semval<SEMAPHORE_MAXVAL)
+            sem_post(data.image[IDout].semlog);
+
+        data.image[IDout].md[0].cnt0 ++;
     }
-    return(0);
-}
 
+    data.image[IDout].md[0].cnt1 = slice;
 
+    sem_getvalue(data.image[IDout].semptr[2], &semval);
+    if(semval<SEMAPHORE_MAXVAL)
+        sem_post(data.image[IDout].semptr[2]);
 
-// set the on field in logshim
-// IDname is name of image logged
-int_fast8_t COREMOD_MEMORY_logshim_set_logexit(const char *IDname, int setv)
-{
-    LOGSHIM_CONF* map;
-    char SM_fname[200];
-    int SM_fd;
-    struct stat file_stat;
+    sem_getvalue(data.image[IDout].semptr[3], &semval);
+    if(semval<SEMAPHORE_MAXVAL)
+        sem_post(data.image[IDout].semptr[3]);
 
-    // read shared mem
-    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
-    printf("Importing mmap file \"%s\"\n",SM_fname);
+    ImageStreamIO_futexwake(&data.image[IDout]);
+}
 
-    SM_fd = open(SM_fname, O_RDWR);
-    if(SM_fd==-1)
-    {
-        printf("Cannot import file - continuing\n");
-        exit(0);
-    }
-    else
-    {
-        fstat(SM_fd, &file_stat);
-        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
 
-        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-        if (map == MAP_FAILED) {
-            close(SM_fd);
-            perror("Error mmapping the file");
-            exit(0);
-        }
 
-        map[0].logexit = setv;
 
-        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
+//
+// pixel decode for unsigned short
+// sem0, cnt0 gets updated at each full frame
+// sem1 gets updated for each slice
+// cnt1 contains the slice index that was just written
+//
+long COREMOD_MEMORY_PixMapDecode_U(const char *inputstream_name, uint32_t xsizeim, uint32_t ysizeim, const char* NBpix_fname, const char* IDmap_name, const char *IDout_name, const char *IDout_pixslice_fname)
+{
+    long IDout = -1;
+    long IDin;
+    long IDmap;
+    long slice, sliceii;
+    long oldslice = 0;
+    long NBslice;
+    long *nbpixslice;
+    uint32_t xsizein, ysizein;
+    FILE *fp;
+    uint32_t *sizearray;
+    long IDout_pixslice;
+    int loopOK;
+    long ii;
+    long cnt = 0;
+//    int RT_priority = 80; //any number from 0-99
+
+    struct sched_param schedpar;
+    struct timespec ts;
+    long scnt;
+    int semval;
+    long long iter;
+    int r;
+    long tmpl0, tmpl1;
+    int semr;
+
+    double *dtarray;
+    struct timespec *tarray;
+    long slice1;
+
+    long *runoffset;   // first run of each slice in decode plan
+    uint32_t *rundst;
+    uint32_t *runsrc;
+    uint32_t *runlen;
+    long NBruntot;
+    long NBpixtot;
+    long *pending;     // slices waiting to be decoded
+    long NBpending;
+    long k;
+
+
+
+
+    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    IDin = image_ID(inputstream_name);
+    IDmap = image_ID(IDmap_name);
+
+    xsizein = data.image[IDin].md[0].size[0];
+    ysizein = data.image[IDin].md[0].size[1];
+
+    if(xsizein != data.image[IDmap].md[0].size[0])
+    {
+        printf("ERROR: xsize for %s (%d) does not match xsize for %s (%d)\n", inputstream_name, xsizein, IDmap_name, data.image[IDmap].md[0].size[0]);
+        exit(0);
+    }
+    if(ysizein != data.image[IDmap].md[0].size[1])
+    {
+        printf("ERROR: xsize for %s (%d) does not match xsize for %s (%d)\n", inputstream_name, ysizein, IDmap_name, data.image[IDmap].md[0].size[1]);
+        exit(0);
+    }
+    sizearray[0] = xsizeim;
+    sizearray[1] = ysizeim;
+    IDout = create_image_ID(IDout_name, 2, sizearray, data.image[IDin].md[0].atype, 1, 0);
+    COREMOD_MEMORY_image_set_createsem(IDout_name, 10); // create 10 semaphores
+    IDout_pixslice = create_image_ID("outpixsl", 2, sizearray, _DATATYPE_UINT16, 0, 0);
+
+    NBslice = data.image[IDin].md[0].size[2];
+
+    dtarray = (double*) malloc(sizeof(double)*NBslice);
+    tarray = (struct timespec *) malloc(sizeof(struct timespec)*NBslice);
+
+
+    nbpixslice = (long*) malloc(sizeof(long)*NBslice);
+    if((fp=fopen(NBpix_fname,"r"))==NULL)
+    {
+        printf("ERROR : cannot open file \"%s\"\n", NBpix_fname);
+        exit(0);
+    }
+
+    for(slice=0; slice<NBslice; slice++)
+        r = fscanf(fp, "%ld %ld %ld\n", &tmpl0, &nbpixslice[slice], &tmpl1);
+    fclose(fp);
+
+    for(slice=0; slice<NBslice; slice++)
+        printf("Slice %5ld   : %5ld pix\n", slice, nbpixslice[slice]);
+
+
+
+
+    for(slice=0; slice<NBslice; slice++)
+    {
+        sliceii = slice*data.image[IDmap].md[0].size[0]*data.image[IDmap].md[0].size[1];
+        for(ii=0; ii<nbpixslice[slice]; ii++)
+            data.image[IDout_pixslice].array.UI16[ data.image[IDmap].array.UI16[sliceii + ii] ] = (unsigned short) slice;
+    }
+
+    save_fits("outpixsl", IDout_pixslice_fname);
+    delete_image_ID("outpixsl");
+
+    // precompute decode plan: per slice, runs of consecutive pixels sorted by destination
+    runoffset = (long*) malloc(sizeof(long)*(NBslice+1));
+    NBpixtot = 0;
+    for(slice=0; slice<NBslice; slice++)
+        NBpixtot += nbpixslice[slice];
+    rundst = (uint32_t*) malloc(sizeof(uint32_t)*(NBpixtot+1));
+    runsrc = (uint32_t*) malloc(sizeof(uint32_t)*(NBpixtot+1));
+    runlen = (uint32_t*) malloc(sizeof(uint32_t)*(NBpixtot+1));
+
+    NBruntot = 0;
+    for(slice=0; slice<NBslice; slice++)
+    {
+        PIXMAP_PAIR *pairs = (PIXMAP_PAIR*) malloc(sizeof(PIXMAP_PAIR)*(nbpixslice[slice]+1));
+
+        sliceii = slice*data.image[IDmap].md[0].size[0]*data.image[IDmap].md[0].size[1];
+        for(ii=0; ii<nbpixslice[slice]; ii++)
+        {
+            pairs[ii].dst = data.image[IDmap].array.UI16[sliceii + ii];
+            pairs[ii].src = sliceii + ii;
+        }
+        qsort(pairs, nbpixslice[slice], sizeof(PIXMAP_PAIR), PixMapDecode_compare_dst);
+
+        runoffset[slice] = NBruntot;
+        for(ii=0; ii<nbpixslice[slice]; ii++)
+        {
+            if( (NBruntot>runoffset[slice])
+                    && (pairs[ii].dst == rundst[NBruntot-1]+runlen[NBruntot-1])
+                    && (pairs[ii].src == runsrc[NBruntot-1]+runlen[NBruntot-1]) )
+                runlen[NBruntot-1]++;
+            else
+            {
+                rundst[NBruntot] = pairs[ii].dst;
+                runsrc[NBruntot] = pairs[ii].src;
+                runlen[NBruntot] = 1;
+                NBruntot++;
+            }
+        }
+        free(pairs);
+    }
+    runoffset[NBslice] = NBruntot;
+    printf("Decode plan: %ld runs for %ld pixels\n", NBruntot, NBpixtot);
+    pending = (long*) malloc(sizeof(long)*NBslice);
+
+    if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGBUS, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGABRT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGHUP, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGPIPE, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+
+    iter = 0;
+    loopOK = 1;
+    oldslice = NBslice-1;
+    while(loopOK == 1)
+    {
+        semr = 0;
+        if(data.image[IDin].md[0].sem==0)
+        {
+            while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
+                usleep(5);
+            cnt = data.image[IDin].md[0].cnt0;
+        }
+        else
+        {
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                perror("clock_gettime");
+                exit(EXIT_FAILURE);
+            }
+            ts.tv_sec += 1;
+            #ifndef __MACH__
+            semr = sem_timedwait(data.image[IDin].semptr[0], &ts);
+            #else
+            alarm(1);
+            semr = sem_wait(data.image[IDin].semptr[0]);
+            #endif
+
+            if(iter == 0)
+            {
+                sem_getvalue(data.image[IDin].semptr[0], &semval);
+                for(scnt=0; scnt<semval; scnt++)
+                    sem_trywait(data.image[IDin].semptr[0]);
+            }
+        }
+
+        if(semr==0)
+        {
+            // all slices written since last pass, in order
+            slice = data.image[IDin].md[0].cnt1;
+            if((slice<0)||(slice>=NBslice))
+                slice = (oldslice+1) % NBslice;
+            NBpending = 0;
+            while(oldslice != slice) // slice == oldslice : nothing new (extra semaphore post)
+            {
+                oldslice = (oldslice+1) % NBslice;
+                pending[NBpending++] = oldslice;
+            }
+
+            data.image[IDout].md[0].write = 1;
+            if(NBpending==1)
+            {
+                PixMapDecode_slice(data.image[IDout].array.UI16, data.image[IDin].array.UI16, rundst+runoffset[slice], runsrc+runoffset[slice], runlen+runoffset[slice], runoffset[slice+1]-runoffset[slice]);
+                PixMapDecode_post(IDout, slice, NBslice);
+            }
+            else if(NBpending>1)
+            {
+                // catching up: slices are independent, decode in parallel then publish in order
+                # ifdef _OPENMP
+                #pragma omp parallel for private(slice1) schedule(dynamic)
+                # endif
+                for(k=0; k<NBpending; k++)
+                {
+                    slice1 = pending[k];
+                    PixMapDecode_slice(data.image[IDout].array.UI16, data.image[IDin].array.UI16, rundst+runoffset[slice1], runsrc+runoffset[slice1], runlen+runoffset[slice1], runoffset[slice1+1]-runoffset[slice1]);
+                }
+                for(k=0; k<NBpending; k++)
+                    PixMapDecode_post(IDout, pending[k], NBslice);
+            }
+            data.image[IDout].md[0].write = 0;
+        }
+
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+            loopOK = 0;
+
+        iter++;
+    }
+
+    free(nbpixslice);
+    free(runoffset);
+    free(rundst);
+    free(runsrc);
+    free(runlen);
+    free(pending);
+    free(sizearray);
+    free(dtarray);
+    free(tarray);
+    
+    return(IDout);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/* =============================================================================================== */
+/*                                                                                                 */
+/* 14. DATA LOGGING                                                                                */
+/*                                                                                                 */
+/* =============================================================================================== */
+/* =============================================================================================== */
+
+
+
+/// creates logshimconf shared memory and loads it
+LOGSHIM_CONF* COREMOD_MEMORY_logshim_create_SHMconf(const char *logshimname)
+{
+    int SM_fd;
+    size_t sharedsize = 0; // shared memory size in bytes
+    char SM_fname[200];
+    int result;
+    LOGSHIM_CONF *map;
+
+    sharedsize = sizeof(LOGSHIM_CONF);
+
+    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, logshimname);
+    
+    SM_fd = open(SM_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+    if (SM_fd == -1) {
+		printf("File \"%s\"\n", SM_fname);
+		fflush(stdout);
+        perror("Error opening file for writing");
+        exit(0);
+    }
+
+    result = lseek(SM_fd, sharedsize-1, SEEK_SET);
+    if (result == -1) {
+        close(SM_fd);
+        printERROR(__FILE__,__func__,__LINE__,"Error calling lseek() to 'stretch' the file");
+        exit(0);
+    }
+
+    result = write(SM_fd, "", 1);
+    if (result != 1) {
+        close(SM_fd);
+        perror("Error writing last byte of the file");
+        exit(0);
+    }
+
+    map = (LOGSHIM_CONF*) mmap(0, sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+    if (map == MAP_FAILED) {
+        close(SM_fd);
+        perror("Error mmapping the file");
+        exit(0);
+    }
+
+    map[0].on = 0;
+    map[0].cnt = 0;
+    map[0].filecnt = 0;
+    map[0].interval = 1;
+    map[0].logexit = 0;
+    strcpy(map[0].fname, SM_fname);
+
+    return(map);
+}
+
+
+
+// IDname is name of image logged
+int_fast8_t COREMOD_MEMORY_logshim_printstatus(const char *IDname)
+{
+    LOGSHIM_CONF* map;
+    char SM_fname[200];
+    int SM_fd;
+    struct stat file_stat;
+
+    // read shared mem
+    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
+    printf("Importing mmap file \"%s\"\n",SM_fname);
+
+    SM_fd = open(SM_fname, O_RDWR);
+    if(SM_fd==-1)
+    {
+        printf("Cannot import file - continuing\n");
+        exit(0);
+    }
+    else
+    {
+        fstat(SM_fd, &file_stat);
+        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+
+        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+        if (map == MAP_FAILED) {
+            close(SM_fd);
+            perror("Error mmapping the file");
+            exit(0);
+        }
+
+        printf("LOG   on = %d\n", map[0].on);
+        printf("    cnt  = %lld\n", map[0].cnt);
+        printf(" filecnt = %lld\n", map[0].filecnt);
+        printf("interval = %ld\n", map[0].interval);
+        printf("logexit  = %d\n", map[0].logexit);
+
+        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
+            printf("unmapping %s\n", SM_fname);
+            perror("Error un-mmapping the file");
+        }
+        close(SM_fd);
+    }
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// set the on field in logshim
+// IDname is name of image logged
+int_fast8_t COREMOD_MEMORY_logshim_set_on(const char *IDname, int setv)
+{
+    LOGSHIM_CONF* map;
+    char SM_fname[200];
+    int SM_fd;
+    struct stat file_stat;
+
+    // read shared mem
+    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
+    printf("Importing mmap file \"%s\"\n",SM_fname);
+
+    SM_fd = open(SM_fname, O_RDWR);
+    if(SM_fd==-1)
+    {
+        printf("Cannot import file - continuing\n");
+        exit(0);
+    }
+    else
+    {
+        fstat(SM_fd, &file_stat);
+        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+
+        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+        if (map == MAP_FAILED) {
+            close(SM_fd);
+            perror("Error mmapping the file");
+            exit(0);
+        }
+
+        map[0].on = setv;
+
+        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
+            printf("unmapping %s\n", SM_fname);
+            perror("Error un-mmapping the file");
+        }
+        close(SM_fd);
+    }
+    return(0);
+}
+
+
+
+// set the on field in logshim
+// IDname is name of image logged
+int_fast8_t COREMOD_MEMORY_logshim_set_logexit(const char *IDname, int setv)
+{
+    LOGSHIM_CONF* map;
+    char SM_fname[200];
+    int SM_fd;
+    struct stat file_stat;
+
+    // read shared mem
+    sprintf(SM_fname, "%s/%s.logshimconf.shm", SHAREDMEMDIR, IDname);
+    printf("Importing mmap file \"%s\"\n",SM_fname);
+
+    SM_fd = open(SM_fname, O_RDWR);
+    if(SM_fd==-1)
+    {
+        printf("Cannot import file - continuing\n");
+        exit(0);
+    }
+    else
+    {
+        fstat(SM_fd, &file_stat);
+        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+
+        map = (LOGSHIM_CONF*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+        if (map == MAP_FAILED) {
+            close(SM_fd);
+            perror("Error mmapping the file");
+            exit(0);
+        }
+
+        map[0].logexit = setv;
+
+        if (munmap(map, sizeof(LOGSHIM_CONF)) == -1) {
             printf("unmapping %s\n", SM_fname);
             perror("Error un-mmapping the file");
         }
-        close(SM_fd);
+        close(SM_fd);
+    }
+    return(0);
+}
+
+
+
+
+
+
+
+/** logs a shared memory stream onto disk
+ * uses semlog semaphore
+ *
+ * uses data cube buffer to store frames
+ * if an image name logdata exists (should ideally be in shared mem), then this will be included in the timing txt file
+ */
+long COREMOD_MEMORY_sharedMem_2Dim_log(const char *IDname, uint32_t zsize, const char *logdir, const char *IDlogdata_name)
+{
+    long ID;
+    uint32_t xsize, ysize;
+    long ii;
+    long i;
+    long IDb, IDb0, IDb1;
+    long index = 0;
+    long cnt = -1;
+    int buffer;
+    uint8_t atype;
+    uint32_t *imsizearray;
+    char fname[200];
+    char iname[200];
+    time_t t;
+    struct tm *uttime;
+    //struct timespec *thetime = (struct timespec *)malloc(sizeof(struct timespec));
+    struct timespec timenow;
+    long kw;
+
+    long IDlogdata;
+
+    char *ptr0; // source
+    char *ptr1; // destination
+    long framesize; // in bytes
+
+    FILE *fp;
+    char fname_asciilog[200];
+
+    pthread_t thread_savefits; 
+    int tOK = 0;
+    int iret_savefits;
+    //	char tmessage[500];
+    struct savethreadmsg *tmsg = malloc(sizeof(struct savethreadmsg));
+
+    long fnb = 0;
+    long NBfiles = -1; // run forever
+    long long cntwait;
+    long waitdelayus = 50;
+    long long cntwaitlim = 20000; // 10 sec
+    int wOK;
+    int noframe;
+
+
+	char logb0name[500];
+	char logb1name[500];
+
+    int is3Dcube = 0; // this is a rolling buffer
+    int exitflag = 0; // toggles to 1 when loop must exit
+
+    int ringreader = -1; // reader cursor if input is a ring buffer stream
+    char *ringptr = NULL;
+    uint64_t ringoverrun = 0;
+    uint64_t ringoverrun_total = 0;
+    long ringtorn = 0;
+
+    LOGSHIM_CONF* logshimconf;
+
+
+    int RT_priority = 60; //any number from 0-99
+    struct sched_param schedpar;
+    
+
+    schedpar.sched_priority = RT_priority;
+    #ifndef __MACH__
+    // r = seteuid(euid_called); //This goes up to maximum privileges
+    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
+    // r = seteuid(euid_real);//Go back to normal privileges
+    #endif
+
+
+
+    IDlogdata = image_ID(IDlogdata_name);
+    if(IDlogdata!=-1)
+    {
+        if(data.image[IDlogdata].md[0].atype != _DATATYPE_FLOAT)
+            IDlogdata = -1;
+    }
+    printf("log data name = %s\n", IDlogdata_name);
+
+
+    logshimconf = COREMOD_MEMORY_logshim_create_SHMconf(IDname);
+
+
+    logshimconf[0].on = 1;
+    logshimconf[0].cnt = 0;
+    logshimconf[0].filecnt = 0;
+    logshimconf[0].logexit = 0;
+    logshimconf[0].interval = 1;
+
+
+
+    imsizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+
+
+    read_sharedmem_image(IDname);
+    ID = image_ID(IDname);
+    atype = data.image[ID].md[0].atype;
+    xsize = data.image[ID].md[0].size[0];
+    ysize = data.image[ID].md[0].size[1];
+
+    if(data.image[ID].md[0].naxis==3)
+        is3Dcube = 1;
+
+    if(data.image[ID].ring != NULL) // ring buffer: read every slot through own cursor
+    {
+        ringreader = ImageStreamIO_ring_reader_open(&data.image[ID], "logshim");
+        printf("ring buffer input, reader cursor %d\n", ringreader);
+    }
+
+    /** create the 2 buffers */
+
+    imsizearray[0] = xsize;
+    imsizearray[1] = ysize;
+    imsizearray[2] = zsize;
+    
+    sprintf(logb0name, "%s_logbuff0", IDname);
+    sprintf(logb1name, "%s_logbuff1", IDname);
+    
+    IDb0 = create_image_ID(logb0name, 3, imsizearray, atype, 1, 1);
+    IDb1 = create_image_ID(logb1name, 3, imsizearray, atype, 1, 1);
+	COREMOD_MEMORY_image_set_semflush(logb0name, -1);
+	COREMOD_MEMORY_image_set_semflush(logb1name, -1);
+
+    IDb = IDb0;
+
+    switch ( atype ) {
+
+    case _DATATYPE_INT8:
+        framesize = SIZEOF_DATATYPE_INT8*xsize*ysize;
+        break;
+    case _DATATYPE_UINT8:
+        framesize = SIZEOF_DATATYPE_UINT8*xsize*ysize;
+        break;
+
+    case _DATATYPE_INT16:
+        framesize = SIZEOF_DATATYPE_INT16*xsize*ysize;
+        break;
+    case _DATATYPE_UINT16:
+        framesize = SIZEOF_DATATYPE_UINT16*xsize*ysize;
+        break;
+
+    case _DATATYPE_INT32:
+        framesize = SIZEOF_DATATYPE_INT32*xsize*ysize;
+        break;
+    case _DATATYPE_UINT32:
+        framesize = SIZEOF_DATATYPE_UINT32*xsize*ysize;
+        break;
+
+    case _DATATYPE_INT64:
+        framesize = SIZEOF_DATATYPE_INT64*xsize*ysize;
+        break;
+    case _DATATYPE_UINT64:
+        framesize = SIZEOF_DATATYPE_UINT64*xsize*ysize;
+        break;
+ 
+    case _DATATYPE_FLOAT:
+        framesize = SIZEOF_DATATYPE_FLOAT*xsize*ysize;
+        break;
+    case _DATATYPE_DOUBLE:
+        framesize = SIZEOF_DATATYPE_DOUBLE*xsize*ysize;
+        break;
+
+    default:
+        printf("ERROR: WRONG DATA TYPE\n");
+        exit(0);
+        break;
+    }
+
+    cnt = data.image[ID].md[0].cnt0 - 1;
+
+    buffer = 0;
+    index = 0;
+
+    printf("logdata ID = %ld\n", IDlogdata);
+    list_image_ID();
+
+    exitflag = 0;
+
+    while( (logshimconf[0].filecnt != NBfiles) && (logshimconf[0].logexit==0) )
+    {
+        cntwait = 0;
+        noframe = 0;
+        wOK = 1;
+        // printf("Entering wait loop   index = %ld %d\n", index, noframe);
+
+        while((((ringreader==-1)&&(cnt==data.image[ID].md[0].cnt0))||((ringreader!=-1)&&(ImageStreamIO_ring_available(&data.image[ID], ringreader)==0))||(logshimconf[0].on == 0))&&(wOK==1))
+        {
+            usleep(waitdelayus);
+            cntwait++;
+            if(cntwait>cntwaitlim) // save current cube
+            {
+                strcpy(tmsg->iname, iname);
+                strcpy(tmsg->fname, fname);
+                tmsg->partial = 1; // partial cube
+                tmsg->cubesize = index;
+                wOK=0;
+                if(index==0)
+                    noframe = 1;
+                else
+                    noframe = 0;
+            }
+        }
+
+
+
+        if(index==0)
+        {
+            /// measure time
+            t = time(NULL);
+            uttime = gmtime(&t);
+            //clock_gettime(CLOCK_REALTIME, thetime);
+            
+			clock_gettime(CLOCK_REALTIME, &timenow);
+/*
+   struct timespec timenow;
+   clock_gettime(CLOCK_REALTIME, &timenow);
+	fprintf(fo, "time:  %ld.%09ld\n", timenow.tv_sec % 60, timenow.tv_nsec);
+  */          
+            sprintf(fname,"!%s/%s_%02d:%02d:%02ld.%09ld.fits", logdir, IDname, uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
+   //        sprintf(fname, "!%s/%s_%02d:%02d:%02d.%09ld.fits", logdir, IDname, uttime->tm_hour, uttime->tm_min, (long)thetime->tv_sec, (long) (thetime->tv_nsec));
+
+            sprintf(fname_asciilog,"%s/%s_%02d:%02d:%02ld.%09ld.txt", logdir, IDname, uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
+            
+         //   printf("fname           = %s\n", fname);
+          //  printf("fname_asciilog  = %s\n", fname_asciilog);
+         //   fflush(stdout);
+        }
+
+        if(logshimconf[0].on == 1)
+        {
+            if(wOK==1) // normal step: a frame has arrived
+            {
+                /// measure time
+                t = time(NULL);
+                uttime = gmtime(&t);
+                //clock_gettime(CLOCK_REALTIME, thetime);
+				clock_gettime(CLOCK_REALTIME, &timenow);
+
+                if(index==0)
+                    fp = fopen(fname_asciilog, "w");
+
+
+                switch ( atype ) {
+
+                case _DATATYPE_INT8:
+                    ptr0 = (char*) data.image[ID].array.SI8;
+                    ptr1 = (char*) data.image[IDb].array.SI8;
+                    break;
+                case _DATATYPE_UINT8:
+                    ptr0 = (char*) data.image[ID].array.UI8;
+                    ptr1 = (char*) data.image[IDb].array.UI8;
+                    break;
+                    
+                case _DATATYPE_INT16:
+                    ptr0 = (char*) data.image[ID].array.SI16;
+                    ptr1 = (char*) data.image[IDb].array.SI16;
+                    break;
+                case _DATATYPE_UINT16:
+                    ptr0 = (char*) data.image[ID].array.UI16;
+                    ptr1 = (char*) data.image[IDb].array.UI16;
+                    break;
+                    
+                case _DATATYPE_INT32:
+                    ptr0 = (char*) data.image[ID].array.SI32;
+                    ptr1 = (char*) data.image[IDb].array.SI32;
+                    break;
+                case _DATATYPE_UINT32:
+                    ptr0 = (char*) data.image[ID].array.UI32;
+                    ptr1 = (char*) data.image[IDb].array.UI32;
+                    break;
+                    
+                case _DATATYPE_INT64:
+                    ptr0 = (char*) data.image[ID].array.SI64;
+                    ptr1 = (char*) data.image[IDb].array.SI64;
+                    break;
+                case _DATATYPE_UINT64:
+                    ptr0 = (char*) data.image[ID].array.UI64;
+                    ptr1 = (char*) data.image[IDb].array.UI64;
+                    break;
+                    
+                case _DATATYPE_FLOAT:
+                    ptr0 = (char*) data.image[ID].array.F;
+                    ptr1 = (char*) data.image[IDb].array.F;
+                    break;
+                case _DATATYPE_DOUBLE:
+                    ptr0 = (char*) data.image[ID].array.D;
+                    ptr1 = (char*) data.image[IDb].array.D;
+                    break;
+
+                }
+
+                //  ptr0 = (char*) data.image[ID].array.F;
+
+
+
+                if(ringreader != -1)
+                {
+                    ringptr = (char*) ImageStreamIO_ring_read(&data.image[ID], ringreader, NULL, &ringoverrun);
+                    ringoverrun_total += ringoverrun;
+                    ptr0 = ringptr;
+                }
+                else if(is3Dcube==1)
+                    ptr0 += framesize*data.image[ID].md[0].cnt1;
+
+                //    ptr1 = (char*) data.image[IDb].array.F;
+                ptr1 += framesize*index;
+
+                memcpy((void *) ptr1, (void *) ptr0, framesize);
+
+                if(ringreader != -1)
+                    ringtorn += ImageStreamIO_ring_release(&data.image[ID], ringreader);
+
+                fprintf(fp, "%02d:%02d:%02ld.%09ld ", uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
+
+                if(IDlogdata!=-1)
+                {
+
+                    fprintf(fp, "%8ld", data.image[IDlogdata].md[0].cnt0);
+                    for(i=0; i<data.image[IDlogdata].md[0].nelement; i++)
+                        fprintf(fp, "  %f", data.image[IDlogdata].array.F[i]);
+                }
+
+                for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
+                {
+                    switch (data.image[ID].kw[kw].type) {
+                    case 'L' :
+                        fprintf(fp, " %ld", data.image[ID].kw[kw].value.numl);
+                        break;
+                    case 'D' :
+                        fprintf(fp, " %f", data.image[ID].kw[kw].value.numf);
+                        break;
+                    }
+                }
+                fprintf(fp, "\n");
+
+                index++;
+            }
+        }
+
+
+        /// cases:
+        /// index>zsize-1  buffer full
+        /// wOK==0 && index>0
+        if(  (index>zsize-1)  ||  ((wOK==0)&&(index>0)) )
+        {
+            /// save image
+           // sprintf(iname, "logbuff%d", buffer);
+            sprintf(iname, "%s_logbuff%d", IDname, buffer);
+            if(buffer==0)
+				IDb = IDb0;
+			else
+				IDb = IDb1;
+            
+            
+            //          printf("Saving %s -> %s\n", iname, fname);
+            //         fflush(stdout);
+            if(wOK==1) // image has arrived
+            {
+                strcpy(tmsg->iname, iname);
+                strcpy(tmsg->fname, fname);
+                tmsg->partial = 0; // full cube
+            }
+
+            fclose(fp);
+
+            if(tOK == 1)
+            {
+                //           printf("WAITING FOR SAVE THREAD TO COMPLETE ...");
+                //          fflush(stdout);
+                pthread_join(thread_savefits, NULL); //(void**)&thread_savefits);
+                //          printf("OK\n");
+                //          fflush(stdout);
+            }
+
+			COREMOD_MEMORY_image_set_sempost_byID(IDb, -1);
+			data.image[IDb].md[0].cnt0++;
+			data.image[IDb].md[0].write = 0;
+			
+
+            strcpy(tmsg->iname, iname);
+            iret_savefits = pthread_create( &thread_savefits, NULL, save_fits_function, tmsg);
+
+            logshimconf[0].cnt ++;
+
+            tOK = 1;
+            if(iret_savefits)
+            {
+                fprintf(stderr,"Error - pthread_create() return code: %d\n", iret_savefits);
+                exit(EXIT_FAILURE);
+            }
+
+            index = 0;
+            buffer++;
+            if(buffer==2)
+                buffer = 0;
+            //            printf("[%ld -> %d]", cnt, buffer);
+            //           fflush(stdout);
+            if(buffer==0)
+                IDb = IDb0;
+            else
+                IDb = IDb1;
+			data.image[IDb].md[0].write = 1;
+            logshimconf[0].filecnt ++;
+        }
+
+
+        cnt = data.image[ID].md[0].cnt0;
+    }
+
+    if(ringreader != -1)
+    {
+        printf("ring buffer: %ld slot(s) lost, %ld torn read(s)\n", (long) ringoverrun_total, ringtorn);
+        ImageStreamIO_ring_reader_close(&data.image[ID], ringreader);
+    }
+
+    free(imsizearray);
+	free(tmsg);
+
+    return(0);
+}
+
+
+
+
+/* =============================================================================================== */
+/*  Telemetry log format (.tlog)                                                                   */
+/* =============================================================================================== */
+
+/** double-buffered block writer shared between acquisition loop and writer thread */
+typedef struct
+{
+    char *buff[2];                   /**< raw frames, blocksize x framesize */
+    TLOG_FRAMEINFO *finfo[2];
+    uint32_t nbframe[2];
+    int full[2];                     /**< 1 if buffer has been handed to writer */
+    int exitflag;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    int fd;
+    int fdidx;
+    uint64_t offset;                 /**< current end of .tlog file */
+    size_t framesize;
+    int typesize;
+    uint32_t blocksize;
+    int compression;
+    int cpu;                         /**< CPU to pin writer to, -1 for none */
+
+    char *tmp;                       /**< shuffle buffer */
+    char *comp;                      /**< compressed block */
+
+    long long NBblock;
+    long long rawbytes;
+    long long compbytes;
+    int writeerr;
+} TLOG_WRITER;
+
+
+
+/**
+ * @brief Write nbbyte, retrying on partial writes
+ */
+static int COREMOD_MEMORY_tlog_writeall(int fd, const void *buff, size_t nbbyte)
+{
+    const char *ptr = (const char*) buff;
+
+    while(nbbyte>0)
+    {
+        ssize_t rs = write(fd, ptr, nbbyte);
+        if(rs<0)
+        {
+            if(errno == EINTR)
+                continue;
+            return(-1);
+        }
+        ptr += rs;
+        nbbyte -= rs;
+    }
+    return(0);
+}
+
+
+
+/**
+ * @brief Shuffle + byte delta + zero run-length encoding of a block
+ *
+ * Bytes of each element are gathered into typesize planes (shuffle), and each plane is delta-encoded.
+ * Slowly varying data then becomes mostly zero bytes, which are run-length encoded:\n
+ * token 0x80|(n-1) : n zero bytes (1..128)\n
+ * token n (1..127) : n literal bytes follow
+ *
+ * @return compressed size. out must hold at least TLOG_COMPBOUND(nbbyte) bytes
+ */
+static size_t COREMOD_MEMORY_tlog_compress(const uint8_t *in, size_t nbbyte, int typesize, uint8_t *tmp, uint8_t *out)
+{
+    size_t N = nbbyte/typesize;
+    size_t i, j, o;
+    int b;
+
+    for(b=0; b<typesize; b++)
+    {
+        uint8_t prev = 0;
+        uint8_t *plane = tmp + b*N;
+
+        for(i=0; i<N; i++)
+        {
+            uint8_t v = in[i*typesize+b];
+            plane[i] = v - prev;
+            prev = v;
+        }
+    }
+
+    o = 0;
+    i = 0;
+    while(i<nbbyte)
+    {
+        if(tmp[i]==0)
+        {
+            j = i;
+            while((j<nbbyte)&&(tmp[j]==0)&&(j-i<128))
+                j++;
+            out[o++] = 0x80 | (uint8_t) (j-i-1);
+        }
+        else
+        {
+            j = i;
+            while((j<nbbyte)&&(j-i<127)&&!((tmp[j]==0)&&(j+1<nbbyte)&&(tmp[j+1]==0)))
+                j++;
+            out[o++] = (uint8_t) (j-i);
+            memcpy(out+o, tmp+i, j-i);
+            o += j-i;
+        }
+        i = j;
+    }
+
+    return(o);
+}
+
+
+
+/**
+ * @brief Inverse of COREMOD_MEMORY_tlog_compress()
+ *
+ * @return 0 if OK, -1 if compressed data is inconsistent
+ */
+static int COREMOD_MEMORY_tlog_decompress(const uint8_t *in, size_t compsize, size_t nbbyte, int typesize, uint8_t *tmp, uint8_t *out)
+{
+    size_t N = nbbyte/typesize;
+    size_t i, p, o;
+    int b;
+
+    p = 0;
+    o = 0;
+    while((p<compsize)&&(o<nbbyte))
+    {
+        uint8_t c = in[p++];
+
+        if(c & 0x80)
+        {
+            size_t n = (c & 0x7f) + 1;
+            if(o+n>nbbyte)
+                return(-1);
+            memset(tmp+o, 0, n);
+            o += n;
+        }
+        else
+        {
+            if((c==0)||(o+c>nbbyte)||(p+c>compsize))
+                return(-1);
+            memcpy(tmp+o, in+p, c);
+            o += c;
+            p += c;
+        }
+    }
+    if((o!=nbbyte)||(p!=compsize))
+        return(-1);
+
+    for(b=0; b<typesize; b++)
+    {
+        uint8_t v = 0;
+        uint8_t *plane = tmp + b*N;
+
+        for(i=0; i<N; i++)
+        {
+            v += plane[i];
+            out[i*typesize+b] = v;
+        }
     }
+
     return(0);
 }
 
 
 
+/**
+ * @brief Compress and append one block to .tlog file, and its entry to the index
+ */
+static int COREMOD_MEMORY_tlog_writeblock(TLOG_WRITER *tw, int b)
+{
+    TLOG_BLOCKHEADER bheader;
+    TLOG_INDEXENTRY ientry;
+    size_t rawsize = tw->framesize*tw->nbframe[b];
+    size_t compsize = rawsize;
+    char *payload = tw->buff[b];
+
+    memset(&bheader, 0, sizeof(bheader));
+    bheader.magic = TLOG_BLOCKMAGIC;
+    bheader.nbframe = tw->nbframe[b];
+    bheader.rawsize = rawsize;
+    bheader.compression = TLOG_COMPRESSION_NONE;
+
+    if(tw->compression == TLOG_COMPRESSION_SHUFFLERLE)
+    {
+        size_t size = COREMOD_MEMORY_tlog_compress((uint8_t*) tw->buff[b], rawsize, tw->typesize, (uint8_t*) tw->tmp, (uint8_t*) tw->comp);
+        if(size < rawsize) // incompressible blocks are stored raw
+        {
+            compsize = size;
+            payload = tw->comp;
+            bheader.compression = TLOG_COMPRESSION_SHUFFLERLE;
+        }
+    }
+    bheader.compsize = compsize;
 
+    if( (COREMOD_MEMORY_tlog_writeall(tw->fd, &bheader, sizeof(bheader)) != 0)
+            || (COREMOD_MEMORY_tlog_writeall(tw->fd, tw->finfo[b], sizeof(TLOG_FRAMEINFO)*tw->nbframe[b]) != 0)
+            || (COREMOD_MEMORY_tlog_writeall(tw->fd, payload, compsize) != 0) )
+        return(-1);
 
+    memset(&ientry, 0, sizeof(ientry));
+    ientry.offset = tw->offset;
+    ientry.nbframe = tw->nbframe[b];
+    ientry.cnt0first = tw->finfo[b][0].cnt0;
+    ientry.cnt0last = tw->finfo[b][tw->nbframe[b]-1].cnt0;
+    ientry.tfirst = tw->finfo[b][0].tns;
+    ientry.tlast = tw->finfo[b][tw->nbframe[b]-1].tns;
+    if(COREMOD_MEMORY_tlog_writeall(tw->fdidx, &ientry, sizeof(ientry)) != 0)
+        return(-1);
 
+    tw->offset += sizeof(bheader) + sizeof(TLOG_FRAMEINFO)*tw->nbframe[b] + compsize;
+    tw->NBblock++;
+    tw->rawbytes += rawsize;
+    tw->compbytes += compsize;
 
-/** logs a shared memory stream onto disk
- * uses semlog semaphore
- *
- * uses data cube buffer to store frames
- * if an image name logdata exists (should ideally be in shared mem), then this will be included in the timing txt file
+    return(0);
+}
+
+
+
+/**
+ * @brief Writer thread: compresses and writes blocks in the order they are handed over
  */
-long COREMOD_MEMORY_sharedMem_2Dim_log(const char *IDname, uint32_t zsize, const char *logdir, const char *IDlogdata_name)
+static void *COREMOD_MEMORY_tlog_writer_thread(void *ptr)
 {
-    long ID;
-    uint32_t xsize, ysize;
-    long ii;
-    long i;
-    long IDb, IDb0, IDb1;
-    long index = 0;
-    long cnt = -1;
-    int buffer;
-    uint8_t atype;
-    uint32_t *imsizearray;
-    char fname[200];
-    char iname[200];
-    time_t t;
-    struct tm *uttime;
-    //struct timespec *thetime = (struct timespec *)malloc(sizeof(struct timespec));
-    struct timespec timenow;
-    long kw;
+    TLOG_WRITER *tw = (TLOG_WRITER*) ptr;
+    int b = 0;
 
-    long IDlogdata;
+#ifndef __MACH__
+    if(tw->cpu >= 0)
+    {
+        cpu_set_t cpuset;
 
-    char *ptr0; // source
-    char *ptr1; // destination
-    long framesize; // in bytes
+        CPU_ZERO(&cpuset);
+        CPU_SET(tw->cpu, &cpuset);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+            printf("WARNING: cannot pin tlog writer to CPU %d\n", tw->cpu);
+    }
+#endif
 
-    FILE *fp;
-    char fname_asciilog[200];
+    while(1)
+    {
+        pthread_mutex_lock(&tw->mutex);
+        while((tw->full[b]==0)&&(tw->exitflag==0))
+            pthread_cond_wait(&tw->cond, &tw->mutex);
+        if(tw->full[b]==0) // exit requested, nothing left to write
+        {
+            pthread_mutex_unlock(&tw->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&tw->mutex);
 
-    pthread_t thread_savefits; 
-    int tOK = 0;
-    int iret_savefits;
-    //	char tmessage[500];
-    struct savethreadmsg *tmsg = malloc(sizeof(struct savethreadmsg));
+        if(COREMOD_MEMORY_tlog_writeblock(tw, b) != 0)
+        {
+            perror("tlog write error");
+            tw->writeerr = 1;
+        }
 
-    long fnb = 0;
-    long NBfiles = -1; // run forever
-    long long cntwait;
-    long waitdelayus = 50;
-    long long cntwaitlim = 20000; // 10 sec
-    int wOK;
-    int noframe;
+        pthread_mutex_lock(&tw->mutex);
+        tw->full[b] = 0;
+        pthread_cond_broadcast(&tw->cond);
+        pthread_mutex_unlock(&tw->mutex);
 
+        b = 1-b;
+    }
+
+    return(NULL);
+}
 
-	char logb0name[500];
-	char logb1name[500];
 
-    int is3Dcube = 0; // this is a rolling buffer
-    int exitflag = 0; // toggles to 1 when loop must exit
 
+/**
+ * @brief Logs a stream to an append-only compressed telemetry file
+ *
+ * Frames are written to <logdir>/<IDname>_<UT time>.tlog as blocks of up to blocksize frames:\n
+ * TLOG_FILEHEADER, then for each block TLOG_BLOCKHEADER, blocksize TLOG_FRAMEINFO (cnt0, time), compressed frame data.\n
+ * Each block appends a TLOG_INDEXENTRY to the .tlogidx file alongside, so that a time or counter range can be located without reading the log.
+ *
+ * Acquisition fills one buffer while a dedicated writer thread, optionally pinned to a CPU, compresses and writes the other.
+ * Logging is controlled through the same logshimconf shared memory as shmimstreamlog (on, logexit).
+ *
+ * @param[in]  IDname       stream to log
+ * @param[in]  blocksize    number of frames per block
+ * @param[in]  logdir       output directory
+ * @param[in]  compression  TLOG_COMPRESSION_NONE or TLOG_COMPRESSION_SHUFFLERLE
+ * @param[in]  cpu          CPU for writer thread, -1 for no pinning
+ */
+long COREMOD_MEMORY_sharedMem_tlog(const char *IDname, uint32_t blocksize, const char *logdir, int compression, int cpu)
+{
+    long ID;
+    TLOG_WRITER tw;
+    TLOG_FILEHEADER fheader;
     LOGSHIM_CONF* logshimconf;
+    pthread_t thread_writer;
+    char fname[500];
+    time_t t;
+    struct tm *uttime;
+    struct timespec timenow;
+    uint64_t cnt0old;
+    int is3Dcube = 0;
+    int b = 0;
+    int axis;
+    long long NBframe = 0;
+    long long NBwait = 0; // number of times acquisition had to wait for writer
+    uint64_t NBlost = 0;  // frames missed at input, from cnt0 gaps
+
+    if((compression!=TLOG_COMPRESSION_NONE)&&(compression!=TLOG_COMPRESSION_SHUFFLERLE))
+        compression = TLOG_COMPRESSION_SHUFFLERLE;
+    if(blocksize<1)
+        blocksize = 1;
 
+    ID = image_ID(IDname);
+    if(ID==-1)
+        ID = read_sharedmem_image(IDname);
+    if(ID==-1)
+    {
+        sprintf(errmsg_memory, "Image \"%s\" does not exist", IDname);
+        printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+        return(-1);
+    }
+    if(data.image[ID].md[0].naxis==3)
+        is3Dcube = 1;
 
-    int RT_priority = 60; //any number from 0-99
-    struct sched_param schedpar;
-    
+    memset(&tw, 0, sizeof(tw));
+    tw.typesize = TYPESIZE[data.image[ID].md[0].atype];
+    tw.framesize = (size_t) tw.typesize*data.image[ID].md[0].size[0];
+    if(data.image[ID].md[0].naxis>1)
+        tw.framesize *= data.image[ID].md[0].size[1];
+    tw.blocksize = blocksize;
+    tw.compression = compression;
+    tw.cpu = cpu;
+    for(b=0; b<2; b++)
+    {
+        tw.buff[b] = (char*) malloc(tw.framesize*blocksize);
+        tw.finfo[b] = (TLOG_FRAMEINFO*) malloc(sizeof(TLOG_FRAMEINFO)*blocksize);
+    }
+    tw.tmp = (char*) malloc(tw.framesize*blocksize);
+    tw.comp = (char*) malloc(TLOG_COMPBOUND(tw.framesize*blocksize));
+    if((tw.buff[0]==NULL)||(tw.buff[1]==NULL)||(tw.finfo[0]==NULL)||(tw.finfo[1]==NULL)||(tw.tmp==NULL)||(tw.comp==NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+        exit(0);
+    }
+    pthread_mutex_init(&tw.mutex, NULL);
+    pthread_cond_init(&tw.cond, NULL);
 
-    schedpar.sched_priority = RT_priority;
-    #ifndef __MACH__
-    // r = seteuid(euid_called); //This goes up to maximum privileges
-    sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
-    // r = seteuid(euid_real);//Go back to normal privileges
-    #endif
+    t = time(NULL);
+    uttime = gmtime(&t);
+    clock_gettime(CLOCK_REALTIME, &timenow);
+    sprintf(fname, "%s/%s_%02d:%02d:%02ld.%09ld.tlog", logdir, IDname, uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
 
+    tw.fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, (mode_t)0644);
+    if(tw.fd == -1)
+    {
+        printf("File \"%s\"\n", fname);
+        perror("Error opening file for writing");
+        exit(0);
+    }
+    strcat(fname, "idx");
+    tw.fdidx = open(fname, O_WRONLY | O_CREAT | O_APPEND, (mode_t)0644);
+    if(tw.fdidx == -1)
+    {
+        printf("File \"%s\"\n", fname);
+        perror("Error opening file for writing");
+        exit(0);
+    }
+    fname[strlen(fname)-3] = '\0';
+    printf("logging %s -> %s\n", IDname, fname);
+    fflush(stdout);
 
+    memset(&fheader, 0, sizeof(fheader));
+    memcpy(fheader.magic, TLOG_FILEMAGIC, 8);
+    fheader.version = TLOG_VERSION;
+    fheader.atype = data.image[ID].md[0].atype;
+    fheader.naxis = (data.image[ID].md[0].naxis>1) ? 2 : 1;
+    for(axis=0; axis<fheader.naxis; axis++)
+        fheader.size[axis] = data.image[ID].md[0].size[axis];
+    fheader.framesize = tw.framesize;
+    fheader.blocksize = blocksize;
+    strncpy(fheader.name, IDname, sizeof(fheader.name)-1);
+    if(COREMOD_MEMORY_tlog_writeall(tw.fd, &fheader, sizeof(fheader)) != 0)
+    {
+        perror("tlog write error");
+        exit(0);
+    }
+    tw.offset = sizeof(fheader);
 
-    IDlogdata = image_ID(IDlogdata_name);
-    if(IDlogdata!=-1)
+    if(pthread_create(&thread_writer, NULL, COREMOD_MEMORY_tlog_writer_thread, &tw) != 0)
     {
-        if(data.image[IDlogdata].md[0].atype != _DATATYPE_FLOAT)
-            IDlogdata = -1;
+        printERROR(__FILE__, __func__, __LINE__, "cannot create writer thread");
+        exit(0);
     }
-    printf("log data name = %s\n", IDlogdata_name);
-
 
     logshimconf = COREMOD_MEMORY_logshim_create_SHMconf(IDname);
-
-
     logshimconf[0].on = 1;
     logshimconf[0].cnt = 0;
     logshimconf[0].filecnt = 0;
     logshimconf[0].logexit = 0;
     logshimconf[0].interval = 1;
+    strcpy(logshimconf[0].fname, fname);
 
+    b = 0;
+    cnt0old = data.image[ID].md[0].cnt0;
+    while((logshimconf[0].logexit==0)&&(tw.writeerr==0))
+    {
+        int handover = 0;
+        int timeout;
+        uint64_t cnt0;
 
+        timeout = COREMOD_MEMORY_image_waitframe(ID, cnt0old, 1000000);
 
-    imsizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+        if((timeout==0)&&(logshimconf[0].on==1))
+        {
+            uint32_t k = tw.nbframe[b];
+            size_t offset = 0;
+
+            cnt0 = data.image[ID].md[0].cnt0;
+            if(is3Dcube==1)
+                offset = tw.framesize*data.image[ID].md[0].cnt1;
+            ImageStreamIO_read_consistent(&data.image[ID], tw.buff[b] + tw.framesize*k, offset, tw.framesize, 10);
+            clock_gettime(CLOCK_REALTIME, &timenow);
+
+            if((NBframe>0)&&(cnt0>cnt0old+1))
+                NBlost += cnt0-cnt0old-1;
+            tw.finfo[b][k].cnt0 = cnt0;
+            tw.finfo[b][k].tns = (uint64_t) timenow.tv_sec*1000000000 + timenow.tv_nsec;
+            tw.nbframe[b]++;
+            NBframe++;
+            logshimconf[0].cnt++;
+            if(tw.nbframe[b]==blocksize)
+                handover = 1;
+        }
+        if(timeout==0)
+            cnt0old = data.image[ID].md[0].cnt0;
+        else if(tw.nbframe[b]>0) // stream idle: flush partial block
+            handover = 1;
 
+        if(handover==1)
+        {
+            pthread_mutex_lock(&tw.mutex);
+            tw.full[b] = 1;
+            pthread_cond_broadcast(&tw.cond);
+            b = 1-b;
+            if(tw.full[b]==1)
+                NBwait++;
+            while(tw.full[b]==1) // writer still busy with other buffer
+                pthread_cond_wait(&tw.cond, &tw.mutex);
+            pthread_mutex_unlock(&tw.mutex);
+            tw.nbframe[b] = 0;
+            logshimconf[0].filecnt++;
+        }
+    }
 
+    // flush last partial block and stop writer
+    pthread_mutex_lock(&tw.mutex);
+    if(tw.nbframe[b]>0)
+        tw.full[b] = 1;
+    tw.exitflag = 1;
+    pthread_cond_broadcast(&tw.cond);
+    pthread_mutex_unlock(&tw.mutex);
+    pthread_join(thread_writer, NULL);
 
-    read_sharedmem_image(IDname);
-    ID = image_ID(IDname);
-    atype = data.image[ID].md[0].atype;
-    xsize = data.image[ID].md[0].size[0];
-    ysize = data.image[ID].md[0].size[1];
+    close(tw.fd);
+    close(tw.fdidx);
 
-    if(data.image[ID].md[0].naxis==3)
-        is3Dcube = 1;
+    printf("%lld frames in %lld blocks, %lld -> %lld bytes", NBframe, tw.NBblock, tw.rawbytes, tw.compbytes);
+    if(tw.rawbytes>0)
+        printf(" (ratio %.3f)", 1.0*tw.compbytes/tw.rawbytes);
+    printf("\n");
+    printf("%lld writer stall(s), %ld input frame(s) missed\n", NBwait, (long) NBlost);
+    fflush(stdout);
 
-    /** create the 2 buffers */
+    pthread_mutex_destroy(&tw.mutex);
+    pthread_cond_destroy(&tw.cond);
+    for(b=0; b<2; b++)
+    {
+        free(tw.buff[b]);
+        free(tw.finfo[b]);
+    }
+    free(tw.tmp);
+    free(tw.comp);
 
-    imsizearray[0] = xsize;
-    imsizearray[1] = ysize;
-    imsizearray[2] = zsize;
-    
-    sprintf(logb0name, "%s_logbuff0", IDname);
-    sprintf(logb1name, "%s_logbuff1", IDname);
-    
-    IDb0 = create_image_ID(logb0name, 3, imsizearray, atype, 1, 1);
-    IDb1 = create_image_ID(logb1name, 3, imsizearray, atype, 1, 1);
-	COREMOD_MEMORY_image_set_semflush(logb0name, -1);
-	COREMOD_MEMORY_image_set_semflush(logb1name, -1);
+    return(ID);
+}
 
-    IDb = IDb0;
 
-    switch ( atype ) {
 
-    case _DATATYPE_INT8:
-        framesize = SIZEOF_DATATYPE_INT8*xsize*ysize;
-        break;
-    case _DATATYPE_UINT8:
-        framesize = SIZEOF_DATATYPE_UINT8*xsize*ysize;
-        break;
+/**
+ * @brief Extract frames in time range from a .tlog file into a 3D image
+ *
+ * Blocks are located with the .tlogidx index; only blocks overlapping the range are read.
+ * Frame counters and times are written to <IDout_name>.txt
+ *
+ * @param[in]  fname       .tlog file
+ * @param[in]  tstart      start time [s], unix time. <= 0 for start of log
+ * @param[in]  tend        end time [s], unix time. <= 0 for end of log
+ * @param[in]  IDout_name  output image
+ */
+long COREMOD_MEMORY_tlog_extract(const char *fname, double tstart, double tend, const char *IDout_name)
+{
+    FILE *fp;
+    FILE *fpidx;
+    FILE *fpt;
+    char fnameidx[500];
+    char fnamet[500];
+    TLOG_FILEHEADER fheader;
+    TLOG_INDEXENTRY *index = NULL;
+    long NBblock = 0;
+    long NBblockmax = 0;
+    long blk;
+    uint64_t t0, t1;
+    long NBframe = 0;
+    long frame;
+    uint32_t sizearray[3];
+    long IDout;
+    char *raw;
+    char *comp;
+    char *tmp;
+    TLOG_FRAMEINFO *finfo;
+    int typesize;
 
-    case _DATATYPE_INT16:
-        framesize = SIZEOF_DATATYPE_INT16*xsize*ysize;
-        break;
-    case _DATATYPE_UINT16:
-        framesize = SIZEOF_DATATYPE_UINT16*xsize*ysize;
-        break;
+    t0 = (tstart>0.0) ? (uint64_t) (tstart*1.0e9) : 0;
+    t1 = (tend>0.0) ? (uint64_t) (tend*1.0e9) : UINT64_MAX;
 
-    case _DATATYPE_INT32:
-        framesize = SIZEOF_DATATYPE_INT32*xsize*ysize;
-        break;
-    case _DATATYPE_UINT32:
-        framesize = SIZEOF_DATATYPE_UINT32*xsize*ysize;
-        break;
+    if((fp = fopen(fname, "r"))==NULL)
+    {
+        sprintf(errmsg_memory, "Cannot open file \"%s\"", fname);
+        printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+        return(-1);
+    }
+    if((fread(&fheader, sizeof(fheader), 1, fp)!=1)||(memcmp(fheader.magic, TLOG_FILEMAGIC, 8)!=0))
+    {
+        sprintf(errmsg_memory, "File \"%s\" is not a tlog file", fname);
+        printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+        fclose(fp);
+        return(-1);
+    }
+    typesize = (fheader.atype < 32) ? TYPESIZE[fheader.atype] : 0;
 
-    case _DATATYPE_INT64:
-        framesize = SIZEOF_DATATYPE_INT64*xsize*ysize;
-        break;
-    case _DATATYPE_UINT64:
-        framesize = SIZEOF_DATATYPE_UINT64*xsize*ysize;
-        break;
- 
-    case _DATATYPE_FLOAT:
-        framesize = SIZEOF_DATATYPE_FLOAT*xsize*ysize;
-        break;
-    case _DATATYPE_DOUBLE:
-        framesize = SIZEOF_DATATYPE_DOUBLE*xsize*ysize;
-        break;
+    sprintf(fnameidx, "%sidx", fname);
+    if((fpidx = fopen(fnameidx, "r"))==NULL)
+    {
+        sprintf(errmsg_memory, "Cannot open index file \"%s\"", fnameidx);
+        printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
+        fclose(fp);
+        return(-1);
+    }
+    while(1)
+    {
+        if(NBblock==NBblockmax)
+        {
+            NBblockmax = 2*NBblockmax + 64;
+            index = (TLOG_INDEXENTRY*) realloc(index, sizeof(TLOG_INDEXENTRY)*NBblockmax);
+        }
+        if(fread(&index[NBblock], sizeof(TLOG_INDEXENTRY), 1, fpidx)!=1)
+            break;
+        if((index[NBblock].tlast>=t0)&&(index[NBblock].tfirst<=t1))
+            NBframe += index[NBblock].nbframe; // upper bound
+        NBblock++;
+    }
+    fclose(fpidx);
 
-    default:
-        printf("ERROR: WRONG DATA TYPE\n");
-        exit(0);
-        break;
+    raw = (char*) malloc(fheader.framesize*fheader.blocksize);
+    tmp = (char*) malloc(fheader.framesize*fheader.blocksize);
+    comp = (char*) malloc(TLOG_COMPBOUND(fheader.framesize*fheader.blocksize));
+    finfo = (TLOG_FRAMEINFO*) malloc(sizeof(TLOG_FRAMEINFO)*fheader.blocksize);
+
+    // first pass over selected blocks: exact frame count
+    NBframe = 0;
+    for(blk=0; blk<NBblock; blk++)
+        if((index[blk].tlast>=t0)&&(index[blk].tfirst<=t1))
+        {
+            TLOG_BLOCKHEADER bheader;
+
+            fseek(fp, index[blk].offset, SEEK_SET);
+            if((fread(&bheader, sizeof(bheader), 1, fp)!=1)||(bheader.magic!=TLOG_BLOCKMAGIC)||(bheader.nbframe>fheader.blocksize)
+                    ||(fread(finfo, sizeof(TLOG_FRAMEINFO), bheader.nbframe, fp)!=bheader.nbframe))
+            {
+                printf("WARNING: block %ld corrupted - skipping\n", blk);
+                index[blk].nbframe = 0;
+                continue;
+            }
+            for(frame=0; frame<bheader.nbframe; frame++)
+                if((finfo[frame].tns>=t0)&&(finfo[frame].tns<=t1))
+                    NBframe++;
+        }
+
+    if(NBframe==0)
+    {
+        printf("No frame in time range\n");
+        IDout = -1;
+    }
+    else
+    {
+        long kk = 0;
+
+        sizearray[0] = fheader.size[0];
+        sizearray[1] = (fheader.naxis>1) ? fheader.size[1] : 1;
+        sizearray[2] = NBframe;
+        IDout = create_image_ID(IDout_name, 3, sizearray, fheader.atype, 0, 0);
+
+        sprintf(fnamet, "%s.txt", IDout_name);
+        fpt = fopen(fnamet, "w");
+
+        for(blk=0; blk<NBblock; blk++)
+            if((index[blk].nbframe>0)&&(index[blk].tlast>=t0)&&(index[blk].tfirst<=t1))
+            {
+                TLOG_BLOCKHEADER bheader;
+                int readOK = 1;
+
+                fseek(fp, index[blk].offset, SEEK_SET);
+                if((fread(&bheader, sizeof(bheader), 1, fp)!=1)
+                        ||(fread(finfo, sizeof(TLOG_FRAMEINFO), bheader.nbframe, fp)!=bheader.nbframe)
+                        ||(bheader.rawsize!=fheader.framesize*bheader.nbframe)
+                        ||(bheader.compsize>TLOG_COMPBOUND(bheader.rawsize)))
+                    readOK = 0;
+                if(readOK==1)
+                {
+                    if(bheader.compression==TLOG_COMPRESSION_NONE)
+                        readOK = (fread(raw, 1, bheader.rawsize, fp)==bheader.rawsize) ? 1 : 0;
+                    else
+                        readOK = ((fread(comp, 1, bheader.compsize, fp)==bheader.compsize)
+                                  &&(COREMOD_MEMORY_tlog_decompress((uint8_t*) comp, bheader.compsize, bheader.rawsize, typesize, (uint8_t*) tmp, (uint8_t*) raw)==0)) ? 1 : 0;
+                }
+                if(readOK==0)
+                {
+                    printf("WARNING: block %ld corrupted - skipping\n", blk);
+                    continue;
+                }
+
+                for(frame=0; frame<bheader.nbframe; frame++)
+                    if((finfo[frame].tns>=t0)&&(finfo[frame].tns<=t1)&&(kk<NBframe))
+                    {
+                        memcpy((char*) data.image[IDout].array.UI8 + fheader.framesize*kk, raw + fheader.framesize*frame, fheader.framesize);
+                        if(fpt!=NULL)
+                            fprintf(fpt, "%6ld  %10ld  %ld.%09ld\n", kk, (long) finfo[frame].cnt0, (long) (finfo[frame].tns/1000000000), (long) (finfo[frame].tns%1000000000));
+                        kk++;
+                    }
+            }
+
+        if(fpt!=NULL)
+            fclose(fpt);
+        printf("%ld frame(s) extracted from %s -> %s\n", kk, fname, IDout_name);
     }
 
-    cnt = data.image[ID].md[0].cnt0 - 1;
+    fclose(fp);
+    free(index);
+    free(raw);
+    free(tmp);
+    free(comp);
+    free(finfo);
 
-    buffer = 0;
-    index = 0;
+    return(IDout);
+}
 
-    printf("logdata ID = %ld\n", IDlogdata);
-    list_image_ID();
 
-    exitflag = 0;
 
-    while( (logshimconf[0].filecnt != NBfiles) && (logshimconf[0].logexit==0) )
-    {
-        cntwait = 0;
-        noframe = 0;
-        wOK = 1;
-        // printf("Entering wait loop   index = %ld %d\n", index, noframe);
 
-        while(((cnt==data.image[ID].md[0].cnt0)||(logshimconf[0].on == 0))&&(wOK==1))
-        {
-            usleep(waitdelayus);
-            cntwait++;
-            if(cntwait>cntwaitlim) // save current cube
-            {
-                strcpy(tmsg->iname, iname);
-                strcpy(tmsg->fname, fname);
-                tmsg->partial = 1; // partial cube
-                tmsg->cubesize = index;
-                wOK=0;
-                if(index==0)
-                    noframe = 1;
-                else
-                    noframe = 0;
-            }
-        }
+/** asynchronous record writer, see COREMOD_MEMORY_asyncwriter_open() */
+struct ASYNCWRITER
+{
+    char fname[500];
+    int fd;
+    int direct;                /**< 1 if file opened with O_DIRECT */
 
+    int NBslot;
+    size_t slotsize;           /**< aligned slot size [byte] */
+    char *slotbuff;            /**< NBslot x slotsize, aligned */
+    size_t *slotlen;           /**< record size in each slot */
+    size_t chunksize;
+    char *chunk;               /**< aligned staging buffer for file writes */
 
+    uint64_t head;             /**< records queued */
+    uint64_t tail;             /**< records written */
+    int closeflag;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
 
-        if(index==0)
-        {
-            /// measure time
-            t = time(NULL);
-            uttime = gmtime(&t);
-            //clock_gettime(CLOCK_REALTIME, thetime);
-            
-			clock_gettime(CLOCK_REALTIME, &timenow);
-/*
-   struct timespec timenow;
-   clock_gettime(CLOCK_REALTIME, &timenow);
-	fprintf(fo, "time:  %ld.%09ld\n", timenow.tv_sec % 60, timenow.tv_nsec);
-  */          
-            sprintf(fname,"!%s/%s_%02d:%02d:%02ld.%09ld.fits", logdir, IDname, uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
-   //        sprintf(fname, "!%s/%s_%02d:%02d:%02d.%09ld.fits", logdir, IDname, uttime->tm_hour, uttime->tm_min, (long)thetime->tv_sec, (long) (thetime->tv_nsec));
+    uint64_t NBsubmit;
+    uint64_t NBdrop;
+    uint64_t nbsubmitted;      /**< bytes queued */
+    uint64_t nbwritten;        /**< bytes written */
+    uint64_t maxdepth;         /**< queue high-water mark */
+    long maxwriteus;
+    int writeerr;              /**< errno of last write error, 0 if none */
+};
 
-            sprintf(fname_asciilog,"%s/%s_%02d:%02d:%02ld.%09ld.txt", logdir, IDname, uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
-            
-         //   printf("fname           = %s\n", fname);
-          //  printf("fname_asciilog  = %s\n", fname_asciilog);
-         //   fflush(stdout);
+
+
+/**
+ * @brief Writer thread for ASYNCWRITER
+ *
+ * Packs queued records contiguously into an aligned chunk, written with a single write() when full.
+ */
+static void *COREMOD_MEMORY_asyncwriter_thread(void *ptr)
+{
+    ASYNCWRITER *aw = (ASYNCWRITER*) ptr;
+    size_t chunkfill = 0;
+
+    while(1)
+    {
+        uint64_t slot;
+        size_t nbbyte;
+        char *src;
+        struct timespec t0, t1;
+        long dtus;
+
+        pthread_mutex_lock(&aw->mutex);
+        while((aw->head==aw->tail)&&(aw->closeflag==0))
+            pthread_cond_wait(&aw->cond, &aw->mutex);
+        if(aw->head==aw->tail) // closing, queue drained
+        {
+            pthread_mutex_unlock(&aw->mutex);
+            break;
         }
+        slot = aw->tail % aw->NBslot;
+        pthread_mutex_unlock(&aw->mutex);
 
-        if(logshimconf[0].on == 1)
+        src = aw->slotbuff + aw->slotsize*slot;
+        nbbyte = aw->slotlen[slot];
+        while(nbbyte>0)
         {
-            if(wOK==1) // normal step: a frame has arrived
+            size_t n = aw->chunksize - chunkfill;
+
+            if(n>nbbyte)
+                n = nbbyte;
+            memcpy(aw->chunk + chunkfill, src, n);
+            chunkfill += n;
+            src += n;
+            nbbyte -= n;
+
+            if(chunkfill == aw->chunksize)
             {
-                /// measure time
-                t = time(NULL);
-                uttime = gmtime(&t);
-                //clock_gettime(CLOCK_REALTIME, thetime);
-				clock_gettime(CLOCK_REALTIME, &timenow);
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                if(COREMOD_MEMORY_tlog_writeall(aw->fd, aw->chunk, aw->chunksize) != 0)
+                    aw->writeerr = errno;
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                dtus = (t1.tv_sec-t0.tv_sec)*1000000 + (t1.tv_nsec-t0.tv_nsec)/1000;
+                if(dtus > aw->maxwriteus)
+                    aw->maxwriteus = dtus;
+                chunkfill = 0;
+            }
+        }
 
-                if(index==0)
-                    fp = fopen(fname_asciilog, "w");
+        pthread_mutex_lock(&aw->mutex);
+        aw->nbwritten += aw->slotlen[slot];
+        aw->tail++;
+        pthread_mutex_unlock(&aw->mutex);
+    }
 
+    // last partial chunk: O_DIRECT requires aligned size, file is truncated to actual size on close
+    if(chunkfill>0)
+    {
+        size_t nbbyte = chunkfill;
 
-                switch ( atype ) {
+        if(aw->direct==1)
+        {
+            nbbyte = (chunkfill + ASYNCWRITER_ALIGN - 1) / ASYNCWRITER_ALIGN * ASYNCWRITER_ALIGN;
+            memset(aw->chunk+chunkfill, 0, nbbyte-chunkfill);
+        }
+        if(COREMOD_MEMORY_tlog_writeall(aw->fd, aw->chunk, nbbyte) != 0)
+            aw->writeerr = errno;
+    }
 
-                case _DATATYPE_INT8:
-                    ptr0 = (char*) data.image[ID].array.SI8;
-                    ptr1 = (char*) data.image[IDb].array.SI8;
-                    break;
-                case _DATATYPE_UINT8:
-                    ptr0 = (char*) data.image[ID].array.UI8;
-                    ptr1 = (char*) data.image[IDb].array.UI8;
-                    break;
-                    
-                case _DATATYPE_INT16:
-                    ptr0 = (char*) data.image[ID].array.SI16;
-                    ptr1 = (char*) data.image[IDb].array.SI16;
-                    break;
-                case _DATATYPE_UINT16:
-                    ptr0 = (char*) data.image[ID].array.UI16;
-                    ptr1 = (char*) data.image[IDb].array.UI16;
-                    break;
-                    
-                case _DATATYPE_INT32:
-                    ptr0 = (char*) data.image[ID].array.SI32;
-                    ptr1 = (char*) data.image[IDb].array.SI32;
-                    break;
-                case _DATATYPE_UINT32:
-                    ptr0 = (char*) data.image[ID].array.UI32;
-                    ptr1 = (char*) data.image[IDb].array.UI32;
-                    break;
-                    
-                case _DATATYPE_INT64:
-                    ptr0 = (char*) data.image[ID].array.SI64;
-                    ptr1 = (char*) data.image[IDb].array.SI64;
-                    break;
-                case _DATATYPE_UINT64:
-                    ptr0 = (char*) data.image[ID].array.UI64;
-                    ptr1 = (char*) data.image[IDb].array.UI64;
-                    break;
-                    
-                case _DATATYPE_FLOAT:
-                    ptr0 = (char*) data.image[ID].array.F;
-                    ptr1 = (char*) data.image[IDb].array.F;
-                    break;
-                case _DATATYPE_DOUBLE:
-                    ptr0 = (char*) data.image[ID].array.D;
-                    ptr1 = (char*) data.image[IDb].array.D;
-                    break;
+    return(NULL);
+}
 
-                }
 
-                //  ptr0 = (char*) data.image[ID].array.F;
 
+/**
+ * @brief Open asynchronous file writer
+ *
+ * Records are copied into one of NBslot preallocated, page-aligned slots and written by a dedicated thread.
+ * The file is opened with O_DIRECT when the filesystem supports it, bypassing the page cache so that
+ * a slow disk shows up as queue depth rather than as stalls in the caller.
+ *
+ * @param[in]  fname       output file
+ * @param[in]  recordsize  maximum record size [byte]
+ * @param[in]  NBslot      queue depth
+ *
+ * @return writer handle, NULL if file cannot be opened
+ */
+ASYNCWRITER *COREMOD_MEMORY_asyncwriter_open(const char *fname, size_t recordsize, int NBslot)
+{
+    ASYNCWRITER *aw;
 
+    if(NBslot<2)
+        NBslot = 2;
 
-                if(is3Dcube==1)
-                    ptr0 += framesize*data.image[ID].md[0].cnt1;
+    aw = (ASYNCWRITER*) calloc(1, sizeof(ASYNCWRITER));
+    if(aw==NULL)
+        return(NULL);
+    strncpy(aw->fname, fname, sizeof(aw->fname)-1);
 
-                //    ptr1 = (char*) data.image[IDb].array.F;
-                ptr1 += framesize*index;
+    aw->direct = 0;
+#ifdef O_DIRECT
+    aw->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, (mode_t)0644);
+    if(aw->fd != -1)
+        aw->direct = 1;
+    else
+#endif
+    aw->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0644);
+    if(aw->fd == -1)
+    {
+        printf("File \"%s\"\n", fname);
+        perror("Error opening file for writing");
+        free(aw);
+        return(NULL);
+    }
 
-                memcpy((void *) ptr1, (void *) ptr0, framesize);
+    aw->NBslot = NBslot;
+    aw->slotsize = (recordsize + ASYNCWRITER_ALIGN - 1) / ASYNCWRITER_ALIGN * ASYNCWRITER_ALIGN;
+    aw->chunksize = ASYNCWRITER_CHUNKSIZE;
+    if( (posix_memalign((void**) &aw->slotbuff, ASYNCWRITER_ALIGN, aw->slotsize*NBslot) != 0)
+            || (posix_memalign((void**) &aw->chunk, ASYNCWRITER_ALIGN, aw->chunksize) != 0) )
+    {
+        printERROR(__FILE__, __func__, __LINE__, "memory allocation failed");
+        exit(0);
+    }
+    aw->slotlen = (size_t*) calloc(NBslot, sizeof(size_t));
 
-                fprintf(fp, "%02d:%02d:%02ld.%09ld ", uttime->tm_hour, uttime->tm_min, timenow.tv_sec % 60, timenow.tv_nsec);
+    // touch buffers now, rather than page-faulting during acquisition
+    memset(aw->slotbuff, 0, aw->slotsize*NBslot);
+    memset(aw->chunk, 0, aw->chunksize);
 
-                if(IDlogdata!=-1)
-                {
+    pthread_mutex_init(&aw->mutex, NULL);
+    pthread_cond_init(&aw->cond, NULL);
+    if(pthread_create(&aw->thread, NULL, COREMOD_MEMORY_asyncwriter_thread, aw) != 0)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create writer thread");
+        exit(0);
+    }
 
-                    fprintf(fp, "%8ld", data.image[IDlogdata].md[0].cnt0);
-                    for(i=0; i<data.image[IDlogdata].md[0].nelement; i++)
-                        fprintf(fp, "  %f", data.image[IDlogdata].array.F[i]);
-                }
+    return(aw);
+}
 
-                for(kw=0; kw<data.image[ID].md[0].NBkw; kw++)
-                {
-                    switch (data.image[ID].kw[kw].type) {
-                    case 'L' :
-                        fprintf(fp, " %ld", data.image[ID].kw[kw].value.numl);
-                        break;
-                    case 'D' :
-                        fprintf(fp, " %f", data.image[ID].kw[kw].value.numf);
-                        break;
-                    }
-                }
-                fprintf(fp, "\n");
 
-                index++;
-            }
-        }
 
+/**
+ * @brief Queue a record for writing, without blocking
+ *
+ * If all slots are busy the record is dropped and counted in aw->NBdrop.
+ *
+ * @return 0 if queued, 1 if dropped
+ */
+int COREMOD_MEMORY_asyncwriter_submit(ASYNCWRITER *aw, const void *ptr, size_t nbbyte)
+{
+    uint64_t head;
+    uint64_t depth;
+    uint64_t slot;
 
-        /// cases:
-        /// index>zsize-1  buffer full
-        /// wOK==0 && index>0
-        if(  (index>zsize-1)  ||  ((wOK==0)&&(index>0)) )
-        {
-            /// save image
-           // sprintf(iname, "logbuff%d", buffer);
-            sprintf(iname, "%s_logbuff%d", IDname, buffer);
-            if(buffer==0)
-				IDb = IDb0;
-			else
-				IDb = IDb1;
-            
-            
-            //          printf("Saving %s -> %s\n", iname, fname);
-            //         fflush(stdout);
-            if(wOK==1) // image has arrived
-            {
-                strcpy(tmsg->iname, iname);
-                strcpy(tmsg->fname, fname);
-                tmsg->partial = 0; // full cube
-            }
+    pthread_mutex_lock(&aw->mutex);
+    head = aw->head;
+    depth = head - aw->tail;
+    pthread_mutex_unlock(&aw->mutex);
 
-            fclose(fp);
+    aw->NBsubmit++;
+    if((depth == (uint64_t) aw->NBslot)||(nbbyte > aw->slotsize))
+    {
+        aw->NBdrop++;
+        return(1);
+    }
 
-            if(tOK == 1)
-            {
-                //           printf("WAITING FOR SAVE THREAD TO COMPLETE ...");
-                //          fflush(stdout);
-                pthread_join(thread_savefits, NULL); //(void**)&thread_savefits);
-                //          printf("OK\n");
-                //          fflush(stdout);
-            }
+    // slot is owned by caller until head is advanced
+    slot = head % aw->NBslot;
+    memcpy(aw->slotbuff + aw->slotsize*slot, ptr, nbbyte);
+    aw->slotlen[slot] = nbbyte;
+    aw->nbsubmitted += nbbyte;
 
-			COREMOD_MEMORY_image_set_sempost_byID(IDb, -1);
-			data.image[IDb].md[0].cnt0++;
-			data.image[IDb].md[0].write = 0;
-			
+    pthread_mutex_lock(&aw->mutex);
+    aw->head++;
+    if(depth+1 > aw->maxdepth)
+        aw->maxdepth = depth+1;
+    pthread_cond_signal(&aw->cond);
+    pthread_mutex_unlock(&aw->mutex);
 
-            strcpy(tmsg->iname, iname);
-            iret_savefits = pthread_create( &thread_savefits, NULL, save_fits_function, tmsg);
+    return(0);
+}
 
-            logshimconf[0].cnt ++;
 
-            tOK = 1;
-            if(iret_savefits)
-            {
-                fprintf(stderr,"Error - pthread_create() return code: %d\n", iret_savefits);
-                exit(EXIT_FAILURE);
-            }
 
-            index = 0;
-            buffer++;
-            if(buffer==2)
-                buffer = 0;
-            //            printf("[%ld -> %d]", cnt, buffer);
-            //           fflush(stdout);
-            if(buffer==0)
-                IDb = IDb0;
-            else
-                IDb = IDb1;
-			data.image[IDb].md[0].write = 1;
-            logshimconf[0].filecnt ++;
-        }
+/**
+ * @brief Drain queue, close file and release writer
+ *
+ * @return number of dropped records, -1 if a write error occurred
+ */
+long COREMOD_MEMORY_asyncwriter_close(ASYNCWRITER *aw)
+{
+    long ret;
 
+    pthread_mutex_lock(&aw->mutex);
+    aw->closeflag = 1;
+    pthread_cond_signal(&aw->cond);
+    pthread_mutex_unlock(&aw->mutex);
+    pthread_join(aw->thread, NULL);
 
-        cnt = data.image[ID].md[0].cnt0;
+    if(ftruncate(aw->fd, aw->nbwritten) != 0)
+        perror("ftruncate");
+    close(aw->fd);
+
+    printf("%s : %ld record(s), %ld dropped, %lld bytes, max queue depth %ld/%d, max write time %ld us%s\n",
+           aw->fname, (long) aw->NBsubmit, (long) aw->NBdrop, (long long) aw->nbwritten, (long) aw->maxdepth, aw->NBslot, aw->maxwriteus,
+           (aw->direct==1) ? " (O_DIRECT)" : "");
+    if(aw->writeerr != 0)
+    {
+        sprintf(errmsg_memory, "write error on %s : %s", aw->fname, strerror(aw->writeerr));
+        printERROR(__FILE__, __func__, __LINE__, errmsg_memory);
     }
+    fflush(stdout);
 
-    free(imsizearray);
-	free(tmsg);
+    ret = (aw->writeerr != 0) ? -1 : (long) aw->NBdrop;
 
-    return(0);
+    pthread_mutex_destroy(&aw->mutex);
+    pthread_cond_destroy(&aw->cond);
+    free(aw->slotbuff);
+    free(aw->chunk);
+    free(aw->slotlen);
+    free(aw);
+
+    return(ret);
 }
 
 
@@ -45,6 +45,78 @@ typedef struct
 
 
 
+/* telemetry log format (.tlog), written by COREMOD_MEMORY_sharedMem_tlog() */
+
+#define TLOG_FILEMAGIC "AOCTLOG1"
+#define TLOG_VERSION 1
+#define TLOG_BLOCKMAGIC 0x4b4c4254  // "TBLK"
+
+#define TLOG_COMPRESSION_NONE       0
+#define TLOG_COMPRESSION_SHUFFLERLE 1  /**< byte shuffle + delta + zero run-length */
+
+/** worst case compressed size of nbbyte bytes */
+#define TLOG_COMPBOUND(nbbyte) ((nbbyte) + (nbbyte)/127 + 16)
+
+typedef struct
+{
+    char magic[8];             /**<  TLOG_FILEMAGIC */
+    uint32_t version;
+    uint8_t atype;
+    uint8_t naxis;
+    uint16_t pad0;
+    uint32_t size[2];
+    uint32_t blocksize;        /**<  max number of frames per block */
+    uint64_t framesize;        /**<  bytes per frame */
+    char name[80];
+} TLOG_FILEHEADER;
+
+typedef struct
+{
+    uint32_t magic;            /**<  TLOG_BLOCKMAGIC */
+    uint32_t nbframe;
+    uint64_t rawsize;
+    uint64_t compsize;         /**<  payload size following TLOG_FRAMEINFO array */
+    uint32_t compression;
+    uint32_t pad0;
+} TLOG_BLOCKHEADER;
+
+typedef struct
+{
+    uint64_t cnt0;
+    uint64_t tns;              /**<  acquisition time [ns], CLOCK_REALTIME */
+} TLOG_FRAMEINFO;
+
+/** one entry per block in .tlogidx file */
+typedef struct
+{
+    uint64_t offset;           /**<  block offset in .tlog file */
+    uint64_t cnt0first;
+    uint64_t cnt0last;
+    uint64_t tfirst;
+    uint64_t tlast;
+    uint32_t nbframe;
+    uint32_t pad0;
+} TLOG_INDEXENTRY;
+
+
+
+/* asynchronous writer (O_DIRECT, preallocated aligned buffers) */
+
+#define ASYNCWRITER_ALIGN 4096
+#define ASYNCWRITER_CHUNKSIZE (4*1024*1024)
+
+typedef struct ASYNCWRITER ASYNCWRITER;
+
+
+
+/* persistent waiter on multiple streams (futex_waitv) */
+
+#define STREAMWAITSET_NBSTREAM_MAX 128
+
+typedef struct STREAMWAITSET STREAMWAITSET;
+
+
+
 typedef struct
 {
     long cnt0;
@@ -52,6 +124,24 @@ typedef struct
 } TCP_BUFFER_METADATA;
 
 
+#define NETWORK_MUX_NBSTREAM_MAX 64
+
+#define NETWORK_MUX_ENCODING_RAW    0  /**< payload is the full slice */
+#define NETWORK_MUX_ENCODING_SPARSE 1  /**< payload is list of changed runs */
+
+/** frame header for multiplexed stream transport */
+typedef struct
+{
+    uint32_t stream;   /**< index of stream in transmit list */
+    uint32_t slice;    /**< slice written */
+    uint64_t nbbyte;   /**< number of payload bytes following header */
+    long cnt0;
+    long cnt1;
+    uint32_t encoding; /**< NETWORK_MUX_ENCODING_RAW or NETWORK_MUX_ENCODING_SPARSE */
+    uint32_t pad;
+} TCP_MUX_HEADER;
+
+
 
 
 int_fast8_t init_COREMOD_memory();
@@ -78,6 +168,9 @@ int_fast8_t init_COREMOD_memory();
 
 int_fast8_t memory_monitor(const char *termttyname);
 
+/** @brief Live stream accounting (update rate, write bandwidth, attached processes) to memory monitor and JSON file */
+long COREMOD_MEMORY_streamstatus(const char *fname, long dtms, int allshm);
+
 long compute_nb_image();
 
 long compute_nb_variable();
@@ -90,6 +183,12 @@ long image_ID(const char *name);
 
 long image_ID_noaccessupdate(const char *name);
 
+long long COREMOD_MEMORY_image_ID_NBlookup();
+
+int_fast8_t COREMOD_MEMORY_image_pool(int mode);
+
+int_fast8_t COREMOD_MEMORY_set_lastaccess_update(int mode);
+
 long variable_ID(const char *name);
 
 long next_avail_image_ID();
@@ -108,6 +207,8 @@ long create_variable_string_ID(const char *name, const char *value);
 
 long create_image_ID(const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int nbkw);
 
+long create_image_ID_flags(const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw, uint16_t flags);
+
 int_fast8_t clearall();
 
 void *save_fits_function( void *ptr );
@@ -125,6 +226,9 @@ void *save_fits_function( void *ptr );
 /* =============================================================================================== */
 /* =============================================================================================== */
 
+long image_keyword_slot(long ID, const char *kname);
+IMAGE_KEYWORD *image_keyword_handle(const char *IDname, const char *kname, char type, const char *comment);
+
 long image_write_keyword_L(const char *IDname, const char *kname, long value, const char *comment);
 long image_write_keyword_D(const char *IDname, const char *kname, double value, const char *comment);
 long image_write_keyword_S(const char *IDname, const char *kname, const char *value, const char *comment);
@@ -317,6 +421,8 @@ long COREMOD_MEMORY_check_3Dsize(const char *IDname, uint32_t xsize, uint32_t ys
 
 int_fast8_t rotate_cube(const char *ID_name, const char *ID_out_name, int orientation);
 
+int rotate_cube_fits(const char *file_in, const char *file_out, int orientation, long MBmax);
+
 ///@}
 
 
@@ -355,12 +461,16 @@ long COREMOD_MEMORY_image_set_sempost(const char *IDname, long index);
 long COREMOD_MEMORY_image_set_sempost_byID(long ID, long index);
 long COREMOD_MEMORY_image_set_sempost_excl_byID(long ID, long index);
 
-long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long dtus);
+long COREMOD_MEMORY_image_set_sempost_loop(const char *IDname, long index, long dtus, int timingmode);
 long COREMOD_MEMORY_image_set_semwait(const char *IDname, long index);
 void *waitforsemID(void *ID);
 long COREMOD_MEMORY_image_set_semwait_OR_IDarray(long *IDarray, long NB_ID);
 long COREMOD_MEMORY_image_set_semflush_IDarray(long *IDarray, long NB_ID);
+STREAMWAITSET *COREMOD_MEMORY_streamwaitset_create(long *IDarray, int *priority, long NB_ID);
+long COREMOD_MEMORY_streamwaitset_wait(STREAMWAITSET *ws, long timeoutus, long *fired);
+int COREMOD_MEMORY_streamwaitset_free(STREAMWAITSET *ws);
 long COREMOD_MEMORY_image_set_semflush(const char *IDname, long index);
+long COREMOD_MEMORY_image_set_futex(const char *IDname, int mode);
 
 ///@}
 
@@ -399,6 +509,29 @@ long COREMOD_MEMORY_stream_halfimDiff(const char *IDstream_name, const char *IDs
 long COREMOD_MEMORY_streamAve(const char *IDstream_name, int NBave, int mode, const char *IDout_name);
 
 
+/** @brief Continuous per-pixel statistics (mean, variance, min, max, EWMA) of stream
+ * 
+ * @param[in]  IDstream_name        Input stream
+ * @param[in]  IDout_prefix         Output streams are <prefix>mean, <prefix>var, <prefix>min, <prefix>max, <prefix>ewma
+ * @param[in]  decimation           Number of input frames between output updates
+ * @param[in]  NBframes             Statistics window (reset every NBframes), 0 for cumulative
+ * @param[in]  ewmagain             EWMA gain
+ * 
+ */
+long COREMOD_MEMORY_streamStats(const char *IDstream_name, const char *IDout_prefix, long decimation, long NBframes, double ewmagain);
+
+
+/** @brief Run graph of stream operators in a single thread
+ * 
+ * Graph file declares source, diff, halfdiff, ave, delay nodes and publish statements, see COREMOD_memory.c.
+ * Intermediate frames stay in process memory, only published nodes are written to streams.
+ * 
+ * @param[in]  fname      graph file
+ * @param[in]  cpu        CPU to pin to, -1 for no pinning
+ */
+long COREMOD_MEMORY_streamGraph(const char *fname, int cpu);
+
+
 
 
 /**
@@ -439,18 +572,24 @@ long COREMOD_MEMORY_image_streamupdateloop_semtrig(const char *IDinname, const c
 
 
 
-long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus);
+long COREMOD_MEMORY_streamDelay(const char *IDin_name, const char *IDout_name, long delayus, long dtus, int interp);
 
 long COREMOD_MEMORY_SaveAll_snapshot(const char *dirname);
 
 long COREMOD_MEMORY_SaveAll_sequ(const char *dirname, const char *IDtrig_name, long semtrig, long NBframes);
 
+long COREMOD_MEMORY_SaveAll_sequ_async(const char *dirname, const char *IDtrig_name, long semtrig, long NBframes, long NBslot);
+
 
 
 long COREMOD_MEMORY_image_NETWORKtransmit(const char *IDname, const char *IPaddr, int port, int mode, int RT_priority);
 
 long COREMOD_MEMORY_image_NETWORKreceive(int port, int mode, int RT_priority);
 
+long COREMOD_MEMORY_image_NETWORKtransmit_multi(const char *IDnamelist, const char *IPaddr, int port, long batchus, int encode, int RT_priority);
+
+long COREMOD_MEMORY_image_NETWORKreceive_multi(int port, int RT_priority);
+
 
 
 long COREMOD_MEMORY_PixMapDecode_U(const char *inputstream_name, uint32_t xsizeim, uint32_t ysizeim, const char* NBpix_fname, const char* IDmap_name, const char *IDout_name, const char *IDout_pixslice_fname);
@@ -476,6 +615,16 @@ int_fast8_t COREMOD_MEMORY_logshim_set_on(const char *IDname, int setv);
 int_fast8_t COREMOD_MEMORY_logshim_set_logexit(const char *IDname, int setv);
 long COREMOD_MEMORY_sharedMem_2Dim_log(const char *IDname, uint32_t zsize, const char *logdir, const char *IDlogdata_name);
 
+long COREMOD_MEMORY_sharedMem_tlog(const char *IDname, uint32_t blocksize, const char *logdir, int compression, int cpu);
+
+long COREMOD_MEMORY_tlog_extract(const char *fname, double tstart, double tend, const char *IDout_name);
+
+ASYNCWRITER *COREMOD_MEMORY_asyncwriter_open(const char *fname, size_t recordsize, int NBslot);
+
+int COREMOD_MEMORY_asyncwriter_submit(ASYNCWRITER *aw, const void *ptr, size_t nbbyte);
+
+long COREMOD_MEMORY_asyncwriter_close(ASYNCWRITER *aw);
+
 ///@}
 
 
@@ -17,6 +17,7 @@
 #define _GNU_SOURCE
 
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <malloc.h>
 #include <stdio.h>
@@ -37,8 +38,18 @@
 #include <fcntl.h> // for open
 #include <unistd.h> // for close
 #include <errno.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <linux/magic.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#endif
 
 #include "ImageStruct.h"
+#include "ImageStreamIO.h"
 
 
 
@@ -178,7 +189,451 @@ int ImageStreamIO_createSem(IMAGE *image, long NBsem)
 
 
 
+/**
+ * @brief Size of one element [byte] for data type atype
+ */
+static size_t ImageStreamIO_typesize(uint8_t atype)
+{
+    switch (atype) {
+    case _DATATYPE_UINT8 :
+        return SIZEOF_DATATYPE_UINT8;
+    case _DATATYPE_INT8 :
+        return SIZEOF_DATATYPE_INT8;
+    case _DATATYPE_UINT16 :
+        return SIZEOF_DATATYPE_UINT16;
+    case _DATATYPE_INT16 :
+        return SIZEOF_DATATYPE_INT16;
+    case _DATATYPE_UINT32 :
+        return SIZEOF_DATATYPE_UINT32;
+    case _DATATYPE_INT32 :
+        return SIZEOF_DATATYPE_INT32;
+    case _DATATYPE_UINT64 :
+        return SIZEOF_DATATYPE_UINT64;
+    case _DATATYPE_INT64 :
+        return SIZEOF_DATATYPE_INT64;
+    case _DATATYPE_FLOAT :
+        return SIZEOF_DATATYPE_FLOAT;
+    case _DATATYPE_DOUBLE :
+        return SIZEOF_DATATYPE_DOUBLE;
+    case _DATATYPE_COMPLEX_FLOAT :
+        return SIZEOF_DATATYPE_COMPLEX_FLOAT;
+    case _DATATYPE_COMPLEX_DOUBLE :
+        return SIZEOF_DATATYPE_COMPLEX_DOUBLE;
+    case _DATATYPE_EVENT_UI8_UI8_UI16_UI8 :
+        return SIZEOF_DATATYPE_EVENT_UI8_UI8_UI16_UI8;
+    }
+    return 0;
+}
+
+
+
+/**
+ * @brief Offset [byte] of the ring buffer header from start of shared memory
+ * 
+ * Ring header follows metadata, data and keywords, rounded up to 64-byte boundary
+ */
+static size_t ImageStreamIO_ringoffset(uint64_t nelement, uint8_t atype, int NBkw)
+{
+    size_t offset;
+    
+    offset = sizeof(IMAGE_METADATA) + nelement*ImageStreamIO_typesize(atype) + NBkw*sizeof(IMAGE_KEYWORD);
+    offset = ((offset + 63)/64)*64;
+    
+    return offset;
+}
+
+
+
+
+
+/**
+ * @brief Offset [byte] of the latency instrumentation block from start of shared memory
+ * 
+ * Follows ring buffer header if any, 64-byte aligned
+ */
+static size_t ImageStreamIO_latencyoffset(uint64_t nelement, uint8_t atype, int NBkw, uint16_t flags)
+{
+    size_t offset;
+    
+    offset = ImageStreamIO_ringoffset(nelement, atype, NBkw);
+    if(flags & IMAGE_FLAG_RING)
+        offset += sizeof(IMAGE_RING);
+    offset = ((offset + 63)/64)*64;
+    
+    return offset;
+}
+
+
+
+
+
+/**
+ * @brief Offset [byte] of the view header from start of shared memory
+ * 
+ * View streams have no data block: header follows metadata and keywords, 64-byte aligned
+ */
+static size_t ImageStreamIO_viewoffset(int NBkw)
+{
+    size_t offset;
+    
+    offset = sizeof(IMAGE_METADATA) + NBkw*sizeof(IMAGE_KEYWORD);
+    offset = ((offset + 63)/64)*64;
+    
+    return offset;
+}
+
+
+
+
+
+/**
+ * @brief Shared memory file size of a stream with legacy (version 1) metadata layout
+ */
+static size_t ImageStreamIO_legacysize(IMAGE_METADATA_V1 *mdv1)
+{
+    return sizeof(IMAGE_METADATA_V1) + mdv1->nelement*ImageStreamIO_typesize(mdv1->atype) + mdv1->NBkw*sizeof(IMAGE_KEYWORD);
+}
+
+
+
+
+/**
+ * @brief Remove stream file, including hugetlbfs file if stream file is a symbolic link to it
+ */
+static void ImageStreamIO_removeshmfile(const char *SM_fname)
+{
+    struct stat lst;
+    
+    if(lstat(SM_fname, &lst) == 0)
+    {
+        if(S_ISLNK(lst.st_mode))
+        {
+            char HP_fname[200];
+            ssize_t n;
+            
+            n = readlink(SM_fname, HP_fname, 199);
+            if(n > 0)
+            {
+                HP_fname[n] = '\0';
+                remove(HP_fname);
+            }
+        }
+        remove(SM_fname);
+    }
+}
+
+
+
+/**
+ * @brief Create and map stream file on hugetlbfs
+ * 
+ * File is created in HUGEPAGEDIR, size rounded up to huge page size, and SHAREDMEMDIR/<name>.im.shm is a symbolic link to it.
+ * 
+ * @return file descriptor, -1 if hugetlbfs is not available (or no free huge page)
+ */
+static int ImageStreamIO_shmopen_hugetlbfs(const char *name, size_t *sharedsize, IMAGE_METADATA **map)
+{
+    int SM_fd = -1;
+#ifdef __linux__
+    char SM_fname[200];
+    char HP_fname[200];
+    struct statfs sfs;
+    size_t hpsize;
+    
+    sprintf(SM_fname, "%s/%s.im.shm", SHAREDMEMDIR, name);
+    sprintf(HP_fname, "%s/%s.im.shm", HUGEPAGEDIR, name);
+    
+    SM_fd = open(HP_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+    if(SM_fd == -1)
+        return -1;
+    
+    if((fstatfs(SM_fd, &sfs) != 0)||(sfs.f_type != HUGETLBFS_MAGIC))
+    {
+        close(SM_fd);
+        remove(HP_fname);
+        return -1;
+    }
+    
+    hpsize = (size_t) sfs.f_bsize;
+    *sharedsize = ((*sharedsize + hpsize - 1)/hpsize)*hpsize;
+    
+    if(ftruncate(SM_fd, *sharedsize) != 0)
+    {
+        close(SM_fd);
+        remove(HP_fname);
+        return -1;
+    }
+    
+    *map = (IMAGE_METADATA*) mmap(0, *sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+    if(*map == MAP_FAILED) // usually: not enough free huge pages
+    {
+        close(SM_fd);
+        remove(HP_fname);
+        return -1;
+    }
+    
+    remove(SM_fname);
+    if(symlink(HP_fname, SM_fname) != 0)
+    {
+        munmap(*map, *sharedsize);
+        close(SM_fd);
+        remove(HP_fname);
+        return -1;
+    }
+#endif
+
+    return SM_fd;
+}
+
+
+
+/* =============================================================================================== */
+/*                                                                                                 */
+/* LOCAL IMAGE POOL                                                                                */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+/*
+ * While pool mode is on (between ImageStreamIO_pool_begin() and ImageStreamIO_pool_end(), can be nested),
+ * data arrays of local images (>= IMAGE_POOL_MINSIZE byte) are allocated in power-of-two size classes,
+ * and kept for reuse when the image is deleted (up to IMAGE_POOL_NBBLOCK free blocks per size class).
+ * Reused blocks are already mapped, so creating a temporary image does not page fault.
+ * Free blocks are released when the outermost pool scope ends.
+ */
+
+#define POOL_NBCLASS 48
+
+static void *ImageStreamIO_pool_block[POOL_NBCLASS][IMAGE_POOL_NBBLOCK];
+static int ImageStreamIO_pool_NBblock[POOL_NBCLASS];
+static int ImageStreamIO_pool_depth = 0;
+static pthread_mutex_t ImageStreamIO_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static int ImageStreamIO_pool_class(size_t nbbyte)
+{
+    int c = 0;
+    
+    while( ((size_t) 1 << c) < nbbyte )
+        c++;
+    
+    return(c);
+}
+
+
+
+/**
+ * @brief Start pool scope for local images created from now on
+ */
+int ImageStreamIO_pool_begin()
+{
+    pthread_mutex_lock(&ImageStreamIO_pool_mutex);
+    ImageStreamIO_pool_depth++;
+    pthread_mutex_unlock(&ImageStreamIO_pool_mutex);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief End pool scope, frees pooled blocks not in use when outermost scope ends
+ * 
+ * Images created within the scope remain valid, their arrays are freed on deletion.
+ */
+int ImageStreamIO_pool_end()
+{
+    int c, b;
+    
+    pthread_mutex_lock(&ImageStreamIO_pool_mutex);
+    if(ImageStreamIO_pool_depth > 0)
+        ImageStreamIO_pool_depth--;
+    if(ImageStreamIO_pool_depth == 0)
+    {
+        for(c=0; c<POOL_NBCLASS; c++)
+        {
+            for(b=0; b<ImageStreamIO_pool_NBblock[c]; b++)
+                free(ImageStreamIO_pool_block[c][b]);
+            ImageStreamIO_pool_NBblock[c] = 0;
+        }
+    }
+    pthread_mutex_unlock(&ImageStreamIO_pool_mutex);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Allocate local image data array
+ * 
+ * Allocates from pool if pool mode is on (and sets IMAGE_FLAG_POOL in flags).\n
+ * Array is zeroed unless IMAGE_FLAG_NOZERO is set in flags.
+ */
+static void *ImageStreamIO_arrayalloc(uint64_t nelement, size_t typesize, uint16_t *flags)
+{
+    size_t nbbyte = (size_t) nelement * typesize;
+    void *ptr = NULL;
+    int zero = ( (*flags & IMAGE_FLAG_NOZERO) == 0 );
+    
+    pthread_mutex_lock(&ImageStreamIO_pool_mutex);
+    if( (ImageStreamIO_pool_depth > 0) && (nbbyte >= IMAGE_POOL_MINSIZE) )
+    {
+        int c = ImageStreamIO_pool_class(nbbyte);
+        
+        *flags |= IMAGE_FLAG_POOL;
+        if(ImageStreamIO_pool_NBblock[c] > 0)
+        {
+            ImageStreamIO_pool_NBblock[c]--;
+            ptr = ImageStreamIO_pool_block[c][ImageStreamIO_pool_NBblock[c]];
+            pthread_mutex_unlock(&ImageStreamIO_pool_mutex);
+            if(zero)
+                memset(ptr, 0, nbbyte);
+            return(ptr);
+        }
+        nbbyte = (size_t) 1 << c;
+    }
+    else
+        *flags &= ~IMAGE_FLAG_POOL;
+    pthread_mutex_unlock(&ImageStreamIO_pool_mutex);
+    
+    if(zero)
+        ptr = calloc(nbbyte, 1);
+    else
+        ptr = malloc(nbbyte);
+    
+    return(ptr);
+}
+
+
+
+/**
+ * @brief Free local image data array
+ * 
+ * Pooled arrays are kept for reuse while pool mode is on.
+ */
+int ImageStreamIO_arrayfree(IMAGE *image)
+{
+    void *ptr = (void*) image->array.UI8;
+    
+    if( image->md[0].flags & IMAGE_FLAG_MMAP )
+    {
+        // mapping starts at page boundary below array
+        size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+        size_t delta = (size_t) ((uintptr_t) ptr % pagesize);
+        
+        munmap((char*) ptr - delta, delta + (size_t) image->md[0].nelement * ImageStreamIO_typesize(image->md[0].atype));
+        image->md[0].flags &= ~IMAGE_FLAG_MMAP;
+        image->array.UI8 = NULL;
+        return(0);
+    }
+    
+    if( image->md[0].flags & IMAGE_FLAG_POOL )
+    {
+        int c = ImageStreamIO_pool_class( (size_t) image->md[0].nelement * ImageStreamIO_typesize(image->md[0].atype) );
+        
+        pthread_mutex_lock(&ImageStreamIO_pool_mutex);
+        if( (ImageStreamIO_pool_depth > 0) && (ImageStreamIO_pool_NBblock[c] < IMAGE_POOL_NBBLOCK) )
+        {
+            ImageStreamIO_pool_block[c][ImageStreamIO_pool_NBblock[c]] = ptr;
+            ImageStreamIO_pool_NBblock[c]++;
+            ptr = NULL;
+        }
+        pthread_mutex_unlock(&ImageStreamIO_pool_mutex);
+    }
+    free(ptr);
+    image->array.UI8 = NULL;
+    
+    return(0);
+}
+
+
+
+
+
+
+
+
+/**
+ * @brief Replace local image data array by private (copy-on-write) mapping of file region
+ * 
+ * Data at byte offset in file descriptor fd is used in place, in file byte order.\n
+ * Mapping is released by ImageStreamIO_arrayfree.
+ * 
+ * @return 0 if OK, -1 if failed (array unchanged)
+ */
+int ImageStreamIO_arraymap(IMAGE *image, int fd, off_t offset)
+{
+    size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t delta = (size_t) (offset % pagesize);
+    size_t nbbyte = (size_t) image->md[0].nelement * ImageStreamIO_typesize(image->md[0].atype);
+    char *map;
+    
+    if(image->md[0].shared == 1)
+        return(-1);
+    
+    map = (char*) mmap(NULL, delta + nbbyte, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset - delta);
+    if(map == MAP_FAILED)
+        return(-1);
+    madvise(map, delta + nbbyte, MADV_SEQUENTIAL);
+    
+    ImageStreamIO_arrayfree(image);
+    image->array.UI8 = (uint8_t*) (map + delta);
+    image->md[0].flags &= ~IMAGE_FLAG_POOL;
+    image->md[0].flags |= IMAGE_FLAG_MMAP;
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Bind mapped memory to NUMA node
+ * 
+ * Must be called before memory is first touched
+ * 
+ * @return 0 if OK, -1 if failed
+ */
+static int ImageStreamIO_numabind(void *map, size_t sharedsize, int node)
+{
+#ifdef __linux__
+    unsigned long nodemask[4] = {0, 0, 0, 0};
+    
+    if((node < 0)||(node >= (int) (sizeof(nodemask)*8)))
+        return -1;
+    
+    nodemask[node/(8*sizeof(unsigned long))] = 1UL << (node%(8*sizeof(unsigned long)));
+    if(syscall(SYS_mbind, map, sharedsize, MPOL_BIND, nodemask, (unsigned long) (sizeof(nodemask)*8), MPOL_MF_MOVE) == 0)
+        return 0;
+#endif
+
+    return -1;
+}
+
+
+
+
+
 int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw)
+{
+    return ImageStreamIO_createIm_flags(image, name, naxis, size, atype, shared, NBkw, 0);
+}
+
+
+
+
+/**
+ * @brief Create image with creation flags
+ * 
+ * flags (IMAGE_FLAG_*) :
+ * - IMAGE_FLAG_RING : ring buffer, size[2] slots of size[0] x size[1] frames, requires naxis = 3 and size[2] > 1
+ * - IMAGE_FLAG_HUGEPAGE : (shared only) place stream on hugetlbfs (HUGEPAGEDIR), fall back to transparent huge pages
+ * - IMAGE_FLAG_NUMANODE(node) : (shared only) bind stream memory to NUMA node
+ * 
+ * Resulting placement is written in md[0].hugepage and md[0].numanode
+ * 
+ */
+int ImageStreamIO_createIm_flags(IMAGE *image, const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw, uint16_t flags)
 {
     long i,ii;
     time_t lt;
@@ -198,6 +653,15 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
     for(i=0; i<naxis; i++)
         nelement*=size[i];
 
+    if(flags & IMAGE_FLAG_RING)
+    {
+        if((naxis != 3)||(size[2] < 2))
+        {
+            ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"ring buffer requires naxis = 3 and at least 2 slots");
+            exit(0);
+        }
+    }
+
     // compute total size to be allocated
     if(shared==1)
     {
@@ -254,54 +718,100 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
         if(atype == _DATATYPE_COMPLEX_DOUBLE)
             sharedsize += nelement*SIZEOF_DATATYPE_COMPLEX_DOUBLE;
 
+        if(atype == _DATATYPE_EVENT_UI8_UI8_UI16_UI8)
+            sharedsize += nelement*SIZEOF_DATATYPE_EVENT_UI8_UI8_UI16_UI8;
+
 
         sharedsize += NBkw*sizeof(IMAGE_KEYWORD);
 
+        if(flags & IMAGE_FLAG_RING)
+            sharedsize = ImageStreamIO_ringoffset(nelement, atype, NBkw) + sizeof(IMAGE_RING);
+        if(flags & IMAGE_FLAG_LATENCY)
+            sharedsize = ImageStreamIO_latencyoffset(nelement, atype, NBkw, flags) + sizeof(IMAGE_LATENCY);
+
 		char SM_fname[200];
         sprintf(SM_fname, "%s/%s.im.shm", SHAREDMEMDIR, name);    
-        int SM_fd; // shared memory file descriptor
-        SM_fd = open(SM_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
-        if (SM_fd == -1) {
-            perror("Error opening file for writing");
-            exit(0);
+        int SM_fd = -1; // shared memory file descriptor
+        uint8_t hugepage = 0;
+        int8_t numanode = -1;
+
+        // previous stream may have been on hugetlbfs
+        struct stat lst;
+        if((lstat(SM_fname, &lst) == 0) && S_ISLNK(lst.st_mode))
+            ImageStreamIO_removeshmfile(SM_fname);
+
+        if(flags & IMAGE_FLAG_HUGEPAGE)
+        {
+            SM_fd = ImageStreamIO_shmopen_hugetlbfs(name, &sharedsize, &map);
+            if(SM_fd != -1)
+                hugepage = 2;
+            else
+                printf("hugetlbfs not available for %s, using transparent huge pages\n", name);
         }
 
+        if(SM_fd == -1)
+        {
+            SM_fd = open(SM_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+            if (SM_fd == -1) {
+                perror("Error opening file for writing");
+                exit(0);
+            }
 
+            int result;
+            result = lseek(SM_fd, sharedsize-1, SEEK_SET);
+            if (result == -1) {
+                close(SM_fd);
+                ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"Error calling lseek() to 'stretch' the file");
+                exit(0);
+            }
 
+            result = write(SM_fd, "", 1);
+            if (result != 1) {
+                close(SM_fd);
+                perror("Error writing last byte of the file");
+                exit(0);
+            }
 
-        image->shmfd = SM_fd;
-        image->memsize = sharedsize;
+            map = (IMAGE_METADATA*) mmap(0, sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+            if (map == MAP_FAILED) {
+                close(SM_fd);
+                perror("Error mmapping the file");
+                exit(0);
+            }
 
-		int result;
-        result = lseek(SM_fd, sharedsize-1, SEEK_SET);
-        if (result == -1) {
-            close(SM_fd);
-            ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"Error calling lseek() to 'stretch' the file");
-            exit(0);
+#ifdef MADV_HUGEPAGE
+            if(flags & IMAGE_FLAG_HUGEPAGE)
+                if(madvise(map, sharedsize, MADV_HUGEPAGE) == 0)
+                    hugepage = 1;
+#endif
         }
 
-        result = write(SM_fd, "", 1);
-        if (result != 1) {
-            close(SM_fd);
-            perror("Error writing last byte of the file");
-            exit(0);
+        // NUMA binding, before memory is touched
+        if(flags & IMAGE_FLAG_NUMA)
+        {
+            int node = (flags >> 8) & 0xff;
+            
+            if(ImageStreamIO_numabind(map, sharedsize, node) == 0)
+                numanode = (int8_t) node;
+            else
+                printf("WARNING: could not bind %s to NUMA node %d\n", name, node);
         }
 
-        map = (IMAGE_METADATA*) mmap(0, sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-        if (map == MAP_FAILED) {
-            close(SM_fd);
-            perror("Error mmapping the file");
-            exit(0);
-        }
+        image->shmfd = SM_fd;
+        image->memsize = sharedsize;
 
         image->md = (IMAGE_METADATA*) map;
         image->md[0].shared = 1;
         image->md[0].sem = 0;
+        image->md[0].hugepage = hugepage;
+        image->md[0].numanode = numanode;
     }
     else
     {
         image->md = (IMAGE_METADATA*) malloc(sizeof(IMAGE_METADATA));
         image->md[0].shared = 0;
+        image->md[0].hugepage = 0;
+        image->md[0].numanode = -1;
         if(NBkw>0)
             image->kw = (IMAGE_KEYWORD*) malloc(sizeof(IMAGE_KEYWORD)*NBkw);
         else
@@ -330,7 +840,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
 		}
         else
-            image->array.UI8 = (uint8_t*) calloc ((size_t) nelement, sizeof(uint8_t));
+            image->array.UI8 = (uint8_t*) ImageStreamIO_arrayalloc(nelement, sizeof(uint8_t), &flags);
 
 
         if(image->array.UI8 == NULL)
@@ -361,7 +871,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
 		}
         else
-            image->array.SI8 = (int8_t*) calloc ((size_t) nelement, sizeof(int8_t));
+            image->array.SI8 = (int8_t*) ImageStreamIO_arrayalloc(nelement, sizeof(int8_t), &flags);
 
 
         if(image->array.SI8 == NULL)
@@ -394,7 +904,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.UI16 = (uint16_t*) calloc ((size_t) nelement, sizeof(uint16_t));
+            image->array.UI16 = (uint16_t*) ImageStreamIO_arrayalloc(nelement, sizeof(uint16_t), &flags);
 
         if(image->array.UI16 == NULL)
         {
@@ -424,7 +934,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.SI16 = (int16_t*) calloc ((size_t) nelement, sizeof(int16_t));
+            image->array.SI16 = (int16_t*) ImageStreamIO_arrayalloc(nelement, sizeof(int16_t), &flags);
 
         if(image->array.SI16 == NULL)
         {
@@ -455,7 +965,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.UI32 = (uint32_t*) calloc ((size_t) nelement, sizeof(uint32_t));
+            image->array.UI32 = (uint32_t*) ImageStreamIO_arrayalloc(nelement, sizeof(uint32_t), &flags);
 
         if(image->array.UI32 == NULL)
         {
@@ -487,7 +997,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.SI32 = (int32_t*) calloc ((size_t) nelement, sizeof(int32_t));
+            image->array.SI32 = (int32_t*) ImageStreamIO_arrayalloc(nelement, sizeof(int32_t), &flags);
 
         if(image->array.SI32 == NULL)
         {
@@ -519,7 +1029,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.UI64 = (uint64_t*) calloc ((size_t) nelement, sizeof(uint64_t));
+            image->array.UI64 = (uint64_t*) ImageStreamIO_arrayalloc(nelement, sizeof(uint64_t), &flags);
 
         if(image->array.SI64 == NULL)
         {
@@ -549,7 +1059,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.SI64 = (int64_t*) calloc ((size_t) nelement, sizeof(int64_t));
+            image->array.SI64 = (int64_t*) ImageStreamIO_arrayalloc(nelement, sizeof(int64_t), &flags);
 
         if(image->array.SI64 == NULL)
         {
@@ -579,7 +1089,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.F = (float*) calloc ((size_t) nelement, sizeof(float));
+            image->array.F = (float*) ImageStreamIO_arrayalloc(nelement, sizeof(float), &flags);
 
         if(image->array.F == NULL)
         {
@@ -609,7 +1119,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.D = (double*) calloc ((size_t) nelement, sizeof(double));
+            image->array.D = (double*) ImageStreamIO_arrayalloc(nelement, sizeof(double), &flags);
   
         if(image->array.D == NULL)
         {
@@ -639,7 +1149,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.CF = (complex_float*) calloc ((size_t) nelement, sizeof(complex_float));
+            image->array.CF = (complex_float*) ImageStreamIO_arrayalloc(nelement, sizeof(complex_float), &flags);
 
         if(image->array.CF == NULL)
         {
@@ -669,7 +1179,7 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
             image->kw = (IMAGE_KEYWORD*) (mapv);
         }
         else
-            image->array.CD = (complex_double*) calloc ((size_t) nelement,sizeof(complex_double));
+            image->array.CD = (complex_double*) ImageStreamIO_arrayalloc(nelement, sizeof(complex_double), &flags);
 
         if(image->array.CD == NULL)
         {
@@ -687,16 +1197,91 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
         }
     }
 
+    if(atype == _DATATYPE_EVENT_UI8_UI8_UI16_UI8)
+    {
+        if(shared==1)
+        {
+			mapv = (char*) map;
+			mapv += sizeof(IMAGE_METADATA);
+			image->array.event1121 = (EVENT_UI8_UI8_UI16_UI8*) (mapv);
+            memset(image->array.event1121, '\0', nelement*sizeof(EVENT_UI8_UI8_UI16_UI8));
+            mapv += sizeof(EVENT_UI8_UI8_UI16_UI8)*nelement;
+            image->kw = (IMAGE_KEYWORD*) (mapv);
+        }
+        else
+            image->array.event1121 = (EVENT_UI8_UI8_UI16_UI8*) ImageStreamIO_arrayalloc(nelement, sizeof(EVENT_UI8_UI8_UI16_UI8), &flags);
 
-
-
-    clock_gettime(CLOCK_REALTIME, &timenow);
-    image->md[0].last_access = 1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec;
+        if(image->array.event1121 == NULL)
+        {
+            ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"memory allocation failed");
+            fprintf(stderr,"%c[%d;%dm", (char) 27, 1, 31);
+            fprintf(stderr,"Image name = %s\n",name);
+            fprintf(stderr,"Requested memory size = %ld events = %f Mb\n", (long) nelement,1.0/1024/1024*nelement*sizeof(EVENT_UI8_UI8_UI16_UI8));
+            fprintf(stderr," %c[%d;m",(char) 27, 0);
+            exit(0);
+        }
+    }
+
+
+
+
+    clock_gettime(CLOCK_REALTIME, &timenow);
+    image->md[0].last_access = 1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec;
     image->md[0].creation_time = image->md[0].last_access;
     image->md[0].write = 0;
     image->md[0].cnt0 = 0;
     image->md[0].cnt1 = 0;
     image->md[0].nelement = nelement;
+    image->md[0].futex = 0;
+    image->md[0].futexwaiters = 0;
+    image->md[0].wseq = 0;
+    image->md[0].flags = flags;
+    image->md[0].version = IMAGE_METADATA_VERSION;
+
+    image->mdlegacy = NULL;
+    image->viewparent = NULL;
+    image->ring = NULL;
+    if(flags & IMAGE_FLAG_RING)
+    {
+        if(shared==1)
+        {
+            mapv = (char*) map;
+            mapv += ImageStreamIO_ringoffset(nelement, atype, NBkw);
+            image->ring = (IMAGE_RING*) (mapv);
+            memset(image->ring, '\0', sizeof(IMAGE_RING));
+        }
+        else
+            image->ring = (IMAGE_RING*) calloc(1, sizeof(IMAGE_RING));
+            
+        if(image->ring == NULL)
+        {
+            ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"ring buffer allocation failed");
+            exit(0);
+        }
+        image->ring->NBslot = size[2];
+        image->ring->framesize = ImageStreamIO_typesize(atype)*size[0]*size[1];
+        image->ring->writeindex = 0;
+    }
+
+    image->latency = NULL;
+    if(flags & IMAGE_FLAG_LATENCY)
+    {
+        if(shared==1)
+        {
+            mapv = (char*) map;
+            mapv += ImageStreamIO_latencyoffset(nelement, atype, NBkw, flags);
+            image->latency = (IMAGE_LATENCY*) (mapv);
+            memset(image->latency, '\0', sizeof(IMAGE_LATENCY));
+        }
+        else
+            image->latency = (IMAGE_LATENCY*) calloc(1, sizeof(IMAGE_LATENCY));
+        
+        if(image->latency == NULL)
+        {
+            ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"latency block allocation failed");
+            exit(0);
+        }
+    }
 
     if(shared==1)
         ImageStreamIO_createSem(image, 10); // by default, create 10 semaphores
@@ -722,17 +1307,295 @@ int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t
 
 
 
+/* =============================================================================================== */
+/*                                                                                                 */
+/* MAPPING CACHE                                                                                   */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+/*
+ * Process-wide cache of stream mappings, keyed by shared memory file name and inode.
+ * Attaching to a stream that is already mapped (same file, same inode and size) reuses the mapping and file descriptor.
+ * A stream file recreated by its writer has a new inode: the next attach maps the new file, the old mapping
+ * stays valid for images still using it and is unmapped when its last user releases it (ImageStreamIO_shmrelease).
+ */
+
+#define SHMCACHE_MAX 1000
+
+typedef struct
+{
+    char    fname[200];     // shared memory file name, empty if entry is stale or unused
+    dev_t   dev;
+    ino_t   ino;
+    size_t  size;
+    void   *map;            // NULL if entry unused
+    int     fd;
+    int     refcnt;         // number of IMAGE structures using mapping
+} SHMCACHE_ENTRY;
+
+static SHMCACHE_ENTRY ImageStreamIO_shmcache[SHMCACHE_MAX];
+static pthread_mutex_t ImageStreamIO_shmcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+/**
+ * @brief Look up a mapping of an unchanged stream file, increments its reference count
+ * 
+ * @return cache index, -1 if not cached (or file changed)
+ */
+static int ImageStreamIO_shmcache_lookup(const char *SM_fname)
+{
+    struct stat file_stat;
+    int i;
+    int index = -1;
+    
+    if(stat(SM_fname, &file_stat) == -1)
+        return(-1);
+    
+    pthread_mutex_lock(&ImageStreamIO_shmcache_mutex);
+    for(i=0; i<SHMCACHE_MAX; i++)
+    {
+        SHMCACHE_ENTRY *entry = &ImageStreamIO_shmcache[i];
+        
+        if( (entry->map != NULL) && (strcmp(entry->fname, SM_fname) == 0) )
+        {
+            if( (entry->dev == file_stat.st_dev) && (entry->ino == file_stat.st_ino) && (entry->size == (size_t) file_stat.st_size) )
+            {
+                entry->refcnt++;
+                index = i;
+            }
+            else
+                entry->fname[0] = '\0'; // file recreated: entry is stale
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ImageStreamIO_shmcache_mutex);
+    
+    return(index);
+}
+
+
+
+
+/**
+ * @brief Add new mapping to cache with reference count 1
+ * 
+ * @return cache index, -1 if cache is full (mapping is then not cached)
+ */
+static int ImageStreamIO_shmcache_insert(const char *SM_fname, struct stat *file_stat, void *map, int fd)
+{
+    int i;
+    int index = -1;
+    
+    pthread_mutex_lock(&ImageStreamIO_shmcache_mutex);
+    for(i=0; i<SHMCACHE_MAX; i++)
+    {
+        SHMCACHE_ENTRY *entry = &ImageStreamIO_shmcache[i];
+        
+        if( (entry->map != NULL) && (strcmp(entry->fname, SM_fname) == 0) )
+            entry->fname[0] = '\0';
+        if( (index == -1) && (entry->map == NULL) )
+            index = i;
+    }
+    if(index != -1)
+    {
+        SHMCACHE_ENTRY *entry = &ImageStreamIO_shmcache[index];
+        
+        strncpy(entry->fname, SM_fname, 199);
+        entry->fname[199] = '\0';
+        entry->dev = file_stat->st_dev;
+        entry->ino = file_stat->st_ino;
+        entry->size = file_stat->st_size;
+        entry->map = map;
+        entry->fd = fd;
+        entry->refcnt = 1;
+    }
+    pthread_mutex_unlock(&ImageStreamIO_shmcache_mutex);
+    
+    return(index);
+}
+
+
+
+
+/**
+ * @brief Release shared memory mapping of an image
+ * 
+ * Mapping is unmapped and file descriptor closed when no other image in the process uses it.\n
+ * For legacy metadata streams, also frees local metadata copy.
+ */
+int ImageStreamIO_shmrelease(IMAGE *image)
+{
+    void *map;
+    int i;
+    int cached = 0;
+    int unmap = 1;
+    
+    if(image->mdlegacy != NULL)
+    {
+        map = (void*) image->mdlegacy;
+        free(image->md);
+        image->mdlegacy = NULL;
+    }
+    else
+        map = (void*) image->md;
+    
+    pthread_mutex_lock(&ImageStreamIO_shmcache_mutex);
+    for(i=0; i<SHMCACHE_MAX; i++)
+    {
+        SHMCACHE_ENTRY *entry = &ImageStreamIO_shmcache[i];
+        
+        if( (entry->map != NULL) && (entry->map == map) )
+        {
+            cached = 1;
+            entry->refcnt--;
+            if(entry->refcnt > 0)
+                unmap = 0;
+            else
+            {
+                entry->map = NULL;
+                entry->fname[0] = '\0';
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ImageStreamIO_shmcache_mutex);
+    
+    if(unmap == 1)
+    {
+        if (munmap(map, image->memsize) == -1) {
+            printf("unmapping %s : %p  %ld\n", image->name, map, (long) image->memsize);
+            perror("Error un-mmapping the file");
+        }
+        close(image->shmfd);
+    }
+    else if(cached == 0)
+        close(image->shmfd);
+    
+    if(image->viewparent != NULL)
+    {
+        ImageStreamIO_shmrelease((IMAGE*) image->viewparent);
+        free(image->viewparent);
+        image->viewparent = NULL;
+    }
+    
+    image->md = NULL;
+    image->kw = NULL;
+    image->ring = NULL;
+    image->latency = NULL;
+    image->shmfd = -1;
+    image->memsize = 0;
+    
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Check if the shared memory file of an attached stream is unchanged
+ * 
+ * @return 1 if file has the same inode and size as the mapping, 0 otherwise (stream was re-created or removed)
+ */
+int ImageStreamIO_shmunchanged(IMAGE *image)
+{
+    struct stat file_stat;
+    char SM_fname[200];
+    void *map;
+    int i;
+    int unchanged = 0;
+    
+    if(image->md == NULL)
+        return(0);
+    map = (image->mdlegacy != NULL) ? (void*) image->mdlegacy : (void*) image->md;
+    
+    sprintf(SM_fname, "%s/%s.im.shm", SHAREDMEMDIR, image->md[0].name);
+    if(stat(SM_fname, &file_stat) == -1)
+        return(0);
+    
+    pthread_mutex_lock(&ImageStreamIO_shmcache_mutex);
+    for(i=0; i<SHMCACHE_MAX; i++)
+    {
+        SHMCACHE_ENTRY *entry = &ImageStreamIO_shmcache[i];
+        
+        if( (entry->map != NULL) && (entry->map == map) )
+        {
+            if( (entry->dev == file_stat.st_dev) && (entry->ino == file_stat.st_ino) && (entry->size == (size_t) file_stat.st_size) )
+                unchanged = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ImageStreamIO_shmcache_mutex);
+    
+    // a view is stale if its parent was re-created
+    if( (unchanged == 1) && (image->viewparent != NULL) )
+        unchanged = ImageStreamIO_shmunchanged((IMAGE*) image->viewparent);
+    
+    return(unchanged);
+}
+
+
+
+
+
+
+
+
+/**
+ * @brief Attach view stream to its parent
+ * 
+ * Imports parent stream named in view header and points view array into parent data
+ */
+static int ImageStreamIO_viewattach(IMAGE *image)
+{
+    IMAGE_VIEW *view;
+    IMAGE *parent;
+    
+    view = (IMAGE_VIEW*) ((char*) image->md + ImageStreamIO_viewoffset(image->md[0].NBkw));
+    
+    parent = (IMAGE*) calloc(1, sizeof(IMAGE));
+    if(ImageStreamIO_read_sharedmem_image_toIMAGE(view->parent, parent) == -1)
+    {
+        printf("ERROR: view %s : cannot import parent stream %s\n", image->md[0].name, view->parent);
+        free(parent);
+        return(-1);
+    }
+    
+    if( (parent->md[0].atype != image->md[0].atype) || (view->offset + image->md[0].nelement > parent->md[0].nelement) )
+    {
+        printf("ERROR: view %s does not fit in parent stream %s\n", image->md[0].name, view->parent);
+        ImageStreamIO_shmrelease(parent);
+        free(parent);
+        return(-1);
+    }
+    
+    parent->used = 1;
+    image->viewparent = (void*) parent;
+    image->array.UI8 = parent->array.UI8 + view->offset*ImageStreamIO_typesize(image->md[0].atype);
+    
+    return(0);
+}
+
+
+
+
 long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 {
     int SM_fd;
     char SM_fname[200];    
 	int rval = -1;
+	int cacheindex;
 
 
 
     sprintf(SM_fname, "%s/%s.im.shm", SHAREDMEMDIR, name);
 
-    SM_fd = open(SM_fname, O_RDWR);
+    cacheindex = ImageStreamIO_shmcache_lookup(SM_fname);
+    if(cacheindex != -1)
+        SM_fd = ImageStreamIO_shmcache[cacheindex].fd;
+    else
+        SM_fd = open(SM_fname, O_RDWR);
     if(SM_fd==-1)
     {
         image->used = 0;
@@ -752,18 +1615,24 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 		
 		rval = 0; // we assume by default success
 		
-        fstat(SM_fd, &file_stat);
-        printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
-
-
-
-
-        map = (IMAGE_METADATA*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
-        if (map == MAP_FAILED) {
-            close(SM_fd);
-            perror("Error mmapping the file");
-            rval = -1;
-            exit(0);
+        if(cacheindex != -1) // stream unchanged since last attach: reuse mapping
+        {
+            file_stat.st_size = ImageStreamIO_shmcache[cacheindex].size;
+            map = (IMAGE_METADATA*) ImageStreamIO_shmcache[cacheindex].map;
+            printf("File %s size: %zd (already mapped)\n", SM_fname, file_stat.st_size);
+        }
+        else
+        {
+            fstat(SM_fd, &file_stat);
+            printf("File %s size: %zd\n", SM_fname, file_stat.st_size);
+
+            map = (IMAGE_METADATA*) mmap(0, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+            if (map == MAP_FAILED) {
+                close(SM_fd);
+                perror("Error mmapping the file");
+                rval = -1;
+                exit(0);
+            }
         }
 
 
@@ -775,6 +1644,46 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 
 
         image->md = map;
+        image->mdlegacy = NULL;
+        if(cacheindex == -1)
+            ImageStreamIO_shmcache_insert(SM_fname, &file_stat, (void*) map, SM_fd);
+        
+        if( (file_stat.st_size < sizeof(IMAGE_METADATA)) || (map->version != IMAGE_METADATA_VERSION) )
+        {
+            // compatibility shim: stream created with legacy (version 1) metadata layout
+            IMAGE_METADATA_V1 *mdv1 = (IMAGE_METADATA_V1*) map;
+            
+            if( ImageStreamIO_legacysize(mdv1) != file_stat.st_size )
+            {
+                printf("ERROR: shared memory file %s : unknown metadata layout (version %d)\n", SM_fname, (int) map->version);
+                image->memsize = file_stat.st_size;
+                image->shmfd = SM_fd;
+                ImageStreamIO_shmrelease(image);
+                image->used = 0;
+                return(-1);
+            }
+            
+            printf("Stream %s uses legacy metadata layout (version 1)\n", name);
+            image->mdlegacy = mdv1;
+            image->md = (IMAGE_METADATA*) calloc(1, sizeof(IMAGE_METADATA));
+            strncpy(image->md[0].name, mdv1->name, 80);
+            image->md[0].naxis = mdv1->naxis;
+            image->md[0].size[0] = mdv1->size[0];
+            image->md[0].size[1] = mdv1->size[1];
+            image->md[0].size[2] = mdv1->size[2];
+            image->md[0].nelement = mdv1->nelement;
+            image->md[0].atype = mdv1->atype;
+            image->md[0].creation_time = mdv1->creation_time;
+            image->md[0].last_access = mdv1->last_access;
+            image->md[0].sem = mdv1->sem;
+            image->md[0].NBkw = mdv1->NBkw;
+            image->md[0].flags = 0;
+            image->md[0].hugepage = 0;
+            image->md[0].numanode = -1;
+            image->md[0].futex = 0;
+            image->md[0].version = 1;
+            ImageStreamIO_legacy_pull(image);
+        }
 
 		uint8_t atype;
         atype = image->md[0].atype;
@@ -806,7 +1715,10 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 
 		char *mapv;
         mapv = (char*) map;
-        mapv += sizeof(IMAGE_METADATA);
+        if(image->mdlegacy != NULL)
+            mapv += sizeof(IMAGE_METADATA_V1);
+        else
+            mapv += sizeof(IMAGE_METADATA);
 
 
 
@@ -897,6 +1809,13 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
             mapv += SIZEOF_DATATYPE_COMPLEX_DOUBLE * image->md[0].nelement;
         }
 
+        if(atype == _DATATYPE_EVENT_UI8_UI8_UI16_UI8)
+        {
+            printf("atype = EVENT_UI8_UI8_UI16_UI8\n");
+            image->array.event1121 = (EVENT_UI8_UI8_UI16_UI8*) mapv;
+            mapv += SIZEOF_DATATYPE_EVENT_UI8_UI8_UI16_UI8 * image->md[0].nelement;
+        }
+
 
 
         printf("%ld keywords\n", (long) image->md[0].NBkw);
@@ -904,6 +1823,36 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 
         image->kw = (IMAGE_KEYWORD*) (mapv);
 
+        image->viewparent = NULL;
+        if( (image->mdlegacy == NULL) && (image->md[0].flags & IMAGE_FLAG_VIEW) )
+        {
+            // no data block: keywords follow metadata, array points into parent
+            image->kw = (IMAGE_KEYWORD*) ((char*) map + sizeof(IMAGE_METADATA));
+            if(ImageStreamIO_viewattach(image) == -1)
+            {
+                ImageStreamIO_shmrelease(image);
+                image->used = 0;
+                return(-1);
+            }
+        }
+
+        image->ring = NULL;
+        if(image->md[0].flags & IMAGE_FLAG_RING)
+        {
+            mapv = (char*) map;
+            mapv += ImageStreamIO_ringoffset(image->md[0].nelement, atype, image->md[0].NBkw);
+            image->ring = (IMAGE_RING*) (mapv);
+            printf("ring buffer: %ld slots, write index = %ld\n", (long) image->ring->NBslot, (long) image->ring->writeindex);
+        }
+
+        image->latency = NULL;
+        if(image->md[0].flags & IMAGE_FLAG_LATENCY)
+        {
+            mapv = (char*) map;
+            mapv += ImageStreamIO_latencyoffset(image->md[0].nelement, atype, image->md[0].NBkw, image->md[0].flags);
+            image->latency = (IMAGE_LATENCY*) (mapv);
+        }
+
 		int kw;
         for(kw=0; kw<image->md[0].NBkw; kw++)
         {
@@ -980,11 +1929,943 @@ long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image)
 
 
 
+/* =============================================================================================== */
+/*                                                                                                 */
+/* VIEW STREAMS                                                                                    */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+/*
+ * A view stream exposes a contiguous region of a parent stream (z-slice range, full-row band, reshape) without copying data.
+ * The view shared memory file holds metadata, keywords and the view header (IMAGE_VIEW); readers importing the view
+ * (ImageStreamIO_read_sharedmem_image_toIMAGE) also attach the parent and read its data in place.
+ * The view has its own counters and semaphores: a relay process calls ImageStreamIO_view_update() after each parent update.
+ */
+
+
 
+/**
+ * @brief Create view stream on a parent stream
+ * 
+ * @param[out] image      view stream
+ * @param[in]  name       view stream name
+ * @param[in]  parentname parent stream name (shared memory)
+ * @param[in]  offset     offset into parent data [element]
+ * @param[in]  naxis      view number of axis
+ * @param[in]  size       view axis sizes
+ * @param[in]  NBkw       number of keywords
+ * 
+ * @return 0 on success, -1 if parent cannot be imported or the view does not fit in parent data
+ */
+int ImageStreamIO_createView(IMAGE *image, const char *name, const char *parentname, uint64_t offset, long naxis, uint32_t *size, int NBkw)
+{
+    IMAGE *parent;
+    uint64_t nelement;
+    long i;
+    char sname[200];
+    char SM_fname[200];
+    size_t sharedsize;
+    int SM_fd;
+    IMAGE_METADATA *map;
+    IMAGE_VIEW *view;
+    struct timespec timenow;
+    int kw;
+    
+    
+    nelement = 1;
+    for(i=0; i<naxis; i++)
+        nelement *= size[i];
+    
+    parent = (IMAGE*) calloc(1, sizeof(IMAGE));
+    if(ImageStreamIO_read_sharedmem_image_toIMAGE(parentname, parent) == -1)
+    {
+        free(parent);
+        ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"cannot import parent stream");
+        return(-1);
+    }
+    parent->used = 1;
+    
+    if(offset + nelement > parent->md[0].nelement)
+    {
+        ImageStreamIO_shmrelease(parent);
+        free(parent);
+        ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"view does not fit in parent stream data");
+        return(-1);
+    }
+    
+    
+    sprintf(sname, "%s_semlog", name);
+    remove(sname);
+    image->semlog = NULL;
+    if ((image->semlog = sem_open(sname, O_CREAT, 0644, 1)) == SEM_FAILED)
+        perror("semaphore creation / initilization");
+    else
+        sem_init(image->semlog, 1, 0);
+    
+    sharedsize = ImageStreamIO_viewoffset(NBkw) + sizeof(IMAGE_VIEW);
+    
+    sprintf(SM_fname, "%s/%s.im.shm", SHAREDMEMDIR, name);
+    struct stat lst;
+    if((lstat(SM_fname, &lst) == 0) && S_ISLNK(lst.st_mode))
+        ImageStreamIO_removeshmfile(SM_fname);
+    
+    SM_fd = open(SM_fname, O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+    if (SM_fd == -1) {
+        perror("Error opening file for writing");
+        exit(0);
+    }
+    if(ftruncate(SM_fd, sharedsize) == -1) {
+        close(SM_fd);
+        ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"Error calling ftruncate() to 'stretch' the file");
+        exit(0);
+    }
+    map = (IMAGE_METADATA*) mmap(0, sharedsize, PROT_READ | PROT_WRITE, MAP_SHARED, SM_fd, 0);
+    if (map == MAP_FAILED) {
+        close(SM_fd);
+        perror("Error mmapping the file");
+        exit(0);
+    }
+    
+    image->shmfd = SM_fd;
+    image->memsize = sharedsize;
+    image->md = map;
+    image->mdlegacy = NULL;
+    image->ring = NULL;
+    image->latency = NULL;
+    
+    strcpy(image->name, name);
+    strcpy(image->md[0].name, name);
+    image->md[0].naxis = naxis;
+    for(i=0; i<naxis; i++)
+        image->md[0].size[i] = size[i];
+    image->md[0].nelement = nelement;
+    image->md[0].atype = parent->md[0].atype;
+    image->md[0].shared = 1;
+    image->md[0].sem = 0;
+    image->md[0].NBkw = NBkw;
+    image->md[0].hugepage = parent->md[0].hugepage;
+    image->md[0].numanode = parent->md[0].numanode;
+    image->md[0].flags = IMAGE_FLAG_VIEW;
+    image->md[0].version = IMAGE_METADATA_VERSION;
+    
+    clock_gettime(CLOCK_REALTIME, &timenow);
+    image->md[0].last_access = 1.0*timenow.tv_sec + 0.000000001*timenow.tv_nsec;
+    image->md[0].creation_time = image->md[0].last_access;
+    image->md[0].write = 0;
+    image->md[0].cnt0 = 0;
+    image->md[0].cnt1 = 0;
+    image->md[0].futex = 0;
+    image->md[0].futexwaiters = 0;
+    image->md[0].wseq = 0;
+    
+    image->kw = (IMAGE_KEYWORD*) ((char*) map + sizeof(IMAGE_METADATA));
+    for(kw=0; kw<NBkw; kw++)
+        image->kw[kw].type = 'N';
+    
+    view = (IMAGE_VIEW*) ((char*) map + ImageStreamIO_viewoffset(NBkw));
+    strncpy(view->parent, parentname, 79);
+    view->offset = offset;
+    
+    image->viewparent = (void*) parent;
+    image->array.UI8 = parent->array.UI8 + offset*ImageStreamIO_typesize(parent->md[0].atype);
+    
+    ImageStreamIO_createSem(image, 10);
+    
+    return(0);
+}
 
 
 
 
+/**
+ * @brief Relay parent stream update to view stream
+ * 
+ * Copies parent counters, acquisition time and write sequence, then posts view semaphores. No data is copied.
+ * 
+ * @return 0 on success, -1 if image is not a view or its parent is not attached
+ */
+int ImageStreamIO_view_update(IMAGE *image)
+{
+    IMAGE *parent = (IMAGE*) image->viewparent;
+    
+    if( (parent == NULL) || ((image->md[0].flags & IMAGE_FLAG_VIEW) == 0) )
+        return(-1);
+    
+    ImageStreamIO_legacy_pull(parent);
+    
+    image->md[0].atime = parent->md[0].atime;
+    image->md[0].cnt1 = parent->md[0].cnt1;
+    image->md[0].wseq = parent->md[0].wseq;
+    image->md[0].write = 0;
+    image->md[0].cnt0 = parent->md[0].cnt0;
+    ImageStreamIO_sempost(image, -1);
+    
+    return(0);
+}
 
 
 
+
+
+
+
+
+
+/**
+ * @brief Pointer to the low 32 bits of cnt0, used as the futex word
+ */
+static uint32_t *ImageStreamIO_futexword(IMAGE *image)
+{
+    // offset arithmetic rather than &md[0].cnt0: cnt0 is a member of a packed struct
+    uint32_t *ptr = (uint32_t*) ((char*) image->md + offsetof(IMAGE_METADATA, cnt0));
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    ptr++;
+#endif
+
+    return ptr;
+}
+
+
+
+
+/**
+ * @brief Wake all readers blocked in ImageStreamIO_futexwait()
+ * 
+ * No syscall is issued if no reader is waiting.
+ */
+int ImageStreamIO_futexwake(IMAGE *image)
+{
+#ifdef __linux__
+    if(__atomic_load_n(&image->md[0].futexwaiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, ImageStreamIO_futexword(image), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Wait until cnt0 differs from cnt0last
+ * 
+ * The reader first polls cnt0 FUTEX_SPINLOOP times, then blocks on the low 32 bits of cnt0.\n
+ * After each wakeup the reader spins again before going back to sleep, which covers writers that post before incrementing cnt0.\n
+ * On non-linux systems, falls back to polling.
+ * 
+ * @param[in]  image      stream
+ * @param[in]  cnt0last   last cnt0 value seen by the reader
+ * @param[in]  timeoutus  timeout [us], no timeout if < 0
+ * 
+ * @return 0 if a new frame is available, 1 if timed out
+ */
+int ImageStreamIO_futexwait(IMAGE *image, uint64_t cnt0last, long timeoutus)
+{
+    long i;
+    struct timespec tstart;
+    struct timespec tnow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    
+    while(1)
+    {
+        for(i=0; i<FUTEX_SPINLOOP; i++)
+        {
+            ImageStreamIO_legacy_pull(image);
+            if(__atomic_load_n(&image->md[0].cnt0, __ATOMIC_ACQUIRE) != cnt0last)
+                return(0);
+        }
+
+
+#ifdef __linux__
+        struct timespec ts;
+        struct timespec *tsptr = NULL;
+        
+        if(timeoutus >= 0)
+        {
+            long dtus;
+            
+            clock_gettime(CLOCK_MONOTONIC, &tnow);
+            dtus = timeoutus - (long) ((tnow.tv_sec - tstart.tv_sec)*1000000 + (tnow.tv_nsec - tstart.tv_nsec)/1000);
+            if(dtus <= 0)
+                return(1);
+            ts.tv_sec = dtus/1000000;
+            ts.tv_nsec = (dtus%1000000)*1000;
+            tsptr = &ts;
+        }
+        
+        __atomic_fetch_add(&image->md[0].futexwaiters, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&image->md[0].cnt0, __ATOMIC_SEQ_CST) == cnt0last)
+            syscall(SYS_futex, ImageStreamIO_futexword(image), FUTEX_WAIT, (uint32_t) cnt0last, tsptr, NULL, 0);
+        __atomic_fetch_sub(&image->md[0].futexwaiters, 1, __ATOMIC_SEQ_CST);
+#else
+        usleep(1);
+        if(timeoutus >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &tnow);
+            if( (tnow.tv_sec - tstart.tv_sec)*1000000 + (tnow.tv_nsec - tstart.tv_nsec)/1000 > timeoutus)
+                return(1);
+        }
+#endif
+    }
+    
+    return(0);
+}
+
+
+
+
+
+/**
+ * @brief Post image semaphore(s) and wake futex readers
+ * 
+ * If index < 0, post all semaphores.\n
+ * Semaphores are only posted if their value is below SEMAPHORE_MAXVAL.\n
+ * Readers blocked in ImageStreamIO_futexwait() are woken with a single syscall, skipped if no reader is waiting.
+ * 
+ * @note cnt0 should be incremented before calling this function
+ */
+int ImageStreamIO_sempost(IMAGE *image, long index)
+{
+    long s;
+    int semval;
+    
+    ImageStreamIO_legacy_push(image);
+    
+    if(image->latency != NULL)
+    {
+        struct timespec tnow;
+        
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        __atomic_store_n(&image->latency->tpost, (uint64_t) tnow.tv_sec*1000000000 + tnow.tv_nsec, __ATOMIC_RELEASE);
+    }
+    
+    if(index<0)
+    {
+        for(s=0; s<image->md[0].sem; s++)
+        {
+            sem_getvalue(image->semptr[s], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(image->semptr[s]);
+        }
+    }
+    else
+    {
+        if(index>image->md[0].sem-1)
+            printf("ERROR: image %s semaphore # %ld does no exist\n", image->md[0].name, index);
+        else
+        {
+            sem_getvalue(image->semptr[index], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(image->semptr[index]);
+        }
+    }
+    
+    ImageStreamIO_futexwake(image);
+    
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/*                                                                                                 */
+/* LEGACY METADATA LAYOUT                                                                          */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+/*
+ * Streams with legacy (version 1) metadata are imported with md pointing to a local copy of the metadata.
+ * Frame counters and flags are exchanged with shared memory by ImageStreamIO_legacy_pull() (reader) and
+ * ImageStreamIO_legacy_push() (writer). Both return immediately for current layout streams.
+ * ImageStreamIO_sempost(), ImageStreamIO_futexwait() and ImageStreamIO_read_begin() call them, so code using these functions
+ * is unaffected. Code polling md[0].cnt0 directly on a legacy stream must call ImageStreamIO_legacy_pull().
+ */
+
+
+
+/**
+ * @brief Update local metadata copy from legacy stream
+ */
+int ImageStreamIO_legacy_pull(IMAGE *image)
+{
+    IMAGE_METADATA_V1 *mdv1 = image->mdlegacy;
+    
+    if(mdv1 == NULL)
+        return(0);
+    
+    image->md[0].cnt0 = __atomic_load_n(&mdv1->cnt0, __ATOMIC_ACQUIRE);
+    image->md[0].cnt1 = mdv1->cnt1;
+    image->md[0].cnt2 = mdv1->cnt2;
+    image->md[0].write = mdv1->write;
+    image->md[0].atime.tsfixed = mdv1->atime.tsfixed;
+    image->md[0].status = mdv1->status;
+    image->md[0].logflag = mdv1->logflag;
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Write local metadata copy to legacy stream
+ */
+int ImageStreamIO_legacy_push(IMAGE *image)
+{
+    IMAGE_METADATA_V1 *mdv1 = image->mdlegacy;
+    
+    if(mdv1 == NULL)
+        return(0);
+    
+    mdv1->cnt1 = image->md[0].cnt1;
+    mdv1->cnt2 = image->md[0].cnt2;
+    mdv1->write = image->md[0].write;
+    mdv1->atime.tsfixed = image->md[0].atime.tsfixed;
+    mdv1->last_access = image->md[0].last_access;
+    __atomic_store_n(&mdv1->cnt0, image->md[0].cnt0, __ATOMIC_RELEASE);
+    
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/*                                                                                                 */
+/* SEQLOCK                                                                                         */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+/*
+ * Write sequence:
+ * - [1] ImageStreamIO_write_begin()  : md[0].write = 1, wseq becomes odd
+ * - [2] write data (and metadata such as atime, cnt1)
+ * - [3] ImageStreamIO_write_end()    : wseq becomes even, md[0].write = 0
+ * - [4] increment cnt0, post semaphores
+ * 
+ * Read sequence (in place, no copy):
+ * - [1] seq = ImageStreamIO_read_begin()
+ * - [2] read data straight from shared memory
+ * - [3] if ImageStreamIO_read_retry(seq) returns 1, the data was overwritten during the read: go back to [1] or discard
+ * 
+ * ImageStreamIO_read_consistent() wraps this sequence for a copy.
+ */
+
+
+
+/**
+ * @brief Start writing image data/metadata
+ */
+int ImageStreamIO_write_begin(IMAGE *image)
+{
+    image->md[0].write = 1;
+    if(image->mdlegacy != NULL)
+        image->mdlegacy->write = 1;
+    __atomic_fetch_add(&image->md[0].wseq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // data stores cannot move above wseq increment
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Done writing image data/metadata
+ */
+int ImageStreamIO_write_end(IMAGE *image)
+{
+    __atomic_fetch_add(&image->md[0].wseq, 1, __ATOMIC_RELEASE);
+    image->md[0].write = 0;
+    if(image->mdlegacy != NULL)
+        image->mdlegacy->write = 0;
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Start reading image data in place
+ * 
+ * Waits (spinning, at most SEQLOCK_SPINMAX polls) until no write is in progress.\n
+ * If the write is still in progress after SEQLOCK_SPINMAX polls (e.g. writer died in the middle of a write), 
+ * the odd sequence value is returned and ImageStreamIO_read_retry() reports the read as torn.
+ * 
+ * @return sequence value, to be passed to ImageStreamIO_read_retry()
+ */
+uint64_t ImageStreamIO_read_begin(IMAGE *image)
+{
+    uint64_t seq;
+    long spin = 0;
+    
+    ImageStreamIO_legacy_pull(image);
+    while( ((seq = __atomic_load_n(&image->md[0].wseq, __ATOMIC_ACQUIRE)) & 1) && (spin < SEQLOCK_SPINMAX) )
+        spin++;
+    
+    return(seq);
+}
+
+
+
+/**
+ * @brief Check if data read since ImageStreamIO_read_begin() has been overwritten
+ * 
+ * @return 0 if read is consistent, 1 if torn (read must be discarded or repeated)
+ */
+int ImageStreamIO_read_retry(IMAGE *image, uint64_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // data loads cannot move below wseq check
+    
+    if( (seq & 1) || (__atomic_load_n(&image->md[0].wseq, __ATOMIC_RELAXED) != seq) )
+        return(1);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Consistent copy of (part of) the image data array
+ * 
+ * Copies nbbyte bytes from image data array (starting at byte offset) to dest.\n
+ * Copy is repeated if the writer modified the image during the copy, up to NBretry times.
+ * 
+ * @param[in]   image    stream
+ * @param[out]  dest     destination buffer
+ * @param[in]   offset   offset into data array [byte]
+ * @param[in]   nbbyte   number of bytes to copy
+ * @param[in]   NBretry  maximum number of retries
+ * 
+ * @return 0 if copy is consistent, 1 if copy is torn after NBretry retries
+ */
+int ImageStreamIO_read_consistent(IMAGE *image, void *dest, size_t offset, size_t nbbyte, int NBretry)
+{
+    int retry;
+    uint64_t seq;
+    
+    for(retry=0; retry<=NBretry; retry++)
+    {
+        seq = ImageStreamIO_read_begin(image);
+        memcpy(dest, ((char*) image->array.UI8) + offset, nbbyte);
+        if(ImageStreamIO_read_retry(image, seq) == 0)
+            return(0);
+    }
+    
+    return(1);
+}
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/*                                                                                                 */
+/* RING BUFFER                                                                                     */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+
+
+/**
+ * @brief Pointer to ring buffer slot to be written next
+ * 
+ * Starts write (ImageStreamIO_write_begin). Slot is published by ImageStreamIO_ring_commit()
+ */
+void *ImageStreamIO_ring_writeslot(IMAGE *image)
+{
+    char *ptr;
+    
+    if(image->ring == NULL)
+        return NULL;
+    
+    ImageStreamIO_write_begin(image);
+    ptr = (char*) image->array.UI8;
+    ptr += image->ring->framesize * (image->ring->writeindex % image->ring->NBslot);
+    
+    return (void*) ptr;
+}
+
+
+
+/**
+ * @brief Publish slot written after ImageStreamIO_ring_writeslot()
+ * 
+ * Increments write index, sets md[0].cnt1 to slot written, increments md[0].cnt0 and posts all semaphores
+ */
+int ImageStreamIO_ring_commit(IMAGE *image)
+{
+    uint64_t windex;
+    
+    if(image->ring == NULL)
+        return(-1);
+    
+    windex = image->ring->writeindex;
+    image->md[0].cnt1 = windex % image->ring->NBslot;
+    
+    ImageStreamIO_write_end(image);
+    __atomic_store_n(&image->ring->writeindex, windex+1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&image->md[0].cnt0, 1, __ATOMIC_RELEASE);
+    
+    ImageStreamIO_sempost(image, -1);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Register a reader cursor
+ * 
+ * Cursor starts at current write index (only frames written after registration are read)
+ * 
+ * @return reader index, -1 if no cursor available
+ */
+int ImageStreamIO_ring_reader_open(IMAGE *image, const char *readername)
+{
+    int r;
+    
+    if(image->ring == NULL)
+        return(-1);
+    
+    for(r=0; r<RING_NBREADER_MAX; r++)
+    {
+        uint8_t expected = 0;
+        
+        if(__atomic_compare_exchange_n(&image->ring->reader[r].used, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            image->ring->reader[r].cursor = __atomic_load_n(&image->ring->writeindex, __ATOMIC_ACQUIRE);
+            image->ring->reader[r].overrun = 0;
+            image->ring->reader[r].pid = (int32_t) getpid();
+            strncpy(image->ring->reader[r].name, readername, 15);
+            image->ring->reader[r].name[15] = '\0';
+            
+            return(r);
+        }
+    }
+    
+    ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"no ring buffer reader cursor available");
+    
+    return(-1);
+}
+
+
+
+/**
+ * @brief Release a reader cursor
+ */
+int ImageStreamIO_ring_reader_close(IMAGE *image, int rindex)
+{
+    if((image->ring == NULL)||(rindex<0)||(rindex>=RING_NBREADER_MAX))
+        return(-1);
+    
+    image->ring->reader[rindex].pid = 0;
+    __atomic_store_n(&image->ring->reader[rindex].used, 0, __ATOMIC_RELEASE);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Number of slots written and not yet read by reader rindex
+ */
+uint64_t ImageStreamIO_ring_available(IMAGE *image, int rindex)
+{
+    if((image->ring == NULL)||(rindex<0)||(rindex>=RING_NBREADER_MAX))
+        return(0);
+    
+    return( __atomic_load_n(&image->ring->writeindex, __ATOMIC_ACQUIRE) - image->ring->reader[rindex].cursor );
+}
+
+
+
+/**
+ * @brief Zero-copy pointer to oldest unread slot
+ * 
+ * If the reader is more than NBslot-1 slots behind, the cursor skips the slots that have been (or are being) overwritten.
+ * 
+ * @param[in]   image    ring buffer stream
+ * @param[in]   rindex   reader index
+ * @param[out]  slot     slot index (z-axis), can be NULL
+ * @param[out]  overrun  number of slots lost on this call, can be NULL
+ * 
+ * @return pointer to slot data, NULL if no unread slot
+ */
+void *ImageStreamIO_ring_read(IMAGE *image, int rindex, uint64_t *slot, uint64_t *overrun)
+{
+    IMAGE_RINGREADER *reader;
+    uint64_t avail;
+    uint64_t lost = 0;
+    char *ptr;
+    
+    if(overrun != NULL)
+        *overrun = 0;
+    
+    if((image->ring == NULL)||(rindex<0)||(rindex>=RING_NBREADER_MAX))
+        return NULL;
+    
+    reader = &image->ring->reader[rindex];
+    avail = __atomic_load_n(&image->ring->writeindex, __ATOMIC_ACQUIRE) - reader->cursor;
+    if(avail == 0)
+        return NULL;
+    
+    if(avail > image->ring->NBslot-1)
+    {
+        lost = avail - (image->ring->NBslot-1);
+        reader->cursor += lost;
+        reader->overrun += lost;
+    }
+    if(overrun != NULL)
+        *overrun = lost;
+    if(slot != NULL)
+        *slot = reader->cursor % image->ring->NBslot;
+    
+    ptr = (char*) image->array.UI8;
+    ptr += image->ring->framesize * (reader->cursor % image->ring->NBslot);
+    
+    return (void*) ptr;
+}
+
+
+
+/**
+ * @brief Advance reader cursor after slot returned by ImageStreamIO_ring_read() has been consumed
+ * 
+ * @return 0 if OK, 1 if the slot was overwritten by the writer while being read (torn read)
+ */
+int ImageStreamIO_ring_release(IMAGE *image, int rindex)
+{
+    IMAGE_RINGREADER *reader;
+    int torn = 0;
+    
+    if((image->ring == NULL)||(rindex<0)||(rindex>=RING_NBREADER_MAX))
+        return(0);
+    
+    reader = &image->ring->reader[rindex];
+    if( __atomic_load_n(&image->ring->writeindex, __ATOMIC_ACQUIRE) - reader->cursor > image->ring->NBslot-1 )
+        torn = 1;
+    reader->cursor++;
+    
+    return(torn);
+}
+
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/*                                                                                                 */
+/* LATENCY INSTRUMENTATION                                                                         */
+/*                                                                                                 */
+/* =============================================================================================== */
+
+
+
+/**
+ * @brief Histogram bucket for latency dt [ns]
+ * 
+ * Buckets 0-3 hold 0-3 ns. Above, 4 buckets per octave: bucket 4*(k-1)+q holds [ (4+q) 2^(k-2), (5+q) 2^(k-2) ) for octave k >= 2.
+ */
+int ImageStreamIO_latency_bucket(uint64_t dt)
+{
+    int k;
+    int b;
+    
+    if(dt < 4)
+        return (int) dt;
+    
+    k = 63 - __builtin_clzll(dt);
+    b = 4*(k-1) + (int) ((dt >> (k-2)) & 3);
+    if(b > LATENCY_NBBUCKET-1)
+        b = LATENCY_NBBUCKET-1;
+    
+    return(b);
+}
+
+
+
+/**
+ * @brief Upper edge of latency histogram bucket [ns]
+ */
+static double ImageStreamIO_latency_bucketedge(int b)
+{
+    int k;
+    
+    if(b < 4)
+        return (double) (b+1);
+    
+    k = b/4 + 1;
+    return ldexp(5.0 + (b%4), k-2);
+}
+
+
+
+/**
+ * @brief Register a latency reader
+ * 
+ * @return reader index, -1 if stream not instrumented or no entry available
+ */
+int ImageStreamIO_latency_reader_open(IMAGE *image, const char *readername)
+{
+    int r;
+    
+    if(image->latency == NULL)
+        return(-1);
+    
+    for(r=0; r<LATENCY_NBREADER_MAX; r++)
+    {
+        uint8_t expected = 0;
+        
+        if(__atomic_compare_exchange_n(&image->latency->reader[r].used, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            IMAGE_LATENCYREADER *reader = &image->latency->reader[r];
+            
+            reader->count = 0;
+            memset(reader->wakeup, 0, sizeof(uint64_t)*LATENCY_NBBUCKET);
+            memset(reader->age, 0, sizeof(uint64_t)*LATENCY_NBBUCKET);
+            reader->pid = (int32_t) getpid();
+            strncpy(reader->name, readername, 15);
+            reader->name[15] = '\0';
+            
+            return(r);
+        }
+    }
+    
+    ImageStreamIO_printERROR(__FILE__,__func__,__LINE__,"no latency reader entry available");
+    
+    return(-1);
+}
+
+
+
+/**
+ * @brief Release a latency reader entry
+ */
+int ImageStreamIO_latency_reader_close(IMAGE *image, int rindex)
+{
+    if((image->latency == NULL)||(rindex<0)||(rindex>=LATENCY_NBREADER_MAX))
+        return(-1);
+    
+    image->latency->reader[rindex].pid = 0;
+    __atomic_store_n(&image->latency->reader[rindex].used, 0, __ATOMIC_RELEASE);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Record latencies of frame just received by reader rindex
+ * 
+ * To be called right after the reader wakes up (sem_wait, futex wait or poll returns)
+ */
+int ImageStreamIO_latency_record(IMAGE *image, int rindex)
+{
+    IMAGE_LATENCYREADER *reader;
+    struct timespec tnow;
+    uint64_t tnowns;
+    uint64_t tpost;
+    uint64_t tacq;
+    
+    if((image->latency == NULL)||(rindex<0)||(rindex>=LATENCY_NBREADER_MAX))
+        return(-1);
+    
+    reader = &image->latency->reader[rindex];
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    tnowns = (uint64_t) tnow.tv_sec*1000000000 + tnow.tv_nsec;
+    
+    tpost = __atomic_load_n(&image->latency->tpost, __ATOMIC_ACQUIRE);
+    if((tpost > 0) && (tnowns >= tpost))
+        __atomic_fetch_add(&reader->wakeup[ImageStreamIO_latency_bucket(tnowns-tpost)], 1, __ATOMIC_RELAXED);
+    
+    tacq = (uint64_t) image->md[0].atime.ts.tv_sec*1000000000 + image->md[0].atime.ts.tv_nsec;
+    if((tacq > 0) && (tnowns >= tacq))
+        __atomic_fetch_add(&reader->age[ImageStreamIO_latency_bucket(tnowns-tacq)], 1, __ATOMIC_RELAXED);
+    
+    __atomic_fetch_add(&reader->count, 1, __ATOMIC_RELAXED);
+    
+    return(0);
+}
+
+
+
+/**
+ * @brief Latency percentile from histogram
+ * 
+ * @param[in]  hist     histogram (LATENCY_NBBUCKET buckets)
+ * @param[in]  fraction percentile, for example 0.99
+ * 
+ * @return upper edge of bucket containing percentile [ns], -1 if histogram is empty
+ */
+double ImageStreamIO_latency_percentile(uint64_t *hist, double fraction)
+{
+    uint64_t total = 0;
+    uint64_t cnt = 0;
+    int b;
+    
+    for(b=0; b<LATENCY_NBBUCKET; b++)
+        total += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+    if(total == 0)
+        return(-1.0);
+    
+    for(b=0; b<LATENCY_NBBUCKET; b++)
+    {
+        cnt += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+        if(cnt >= fraction*total)
+            break;
+    }
+    if(b == LATENCY_NBBUCKET)
+        b--;
+        
+    return ImageStreamIO_latency_bucketedge(b);
+}
+
+
+
+
+
+
+
+
+
+/**
+ * @brief NUMA node holding the first page of the image data array
+ * 
+ * @return node index, -1 if unknown
+ */
+int ImageStreamIO_datanode(IMAGE *image)
+{
+#ifdef __linux__
+    void *pages[1];
+    int status[1];
+    uintptr_t pagesize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    
+    pages[0] = (void*) (((uintptr_t) image->array.UI8) & ~(pagesize-1));
+    status[0] = -1;
+    if(syscall(SYS_move_pages, 0, 1UL, pages, NULL, status, 0) == 0)
+        if(status[0] >= 0)
+            return status[0];
+#endif
+
+    return -1;
+}
@@ -24,9 +24,81 @@ int ImageStreamIO_createSem(IMAGE *image, long NBsem);
 
 int ImageStreamIO_createIm(IMAGE *image, const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw);
 
+int ImageStreamIO_createIm_flags(IMAGE *image, const char *name, long naxis, uint32_t *size, uint8_t atype, int shared, int NBkw, uint16_t flags);
+
+
+int ImageStreamIO_pool_begin();
+
+int ImageStreamIO_pool_end();
+
+int ImageStreamIO_arrayfree(IMAGE *image);
+
+int ImageStreamIO_arraymap(IMAGE *image, int fd, off_t offset);
+
 
 long ImageStreamIO_read_sharedmem_image_toIMAGE(const char *name, IMAGE *image);
 
+int ImageStreamIO_shmrelease(IMAGE *image);
+
+int ImageStreamIO_shmunchanged(IMAGE *image);
+
+
+int ImageStreamIO_createView(IMAGE *image, const char *name, const char *parentname, uint64_t offset, long naxis, uint32_t *size, int NBkw);
+
+int ImageStreamIO_view_update(IMAGE *image);
+
+
+int ImageStreamIO_sempost(IMAGE *image, long index);
+
+int ImageStreamIO_futexwake(IMAGE *image);
+
+int ImageStreamIO_futexwait(IMAGE *image, uint64_t cnt0last, long timeoutus);
+
+
+int ImageStreamIO_legacy_pull(IMAGE *image);
+
+int ImageStreamIO_legacy_push(IMAGE *image);
+
+
+int ImageStreamIO_write_begin(IMAGE *image);
+
+int ImageStreamIO_write_end(IMAGE *image);
+
+uint64_t ImageStreamIO_read_begin(IMAGE *image);
+
+int ImageStreamIO_read_retry(IMAGE *image, uint64_t seq);
+
+int ImageStreamIO_read_consistent(IMAGE *image, void *dest, size_t offset, size_t nbbyte, int NBretry);
+
+
+void *ImageStreamIO_ring_writeslot(IMAGE *image);
+
+int ImageStreamIO_ring_commit(IMAGE *image);
+
+int ImageStreamIO_ring_reader_open(IMAGE *image, const char *readername);
+
+int ImageStreamIO_ring_reader_close(IMAGE *image, int rindex);
+
+uint64_t ImageStreamIO_ring_available(IMAGE *image, int rindex);
+
+void *ImageStreamIO_ring_read(IMAGE *image, int rindex, uint64_t *slot, uint64_t *overrun);
+
+int ImageStreamIO_ring_release(IMAGE *image, int rindex);
+
+
+int ImageStreamIO_latency_bucket(uint64_t dt);
+
+int ImageStreamIO_latency_reader_open(IMAGE *image, const char *readername);
+
+int ImageStreamIO_latency_reader_close(IMAGE *image, int rindex);
+
+int ImageStreamIO_latency_record(IMAGE *image, int rindex);
+
+double ImageStreamIO_latency_percentile(uint64_t *hist, double fraction);
+
+
+int ImageStreamIO_datanode(IMAGE *image);
+
 
 #endif
 
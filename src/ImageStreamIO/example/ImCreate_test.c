@@ -100,7 +100,7 @@ int main()
 		yc = y0 + r*sin(angle);
 		
 		
-		imarray[0].md[0].write = 1; // set this flag to 1 when writing data
+		ImageStreamIO_write_begin(&imarray[0]); // sets write flag to 1, wseq odd
 		
 		for(ii=0; ii<imarray[0].md[0].size[0]; ii++)
 			for(jj=0; jj<imarray[0].md[0].size[1]; jj++)
@@ -118,6 +118,10 @@ int main()
 				//	imarray[0].array.F[jj*imarray[0].md[0].size[0]+ii] = 0.0;
 			}
 		
+		ImageStreamIO_write_end(&imarray[0]); // Done writing data
+		imarray[0].md[0].cnt0++;
+		imarray[0].md[0].cnt1++;
+		
 		// POST ALL SEMAPHORES
 		for(s=0; s<imarray[0].md[0].sem; s++)
         {
@@ -130,10 +134,6 @@ int main()
             sem_post(imarray[0].semlog);
 		
 		
-		imarray[0].md[0].write = 0; // Done writing data
-		imarray[0].md[0].cnt0++;
-		imarray[0].md[0].cnt1++;
-		
 		
 		usleep(dtus);
 		angle += dangle;
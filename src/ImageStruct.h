@@ -33,9 +33,40 @@
 
 #define SHAREDMEMDIR        "/tmp"        /**< location of file mapped semaphores */
 
+#define HUGEPAGEDIR         "/dev/hugepages" /**< hugetlbfs mount point for streams created with IMAGE_FLAG_HUGEPAGE */
+
 
 #define SEMAPHORE_MAXVAL    10 	          /**< maximum value for each of the semaphore, mitigates warm-up time when processes catch up with data that has accumulated */
 
+#define FUTEX_SPINLOOP      2000          /**< number of cnt0 polls before a futex reader goes to sleep in the kernel */
+
+#define SEQLOCK_SPINMAX     100000        /**< maximum number of wseq polls in ImageStreamIO_read_begin() while a write is in progress */
+
+#define IMAGE_METADATA_VERSION  2         /**< shared memory metadata layout version (md[0].version), legacy streams are version 1 */
+
+
+
+// Image creation flags (md[0].flags)
+
+#define IMAGE_FLAG_RING     0x0001        /**< multi-slot ring buffer with per-reader cursors (see IMAGE_RING) */
+#define IMAGE_FLAG_HUGEPAGE 0x0002        /**< shared memory on huge pages: hugetlbfs if available, otherwise transparent huge pages */
+#define IMAGE_FLAG_NUMA     0x0004        /**< bind shared memory to NUMA node stored in flags bits 8-15 */
+#define IMAGE_FLAG_NOZERO   0x0008        /**< local image: do not zero-fill data array (caller overwrites all elements) */
+#define IMAGE_FLAG_POOL     0x0010        /**< local image: data array allocated from image pool (set by ImageStreamIO, not a creation flag) */
+#define IMAGE_FLAG_LATENCY  0x0020        /**< latency instrumentation block in shared memory (see IMAGE_LATENCY) */
+#define IMAGE_FLAG_MMAP     0x0040        /**< local image: data array is a private file mapping (see ImageStreamIO_arraymap, not a creation flag) */
+#define IMAGE_FLAG_VIEW     0x0080        /**< view stream: data array is a contiguous region of a parent stream (see IMAGE_VIEW, not a creation flag) */
+
+#define IMAGE_FLAG_NUMANODE(node)  (IMAGE_FLAG_NUMA | (((node) & 0xff) << 8))   /**< creation flag binding stream to NUMA node */
+
+#define RING_NBREADER_MAX   16            /**< maximum number of reader cursors in a ring buffer stream */
+
+#define LATENCY_NBREADER_MAX 16           /**< maximum number of readers in latency instrumentation block */
+#define LATENCY_NBBUCKET    128           /**< number of latency histogram buckets: 4 per octave, 0 to 4.3 s [ns] */
+
+#define IMAGE_POOL_MINSIZE  65536         /**< local image data arrays smaller than this [byte] are not pooled */
+#define IMAGE_POOL_NBBLOCK  8             /**< maximum number of free blocks kept per pool size class */
+
 
 
 
@@ -221,11 +252,113 @@ typedef struct
 
 
 
+/** @brief Ring buffer reader cursor
+ * 
+ * Each reader cursor occupies its own 64-byte cache line, so that readers advancing at different rates do not interfere
+ */
+typedef struct
+{
+	uint64_t cursor;                /**< absolute index of next slot to be read                      */
+	uint64_t overrun;               /**< total number of slots overwritten before reader could read them */
+	int32_t  pid;                   /**< reader process ID                                           */
+	uint8_t  used;                  /**< 1 if cursor is in use                                       */
+	char     name[16];              /**< reader name                                                 */
+} __attribute__ ((aligned (64))) IMAGE_RINGREADER;
+
+
+
+/** @brief Ring buffer header
+ * 
+ * Stored in shared memory after the keywords (64-byte aligned) if md[0].flags has IMAGE_FLAG_RING set.\n
+ * A ring buffer stream is a 3D image: z-axis size (md[0].size[2]) is the number of slots.\n
+ * 
+ * Write sequence:
+ * - [1] ptr = ImageStreamIO_ring_writeslot(): pointer to slot writeindex % NBslot
+ * - [2] write frame at ptr
+ * - [3] ImageStreamIO_ring_commit(): increment writeindex, set md[0].cnt1 to slot written, increment md[0].cnt0, post semaphores
+ * 
+ * Read sequence:
+ * - [1] rindex = ImageStreamIO_ring_reader_open() once
+ * - [2] ptr = ImageStreamIO_ring_read(): zero-copy pointer to oldest unread slot, NULL if none. Reports slots lost (overrun)
+ * - [3] read frame at ptr
+ * - [4] ImageStreamIO_ring_release(): advance cursor, returns 1 if the slot was overwritten during read
+ * 
+ * The writer never waits for readers: a reader more than NBslot-1 slots behind skips the oldest slots.
+ */
+typedef struct
+{
+	uint64_t writeindex;            /**< number of slots written since creation (monotonic)          */
+	uint64_t framesize;             /**< slot size [byte]                                            */
+	uint32_t NBslot;                /**< number of slots                                             */
+	
+	IMAGE_RINGREADER reader[RING_NBREADER_MAX];
+} __attribute__ ((aligned (64))) IMAGE_RING;
+
+
+
+
+/** @brief Latency histograms of a stream reader
+ * 
+ * Log-scale histograms, 4 buckets per octave (see ImageStreamIO_latency_bucket).\n
+ * Each reader only updates its own entry, with atomic increments, so that histograms can be read by other processes at any time.
+ */
+typedef struct
+{
+    uint64_t count;                         /**< number of frames recorded                                 */
+    uint64_t wakeup[LATENCY_NBBUCKET];      /**< writer post to reader wakeup [ns]                          */
+    uint64_t age[LATENCY_NBBUCKET];         /**< frame acquisition time (md[0].atime) to reader wakeup [ns] */
+    int32_t  pid;                           /**< reader process ID                                          */
+    uint8_t  used;                          /**< 1 if entry is registered                                   */
+    char     name[16];                      /**< reader name                                                */
+} __attribute__ ((aligned (64))) IMAGE_LATENCYREADER;
+
+
+
+/** @brief Latency instrumentation block
+ * 
+ * Stored in shared memory after the keywords (and ring buffer header, if any), 64-byte aligned, if md[0].flags has IMAGE_FLAG_LATENCY set.\n
+ * 
+ * - Writer: ImageStreamIO_sempost() stores post time in tpost
+ * - Reader: rindex = ImageStreamIO_latency_reader_open() once, then ImageStreamIO_latency_record() after each wakeup
+ * - Monitor: ImageStreamIO_latency_percentile() on reader histograms (CLI: imlatency)
+ */
+typedef struct
+{
+	uint64_t tpost;                         /**< time of last writer post, CLOCK_REALTIME [ns] */
+	IMAGE_LATENCYREADER reader[LATENCY_NBREADER_MAX];
+} __attribute__ ((aligned (64))) IMAGE_LATENCY;
+
+
+
+/** @brief View stream header
+ * 
+ * Stored in shared memory after the keywords (64-byte aligned) if md[0].flags has IMAGE_FLAG_VIEW set. A view stream has no data block:
+ * its array points into the parent stream data, starting at element offset. The region is contiguous (z-slice range, full-row band or reshape).\n
+ * A view has its own metadata, counters and semaphores. Parent frames are relayed by ImageStreamIO_view_update() (no data copy).
+ */
+typedef struct
+{
+	char     parent[80];                    /**< parent stream name                    */
+	uint64_t offset;                        /**< offset into parent data [element]     */
+} __attribute__ ((aligned (64))) IMAGE_VIEW;
+
+
+
+
+
+
 /** @brief Image metadata
  * 
  * This structure has a fixed size regardless of implementation
+ * 
+ * Fields are grouped by writer on separate 64-byte cache lines, so that frequent writes do not invalidate the line polled by readers:
+ *   - bytes   0-127 : read-mostly fields, set at image creation
+ *   - bytes 128-191 : writer-hot fields, updated by the stream writer on every frame (cnt0, cnt1, cnt2, wseq, atime, write)
+ *   - bytes 192-255 : fields updated by readers (last_access, futexwaiters, logging control)
+ * 
+ * md version is stored in field version (IMAGE_METADATA_VERSION). Streams created without version number use the legacy layout IMAGE_METADATA_V1, see ImageStreamIO_read_sharedmem_image_toIMAGE().
  *
- * @note size = 171 byte = 1368 bit
+ * @note size = 256 byte = 2048 bit
  *  
  */ 
 typedef struct
@@ -276,8 +409,48 @@ typedef struct
 	// mem offset = 102
 
     double creation_time;           /**< creation time (since process start)                                          */
-    double last_access;             /**< last time the image was accessed  (since process start)                      */
-    // mem offset = 118
+    // mem offset = 110
+    
+    uint8_t shared;                 /**< 1 if in shared memory                                                        */
+    uint16_t sem; 				    /**< number of semaphores in use, specified at image creation                     */
+    uint16_t NBkw;                  /**< number of keywords (max: 65536)                                              */
+    // mem offset = 115
+
+    uint16_t flags;                 /**< creation flags (IMAGE_FLAG_*)                                                */
+    uint8_t  hugepage;              /**< page placement: 0 = default pages, 1 = transparent huge pages, 2 = hugetlbfs */
+    int8_t   numanode;              /**< NUMA node the stream is bound to, -1 if not bound                           */
+    // mem offset = 119
+
+    /** @brief Futex wakeup mode
+     * 
+     * If set to 1, readers may wait for a new frame by blocking on the low 32 bits of cnt0 (see ImageStreamIO_futexwait) instead of waiting on a semaphore.\n
+     * A single writer post (ImageStreamIO_sempost) then wakes all futex readers. Semaphores are still posted, so semaphore readers are unaffected.
+     */
+    uint8_t  futex;
+    // mem offset = 120
+
+    uint16_t version;               /**< metadata layout version (IMAGE_METADATA_VERSION)                             */
+    // mem offset = 122
+
+    uint8_t  pad0[6];               // pad to cache line boundary -> mem offset = 128
+
+
+
+    // ---- writer-hot cache line -----------------------------------------------------------------
+
+    uint64_t cnt0;               	/**< counter (incremented if image is updated)                                    */
+    uint64_t cnt1;               	/**< in 3D rolling buffer image, this is the last slice written                   */
+    uint64_t cnt2;                  /**< in event mode, this is the # of events                                       */
+    // mem offset = 152
+
+    /** @brief Write sequence counter (seqlock)
+     * 
+     * Incremented by ImageStreamIO_write_begin() and ImageStreamIO_write_end(): odd while a write is in progress.\n
+     * A reader copying or reading data in place checks that wseq is even and unchanged across the read (see ImageStreamIO_read_consistent).\n
+     * Writers that do not use the seqlock leave wseq at 0, in which case readers see every read as consistent.
+     */
+    uint64_t wseq;
+    // mem offset = 160
     
     /** @brief Acquisition time (beginning of exposure   
      * 
@@ -300,28 +473,30 @@ typedef struct
 		struct timespec ts;
 		TIMESPECFIXED tsfixed;
 	} atime;
-    // mem offset = 134
-    
-    
-    uint8_t shared;                 /**< 1 if in shared memory                                                        */
-    uint8_t status;              	/**< 1 to log image (default); 0 : do not log: 2 : stop log (then goes back to 2) */
-	// mem offset = 136
+    // mem offset = 176
 
-	uint8_t logflag;                    /**< set to 1 to start logging         */
-    uint16_t sem; 				        /**< number of semaphores in use, specified at image creation      */
-	// mem offset = 139
+    uint8_t  write;               	/**< 1 if image is being written                                                  */
+    // mem offset = 177
 
-	uint64_t : 0; // align array to 8-byte boundary for speed  -> pushed mem offset to 144
-    
-    uint64_t cnt0;               	/**< counter (incremented if image is updated)                                    */
-    uint64_t cnt1;               	/**< in 3D rolling buffer image, this is the last slice written                   */
-    uint64_t cnt2;                  /**< in event mode, this is the # of events                                       */
+    uint8_t  pad1[15];              // pad to cache line boundary -> mem offset = 192
 
-    uint8_t  write;               	/**< 1 if image is being written                                                  */
 
-    uint16_t NBkw;                  /**< number of keywords (max: 65536)                                              */
+
+    // ---- reader-written cache line -------------------------------------------------------------
+
+    double last_access;             /**< last time the image was accessed  (since process start)                      */
+    // mem offset = 200
+
+    uint32_t futexwaiters;          /**< number of readers currently blocked in futex wait on cnt0 (writer skips wake syscall if 0) */
+    // mem offset = 204
+
+    uint8_t status;              	/**< 1 to log image (default); 0 : do not log: 2 : stop log (then goes back to 2) */
+	uint8_t logflag;                /**< set to 1 to start logging                                                    */
+	// mem offset = 206
+
+    uint8_t  pad2[50];              // pad to cache line boundary -> mem offset = 256
     
-    // total size is 171 byte = 1368 bit
+    // total size is 256 byte = 2048 bit
     
 } __attribute__ ((__packed__)) IMAGE_METADATA;
 
@@ -329,6 +504,42 @@ typedef struct
 
 
 
+/** @brief Legacy (version 1) image metadata
+ * 
+ * Layout of shared memory streams created before metadata versioning (no version field).\n
+ * Only used by the compatibility shim in ImageStreamIO to import such streams.
+ *
+ * @note size = 171 byte = 1368 bit
+ */
+typedef struct
+{
+    char name[80];
+    uint8_t naxis;
+    uint32_t size[3];
+    uint64_t nelement;
+    uint8_t atype;
+    double creation_time;
+    double last_access;
+    union
+    {
+		struct timespec ts;
+		TIMESPECFIXED tsfixed;
+	} atime;
+    uint8_t shared;
+    uint8_t status;
+	uint8_t logflag;
+    uint16_t sem;
+	uint64_t : 0;
+    uint64_t cnt0;
+    uint64_t cnt1;
+    uint64_t cnt2;
+    uint8_t  write;
+    uint16_t NBkw;
+} __attribute__ ((__packed__)) IMAGE_METADATA_V1;
+
+
+
+
  
  
 
@@ -337,7 +548,7 @@ typedef struct
  *   - an array of IMAGE_KEWORD structures
  *   - an array of IMAGE_METADATA structures (usually only 1 element)
  * 
- * @note size = 136 byte = 1088 bit
+ * @note size = 168 byte = 1344 bit
  * 
  */
 typedef struct          		/**< structure used to store data arrays                      */
@@ -414,8 +625,20 @@ typedef struct          		/**< structure used to store data arrays
 
     IMAGE_KEYWORD *kw;
     // mem offset 136    
+
+    IMAGE_RING *ring;                   /**< ring buffer header, NULL if not a ring buffer stream */
+    // mem offset 144
+
+    IMAGE_METADATA_V1 *mdlegacy;        /**< legacy (version 1) metadata in shared memory, NULL unless stream uses legacy layout. md then points to a local copy */
+    // mem offset 152
+
+    IMAGE_LATENCY *latency;             /**< latency instrumentation block, NULL if not instrumented */
+    // mem offset 160
+
+    void *viewparent;                   /**< view streams: IMAGE * of the attached parent stream, NULL otherwise */
+    // mem offset 168
     
-    // total size is 136 byte = 1088 bit
+    // total size is 168 byte = 1344 bit
     
 } __attribute__ ((__packed__)) IMAGE;
 
@@ -76,17 +76,37 @@ int_fast8_t init_OptSystProp()
 
 
 
+// memory budget for propagation work arrays, see OptSystProp_set_propmemlimit()
+static long OptSystProp_propmemlimitMB = 1024;
+
+
+
+/// Set memory budget [MB] for work arrays of OptSystProp_propagateCube
+/// wavelengths are propagated in batches fitting in this budget (at least one wavelength per batch)
+int OptSystProp_set_propmemlimit(long memMB)
+{
+    OptSystProp_propmemlimitMB = memMB;
+
+    return 0;
+}
+
+
+
+
+/// Propagate amplitude/phase cube (one slice per wavelength) by zprop
+/// wavelengths are processed in batches: each batch is converted to a complex cube and propagated with
+/// a single batched FFT pair (Fresnel_propagate_wavefront_multilambda)
 int OptSystProp_propagateCube(OPTSYST *optsyst, long index, const char *IDin_amp_name, const char *IDin_pha_name, const char *IDout_amp_name, const char *IDout_pha_name, double zprop, int sharedmem)
 {
-    int kl;
     long ii;
     long size;
     long size2;
+    long nblambda;
+    long NBlambdabatch;
+    long kl0;
     long IDin_amp, IDin_pha;
-    long IDc_in;
     long IDout_amp, IDout_pha;
     uint32_t *imsizearray;
-    double amp, pha, re, im;
 
 
 
@@ -96,14 +116,19 @@ int OptSystProp_propagateCube(OPTSYST *optsyst, long index, const char *IDin_amp
     IDin_pha = image_ID(IDin_pha_name);
     size = data.image[IDin_amp].md[0].size[0];
     size2 = size*size;
-    IDc_in = create_2DCimage_ID("tmppropCin", size, size);
-
+    nblambda = optsyst[index].nblambda;
 
+    // batch input + FFT output + propagated output, complex float
+    NBlambdabatch = (long) (1024.0*1024.0*OptSystProp_propmemlimitMB/(3.0*sizeof(complex_float)*size2));
+    if(NBlambdabatch < 1)
+        NBlambdabatch = 1;
+    if(NBlambdabatch > nblambda)
+        NBlambdabatch = nblambda;
    
     imsizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
     imsizearray[0] = size;
     imsizearray[1] = size;
-    imsizearray[2] = optsyst[index].nblambda;
+    imsizearray[2] = nblambda;
     
     IDout_amp = image_ID(IDout_amp_name);
 
@@ -119,35 +144,50 @@ int OptSystProp_propagateCube(OPTSYST *optsyst, long index, const char *IDin_amp
     data.image[IDout_amp].md[0].write = 1;
     data.image[IDout_pha].md[0].write = 1;
     
-    for(kl=0; kl<optsyst[index].nblambda; kl++)
+    for(kl0=0; kl0<nblambda; kl0+=NBlambdabatch)
     {
-		long IDc_out; 
+		long IDc_in, IDc_out;
+		long nbl = NBlambdabatch;
 		
-        printf("kl = %d / %d  %g\n", kl, optsyst[index].nblambda, optsyst[index].lambdaarray[kl]);
+		if(kl0+nbl > nblambda)
+			nbl = nblambda-kl0;
+
+        printf("kl = %ld-%ld / %ld\n", kl0, kl0+nbl-1, nblambda);
+
+        imsizearray[2] = nbl;
+        IDc_in = create_image_ID("tmppropCin", 3, imsizearray, _DATATYPE_COMPLEX_FLOAT, 0, 0);
+
         // convert from amp/phase to Re/Im
-        for(ii=0; ii<size2; ii++)
+# ifdef HAVE_LIBGOMP
+        #pragma omp parallel for
+# endif
+        for(ii=0; ii<nbl*size2; ii++)
         {
-            amp = data.image[IDin_amp].array.F[kl*size2+ii];
-            pha = data.image[IDin_pha].array.F[kl*size2+ii];
+            double amp = data.image[IDin_amp].array.F[kl0*size2+ii];
+            double pha = data.image[IDin_pha].array.F[kl0*size2+ii];
             data.image[IDc_in].array.CF[ii].re = amp*cos(pha);
             data.image[IDc_in].array.CF[ii].im = amp*sin(pha);
         }
         // do the actual propagation
-        Fresnel_propagate_wavefront("tmppropCin", "tmppropCout", optsyst[index].pixscale, zprop, optsyst[index].lambdaarray[kl]);
+        Fresnel_propagate_wavefront_multilambda("tmppropCin", "tmppropCout", optsyst[index].pixscale, zprop, &optsyst[index].lambdaarray[kl0]);
+        delete_image_ID("tmppropCin");
+        fft_gpu_sync("tmppropCout");
 
         IDc_out = image_ID("tmppropCout");
         // convert back from Re/Im to amp/phase
-        for(ii=0; ii<size2; ii++)
+# ifdef HAVE_LIBGOMP
+        #pragma omp parallel for
+# endif
+        for(ii=0; ii<nbl*size2; ii++)
         {
-            re = data.image[IDc_out].array.CF[ii].re;
-            im = data.image[IDc_out].array.CF[ii].im;
-            amp = sqrt(re*re+im*im);
-            pha = atan2(im,re);
-            data.image[IDout_amp].array.F[kl*size2+ii] = amp;
-            data.image[IDout_pha].array.F[kl*size2+ii] = pha;
+            double re = data.image[IDc_out].array.CF[ii].re;
+            double im = data.image[IDc_out].array.CF[ii].im;
+            data.image[IDout_amp].array.F[kl0*size2+ii] = sqrt(re*re+im*im);
+            data.image[IDout_pha].array.F[kl0*size2+ii] = atan2(im,re);
         }
         delete_image_ID("tmppropCout");
     }
+    free(imsizearray);
     
     data.image[IDout_amp].md[0].cnt0++;
     data.image[IDout_pha].md[0].cnt0++;
@@ -341,6 +381,12 @@ int OptSystProp_run(OPTSYST *optsyst, long index, long elemstart, long elemend,
             // do the real propagation via Fresnel propagation
             OptSystProp_propagateCube(optsyst, 0, imnameamp_in, imnamepha_in, imnameamp_out, imnamepha_out, propdist, sharedmem);
         }
+        else if((elem>0)&&(optsyst[index].keepMem[elem-1]==0)&&(sharedmem==0))
+        {
+            // input not needed downstream: hand over its arrays instead of copying
+            chname_image_ID(imnameamp_in, imnameamp_out);
+            chname_image_ID(imnamepha_in, imnamepha_out);
+        }
         else // do the trivial identity propagation
         {
             copy_image_ID(imnameamp_in, imnameamp_out, sharedmem);
@@ -350,8 +396,7 @@ int OptSystProp_run(OPTSYST *optsyst, long index, long elemstart, long elemend,
         IDp = image_ID(imnamepha_out);
 
         /// discard element memory after used
-        printf("*********** %ld  -> %d\n", elem-1, optsyst[index].keepMem[elem-1]);
-        if((optsyst[index].keepMem[elem-1]==0)&&(sharedmem==0))
+        if((elem>0)&&(optsyst[index].keepMem[elem-1]==0)&&(sharedmem==0)&&(image_ID(imnameamp_in)!=-1))
         {
             printf("********** Deleting element %ld      %s %s\n", elem-1, imnameamp_in, imnamepha_in);
             delete_image_ID(imnameamp_in);
@@ -505,15 +550,22 @@ int OptSystProp_run(OPTSYST *optsyst, long index, long elemstart, long elemend,
             
             if(optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].init!=1)
             {
+                double *n0array = (double*) malloc(sizeof(double)*nblambda);
+                double *n1array = (double*) malloc(sizeof(double)*nblambda);
+
+                // get the indices of refraction, n0 for ambient index, n1 for the lens index etc.
+                OPTICSMATERIALS_n_batch( optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].mat0, optsyst[index].lambdaarray, n0array, nblambda);
+                OPTICSMATERIALS_n_batch( optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].mat1, optsyst[index].lambdaarray, n1array, nblambda);
                 for(kl=0; kl<nblambda; kl++)
                 {
-                    // get the indices of refraction, n0 for ambient index, n1 for the lens index etc.
-                    n0 = OPTICSMATERIALS_n( optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].mat0, optsyst[index].lambdaarray[kl]);
-                    n1 = OPTICSMATERIALS_n( optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].mat1, optsyst[index].lambdaarray[kl]);
+                    n0 = n0array[kl];
+                    n1 = n1array[kl];
                     // set the resulting wavelength-dependent phase coefficient
                     optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].ncoeff[kl] = 2.0*M_PI*(n0-n1)/optsyst[index].lambdaarray[kl];
 //                    printf("optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].ncoeff[kl] = %f %f %g -> %f\n", n0, n1, optsyst[index].lambdaarray[kl], optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].ncoeff[kl]);
                 }
+                free(n0array);
+                free(n1array);
                 optsyst[index].ASPHSURFRarray[optsyst[index].elemarrayindex[elem]].init = 1;
             }
 
@@ -119,6 +119,8 @@ int_fast8_t init_OptSystProp();
 
 
 
+int OptSystProp_set_propmemlimit(long memMB);
+
 int OptSystProp_propagateCube(OPTSYST *optsyst, long index, const char *IDin_amp_name, const char *IDin_pha_name, const char *IDout_amp_name, const char *IDout_pha_name, double zprop, int sharedmem);
 
 int OptSystProp_run(OPTSYST *optsyst, long index, long elemstart, long elemend, const char *savedir, int sharedmem);
@@ -1,6 +1,21 @@
 #ifndef _OPTICSMATERIALS_H
 #define _OPTICSMATERIALS_H
 
+// tabulated refractive index of a material, see OPTICSMATERIALS_ntable()
+typedef struct
+{
+    int material;
+    double lambda0;          // valid range [m]
+    double lambda1;
+    int direct;              // 1 if table is not used (tabulated material data, or spline not accurate)
+    long NBpt;
+    double l0;               // wavelength of first node [m]
+    double dl;               // node spacing [m]
+    double *n;               // index at nodes
+    double *d2;              // spline second derivatives
+} OPTICSMATERIALS_NTABLE;
+
+
 int init_OpticsMaterials();
 
 
@@ -13,4 +28,14 @@ double OPTICSMATERIALS_n( int material, double lambda);
 // phase offset as function of mask thickness and lambda
 double OPTICSMATERIALS_pha_lambda( int material, double z, double lambda );
 
+OPTICSMATERIALS_NTABLE *OPTICSMATERIALS_ntable(int material, double lambda0, double lambda1);
+
+void OPTICSMATERIALS_ntable_free();
+
+double OPTICSMATERIALS_ntable_n(const OPTICSMATERIALS_NTABLE *tab, double lambda);
+
+int OPTICSMATERIALS_n_batch(int material, const double *lambda, double *n, long NBlambda);
+
+int OPTICSMATERIALS_pha_lambda_batch(int material, double z, const double *lambda, double *pha, long NBlambda);
+
 #endif
@@ -21,10 +21,12 @@
 #include <malloc.h>
 #include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <fitsio.h> 
 
 #include "CLIcore.h"
+#include "00CORE/00CORE.h"
 #include "COREMOD_memory/COREMOD_memory.h"
 #include "COREMOD_arith/COREMOD_arith.h"
 #include "COREMOD_iofits/COREMOD_iofits.h"
@@ -83,83 +85,284 @@ int_fast8_t init_WFpropagate()
 
 
 
-int Fresnel_propagate_wavefront(const char *in, const char *out, double PUPIL_SCALE, double z, double lambda)
+/* =============================================================================================== */
+/*                                FRESNEL TRANSFER FUNCTION CACHE                                  */
+/* =============================================================================================== */
+
+/*
+ * Fresnel transfer function H = exp(-i PI z lambda (u^2+v^2)) / (nx*ny), in FFT layout:
+ * unshifted frequency coordinates for even sizes, quadrant-swapped (permut) layout for odd sizes.
+ * Entries are keyed by (size, pixel scale, z, lambda, precision) and evicted least-recently-used
+ * when the total exceeds WFpropagate_TFcachememMB.
+ */
+
+#define WFPROPAGATE_TFCACHE_NBENTRY 256
+
+typedef struct
 {
-    /* all units are in m */
-    double coeff;
-    long ii,jj,ii1,jj1;
-    long naxes[2];
-    long ID;
-    double sqdist;
-    double re, im;
-    double angle;
-    double co1;
-    long ii2, jj2;
-    long n0h;
-    int atype;
+    int used;
+    long nx;
+    long ny;
+    double pixscale;
+    double z;
+    double lambda;
+    int dbl;           // 1 if complex double
+    void *H;
+    size_t nbbyte;
+    int pinned;        // in use by current propagation, not evicted
+    uint64_t lastuse;
+} WFPROPAGATE_TFCACHE_ENTRY;
+
+static WFPROPAGATE_TFCACHE_ENTRY WFpropagate_TFcache[WFPROPAGATE_TFCACHE_NBENTRY];
+static size_t WFpropagate_TFcachemem = 0;
+static uint64_t WFpropagate_TFcacheclock = 0;
+static long WFpropagate_TFcachememMB = 512;
+
+
+
+/// Set memory cap [MB] of Fresnel transfer function cache (0: no caching across calls)
+int WFpropagate_set_TFcachemem(long memMB)
+{
+    WFpropagate_TFcachememMB = memMB;
 
+    return 0;
+}
 
-    do2dfft(in, "tmp");
-    permut("tmp");
-    ID = image_ID("tmp");
-    atype = data.image[ID].md[0].atype;
 
 
+int WFpropagate_TFcache_flush()
+{
+    long k;
+
+    for(k=0; k<WFPROPAGATE_TFCACHE_NBENTRY; k++)
+        if((WFpropagate_TFcache[k].used == 1)&&(WFpropagate_TFcache[k].pinned == 0))
+        {
+            free(WFpropagate_TFcache[k].H);
+            WFpropagate_TFcachemem -= WFpropagate_TFcache[k].nbbyte;
+            WFpropagate_TFcache[k].used = 0;
+        }
+
+    return 0;
+}
 
 
 
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    coeff = PI*z*lambda/(PUPIL_SCALE*naxes[0])/(PUPIL_SCALE*naxes[0]);
+// evict least recently used unpinned entries until cache fits in memory cap
+static void WFpropagate_TFcache_trim()
+{
+    while(WFpropagate_TFcachemem > (size_t) WFpropagate_TFcachememMB*1024*1024)
+    {
+        long k;
+        long kevict = -1;
+        uint64_t tmin = UINT64_MAX;
 
-    co1 = 1.0*naxes[0]*naxes[1];
-    n0h = naxes[0]/2;
+        for(k=0; k<WFPROPAGATE_TFCACHE_NBENTRY; k++)
+            if((WFpropagate_TFcache[k].used == 1)&&(WFpropagate_TFcache[k].pinned == 0)&&(WFpropagate_TFcache[k].lastuse < tmin))
+            {
+                tmin = WFpropagate_TFcache[k].lastuse;
+                kevict = k;
+            }
+        if(kevict == -1)
+            break;
 
+        free(WFpropagate_TFcache[kevict].H);
+        WFpropagate_TFcachemem -= WFpropagate_TFcache[kevict].nbbyte;
+        WFpropagate_TFcache[kevict].used = 0;
+    }
+}
 
-//	printf("coeff = %g     co1 = %g\n", coeff, co1);
 
-    if(atype == _DATATYPE_COMPLEX_FLOAT)
+
+// returns pinned cache entry holding transfer function, computing it if needed
+static WFPROPAGATE_TFCACHE_ENTRY *WFpropagate_TFget(long nx, long ny, double PUPIL_SCALE, double z, double lambda, int dbl)
+{
+    long k;
+    long kfree = -1;
+    WFPROPAGATE_TFCACHE_ENTRY *e;
+    double coeff;
+    int shifted;
+
+
+    WFpropagate_TFcacheclock++;
+
+    for(k=0; k<WFPROPAGATE_TFCACHE_NBENTRY; k++)
     {
-        for(jj=0; jj<naxes[1]; jj++)
+        e = &WFpropagate_TFcache[k];
+        if(e->used == 0)
+        {
+            if(kfree == -1)
+                kfree = k;
+            continue;
+        }
+        if((e->nx == nx)&&(e->ny == ny)&&(e->pixscale == PUPIL_SCALE)&&(e->z == z)&&(e->lambda == lambda)&&(e->dbl == dbl))
         {
-            jj1 = naxes[0]*jj;
-            jj2 = (jj-naxes[1]/2)*(jj-naxes[1]/2);
-            for(ii=0; ii<naxes[0]; ii++)
+            e->lastuse = WFpropagate_TFcacheclock;
+            e->pinned++;
+            return(e);
+        }
+    }
+
+    if(kfree == -1)
+    {
+        // table full: evict least recently used unpinned entry
+        uint64_t tmin = UINT64_MAX;
+
+        for(k=0; k<WFPROPAGATE_TFCACHE_NBENTRY; k++)
+            if((WFpropagate_TFcache[k].pinned == 0)&&(WFpropagate_TFcache[k].lastuse < tmin))
             {
-                ii1 = jj1+ii;
-                ii2 = ii-n0h;
-                sqdist = ii2*ii2+jj2;
-                angle = -coeff*sqdist;
-                re = data.image[ID].array.CF[ii1].re/co1;
-                im = data.image[ID].array.CF[ii1].im/co1;
-                data.image[ID].array.CF[ii1].re = re*cos(angle) - im*sin(angle);
-                data.image[ID].array.CF[ii1].im = re*sin(angle) + im*cos(angle);
+                tmin = WFpropagate_TFcache[k].lastuse;
+                kfree = k;
             }
+        if(kfree == -1)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"Fresnel transfer function cache full");
+            exit(0);
         }
+        free(WFpropagate_TFcache[kfree].H);
+        WFpropagate_TFcachemem -= WFpropagate_TFcache[kfree].nbbyte;
+        WFpropagate_TFcache[kfree].used = 0;
     }
-    else
+
+    e = &WFpropagate_TFcache[kfree];
+    e->nx = nx;
+    e->ny = ny;
+    e->pixscale = PUPIL_SCALE;
+    e->z = z;
+    e->lambda = lambda;
+    e->dbl = dbl;
+    e->nbbyte = ((dbl == 1) ? sizeof(complex_double) : sizeof(complex_float))*nx*ny;
+    e->H = malloc(e->nbbyte);
+    if(e->H == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc error");
+        exit(0);
+    }
+
+    coeff = PI*z*lambda/(PUPIL_SCALE*nx)/(PUPIL_SCALE*nx);
+    shifted = ((nx%2 == 0)&&(ny%2 == 0)) ? 0 : 1;
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for
+# endif
+    for(long jj=0; jj<ny; jj++)
     {
-        for(jj=0; jj<naxes[1]; jj++)
+        long ii, jj2;
+
+        if(shifted == 1)
+            jj2 = (jj-ny/2)*(jj-ny/2);
+        else
+            jj2 = (jj<ny/2) ? jj*jj : (jj-ny)*(jj-ny);
+
+        for(ii=0; ii<nx; ii++)
         {
-            jj1 = naxes[0]*jj;
-            jj2 = (jj-naxes[1]/2)*(jj-naxes[1]/2);
-            for(ii=0; ii<naxes[0]; ii++)
+            long ii2;
+            double angle;
+
+            if(shifted == 1)
+                ii2 = ii-nx/2;
+            else
+                ii2 = (ii<nx/2) ? ii : ii-nx;
+            angle = -coeff*(ii2*ii2+jj2);
+
+            if(dbl == 1)
+            {
+                ((complex_double*) e->H)[jj*nx+ii].re = cos(angle)/nx/ny;
+                ((complex_double*) e->H)[jj*nx+ii].im = sin(angle)/nx/ny;
+            }
+            else
             {
-                ii1 = jj1+ii;
-                ii2 = ii-n0h;
-                sqdist = ii2*ii2+jj2;
-                angle = -coeff*sqdist;
-                re = data.image[ID].array.CD[ii1].re/co1;
-                im = data.image[ID].array.CD[ii1].im/co1;
-                data.image[ID].array.CD[ii1].re = re*cos(angle) - im*sin(angle);
-                data.image[ID].array.CD[ii1].im = re*sin(angle) + im*cos(angle);
+                ((complex_float*) e->H)[jj*nx+ii].re = cos(angle)/nx/ny;
+                ((complex_float*) e->H)[jj*nx+ii].im = sin(angle)/nx/ny;
             }
         }
     }
-    
-    permut("tmp");
-	
-    
+
+    e->used = 1;
+    e->pinned = 1;
+    e->lastuse = WFpropagate_TFcacheclock;
+    WFpropagate_TFcachemem += e->nbbyte;
+
+    return(e);
+}
+
+
+
+static void WFpropagate_TFrelease(WFPROPAGATE_TFCACHE_ENTRY *e)
+{
+    e->pinned--;
+    WFpropagate_TFcache_trim();
+}
+
+
+
+// multiply slice kk of complex image ID by transfer function
+static void WFpropagate_TFapply(long ID, long kk, const WFPROPAGATE_TFCACHE_ENTRY *e)
+{
+    long nelem = e->nx*e->ny;
+    long ii;
+
+    if(e->dbl == 1)
+    {
+        complex_double *im = data.image[ID].array.CD + kk*nelem;
+        const complex_double *H = (const complex_double*) e->H;
+
+# ifdef HAVE_LIBGOMP
+        #pragma omp parallel for
+# endif
+        for(ii=0; ii<nelem; ii++)
+        {
+            double re = im[ii].re;
+            double imv = im[ii].im;
+            im[ii].re = re*H[ii].re - imv*H[ii].im;
+            im[ii].im = re*H[ii].im + imv*H[ii].re;
+        }
+    }
+    else
+    {
+        complex_float *im = data.image[ID].array.CF + kk*nelem;
+        const complex_float *H = (const complex_float*) e->H;
+
+# ifdef HAVE_LIBGOMP
+        #pragma omp parallel for
+# endif
+        for(ii=0; ii<nelem; ii++)
+        {
+            float re = im[ii].re;
+            float imv = im[ii].im;
+            im[ii].re = re*H[ii].re - imv*H[ii].im;
+            im[ii].im = re*H[ii].im + imv*H[ii].re;
+        }
+    }
+}
+
+
+
+
+
+int Fresnel_propagate_wavefront(const char *in, const char *out, double PUPIL_SCALE, double z, double lambda)
+{
+    /* all units are in m */
+    long ID;
+    int shifted;
+    WFPROPAGATE_TFCACHE_ENTRY *tf;
+
+
+    do2dfft(in, "tmp");
+    fft_gpu_sync("tmp");
+    ID = image_ID("tmp");
+
+    // for even sizes, transfer function is in unshifted frequency coordinates (no quadrant swap needed)
+    shifted = ((data.image[ID].md[0].size[0]%2 == 0)&&(data.image[ID].md[0].size[1]%2 == 0)) ? 0 : 1;
+    if(shifted == 1)
+        permut("tmp");
+
+    tf = WFpropagate_TFget(data.image[ID].md[0].size[0], data.image[ID].md[0].size[1], PUPIL_SCALE, z, lambda, (data.image[ID].md[0].atype == _DATATYPE_COMPLEX_DOUBLE) ? 1 : 0);
+    WFpropagate_TFapply(ID, 0, tf);
+    WFpropagate_TFrelease(tf);
+
+    if(shifted == 1)
+        permut("tmp");
+
     do2dffti("tmp", out);
     
    
@@ -171,6 +374,54 @@ int Fresnel_propagate_wavefront(const char *in, const char *out, double PUPIL_SC
 
 
 
+/*
+ * Fresnel propagation of a cube of complex amplitudes, one slice per wavelength (lambdaarray[kk] for slice kk)
+ * all slices are transformed by a single batched 2D FFT, transfer functions are taken from cache
+ */
+int Fresnel_propagate_wavefront_multilambda(const char *in, const char *out, double PUPIL_SCALE, double z, const double *lambdaarray)
+{
+    long ID;
+    long nx, ny, nz;
+    long kk;
+    int dbl;
+    int shifted;
+    char tmpname[SBUFFERSIZE];
+
+
+    sprintf(tmpname, "_tmpFresnelml_%d", (int) getpid());
+    do2dfft(in, tmpname);
+    ID = image_ID(tmpname);
+    dbl = (data.image[ID].md[0].atype == _DATATYPE_COMPLEX_DOUBLE) ? 1 : 0;
+
+    nx = data.image[ID].md[0].size[0];
+    ny = data.image[ID].md[0].size[1];
+    nz = (data.image[ID].md[0].naxis == 3) ? data.image[ID].md[0].size[2] : 1;
+
+    // same convention as Fresnel_propagate_wavefront
+    shifted = ((nx%2 == 0)&&(ny%2 == 0)) ? 0 : 1;
+    if(shifted == 1)
+        permut(tmpname);
+
+    fft_gpu_sync(tmpname);
+
+    for(kk=0; kk<nz; kk++)
+    {
+        WFPROPAGATE_TFCACHE_ENTRY *tf;
+
+        tf = WFpropagate_TFget(nx, ny, PUPIL_SCALE, z, lambdaarray[kk], dbl);
+        WFpropagate_TFapply(ID, kk, tf);
+        WFpropagate_TFrelease(tf);
+    }
+
+    if(shifted == 1)
+        permut(tmpname);
+
+    do2dffti(tmpname, out);
+    delete_image_ID(tmpname);
+
+    return(0);
+}
+
 
 
 
@@ -375,16 +626,33 @@ long Fresnel_propagate_cube(const char *IDcin_name, const char *IDout_name_amp,
         IDoutp = create_3Dimage_ID_double(IDout_name_pha,xsize,ysize,NBzpts);
     }
 
+    // input spectrum computed once, each plane is transfer function multiply + inverse FFT
+    do2dfft(IDcin_name, "_propcubeft");
+    fft_gpu_sync("_propcubeft");
+    if(((xsize%2)==1)||((ysize%2)==1))
+        permut("_propcubeft");
+
     for(kk=0; kk<NBzpts; kk++)
     {
 		double zprop;
 		long IDtmp;
 		long ii, jj;
 		double re, im, amp, pha;
+		WFPROPAGATE_TFCACHE_ENTRY *tf;
 		
         zprop = zstart + (zend-zstart)*kk/NBzpts;
         printf("[%ld] propagating by %f m\n",kk,zprop);
-        Fresnel_propagate_wavefront(IDcin_name, "_propim", PUPIL_SCALE, zprop, lambda);
+
+        copy_image_ID("_propcubeft", "_propcubeft1", 0);
+        IDtmp = image_ID("_propcubeft1");
+        tf = WFpropagate_TFget(xsize, ysize, PUPIL_SCALE, zprop, lambda, (atype == _DATATYPE_COMPLEX_DOUBLE) ? 1 : 0);
+        WFpropagate_TFapply(IDtmp, 0, tf);
+        WFpropagate_TFrelease(tf);
+        if(((xsize%2)==1)||((ysize%2)==1))
+            permut("_propcubeft1");
+        do2dffti("_propcubeft1", "_propim");
+        delete_image_ID("_propcubeft1");
+        fft_gpu_sync("_propim");
         IDtmp = image_ID("_propim");
         if(atype == _DATATYPE_COMPLEX_FLOAT)
         {
@@ -415,6 +683,7 @@ long Fresnel_propagate_cube(const char *IDcin_name, const char *IDout_name_amp,
 
         delete_image_ID("_propim");
     }
+    delete_image_ID("_propcubeft");
 
     return(0);
 }
@@ -5,8 +5,14 @@
 int_fast8_t init_WFpropagate();
 
 
+int WFpropagate_set_TFcachemem(long memMB);
+
+int WFpropagate_TFcache_flush();
+
 int Fresnel_propagate_wavefront(const char *in, const char *out, double PUPIL_SCALE, double z, double lambda);
 
+int Fresnel_propagate_wavefront_multilambda(const char *in, const char *out, double PUPIL_SCALE, double z, const double *lambdaarray);
+
 int Init_Fresnel_propagate_wavefront(const char *Cim, long size, double PUPIL_SCALE, double z, double lambda, double FPMASKRAD, int Precision);
 
 int Fresnel_propagate_wavefront1(const char *in, const char *out, const char *Cin);
@@ -6,8 +6,10 @@
 
 
 #include <fitsio.h>  /* required by every program that uses CFITSIO  */
+#include <gsl/gsl_cblas.h>
 
 #include "CLIcore.h"
+#include "00CORE/00CORE.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
 #include "COREMOD_iofits/COREMOD_iofits.h"
@@ -26,6 +28,15 @@ extern DATA data;
 ZERNIKE Zernike;
 
 
+// cached basis for fitting : modes sampled on pixels inside rpix, mode-major
+static long   ZERcache_size = 0;
+static float  ZERcache_rpix = 0.0;
+static long   ZERcache_NBzer = 0;
+static long   ZERcache_NBpix = 0;
+static long  *ZERcache_pixindex = NULL;
+static float *ZERcache_basis = NULL;
+
+
 
 // CLI commands
 //
@@ -210,40 +221,241 @@ double Zernike_value(long j, double r, double PA)
 {
   long i;
   double value = 0.0;
-  double tmp,s2;
   long n,m;
 
   n = Zernike.Zer_n[j]+1;
   m = Zernike.Zer_m[j];
-  s2 = sqrt(2.0);
- 
-  if (m==0)
+
+  /* Horner scheme on radial coefficients */
+  for (i=n-1;i>=0;i--)
+    value = value*r + Zernike.R_array[j*Zernike.ZERMAX+i];
+
+  if (m<0)
+    value *= -sqrt(2.0)*sin(m*PA);
+  else if (m>0)
+    value *= sqrt(2.0)*cos(m*PA);
+
+  return(value);
+}
+
+
+
+
+//
+// evaluates Zernikes 0 to NBzer-1 at a single point in one pass
+// radial terms from R_n^m = r (R_{n-1}^{|m-1|} + R_{n-1}^{m+1}) - R_{n-2}^m
+// angular terms from Chebyshev recurrence on (ct, st) = (cos, sin) of PA
+// Rbuf holds (nmax+1)*(nmax+2) values, cbuf and sbuf nmax+1 values
+//
+static void zernike_eval_series(long NBzer, long nmax, double r, double ct, double st, double *Rbuf, double *cbuf, double *sbuf, double *out)
+{
+  long n, m, j;
+  long w = nmax+2;
+
+  memset(Rbuf, 0, sizeof(double)*(nmax+1)*w);
+  Rbuf[0] = 1.0;
+  for(n=1;n<=nmax;n++)
+    for(m=n%2;m<=n;m+=2)
+      {
+	double v;
+
+	v = r*(Rbuf[(n-1)*w+labs(m-1)] + Rbuf[(n-1)*w+m+1]);
+	if(n>1)
+	  v -= Rbuf[(n-2)*w+m];
+	Rbuf[n*w+m] = v;
+      }
+
+  cbuf[0] = 1.0;
+  sbuf[0] = 0.0;
+  if(nmax>0)
     {
-      for (i=0;i<n;i++)
-	{
-	  tmp = Zernike.R_array[j*Zernike.ZERMAX+i];
-	  if (tmp!=0)
-	    value += pow(r,i)*tmp;
-	}
+      cbuf[1] = ct;
+      sbuf[1] = st;
     }
-  else
+  for(m=2;m<=nmax;m++)
     {
-      for (i=0;i<n;i++)
-	{
-	  tmp = Zernike.R_array[j*Zernike.ZERMAX+i];
-	  if (tmp!=0)
-	    {
-	      if (m<0)
-		value -= tmp*s2*pow(r,i)*sin(m*PA);
-	      else
-		value += tmp*s2*pow(r,i)*cos(m*PA);
-	    }
-	}
+      cbuf[m] = 2.0*ct*cbuf[m-1] - cbuf[m-2];
+      sbuf[m] = 2.0*ct*sbuf[m-1] - sbuf[m-2];
     }
 
-  return(value);
+  for(j=0;j<NBzer;j++)
+    {
+      double v;
+
+      n = Zernike.Zer_n[j];
+      m = Zernike.Zer_m[j];
+      v = sqrt(n+1)*Rbuf[n*w+labs(m)];
+      if(m>0)
+	v *= sqrt(2.0)*cbuf[m];
+      else if(m<0)
+	v *= sqrt(2.0)*sbuf[-m];
+      out[j] = v;
+    }
+}
+
+
+
+
+//
+// builds (or reuses) basis cache for given size, radius and number of modes
+// pixel geometry and normalization follow mk_zer : modes j>0 have unit mean square over the pupil
+// returns number of pupil pixels, -1 on failure
+//
+static long zernike_basis_cache(long SIZE, long zer_nb, float rpix)
+{
+  long ii, jj, j, p;
+  long NBpix;
+  long nmax;
+
+  if(Zernike.init==0)
+    zernike_init();
+
+  if((zer_nb<1)||(zer_nb>Zernike.ZERMAX))
+    {
+      printERROR(__FILE__,__func__,__LINE__,"number of modes out of range");
+      return(-1);
+    }
+
+  if((ZERcache_basis!=NULL)&&(ZERcache_size==SIZE)&&(ZERcache_rpix==rpix)&&(ZERcache_NBzer>=zer_nb))
+    return(ZERcache_NBpix);
+
+  free(ZERcache_pixindex);
+  free(ZERcache_basis);
+  ZERcache_pixindex = NULL;
+  ZERcache_basis = NULL;
+  ZERcache_NBzer = 0;
+
+  NBpix = 0;
+  for(jj=0;jj<SIZE;jj++)
+    for(ii=0;ii<SIZE;ii++)
+      {
+	double x = 1.0*(ii-SIZE/2);
+	double y = 1.0*(jj-SIZE/2);
+
+	if(sqrt(x*x+y*y)/rpix < 1.0)
+	  NBpix++;
+      }
+
+  ZERcache_pixindex = (long*) malloc(sizeof(long)*NBpix);
+  ZERcache_basis = (float*) malloc(sizeof(float)*zer_nb*NBpix);
+  if((ZERcache_pixindex==NULL)||(ZERcache_basis==NULL))
+    {
+      printERROR(__FILE__,__func__,__LINE__,"memory allocation failed");
+      free(ZERcache_pixindex);
+      free(ZERcache_basis);
+      ZERcache_pixindex = NULL;
+      ZERcache_basis = NULL;
+      return(-1);
+    }
+
+  p = 0;
+  for(jj=0;jj<SIZE;jj++)
+    for(ii=0;ii<SIZE;ii++)
+      {
+	double x = 1.0*(ii-SIZE/2);
+	double y = 1.0*(jj-SIZE/2);
+
+	if(sqrt(x*x+y*y)/rpix < 1.0)
+	  ZERcache_pixindex[p++] = jj*SIZE+ii;
+      }
+
+  nmax = Zernike.Zer_n[zer_nb-1];
+
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel private(p, j)
+# endif
+  {
+    double *Rbuf = (double*) malloc(sizeof(double)*(nmax+1)*(nmax+2));
+    double *cbuf = (double*) malloc(sizeof(double)*(nmax+1));
+    double *sbuf = (double*) malloc(sizeof(double)*(nmax+1));
+    double *zval = (double*) malloc(sizeof(double)*zer_nb);
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp for schedule(static)
+# endif
+    for(p=0;p<NBpix;p++)
+      {
+	double x = 1.0*(ZERcache_pixindex[p]%SIZE-SIZE/2);
+	double y = 1.0*(ZERcache_pixindex[p]/SIZE-SIZE/2);
+	double rho = sqrt(x*x+y*y);
+	double ct = 1.0;
+	double st = 0.0;
+
+	if(rho>0.0)
+	  {
+	    ct = x/rho;
+	    st = y/rho;
+	  }
+	zernike_eval_series(zer_nb, nmax, rho/rpix, ct, st, Rbuf, cbuf, sbuf, zval);
+	for(j=0;j<zer_nb;j++)
+	  ZERcache_basis[j*NBpix+p] = (float) zval[j];
+      }
+
+    free(Rbuf);
+    free(cbuf);
+    free(sbuf);
+    free(zval);
+  }
+
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel for
+# endif
+  for(j=1;j<zer_nb;j++)
+    {
+      double ss = cblas_dsdot(NBpix, ZERcache_basis+j*NBpix, 1, ZERcache_basis+j*NBpix, 1);
+
+      if(ss>0.0)
+	cblas_sscal(NBpix, (float) sqrt(NBpix/ss), ZERcache_basis+j*NBpix, 1);
+    }
+
+  ZERcache_size = SIZE;
+  ZERcache_rpix = rpix;
+  ZERcache_NBzer = zer_nb;
+  ZERcache_NBpix = NBpix;
+
+  return(NBpix);
 }
 
+
+
+
+//
+// Zernike coefficients of image ID over cached basis (one GEMV)
+// pupil values are written to vec (NBpix) if not NULL
+//
+static int zernike_basis_project(long ID, long max_zer, double radius, double *coeff, float *vec)
+{
+  long SIZE, NBpix, p, j;
+  float *imvec;
+  float *fcoeff;
+
+  SIZE = data.image[ID].md[0].size[0];
+  NBpix = zernike_basis_cache(SIZE, max_zer, (float) radius);
+  if(NBpix<1)
+    return(-1);
+
+  imvec = vec;
+  if(imvec==NULL)
+    imvec = (float*) malloc(sizeof(float)*NBpix);
+  fcoeff = (float*) malloc(sizeof(float)*max_zer);
+
+  for(p=0;p<NBpix;p++)
+    imvec[p] = data.image[ID].array.F[ZERcache_pixindex[p]];
+
+  cblas_sgemv(CblasRowMajor, CblasNoTrans, max_zer, NBpix, 1.0/NBpix, ZERcache_basis, NBpix, imvec, 1, 0.0, fcoeff, 1);
+  for(j=0;j<max_zer;j++)
+    coeff[j] = fcoeff[j];
+
+  free(fcoeff);
+  if(vec==NULL)
+    free(imvec);
+
+  return(0);
+}
+
+
+
+
 long mk_zer(const char *ID_name, long SIZE, long zer_nb, float rpix)
 {
     long ii, jj;
@@ -554,67 +766,67 @@ int mk_zer_series(const char *ID_name, long SIZE, long zer_nb, float rpix)
 
 long mk_zer_seriescube(const char *ID_namec, long SIZE, long zer_nb, float rpix)
 {
-    long ii, jj;
-    double *r;
-    double *theta;
+    long ii, jj, j;
     long ID;
-    long naxes[2];
-    double tmp;
-    char fname[200];
-    long j;
-
-    j=0;
-    naxes[0] = SIZE;
-    naxes[1] = SIZE;
+    long nmax;
 
     if(Zernike.init==0)
         zernike_init();
 
-    ID = create_3Dimage_ID(ID_namec, SIZE, SIZE, zer_nb);
-//    ID = image_ID("ztmp");
-
-    r = (double*) malloc(SIZE*SIZE*sizeof(double));
-    theta = (double*) malloc(SIZE*SIZE*sizeof(double));
-
-    if ((r==NULL)||(theta==NULL))
-        printf("error in memory allocation !!!\n");
+    if((zer_nb<1)||(zer_nb>Zernike.ZERMAX))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"number of modes out of range");
+        return(-1);
+    }
 
-    /* let's compute the polar coordinates */
-    for (ii=0; ii<SIZE; ii++)
-        for (jj=0; jj<SIZE; jj++)
-        {
-            r[jj*naxes[0]+ii] = sqrt((0.5+ii-SIZE/2)*(0.5+ii-SIZE/2)+(0.5+jj-SIZE/2)*(0.5+jj-SIZE/2))/rpix;
-            theta[jj*naxes[0]+ii] = atan2((jj-SIZE/2),(ii-SIZE/2));
-        }
+    ID = create_3Dimage_ID(ID_namec, SIZE, SIZE, zer_nb);
+    nmax = Zernike.Zer_n[zer_nb-1];
 
-    /* let's make the Zernikes */
-    for (ii=0; ii<SIZE; ii++)
-        for (jj=0; jj<SIZE; jj++)
-        {
-            tmp = r[jj*naxes[0]+ii];
-            if(tmp < 1.0)
-                data.image[ID].array.F[jj*SIZE+ii] = 1.0;
-            else
-                data.image[ID].array.F[jj*SIZE+ii] = 0.0;
-        }
-    for (j=1; j<zer_nb; j++)
+    /* all modes evaluated in one pass per pixel */
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel private(ii, jj, j)
+# endif
     {
-        /*	printf("%ld/%ld\n",j,zer_nb);*/
-//        fflush(stdout);
-
-        for (ii=0; ii<SIZE; ii++)
-            for (jj=0; jj<SIZE; jj++)
+        double *Rbuf = (double*) malloc(sizeof(double)*(nmax+1)*(nmax+2));
+        double *cbuf = (double*) malloc(sizeof(double)*(nmax+1));
+        double *sbuf = (double*) malloc(sizeof(double)*(nmax+1));
+        double *zval = (double*) malloc(sizeof(double)*zer_nb);
+
+# ifdef HAVE_LIBGOMP
+        #pragma omp for schedule(static)
+# endif
+        for (jj=0; jj<SIZE; jj++)
+            for (ii=0; ii<SIZE; ii++)
             {
-                tmp = r[jj*naxes[0]+ii];
-                if(tmp < 1.0)
-                    data.image[ID].array.F[j*SIZE*SIZE + jj*SIZE + ii] = Zernike_value(j,tmp,theta[jj*naxes[0]+ii]);
+                double r = sqrt((0.5+ii-SIZE/2)*(0.5+ii-SIZE/2)+(0.5+jj-SIZE/2)*(0.5+jj-SIZE/2))/rpix;
+
+                if(r < 1.0)
+                {
+                    double x = 1.0*(ii-SIZE/2);
+                    double y = 1.0*(jj-SIZE/2);
+                    double rho = sqrt(x*x+y*y);
+                    double ct = 1.0;
+                    double st = 0.0;
+
+                    if(rho>0.0)
+                    {
+                        ct = x/rho;
+                        st = y/rho;
+                    }
+                    zernike_eval_series(zer_nb, nmax, r, ct, st, Rbuf, cbuf, sbuf, zval);
+                    for (j=0; j<zer_nb; j++)
+                        data.image[ID].array.F[j*SIZE*SIZE + jj*SIZE + ii] = (float) zval[j];
+                }
                 else
-                    data.image[ID].array.F[j*SIZE*SIZE + jj*SIZE + ii] = 0.0;
+                    for (j=0; j<zer_nb; j++)
+                        data.image[ID].array.F[j*SIZE*SIZE + jj*SIZE + ii] = 0.0;
             }
-	}
 
-    free(r);
-    free(theta);
+        free(Rbuf);
+        free(cbuf);
+        free(sbuf);
+        free(zval);
+    }
 
     return(ID);
 }
@@ -698,9 +910,13 @@ double get_zer_crop(const char *ID_name, long zer_nb, double radius, double radi
 int get_zerns(const char *ID_name, long max_zer, double radius)
 {
   long i;
-  
-  for(i=0;i<max_zer;i++)
-    printf("%ld %e\n",i,get_zer(ID_name,i,radius));
+  double *coeff;
+
+  coeff = (double*) malloc(sizeof(double)*max_zer);
+  if(zernike_basis_project(image_ID(ID_name), max_zer, radius, coeff, NULL)==0)
+    for(i=0;i<max_zer;i++)
+      printf("%ld %e\n",i,coeff[i]);
+  free(coeff);
 
   return(0);
 }
@@ -709,44 +925,45 @@ int get_zerns(const char *ID_name, long max_zer, double radius)
 
 int get_zern_array(const char *ID_name, long max_zer, double radius, double *array)
 {
-  long i;
-
-  for(i=0;i<max_zer;i++)
-    {
-		  double tmp;
-		  
-      tmp = get_zer(ID_name,i,radius);
-      /*     printf("%ld %e\n",i,tmp);*/
-      array[i] = tmp;
-    }
-
-  return(0);
+  return(zernike_basis_project(image_ID(ID_name), max_zer, radius, array, NULL));
 }
 
 
 
 int remove_zerns(const char *ID_name, const char *ID_name_out, int max_zer, double radius)
 {
-  int i;
-  long ID;
-  long SIZE;
+  long ID, IDout;
+  long p;
+  double *coeff;
+  float *fcoeff;
+  float *vec;
+  long NBpix;
 
-  copy_image_ID(ID_name, ID_name_out, 0);
   ID = image_ID(ID_name);
-  SIZE = data.image[ID].md[0].size[0];
-  for(i=0;i<max_zer;i++)
-    {
-		  double coeff;
-		  
-      mk_zer("zer_tmp",SIZE,i,radius);
-      coeff = -1.0*get_zer(ID_name,i,radius);
-      arith_image_cstmult_inplace("zer_tmp",coeff);
-      arith_image_add(ID_name_out,"zer_tmp","tmp");
-      delete_image_ID(ID_name_out);
-      copy_image_ID("tmp", ID_name_out, 0);
-      delete_image_ID("tmp");
-      delete_image_ID("zer_tmp");
-    }
+  NBpix = zernike_basis_cache(data.image[ID].md[0].size[0], max_zer, (float) radius);
+  if(NBpix<1)
+    return(-1);
+
+  coeff = (double*) malloc(sizeof(double)*max_zer);
+  fcoeff = (float*) malloc(sizeof(float)*max_zer);
+  vec = (float*) malloc(sizeof(float)*NBpix);
+
+  zernike_basis_project(ID, max_zer, radius, coeff, vec);
+  for(p=0;p<max_zer;p++)
+    fcoeff[p] = (float) coeff[p];
+
+  /* residual = image - basis^T coeff over the pupil */
+  cblas_sgemv(CblasRowMajor, CblasTrans, max_zer, NBpix, -1.0, ZERcache_basis, NBpix, fcoeff, 1, 1.0, vec, 1);
+
+  copy_image_ID(ID_name, ID_name_out, 0);
+  IDout = image_ID(ID_name_out);
+  for(p=0;p<NBpix;p++)
+    data.image[IDout].array.F[ZERcache_pixindex[p]] = vec[p];
+
+  free(coeff);
+  free(fcoeff);
+  free(vec);
+
   return(0);
 }
 
@@ -839,28 +1056,27 @@ int remove_TTF(const char *ID_name, const char *ID_name_out, double radius)
 double fit_zer(const char *ID_name, long maxzer_nb, double radius, double *zvalue, double *residual)
 {
   long SIZE;
-  long ID, IDZ, IDdisk;
-  char fname[200];
-  char fname1[200];
+  long ID;
   long i;
-  long ii;
-  double tmp;
-  double disktot=0.0;
+  long ii, p;
+  long NBpix;
   long NBpass,pass;
-  double value;
   double residualf=0.0;
+  float *vec;
 
   NBpass = 10;
 
-  copy_image_ID(ID_name, "resid", 0);  
+  copy_image_ID(ID_name, "resid", 0);
 
   ID = image_ID("resid");
   SIZE = data.image[ID].md[0].size[0];
-  IDdisk = make_disk("dtmp",SIZE,SIZE,0.5*SIZE,0.5*SIZE,0.999*radius);
+  NBpix = zernike_basis_cache(SIZE, maxzer_nb, (float) radius);
+  if(NBpix<1)
+    return(-1.0);
 
-  for(ii=0;ii<SIZE*SIZE;ii++)
-    if(data.image[IDdisk].array.F[ii]>0.5)
-      disktot += 1.0;
+  vec = (float*) malloc(sizeof(float)*NBpix);
+  for(p=0;p<NBpix;p++)
+    vec[p] = data.image[ID].array.F[ZERcache_pixindex[p]];
 
   for(i=0;i<maxzer_nb;i++)
     {
@@ -868,38 +1084,18 @@ double fit_zer(const char *ID_name, long maxzer_nb, double radius, double *zvalu
       zvalue[i] = 0.0;
     }
 
+  /* sequential projections over cached basis rows */
   for(pass=0;pass<NBpass;pass++)
-    {
-      for(i=0;i<maxzer_nb;i++)
-	{
-	  sprintf(fname,"/RAID0/tmp/Zernike/Z_%ld",i);
-	  sprintf(fname1,"Z_%ld",i);
-	  
-	  if((IDZ=image_ID(fname1))==-1)
-	    {
-	      if(file_exists(fname)==1)
-		IDZ = load_fits(fname,fname1, 1);
-	      else
-		IDZ = mk_zer(fname1,SIZE,i,radius);
-	    }
-	  tmp = 0.0;
-	  for(ii=0;ii<SIZE*SIZE;ii++)
-	    if(data.image[IDdisk].array.F[ii]>0.5)
-	      tmp += data.image[IDZ].array.F[ii]*data.image[ID].array.F[ii];
-	  value = tmp/disktot;
-	  
-	  for(ii=0;ii<SIZE*SIZE;ii++)
-	    if(data.image[IDdisk].array.F[ii]>0.5)
-	      data.image[ID].array.F[ii] -= value*data.image[IDZ].array.F[ii];
-	  zvalue[i] += value;	  
-	  tmp = 0.0;
-	  for(ii=0;ii<SIZE*SIZE;ii++)
-	    if(data.image[IDdisk].array.F[ii]>0.5)
-	      tmp += data.image[ID].array.F[ii]*data.image[ID].array.F[ii];
-
-	  residualf = sqrt(tmp/disktot);
-	}
-    }
+    for(i=0;i<maxzer_nb;i++)
+      {
+	double value;
+
+	value = cblas_dsdot(NBpix, ZERcache_basis+i*NBpix, 1, vec, 1)/NBpix;
+	cblas_saxpy(NBpix, (float) (-value), ZERcache_basis+i*NBpix, 1, vec, 1);
+	zvalue[i] += value;
+      }
+
+  residualf = sqrt(cblas_dsdot(NBpix, vec, 1, vec, 1)/NBpix);
 
   residual[maxzer_nb-1] = residualf;
   for(i=maxzer_nb-1;i>0;i--)
@@ -908,12 +1104,11 @@ double fit_zer(const char *ID_name, long maxzer_nb, double radius, double *zvalu
     }
 
   for(ii=0;ii<SIZE*SIZE;ii++)
-    {
-      if(data.image[IDdisk].array.F[ii]<0.5)
-	data.image[ID].array.F[ii] = 0.0;
-    }
+    data.image[ID].array.F[ii] = 0.0;
+  for(p=0;p<NBpix;p++)
+    data.image[ID].array.F[ZERcache_pixindex[p]] = vec[p];
 
-  delete_image_ID("dtmp");
+  free(vec);
 
   return(residualf);
 }
@@ -1,8 +1,9 @@
-/* A Bison parser, made by GNU Bison 3.0.2.  */
+/* A Bison parser, made by GNU Bison 3.8.2.  */
 
 /* Bison interface for Yacc-like parsers in C
 
-   Copyright (C) 1984, 1989-1990, 2000-2013 Free Software Foundation, Inc.
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
 
    This program is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
@@ -15,7 +16,7 @@
    GNU General Public License for more details.
 
    You should have received a copy of the GNU General Public License
-   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
 /* As a special exception, you may create a larger work that contains
    part or all of the Bison parser skeleton and distribute that work
@@ -30,6 +31,10 @@
    This special exception was added by the Free Software Foundation in
    version 2.2 of Bison.  */
 
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
 #ifndef YY_YY_CALC_BISON_H_INCLUDED
 # define YY_YY_CALC_BISON_H_INCLUDED
 /* Debug traces.  */
@@ -40,47 +45,37 @@
 extern int yydebug;
 #endif
 
-/* Token type.  */
+/* Token kinds.  */
 #ifndef YYTOKENTYPE
 # define YYTOKENTYPE
   enum yytokentype
   {
-    TKNUMl = 258,
-    TKNUMf = 259,
-    TKNUMd = 260,
-    TKVAR = 261,
-    TKNVAR = 262,
-    TKIMAGE = 263,
-    TKCOMMAND = 264,
-    TKFUNC_d_d = 265,
-    TKFUNC_dd_d = 266,
-    TKFUNC_ddd_d = 267,
-    TKFUNC_im_d = 268,
-    TKFUNC_imd_d = 269,
-    NEG = 270
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    TKNUMl = 258,                  /* TKNUMl  */
+    TKNUMf = 259,                  /* TKNUMf  */
+    TKNUMd = 260,                  /* TKNUMd  */
+    TKVAR = 261,                   /* TKVAR  */
+    TKNVAR = 262,                  /* TKNVAR  */
+    TKIMAGE = 263,                 /* TKIMAGE  */
+    TKCOMMAND = 264,               /* TKCOMMAND  */
+    TKFUNC_d_d = 265,              /* TKFUNC_d_d  */
+    TKFUNC_dd_d = 266,             /* TKFUNC_dd_d  */
+    TKFUNC_ddd_d = 267,            /* TKFUNC_ddd_d  */
+    TKFUNC_im_d = 268,             /* TKFUNC_im_d  */
+    TKFUNC_imd_d = 269,            /* TKFUNC_imd_d  */
+    NEG = 270                      /* NEG  */
   };
+  typedef enum yytokentype yytoken_kind_t;
 #endif
-/* Tokens.  */
-#define TKNUMl 258
-#define TKNUMf 259
-#define TKNUMd 260
-#define TKVAR 261
-#define TKNVAR 262
-#define TKIMAGE 263
-#define TKCOMMAND 264
-#define TKFUNC_d_d 265
-#define TKFUNC_dd_d 266
-#define TKFUNC_ddd_d 267
-#define TKFUNC_im_d 268
-#define TKFUNC_imd_d 269
-#define NEG 270
 
 /* Value type.  */
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
-typedef union YYSTYPE YYSTYPE;
 union YYSTYPE
 {
-#line 31 "calc_bison.y" /* yacc.c:1909  */
+#line 31 "calc_bison.y"
 
   long     val_l;  /* long */  
   float    val_f;  /* float */
@@ -88,8 +83,10 @@ union YYSTYPE
   char  *string;   /* For returning strings (variables, images)  */
   double (*fnctptr)();    /* pointer to function -> double */
 
-#line 92 "calc_bison.h" /* yacc.c:1909  */
+#line 87 "calc_bison.h"
+
 };
+typedef union YYSTYPE YYSTYPE;
 # define YYSTYPE_IS_TRIVIAL 1
 # define YYSTYPE_IS_DECLARED 1
 #endif
@@ -97,6 +94,8 @@ union YYSTYPE
 
 extern YYSTYPE yylval;
 
+
 int yyparse (void);
 
+
 #endif /* !YY_YY_CALC_BISON_H_INCLUDED  */
@@ -73,17 +73,21 @@ line:
 printf("\t double: %.10g\n", $1); 
 data.cmdargtoken[data.cmdNBarg].type = 1; 
 data.cmdargtoken[data.cmdNBarg].val.numf = $1;
+arith_expr_reset();
 }
 | expl '\n'  { 
 printf("\t long:   %ld\n", $1); 
 data.cmdargtoken[data.cmdNBarg].type = 2; 
 data.cmdargtoken[data.cmdNBarg].val.numl = $1;
+arith_expr_reset();
 }
 | exps '\n' { if(data.Debug>0) {printf("\t string: %s\n", $1);}
+arith_expr_materialize($1);
+arith_expr_reset();
     //data.cmdargtoken[data.cmdNBarg].type = 3;
 sprintf(data.cmdargtoken[data.cmdNBarg].val.string, "%s", $1);
 }
-| error '\n' { yyerrok;                  }
+| error '\n' { yyerrok; arith_expr_reset(); }
 ;
 
 expl:     TKNUMl       { $$ = $1;        if(data.Debug>0){printf("this is a long\n");}}
@@ -132,8 +136,8 @@ expd:      TKNUMd      { $$ = $1;        if(data.Debug>0){printf("this is a doub
 | TKFUNC_ddd_d expl ',' expd ',' expl ')'  { $$ = $1((double) $2,$4,(double) $6);  if(data.Debug>0){printf("double=func(long->double,double,long->double)\n");}}
 | TKFUNC_ddd_d expd ',' expl ',' expl ')'  { $$ = $1($2,(double) $4,(double) $6);  if(data.Debug>0){printf("double=func(double,long->double,long->double)\n");}}
 | TKFUNC_ddd_d expl ',' expl ',' expl ')'  { $$ = $1((double) $2,(double) $4,(double) $6);  if(data.Debug>0){printf("double=func(long->double,long->double,long->double)\n");}}
-| TKFUNC_im_d exps ')'  { $$ = $1($2);  if(data.Debug>0){printf("double=func(image)\n");}}
-| TKFUNC_imd_d exps ',' expd ')'  { $$ = $1($2,$4);  if(data.Debug>0){printf("double=func(image,double)\n");}}
+| TKFUNC_im_d exps ')'  { arith_expr_materialize($2); $$ = $1($2);  if(data.Debug>0){printf("double=func(image)\n");}}
+| TKFUNC_imd_d exps ',' expd ')'  { arith_expr_materialize($2); $$ = $1($2,$4);  if(data.Debug>0){printf("double=func(image,double)\n");}}
 | '(' expd ')'         { $$ = $2;                         }
 ;
 
@@ -141,33 +145,33 @@ expd:      TKNUMd      { $$ = $1;        if(data.Debug>0){printf("this is a doub
 exps:    TKNVAR         {$$ = strdup($1);        data.cmdargtoken[data.cmdNBarg].type = 3; if(data.Debug>0){printf("this is a string (new variable/image)\n");}}
 | TKIMAGE               {$$ = strdup($1);        data.cmdargtoken[data.cmdNBarg].type = 4; if(data.Debug>0){printf("this is a string (existing image)\n");}}
 | TKCOMMAND             {$$ = strdup($1);        data.cmdargtoken[data.cmdNBarg].type = 5; if(data.Debug>0){printf("this is a string (command)\n");}}
-| TKIMAGE '=' exps    {$$ = strdup($1);        delete_image_ID($1); chname_image_ID($3,$1); if(data.Debug>0){printf("changing name\n");}}
-| TKNVAR '=' exps    {$$ = strdup($1);        chname_image_ID($3,$1); if(data.Debug>0){printf("changing name\n");}}
-| exps '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_add($1, $3, calctmpimname); $$ = strdup(calctmpimname); if(data.Debug>0){printf("image + image\n");}}
-| exps '+' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($1,(double) $3, calctmpimname); $$=strdup(calctmpimname);  if(data.Debug>0){printf("image + double\n");}}
-| exps '+' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image + long\n");}}
-| expd '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double + image\n");}}
-| expl '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long + image\n");}}
-| exps '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_sub($1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image + image\n");}}
-| exps '-' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($1,(double) -$3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - double\n");}}
-| exps '-' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstadd($1,(double) -$3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - long\n");}}
-| expd '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstsubm($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double - image\n");}}
-| expl '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstsubm($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long - image\n");}}
-| exps '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_mult($1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * image\n");}}
-| exps '*' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstmult($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * double\n");}}
-| exps '*' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstmult($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * long\n");}}
-| expd '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstmult($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double * image\n");}}
-| expl '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstmult($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long * image\n");}}
-| exps '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_div($1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image / image\n");}}
-| exps '/' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstdiv($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - double\n");}}
-| exps '/' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstdiv($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - long\n");}}
-| expd '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstdiv($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double - image\n");}}
-| expl '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstdiv($3,(double) $1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long - image\n");}}
-| exps '^' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstpow($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image^long\n");}}
-| exps '^' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_cstpow($1,(double) $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image^double\n");}}
-| TKFUNC_d_d exps ')'           {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_function_im_im__d_d($2, calctmpimname, $1); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double)\n");}}
-| TKFUNC_dd_d exps ',' expd ')' {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_function_imd_im__dd_d($2, (double) $4, calctmpimname, $1); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double, double)\n");}}
-| TKFUNC_ddd_d exps ',' expd ',' expd ')' {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_image_function_imdd_im__ddd_d($2, (double) $4, (double) $6, calctmpimname, $1); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double, double, double)\n");}}
+| TKIMAGE '=' exps    {$$ = strdup($1);        arith_expr_materialize($3); delete_image_ID($1); chname_image_ID($3,$1); if(data.Debug>0){printf("changing name\n");}}
+| TKNVAR '=' exps    {$$ = strdup($1);        arith_expr_materialize($3); chname_image_ID($3,$1); if(data.Debug>0){printf("changing name\n");}}
+| exps '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imim('+', $1, $3, calctmpimname); $$ = strdup(calctmpimname); if(data.Debug>0){printf("image + image\n");}}
+| exps '+' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('+', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname);  if(data.Debug>0){printf("image + double\n");}}
+| exps '+' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('+', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image + long\n");}}
+| expd '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('+', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double + image\n");}}
+| expl '+' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('+', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long + image\n");}}
+| exps '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imim('-', $1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - image\n");}}
+| exps '-' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('-', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - double\n");}}
+| exps '-' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('-', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image - long\n");}}
+| expd '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('-', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double - image\n");}}
+| expl '-' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('-', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long - image\n");}}
+| exps '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imim('*', $1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * image\n");}}
+| exps '*' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('*', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * double\n");}}
+| exps '*' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('*', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image * long\n");}}
+| expd '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('*', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double * image\n");}}
+| expl '*' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('*', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long * image\n");}}
+| exps '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imim('/', $1, $3, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image / image\n");}}
+| exps '/' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('/', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image / double\n");}}
+| exps '/' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('/', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image / long\n");}}
+| expd '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('/', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double / image\n");}}
+| expl '/' exps      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('/', $3, (double) $1, 1, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("long / image\n");}}
+| exps '^' expl      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('^', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image^long\n");}}
+| exps '^' expd      {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_imcst('^', $1, (double) $3, 0, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("image^double\n");}}
+| TKFUNC_d_d exps ')'           {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_func_im($1, $2, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double)\n");}}
+| TKFUNC_dd_d exps ',' expd ')' {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_func_imd($1, $2, (double) $4, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double, double)\n");}}
+| TKFUNC_ddd_d exps ',' expd ',' expd ')' {sprintf(calctmpimname,"_tmpcalc%ld",data.calctmp_imindex); data.calctmp_imindex++; arith_expr_func_imdd($1, $2, (double) $4, (double) $6, calctmpimname); $$=strdup(calctmpimname); if(data.Debug>0){printf("double_func(double, double, double)\n");}}
 | '(' exps ')'         { $$ = strdup($2);                         }
 ;
 
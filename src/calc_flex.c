@@ -1058,16 +1058,12 @@ if(variable_ID(yytext)!=-1) {if(data.Debug>0){printf("THIS IS A VARIABLE\n");} r
 if(image_ID(yytext)!=-1) {if(data.Debug>0){printf("THIS IS AN IMAGE\n");} return TKIMAGE;}
 if(data.cmdNBarg==0)
 {
-data.cmdindex = -1;
- for(i=0;i<data.NBcmd;i++)
-  { 
-   if(!strcmp(yytext, data.cmd[i].key))
-    {
-     data.cmdindex = i;
-     if(data.Debug>0){printf("THIS IS A COMMAND (%ld)\n",i);}
-     return TKCOMMAND;
-    }
-   }
+data.cmdindex = CLI_cmd_index(yytext);
+ if(data.cmdindex != -1)
+  {
+   if(data.Debug>0){printf("THIS IS A COMMAND (%ld)\n",data.cmdindex);}
+   return TKCOMMAND;
+  }
   }
  if(data.Debug>0){printf("THIS IS A NEW VARIABLE\n");}
  return TKNVAR;
@@ -30,6 +30,7 @@
 #include <math.h>
 #include <sched.h>
 #include <signal.h> 
+#include <errno.h>
 
 
 #include <semaphore.h>
@@ -67,6 +68,7 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 
 #include <cuda_runtime_api.h>
 #include <cuda_runtime.h>
+#include <cuda.h>
 #include <cublas_v2.h>
 #include <device_types.h>
 #include <pthread.h>
@@ -91,6 +93,7 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 #include "COREMOD_iofits/COREMOD_iofits.h"
 #include "COREMOD_arith/COREMOD_arith.h"
 #include "info/info.h"
+#include "statistic/statistic.h"
 #include "cudacomp/cudacomp.h"
 
 #include "linopt_imtools/linopt_imtools.h" // for testing
@@ -111,6 +114,11 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 #define OMP_NELEMENT_LIMIT 1000000
 # endif
 
+#define GPU_BALANCE_NBFRAME 2000   // number of frames between load balancing checks
+#define GPU_BALANCE_TOL 1.15       // rebalance if slowest/fastest device MVM time exceeds this ratio
+#define GPU_FAILOVER_MBLOCK 256    // CPU failover: number of output rows per thread block
+#define GPU_LOADCMAT_TBLOCK 64     // GPUloadCmat: tile size for control matrix transpose (orientation 0)
+
 
 
 
@@ -143,6 +151,8 @@ static int deviceCount;
 
 GPUMATMULTCONF gpumatmultconf[20]; // supports up to 20 configurations per process
 
+static char GPUtune_fname[200] = ""; // benchmark results used to select execution mode at setup
+
 
 static cudaError_t error;
 static cublasStatus_t stat;
@@ -306,6 +316,42 @@ int_fast8_t CUDACOMP_magma_compute_SVDpseudoInverse_cli()
 }
 
 
+int_fast8_t GPUcomp_benchmark_cli()
+{
+    if(CLI_checkarg(1,2)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,3)==0)
+        GPUcomp_benchmark(data.cmdargtoken[1].val.numl, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.string);
+    else
+        return 1;
+}
+
+
+int_fast8_t GPU_loop_MultMat_tunefile_cli()
+{
+    if(CLI_checkarg(1,3)==0)
+        GPU_loop_MultMat_tunefile(data.cmdargtoken[1].val.string);
+    else
+        return 1;
+}
+
+
+int_fast8_t CUDACOMP_OOC_compute_SVDpseudoInverse_cli()
+{
+	if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,1)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)==0)
+        CUDACOMP_OOC_compute_SVDpseudoInverse(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl);
+    else
+        return 1;
+}
+
+
+int_fast8_t CUDACOMP_randSVD_computeControlMatrix_cli()
+{
+	if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,1)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,2)+CLI_checkarg(7,2)+CLI_checkarg(8,3)==0)
+        CUDACOMP_randSVD_computeControlMatrix(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl, data.cmdargtoken[7].val.numl, data.cmdargtoken[8].val.string);
+    else
+        return 1;
+}
+
+
 
 
 
@@ -344,6 +390,33 @@ int_fast8_t CUDACOMP_extractModesLoop_cli()
     else
         return 1;
 }
+
+
+int_fast8_t CUDACOMP_extractModesBatch_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,4)+CLI_checkarg(3,5)+CLI_checkarg(4,3)+CLI_checkarg(5,2)+CLI_checkarg(6,2)==0)
+        CUDACOMP_extractModesBatch(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl);
+    else
+        return 1;
+}
+
+
+int_fast8_t CUDACOMP_persistentMVMLoop_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,3)+CLI_checkarg(4,4)+CLI_checkarg(5,2)+CLI_checkarg(6,2)==0)
+        CUDACOMP_persistentMVMLoop(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.numl);
+    else
+        return 1;
+}
+
+
+int_fast8_t CUDACOMP_modalPipelineLoop_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,5)+CLI_checkarg(4,4)+CLI_checkarg(5,4)+CLI_checkarg(6,4)+CLI_checkarg(7,5)+CLI_checkarg(8,4)+CLI_checkarg(9,4)+CLI_checkarg(10,5)+CLI_checkarg(11,2)+CLI_checkarg(12,2)==0)
+        CUDACOMP_modalPipelineLoop(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.string, data.cmdargtoken[6].val.string, data.cmdargtoken[7].val.string, data.cmdargtoken[8].val.string, data.cmdargtoken[9].val.string, data.cmdargtoken[10].val.string, data.cmdargtoken[11].val.numl, data.cmdargtoken[12].val.numl);
+    else
+        return 1;
+}
 #endif
 
 
@@ -382,6 +455,16 @@ int_fast8_t init_cudacomp()
     for(i=0; i<10; i++) {
         gpumatmultconf[i].init = 0;
         gpumatmultconf[i].alloc = 0;
+        gpumatmultconf[i].CMhotswap = 0;
+        gpumatmultconf[i].asyncmode = 0;
+        gpumatmultconf[i].asyncmode_req = 0;
+        gpumatmultconf[i].zerocopy = 0;
+        gpumatmultconf[i].balance = 0;
+        gpumatmultconf[i].balance_req = 0;
+        gpumatmultconf[i].p2preduce = 0;
+        gpumatmultconf[i].failover_timeout = 0;
+        gpumatmultconf[i].failover_NBthreads = 4;
+        gpumatmultconf[i].failovercnt = 0;
     }
 #endif
 
@@ -448,6 +531,14 @@ int_fast8_t init_cudacomp()
     RegisterCLIcommand("cudacomppsinvSVD", __FILE__, CUDACOMP_magma_compute_SVDpseudoInverse_SVD_cli, "compute pseudo inverse with direct SVD", "<input matrix [string]> <output pseudoinv [string]> <eps [float]> <NBmodes [long]> <VTmat [string]>", "cudacomppsinvSVD matA matAinv 0.01 100 VTmat", "int CUDACOMP_magma_compute_SVDpseudoInverse_SVD(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name);");
         
     RegisterCLIcommand("cudacomppsinv", __FILE__, CUDACOMP_magma_compute_SVDpseudoInverse_cli, "compute pseudo inverse", "<input matrix [string]> <output pseudoinv [string]> <eps [float]> <NBmodes [long]> <VTmat [string]>", "cudacomppsinv matA matAinv 0.01 100 VTmat", "int CUDACOMP_magma_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name, int LOOPmode)");
+
+    RegisterCLIcommand("cudacompbench", __FILE__, GPUcomp_benchmark_cli, "benchmark GPU MVM latency over sizes, GPU count and execution modes", "<NBmodes min> <NBmodes max> <WFS size min> <WFS size max> <NB GPUs max> <NBiter> <output file>", "cudacompbench 256 4096 32 256 4 10000 GPUtune.txt", "int GPUcomp_benchmark(long NBmodesmin, long NBmodesmax, long WFSsizemin, long WFSsizemax, long NBGPUmax, long NBiter, const char *fname)");
+
+    RegisterCLIcommand("cudatunefile", __FILE__, GPU_loop_MultMat_tunefile_cli, "set GPU MVM tuning file, read at setup", "<tuning file>", "cudatunefile GPUtune.txt", "int GPU_loop_MultMat_tunefile(const char *fname)");
+
+    RegisterCLIcommand("cudacomppsinvooc", __FILE__, CUDACOMP_OOC_compute_SVDpseudoInverse_cli, "compute pseudo inverse, out-of-core (matrix larger than GPU memory)", "<input matrix [string]> <output pseudoinv [string]> <eps [float]> <NBmodes [long]> <NB GPUs [long]> <panel size [long]>", "cudacomppsinvooc matA matAinv 0.01 10000 2 8192", "int CUDACOMP_OOC_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, int NBGPU, long panelsize)");
+
+    RegisterCLIcommand("cudacomprsvd", __FILE__, CUDACOMP_randSVD_computeControlMatrix_cli, "compute pseudo inverse with randomized truncated SVD", "<input matrix [string]> <output pseudoinv [string]> <eps [float]> <NBmodes [long]> <oversampling [long]> <power iterations [long]> <NB GPUs [long]> <VTmat [string]>", "cudacomprsvd matA matAinv 0.01 2000 100 2 2 VTmat", "int CUDACOMP_randSVD_computeControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long NBmodes, long oversample, int NBpowiter, int NBGPU, const char *ID_VTmatrix_name)");
     
         
         
@@ -490,6 +581,12 @@ int_fast8_t init_cudacomp()
     strcpy(data.cmd[data.NBcmd].example,"cudaextrmodes inmap inmaptot modes imref imoutref modeval 3 1 1 1 3 0 0");
     strcpy(data.cmd[data.NBcmd].Ccall,"int CUDACOMP_extractModesLoop(const char *in_stream, const char *intot_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDrefout_name, const char *IDmodes_val_name, int GPUindex, int PROCESS, int TRACEMODE, int MODENORM, int insem, int axmode, long twait)");
     data.NBcmd++;
+
+    RegisterCLIcommand("cudaextrmodesbatch", __FILE__, CUDACOMP_extractModesBatch_cli, "CUDA extract mode values from frame cube or FITS file (offline, batched)", "<input cube or file> <modes> <refin val> <output coeff cube> <GPU index [long]> <batch size [long]>", "cudaextrmodesbatch wfstelem.fits modes imref modecoeffs 0 1000", "int CUDACOMP_extractModesBatch(const char *in_name, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, long batchsize)");
+
+    RegisterCLIcommand("cudapersistmvm", __FILE__, CUDACOMP_persistentMVMLoop_cli, "extract modes with persistent GPU kernel (no launch per frame), for small number of modes. Reference can be NULL", "<input stream> <modes> <reference [string]> <output modes> <GPU index [long]> <input semaphore [long]>", "cudapersistmvm lowfsim lowfsmodes NULL lowfsmval 0 3", "int CUDACOMP_persistentMVMLoop(const char *in_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, int insem)");
+
+    RegisterCLIcommand("cudamodalpipe", __FILE__, CUDACOMP_modalPipelineLoop_cli, "GPU-resident modal loop: extract modes, filter, expand to DM. Reference, predictive input and telemetry can be NULL", "<WFS stream> <WFS modes> <WFS ref> <gain> <mult> <limit> <pred input> <DM modes> <DM output> <telemetry> <GPU index [long]> <input semaphore [long]>", "cudamodalpipe wfsim wfsmodes wfsref mgain mmult mlimit NULL DMmodes dmout modetelem 0 3", "int CUDACOMP_modalPipelineLoop(const char *in_stream, const char *IDwfsmodes_name, const char *IDwfsref_name, const char *IDgain_name, const char *IDmult_name, const char *IDlimit_name, const char *IDpf_name, const char *IDDMmodes_name, const char *IDout_name, const char *IDtelem_name, int GPUindex, int insem)");
     
 
 #endif
@@ -540,6 +637,167 @@ int_fast8_t CUDACOMP_init()
 
 
 
+static int GPUcomp_benchmark_cmpdouble(const void *a, const void *b)
+{
+    double va = *((const double*) a);
+    double vb = *((const double*) b);
+
+    return((va > vb) - (va < vb));
+}
+
+
+
+/**
+ * @brief Time GPU_loop_MultMat_execute for one configuration (index 0), returns latency statistics [us]
+ */
+static int GPUcomp_benchmark_config(const char *IDcm_name, const char *IDwfs_name, const char *IDout_name, long NBGPU, int *GPUdevices, int USEsem, int asyncmode, int balance, long NBiter, double *lat, double *p50, double *p99, double *lmax, double *lmean)
+{
+    int_fast8_t status;
+    int_fast8_t GPUstatus[100];
+    long iter;
+    struct timespec t0, t1;
+
+    GPU_loop_MultMat_async(0, asyncmode);
+    GPU_loop_MultMat_balance(0, balance);
+    GPU_loop_MultMat_setup(0, IDcm_name, IDwfs_name, IDout_name, NBGPU, GPUdevices, 0, USEsem, 1, 0);
+
+    for(iter=0; iter<100; iter++) // warm-up, includes reference computation
+    {
+        status = 0;
+        GPU_loop_MultMat_execute(0, &status, &GPUstatus[0], 1.0, 0.0, 0);
+    }
+
+    *lmean = 0.0;
+    for(iter=0; iter<NBiter; iter++)
+    {
+        status = 0;
+        clock_gettime(CLOCK_REALTIME, &t0);
+        GPU_loop_MultMat_execute(0, &status, &GPUstatus[0], 1.0, 0.0, 0);
+        clock_gettime(CLOCK_REALTIME, &t1);
+        lat[iter] = 1.0e6*(t1.tv_sec - t0.tv_sec) + 1.0e-3*(t1.tv_nsec - t0.tv_nsec);
+        *lmean += lat[iter];
+    }
+    *lmean /= NBiter;
+
+    GPU_loop_MultMat_free(0);
+
+    qsort(lat, NBiter, sizeof(double), GPUcomp_benchmark_cmpdouble);
+    *p50 = lat[NBiter/2];
+    *p99 = lat[(long) (0.99*(NBiter-1))];
+    *lmax = lat[NBiter-1];
+
+    return(0);
+}
+
+
+
+//
+// Sweeps matrix size (x2 steps), number of GPUs and execution mode
+// For each size and number of GPUs, configuration with lowest p99 latency is written as BEST line (loaded by GPU_loop_MultMat_setup)
+//
+int GPUcomp_benchmark(long NBmodesmin, long NBmodesmax, long WFSsizemin, long WFSsizemax, long NBGPUmax, long NBiter, const char *fname)
+{
+    // execution modes tested: USEsem, asyncmode, balance
+    int cfgsem[]   = {1, 1, 1, 1};
+    int cfgasync[] = {0, 1, 2, 1};
+    int cfgbal[]   = {0, 0, 0, 1};
+    const char *cfgname[] = {"threads+semaphores", "async busy-wait", "async CUDA graph", "async balanced"};
+    int NBcfg = 4;
+    int cfg, best;
+    long NBmodes, WFSsize, NBGPU;
+    long k;
+    uint32_t *imsize;
+    int *GPUdevices;
+    double *lat;
+    double p50, p99, lmax, lmean, bestp50, bestp99;
+    FILE *fp;
+    char tunefname_save[200];
+
+
+    if(NBiter < 100)
+        NBiter = 100;
+    cudaGetDeviceCount(&deviceCount);
+    if(NBGPUmax > deviceCount)
+        NBGPUmax = deviceCount;
+
+    if((fp = fopen(fname, "w")) == NULL)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cannot create benchmark output file");
+        return(-1);
+    }
+    fprintf(fp, "# GPU MVM benchmark, %ld iterations per configuration\n", NBiter);
+    fprintf(fp, "# [TEST|BEST]  M(modes)  N(pixels)  NBGPU  USEsem  asyncmode  balance  p50[us]  p99[us]  max[us]  mean[us]\n");
+
+    // benchmark must not be affected by a previous tuning file
+    strcpy(tunefname_save, GPUtune_fname);
+    GPUtune_fname[0] = '\0';
+
+    lat = (double*) malloc(sizeof(double)*NBiter);
+    GPUdevices = (int*) malloc(sizeof(int)*NBGPUmax);
+    for(k=0; k<NBGPUmax; k++)
+        GPUdevices[k] = k;
+    imsize = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    for(WFSsize=WFSsizemin; WFSsize<=WFSsizemax; WFSsize*=2)
+        for(NBmodes=NBmodesmin; NBmodes<=NBmodesmax; NBmodes*=2)
+        {
+            imsize[0] = WFSsize;
+            imsize[1] = WFSsize;
+            imsize[2] = NBmodes;
+            create_image_ID("cudabenchcm", 3, imsize, _DATATYPE_FLOAT, 0, 0);
+            create_image_ID("cudabenchwfs", 2, imsize, _DATATYPE_FLOAT, 0, 0);
+            imsize[0] = NBmodes;
+            imsize[1] = 1;
+            create_image_ID("cudabenchout", 2, imsize, _DATATYPE_FLOAT, 0, 0);
+
+            for(NBGPU=1; NBGPU<=NBGPUmax; NBGPU++)
+            {
+                best = -1;
+                bestp50 = bestp99 = 0.0;
+                for(cfg=0; cfg<NBcfg; cfg++)
+                {
+                    if((cfgbal[cfg] == 1)&&(NBGPU == 1))
+                        continue;
+
+                    GPUcomp_benchmark_config("cudabenchcm", "cudabenchwfs", "cudabenchout", NBGPU, GPUdevices, cfgsem[cfg], cfgasync[cfg], cfgbal[cfg], NBiter, lat, &p50, &p99, &lmax, &lmean);
+
+                    printf("%5ld modes x %7ld pix  %ld GPU  %-20s  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", NBmodes, WFSsize*WFSsize, NBGPU, cfgname[cfg], p50, p99, lmax);
+                    fflush(stdout);
+                    fprintf(fp, "TEST %6ld %8ld %2ld %d %d %d %10.2f %10.2f %10.2f %10.2f\n", NBmodes, WFSsize*WFSsize, NBGPU, cfgsem[cfg], cfgasync[cfg], cfgbal[cfg], p50, p99, lmax, lmean);
+
+                    if((best == -1)||(p99 < bestp99)||((p99 == bestp99)&&(p50 < bestp50)))
+                    {
+                        best = cfg;
+                        bestp50 = p50;
+                        bestp99 = p99;
+                    }
+                }
+                fprintf(fp, "BEST %6ld %8ld %2ld %d %d %d %10.2f %10.2f\n", NBmodes, WFSsize*WFSsize, NBGPU, cfgsem[best], cfgasync[best], cfgbal[best], bestp50, bestp99);
+                fflush(fp);
+            }
+
+            delete_image_ID("cudabenchcm");
+            delete_image_ID("cudabenchwfs");
+            delete_image_ID("cudabenchout");
+        }
+
+    fclose(fp);
+    strcpy(GPUtune_fname, tunefname_save);
+    GPU_loop_MultMat_async(0, 0);
+    GPU_loop_MultMat_balance(0, 0);
+
+    free(imsize);
+    free(GPUdevices);
+    free(lat);
+
+    printf("Benchmark results written to %s\n", fname);
+
+    return(0);
+}
+
+
+
+
 int_fast8_t GPUcomp_test(long NBact, long NBmodes, long WFSsize, long GPUcnt)
 {
     long ID_contrM;
@@ -844,6 +1102,11 @@ void *compute_function( void *ptr )
 
         *ptrstat = 3; // transfer: prt0 -> d_wfsVec
         stat = cublasSetVector(gpumatmultconf[index].Nsize[device], sizeof(float), (float*) ptr0, 1, gpumatmultconf[index].d_wfsVec[device], 1);
+        if((stat != CUBLAS_STATUS_SUCCESS)&&(gpumatmultconf[index].failover_timeout > 0))
+        {
+            gpumatmultconf[index].deverror[device] = 1; // reported by watchdog in GPU_loop_MultMat_execute
+            stat = CUBLAS_STATUS_SUCCESS;
+        }
         if (stat != CUBLAS_STATUS_SUCCESS)
         {
             fprintf(stderr, "!!!! device access error (read C)\n");
@@ -965,6 +1228,11 @@ void *compute_function( void *ptr )
                 sem_post(gpumatmultconf[index].semptr2[device]);
 
             stat = cublasSgemv(gpumatmultconf[index].handle[device], CUBLAS_OP_N, gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], &cublasSgemv_alpha, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M, gpumatmultconf[index].d_wfsVec[device], 1, &cublasSgemv_beta, gpumatmultconf[index].d_dmVec[device], 1);
+            if((stat != CUBLAS_STATUS_SUCCESS)&&(gpumatmultconf[index].failover_timeout > 0))
+            {
+                gpumatmultconf[index].deverror[device] = 1;
+                stat = CUBLAS_STATUS_SUCCESS;
+            }
 
             if (stat != CUBLAS_STATUS_SUCCESS)
             {
@@ -1010,6 +1278,11 @@ void *compute_function( void *ptr )
 
             // result is on gpumatmultconf[index].d_dmVec[device]
             stat = cublasGetVector(gpumatmultconf[index].M, sizeof(float), gpumatmultconf[index].d_dmVec[device], 1, gpumatmultconf[index].dmVec_part[device], 1);
+            if((stat != CUBLAS_STATUS_SUCCESS)&&(gpumatmultconf[index].failover_timeout > 0))
+            {
+                gpumatmultconf[index].deverror[device] = 1;
+                stat = CUBLAS_STATUS_SUCCESS;
+            }
             if (stat != CUBLAS_STATUS_SUCCESS)
             {
                 fprintf(stderr, "!!!! device access error (read C)\n");
@@ -1058,24 +1331,43 @@ int GPUloadCmat(int index)
 
     for(device = 0; device < gpumatmultconf[index].NBstreams; device++)
     {
-        for (n=gpumatmultconf[index].Noffset[device]; n<gpumatmultconf[index].Noffset[device]+gpumatmultconf[index].Nsize[device]; n++) {
-            if(gpumatmultconf[index].orientation==0)
-            {
-                for (m=0; m<gpumatmultconf[index].M; m++) {
-                    gpumatmultconf[index].cMat_part[device][(n-gpumatmultconf[index].Noffset[device])*gpumatmultconf[index].M+m] = gpumatmultconf[index].cMat[m*gpumatmultconf[index].N+n];
-                }
-            }
-            else
+        long M = gpumatmultconf[index].M;
+        long N = gpumatmultconf[index].N;
+        long noff = gpumatmultconf[index].Noffset[device];
+        long nsize = gpumatmultconf[index].Nsize[device];
+        float *part = gpumatmultconf[index].cMat_part[device];
+        const float *cMat = gpumatmultconf[index].cMat;
+
+        if(gpumatmultconf[index].orientation==0)
+        {
+            // tiled transpose : cMat[m*N+n] -> part[(n-noff)*M+m]
+            long nt;
+# ifdef _OPENMP
+            #pragma omp parallel for private(n,m) schedule(static)
+# endif
+            for(nt=0; nt<nsize; nt+=GPU_LOADCMAT_TBLOCK)
             {
-                for (m=0; m<gpumatmultconf[index].M; m++) {
-                    gpumatmultconf[index].cMat_part[device][(n-gpumatmultconf[index].Noffset[device])*gpumatmultconf[index].M+m] = gpumatmultconf[index].cMat[n*gpumatmultconf[index].M+m];
+                long mt;
+                long n1 = (nt+GPU_LOADCMAT_TBLOCK < nsize) ? nt+GPU_LOADCMAT_TBLOCK : nsize;
+
+                for(mt=0; mt<M; mt+=GPU_LOADCMAT_TBLOCK)
+                {
+                    long m1 = (mt+GPU_LOADCMAT_TBLOCK < M) ? mt+GPU_LOADCMAT_TBLOCK : M;
+
+                    for(n=nt; n<n1; n++)
+                        for(m=mt; m<m1; m++)
+                            part[n*M+m] = cMat[m*N+noff+n];
                 }
             }
         }
+        else // partition is contiguous
+            memcpy(part, cMat + noff*M, sizeof(float)*M*nsize);
     }
 
     for(device=0; device<gpumatmultconf[index].NBstreams; device++)
     {
+        if(gpumatmultconf[index].devfailed[device] == 1) // partition computed on CPU from cMat_part
+            continue;
         cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
         error = cublasSetMatrix (gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], sizeof(float), gpumatmultconf[index].cMat_part[device], gpumatmultconf[index].M, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M);
         if (error != cudaSuccess)
@@ -1095,6 +1387,110 @@ int GPUloadCmat(int index)
 
 
 
+/**
+ * @brief Measure MVM throughput of each device (load balancing)
+ *
+ * Each device multiplies a M x (N/NBdev) test matrix; weight = 1 / time per column.
+ */
+static int GPU_loop_MultMat_benchmark(int NBdev, int *GPUdevice, long M, long N, double *weight)
+{
+    int device;
+    int iter;
+    int NBiter = 50;
+    long Ntest = N/NBdev;
+    float *d_A, *d_x, *d_y;
+    float alphab = 1.0;
+    float betab = 0.0;
+    float tms;
+    cublasHandle_t bhandle;
+    cudaEvent_t ev0, ev1;
+
+    if(Ntest < 1)
+        Ntest = 1;
+
+    for(device=0; device<NBdev; device++)
+    {
+        cudaSetDevice(GPUdevice[device]);
+        cudaMalloc((void **) &d_A, sizeof(float)*M*Ntest);
+        cudaMalloc((void **) &d_x, sizeof(float)*Ntest);
+        cudaMalloc((void **) &d_y, sizeof(float)*M);
+        cudaMemset(d_A, 0, sizeof(float)*M*Ntest);
+        cudaMemset(d_x, 0, sizeof(float)*Ntest);
+        cublasCreate(&bhandle);
+        cudaEventCreate(&ev0);
+        cudaEventCreate(&ev1);
+
+        for(iter=0; iter<5; iter++) // warm up
+            cublasSgemv(bhandle, CUBLAS_OP_N, M, Ntest, &alphab, d_A, M, d_x, 1, &betab, d_y, 1);
+
+        cudaEventRecord(ev0, 0);
+        for(iter=0; iter<NBiter; iter++)
+            cublasSgemv(bhandle, CUBLAS_OP_N, M, Ntest, &alphab, d_A, M, d_x, 1, &betab, d_y, 1);
+        cudaEventRecord(ev1, 0);
+        cudaEventSynchronize(ev1);
+        cudaEventElapsedTime(&tms, ev0, ev1);
+
+        weight[device] = (tms > 0.0) ? 1.0*NBiter/tms : 1.0;
+        printf("GPU device %2d : MVM %ld x %ld  %8.3f us  -> weight %g\n", GPUdevice[device], M, Ntest, 1000.0*tms/NBiter, weight[device]);
+        fflush(stdout);
+
+        cudaEventDestroy(ev0);
+        cudaEventDestroy(ev1);
+        cublasDestroy(bhandle);
+        cudaFree(d_A);
+        cudaFree(d_x);
+        cudaFree(d_y);
+    }
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Split N axis across devices proportionally to weight
+ */
+static int GPU_loop_MultMat_partition(int index, double *weight)
+{
+    int device;
+    double wtot = 0.0;
+    double wcum = 0.0;
+    long N = gpumatmultconf[index].N;
+    int NBdev = gpumatmultconf[index].NBstreams;
+
+    for(device=0; device<NBdev; device++)
+        wtot += weight[device];
+
+    gpumatmultconf[index].Noffset[0] = 0;
+    for(device=1; device<NBdev; device++)
+    {
+        long noff;
+
+        wcum += weight[device-1];
+        noff = (long) (N*wcum/wtot + 0.5);
+        if(noff < gpumatmultconf[index].Noffset[device-1] + 1) // at least one column per device
+            noff = gpumatmultconf[index].Noffset[device-1] + 1;
+        if(noff > N - (NBdev-device))
+            noff = N - (NBdev-device);
+        gpumatmultconf[index].Noffset[device] = noff;
+        gpumatmultconf[index].Nsize[device-1] = gpumatmultconf[index].Noffset[device] - gpumatmultconf[index].Noffset[device-1];
+    }
+    gpumatmultconf[index].Nsize[NBdev-1] = N - gpumatmultconf[index].Noffset[NBdev-1];
+
+    return(0);
+}
+
+
+
+int GPU_loop_MultMat_balance(int index, int mode)
+{
+    gpumatmultconf[index].balance_req = mode;
+    return(0);
+}
+
+
+
+
 /** setup matrix multiplication using multiple GPUs */
 /*
  *
@@ -1104,6 +1500,67 @@ int GPUloadCmat(int index)
  *
 */
 
+int GPU_loop_MultMat_tunefile(const char *fname)
+{
+    strncpy(GPUtune_fname, fname, 199);
+    GPUtune_fname[199] = '\0';
+
+    return(0);
+}
+
+
+
+/**
+ * @brief Apply tuned execution mode from benchmark file (see GPUcomp_benchmark), if any
+ *
+ * Uses BEST entry with same number of GPUs and closest matrix size (M x N).
+ * Overrides USEsem, async mode and balancing requested by caller.
+ */
+static int GPU_loop_MultMat_applytune(int index, long NBGPUs)
+{
+    FILE *fp;
+    char line[500];
+    long tM, tN, tNBGPU;
+    int tsem, tasync, tbal;
+    double dist, bestdist = -1.0;
+    int bsem = 0, basync = 0, bbal = 0;
+
+    if(GPUtune_fname[0] == '\0')
+        return(0);
+    if((fp = fopen(GPUtune_fname, "r")) == NULL)
+        return(0);
+
+    while(fgets(line, 500, fp) != NULL)
+    {
+        if(sscanf(line, "BEST %ld %ld %ld %d %d %d", &tM, &tN, &tNBGPU, &tsem, &tasync, &tbal) != 6)
+            continue;
+        if(tNBGPU != NBGPUs)
+            continue;
+        dist = fabs(log(1.0*tM*tN/gpumatmultconf[index].M/gpumatmultconf[index].N));
+        if((bestdist < 0.0)||(dist < bestdist))
+        {
+            bestdist = dist;
+            bsem = tsem;
+            basync = tasync;
+            bbal = tbal;
+        }
+    }
+    fclose(fp);
+
+    if(bestdist >= 0.0)
+    {
+        printf("Tuned GPU configuration (%s): USEsem = %d  asyncmode = %d  balance = %d\n", GPUtune_fname, bsem, basync, bbal);
+        fflush(stdout);
+        gpumatmultconf[index].sem = bsem;
+        gpumatmultconf[index].asyncmode_req = basync;
+        gpumatmultconf[index].balance_req = bbal;
+    }
+
+    return(0);
+}
+
+
+
 int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDwfsim_name, const char *IDoutdmmodes_name, long NBGPUs, int *GPUdevice, int orientation, int USEsem, int initWFSref, long loopnb)
 {
     int device;
@@ -1216,6 +1673,8 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
 
         gpumatmultconf[index].cMat =  data.image[IDcontrM].array.F;
 
+        GPU_loop_MultMat_applytune(index, NBGPUs);
+
 
         /// Load Input vectors
         IDwfsim = image_ID(IDwfsim_name);
@@ -1307,13 +1766,21 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
 
         gpumatmultconf[index].Nsize = (uint_fast32_t*) malloc(sizeof(long)*gpumatmultconf[index].NBstreams);
         gpumatmultconf[index].Noffset = (uint_fast32_t*) malloc(sizeof(long)*gpumatmultconf[index].NBstreams);
-        gpumatmultconf[index].Noffset[0] = 0;
-        for(device=1; device<gpumatmultconf[index].NBstreams; device++)
+        gpumatmultconf[index].Nalloc = (uint_fast32_t*) malloc(sizeof(long)*gpumatmultconf[index].NBstreams);
+
+        gpumatmultconf[index].balance = ((gpumatmultconf[index].balance_req == 1)&&(gpumatmultconf[index].NBstreams > 1)) ? 1 : 0;
         {
-            gpumatmultconf[index].Noffset[device] = gpumatmultconf[index].Noffset[device-1] + (long) (gpumatmultconf[index].N/gpumatmultconf[index].NBstreams);
-            gpumatmultconf[index].Nsize[device-1] = gpumatmultconf[index].Noffset[device] - gpumatmultconf[index].Noffset[device-1];
+            double *devweight = (double*) malloc(sizeof(double)*gpumatmultconf[index].NBstreams);
+
+            for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+                devweight[device] = 1.0;
+            if(gpumatmultconf[index].balance == 1)
+                GPU_loop_MultMat_benchmark(gpumatmultconf[index].NBstreams, GPUdevice, gpumatmultconf[index].M, gpumatmultconf[index].N, devweight);
+            GPU_loop_MultMat_partition(index, devweight);
+            free(devweight);
         }
-        gpumatmultconf[index].Nsize[gpumatmultconf[index].NBstreams-1] = gpumatmultconf[index].N-gpumatmultconf[index].Noffset[gpumatmultconf[index].NBstreams-1];
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+            gpumatmultconf[index].Nalloc[device] = (gpumatmultconf[index].balance == 1) ? gpumatmultconf[index].N : gpumatmultconf[index].Nsize[device];
 
 
         printf("Allocating physical GPU(s) to stream(s) (index %d, NBGPU(s) = %ld)\n", index, NBGPUs);
@@ -1371,12 +1838,18 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
         gpumatmultconf[index].semptr4 = (sem_t **) malloc(sizeof(sem_t*)*gpumatmultconf[index].NBstreams);
         gpumatmultconf[index].semptr5 = (sem_t **) malloc(sizeof(sem_t*)*gpumatmultconf[index].NBstreams);
 
+        gpumatmultconf[index].devfailed = (int_fast8_t*) calloc(gpumatmultconf[index].NBstreams, sizeof(int_fast8_t));
+        gpumatmultconf[index].deverror = (int_fast8_t*) calloc(gpumatmultconf[index].NBstreams, sizeof(int_fast8_t));
+        gpumatmultconf[index].cpu_dmVec_part = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].failovercnt = 0;
+
 
         for(device = 0; device < gpumatmultconf[index].NBstreams; device++)
         {
-            gpumatmultconf[index].cMat_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nsize[device]);
-            gpumatmultconf[index].wfsVec_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].Nsize[device]);
-            gpumatmultconf[index].wfsRef_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].Nsize[device]);
+            gpumatmultconf[index].cMat_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nalloc[device]);
+            gpumatmultconf[index].cpu_dmVec_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M);
+            gpumatmultconf[index].wfsVec_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].Nalloc[device]);
+            gpumatmultconf[index].wfsRef_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].Nalloc[device]);
             gpumatmultconf[index].dmVec_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M);
             gpumatmultconf[index].dmRef_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M);
 
@@ -1430,7 +1903,7 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
 
             // ALLOCATE MEMORY ON DEVICE
 
-            error = cudaMalloc((void **) &gpumatmultconf[index].d_cMat[device], sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nsize[device]);
+            error = cudaMalloc((void **) &gpumatmultconf[index].d_cMat[device], sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nalloc[device]);
             if (error != cudaSuccess)
             {
                 printf("cudaMalloc d_cMat returned error code %d, line(%d)\n", error, __LINE__);
@@ -1442,7 +1915,7 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
             }
 
 
-            error = cudaMalloc((void **) &gpumatmultconf[index].d_wfsVec[device], sizeof(float)*gpumatmultconf[index].Nsize[device]);
+            error = cudaMalloc((void **) &gpumatmultconf[index].d_wfsVec[device], sizeof(float)*gpumatmultconf[index].Nalloc[device]);
             if (error != cudaSuccess)
             {
                 printf("cudaMalloc d_wfsVec returned error code %d, line(%d)\n", error, __LINE__);
@@ -1453,7 +1926,7 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
                 printf("ALLOCATED gpumatmultconf[%d].d_wfsVec[%d] size %d\n", index, device, (int) gpumatmultconf[index].Nsize[device]);
             }
 
-            error = cudaMalloc((void **) &gpumatmultconf[index].d_wfsRef[device], sizeof(float)*gpumatmultconf[index].Nsize[device]);
+            error = cudaMalloc((void **) &gpumatmultconf[index].d_wfsRef[device], sizeof(float)*gpumatmultconf[index].Nalloc[device]);
             if (error != cudaSuccess)
             {
                 printf("cudaMalloc d_wfsRef returned error code %d, line(%d)\n", error, __LINE__);
@@ -1542,6 +2015,9 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
        // iter = 0;
         gpumatmultconf[index].init = 1;
 
+        if(gpumatmultconf[index].asyncmode_req != 0)
+            GPU_loop_MultMat_async(index, gpumatmultconf[index].asyncmode_req);
+
         printf(". . . \n");
         fflush(stdout);
     }
@@ -1562,1793 +2038,4040 @@ int GPU_loop_MultMat_setup(int index, const char *IDcontrM_name, const char *IDw
 
 
 
-// increments status by 4
-int GPU_loop_MultMat_execute(int index, int_fast8_t *status, int_fast8_t *GPUstatus, float alpha, float beta, int timing)
+static int GPU_loop_MultMat_zerocopy_free(int index)
 {
-    int m;
-    int ptn;
-    int statustot;
-    int semval;
-    long cnt;
-
+    int device;
 
-    cublasSgemv_alpha = alpha;
-    cublasSgemv_beta = beta;
+    if(gpumatmultconf[index].zerocopy == 0)
+        return(0);
 
-	// flush semaphores
-    for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
     {
-        sem_getvalue(gpumatmultconf[index].semptr1[ptn], &semval);
-        for(cnt=0; cnt<semval; cnt++)
-            sem_trywait(gpumatmultconf[index].semptr1[ptn]);
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        cudaStreamSynchronize(gpumatmultconf[index].stream[device]);
+        cudaFree(gpumatmultconf[index].zc_d_mask[device]);
+        cudaFree(gpumatmultconf[index].zc_d_dmDark[device]);
+        cudaFree(gpumatmultconf[index].zc_d_flux[device]);
+        free(gpumatmultconf[index].zc_dmDark_part[device]);
+    }
+    cudaHostUnregister(data.image[gpumatmultconf[index].zc_IDin].array.F);
+    cudaFreeHost(gpumatmultconf[index].zc_flux_part);
 
-        sem_getvalue(gpumatmultconf[index].semptr2[ptn], &semval);
-        for(cnt=0; cnt<semval; cnt++)
-            sem_trywait(gpumatmultconf[index].semptr2[ptn]);
+    free(gpumatmultconf[index].zc_d_in);
+    free(gpumatmultconf[index].zc_d_mask);
+    free(gpumatmultconf[index].zc_d_dmDark);
+    free(gpumatmultconf[index].zc_dmDark_part);
+    free(gpumatmultconf[index].zc_d_flux);
 
-        sem_getvalue(gpumatmultconf[index].semptr3[ptn], &semval);
-        for(cnt=0; cnt<semval; cnt++)
-            sem_trywait(gpumatmultconf[index].semptr3[ptn]);
+    gpumatmultconf[index].zerocopy = 0;
 
-        sem_getvalue(gpumatmultconf[index].semptr4[ptn], &semval);
-        for(cnt=0; cnt<semval; cnt++)
-            sem_trywait(gpumatmultconf[index].semptr4[ptn]);
+    return(0);
+}
 
-        sem_getvalue(gpumatmultconf[index].semptr5[ptn], &semval);
-        for(cnt=0; cnt<semval; cnt++)
-            sem_trywait(gpumatmultconf[index].semptr5[ptn]);
-    }
 
 
-    if(timing==1)
+/**
+ * @brief Queue input transfer, MVM and output transfer for one device on its stream (asyncmode 1 and 2)
+ *
+ * Same operations as compute_function: dmVec = alpha * cMat x wfsVec + beta * dmRef\n
+ * If output = 1, result is also copied to host (dmVec_part)
+ */
+static int GPU_loop_MultMat_async_enqueue(int index, int device, float alpha, float beta, int output)
+{
+    cublasStatus_t astat;
+
+    cudaMemcpyAsync(gpumatmultconf[index].d_wfsVec[device], gpumatmultconf[index].wfsVec + gpumatmultconf[index].Noffset[device], sizeof(float)*gpumatmultconf[index].Nsize[device], cudaMemcpyHostToDevice, gpumatmultconf[index].stream[device]);
+    cudaMemcpyAsync(gpumatmultconf[index].d_dmVec[device], gpumatmultconf[index].d_dmRef[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToDevice, gpumatmultconf[index].stream[device]);
+
+    astat = cublasSgemv(gpumatmultconf[index].handle[device], CUBLAS_OP_N, gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], &alpha, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M, gpumatmultconf[index].d_wfsVec[device], 1, &beta, gpumatmultconf[index].d_dmVec[device], 1);
+    if (astat != CUBLAS_STATUS_SUCCESS)
     {
-        *status = *status + 1;  // ->7
-        clock_gettime(CLOCK_REALTIME, &tnow);
-        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-        data.image[IDtiming].array.F[*status] = tdiffv;
+        printf("cublasSgemv returned error code %d, line(%d)\n", astat, __LINE__);
+        fflush(stdout);
+        exit(EXIT_FAILURE);
     }
 
-//    if((index==0)||(index==2)) /// main CM multiplication loop
-//    {
-
-        if(gpumatmultconf[index].CM_cnt != data.image[gpumatmultconf[index].CM_ID].md[0].cnt0)
-            if(data.image[gpumatmultconf[index].CM_ID].md[0].write == 0)
-            {
-                printf("New CM detected (cnt : %ld)\n", data.image[gpumatmultconf[index].CM_ID].md[0].cnt0);
-                GPUloadCmat(index);
-                gpumatmultconf[index].CM_cnt = data.image[gpumatmultconf[index].CM_ID].md[0].cnt0;
-            }
- //   }
-
-
-
-    // index is the matrix multiplication index (unique to each matrix multiplication stream operation)
-    // ptn is the thread number = GPU device number
+    if(output == 1)
+        cudaMemcpyAsync(gpumatmultconf[index].dmVec_part[device], gpumatmultconf[index].d_dmVec[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[device]);
 
+    return(0);
+}
 
-    //    if((gpumatmultconf[index].sem==0)||
 
 
+/**
+ * @brief Queue reference product dmRef = cMat x wfsVec for one device (input vector holds reference)
+ */
+static int GPU_loop_MultMat_async_enqueue_ref(int index, int device)
+{
+    float alpharef = 1.0;
+    float betaref = 0.0;
+    cublasStatus_t astat;
 
-    if(gpumatmultconf[index].gpuinit==0)
+    cudaMemcpyAsync(gpumatmultconf[index].d_wfsVec[device], gpumatmultconf[index].wfsVec + gpumatmultconf[index].Noffset[device], sizeof(float)*gpumatmultconf[index].Nsize[device], cudaMemcpyHostToDevice, gpumatmultconf[index].stream[device]);
+    astat = cublasSgemv(gpumatmultconf[index].handle[device], CUBLAS_OP_N, gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], &alpharef, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M, gpumatmultconf[index].d_wfsVec[device], 1, &betaref, gpumatmultconf[index].d_dmRef[device], 1);
+    if (astat != CUBLAS_STATUS_SUCCESS)
     {
-        printf("GPU pthread create, index = %d    %d %d\n", index, gpumatmultconf[index].sem, gpumatmultconf[index].gpuinit);//TEST
+        printf("cublasSgemv returned error code %d, line(%d)\n", astat, __LINE__);
         fflush(stdout);
-
-        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
-        {
-            gpumatmultconf[index].thdata[ptn].thread_no = ptn;
-            gpumatmultconf[index].thdata[ptn].numl0 = ptn*ptn;
-            gpumatmultconf[index].thdata[ptn].cindex = index;
-            gpumatmultconf[index].thdata[ptn].status = GPUstatus;
-            gpumatmultconf[index].iret[ptn] = pthread_create( &gpumatmultconf[index].threadarray[ptn], NULL, compute_function, (void*) &gpumatmultconf[index].thdata[ptn]);
-            if(gpumatmultconf[index].iret[ptn])
-            {
-                fprintf(stderr,"Error - pthread_create() return code: %d\n", gpumatmultconf[index].iret[ptn]);
-                exit(EXIT_FAILURE);
-            }
-        }
-        gpumatmultconf[index].gpuinit = 1;
+        exit(EXIT_FAILURE);
     }
+    cudaMemcpyAsync(gpumatmultconf[index].dmRef_part[device], gpumatmultconf[index].d_dmRef[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[device]);
+    gpumatmultconf[index].refWFSinit[device] = 1;
+
+    return(0);
+}
 
-    if(timing == 1)
-    {
-        *status = *status + 1;  // -> 8
-        clock_gettime(CLOCK_REALTIME, &tnow);
-        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-        data.image[IDtiming].array.F[*status] = tdiffv;
-    }
 
 
-    if(gpumatmultconf[index].sem==0)
+/**
+ * @brief Re-partition matrix across devices from measured MVM times (load balancing, async mode)
+ *
+ * Called every GPU_BALANCE_NBFRAME frames. If slowest device takes more than GPU_BALANCE_TOL x fastest device time, the
+ * partition is recomputed from measured throughputs and the matrix is reloaded (blocking, one frame). Reference product is
+ * kept on the first device so that it does not need to be recomputed. Not done in zero-copy mode or while a hot swap upload is pending.
+ */
+static int GPU_loop_MultMat_rebalance(int index)
+{
+    int device;
+    int NBdev = gpumatmultconf[index].NBstreams;
+    double tmin, tmax;
+    double *weight;
+    long m;
+    int claimed = 0;
+
+    tmin = tmax = gpumatmultconf[index].devtime[0];
+    for(device=1; device<NBdev; device++)
     {
-        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
-            pthread_join( gpumatmultconf[index].threadarray[ptn], NULL);
+        if(gpumatmultconf[index].devtime[device] < tmin)
+            tmin = gpumatmultconf[index].devtime[device];
+        if(gpumatmultconf[index].devtime[device] > tmax)
+            tmax = gpumatmultconf[index].devtime[device];
     }
-    else
+
+    if((tmax > GPU_BALANCE_TOL*tmin)&&(tmin > 0.0)&&(gpumatmultconf[index].zerocopy == 0))
     {
-        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+        if(gpumatmultconf[index].CMhotswap != 0)
+            claimed = __sync_bool_compare_and_swap(&gpumatmultconf[index].CMupload_status, 0, 1); // keep upload thread idle
+        if((gpumatmultconf[index].CMhotswap == 0)||(claimed == 1))
         {
-            sem_post(gpumatmultconf[index].semptr1[ptn]); // START COMPUTATION
-            sem_post(gpumatmultconf[index].semptr4[ptn]);
-        }
+            weight = (double*) malloc(sizeof(double)*NBdev);
+            for(device=0; device<NBdev; device++)
+                weight[device] = gpumatmultconf[index].Nsize[device]/gpumatmultconf[index].devtime[device];
 
-        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
-            sem_wait(gpumatmultconf[index].semptr5[ptn]); // WAIT FOR RESULT
+            printf("GPU load rebalancing (index %d) :", index);
+            for(device=0; device<NBdev; device++)
+                printf("  [%d] %.1f us", gpumatmultconf[index].GPUdevice[device], 1000.0*gpumatmultconf[index].devtime[device]/gpumatmultconf[index].devtimecnt);
+            printf("\n");
+            fflush(stdout);
 
-        // for safety, set semaphores to zerosem_getvalue(data.image[IDarray[i]].semptr[s], &semval);
-        if(FORCESEMINIT==1)
-            for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+            GPU_loop_MultMat_partition(index, weight);
+            free(weight);
+
+            gpumatmultconf[index].CM_cnt = data.image[gpumatmultconf[index].CM_ID].md[0].cnt0;
+            GPUloadCmat(index);
+
+            // total reference product on first device
+            for(m=0; m<gpumatmultconf[index].M; m++)
+                for(device=1; device<NBdev; device++)
+                {
+                    gpumatmultconf[index].dmRef_part[0][m] += gpumatmultconf[index].dmRef_part[device][m];
+                    gpumatmultconf[index].dmRef_part[device][m] = 0.0;
+                }
+            for(device=0; device<NBdev; device++)
             {
-                sem_getvalue(gpumatmultconf[index].semptr5[ptn], &semval);
-                for(cnt=0; cnt<semval; cnt++)
-                    sem_trywait(gpumatmultconf[index].semptr5[ptn]);
+                cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+                cudaMemcpy(gpumatmultconf[index].d_dmRef[device], gpumatmultconf[index].dmRef_part[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyHostToDevice);
+                if(gpumatmultconf[index].graphOK[device] == 1)
+                    cudaGraphExecDestroy(gpumatmultconf[index].graphexec[device]);
+                gpumatmultconf[index].graphOK[device] = 0;
             }
 
+            if(claimed == 1)
+                gpumatmultconf[index].CMupload_status = 0;
+        }
     }
 
+    for(device=0; device<NBdev; device++)
+        gpumatmultconf[index].devtime[device] = 0.0;
+    gpumatmultconf[index].devtimecnt = 0;
 
-    // SUM RESULTS FROM SEPARATE GPUs
-    if(timing == 1)
+    return(0);
+}
+
+
+
+/**
+ * @brief Run matrix multiplication on all devices without compute threads (asyncmode 1 and 2)
+ *
+ * Work is queued on every device first, then completion events are polled, so that devices run concurrently.\n
+ * In asyncmode 2 the per-device sequence is launched as a CUDA graph, re-captured when alpha, beta or the matrix buffer change.\n
+ * With peer-to-peer reduction, other devices copy their partial result to the first device, which sums them: one transfer to host.\n
+ * If refWFSinit = 0, the reference product dmRef = cMat x wfsVec is computed instead (output not updated), as in compute_function.
+ */
+int GPU_loop_MultMat_failover(int index, long timeout, int NBthreads)
+{
+    gpumatmultconf[index].failover_timeout = timeout;
+    gpumatmultconf[index].failover_NBthreads = (NBthreads < 1) ? 1 : NBthreads;
+
+    if((timeout > 0)&&(gpumatmultconf[index].p2preduce == 1))
     {
-        *status = *status + 1;  // -> 9
-        clock_gettime(CLOCK_REALTIME, &tnow);
-        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-        data.image[IDtiming].array.F[*status] = tdiffv;
+        printf("WARNING: peer-to-peer reduction active (index %d), MVM watchdog in async mode is disabled\n", index);
+        fflush(stdout);
     }
 
-    data.image[gpumatmultconf[index].IDout].md[0].write = 1;
+    return(0);
+}
 
-    for(m=0; m<gpumatmultconf[index].M; m++)
-        gpumatmultconf[index].dmVecTMP[m] = 0.0;
 
 
+long GPU_loop_MultMat_failover_count(int index)
+{
+    return(gpumatmultconf[index].failovercnt);
+}
 
-    for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
-    {
-        for(m=0; m<gpumatmultconf[index].M; m++)
-            gpumatmultconf[index].dmVecTMP[m] += gpumatmultconf[index].dmVec_part[ptn][m];
-    }
 
-    COREMOD_MEMORY_image_set_sempost_byID(gpumatmultconf[index].IDout, -1);
 
+static void GPU_loop_MultMat_failover_deadline(struct timespec *t, long timeout)
+{
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_nsec += 1000*timeout;
+    t->tv_sec += t->tv_nsec/1000000000;
+    t->tv_nsec = t->tv_nsec%1000000000;
+}
 
-    /*  if(data.image[gpumatmultconf[index].IDout].md[0].sem > 0)
-       {
-           sem_getvalue(data.image[gpumatmultconf[index].IDout].semptr[0], &semval);
-           if(semval<SEMAPHORE_MAXVAL)
-               sem_post(data.image[gpumatmultconf[index].IDout].semptr[0]);
-       }
 
 
-       if(data.image[gpumatmultconf[index].IDout].md[0].sem > 1)
-           {
-               sem_getvalue(data.image[gpumatmultconf[index].IDout].semptr[1], &semval);
-               if(semval<SEMAPHORE_MAXVAL)
-                   sem_post(data.image[gpumatmultconf[index].IDout].semptr[1]);
-           }
-    */
+static int GPU_loop_MultMat_failover_expired(struct timespec *t)
+{
+    struct timespec t1;
 
+    clock_gettime(CLOCK_REALTIME, &t1);
 
-    data.image[gpumatmultconf[index].IDout].md[0].write = 0;
-    data.image[gpumatmultconf[index].IDout].md[0].cnt0++;
+    return((t1.tv_sec > t->tv_sec)||((t1.tv_sec == t->tv_sec)&&(t1.tv_nsec > t->tv_nsec)));
+}
 
-    if(timing == 1)
-    {
-        *status = *status + 1; // -> 10
-        clock_gettime(CLOCK_REALTIME, &tnow);
-        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-        data.image[IDtiming].array.F[*status] = tdiffv;
-    }
 
-    return(0);
+
+/**
+ * @brief Flag device as failed and raise alarm
+ */
+static void GPU_loop_MultMat_failover_trigger(int index, int device, const char *reason)
+{
+    char msg[200];
+
+    gpumatmultconf[index].devfailed[device] = 1;
+    gpumatmultconf[index].failovercnt++;
+
+    sprintf(msg, "GPU MVM ALARM: index %d, device %d (GPU %d): %s -> partition computed on CPU (%d threads)", index, device, gpumatmultconf[index].GPUdevice[device], reason, gpumatmultconf[index].failover_NBthreads);
+    printERROR(__FILE__, __func__, __LINE__, msg);
 }
 
 
 
+/**
+ * @brief Compute partition of failed device on CPU: dmVec_part = alpha x cMat_part x wfsVec_part + beta x dmRef_part
+ *
+ * Matrix slice is column-major (M rows), rows are split in blocks across threads.
+ */
+static void GPU_loop_MultMat_failover_compute(int index, int device, float alpha, float beta)
+{
+    long M = gpumatmultconf[index].M;
+    long Nsize = gpumatmultconf[index].Nsize[device];
+    const float *cM = gpumatmultconf[index].cMat_part[device];
+    const float *x = gpumatmultconf[index].wfsVec + gpumatmultconf[index].Noffset[device];
+    float *y = gpumatmultconf[index].cpu_dmVec_part[device];
+    float *yref = gpumatmultconf[index].dmRef_part[device];
+    int refinit = gpumatmultconf[index].refWFSinit[device];
+    long mb;
+
+# ifdef _OPENMP
+    #pragma omp parallel for num_threads(gpumatmultconf[index].failover_NBthreads) schedule(static)
+# endif
+    for(mb=0; mb<M; mb+=GPU_FAILOVER_MBLOCK)
+    {
+        long m, n;
+        long m1 = (mb+GPU_FAILOVER_MBLOCK < M) ? mb+GPU_FAILOVER_MBLOCK : M;
 
+        if(refinit == 0) // reference changed: recompute DM reference
+        {
+            for(m=mb; m<m1; m++)
+                yref[m] = 0.0;
+            for(n=0; n<Nsize; n++)
+                for(m=mb; m<m1; m++)
+                    yref[m] += cM[n*M+m]*x[n];
+        }
 
+        for(m=mb; m<m1; m++)
+            y[m] = beta*yref[m];
+        for(n=0; n<Nsize; n++)
+        {
+            float xa = alpha*x[n];
 
+            for(m=mb; m<m1; m++)
+                y[m] += cM[n*M+m]*xa;
+        }
+    }
 
+    gpumatmultconf[index].refWFSinit[device] = 1;
+}
 
 
 
-int GPU_loop_MultMat_free(int index)
+static int GPU_loop_MultMat_async_run(int index, float alpha, float beta, int_fast8_t *GPUstatus)
 {
     int device;
+    int k;
+    int NBdev = gpumatmultconf[index].NBstreams;
+    int p2p = gpumatmultconf[index].p2preduce;
+    int refframe = 0;
+    float alphaone = 1.0;
+    float tms;
+    cudaGraph_t graph;
+    int failover = ((gpumatmultconf[index].failover_timeout > 0)&&(p2p == 0)) ? 1 : 0;
+    int NBfailed = 0;
+    struct timespec tdeadline;
+
+    for(device=0; device<NBdev; device++)
+    {
+        if(gpumatmultconf[index].refWFSinit[device] == 0)
+            refframe = 1;
+        if(gpumatmultconf[index].devfailed[device] == 1)
+            NBfailed++;
+    }
 
-    cudaFree(gpumatmultconf[index].d_cMat);
-    cudaFree(gpumatmultconf[index].d_dmVec);
-    cudaFree(gpumatmultconf[index].d_wfsVec);
-    cudaFree(gpumatmultconf[index].d_wfsRef);
-    cudaFree(gpumatmultconf[index].d_dmRef);
-    free(gpumatmultconf[index].stream);
+    if(failover == 1)
+        GPU_loop_MultMat_failover_deadline(&tdeadline, gpumatmultconf[index].failover_timeout);
 
-    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    for(k=0; k<NBdev; k++)
     {
-        // free memory for stream
-        cublasDestroy(gpumatmultconf[index].handle[device]);
-        free(gpumatmultconf[index].cMat_part[device]);
-        free(gpumatmultconf[index].wfsVec_part[device]);
-        free(gpumatmultconf[index].dmVec_part[device]);
-    }
+        device = (p2p == 1) ? NBdev-1-k : k; // first device last: it waits for partial results of others
+        if(gpumatmultconf[index].devfailed[device] == 1)
+        {
+            GPUstatus[device] = 4;
+            continue;
+        }
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        GPUstatus[device] = 3;
+        cudaEventRecord(gpumatmultconf[index].event_start[device], gpumatmultconf[index].stream[device]);
 
-    free(gpumatmultconf[index].cMat_part);
-    free(gpumatmultconf[index].dmVec_part);
-    free(gpumatmultconf[index].wfsVec_part);
+        if(gpumatmultconf[index].refWFSinit[device] == 0) // compute DM reference (used when reference changes)
+            GPU_loop_MultMat_async_enqueue_ref(index, device);
+        else if((gpumatmultconf[index].asyncmode == 2)&&(p2p == 0))
+        {
+            if((gpumatmultconf[index].graphOK[device] == 0)||(gpumatmultconf[index].graph_d_cMat[device] != gpumatmultconf[index].d_cMat[device])
+                    ||(gpumatmultconf[index].graph_alpha != alpha)||(gpumatmultconf[index].graph_beta != beta))
+            {
+                if(gpumatmultconf[index].graphOK[device] == 1)
+                    cudaGraphExecDestroy(gpumatmultconf[index].graphexec[device]);
+
+                cudaStreamBeginCapture(gpumatmultconf[index].stream[device], cudaStreamCaptureModeThreadLocal);
+                GPU_loop_MultMat_async_enqueue(index, device, alpha, beta, 1);
+                error = cudaStreamEndCapture(gpumatmultconf[index].stream[device], &graph);
+                if(error == cudaSuccess)
+                    error = cudaGraphInstantiateWithFlags(&gpumatmultconf[index].graphexec[device], graph, 0);
+                if (error != cudaSuccess)
+                {
+                    printf("CUDA graph capture returned error code %d, line(%d)\n", error, __LINE__);
+                    exit(EXIT_FAILURE);
+                }
+                cudaGraphDestroy(graph);
 
-    free(gpumatmultconf[index].Nsize);
-    free(gpumatmultconf[index].Noffset);
+                gpumatmultconf[index].graphOK[device] = 1;
+                gpumatmultconf[index].graph_d_cMat[device] = gpumatmultconf[index].d_cMat[device];
+                if(device == NBdev-1)
+                {
+                    gpumatmultconf[index].graph_alpha = alpha;
+                    gpumatmultconf[index].graph_beta = beta;
+                }
+            }
+            cudaGraphLaunch(gpumatmultconf[index].graphexec[device], gpumatmultconf[index].stream[device]);
+        }
+        else
+            GPU_loop_MultMat_async_enqueue(index, device, alpha, beta, (p2p == 0) ? 1 : 0);
 
-    free(gpumatmultconf[index].iret);
-    free(gpumatmultconf[index].threadarray);
-    free(gpumatmultconf[index].thdata);
+        cudaEventRecord(gpumatmultconf[index].event_mvm[device], gpumatmultconf[index].stream[device]);
 
-    free(gpumatmultconf[index].refWFSinit);
+        if((p2p == 1)&&(refframe == 0))
+        {
+            if(device > 0) // partial result -> first device
+                cudaMemcpyPeerAsync(gpumatmultconf[index].d_peer[device], gpumatmultconf[index].GPUdevice[0], gpumatmultconf[index].d_dmVec[device], gpumatmultconf[index].GPUdevice[device], sizeof(float)*gpumatmultconf[index].M, gpumatmultconf[index].stream[device]);
+            else
+            {
+                int device1;
 
-    free(gpumatmultconf[index].GPUdevice);
+                for(device1=1; device1<NBdev; device1++)
+                {
+                    cudaStreamWaitEvent(gpumatmultconf[index].stream[0], gpumatmultconf[index].event_done[device1], 0);
+                    cublasSaxpy(gpumatmultconf[index].handle[0], gpumatmultconf[index].M, &alphaone, gpumatmultconf[index].d_peer[device1], 1, gpumatmultconf[index].d_dmVec[0], 1);
+                }
+                cudaMemcpyAsync(gpumatmultconf[index].dmVec_part[0], gpumatmultconf[index].d_dmVec[0], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[0]);
+            }
+        }
+
+        cudaEventRecord(gpumatmultconf[index].event_done[device], gpumatmultconf[index].stream[device]);
+        GPUstatus[device] = 4;
+    }
+
+    // busy wait: lowest latency on dedicated core
+    for(device=0; device<NBdev; device++)
+    {
+        if(gpumatmultconf[index].devfailed[device] == 1)
+            continue;
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        if(failover == 0)
+            while(cudaEventQuery(gpumatmultconf[index].event_done[device]) == cudaErrorNotReady) {}
+        else
+        {
+            while((error = cudaEventQuery(gpumatmultconf[index].event_done[device])) == cudaErrorNotReady)
+                if(GPU_loop_MultMat_failover_expired(&tdeadline) == 1)
+                    break;
+            if(error != cudaSuccess)
+            {
+                GPU_loop_MultMat_failover_trigger(index, device, (error == cudaErrorNotReady) ? "deadline missed" : "CUDA error");
+                NBfailed++;
+            }
+        }
+        GPUstatus[device] = 6;
+    }
+
+    for(device=0; device<NBdev; device++)
+        if(gpumatmultconf[index].devfailed[device] == 1)
+            GPU_loop_MultMat_failover_compute(index, device, alpha, beta);
+
+    if((gpumatmultconf[index].balance == 1)&&(refframe == 0)&&(NBfailed == 0))
+    {
+        for(device=0; device<NBdev; device++)
+        {
+            cudaEventElapsedTime(&tms, gpumatmultconf[index].event_start[device], gpumatmultconf[index].event_mvm[device]);
+            gpumatmultconf[index].devtime[device] += tms;
+        }
+        gpumatmultconf[index].devtimecnt++;
+        if(gpumatmultconf[index].devtimecnt == GPU_BALANCE_NBFRAME)
+            GPU_loop_MultMat_rebalance(index);
+    }
 
     return(0);
 }
 
 
 
+static int GPU_loop_MultMat_async_free(int index)
+{
+    int device;
 
+    if(gpumatmultconf[index].asyncmode == 0)
+        return(0);
 
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        if(gpumatmultconf[index].devfailed[device] == 0)
+            cudaStreamSynchronize(gpumatmultconf[index].stream[device]);
+        if(gpumatmultconf[index].graphOK[device] == 1)
+            cudaGraphExecDestroy(gpumatmultconf[index].graphexec[device]);
+        cudaEventDestroy(gpumatmultconf[index].event_done[device]);
+        cudaEventDestroy(gpumatmultconf[index].event_start[device]);
+        cudaEventDestroy(gpumatmultconf[index].event_mvm[device]);
+        cudaHostUnregister(gpumatmultconf[index].dmVec_part[device]);
+    }
+    if(gpumatmultconf[index].p2preduce == 1)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[0]);
+        for(device=1; device<gpumatmultconf[index].NBstreams; device++)
+            cudaFree(gpumatmultconf[index].d_peer[device]);
+        free(gpumatmultconf[index].d_peer);
+    }
+    gpumatmultconf[index].p2preduce = 0;
+    if(gpumatmultconf[index].wfsVec_pinned == 1)
+        cudaHostUnregister(gpumatmultconf[index].wfsVec);
+    gpumatmultconf[index].wfsVec_pinned = 0;
 
+    free(gpumatmultconf[index].event_done);
+    free(gpumatmultconf[index].graphexec);
+    free(gpumatmultconf[index].graphOK);
+    free(gpumatmultconf[index].graph_d_cMat);
+    free(gpumatmultconf[index].event_start);
+    free(gpumatmultconf[index].event_mvm);
+    free(gpumatmultconf[index].devtime);
 
+    gpumatmultconf[index].asyncmode = 0;
 
-#ifdef HAVE_MAGMA
+    return(0);
+}
 
 
 
+int GPU_loop_MultMat_async(int index, int mode)
+{
+    int device;
 
+    gpumatmultconf[index].asyncmode_req = mode;
 
+    if((gpumatmultconf[index].init == 0)||(mode == gpumatmultconf[index].asyncmode))
+        return(0);
 
-/******************* CPU memory */
-#define TESTING_MALLOC_CPU( ptr, type, size )                              \
-    if ( MAGMA_SUCCESS !=                                                  \
-            magma_malloc_cpu( (void**) &ptr, (size)*sizeof(type) )) {      \
-        fprintf( stderr, "!!!! magma_malloc_cpu failed for: %s\n", #ptr ); \
-        magma_finalize();                                                  \
-        exit(-1);                                                          \
+    if(mode == 0)
+    {
+        GPU_loop_MultMat_zerocopy_free(index);
+        return(GPU_loop_MultMat_async_free(index));
     }
 
-#define TESTING_FREE_CPU( ptr ) magma_free_cpu( ptr )
+    if(gpumatmultconf[index].asyncmode == 0)
+    {
+        if(gpumatmultconf[index].gpuinit == 1)
+        {
+            printf("WARNING: GPU compute threads already running (index %d), cannot switch to async mode\n", index);
+            fflush(stdout);
+            gpumatmultconf[index].asyncmode_req = 0;
+            return(-1);
+        }
 
+        printf("GPU async mode %d (index %d): pinning host buffers\n", mode, index);
+        fflush(stdout);
 
-/******************* Pinned CPU memory */
-#ifdef HAVE_CUBLAS
-    // In CUDA, this allocates pinned memory.
-    #define TESTING_MALLOC_PIN( ptr, type, size )                                 \
-        if ( MAGMA_SUCCESS !=                                                     \
-                magma_malloc_pinned( (void**) &ptr, (size)*sizeof(type) )) {      \
-            fprintf( stderr, "!!!! magma_malloc_pinned failed for: %s\n", #ptr ); \
-            magma_finalize();                                                     \
-            exit(-1);                                                             \
-        }
-    
-    #define TESTING_FREE_PIN( ptr ) magma_free_pinned( ptr )
-#else
-    // For OpenCL, we don't support pinned memory yet.
-    #define TESTING_MALLOC_PIN( ptr, type, size )                              \
-        if ( MAGMA_SUCCESS !=                                                  \
-                magma_malloc_cpu( (void**) &ptr, (size)*sizeof(type) )) {      \
-            fprintf( stderr, "!!!! magma_malloc_cpu failed for: %s\n", #ptr ); \
-            magma_finalize();                                                  \
-            exit(-1);                                                          \
+        gpumatmultconf[index].event_done = (cudaEvent_t*) malloc(sizeof(cudaEvent_t)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].graphexec = (cudaGraphExec_t*) malloc(sizeof(cudaGraphExec_t)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].graphOK = (int_fast8_t*) malloc(sizeof(int_fast8_t)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].graph_d_cMat = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].event_start = (cudaEvent_t*) malloc(sizeof(cudaEvent_t)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].event_mvm = (cudaEvent_t*) malloc(sizeof(cudaEvent_t)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].devtime = (double*) malloc(sizeof(double)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].devtimecnt = 0;
+
+        // input vector is a shared memory stream: register in place (no copy on host side)
+        gpumatmultconf[index].wfsVec_pinned = 0;
+        if(cudaHostRegister(gpumatmultconf[index].wfsVec, sizeof(float)*gpumatmultconf[index].N, cudaHostRegisterPortable) == cudaSuccess)
+            gpumatmultconf[index].wfsVec_pinned = 1;
+        else
+            printf("WARNING: cannot register input vector as pinned memory, using pageable transfers\n");
+
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+        {
+            cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+            cublasSetStream(gpumatmultconf[index].handle[device], gpumatmultconf[index].stream[device]);
+            cudaEventCreateWithFlags(&gpumatmultconf[index].event_done[device], cudaEventDisableTiming);
+            cudaEventCreate(&gpumatmultconf[index].event_start[device]);
+            cudaEventCreate(&gpumatmultconf[index].event_mvm[device]);
+            cudaHostRegister(gpumatmultconf[index].dmVec_part[device], sizeof(float)*gpumatmultconf[index].M, cudaHostRegisterPortable);
+            gpumatmultconf[index].graphOK[device] = 0;
+            gpumatmultconf[index].devtime[device] = 0.0;
         }
-    
-    #define TESTING_FREE_PIN( ptr ) magma_free_cpu( ptr )
-#endif
 
+        // peer-to-peer reduction on first device if all devices can reach it
+        gpumatmultconf[index].p2preduce = 0;
+        if(gpumatmultconf[index].NBstreams > 1)
+        {
+            int canaccess = 1;
+            int access;
 
-/******************* GPU memory */
-#ifdef HAVE_CUBLAS
-    // In CUDA, this has (void**) cast.
-    #define TESTING_MALLOC_DEV( ptr, type, size )                              \
-        if ( MAGMA_SUCCESS !=                                                  \
-                magma_malloc( (void**) &ptr, (size)*sizeof(type) )) {          \
-            fprintf( stderr, "!!!! magma_malloc failed for: %s\n", #ptr );     \
-            magma_finalize();                                                  \
-            exit(-1);                                                          \
+            for(device=1; device<gpumatmultconf[index].NBstreams; device++)
+            {
+                cudaDeviceCanAccessPeer(&access, gpumatmultconf[index].GPUdevice[0], gpumatmultconf[index].GPUdevice[device]);
+                if(access == 0)
+                    canaccess = 0;
+            }
+            if(canaccess == 1)
+            {
+                gpumatmultconf[index].d_peer = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+                gpumatmultconf[index].d_peer[0] = NULL;
+                cudaSetDevice(gpumatmultconf[index].GPUdevice[0]);
+                for(device=1; device<gpumatmultconf[index].NBstreams; device++)
+                {
+                    error = cudaDeviceEnablePeerAccess(gpumatmultconf[index].GPUdevice[device], 0);
+                    if((error != cudaSuccess)&&(error != cudaErrorPeerAccessAlreadyEnabled))
+                        canaccess = 0;
+                    cudaMalloc((void **) &gpumatmultconf[index].d_peer[device], sizeof(float)*gpumatmultconf[index].M);
+                }
+                cudaGetLastError(); // clear already-enabled error
+                if(canaccess == 1)
+                {
+                    gpumatmultconf[index].p2preduce = 1;
+                    printf("GPU async mode (index %d): peer-to-peer reduction on device %d\n", index, gpumatmultconf[index].GPUdevice[0]);
+                }
+                else
+                {
+                    for(device=1; device<gpumatmultconf[index].NBstreams; device++)
+                        cudaFree(gpumatmultconf[index].d_peer[device]);
+                    free(gpumatmultconf[index].d_peer);
+                }
+            }
         }
-#else
-    // For OpenCL, ptr is cl_mem* and there is no cast.
-    #define TESTING_MALLOC_DEV( ptr, type, size )                              \
-        if ( MAGMA_SUCCESS !=                                                  \
-                magma_malloc( &ptr, (size)*sizeof(type) )) {                   \
-            fprintf( stderr, "!!!! magma_malloc failed for: %s\n", #ptr );     \
-            magma_finalize();                                                  \
-            exit(-1);                                                          \
+    }
+    gpumatmultconf[index].asyncmode = mode;
+
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Recompute cMat x dark and masked dark flux (zero-copy mode), blocking
+ */
+static int GPU_loop_MultMat_zerocopy_darkupdate(int index)
+{
+    int device;
+    long n;
+    float alpharef = 1.0;
+    float betaref = 0.0;
+    double maskdark = 0.0;
+
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        if(gpumatmultconf[index].zc_IDdark == -1)
+        {
+            cudaMemsetAsync(gpumatmultconf[index].zc_d_dmDark[device], 0, sizeof(float)*gpumatmultconf[index].M, gpumatmultconf[index].stream[device]);
+            memset(gpumatmultconf[index].zc_dmDark_part[device], 0, sizeof(float)*gpumatmultconf[index].M);
+            continue;
         }
-#endif
+        cudaMemcpyAsync(gpumatmultconf[index].d_wfsVec[device], data.image[gpumatmultconf[index].zc_IDdark].array.F + gpumatmultconf[index].Noffset[device], sizeof(float)*gpumatmultconf[index].Nsize[device], cudaMemcpyHostToDevice, gpumatmultconf[index].stream[device]);
+        cublasSgemv(gpumatmultconf[index].handle[device], CUBLAS_OP_N, gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], &alpharef, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M, gpumatmultconf[index].d_wfsVec[device], 1, &betaref, gpumatmultconf[index].zc_d_dmDark[device], 1);
+        cudaMemcpyAsync(gpumatmultconf[index].zc_dmDark_part[device], gpumatmultconf[index].zc_d_dmDark[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[device]);
+    }
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        cudaStreamSynchronize(gpumatmultconf[index].stream[device]);
+    }
 
-#define TESTING_FREE_DEV( ptr ) magma_free( ptr )
+    if(gpumatmultconf[index].zc_IDdark != -1)
+    {
+        for(n=0; n<gpumatmultconf[index].N; n++)
+            maskdark += (gpumatmultconf[index].zc_IDmask == -1) ? data.image[gpumatmultconf[index].zc_IDdark].array.F[n] : data.image[gpumatmultconf[index].zc_IDmask].array.F[n]*data.image[gpumatmultconf[index].zc_IDdark].array.F[n];
+        gpumatmultconf[index].zc_darkcnt = data.image[gpumatmultconf[index].zc_IDdark].md[0].cnt0;
+    }
+    gpumatmultconf[index].zc_maskdark = (float) maskdark;
 
+    return(0);
+}
 
 
 
+/**
+ * @brief Zero-copy frame: masked flux and cMat x in, read from mapped camera stream
+ */
+static int GPU_loop_MultMat_zerocopy_run(int index, int_fast8_t *GPUstatus)
+{
+    int device;
+    long slice = 0;
+    float alphaone = 1.0;
+    float betazero = 0.0;
+    float *d_in;
+    cublasStatus_t zstat;
+
+    if(gpumatmultconf[index].zc_IDdark != -1)
+        if(data.image[gpumatmultconf[index].zc_IDdark].md[0].cnt0 != gpumatmultconf[index].zc_darkcnt)
+        {
+            printf("New dark detected (cnt : %ld)\n", data.image[gpumatmultconf[index].zc_IDdark].md[0].cnt0);
+            GPU_loop_MultMat_zerocopy_darkupdate(index);
+        }
 
+    if(data.image[gpumatmultconf[index].zc_IDin].md[0].naxis == 3) // ring buffer
+    {
+        slice = data.image[gpumatmultconf[index].zc_IDin].md[0].cnt1;
+        if(slice == -1)
+            slice = data.image[gpumatmultconf[index].zc_IDin].md[0].size[2];
+    }
 
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        GPUstatus[device] = 3;
 
+        if(gpumatmultconf[index].refWFSinit[device] == 0)
+            GPU_loop_MultMat_async_enqueue_ref(index, device);
 
+        d_in = gpumatmultconf[index].zc_d_in[device] + slice*gpumatmultconf[index].N + gpumatmultconf[index].Noffset[device];
 
-/* =============================================================================================== */
-/* =============================================================================================== */
-/*                                                                                                 */
-/* 3. SINGULAR VALUE DECOMPOSITION, PSEUDO-INVERSE                                                 */
-/*                                                                                                 */
-/* =============================================================================================== */
-/* =============================================================================================== */
+        cublasSetPointerMode(gpumatmultconf[index].handle[device], CUBLAS_POINTER_MODE_DEVICE);
+        zstat = cublasSdot(gpumatmultconf[index].handle[device], gpumatmultconf[index].Nsize[device], d_in, 1, gpumatmultconf[index].zc_d_mask[device], 1, gpumatmultconf[index].zc_d_flux[device]);
+        cublasSetPointerMode(gpumatmultconf[index].handle[device], CUBLAS_POINTER_MODE_HOST);
+        if (zstat == CUBLAS_STATUS_SUCCESS)
+            zstat = cublasSgemv(gpumatmultconf[index].handle[device], CUBLAS_OP_N, gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], &alphaone, gpumatmultconf[index].d_cMat[device], gpumatmultconf[index].M, d_in, 1, &betazero, gpumatmultconf[index].d_dmVec[device], 1);
+        if (zstat != CUBLAS_STATUS_SUCCESS)
+        {
+            printf("cuBLAS zero-copy MVM returned error code %d, line(%d)\n", zstat, __LINE__);
+            fflush(stdout);
+            exit(EXIT_FAILURE);
+        }
 
+        cudaMemcpyAsync(gpumatmultconf[index].dmVec_part[device], gpumatmultconf[index].d_dmVec[device], sizeof(float)*gpumatmultconf[index].M, cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[device]);
+        cudaMemcpyAsync(gpumatmultconf[index].zc_flux_part + device, gpumatmultconf[index].zc_d_flux[device], sizeof(float), cudaMemcpyDeviceToHost, gpumatmultconf[index].stream[device]);
+        cudaEventRecord(gpumatmultconf[index].event_done[device], gpumatmultconf[index].stream[device]);
+        GPUstatus[device] = 4;
+    }
 
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        while(cudaEventQuery(gpumatmultconf[index].event_done[device]) == cudaErrorNotReady) {}
+        GPUstatus[device] = 6;
+    }
 
-/** @brief Test pseudo inverse
- * 
- */
- 
-long CUDACOMP_MatMatMult_testPseudoInverse(const char *IDmatA_name, const char *IDmatAinv_name, const char *IDmatOut_name)
-{
-	long IDmatA, IDmatAinv;
-	long IDmatOut;
-	
-	long ii;
-	float *magmaf_d_AinvA;
-	float *magmaf_h_AinvA;
+    return(0);
+}
 
-	uint32_t *arraysizetmp;
-	magma_int_t M, N;
-	
 
-	/**
-	 * 
-	 * IDmatA is an image loaded as a M x N matrix
-	 * IDmatAinv is an image loaded as a M x M matrix, representing the transpose of the pseudo inverse of IDmatA
-	 * 
-	 * The input matrices can be 2D or a 3D images
-	 * 
-	 * If 2D image :
-	 *   IDmatA    M = xsize
-	 *   IDmatA    N = ysize
-	 * 
-	 * If 3D image :
-	 *   IDmatA M = xsize*ysize
-	 *   IDmatA N = ysize
-	 * 
-	 * 
-	 */
 
-	///
-	/// MAGMA uses column-major matrices. For matrix A with dimension (M,N), element A(i,j) is A[ j*M + i]
-	/// i = 0 ... M
-	/// j = 0 ... N
-	///
-	
-	
-	arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+/**
+ * @brief Combine device results into output vector (zero-copy mode): dark, normalization and reference terms
+ */
+static int GPU_loop_MultMat_zerocopy_combine(int index)
+{
+    int device;
+    long m;
+    double flux = 0.0;
+    float totalinv = 1.0;
+    float normfloorcoeff = 1.0;
+    float val;
 
-    IDmatA = image_ID(IDmatA_name);
-    IDmatAinv = image_ID(IDmatAinv_name);
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+        flux += gpumatmultconf[index].zc_flux_part[device];
+    flux -= gpumatmultconf[index].zc_maskdark;
+    gpumatmultconf[index].zc_flux = (float) flux;
 
-    if(data.image[IDmatA].md[0].naxis==3)
+    if(gpumatmultconf[index].zc_normalize == 1)
     {
-		/// each column (N=cst) of A is a z=cst slice of image Rmatrix
-        M = data.image[IDmatA].md[0].size[0]*data.image[IDmatA].md[0].size[1];
-        N = data.image[IDmatA].md[0].size[2];
+        totalinv = 1.0/(flux + gpumatmultconf[index].zc_normfloor*gpumatmultconf[index].N);
+        normfloorcoeff = flux*totalinv;
     }
-    else
+
+    for(m=0; m<gpumatmultconf[index].M; m++)
     {
-		/// each column (N=cst) of A is a line (y=cst) of Rmatrix (90 deg rotation)
-        M = data.image[IDmatA].md[0].size[0];
-        N = data.image[IDmatA].md[0].size[1];
+        val = 0.0;
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+            val += totalinv*(gpumatmultconf[index].dmVec_part[device][m] - gpumatmultconf[index].zc_dmDark_part[device][m]) - normfloorcoeff*gpumatmultconf[index].dmRef_part[device][m];
+        gpumatmultconf[index].dmVecTMP[m] = val;
     }
 
+    return(0);
+}
 
-	/// Initialize MAGAM if needed
-    if(INIT_MAGMA==0)
+
+
+int GPU_loop_MultMat_zerocopy(int index, const char *IDin_name, const char *IDdark_name, const char *IDmask_name, int normalize, float normfloor)
+{
+    int device;
+    long IDin;
+    long n;
+    long nbslice = 1;
+    float *maskpart;
+
+    if(gpumatmultconf[index].zerocopy == 1)
     {
-        magma_init();
-        magma_print_environment();
+        gpumatmultconf[index].zc_normalize = normalize;
+        gpumatmultconf[index].zc_normfloor = normfloor;
+        return(0);
+    }
 
-        INIT_MAGMA = 1;
+    if((gpumatmultconf[index].init == 0)||(gpumatmultconf[index].asyncmode == 0)||(gpumatmultconf[index].orientation != 0))
+    {
+        printf("WARNING: zero-copy input requires initialized async matrix multiplication (index %d)\n", index);
+        return(-1);
     }
-	magma_queue_create(0, &magmaqueue);
 
-    TESTING_MALLOC_CPU( magmaf_h_A, float, M*N);
-    TESTING_MALLOC_DEV( magmaf_d_A, float, M*N);
+    IDin = image_ID(IDin_name);
+    if((IDin == -1)||(data.image[IDin].md[0].atype != _DATATYPE_FLOAT)||(data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1] != gpumatmultconf[index].N))
+    {
+        printf("WARNING: zero-copy input requires FLOAT stream of size %ld: %s not compatible\n", (long) gpumatmultconf[index].N, IDin_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].naxis == 3)
+        nbslice = data.image[IDin].md[0].size[2];
 
-    TESTING_MALLOC_CPU( magmaf_h_Ainv, float, M*N);
-    TESTING_MALLOC_DEV( magmaf_d_Ainv, float, M*N);
+    if(cudaHostRegister(data.image[IDin].array.F, sizeof(float)*gpumatmultconf[index].N*nbslice, cudaHostRegisterMapped|cudaHostRegisterPortable) != cudaSuccess)
+    {
+        printf("WARNING: cannot map stream %s into device address space\n", IDin_name);
+        return(-1);
+    }
 
-    TESTING_MALLOC_CPU( magmaf_h_AinvA, float, N*N);
-    TESTING_MALLOC_DEV( magmaf_d_AinvA, float, N*N);
+    printf("Zero-copy input %s (index %d, %ld slice(s))\n", IDin_name, index, nbslice);
+    fflush(stdout);
 
+    gpumatmultconf[index].zc_IDin = IDin;
+    gpumatmultconf[index].zc_IDdark = image_ID(IDdark_name);
+    gpumatmultconf[index].zc_IDmask = image_ID(IDmask_name);
+    gpumatmultconf[index].zc_normalize = normalize;
+    gpumatmultconf[index].zc_normfloor = normfloor;
+    gpumatmultconf[index].zc_flux = 0.0;
 
-	/// load matA in h_A -> d_A
-    for(ii=0; ii<M*N; ii++)
-        magmaf_h_A[ii] =  data.image[IDmatA].array.F[ii];	
-    magma_ssetmatrix( M, N, magmaf_h_A, M, magmaf_d_A, M, magmaqueue);
+    gpumatmultconf[index].zc_d_in = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+    gpumatmultconf[index].zc_d_mask = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+    gpumatmultconf[index].zc_d_dmDark = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+    gpumatmultconf[index].zc_dmDark_part = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+    gpumatmultconf[index].zc_d_flux = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+    cudaMallocHost((void **) &gpumatmultconf[index].zc_flux_part, sizeof(float)*gpumatmultconf[index].NBstreams);
 
-	/// load matAinv in h_Ainv -> d_Ainv
-    for(ii=0; ii<M*N; ii++)
-        magmaf_h_Ainv[ii] =  data.image[IDmatAinv].array.F[ii];	
-    magma_ssetmatrix( M, N, magmaf_h_Ainv, M, magmaf_d_Ainv, M, magmaqueue);
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        cudaHostGetDevicePointer((void **) &gpumatmultconf[index].zc_d_in[device], data.image[IDin].array.F, 0);
 
+        cudaMalloc((void **) &gpumatmultconf[index].zc_d_mask[device], sizeof(float)*gpumatmultconf[index].Nsize[device]);
+        cudaMalloc((void **) &gpumatmultconf[index].zc_d_dmDark[device], sizeof(float)*gpumatmultconf[index].M);
+        cudaMalloc((void **) &gpumatmultconf[index].zc_d_flux[device], sizeof(float));
+        gpumatmultconf[index].zc_dmDark_part[device] = (float*) malloc(sizeof(float)*gpumatmultconf[index].M);
 
-	magma_sgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magmaf_d_Ainv, M, magmaf_d_A, M, 0.0,  magmaf_d_AinvA, N, magmaqueue);
+        maskpart = gpumatmultconf[index].wfsRef_part[device]; // host scratch of size Nsize, not used after setup
+        for(n=0; n<gpumatmultconf[index].Nsize[device]; n++)
+            maskpart[n] = (gpumatmultconf[index].zc_IDmask == -1) ? 1.0 : data.image[gpumatmultconf[index].zc_IDmask].array.F[gpumatmultconf[index].Noffset[device]+n];
+        cudaMemcpy(gpumatmultconf[index].zc_d_mask[device], maskpart, sizeof(float)*gpumatmultconf[index].Nsize[device], cudaMemcpyHostToDevice);
+    }
 
-	magma_sgetmatrix( N, N, magmaf_d_AinvA, N, magmaf_h_AinvA, N, magmaqueue);
+    GPU_loop_MultMat_zerocopy_darkupdate(index);
 
-	
-	arraysizetmp[0] = N;
-	arraysizetmp[1] = N;
-	IDmatOut = create_image_ID(IDmatOut_name, 2, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
-       
+    gpumatmultconf[index].zerocopy = 1;
 
-    for(ii=0; ii<N*N; ii++)
-         data.image[IDmatOut].array.F[ii] = magmaf_h_AinvA[ii];
+    return(0);
+}
 
 
 
-    TESTING_FREE_CPU( magmaf_h_AinvA );
-    TESTING_FREE_DEV( magmaf_d_AinvA );
+float GPU_loop_MultMat_zerocopy_flux(int index)
+{
+    return(gpumatmultconf[index].zc_flux);
+}
 
-    TESTING_FREE_DEV( magmaf_d_A );
-    TESTING_FREE_CPU( magmaf_h_A );
 
-    TESTING_FREE_DEV( magmaf_d_Ainv );
-    TESTING_FREE_CPU( magmaf_h_Ainv );
 
 
-	free(arraysizetmp);
-	
-    magma_queue_destroy( magmaqueue );
-    magma_finalize ();                               //  finalize  Magma
+// increments status by 4
+int GPU_loop_MultMat_execute(int index, int_fast8_t *status, int_fast8_t *GPUstatus, float alpha, float beta, int timing)
+{
+    int m;
+    int ptn;
+    int statustot;
+    int semval;
+    long cnt;
 
 
+    cublasSgemv_alpha = alpha;
+    cublasSgemv_beta = beta;
 
-	return IDmatOut;
-}
+	// flush semaphores
+    if(gpumatmultconf[index].asyncmode == 0)
+    for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+    {
+        sem_getvalue(gpumatmultconf[index].semptr1[ptn], &semval);
+        for(cnt=0; cnt<semval; cnt++)
+            sem_trywait(gpumatmultconf[index].semptr1[ptn]);
 
+        sem_getvalue(gpumatmultconf[index].semptr2[ptn], &semval);
+        for(cnt=0; cnt<semval; cnt++)
+            sem_trywait(gpumatmultconf[index].semptr2[ptn]);
 
+        sem_getvalue(gpumatmultconf[index].semptr3[ptn], &semval);
+        for(cnt=0; cnt<semval; cnt++)
+            sem_trywait(gpumatmultconf[index].semptr3[ptn]);
 
+        sem_getvalue(gpumatmultconf[index].semptr4[ptn], &semval);
+        for(cnt=0; cnt<semval; cnt++)
+            sem_trywait(gpumatmultconf[index].semptr4[ptn]);
 
+        sem_getvalue(gpumatmultconf[index].semptr5[ptn], &semval);
+        for(cnt=0; cnt<semval; cnt++)
+            sem_trywait(gpumatmultconf[index].semptr5[ptn]);
+    }
 
-//
-// Computes control matrix
-// Conventions:
-//   m: number of actuators 
-//   n: number of sensors  
-int CUDACOMP_magma_compute_SVDpseudoInverse_SVD(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name) 
-{
-	uint32_t *arraysizetmp;
-	magma_int_t M, N, min_mn;
-	long m, n, ii, jj, k;
-	long ID_Rmatrix;
-	long ID_Cmatrix;
-	uint8_t atype;
-	
-	magma_int_t lda, ldu, ldv;
-	float dummy[1];
-	float *a, *h_R;         // a, h_R - mxn  matrices
-	float *U, *VT;			// u - mxm matrix , vt - nxn  matrix  on the  host
-	float *S1;              //  vectors  of  singular  values
-	magma_int_t  info;
-	float  work[1];				// used in  difference  computations
-	float  *h_work;           //  h_work  - workspace
-	magma_int_t  lwork;                     //  workspace  size
-	real_Double_t gpu_time , cpu_time;
-	
-	FILE *fp;
-	char fname[200];
-	long ID_VTmatrix;
-	float egvlim;
-	long maxMode, MaxNBmodes1, mode;
 
-	
-    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
-
-    ID_Rmatrix = image_ID(ID_Rmatrix_name);
-    atype = data.image[ID_Rmatrix].md[0].atype;
-    
-    
-    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    if(timing==1)
     {
-        n = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
-        m = data.image[ID_Rmatrix].md[0].size[2];
-        printf("3D image -> %ld %ld\n", n, m);
-        fflush(stdout);
+        *status = *status + 1;  // ->7
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[IDtiming].array.F[*status] = tdiffv;
     }
-    else
-    {
-        n = data.image[ID_Rmatrix].md[0].size[0];
-        m = data.image[ID_Rmatrix].md[0].size[1];
-         printf("2D image -> %ld %ld\n", n, m);
-        fflush(stdout);
-   }
-
-	M = n;
-	N = m;
 
-	lda = M;
-	ldu = M;
-	ldv = N;
-	
-	min_mn=min(M,N);
-	
-	//printf("INITIALIZE MAGMA\n");
-	//fflush(stdout);
-	
-    /* in this procedure, m=number of actuators/modes, n=number of WFS elements */
- //   printf("magma :    M = %ld , N = %ld\n", (long) M, (long) N);
-    //fflush(stdout);
+    if(gpumatmultconf[index].CMhotswap == 0)
+    {
+        if(gpumatmultconf[index].CM_cnt != data.image[gpumatmultconf[index].CM_ID].md[0].cnt0)
+            if(data.image[gpumatmultconf[index].CM_ID].md[0].write == 0)
+            {
+                printf("New CM detected (cnt : %ld)\n", data.image[gpumatmultconf[index].CM_ID].md[0].cnt0);
+                GPUloadCmat(index);
+                gpumatmultconf[index].CM_cnt = data.image[gpumatmultconf[index].CM_ID].md[0].cnt0;
+            }
+    }
+    else if(gpumatmultconf[index].CMhotswap == 1)
+        GPU_loop_MultMat_CMswap(index);
 
 
 
-	magma_init (); // initialize Magma
-	//  Allocate  host  memory
-	magma_smalloc_cpu (&a, lda*N);                  // host  memory  for a
-	magma_smalloc_cpu (&VT, ldv*N);                 // host  memory  for vt
-	magma_smalloc_cpu (&U, M*M);                    // host  memory  for u
-	magma_smalloc_cpu (&S1, min_mn );               // host  memory  for s1
-	magma_smalloc_pinned (&h_R, lda*N);             // host  memory  for r
-	magma_int_t  nb = magma_get_sgesvd_nb(M,N);     // opt. block  size
-	lwork = (M+N)*nb + 3* min_mn;
-	magma_smalloc_pinned (&h_work, lwork);          // host  mem. for  h_work
+    // index is the matrix multiplication index (unique to each matrix multiplication stream operation)
+    // ptn is the thread number = GPU device number
 
 
+    //    if((gpumatmultconf[index].sem==0)||
 
 
 
-	
-	// write input h_R matrix
-	 if(atype==_DATATYPE_FLOAT)
-    {
-        for(k=0; k<m; k++)
-            for(ii=0; ii<n; ii++)
-                h_R[k*n+ii] =  data.image[ID_Rmatrix].array.F[k*n+ii];
-    }
-    else
+    if((gpumatmultconf[index].asyncmode == 0)&&(gpumatmultconf[index].gpuinit==0))
     {
-        for(k=0; k<m; k++)
-            for(ii=0; ii<n; ii++)
-                h_R[k*n+ii] = data.image[ID_Rmatrix].array.D[k*n+ii];
-    }
+        printf("GPU pthread create, index = %d    %d %d\n", index, gpumatmultconf[index].sem, gpumatmultconf[index].gpuinit);//TEST
+        fflush(stdout);
 
-	//printf("M = %ld   N = %ld\n", (long) M, (long) N);
-	//printf("=============== lwork = %ld\n", (long) lwork);
-	gpu_time = magma_wtime ();
-	magma_sgesvd( MagmaSomeVec, MagmaAllVec, M, N, h_R, lda, S1, U, ldu, VT, ldv, h_work, lwork, &info );
-	gpu_time = magma_wtime() - gpu_time;
-	if (info != 0) {
-                printf("magma_sgesvd returned error %d: %s.\n",
-                       (int) info, magma_strerror( info ));
+        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+        {
+            gpumatmultconf[index].thdata[ptn].thread_no = ptn;
+            gpumatmultconf[index].thdata[ptn].numl0 = ptn*ptn;
+            gpumatmultconf[index].thdata[ptn].cindex = index;
+            gpumatmultconf[index].thdata[ptn].status = GPUstatus;
+            gpumatmultconf[index].iret[ptn] = pthread_create( &gpumatmultconf[index].threadarray[ptn], NULL, compute_function, (void*) &gpumatmultconf[index].thdata[ptn]);
+            if(gpumatmultconf[index].iret[ptn])
+            {
+                fprintf(stderr,"Error - pthread_create() return code: %d\n", gpumatmultconf[index].iret[ptn]);
+                exit(EXIT_FAILURE);
             }
-            
-	//printf("sgesvd gpu time: %7.5f\n", gpu_time );   
-     
-     
-     // Write eigenvalues
-    sprintf(fname, "eigenv.dat.magma");
-    if((fp=fopen(fname, "w"))==NULL)
-      {
-        printf("ERROR: cannot create file \"%s\"\n", fname);
-        exit(0);
-      }
-    for(k=0; k<min_mn; k++)
-      fprintf(fp,"%5ld %20g %20g\n", k, S1[k], S1[k]/S1[0] );
-    fclose(fp);
-
- 
-    egvlim = SVDeps * S1[0];
-        
-	MaxNBmodes1 = MaxNBmodes;
-	if(MaxNBmodes1>M)
-		MaxNBmodes1 = M;
-	if(MaxNBmodes1>N)
-		MaxNBmodes1 = N;
-	mode = 0;
-	while( (mode<MaxNBmodes1) && (S1[mode]>egvlim) )
-		mode++;
-	MaxNBmodes1 = mode;
-	
-	//printf("Keeping %ld modes  (SVDeps = %g)\n", MaxNBmodes1, SVDeps);
-    // Write rotation matrix 
-    arraysizetmp[0] = m;
-    arraysizetmp[1] = m;
-    if(atype==_DATATYPE_FLOAT)
-    {
-        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
-        for(ii=0; ii<m; ii++) // modes
-            for(k=0; k<m; k++) // modes
-                data.image[ID_VTmatrix].array.F[k*m+ii] = (float) VT[k*m+ii];
+        }
+        gpumatmultconf[index].gpuinit = 1;
     }
-    else
+
+    if(timing == 1)
     {
-        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
-        for(ii=0; ii<m; ii++) // modes
-            for(k=0; k<m; k++) // modes
-                data.image[ID_VTmatrix].array.D[k*m+ii] = (double) VT[k*m+ii];
+        *status = *status + 1;  // -> 8
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[IDtiming].array.F[*status] = tdiffv;
     }
 
-     
-    if(data.image[ID_Rmatrix].md[0].naxis==3)
+
+    if(gpumatmultconf[index].zerocopy == 1)
+        GPU_loop_MultMat_zerocopy_run(index, GPUstatus);
+    else if(gpumatmultconf[index].asyncmode != 0)
+        GPU_loop_MultMat_async_run(index, alpha, beta, GPUstatus);
+    else if(gpumatmultconf[index].sem==0)
     {
-        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
-        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
-        arraysizetmp[2] = m;
+        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+            pthread_join( gpumatmultconf[index].threadarray[ptn], NULL);
     }
     else
     {
-        arraysizetmp[0] = n;
-        arraysizetmp[1] = m;
-    }
-    
-    if(atype==_DATATYPE_FLOAT)
-        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
-    else
-        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+        struct timespec tdeadline;
+        int r;
 
-   // compute pseudo-inverse
-   // M+ = V Sig^-1 UT
-   for(ii=0;ii<M;ii++)
-		for(jj=0;jj<N;jj++)
-			for(mode=0;mode<MaxNBmodes1-1;mode++)
-				{
-					data.image[ID_Cmatrix].array.F[jj*M+ii] += VT[jj*N+mode]*U[mode*M+ii]/S1[mode];
-				}
-   
-     
-            
-    magma_free_cpu(a);                                        // free  host  memory
-	magma_free_cpu(VT);                                       // free  host  memory
-	magma_free_cpu(S1);                                       // free  host  memory
-	magma_free_cpu(U);                                        // free  host  memory
-	magma_free_pinned(h_work );                  // free  host  memory
-	magma_free_pinned(h_R);                        // free  host  memory       
-            
-	magma_finalize ();                               //  finalize  Magma
+        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+        {
+            if(gpumatmultconf[index].devfailed[ptn] == 1)
+                continue;
+            sem_post(gpumatmultconf[index].semptr1[ptn]); // START COMPUTATION
+            sem_post(gpumatmultconf[index].semptr4[ptn]);
+        }
 
-	free(arraysizetmp);
+        if(gpumatmultconf[index].failover_timeout > 0)
+            GPU_loop_MultMat_failover_deadline(&tdeadline, gpumatmultconf[index].failover_timeout);
 
-//    printf("[CM magma SVD done]\n");
- //   fflush(stdout);
+        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+        {
+            if(gpumatmultconf[index].devfailed[ptn] == 1)
+                continue;
+            if(gpumatmultconf[index].failover_timeout == 0)
+                sem_wait(gpumatmultconf[index].semptr5[ptn]); // WAIT FOR RESULT
+            else
+            {
+                // watchdog: device result must arrive before deadline
+                while(((r = sem_timedwait(gpumatmultconf[index].semptr5[ptn], &tdeadline)) == -1)&&(errno == EINTR)) {}
+                if(r == -1)
+                    GPU_loop_MultMat_failover_trigger(index, ptn, "deadline missed");
+                else if(gpumatmultconf[index].deverror[ptn] == 1)
+                    GPU_loop_MultMat_failover_trigger(index, ptn, "CUDA error");
+            }
+        }
 
-    return(ID_Cmatrix);
-}
+        for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+            if(gpumatmultconf[index].devfailed[ptn] == 1)
+                GPU_loop_MultMat_failover_compute(index, ptn, alpha, beta);
 
+        // for safety, set semaphores to zerosem_getvalue(data.image[IDarray[i]].semptr[s], &semval);
+        if(FORCESEMINIT==1)
+            for(ptn=0; ptn<gpumatmultconf[index].NBstreams; ptn++)
+            {
+                sem_getvalue(gpumatmultconf[index].semptr5[ptn], &semval);
+                for(cnt=0; cnt<semval; cnt++)
+                    sem_trywait(gpumatmultconf[index].semptr5[ptn]);
+            }
 
+    }
 
 
+    // SUM RESULTS FROM SEPARATE GPUs
+    if(timing == 1)
+    {
+        *status = *status + 1;  // -> 9
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[IDtiming].array.F[*status] = tdiffv;
+    }
 
+    data.image[gpumatmultconf[index].IDout].md[0].write = 1;
 
+    if(gpumatmultconf[index].zerocopy == 1)
+        GPU_loop_MultMat_zerocopy_combine(index);
+    else
+    {
+        for(m=0; m<gpumatmultconf[index].M; m++)
+            gpumatmultconf[index].dmVecTMP[m] = 0.0;
 
+        // with peer-to-peer reduction, first device holds the complete result
+        int NBpart = ((gpumatmultconf[index].p2preduce == 1)&&(gpumatmultconf[index].asyncmode != 0)) ? 1 : gpumatmultconf[index].NBstreams;
 
+        for(ptn=0; ptn<NBpart; ptn++)
+        {
+            // failed device: result computed on CPU (GPU may still write dmVec_part)
+            float *dmVec_part = (gpumatmultconf[index].devfailed[ptn] == 1) ? gpumatmultconf[index].cpu_dmVec_part[ptn] : gpumatmultconf[index].dmVec_part[ptn];
 
+            for(m=0; m<gpumatmultconf[index].M; m++)
+                gpumatmultconf[index].dmVecTMP[m] += dmVec_part[m];
+        }
+    }
 
+    COREMOD_MEMORY_image_set_sempost_byID(gpumatmultconf[index].IDout, -1);
 
 
-/** 
- *  @brief Computes matrix pseudo-inverse (AT A)^-1 AT, using eigenvector/eigenvalue decomposition of AT A
- * 
- * 
- * Computes pseuso inverse of M x N matrix
- * 
- * When used with AOloopControl module:
- *    N: number of actuators 
- *    M: number of sensors 
- * 	assumes M>N
- * 
- * 
- *  use LOOPmode = 1 for computing the same size SVD, same input and output location
- * 
- * Notations: 
- * 	AT is transpose of A 
- * 	A+ is pseudo inverse of A
- * 
- *  Computes pseudo-inverse : A+ = (AT A)^-1 AT
- *  Inverse of AT A is computed by SVD
- * 
- * SVD:   A = U S V^T
- *   U are eigenvectors of A A^T
- *   V are eigenvectors of A^T A, computed at step 4 below
- * 
- * Linear algebra reminder: equivalence between (AT A)^-1 AT and V S^-1 UT
- * 
- * Definition of pseudoinverse:
- * A+ = (AT A)^-1 AT   
- * singular value decomposition of A = U S VT 
- * A+ = ( V S UT U S VT )^-1 V S UT
- * Since U is unitary, UT U = Id ->
- * A+ = ( V S^2 VT )^-1 V S UT
- * A+ = VT^-1 S^-2 V^-1 V S UT
- * A+ = V S^-1 UT
- * 
- *  Main steps:
- * 
- *  STEP 1 :   Fill input data into magmaf_h_A on host   
- * 
- *  STEP 2 :   Copy input data to GPU                                 -> magmaf_d_A        (MxN matrix on device) 
- * 
- *  STEP 3 :   Compute  trans(A) x A   : magmaf_d_A x magmaf_d_A      -> magmaf_d_AtA      (NxN matrix on device)
- * 
- *  STEP 4 :   Compute eigenvalues and eigenvectors of A^T A          -> magmaf_d_AtA      (NxN matrix on device)
- *     Calls magma_ssyevd_gpu :
- *     Compute the eigenvalues and optionally eigenvectors of a symmetric real matrix in single precision, GPU interface, big matrix.
- *     This function computes in single precision all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A defined on the device.  
- *     The  first parameter can take the values MagmaVec,'V' or MagmaNoVec,'N' and answers the question whether the eigenvectors are desired.  
- *     If the eigenvectors are desired, it uses a divide and conquer algorithm.  The symmetric matrix A can be stored in lower (MagmaLower,'L') 
- *     or upper  (MagmaUpper,'U') mode. If the eigenvectors are desired, then on exit A contains orthonormal eigenvectors.  
- *     The eigenvalues are stored in an array w
- * 
- *  STEP 5 :   Set eigenvalue limit
- * 
- *  STEP 6 :   Write eigenvectors to V^T matrix
- * 
- *  STEP 7 :   Write eigenvectors/eigenvalue to magma_h_VT1 if eigenvalue > limit
- *           Copy to magma_d_VT1
- * 
- *  STEP 8 :   Compute M2 = VT1 VT. M2 is (AT A)^-1
- * 
- *  STEP 9 :   Compute Ainv = M2 A. This is the pseudo inverse
- * 
- * @note SVDeps^2 is applied as a limit to the eigenvectors of AT A, which are equal to the squares of the singular values of A, so this is equivalent to applying SVDeps as a limit on the singular values of A
- * @note When used to compute AO control matrix, N=number of actuators/modes, M=number of WFS elements
- * @note EIGENVALUES are good to about 1e-6 of peak eigenvalue in single precision, much better with double precision
- * @note 2.5x faster in single precision
- */
-
+    /*  if(data.image[gpumatmultconf[index].IDout].md[0].sem > 0)
+       {
+           sem_getvalue(data.image[gpumatmultconf[index].IDout].semptr[0], &semval);
+           if(semval<SEMAPHORE_MAXVAL)
+               sem_post(data.image[gpumatmultconf[index].IDout].semptr[0]);
+       }
 
-int CUDACOMP_magma_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name, int LOOPmode) 
-{
-    long ID_Rmatrix;
-    uint8_t atype;
-    uint32_t *arraysizetmp;
-    int size; // variable for memory allocations
-    long N, M;
-    long ii, jj, k;
-    magma_int_t info;
 
+       if(data.image[gpumatmultconf[index].IDout].md[0].sem > 1)
+           {
+               sem_getvalue(data.image[gpumatmultconf[index].IDout].semptr[1], &semval);
+               if(semval<SEMAPHORE_MAXVAL)
+                   sem_post(data.image[gpumatmultconf[index].IDout].semptr[1]);
+           }
+    */
 
-    long ID_AtA, ID_VT, ID_Ainv;
 
-    /// Timing tests
-   // int timing = 1;                                                        /**< 1 if timing test ON, 0 otherwise */
-    struct timespec t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;                /**< Timers                           */
-    double t01d, t12d, t23d, t34d, t45d, t56d, t67d, t78d, t89d, t09d;     /**< Times in sec                     */
-    struct timespec tdiff;
+    data.image[gpumatmultconf[index].IDout].md[0].write = 0;
+    data.image[gpumatmultconf[index].IDout].md[0].cnt0++;
 
+    if(timing == 1)
+    {
+        *status = *status + 1; // -> 10
+        clock_gettime(CLOCK_REALTIME, &tnow);
+        tdiff = info_time_diff(data.image[IDtiming].md[0].atime.ts, tnow);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+        data.image[IDtiming].array.F[*status] = tdiffv;
+    }
 
-    FILE *fp;
-    char fname[200];
+    return(0);
+}
 
-    long maxMode, MaxNBmodes1, mode;
-    double egvlim;
-    long nbmodesremoved;
 
-    long ID_Cmatrix;
 
-	// TESTING FLAGS
-	int VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse = 0;
-    int testmode = 0;
 
 
-    int MAGMAfloat = 1;		                                               /**< 1 if single precision, 0 if double precision */
 
 
-	int magmaXmode = 0; // expert mode, uses magma_ssyevdx_gpu
-	// this does not speed up computation
-	magma_int_t mout;
 
 
 
+/**
+ * @brief Background control matrix upload (hot swap)
+ *
+ * Polls control matrix stream. A new matrix is transposed into (pinned) host buffers and uploaded to the standby
+ * device buffers on a separate CUDA stream per device, while computation continues on the active buffers.
+ * Upload is restarted if the matrix is modified during the host copy.
+ */
+static void *GPU_loop_MultMat_CMupload_thread(void *ptr)
+{
+    int index = *((int*) ptr);
+    int device;
+    long n, m;
+    long cnt;
+    long IDcm;
+    cublasStatus_t ustat;
 
-  //  if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t0);
+    IDcm = gpumatmultconf[index].CM_ID;
 
+    while(gpumatmultconf[index].CMhotswap != 0)
+    {
+        if((gpumatmultconf[index].CMupload_status != 0)||(data.image[IDcm].md[0].cnt0 == gpumatmultconf[index].CM_cnt)||(data.image[IDcm].md[0].write == 1))
+        {
+            usleep(1000);
+            continue;
+        }
 
-	/**
-	 * 
-	 * The input matrix can be a 2D or a 3D image
-	 * 
-	 * If 2D image :
-	 *   M = xsize
-	 *   N = ysize
-	 * 
-	 * If 3D image :
-	 *   M = xsize*ysize
-	 *   N = ysize
-	 * 
-	 * Note that a tall input matrix (M>N) will appear short if viewed as an image.
-	 * There is a 90 deg rotation between image and matrix
-	 * 
-	 */
+        cnt = data.image[IDcm].md[0].cnt0;
+        gpumatmultconf[index].CMupload_status = 1;
 
+        for(device = 0; device < gpumatmultconf[index].NBstreams; device++)
+            for (n=gpumatmultconf[index].Noffset[device]; n<gpumatmultconf[index].Noffset[device]+gpumatmultconf[index].Nsize[device]; n++)
+            {
+                if(gpumatmultconf[index].orientation==0)
+                {
+                    for (m=0; m<gpumatmultconf[index].M; m++)
+                        gpumatmultconf[index].cMat_part[device][(n-gpumatmultconf[index].Noffset[device])*gpumatmultconf[index].M+m] = gpumatmultconf[index].cMat[m*gpumatmultconf[index].N+n];
+                }
+                else
+                {
+                    for (m=0; m<gpumatmultconf[index].M; m++)
+                        gpumatmultconf[index].cMat_part[device][(n-gpumatmultconf[index].Noffset[device])*gpumatmultconf[index].M+m] = gpumatmultconf[index].cMat[n*gpumatmultconf[index].M+m];
+                }
+            }
 
+        if((data.image[IDcm].md[0].write == 1)||(data.image[IDcm].md[0].cnt0 != cnt))
+        {
+            gpumatmultconf[index].CMupload_status = 0; // matrix changed during copy: retry
+            continue;
+        }
 
-	///
-	/// MAGMA uses column-major matrices. For matrix A with dimension (M,N), element A(i,j) is A[ j*M + i]
-	/// i = 0 ... M
-	/// j = 0 ... N
-	///
-	
-	
-    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+        {
+            if(gpumatmultconf[index].devfailed[device] == 1)
+                continue;
+            cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+            ustat = cublasSetMatrixAsync(gpumatmultconf[index].M, gpumatmultconf[index].Nsize[device], sizeof(float), gpumatmultconf[index].cMat_part[device], gpumatmultconf[index].M, gpumatmultconf[index].d_cMat_standby[device], gpumatmultconf[index].M, gpumatmultconf[index].stream_upload[device]);
+            if (ustat != CUBLAS_STATUS_SUCCESS)
+            {
+                printf("cublasSetMatrixAsync returned error code %d, line(%d)\n", ustat, __LINE__);
+                exit(EXIT_FAILURE);
+            }
+        }
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+        {
+            if(gpumatmultconf[index].devfailed[device] == 1)
+                continue;
+            cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+            cudaStreamSynchronize(gpumatmultconf[index].stream_upload[device]);
+        }
 
-    ID_Rmatrix = image_ID(ID_Rmatrix_name);
-    atype = data.image[ID_Rmatrix].md[0].atype;
+        printf("New CM uploaded to standby buffer (index %d, cnt : %ld)\n", index, cnt);
+        fflush(stdout);
 
-    if(data.image[ID_Rmatrix].md[0].naxis==3)
-    {
-        /// each column (N=cst) of A is a z=cst slice of image Rmatrix
-        M = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
-        
-        N = data.image[ID_Rmatrix].md[0].size[2];
-        
-        if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-        {
-			printf("3D image -> %ld %ld\n", M, N);
-			fflush(stdout);
-		}
+        gpumatmultconf[index].CMupload_cnt = cnt;
+        __sync_synchronize();
+        gpumatmultconf[index].CMupload_status = 2;
     }
-    else
-    {
-		/// each column (N=cst) of A is a line (y=cst) of Rmatrix (90 deg rotation)
-        M = data.image[ID_Rmatrix].md[0].size[0];
 
-        N = data.image[ID_Rmatrix].md[0].size[1];
+    pthread_exit(0);
+}
 
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("2D image -> %ld %ld\n", M, N);
-			fflush(stdout);
-		}
+
+
+static int GPU_loop_MultMat_CMhotswap_free(int index)
+{
+    int device;
+
+    if(gpumatmultconf[index].CMhotswap == 0)
+        return(0);
+
+    gpumatmultconf[index].CMhotswap = 0;
+    pthread_join(gpumatmultconf[index].CMuploadthread, NULL);
+
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+    {
+        cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+        cudaFree(gpumatmultconf[index].d_cMat_standby[device]);
+        cudaStreamDestroy(gpumatmultconf[index].stream_upload[device]);
+        cudaHostUnregister(gpumatmultconf[index].cMat_part[device]);
     }
+    free(gpumatmultconf[index].d_cMat_standby);
+    free(gpumatmultconf[index].stream_upload);
 
+    return(0);
+}
 
 
 
+int GPU_loop_MultMat_CMhotswap(int index, int mode)
+{
+    static int CMupload_index[20];
+    int device;
 
+    if(gpumatmultconf[index].init == 0)
+        return(-1);
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("magma :    M = %ld , N = %ld\n", (long) M, (long) N);
-		fflush(stdout);
-	}
+    if(mode == gpumatmultconf[index].CMhotswap)
+        return(0);
 
+    if(mode == 0)
+        return(GPU_loop_MultMat_CMhotswap_free(index));
 
-	/// Initialize MAGMA if needed
-    if(INIT_MAGMA==0)
+    if(gpumatmultconf[index].CMhotswap == 0)
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("INITIALIZE MAGMA\n");
-			fflush(stdout);
+        printf("CM hot swap: allocating standby buffers (index %d)\n", index);
+        fflush(stdout);
+
+        gpumatmultconf[index].d_cMat_standby = (float **) malloc(sizeof(float*)*gpumatmultconf[index].NBstreams);
+        gpumatmultconf[index].stream_upload = (cudaStream_t*) malloc(sizeof(cudaStream_t)*gpumatmultconf[index].NBstreams);
+
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
+        {
+            cudaSetDevice(gpumatmultconf[index].GPUdevice[device]);
+            error = cudaMalloc((void **) &gpumatmultconf[index].d_cMat_standby[device], sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nalloc[device]);
+            if (error != cudaSuccess)
+            {
+                printf("cudaMalloc d_cMat_standby returned error code %d, line(%d)\n", error, __LINE__);
+                exit(EXIT_FAILURE);
+            }
+            cudaStreamCreateWithFlags(&gpumatmultconf[index].stream_upload[device], cudaStreamNonBlocking);
+            // pinned host buffer required for asynchronous transfer
+            cudaHostRegister(gpumatmultconf[index].cMat_part[device], sizeof(float)*gpumatmultconf[index].M*gpumatmultconf[index].Nalloc[device], cudaHostRegisterPortable);
         }
-        magma_init();
-        magma_print_environment();
 
-        INIT_MAGMA = 1;
+        gpumatmultconf[index].CMupload_status = 0;
+        gpumatmultconf[index].CMswapcnt = 0;
+        gpumatmultconf[index].CMhotswap = mode;
+
+        CMupload_index[index] = index;
+        if(pthread_create(&gpumatmultconf[index].CMuploadthread, NULL, GPU_loop_MultMat_CMupload_thread, (void*) &CMupload_index[index]))
+        {
+            fprintf(stderr,"Error - pthread_create() failed for CM upload thread\n");
+            exit(EXIT_FAILURE);
+        }
     }
+    else
+        gpumatmultconf[index].CMhotswap = mode;
 
+    return(0);
+}
 
 
 
+long GPU_loop_MultMat_CMswap(int index)
+{
+    int device;
+    float *ptmp;
+
+    if((gpumatmultconf[index].CMhotswap == 0)||(gpumatmultconf[index].CMupload_status != 2))
+        return(-1);
 
-    if(MAGMAloop_iter == 0) /// memory is only allocated on first pass
+    // compute threads are idle between frames: pointer exchange is picked up by next cublasSgemv
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
     {
-        if(MAGMAfloat==0)
-        {
-            TESTING_MALLOC_CPU( magma_h_A, double, M*N);
-            TESTING_MALLOC_DEV( magma_d_A, double, M*N);
-
-            TESTING_MALLOC_CPU( magma_h_AtA, double, N*N);
-            TESTING_MALLOC_DEV( magma_d_AtA, double, N*N);
-
-            TESTING_MALLOC_CPU( magma_h_VT1, double, N*N);
-            TESTING_MALLOC_DEV( magma_d_VT1, double, N*N);
-            TESTING_MALLOC_DEV( magma_d_M2, double, N*N);
-        }
-        else
-        {
-            TESTING_MALLOC_CPU( magmaf_h_A, float, M*N);
-            TESTING_MALLOC_DEV( magmaf_d_A, float, M*N);
-
-            TESTING_MALLOC_CPU( magmaf_h_AtA, float, N*N);
-            TESTING_MALLOC_DEV( magmaf_d_AtA, float, N*N);
-
-            TESTING_MALLOC_CPU( magmaf_h_VT1, float, N*N);
-            TESTING_MALLOC_DEV( magmaf_d_VT1, float, N*N);
-            TESTING_MALLOC_DEV( magmaf_d_M2, float, N*N);
-        }
+        ptmp = gpumatmultconf[index].d_cMat[device];
+        gpumatmultconf[index].d_cMat[device] = gpumatmultconf[index].d_cMat_standby[device];
+        gpumatmultconf[index].d_cMat_standby[device] = ptmp;
     }
+    gpumatmultconf[index].CM_cnt = gpumatmultconf[index].CMupload_cnt;
+    gpumatmultconf[index].CMswapcnt++;
 
+    __sync_synchronize();
+    gpumatmultconf[index].CMupload_status = 0;
 
+    return(gpumatmultconf[index].CM_cnt);
+}
 
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("MAGMA READY\n");
-		fflush(stdout);
-	}
 
 
-   // if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t1);
 
+int GPU_loop_MultMat_free(int index)
+{
+    int device;
 
-	// ****************************************************
-	// STEP 1 :   Fill input data into magmaf_h_A on host   
-	// ****************************************************
-	
-    if(atype==_DATATYPE_FLOAT)
-    {
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<M*N; ii++)
-                magmaf_h_A[ii] =  data.image[ID_Rmatrix].array.F[ii];
-        }
-        else
-        {
-            for(ii=0; ii<M*N; ii++)
-                magma_h_A[ii] =  data.image[ID_Rmatrix].array.F[ii];
-        }
-    }
-    else
+    // stop semaphore-driven compute threads (sem==0 threads are joined at each execute)
+    if((gpumatmultconf[index].asyncmode == 0)&&(gpumatmultconf[index].sem == 1)&&(gpumatmultconf[index].gpuinit == 1))
     {
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<M*N; ii++)
-                magmaf_h_A[ii] = data.image[ID_Rmatrix].array.D[ii];
-        }
-        else
+        for(device=0; device<gpumatmultconf[index].NBstreams; device++)
         {
-            for(ii=0; ii<M*N; ii++)
-                magma_h_A[ii] = data.image[ID_Rmatrix].array.D[ii];
+            pthread_cancel(gpumatmultconf[index].threadarray[device]);
+            pthread_join(gpumatmultconf[index].threadarray[device], NULL);
         }
     }
+    gpumatmultconf[index].gpuinit = 0;
 
-    if(testmode==1)
+    GPU_loop_MultMat_CMhotswap_free(index);
+    GPU_loop_MultMat_zerocopy_free(index);
+    GPU_loop_MultMat_async_free(index);
+
+    cudaFree(gpumatmultconf[index].d_cMat);
+    cudaFree(gpumatmultconf[index].d_dmVec);
+    cudaFree(gpumatmultconf[index].d_wfsVec);
+    cudaFree(gpumatmultconf[index].d_wfsRef);
+    cudaFree(gpumatmultconf[index].d_dmRef);
+    free(gpumatmultconf[index].stream);
+
+    for(device=0; device<gpumatmultconf[index].NBstreams; device++)
     {
-		long ID_A;
-		
-        ID_A = create_2Dimage_ID("mA", M, N);
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_A].array.F[ii] = magmaf_h_A[ii];
-        }
-        else
-        {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_A].array.F[ii] = magma_h_A[ii];
-        }
-        
-        save_fits("mA", "!test_mA.fits");
-        delete_image_ID("mA");
+        // free memory for stream
+        cublasDestroy(gpumatmultconf[index].handle[device]);
+        free(gpumatmultconf[index].cMat_part[device]);
+        free(gpumatmultconf[index].cpu_dmVec_part[device]);
+        free(gpumatmultconf[index].wfsVec_part[device]);
+        free(gpumatmultconf[index].dmVec_part[device]);
     }
 
+    free(gpumatmultconf[index].cMat_part);
+    free(gpumatmultconf[index].cpu_dmVec_part);
+    free(gpumatmultconf[index].devfailed);
+    free(gpumatmultconf[index].deverror);
+    free(gpumatmultconf[index].dmVec_part);
+    free(gpumatmultconf[index].wfsVec_part);
 
+    free(gpumatmultconf[index].Nsize);
+    free(gpumatmultconf[index].Noffset);
+    free(gpumatmultconf[index].Nalloc);
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("MAGMA: CREATE QUEUE\n");
-		fflush(stdout);
-	}
-	
-
+    free(gpumatmultconf[index].iret);
+    free(gpumatmultconf[index].threadarray);
+    free(gpumatmultconf[index].thdata);
 
+    free(gpumatmultconf[index].refWFSinit);
 
+    free(gpumatmultconf[index].GPUdevice);
 
-	// ****************************************************
-	// STEP 2 :   Copy input data from CPU to GPU   
-	// ****************************************************
-	
-    if(MAGMAloop_iter == 0)
-        magma_queue_create(0, &magmaqueue);
-	
-    if(MAGMAfloat==1)
-        magma_ssetmatrix( M, N, magmaf_h_A, M, magmaf_d_A, M, magmaqueue);
-    else
-        magma_dsetmatrix( M, N, magma_h_A, M, magma_d_A, M, magmaqueue);
+    gpumatmultconf[index].alloc = 0;
+    gpumatmultconf[index].init = 0;
 
+    return(0);
+}
 
-    if(LOOPmode==0) /// if pseudo-inverse is only computed once, these arrays can be freed
-    {
-        if(MAGMAfloat==1)
-            TESTING_FREE_CPU( magmaf_h_A );
-        else
-            TESTING_FREE_CPU( magma_h_A );
-    }
 
-    //if(timing==1)
-        
-    clock_gettime(CLOCK_REALTIME, &t2);
 
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("MAGMA: COMPUTE trans(A) x A\n");
-		fflush(stdout);
-    }
-    
-    
-	// ****************************************************    
-    // STEP 3 :   Compute trans(A) x A    : magmaf_d_A x magmaf_d_A      -> magmaf_d_AtA      (NxN matrix on device)
-	// ****************************************************
-	
-	    
-    if(MAGMAfloat==1)
-        magma_sgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magmaf_d_A, M, magmaf_d_A, M, 0.0,  magmaf_d_AtA, N, magmaqueue);
-    else
-        magma_dgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magma_d_A, M, magma_d_A, M, 0.0,  magma_d_AtA, N, magmaqueue);
 
 
 
-    if(testmode == 1)
-    {
-        if(MAGMAfloat==1)
-            magma_sgetmatrix( N, N, magmaf_d_AtA, N, magmaf_h_AtA, N, magmaqueue);
-        else
-            magma_dgetmatrix( N, N, magma_d_AtA, N, magma_h_AtA, N, magmaqueue);
 
+#ifdef HAVE_MAGMA
 
-        ID_AtA = create_2Dimage_ID("mAtA", N, N);
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<N*N; ii++)
-                data.image[ID_AtA].array.F[ii] = magmaf_h_AtA[ii];
-        }
-        else
-        {
-            for(ii=0; ii<N*N; ii++)
-                data.image[ID_AtA].array.F[ii] = magma_h_AtA[ii];
-        }
-        save_fits("mAtA", "!test_mAtA.fits");
-    }
 
 
 
-    //if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t3);
 
 
-	// ****************************************************    
-	// STEP 4 :   Compute eigenvalues and eigenvectors of AT A   -> magmaf_d_AtA      (NxN matrix on device)
-	//
-	// SVD of AT A = V S^2 VT
-	// calls function magma_ssyevd_gpu
-	// 
-	//
-	// ****************************************************    
+/******************* CPU memory */
+#define TESTING_MALLOC_CPU( ptr, type, size )                              \
+    if ( MAGMA_SUCCESS !=                                                  \
+            magma_malloc_cpu( (void**) &ptr, (size)*sizeof(type) )) {      \
+        fprintf( stderr, "!!!! magma_malloc_cpu failed for: %s\n", #ptr ); \
+        magma_finalize();                                                  \
+        exit(-1);                                                          \
+    }
 
+#define TESTING_FREE_CPU( ptr ) magma_free_cpu( ptr )
 
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("COMPUTE eigenvalues and eigenvectors of AT A\n");
-		fflush(stdout);
-	}
-	
-    if(MAGMAloop_iter==0)
-    {	
-        // get workspace size
-        if(MAGMAfloat==1)
-        {
-			float auxf_work[1];
-			
-			if(magmaXmode==1)
-				magma_ssyevdx_gpu( MagmaVec, MagmaRangeI, MagmaLower, N, NULL, N, 0.0, 1.0, N-MaxNBmodes, N, NULL, NULL, NULL, N, auxf_work, -1, magma_aux_iwork, -1, &info );
-			else
-				magma_ssyevd_gpu(  MagmaVec,              MagmaLower, N, NULL, N,                       NULL, NULL, N, auxf_work, -1, magma_aux_iwork, -1, &info );
-            
-            magma_lwork  = (magma_int_t) MAGMA_S_REAL( auxf_work[0] );
+/******************* Pinned CPU memory */
+#ifdef HAVE_CUBLAS
+    // In CUDA, this allocates pinned memory.
+    #define TESTING_MALLOC_PIN( ptr, type, size )                                 \
+        if ( MAGMA_SUCCESS !=                                                     \
+                magma_malloc_pinned( (void**) &ptr, (size)*sizeof(type) )) {      \
+            fprintf( stderr, "!!!! magma_malloc_pinned failed for: %s\n", #ptr ); \
+            magma_finalize();                                                     \
+            exit(-1);                                                             \
         }
-        else
-        {
-			double aux_work[1];
     
-            magma_dsyevd_gpu( MagmaVec, MagmaLower, N, NULL, N, NULL, NULL, N, aux_work,  -1, magma_aux_iwork, -1, &info );
-            magma_lwork  = (magma_int_t) MAGMA_S_REAL( aux_work[0] );
+    #define TESTING_FREE_PIN( ptr ) magma_free_pinned( ptr )
+#else
+    // For OpenCL, we don't support pinned memory yet.
+    #define TESTING_MALLOC_PIN( ptr, type, size )                              \
+        if ( MAGMA_SUCCESS !=                                                  \
+                magma_malloc_cpu( (void**) &ptr, (size)*sizeof(type) )) {      \
+            fprintf( stderr, "!!!! magma_malloc_cpu failed for: %s\n", #ptr ); \
+            magma_finalize();                                                  \
+            exit(-1);                                                          \
         }
+    
+    #define TESTING_FREE_PIN( ptr ) magma_free_cpu( ptr )
+#endif
 
-        magma_liwork = magma_aux_iwork[0];
-    }
 
+/******************* GPU memory */
+#ifdef HAVE_CUBLAS
+    // In CUDA, this has (void**) cast.
+    #define TESTING_MALLOC_DEV( ptr, type, size )                              \
+        if ( MAGMA_SUCCESS !=                                                  \
+                magma_malloc( (void**) &ptr, (size)*sizeof(type) )) {          \
+            fprintf( stderr, "!!!! magma_malloc failed for: %s\n", #ptr );     \
+            magma_finalize();                                                  \
+            exit(-1);                                                          \
+        }
+#else
+    // For OpenCL, ptr is cl_mem* and there is no cast.
+    #define TESTING_MALLOC_DEV( ptr, type, size )                              \
+        if ( MAGMA_SUCCESS !=                                                  \
+                magma_malloc( &ptr, (size)*sizeof(type) )) {                   \
+            fprintf( stderr, "!!!! magma_malloc failed for: %s\n", #ptr );     \
+            magma_finalize();                                                  \
+            exit(-1);                                                          \
+        }
+#endif
 
+#define TESTING_FREE_DEV( ptr ) magma_free( ptr )
 
-    //if(timing==1)
+
+
+
+
+
+
+
+
+/* =============================================================================================== */
+/* =============================================================================================== */
+/*                                                                                                 */
+/* 3. SINGULAR VALUE DECOMPOSITION, PSEUDO-INVERSE                                                 */
+/*                                                                                                 */
+/* =============================================================================================== */
+/* =============================================================================================== */
+
+
+
+/** @brief Test pseudo inverse
+ * 
+ */
+ 
+long CUDACOMP_MatMatMult_testPseudoInverse(const char *IDmatA_name, const char *IDmatAinv_name, const char *IDmatOut_name)
+{
+	long IDmatA, IDmatAinv;
+	long IDmatOut;
+	
+	long ii;
+	float *magmaf_d_AinvA;
+	float *magmaf_h_AinvA;
+
+	uint32_t *arraysizetmp;
+	magma_int_t M, N;
+	
+
+	/**
+	 * 
+	 * IDmatA is an image loaded as a M x N matrix
+	 * IDmatAinv is an image loaded as a M x M matrix, representing the transpose of the pseudo inverse of IDmatA
+	 * 
+	 * The input matrices can be 2D or a 3D images
+	 * 
+	 * If 2D image :
+	 *   IDmatA    M = xsize
+	 *   IDmatA    N = ysize
+	 * 
+	 * If 3D image :
+	 *   IDmatA M = xsize*ysize
+	 *   IDmatA N = ysize
+	 * 
+	 * 
+	 */
+
+	///
+	/// MAGMA uses column-major matrices. For matrix A with dimension (M,N), element A(i,j) is A[ j*M + i]
+	/// i = 0 ... M
+	/// j = 0 ... N
+	///
+	
+	
+	arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    IDmatA = image_ID(IDmatA_name);
+    IDmatAinv = image_ID(IDmatAinv_name);
+
+    if(data.image[IDmatA].md[0].naxis==3)
+    {
+		/// each column (N=cst) of A is a z=cst slice of image Rmatrix
+        M = data.image[IDmatA].md[0].size[0]*data.image[IDmatA].md[0].size[1];
+        N = data.image[IDmatA].md[0].size[2];
+    }
+    else
+    {
+		/// each column (N=cst) of A is a line (y=cst) of Rmatrix (90 deg rotation)
+        M = data.image[IDmatA].md[0].size[0];
+        N = data.image[IDmatA].md[0].size[1];
+    }
+
+
+	/// Initialize MAGAM if needed
+    if(INIT_MAGMA==0)
+    {
+        magma_init();
+        magma_print_environment();
+
+        INIT_MAGMA = 1;
+    }
+	magma_queue_create(0, &magmaqueue);
+
+    TESTING_MALLOC_CPU( magmaf_h_A, float, M*N);
+    TESTING_MALLOC_DEV( magmaf_d_A, float, M*N);
+
+    TESTING_MALLOC_CPU( magmaf_h_Ainv, float, M*N);
+    TESTING_MALLOC_DEV( magmaf_d_Ainv, float, M*N);
+
+    TESTING_MALLOC_CPU( magmaf_h_AinvA, float, N*N);
+    TESTING_MALLOC_DEV( magmaf_d_AinvA, float, N*N);
+
+
+	/// load matA in h_A -> d_A
+    for(ii=0; ii<M*N; ii++)
+        magmaf_h_A[ii] =  data.image[IDmatA].array.F[ii];	
+    magma_ssetmatrix( M, N, magmaf_h_A, M, magmaf_d_A, M, magmaqueue);
+
+	/// load matAinv in h_Ainv -> d_Ainv
+    for(ii=0; ii<M*N; ii++)
+        magmaf_h_Ainv[ii] =  data.image[IDmatAinv].array.F[ii];	
+    magma_ssetmatrix( M, N, magmaf_h_Ainv, M, magmaf_d_Ainv, M, magmaqueue);
+
+
+	magma_sgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magmaf_d_Ainv, M, magmaf_d_A, M, 0.0,  magmaf_d_AinvA, N, magmaqueue);
+
+	magma_sgetmatrix( N, N, magmaf_d_AinvA, N, magmaf_h_AinvA, N, magmaqueue);
+
+	
+	arraysizetmp[0] = N;
+	arraysizetmp[1] = N;
+	IDmatOut = create_image_ID(IDmatOut_name, 2, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+       
+
+    for(ii=0; ii<N*N; ii++)
+         data.image[IDmatOut].array.F[ii] = magmaf_h_AinvA[ii];
+
+
+
+    TESTING_FREE_CPU( magmaf_h_AinvA );
+    TESTING_FREE_DEV( magmaf_d_AinvA );
+
+    TESTING_FREE_DEV( magmaf_d_A );
+    TESTING_FREE_CPU( magmaf_h_A );
+
+    TESTING_FREE_DEV( magmaf_d_Ainv );
+    TESTING_FREE_CPU( magmaf_h_Ainv );
+
+
+	free(arraysizetmp);
+	
+    magma_queue_destroy( magmaqueue );
+    magma_finalize ();                               //  finalize  Magma
+
+
+
+	return IDmatOut;
+}
+
+
+
+
+
+//
+// Computes control matrix
+// Conventions:
+//   m: number of actuators 
+//   n: number of sensors  
+int CUDACOMP_magma_compute_SVDpseudoInverse_SVD(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name) 
+{
+	uint32_t *arraysizetmp;
+	magma_int_t M, N, min_mn;
+	long m, n, ii, jj, k;
+	long ID_Rmatrix;
+	long ID_Cmatrix;
+	uint8_t atype;
+	
+	magma_int_t lda, ldu, ldv;
+	float dummy[1];
+	float *a, *h_R;         // a, h_R - mxn  matrices
+	float *U, *VT;			// u - mxm matrix , vt - nxn  matrix  on the  host
+	float *S1;              //  vectors  of  singular  values
+	magma_int_t  info;
+	float  work[1];				// used in  difference  computations
+	float  *h_work;           //  h_work  - workspace
+	magma_int_t  lwork;                     //  workspace  size
+	real_Double_t gpu_time , cpu_time;
+	
+	FILE *fp;
+	char fname[200];
+	long ID_VTmatrix;
+	float egvlim;
+	long maxMode, MaxNBmodes1, mode;
+
+	
+    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    atype = data.image[ID_Rmatrix].md[0].atype;
+    
+    
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        n = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        m = data.image[ID_Rmatrix].md[0].size[2];
+        printf("3D image -> %ld %ld\n", n, m);
+        fflush(stdout);
+    }
+    else
+    {
+        n = data.image[ID_Rmatrix].md[0].size[0];
+        m = data.image[ID_Rmatrix].md[0].size[1];
+         printf("2D image -> %ld %ld\n", n, m);
+        fflush(stdout);
+   }
+
+	M = n;
+	N = m;
+
+	lda = M;
+	ldu = M;
+	ldv = N;
+	
+	min_mn=min(M,N);
+	
+	//printf("INITIALIZE MAGMA\n");
+	//fflush(stdout);
+	
+    /* in this procedure, m=number of actuators/modes, n=number of WFS elements */
+ //   printf("magma :    M = %ld , N = %ld\n", (long) M, (long) N);
+    //fflush(stdout);
+
+
+
+	magma_init (); // initialize Magma
+	//  Allocate  host  memory
+	magma_smalloc_cpu (&a, lda*N);                  // host  memory  for a
+	magma_smalloc_cpu (&VT, ldv*N);                 // host  memory  for vt
+	magma_smalloc_cpu (&U, M*M);                    // host  memory  for u
+	magma_smalloc_cpu (&S1, min_mn );               // host  memory  for s1
+	magma_smalloc_pinned (&h_R, lda*N);             // host  memory  for r
+	magma_int_t  nb = magma_get_sgesvd_nb(M,N);     // opt. block  size
+	lwork = (M+N)*nb + 3* min_mn;
+	magma_smalloc_pinned (&h_work, lwork);          // host  mem. for  h_work
+
+
+
+
+
+	
+	// write input h_R matrix
+	 if(atype==_DATATYPE_FLOAT)
+    {
+        for(k=0; k<m; k++)
+            for(ii=0; ii<n; ii++)
+                h_R[k*n+ii] =  data.image[ID_Rmatrix].array.F[k*n+ii];
+    }
+    else
+    {
+        for(k=0; k<m; k++)
+            for(ii=0; ii<n; ii++)
+                h_R[k*n+ii] = data.image[ID_Rmatrix].array.D[k*n+ii];
+    }
+
+	//printf("M = %ld   N = %ld\n", (long) M, (long) N);
+	//printf("=============== lwork = %ld\n", (long) lwork);
+	gpu_time = magma_wtime ();
+	magma_sgesvd( MagmaSomeVec, MagmaAllVec, M, N, h_R, lda, S1, U, ldu, VT, ldv, h_work, lwork, &info );
+	gpu_time = magma_wtime() - gpu_time;
+	if (info != 0) {
+                printf("magma_sgesvd returned error %d: %s.\n",
+                       (int) info, magma_strerror( info ));
+            }
+            
+	//printf("sgesvd gpu time: %7.5f\n", gpu_time );   
+     
+     
+     // Write eigenvalues
+    sprintf(fname, "eigenv.dat.magma");
+    if((fp=fopen(fname, "w"))==NULL)
+      {
+        printf("ERROR: cannot create file \"%s\"\n", fname);
+        exit(0);
+      }
+    for(k=0; k<min_mn; k++)
+      fprintf(fp,"%5ld %20g %20g\n", k, S1[k], S1[k]/S1[0] );
+    fclose(fp);
+
+ 
+    egvlim = SVDeps * S1[0];
+        
+	MaxNBmodes1 = MaxNBmodes;
+	if(MaxNBmodes1>M)
+		MaxNBmodes1 = M;
+	if(MaxNBmodes1>N)
+		MaxNBmodes1 = N;
+	mode = 0;
+	while( (mode<MaxNBmodes1) && (S1[mode]>egvlim) )
+		mode++;
+	MaxNBmodes1 = mode;
+	
+	//printf("Keeping %ld modes  (SVDeps = %g)\n", MaxNBmodes1, SVDeps);
+    // Write rotation matrix 
+    arraysizetmp[0] = m;
+    arraysizetmp[1] = m;
+    if(atype==_DATATYPE_FLOAT)
+    {
+        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+        for(ii=0; ii<m; ii++) // modes
+            for(k=0; k<m; k++) // modes
+                data.image[ID_VTmatrix].array.F[k*m+ii] = (float) VT[k*m+ii];
+    }
+    else
+    {
+        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+        for(ii=0; ii<m; ii++) // modes
+            for(k=0; k<m; k++) // modes
+                data.image[ID_VTmatrix].array.D[k*m+ii] = (double) VT[k*m+ii];
+    }
+
+     
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[2] = m;
+    }
+    else
+    {
+        arraysizetmp[0] = n;
+        arraysizetmp[1] = m;
+    }
+    
+    if(atype==_DATATYPE_FLOAT)
+        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+    else
+        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+
+   // compute pseudo-inverse
+   // M+ = V Sig^-1 UT
+   for(ii=0;ii<M;ii++)
+		for(jj=0;jj<N;jj++)
+			for(mode=0;mode<MaxNBmodes1-1;mode++)
+				{
+					data.image[ID_Cmatrix].array.F[jj*M+ii] += VT[jj*N+mode]*U[mode*M+ii]/S1[mode];
+				}
+   
+     
+            
+    magma_free_cpu(a);                                        // free  host  memory
+	magma_free_cpu(VT);                                       // free  host  memory
+	magma_free_cpu(S1);                                       // free  host  memory
+	magma_free_cpu(U);                                        // free  host  memory
+	magma_free_pinned(h_work );                  // free  host  memory
+	magma_free_pinned(h_R);                        // free  host  memory       
+            
+	magma_finalize ();                               //  finalize  Magma
+
+	free(arraysizetmp);
+
+//    printf("[CM magma SVD done]\n");
+ //   fflush(stdout);
+
+    return(ID_Cmatrix);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+/** 
+ *  @brief Computes matrix pseudo-inverse (AT A)^-1 AT, using eigenvector/eigenvalue decomposition of AT A
+ * 
+ * 
+ * Computes pseuso inverse of M x N matrix
+ * 
+ * When used with AOloopControl module:
+ *    N: number of actuators 
+ *    M: number of sensors 
+ * 	assumes M>N
+ * 
+ * 
+ *  use LOOPmode = 1 for computing the same size SVD, same input and output location
+ * 
+ * Notations: 
+ * 	AT is transpose of A 
+ * 	A+ is pseudo inverse of A
+ * 
+ *  Computes pseudo-inverse : A+ = (AT A)^-1 AT
+ *  Inverse of AT A is computed by SVD
+ * 
+ * SVD:   A = U S V^T
+ *   U are eigenvectors of A A^T
+ *   V are eigenvectors of A^T A, computed at step 4 below
+ * 
+ * Linear algebra reminder: equivalence between (AT A)^-1 AT and V S^-1 UT
+ * 
+ * Definition of pseudoinverse:
+ * A+ = (AT A)^-1 AT   
+ * singular value decomposition of A = U S VT 
+ * A+ = ( V S UT U S VT )^-1 V S UT
+ * Since U is unitary, UT U = Id ->
+ * A+ = ( V S^2 VT )^-1 V S UT
+ * A+ = VT^-1 S^-2 V^-1 V S UT
+ * A+ = V S^-1 UT
+ * 
+ *  Main steps:
+ * 
+ *  STEP 1 :   Fill input data into magmaf_h_A on host   
+ * 
+ *  STEP 2 :   Copy input data to GPU                                 -> magmaf_d_A        (MxN matrix on device) 
+ * 
+ *  STEP 3 :   Compute  trans(A) x A   : magmaf_d_A x magmaf_d_A      -> magmaf_d_AtA      (NxN matrix on device)
+ * 
+ *  STEP 4 :   Compute eigenvalues and eigenvectors of A^T A          -> magmaf_d_AtA      (NxN matrix on device)
+ *     Calls magma_ssyevd_gpu :
+ *     Compute the eigenvalues and optionally eigenvectors of a symmetric real matrix in single precision, GPU interface, big matrix.
+ *     This function computes in single precision all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A defined on the device.  
+ *     The  first parameter can take the values MagmaVec,'V' or MagmaNoVec,'N' and answers the question whether the eigenvectors are desired.  
+ *     If the eigenvectors are desired, it uses a divide and conquer algorithm.  The symmetric matrix A can be stored in lower (MagmaLower,'L') 
+ *     or upper  (MagmaUpper,'U') mode. If the eigenvectors are desired, then on exit A contains orthonormal eigenvectors.  
+ *     The eigenvalues are stored in an array w
+ * 
+ *  STEP 5 :   Set eigenvalue limit
+ * 
+ *  STEP 6 :   Write eigenvectors to V^T matrix
+ * 
+ *  STEP 7 :   Write eigenvectors/eigenvalue to magma_h_VT1 if eigenvalue > limit
+ *           Copy to magma_d_VT1
+ * 
+ *  STEP 8 :   Compute M2 = VT1 VT. M2 is (AT A)^-1
+ * 
+ *  STEP 9 :   Compute Ainv = M2 A. This is the pseudo inverse
+ * 
+ * @note SVDeps^2 is applied as a limit to the eigenvectors of AT A, which are equal to the squares of the singular values of A, so this is equivalent to applying SVDeps as a limit on the singular values of A
+ * @note When used to compute AO control matrix, N=number of actuators/modes, M=number of WFS elements
+ * @note EIGENVALUES are good to about 1e-6 of peak eigenvalue in single precision, much better with double precision
+ * @note 2.5x faster in single precision
+ */
+
+
+int CUDACOMP_magma_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name, int LOOPmode) 
+{
+    long ID_Rmatrix;
+    uint8_t atype;
+    uint32_t *arraysizetmp;
+    int size; // variable for memory allocations
+    long N, M;
+    long ii, jj, k;
+    magma_int_t info;
+
+
+    long ID_AtA, ID_VT, ID_Ainv;
+
+    /// Timing tests
+   // int timing = 1;                                                        /**< 1 if timing test ON, 0 otherwise */
+    struct timespec t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;                /**< Timers                           */
+    double t01d, t12d, t23d, t34d, t45d, t56d, t67d, t78d, t89d, t09d;     /**< Times in sec                     */
+    struct timespec tdiff;
+
+
+    FILE *fp;
+    char fname[200];
+
+    long maxMode, MaxNBmodes1, mode;
+    double egvlim;
+    long nbmodesremoved;
+
+    long ID_Cmatrix;
+
+	// TESTING FLAGS
+	int VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse = 0;
+    int testmode = 0;
+
+
+    int MAGMAfloat = 1;		                                               /**< 1 if single precision, 0 if double precision */
+
+
+	int magmaXmode = 0; // expert mode, uses magma_ssyevdx_gpu
+	// this does not speed up computation
+	magma_int_t mout;
+
+
+
+
+  //  if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t0);
+
+
+	/**
+	 * 
+	 * The input matrix can be a 2D or a 3D image
+	 * 
+	 * If 2D image :
+	 *   M = xsize
+	 *   N = ysize
+	 * 
+	 * If 3D image :
+	 *   M = xsize*ysize
+	 *   N = ysize
+	 * 
+	 * Note that a tall input matrix (M>N) will appear short if viewed as an image.
+	 * There is a 90 deg rotation between image and matrix
+	 * 
+	 */
+
+
+
+	///
+	/// MAGMA uses column-major matrices. For matrix A with dimension (M,N), element A(i,j) is A[ j*M + i]
+	/// i = 0 ... M
+	/// j = 0 ... N
+	///
+	
+	
+    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    atype = data.image[ID_Rmatrix].md[0].atype;
+
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        /// each column (N=cst) of A is a z=cst slice of image Rmatrix
+        M = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        
+        N = data.image[ID_Rmatrix].md[0].size[2];
+        
+        if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+        {
+			printf("3D image -> %ld %ld\n", M, N);
+			fflush(stdout);
+		}
+    }
+    else
+    {
+		/// each column (N=cst) of A is a line (y=cst) of Rmatrix (90 deg rotation)
+        M = data.image[ID_Rmatrix].md[0].size[0];
+
+        N = data.image[ID_Rmatrix].md[0].size[1];
+
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("2D image -> %ld %ld\n", M, N);
+			fflush(stdout);
+		}
+    }
+
+
+
+
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("magma :    M = %ld , N = %ld\n", (long) M, (long) N);
+		fflush(stdout);
+	}
+
+
+	/// Initialize MAGMA if needed
+    if(INIT_MAGMA==0)
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("INITIALIZE MAGMA\n");
+			fflush(stdout);
+        }
+        magma_init();
+        magma_print_environment();
+
+        INIT_MAGMA = 1;
+    }
+
+
+
+
+
+    if(MAGMAloop_iter == 0) /// memory is only allocated on first pass
+    {
+        if(MAGMAfloat==0)
+        {
+            TESTING_MALLOC_CPU( magma_h_A, double, M*N);
+            TESTING_MALLOC_DEV( magma_d_A, double, M*N);
+
+            TESTING_MALLOC_CPU( magma_h_AtA, double, N*N);
+            TESTING_MALLOC_DEV( magma_d_AtA, double, N*N);
+
+            TESTING_MALLOC_CPU( magma_h_VT1, double, N*N);
+            TESTING_MALLOC_DEV( magma_d_VT1, double, N*N);
+            TESTING_MALLOC_DEV( magma_d_M2, double, N*N);
+        }
+        else
+        {
+            TESTING_MALLOC_CPU( magmaf_h_A, float, M*N);
+            TESTING_MALLOC_DEV( magmaf_d_A, float, M*N);
+
+            TESTING_MALLOC_CPU( magmaf_h_AtA, float, N*N);
+            TESTING_MALLOC_DEV( magmaf_d_AtA, float, N*N);
+
+            TESTING_MALLOC_CPU( magmaf_h_VT1, float, N*N);
+            TESTING_MALLOC_DEV( magmaf_d_VT1, float, N*N);
+            TESTING_MALLOC_DEV( magmaf_d_M2, float, N*N);
+        }
+    }
+
+
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("MAGMA READY\n");
+		fflush(stdout);
+	}
+
+
+   // if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t1);
+
+
+	// ****************************************************
+	// STEP 1 :   Fill input data into magmaf_h_A on host   
+	// ****************************************************
+	
+    if(atype==_DATATYPE_FLOAT)
+    {
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M*N; ii++)
+                magmaf_h_A[ii] =  data.image[ID_Rmatrix].array.F[ii];
+        }
+        else
+        {
+            for(ii=0; ii<M*N; ii++)
+                magma_h_A[ii] =  data.image[ID_Rmatrix].array.F[ii];
+        }
+    }
+    else
+    {
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M*N; ii++)
+                magmaf_h_A[ii] = data.image[ID_Rmatrix].array.D[ii];
+        }
+        else
+        {
+            for(ii=0; ii<M*N; ii++)
+                magma_h_A[ii] = data.image[ID_Rmatrix].array.D[ii];
+        }
+    }
+
+    if(testmode==1)
+    {
+		long ID_A;
+		
+        ID_A = create_2Dimage_ID("mA", M, N);
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_A].array.F[ii] = magmaf_h_A[ii];
+        }
+        else
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_A].array.F[ii] = magma_h_A[ii];
+        }
+        
+        save_fits("mA", "!test_mA.fits");
+        delete_image_ID("mA");
+    }
+
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("MAGMA: CREATE QUEUE\n");
+		fflush(stdout);
+	}
+	
+
+
+
+
+	// ****************************************************
+	// STEP 2 :   Copy input data from CPU to GPU   
+	// ****************************************************
+	
+    if(MAGMAloop_iter == 0)
+        magma_queue_create(0, &magmaqueue);
+	
+    if(MAGMAfloat==1)
+        magma_ssetmatrix( M, N, magmaf_h_A, M, magmaf_d_A, M, magmaqueue);
+    else
+        magma_dsetmatrix( M, N, magma_h_A, M, magma_d_A, M, magmaqueue);
+
+
+    if(LOOPmode==0) /// if pseudo-inverse is only computed once, these arrays can be freed
+    {
+        if(MAGMAfloat==1)
+            TESTING_FREE_CPU( magmaf_h_A );
+        else
+            TESTING_FREE_CPU( magma_h_A );
+    }
+
+    //if(timing==1)
+        
+    clock_gettime(CLOCK_REALTIME, &t2);
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("MAGMA: COMPUTE trans(A) x A\n");
+		fflush(stdout);
+    }
+    
+    
+	// ****************************************************    
+    // STEP 3 :   Compute trans(A) x A    : magmaf_d_A x magmaf_d_A      -> magmaf_d_AtA      (NxN matrix on device)
+	// ****************************************************
+	
+	    
+    if(MAGMAfloat==1)
+        magma_sgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magmaf_d_A, M, magmaf_d_A, M, 0.0,  magmaf_d_AtA, N, magmaqueue);
+    else
+        magma_dgemm(  MagmaTrans, MagmaNoTrans, N, N, M, 1.0, magma_d_A, M, magma_d_A, M, 0.0,  magma_d_AtA, N, magmaqueue);
+
+
+
+    if(testmode == 1)
+    {
+        if(MAGMAfloat==1)
+            magma_sgetmatrix( N, N, magmaf_d_AtA, N, magmaf_h_AtA, N, magmaqueue);
+        else
+            magma_dgetmatrix( N, N, magma_d_AtA, N, magma_h_AtA, N, magmaqueue);
+
+
+        ID_AtA = create_2Dimage_ID("mAtA", N, N);
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<N*N; ii++)
+                data.image[ID_AtA].array.F[ii] = magmaf_h_AtA[ii];
+        }
+        else
+        {
+            for(ii=0; ii<N*N; ii++)
+                data.image[ID_AtA].array.F[ii] = magma_h_AtA[ii];
+        }
+        save_fits("mAtA", "!test_mAtA.fits");
+    }
+
+
+
+    //if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t3);
+
+
+	// ****************************************************    
+	// STEP 4 :   Compute eigenvalues and eigenvectors of AT A   -> magmaf_d_AtA      (NxN matrix on device)
+	//
+	// SVD of AT A = V S^2 VT
+	// calls function magma_ssyevd_gpu
+	// 
+	//
+	// ****************************************************    
+
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("COMPUTE eigenvalues and eigenvectors of AT A\n");
+		fflush(stdout);
+	}
+	
+    if(MAGMAloop_iter==0)
+    {	
+        // get workspace size
+        if(MAGMAfloat==1)
+        {
+			float auxf_work[1];
+			
+			if(magmaXmode==1)
+				magma_ssyevdx_gpu( MagmaVec, MagmaRangeI, MagmaLower, N, NULL, N, 0.0, 1.0, N-MaxNBmodes, N, NULL, NULL, NULL, N, auxf_work, -1, magma_aux_iwork, -1, &info );
+			else
+				magma_ssyevd_gpu(  MagmaVec,              MagmaLower, N, NULL, N,                       NULL, NULL, N, auxf_work, -1, magma_aux_iwork, -1, &info );
+            
+            magma_lwork  = (magma_int_t) MAGMA_S_REAL( auxf_work[0] );
+        }
+        else
+        {
+			double aux_work[1];
+    
+            magma_dsyevd_gpu( MagmaVec, MagmaLower, N, NULL, N, NULL, NULL, N, aux_work,  -1, magma_aux_iwork, -1, &info );
+            magma_lwork  = (magma_int_t) MAGMA_S_REAL( aux_work[0] );
+        }
+
+        magma_liwork = magma_aux_iwork[0];
+    }
+
+
+
+    //if(timing==1)
     clock_gettime(CLOCK_REALTIME, &t4);
 
 	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
 	{
-		printf("MAGMA: allocate & compute\n");
+		printf("MAGMA: allocate & compute\n");
+		fflush(stdout);
+    }
+    
+    
+    if(MAGMAloop_iter == 0)
+    {
+        if(MAGMAfloat==1)
+        {
+            TESTING_MALLOC_CPU( magma_iwork,  magma_int_t, magma_liwork );
+            TESTING_MALLOC_PIN( magmaf_h_work, float, magma_lwork  );
+            TESTING_MALLOC_CPU( magmaf_w1,     float,             N      );
+            TESTING_MALLOC_PIN( magmaf_h_R,    float, N*N  );
+        }
+        else
+        {
+            TESTING_MALLOC_CPU( magma_iwork,  magma_int_t, magma_liwork );
+            TESTING_MALLOC_PIN( magma_h_work, double, magma_lwork  );
+            TESTING_MALLOC_CPU( magma_w1,     double,             N      );
+            TESTING_MALLOC_PIN( magma_h_R,    double, N*N  );
+        }
+    }
+
+
+   
+    
+    
+    
+    if(MAGMAfloat==1)
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_ssyevd_gpu -> ");
+			fflush(stdout);
+		}
+		
+		// SSYEVD computes all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A
+		if(magmaXmode==1)
+			magma_ssyevdx_gpu( MagmaVec, MagmaRangeI, MagmaLower, N, magmaf_d_AtA, N, 0.0, 1.0, N-MaxNBmodes, N, &mout, magmaf_w1, magmaf_h_R, N, magmaf_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
+		else
+			magma_ssyevd_gpu( MagmaVec,               MagmaLower, N, magmaf_d_AtA, N,                        magmaf_w1, magmaf_h_R, N, magmaf_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
+				
+		
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" DONE\n");
+			fflush(stdout);
+		}
+	}
+    else
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_dsyevd_gpu -> ");  
+			fflush(stdout);
+        }
+        // CODE CAN HANG HERE - THIS HAPPENS ONCE OUT OF multiple 1000s EXECUTIONS WHEN RUNNING IN A LOOP.. SEEMS TO BE A MAGMA ISSUE
+        
+        // SSYEVD computes all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A
+        magma_dsyevd_gpu( MagmaVec, MagmaLower, N, magma_d_AtA, N, magma_w1, magma_h_R, N, magma_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
+		
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" DONE\n");
+			fflush(stdout);
+		}
+	}
+
+    if(LOOPmode == 0)
+    {
+        TESTING_FREE_CPU( magma_iwork  );
+
+        if(MAGMAfloat==1)
+            TESTING_FREE_PIN( magmaf_h_R    );
+        else
+            TESTING_FREE_PIN( magma_h_R    );
+
+		if(MAGMAfloat==1)
+			TESTING_FREE_PIN( magma_h_work );
+		else
+			TESTING_FREE_PIN( magmaf_h_work );
+    }
+
+
+
+
+    //if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t5);
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("Write eigenvalues to file\n");
+		fflush(stdout);
+    }
+    
+    sprintf(fname, "eigenv.dat");
+    if((fp=fopen(fname, "w"))==NULL)
+    {
+        printf("ERROR: cannot create file \"%s\"\n", fname);
+        exit(0);
+    }
+    if(MAGMAfloat==1)
+    {
+        for(k=0; k<N; k++)
+            fprintf(fp,"%5ld %20.8g  %20.8f  %20.8f\n", k, magmaf_w1[N-k-1], magmaf_w1[N-k-1]/magmaf_w1[N-1], SVDeps*SVDeps);
+    }
+    else
+    {
+        for(k=0; k<N; k++)
+            fprintf(fp,"%5ld %20.8g  %20.8f  %20.8f\n", k, magma_w1[N-k-1], magma_w1[N-k-1]/magma_w1[N-1], SVDeps*SVDeps);
+    }
+    fclose(fp);
+
+
+	/// w1 values are the EIGENVALUES of AT A
+	/// Note: w1 values are the SQUARE of the singular values of A 
+
+
+	// ****************************************************    
+	// STEP 5 :   Set eigenvalue limit
+	// ****************************************************    
+	
+	if(MAGMAfloat==1)
+		egvlim = SVDeps*SVDeps* magmaf_w1[N-1];
+    else
+    	egvlim = SVDeps*SVDeps* magma_w1[N-1];
+    
+    MaxNBmodes1 = MaxNBmodes;
+    if(MaxNBmodes1>N)
+        MaxNBmodes1 = N;
+    if(MaxNBmodes1>M)
+        MaxNBmodes1 = M;
+    mode = 0;
+    
+    if(MAGMAfloat==1)
+    {
+		while( (mode<MaxNBmodes1) && (magmaf_w1[N-mode-1]>egvlim) )
+			mode++;
+    }
+    else
+    {
+		while( (mode<MaxNBmodes1) && (magma_w1[N-mode-1]>egvlim) )
+			mode++;
+	}
+	
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("Keeping %ld modes  (SVDeps = %g -> %g, MaxNBmodes = %ld -> %ld)\n", mode, SVDeps, egvlim, MaxNBmodes, MaxNBmodes1);
+		fflush(stdout);
+	}
+	
+    fp = fopen("SVDmodes.log", "w");
+    fprintf(fp, "%6ld %6ld\n", mode, MaxNBmodes1);
+    fclose(fp);
+    MaxNBmodes1 = mode;
+    //printf("Keeping %ld modes  (SVDeps = %g)\n", MaxNBmodes1, SVDeps);
+
+
+	// ****************************************************    
+	// STEP 6 :   Write eigenvectors to VT matrix
+	// ****************************************************    
+	
+	// eigenvectors are in magma_d_AtA (device), copy them to magma_h_AtA (host)
+
+    if(MAGMAfloat==1)
+        magma_sgetmatrix( N, N, magmaf_d_AtA, N, magmaf_h_AtA, N, magmaqueue);
+    else
+        magma_dgetmatrix( N, N, magma_d_AtA, N, magma_h_AtA, N, magmaqueue);
+
+
+	// copy eigenvectors from magma_h_AtA to VT
+    ID_VT = create_2Dimage_ID(ID_VTmatrix_name, N, N);
+
+    if(MAGMAfloat==1)
+    {
+        for(ii=0; ii<N; ii++)
+            for(jj=0; jj<N; jj++)
+                data.image[ID_VT].array.F[jj*N+ii] = magmaf_h_AtA[(N-ii-1)*N+jj];
+    }
+    else
+    {
+        for(ii=0; ii<N; ii++)
+            for(jj=0; jj<N; jj++)
+                data.image[ID_VT].array.F[jj*N+ii] = magma_h_AtA[(N-ii-1)*N+jj];
+    }
+
+
+	// ****************************************************    
+	// STEP 7 :   Write eigenvectors/eigenvalue to magma_h_VT1 if eigenvalue > limit
+	//          Copy to magma_d_VT1
+	// ****************************************************   
+
+    if(MAGMAfloat==1)
+    {
+        for(ii=0; ii<N; ii++)
+            for(jj=0; jj<N; jj++)
+            {
+                if(N-jj-1<MaxNBmodes1)
+                    magmaf_h_VT1[ii*N+jj] = magmaf_h_AtA[jj*N+ii]/magmaf_w1[jj];
+                else
+                    magmaf_h_VT1[ii*N+jj] = 0.0;
+            }
+        magma_ssetmatrix( N, N, magmaf_h_VT1, N, magmaf_d_VT1, N, magmaqueue);
+    }
+    else
+    {
+        for(ii=0; ii<N; ii++)
+            for(jj=0; jj<N; jj++)
+            {
+                if(N-jj-1<MaxNBmodes1)
+                    magma_h_VT1[ii*N+jj] = magma_h_AtA[jj*N+ii]/magma_w1[jj];
+                else
+                    magma_h_VT1[ii*N+jj] = 0.0;
+            }
+        magma_dsetmatrix( N, N, magma_h_VT1, N, magma_d_VT1, N, magmaqueue);
+    }
+
+
+    if(LOOPmode == 0)
+    {
+        if(MAGMAfloat==1)
+        {
+            TESTING_FREE_CPU( magmaf_h_VT1 );
+            TESTING_FREE_CPU( magmaf_w1 );
+            TESTING_FREE_CPU( magmaf_h_AtA );
+        }
+        else
+        {
+            TESTING_FREE_CPU( magma_h_VT1 );
+            TESTING_FREE_CPU( magma_w1 );
+            TESTING_FREE_CPU( magma_h_AtA );
+        }
+    }
+
+
+
+    //if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t6);
+
+
+	// ****************************************************    
+	// STEP 8 :   Compute M2 = VT1 VT = (AT A)^-1
+	// ****************************************************    
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+    {
+		printf("compute M2 = VT1 VT\n");
+		fflush(stdout);
+    }
+    
+    if(MAGMAfloat==1)
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_sgemm ");
+			fflush(stdout);
+        }
+        
+        magma_sgemm(  MagmaTrans, MagmaTrans, N, N, N, 1.0, magmaf_d_VT1, N, magmaf_d_AtA, N, 0.0,  magmaf_d_M2, N, magmaqueue);
+
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("-> DONE\n");
+			fflush(stdout);
+		}
+    }
+    else
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_dgemm ");
+			fflush(stdout);
+        }
+        
+	    magma_dgemm(  MagmaTrans, MagmaTrans, N, N, N, 1.0, magma_d_VT1, N, magma_d_AtA, N, 0.0,  magma_d_M2, N, magmaqueue);
+
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("-> DONE\n");
+			fflush(stdout);
+		}
+	}
+
+    if(testmode == 1)
+    {
+		 long ID_M2;
+		    
+        ID_M2 = create_2Dimage_ID("mM2", N, N);
+        if(MAGMAfloat==1)
+        {
+            TESTING_MALLOC_CPU( magmaf_h_M2, float, N*N);
+            magma_sgetmatrix( N, N, magmaf_d_M2, N, magmaf_h_M2, N, magmaqueue);
+
+            for(ii=0; ii<N; ii++)
+                for(jj=0; jj<N; jj++)
+                    data.image[ID_M2].array.F[jj*N+ii] = magmaf_h_M2[jj*N+ii];
+        }
+        else
+        {
+            TESTING_MALLOC_CPU( magma_h_M2, double, N*N);
+            magma_dgetmatrix( N, N, magma_d_M2, N, magma_h_M2, N, magmaqueue);
+
+            for(ii=0; ii<N; ii++)
+                for(jj=0; jj<N; jj++)
+                    data.image[ID_M2].array.F[jj*N+ii] = magma_h_M2[jj*N+ii];
+        }
+
+        save_fits("mM2", "!test_mM2.fits");
+
+
+        //	magma_dsetmatrix( N, N, h_M2, N, d_M2, N, magmaqueue);
+        if(MAGMAfloat==1)
+            TESTING_FREE_CPU( magmaf_h_M2 );
+        else
+            TESTING_FREE_CPU( magma_h_M2 );
+    }
+
+    if(LOOPmode == 0)
+    {
+        if(MAGMAfloat==1)
+        {
+            TESTING_FREE_DEV( magmaf_d_VT1 );
+            TESTING_FREE_DEV( magmaf_d_AtA );
+        }
+        else
+        {
+            TESTING_FREE_DEV( magma_d_VT1 );
+            TESTING_FREE_DEV( magma_d_AtA );
+        }
+    }
+
+ 
+
+
+	// ****************************************************    
+	// STEP 9 :   Compute Ainv = M2 A = (AT A)^-1 A 
+	// ****************************************************    
+
+
+    // compute Ainv = M2 A
+    if(MAGMAloop_iter==0)
+    {
+        if(MAGMAfloat==1)
+        {
+            TESTING_MALLOC_DEV( magmaf_d_Ainv, float, N*M);
+        }
+        else
+        {
+            TESTING_MALLOC_DEV( magma_d_Ainv, double, N*M);
+        }
+    }
+
+    if(MAGMAfloat==1)
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_sgemm ");
+			fflush(stdout);
+        }
+        
+        magma_sgemm(  MagmaNoTrans, MagmaNoTrans, M, N, N, 1.0, magmaf_d_A, M, magmaf_d_M2, N, 0.0, magmaf_d_Ainv, M, magmaqueue);
+		
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("-> DONE\n");
+			fflush(stdout);
+		}
+    }
+    else
+    {
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf(" -> magma_dgemm ");
+			fflush(stdout);
+        }
+        
+        magma_dgemm(  MagmaNoTrans, MagmaNoTrans, M, N, N, 1.0, magma_d_A, M, magma_d_M2, N, 0.0, magma_d_Ainv, M, magmaqueue);
+		
+		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+		{
+			printf("-> DONE\n");
+			fflush(stdout);	
+		}
+	}
+
+    if(LOOPmode==0)
+    {
+        if(MAGMAfloat==1)
+			TESTING_FREE_DEV( magmaf_d_A);
+        else
+            TESTING_FREE_DEV( magma_d_A);
+	}
+
+
+    if(MAGMAloop_iter==0)
+    {
+        if(MAGMAfloat==1)
+		{
+			TESTING_MALLOC_CPU( magmaf_h_Ainv, float, N*M);
+		}
+        else
+		{
+			TESTING_MALLOC_CPU( magma_h_Ainv, double, N*M);
+		}
+    }
+
+    if(LOOPmode==0)
+    {
+        if(MAGMAfloat==1)
+         {
+		   TESTING_FREE_DEV( magmaf_d_M2 );
+        }
+        else
+        {    
+			TESTING_FREE_DEV( magma_d_M2 );
+		}
+    }
+
+
+
+
+    //if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t7);
+
+    if(MAGMAfloat==1)
+        magma_sgetmatrix( M, N, magmaf_d_Ainv, M, magmaf_h_Ainv, M, magmaqueue);
+    else
+        magma_dgetmatrix( M, N, magma_d_Ainv, M, magma_h_Ainv, M, magmaqueue);
+
+
+    if(testmode == 1)
+    {
+        ID_Ainv = create_2Dimage_ID("mAinv", M, N);
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M; ii++)
+                for(jj=0; jj<N; jj++)
+                    data.image[ID_Ainv].array.F[jj*M+ii] = magmaf_h_Ainv[jj*M+ii];
+        }
+        else
+        {
+            for(ii=0; ii<M; ii++)
+                for(jj=0; jj<N; jj++)
+                    data.image[ID_Ainv].array.F[jj*M+ii] = magma_h_Ainv[jj*M+ii];
+        }
+        save_fits("mAinv", "!test_mAinv.fits");
+    }
+
+    //if(timing==1)
+     clock_gettime(CLOCK_REALTIME, &t8);
+
+
+    if(MAGMAloop_iter==0)
+    {
+        if(data.image[ID_Rmatrix].md[0].naxis==3)
+        {
+            arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+            arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+            arraysizetmp[2] = N;
+        }
+        else
+        {
+            arraysizetmp[0] = M;
+            arraysizetmp[1] = N;
+        }
+
+        if(atype==_DATATYPE_FLOAT)
+            ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+        else
+            ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+    }
+    else
+        ID_Cmatrix = image_ID(ID_Cmatrix_name);
+
+	
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("write result\n");
+		fflush(stdout);
+    }
+
+    if(atype==_DATATYPE_FLOAT)
+    {
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_Cmatrix].array.F[ii] = magmaf_h_Ainv[ii];
+        }
+        else
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_Cmatrix].array.F[ii] = (float) magma_h_Ainv[ii];
+        }
+    }
+    else
+    {
+        // sensors : M
+        // actuator modes: N
+        if(MAGMAfloat==1)
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_Cmatrix].array.D[ii] = magmaf_h_Ainv[ii];
+        }
+        else
+        {
+            for(ii=0; ii<M*N; ii++)
+                data.image[ID_Cmatrix].array.D[ii] = magma_h_Ainv[ii];
+        }
+    }
+
+
+    //if(timing==1)
+    clock_gettime(CLOCK_REALTIME, &t9);
+
+
+    if(LOOPmode==0)
+    {
+        if(MAGMAfloat==1)
+        {
+            TESTING_FREE_DEV( magmaf_d_Ainv );
+            TESTING_FREE_CPU( magmaf_h_Ainv );
+        }
+        else
+        {
+            TESTING_FREE_DEV( magma_d_Ainv );
+            TESTING_FREE_CPU( magma_h_Ainv );
+        }
+    }
+
+
+
+
+
+    if(LOOPmode==0)
+    {
+        magma_queue_destroy( magmaqueue );
+        magma_finalize ();                               //  finalize  Magma
+    }
+
+    free(arraysizetmp);
+
+
+    //if(timing==1)
+    //{
+        tdiff = info_time_diff(t0, t1);
+        t01d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t1, t2);
+        t12d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t2, t3);
+        t23d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t3, t4);
+        t34d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t4, t5);
+        t45d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t5, t6);
+        t56d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t6, t7);
+        t67d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t7, t8);
+        t78d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t8, t9);
+        t89d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+        tdiff = info_time_diff(t0, t9);
+        t09d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+      printf("%6ld  Timing info: \n", MAGMAloop_iter);
+      printf("  0-1	%12.3f ms\n", t01d*1000.0);
+      printf("  1-2	%12.3f ms\n", t12d*1000.0);
+      printf("  2-3	%12.3f ms\n", t23d*1000.0);
+      printf("  3-4	%12.3f ms\n", t34d*1000.0);
+      printf("  4-5	%12.3f ms\n", t45d*1000.0);
+      printf("  5-6	%12.3f ms\n", t56d*1000.0);
+      printf("  6-7	%12.3f ms\n", t67d*1000.0);
+      printf("  7-8	%12.3f ms\n", t78d*1000.0);
+      printf("  8-9	%12.3f ms\n", t89d*1000.0);
+      printf("\n");
+      printf(" TOTAL  %12.3f ms\n", t09d*1000.0);
+		fflush(stdout);
+    }
+    //}
+
+
+	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+	{
+		printf("\n\n");
 		fflush(stdout);
+	}
+
+    if(LOOPmode == 1)
+        MAGMAloop_iter++;
+
+    return(ID_Cmatrix);
+}
+
+
+
+
+#endif
+
+
+
+
+
+
+
+
+
+
+
+//
+// Computes control matrix
+// Conventions:
+//   n: number of actuators (= NB_MODES)
+//   m: number of sensors  (= # of pixels)
+// assumes m = n
+
+int GPU_SVD_computeControlMatrix(int device, const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, const char *ID_VTmatrix_name)
+{
+    cusolverDnHandle_t  cudenseH = NULL;
+    cublasHandle_t cublasH = NULL;
+    cublasStatus_t cublas_status; // = CUBLAS_STATUS_SUCCESS;
+    cusolverStatus_t cusolver_status; // = CUSOLVER_STATUS_SUCCESS;
+    struct cudaDeviceProp deviceProp;
+    int k;
+
+    long ID_Rmatrix, ID_Cmatrix, ID_VTmatrix;
+    uint8_t atype;
+    int m;
+    int n;
+    uint32_t *arraysizetmp;
+    int lda, ldu, ldvt;
+    
+
+    float *d_A = NULL; // linear memory of GPU
+    float *h_A = NULL;
+    float *d_S = NULL; // linear memory of GPU
+    float *d_U = NULL; // linear memory of GPU
+    float *h_U1 = NULL;    
+    float *d_VT = NULL; // linear memory of GPU
+    float *d_M = NULL; // linear memory of GPU
+    float *d_U1 = NULL; // linear memory of GPU
+    float *d_Work = NULL; // linear memory of GPU
+    cudaError_t cudaStat = cudaSuccess;
+    int *devInfo = NULL; // info in gpu (device copy)
+    int Lwork;
+    float *rwork;
+
+    float *Sarray;
+    float *Aarray;
+    long i;
+    FILE *fp;
+    char fname[200];
+
+    int info_gpu;
+
+    double time1sec, time2sec;
+    struct timespec tnow;
+
+
+    long ID_leftSV; // left singular vectors
+    float val;
+    long ii, jj;
+    float alpha = 1.0;
+    float beta = 0.0;
+    long ID;
+    
+    float *h_M;
+    long cnt0;
+ 
+
+    cudaGetDeviceCount(&deviceCount);
+    printf("%d devices found\n", deviceCount);
+    fflush(stdout);
+    printf("\n");
+    for (k = 0; k < deviceCount; ++k) {
+        cudaGetDeviceProperties(&deviceProp, k);
+        printf("Device %d [ %20s ]  has compute capability %d.%d.\n",
+               k, deviceProp.name, deviceProp.major, deviceProp.minor);
+        printf("  Total amount of global memory:                 %.0f MBytes (%llu bytes)\n", (float)deviceProp.totalGlobalMem/1048576.0f, (unsigned long long) deviceProp.totalGlobalMem);
+        printf("  (%2d) Multiprocessors\n", deviceProp.multiProcessorCount);
+        printf("  GPU Clock rate:                                %.0f MHz (%0.2f GHz)\n", deviceProp.clockRate * 1e-3f, deviceProp.clockRate * 1e-6f);
+        printf("\n");
+    }
+
+
+    if(device<deviceCount)
+    {
+        cudaSetDevice(device);
+    }
+    else
+    {
+        printf("Invalid Device : %d / %d\n", device, deviceCount);
+        exit(0);
+    }
+
+    cudaDeviceReset();
+
+    printf("step 1a: create cudense handle ...");
+    fflush(stdout);
+    cusolver_status = cusolverDnCreate(&cudenseH);
+    if (cusolver_status != CUSOLVER_STATUS_SUCCESS) {
+        printf ("CUSOLVER initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    printf(" done\n");
+    fflush(stdout);
+
+
+    printf("step 1b: create cublas handle ...");
+    fflush(stdout);
+    cublas_status = cublasCreate(&cublasH);
+    if (cublas_status != CUBLAS_STATUS_SUCCESS) {
+        printf ("CUBLAS initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    printf(" done\n");
+    fflush(stdout);
+
+
+
+
+
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    time1sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
+
+
+
+    list_image_ID();
+
+   
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+
+    atype = data.image[ID_Rmatrix].md[0].atype;
+    if(atype!=_DATATYPE_FLOAT)
+    {
+        printf("wrong type\n");
+        exit(0);
+    }
+
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        m = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        n = data.image[ID_Rmatrix].md[0].size[2];
+        printf("3D image -> %d %d\n", m, n);
+        fflush(stdout);
+    }
+    else
+    {
+        m = data.image[ID_Rmatrix].md[0].size[0];
+        n = data.image[ID_Rmatrix].md[0].size[1];
+        printf("2D image -> %d %d\n", m, n);
+        fflush(stdout);
+    }
+
+    if(m!=n)
+    {
+        printf("ERROR: m must be equal to n\n");
+        exit(0);
+    }
+
+
+
+
+
+
+
+
+
+    cudaStat = cudaMalloc ((void**)&d_A  , sizeof(float) * n * m);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_A returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    h_A = (float*) malloc(sizeof(float)*m*n);
+    
+    cudaStat = cudaMemcpy(d_A, data.image[ID_Rmatrix].array.F, sizeof(float)*m*n, cudaMemcpyHostToDevice);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy d_A returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+
+
+
+
+    cudaStat = cudaMalloc ((void**)&d_S  , sizeof(float) * n);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_S returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    cudaStat = cudaMalloc ((void**)&d_U  , sizeof(float) * m * m);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_U returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    cudaStat = cudaMalloc ((void**)&d_VT  , sizeof(float) * n * n);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_VT returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    
+    cudaStat = cudaMalloc ((void**)&devInfo, sizeof(int));
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc devInfo returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    lda = m;
+    ldu = m;
+    ldvt = n;
+    cusolver_status = cusolverDnSgesvd_bufferSize(cudenseH, m, n, &Lwork );
+    if (cusolver_status != CUSOLVER_STATUS_SUCCESS) {
+        printf ("CUSOLVER DnSgesvd_bufferSize failed\n");
+        return EXIT_FAILURE;
+    }
+
+    cudaStat = cudaMalloc((void**)&d_Work, sizeof(float)*Lwork);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_Work returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
     
+    rwork = (float*) malloc(5*sizeof(float)*n);
     
-    if(MAGMAloop_iter == 0)
+ 
+    printf("START GPU COMPUTATION (%d x %d)  buffer size = %d ...", m, n, Lwork);
+    fflush(stdout);
+    cusolverDnSgesvd (cudenseH, 'A', 'A', m, n, d_A, lda, d_S, d_U, ldu, d_VT, ldvt, d_Work, Lwork, NULL, devInfo);
+    printf(" SYNC ");
+    fflush(stdout);
+    cudaStat = cudaDeviceSynchronize();
+    printf(" DONE\n");
+    fflush(stdout);
+
+    cudaStat = cudaMemcpy(&info_gpu, devInfo, sizeof(int), cudaMemcpyDeviceToHost);
+    printf("after gesvd: info_gpu = %d\n", info_gpu);
+
+ 
+    ID_VTmatrix = create_2Dimage_ID(ID_VTmatrix_name, n, n);
+    cudaStat = cudaMemcpy(data.image[ID_VTmatrix].array.F, d_VT, sizeof(float)*n*n, cudaMemcpyDeviceToHost);
+    if (cudaStat != cudaSuccess)
     {
-        if(MAGMAfloat==1)
-        {
-            TESTING_MALLOC_CPU( magma_iwork,  magma_int_t, magma_liwork );
-            TESTING_MALLOC_PIN( magmaf_h_work, float, magma_lwork  );
-            TESTING_MALLOC_CPU( magmaf_w1,     float,             N      );
-            TESTING_MALLOC_PIN( magmaf_h_R,    float, N*N  );
-        }
-        else
-        {
-            TESTING_MALLOC_CPU( magma_iwork,  magma_int_t, magma_liwork );
-            TESTING_MALLOC_PIN( magma_h_work, double, magma_lwork  );
-            TESTING_MALLOC_CPU( magma_w1,     double,             N      );
-            TESTING_MALLOC_PIN( magma_h_R,    double, N*N  );
-        }
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+   
+   save_fits(ID_VTmatrix_name, "!matVT0.fits");
+  
+  
+     Sarray = (float*) malloc(sizeof(float)*n);
+    //    Aarray = (float*) malloc(sizeof(float)*m*n);
+    cudaStat = cudaMemcpy(Sarray, d_S, sizeof(float)*n, cudaMemcpyDeviceToHost);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    sprintf(fname, "eigenv.dat.gsl");
+    if((fp=fopen(fname, "w"))==NULL)
+    {
+        printf("ERROR: cannot create file \"%s\"\n", fname);
+        exit(0);
+    }
+    for(i=0; i<n; i++)
+        fprintf(fp,"%5ld %20g %20g\n", i, Sarray[i], Sarray[i]/Sarray[0]);
+    fclose(fp);
+
+
+
+    ID = create_2Dimage_ID("matU", m, m);
+    cudaMemcpy(data.image[ID].array.F, d_U, sizeof(float)*m*m, cudaMemcpyDeviceToHost);
+    save_fits("matU", "!matU.fits");
+  
+    h_U1 = (float*) malloc(sizeof(float)*m*n);
+    cudaStat = cudaMalloc((void**)&d_U1, sizeof(float)*m*n);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_U1 returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
+    for(ii=0;ii<m;ii++)
+        for(jj=0;jj<n;jj++)
+            h_U1[jj*m+ii] = data.image[ID].array.F[jj*m+ii];
+    cudaMemcpy(d_U1, h_U1, sizeof(float)*m*n, cudaMemcpyHostToDevice);
+    free(h_U1);
+    
+    ID = create_2Dimage_ID("matU1", m, n);
+    cudaMemcpy(data.image[ID].array.F, d_U1, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
+    save_fits("matU1", "!matU1.fits");
 
 
    
+   
+    printf("SVDeps = %f\n", SVDeps);
+    cnt0 = 0;
+    // multiply lines of VT by 1/eigenval
+    for(ii=0;ii<n;ii++)
+    {
+        if( Sarray[ii] > Sarray[0]*SVDeps )
+            {
+                val = 1.0/(Sarray[ii]);
+                cnt0++;
+            }
+        else
+            val = 0.0;
+        
+        for(jj=0;jj<n;jj++)
+             data.image[ID_VTmatrix].array.F[jj*n+ii] *= val;
+    }
+    printf("%ld eigenvalues kept\n", cnt0);
     
+    // copy VT back to GPU
+   cudaStat = cudaMemcpy(d_VT, data.image[ID_VTmatrix].array.F, sizeof(float)*n*n, cudaMemcpyHostToDevice);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
     
     
-    if(MAGMAfloat==1)
+    cudaStat = cudaMalloc((void**)&d_M, sizeof(float)*n*m);
+    if (cudaStat != cudaSuccess)
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_ssyevd_gpu -> ");
-			fflush(stdout);
-		}
-		
-		// SSYEVD computes all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A
-		if(magmaXmode==1)
-			magma_ssyevdx_gpu( MagmaVec, MagmaRangeI, MagmaLower, N, magmaf_d_AtA, N, 0.0, 1.0, N-MaxNBmodes, N, &mout, magmaf_w1, magmaf_h_R, N, magmaf_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
-		else
-			magma_ssyevd_gpu( MagmaVec,               MagmaLower, N, magmaf_d_AtA, N,                        magmaf_w1, magmaf_h_R, N, magmaf_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
-				
-		
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" DONE\n");
-			fflush(stdout);
-		}
-	}
+        printf("cudaMalloc d_M returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    
+ 
+    save_fits(ID_VTmatrix_name, "!matVT.fits");
+ 
+    cudaStat = cublasSgemm(cublasH, CUBLAS_OP_T, CUBLAS_OP_T, n, m, n, &alpha, d_VT, n, d_U, m, &beta, d_M, n);
+     if (cudaStat != cudaSuccess)
+    {
+        printf("cublasSgemm returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+     
+
+	arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[2] = n;
+    }
     else
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_dsyevd_gpu -> ");  
-			fflush(stdout);
-        }
-        // CODE CAN HANG HERE - THIS HAPPENS ONCE OUT OF multiple 1000s EXECUTIONS WHEN RUNNING IN A LOOP.. SEEMS TO BE A MAGMA ISSUE
-        
-        // SSYEVD computes all eigenvalues and, optionally, eigenvectors of a real symmetric matrix A
-        magma_dsyevd_gpu( MagmaVec, MagmaLower, N, magma_d_AtA, N, magma_w1, magma_h_R, N, magma_h_work, magma_lwork, magma_iwork, magma_liwork, &info );
-		
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" DONE\n");
-			fflush(stdout);
-		}
-	}
+        arraysizetmp[0] = m;
+        arraysizetmp[1] = n;
+    }
 
-    if(LOOPmode == 0)
+    
+    ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+    
+    
+ //   cudaStat = cudaMemcpy(data.image[ID_Cmatrix].array.F, d_M, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
+    
+    h_M = (float*) malloc(sizeof(float)*m*n);
+    cudaStat = cudaMemcpy(h_M, d_M, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
+    for(ii=0;ii<m;ii++)
+        for(jj=0;jj<n;jj++)
+            data.image[ID_Cmatrix].array.F[jj*m+ii] = h_M[ii*n+jj];
+    
+    //cudaStat = cudaMemcpy(data.image[ID_Cmatrix].array.F, d_VT, sizeof(float)*n*n, cudaMemcpyDeviceToHost);
+    if (cudaStat != cudaSuccess)
     {
-        TESTING_FREE_CPU( magma_iwork  );
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        free(arraysizetmp);
+        exit(EXIT_FAILURE);
+    }
+    
 
-        if(MAGMAfloat==1)
-            TESTING_FREE_PIN( magmaf_h_R    );
-        else
-            TESTING_FREE_PIN( magma_h_R    );
 
-		if(MAGMAfloat==1)
-			TESTING_FREE_PIN( magma_h_work );
-		else
-			TESTING_FREE_PIN( magmaf_h_work );
-    }
+    cudaFree(d_A);
+    cudaFree(d_S);
+    cudaFree(d_U);
+    cudaFree(d_VT);
+    cudaFree(d_Work);
+    cudaFree(devInfo);
+    cudaFree(d_M);
+    cudaFree(d_U1);
 
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    time2sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
 
+    printf("time = %8.3f s\n", 1.0*(time2sec-time1sec));
 
 
-    //if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t5);
 
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("Write eigenvalues to file\n");
-		fflush(stdout);
-    }
+    if (cublasH ) cublasDestroy(cublasH);
+    if (cudenseH) cusolverDnDestroy(cudenseH);
+
+    cudaDeviceReset();
+
+    free(arraysizetmp);
+    free(Sarray);
+    free(rwork);
+    free(h_A);
+    free(h_M);
     
-    sprintf(fname, "eigenv.dat");
-    if((fp=fopen(fname, "w"))==NULL)
-    {
-        printf("ERROR: cannot create file \"%s\"\n", fname);
-        exit(0);
-    }
-    if(MAGMAfloat==1)
+    
+    return(0);
+}
+
+
+
+
+/**
+ * @brief Orthonormalize columns of device matrix (m x n, column-major, m >= n) in place: thin QR, Q kept
+ */
+static int CUDACOMP_randSVD_orth(cusolverDnHandle_t cudenseH, float *d_A, int m, int n, float *d_tau, int *devInfo)
+{
+    float *d_Work = NULL;
+    int Lwork, Lwork1;
+    cudaError_t cudaStat;
+
+    cusolverDnSgeqrf_bufferSize(cudenseH, m, n, d_A, m, &Lwork);
+    cusolverDnSorgqr_bufferSize(cudenseH, m, n, n, d_A, m, d_tau, &Lwork1);
+    if(Lwork1 > Lwork)
+        Lwork = Lwork1;
+
+    cudaStat = cudaMalloc((void**)&d_Work, sizeof(float)*Lwork);
+    if (cudaStat != cudaSuccess)
     {
-        for(k=0; k<N; k++)
-            fprintf(fp,"%5ld %20.8g  %20.8f  %20.8f\n", k, magmaf_w1[N-k-1], magmaf_w1[N-k-1]/magmaf_w1[N-1], SVDeps*SVDeps);
+        printf("cudaMalloc d_Work returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
-    else
+    if((cusolverDnSgeqrf(cudenseH, m, n, d_A, m, d_tau, d_Work, Lwork, devInfo) != CUSOLVER_STATUS_SUCCESS)
+            ||(cusolverDnSorgqr(cudenseH, m, n, n, d_A, m, d_tau, d_Work, Lwork, devInfo) != CUSOLVER_STATUS_SUCCESS))
     {
-        for(k=0; k<N; k++)
-            fprintf(fp,"%5ld %20.8g  %20.8f  %20.8f\n", k, magma_w1[N-k-1], magma_w1[N-k-1]/magma_w1[N-1], SVDeps*SVDeps);
+        printf("CUSOLVER QR factorization failed, line(%d)\n", __LINE__);
+        exit(EXIT_FAILURE);
     }
-    fclose(fp);
+    cudaFree(d_Work);
 
+    return(0);
+}
 
-	/// w1 values are the EIGENVALUES of AT A
-	/// Note: w1 values are the SQUARE of the singular values of A 
 
 
-	// ****************************************************    
-	// STEP 5 :   Set eigenvalue limit
-	// ****************************************************    
-	
-	if(MAGMAfloat==1)
-		egvlim = SVDeps*SVDeps* magmaf_w1[N-1];
-    else
-    	egvlim = SVDeps*SVDeps* magma_w1[N-1];
-    
-    MaxNBmodes1 = MaxNBmodes;
-    if(MaxNBmodes1>N)
-        MaxNBmodes1 = N;
-    if(MaxNBmodes1>M)
-        MaxNBmodes1 = M;
-    mode = 0;
-    
-    if(MAGMAfloat==1)
-    {
-		while( (mode<MaxNBmodes1) && (magmaf_w1[N-mode-1]>egvlim) )
-			mode++;
-    }
-    else
-    {
-		while( (mode<MaxNBmodes1) && (magma_w1[N-mode-1]>egvlim) )
-			mode++;
-	}
-	
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("Keeping %ld modes  (SVDeps = %g -> %g, MaxNBmodes = %ld -> %ld)\n", mode, SVDeps, egvlim, MaxNBmodes, MaxNBmodes1);
-		fflush(stdout);
-	}
-	
-    fp = fopen("SVDmodes.log", "w");
-    fprintf(fp, "%6ld %6ld\n", mode, MaxNBmodes1);
-    fclose(fp);
-    MaxNBmodes1 = mode;
-    //printf("Keeping %ld modes  (SVDeps = %g)\n", MaxNBmodes1, SVDeps);
 
+//
+// Computes control matrix from truncated SVD, randomized range finder
+// Conventions as GPU_SVD_computeControlMatrix:
+//   n: number of actuators (= NB_MODES)
+//   m: number of sensors  (= # of pixels)
+// Response matrix columns are split across GPUs; range basis Q is computed on first GPU
+//
+int CUDACOMP_randSVD_computeControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long NBmodes, long oversample, int NBpowiter, int NBGPU, const char *ID_VTmatrix_name)
+{
+    cusolverDnHandle_t cudenseH = NULL;
+    cublasHandle_t *cublasH;
+    cudaError_t cudaStat = cudaSuccess;
+    long ID_Rmatrix, ID_Cmatrix, ID_VTmatrix;
+    uint32_t *arraysizetmp;
+    int m, n, l, k;
+    int g;
+    int iter;
+    int *GPUdev;
+    int *noff;
+    int *nsize;
+
+    float **d_A;      // per GPU: columns noff .. noff+nsize-1 of response matrix
+    float **d_Y;      // per GPU: m x l partial range sample
+    float **d_Q;      // per GPU: copy of m x l range basis
+    float **d_Z;      // per GPU: copy of n x l co-range basis
+    float *d_Ytmp = NULL;
+    float *d_Bt = NULL;      // l x n   B = Q^T A
+    float *d_tau = NULL;
+    float *d_S = NULL;
+    float *d_Ub = NULL;      // n x l   left singular vectors of B^T = right singular vectors of A
+    float *d_VTb = NULL;     // l x l
+    float *d_UA = NULL;      // m x l   left singular vectors of A
+    float *d_M = NULL;       // m x n   control matrix
+    float *d_Work = NULL;
+    int *devInfo = NULL;
+    int Lwork;
+    int info_gpu;
 
-	// ****************************************************    
-	// STEP 6 :   Write eigenvectors to VT matrix
-	// ****************************************************    
-	
-	// eigenvectors are in magma_d_AtA (device), copy them to magma_h_AtA (host)
+    float *h_Omega;
+    float *Sarray;
+    float *invS;
+    float alpha = 1.0;
+    float beta = 0.0;
+    float normA, normAg;
+    double resid2;
+    long ii, jj;
+    long cnt0;
+    FILE *fp;
+    double time1sec, time2sec;
+    struct timespec tnow;
 
-    if(MAGMAfloat==1)
-        magma_sgetmatrix( N, N, magmaf_d_AtA, N, magmaf_h_AtA, N, magmaqueue);
-    else
-        magma_dgetmatrix( N, N, magma_d_AtA, N, magma_h_AtA, N, magmaqueue);
 
 
-	// copy eigenvectors from magma_h_AtA to VT
-    ID_VT = create_2Dimage_ID(ID_VTmatrix_name, N, N);
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    time1sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
 
-    if(MAGMAfloat==1)
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    if(ID_Rmatrix == -1)
     {
-        for(ii=0; ii<N; ii++)
-            for(jj=0; jj<N; jj++)
-                data.image[ID_VT].array.F[jj*N+ii] = magmaf_h_AtA[(N-ii-1)*N+jj];
+        printERROR(__FILE__, __func__, __LINE__, "response matrix does not exist");
+        return(-1);
     }
-    else
+    if(data.image[ID_Rmatrix].md[0].atype!=_DATATYPE_FLOAT)
     {
-        for(ii=0; ii<N; ii++)
-            for(jj=0; jj<N; jj++)
-                data.image[ID_VT].array.F[jj*N+ii] = magma_h_AtA[(N-ii-1)*N+jj];
+        printf("wrong type\n");
+        exit(0);
     }
-
-
-	// ****************************************************    
-	// STEP 7 :   Write eigenvectors/eigenvalue to magma_h_VT1 if eigenvalue > limit
-	//          Copy to magma_d_VT1
-	// ****************************************************   
-
-    if(MAGMAfloat==1)
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
     {
-        for(ii=0; ii<N; ii++)
-            for(jj=0; jj<N; jj++)
-            {
-                if(N-jj-1<MaxNBmodes1)
-                    magmaf_h_VT1[ii*N+jj] = magmaf_h_AtA[jj*N+ii]/magmaf_w1[jj];
-                else
-                    magmaf_h_VT1[ii*N+jj] = 0.0;
-            }
-        magma_ssetmatrix( N, N, magmaf_h_VT1, N, magmaf_d_VT1, N, magmaqueue);
+        m = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        n = data.image[ID_Rmatrix].md[0].size[2];
     }
     else
     {
-        for(ii=0; ii<N; ii++)
-            for(jj=0; jj<N; jj++)
-            {
-                if(N-jj-1<MaxNBmodes1)
-                    magma_h_VT1[ii*N+jj] = magma_h_AtA[jj*N+ii]/magma_w1[jj];
-                else
-                    magma_h_VT1[ii*N+jj] = 0.0;
-            }
-        magma_dsetmatrix( N, N, magma_h_VT1, N, magma_d_VT1, N, magmaqueue);
+        m = data.image[ID_Rmatrix].md[0].size[0];
+        n = data.image[ID_Rmatrix].md[0].size[1];
     }
 
+    k = (NBmodes < 1) ? n : NBmodes;
+    if(k > n)
+        k = n;
+    l = k + oversample;
+    if(l > n)
+        l = n;
+    if(l > m)
+        l = m;
+    if(k > l)
+        k = l;
 
-    if(LOOPmode == 0)
+    cudaGetDeviceCount(&deviceCount);
+    if(NBGPU < 1)
+        NBGPU = 1;
+    if(NBGPU > deviceCount)
+        NBGPU = deviceCount;
+    if(NBGPU > n)
+        NBGPU = n;
+
+    printf("Randomized SVD: %d x %d matrix, %d modes + %d oversampling, %d power iterations, %d GPU(s)\n", m, n, k, l-k, NBpowiter, NBGPU);
+    fflush(stdout);
+
+
+    GPUdev = (int*) malloc(sizeof(int)*NBGPU);
+    noff = (int*) malloc(sizeof(int)*NBGPU);
+    nsize = (int*) malloc(sizeof(int)*NBGPU);
+    cublasH = (cublasHandle_t*) malloc(sizeof(cublasHandle_t)*NBGPU);
+    d_A = (float**) malloc(sizeof(float*)*NBGPU);
+    d_Y = (float**) malloc(sizeof(float*)*NBGPU);
+    d_Q = (float**) malloc(sizeof(float*)*NBGPU);
+    d_Z = (float**) malloc(sizeof(float*)*NBGPU);
+
+    // random test matrix, n x l
+    h_Omega = (float*) malloc(sizeof(float)*n*l);
+    for(ii=0; ii<(long) n*l; ii++)
+        h_Omega[ii] = gauss();
+
+    for(g=0; g<NBGPU; g++)
     {
-        if(MAGMAfloat==1)
+        GPUdev[g] = g;
+        noff[g] = (int) ((long) n*g/NBGPU);
+        nsize[g] = (int) ((long) n*(g+1)/NBGPU) - noff[g];
+
+        cudaSetDevice(GPUdev[g]);
+        if(cublasCreate(&cublasH[g]) != CUBLAS_STATUS_SUCCESS)
         {
-            TESTING_FREE_CPU( magmaf_h_VT1 );
-            TESTING_FREE_CPU( magmaf_w1 );
-            TESTING_FREE_CPU( magmaf_h_AtA );
+            printf ("CUBLAS initialization failed\n");
+            return EXIT_FAILURE;
         }
-        else
+        cudaStat = cudaMalloc((void**)&d_A[g], sizeof(float)*m*nsize[g]);
+        if(cudaStat == cudaSuccess)
+            cudaStat = cudaMalloc((void**)&d_Y[g], sizeof(float)*m*l);
+        if(cudaStat == cudaSuccess)
+            cudaStat = cudaMalloc((void**)&d_Q[g], sizeof(float)*m*l);
+        if(cudaStat == cudaSuccess)
+            cudaStat = cudaMalloc((void**)&d_Z[g], sizeof(float)*n*l);
+        if (cudaStat != cudaSuccess)
         {
-            TESTING_FREE_CPU( magma_h_VT1 );
-            TESTING_FREE_CPU( magma_w1 );
-            TESTING_FREE_CPU( magma_h_AtA );
+            printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
         }
+        cudaMemcpy(d_A[g], data.image[ID_Rmatrix].array.F + (long) m*noff[g], sizeof(float)*m*nsize[g], cudaMemcpyHostToDevice);
+        cudaMemcpy(d_Z[g], h_Omega, sizeof(float)*n*l, cudaMemcpyHostToDevice);
     }
+    free(h_Omega);
 
-
-
-    //if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t6);
-
-
-	// ****************************************************    
-	// STEP 8 :   Compute M2 = VT1 VT = (AT A)^-1
-	// ****************************************************    
-
-
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
+    cudaSetDevice(GPUdev[0]);
+    if(cusolverDnCreate(&cudenseH) != CUSOLVER_STATUS_SUCCESS)
     {
-		printf("compute M2 = VT1 VT\n");
-		fflush(stdout);
+        printf ("CUSOLVER initialization failed\n");
+        return EXIT_FAILURE;
     }
-    
-    if(MAGMAfloat==1)
+    cudaStat = cudaMalloc((void**)&d_Ytmp, sizeof(float)*m*l);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_Bt, sizeof(float)*l*n);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_tau, sizeof(float)*l);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&devInfo, sizeof(int));
+    if (cudaStat != cudaSuccess)
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_sgemm ");
-			fflush(stdout);
-        }
-        
-        magma_sgemm(  MagmaTrans, MagmaTrans, N, N, N, 1.0, magmaf_d_VT1, N, magmaf_d_AtA, N, 0.0,  magmaf_d_M2, N, magmaqueue);
-
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("-> DONE\n");
-			fflush(stdout);
-		}
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
-    else
+
+    // |A|_F (for residual)
+    normA = 0.0;
+    for(g=0; g<NBGPU; g++)
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_dgemm ");
-			fflush(stdout);
-        }
-        
-	    magma_dgemm(  MagmaTrans, MagmaTrans, N, N, N, 1.0, magma_d_VT1, N, magma_d_AtA, N, 0.0,  magma_d_M2, N, magmaqueue);
+        cudaSetDevice(GPUdev[g]);
+        cublasSnrm2(cublasH[g], m*nsize[g], d_A[g], 1, &normAg);
+        normA += normAg*normAg;
+    }
+    normA = sqrt(normA);
 
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("-> DONE\n");
-			fflush(stdout);
-		}
-	}
 
-    if(testmode == 1)
+    for(iter=0; iter<=NBpowiter; iter++)
     {
-		 long ID_M2;
-		    
-        ID_M2 = create_2Dimage_ID("mM2", N, N);
-        if(MAGMAfloat==1)
+        // Y = A Z = sum over GPUs of A_g Z_g  (Z = Omega at first iteration)
+        for(g=0; g<NBGPU; g++)
         {
-            TESTING_MALLOC_CPU( magmaf_h_M2, float, N*N);
-            magma_sgetmatrix( N, N, magmaf_d_M2, N, magmaf_h_M2, N, magmaqueue);
-
-            for(ii=0; ii<N; ii++)
-                for(jj=0; jj<N; jj++)
-                    data.image[ID_M2].array.F[jj*N+ii] = magmaf_h_M2[jj*N+ii];
+            cudaSetDevice(GPUdev[g]);
+            cublasSgemm(cublasH[g], CUBLAS_OP_N, CUBLAS_OP_N, m, l, nsize[g], &alpha, d_A[g], m, d_Z[g]+noff[g], n, &beta, d_Y[g], m);
         }
-        else
+        cudaSetDevice(GPUdev[0]);
+        for(g=1; g<NBGPU; g++)
         {
-            TESTING_MALLOC_CPU( magma_h_M2, double, N*N);
-            magma_dgetmatrix( N, N, magma_d_M2, N, magma_h_M2, N, magmaqueue);
-
-            for(ii=0; ii<N; ii++)
-                for(jj=0; jj<N; jj++)
-                    data.image[ID_M2].array.F[jj*N+ii] = magma_h_M2[jj*N+ii];
+            cudaMemcpyPeer(d_Ytmp, GPUdev[0], d_Y[g], GPUdev[g], sizeof(float)*m*l);
+            cublasSaxpy(cublasH[0], m*l, &alpha, d_Ytmp, 1, d_Y[0], 1);
         }
 
-        save_fits("mM2", "!test_mM2.fits");
-
-
-        //	magma_dsetmatrix( N, N, h_M2, N, d_M2, N, magmaqueue);
-        if(MAGMAfloat==1)
-            TESTING_FREE_CPU( magmaf_h_M2 );
-        else
-            TESTING_FREE_CPU( magma_h_M2 );
-    }
+        // Q = orth(Y), broadcast
+        CUDACOMP_randSVD_orth(cudenseH, d_Y[0], m, l, d_tau, devInfo);
+        cudaMemcpy(d_Q[0], d_Y[0], sizeof(float)*m*l, cudaMemcpyDeviceToDevice);
+        for(g=1; g<NBGPU; g++)
+            cudaMemcpyPeer(d_Q[g], GPUdev[g], d_Q[0], GPUdev[0], sizeof(float)*m*l);
 
-    if(LOOPmode == 0)
-    {
-        if(MAGMAfloat==1)
+        // B = Q^T A: each GPU computes its block of columns, gathered on first GPU
+        for(g=0; g<NBGPU; g++)
         {
-            TESTING_FREE_DEV( magmaf_d_VT1 );
-            TESTING_FREE_DEV( magmaf_d_AtA );
+            cudaSetDevice(GPUdev[g]);
+            cublasSgemm(cublasH[g], CUBLAS_OP_T, CUBLAS_OP_N, l, nsize[g], m, &alpha, d_Q[g], m, d_A[g], m, &beta, d_Z[g], l);
         }
-        else
+        cudaSetDevice(GPUdev[0]);
+        cudaMemcpy(d_Bt, d_Z[0], sizeof(float)*l*nsize[0], cudaMemcpyDeviceToDevice);
+        for(g=1; g<NBGPU; g++)
+            cudaMemcpyPeer(d_Bt + (long) l*noff[g], GPUdev[0], d_Z[g], GPUdev[g], sizeof(float)*l*nsize[g]);
+
+        // Z = B^T  (n x l)
+        cublasSgeam(cublasH[0], CUBLAS_OP_T, CUBLAS_OP_N, n, l, &alpha, d_Bt, l, &beta, d_Z[0], n, d_Z[0], n);
+
+        if(iter < NBpowiter)  // power iteration: Z = orth(A^T Q), broadcast
         {
-            TESTING_FREE_DEV( magma_d_VT1 );
-            TESTING_FREE_DEV( magma_d_AtA );
+            CUDACOMP_randSVD_orth(cudenseH, d_Z[0], n, l, d_tau, devInfo);
+            for(g=1; g<NBGPU; g++)
+                cudaMemcpyPeer(d_Z[g], GPUdev[g], d_Z[0], GPUdev[0], sizeof(float)*n*l);
         }
+        printf("  iteration %d / %d done\n", iter, NBpowiter);
+        fflush(stdout);
     }
 
- 
 
+    // SVD of B^T = Ub S VTb  ->  A = (Q VTb^T) S Ub^T
+    cudaSetDevice(GPUdev[0]);
+    cudaStat = cudaMalloc((void**)&d_S, sizeof(float)*l);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_Ub, sizeof(float)*n*l);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_VTb, sizeof(float)*l*l);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_UA, sizeof(float)*m*l);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cusolverDnSgesvd_bufferSize(cudenseH, n, l, &Lwork);
+    cudaStat = cudaMalloc((void**)&d_Work, sizeof(float)*Lwork);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_Work returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cusolverDnSgesvd(cudenseH, 'S', 'S', n, l, d_Z[0], n, d_S, d_Ub, n, d_VTb, l, d_Work, Lwork, NULL, devInfo);
+    cudaMemcpy(&info_gpu, devInfo, sizeof(int), cudaMemcpyDeviceToHost);
+    if(info_gpu != 0)
+        printf("WARNING: gesvd info_gpu = %d\n", info_gpu);
+    cudaFree(d_Work);
 
-	// ****************************************************    
-	// STEP 9 :   Compute Ainv = M2 A = (AT A)^-1 A 
-	// ****************************************************    
+    cublasSgemm(cublasH[0], CUBLAS_OP_N, CUBLAS_OP_T, m, l, l, &alpha, d_Q[0], m, d_VTb, l, &beta, d_UA, m);
 
 
-    // compute Ainv = M2 A
-    if(MAGMAloop_iter==0)
-    {
-        if(MAGMAfloat==1)
-        {
-            TESTING_MALLOC_DEV( magmaf_d_Ainv, float, N*M);
-        }
-        else
+    // truncation: k modes max, and SVDeps relative to first singular value
+    Sarray = (float*) malloc(sizeof(float)*l);
+    invS = (float*) malloc(sizeof(float)*l);
+    cudaMemcpy(Sarray, d_S, sizeof(float)*l, cudaMemcpyDeviceToHost);
+    cnt0 = 0;
+    resid2 = 1.0*normA*normA;
+    for(ii=0; ii<l; ii++)
+    {
+        if((ii < k)&&(Sarray[ii] > Sarray[0]*SVDeps))
         {
-            TESTING_MALLOC_DEV( magma_d_Ainv, double, N*M);
+            invS[ii] = 1.0/Sarray[ii];
+            resid2 -= 1.0*Sarray[ii]*Sarray[ii];
+            cnt0++;
         }
+        else
+            invS[ii] = 0.0;
     }
+    if(resid2 < 0.0)
+        resid2 = 0.0;
+    printf("%ld modes kept\n", cnt0);
+    printf("relative residual |A - U S VT|_F / |A|_F = %g\n", sqrt(resid2)/normA);
 
-    if(MAGMAfloat==1)
+    if((fp=fopen("eigenv.dat.rsvd", "w"))==NULL)
     {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_sgemm ");
-			fflush(stdout);
-        }
-        
-        magma_sgemm(  MagmaNoTrans, MagmaNoTrans, M, N, N, 1.0, magmaf_d_A, M, magmaf_d_M2, N, 0.0, magmaf_d_Ainv, M, magmaqueue);
-		
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("-> DONE\n");
-			fflush(stdout);
-		}
+        printf("ERROR: cannot create file \"eigenv.dat.rsvd\"\n");
+        exit(0);
     }
-    else
-    {
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf(" -> magma_dgemm ");
-			fflush(stdout);
-        }
-        
-        magma_dgemm(  MagmaNoTrans, MagmaNoTrans, M, N, N, 1.0, magma_d_A, M, magma_d_M2, N, 0.0, magma_d_Ainv, M, magmaqueue);
-		
-		if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-		{
-			printf("-> DONE\n");
-			fflush(stdout);	
-		}
-	}
+    for(ii=0; ii<l; ii++)
+        fprintf(fp,"%5ld %20g %20g\n", ii, Sarray[ii], Sarray[ii]/Sarray[0]);
+    fclose(fp);
 
-    if(LOOPmode==0)
+    if(strcmp(ID_VTmatrix_name, "NULL") != 0) // right singular vectors, n x modes
     {
-        if(MAGMAfloat==1)
-			TESTING_FREE_DEV( magmaf_d_A);
-        else
-            TESTING_FREE_DEV( magma_d_A);
-	}
+        ID_VTmatrix = create_2Dimage_ID(ID_VTmatrix_name, n, cnt0);
+        cudaMemcpy(data.image[ID_VTmatrix].array.F, d_Ub, sizeof(float)*n*cnt0, cudaMemcpyDeviceToHost);
+    }
 
+    // control matrix (m x n, same layout as input):  M = UA S^-1 Ub^T
+    cudaMemcpy(d_S, invS, sizeof(float)*l, cudaMemcpyHostToDevice);
+    cublasSdgmm(cublasH[0], CUBLAS_SIDE_RIGHT, m, l, d_UA, m, d_S, 1, d_UA, m);
+    cudaStat = cudaMalloc((void**)&d_M, sizeof(float)*m*n);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_M returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    if(cnt0 > 0)
+        cublasSgemm(cublasH[0], CUBLAS_OP_N, CUBLAS_OP_T, m, n, cnt0, &alpha, d_UA, m, d_Ub, n, &beta, d_M, m);
+    else
+        cudaMemset(d_M, 0, sizeof(float)*m*n);
 
-    if(MAGMAloop_iter==0)
+    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
     {
-        if(MAGMAfloat==1)
-		{
-			TESTING_MALLOC_CPU( magmaf_h_Ainv, float, N*M);
-		}
-        else
-		{
-			TESTING_MALLOC_CPU( magma_h_Ainv, double, N*M);
-		}
+        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[2] = n;
+    }
+    else
+    {
+        arraysizetmp[0] = m;
+        arraysizetmp[1] = n;
+    }
+    ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+    free(arraysizetmp);
+    cudaStat = cudaMemcpy(data.image[ID_Cmatrix].array.F, d_M, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
 
-    if(LOOPmode==0)
+
+    cudaFree(d_Ytmp);
+    cudaFree(d_Bt);
+    cudaFree(d_tau);
+    cudaFree(devInfo);
+    cudaFree(d_S);
+    cudaFree(d_Ub);
+    cudaFree(d_VTb);
+    cudaFree(d_UA);
+    cudaFree(d_M);
+    if (cudenseH) cusolverDnDestroy(cudenseH);
+    for(g=0; g<NBGPU; g++)
     {
-        if(MAGMAfloat==1)
-         {
-		   TESTING_FREE_DEV( magmaf_d_M2 );
-        }
-        else
-        {    
-			TESTING_FREE_DEV( magma_d_M2 );
-		}
+        cudaSetDevice(GPUdev[g]);
+        cudaFree(d_A[g]);
+        cudaFree(d_Y[g]);
+        cudaFree(d_Q[g]);
+        cudaFree(d_Z[g]);
+        cublasDestroy(cublasH[g]);
     }
 
+    clock_gettime(CLOCK_REALTIME, &tnow);
+    time2sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
+    printf("time = %8.3f s\n", 1.0*(time2sec-time1sec));
 
+    free(GPUdev);
+    free(noff);
+    free(nsize);
+    free(cublasH);
+    free(d_A);
+    free(d_Y);
+    free(d_Q);
+    free(d_Z);
+    free(Sarray);
+    free(invS);
 
+    return(0);
+}
 
-    //if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t7);
 
-    if(MAGMAfloat==1)
-        magma_sgetmatrix( M, N, magmaf_d_Ainv, M, magmaf_h_Ainv, M, magmaqueue);
-    else
-        magma_dgetmatrix( M, N, magma_d_Ainv, M, magma_h_Ainv, M, magmaqueue);
 
 
-    if(testmode == 1)
+/**
+ * @brief Stream row panels of host matrix A (M x N, column-major) through GPUs (out-of-core pseudo-inverse)
+ *
+ * Panel p (rows p*Mp ... ) is processed by GPU p % NBGPU. On each GPU, two panel buffers are used:
+ * upload of next panel (copy stream) overlaps with computation on current panel (compute stream).\n
+ * mode 0 : d_AtA[g] += A_p^T A_p          (lower triangle, syrk)\n
+ * mode 1 : Cmat_p = A_p x d_AtA[g]        (d_AtA[g] holds M2 = (AT A)^-1), result written to h_C
+ */
+static int CUDACOMP_OOC_panels(int mode, int NBGPU, cublasHandle_t *cublasH, cudaStream_t *scopy, cudaStream_t *scomp, cudaEvent_t *evup, cudaEvent_t *evdone,
+                               float **d_pan, float **d_out, float **d_AtA, float *h_A, float *h_C, long M, long N, long Mp)
+{
+    long p, NBpanel;
+    long row0, rows;
+    int g, b;
+    float alpha = 1.0;
+    float beta = 0.0;
+    float beta1 = 1.0;
+
+    NBpanel = (M + Mp - 1)/Mp;
+    for(p=0; p<NBpanel; p++)
     {
-        ID_Ainv = create_2Dimage_ID("mAinv", M, N);
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<M; ii++)
-                for(jj=0; jj<N; jj++)
-                    data.image[ID_Ainv].array.F[jj*M+ii] = magmaf_h_Ainv[jj*M+ii];
-        }
+        g = p % NBGPU;
+        b = (int) ((p/NBGPU) % 2);
+        row0 = p*Mp;
+        rows = (row0 + Mp > M) ? M - row0 : Mp;
+
+        cudaSetDevice(g);
+        // buffer b is free once its previous panel has been processed
+        cudaStreamWaitEvent(scopy[g], evdone[2*g+b], 0);
+        cudaMemcpy2DAsync(d_pan[2*g+b], sizeof(float)*Mp, h_A + row0, sizeof(float)*M, sizeof(float)*rows, N, cudaMemcpyHostToDevice, scopy[g]);
+        cudaEventRecord(evup[2*g+b], scopy[g]);
+
+        cudaStreamWaitEvent(scomp[g], evup[2*g+b], 0);
+        if(mode == 0)
+            cublasSsyrk(cublasH[g], CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_T, N, rows, &alpha, d_pan[2*g+b], Mp, &beta1, d_AtA[g], N);
         else
         {
-            for(ii=0; ii<M; ii++)
-                for(jj=0; jj<N; jj++)
-                    data.image[ID_Ainv].array.F[jj*M+ii] = magma_h_Ainv[jj*M+ii];
+            cublasSgemm(cublasH[g], CUBLAS_OP_N, CUBLAS_OP_N, rows, N, N, &alpha, d_pan[2*g+b], Mp, d_AtA[g], N, &beta, d_out[2*g+b], Mp);
+            cudaMemcpy2DAsync(h_C + row0, sizeof(float)*M, d_out[2*g+b], sizeof(float)*Mp, sizeof(float)*rows, N, cudaMemcpyDeviceToHost, scomp[g]);
         }
-        save_fits("mAinv", "!test_mAinv.fits");
+        cudaEventRecord(evdone[2*g+b], scomp[g]);
     }
 
-    //if(timing==1)
-     clock_gettime(CLOCK_REALTIME, &t8);
+    for(g=0; g<NBGPU; g++)
+    {
+        cudaSetDevice(g);
+        cudaStreamSynchronize(scomp[g]);
+    }
+
+    return(0);
+}
 
 
-    if(MAGMAloop_iter==0)
+
+
+//
+// Computes pseudo-inverse of matrix larger than GPU memory
+// Same algorithm as CUDACOMP_magma_compute_SVDpseudoInverse: Ainv = A (AT A)^-1, with truncated eigen-decomposition of AT A
+// Only N x N matrices (AT A, eigenvectors) are fully resident on GPU; A and Ainv are streamed in row panels
+//
+int CUDACOMP_OOC_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, int NBGPU, long panelsize)
+{
+    long ID_Rmatrix, ID_Cmatrix;
+    long M, N, Mp;
+    long ii;
+    int g, b;
+    uint32_t *arraysizetmp;
+    cusolverDnHandle_t cudenseH = NULL;
+    cublasHandle_t *cublasH;
+    cudaStream_t *scopy, *scomp;
+    cudaEvent_t *evup, *evdone;
+    cudaError_t cudaStat = cudaSuccess;
+    int inpinned, outpinned;
+
+    float **d_pan;
+    float **d_out;
+    float **d_AtA;
+    float *d_tmp = NULL;
+    float *d_W = NULL;
+    float *d_VT1 = NULL;
+    float *d_Work = NULL;
+    int *devInfo = NULL;
+    int Lwork;
+    int info_gpu;
+    float *w1;
+    float *invw;
+    float alpha = 1.0;
+    float beta = 0.0;
+    double egvlim;
+    long MaxNBmodes1, mode;
+    FILE *fp;
+    struct timespec t0, t1, t2, t3;
+
+
+
+    clock_gettime(CLOCK_REALTIME, &t0);
+
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    if(ID_Rmatrix == -1)
     {
-        if(data.image[ID_Rmatrix].md[0].naxis==3)
-        {
-            arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
-            arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
-            arraysizetmp[2] = N;
-        }
-        else
-        {
-            arraysizetmp[0] = M;
-            arraysizetmp[1] = N;
-        }
+        printERROR(__FILE__, __func__, __LINE__, "response matrix does not exist");
+        return(-1);
+    }
+    if(data.image[ID_Rmatrix].md[0].atype != _DATATYPE_FLOAT)
+    {
+        printf("wrong type\n");
+        exit(0);
+    }
 
-        if(atype==_DATATYPE_FLOAT)
-            ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
-        else
-            ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        M = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        N = data.image[ID_Rmatrix].md[0].size[2];
+        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[2] = N;
     }
     else
-        ID_Cmatrix = image_ID(ID_Cmatrix_name);
+    {
+        M = data.image[ID_Rmatrix].md[0].size[0];
+        N = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[0] = M;
+        arraysizetmp[1] = N;
+    }
 
-	
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("write result\n");
-		fflush(stdout);
+    // output written directly in shared memory
+    ID_Cmatrix = image_ID(ID_Cmatrix_name);
+    if((ID_Cmatrix != -1)&&((data.image[ID_Cmatrix].md[0].nelement != M*N)||(data.image[ID_Cmatrix].md[0].atype != _DATATYPE_FLOAT)))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "existing output image has wrong size or type");
+        free(arraysizetmp);
+        return(-1);
     }
+    if(ID_Cmatrix == -1)
+        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 1, 0);
+    free(arraysizetmp);
 
-    if(atype==_DATATYPE_FLOAT)
+    cudaGetDeviceCount(&deviceCount);
+    if(NBGPU < 1)
+        NBGPU = 1;
+    if(NBGPU > deviceCount)
+        NBGPU = deviceCount;
+    Mp = panelsize;
+    if((Mp < 1)||(Mp > M))
+        Mp = M;
+
+    printf("Out-of-core pseudo-inverse: %ld x %ld matrix, %ld-row panels, %d GPU(s)\n", M, N, Mp, NBGPU);
+    fflush(stdout);
+
+    cublasH = (cublasHandle_t*) malloc(sizeof(cublasHandle_t)*NBGPU);
+    scopy = (cudaStream_t*) malloc(sizeof(cudaStream_t)*NBGPU);
+    scomp = (cudaStream_t*) malloc(sizeof(cudaStream_t)*NBGPU);
+    evup = (cudaEvent_t*) malloc(sizeof(cudaEvent_t)*2*NBGPU);
+    evdone = (cudaEvent_t*) malloc(sizeof(cudaEvent_t)*2*NBGPU);
+    d_pan = (float**) malloc(sizeof(float*)*2*NBGPU);
+    d_out = (float**) malloc(sizeof(float*)*2*NBGPU);
+    d_AtA = (float**) malloc(sizeof(float*)*NBGPU);
+
+    for(g=0; g<NBGPU; g++)
     {
-        if(MAGMAfloat==1)
-        {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_Cmatrix].array.F[ii] = magmaf_h_Ainv[ii];
-        }
-        else
+        cudaSetDevice(g);
+        if(cublasCreate(&cublasH[g]) != CUBLAS_STATUS_SUCCESS)
         {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_Cmatrix].array.F[ii] = (float) magma_h_Ainv[ii];
+            printf ("CUBLAS initialization failed\n");
+            return EXIT_FAILURE;
         }
-    }
-    else
-    {
-        // sensors : M
-        // actuator modes: N
-        if(MAGMAfloat==1)
+        cudaStreamCreateWithFlags(&scopy[g], cudaStreamNonBlocking);
+        cudaStreamCreateWithFlags(&scomp[g], cudaStreamNonBlocking);
+        cublasSetStream(cublasH[g], scomp[g]);
+
+        cudaStat = cudaMalloc((void**)&d_AtA[g], sizeof(float)*N*N);
+        for(b=0; b<2; b++)
         {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_Cmatrix].array.D[ii] = magmaf_h_Ainv[ii];
+            if(cudaStat == cudaSuccess)
+                cudaStat = cudaMalloc((void**)&d_pan[2*g+b], sizeof(float)*Mp*N);
+            if(cudaStat == cudaSuccess)
+                cudaStat = cudaMalloc((void**)&d_out[2*g+b], sizeof(float)*Mp*N);
+            cudaEventCreateWithFlags(&evup[2*g+b], cudaEventDisableTiming);
+            cudaEventCreateWithFlags(&evdone[2*g+b], cudaEventDisableTiming);
         }
-        else
+        if (cudaStat != cudaSuccess)
         {
-            for(ii=0; ii<M*N; ii++)
-                data.image[ID_Cmatrix].array.D[ii] = magma_h_Ainv[ii];
+            printf("cudaMalloc returned error code %d, line(%d) - reduce panel size\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
         }
+        cudaMemset(d_AtA[g], 0, sizeof(float)*N*N);
+        cudaDeviceSynchronize(); // panels are processed on non-blocking streams
     }
 
+    inpinned = (cudaHostRegister(data.image[ID_Rmatrix].array.F, sizeof(float)*M*N, cudaHostRegisterPortable) == cudaSuccess) ? 1 : 0;
+    outpinned = (cudaHostRegister(data.image[ID_Cmatrix].array.F, sizeof(float)*M*N, cudaHostRegisterPortable) == cudaSuccess) ? 1 : 0;
+    if((inpinned == 0)||(outpinned == 0))
+        printf("WARNING: cannot pin host memory, transfers will not overlap with compute\n");
 
-    //if(timing==1)
-    clock_gettime(CLOCK_REALTIME, &t9);
 
+    // STEP 1 : AT A, accumulated panel-wise on each GPU, summed on first GPU
+    CUDACOMP_OOC_panels(0, NBGPU, cublasH, scopy, scomp, evup, evdone, d_pan, d_out, d_AtA, data.image[ID_Rmatrix].array.F, NULL, M, N, Mp);
 
-    if(LOOPmode==0)
+    cudaSetDevice(0);
+    cudaStat = cudaMalloc((void**)&d_tmp, sizeof(float)*N*N);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_W, sizeof(float)*N);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&devInfo, sizeof(int));
+    if (cudaStat != cudaSuccess)
     {
-        if(MAGMAfloat==1)
-        {
-            TESTING_FREE_DEV( magmaf_d_Ainv );
-            TESTING_FREE_CPU( magmaf_h_Ainv );
-        }
-        else
-        {
-            TESTING_FREE_DEV( magma_d_Ainv );
-            TESTING_FREE_CPU( magma_h_Ainv );
-        }
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for(g=1; g<NBGPU; g++)
+    {
+        cudaMemcpyPeerAsync(d_tmp, 0, d_AtA[g], g, sizeof(float)*N*N, scomp[0]);
+        cublasSaxpy(cublasH[0], N*N, &alpha, d_tmp, 1, d_AtA[0], 1);
     }
+    cudaStreamSynchronize(scomp[0]);
+    clock_gettime(CLOCK_REALTIME, &t1);
 
 
+    // STEP 2 : eigenvalues and eigenvectors of AT A (ascending order)
+    if(cusolverDnCreate(&cudenseH) != CUSOLVER_STATUS_SUCCESS)
+    {
+        printf ("CUSOLVER initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    cusolverDnSetStream(cudenseH, scomp[0]);
+    cusolverDnSsyevd_bufferSize(cudenseH, CUSOLVER_EIG_MODE_VECTOR, CUBLAS_FILL_MODE_LOWER, N, d_AtA[0], N, d_W, &Lwork);
+    cudaStat = cudaMalloc((void**)&d_Work, sizeof(float)*Lwork);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc d_Work returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cusolverDnSsyevd(cudenseH, CUSOLVER_EIG_MODE_VECTOR, CUBLAS_FILL_MODE_LOWER, N, d_AtA[0], N, d_W, d_Work, Lwork, devInfo);
+    cudaStreamSynchronize(scomp[0]);
+    cudaMemcpy(&info_gpu, devInfo, sizeof(int), cudaMemcpyDeviceToHost);
+    if(info_gpu != 0)
+        printf("WARNING: syevd info_gpu = %d\n", info_gpu);
+    cudaFree(d_Work);
+
+    w1 = (float*) malloc(sizeof(float)*N);
+    invw = (float*) malloc(sizeof(float)*N);
+    cudaMemcpy(w1, d_W, sizeof(float)*N, cudaMemcpyDeviceToHost);
 
+    if((fp=fopen("eigenv.dat", "w"))==NULL)
+    {
+        printf("ERROR: cannot create file \"eigenv.dat\"\n");
+        exit(0);
+    }
+    for(ii=0; ii<N; ii++)
+        fprintf(fp, "%5ld %20.8g  %20.8f  %20.8f\n", ii, w1[N-ii-1], w1[N-ii-1]/w1[N-1], SVDeps*SVDeps);
+    fclose(fp);
 
+    // STEP 3 : eigenvalue limit, M2 = V diag(1/w) VT = (AT A)^-1
+    egvlim = SVDeps*SVDeps*w1[N-1];
+    MaxNBmodes1 = MaxNBmodes;
+    if(MaxNBmodes1>N)
+        MaxNBmodes1 = N;
+    if(MaxNBmodes1>M)
+        MaxNBmodes1 = M;
+    mode = 0;
+    while( (mode<MaxNBmodes1) && (w1[N-mode-1]>egvlim) )
+        mode++;
+    printf("Keeping %ld modes  (SVDeps = %g)\n", mode, SVDeps);
+    fflush(stdout);
+    for(ii=0; ii<N; ii++)
+        invw[ii] = (N-ii-1 < mode) ? 1.0/w1[ii] : 0.0;
 
-    if(LOOPmode==0)
+    cudaMemcpyAsync(d_W, invw, sizeof(float)*N, cudaMemcpyHostToDevice, scomp[0]);
+    cudaStat = cudaMalloc((void**)&d_VT1, sizeof(float)*N*N);
+    if (cudaStat != cudaSuccess)
     {
-        magma_queue_destroy( magmaqueue );
-        magma_finalize ();                               //  finalize  Magma
+        printf("cudaMalloc d_VT1 returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cublasSdgmm(cublasH[0], CUBLAS_SIDE_RIGHT, N, N, d_AtA[0], N, d_W, 1, d_VT1, N);
+    cublasSgemm(cublasH[0], CUBLAS_OP_N, CUBLAS_OP_T, N, N, N, &alpha, d_VT1, N, d_AtA[0], N, &beta, d_tmp, N);
+    cudaMemcpyAsync(d_AtA[0], d_tmp, sizeof(float)*N*N, cudaMemcpyDeviceToDevice, scomp[0]);
+    cudaStreamSynchronize(scomp[0]);
+    for(g=1; g<NBGPU; g++)
+    {
+        cudaSetDevice(g);
+        cudaMemcpyPeerAsync(d_AtA[g], g, d_AtA[0], 0, sizeof(float)*N*N, scomp[g]);
     }
+    cudaSetDevice(0);
+    cudaFree(d_VT1);
+    clock_gettime(CLOCK_REALTIME, &t2);
 
-    free(arraysizetmp);
 
+    // STEP 4 : Ainv = A M2, panel-wise, into output image
+    data.image[ID_Cmatrix].md[0].write = 1;
+    CUDACOMP_OOC_panels(1, NBGPU, cublasH, scopy, scomp, evup, evdone, d_pan, d_out, d_AtA, data.image[ID_Rmatrix].array.F, data.image[ID_Cmatrix].array.F, M, N, Mp);
+    COREMOD_MEMORY_image_set_sempost_byID(ID_Cmatrix, -1);
+    data.image[ID_Cmatrix].md[0].cnt0++;
+    data.image[ID_Cmatrix].md[0].write = 0;
+    clock_gettime(CLOCK_REALTIME, &t3);
 
-    //if(timing==1)
-    //{
-        tdiff = info_time_diff(t0, t1);
-        t01d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+    printf("time  AtA %.3f s   eigen %.3f s   back-projection %.3f s\n",
+           1.0*(t1.tv_sec-t0.tv_sec)+1.0e-9*(t1.tv_nsec-t0.tv_nsec),
+           1.0*(t2.tv_sec-t1.tv_sec)+1.0e-9*(t2.tv_nsec-t1.tv_nsec),
+           1.0*(t3.tv_sec-t2.tv_sec)+1.0e-9*(t3.tv_nsec-t2.tv_nsec));
+    fflush(stdout);
 
-        tdiff = info_time_diff(t1, t2);
-        t12d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        tdiff = info_time_diff(t2, t3);
-        t23d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+    if(inpinned == 1)
+        cudaHostUnregister(data.image[ID_Rmatrix].array.F);
+    if(outpinned == 1)
+        cudaHostUnregister(data.image[ID_Cmatrix].array.F);
 
-        tdiff = info_time_diff(t3, t4);
-        t34d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+    cudaSetDevice(0);
+    cudaFree(d_tmp);
+    cudaFree(d_W);
+    cudaFree(devInfo);
+    if (cudenseH) cusolverDnDestroy(cudenseH);
+    for(g=0; g<NBGPU; g++)
+    {
+        cudaSetDevice(g);
+        cudaFree(d_AtA[g]);
+        for(b=0; b<2; b++)
+        {
+            cudaFree(d_pan[2*g+b]);
+            cudaFree(d_out[2*g+b]);
+            cudaEventDestroy(evup[2*g+b]);
+            cudaEventDestroy(evdone[2*g+b]);
+        }
+        cudaStreamDestroy(scopy[g]);
+        cudaStreamDestroy(scomp[g]);
+        cublasDestroy(cublasH[g]);
+    }
+
+    free(cublasH);
+    free(scopy);
+    free(scomp);
+    free(evup);
+    free(evdone);
+    free(d_pan);
+    free(d_out);
+    free(d_AtA);
+    free(w1);
+    free(invw);
 
-        tdiff = info_time_diff(t4, t5);
-        t45d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+    return(0);
+}
 
-        tdiff = info_time_diff(t5, t6);
-        t56d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        tdiff = info_time_diff(t6, t7);
-        t67d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        tdiff = info_time_diff(t7, t8);
-        t78d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        tdiff = info_time_diff(t8, t9);
-        t89d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-        tdiff = info_time_diff(t0, t9);
-        t09d = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-      printf("%6ld  Timing info: \n", MAGMAloop_iter);
-      printf("  0-1	%12.3f ms\n", t01d*1000.0);
-      printf("  1-2	%12.3f ms\n", t12d*1000.0);
-      printf("  2-3	%12.3f ms\n", t23d*1000.0);
-      printf("  3-4	%12.3f ms\n", t34d*1000.0);
-      printf("  4-5	%12.3f ms\n", t45d*1000.0);
-      printf("  5-6	%12.3f ms\n", t56d*1000.0);
-      printf("  6-7	%12.3f ms\n", t67d*1000.0);
-      printf("  7-8	%12.3f ms\n", t78d*1000.0);
-      printf("  8-9	%12.3f ms\n", t89d*1000.0);
-      printf("\n");
-      printf(" TOTAL  %12.3f ms\n", t09d*1000.0);
-		fflush(stdout);
-    }
-    //}
 
 
-	if(VERBOSE_CUDACOMP_magma_compute_SVDpseudoInverse==1)
-	{
-		printf("\n\n");
-		fflush(stdout);
-	}
 
-    if(LOOPmode == 1)
-        MAGMAloop_iter++;
 
-    return(ID_Cmatrix);
-}
 
 
 
+/* =============================================================================================== */
+/* =============================================================================================== */
+/*                                                                                                 */
+/* 4. HIGH LEVEL FUNCTIONS                                                                         */
+/*                                                                                                 */
+/* =============================================================================================== */
+/* =============================================================================================== */
 
-#endif
 
 
 
 
 
 
+//
+// single GPU
+// semaphore input = 3
+//
+int CUDACOMP_Coeff2Map_Loop(const char *IDmodes_name, const char *IDcoeff_name, int GPUindex, const char *IDoutmap_name, int offsetmode, const char *IDoffset_name)
+{
+    long NBmodes;
+    long IDmodes;
+    long IDcoeff;
+    long IDoutmap;
+    long m;
+    int k;
+    cublasHandle_t cublasH = NULL;
+    cublasStatus_t cublas_status = CUBLAS_STATUS_SUCCESS;
+    cudaError_t cudaStat = cudaSuccess;
+    struct cudaDeviceProp deviceProp;
 
+    float *d_modes = NULL; // linear memory of GPU
+    float *d_coeff = NULL;
+    float *d_outmap = NULL;
 
+    float alpha = 1.0;
+    float beta = 0.0;
+    int loopOK;
+    struct timespec ts;
+    long iter;
+    long long cnt = -1;
+    long scnt;
+    int semval;
+    int semr;
+    long ii, kk;
 
+    long IDoffset;
 
 
-//
-// Computes control matrix
-// Conventions:
-//   n: number of actuators (= NB_MODES)
-//   m: number of sensors  (= # of pixels)
-// assumes m = n
+    printf("entering CUDACOMP_Coeff2Map_Loop\n");
+    printf("offsetmode = %d\n", offsetmode);
+    fflush(stdout);
 
-int GPU_SVD_computeControlMatrix(int device, const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, const char *ID_VTmatrix_name)
-{
-    cusolverDnHandle_t  cudenseH = NULL;
-    cublasHandle_t cublasH = NULL;
-    cublasStatus_t cublas_status; // = CUBLAS_STATUS_SUCCESS;
-    cusolverStatus_t cusolver_status; // = CUSOLVER_STATUS_SUCCESS;
-    struct cudaDeviceProp deviceProp;
-    int k;
+    if(offsetmode==1)
+    {
+        beta = 1.0;
+        IDoffset = image_ID(IDoffset_name);
+        
+        if(IDoffset == -1)
+        {
+            printf("ERROR: image \"%s\" does not exist\n", IDoffset_name);
+            exit(0);
+        }
+    }
 
-    long ID_Rmatrix, ID_Cmatrix, ID_VTmatrix;
-    uint8_t atype;
-    int m;
-    int n;
-    uint32_t *arraysizetmp;
-    int lda, ldu, ldvt;
-    
 
-    float *d_A = NULL; // linear memory of GPU
-    float *h_A = NULL;
-    float *d_S = NULL; // linear memory of GPU
-    float *d_U = NULL; // linear memory of GPU
-    float *h_U1 = NULL;    
-    float *d_VT = NULL; // linear memory of GPU
-    float *d_M = NULL; // linear memory of GPU
-    float *d_U1 = NULL; // linear memory of GPU
-    float *d_Work = NULL; // linear memory of GPU
-    cudaError_t cudaStat = cudaSuccess;
-    int *devInfo = NULL; // info in gpu (device copy)
-    int Lwork;
-    float *rwork;
+    IDcoeff = image_ID(IDcoeff_name);
+    NBmodes = 1;
+    for(k=0; k<data.image[IDcoeff].md[0].naxis; k++)
+        NBmodes *= data.image[IDcoeff].md[0].size[k];
 
-    float *Sarray;
-    float *Aarray;
-    long i;
-    FILE *fp;
-    char fname[200];
+    IDmodes = image_ID(IDmodes_name);
+    if(data.image[IDmodes].md[0].naxis==3)
+        m = data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1];
+    else
+        m = data.image[IDmodes].md[0].size[0];
 
-    int info_gpu;
 
-    double time1sec, time2sec;
-    struct timespec tnow;
 
+    IDoutmap = image_ID(IDoutmap_name);
+    if(IDoutmap==-1)
+    {
+        printf("ERROR: missing output stream\n");
+        exit(0);
+    }
+    COREMOD_MEMORY_image_set_createsem(IDoutmap_name, 5);
 
-    long ID_leftSV; // left singular vectors
-    float val;
-    long ii, jj;
-    float alpha = 1.0;
-    float beta = 0.0;
-    long ID;
-    
-    float *h_M;
-    long cnt0;
- 
 
     cudaGetDeviceCount(&deviceCount);
     printf("%d devices found\n", deviceCount);
@@ -3365,30 +6088,16 @@ int GPU_SVD_computeControlMatrix(int device, const char *ID_Rmatrix_name, const
     }
 
 
-    if(device<deviceCount)
-    {
-        cudaSetDevice(device);
-    }
+    if(GPUindex<deviceCount)
+        cudaSetDevice(GPUindex);
     else
     {
-        printf("Invalid Device : %d / %d\n", device, deviceCount);
+        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
         exit(0);
     }
 
-    cudaDeviceReset();
-
-    printf("step 1a: create cudense handle ...");
-    fflush(stdout);
-    cusolver_status = cusolverDnCreate(&cudenseH);
-    if (cusolver_status != CUSOLVER_STATUS_SUCCESS) {
-        printf ("CUSOLVER initialization failed\n");
-        return EXIT_FAILURE;
-    }
-    printf(" done\n");
-    fflush(stdout);
-
 
-    printf("step 1b: create cublas handle ...");
+    printf("Create cublas handle ...");
     fflush(stdout);
     cublas_status = cublasCreate(&cublasH);
     if (cublas_status != CUBLAS_STATUS_SUCCESS) {
@@ -3396,354 +6105,250 @@ int GPU_SVD_computeControlMatrix(int device, const char *ID_Rmatrix_name, const
         return EXIT_FAILURE;
     }
     printf(" done\n");
-    fflush(stdout);
-
-
-
-
-
-    clock_gettime(CLOCK_REALTIME, &tnow);
-    time1sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
-
-
-
-    list_image_ID();
-
-   
-    ID_Rmatrix = image_ID(ID_Rmatrix_name);
-
-    atype = data.image[ID_Rmatrix].md[0].atype;
-    if(atype!=_DATATYPE_FLOAT)
-    {
-        printf("wrong type\n");
-        exit(0);
-    }
-
-    if(data.image[ID_Rmatrix].md[0].naxis==3)
-    {
-        m = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
-        n = data.image[ID_Rmatrix].md[0].size[2];
-        printf("3D image -> %d %d\n", m, n);
-        fflush(stdout);
-    }
-    else
-    {
-        m = data.image[ID_Rmatrix].md[0].size[0];
-        n = data.image[ID_Rmatrix].md[0].size[1];
-        printf("2D image -> %d %d\n", m, n);
-        fflush(stdout);
-    }
-
-    if(m!=n)
-    {
-        printf("ERROR: m must be equal to n\n");
-        exit(0);
-    }
-
-
-
-
+    fflush(stdout);
 
 
 
 
 
-    cudaStat = cudaMalloc ((void**)&d_A  , sizeof(float) * n * m);
+    // load modes to GPU
+    
+    printf("Allocating d_modes. Size = %ld x %ld, total = %ld\n", m, NBmodes, sizeof(float)*m*NBmodes);
+	fflush(stdout);
+    cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
     if (cudaStat != cudaSuccess)
     {
-        printf("cudaMalloc d_A returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        printf("cudaMalloc d_DMmodes returned error code %d, line(%d)\n", cudaStat, __LINE__);
         exit(EXIT_FAILURE);
     }
-
-    h_A = (float*) malloc(sizeof(float)*m*n);
     
-    cudaStat = cudaMemcpy(d_A, data.image[ID_Rmatrix].array.F, sizeof(float)*m*n, cudaMemcpyHostToDevice);
+    printf("cudaMemcpy ID %ld  -> d_modes\n", IDmodes);
+	fflush(stdout);
+	list_image_ID();
+    cudaStat = cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
     if (cudaStat != cudaSuccess)
     {
-        printf("cudaMemcpy d_A returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
         exit(EXIT_FAILURE);
     }
 
 
-
-
-
-    cudaStat = cudaMalloc ((void**)&d_S  , sizeof(float) * n);
+    // create d_outmap
+    printf("Allocating d_outmap. Size = %ld,  total = %ld\n", m, sizeof(float)*m);
+	fflush(stdout);   
+    cudaStat = cudaMalloc((void**)&d_outmap, sizeof(float)*m);
     if (cudaStat != cudaSuccess)
     {
-        printf("cudaMalloc d_S returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        printf("cudaMalloc d_outmap returned error code %d, line(%d)\n", cudaStat, __LINE__);
         exit(EXIT_FAILURE);
     }
 
-    cudaStat = cudaMalloc ((void**)&d_U  , sizeof(float) * m * m);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_U returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
-    }
 
-    cudaStat = cudaMalloc ((void**)&d_VT  , sizeof(float) * n * n);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_VT returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
-    }
-    
-    cudaStat = cudaMalloc ((void**)&devInfo, sizeof(int));
+    // create d_coeff
+	printf("Allocating d_coeff. Size = %ld,  total = %ld\n", NBmodes, sizeof(float)*NBmodes);
+	fflush(stdout);      
+    cudaStat = cudaMalloc((void**)&d_coeff, sizeof(float)*NBmodes);
     if (cudaStat != cudaSuccess)
     {
-        printf("cudaMalloc devInfo returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        printf("cudaMalloc d_coeff returned error code %d, line(%d)\n", cudaStat, __LINE__);
         exit(EXIT_FAILURE);
     }
 
-    lda = m;
-    ldu = m;
-    ldvt = n;
-    cusolver_status = cusolverDnSgesvd_bufferSize(cudenseH, m, n, &Lwork );
-    if (cusolver_status != CUSOLVER_STATUS_SUCCESS) {
-        printf ("CUSOLVER DnSgesvd_bufferSize failed\n");
-        return EXIT_FAILURE;
-    }
 
-    cudaStat = cudaMalloc((void**)&d_Work, sizeof(float)*Lwork);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_Work returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    
-    rwork = (float*) malloc(5*sizeof(float)*n);
-    
- 
-    printf("START GPU COMPUTATION (%d x %d)  buffer size = %d ...", m, n, Lwork);
-    fflush(stdout);
-    cusolverDnSgesvd (cudenseH, 'A', 'A', m, n, d_A, lda, d_S, d_U, ldu, d_VT, ldvt, d_Work, Lwork, NULL, devInfo);
-    printf(" SYNC ");
-    fflush(stdout);
-    cudaStat = cudaDeviceSynchronize();
-    printf(" DONE\n");
-    fflush(stdout);
-
-    cudaStat = cudaMemcpy(&info_gpu, devInfo, sizeof(int), cudaMemcpyDeviceToHost);
-    printf("after gesvd: info_gpu = %d\n", info_gpu);
-
- 
-    ID_VTmatrix = create_2Dimage_ID(ID_VTmatrix_name, n, n);
-    cudaStat = cudaMemcpy(data.image[ID_VTmatrix].array.F, d_VT, sizeof(float)*n*n, cudaMemcpyDeviceToHost);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-   
-   save_fits(ID_VTmatrix_name, "!matVT0.fits");
-  
-  
-     Sarray = (float*) malloc(sizeof(float)*n);
-    //    Aarray = (float*) malloc(sizeof(float)*m*n);
-    cudaStat = cudaMemcpy(Sarray, d_S, sizeof(float)*n, cudaMemcpyDeviceToHost);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGUSR1, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-
-    sprintf(fname, "eigenv.dat.gsl");
-    if((fp=fopen(fname, "w"))==NULL)
-    {
-        printf("ERROR: cannot create file \"%s\"\n", fname);
-        exit(0);
+    if (sigaction(SIGBUS, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
     }
-    for(i=0; i<n; i++)
-        fprintf(fp,"%5ld %20g %20g\n", i, Sarray[i], Sarray[i]/Sarray[0]);
-    fclose(fp);
-
-
-
-    ID = create_2Dimage_ID("matU", m, m);
-    cudaMemcpy(data.image[ID].array.F, d_U, sizeof(float)*m*m, cudaMemcpyDeviceToHost);
-    save_fits("matU", "!matU.fits");
-  
-    h_U1 = (float*) malloc(sizeof(float)*m*n);
-    cudaStat = cudaMalloc((void**)&d_U1, sizeof(float)*m*n);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_U1 returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    for(ii=0;ii<m;ii++)
-        for(jj=0;jj<n;jj++)
-            h_U1[jj*m+ii] = data.image[ID].array.F[jj*m+ii];
-    cudaMemcpy(d_U1, h_U1, sizeof(float)*m*n, cudaMemcpyHostToDevice);
-    free(h_U1);
-    
-    ID = create_2Dimage_ID("matU1", m, n);
-    cudaMemcpy(data.image[ID].array.F, d_U1, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
-    save_fits("matU1", "!matU1.fits");
-
-
-   
-   
-    printf("SVDeps = %f\n", SVDeps);
-    cnt0 = 0;
-    // multiply lines of VT by 1/eigenval
-    for(ii=0;ii<n;ii++)
-    {
-        if( Sarray[ii] > Sarray[0]*SVDeps )
-            {
-                val = 1.0/(Sarray[ii]);
-                cnt0++;
-            }
-        else
-            val = 0.0;
-        
-        for(jj=0;jj<n;jj++)
-             data.image[ID_VTmatrix].array.F[jj*n+ii] *= val;
+    if (sigaction(SIGABRT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
     }
-    printf("%ld eigenvalues kept\n", cnt0);
-    
-    // copy VT back to GPU
-   cudaStat = cudaMemcpy(d_VT, data.image[ID_VTmatrix].array.F, sizeof(float)*n*n, cudaMemcpyHostToDevice);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGHUP, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    
-    
-    cudaStat = cudaMalloc((void**)&d_M, sizeof(float)*n*m);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_M returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGPIPE, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    
- 
-    save_fits(ID_VTmatrix_name, "!matVT.fits");
- 
-    cudaStat = cublasSgemm(cublasH, CUBLAS_OP_T, CUBLAS_OP_T, n, m, n, &alpha, d_VT, n, d_U, m, &beta, d_M, n);
-     if (cudaStat != cudaSuccess)
-    {
-        printf("cublasSgemm returned error code %d, line(%d)\n", cudaStat, __LINE__);
+    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
+        perror("sigaction");
         exit(EXIT_FAILURE);
     }
 
-     
 
-	arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
 
-    if(data.image[ID_Rmatrix].md[0].naxis==3)
-    {
-        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
-        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
-        arraysizetmp[2] = n;
-    }
-    else
-    {
-        arraysizetmp[0] = m;
-        arraysizetmp[1] = n;
-    }
+    loopOK = 1;
+    iter = 0;
 
-    
-    ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
-    
-    
- //   cudaStat = cudaMemcpy(data.image[ID_Cmatrix].array.F, d_M, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
-    
-    h_M = (float*) malloc(sizeof(float)*m*n);
-    cudaStat = cudaMemcpy(h_M, d_M, sizeof(float)*m*n, cudaMemcpyDeviceToHost);
-    for(ii=0;ii<m;ii++)
-        for(jj=0;jj<n;jj++)
-            data.image[ID_Cmatrix].array.F[jj*m+ii] = h_M[ii*n+jj];
-    
-    //cudaStat = cudaMemcpy(data.image[ID_Cmatrix].array.F, d_VT, sizeof(float)*n*n, cudaMemcpyDeviceToHost);
-    if (cudaStat != cudaSuccess)
+    printf("ENTERING LOOP, %ld modes (offsetmode = %d)\n", NBmodes, offsetmode);
+    fflush(stdout);
+
+    while(loopOK == 1)
     {
-        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        free(arraysizetmp);
-        exit(EXIT_FAILURE);
-    }
-    
+
+        if(data.image[IDcoeff].md[0].sem==0)
+        {
+            while(data.image[IDcoeff].md[0].cnt0==cnt) // test if new frame exists
+                usleep(5);
+            cnt = data.image[IDcoeff].md[0].cnt0;
+            semr = 0;
+        }
+        else
+        {
 
 
-    cudaFree(d_A);
-    cudaFree(d_S);
-    cudaFree(d_U);
-    cudaFree(d_VT);
-    cudaFree(d_Work);
-    cudaFree(devInfo);
-    cudaFree(d_M);
-    cudaFree(d_U1);
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                perror("clock_gettime");
+                exit(EXIT_FAILURE);
+            }
+            ts.tv_sec += 1;
+            semr = sem_timedwait(data.image[IDcoeff].semptr[3], &ts);
+
+
+            if(iter == 0)
+            {
+                //  printf("driving semaphore to zero ... ");
+                // fflush(stdout);
+                sem_getvalue(data.image[IDcoeff].semptr[2], &semval);
+                for(scnt=0; scnt<semval; scnt++)
+                    sem_trywait(data.image[IDcoeff].semptr[2]);
+                // printf("done\n");
+                // fflush(stdout);
+            }
+        }
 
-    clock_gettime(CLOCK_REALTIME, &tnow);
-    time2sec = 1.0*((long) tnow.tv_sec) + 1.0e-9*tnow.tv_nsec;
 
-    printf("time = %8.3f s\n", 1.0*(time2sec-time1sec));
 
 
+        if(semr==0)
+        {
+            //  printf("Compute\n");
+            //  fflush(stdout);
 
+            // send vector back to GPU
+            cudaStat = cudaMemcpy(d_coeff, data.image[IDcoeff].array.F, sizeof(float)*NBmodes, cudaMemcpyHostToDevice);
+            if (cudaStat != cudaSuccess)
+            {
+                printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+                exit(EXIT_FAILURE);
+            }
 
-    if (cublasH ) cublasDestroy(cublasH);
-    if (cudenseH) cusolverDnDestroy(cudenseH);
+            if(offsetmode==1)
+            {
+                cudaStat = cudaMemcpy(d_outmap, data.image[IDoffset].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
+                if (cudaStat != cudaSuccess)
+                {
+                    printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+                    exit(EXIT_FAILURE);
+                }
+            }
 
-    cudaDeviceReset();
+            // compute
+            cublas_status = cublasSgemv(cublasH, CUBLAS_OP_N, m, NBmodes, &alpha, d_modes, m, d_coeff, 1, &beta, d_outmap, 1);
+            if (cublas_status != CUBLAS_STATUS_SUCCESS)
+            {
+				printf("cublasSgemv returned error code %d, line(%d)\n", cublas_status, __LINE__);
+                fflush(stdout);
+                if(cublas_status == CUBLAS_STATUS_NOT_INITIALIZED)
+                    printf("   CUBLAS_STATUS_NOT_INITIALIZED\n");
+                if(cublas_status == CUBLAS_STATUS_INVALID_VALUE)
+                    printf("   CUBLAS_STATUS_INVALID_VALUE\n");
+                if(cublas_status == CUBLAS_STATUS_ARCH_MISMATCH)
+                    printf("   CUBLAS_STATUS_ARCH_MISMATCH\n");
+                if(cublas_status == CUBLAS_STATUS_EXECUTION_FAILED)
+                    printf("   CUBLAS_STATUS_EXECUTION_FAILED\n");
 
-    free(arraysizetmp);
-    free(Sarray);
-    free(rwork);
-    free(h_A);
-    free(h_M);
-    
-    
-    return(0);
-}
+                printf("GPU index                           = %d\n", GPUindex);
+
+                printf("CUBLAS_OP_N                         = %d\n", CUBLAS_OP_N);
+                printf("alpha                               = %f\n", alpha);
+                printf("alpha                               = %f\n", beta);
+                printf("m                                   = %d\n", (int) m);
+                printf("NBmodes                             = %d\n", (int) NBmodes);
+                fflush(stdout);
+                exit(EXIT_FAILURE);								
+            }
 
+            // copy result
+            data.image[IDoutmap].md[0].write = 1;
+            cudaStat = cudaMemcpy(data.image[IDoutmap].array.F, d_outmap, sizeof(float)*m, cudaMemcpyDeviceToHost);
+            sem_getvalue(data.image[IDoutmap].semptr[0], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[IDoutmap].semptr[0]);
+            sem_getvalue(data.image[IDoutmap].semptr[1], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[IDoutmap].semptr[1]);
+            data.image[IDoutmap].md[0].cnt0++;
+            data.image[IDoutmap].md[0].write = 0;
 
 
 
+        }
 
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+            loopOK = 0;
 
+        iter++;
 
+    }
 
 
+    cudaFree(d_modes);
+    cudaFree(d_outmap);
+    cudaFree(d_coeff);
 
 
+    if (cublasH ) cublasDestroy(cublasH);
 
 
-/* =============================================================================================== */
-/* =============================================================================================== */
-/*                                                                                                 */
-/* 4. HIGH LEVEL FUNCTIONS                                                                         */
-/*                                                                                                 */
-/* =============================================================================================== */
-/* =============================================================================================== */
 
+    return(0);
+}
 
 
 
 
 
+/** @brief extract mode coefficients from data stream
+ * 
+ */ 
 
-//
-// single GPU
-// semaphore input = 3
-//
-int CUDACOMP_Coeff2Map_Loop(const char *IDmodes_name, const char *IDcoeff_name, int GPUindex, const char *IDoutmap_name, int offsetmode, const char *IDoffset_name)
+int CUDACOMP_extractModesLoop(const char *in_stream, const char *intot_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDrefout_name, const char *IDmodes_val_name, int GPUindex, int PROCESS, int TRACEMODE, int MODENORM, int insem, int axmode, long twait)
 {
-    long NBmodes;
+    long IDin;
+    long IDintot;
     long IDmodes;
-    long IDcoeff;
-    long IDoutmap;
-    long m;
-    int k;
+    long IDref;
+    long ID;
+    long ID_modeval;
     cublasHandle_t cublasH = NULL;
     cublasStatus_t cublas_status = CUBLAS_STATUS_SUCCESS;
     cudaError_t cudaStat = cudaSuccess;
     struct cudaDeviceProp deviceProp;
+    int m, n;
+    int k;
+    uint32_t *arraytmp;
 
     float *d_modes = NULL; // linear memory of GPU
-    float *d_coeff = NULL;
-    float *d_outmap = NULL;
+    float *d_in = NULL;
+    float *d_modeval = NULL;
 
     float alpha = 1.0;
     float beta = 0.0;
@@ -3754,132 +6359,260 @@ int CUDACOMP_Coeff2Map_Loop(const char *IDmodes_name, const char *IDcoeff_name,
     long scnt;
     int semval;
     int semr;
-    long ii, kk;
+    long ii, jj, kk;
 
-    long IDoffset;
+    long NBmodes;
+    float *normcoeff;
+
+    long IDoutact;
+    uint32_t *sizearraytmp;
 
+    long ID_modeval_mult;
+    int imOK;
 
-    printf("entering CUDACOMP_Coeff2Map_Loop\n");
-    printf("offsetmode = %d\n", offsetmode);
-    fflush(stdout);
 
-    if(offsetmode==1)
+    char traceim_name[200];
+    long TRACEsize = 2000;
+    long TRACEindex = 0;
+    long IDtrace;
+
+
+    int NBaveSTEP = 10; // each step is 2x longer average than previous step
+    double stepcoeff;
+    double stepcoeff0 = 0.3;
+    char process_ave_name[200];
+    char process_rms_name[200];
+    long IDprocave;
+    long IDprocrms;
+    long step;
+
+    long semnb;
+    double tmpv;
+
+    int INNORMMODE = 0; // 1 if input normalized
+
+    float *modevalarray;
+    float *modevalarrayref;
+
+    int initref = 0; // 1 when reference has been processed
+    int BETAMODE = 0;
+    long IDrefout;
+
+    long refindex;
+	long twait1;
+    struct timespec t0;
+    struct timespec t1;
+
+    int MODEVALCOMPUTE = 1; // 1 if compute, 0 if import
+
+
+	int RT_priority = 80; //any number from 0-99
+    struct sched_param schedpar;
+
+
+
+    schedpar.sched_priority = RT_priority;
+#ifndef __MACH__
+    sched_setscheduler(0, SCHED_FIFO, &schedpar); 
+#endif
+
+
+
+
+    IDin = image_ID(in_stream);
+    m = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+    COREMOD_MEMORY_image_set_createsem(in_stream, 10);
+
+    // total flux
+    IDintot = image_ID(intot_stream);
+
+    if(IDintot==-1)
     {
-        beta = 1.0;
-        IDoffset = image_ID(IDoffset_name);
-        
-        if(IDoffset == -1)
-        {
-            printf("ERROR: image \"%s\" does not exist\n", IDoffset_name);
-            exit(0);
-        }
+        INNORMMODE = 0;
+        IDintot = create_2Dimage_ID("intot_tmp", 1, 1);
+        data.image[IDintot].array.F[0] = 1.0;
     }
+    else
+        INNORMMODE = 1;
 
+    // reference
+    IDref = image_ID(IDrefin_name);
+    if(IDref==-1)
+    {
+        IDref = create_2Dimage_ID("_tmprefin", data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1]);
+        for(ii=0; ii<data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1]; ii++)
+            data.image[IDref].array.F[ii] = 0.0;
+    }
 
-    IDcoeff = image_ID(IDcoeff_name);
-    NBmodes = 1;
-    for(k=0; k<data.image[IDcoeff].md[0].naxis; k++)
-        NBmodes *= data.image[IDcoeff].md[0].size[k];
 
-    IDmodes = image_ID(IDmodes_name);
-    if(data.image[IDmodes].md[0].naxis==3)
-        m = data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1];
+
+    if(axmode==0)
+    {
+        IDmodes = image_ID(IDmodes_name);
+        n = data.image[IDmodes].md[0].size[2];
+        NBmodes = n;
+    }
+    else
+    {
+        ID = image_ID(IDmodes_name);
+        printf("Modes: ID = %ld   %s\n", ID, IDmodes_name);
+        fflush(stdout);
+
+        NBmodes = data.image[ID].md[0].size[0]*data.image[ID].md[0].size[1];
+        n = NBmodes;
+        printf("NBmodes = %ld\n", NBmodes);
+        fflush(stdout);
+
+        printf("creating _tmpmodes  %ld %ld %ld\n", (long) data.image[IDin].md[0].size[0], (long) data.image[IDin].md[0].size[1], NBmodes);
+        fflush(stdout);
+
+
+        IDmodes = create_3Dimage_ID("_tmpmodes", data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1], NBmodes);
+
+        for(ii=0; ii<data.image[IDin].md[0].size[0]; ii++)
+            for(jj=0; jj<data.image[IDin].md[0].size[1]; jj++)
+            {
+                for(kk=0; kk<NBmodes; kk++)
+                    data.image[IDmodes].array.F[kk*data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1]+jj*data.image[IDin].md[0].size[0]+ii] = data.image[ID].array.F[NBmodes*(jj*data.image[IDin].md[0].size[0]+ii)+kk];
+            }
+        save_fits("_tmpmodes", "!_test_tmpmodes.fits");
+    }
+
+
+
+    normcoeff = (float*) malloc(sizeof(float)*NBmodes);
+
+    if(MODENORM==1)
+    {
+        for(k=0; k<NBmodes; k++)
+        {
+            normcoeff[k] = 0.0;
+            for(ii=0; ii<m; ii++)
+                normcoeff[k] += data.image[IDmodes].array.F[k*m+ii] * data.image[IDmodes].array.F[k*m+ii];
+        }
+    }
     else
-        m = data.image[IDmodes].md[0].size[0];
+        for(k=0; k<NBmodes; k++)
+            normcoeff[k] = 1.0;
 
 
 
-    IDoutmap = image_ID(IDoutmap_name);
-    if(IDoutmap==-1)
-    {
-        printf("ERROR: missing output stream\n");
-        exit(0);
-    }
-    COREMOD_MEMORY_image_set_createsem(IDoutmap_name, 5);
 
 
-    cudaGetDeviceCount(&deviceCount);
-    printf("%d devices found\n", deviceCount);
-    fflush(stdout);
-    printf("\n");
-    for (k = 0; k < deviceCount; ++k) {
-        cudaGetDeviceProperties(&deviceProp, k);
-        printf("Device %d [ %20s ]  has compute capability %d.%d.\n",
-               k, deviceProp.name, deviceProp.major, deviceProp.minor);
-        printf("  Total amount of global memory:                 %.0f MBytes (%llu bytes)\n", (float)deviceProp.totalGlobalMem/1048576.0f, (unsigned long long) deviceProp.totalGlobalMem);
-        printf("  (%2d) Multiprocessors\n", deviceProp.multiProcessorCount);
-        printf("  GPU Clock rate:                                %.0f MHz (%0.2f GHz)\n", deviceProp.clockRate * 1e-3f, deviceProp.clockRate * 1e-6f);
-        printf("\n");
-    }
+    modevalarray = (float*) malloc(sizeof(float)*n);
+    modevalarrayref = (float*) malloc(sizeof(float)*n);
 
 
-    if(GPUindex<deviceCount)
-        cudaSetDevice(GPUindex);
-    else
+    arraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
+
+    IDrefout = image_ID(IDrefout_name);
+    if(IDrefout==-1)
     {
-        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
-        exit(0);
+        arraytmp[0] = NBmodes;
+        arraytmp[1] = 1;
     }
-
-
-    printf("Create cublas handle ...");
-    fflush(stdout);
-    cublas_status = cublasCreate(&cublasH);
-    if (cublas_status != CUBLAS_STATUS_SUCCESS) {
-        printf ("CUBLAS initialization failed\n");
-        return EXIT_FAILURE;
+    else
+    {
+        arraytmp[0] = data.image[IDrefout].md[0].size[0];
+        arraytmp[1] = data.image[IDrefout].md[0].size[1];
     }
-    printf(" done\n");
-    fflush(stdout);
 
 
 
 
 
-    // load modes to GPU
-    
-    printf("Allocating d_modes. Size = %ld x %ld, total = %ld\n", m, NBmodes, sizeof(float)*m*NBmodes);
-	fflush(stdout);
-    cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
-    if (cudaStat != cudaSuccess)
+    ID_modeval = image_ID(IDmodes_val_name);
+    if(ID_modeval==-1) // CREATE IT
     {
-        printf("cudaMalloc d_DMmodes returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
+        ID_modeval = create_image_ID(IDmodes_val_name, 2, arraytmp, _DATATYPE_FLOAT, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(IDmodes_val_name, 10);
+        MODEVALCOMPUTE = 1;
     }
-    
-    printf("cudaMemcpy ID %ld  -> d_modes\n", IDmodes);
-	fflush(stdout);
-	list_image_ID();
-    cudaStat = cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
-    if (cudaStat != cudaSuccess)
+    else // USE STREAM, DO NOT COMPUTE IT
     {
-        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
+        MODEVALCOMPUTE = 0;
+        // drive semaphore to zero
+        while(sem_trywait(data.image[ID_modeval].semptr[insem])==0) {}
     }
 
+    free(arraytmp);
 
-    // create d_outmap
-    printf("Allocating d_outmap. Size = %ld,  total = %ld\n", m, sizeof(float)*m);
-	fflush(stdout);   
-    cudaStat = cudaMalloc((void**)&d_outmap, sizeof(float)*m);
-    if (cudaStat != cudaSuccess)
-    {
-        printf("cudaMalloc d_outmap returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
-    }
 
 
-    // create d_coeff
-	printf("Allocating d_coeff. Size = %ld,  total = %ld\n", NBmodes, sizeof(float)*NBmodes);
-	fflush(stdout);      
-    cudaStat = cudaMalloc((void**)&d_coeff, sizeof(float)*NBmodes);
-    if (cudaStat != cudaSuccess)
+
+
+    if(MODEVALCOMPUTE == 1)
     {
-        printf("cudaMalloc d_coeff returned error code %d, line(%d)\n", cudaStat, __LINE__);
-        exit(EXIT_FAILURE);
+        cudaGetDeviceCount(&deviceCount);
+        printf("%d devices found\n", deviceCount);
+        fflush(stdout);
+        printf("\n");
+        for (k = 0; k < deviceCount; ++k) {
+            cudaGetDeviceProperties(&deviceProp, k);
+            printf("Device %d [ %20s ]  has compute capability %d.%d.\n",
+                   k, deviceProp.name, deviceProp.major, deviceProp.minor);
+            printf("  Total amount of global memory:                 %.0f MBytes (%llu bytes)\n", (float)deviceProp.totalGlobalMem/1048576.0f, (unsigned long long) deviceProp.totalGlobalMem);
+            printf("  (%2d) Multiprocessors\n", deviceProp.multiProcessorCount);
+            printf("  GPU Clock rate:                                %.0f MHz (%0.2f GHz)\n", deviceProp.clockRate * 1e-3f, deviceProp.clockRate * 1e-6f);
+            printf("\n");
+        }
+
+
+        if(GPUindex<deviceCount)
+            cudaSetDevice(GPUindex);
+        else
+        {
+            printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
+            exit(0);
+        }
+
+
+        printf("Create cublas handle ...");
+        fflush(stdout);
+        cublas_status = cublasCreate(&cublasH);
+        if (cublas_status != CUBLAS_STATUS_SUCCESS) {
+            printf ("CUBLAS initialization failed\n");
+            return EXIT_FAILURE;
+        }
+        printf(" done\n");
+        fflush(stdout);
+
+
+        // load modes to GPU
+        cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
+        if (cudaStat != cudaSuccess)
+        {
+            printf("cudaMalloc d_modes returned error code %d, line %d\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        cudaStat = cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
+        if (cudaStat != cudaSuccess)
+        {
+            printf("cudaMemcpy returned error code %d, line %d\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+
+
+        // create d_in
+        cudaStat = cudaMalloc((void**)&d_in, sizeof(float)*m);
+        if (cudaStat != cudaSuccess)
+        {
+            printf("cudaMalloc d_in returned error code %d, line %d\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+
+
+        // create d_modeval
+        cudaStat = cudaMalloc((void**)&d_modeval, sizeof(float)*NBmodes);
+        if (cudaStat != cudaSuccess)
+        {
+            printf("cudaMalloc d_modeval returned error code %d, line %d\n", cudaStat, __LINE__);
+            exit(EXIT_FAILURE);
+        }
     }
 
 
+
     if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
         perror("sigaction");
         exit(EXIT_FAILURE);
@@ -3914,77 +6647,164 @@ int CUDACOMP_Coeff2Map_Loop(const char *IDmodes_name, const char *IDcoeff_name,
     }
 
 
-
     loopOK = 1;
     iter = 0;
 
-    printf("ENTERING LOOP, %ld modes (offsetmode = %d)\n", NBmodes, offsetmode);
-    fflush(stdout);
 
-    while(loopOK == 1)
-    {
 
-        if(data.image[IDcoeff].md[0].sem==0)
-        {
-            while(data.image[IDcoeff].md[0].cnt0==cnt) // test if new frame exists
-                usleep(5);
-            cnt = data.image[IDcoeff].md[0].cnt0;
-            semr = 0;
-        }
+
+
+    if(TRACEMODE==1)
+    {
+        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        sprintf(traceim_name, "%s_trace", IDmodes_val_name);
+        sizearraytmp[0] = TRACEsize;
+        sizearraytmp[1] = NBmodes;
+        IDtrace = image_ID(traceim_name);
+        imOK = 1;
+        if(IDtrace == -1)
+            imOK = 0;
         else
         {
+            if((data.image[IDtrace].md[0].size[0]!=TRACEsize)||(data.image[IDtrace].md[0].size[1]!=NBmodes))
+            {
+                imOK = 0;
+                delete_image_ID(traceim_name);
+            }
+        }
+        if(imOK==0)
+            IDtrace = create_image_ID(traceim_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(traceim_name, 10);
+        free(sizearraytmp);
+    }
 
 
-            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-                perror("clock_gettime");
-                exit(EXIT_FAILURE);
-            }
-            ts.tv_sec += 1;
-            semr = sem_timedwait(data.image[IDcoeff].semptr[3], &ts);
 
 
-            if(iter == 0)
+
+    if(PROCESS==1)
+    {
+        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        sprintf(process_ave_name, "%s_ave", IDmodes_val_name);
+        sizearraytmp[0] = NBmodes;
+        sizearraytmp[1] = NBaveSTEP;
+        IDprocave = image_ID(process_ave_name);
+        imOK = 1;
+        if(IDprocave == -1)
+            imOK = 0;
+        else
+        {
+            if((data.image[IDprocave].md[0].size[0]!=NBmodes)||(data.image[IDprocave].md[0].size[1]!=NBaveSTEP))
             {
-                //  printf("driving semaphore to zero ... ");
-                // fflush(stdout);
-                sem_getvalue(data.image[IDcoeff].semptr[2], &semval);
-                for(scnt=0; scnt<semval; scnt++)
-                    sem_trywait(data.image[IDcoeff].semptr[2]);
-                // printf("done\n");
-                // fflush(stdout);
+                imOK = 0;
+                delete_image_ID(process_ave_name);
+            }
+        }
+        if(imOK==0)
+            IDprocave = create_image_ID(process_ave_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(process_ave_name, 10);
+        free(sizearraytmp);
+
+        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        sprintf(process_rms_name, "%s_rms", IDmodes_val_name);
+        sizearraytmp[0] = NBmodes;
+        sizearraytmp[1] = NBaveSTEP;
+        IDprocrms = image_ID(process_rms_name);
+        imOK = 1;
+        if(IDprocrms == -1)
+            imOK = 0;
+        else
+        {
+            if((data.image[IDprocrms].md[0].size[0]!=NBmodes)||(data.image[IDprocrms].md[0].size[1]!=NBaveSTEP))
+            {
+                imOK = 0;
+                delete_image_ID(process_rms_name);
             }
         }
+        if(imOK==0)
+            IDprocrms = create_image_ID(process_rms_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
+        COREMOD_MEMORY_image_set_createsem(process_rms_name, 10);
+        free(sizearraytmp);
+    }
+
 
+    initref = 0;
 
 
 
-        if(semr==0)
+
+
+
+	twait1 = twait;
+
+    while(loopOK == 1)
+    {
+		clock_gettime(CLOCK_REALTIME, &t0);
+				
+        if(MODEVALCOMPUTE==1)
         {
-            //  printf("Compute\n");
-            //  fflush(stdout);
+            if(refindex != data.image[IDref].md[0].cnt0)
+            {
+                initref = 0;
+                refindex = data.image[IDref].md[0].cnt0;
+            }
 
-            // send vector back to GPU
-            cudaStat = cudaMemcpy(d_coeff, data.image[IDcoeff].array.F, sizeof(float)*NBmodes, cudaMemcpyHostToDevice);
-            if (cudaStat != cudaSuccess)
+            if(initref==1)
             {
-                printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
-                exit(EXIT_FAILURE);
+                if(data.image[IDin].md[0].sem==0)
+                {
+                    while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
+                        usleep(5);
+                    cnt = data.image[IDin].md[0].cnt0;
+                    semr = 0;
+                }
+                else
+                {
+                    if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                        perror("clock_gettime");
+                        exit(EXIT_FAILURE);
+                    }
+                    ts.tv_sec += 1;
+                    semr = sem_timedwait(data.image[IDin].semptr[insem], &ts);
+
+                    // drive semaphore to zero
+                    while(sem_trywait(data.image[IDin].semptr[insem])==0) {}
+                }
+            }
+            else // compute response of reference immediately
+            {
+                printf("COMPUTE NEW REFERENCE RESPONSE\n");
+                semr = 0;
             }
 
-            if(offsetmode==1)
+
+
+            if(semr==0)
             {
-                cudaStat = cudaMemcpy(d_outmap, data.image[IDoffset].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
+                // load in_stream to GPU
+                if(initref==0)
+                    cudaStat = cudaMemcpy(d_in, data.image[IDref].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
+                else
+                    cudaStat = cudaMemcpy(d_in, data.image[IDin].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
+
+
                 if (cudaStat != cudaSuccess)
                 {
-                    printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+                    printf("initref = %d    %ld  %ld\n", initref, IDref, IDin);
+                    printf("cudaMemcpy returned error code %d, line %d\n", cudaStat, __LINE__);
                     exit(EXIT_FAILURE);
                 }
-            }
 
-            // compute
-            cublas_status = cublasSgemv(cublasH, CUBLAS_OP_N, m, NBmodes, &alpha, d_modes, m, d_coeff, 1, &beta, d_outmap, 1);
-            if (cublas_status != CUBLAS_STATUS_SUCCESS)
-            {
+                if(BETAMODE == 1)
+                {
+                    beta = -1.0;
+                    cudaStat = cudaMemcpy(d_modeval, modevalarrayref, sizeof(float)*NBmodes, cudaMemcpyHostToDevice);
+                }
+
+                // compute
+                cublas_status = cublasSgemv(cublasH, CUBLAS_OP_T, m, NBmodes, &alpha, d_modes, m, d_in, 1, &beta, d_modeval, 1);
+                if (cublas_status != CUBLAS_STATUS_SUCCESS)
+                {
 				printf("cublasSgemv returned error code %d, line(%d)\n", cublas_status, __LINE__);
                 fflush(stdout);
                 if(cublas_status == CUBLAS_STATUS_NOT_INITIALIZED)
@@ -3998,340 +6818,464 @@ int CUDACOMP_Coeff2Map_Loop(const char *IDmodes_name, const char *IDcoeff_name,
 
                 printf("GPU index                           = %d\n", GPUindex);
 
-                printf("CUBLAS_OP_N                         = %d\n", CUBLAS_OP_N);
+                printf("CUBLAS_OP                           = %d\n", CUBLAS_OP_T);
                 printf("alpha                               = %f\n", alpha);
                 printf("alpha                               = %f\n", beta);
                 printf("m                                   = %d\n", (int) m);
                 printf("NBmodes                             = %d\n", (int) NBmodes);
                 fflush(stdout);
                 exit(EXIT_FAILURE);								
-            }
+                }
 
-            // copy result
-            data.image[IDoutmap].md[0].write = 1;
-            cudaStat = cudaMemcpy(data.image[IDoutmap].array.F, d_outmap, sizeof(float)*m, cudaMemcpyDeviceToHost);
-            sem_getvalue(data.image[IDoutmap].semptr[0], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDoutmap].semptr[0]);
-            sem_getvalue(data.image[IDoutmap].semptr[1], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDoutmap].semptr[1]);
-            data.image[IDoutmap].md[0].cnt0++;
-            data.image[IDoutmap].md[0].write = 0;
+                // copy result
+                data.image[ID_modeval].md[0].write = 1;
 
 
+                if(initref==0) // construct reference to be subtracted
+                {
+                    cudaStat = cudaMemcpy(modevalarrayref, d_modeval, sizeof(float)*NBmodes, cudaMemcpyDeviceToHost);
 
-        }
+                    IDrefout = image_ID(IDrefout_name);
+                    if(IDrefout != -1)
+                        for(k=0; k<NBmodes; k++)
+                            modevalarrayref[k] -= data.image[IDrefout].array.F[k];
 
-        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
-            loopOK = 0;
 
-        iter++;
+                    if((INNORMMODE==0)&&(MODENORM==0))
+                        BETAMODE = 1; // include ref subtraction in GPU operation
+                    else
+                        BETAMODE = 0;
+                }
+                else
+                {
+                    cudaStat = cudaMemcpy(modevalarray, d_modeval, sizeof(float)*NBmodes, cudaMemcpyDeviceToHost);
 
-    }
+                    if(BETAMODE==0)
+                    {
+                        for(k=0; k<NBmodes; k++)
+                            data.image[ID_modeval].array.F[k] = (modevalarray[k]/data.image[IDintot].array.F[0]-modevalarrayref[k])/normcoeff[k];
+                    }
+                    else
+                        for(k=0; k<NBmodes; k++)
+                            data.image[ID_modeval].array.F[k] = modevalarray[k];
 
 
-    cudaFree(d_modes);
-    cudaFree(d_outmap);
-    cudaFree(d_coeff);
+                    COREMOD_MEMORY_image_set_sempost_byID(ID_modeval, -1);
 
+                    data.image[ID_modeval].md[0].cnt0++;
+                    data.image[ID_modeval].md[0].write = 0;
+                }
+            }
+        }
+        else // WAIT FOR NEW MODEVAL
+        {
+			sem_wait(data.image[ID_modeval].semptr[insem]);
+		}
 
-    if (cublasH ) cublasDestroy(cublasH);
 
 
 
-    return(0);
-}
 
 
 
 
 
-/** @brief extract mode coefficients from data stream
- * 
- */ 
 
-int CUDACOMP_extractModesLoop(const char *in_stream, const char *intot_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDrefout_name, const char *IDmodes_val_name, int GPUindex, int PROCESS, int TRACEMODE, int MODENORM, int insem, int axmode, long twait)
-{
-    long IDin;
-    long IDintot;
-    long IDmodes;
-    long IDref;
-    long ID;
-    long ID_modeval;
-    cublasHandle_t cublasH = NULL;
-    cublasStatus_t cublas_status = CUBLAS_STATUS_SUCCESS;
-    cudaError_t cudaStat = cudaSuccess;
-    struct cudaDeviceProp deviceProp;
-    int m, n;
-    int k;
-    uint32_t *arraytmp;
+        if(TRACEMODE == 1)
+        {
+            data.image[ID_modeval].md[0].write = 1;
 
-    float *d_modes = NULL; // linear memory of GPU
-    float *d_in = NULL;
-    float *d_modeval = NULL;
+            for(k=0; k<NBmodes; k++)
+                data.image[IDtrace].array.F[k*TRACEsize+TRACEindex] = data.image[ID_modeval].array.F[k];
+            data.image[IDtrace].md[0].cnt1 = TRACEindex;
 
-    float alpha = 1.0;
-    float beta = 0.0;
-    int loopOK;
-    struct timespec ts;
-    long iter;
-    long long cnt = -1;
-    long scnt;
-    int semval;
-    int semr;
-    long ii, jj, kk;
+            sem_getvalue(data.image[IDtrace].semptr[0], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[IDtrace].semptr[0]);
+            sem_getvalue(data.image[IDtrace].semptr[1], &semval);
+            if(semval<SEMAPHORE_MAXVAL)
+                sem_post(data.image[IDtrace].semptr[1]);
+            data.image[IDtrace].md[0].cnt0++;
+            data.image[IDtrace].md[0].write = 0;
 
-    long NBmodes;
-    float *normcoeff;
+            TRACEindex++;
+            if(TRACEindex>=TRACEsize)
+            {
+                TRACEindex = 0;
+                // copy to tracef shared memory (frozen trace)
+            }
+        }
 
-    long IDoutact;
-    uint32_t *sizearraytmp;
 
-    long ID_modeval_mult;
-    int imOK;
 
+        if(PROCESS==1)
+        {
+            stepcoeff = stepcoeff0;
+            data.image[IDprocave].md[0].write = 1;
+            for(step=0; step<NBaveSTEP; step++)
+            {
+                for(k=0; k<NBmodes; k++)
+                    data.image[IDprocave].array.F[NBmodes*step+k] = (1.0-stepcoeff)*data.image[IDprocave].array.F[NBmodes*step+k] + stepcoeff*data.image[ID_modeval].array.F[k];
+                stepcoeff *= stepcoeff0;
+            }
+            for(semnb=0; semnb<data.image[IDprocave].md[0].sem; semnb++)
+            {
+                sem_getvalue(data.image[IDprocave].semptr[semnb], &semval);
+                if(semval<SEMAPHORE_MAXVAL)
+                    sem_post(data.image[IDprocave].semptr[semnb]);
+            }
+            data.image[IDprocave].md[0].cnt0++;
+            data.image[IDprocave].md[0].write = 0;
 
-    char traceim_name[200];
-    long TRACEsize = 2000;
-    long TRACEindex = 0;
-    long IDtrace;
+            stepcoeff = stepcoeff0;
+            data.image[IDprocrms].md[0].write = 1;
+            for(step=0; step<NBaveSTEP; step++)
+            {
+                for(k=0; k<NBmodes; k++)
+                {
+                    tmpv = data.image[ID_modeval].array.F[k] - data.image[IDprocave].array.F[NBmodes*step+k];
+                    tmpv = tmpv*tmpv;
+                    data.image[IDprocrms].array.F[NBmodes*step+k] = (1.0-stepcoeff)*data.image[IDprocrms].array.F[NBmodes*step+k] + stepcoeff*tmpv;
+                }
+                stepcoeff *= stepcoeff0;
+            }
+            for(semnb=0; semnb<data.image[IDprocrms].md[0].sem; semnb++)
+            {
+                sem_getvalue(data.image[IDprocrms].semptr[semnb], &semval);
+                if(semval<SEMAPHORE_MAXVAL)
+                    sem_post(data.image[IDprocrms].semptr[semnb]);
+            }
+            data.image[IDprocrms].md[0].cnt0++;
+            data.image[IDprocrms].md[0].write = 0;
+        }
+
+
+	//	printf("wait\n");
+	//	fflush(stdout);
+
+		if(twait1<0)
+			twait1 = 0;
+		
+		if(twait>0)
+			usleep(twait1);
+				
+		clock_gettime(CLOCK_REALTIME, &t1);
+        tdiff = info_time_diff(t0, t1);
+        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
+	
+		if(tdiffv<1.0e-6*twait) 
+			twait1 ++;
+		else
+			twait1 --;
+		
+		
+		//printf("%ld   timing info : %11.9lf  %ld %ld\n", iter, tdiffv, twait1, twait);
+		//fflush(stdout);
 
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+        {
+            loopOK = 0;
+            printf("Exiting loop\n");
+            fflush(stdout);
+            sleep(1.0);
+        }
 
-    int NBaveSTEP = 10; // each step is 2x longer average than previous step
-    double stepcoeff;
-    double stepcoeff0 = 0.3;
-    char process_ave_name[200];
-    char process_rms_name[200];
-    long IDprocave;
-    long IDprocrms;
-    long step;
+        initref = 1;
+        iter++;
+    }
 
-    long semnb;
-    double tmpv;
+    if(MODEVALCOMPUTE==1)
+    {
+        cudaFree(d_modes);
+        cudaFree(d_in);
+        cudaFree(d_modeval);
 
-    int INNORMMODE = 0; // 1 if input normalized
 
-    float *modevalarray;
-    float *modevalarrayref;
 
-    int initref = 0; // 1 when reference has been processed
-    int BETAMODE = 0;
-    long IDrefout;
+        if (cublasH ) cublasDestroy(cublasH);
+    }
 
-    long refindex;
-	long twait1;
-    struct timespec t0;
-    struct timespec t1;
+    free(normcoeff);
+    free(modevalarray);
+    free(modevalarrayref);
 
-    int MODEVALCOMPUTE = 1; // 1 if compute, 0 if import
 
 
-	int RT_priority = 80; //any number from 0-99
-    struct sched_param schedpar;
 
+    return(0);
+}
 
 
-    schedpar.sched_priority = RT_priority;
-#ifndef __MACH__
-    sched_setscheduler(0, SCHED_FIFO, &schedpar); 
-#endif
 
 
 
 
-    IDin = image_ID(in_stream);
-    m = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
-    COREMOD_MEMORY_image_set_createsem(in_stream, 10);
 
-    // total flux
-    IDintot = image_ID(intot_stream);
 
-    if(IDintot==-1)
-    {
-        INNORMMODE = 0;
-        IDintot = create_2Dimage_ID("intot_tmp", 1, 1);
-        data.image[IDintot].array.F[0] = 1.0;
-    }
-    else
-        INNORMMODE = 1;
 
-    // reference
-    IDref = image_ID(IDrefin_name);
-    if(IDref==-1)
-    {
-        IDref = create_2Dimage_ID("_tmprefin", data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1]);
-        for(ii=0; ii<data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1]; ii++)
-            data.image[IDref].array.F[ii] = 0.0;
-    }
 
 
 
-    if(axmode==0)
-    {
-        IDmodes = image_ID(IDmodes_name);
-        n = data.image[IDmodes].md[0].size[2];
-        NBmodes = n;
-    }
-    else
-    {
-        ID = image_ID(IDmodes_name);
-        printf("Modes: ID = %ld   %s\n", ID, IDmodes_name);
-        fflush(stdout);
 
-        NBmodes = data.image[ID].md[0].size[0]*data.image[ID].md[0].size[1];
-        n = NBmodes;
-        printf("NBmodes = %ld\n", NBmodes);
-        fflush(stdout);
 
-        printf("creating _tmpmodes  %ld %ld %ld\n", (long) data.image[IDin].md[0].size[0], (long) data.image[IDin].md[0].size[1], NBmodes);
-        fflush(stdout);
 
 
-        IDmodes = create_3Dimage_ID("_tmpmodes", data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1], NBmodes);
 
-        for(ii=0; ii<data.image[IDin].md[0].size[0]; ii++)
-            for(jj=0; jj<data.image[IDin].md[0].size[1]; jj++)
-            {
-                for(kk=0; kk<NBmodes; kk++)
-                    data.image[IDmodes].array.F[kk*data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1]+jj*data.image[IDin].md[0].size[0]+ii] = data.image[ID].array.F[NBmodes*(jj*data.image[IDin].md[0].size[0]+ii)+kk];
-            }
-        save_fits("_tmpmodes", "!_test_tmpmodes.fits");
-    }
+/**
+ * PTX source of the modal filter kernel, JIT-compiled by the CUDA driver (no nvcc in the build)
+ *
+ * cmd[k] = mult[k] * clip( cmd[k] - gain[k]*meas[k] + pf[k], limit[k] )\n
+ * pf is optional (0 pointer). Same filter as AOloopControl CPU modal filter.
+ */
+static const char *CUDACOMP_modalfilter_ptx =
+    ".version 6.0\n"
+    ".target sm_50\n"
+    ".address_size 64\n"
+    ".visible .entry modalfilter(.param .u64 p_cmd, .param .u64 p_meas, .param .u64 p_gain, .param .u64 p_mult, .param .u64 p_limit, .param .u64 p_pf, .param .u32 p_n)\n"
+    "{\n"
+    "  .reg .pred %p<3>;\n"
+    "  .reg .b32 %r<6>;\n"
+    "  .reg .f32 %f<10>;\n"
+    "  .reg .b64 %rd<16>;\n"
+    "  ld.param.u64 %rd1, [p_cmd];\n"
+    "  ld.param.u64 %rd2, [p_meas];\n"
+    "  ld.param.u64 %rd3, [p_gain];\n"
+    "  ld.param.u64 %rd4, [p_mult];\n"
+    "  ld.param.u64 %rd5, [p_limit];\n"
+    "  ld.param.u64 %rd6, [p_pf];\n"
+    "  ld.param.u32 %r1, [p_n];\n"
+    "  mov.u32 %r2, %ctaid.x;\n"
+    "  mov.u32 %r3, %ntid.x;\n"
+    "  mov.u32 %r4, %tid.x;\n"
+    "  mad.lo.s32 %r5, %r2, %r3, %r4;\n"
+    "  setp.ge.s32 %p1, %r5, %r1;\n"
+    "  @%p1 bra DONE;\n"
+    "  mul.wide.s32 %rd7, %r5, 4;\n"
+    "  cvta.to.global.u64 %rd8, %rd1;\n"
+    "  add.s64 %rd8, %rd8, %rd7;\n"
+    "  cvta.to.global.u64 %rd9, %rd2;\n"
+    "  add.s64 %rd9, %rd9, %rd7;\n"
+    "  cvta.to.global.u64 %rd10, %rd3;\n"
+    "  add.s64 %rd10, %rd10, %rd7;\n"
+    "  cvta.to.global.u64 %rd11, %rd4;\n"
+    "  add.s64 %rd11, %rd11, %rd7;\n"
+    "  cvta.to.global.u64 %rd12, %rd5;\n"
+    "  add.s64 %rd12, %rd12, %rd7;\n"
+    "  ld.global.f32 %f1, [%rd8];\n"
+    "  ld.global.f32 %f2, [%rd9];\n"
+    "  ld.global.f32 %f3, [%rd10];\n"
+    "  ld.global.f32 %f4, [%rd11];\n"
+    "  ld.global.f32 %f5, [%rd12];\n"
+    "  mul.f32 %f6, %f3, %f2;\n"
+    "  sub.f32 %f7, %f1, %f6;\n"
+    "  setp.eq.u64 %p2, %rd6, 0;\n"
+    "  @%p2 bra NOPF;\n"
+    "  cvta.to.global.u64 %rd13, %rd6;\n"
+    "  add.s64 %rd13, %rd13, %rd7;\n"
+    "  ld.global.f32 %f8, [%rd13];\n"
+    "  add.f32 %f7, %f7, %f8;\n"
+    "NOPF:\n"
+    "  neg.f32 %f9, %f5;\n"
+    "  min.f32 %f7, %f7, %f5;\n"
+    "  max.f32 %f7, %f7, %f9;\n"
+    "  mul.f32 %f7, %f7, %f4;\n"
+    "  st.global.f32 [%rd8], %f7;\n"
+    "DONE:\n"
+    "  ret;\n"
+    "}\n";
 
 
 
-    normcoeff = (float*) malloc(sizeof(float)*NBmodes);
 
-    if(MODENORM==1)
+/**
+ * @brief Upload per-mode parameter vector to GPU if its stream has been updated
+ */
+static int CUDACOMP_modalPipeline_upload(long ID, float *d_vec, long NBmodes, long long *cnt, cudaStream_t stream)
+{
+    if(data.image[ID].md[0].cnt0 != *cnt)
     {
-        for(k=0; k<NBmodes; k++)
-        {
-            normcoeff[k] = 0.0;
-            for(ii=0; ii<m; ii++)
-                normcoeff[k] += data.image[IDmodes].array.F[k*m+ii] * data.image[IDmodes].array.F[k*m+ii];
-        }
+        cudaMemcpyAsync(d_vec, data.image[ID].array.F, sizeof(float)*NBmodes, cudaMemcpyHostToDevice, stream);
+        *cnt = data.image[ID].md[0].cnt0;
+        return(1);
     }
-    else
-        for(k=0; k<NBmodes; k++)
-            normcoeff[k] = 1.0;
+    return(0);
+}
+
 
 
 
+//
+// single GPU, single CUDA stream
+// WFS -> modes -> modal filter -> DM map, mode coefficients stay on GPU
+//
+int CUDACOMP_modalPipelineLoop(const char *in_stream, const char *IDwfsmodes_name, const char *IDwfsref_name, const char *IDgain_name, const char *IDmult_name, const char *IDlimit_name, const char *IDpf_name, const char *IDDMmodes_name, const char *IDout_name, const char *IDtelem_name, int GPUindex, int insem)
+{
+    long IDin, IDwfsmodes, IDwfsref, IDgain, IDmult, IDlimit, IDpf, IDDMmodes, IDout, IDtelem;
+    long m, mdm;
+    long NBmodes;
+    int k;
+    uint32_t *sizearray;
+    cublasHandle_t cublasH = NULL;
+    cublasStatus_t cublas_status = CUBLAS_STATUS_SUCCESS;
+    cudaError_t cudaStat = cudaSuccess;
+    cudaStream_t stream;
+    CUmodule module;
+    CUfunction kernel;
+    CUresult custat;
 
+    float *d_wfsmodes = NULL;
+    float *d_in = NULL;
+    float *d_mref = NULL;
+    float *d_meas = NULL;
+    float *d_cmd = NULL;
+    float *d_gain = NULL;
+    float *d_mult = NULL;
+    float *d_limit = NULL;
+    float *d_pf = NULL;
+    float *d_DMmodes = NULL;
+    float *d_out = NULL;
+    CUdeviceptr pf_ptr = 0;
+    void *kargs[7];
+    int kn;
 
-    modevalarray = (float*) malloc(sizeof(float)*n);
-    modevalarrayref = (float*) malloc(sizeof(float)*n);
+    float alpha = 1.0;
+    float beta;
+    long long cnt = -1;
+    long long cntgain = -1;
+    long long cntmult = -1;
+    long long cntlimit = -1;
+    long long cntpf = -1;
+    long long cntref = -1;
+    int inpinned = 0;
+    int loopOK;
+    long iter;
+    int semr;
+    struct timespec ts;
 
 
-    arraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
 
-    IDrefout = image_ID(IDrefout_name);
-    if(IDrefout==-1)
-    {
-        arraytmp[0] = NBmodes;
-        arraytmp[1] = 1;
-    }
-    else
+    IDin = image_ID(in_stream);
+    IDwfsmodes = image_ID(IDwfsmodes_name);
+    IDDMmodes = image_ID(IDDMmodes_name);
+    IDgain = image_ID(IDgain_name);
+    IDmult = image_ID(IDmult_name);
+    IDlimit = image_ID(IDlimit_name);
+    IDout = image_ID(IDout_name);
+    if((IDin==-1)||(IDwfsmodes==-1)||(IDDMmodes==-1)||(IDgain==-1)||(IDmult==-1)||(IDlimit==-1)||(IDout==-1))
     {
-        arraytmp[0] = data.image[IDrefout].md[0].size[0];
-        arraytmp[1] = data.image[IDrefout].md[0].size[1];
+        printERROR(__FILE__, __func__, __LINE__, "missing input, modes, filter parameter or output stream");
+        exit(0);
     }
+    IDwfsref = image_ID(IDwfsref_name); // optional
+    IDpf = image_ID(IDpf_name);         // optional
 
+    m = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+    NBmodes = data.image[IDwfsmodes].md[0].size[2];
+    mdm = data.image[IDDMmodes].md[0].size[0]*data.image[IDDMmodes].md[0].size[1];
 
-
-
-
-    ID_modeval = image_ID(IDmodes_val_name);
-    if(ID_modeval==-1) // CREATE IT
+    if((data.image[IDwfsmodes].md[0].size[0]*data.image[IDwfsmodes].md[0].size[1] != m)||(data.image[IDDMmodes].md[0].size[2] != NBmodes)
+            ||(data.image[IDout].md[0].nelement != mdm)||(data.image[IDgain].md[0].nelement < NBmodes)
+            ||(data.image[IDmult].md[0].nelement < NBmodes)||(data.image[IDlimit].md[0].nelement < NBmodes)
+            ||((IDwfsref != -1)&&(data.image[IDwfsref].md[0].nelement != m))||((IDpf != -1)&&(data.image[IDpf].md[0].nelement < NBmodes)))
     {
-        ID_modeval = create_image_ID(IDmodes_val_name, 2, arraytmp, _DATATYPE_FLOAT, 1, 0);
-        COREMOD_MEMORY_image_set_createsem(IDmodes_val_name, 10);
-        MODEVALCOMPUTE = 1;
+        printERROR(__FILE__, __func__, __LINE__, "incompatible stream sizes");
+        exit(0);
     }
-    else // USE STREAM, DO NOT COMPUTE IT
+    COREMOD_MEMORY_image_set_createsem(IDout_name, 5);
+
+    // telemetry: measured (row 0) and filtered (row 1) mode values
+    IDtelem = image_ID(IDtelem_name);
+    if((IDtelem == -1)&&(strcmp(IDtelem_name, "NULL") != 0))
     {
-        MODEVALCOMPUTE = 0;
-        // drive semaphore to zero
-        while(sem_trywait(data.image[ID_modeval].semptr[insem])==0) {}
+        sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+        sizearray[0] = NBmodes;
+        sizearray[1] = 2;
+        IDtelem = create_image_ID(IDtelem_name, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+        free(sizearray);
+        COREMOD_MEMORY_image_set_createsem(IDtelem_name, 2);
+    }
+    if((IDtelem != -1)&&(data.image[IDtelem].md[0].nelement < 2*NBmodes))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "telemetry stream too small");
+        exit(0);
     }
 
-    free(arraytmp);
-
-
-
+    printf("Modal pipeline: %ld WFS pixels -> %ld modes -> %ld DM actuators\n", m, NBmodes, mdm);
+    printf("    reference: %s   predictive input: %s   telemetry: %s\n", (IDwfsref==-1) ? "no" : "yes", (IDpf==-1) ? "no" : "yes", (IDtelem==-1) ? "no" : "yes");
+    fflush(stdout);
 
 
-    if(MODEVALCOMPUTE == 1)
+    cudaGetDeviceCount(&deviceCount);
+    if(GPUindex<deviceCount)
+        cudaSetDevice(GPUindex);
+    else
     {
-        cudaGetDeviceCount(&deviceCount);
-        printf("%d devices found\n", deviceCount);
-        fflush(stdout);
-        printf("\n");
-        for (k = 0; k < deviceCount; ++k) {
-            cudaGetDeviceProperties(&deviceProp, k);
-            printf("Device %d [ %20s ]  has compute capability %d.%d.\n",
-                   k, deviceProp.name, deviceProp.major, deviceProp.minor);
-            printf("  Total amount of global memory:                 %.0f MBytes (%llu bytes)\n", (float)deviceProp.totalGlobalMem/1048576.0f, (unsigned long long) deviceProp.totalGlobalMem);
-            printf("  (%2d) Multiprocessors\n", deviceProp.multiProcessorCount);
-            printf("  GPU Clock rate:                                %.0f MHz (%0.2f GHz)\n", deviceProp.clockRate * 1e-3f, deviceProp.clockRate * 1e-6f);
-            printf("\n");
-        }
-
-
-        if(GPUindex<deviceCount)
-            cudaSetDevice(GPUindex);
-        else
-        {
-            printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
-            exit(0);
-        }
-
-
-        printf("Create cublas handle ...");
-        fflush(stdout);
-        cublas_status = cublasCreate(&cublasH);
-        if (cublas_status != CUBLAS_STATUS_SUCCESS) {
-            printf ("CUBLAS initialization failed\n");
-            return EXIT_FAILURE;
-        }
-        printf(" done\n");
-        fflush(stdout);
+        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
+        exit(0);
+    }
+    cudaFree(0); // create primary context, shared with driver API calls below
 
+    cublas_status = cublasCreate(&cublasH);
+    if (cublas_status != CUBLAS_STATUS_SUCCESS) {
+        printf ("CUBLAS initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking);
+    cublasSetStream(cublasH, stream);
 
-        // load modes to GPU
-        cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
-        if (cudaStat != cudaSuccess)
-        {
-            printf("cudaMalloc d_modes returned error code %d, line %d\n", cudaStat, __LINE__);
-            exit(EXIT_FAILURE);
-        }
-        cudaStat = cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
-        if (cudaStat != cudaSuccess)
-        {
-            printf("cudaMemcpy returned error code %d, line %d\n", cudaStat, __LINE__);
-            exit(EXIT_FAILURE);
-        }
+    custat = cuModuleLoadData(&module, CUDACOMP_modalfilter_ptx);
+    if(custat == CUDA_SUCCESS)
+        custat = cuModuleGetFunction(&kernel, module, "modalfilter");
+    if(custat != CUDA_SUCCESS)
+    {
+        printf("modal filter kernel JIT compilation returned error code %d, line(%d)\n", custat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
 
 
-        // create d_in
+    cudaStat = cudaMalloc((void**)&d_wfsmodes, sizeof(float)*m*NBmodes);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_DMmodes, sizeof(float)*mdm*NBmodes);
+    if(cudaStat == cudaSuccess)
         cudaStat = cudaMalloc((void**)&d_in, sizeof(float)*m);
-        if (cudaStat != cudaSuccess)
-        {
-            printf("cudaMalloc d_in returned error code %d, line %d\n", cudaStat, __LINE__);
-            exit(EXIT_FAILURE);
-        }
-
-
-        // create d_modeval
-        cudaStat = cudaMalloc((void**)&d_modeval, sizeof(float)*NBmodes);
-        if (cudaStat != cudaSuccess)
-        {
-            printf("cudaMalloc d_modeval returned error code %d, line %d\n", cudaStat, __LINE__);
-            exit(EXIT_FAILURE);
-        }
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_out, sizeof(float)*mdm);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_mref, sizeof(float)*NBmodes*7); // mode vectors: ref, meas, cmd, gain, mult, limit, pf
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
     }
-
+    d_meas = d_mref + NBmodes;
+    d_cmd = d_mref + 2*NBmodes;
+    d_gain = d_mref + 3*NBmodes;
+    d_mult = d_mref + 4*NBmodes;
+    d_limit = d_mref + 5*NBmodes;
+    d_pf = d_mref + 6*NBmodes;
+    cudaMemset(d_mref, 0, sizeof(float)*NBmodes*7);
+
+    cudaMemcpy(d_wfsmodes, data.image[IDwfsmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_DMmodes, data.image[IDDMmodes].array.F, sizeof(float)*mdm*NBmodes, cudaMemcpyHostToDevice);
+    cudaDeviceSynchronize(); // loop runs on non-blocking stream: setup must be complete
+
+    // pinned host buffers: transfers overlap with nothing else but avoid staging copies
+    if(cudaHostRegister(data.image[IDin].array.F, sizeof(float)*m, cudaHostRegisterPortable) == cudaSuccess)
+        inpinned = 1;
+    cudaHostRegister(data.image[IDout].array.F, sizeof(float)*mdm, cudaHostRegisterPortable);
+    if(IDtelem != -1)
+        cudaHostRegister(data.image[IDtelem].array.F, sizeof(float)*2*NBmodes, cudaHostRegisterPortable);
+
+    if(IDpf != -1)
+        pf_ptr = (CUdeviceptr) d_pf;
+    kn = (int) NBmodes;
+    kargs[0] = &d_cmd;
+    kargs[1] = &d_meas;
+    kargs[2] = &d_gain;
+    kargs[3] = &d_mult;
+    kargs[4] = &d_limit;
+    kargs[5] = &pf_ptr;
+    kargs[6] = &kn;
 
 
     if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
@@ -4362,381 +7306,826 @@ int CUDACOMP_extractModesLoop(const char *in_stream, const char *intot_stream, c
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
 
 
     loopOK = 1;
     iter = 0;
 
-
-
-
-
-    if(TRACEMODE==1)
+    while(loopOK == 1)
     {
-        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
-        sprintf(traceim_name, "%s_trace", IDmodes_val_name);
-        sizearraytmp[0] = TRACEsize;
-        sizearraytmp[1] = NBmodes;
-        IDtrace = image_ID(traceim_name);
-        imOK = 1;
-        if(IDtrace == -1)
-            imOK = 0;
+        if(data.image[IDin].md[0].sem==0)
+        {
+            while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
+                usleep(5);
+            cnt = data.image[IDin].md[0].cnt0;
+            semr = 0;
+        }
         else
         {
-            if((data.image[IDtrace].md[0].size[0]!=TRACEsize)||(data.image[IDtrace].md[0].size[1]!=NBmodes))
-            {
-                imOK = 0;
-                delete_image_ID(traceim_name);
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                perror("clock_gettime");
+                exit(EXIT_FAILURE);
             }
+            ts.tv_sec += 1;
+            semr = sem_timedwait(data.image[IDin].semptr[insem], &ts);
+
+            // drive semaphore to zero
+            while(sem_trywait(data.image[IDin].semptr[insem])==0) {}
         }
-        if(imOK==0)
-            IDtrace = create_image_ID(traceim_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
-        COREMOD_MEMORY_image_set_createsem(traceim_name, 10);
-        free(sizearraytmp);
-    }
 
+        if(semr==0)
+        {
+            // filter parameters and predictive input: uploaded when updated
+            CUDACOMP_modalPipeline_upload(IDgain, d_gain, NBmodes, &cntgain, stream);
+            CUDACOMP_modalPipeline_upload(IDmult, d_mult, NBmodes, &cntmult, stream);
+            CUDACOMP_modalPipeline_upload(IDlimit, d_limit, NBmodes, &cntlimit, stream);
+            if(IDpf != -1)
+                CUDACOMP_modalPipeline_upload(IDpf, d_pf, NBmodes, &cntpf, stream);
+
+            // reference mode values  d_mref = WFSmodes^T x ref
+            if(IDwfsref != -1)
+                if(data.image[IDwfsref].md[0].cnt0 != cntref)
+                {
+                    beta = 0.0;
+                    cudaMemcpyAsync(d_in, data.image[IDwfsref].array.F, sizeof(float)*m, cudaMemcpyHostToDevice, stream);
+                    cublasSgemv(cublasH, CUBLAS_OP_T, m, NBmodes, &alpha, d_wfsmodes, m, d_in, 1, &beta, d_mref, 1);
+                    cntref = data.image[IDwfsref].md[0].cnt0;
+                }
 
+            // WFS -> modes   d_meas = WFSmodes^T x in - d_mref
+            cudaMemcpyAsync(d_in, data.image[IDin].array.F, sizeof(float)*m, cudaMemcpyHostToDevice, stream);
+            cudaMemcpyAsync(d_meas, d_mref, sizeof(float)*NBmodes, cudaMemcpyDeviceToDevice, stream);
+            beta = -1.0;
+            cublas_status = cublasSgemv(cublasH, CUBLAS_OP_T, m, NBmodes, &alpha, d_wfsmodes, m, d_in, 1, &beta, d_meas, 1);
+            if (cublas_status != CUBLAS_STATUS_SUCCESS)
+            {
+                printf("cublasSgemv returned error code %d, line(%d)\n", cublas_status, __LINE__);
+                exit(EXIT_FAILURE);
+            }
 
+            // modal filter: gain, predictive term, limit, mult
+            custat = cuLaunchKernel(kernel, (kn+255)/256, 1, 1, 256, 1, 1, 0, (CUstream) stream, kargs, NULL);
+            if(custat != CUDA_SUCCESS)
+            {
+                printf("cuLaunchKernel returned error code %d, line(%d)\n", custat, __LINE__);
+                exit(EXIT_FAILURE);
+            }
 
+            // modes -> DM   d_out = DMmodes x d_cmd
+            beta = 0.0;
+            cublasSgemv(cublasH, CUBLAS_OP_N, mdm, NBmodes, &alpha, d_DMmodes, mdm, d_cmd, 1, &beta, d_out, 1);
 
-    if(PROCESS==1)
-    {
-        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
-        sprintf(process_ave_name, "%s_ave", IDmodes_val_name);
-        sizearraytmp[0] = NBmodes;
-        sizearraytmp[1] = NBaveSTEP;
-        IDprocave = image_ID(process_ave_name);
-        imOK = 1;
-        if(IDprocave == -1)
-            imOK = 0;
-        else
-        {
-            if((data.image[IDprocave].md[0].size[0]!=NBmodes)||(data.image[IDprocave].md[0].size[1]!=NBaveSTEP))
+            data.image[IDout].md[0].write = 1;
+            cudaMemcpyAsync(data.image[IDout].array.F, d_out, sizeof(float)*mdm, cudaMemcpyDeviceToHost, stream);
+            if(IDtelem != -1)
             {
-                imOK = 0;
-                delete_image_ID(process_ave_name);
+                data.image[IDtelem].md[0].write = 1;
+                cudaMemcpyAsync(data.image[IDtelem].array.F, d_meas, sizeof(float)*2*NBmodes, cudaMemcpyDeviceToHost, stream); // d_meas, d_cmd contiguous
+            }
+            cudaStat = cudaStreamSynchronize(stream);
+            if (cudaStat != cudaSuccess)
+            {
+                printf("cudaStreamSynchronize returned error code %d, line(%d)\n", cudaStat, __LINE__);
+                exit(EXIT_FAILURE);
             }
-        }
-        if(imOK==0)
-            IDprocave = create_image_ID(process_ave_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
-        COREMOD_MEMORY_image_set_createsem(process_ave_name, 10);
-        free(sizearraytmp);
 
-        sizearraytmp = (uint32_t*) malloc(sizeof(uint32_t)*2);
-        sprintf(process_rms_name, "%s_rms", IDmodes_val_name);
-        sizearraytmp[0] = NBmodes;
-        sizearraytmp[1] = NBaveSTEP;
-        IDprocrms = image_ID(process_rms_name);
-        imOK = 1;
-        if(IDprocrms == -1)
-            imOK = 0;
-        else
-        {
-            if((data.image[IDprocrms].md[0].size[0]!=NBmodes)||(data.image[IDprocrms].md[0].size[1]!=NBaveSTEP))
+            COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+            data.image[IDout].md[0].cnt0++;
+            data.image[IDout].md[0].write = 0;
+            if(IDtelem != -1)
             {
-                imOK = 0;
-                delete_image_ID(process_rms_name);
+                COREMOD_MEMORY_image_set_sempost_byID(IDtelem, -1);
+                data.image[IDtelem].md[0].cnt0++;
+                data.image[IDtelem].md[0].write = 0;
             }
         }
-        if(imOK==0)
-            IDprocrms = create_image_ID(process_rms_name, 2, sizearraytmp, _DATATYPE_FLOAT, 1, 0);
-        COREMOD_MEMORY_image_set_createsem(process_rms_name, 10);
-        free(sizearraytmp);
+
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+            loopOK = 0;
+
+        iter++;
     }
 
 
-    initref = 0;
+    if(inpinned == 1)
+        cudaHostUnregister(data.image[IDin].array.F);
+    cudaHostUnregister(data.image[IDout].array.F);
+    if(IDtelem != -1)
+        cudaHostUnregister(data.image[IDtelem].array.F);
 
+    cuModuleUnload(module);
+    cudaFree(d_wfsmodes);
+    cudaFree(d_DMmodes);
+    cudaFree(d_in);
+    cudaFree(d_out);
+    cudaFree(d_mref);
+    cudaStreamDestroy(stream);
 
+    if (cublasH ) cublasDestroy(cublasH);
 
+    return(0);
+}
 
 
 
-	twait1 = twait;
 
-    while(loopOK == 1)
-    {
-		clock_gettime(CLOCK_REALTIME, &t0);
-				
-        if(MODEVALCOMPUTE==1)
-        {
-            if(refindex != data.image[IDref].md[0].cnt0)
-            {
-                initref = 0;
-                refindex = data.image[IDref].md[0].cnt0;
-            }
+/**
+ * PTX source of the persistent MVM kernel, JIT-compiled by the CUDA driver (no nvcc in the build)
+ *
+ * Kernel stays resident: thread 0 of each block polls frame counter *flag (mapped host memory).
+ * For each new frame, blocks stage the input (mapped host memory) in shared memory by tiles, each warp
+ * accumulates the dot products of its modes (mode k -> warp k % NBwarps, slot k / NBwarps), then reduces with warp shuffles:\n
+ * out[k] = sum_i modes[k*m+i] x in[i] - mref[k]\n
+ * The last block to complete writes the frame counter to *done. Kernel exits when *flag = -1.\n
+ * Dynamic shared memory: tile + nslot x blockDim floats.
+ */
+static const char *CUDACOMP_persistmvm_ptx =
+    ".version 6.0\n"
+    ".target sm_50\n"
+    ".address_size 64\n"
+    ".extern .shared .align 4 .b8 smem[];\n"
+    ".visible .entry persistmvm(.param .u64 p_flag, .param .u64 p_done, .param .u64 p_count, .param .u64 p_in, .param .u64 p_modes, .param .u64 p_mref, .param .u64 p_out, .param .u32 p_m, .param .u32 p_n, .param .u32 p_nslot, .param .u32 p_tile)\n"
+    "{\n"
+    "  .reg .pred %p<8>;\n"
+    "  .reg .b32 %r<30>;\n"
+    "  .reg .f32 %f<8>;\n"
+    "  .reg .b64 %rd<20>;\n"
+    "  .shared .align 4 .u32 sflag;\n"
+    "  ld.param.u64 %rd1, [p_flag];\n"
+    "  ld.param.u64 %rd2, [p_done];\n"
+    "  ld.param.u64 %rd3, [p_count];\n"
+    "  ld.param.u64 %rd4, [p_in];\n"
+    "  ld.param.u64 %rd5, [p_modes];\n"
+    "  ld.param.u64 %rd6, [p_mref];\n"
+    "  ld.param.u64 %rd7, [p_out];\n"
+    "  ld.param.u32 %r1, [p_m];\n"
+    "  ld.param.u32 %r2, [p_n];\n"
+    "  ld.param.u32 %r3, [p_nslot];\n"
+    "  ld.param.u32 %r4, [p_tile];\n"
+    "  cvta.to.global.u64 %rd1, %rd1;\n"
+    "  cvta.to.global.u64 %rd2, %rd2;\n"
+    "  cvta.to.global.u64 %rd3, %rd3;\n"
+    "  cvta.to.global.u64 %rd4, %rd4;\n"
+    "  cvta.to.global.u64 %rd5, %rd5;\n"
+    "  cvta.to.global.u64 %rd6, %rd6;\n"
+    "  cvta.to.global.u64 %rd7, %rd7;\n"
+    "  mov.u32 %r5, %tid.x;\n"
+    "  mov.u32 %r6, %ntid.x;\n"
+    "  mov.u32 %r7, %ctaid.x;\n"
+    "  mov.u32 %r8, %nctaid.x;\n"
+    "  and.b32 %r9, %r5, 31;\n"                 // lane
+    "  shr.u32 %r10, %r5, 5;\n"                 // warp in block
+    "  shr.u32 %r11, %r6, 5;\n"                 // warps per block
+    "  mad.lo.u32 %r12, %r7, %r11, %r10;\n"     // global warp
+    "  mul.lo.u32 %r13, %r8, %r11;\n"           // total number of warps
+    "  mov.u32 %r14, smem;\n"                   // input tile
+    "  shl.b32 %r15, %r4, 2;\n"
+    "  add.u32 %r16, %r14, %r15;\n"             // accumulators
+    "  mov.u32 %r17, 0;\n"                      // last frame counter
+    "  setp.ne.u32 %p1, %r5, 0;\n"
+    "WAIT:\n"
+    "  @%p1 bra SYNC;\n"
+    "POLL:\n"
+    "  ld.volatile.global.u32 %r18, [%rd1];\n"
+    "  setp.eq.u32 %p2, %r18, %r17;\n"
+    "  @%p2 bra POLL;\n"
+    "  st.shared.u32 [sflag], %r18;\n"
+    "SYNC:\n"
+    "  bar.sync 0;\n"
+    "  ld.shared.u32 %r17, [sflag];\n"
+    "  setp.eq.u32 %p3, %r17, 0xffffffff;\n"
+    "  @%p3 bra EXIT;\n"
+    "  mov.u32 %r19, 0;\n"
+    "  mov.f32 %f7, 0f00000000;\n"
+    "ZLOOP:\n"
+    "  setp.ge.u32 %p4, %r19, %r3;\n"
+    "  @%p4 bra ZDONE;\n"
+    "  mad.lo.u32 %r20, %r19, %r6, %r5;\n"
+    "  shl.b32 %r20, %r20, 2;\n"
+    "  add.u32 %r20, %r20, %r16;\n"
+    "  st.shared.f32 [%r20], %f7;\n"
+    "  add.u32 %r19, %r19, 1;\n"
+    "  bra ZLOOP;\n"
+    "ZDONE:\n"
+    "  mov.u32 %r21, 0;\n"                      // tile offset
+    "TLOOP:\n"
+    "  setp.ge.u32 %p4, %r21, %r1;\n"
+    "  @%p4 bra TDONE;\n"
+    "  sub.u32 %r22, %r1, %r21;\n"
+    "  min.u32 %r22, %r22, %r4;\n"              // tile size
+    "  bar.sync 0;\n"
+    "  mov.u32 %r23, %r5;\n"
+    "LLOOP:\n"
+    "  setp.ge.u32 %p5, %r23, %r22;\n"
+    "  @%p5 bra LDONE;\n"
+    "  add.u32 %r24, %r21, %r23;\n"
+    "  mul.wide.u32 %rd8, %r24, 4;\n"
+    "  add.s64 %rd9, %rd4, %rd8;\n"
+    "  ld.global.cv.f32 %f1, [%rd9];\n"
+    "  shl.b32 %r25, %r23, 2;\n"
+    "  add.u32 %r25, %r25, %r14;\n"
+    "  st.shared.f32 [%r25], %f1;\n"
+    "  add.u32 %r23, %r23, %r6;\n"
+    "  bra LLOOP;\n"
+    "LDONE:\n"
+    "  bar.sync 0;\n"
+    "  mov.u32 %r19, 0;\n"
+    "JLOOP:\n"
+    "  setp.ge.u32 %p4, %r19, %r3;\n"
+    "  @%p4 bra JDONE;\n"
+    "  mad.lo.u32 %r26, %r19, %r13, %r12;\n"    // mode index
+    "  setp.ge.u32 %p5, %r26, %r2;\n"
+    "  @%p5 bra JDONE;\n"
+    "  mad.lo.u32 %r20, %r19, %r6, %r5;\n"
+    "  shl.b32 %r20, %r20, 2;\n"
+    "  add.u32 %r20, %r20, %r16;\n"
+    "  ld.shared.f32 %f2, [%r20];\n"
+    "  mul.wide.u32 %rd10, %r26, %r1;\n"
+    "  cvt.u64.u32 %rd11, %r21;\n"
+    "  add.s64 %rd10, %rd10, %rd11;\n"
+    "  shl.b64 %rd10, %rd10, 2;\n"
+    "  add.s64 %rd10, %rd5, %rd10;\n"
+    "  mov.u32 %r23, %r9;\n"
+    "ILOOP:\n"
+    "  setp.ge.u32 %p6, %r23, %r22;\n"
+    "  @%p6 bra IDONE;\n"
+    "  mul.wide.u32 %rd12, %r23, 4;\n"
+    "  add.s64 %rd13, %rd10, %rd12;\n"
+    "  ld.global.nc.f32 %f3, [%rd13];\n"
+    "  shl.b32 %r25, %r23, 2;\n"
+    "  add.u32 %r25, %r25, %r14;\n"
+    "  ld.shared.f32 %f4, [%r25];\n"
+    "  fma.rn.f32 %f2, %f3, %f4, %f2;\n"
+    "  add.u32 %r23, %r23, 32;\n"
+    "  bra ILOOP;\n"
+    "IDONE:\n"
+    "  st.shared.f32 [%r20], %f2;\n"
+    "  add.u32 %r19, %r19, 1;\n"
+    "  bra JLOOP;\n"
+    "JDONE:\n"
+    "  add.u32 %r21, %r21, %r4;\n"
+    "  bra TLOOP;\n"
+    "TDONE:\n"
+    "  mov.u32 %r19, 0;\n"
+    "RLOOP:\n"
+    "  setp.ge.u32 %p4, %r19, %r3;\n"
+    "  @%p4 bra RDONE;\n"
+    "  mad.lo.u32 %r26, %r19, %r13, %r12;\n"
+    "  setp.ge.u32 %p5, %r26, %r2;\n"
+    "  @%p5 bra RDONE;\n"
+    "  mad.lo.u32 %r20, %r19, %r6, %r5;\n"
+    "  shl.b32 %r20, %r20, 2;\n"
+    "  add.u32 %r20, %r20, %r16;\n"
+    "  ld.shared.f32 %f2, [%r20];\n"
+    "  shfl.sync.down.b32 %f5, %f2, 16, 31, 0xffffffff;\n"
+    "  add.f32 %f2, %f2, %f5;\n"
+    "  shfl.sync.down.b32 %f5, %f2, 8, 31, 0xffffffff;\n"
+    "  add.f32 %f2, %f2, %f5;\n"
+    "  shfl.sync.down.b32 %f5, %f2, 4, 31, 0xffffffff;\n"
+    "  add.f32 %f2, %f2, %f5;\n"
+    "  shfl.sync.down.b32 %f5, %f2, 2, 31, 0xffffffff;\n"
+    "  add.f32 %f2, %f2, %f5;\n"
+    "  shfl.sync.down.b32 %f5, %f2, 1, 31, 0xffffffff;\n"
+    "  add.f32 %f2, %f2, %f5;\n"
+    "  setp.ne.u32 %p6, %r9, 0;\n"
+    "  @%p6 bra RNEXT;\n"
+    "  mul.wide.u32 %rd14, %r26, 4;\n"
+    "  add.s64 %rd15, %rd6, %rd14;\n"
+    "  ld.global.cv.f32 %f6, [%rd15];\n"
+    "  sub.f32 %f2, %f2, %f6;\n"
+    "  add.s64 %rd16, %rd7, %rd14;\n"
+    "  st.global.f32 [%rd16], %f2;\n"
+    "RNEXT:\n"
+    "  add.u32 %r19, %r19, 1;\n"
+    "  bra RLOOP;\n"
+    "RDONE:\n"
+    "  membar.sys;\n"
+    "  bar.sync 0;\n"
+    "  @%p1 bra WAIT;\n"
+    "  atom.global.add.u32 %r27, [%rd3], 1;\n"
+    "  add.u32 %r27, %r27, 1;\n"
+    "  setp.ne.u32 %p7, %r27, %r8;\n"
+    "  @%p7 bra WAIT;\n"
+    "  mov.u32 %r28, 0;\n"
+    "  st.global.u32 [%rd3], %r28;\n"
+    "  membar.sys;\n"
+    "  st.volatile.global.u32 [%rd2], %r17;\n"
+    "  bra WAIT;\n"
+    "EXIT:\n"
+    "  ret;\n"
+    "}\n";
+
+
+
+
+#define PERSISTMVM_TIMEOUTUS 1000000  // maximum time [us] waiting for persistent kernel to complete a frame or to exit
 
-            if(initref==1)
-            {
-                if(data.image[IDin].md[0].sem==0)
-                {
-                    while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
-                        usleep(5);
-                    cnt = data.image[IDin].md[0].cnt0;
-                    semr = 0;
-                }
-                else
-                {
-                    if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-                        perror("clock_gettime");
-                        exit(EXIT_FAILURE);
-                    }
-                    ts.tv_sec += 1;
-                    semr = sem_timedwait(data.image[IDin].semptr[insem], &ts);
 
-                    // drive semaphore to zero
-                    while(sem_trywait(data.image[IDin].semptr[insem])==0) {}
-                }
-            }
-            else // compute response of reference immediately
-            {
-                printf("COMPUTE NEW REFERENCE RESPONSE\n");
-                semr = 0;
-            }
+//
+// single GPU, LOWFS-size problems (tens of modes): no kernel launch per frame
+// input and output streams are mapped in device address space, kernel polls frame counter in mapped host memory
+// all blocks must be co-resident (grid barrier through d_count): grid is limited by occupancy, and launched as cooperative kernel if supported
+//
+int CUDACOMP_persistentMVMLoop(const char *in_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, int insem)
+{
+    long IDin, IDmodes, IDref, IDout;
+    long m, NBmodes;
+    long k, ii;
+    cudaStream_t stream;
+    cudaError_t cudaStat = cudaSuccess;
+    struct cudaDeviceProp deviceProp;
+    CUmodule module;
+    CUfunction kernel;
+    CUresult custat;
+    CUdevice cudev;
+    int coop = 0;
+    int NBblockSM = 0;
+    int kernelOK = 1;                    // 0 if kernel did not respond within PERSISTMVM_TIMEOUTUS
+    struct timespec tspin0, tspin1;
+    long spincnt;
+
+    int NBthreads = 256;                 // threads per block (8 warps)
+    int tile = 4096;                     // input tile size [float]
+    int NBblocks, nslot;
+    unsigned int shmem;
+
+    volatile unsigned int *flag = NULL;  // mapped host memory: flag[0] = frame counter (host -> GPU), flag[1] = done (GPU -> host)
+    float *mref = NULL;                  // mapped host memory: reference mode values
+    unsigned int *d_count = NULL;
+    float *d_modes = NULL;
+    float *d_in, *d_out, *d_mref;
+    unsigned int *d_flag, *d_done;
+    void *kargs[11];
+    int km, kn;
+    unsigned int frame = 0;
 
+    long long cnt = -1;
+    long long cntref = -1;
+    int loopOK;
+    long iter;
+    int semr;
+    struct timespec ts;
 
 
-            if(semr==0)
-            {
-                // load in_stream to GPU
-                if(initref==0)
-                    cudaStat = cudaMemcpy(d_in, data.image[IDref].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
-                else
-                    cudaStat = cudaMemcpy(d_in, data.image[IDin].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
 
+    IDin = image_ID(in_stream);
+    IDmodes = image_ID(IDmodes_name);
+    IDout = image_ID(IDout_name);
+    if((IDin==-1)||(IDmodes==-1)||(IDout==-1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "missing input, modes or output stream");
+        exit(0);
+    }
+    IDref = image_ID(IDrefin_name); // optional
 
-                if (cudaStat != cudaSuccess)
-                {
-                    printf("initref = %d    %ld  %ld\n", initref, IDref, IDin);
-                    printf("cudaMemcpy returned error code %d, line %d\n", cudaStat, __LINE__);
-                    exit(EXIT_FAILURE);
-                }
+    m = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+    NBmodes = data.image[IDmodes].md[0].size[2];
+    if((data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1] != m)||(data.image[IDout].md[0].nelement < NBmodes)
+            ||((IDref != -1)&&(data.image[IDref].md[0].nelement != m)))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "incompatible stream sizes");
+        exit(0);
+    }
 
-                if(BETAMODE == 1)
-                {
-                    beta = -1.0;
-                    cudaStat = cudaMemcpy(d_modeval, modevalarrayref, sizeof(float)*NBmodes, cudaMemcpyHostToDevice);
-                }
 
-                // compute
-                cublas_status = cublasSgemv(cublasH, CUBLAS_OP_T, m, NBmodes, &alpha, d_modes, m, d_in, 1, &beta, d_modeval, 1);
-                if (cublas_status != CUBLAS_STATUS_SUCCESS)
-                {
-				printf("cublasSgemv returned error code %d, line(%d)\n", cublas_status, __LINE__);
-                fflush(stdout);
-                if(cublas_status == CUBLAS_STATUS_NOT_INITIALIZED)
-                    printf("   CUBLAS_STATUS_NOT_INITIALIZED\n");
-                if(cublas_status == CUBLAS_STATUS_INVALID_VALUE)
-                    printf("   CUBLAS_STATUS_INVALID_VALUE\n");
-                if(cublas_status == CUBLAS_STATUS_ARCH_MISMATCH)
-                    printf("   CUBLAS_STATUS_ARCH_MISMATCH\n");
-                if(cublas_status == CUBLAS_STATUS_EXECUTION_FAILED)
-                    printf("   CUBLAS_STATUS_EXECUTION_FAILED\n");
+    cudaGetDeviceCount(&deviceCount);
+    if(GPUindex<deviceCount)
+        cudaSetDevice(GPUindex);
+    else
+    {
+        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
+        exit(0);
+    }
+    cudaFree(0); // create primary context, shared with driver API calls below
+    cudaGetDeviceProperties(&deviceProp, GPUindex);
 
-                printf("GPU index                           = %d\n", GPUindex);
+    custat = cuModuleLoadData(&module, CUDACOMP_persistmvm_ptx);
+    if(custat == CUDA_SUCCESS)
+        custat = cuModuleGetFunction(&kernel, module, "persistmvm");
+    if(custat != CUDA_SUCCESS)
+    {
+        printf("persistent MVM kernel JIT compilation returned error code %d, line(%d)\n", custat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
 
-                printf("CUBLAS_OP                           = %d\n", CUBLAS_OP_T);
-                printf("alpha                               = %f\n", alpha);
-                printf("alpha                               = %f\n", beta);
-                printf("m                                   = %d\n", (int) m);
-                printf("NBmodes                             = %d\n", (int) NBmodes);
-                fflush(stdout);
-                exit(EXIT_FAILURE);								
-                }
+    // one block per multiprocessor at most, and no more blocks than can be resident at the same time
+    NBblocks = (NBmodes + NBthreads/32 - 1)/(NBthreads/32);
+    if(NBblocks > deviceProp.multiProcessorCount)
+        NBblocks = deviceProp.multiProcessorCount;
+    while(1)
+    {
+        nslot = (NBmodes + NBblocks*(NBthreads/32) - 1)/(NBblocks*(NBthreads/32));
+        shmem = sizeof(float)*(tile + nslot*NBthreads);
+        if(shmem > 48*1024)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "too many modes for persistent kernel");
+            exit(0);
+        }
+        custat = cuOccupancyMaxActiveBlocksPerMultiprocessor(&NBblockSM, kernel, NBthreads, shmem);
+        if((custat != CUDA_SUCCESS)||(NBblockSM < 1))
+        {
+            printERROR(__FILE__, __func__, __LINE__, "persistent kernel cannot be resident on device");
+            exit(0);
+        }
+        if(NBblocks <= NBblockSM*deviceProp.multiProcessorCount)
+            break;
+        NBblocks = NBblockSM*deviceProp.multiProcessorCount;
+    }
 
-                // copy result
-                data.image[ID_modeval].md[0].write = 1;
+    cuDeviceGet(&cudev, GPUindex);
+    if(cuDeviceGetAttribute(&coop, CU_DEVICE_ATTRIBUTE_COOPERATIVE_LAUNCH, cudev) != CUDA_SUCCESS)
+        coop = 0;
+
+    printf("Persistent MVM: %ld WFS pixels -> %ld modes, %d blocks x %d threads, %d mode(s) per warp, cooperative launch = %d\n", m, NBmodes, NBblocks, NBthreads, nslot, coop);
+    fflush(stdout);
+
+    cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_count, sizeof(unsigned int));
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaHostAlloc((void**)&flag, sizeof(unsigned int)*2, cudaHostAllocMapped);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaHostAlloc((void**)&mref, sizeof(float)*NBmodes, cudaHostAllocMapped);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaHostRegister(data.image[IDin].array.F, sizeof(float)*m, cudaHostRegisterMapped|cudaHostRegisterPortable);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaHostRegister(data.image[IDout].array.F, sizeof(float)*NBmodes, cudaHostRegisterMapped|cudaHostRegisterPortable);
+    if (cudaStat != cudaSuccess)
+    {
+        printf("memory allocation / mapping returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cudaHostGetDevicePointer((void **) &d_flag, (void*) flag, 0);
+    d_done = d_flag + 1;
+    cudaHostGetDevicePointer((void **) &d_mref, mref, 0);
+    cudaHostGetDevicePointer((void **) &d_in, data.image[IDin].array.F, 0);
+    cudaHostGetDevicePointer((void **) &d_out, data.image[IDout].array.F, 0);
+
+    cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
+    cudaMemset(d_count, 0, sizeof(unsigned int));
+    for(k=0; k<NBmodes; k++)
+        mref[k] = 0.0;
+    flag[0] = 0;
+    flag[1] = 0;
+    cudaDeviceSynchronize(); // kernel runs on non-blocking stream: setup must be complete
+
+
+    km = (int) m;
+    kn = (int) NBmodes;
+    kargs[0] = &d_flag;
+    kargs[1] = &d_done;
+    kargs[2] = &d_count;
+    kargs[3] = &d_in;
+    kargs[4] = &d_modes;
+    kargs[5] = &d_mref;
+    kargs[6] = &d_out;
+    kargs[7] = &km;
+    kargs[8] = &kn;
+    kargs[9] = &nslot;
+    kargs[10] = &tile;
+
+    cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking);
+    if(coop == 1) // launch fails instead of deadlocking if blocks cannot all be resident
+        custat = cuLaunchCooperativeKernel(kernel, NBblocks, 1, 1, NBthreads, 1, 1, shmem, (CUstream) stream, kargs);
+    else
+        custat = cuLaunchKernel(kernel, NBblocks, 1, 1, NBthreads, 1, 1, shmem, (CUstream) stream, kargs, NULL);
+    if(custat != CUDA_SUCCESS)
+    {
+        printf("kernel launch returned error code %d, line(%d)\n", custat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+
+    if (sigaction(SIGINT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGTERM, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGBUS, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGSEGV, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGABRT, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGHUP, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGPIPE, &data.sigact, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
 
 
-                if(initref==0) // construct reference to be subtracted
-                {
-                    cudaStat = cudaMemcpy(modevalarrayref, d_modeval, sizeof(float)*NBmodes, cudaMemcpyDeviceToHost);
+    loopOK = 1;
+    iter = 0;
 
-                    IDrefout = image_ID(IDrefout_name);
-                    if(IDrefout != -1)
-                        for(k=0; k<NBmodes; k++)
-                            modevalarrayref[k] -= data.image[IDrefout].array.F[k];
+    while(loopOK == 1)
+    {
+        if(data.image[IDin].md[0].sem==0)
+        {
+            while(data.image[IDin].md[0].cnt0==cnt) // test if new frame exists
+                usleep(5);
+            cnt = data.image[IDin].md[0].cnt0;
+            semr = 0;
+        }
+        else
+        {
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                perror("clock_gettime");
+                exit(EXIT_FAILURE);
+            }
+            ts.tv_sec += 1;
+            semr = sem_timedwait(data.image[IDin].semptr[insem], &ts);
 
+            // drive semaphore to zero
+            while(sem_trywait(data.image[IDin].semptr[insem])==0) {}
+        }
 
-                    if((INNORMMODE==0)&&(MODENORM==0))
-                        BETAMODE = 1; // include ref subtraction in GPU operation
-                    else
-                        BETAMODE = 0;
-                }
-                else
+        if(semr==0)
+        {
+            // reference mode values, computed on host when reference changes (read by kernel in mapped memory)
+            if(IDref != -1)
+                if(data.image[IDref].md[0].cnt0 != cntref)
                 {
-                    cudaStat = cudaMemcpy(modevalarray, d_modeval, sizeof(float)*NBmodes, cudaMemcpyDeviceToHost);
-
-                    if(BETAMODE==0)
+                    for(k=0; k<NBmodes; k++)
                     {
-                        for(k=0; k<NBmodes; k++)
-                            data.image[ID_modeval].array.F[k] = (modevalarray[k]/data.image[IDintot].array.F[0]-modevalarrayref[k])/normcoeff[k];
+                        float val = 0.0;
+
+                        for(ii=0; ii<m; ii++)
+                            val += data.image[IDmodes].array.F[k*m+ii]*data.image[IDref].array.F[ii];
+                        mref[k] = val;
                     }
-                    else
-                        for(k=0; k<NBmodes; k++)
-                            data.image[ID_modeval].array.F[k] = modevalarray[k];
+                    cntref = data.image[IDref].md[0].cnt0;
+                }
 
+            data.image[IDout].md[0].write = 1;
 
-                    COREMOD_MEMORY_image_set_sempost_byID(ID_modeval, -1);
+            // start computation: new frame counter (skip -1, reserved for exit)
+            frame++;
+            if(frame == 0xffffffff)
+                frame = 1;
+            __sync_synchronize();
+            flag[0] = frame;
 
-                    data.image[ID_modeval].md[0].cnt0++;
-                    data.image[ID_modeval].md[0].write = 0;
+            // busy wait: lowest latency on dedicated core
+            // clock and signals only checked every 1024 polls, kernel assumed hung after PERSISTMVM_TIMEOUTUS
+            clock_gettime(CLOCK_REALTIME, &tspin0);
+            spincnt = 0;
+            while(flag[1] != frame)
+            {
+                spincnt++;
+                if((spincnt & 1023) == 0)
+                {
+                    if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_USR1 == 1))
+                        break;
+                    clock_gettime(CLOCK_REALTIME, &tspin1);
+                    if(1.0e6*(tspin1.tv_sec - tspin0.tv_sec) + 1.0e-3*(tspin1.tv_nsec - tspin0.tv_nsec) > PERSISTMVM_TIMEOUTUS)
+                    {
+                        printf("ERROR: persistent MVM kernel did not complete frame %u within %d us\n", frame, PERSISTMVM_TIMEOUTUS);
+                        kernelOK = 0;
+                        loopOK = 0;
+                        break;
+                    }
                 }
             }
-        }
-        else // WAIT FOR NEW MODEVAL
-        {
-			sem_wait(data.image[ID_modeval].semptr[insem]);
-		}
+            __sync_synchronize();
 
+            if(flag[1] == frame)
+            {
+                COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+                data.image[IDout].md[0].cnt0++;
+            }
+            data.image[IDout].md[0].write = 0;
+        }
 
+        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_USR1 == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
+            loopOK = 0;
 
+        iter++;
+    }
 
 
+    // stop kernel, bounded wait
+    __sync_synchronize();
+    flag[0] = 0xffffffff;
+    clock_gettime(CLOCK_REALTIME, &tspin0);
+    while((kernelOK == 1)&&(cudaStreamQuery(stream) == cudaErrorNotReady))
+    {
+        usleep(10);
+        clock_gettime(CLOCK_REALTIME, &tspin1);
+        if(1.0e6*(tspin1.tv_sec - tspin0.tv_sec) + 1.0e-3*(tspin1.tv_nsec - tspin0.tv_nsec) > PERSISTMVM_TIMEOUTUS)
+            kernelOK = 0;
+    }
+    if(kernelOK == 0)
+    {
+        // kernel still running: device reset terminates it and releases all device allocations and mappings
+        printf("persistent MVM kernel not responding -> device reset\n");
+        cudaDeviceReset();
+        return(-1);
+    }
 
+    cudaHostUnregister(data.image[IDin].array.F);
+    cudaHostUnregister(data.image[IDout].array.F);
+    cuModuleUnload(module);
+    cudaFree(d_modes);
+    cudaFree(d_count);
+    cudaFreeHost((void*) flag);
+    cudaFreeHost(mref);
+    cudaStreamDestroy(stream);
 
+    return(0);
+}
 
 
 
-        if(TRACEMODE == 1)
-        {
-            data.image[ID_modeval].md[0].write = 1;
 
-            for(k=0; k<NBmodes; k++)
-                data.image[IDtrace].array.F[k*TRACEsize+TRACEindex] = data.image[ID_modeval].array.F[k];
-            data.image[IDtrace].md[0].cnt1 = TRACEindex;
 
-            sem_getvalue(data.image[IDtrace].semptr[0], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDtrace].semptr[0]);
-            sem_getvalue(data.image[IDtrace].semptr[1], &semval);
-            if(semval<SEMAPHORE_MAXVAL)
-                sem_post(data.image[IDtrace].semptr[1]);
-            data.image[IDtrace].md[0].cnt0++;
-            data.image[IDtrace].md[0].write = 0;
 
-            TRACEindex++;
-            if(TRACEindex>=TRACEsize)
-            {
-                TRACEindex = 0;
-                // copy to tracef shared memory (frozen trace)
-            }
-        }
+//
+// single GPU, offline (not used by real-time loop)
+// frame batches are processed alternately on two streams: upload of batch k+1 overlaps with GEMM of batch k
+//
+int CUDACOMP_extractModesBatch(const char *in_name, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, long batchsize)
+{
+    long IDin, IDmodes, IDref, IDout;
+    long m, NBmodes, NBframe;
+    long frame0, nbf;
+    long batch;
+    int buf;
+    uint32_t *sizearray;
+    cublasHandle_t cublasH = NULL;
+    cublasStatus_t cublas_status = CUBLAS_STATUS_SUCCESS;
+    cudaError_t cudaStat = cudaSuccess;
+    cudaStream_t stream[2];
+
+    float *d_modes = NULL;
+    float *d_in[2];
+    float *d_out[2];
+    float *d_mref = NULL;
+    float *d_ones = NULL;
+    float *ones;
+    float alpha = 1.0;
+    float beta = 0.0;
+    float alpharef = -1.0;
+    long ii;
+    int inpinned, outpinned;
+    struct timespec t0, t1;
+    double tdiffv;
 
 
 
-        if(PROCESS==1)
-        {
-            stepcoeff = stepcoeff0;
-            data.image[IDprocave].md[0].write = 1;
-            for(step=0; step<NBaveSTEP; step++)
-            {
-                for(k=0; k<NBmodes; k++)
-                    data.image[IDprocave].array.F[NBmodes*step+k] = (1.0-stepcoeff)*data.image[IDprocave].array.F[NBmodes*step+k] + stepcoeff*data.image[ID_modeval].array.F[k];
-                stepcoeff *= stepcoeff0;
-            }
-            for(semnb=0; semnb<data.image[IDprocave].md[0].sem; semnb++)
-            {
-                sem_getvalue(data.image[IDprocave].semptr[semnb], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDprocave].semptr[semnb]);
-            }
-            data.image[IDprocave].md[0].cnt0++;
-            data.image[IDprocave].md[0].write = 0;
+    IDin = image_ID(in_name);
+    if(IDin == -1) // not in memory: read telemetry file
+        IDin = load_fits(in_name, "_extrmodesbatch_in", 1);
+    IDmodes = image_ID(IDmodes_name);
+    if((IDin == -1)||(IDmodes == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "missing input frames or modes");
+        return(-1);
+    }
+    IDref = image_ID(IDrefin_name); // optional
 
-            stepcoeff = stepcoeff0;
-            data.image[IDprocrms].md[0].write = 1;
-            for(step=0; step<NBaveSTEP; step++)
-            {
-                for(k=0; k<NBmodes; k++)
-                {
-                    tmpv = data.image[ID_modeval].array.F[k] - data.image[IDprocave].array.F[NBmodes*step+k];
-                    tmpv = tmpv*tmpv;
-                    data.image[IDprocrms].array.F[NBmodes*step+k] = (1.0-stepcoeff)*data.image[IDprocrms].array.F[NBmodes*step+k] + stepcoeff*tmpv;
-                }
-                stepcoeff *= stepcoeff0;
-            }
-            for(semnb=0; semnb<data.image[IDprocrms].md[0].sem; semnb++)
-            {
-                sem_getvalue(data.image[IDprocrms].semptr[semnb], &semval);
-                if(semval<SEMAPHORE_MAXVAL)
-                    sem_post(data.image[IDprocrms].semptr[semnb]);
-            }
-            data.image[IDprocrms].md[0].cnt0++;
-            data.image[IDprocrms].md[0].write = 0;
-        }
+    m = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+    NBframe = (data.image[IDin].md[0].naxis == 3) ? data.image[IDin].md[0].size[2] : 1;
+    NBmodes = data.image[IDmodes].md[0].size[2];
+    if((data.image[IDin].md[0].atype != _DATATYPE_FLOAT)||(data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1] != m)
+            ||((IDref != -1)&&(data.image[IDref].md[0].nelement != m)))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input frames, modes and reference must be float with matching frame size");
+        return(-1);
+    }
+    if(batchsize < 1)
+        batchsize = 1;
+    if(batchsize > NBframe)
+        batchsize = NBframe;
 
+    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+    sizearray[0] = NBmodes;
+    sizearray[1] = NBframe;
+    IDout = create_image_ID(IDout_name, 2, sizearray, _DATATYPE_FLOAT, 0, 0);
+    free(sizearray);
 
-	//	printf("wait\n");
-	//	fflush(stdout);
+    printf("Batch mode extraction: %ld frames x %ld pixels -> %ld modes, batch size %ld\n", NBframe, m, NBmodes, batchsize);
+    fflush(stdout);
 
-		if(twait1<0)
-			twait1 = 0;
-		
-		if(twait>0)
-			usleep(twait1);
-				
-		clock_gettime(CLOCK_REALTIME, &t1);
-        tdiff = info_time_diff(t0, t1);
-        tdiffv = 1.0*tdiff.tv_sec + 1.0e-9*tdiff.tv_nsec;
-	
-		if(tdiffv<1.0e-6*twait) 
-			twait1 ++;
-		else
-			twait1 --;
-		
-		
-		//printf("%ld   timing info : %11.9lf  %ld %ld\n", iter, tdiffv, twait1, twait);
-		//fflush(stdout);
 
-        if((data.signal_INT == 1)||(data.signal_TERM == 1)||(data.signal_ABRT==1)||(data.signal_BUS==1)||(data.signal_SEGV==1)||(data.signal_HUP==1)||(data.signal_PIPE==1))
-        {
-            loopOK = 0;
-            printf("Exiting loop\n");
-            fflush(stdout);
-            sleep(1.0);
-        }
+    cudaGetDeviceCount(&deviceCount);
+    if(GPUindex<deviceCount)
+        cudaSetDevice(GPUindex);
+    else
+    {
+        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
+        return(-1);
+    }
 
-        initref = 1;
-        iter++;
+    cublas_status = cublasCreate(&cublasH);
+    if (cublas_status != CUBLAS_STATUS_SUCCESS) {
+        printf ("CUBLAS initialization failed\n");
+        return EXIT_FAILURE;
     }
 
-    if(MODEVALCOMPUTE==1)
+    cudaStat = cudaMalloc((void**)&d_modes, sizeof(float)*m*NBmodes);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_mref, sizeof(float)*NBmodes);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**)&d_ones, sizeof(float)*batchsize);
+    for(buf=0; buf<2; buf++)
     {
-        cudaFree(d_modes);
-        cudaFree(d_in);
-        cudaFree(d_modeval);
-
-
-
-        if (cublasH ) cublasDestroy(cublasH);
+        if(cudaStat == cudaSuccess)
+            cudaStat = cudaMalloc((void**)&d_in[buf], sizeof(float)*m*batchsize);
+        if(cudaStat == cudaSuccess)
+            cudaStat = cudaMalloc((void**)&d_out[buf], sizeof(float)*NBmodes*batchsize);
+        cudaStreamCreateWithFlags(&stream[buf], cudaStreamNonBlocking);
     }
+    if (cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    cudaMemcpy(d_modes, data.image[IDmodes].array.F, sizeof(float)*m*NBmodes, cudaMemcpyHostToDevice);
 
-    free(normcoeff);
-    free(modevalarray);
-    free(modevalarrayref);
-
-
-
-
-    return(0);
-}
+    ones = (float*) malloc(sizeof(float)*batchsize);
+    for(ii=0; ii<batchsize; ii++)
+        ones[ii] = 1.0;
+    cudaMemcpy(d_ones, ones, sizeof(float)*batchsize, cudaMemcpyHostToDevice);
+    free(ones);
 
+    // reference mode values  d_mref = modes^T x ref
+    cudaMemset(d_mref, 0, sizeof(float)*NBmodes);
+    if(IDref != -1)
+    {
+        cudaMemcpy(d_in[0], data.image[IDref].array.F, sizeof(float)*m, cudaMemcpyHostToDevice);
+        cublasSgemv(cublasH, CUBLAS_OP_T, m, NBmodes, &alpha, d_modes, m, d_in[0], 1, &beta, d_mref, 1);
+    }
+    cudaDeviceSynchronize(); // batches run on non-blocking streams: setup must be complete
 
+    // pinned host memory required for transfers to overlap with compute
+    inpinned = (cudaHostRegister(data.image[IDin].array.F, sizeof(float)*m*NBframe, cudaHostRegisterPortable) == cudaSuccess) ? 1 : 0;
+    outpinned = (cudaHostRegister(data.image[IDout].array.F, sizeof(float)*NBmodes*NBframe, cudaHostRegisterPortable) == cudaSuccess) ? 1 : 0;
+    if((inpinned == 0)||(outpinned == 0))
+        printf("WARNING: cannot pin host memory, transfers will not overlap with compute\n");
 
+    clock_gettime(CLOCK_REALTIME, &t0);
+    for(batch=0; batch*batchsize < NBframe; batch++)
+    {
+        buf = batch % 2; // batch k-2 used same buffers on same stream: no extra synchronization needed
+        frame0 = batch*batchsize;
+        nbf = (frame0 + batchsize > NBframe) ? NBframe - frame0 : batchsize;
 
+        cudaMemcpyAsync(d_in[buf], data.image[IDin].array.F + frame0*m, sizeof(float)*m*nbf, cudaMemcpyHostToDevice, stream[buf]);
 
+        cublasSetStream(cublasH, stream[buf]);
+        cublas_status = cublasSgemm(cublasH, CUBLAS_OP_T, CUBLAS_OP_N, NBmodes, nbf, m, &alpha, d_modes, m, d_in[buf], m, &beta, d_out[buf], NBmodes);
+        if (cublas_status != CUBLAS_STATUS_SUCCESS)
+        {
+            printf("cublasSgemm returned error code %d, line(%d)\n", cublas_status, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        if(IDref != -1) // out -= mref x ones^T
+            cublasSger(cublasH, NBmodes, nbf, &alpharef, d_mref, 1, d_ones, 1, d_out[buf], NBmodes);
 
+        cudaMemcpyAsync(data.image[IDout].array.F + frame0*NBmodes, d_out[buf], sizeof(float)*NBmodes*nbf, cudaMemcpyDeviceToHost, stream[buf]);
+    }
+    for(buf=0; buf<2; buf++)
+        cudaStreamSynchronize(stream[buf]);
+    clock_gettime(CLOCK_REALTIME, &t1);
 
+    tdiffv = 1.0*(t1.tv_sec - t0.tv_sec) + 1.0e-9*(t1.tv_nsec - t0.tv_nsec);
+    printf("%ld frames processed in %.3f s  (%.0f frames/s)\n", NBframe, tdiffv, NBframe/tdiffv);
+    fflush(stdout);
 
+    if(inpinned == 1)
+        cudaHostUnregister(data.image[IDin].array.F);
+    if(outpinned == 1)
+        cudaHostUnregister(data.image[IDout].array.F);
 
+    for(buf=0; buf<2; buf++)
+    {
+        cudaFree(d_in[buf]);
+        cudaFree(d_out[buf]);
+        cudaStreamDestroy(stream[buf]);
+    }
+    cudaFree(d_modes);
+    cudaFree(d_mref);
+    cudaFree(d_ones);
 
+    if (cublasH ) cublasDestroy(cublasH);
 
+    if(image_ID("_extrmodesbatch_in") != -1)
+        delete_image_ID("_extrmodesbatch_in");
 
+    return(0);
+}
 
 
 
@@ -4997,26 +8386,97 @@ int CUDACOMP_createModesLoop(const char *DMmodeval_stream, const char *DMmodes,
 
 
 
+/* =============================================================================================== */
+/*                                   TEMPORAL FIR ON FRAME STREAM                                  */
+/* =============================================================================================== */
 
 
+int CUDACOMP_FIR_setup(CUDACOMP_FIRCONF *fir, int GPUindex, long xysize, long ksize)
+{
+    cudaError_t cudaStat;
 
+    fir->init = 0;
+    cudaGetDeviceCount(&deviceCount);
+    if(GPUindex >= deviceCount)
+    {
+        printf("Invalid Device : %d / %d\n", GPUindex, deviceCount);
+        return(-1);
+    }
+    cudaSetDevice(GPUindex);
 
+    fir->device = GPUindex;
+    fir->xysize = xysize;
+    fir->ksize = ksize;
 
+    if(cublasCreate(&fir->handle) != CUBLAS_STATUS_SUCCESS)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "cublasCreate failed");
+        return(-1);
+    }
 
+    cudaStat = cudaMalloc((void**) &fir->d_hist, sizeof(float)*xysize*ksize);
+    if(cudaStat == cudaSuccess)
+        cudaStat = cudaMalloc((void**) &fir->d_out, sizeof(float)*xysize);
+    if(cudaStat != cudaSuccess)
+    {
+        printf("cudaMalloc returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        cublasDestroy(fir->handle);
+        return(-1);
+    }
+    cudaMemset(fir->d_hist, 0, sizeof(float)*xysize*ksize);
 
+    fir->init = 1;
 
+    return(0);
+}
 
 
 
+int CUDACOMP_FIR_execute(CUDACOMP_FIRCONF *fir, const float *frame, long slot, long NBtap, const long *tapslot, const float *tapw, float *out)
+{
+    cudaError_t cudaStat;
+    long t;
 
+    cudaStat = cudaMemcpy(fir->d_hist + slot*fir->xysize, frame, sizeof(float)*fir->xysize, cudaMemcpyHostToDevice);
+    if(cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        return(-1);
+    }
 
+    cudaMemset(fir->d_out, 0, sizeof(float)*fir->xysize);
+    for(t=0; t<NBtap; t++)
+        if(cublasSaxpy(fir->handle, fir->xysize, &tapw[t], fir->d_hist + tapslot[t]*fir->xysize, 1, fir->d_out, 1) != CUBLAS_STATUS_SUCCESS)
+        {
+            printERROR(__FILE__, __func__, __LINE__, "cublasSaxpy failed");
+            return(-1);
+        }
 
+    cudaStat = cudaMemcpy(out, fir->d_out, sizeof(float)*fir->xysize, cudaMemcpyDeviceToHost);
+    if(cudaStat != cudaSuccess)
+    {
+        printf("cudaMemcpy returned error code %d, line(%d)\n", cudaStat, __LINE__);
+        return(-1);
+    }
 
+    return(0);
+}
 
 
 
+int CUDACOMP_FIR_free(CUDACOMP_FIRCONF *fir)
+{
+    if(fir->init == 1)
+    {
+        cudaSetDevice(fir->device);
+        cudaFree(fir->d_hist);
+        cudaFree(fir->d_out);
+        cublasDestroy(fir->handle);
+        fir->init = 0;
+    }
 
- 
+    return(0);
+}
 
 
 
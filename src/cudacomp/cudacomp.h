@@ -100,6 +100,7 @@ typedef struct
     // splitting limits
     uint_fast32_t *Nsize;
     uint_fast32_t *Noffset;
+    uint_fast32_t *Nalloc;              /**< allocated size along N per device (N if load balancing, so that partition can move) */
 
     int *GPUdevice;
 
@@ -107,8 +108,76 @@ typedef struct
 
     long IDout;
 
+    // control matrix hot swap: new matrix uploaded to standby buffers in background, swapped at frame boundary
+    int_fast8_t CMhotswap;              /**< 0: blocking reload in execute, 1: swap in execute, 2: swap by caller (GPU_loop_MultMat_CMswap) */
+    volatile int CMupload_status;       /**< 0: idle, 1: upload in progress, 2: standby matrix ready */
+    long CMupload_cnt;                  /**< CM counter of matrix in standby buffers */
+    long CMswapcnt;                     /**< number of swaps performed */
+    float **d_cMat_standby;
+    cudaStream_t *stream_upload;
+    pthread_t CMuploadthread;
+
+    // asynchronous execution: no compute threads/semaphores, pinned host buffers, per-device streams and events
+    int_fast8_t asyncmode;              /**< 0: compute threads + semaphores, 1: async copies + events, 2: same, launched as CUDA graph */
+    int_fast8_t asyncmode_req;          /**< requested asyncmode, applied at end of setup if not yet initialized */
+    cudaEvent_t *event_done;            /**< per device: output transfer to host completed */
+    cudaGraphExec_t *graphexec;         /**< per device: captured H2D + MVM + D2H sequence (asyncmode = 2) */
+    int_fast8_t *graphOK;               /**< per device: 1 if graphexec matches current parameters */
+    float **graph_d_cMat;               /**< per device: matrix pointer captured in graph */
+    float graph_alpha;
+    float graph_beta;
+    int_fast8_t wfsVec_pinned;          /**< 1 if input vector is registered as pinned memory */
+
+    // zero-copy input: camera stream mapped into device address space, dark/flux/normalization folded into MVM
+    int_fast8_t zerocopy;               /**< 1 if input is read by GPU directly from camera stream */
+    long zc_IDin;                       /**< camera stream (FLOAT, 2D or 3D ring buffer) */
+    long zc_IDdark;                     /**< dark frame, -1 if none */
+    long zc_IDmask;                     /**< flux mask, -1 if none */
+    long zc_darkcnt;                    /**< dark counter used for zc_d_dmDark */
+    int_fast8_t zc_normalize;
+    float zc_normfloor;
+    float zc_flux;                      /**< dark-subtracted masked flux of last frame */
+    float zc_maskdark;                  /**< masked dark flux */
+    float **zc_d_in;                    /**< per device: device pointer to mapped camera stream */
+    float **zc_d_mask;                  /**< per device: flux mask, device part */
+    float **zc_d_dmDark;                /**< per device: cMat x dark */
+    float **zc_dmDark_part;             /**< per device: host copy of cMat x dark */
+    float **zc_d_flux;                  /**< per device: masked flux of device part */
+    float *zc_flux_part;                /**< per device: host copy of masked flux (pinned) */
+
+    // load balancing across devices
+    int_fast8_t balance;                /**< 1: partition from measured device throughput, rebalanced at runtime in async mode */
+    int_fast8_t balance_req;            /**< requested balance mode, applied at setup */
+    int_fast8_t p2preduce;              /**< 1 if partial results are summed on first device through peer-to-peer copies */
+    double *devtime;                    /**< per device: accumulated MVM time [ms] since last rebalancing check */
+    long devtimecnt;
+    cudaEvent_t *event_start;           /**< per device: start of frame (timing) */
+    cudaEvent_t *event_mvm;             /**< per device: MVM done (timing, peer copy source) */
+    float **d_peer;                     /**< on first device: partial results of other devices */
+
+    // watchdog: partition of stalled/failed device recomputed on CPU
+    long failover_timeout;              /**< deadline for device contribution [us], 0 = watchdog disabled */
+    int failover_NBthreads;             /**< number of CPU threads computing failed partitions */
+    int_fast8_t *devfailed;             /**< per device: 1 if partition is computed on CPU */
+    int_fast8_t *deverror;              /**< per device: set by compute thread on CUDA/CUBLAS error */
+    float **cpu_dmVec_part;             /**< per device: CPU result of partition */
+    long failovercnt;                   /**< number of device failures since setup */
+
 
 } GPUMATMULTCONF;
+
+
+/** \brief Temporal FIR filter state: frame history on GPU, see CUDACOMP_FIR_setup() */
+typedef struct
+{
+    int_fast8_t init;
+    int device;
+    long xysize;          /**< pixels per frame                 */
+    long ksize;           /**< number of history slots          */
+    cublasHandle_t handle;
+    float *d_hist;        /**< frame history, ksize x xysize    */
+    float *d_out;
+} CUDACOMP_FIRCONF;
 #endif
 
 
@@ -146,6 +215,17 @@ int_fast8_t CUDACOMP_init();
 
 int_fast8_t GPUcomp_test(long NBact, long NBmodes, long WFSsize, long GPUcnt);
 
+
+/**
+ * @brief Benchmark GPU MVM latency and write tuning file
+ *
+ * Sweeps matrix size (NBmodes x WFSsize^2, factor 2 steps), number of GPUs (1 to NBGPUmax) and execution
+ * mode (semaphore-driven threads, async busy-wait, async CUDA graph, async balanced).\n
+ * Reports p50, p99 and max latency [us] over NBiter frames. For each size and number of GPUs, the mode with
+ * lowest p99 latency is written as a BEST line, to be used with GPU_loop_MultMat_tunefile.
+ */
+int GPUcomp_benchmark(long NBmodesmin, long NBmodesmax, long WFSsizemin, long WFSsizemax, long NBGPUmax, long NBiter, const char *fname);
+
 ///@}
 
 
@@ -187,6 +267,94 @@ int GPU_loop_MultMat_execute(int index, int_fast8_t *status, int_fast8_t *GPUsta
 
 int GPU_loop_MultMat_free(int index);
 
+
+/**
+ * @brief Enable/disable control matrix hot swap for a configured matrix multiplication
+ *
+ * mode 0: new matrix is loaded synchronously in GPU_loop_MultMat_execute (default)\n
+ * mode 1: background upload, swap at start of GPU_loop_MultMat_execute\n
+ * mode 2: background upload, swap when caller runs GPU_loop_MultMat_CMswap()
+ */
+int GPU_loop_MultMat_CMhotswap(int index, int mode);
+
+
+/**
+ * @brief Swap in standby control matrix if upload is complete
+ *
+ * Must be called at a frame boundary (no computation in progress).
+ * @return control matrix counter (cnt0) of swapped in matrix, -1 if no swap
+ */
+long GPU_loop_MultMat_CMswap(int index);
+
+
+/**
+ * @brief Select GPU_loop_MultMat_execute transfer/synchronization mode
+ *
+ * mode 0: per-device compute threads synchronized by semaphores, synchronous transfers (default)\n
+ * mode 1: input and output host buffers pinned, transfers and MVM queued on per-device CUDA streams, completion by events\n
+ * mode 2: as mode 1, per-device sequence captured once and launched as a CUDA graph\n
+ * If called before setup, mode is applied at end of GPU_loop_MultMat_setup.
+ */
+int GPU_loop_MultMat_async(int index, int mode);
+
+
+/**
+ * @brief Read matrix multiplication input directly from camera stream (zero-copy)
+ *
+ * Camera stream is registered as mapped pinned memory and read by the GPUs over the bus: no host copy of the frame.\n
+ * Dark subtraction, masked flux and normalization are folded into the MVM:\n
+ * out = (cMat x (in - dark)) / (flux + normfloor x N) - flux / (flux + normfloor x N) x dmRef,\n
+ * with cMat x dark recomputed when the dark stream is updated. Only mode coefficients and one flux value per device are
+ * transferred back. Same output as the GPUall path (alpha = 1/total, beta = -normfloorcoeff).\n
+ * Requires FLOAT camera stream and async mode (GPU_loop_MultMat_async). 3D ring buffer streams are recommended, since
+ * the frame is read in place while the camera may write the next one.
+ *
+ * @return 0 if zero-copy path is active, -1 otherwise
+ */
+int GPU_loop_MultMat_zerocopy(int index, const char *IDin_name, const char *IDdark_name, const char *IDmask_name, int normalize, float normfloor);
+
+
+/**
+ * @brief Dark-subtracted masked flux of last zero-copy frame
+ */
+float GPU_loop_MultMat_zerocopy_flux(int index);
+
+
+/**
+ * @brief Request throughput-based partitioning across GPUs (mode = 1), to be called before GPU_loop_MultMat_setup
+ *
+ * At setup, each device runs a short MVM benchmark and receives a share of the matrix proportional to its throughput.\n
+ * In async mode, per-device MVM times are measured every frame and the partition is recomputed if devices become
+ * unbalanced (for example when one throttles).
+ */
+int GPU_loop_MultMat_balance(int index, int mode);
+
+
+/**
+ * @brief Set tuning file written by GPUcomp_benchmark (empty string to disable)
+ *
+ * If the file exists, GPU_loop_MultMat_setup overrides USEsem, async and balance modes with the BEST entry
+ * for the same number of GPUs and closest matrix size.
+ */
+int GPU_loop_MultMat_tunefile(const char *fname);
+
+
+/**
+ * @brief Enable MVM watchdog (timeout > 0) with CPU failover
+ *
+ * Each device contribution must complete within timeout [us] of the start of the computation.
+ * A device that misses the deadline or reports a CUDA/CUBLAS error raises an alarm and is flagged as failed:
+ * its partition is then computed on NBthreads CPU threads from the host copy of the matrix slice, until the next setup.\n
+ * Applies to semaphore (USEsem = 1) and async modes, not to zero-copy input or peer-to-peer reduction.
+ */
+int GPU_loop_MultMat_failover(int index, long timeout, int NBthreads);
+
+
+/**
+ * @brief Number of device failures detected by MVM watchdog since setup
+ */
+long GPU_loop_MultMat_failover_count(int index);
+
 ///@}
 
 
@@ -238,6 +406,48 @@ int CUDACOMP_magma_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const c
 
 int GPU_SVD_computeControlMatrix(int device, const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, const char *ID_VTmatrix_name);
 
+
+
+/**
+ * @brief Computes control matrix (pseudoinverse) from truncated SVD, using randomized range finder
+ *
+ * Range of A is sampled with (NBmodes + oversample) random vectors, refined by power iterations (A A^T)^q,
+ * and SVD is computed on the small projected matrix. A^T A is never formed.\n
+ * Response matrix columns are distributed across GPUs 0 .. NBGPU-1.\n
+ * Reports relative Frobenius residual of the truncated decomposition.
+ *
+ * @param[in]   ID_Rmatrix_name     Input data matrix, can be 2D or 3D
+ * @param[out]  ID_Cmatrix_name     Pseudoinverse (result), same size as input
+ * @param[in]   SVDeps              SVD eigenvalue limit for pseudoinverse
+ * @param[in]   NBmodes             Number of modes computed (maximum kept)
+ * @param[in]   oversample          Number of additional random vectors (typically 10 to 100)
+ * @param[in]   NBpowiter           Number of power iterations (1 or 2 for slowly decaying spectra)
+ * @param[in]   NBGPU               Number of GPUs
+ * @param[out]  ID_VTmatrix_name    [optional] right singular vectors (NB actuators x NB modes kept), NULL if not needed
+ */
+int CUDACOMP_randSVD_computeControlMatrix(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long NBmodes, long oversample, int NBpowiter, int NBGPU, const char *ID_VTmatrix_name);
+
+
+
+/**
+ * @brief Computes pseudoinverse of a matrix that does not fit in GPU memory (out-of-core)
+ *
+ * Same algorithm as CUDACOMP_magma_compute_SVDpseudoInverse: Ainv = A (AT A)^-1, truncated eigen-decomposition of AT A.\n
+ * A is streamed from host memory in row panels (double-buffered) across GPUs 0 .. NBGPU-1 to accumulate AT A,
+ * eigenproblem is solved on first GPU (cuSOLVER), and Ainv is back-projected panel-wise directly into output image.\n
+ * Only the N x N matrices need to fit in GPU memory.
+ *
+ * @param[in]   ID_Rmatrix_name     Input data matrix, can be 2D or 3D
+ * @param[out]  ID_Cmatrix_name     Pseudoinverse (result). Created in shared memory if it does not exist
+ * @param[in]   SVDeps              SVD eigenvalue limit for pseudoinverse
+ * @param[in]   MaxNBmodes          Maximum number of modes kept
+ * @param[in]   NBGPU               Number of GPUs
+ * @param[in]   panelsize           Number of matrix rows (sensors) per panel
+ *
+ * @warning Requires M>N (tall matrix)
+ */
+int CUDACOMP_OOC_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, int NBGPU, long panelsize);
+
 ///@}
 
 #endif
@@ -286,6 +496,85 @@ int CUDACOMP_extractModesLoop(const char *in_stream, const char *intot_stream, c
 
 
 
+/**
+ * @brief extract mode coefficients from a frame cube, in batches (offline telemetry processing)
+ *
+ * Same computation as CUDACOMP_extractModesLoop (modes need to be orthogonal and normalized), one GEMM per batch of frames.\n
+ * Two buffers/streams: host-to-device upload of next batch overlaps with computation of current batch.
+ *
+ * @param[in]   in_name              input frame cube (float), or FITS file name if no such image in memory
+ * @param[in]   IDmodes_name         Modes
+ * @param[in]   IDrefin_name         [optional] input reference  - to be subtracted
+ * @param[out]  IDout_name           output mode coefficients, NBmodes x NBframe
+ * @param[in]   GPUindex             GPU index
+ * @param[in]   batchsize            number of frames per GEMM
+ */
+int CUDACOMP_extractModesBatch(const char *in_name, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, long batchsize);
+
+
+
+/**
+ * @brief GPU-resident modal control loop: WFS -> modes -> modal filter -> DM map on a single CUDA stream
+ *
+ * Replaces the extractModesLoop -> host modal filter -> Coeff2Map_Loop chain: mode coefficients never leave the GPU.\n
+ * Filter (same as AOloopControl):  cmd = mult * clip( cmd - gain * meas + pred, limit )\n
+ * single GPU computation
+ *
+ * @param[in]   in_stream            input WFS stream
+ * @param[in]   IDwfsmodes_name      WFS modes (m x NBmodes cube), pre-normalized: meas = WFSmodes^T x (in - ref)
+ * @param[in]   IDwfsref_name        [optional] WFS reference - to be subtracted, re-processed when updated
+ * @param[in]   IDgain_name          mode gains (NBmodes)
+ * @param[in]   IDmult_name          mode mult factors (NBmodes)
+ * @param[in]   IDlimit_name         mode limits (NBmodes)
+ * @param[in]   IDpf_name            [optional] predictive filter input (NBmodes), added before limit. Latest value is used
+ * @param[in]   IDDMmodes_name       DM modes (mdm x NBmodes cube)
+ * @param[out]  IDout_name           output DM stream (must exist)
+ * @param[out]  IDtelem_name         [optional] telemetry stream, NBmodes x 2: measured and filtered mode values
+ * @param[in]   GPUindex             GPU index
+ * @param[in]   insem                input semaphore index
+ *
+ * @note gain, mult, limit and predictive input are uploaded only when their cnt0 changes
+ */
+int CUDACOMP_modalPipelineLoop(const char *in_stream, const char *IDwfsmodes_name, const char *IDwfsref_name, const char *IDgain_name, const char *IDmult_name, const char *IDlimit_name, const char *IDpf_name, const char *IDDMmodes_name, const char *IDout_name, const char *IDtelem_name, int GPUindex, int insem);
+
+
+
+/**
+ * @brief Mode extraction with persistent GPU kernel
+ *
+ * Kernel is launched once and stays resident, polling a frame counter in mapped host memory: no kernel launch,
+ * no host-device copy per frame. Input and output streams are mapped in device address space.\n
+ * Intended for small number of modes (LOWFS), where launch overhead dominates the computation.\n
+ * out = modes^T x (in - ref)\n
+ * single GPU computation, one block per multiprocessor at most
+ *
+ * @param[in]   in_stream            input WFS stream
+ * @param[in]   IDmodes_name         modes (m x NBmodes cube)
+ * @param[in]   IDrefin_name         [optional] input reference - to be subtracted, re-processed on host when updated
+ * @param[out]  IDout_name           output mode coefficients (must exist, NBmodes)
+ * @param[in]   GPUindex             GPU index
+ * @param[in]   insem                input semaphore index
+ *
+ * @note host thread busy-waits for kernel completion, to be run on dedicated core
+ */
+int CUDACOMP_persistentMVMLoop(const char *in_stream, const char *IDmodes_name, const char *IDrefin_name, const char *IDout_name, int GPUindex, int insem);
+
+
+
+/**
+ * @brief Temporal FIR on a frame stream, history kept on GPU
+ *
+ * CUDACOMP_FIR_execute() uploads frame into history slot, then out = sum_t tapw[t] x history[tapslot[t]].\n
+ * Slots are managed by the caller (circular index), history is zero at setup.
+ */
+int CUDACOMP_FIR_setup(CUDACOMP_FIRCONF *fir, int GPUindex, long xysize, long ksize);
+
+int CUDACOMP_FIR_execute(CUDACOMP_FIRCONF *fir, const float *frame, long slot, long NBtap, const long *tapslot, const float *tapw, float *out);
+
+int CUDACOMP_FIR_free(CUDACOMP_FIRCONF *fir);
+
+
+
 #endif
 
 
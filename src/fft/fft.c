@@ -46,6 +46,14 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 
 
 #include <fftw3.h>
+#include <gsl/gsl_cblas.h>
+
+#ifdef HAVE_CUDA
+#include <cuda_runtime_api.h>
+#include <cufft.h>
+#endif
+#include <pthread.h>
+#include <unistd.h>
 
 
 
@@ -81,6 +89,80 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 //#define FFTWMT 1
 static int NB_FFTW_THREADS = 2;
 
+
+// FFTW plan cache, see fft_plancache_execute()
+#define FFT_PLANCACHE_NBENTRY 64
+#define FFT_PLAN_C2C 0
+#define FFT_PLAN_R2C 1
+
+typedef struct
+{
+    int used;
+    int kind;          // FFT_PLAN_C2C or FFT_PLAN_R2C
+    int dbl;           // 1 if double precision
+    int rank;          // 1 or 2
+    int n[2];
+    int howmany;
+    int dir;
+    int inplace;
+    int aligned;       // 1 if input and output are SIMD-aligned
+    int nthreads;
+    unsigned flags;    // planner flags
+    fftwf_plan planf;
+    fftw_plan pland;
+    long inuse;        // number of callers executing plan
+    uint64_t lastuse;
+} FFT_PLANCACHE_ENTRY;
+
+static FFT_PLANCACHE_ENTRY fft_plancache[FFT_PLANCACHE_NBENTRY];
+static pthread_mutex_t fft_plancache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t fft_plancache_clock = 0;
+static unsigned fft_planmode = FFTWOPTMODE;  // set by fft_set_planmode()
+static int fft_nthreads = 1;
+
+
+// FFT backend, see fft_set_backend()
+#define FFT_BACKEND_FFTW        0
+#define FFT_BACKEND_CUFFT       1  // outputs copied back to host after each transform
+#define FFT_BACKEND_CUFFT_LAZY  2  // outputs stay on device until fft_gpu_sync()
+
+static int fft_backend = FFT_BACKEND_FFTW;
+
+#ifdef HAVE_CUDA
+#define FFT_GPUIMAGE_NBENTRY 32
+#define FFT_CUFFTPLAN_NBENTRY 16
+
+// device copy of image
+typedef struct
+{
+    int used;
+    long ID;
+    char name[80];
+    void *hostptr;     // data.image[ID].array and creation time at upload, used to detect re-created images
+    double creation_time;
+    size_t nbbyte;
+    void *d_data;
+    int hostvalid;     // 0 if device copy is more recent than host array
+} FFT_GPUIMAGE;
+
+typedef struct
+{
+    int used;
+    int kind;
+    int dbl;
+    int rank;
+    int n[2];
+    int howmany;
+    cufftHandle plan;
+} FFT_CUFFTPLAN;
+
+static FFT_GPUIMAGE fft_gpuimage[FFT_GPUIMAGE_NBENTRY];
+static FFT_CUFFTPLAN fft_cufftplan[FFT_CUFFTPLAN_NBENTRY];
+static long fft_cufftplan_next = 0;
+#endif
+
+static void fft_gpu_hostwrite(long ID);
+
 extern DATA data;
 
 
@@ -192,6 +274,78 @@ int_fast8_t fft_correlation_cli()
 
 
 
+int_fast8_t fft_stream_WelchPSD_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,2)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,3)+CLI_checkarg(7,2)==0)
+        fft_stream_WelchPSD(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.string, data.cmdargtoken[7].val.numl);
+    else
+        return 1;
+
+    return 0;
+}
+
+
+int_fast8_t fft_convolve_stream_cli()
+{
+    if(CLI_checkarg(1,5)+CLI_checkarg(2,4)+CLI_checkarg(3,2)+CLI_checkarg(4,3)+CLI_checkarg(5,2)==0)
+        fft_convolve_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.numl);
+    else
+        return 1;
+
+    return 0;
+}
+
+
+
+
+
+
+
+
+int_fast8_t fft_cube_register_cli()
+{
+    if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,2)+CLI_checkarg(4,3)==0)
+    {
+        fft_cube_register(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.string);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+
+int_fast8_t fft_set_planmode_cli()
+{
+    if(CLI_checkarg(1,2)==0)
+    {
+        fft_set_planmode(data.cmdargtoken[1].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+
+
+
+
+
+
+int_fast8_t fft_set_backend_cli()
+{
+    if(CLI_checkarg(1,2)==0)
+    {
+        fft_set_backend(data.cmdargtoken[1].val.numl);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+
 int_fast8_t init_fft()
 {
 
@@ -199,6 +353,7 @@ int_fast8_t init_fft()
     printf("Multi-threaded fft enabled, max threads = %d\n",omp_get_max_threads());
     fftwf_init_threads();
     fftwf_plan_with_nthreads(omp_get_max_threads());
+    fft_nthreads = omp_get_max_threads();
 # endif
 
 
@@ -294,6 +449,51 @@ int_fast8_t init_fft()
     strcpy(data.cmd[data.NBcmd].Ccall,"long fft_correlation(const char *ID_name1, const char *ID_name2, const char *ID_nameout)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"fftregister");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = fft_cube_register_cli;
+    strcpy(data.cmd[data.NBcmd].info,"sub-pixel registration of cube slices against reference (upsampled cross-correlation)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input cube> <reference image> <upsampling factor> <output shifts>");
+    strcpy(data.cmd[data.NBcmd].example,"fftregister imc imref 100 imcshifts");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long fft_cube_register(const char *IDcube_name, const char *IDref_name, long upsample, const char *IDout_name)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"fftplanmode");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = fft_set_planmode_cli;
+    strcpy(data.cmd[data.NBcmd].info,"set FFTW planning mode of cached plans (0:ESTIMATE 1:MEASURE 2:PATIENT 3:EXHAUSTIVE)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<mode>");
+    strcpy(data.cmd[data.NBcmd].example,"fftplanmode 1");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int fft_set_planmode(int mode)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"fftbackend");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = fft_set_backend_cli;
+    strcpy(data.cmd[data.NBcmd].info,"select FFT backend (0:FFTW 1:cuFFT 2:cuFFT, device-resident outputs)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<backend>");
+    strcpy(data.cmd[data.NBcmd].example,"fftbackend 1");
+    strcpy(data.cmd[data.NBcmd].Ccall,"int fft_set_backend(int backend)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"streampsd");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = fft_stream_WelchPSD_cli;
+    strcpy(data.cmd[data.NBcmd].info,"continuous Welch PSD and statistics of each stream element");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input stream> <semtrig> <FFT size> <window step> <averaging coeff> <output PSD> <NBiter (0=until USR1)>");
+    strcpy(data.cmd[data.NBcmd].example,"streampsd aol0_modeval_ol 4 1024 512 0.05 aol0_modeval_ol_PSD 0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long fft_stream_WelchPSD(const char *IDin_name, long semtrig, long NBfft, long NBstep, float avecoeff, const char *IDout_name, long NBiter)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"streamconv");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = fft_convolve_stream_cli;
+    strcpy(data.cmd[data.NBcmd].info,"convolve each frame of stream by kernel (cached kernel FFT, overlap-save tiles)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input stream> <kernel> <semtrig> <output stream> <NBiter (0=until USR1)>");
+    strcpy(data.cmd[data.NBcmd].example,"streamconv wfsim psfke 3 wfsimc 0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long fft_convolve_stream(const char *IDin_name, const char *IDke_name, long semtrig, const char *IDout_name, long NBiter)");
+    data.NBcmd++;
+
     return 0;
 }
 
@@ -333,6 +533,7 @@ int fft_setNthreads(int nt)
     //  printf("Multi-threaded fft enabled, max threads = %d\n",nt);
     fftwf_init_threads();
     fftwf_plan_with_nthreads(nt);
+    fft_nthreads = nt;
 # endif
 
 
@@ -341,36 +542,50 @@ int fft_setNthreads(int nt)
     return(0);
 }
 
-int import_wisdom()
+/* wisdom file name: <FFTCONFIGDIR>/<fftw|fftwf>[_mt]_wisdom[_<host>].dat */
+static void fft_wisdom_fname(char *fname, const char *prefix, int hostspecific)
 {
-    FILE *fp;
-    char wisdom_file_single[SBUFFERSIZE];
-    char wisdom_file_double[SBUFFERSIZE];
-    char warnmessg[SBUFFERSIZE];
+    char hostname[200];
+    const char *mt = "";
     int n;
 
-
-
 # ifdef FFTWMT
-    n = snprintf(wisdom_file_single, SBUFFERSIZE, "%s/fftwf_mt_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-    n = snprintf(wisdom_file_double, SBUFFERSIZE, "%s/fftw_mt_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
+    mt = "_mt";
 # endif
 
-# ifndef FFTWMT
-    n = snprintf(wisdom_file_single, SBUFFERSIZE, "%s/fftwf_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-    n = snprintf(wisdom_file_double, SBUFFERSIZE, "%s/fftw_wisdom.dat", FFTCONFIGDIR);
+    if(hostspecific == 1)
+    {
+        if(gethostname(hostname, 199) != 0)
+            strcpy(hostname, "localhost");
+        hostname[199] = '\0';
+        n = snprintf(fname, SBUFFERSIZE, "%s/%s%s_wisdom_%s.dat", FFTCONFIGDIR, prefix, mt, hostname);
+    }
+    else
+        n = snprintf(fname, SBUFFERSIZE, "%s/%s%s_wisdom.dat", FFTCONFIGDIR, prefix, mt);
+
     if(n >= SBUFFERSIZE)
         printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-# endif
+}
+
+
+
+// wisdom is stored per host, host-independent wisdom file is read if no host wisdom file exists
+int import_wisdom()
+{
+    FILE *fp;
+    char wisdom_file_single[SBUFFERSIZE];
+    char wisdom_file_double[SBUFFERSIZE];
+    char warnmessg[SBUFFERSIZE];
+    int n;
 
 
+    fft_wisdom_fname(wisdom_file_single, "fftwf", 1);
     if((fp = fopen(wisdom_file_single,"r"))==NULL)
+    {
+        fft_wisdom_fname(wisdom_file_single, "fftwf", 0);
+        fp = fopen(wisdom_file_single,"r");
+    }
+    if(fp==NULL)
     {
         n = snprintf(warnmessg,SBUFFERSIZE,"No single precision wisdom file in %s\n FFTs will not be optimized, and may run slower than if a wisdom file is used\n type \"initfft\" to create the wisdom file (this will take time)", wisdom_file_single);
         if(n >= SBUFFERSIZE)
@@ -383,7 +598,13 @@ int import_wisdom()
     }
 
 
+    fft_wisdom_fname(wisdom_file_double, "fftw", 1);
     if((fp = fopen(wisdom_file_double,"r"))==NULL)
+    {
+        fft_wisdom_fname(wisdom_file_double, "fftw", 0);
+        fp = fopen(wisdom_file_double,"r");
+    }
+    if(fp==NULL)
     {
         n = snprintf(warnmessg,SBUFFERSIZE,"No double precision wisdom file in %s\n FFTs will not be optimized, and may run slower than if a wisdom file is used\n type \"initfft\" to create the wisdom file (this will take time)", wisdom_file_double);
         if(n >= SBUFFERSIZE)
@@ -413,24 +634,9 @@ int export_wisdom()
     
     sprintf(command, "mkdir -p %s", FFTCONFIGDIR);
     ret = system(command);
-    
-# ifdef FFTWMT
-    n = snprintf(wisdom_file_single, SBUFFERSIZE, "%s/fftwf_mt_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-    n = snprintf(wisdom_file_double, SBUFFERSIZE, "%s/fftw_mt_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-# endif
 
-# ifndef FFTWMT
-    n = snprintf(wisdom_file_single, SBUFFERSIZE, "%s/fftwf_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-    n = snprintf(wisdom_file_double, SBUFFERSIZE, "%s/fftw_wisdom.dat", FFTCONFIGDIR);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-# endif
+    fft_wisdom_fname(wisdom_file_single, "fftwf", 1);
+    fft_wisdom_fname(wisdom_file_double, "fftw", 1);
 
 
     if((fp = fopen(wisdom_file_single, "w"))==NULL)
@@ -611,6 +817,7 @@ int permut(const char *ID_name)
     //  printf("permut image %s ...", ID_name);
     // fflush(stdout);
 
+    fft_gpu_sync(ID_name);
     ID = image_ID(ID_name);
     naxis = data.image[ID].md[0].naxis;
 
@@ -811,6 +1018,7 @@ int permut(const char *ID_name)
 
     if(OK==0)
         printf("Error : data format not supported by permut\n");
+    fft_gpu_hostwrite(ID);
 
 
     //  printf(" done\n");
@@ -883,261 +1091,649 @@ int array_index(long size)
 
 
 
-/* 1d complex -> complex fft */
-// supports single and double precisions
-long FFT_do1dfft(const char *in_name, const char *out_name, int dir)
+/* =============================================================================================== */
+/*                                        FFTW PLAN CACHE                                          */
+/* =============================================================================================== */
+
+/*
+ * Plans are created once per (transform type, precision, size, batch, direction, in-place, alignment, threads, planner flags)
+ * and executed on new arrays with fftw(f)_execute_dft / fftw(f)_execute_dft_r2c.
+ * Planning in MEASURE/PATIENT/EXHAUSTIVE mode is done on scratch arrays, so input data is preserved,
+ * and accumulated wisdom is written to the host wisdom file.
+ * When the cache is full, the least recently used plan not being executed is destroyed.
+ */
+
+
+/* planning mode of cached plans: 0:ESTIMATE 1:MEASURE 2:PATIENT 3:EXHAUSTIVE */
+int fft_set_planmode(int mode)
 {
-    int *naxes;
-    uint32_t *naxesl;
-    long naxis;
-    long IDin, IDout;
-    long i;
-    int OK=0;
-    fftwf_plan plan;
-    fftw_plan plan_double;
-	long jj;
-	fftwf_complex *inptr, *outptr;
-	fftw_complex *inptr_double, *outptr_double;
-	int atype;
+    switch(mode) {
+    case 0:
+        fft_planmode = FFTW_ESTIMATE;
+        break;
+    case 1:
+        fft_planmode = FFTW_MEASURE;
+        break;
+    case 2:
+        fft_planmode = FFTW_PATIENT;
+        break;
+    case 3:
+        fft_planmode = FFTW_EXHAUSTIVE;
+        break;
+    default:
+        printERROR(__FILE__,__func__,__LINE__,"Unknown FFTW planning mode");
+        return(-1);
+    }
 
-    IDin=image_ID(in_name);
-    naxis=data.image[IDin].md[0].naxis;
-    naxes = (int *) malloc(naxis*sizeof(int));
-    naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
-    for (i=0; i<naxis; i++)
+    return(0);
+}
+
+
+
+static FFT_PLANCACHE_ENTRY *fft_plancache_get(int kind, int dbl, int rank, const int *n, int howmany, int dir, void *in, void *out)
+{
+    FFT_PLANCACHE_ENTRY *entry = NULL;
+    long k;
+    long kfree = -1;
+    int inplace;
+    int aligned;
+    unsigned flags;
+    long nelem = 1;
+    long nelemout;
+
+
+    inplace = (in == out) ? 1 : 0;
+    if(dbl == 1)
+        aligned = ((fftw_alignment_of((double*) in) == 0)&&(fftw_alignment_of((double*) out) == 0)) ? 1 : 0;
+    else
+        aligned = ((fftwf_alignment_of((float*) in) == 0)&&(fftwf_alignment_of((float*) out) == 0)) ? 1 : 0;
+
+    for(k=0; k<rank; k++)
+        nelem *= n[k];
+    if(kind == FFT_PLAN_R2C)
+        nelemout = nelem/n[rank-1]*(n[rank-1]/2+1);
+    else
+        nelemout = nelem;
+
+    pthread_mutex_lock(&fft_plancache_mutex);
+
+    flags = fft_planmode | ((aligned == 1) ? 0 : FFTW_UNALIGNED);
+    fft_plancache_clock++;
+
+    for(k=0; k<FFT_PLANCACHE_NBENTRY; k++)
     {
-        naxesl[i]= data.image[IDin].md[0].size[i];
-        naxes[i]= (int) data.image[IDin].md[0].size[i];
+        FFT_PLANCACHE_ENTRY *e = &fft_plancache[k];
+
+        if(e->used == 0)
+        {
+            if(kfree == -1)
+                kfree = k;
+            continue;
+        }
+        if((e->kind == kind)&&(e->dbl == dbl)&&(e->rank == rank)&&(e->n[0] == n[0])&&((rank == 1)||(e->n[1] == n[1]))
+                &&(e->howmany == howmany)&&(e->dir == dir)&&(e->inplace == inplace)&&(e->aligned == aligned)
+                &&(e->nthreads == fft_nthreads)&&(e->flags == flags))
+        {
+            entry = e;
+            break;
+        }
     }
-	atype = data.image[IDin].md[0].atype;
-    IDout = create_image_ID(out_name, naxis, naxesl, atype, data.SHARED_DFT, data.NBKEWORD_DFT);
 
-    if(naxis==1)
+    if(entry == NULL)
     {
-        if(array_index(naxes[0])!=100)
+        void *pin = in;
+        void *pout = out;
+        size_t elemsize = (dbl == 1) ? sizeof(double) : sizeof(float);
+        int estimate = ((fft_planmode & FFTW_ESTIMATE) != 0) ? 1 : 0;
+
+        if(kfree == -1)
         {
-            OK=1;
-            if(atype == _DATATYPE_COMPLEX_FLOAT)
-				{
-					plan = fftwf_plan_dft_1d(naxes[0], (fftwf_complex*) data.image[IDin].array.CF, (fftwf_complex*) data.image[IDout].array.CF, dir, FFTWOPTMODE);
-					fftwf_execute(plan);
-					fftwf_destroy_plan(plan);
-				}
+            uint64_t tmin = UINT64_MAX;
+
+            for(k=0; k<FFT_PLANCACHE_NBENTRY; k++)
+                if((fft_plancache[k].inuse == 0)&&(fft_plancache[k].lastuse < tmin))
+                {
+                    tmin = fft_plancache[k].lastuse;
+                    kfree = k;
+                }
+            if(kfree == -1)
+            {
+                pthread_mutex_unlock(&fft_plancache_mutex);
+                printERROR(__FILE__,__func__,__LINE__,"FFTW plan cache full");
+                return(NULL);
+            }
+            if(fft_plancache[kfree].dbl == 1)
+                fftw_destroy_plan(fft_plancache[kfree].pland);
+            else
+                fftwf_destroy_plan(fft_plancache[kfree].planf);
+            fft_plancache[kfree].used = 0;
+        }
+        entry = &fft_plancache[kfree];
+
+        // planning overwrites arrays unless FFTW_ESTIMATE
+        if(estimate == 0)
+        {
+            size_t szin = elemsize*nelem*howmany*((kind == FFT_PLAN_C2C) ? 2 : 1);
+            size_t szout = 2*elemsize*nelemout*howmany;
+
+            pin = fftw_malloc(szin);
+            pout = (inplace == 1) ? pin : fftw_malloc(szout);
+            printf("New FFT plan [%s %s %d x %d x %d]: optimizing ...", (kind == FFT_PLAN_C2C) ? "c2c" : "r2c", (dbl == 1) ? "double" : "single", n[0], (rank == 2) ? n[1] : 1, howmany);
+            fflush(stdout);
+        }
+
+        if(dbl == 1)
+        {
+            if(kind == FFT_PLAN_C2C)
+                entry->pland = fftw_plan_many_dft(rank, n, howmany, (fftw_complex*) pin, NULL, 1, nelem, (fftw_complex*) pout, NULL, 1, nelem, dir, flags);
             else
-				{
-					plan_double = fftw_plan_dft_1d(naxes[0], (fftw_complex*) data.image[IDin].array.CD, (fftw_complex*) data.image[IDout].array.CD, dir, FFTWOPTMODE);
-					fftw_execute(plan_double);
-					fftw_destroy_plan(plan_double);
-				}
+                entry->pland = fftw_plan_many_dft_r2c(rank, n, howmany, (double*) pin, NULL, 1, nelem, (fftw_complex*) pout, NULL, 1, nelemout, flags);
         }
         else
         {
-            OK=1;
-            if(atype == _DATATYPE_COMPLEX_FLOAT)
-				{
-					plan = fftwf_plan_dft_1d(naxes[0], (fftwf_complex*) data.image[IDin].array.CF, (fftwf_complex*) data.image[IDout].array.CF, dir, FFTWOPTMODE);
-					fftwf_execute(plan);
-					fftwf_destroy_plan(plan);
-				}
+            if(kind == FFT_PLAN_C2C)
+                entry->planf = fftwf_plan_many_dft(rank, n, howmany, (fftwf_complex*) pin, NULL, 1, nelem, (fftwf_complex*) pout, NULL, 1, nelem, dir, flags);
             else
-				{
-					plan_double =  fftw_plan_dft_1d(naxes[0], (fftw_complex*) data.image[IDin].array.CD, (fftw_complex*) data.image[IDout].array.CD, dir, FFTWOPTMODE);
-					fftw_execute(plan_double);
-					fftw_destroy_plan(plan_double);
-				}
+                entry->planf = fftwf_plan_many_dft_r2c(rank, n, howmany, (float*) pin, NULL, 1, nelem, (fftwf_complex*) pout, NULL, 1, nelemout, flags);
         }
-    }
 
-    if(naxis==2)
-    {
-        if((naxes[1]==1)&&(array_index(naxes[0])!=100))
+        if(estimate == 0)
         {
-            OK=1;
-            if(atype == _DATATYPE_COMPLEX_FLOAT)
-            {
-				inptr = (fftwf_complex*) data.image[IDin].array.CF;
-				outptr = (fftwf_complex*) data.image[IDout].array.CF;
-				plan = fftwf_plan_dft_1d(naxes[0], inptr, outptr, dir, FFTWOPTMODE);
-				fftwf_execute(plan);
-				fftwf_destroy_plan(plan);
-			}
-			else
-			{
-				inptr_double = (fftw_complex*) data.image[IDin].array.CD;
-				outptr_double = (fftw_complex*) data.image[IDout].array.CD;
-				plan_double = fftw_plan_dft_1d(naxes[0], inptr_double, outptr_double, dir, FFTWOPTMODE);
-				fftw_execute(plan_double);
-				fftw_destroy_plan(plan_double);
-			}
+            if(pout != pin)
+                fftw_free(pout);
+            fftw_free(pin);
+            printf("\n");
         }
-        else
+
+        if( ((dbl == 1)&&(entry->pland == NULL)) || ((dbl == 0)&&(entry->planf == NULL)) )
         {
-            OK=1;
-            if(atype == _DATATYPE_COMPLEX_FLOAT)
-            {
-				inptr = (fftwf_complex*) malloc(sizeof(fftwf_complex)*naxes[0]);
-				outptr = (fftwf_complex*) malloc(sizeof(fftwf_complex)*naxes[0]);
-				plan = fftwf_plan_dft_1d(naxes[0], inptr, outptr, dir, FFTWOPTMODE);
-            
-				for(jj=0;jj<naxes[1];jj++)
-				{
-					memcpy((char*) inptr, (char*) data.image[IDin].array.CF + sizeof(fftwf_complex)*jj*naxes[0], sizeof(fftwf_complex)*naxes[0]);
-					fftwf_execute(plan);
-					memcpy((char*) data.image[IDout].array.CF + sizeof(complex_float)*jj*naxes[0], outptr, sizeof(fftwf_complex)*naxes[0]);
-				}
-				fftwf_destroy_plan(plan);
-				free(inptr);
-				free(outptr);
-			}
-			else
-			{
-				inptr_double = (fftw_complex*) malloc(sizeof(fftw_complex)*naxes[0]);
-				outptr_double = (fftw_complex*) malloc(sizeof(fftw_complex)*naxes[0]);
-				plan_double = fftw_plan_dft_1d(naxes[0], inptr_double, outptr_double, dir, FFTWOPTMODE);
-            
-				for(jj=0;jj<naxes[1];jj++)
-				{
-					memcpy((char*) inptr_double, (char*) data.image[IDin].array.CD + sizeof(fftw_complex)*jj*naxes[0], sizeof(fftw_complex)*naxes[0]);
-					fftw_execute(plan_double);
-					memcpy((char*) data.image[IDout].array.CD + sizeof(complex_double)*jj*naxes[0], outptr_double, sizeof(fftw_complex)*naxes[0]);
-				}
-				fftw_destroy_plan(plan_double);
-				free(inptr_double);
-				free(outptr_double);
-			}
+            pthread_mutex_unlock(&fft_plancache_mutex);
+            printERROR(__FILE__,__func__,__LINE__,"FFTW planning failed");
+            return(NULL);
         }
-    }
 
-    if(OK==0)
-    {
-        printf("Error : image dimension not appropriate for FFT\n");
+        entry->used = 1;
+        entry->kind = kind;
+        entry->dbl = dbl;
+        entry->rank = rank;
+        entry->n[0] = n[0];
+        entry->n[1] = (rank == 2) ? n[1] : 1;
+        entry->howmany = howmany;
+        entry->dir = dir;
+        entry->inplace = inplace;
+        entry->aligned = aligned;
+        entry->nthreads = fft_nthreads;
+        entry->flags = flags;
+        entry->inuse = 0;
+
+        if(estimate == 0)
+            export_wisdom();
     }
-    free(naxes);
-    free(naxesl);
 
-    return(IDout);
+    entry->inuse++;
+    entry->lastuse = fft_plancache_clock;
+
+    pthread_mutex_unlock(&fft_plancache_mutex);
+
+    return(entry);
 }
 
 
 
-/* 1d real -> complex fft */
-// supports single and double precision
-long do1drfft(const char *in_name, const char *out_name)
+/*
+ * Executes transform with cached plan
+ *  kind    : FFT_PLAN_C2C or FFT_PLAN_R2C (forward)
+ *  rank    : 1 or 2, n : sizes (fftw order, last index varies fastest)
+ *  howmany : number of contiguous transforms
+ *  dir     : FFTW_FORWARD or FFTW_BACKWARD (C2C only)
+ * returns 0 if OK, -1 if no plan could be created
+ */
+static int fft_plancache_execute(int kind, int dbl, int rank, const int *n, int howmany, int dir, void *in, void *out)
 {
-    int *naxes;
-    uint32_t *naxesl;
-    uint32_t *naxesout;
-    long naxis;
-    long IDin, IDout, IDtmp;
-    long i;
-    int OK=0;
-    long ii,jj;
-    fftwf_plan plan;
-	fftw_plan plan_double;
-	fftwf_complex *outptr;
-	fftw_complex *outptr_double;
-	float *inptr;
-	double *inptr_double;
-	int atype;
-	
-    char ffttmpname[SBUFFERSIZE];
-    int n;
+    FFT_PLANCACHE_ENTRY *entry;
 
-    IDin = image_ID(in_name);
-    naxis = data.image[IDin].md[0].naxis;
-    naxes = (int *) malloc(naxis*sizeof(int));
-    naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
-    naxesout = (uint32_t *) malloc(naxis*sizeof(uint32_t));
 
-	atype = data.image[IDin].md[0].atype;
+    entry = fft_plancache_get(kind, dbl, rank, n, howmany, dir, in, out);
+    if(entry == NULL)
+        return(-1);
 
-    for (i=0; i<naxis; i++)
+    if(dbl == 1)
     {
-        naxesl[i]= data.image[IDin].md[0].size[i];
-        naxes[i]= (int) data.image[IDin].md[0].size[i];
-        naxesout[i]=data.image[IDin].md[0].size[i];
-        if(i==0)
-            {
-				naxesout[i] = data.image[IDin].md[0].size[i]/2+1;
-			}
+        if(kind == FFT_PLAN_C2C)
+            fftw_execute_dft(entry->pland, (fftw_complex*) in, (fftw_complex*) out);
+        else
+            fftw_execute_dft_r2c(entry->pland, (double*) in, (fftw_complex*) out);
+    }
+    else
+    {
+        if(kind == FFT_PLAN_C2C)
+            fftwf_execute_dft(entry->planf, (fftwf_complex*) in, (fftwf_complex*) out);
+        else
+            fftwf_execute_dft_r2c(entry->planf, (float*) in, (fftwf_complex*) out);
     }
 
+    pthread_mutex_lock(&fft_plancache_mutex);
+    entry->inuse--;
+    pthread_mutex_unlock(&fft_plancache_mutex);
 
-    n = snprintf(ffttmpname,SBUFFERSIZE,"_ffttmpname_%d",(int) getpid());
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-   // IDtmp = create_image_ID(ffttmpname, naxis, naxestmp, CDtype, data.SHARED_DFT, data.NBKEWORD_DFT);
+    return(0);
+}
+
+
+
+
+
+/* =============================================================================================== */
+/*                                        GPU (cuFFT) BACKEND                                      */
+/* =============================================================================================== */
+
+/*
+ * With backend 1 or 2, FFT_do2dfft, FFT_do2dfft_shift and FFT_do2drfft (and functions built on them,
+ * such as fft_correlation and fftzoom) run on the GPU with cuFFT. Each image used by a transform
+ * gets a device copy. A transform output stays on the device in backend 2, so a following transform
+ * reading it does not upload it again. The host array is then stale until fft_gpu_sync() is called.
+ * Functions in this file call fft_gpu_sync() before reading host data.
+ * When cuFFT fails, the transform falls back to FFTW.
+ */
+
+
+int fft_set_backend(int backend)
+{
+    if((backend < FFT_BACKEND_FFTW)||(backend > FFT_BACKEND_CUFFT_LAZY))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"Unknown FFT backend");
+        return(-1);
+    }
+
+#ifndef HAVE_CUDA
+    if(backend != FFT_BACKEND_FFTW)
+    {
+        printf("WARNING: compiled without CUDA, keeping FFTW backend\n");
+        return(-1);
+    }
+#endif
+
+    // switching back to host: sync all device-resident images
+    if(backend != FFT_BACKEND_CUFFT_LAZY)
+        fft_gpu_syncall();
+
+    fft_backend = backend;
+
+    return(0);
+}
 
 
-	if(atype == _DATATYPE_FLOAT)
-		IDout = create_image_ID(out_name, naxis, naxesout, _DATATYPE_COMPLEX_FLOAT, data.SHARED_DFT, data.NBKEWORD_DFT);
-	else
-		IDout = create_image_ID(out_name, naxis, naxesout, _DATATYPE_COMPLEX_DOUBLE, data.SHARED_DFT, data.NBKEWORD_DFT);
 
-    if(naxis==2)
+
+#ifdef HAVE_CUDA
+
+static long fft_gpuimage_find(long ID)
+{
+    long k;
+
+    for(k=0; k<FFT_GPUIMAGE_NBENTRY; k++)
     {
-        if((naxes[1]==1)&&(array_index(naxes[0])!=100))
+        FFT_GPUIMAGE *g = &fft_gpuimage[k];
+
+        if((g->used == 1)&&(g->ID == ID))
         {
-            OK=1;
-            if(atype == _DATATYPE_FLOAT)
+            // image deleted or re-created since device copy was made
+            if((data.image[ID].used == 0)||(strcmp(g->name, data.image[ID].name) != 0)
+                    ||(g->hostptr != (void*) data.image[ID].array.UI8)||(g->creation_time != data.image[ID].md[0].creation_time)
+                    ||(g->nbbyte != TYPESIZE[data.image[ID].md[0].atype]*data.image[ID].md[0].nelement))
             {
-				plan = fftwf_plan_dft_r2c_1d(naxes[0], data.image[IDin].array.F, (fftwf_complex*) data.image[IDout].array.CF, FFTWOPTMODE);
-				fftwf_execute(plan);
-				fftwf_destroy_plan(plan);
-			}
-			else
-			{
-				plan_double = fftw_plan_dft_r2c_1d(naxes[0], data.image[IDin].array.D, (fftw_complex*) data.image[IDout].array.CD, FFTWOPTMODE);
-				fftw_execute(plan_double);
-				fftw_destroy_plan(plan_double);
-			}
+                cudaFree(g->d_data);
+                g->used = 0;
+                return(-1);
+            }
+            return(k);
         }
-        else
+    }
+
+    return(-1);
+}
+
+
+
+static void fft_gpuimage_release(long k)
+{
+    if(fft_gpuimage[k].used == 1)
+    {
+        cudaFree(fft_gpuimage[k].d_data);
+        fft_gpuimage[k].used = 0;
+    }
+}
+
+
+
+// returns device array for image, upload = 1 copies host array to device unless device copy is more recent
+static void *fft_gpuimage_get(long ID, int upload)
+{
+    long k;
+    FFT_GPUIMAGE *g;
+    size_t nbbyte = TYPESIZE[data.image[ID].md[0].atype]*data.image[ID].md[0].nelement;
+
+
+    k = fft_gpuimage_find(ID);
+    if(k == -1)
+    {
+        for(k=0; k<FFT_GPUIMAGE_NBENTRY; k++)
+            if(fft_gpuimage[k].used == 0)
+                break;
+        if(k == FFT_GPUIMAGE_NBENTRY)
         {
-            OK=1;
-            if(atype == _DATATYPE_FLOAT)
+            // table full : evict first entry, syncing it to host if needed
+            for(k=0; k<FFT_GPUIMAGE_NBENTRY; k++)
+                if(fft_gpuimage[k].hostvalid == 1)
+                    break;
+            if(k == FFT_GPUIMAGE_NBENTRY)
             {
-				inptr = (float*) malloc(sizeof(float)*naxes[0]);
-				outptr = (fftwf_complex*) malloc(sizeof(fftwf_complex)*naxes[0]);
-				plan = fftwf_plan_dft_r2c_1d(naxes[0], inptr, outptr, FFTWOPTMODE);
-            
-				for(jj=0;jj<naxes[1];jj++)
-				{
-					memcpy((char*) inptr, (char*) data.image[IDin].array.F + sizeof(float)*jj*naxes[0], sizeof(float)*naxes[0]);
-					fftwf_execute(plan);
-					memcpy((char*) data.image[IDout].array.CF + sizeof(complex_float)*jj*naxesout[0], outptr, sizeof(fftwf_complex)*naxesout[0]);
-				}
-				fftwf_destroy_plan(plan);
-				free(inptr);
-				free(outptr);
-			}
-			else
-			{
-				inptr_double = (double*) malloc(sizeof(double)*naxes[0]);
-				outptr_double = (fftw_complex*) malloc(sizeof(fftw_complex)*naxes[0]);
-				plan_double = fftw_plan_dft_r2c_1d(naxes[0], inptr_double, outptr_double, FFTWOPTMODE);
-            
-				for(jj=0;jj<naxes[1];jj++)
-				{
-					memcpy((char*) inptr_double, (char*) data.image[IDin].array.D + sizeof(double)*jj*naxes[0], sizeof(double)*naxes[0]);
-					fftw_execute(plan_double);
-					memcpy((char*) data.image[IDout].array.CD + sizeof(complex_double)*jj*naxesout[0], outptr_double, sizeof(fftw_complex)*naxesout[0]);
-				}
-				fftw_destroy_plan(plan_double);
-				free(inptr_double);
-				free(outptr_double);
-			}
+                k = 0;
+                fft_gpu_sync(data.image[fft_gpuimage[0].ID].name);
+            }
+            fft_gpuimage_release(k);
+        }
+
+        g = &fft_gpuimage[k];
+        if(cudaMalloc(&g->d_data, nbbyte) != cudaSuccess)
+            return(NULL);
+        g->used = 1;
+        g->ID = ID;
+        strncpy(g->name, data.image[ID].name, 79);
+        g->name[79] = '\0';
+        g->hostptr = (void*) data.image[ID].array.UI8;
+        g->creation_time = data.image[ID].md[0].creation_time;
+        g->nbbyte = nbbyte;
+        g->hostvalid = 1;
+    }
+    g = &fft_gpuimage[k];
+
+    if((upload == 1)&&(g->hostvalid == 1))
+        if(cudaMemcpy(g->d_data, data.image[ID].array.UI8, nbbyte, cudaMemcpyHostToDevice) != cudaSuccess)
+            return(NULL);
+
+    return(g->d_data);
+}
+
+
+
+static FFT_CUFFTPLAN *fft_cufftplan_get(int kind, int dbl, int rank, const int *n, int howmany)
+{
+    long k;
+    FFT_CUFFTPLAN *p;
+    int nn[2];
+    long nelem = 1;
+    long nelemout;
+    cufftType type;
+
+
+    for(k=0; k<FFT_CUFFTPLAN_NBENTRY; k++)
+    {
+        p = &fft_cufftplan[k];
+        if((p->used == 1)&&(p->kind == kind)&&(p->dbl == dbl)&&(p->rank == rank)&&(p->n[0] == n[0])
+                &&((rank == 1)||(p->n[1] == n[1]))&&(p->howmany == howmany))
+            return(p);
+    }
+
+    k = fft_cufftplan_next;
+    fft_cufftplan_next = (fft_cufftplan_next+1) % FFT_CUFFTPLAN_NBENTRY;
+    p = &fft_cufftplan[k];
+    if(p->used == 1)
+    {
+        cufftDestroy(p->plan);
+        p->used = 0;
+    }
+
+    for(k=0; k<rank; k++)
+    {
+        nn[k] = n[k];
+        nelem *= n[k];
+    }
+    nelemout = (kind == FFT_PLAN_R2C) ? nelem/n[rank-1]*(n[rank-1]/2+1) : nelem;
+
+    if(kind == FFT_PLAN_C2C)
+        type = (dbl == 1) ? CUFFT_Z2Z : CUFFT_C2C;
+    else
+        type = (dbl == 1) ? CUFFT_D2Z : CUFFT_R2C;
+
+    if(cufftPlanMany(&p->plan, rank, nn, NULL, 1, nelem, NULL, 1, nelemout, type, howmany) != CUFFT_SUCCESS)
+        return(NULL);
+
+    p->used = 1;
+    p->kind = kind;
+    p->dbl = dbl;
+    p->rank = rank;
+    p->n[0] = n[0];
+    p->n[1] = (rank == 2) ? n[1] : 1;
+    p->howmany = howmany;
+
+    return(p);
+}
+
+#endif
+
+
+
+/*
+ * Runs transform on GPU between images IDin and IDout
+ * returns 0 if OK, -1 if GPU backend not selected or transform failed (caller should then use FFTW)
+ */
+static int fft_cufft_execute(int kind, int dbl, int rank, const int *n, int howmany, int dir, long IDin, long IDout)
+{
+#ifdef HAVE_CUDA
+    void *d_in;
+    void *d_out;
+    FFT_CUFFTPLAN *p;
+    cufftResult res;
+    long k;
+
+
+    if(fft_backend == FFT_BACKEND_FFTW)
+        return(-1);
+
+    d_in = fft_gpuimage_get(IDin, 1);
+    d_out = (IDout == IDin) ? d_in : fft_gpuimage_get(IDout, 0);
+    p = fft_cufftplan_get(kind, dbl, rank, n, howmany);
+    if((d_in == NULL)||(d_out == NULL)||(p == NULL))
+    {
+        printf("WARNING: cuFFT transform failed, using FFTW\n");
+        fft_gpu_sync(data.image[IDin].name);
+        return(-1);
+    }
+
+    if(kind == FFT_PLAN_C2C)
+    {
+        if(dbl == 1)
+            res = cufftExecZ2Z(p->plan, (cufftDoubleComplex*) d_in, (cufftDoubleComplex*) d_out, (dir == -1) ? CUFFT_FORWARD : CUFFT_INVERSE);
+        else
+            res = cufftExecC2C(p->plan, (cufftComplex*) d_in, (cufftComplex*) d_out, (dir == -1) ? CUFFT_FORWARD : CUFFT_INVERSE);
+    }
+    else
+    {
+        if(dbl == 1)
+            res = cufftExecD2Z(p->plan, (cufftDoubleReal*) d_in, (cufftDoubleComplex*) d_out);
+        else
+            res = cufftExecR2C(p->plan, (cufftReal*) d_in, (cufftComplex*) d_out);
+    }
+    if(res != CUFFT_SUCCESS)
+    {
+        printf("WARNING: cuFFT transform failed, using FFTW\n");
+        fft_gpu_sync(data.image[IDin].name);
+        return(-1);
+    }
+
+    k = fft_gpuimage_find(IDout);
+    fft_gpuimage[k].hostvalid = 0;
+    if(fft_backend == FFT_BACKEND_CUFFT)
+        fft_gpu_sync(data.image[IDout].name);
+
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+
+
+/*
+ * Copies device-resident image to host array if device copy is more recent
+ * Must be called before host code reads images written by transforms in backend 2
+ * The host array is then considered current: next GPU transform reading it uploads it again
+ */
+int fft_gpu_sync(const char *ID_name)
+{
+#ifdef HAVE_CUDA
+    long ID;
+    long k;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+        return(-1);
+
+    k = fft_gpuimage_find(ID);
+    if(k == -1)
+        return(0);
+
+    if(fft_gpuimage[k].hostvalid == 0)
+    {
+        if(cudaMemcpy(data.image[ID].array.UI8, fft_gpuimage[k].d_data, fft_gpuimage[k].nbbyte, cudaMemcpyDeviceToHost) != cudaSuccess)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"cudaMemcpy device to host failed");
+            return(-1);
         }
+        fft_gpuimage[k].hostvalid = 1;
+    }
+#endif
+
+    return(0);
+}
+
+
+
+int fft_gpu_syncall()
+{
+#ifdef HAVE_CUDA
+    long k;
+
+    for(k=0; k<FFT_GPUIMAGE_NBENTRY; k++)
+        if(fft_gpuimage[k].used == 1)
+            if(fft_gpuimage_find(fft_gpuimage[k].ID) == k)
+                fft_gpu_sync(data.image[fft_gpuimage[k].ID].name);
+#endif
+
+    return(0);
+}
+
+
+
+// drop device copy after host array has been replaced or written
+static void fft_gpu_hostwrite(long ID)
+{
+#ifdef HAVE_CUDA
+    long k;
+
+    k = fft_gpuimage_find(ID);
+    if(k != -1)
+        fft_gpuimage_release(k);
+#endif
+}
+
+
+
+
+/* 1d complex -> complex fft */
+// supports single and double precisions
+// 2D image : each line is transformed
+long FFT_do1dfft(const char *in_name, const char *out_name, int dir)
+{
+    uint32_t *naxesl;
+    long naxis;
+    long IDin, IDout;
+    long i;
+    int OK=0;
+    int n;
+    int howmany;
+	int atype;
+
+    fft_gpu_sync(in_name);
+    IDin=image_ID(in_name);
+    naxis=data.image[IDin].md[0].naxis;
+    naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
+    for (i=0; i<naxis; i++)
+        naxesl[i]= data.image[IDin].md[0].size[i];
+	atype = data.image[IDin].md[0].atype;
+    IDout = create_image_ID(out_name, naxis, naxesl, atype, data.SHARED_DFT, data.NBKEWORD_DFT);
+    fft_gpu_hostwrite(IDout);
+
+    if((naxis==1)||(naxis==2))
+    {
+        n = (int) naxesl[0];
+        howmany = (naxis==2) ? (int) naxesl[1] : 1;
+
+        if(atype == _DATATYPE_COMPLEX_FLOAT)
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 0, 1, &n, howmany, dir, data.image[IDin].array.CF, data.image[IDout].array.CF) == 0);
+        else
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 1, 1, &n, howmany, dir, data.image[IDin].array.CD, data.image[IDout].array.CD) == 0);
     }
 
     if(OK==0)
     {
         printf("Error : image dimension not appropriate for FFT\n");
     }
-    free(naxes);
     free(naxesl);
+
+    return(IDout);
+}
+
+
+
+/* 1d real -> complex fft */
+// supports single and double precision
+// 2D image : each line is transformed
+long do1drfft(const char *in_name, const char *out_name)
+{
+    uint32_t *naxesout;
+    long naxis;
+    long IDin, IDout;
+    long i;
+    int OK=0;
+    int n;
+    int howmany;
+	int atype;
+
+    fft_gpu_sync(in_name);
+    IDin = image_ID(in_name);
+    naxis = data.image[IDin].md[0].naxis;
+    naxesout = (uint32_t *) malloc(naxis*sizeof(uint32_t));
+
+	atype = data.image[IDin].md[0].atype;
+
+    for (i=0; i<naxis; i++)
+        naxesout[i] = data.image[IDin].md[0].size[i];
+    naxesout[0] = data.image[IDin].md[0].size[0]/2+1;
+
+	if(atype == _DATATYPE_FLOAT)
+		IDout = create_image_ID(out_name, naxis, naxesout, _DATATYPE_COMPLEX_FLOAT, data.SHARED_DFT, data.NBKEWORD_DFT);
+	else
+		IDout = create_image_ID(out_name, naxis, naxesout, _DATATYPE_COMPLEX_DOUBLE, data.SHARED_DFT, data.NBKEWORD_DFT);
+    fft_gpu_hostwrite(IDout);
+
+    if((naxis==1)||(naxis==2))
+    {
+        n = (int) data.image[IDin].md[0].size[0];
+        howmany = (naxis==2) ? (int) data.image[IDin].md[0].size[1] : 1;
+
+        if(atype == _DATATYPE_FLOAT)
+            OK = (fft_plancache_execute(FFT_PLAN_R2C, 0, 1, &n, howmany, FFTW_FORWARD, data.image[IDin].array.F, data.image[IDout].array.CF) == 0);
+        else
+            OK = (fft_plancache_execute(FFT_PLAN_R2C, 1, 1, &n, howmany, FFTW_FORWARD, data.image[IDin].array.D, data.image[IDout].array.CD) == 0);
+    }
+
+    if(OK==0)
+    {
+        printf("Error : image dimension not appropriate for FFT\n");
+    }
     free(naxesout);
-   // delete_image_ID(ffttmpname);
 
     return(IDout);
 }
@@ -1171,164 +1767,52 @@ long do1dffti(const char *in_name, const char *out_name)
 
 /* 2d complex fft */
 // supports single and double precisions
+// 3D image : each slice is transformed
 long FFT_do2dfft(const char *in_name, const char *out_name, int dir)
 {
-    int *naxes;
     uint32_t *naxesl;
     long naxis;
     long IDin,IDout;
     long i;
     int OK=0;
-    fftwf_plan plan;
-    fftw_plan plan_double;
-    long tmp1;
-    long IDcpy;
-
-    char ffttmpcpyname[SBUFFERSIZE];
-    int n;
-    long nextID;
+    int n[2];
+    int howmany;
 	int atype;
 
 
 	
     IDin = image_ID(in_name);
     naxis = data.image[IDin].md[0].naxis;
-    naxes = (int *) malloc(naxis*sizeof(int));
     naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
 
     for (i=0; i<naxis; i++)
-    {
         naxesl[i]= (long) data.image[IDin].md[0].size[i];
-        naxes[i]= (int) data.image[IDin].md[0].size[i];
-    }
-
-	
 
 	atype = data.image[IDin].md[0].atype;
     IDout = create_image_ID(out_name, naxis, naxesl, atype, data.SHARED_DFT, data.NBKEWORD_DFT);
+    fft_gpu_hostwrite(IDout);
 
 
-
-    // need to swap first 2 axis for fftw
-    if(naxis>1)
-    {
-        tmp1 = naxes[0];
-        naxes[0] = naxes[1];
-        naxes[1] = tmp1;
-    }
-    
-    
-
-    if(naxis==2)
-    {
-        OK=1;
-        
-        if(atype == _DATATYPE_COMPLEX_FLOAT)
-        {
-			plan = fftwf_plan_dft_2d(naxes[0],naxes[1], (fftwf_complex*) data.image[IDin].array.CF, (fftwf_complex*) data.image[IDout].array.CF, dir, FFTWOPTMODE);
-			if(plan==NULL)
-			{
-				//	  if ( Debug > 2)
-				fprintf(stdout,"New FFT size [do2dfft %d x %d]: optimizing ...",naxes[1],naxes[0]);
-				fflush(stdout);
-
-				n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpyname_%d",(int) getpid());
-				if(n >= SBUFFERSIZE)
-					printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-				copy_image_ID(in_name, ffttmpcpyname, 0);
-
-				plan = fftwf_plan_dft_2d(naxes[0],naxes[1], (fftwf_complex*) data.image[IDin].array.CF, (fftwf_complex*) data.image[IDout].array.CF, dir, FFTWOPTMODE);
-				copy_image_ID(ffttmpcpyname, in_name, 0);
-				delete_image_ID(ffttmpcpyname);
-				export_wisdom();
-				fprintf(stdout,"\n");
-			}
-			fftwf_execute(plan);
-			fftwf_destroy_plan(plan);
-		}
-		else
-		{
-			plan_double = fftw_plan_dft_2d(naxes[0], naxes[1], (fftw_complex*) data.image[IDin].array.CD, (fftw_complex*) data.image[IDout].array.CD, dir, FFTWOPTMODE);
-			if(plan_double==NULL)
-			{
-				//	  if ( Debug > 2)
-				fprintf(stdout,"New FFT size [do2dfft %d x %d]: optimizing ...",naxes[1], naxes[0]);
-				fflush(stdout);
-
-				n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpyname_%d",(int) getpid());
-				if(n >= SBUFFERSIZE)
-					printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-				copy_image_ID(in_name, ffttmpcpyname, 0);
-
-				plan_double = fftw_plan_dft_2d(naxes[0], naxes[1], (fftw_complex*) data.image[IDin].array.CD, (fftw_complex*) data.image[IDout].array.CD, dir, FFTWOPTMODE);
-				copy_image_ID(ffttmpcpyname, in_name, 0);
-				delete_image_ID(ffttmpcpyname);
-				export_wisdom();
-				fprintf(stdout,"\n");
-			}
-			fftw_execute(plan_double);
-			fftw_destroy_plan(plan_double);
-		}
-    }
-
-
-
-    if(naxis==3)
+    if((naxis==2)||(naxis==3))
     {
-        OK=1;
-		if(atype == _DATATYPE_COMPLEX_FLOAT)
-        {
-			plan = fftwf_plan_many_dft(2,naxes,naxes[2],(fftwf_complex*) data.image[IDin].array.CF,NULL, 1, naxes[0]*naxes[1],(fftwf_complex*) data.image[IDout].array.CF,NULL, 1 ,naxes[0]*naxes[1], dir, FFTWOPTMODE);
-			if(plan==NULL)
-			{
-				//if ( Debug > 2)
-				fprintf(stdout,"New FFT size [do2dfft %d x %d x %d]: optimizing ...",naxes[1],naxes[0],naxes[2]);
-				fflush(stdout);
-
-				n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpyname_%d",(int) getpid());
-				if(n >= SBUFFERSIZE)
-					printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-				copy_image_ID(in_name, ffttmpcpyname, 0);
-
-				plan = fftwf_plan_many_dft(2,naxes,naxes[2],(fftwf_complex*) data.image[IDin].array.CF,NULL, 1, naxes[0]*naxes[1],(fftwf_complex*) data.image[IDout].array.CF,NULL, 1,naxes[0]*naxes[1], dir, FFTWOPTMODE);
-				copy_image_ID(ffttmpcpyname, in_name, 0);
-				delete_image_ID(ffttmpcpyname);
-				export_wisdom();
-				fprintf(stdout,"\n");
-			}
-			fftwf_execute(plan);
-			fftwf_destroy_plan(plan);
-		}
-		else
-		{
-			plan_double = fftw_plan_many_dft(2, naxes, naxes[2],(fftw_complex*) data.image[IDin].array.CD, NULL, 1, naxes[0]*naxes[1], (fftw_complex*) data.image[IDout].array.CD, NULL, 1 ,naxes[0]*naxes[1], dir, FFTWOPTMODE);
-			if(plan_double==NULL)
-			{
-				//if ( Debug > 2)
-				fprintf(stdout,"New FFT size [do2dfft %d x %d x %d]: optimizing ...",naxes[1],naxes[0],naxes[2]);
-				fflush(stdout);
-
-				n = snprintf(ffttmpcpyname, SBUFFERSIZE, "_ffttmpcpyname_%d", (int) getpid());
-				if(n >= SBUFFERSIZE)
-					printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-				copy_image_ID(in_name, ffttmpcpyname, 0);
-
-				plan_double = fftw_plan_many_dft(2, naxes, naxes[2], (fftw_complex*) data.image[IDin].array.CD, NULL, 1, naxes[0]*naxes[1],(fftw_complex*) data.image[IDout].array.CD,NULL, 1, naxes[0]*naxes[1], dir, FFTWOPTMODE);
-				copy_image_ID(ffttmpcpyname, in_name, 0);
-				delete_image_ID(ffttmpcpyname);
-				export_wisdom();
-				fprintf(stdout,"\n");
-			}
-			fftw_execute(plan_double);
-			fftw_destroy_plan(plan_double);
-		}
+        // need to swap first 2 axis for fftw
+        n[0] = (int) naxesl[1];
+        n[1] = (int) naxesl[0];
+        howmany = (naxis==3) ? (int) naxesl[2] : 1;
+
+        if(fft_cufft_execute(FFT_PLAN_C2C, (atype == _DATATYPE_COMPLEX_DOUBLE) ? 1 : 0, 2, n, howmany, dir, IDin, IDout) == 0)
+            OK = 1;
+        else if(atype == _DATATYPE_COMPLEX_FLOAT)
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, howmany, dir, data.image[IDin].array.CF, data.image[IDout].array.CF) == 0);
+        else
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 1, 2, n, howmany, dir, data.image[IDin].array.CD, data.image[IDout].array.CD) == 0);
     }
 
 
     if(OK==0)
         printf("Error : image dimension not appropriate for FFT\n");
 
-    free(naxes);
+    free(naxesl);
 
 
     return(IDout);
@@ -1358,6 +1842,157 @@ long do2dffti(const char *in_name, const char *out_name)
 
 
 
+/* 2d complex fft between existing images (IDin == IDout allowed), no allocation */
+// intended for loops that transform the same buffers every iteration
+// 3D image : each slice is transformed
+long FFT_do2dfft_byID(long IDin, long IDout, int dir)
+{
+    long naxis;
+    int n[2];
+    int howmany;
+    int atype;
+    int OK = 0;
+
+
+    naxis = data.image[IDin].md[0].naxis;
+    atype = data.image[IDin].md[0].atype;
+
+    if(((naxis==2)||(naxis==3))&&(data.image[IDout].md[0].atype == atype)&&(data.image[IDout].md[0].nelement == data.image[IDin].md[0].nelement))
+    {
+        n[0] = (int) data.image[IDin].md[0].size[1];
+        n[1] = (int) data.image[IDin].md[0].size[0];
+        howmany = (naxis==3) ? (int) data.image[IDin].md[0].size[2] : 1;
+
+        fft_gpu_hostwrite(IDout);
+        if(fft_cufft_execute(FFT_PLAN_C2C, (atype == _DATATYPE_COMPLEX_DOUBLE) ? 1 : 0, 2, n, howmany, dir, IDin, IDout) == 0)
+            OK = 1;
+        else if(atype == _DATATYPE_COMPLEX_FLOAT)
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, howmany, dir, data.image[IDin].array.CF, data.image[IDout].array.CF) == 0);
+        else if(atype == _DATATYPE_COMPLEX_DOUBLE)
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 1, 2, n, howmany, dir, data.image[IDin].array.CD, data.image[IDout].array.CD) == 0);
+    }
+
+    if(OK==0)
+    {
+        printf("Error : image dimension not appropriate for FFT\n");
+        return(-1);
+    }
+
+    return(IDout);
+}
+
+
+
+/* 2d complex fft with centered output, equivalent to FFT_do2dfft followed by permut(out_name) */
+// for even sizes, the quadrant swap is applied as a (-1)^(ii+jj) modulation fused into the input copy and the transform is done in place
+// odd sizes fall back to FFT_do2dfft + permut
+// 3D image : each slice is transformed
+long FFT_do2dfft_shift(const char *in_name, const char *out_name, int dir)
+{
+    long IDin, IDout;
+    long naxis;
+    uint32_t *naxesl;
+    long i;
+    long ii, jj, kk;
+    long nx, ny, nz;
+    int n[2];
+    int atype;
+    int OK = 0;
+
+
+    fft_gpu_sync(in_name);
+    IDin = image_ID(in_name);
+    naxis = data.image[IDin].md[0].naxis;
+    atype = data.image[IDin].md[0].atype;
+
+    if((naxis<2)||(naxis>3)||(data.image[IDin].md[0].size[0]%2==1)||(data.image[IDin].md[0].size[1]%2==1))
+    {
+        IDout = FFT_do2dfft(in_name, out_name, dir);
+        permut(out_name);
+        return(IDout);
+    }
+
+    naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
+    for (i=0; i<naxis; i++)
+        naxesl[i] = data.image[IDin].md[0].size[i];
+    IDout = create_image_ID(out_name, naxis, naxesl, atype, data.SHARED_DFT, data.NBKEWORD_DFT);
+    fft_gpu_hostwrite(IDout);
+
+    nx = naxesl[0];
+    ny = naxesl[1];
+    nz = (naxis==3) ? naxesl[2] : 1;
+    n[0] = (int) ny;
+    n[1] = (int) nx;
+
+    if(atype == _DATATYPE_COMPLEX_FLOAT)
+    {
+        complex_float *in = data.image[IDin].array.CF;
+        complex_float *out = data.image[IDout].array.CF;
+
+        for(kk=0; kk<nz; kk++)
+            for(jj=0; jj<ny; jj++)
+            {
+                long offset = (kk*ny+jj)*nx;
+                for(ii=(jj%2); ii<nx; ii+=2)
+                    out[offset+ii] = in[offset+ii];
+                for(ii=1-(jj%2); ii<nx; ii+=2)
+                {
+                    out[offset+ii].re = -in[offset+ii].re;
+                    out[offset+ii].im = -in[offset+ii].im;
+                }
+            }
+        if(fft_cufft_execute(FFT_PLAN_C2C, 0, 2, n, (int) nz, dir, IDout, IDout) == 0)
+            OK = 1;
+        else
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, (int) nz, dir, out, out) == 0);
+    }
+    else if(atype == _DATATYPE_COMPLEX_DOUBLE)
+    {
+        complex_double *in = data.image[IDin].array.CD;
+        complex_double *out = data.image[IDout].array.CD;
+
+        for(kk=0; kk<nz; kk++)
+            for(jj=0; jj<ny; jj++)
+            {
+                long offset = (kk*ny+jj)*nx;
+                for(ii=(jj%2); ii<nx; ii+=2)
+                    out[offset+ii] = in[offset+ii];
+                for(ii=1-(jj%2); ii<nx; ii+=2)
+                {
+                    out[offset+ii].re = -in[offset+ii].re;
+                    out[offset+ii].im = -in[offset+ii].im;
+                }
+            }
+        if(fft_cufft_execute(FFT_PLAN_C2C, 1, 2, n, (int) nz, dir, IDout, IDout) == 0)
+            OK = 1;
+        else
+            OK = (fft_plancache_execute(FFT_PLAN_C2C, 1, 2, n, (int) nz, dir, out, out) == 0);
+    }
+
+    if(OK==0)
+        printf("Error : image dimension not appropriate for FFT\n");
+
+    free(naxesl);
+
+    return(IDout);
+}
+
+
+long do2dfft_shift(const char *in_name, const char *out_name)
+{
+	return(FFT_do2dfft_shift(in_name, out_name, -1));
+}
+
+
+long do2dffti_shift(const char *in_name, const char *out_name)
+{
+	return(FFT_do2dfft_shift(in_name, out_name, 1));
+}
+
+
+
+
+
 
 
 
@@ -1368,8 +2003,6 @@ long do2dffti(const char *in_name, const char *out_name)
 
 
 
-
-
 /* inv = 0 for direct fft and 1 for inverse fft */
 /* direct = focal plane -> pupil plane  equ. fft2d(..,..,..,1) */
 /* inverse = pupil plane -> focal plane equ. fft2d(..,..,..,0) */
@@ -1449,9 +2082,10 @@ int pupfft(const char *ID_name_ampl, const char *ID_name_pha, const char *ID_nam
 
 /* real fft : real to complex */
 // supports single and double precisions
+// full complex spectrum is reconstructed from r2c output by hermitian symmetry, conjugated for dir = 1
+// 3D image : each slice is transformed
 long FFT_do2drfft(const char *in_name, const char *out_name, int dir)
 {
-    int *naxes;  // int format for fftw 
     uint32_t *naxesl;
     uint32_t *naxestmp;
 
@@ -1459,15 +2093,12 @@ long FFT_do2drfft(const char *in_name, const char *out_name, int dir)
     long IDin,IDout,IDtmp;
     long i;
     int OK=0;
-    long idist;
     long ii,jj,kk;
-    fftwf_plan plan;
-    fftw_plan plan_double;
-    long tmp1;
+    long nx, ny, nxt, nz;
+    int n[2];
 
     char ffttmpname[SBUFFERSIZE];
-    char ffttmpcpyname[SBUFFERSIZE];
-    int n;
+    int nc;
     
     int atype;
     int atypeout;
@@ -1477,225 +2108,123 @@ long FFT_do2drfft(const char *in_name, const char *out_name, int dir)
     
     atype = data.image[IDin].md[0].atype;
     naxis = data.image[IDin].md[0].naxis;
-    naxes = (int *) malloc(naxis*sizeof(int));
     naxesl = (uint32_t *) malloc(naxis*sizeof(uint32_t));
     naxestmp = (uint32_t *) malloc(naxis*sizeof(uint32_t));
 
-
-
-
     for (i=0; i<naxis; i++)
     {
-        naxes[i] = (int) data.image[IDin].md[0].size[i];
         naxesl[i] = (uint32_t) data.image[IDin].md[0].size[i];
         naxestmp[i] = data.image[IDin].md[0].size[i];
         if(i==0)
             naxestmp[i] = data.image[IDin].md[0].size[i]/2+1;
     }
 
-    n = snprintf(ffttmpname,SBUFFERSIZE,"_ffttmp_%d",(int) getpid());
-    if(n >= SBUFFERSIZE)
+    nc = snprintf(ffttmpname,SBUFFERSIZE,"_ffttmp_%d",(int) getpid());
+    if(nc >= SBUFFERSIZE)
+    {
         printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
+    }
 
-	if(atype==_DATATYPE_FLOAT)
-		atypeout = _DATATYPE_COMPLEX_FLOAT;
-	else
-		atypeout = _DATATYPE_COMPLEX_DOUBLE;
+    if(atype==_DATATYPE_FLOAT)
+        atypeout = _DATATYPE_COMPLEX_FLOAT;
+    else
+        atypeout = _DATATYPE_COMPLEX_DOUBLE;
 
     IDtmp = create_image_ID(ffttmpname, naxis, naxestmp, atypeout, data.SHARED_DFT, data.NBKEWORD_DFT);
 
     IDout = create_image_ID(out_name, naxis, naxesl, atypeout, data.SHARED_DFT, data.NBKEWORD_DFT);
-    
-    if(naxis==2)
-    {
-        OK=1;
-        if(atype==_DATATYPE_FLOAT)
-        {
-            plan = fftwf_plan_dft_r2c_2d((int) naxes[1], (int) naxes[0], data.image[IDin].array.F, (fftwf_complex*) data.image[IDtmp].array.CF, FFTWOPTMODE);
-            if(plan==NULL)
-            {
-                // if ( Debug > 2)
-                fprintf(stdout,"New FFT size [do2drfft %d x %d]: optimizing ...",naxes[1], naxes[0]);
-                fflush(stdout);
-
-                n = snprintf(ffttmpcpyname, SBUFFERSIZE, "_ffttmpcpy_%d", (int) getpid());
-                if(n >= SBUFFERSIZE)
-                    printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-                copy_image_ID(in_name, ffttmpcpyname, 0);
-
-                plan = fftwf_plan_dft_r2c_2d(naxes[1], naxes[0], data.image[IDin].array.F, (fftwf_complex*) data.image[IDtmp].array.CF, FFTWOPTMODE);
-                copy_image_ID(ffttmpcpyname, in_name, 0);
-                delete_image_ID(ffttmpcpyname);
-                export_wisdom();
-                fprintf(stdout,"\n");
-            }
-            fftwf_execute(plan);
-            fftwf_destroy_plan(plan);
-
-            if(dir == -1)
-            {
-                for(ii=0; ii<naxes[0]/2+1; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                        data.image[IDout].array.CF[jj*naxes[0]+ii] = data.image[IDtmp].array.CF[jj*naxestmp[0]+ii];
-                 
-                for(ii=1; ii<naxes[0]/2+1; ii++)
-                {
-                    jj=0;
-                    data.image[IDout].array.CF[jj*naxes[0]+(naxes[0]-ii)].re = data.image[IDtmp].array.CF[jj*naxestmp[0]+ii].re;
-                    data.image[IDout].array.CF[jj*naxes[0]+(naxes[0]-ii)].im = -data.image[IDtmp].array.CF[jj*naxestmp[0]+ii].im;
-                    for(jj=1; jj<naxes[1]; jj++)
-                    {
-                        data.image[IDout].array.CF[jj*naxes[0]+(naxes[0]-ii)].re = data.image[IDtmp].array.CF[(naxes[1]-jj)*naxestmp[0]+ii].re;
-                        data.image[IDout].array.CF[jj*naxes[0]+(naxes[0]-ii)].im = -data.image[IDtmp].array.CF[(naxes[1]-jj)*naxestmp[0]+ii].im;
-                    }
-                }
-            }
-        }
-        else
-        {
-            plan_double = fftw_plan_dft_r2c_2d(naxes[1], naxes[0], data.image[IDin].array.D, (fftw_complex*) data.image[IDtmp].array.CD, FFTWOPTMODE);
-            if(plan_double==NULL)
-            {
-                // if ( Debug > 2)
-                fprintf(stdout,"New FFT size [do2drfft %d x %d]: optimizing ...",naxes[1], naxes[0]);
-                fflush(stdout);
-
-                n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpy_%d",(int) getpid());
-                if(n >= SBUFFERSIZE)
-                    printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-                copy_image_ID(in_name, ffttmpcpyname, 0);
-
-                plan_double = fftw_plan_dft_r2c_2d(naxes[1], naxes[0], data.image[IDin].array.D, (fftw_complex*) data.image[IDtmp].array.CD, FFTWOPTMODE);
-                copy_image_ID(ffttmpcpyname, in_name, 0);
-                delete_image_ID(ffttmpcpyname);
-                export_wisdom();
-                fprintf(stdout,"\n");
-            }
-            fftw_execute(plan_double);
-            fftw_destroy_plan(plan_double);
+    fft_gpu_hostwrite(IDtmp);
+    fft_gpu_hostwrite(IDout);
 
-            if(dir == -1)
-            {
-                for(ii=0; ii<naxes[0]/2+1; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                        data.image[IDout].array.CD[jj*naxes[0]+ii] = data.image[IDtmp].array.CD[jj*naxestmp[0]+ii];
-
-                for(ii=1; ii<naxes[0]/2+1; ii++)
-                {
-                    jj=0;
-                    data.image[IDout].array.CD[jj*naxes[0]+(naxes[0]-ii)].re = data.image[IDtmp].array.CD[jj*naxestmp[0]+ii].re;
-                    data.image[IDout].array.CD[jj*naxes[0]+(naxes[0]-ii)].im = -data.image[IDtmp].array.CD[jj*naxestmp[0]+ii].im;
-                    for(jj=1; jj<naxes[1]; jj++)
-                    {
-                        data.image[IDout].array.CD[jj*naxes[0]+(naxes[0]-ii)].re = data.image[IDtmp].array.CD[(naxes[1]-jj)*naxestmp[0]+ii].re;
-                        data.image[IDout].array.CD[jj*naxes[0]+(naxes[0]-ii)].im = -data.image[IDtmp].array.CD[(naxes[1]-jj)*naxestmp[0]+ii].im;
-                    }
-                }
-            }
-        }
-    }
-    if(naxis==3)
+    if((naxis==2)||(naxis==3))
     {
-        OK=1;
-        idist = naxes[0]*naxes[1];
+        nx = naxesl[0];
+        ny = naxesl[1];
+        nxt = naxestmp[0];
+        nz = (naxis==3) ? naxesl[2] : 1;
 
-        // swapping first 2 axis
-        tmp1 = naxes[0];
-        naxes[0] = naxes[1];
-        naxes[1] = tmp1;
+        // fftw order: first 2 axis swapped
+        n[0] = (int) ny;
+        n[1] = (int) nx;
 
         if(atype==_DATATYPE_FLOAT)
         {
-            plan = fftwf_plan_many_dft_r2c(2, naxes, naxes[2], data.image[IDin].array.F, NULL, 1, naxes[0]*naxes[1], (fftwf_complex*) data.image[IDout].array.CF,NULL,1,naxes[0]*naxes[1],FFTWOPTMODE);
-            if(plan==NULL)
+            if(fft_cufft_execute(FFT_PLAN_R2C, 0, 2, n, (int) nz, FFTW_FORWARD, IDin, IDtmp) == 0)
+                OK = (fft_gpu_sync(ffttmpname) == 0);
+            else
             {
-                //	  if ( Debug > 2) fprintf(stdout,"New FFT size [do2drfft %d x %d x %d]: optimizing ...",naxes[1],naxes[0],naxes[2]);
-                fflush(stdout);
-
-                n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpy_%d",(int) getpid());
-                if(n >= SBUFFERSIZE)
-                    printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-                copy_image_ID(in_name, ffttmpcpyname, 0);
-
-                plan = fftwf_plan_many_dft_r2c(2, naxes, naxes[2], data.image[IDin].array.F, NULL, 1, naxes[0]*naxes[1], (fftwf_complex*) data.image[IDout].array.CF,NULL,1,naxes[0]*naxes[1],FFTWOPTMODE);
-
-                copy_image_ID(ffttmpcpyname, in_name, 0);
-                delete_image_ID(ffttmpcpyname);
-                export_wisdom();
-                fprintf(stdout,"\n");
+                fft_gpu_sync(in_name);
+                OK = (fft_plancache_execute(FFT_PLAN_R2C, 0, 2, n, (int) nz, FFTW_FORWARD, data.image[IDin].array.F, data.image[IDtmp].array.CF) == 0);
             }
 
-            fftwf_execute(plan);
-            fftwf_destroy_plan(plan);
+            if(OK==1)
+                for(kk=0; kk<nz; kk++)
+                {
+                    complex_float *tmp = data.image[IDtmp].array.CF + kk*nxt*ny;
+                    complex_float *out = data.image[IDout].array.CF + kk*nx*ny;
+                    float sgn = (dir == 1) ? -1.0 : 1.0;
 
-            if(dir==-1)
-            {
-                // unswapping first 2 axis
-                tmp1 = naxes[0];
-                naxes[0] = naxes[1];
-                naxes[1] = tmp1;
-
-                for(ii=0; ii<naxes[0]/2+1; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                        for(kk=0; kk<naxes[2]; kk++)
+                    for(jj=0; jj<ny; jj++)
+                        for(ii=0; ii<nxt; ii++)
                         {
-                            data.image[IDout].array.CF[naxes[0]*naxes[1]*kk+jj*naxes[0]+ii] = data.image[IDtmp].array.CF[naxestmp[0]*naxestmp[1]*kk+jj*naxestmp[0]+ii];
-                            if(ii!=0)
-                                data.image[IDout].array.CF[naxes[0]*naxes[1]*kk+jj*naxes[0]+(naxes[0]-ii)] = data.image[IDtmp].array.CF[naxestmp[0]*naxestmp[1]*kk+jj*naxestmp[0]+ii];
+                            out[jj*nx+ii].re = tmp[jj*nxt+ii].re;
+                            out[jj*nx+ii].im = sgn*tmp[jj*nxt+ii].im;
                         }
-            }
+
+                    for(ii=1; ii<nx/2+1; ii++)
+                        for(jj=0; jj<ny; jj++)
+                        {
+                            long jj1 = (jj==0) ? 0 : ny-jj;
+
+                            out[jj*nx+(nx-ii)].re = tmp[jj1*nxt+ii].re;
+                            out[jj*nx+(nx-ii)].im = -sgn*tmp[jj1*nxt+ii].im;
+                        }
+                }
         }
         else
         {
-            plan_double = fftw_plan_many_dft_r2c(2, naxes, naxes[2], data.image[IDin].array.D, NULL, 1, naxes[0]*naxes[1], (fftw_complex*) data.image[IDout].array.CD, NULL, 1, naxes[0]*naxes[1], FFTWOPTMODE);
-            if(plan==NULL)
+            if(fft_cufft_execute(FFT_PLAN_R2C, 1, 2, n, (int) nz, FFTW_FORWARD, IDin, IDtmp) == 0)
+                OK = (fft_gpu_sync(ffttmpname) == 0);
+            else
             {
-                //	  if ( Debug > 2) fprintf(stdout,"New FFT size [do2drfft %d x %d x %d]: optimizing ...",naxes[1],naxes[0],naxes[2]);
-                //				fflush(stdout);
-
-                n = snprintf(ffttmpcpyname,SBUFFERSIZE,"_ffttmpcpy_%d",(int) getpid());
-                if(n >= SBUFFERSIZE)
-                    printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-                copy_image_ID(in_name, ffttmpcpyname, 0);
-
-                plan_double = fftw_plan_many_dft_r2c(2, naxes, naxes[2], data.image[IDin].array.D, NULL, 1, naxes[0]*naxes[1], (fftw_complex*) data.image[IDout].array.CD, NULL, 1, naxes[0]*naxes[1], FFTWOPTMODE);
-
-                copy_image_ID(ffttmpcpyname, in_name, 0);
-                delete_image_ID(ffttmpcpyname);
-                export_wisdom();
-                fprintf(stdout,"\n");
+                fft_gpu_sync(in_name);
+                OK = (fft_plancache_execute(FFT_PLAN_R2C, 1, 2, n, (int) nz, FFTW_FORWARD, data.image[IDin].array.D, data.image[IDtmp].array.CD) == 0);
             }
 
-            fftw_execute(plan_double);
-            fftw_destroy_plan(plan_double);
+            if(OK==1)
+                for(kk=0; kk<nz; kk++)
+                {
+                    complex_double *tmp = data.image[IDtmp].array.CD + kk*nxt*ny;
+                    complex_double *out = data.image[IDout].array.CD + kk*nx*ny;
+                    double sgn = (dir == 1) ? -1.0 : 1.0;
 
-            if(dir==-1)
-            {
-                // unswapping first 2 axis
-                tmp1 = naxes[0];
-                naxes[0] = naxes[1];
-                naxes[1] = tmp1;
-
-                for(ii=0; ii<naxes[0]/2+1; ii++)
-                    for(jj=0; jj<naxes[1]; jj++)
-                        for(kk=0; kk<naxes[2]; kk++)
+                    for(jj=0; jj<ny; jj++)
+                        for(ii=0; ii<nxt; ii++)
                         {
-                            data.image[IDout].array.CD[naxes[0]*naxes[1]*kk+jj*naxes[0]+ii] = data.image[IDtmp].array.CD[naxestmp[0]*naxestmp[1]*kk+jj*naxestmp[0]+ii];
-                            if(ii!=0)
-                                data.image[IDout].array.CD[naxes[0]*naxes[1]*kk+jj*naxes[0]+(naxes[0]-ii)] = data.image[IDtmp].array.CD[naxestmp[0]*naxestmp[1]*kk+jj*naxestmp[0]+ii];
+                            out[jj*nx+ii].re = tmp[jj*nxt+ii].re;
+                            out[jj*nx+ii].im = sgn*tmp[jj*nxt+ii].im;
                         }
-            }
+
+                    for(ii=1; ii<nx/2+1; ii++)
+                        for(jj=0; jj<ny; jj++)
+                        {
+                            long jj1 = (jj==0) ? 0 : ny-jj;
+
+                            out[jj*nx+(nx-ii)].re = tmp[jj1*nxt+ii].re;
+                            out[jj*nx+(nx-ii)].im = -sgn*tmp[jj1*nxt+ii].im;
+                        }
+                }
         }
     }
 
     if(OK==0)
         printf("Error : image dimension not appropriate for FFT\n");
 
+    fft_gpu_hostwrite(IDtmp);
     delete_image_ID(ffttmpname);
 
     free(naxestmp);
     free(naxesl);
-    free(naxes);
 
     return(IDout);
 }
@@ -1817,6 +2346,7 @@ long fft_correlation(const char *ID_name1, const char *ID_name2, const char *ID_
         printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
 
     do2dfft(fftname, fft1name);
+    fft_gpu_sync(fft1name);
     delete_image_ID(fftname);
 
     n = snprintf(fft1pname,SBUFFERSIZE,"_fft1p_%d",(int) getpid());
@@ -2147,409 +2677,367 @@ int test_fftspeed(int nmax)
 // dir = -1 for FT, 1 for inverse FT
 // kin in selects slice in IDin_name if this is a cube
 //
-long fft_DFT( const char *IDin_name, const char *IDinmask_name, const char *IDout_name, const char *IDoutmask_name, double Zfactor, int dir, long kin)
-{
-    long IDin;
-    long IDout;
-    long IDinmask;
-    long IDoutmask;
-
-    long NBptsin;
-    long NBptsout;
-
-    uint_fast16_t xsize, ysize;
-    uint_fast16_t ii, jj, k, kout;
-    double val;
-    double re, im;
-    float pha;
-
-    uint_fast16_t *iiinarray;
-    uint_fast16_t *jjinarray;
-    double *xinarray;
-    double *yinarray;
-    double *valinamp;
-    double *valinpha;
-    float *cosvalinpha;
-    float *sinvalinpha;
-
-    uint_fast16_t *iioutarray;
-    uint_fast16_t *jjoutarray;
-    double *xoutarray;
-    double *youtarray;
-
-	float cospha, sinpha;
-
-	long IDcosXX, IDcosYY, IDsinXX, IDsinYY;
-
-	// list of active coordinates
-	uint_fast16_t *iiinarrayActive;
-	uint_fast16_t *jjinarrayActive;
-	uint_fast16_t *iioutarrayActive;
-	uint_fast16_t *jjoutarrayActive;	
-	uint_fast16_t pixiiin, pixiiout, pixjjin, pixjjout;
-	
-	uint_fast8_t pixact;
-	uint_fast16_t NBpixact_iiin, NBpixact_jjin;
-	uint_fast16_t NBpixact_iiout, NBpixact_jjout;
-
-	float *XinarrayActive;
-	float *YinarrayActive;
-	float *XoutarrayActive;
-	float *YoutarrayActive;
-	uint_fast16_t iiin, jjin, iiout, jjout;
-
-	float cosXX, sinXX, cosYY, sinYY, cosXY, sinXY;
+/* =============================================================================================== */
+/*                           MATRIX FOURIER TRANSFORM (MFT) PLANS                                  */
+/* =============================================================================================== */
 
+/*
+ * Masked DFT between input and output pixel grids:
+ *   out(iiout,jjout) = 1/Zfactor * SUM_{in mask} in(iiin,jjin) exp(i 2 PI dir (Xin Xout + Yin Yout))
+ * with Xin = iiin/xsize-0.5, Xout = (iiout/xsize-0.5)*xsize/Zfactor (same along y)
+ *
+ * The transform is separable: restricted to active input/output rows and columns,
+ *   OUT = KY . IN . KX^T
+ * Kernel matrices KX and KY are computed once at plan creation, execution is two complex GEMMs.
+ * Slices of a cube are batched in the first GEMM.
+ */
 
 
+#define FFT_MFTPLANCACHE_NBENTRY 8
 
+static FFT_MFTPLAN *fft_MFTplancache[FFT_MFTPLANCACHE_NBENTRY];
+static uint64_t fft_MFTplancache_lastuse[FFT_MFTPLANCACHE_NBENTRY];
+static uint64_t fft_MFTplancache_clock = 0;
 
-    IDin = image_ID(IDin_name);
 
-    IDinmask = image_ID(IDinmask_name);
-    xsize = data.image[IDinmask].md[0].size[0];
-    ysize = data.image[IDinmask].md[0].size[1];
-   	iiinarrayActive = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*xsize);
-	jjinarrayActive = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*ysize);
-	iioutarrayActive = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*xsize);
-	jjoutarrayActive = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*ysize);
 
+// list active columns (isrow=0) or rows (isrow=1) of mask, returns number of active pixels in mask
+static long fft_MFT_activelist(const uint8_t *mask, uint32_t xsize, uint32_t ysize, int isrow, uint32_t *list, long *NBlist)
+{
+    long ii, jj;
+    long NBpts = 0;
+    long n1 = (isrow == 0) ? xsize : ysize;
+    long n2 = (isrow == 0) ? ysize : xsize;
 
-    
-    
-    
-    NBptsin = 0;
-    NBpixact_iiin = 0;
-    for(ii=0; ii<xsize; ii++)
+    *NBlist = 0;
+    for(ii=0; ii<n1; ii++)
     {
-		pixact = 0;
-        for(jj=0; jj<ysize; jj++)
+        int pixact = 0;
+        for(jj=0; jj<n2; jj++)
         {
-            val = data.image[IDinmask].array.F[jj*xsize+ii];
-            if(val>0.5)
+            long pix = (isrow == 0) ? (jj*xsize+ii) : (ii*xsize+jj);
+            if(mask[pix] == 1)
             {
-				pixact = 1;
-                NBptsin ++;
-			}
-        }
-        if(pixact==1)
-			{
-				iiinarrayActive[NBpixact_iiin] = ii;
-				NBpixact_iiin++;
-			}
-	}
-
-	NBpixact_jjin = 0;
-    for(jj=0; jj<ysize; jj++)
-    {
-		pixact = 0;
-        for(ii=0; ii<xsize; ii++)
-        {
-            val = data.image[IDinmask].array.F[jj*xsize+ii];
-            if(val>0.5)
-				pixact = 1;
+                pixact = 1;
+                NBpts++;
+            }
         }
-        if(pixact==1)
-			{
-				jjinarrayActive[NBpixact_jjin] = jj;
-				NBpixact_jjin++;
-			}
-	}
-	
-    XinarrayActive = (float *) malloc(sizeof(float)*NBpixact_iiin);
-    YinarrayActive = (float *) malloc(sizeof(float)*NBpixact_jjin);
-
-	for(pixiiin=0; pixiiin<NBpixact_iiin; pixiiin++)
-	{
-		iiin = iiinarrayActive[pixiiin];
-		XinarrayActive[pixiiin] = (1.0*iiin/xsize-0.5);
-	}
-	for(pixjjin=0; pixjjin<NBpixact_jjin; pixjjin++)
-	{
-		jjin = jjinarrayActive[pixjjin];
-		YinarrayActive[pixjjin] = (1.0*jjin/ysize-0.5);
-	}
-
-    printf("DFT (factor %f, slice %ld):  %ld input points (%ld %ld)-> ", Zfactor, kin, NBptsin, NBpixact_iiin, NBpixact_jjin);
-
-    iiinarray = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*NBptsin);
-    jjinarray = (uint_fast16_t *) malloc(sizeof(uint_fast16_t)*NBptsin);
-    xinarray = (double *) malloc(sizeof(double)*NBptsin);
-    yinarray = (double *) malloc(sizeof(double)*NBptsin);
-    valinamp = (double *) malloc(sizeof(double)*NBptsin);
-    valinpha = (double *) malloc(sizeof(double)*NBptsin);
-    cosvalinpha = (float *) malloc(sizeof(float)*NBptsin);
-    sinvalinpha = (float *) malloc(sizeof(float)*NBptsin);
-    k = 0;
-
-
-
-    for(ii=0; ii<xsize; ii++)
-        for(jj=0; jj<ysize; jj++)
+        if(pixact == 1)
         {
-            val = data.image[IDinmask].array.F[jj*xsize+ii];
-            if(val>0.5)
-            {
-                iiinarray[k] = ii;
-                jjinarray[k] = jj;
-                xinarray[k] = 1.0*ii/xsize-0.5;
-                yinarray[k] = 1.0*jj/xsize-0.5;
-                re = data.image[IDin].array.CF[kin*xsize*ysize+jj*xsize+ii].re;
-                im = data.image[IDin].array.CF[kin*xsize*ysize+jj*xsize+ii].im;
-                valinamp[k] = sqrt(re*re+im*im);
-                valinpha[k] = atan2(im,re);
-                cosvalinpha[k] = cosf(valinpha[k]);
-                sinvalinpha[k] = sinf(valinpha[k]);
-                k++;
-            }
+            list[*NBlist] = ii;
+            (*NBlist)++;
         }
+    }
 
+    return(NBpts);
+}
 
 
 
-    IDoutmask = image_ID(IDoutmask_name);
+// kernel K[iout*NBin+iin] = exp(i 2 PI dir Xin Xout)
+static void fft_MFT_kernel(complex_float *K, const uint32_t *listin, long NBin, const uint32_t *listout, long NBout, uint32_t size, double Zfactor, int dir)
+{
+    long iout;
 
-    NBptsout = 0;
-    NBpixact_iiout = 0;
-    for(ii=0; ii<xsize; ii++)
-    {
-		pixact = 0;
-	    for(jj=0; jj<ysize; jj++)
-        {
-            val = data.image[IDoutmask].array.F[jj*xsize+ii];
-            if(val>0.5)
-            {
-				pixact = 1;
-                NBptsout ++;
-			}
-        }
-        if(pixact==1)
-			{
-				iioutarrayActive[NBpixact_iiout] = ii;
-				NBpixact_iiout++;
-			}
-	}
-	
-	NBpixact_jjout = 0;
-    for(jj=0; jj<ysize; jj++)
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for
+# endif
+    for(iout=0; iout<NBout; iout++)
     {
-		pixact = 0;
-        for(ii=0; ii<xsize; ii++)
-        {
-            val = data.image[IDoutmask].array.F[jj*xsize+ii];
-            if(val>0.5)
-				pixact = 1;
-        }
-        if(pixact==1)
-			{
-				jjoutarrayActive[NBpixact_jjout] = jj;
-				NBpixact_jjout++;
-			}
-	}
-	XoutarrayActive = (float *) malloc(sizeof(float)*NBpixact_iiout);
-    YoutarrayActive = (float *) malloc(sizeof(float)*NBpixact_jjout);
-	
-	for(pixiiout=0; pixiiout<NBpixact_iiout; pixiiout++)
-	{
-		iiout = iioutarrayActive[pixiiout];
-		XoutarrayActive[pixiiout] = (1.0/Zfactor) * (1.0*iiout/xsize-0.5) * xsize;
-	}
-	
-	for(pixjjout=0; pixjjout<NBpixact_jjout; pixjjout++)
-	{
-		jjout = jjoutarrayActive[pixjjout];
-		YoutarrayActive[pixjjout] = (1.0/Zfactor) * (1.0*jjout/ysize-0.5) * ysize;
-	}	
-	
-    printf("%ld output points (%ld %ld) \n", NBptsout, NBpixact_iiout, NBpixact_jjout);
-
-
+        long iin;
+        double xout = (1.0/Zfactor) * (1.0*listout[iout]/size-0.5) * size;
 
-    iioutarray = (uint_fast32_t *) malloc(sizeof(uint_fast32_t)*NBptsout);
-    jjoutarray = (uint_fast32_t *) malloc(sizeof(uint_fast32_t)*NBptsout);
-    xoutarray = (double *) malloc(sizeof(double)*NBptsout);
-    youtarray = (double *) malloc(sizeof(double)*NBptsout);
-    kout = 0;
-    for(ii=0; ii<xsize; ii++)
-        for(jj=0; jj<ysize; jj++)
+        for(iin=0; iin<NBin; iin++)
         {
-            val = data.image[IDoutmask].array.F[jj*xsize+ii];
-            if(val>0.5)
-            {
-                iioutarray[kout] = ii;
-                jjoutarray[kout] = jj;
-                xoutarray[kout] = (1.0/Zfactor) * (1.0*ii/xsize-0.5) * xsize;
-                youtarray[kout] = (1.0/Zfactor) * (1.0*jj/ysize-0.5) * ysize;
-                kout++;
-            }
-        }
+            double xin = 1.0*listin[iin]/size-0.5;
+            double pha = 2.0*dir*M_PI*xin*xout;
 
-    IDout = create_2DCimage_ID(IDout_name, xsize, ysize);
+            K[iout*NBin+iin].re = (float) cos(pha);
+            K[iout*NBin+iin].im = (float) sin(pha);
+        }
+    }
+}
 
 
 
+/*
+ * Create MFT plan from input and output masks (pixels > 0.5 are active, masks must have same size)
+ */
+FFT_MFTPLAN *fft_MFTplan_create(const char *IDinmask_name, const char *IDoutmask_name, double Zfactor, int dir)
+{
+    FFT_MFTPLAN *plan;
+    long IDinmask, IDoutmask;
+    uint32_t xsize, ysize;
+    long ii;
 
-	IDcosXX = create_2Dimage_ID("_cosXX", xsize, xsize);
-	IDsinXX = create_2Dimage_ID("_sinXX", xsize, xsize);
-	IDcosYY = create_2Dimage_ID("_cosYY", ysize, ysize);
-	IDsinYY = create_2Dimage_ID("_sinYY", ysize, ysize);
 
+    IDinmask = image_ID(IDinmask_name);
+    IDoutmask = image_ID(IDoutmask_name);
+    if((IDinmask == -1)||(IDoutmask == -1))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"mask image not found");
+        return(NULL);
+    }
+    xsize = data.image[IDinmask].md[0].size[0];
+    ysize = data.image[IDinmask].md[0].size[1];
+    if((data.image[IDoutmask].md[0].size[0] != xsize)||(data.image[IDoutmask].md[0].size[1] != ysize))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"input and output masks have different sizes");
+        return(NULL);
+    }
 
-printf(" <");
-fflush(stdout);
+    plan = (FFT_MFTPLAN *) malloc(sizeof(FFT_MFTPLAN));
+    plan->xsize = xsize;
+    plan->ysize = ysize;
+    plan->Zfactor = Zfactor;
+    plan->dir = dir;
 
-    //# ifdef _OPENMP
-# ifdef HAVE_LIBGOMP
-    #pragma omp parallel default(shared) private(pixiiout, pixiiin, iiout, iiin, pha, cospha, sinpha)
+    plan->inmask = (uint8_t *) malloc(sizeof(uint8_t)*xsize*ysize);
+    plan->outmask = (uint8_t *) malloc(sizeof(uint8_t)*xsize*ysize);
+    for(ii=0; ii<xsize*ysize; ii++)
     {
-        #pragma omp for
-# endif
-        for(pixiiout=0; pixiiout<NBpixact_iiout; pixiiout++)
-        {
-			iiout = iioutarrayActive[pixiiout];
-            for(pixiiin=0; pixiiin<NBpixact_iiin; pixiiin++)
-            {
-				iiin = iiinarrayActive[pixiiin];
-                pha = 2.0*dir*M_PI*(XinarrayActive[pixiiin]*XoutarrayActive[pixiiout]);
-				cospha = cosf(pha);
-				sinpha = sinf(pha);
-                
-                data.image[IDcosXX].array.F[iiout*xsize+iiin] = cospha;
-                data.image[IDsinXX].array.F[iiout*xsize+iiin] = sinpha;
-               
-            }
-        }
-# ifdef HAVE_LIBGOMP
-        // # ifdef _OPENMP
+        plan->inmask[ii] = (data.image[IDinmask].array.F[ii] > 0.5) ? 1 : 0;
+        plan->outmask[ii] = (data.image[IDoutmask].array.F[ii] > 0.5) ? 1 : 0;
     }
-# endif
 
-printf("> ");
-fflush(stdout);
+    plan->iiin = (uint32_t *) malloc(sizeof(uint32_t)*xsize);
+    plan->jjin = (uint32_t *) malloc(sizeof(uint32_t)*ysize);
+    plan->iiout = (uint32_t *) malloc(sizeof(uint32_t)*xsize);
+    plan->jjout = (uint32_t *) malloc(sizeof(uint32_t)*ysize);
 
+    plan->NBptsin = fft_MFT_activelist(plan->inmask, xsize, ysize, 0, plan->iiin, &plan->NBiiin);
+    fft_MFT_activelist(plan->inmask, xsize, ysize, 1, plan->jjin, &plan->NBjjin);
+    plan->NBptsout = fft_MFT_activelist(plan->outmask, xsize, ysize, 0, plan->iiout, &plan->NBiiout);
+    fft_MFT_activelist(plan->outmask, xsize, ysize, 1, plan->jjout, &plan->NBjjout);
 
+    plan->KX = (complex_float *) malloc(sizeof(complex_float)*(plan->NBiiout*plan->NBiiin+1));
+    plan->KY = (complex_float *) malloc(sizeof(complex_float)*(plan->NBjjout*plan->NBjjin+1));
+    fft_MFT_kernel(plan->KX, plan->iiin, plan->NBiiin, plan->iiout, plan->NBiiout, xsize, Zfactor, dir);
+    fft_MFT_kernel(plan->KY, plan->jjin, plan->NBjjin, plan->jjout, plan->NBjjout, ysize, Zfactor, dir);
 
+    plan->NBslicealloc = 0;
+    plan->bufin = NULL;
+    plan->buftmp = NULL;
+    plan->bufout = NULL;
 
-printf(" <");
-fflush(stdout);
+    return(plan);
+}
 
-    //# ifdef _OPENMP
-# ifdef HAVE_LIBGOMP
-    #pragma omp parallel default(shared) private(pixjjout, pixjjin, jjout, jjin, pha, cospha, sinpha)
-    {
-        #pragma omp for
-# endif
-        for(pixjjout=0; pixjjout<NBpixact_jjout; pixjjout++)
-        {
-			jjout = jjoutarrayActive[pixjjout];
-            for(pixjjin=0; pixjjin<NBpixact_jjin; pixjjin++)
-            {
-				jjin = jjinarrayActive[pixjjin];
-                pha = 2.0*dir*M_PI*(YinarrayActive[pixjjin]*YoutarrayActive[pixjjout]);
-				cospha = cosf(pha);
-				sinpha = sinf(pha);
-                
-                data.image[IDcosYY].array.F[jjout*ysize+jjin] = cospha;
-                data.image[IDsinYY].array.F[jjout*ysize+jjin] = sinpha;
-               
-            }
-        }
-# ifdef HAVE_LIBGOMP
-        // # ifdef _OPENMP
-    }
-# endif
 
-printf("> ");
-fflush(stdout);
 
+void fft_MFTplan_free(FFT_MFTPLAN *plan)
+{
+    if(plan == NULL)
+        return;
+
+    free(plan->inmask);
+    free(plan->outmask);
+    free(plan->iiin);
+    free(plan->jjin);
+    free(plan->iiout);
+    free(plan->jjout);
+    free(plan->KX);
+    free(plan->KY);
+    free(plan->bufin);
+    free(plan->buftmp);
+    free(plan->bufout);
+    free(plan);
+}
 
 
 
-	
+/*
+ * Execute MFT plan on NBslice slices of complex float image IDin (starting at kin)
+ * result written to slices kout... of complex float image IDout, pixels outside output mask set to zero
+ */
+int fft_MFTplan_execute(FFT_MFTPLAN *plan, long IDin, long kin, long IDout, long kout, long NBslice)
+{
+    long xysize = plan->xsize*plan->ysize;
+    long nin = plan->NBiiin*plan->NBjjin;
+    long ntmp = plan->NBjjin*plan->NBiiout;
+    long nout = plan->NBjjout*plan->NBiiout;
+    complex_float alpha, beta;
+    long k;
 
 
-printf("<<");
-fflush(stdout);
+    if((data.image[IDin].md[0].atype != _DATATYPE_COMPLEX_FLOAT)||(data.image[IDout].md[0].atype != _DATATYPE_COMPLEX_FLOAT))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"MFT requires complex float images");
+        return(-1);
+    }
 
+    if(NBslice > plan->NBslicealloc)
+    {
+        free(plan->bufin);
+        free(plan->buftmp);
+        free(plan->bufout);
+        plan->bufin = (complex_float *) malloc(sizeof(complex_float)*(nin*NBslice+1));
+        plan->buftmp = (complex_float *) malloc(sizeof(complex_float)*(ntmp*NBslice+1));
+        plan->bufout = (complex_float *) malloc(sizeof(complex_float)*(nout+1));
+        plan->NBslicealloc = NBslice;
+    }
 
-# ifdef HAVE_LIBGOMP
-    #pragma omp parallel default(shared) private(kout, k, pha, re, im, cospha, sinpha, iiin, jjin, iiout, jjout, cosXX, cosYY, sinXX, sinYY, cosXY, sinXY)
+    // gather masked input over active rows/columns
+    for(k=0; k<NBslice; k++)
     {
-        #pragma omp for
-# endif
-        for(kout=0; kout<NBptsout; kout++)
-        {
-			iiout = iioutarray[kout];
-			jjout = jjoutarray[kout];
-			
-            re = 0.0;
-            im = 0.0;
-            for(k=0; k<NBptsin; k++)
+        complex_float *in = data.image[IDin].array.CF + (kin+k)*xysize;
+        complex_float *buf = plan->bufin + k*nin;
+        long pj, pi;
+
+        for(pj=0; pj<plan->NBjjin; pj++)
+            for(pi=0; pi<plan->NBiiin; pi++)
             {
-				iiin = iiinarray[k];
-				jjin = jjinarray[k];
-				
-				cosXX = data.image[IDcosXX].array.F[iiout*xsize + iiin];
-				cosYY = data.image[IDcosYY].array.F[jjout*ysize + jjin];
-				
-				sinXX = data.image[IDsinXX].array.F[iiout*xsize + iiin];
-				sinYY = data.image[IDsinYY].array.F[jjout*ysize + jjin];
-				
-				cosXY = cosXX*cosYY - sinXX*sinYY;
-				sinXY = sinXX*cosYY + cosXX*sinYY;
-				
-				cospha = cosvalinpha[k]*cosXY - sinvalinpha[k]*sinXY;
-				sinpha = sinvalinpha[k]*cosXY + cosvalinpha[k]*sinXY;
-				
-				
-                re += valinamp[k]*cospha;
-                im += valinamp[k]*sinpha;
+                long pix = plan->jjin[pj]*plan->xsize + plan->iiin[pi];
+                if(plan->inmask[pix] == 1)
+                    buf[pj*plan->NBiiin+pi] = in[pix];
+                else
+                {
+                    buf[pj*plan->NBiiin+pi].re = 0.0;
+                    buf[pj*plan->NBiiin+pi].im = 0.0;
+                }
             }
-            data.image[IDout].array.CF[jjoutarray[kout]*xsize+iioutarray[kout]].re = re/Zfactor;
-            data.image[IDout].array.CF[jjoutarray[kout]*xsize+iioutarray[kout]].im = im/Zfactor;
-        }
-# ifdef HAVE_LIBGOMP
     }
-# endif
 
+    // TMP = IN . KX^T, all slices stacked along rows
+    alpha.re = 1.0;
+    alpha.im = 0.0;
+    beta.re = 0.0;
+    beta.im = 0.0;
+    if((nin > 0)&&(nout > 0))
+        cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasTrans, NBslice*plan->NBjjin, plan->NBiiout, plan->NBiiin, &alpha, plan->bufin, plan->NBiiin, plan->KX, plan->NBiiin, &beta, plan->buftmp, plan->NBiiout);
+
+    // OUT = KY . TMP / Zfactor
+    alpha.re = 1.0/plan->Zfactor;
+    for(k=0; k<NBslice; k++)
+    {
+        complex_float *out = data.image[IDout].array.CF + (kout+k)*xysize;
+        long pj, pi;
 
-printf(">>");
-fflush(stdout);
+        memset(out, 0, sizeof(complex_float)*xysize);
+        if((nin == 0)||(nout == 0))
+            continue;
 
-	free(cosvalinpha);
-	free(sinvalinpha);
-	
-	delete_image_ID("_cosXX");
-	delete_image_ID("_sinXX");
-	delete_image_ID("_cosYY");
-	delete_image_ID("_sinYY");
-
-	free(XinarrayActive);
-	free(YinarrayActive);
-	free(XoutarrayActive);
-	free(YoutarrayActive);
-
-	free(iiinarrayActive);
-	free(jjinarrayActive);
-	free(iioutarrayActive);
-	free(jjoutarrayActive);
-
-    free(iiinarray);
-    free(jjinarray);
-    free(xinarray);
-    free(yinarray);
-    free(valinamp);
-    free(valinpha);
-
-
-    free(iioutarray);
-    free(jjoutarray);
-    free(xoutarray);
-    free(youtarray);
+        cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, plan->NBjjout, plan->NBiiout, plan->NBjjin, &alpha, plan->KY, plan->NBjjin, plan->buftmp + k*ntmp, plan->NBiiout, &beta, plan->bufout, plan->NBiiout);
 
-    return(IDout);
-}
+        for(pj=0; pj<plan->NBjjout; pj++)
+            for(pi=0; pi<plan->NBiiout; pi++)
+            {
+                long pix = plan->jjout[pj]*plan->xsize + plan->iiout[pi];
+                if(plan->outmask[pix] == 1)
+                    out[pix] = plan->bufout[pj*plan->NBiiout+pi];
+            }
+    }
 
+    return(0);
+}
+
+
+
+/*
+ * Returns cached MFT plan matching masks, zoom factor and direction, creating it if needed.
+ * Plans are owned by the cache, least recently used plan is replaced when cache is full.
+ */
+FFT_MFTPLAN *fft_MFTplan_get(const char *IDinmask_name, const char *IDoutmask_name, double Zfactor, int dir)
+{
+    long IDinmask, IDoutmask;
+    long k, ii;
+    long kfree = -1;
+    uint64_t tmin = UINT64_MAX;
+
+
+    IDinmask = image_ID(IDinmask_name);
+    IDoutmask = image_ID(IDoutmask_name);
+    if((IDinmask == -1)||(IDoutmask == -1))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"mask image not found");
+        return(NULL);
+    }
+
+    fft_MFTplancache_clock++;
+
+    for(k=0; k<FFT_MFTPLANCACHE_NBENTRY; k++)
+    {
+        FFT_MFTPLAN *plan = fft_MFTplancache[k];
+        int match;
+
+        if(plan == NULL)
+        {
+            if(tmin > 0)
+                kfree = k;
+            tmin = 0;
+            continue;
+        }
+        if(fft_MFTplancache_lastuse[k] < tmin)
+        {
+            tmin = fft_MFTplancache_lastuse[k];
+            kfree = k;
+        }
+
+        if((plan->Zfactor != Zfactor)||(plan->dir != dir)
+                ||(plan->xsize != data.image[IDinmask].md[0].size[0])||(plan->ysize != data.image[IDinmask].md[0].size[1])
+                ||(plan->xsize != data.image[IDoutmask].md[0].size[0])||(plan->ysize != data.image[IDoutmask].md[0].size[1]))
+            continue;
+
+        match = 1;
+        for(ii=0; ii<plan->xsize*plan->ysize; ii++)
+            if((plan->inmask[ii] != ((data.image[IDinmask].array.F[ii] > 0.5) ? 1 : 0))
+                    ||(plan->outmask[ii] != ((data.image[IDoutmask].array.F[ii] > 0.5) ? 1 : 0)))
+            {
+                match = 0;
+                break;
+            }
+
+        if(match == 1)
+        {
+            fft_MFTplancache_lastuse[k] = fft_MFTplancache_clock;
+            return(plan);
+        }
+    }
+
+    fft_MFTplan_free(fft_MFTplancache[kfree]);
+    fft_MFTplancache[kfree] = fft_MFTplan_create(IDinmask_name, IDoutmask_name, Zfactor, dir);
+    fft_MFTplancache_lastuse[kfree] = fft_MFTplancache_clock;
+
+    return(fft_MFTplancache[kfree]);
+}
+
+
+
+void fft_MFTplan_flushcache()
+{
+    long k;
+
+    for(k=0; k<FFT_MFTPLANCACHE_NBENTRY; k++)
+    {
+        fft_MFTplan_free(fft_MFTplancache[k]);
+        fft_MFTplancache[k] = NULL;
+    }
+}
+
+
+
+
+long fft_DFT( const char *IDin_name, const char *IDinmask_name, const char *IDout_name, const char *IDoutmask_name, double Zfactor, int dir, long kin)
+{
+    long IDin;
+    long IDout;
+    FFT_MFTPLAN *plan;
+
+
+    IDin = image_ID(IDin_name);
+
+    plan = fft_MFTplan_get(IDinmask_name, IDoutmask_name, Zfactor, dir);
+    if(plan == NULL)
+        return(-1);
+
+    printf("DFT (factor %f, slice %ld):  %ld input points (%ld %ld)-> %ld output points (%ld %ld) \n", Zfactor, kin, plan->NBptsin, plan->NBiiin, plan->NBjjin, plan->NBptsout, plan->NBiiout, plan->NBjjout);
+
+    IDout = create_2DCimage_ID(IDout_name, plan->xsize, plan->ysize);
+
+    fft_MFTplan_execute(plan, IDin, kin, IDout, 0, 1);
+
+    return(IDout);
+}
 
 
 
@@ -2912,6 +3400,246 @@ long fft_DFTinsertFPM_re( const char *pupin_name, const char *fpmz_name, double
 | COMMENT:  Inclusion of this routine requires inclusion of modules:
 |           fft, gen_image
 +-----------------------------------------------------------------------------*/
+/* =============================================================================================== */
+/*                         SUB-PIXEL REGISTRATION (UPSAMPLED CROSS-CORRELATION)                    */
+/* =============================================================================================== */
+
+/*
+ * Guizar-Sicairos, Thurman & Fienup, Opt. Lett. 33, 156 (2008)
+ * 1. cross-power spectrum CC = FFT(im) . conj(FFT(ref)), inverse FFT -> integer peak
+ * 2. cross-correlation upsampled by factor upsample in a 1.5 x 1.5 pixel region around the peak,
+ *    computed as a matrix DFT of CC (two GEMMs)
+ * Shift (dx,dy) is such that im(x) ~ ref(x-dx, y-dy).
+ * FFTs go through the plan cache, measurement functions can be called concurrently on one plan.
+ */
+
+
+FFT_REGPLAN *fft_regplan_create(const float *ref, long nx, long ny, long upsample)
+{
+    FFT_REGPLAN *plan;
+    long ii;
+    int n[2];
+
+
+    plan = (FFT_REGPLAN *) malloc(sizeof(FFT_REGPLAN));
+    plan->nx = nx;
+    plan->ny = ny;
+    plan->upsample = (upsample < 1) ? 1 : upsample;
+    plan->Fref = (complex_float *) fftwf_malloc(sizeof(complex_float)*nx*ny);
+
+    for(ii=0; ii<nx*ny; ii++)
+    {
+        plan->Fref[ii].re = ref[ii];
+        plan->Fref[ii].im = 0.0;
+    }
+    n[0] = (int) ny;
+    n[1] = (int) nx;
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, plan->Fref, plan->Fref);
+
+    return(plan);
+}
+
+
+
+void fft_regplan_free(FFT_REGPLAN *plan)
+{
+    if(plan == NULL)
+        return;
+    fftwf_free(plan->Fref);
+    free(plan);
+}
+
+
+
+// signed frequency of FFT index
+static inline double fft_reg_freq(long k, long n)
+{
+    return (double) ((k < (n+1)/2) ? k : k-n);
+}
+
+
+
+int fft_regplan_measure(FFT_REGPLAN *plan, const float *im, double *dx, double *dy, double *ccpeak)
+{
+    long nx = plan->nx;
+    long ny = plan->ny;
+    long nxy = nx*ny;
+    complex_float *CC;
+    complex_float *cc;
+    long ii, jj;
+    long iipeak = 0;
+    long jjpeak = 0;
+    float vmax = -1.0;
+    double x0, y0;
+    int n[2];
+
+
+    CC = (complex_float *) fftwf_malloc(sizeof(complex_float)*nxy);
+    cc = (complex_float *) fftwf_malloc(sizeof(complex_float)*nxy);
+
+    for(ii=0; ii<nxy; ii++)
+    {
+        CC[ii].re = im[ii];
+        CC[ii].im = 0.0;
+    }
+    n[0] = (int) ny;
+    n[1] = (int) nx;
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, CC, CC);
+
+    for(ii=0; ii<nxy; ii++)
+    {
+        float re = CC[ii].re*plan->Fref[ii].re + CC[ii].im*plan->Fref[ii].im;
+        float imv = CC[ii].im*plan->Fref[ii].re - CC[ii].re*plan->Fref[ii].im;
+        CC[ii].re = re;
+        CC[ii].im = imv;
+    }
+
+    // integer peak
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_BACKWARD, CC, cc);
+    for(jj=0; jj<ny; jj++)
+        for(ii=0; ii<nx; ii++)
+            if(cc[jj*nx+ii].re > vmax)
+            {
+                vmax = cc[jj*nx+ii].re;
+                iipeak = ii;
+                jjpeak = jj;
+            }
+    x0 = fft_reg_freq(iipeak, nx);
+    y0 = fft_reg_freq(jjpeak, ny);
+    if(ccpeak != NULL)
+        *ccpeak = vmax/nxy;
+
+    // upsampled refinement
+    if(plan->upsample > 1)
+    {
+        long us = plan->upsample;
+        long nout = (long) ceil(1.5*us);
+        long p, q;
+        long qmax = 0;
+        long pmax = 0;
+        complex_float *Kx, *Ky, *T, *out;
+        complex_float alpha, beta;
+
+        if(nout%2 == 0)
+            nout++;
+
+        Kx = (complex_float *) malloc(sizeof(complex_float)*nout*nx);
+        Ky = (complex_float *) malloc(sizeof(complex_float)*nout*ny);
+        T = (complex_float *) malloc(sizeof(complex_float)*ny*nout);
+        out = (complex_float *) malloc(sizeof(complex_float)*nout*nout);
+
+        for(p=0; p<nout; p++)
+        {
+            double x = x0 + 1.0*(p-nout/2)/us;
+            for(ii=0; ii<nx; ii++)
+            {
+                double pha = 2.0*M_PI*fft_reg_freq(ii, nx)*x/nx;
+                Kx[p*nx+ii].re = (float) cos(pha);
+                Kx[p*nx+ii].im = (float) sin(pha);
+            }
+        }
+        for(q=0; q<nout; q++)
+        {
+            double y = y0 + 1.0*(q-nout/2)/us;
+            for(jj=0; jj<ny; jj++)
+            {
+                double pha = 2.0*M_PI*fft_reg_freq(jj, ny)*y/ny;
+                Ky[q*ny+jj].re = (float) cos(pha);
+                Ky[q*ny+jj].im = (float) sin(pha);
+            }
+        }
+
+        alpha.re = 1.0;
+        alpha.im = 0.0;
+        beta.re = 0.0;
+        beta.im = 0.0;
+        // T[jj][p] = SUM_ii CC[jj][ii] Kx[p][ii]
+        cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasTrans, ny, nout, nx, &alpha, CC, nx, Kx, nx, &beta, T, nout);
+        // out[q][p] = SUM_jj Ky[q][jj] T[jj][p]
+        cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, nout, nout, ny, &alpha, Ky, ny, T, nout, &beta, out, nout);
+
+        vmax = out[(nout/2)*nout+nout/2].re;
+        qmax = nout/2;
+        pmax = nout/2;
+        for(q=0; q<nout; q++)
+            for(p=0; p<nout; p++)
+                if(out[q*nout+p].re > vmax)
+                {
+                    vmax = out[q*nout+p].re;
+                    qmax = q;
+                    pmax = p;
+                }
+        x0 += 1.0*(pmax-nout/2)/us;
+        y0 += 1.0*(qmax-nout/2)/us;
+        if(ccpeak != NULL)
+            *ccpeak = vmax/nxy;
+
+        free(Kx);
+        free(Ky);
+        free(T);
+        free(out);
+    }
+
+    *dx = x0;
+    *dy = y0;
+
+    fftwf_free(CC);
+    fftwf_free(cc);
+
+    return(0);
+}
+
+
+
+/*
+ * Registers each slice of float cube against 2D float reference image
+ * output: 3 x NBslice float image (dx, dy, normalized cross-correlation peak), slices processed in parallel
+ */
+long fft_cube_register(const char *IDcube_name, const char *IDref_name, long upsample, const char *IDout_name)
+{
+    long IDcube, IDref, IDout;
+    long nx, ny, nz;
+    long kk;
+    FFT_REGPLAN *plan;
+
+
+    IDcube = image_ID(IDcube_name);
+    IDref = image_ID(IDref_name);
+    nx = data.image[IDcube].md[0].size[0];
+    ny = data.image[IDcube].md[0].size[1];
+    nz = (data.image[IDcube].md[0].naxis == 3) ? data.image[IDcube].md[0].size[2] : 1;
+
+    if((data.image[IDref].md[0].size[0] != nx)||(data.image[IDref].md[0].size[1] != ny))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"reference and cube sizes do not match");
+        return(-1);
+    }
+
+    plan = fft_regplan_create(data.image[IDref].array.F, nx, ny, upsample);
+    IDout = create_2Dimage_ID(IDout_name, 3, nz);
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic, 8)
+# endif
+    for(kk=0; kk<nz; kk++)
+    {
+        double dx, dy, ccpeak;
+
+        fft_regplan_measure(plan, data.image[IDcube].array.F + kk*nx*ny, &dx, &dy, &ccpeak);
+        data.image[IDout].array.F[kk*3] = (float) dx;
+        data.image[IDout].array.F[kk*3+1] = (float) dy;
+        data.image[IDout].array.F[kk*3+2] = (float) ccpeak;
+    }
+
+    fft_regplan_free(plan);
+
+    return(IDout);
+}
+
+
+
+
+
 int fft_image_translate(const char *ID_name, const char *ID_out, double xtransl, double ytransl)
 {
     long ID;
@@ -2956,3 +3684,711 @@ int fft_image_translate(const char *ID_name, const char *ID_out, double xtransl,
 }
 
 
+
+
+
+/**
+ * @brief Continuous Welch PSD of each element of a stream
+ *
+ * A window of NBfft frames is processed every NBstep new frames (NBstep = NBfft/2 : 50% overlap).
+ * Hann-windowed frames of all elements are transformed with a single r2c plan created once (FFTW wisdom applies).
+ * Output PSDs are exponentially averaged (avecoeff = weight of newest window), one-sided, unit = input^2 per (frame rate).
+ *
+ * Output streams :
+ *   IDout_name         : PSD, size (NBfft/2+1) x NBelem
+ *   IDout_name_stats   : per element mean and RMS, size NBelem x 2
+ *
+ * Runs NBiter windows (NBiter < 1 : until USR1 signal).
+ */
+long fft_stream_WelchPSD(const char *IDin_name, long semtrig, long NBfft, long NBstep, float avecoeff, const char *IDout_name, long NBiter)
+{
+    long IDin, IDout, IDstats;
+    char imname[200];
+    long NBelem, NBfreq;
+    float *hbuff;     // history, NBfft frames x NBelem, circular
+    float *win;
+    float *fftin;
+    fftwf_complex *fftout;
+    fftwf_plan plan;
+    int n[1];
+    uint32_t imsize[2];
+    double wnorm;
+    long ii, k, f;
+    long cnt = 0;       // frames received
+    long iter = 0;
+
+
+    IDin = image_ID(IDin_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(IDin_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: stream %s not found\n", IDin_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].atype != _DATATYPE_FLOAT)
+    {
+        printf("ERROR: stream %s is not FLOAT\n", IDin_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].sem <= semtrig)
+    {
+        printf("ERROR: stream %s has %d semaphores, need > %ld\n", IDin_name, (int) data.image[IDin].md[0].sem, semtrig);
+        return(-1);
+    }
+    if(NBfft < 4)
+        NBfft = 4;
+    if((NBstep < 1)||(NBstep > NBfft))
+        NBstep = NBfft/2;
+
+    NBelem = data.image[IDin].md[0].nelement;
+    NBfreq = NBfft/2 + 1;
+
+    hbuff = (float*) calloc(NBfft*NBelem, sizeof(float));
+    win = (float*) malloc(sizeof(float)*NBfft);
+    fftin = (float*) fftwf_malloc(sizeof(float)*NBfft*NBelem);
+    fftout = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*NBfreq*NBelem);
+
+    wnorm = 0.0;
+    for(k=0; k<NBfft; k++)
+    {
+        win[k] = 0.5 - 0.5*cos(2.0*PI*k/NBfft);
+        wnorm += win[k]*win[k];
+    }
+
+    n[0] = (int) NBfft;
+    plan = fftwf_plan_many_dft_r2c(1, n, (int) NBelem, fftin, NULL, 1, (int) NBfft, fftout, NULL, 1, (int) NBfreq, FFTWOPTMODE);
+
+
+    imsize[0] = NBfreq;
+    imsize[1] = NBelem;
+    IDout = create_image_ID(IDout_name, 2, imsize, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_semflush(IDout_name, -1);
+
+    if(sprintf(imname, "%s_stats", IDout_name) < 1)
+        printERROR(__FILE__, __func__, __LINE__, "sprintf wrote <1 char");
+    imsize[0] = NBelem;
+    imsize[1] = 2;
+    IDstats = create_image_ID(imname, 2, imsize, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_semflush(imname, -1);
+
+
+    COREMOD_MEMORY_image_set_semflush(IDin_name, semtrig);
+
+    while(((NBiter < 1)||(iter < NBiter))&&(data.signal_USR1 == 0))
+    {
+        float coeff;
+
+        sem_wait(data.image[IDin].semptr[semtrig]);
+
+        memcpy(hbuff + (cnt % NBfft)*NBelem, data.image[IDin].array.F, sizeof(float)*NBelem);
+        cnt++;
+
+        if((cnt < NBfft)||((cnt - NBfft) % NBstep != 0))
+            continue;
+
+        data.image[IDstats].md[0].write = 1;
+
+        // newest window : frames cnt-NBfft ... cnt-1, mean removed then Hann window
+        # ifdef HAVE_LIBGOMP
+        #pragma omp parallel for private(k)
+        # endif
+        for(ii=0; ii<NBelem; ii++)
+        {
+            double ave = 0.0;
+            double rms = 0.0;
+            float *fin = fftin + ii*NBfft;
+
+            for(k=0; k<NBfft; k++)
+            {
+                float val = hbuff[((cnt - NBfft + k) % NBfft)*NBelem + ii];
+
+                fin[k] = val;
+                ave += val;
+            }
+            ave /= NBfft;
+            for(k=0; k<NBfft; k++)
+            {
+                fin[k] -= ave;
+                rms += fin[k]*fin[k];
+                fin[k] *= win[k];
+            }
+            rms = sqrt(rms/NBfft);
+
+            data.image[IDstats].array.F[ii] = (iter == 0) ? ave : (1.0-avecoeff)*data.image[IDstats].array.F[ii] + avecoeff*ave;
+            data.image[IDstats].array.F[NBelem+ii] = (iter == 0) ? rms : (1.0-avecoeff)*data.image[IDstats].array.F[NBelem+ii] + avecoeff*rms;
+        }
+
+        fftwf_execute(plan);
+
+        coeff = (iter == 0) ? 1.0 : avecoeff;
+        data.image[IDout].md[0].write = 1;
+        for(ii=0; ii<NBelem; ii++)
+            for(f=0; f<NBfreq; f++)
+            {
+                fftwf_complex *c = fftout + ii*NBfreq + f;
+                float psd = ((*c)[0]*(*c)[0] + (*c)[1]*(*c)[1])/wnorm;
+
+                if((f > 0)&&(f < NBfft-f)) // one-sided
+                    psd *= 2.0;
+                data.image[IDout].array.F[ii*NBfreq + f] = (1.0-coeff)*data.image[IDout].array.F[ii*NBfreq + f] + coeff*psd;
+            }
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+        data.image[IDout].md[0].cnt0++;
+        data.image[IDout].md[0].write = 0;
+
+        COREMOD_MEMORY_image_set_sempost_byID(IDstats, -1);
+        data.image[IDstats].md[0].cnt0++;
+        data.image[IDstats].md[0].write = 0;
+
+        iter++;
+    }
+
+    fftwf_destroy_plan(plan);
+    fftwf_free(fftin);
+    fftwf_free(fftout);
+    free(win);
+    free(hbuff);
+
+    return(iter);
+}
+
+
+
+
+/* =============================================================================================== */
+/*                                     CONVOLUTION PLANS                                           */
+/* =============================================================================================== */
+
+//
+// Kernel spectrum is computed once. Images (and all slices of a cube) are convolved tile by tile
+// (overlap-save) with small FFTs, two real tiles packed into one complex transform.
+// FFT_CONV_CIRCULAR : single tile = full image, periodic (same result as fconvolve)
+// FFT_CONV_LINEAR   : zero outside image
+// Kernel images are centered on pixel (kx/2, ky/2).
+//
+
+FFT_CONVPLAN *fft_convplan_create(const float *ke, long kx, long ky, long tilesize, int mode)
+{
+    FFT_CONVPLAN *plan;
+    long ii, jj;
+    long cx = kx/2;
+    long cy = ky/2;
+    long ext;
+    int n[2];
+    complex_float *tmp;
+
+
+    plan = (FFT_CONVPLAN *) malloc(sizeof(FFT_CONVPLAN));
+    plan->mode = mode;
+
+    // kernel support
+    plan->d0x = 0;
+    plan->d1x = 0;
+    plan->d0y = 0;
+    plan->d1y = 0;
+    for(jj=0; jj<ky; jj++)
+        for(ii=0; ii<kx; ii++)
+            if(ke[jj*kx+ii] != 0.0)
+            {
+                if(ii-cx < plan->d0x) plan->d0x = ii-cx;
+                if(ii-cx > plan->d1x) plan->d1x = ii-cx;
+                if(jj-cy < plan->d0y) plan->d0y = jj-cy;
+                if(jj-cy > plan->d1y) plan->d1y = jj-cy;
+            }
+
+    if(mode == FFT_CONV_CIRCULAR)
+    {
+        plan->tx = kx;
+        plan->ty = ky;
+        plan->bx = kx;
+        plan->by = ky;
+    }
+    else
+    {
+        // tile : power of 2, at least twice the kernel extent
+        ext = plan->d1x - plan->d0x + 1;
+        if(plan->d1y - plan->d0y + 1 > ext)
+            ext = plan->d1y - plan->d0y + 1;
+        plan->tx = 64;
+        while(plan->tx < 2*ext)
+            plan->tx *= 2;
+        if(tilesize >= 2*ext)   // requested size, if large enough
+            plan->tx = tilesize;
+        plan->ty = plan->tx;
+        plan->bx = plan->tx - (plan->d1x - plan->d0x);
+        plan->by = plan->ty - (plan->d1y - plan->d0y);
+    }
+
+    plan->Fke = (complex_float *) fftwf_malloc(sizeof(complex_float)*plan->tx*plan->ty);
+    memset(plan->Fke, 0, sizeof(complex_float)*plan->tx*plan->ty);
+    for(jj=cy+plan->d0y; jj<=cy+plan->d1y; jj++)
+        for(ii=cx+plan->d0x; ii<=cx+plan->d1x; ii++)
+        {
+            long u = ((ii-cx) % plan->tx + plan->tx) % plan->tx;
+            long v = ((jj-cy) % plan->ty + plan->ty) % plan->ty;
+
+            plan->Fke[v*plan->tx+u].re += ke[jj*kx+ii]/(plan->tx*plan->ty);
+        }
+
+    n[0] = (int) plan->ty;
+    n[1] = (int) plan->tx;
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, plan->Fke, plan->Fke);
+
+    // create backward plan now, not from worker threads
+    tmp = (complex_float *) fftwf_malloc(sizeof(complex_float)*plan->tx*plan->ty);
+    memset(tmp, 0, sizeof(complex_float)*plan->tx*plan->ty);
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_BACKWARD, tmp, tmp);
+    fftwf_free(tmp);
+
+    return(plan);
+}
+
+
+
+void fft_convplan_free(FFT_CONVPLAN *plan)
+{
+    if(plan == NULL)
+        return;
+    fftwf_free(plan->Fke);
+    free(plan);
+}
+
+
+
+// tile t -> slice, output origin, input origin
+static void fft_convplan_tile(FFT_CONVPLAN *plan, long t, long ntx, long nty, long *slice, long *ox, long *oy, long *sx, long *sy)
+{
+    long r = t % (ntx*nty);
+
+    *slice = t / (ntx*nty);
+    *ox = (r % ntx)*plan->bx;
+    *oy = (r / ntx)*plan->by;
+    if(plan->mode == FFT_CONV_CIRCULAR)
+    {
+        *sx = 0;
+        *sy = 0;
+    }
+    else
+    {
+        *sx = *ox - plan->d1x;
+        *sy = *oy - plan->d1y;
+    }
+}
+
+
+
+//
+// convolves NBslice images of nx x ny pixels (in, out : contiguous slices, may not overlap)
+// CIRCULAR plans require nx, ny = kernel size
+//
+int fft_convplan_execute(FFT_CONVPLAN *plan, const float *in, float *out, long nx, long ny, long NBslice)
+{
+    long tx = plan->tx;
+    long ty = plan->ty;
+    long ntx, nty, NBtile, NBpair;
+    long p;
+    int n[2];
+
+
+    if((plan->mode == FFT_CONV_CIRCULAR)&&((nx != tx)||(ny != ty)))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"image and kernel sizes differ");
+        return(-1);
+    }
+
+    ntx = (nx + plan->bx - 1)/plan->bx;
+    nty = (ny + plan->by - 1)/plan->by;
+    NBtile = ntx*nty*NBslice;
+    NBpair = (NBtile+1)/2;
+    n[0] = (int) ty;
+    n[1] = (int) tx;
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel if (NBpair > 1)
+    {
+# endif
+        complex_float *buf = (complex_float *) fftwf_malloc(sizeof(complex_float)*tx*ty);
+
+# ifdef HAVE_LIBGOMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(p=0; p<NBpair; p++)
+        {
+            long t, k, u, v;
+
+            // tile 2p in real part, tile 2p+1 in imaginary part
+            for(k=0; k<2; k++)
+            {
+                long slice, ox, oy, sx, sy;
+                const float *im;
+
+                t = 2*p+k;
+                if(t >= NBtile)
+                {
+                    for(v=0; v<tx*ty; v++)
+                        buf[v].im = 0.0;
+                    continue;
+                }
+                fft_convplan_tile(plan, t, ntx, nty, &slice, &ox, &oy, &sx, &sy);
+                im = in + slice*nx*ny;
+                for(v=0; v<ty; v++)
+                {
+                    long y = sy + v;
+                    float *b = (float *) (buf + v*tx) + k;
+
+                    if((y < 0)||(y >= ny))
+                    {
+                        for(u=0; u<tx; u++)
+                            b[2*u] = 0.0;
+                        continue;
+                    }
+                    for(u=0; u<tx; u++)
+                    {
+                        long x = sx + u;
+
+                        b[2*u] = ((x >= 0)&&(x < nx)) ? im[y*nx+x] : 0.0;
+                    }
+                }
+            }
+
+            fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, buf, buf);
+            for(v=0; v<tx*ty; v++)
+            {
+                float re = buf[v].re*plan->Fke[v].re - buf[v].im*plan->Fke[v].im;
+                float imv = buf[v].re*plan->Fke[v].im + buf[v].im*plan->Fke[v].re;
+
+                buf[v].re = re;
+                buf[v].im = imv;
+            }
+            fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_BACKWARD, buf, buf);
+
+            for(k=0; k<2; k++)
+            {
+                long slice, ox, oy, sx, sy;
+                long v0, u0;
+                float *im;
+
+                t = 2*p+k;
+                if(t >= NBtile)
+                    continue;
+                fft_convplan_tile(plan, t, ntx, nty, &slice, &ox, &oy, &sx, &sy);
+                im = out + slice*nx*ny;
+                v0 = oy - sy;
+                u0 = ox - sx;
+                for(v=0; (v<plan->by)&&(oy+v<ny); v++)
+                {
+                    const float *b = (const float *) (buf + (v0+v)*tx + u0) + k;
+
+                    for(u=0; (u<plan->bx)&&(ox+u<nx); u++)
+                        im[(oy+v)*nx+ox+u] = b[2*u];
+                }
+            }
+        }
+
+        fftwf_free(buf);
+# ifdef HAVE_LIBGOMP
+    }
+# endif
+
+    return(0);
+}
+
+
+
+//
+// convolves each new frame of input stream (2D or 3D FLOAT) by kernel image, result in shared memory stream
+// runs until NBiter frames processed (NBiter < 1 : until USR1 signal)
+//
+long fft_convolve_stream(const char *IDin_name, const char *IDke_name, long semtrig, const char *IDout_name, long NBiter)
+{
+    long IDin, IDke, IDout;
+    FFT_CONVPLAN *plan;
+    uint32_t *imsize;
+    long nx, ny, NBslice;
+    long naxis, i;
+    long iter = 0;
+
+
+    IDin = image_ID(IDin_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(IDin_name);
+    IDke = image_ID(IDke_name);
+    if((IDin == -1)||(IDke == -1))
+    {
+        printf("ERROR: stream %s or kernel %s not found\n", IDin_name, IDke_name);
+        return(-1);
+    }
+    if((data.image[IDin].md[0].atype != _DATATYPE_FLOAT)||(data.image[IDke].md[0].atype != _DATATYPE_FLOAT))
+    {
+        printf("ERROR: stream %s and kernel %s must be FLOAT\n", IDin_name, IDke_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].sem <= semtrig)
+    {
+        printf("ERROR: stream %s has %d semaphores, need > %ld\n", IDin_name, (int) data.image[IDin].md[0].sem, semtrig);
+        return(-1);
+    }
+
+    naxis = data.image[IDin].md[0].naxis;
+    nx = data.image[IDin].md[0].size[0];
+    ny = data.image[IDin].md[0].size[1];
+    NBslice = (naxis == 3) ? data.image[IDin].md[0].size[2] : 1;
+
+    plan = fft_convplan_create(data.image[IDke].array.F, data.image[IDke].md[0].size[0], data.image[IDke].md[0].size[1], 0, FFT_CONV_LINEAR);
+
+    imsize = (uint32_t*) malloc(sizeof(uint32_t)*naxis);
+    for(i=0; i<naxis; i++)
+        imsize[i] = data.image[IDin].md[0].size[i];
+    IDout = create_image_ID(IDout_name, naxis, imsize, _DATATYPE_FLOAT, 1, 0);
+    free(imsize);
+    COREMOD_MEMORY_image_set_semflush(IDout_name, -1);
+
+    COREMOD_MEMORY_image_set_semflush(IDin_name, semtrig);
+
+    while(((NBiter < 1)||(iter < NBiter))&&(data.signal_USR1 == 0))
+    {
+        sem_wait(data.image[IDin].semptr[semtrig]);
+
+        data.image[IDout].md[0].write = 1;
+        fft_convplan_execute(plan, data.image[IDin].array.F, data.image[IDout].array.F, nx, ny, NBslice);
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+        data.image[IDout].md[0].cnt0++;
+        data.image[IDout].md[0].write = 0;
+
+        iter++;
+    }
+
+    fft_convplan_free(plan);
+
+    return(iter);
+}
+
+
+
+
+
+/* =============================================================================================== */
+/*                                MASKED STRUCTURE FUNCTION                                        */
+/* =============================================================================================== */
+
+/*
+ * D(r) = sum_x w(x)w(x+r) [p(x+r)-p(x)]^2 / sum_x w(x)w(x+r)
+ *
+ * Numerator expands into correlations of w, w.p and w.p^2, computed on FFT grids padded to twice the
+ * image size (no wrap-around). Mask spectrum and overlap counts are computed once per plan.
+ */
+FFT_STRFPLAN *fft_strfplan_create(const float *mask, long nx, long ny)
+{
+    FFT_STRFPLAN *plan;
+    complex_float *buf;
+    long px = 2*nx;
+    long py = 2*ny;
+    long ii, jj;
+    int n[2];
+
+    plan = (FFT_STRFPLAN *) malloc(sizeof(FFT_STRFPLAN));
+    plan->nx = nx;
+    plan->ny = ny;
+    plan->px = px;
+    plan->py = py;
+    plan->w = (float *) malloc(sizeof(float)*nx*ny);
+    plan->Fw = (complex_float *) fftwf_malloc(sizeof(complex_float)*px*py);
+    plan->Nov = (float *) malloc(sizeof(float)*px*py);
+    buf = (complex_float *) fftwf_malloc(sizeof(complex_float)*px*py);
+
+    plan->NBpix = 0;
+    for(ii=0; ii<nx*ny; ii++)
+    {
+        plan->w[ii] = ((mask == NULL)||(mask[ii] > 0.5)) ? 1.0 : 0.0;
+        plan->NBpix += (long) plan->w[ii];
+    }
+
+    for(ii=0; ii<px*py; ii++)
+    {
+        plan->Fw[ii].re = 0.0;
+        plan->Fw[ii].im = 0.0;
+    }
+    for(jj=0; jj<ny; jj++)
+        for(ii=0; ii<nx; ii++)
+            plan->Fw[jj*px+ii].re = plan->w[jj*nx+ii];
+    n[0] = (int) py;
+    n[1] = (int) px;
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, plan->Fw, plan->Fw);
+
+    // overlap count per separation
+    for(ii=0; ii<px*py; ii++)
+    {
+        buf[ii].re = plan->Fw[ii].re*plan->Fw[ii].re + plan->Fw[ii].im*plan->Fw[ii].im;
+        buf[ii].im = 0.0;
+    }
+    fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_BACKWARD, buf, buf);
+    for(ii=0; ii<px*py; ii++)
+        plan->Nov[ii] = buf[ii].re/(px*py);
+
+    fftwf_free(buf);
+
+    return(plan);
+}
+
+
+
+void fft_strfplan_free(FFT_STRFPLAN *plan)
+{
+    if(plan == NULL)
+        return;
+    free(plan->w);
+    fftwf_free(plan->Fw);
+    free(plan->Nov);
+    free(plan);
+}
+
+
+
+/*
+ * Structure function of NBslice images, numerators and overlap counts summed over slices.
+ *  strf : nx x ny, pixel (dx,dy) = D at separation (|dx|,|dy|), 0 where no pixel pair exists (may be NULL)
+ *  prof : azimuthal average, bin k = separations with round(|r|) = k, NBbin values (may be NULL)
+ */
+int fft_strfplan_execute(FFT_STRFPLAN *plan, const float *im, long NBslice, float *strf, float *prof, long NBbin)
+{
+    long nx = plan->nx;
+    long ny = plan->ny;
+    long px = plan->px;
+    long py = plan->py;
+    long pxy = px*py;
+    double *num;
+    double *profnum = NULL;
+    double *profden = NULL;
+    long kk, ii, jj;
+    int n[2];
+
+
+    num = (double *) calloc(pxy, sizeof(double));
+    if(num == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"calloc error");
+        exit(0);
+    }
+    n[0] = (int) py;
+    n[1] = (int) px;
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel if (NBslice > 1)
+    {
+# endif
+        complex_float *buf = (complex_float *) fftwf_malloc(sizeof(complex_float)*pxy);
+        complex_float *sbuf = (complex_float *) fftwf_malloc(sizeof(complex_float)*pxy);
+        double *numt = (double *) calloc(pxy, sizeof(double));
+        long u, v;
+
+# ifdef HAVE_LIBGOMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(kk=0; kk<NBslice; kk++)
+        {
+            const float *p = im + kk*nx*ny;
+            double mean = 0.0;
+
+            // masked mean removed for accuracy, D is offset-invariant
+            for(u=0; u<nx*ny; u++)
+                mean += plan->w[u]*p[u];
+            if(plan->NBpix > 0)
+                mean /= plan->NBpix;
+
+            // w.p in real part, w.p^2 in imaginary part
+            for(u=0; u<pxy; u++)
+            {
+                buf[u].re = 0.0;
+                buf[u].im = 0.0;
+            }
+            for(v=0; v<ny; v++)
+                for(u=0; u<nx; u++)
+                {
+                    float w = plan->w[v*nx+u];
+                    float d = p[v*nx+u] - (float) mean;
+
+                    buf[v*px+u].re = w*d;
+                    buf[v*px+u].im = w*d*d;
+                }
+            fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_FORWARD, buf, buf);
+
+            // S = 2 Re(conj(W) Q) - 2 |B|^2, with B and Q separated by Hermitian symmetry
+            for(v=0; v<py; v++)
+                for(u=0; u<px; u++)
+                {
+                    long k = v*px+u;
+                    long km = ((py-v)%py)*px + (px-u)%px;
+                    float br = 0.5*(buf[k].re+buf[km].re);
+                    float bi = 0.5*(buf[k].im-buf[km].im);
+                    float qr = 0.5*(buf[k].im+buf[km].im);
+                    float qi = -0.5*(buf[k].re-buf[km].re);
+
+                    sbuf[k].re = 2.0*(plan->Fw[k].re*qr + plan->Fw[k].im*qi) - 2.0*(br*br+bi*bi);
+                    sbuf[k].im = 0.0;
+                }
+            fft_plancache_execute(FFT_PLAN_C2C, 0, 2, n, 1, FFTW_BACKWARD, sbuf, sbuf);
+
+            for(u=0; u<pxy; u++)
+                numt[u] += sbuf[u].re/pxy;
+        }
+# ifdef HAVE_LIBGOMP
+        #pragma omp critical
+# endif
+        for(u=0; u<pxy; u++)
+            num[u] += numt[u];
+
+        free(numt);
+        fftwf_free(buf);
+        fftwf_free(sbuf);
+# ifdef HAVE_LIBGOMP
+    }
+# endif
+
+
+    // fold (dx,dy) and (dx,-dy); (-dx,-dy) is the same pair set as (dx,dy)
+    if(strf != NULL)
+        for(jj=0; jj<ny; jj++)
+            for(ii=0; ii<nx; ii++)
+            {
+                long k1 = jj*px + ii;
+                long k2 = ((py-jj)%py)*px + ii;
+                double nn = num[k1];
+                double dd = plan->Nov[k1];
+
+                if((jj != 0)&&(ii != 0))
+                {
+                    nn += num[k2];
+                    dd += plan->Nov[k2];
+                }
+                dd *= NBslice;
+                strf[jj*nx+ii] = (dd > 0.5) ? (float) (nn/dd) : 0.0;
+            }
+
+    // azimuthal average over all separations, weighted by pair counts
+    if((prof != NULL)&&(NBbin > 0))
+    {
+        profnum = (double *) calloc(NBbin, sizeof(double));
+        profden = (double *) calloc(NBbin, sizeof(double));
+        for(jj=1-ny; jj<ny; jj++)
+            for(ii=1-nx; ii<nx; ii++)
+            {
+                long k = ((jj+py)%py)*px + (ii+px)%px;
+                long bin = (long) (sqrt((double) (ii*ii+jj*jj)) + 0.5);
+
+                if((bin < NBbin)&&(plan->Nov[k] > 0.5))
+                {
+                    profnum[bin] += num[k];
+                    profden[bin] += NBslice*plan->Nov[k];
+                }
+            }
+        for(ii=0; ii<NBbin; ii++)
+            prof[ii] = (profden[ii] > 0.5) ? (float) (profnum[ii]/profden[ii]) : 0.0;
+        free(profnum);
+        free(profden);
+    }
+
+    free(num);
+
+    return(0);
+}
@@ -1,6 +1,80 @@
 #if !defined(FFT_H)
 #define FFT_H
 
+
+// matrix Fourier transform plan, see fft_MFTplan_create()
+typedef struct
+{
+    uint32_t xsize;
+    uint32_t ysize;
+    double Zfactor;
+    int dir;
+
+    uint8_t *inmask;         // 1 for active pixels
+    uint8_t *outmask;
+    long NBptsin;
+    long NBptsout;
+
+    // active columns and rows
+    uint32_t *iiin;
+    uint32_t *jjin;
+    uint32_t *iiout;
+    uint32_t *jjout;
+    long NBiiin;
+    long NBjjin;
+    long NBiiout;
+    long NBjjout;
+
+    complex_float *KX;       // NBiiout x NBiiin
+    complex_float *KY;       // NBjjout x NBjjin
+
+    // work buffers
+    long NBslicealloc;
+    complex_float *bufin;
+    complex_float *buftmp;
+    complex_float *bufout;
+} FFT_MFTPLAN;
+
+
+// sub-pixel registration plan, see fft_regplan_create()
+typedef struct
+{
+    long nx;
+    long ny;
+    long upsample;           // sub-pixel resolution = 1/upsample
+    complex_float *Fref;     // reference spectrum
+} FFT_REGPLAN;
+
+
+// convolution plan, see fft_convplan_create()
+#define FFT_CONV_LINEAR   0  // zero outside image, overlap-save tiles
+#define FFT_CONV_CIRCULAR 1  // periodic, single tile
+
+typedef struct
+{
+    int mode;
+    long d0x, d1x;           // kernel support, offsets from kernel center
+    long d0y, d1y;
+    long tx, ty;             // FFT tile size
+    long bx, by;             // valid output block per tile
+    complex_float *Fke;      // kernel spectrum, normalized
+} FFT_CONVPLAN;
+
+
+// masked structure function plan, see fft_strfplan_create()
+typedef struct
+{
+    long nx;
+    long ny;
+    long px;                 // FFT size, 2x image size
+    long py;
+    float *w;                // mask, 0 or 1
+    long NBpix;              // number of active pixels
+    complex_float *Fw;       // mask spectrum
+    float *Nov;              // number of pixel pairs per separation (FFT index order)
+} FFT_STRFPLAN;
+
+
 int_fast8_t init_fft();
 
 
@@ -14,6 +88,14 @@ int_fast8_t init_fftw_plans0();
 
 int export_wisdom();
 
+int fft_set_planmode(int mode);
+
+int fft_set_backend(int backend);
+
+int fft_gpu_sync(const char *ID_name);
+
+int fft_gpu_syncall();
+
 int permut(const char *ID_name);
 
 //void permutfliphv(const char *ID_name);
@@ -28,6 +110,14 @@ long do2dfft(const char *in_name, const char *out_name);
 
 long do2dffti(const char *in_name, const char *out_name);
 
+long FFT_do2dfft_byID(long IDin, long IDout, int dir);
+
+long FFT_do2dfft_shift(const char *in_name, const char *out_name, int dir);
+
+long do2dfft_shift(const char *in_name, const char *out_name);
+
+long do2dffti_shift(const char *in_name, const char *out_name);
+
 int pupfft(const char *ID_name_ampl, const char *ID_name_pha, const char *ID_name_ampl_out, const char *ID_name_pha_out, const char *options);
 
 long do2drfft(const char *in_name, const char *out_name);
@@ -44,12 +134,46 @@ int fftczoom(const char *ID_name, const char *ID_out, long factor);
 
 int test_fftspeed(int nmax);
 
+FFT_MFTPLAN *fft_MFTplan_create(const char *IDinmask_name, const char *IDoutmask_name, double Zfactor, int dir);
+
+void fft_MFTplan_free(FFT_MFTPLAN *plan);
+
+int fft_MFTplan_execute(FFT_MFTPLAN *plan, long IDin, long kin, long IDout, long kout, long NBslice);
+
+FFT_MFTPLAN *fft_MFTplan_get(const char *IDinmask_name, const char *IDoutmask_name, double Zfactor, int dir);
+
+void fft_MFTplan_flushcache();
+
 long fft_DFT( const char *IDin_name, const char *IDinmask_name, const char *IDout_name, const char *IDoutmask_name, double Zfactor, int dir, long kin);
 
 long fft_DFTinsertFPM( const char *pupin_name, const char *fpmz_name, double zfactor, const char *pupout_name);
 
 long fft_DFTinsertFPM_re( const char *pupin_name, const char *fpmz_name, double zfactor, const char *pupout_name);
 
+FFT_REGPLAN *fft_regplan_create(const float *ref, long nx, long ny, long upsample);
+
+void fft_regplan_free(FFT_REGPLAN *plan);
+
+int fft_regplan_measure(FFT_REGPLAN *plan, const float *im, double *dx, double *dy, double *ccpeak);
+
+long fft_cube_register(const char *IDcube_name, const char *IDref_name, long upsample, const char *IDout_name);
+
 int fft_image_translate(const char *ID_name, const char *ID_out, double xtransl, double ytransl);
 
+long fft_stream_WelchPSD(const char *IDin_name, long semtrig, long NBfft, long NBstep, float avecoeff, const char *IDout_name, long NBiter);
+
+FFT_CONVPLAN *fft_convplan_create(const float *ke, long kx, long ky, long tilesize, int mode);
+
+void fft_convplan_free(FFT_CONVPLAN *plan);
+
+int fft_convplan_execute(FFT_CONVPLAN *plan, const float *in, float *out, long nx, long ny, long NBslice);
+
+long fft_convolve_stream(const char *IDin_name, const char *IDke_name, long semtrig, const char *IDout_name, long NBiter);
+
+FFT_STRFPLAN *fft_strfplan_create(const float *mask, long nx, long ny);
+
+void fft_strfplan_free(FFT_STRFPLAN *plan);
+
+int fft_strfplan_execute(FFT_STRFPLAN *plan, const float *im, long NBslice, float *strf, float *prof, long NBbin);
+
 #endif
@@ -23,6 +23,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sched.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <fitsio.h>  /* required by every program that uses CFITSIO  */
 
@@ -48,6 +50,10 @@
 
 #define SBUFFERSIZE 1000
 
+#define IMAGE_BASIC_FITS_PREFETCH 4   // files read ahead by load_fitsimages_cube
+#define IMAGE_BASIC_STREAM_CHUNK 67108864  // bytes per chunk of slices streamed from file
+#define IMAGE_BASIC_STREAM_PIXBLOCK 4096   // pixels per thread work unit in slice accumulations
+
 #define SWAP(x,y)  temp=(x);x=(y);y=temp;
 
 #ifndef M_PI
@@ -120,6 +126,42 @@ int_fast8_t image_basic_rotate_cli()
 }
 
 
+int_fast8_t image_basic_rotate_interp_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,1)+CLI_checkarg(4,2) == 0)
+    {
+      basic_rotate_interp(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t image_basic_translate_interp_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,1)+CLI_checkarg(4,1)+CLI_checkarg(5,2) == 0)
+    {
+      basic_translate_interp(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t image_basic_rotate_cube_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,3)+CLI_checkarg(4,2) == 0)
+    {
+      basic_rotate_cube(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
 int_fast8_t image_basic_3Dto2D_cli() // collapse first 2 axis into one
 {
 	if(CLI_checkarg(1,4) == 0)
@@ -226,6 +268,18 @@ int_fast8_t image_basic_load_fitsimages_cube_cli()
 }
 
 
+int_fast8_t image_basic_load_fitsimages_cube_sort_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,3)+CLI_checkarg(3,3) == 0)
+    {
+        load_fitsimages_cube_sort(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 int_fast8_t image_basic_cubecollapse_cli()
 {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,3) == 0)
@@ -240,6 +294,30 @@ int_fast8_t image_basic_cubecollapse_cli()
 
 
 
+int_fast8_t image_basic_cube_average_file_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,3)+CLI_checkarg(3,1) == 0)
+    {
+        cube_average_file(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
+int_fast8_t image_basic_cube_center_file_cli()
+{
+    if(CLI_checkarg(1,3)+CLI_checkarg(2,3) == 0)
+    {
+        basic_cube_center_file(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string);
+        return 0;
+    }
+    else
+        return 1;
+}
+
+
 int_fast8_t image_basic_streamaverage_cli()
 {
     if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,3)+CLI_checkarg(4,2)+CLI_checkarg(5,2) == 0)
@@ -324,6 +402,33 @@ int_fast8_t init_image_basic()
     strcpy(data.cmd[data.NBcmd].syntax,"<image in> <output image> <angle>");
     strcpy(data.cmd[data.NBcmd].example,"rotateim imin imout 230");
     strcpy(data.cmd[data.NBcmd].Ccall,"long basic_rotate(const char *ID_name, const char *ID_out_name, float angle)");
+    data.NBcmd++;
+
+	strcpy(data.cmd[data.NBcmd].key,"rotateiminterp");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_rotate_interp_cli;
+    strcpy(data.cmd[data.NBcmd].info,"rotate 2D image, interpolation 0:nearest 1:bilinear 2:bicubic");
+    strcpy(data.cmd[data.NBcmd].syntax,"<image in> <output image> <angle [rad]> <interp>");
+    strcpy(data.cmd[data.NBcmd].example,"rotateiminterp imin imout 0.3 2");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long basic_rotate_interp(const char *ID_name, const char *IDout_name, float angle, int interp)");
+    data.NBcmd++;
+
+	strcpy(data.cmd[data.NBcmd].key,"translateinterp");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_translate_interp_cli;
+    strcpy(data.cmd[data.NBcmd].info,"translate 2D image, interpolation 0:nearest 1:bilinear 2:bicubic");
+    strcpy(data.cmd[data.NBcmd].syntax,"<image in> <output image> <dx> <dy> <interp>");
+    strcpy(data.cmd[data.NBcmd].example,"translateinterp imin imout 0.4 -1.2 1");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long basic_translate_interp(const char *ID_name, const char *IDout_name, float xtransl, float ytransl, int interp)");
+    data.NBcmd++;
+
+	strcpy(data.cmd[data.NBcmd].key,"rotatecube");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_rotate_cube_cli;
+    strcpy(data.cmd[data.NBcmd].info,"rotate each slice of a cube by its own angle (ADI derotation)");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input cube> <angles [rad], one per slice> <output cube> <interp>");
+    strcpy(data.cmd[data.NBcmd].example,"rotatecube imc parang imcderot 2");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long basic_rotate_cube(const char *IDin_name, const char *IDangle_name, const char *IDout_name, int interp)");
     data.NBcmd++;
     
 
@@ -409,6 +514,15 @@ int_fast8_t init_image_basic()
     strcpy(data.cmd[data.NBcmd].example,"loadfitsimgcube im out");
     strcpy(data.cmd[data.NBcmd].Ccall,"long load_fitsimages_cube(const char *strfilter, const char *ID_out_name)");
     data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"loadfitsimgcubesort");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_load_fitsimages_cube_sort_cli;
+    strcpy(data.cmd[data.NBcmd].info,"load multiple images into a single cube, ordered by header keyword");
+    strcpy(data.cmd[data.NBcmd].syntax,"loadfitsimgcubesort <string pattern> <outputcube> <keyword>");
+    strcpy(data.cmd[data.NBcmd].example,"loadfitsimgcubesort \"tel*.fits\" out MJD-OBS");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long load_fitsimages_cube_sort(const char *strfilter, const char *ID_out_name, const char *sortkey)");
+    data.NBcmd++;
     
     
     strcpy(data.cmd[data.NBcmd].key,"cubecollapse");
@@ -419,6 +533,24 @@ int_fast8_t init_image_basic()
     strcpy(data.cmd[data.NBcmd].example,"cubecollapse im1 outim");
     strcpy(data.cmd[data.NBcmd].Ccall,"long cube_collapse(const char *ID_in_name, const char *ID_out_name)");
     data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"cubeavefile");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_cube_average_file_cli;
+    strcpy(data.cmd[data.NBcmd].info,"sigma-clipped average of FITS cube streamed from file, RMS in rmsim");
+    strcpy(data.cmd[data.NBcmd].syntax,"cubeavefile <input FITS file> <output image> <alpha>");
+    strcpy(data.cmd[data.NBcmd].example,"cubeavefile telem.fits imave 3.0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long cube_average_file(const char *file_name, const char *ID_out_name, float alpha)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"cubecenterfile");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = image_basic_cube_center_file_cli;
+    strcpy(data.cmd[data.NBcmd].info,"recenter frames of FITS cube streamed from file into output file");
+    strcpy(data.cmd[data.NBcmd].syntax,"cubecenterfile <input FITS file> <output FITS file>");
+    strcpy(data.cmd[data.NBcmd].example,"cubecenterfile telem.fits telemc.fits");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long basic_cube_center_file(const char *file_in, const char *file_out)");
+    data.NBcmd++;
     
     strcpy(data.cmd[data.NBcmd].key,"imgstreamave");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
@@ -905,14 +1037,56 @@ int basic_trunc_circ(const char *ID_name, float f1)
 }
 
 
+/* replicate each of the n pixels of a row nrep times */
+static void basic_expand_row_float(const float *in, float *out, long n, int nrep)
+{
+    long ii;
+    int i;
+
+    switch(nrep) {
+    case 1:
+        memcpy(out, in, sizeof(float)*n);
+        break;
+    case 2:
+        for(ii=0; ii<n; ii++)
+        {
+            out[2*ii] = in[ii];
+            out[2*ii+1] = in[ii];
+        }
+        break;
+    case 3:
+        for(ii=0; ii<n; ii++)
+        {
+            out[3*ii] = in[ii];
+            out[3*ii+1] = in[ii];
+            out[3*ii+2] = in[ii];
+        }
+        break;
+    case 4:
+        for(ii=0; ii<n; ii++)
+        {
+            out[4*ii] = in[ii];
+            out[4*ii+1] = in[ii];
+            out[4*ii+2] = in[ii];
+            out[4*ii+3] = in[ii];
+        }
+        break;
+    default:
+        for(ii=0; ii<n; ii++)
+            for(i=0; i<nrep; i++)
+                out[ii*nrep+i] = in[ii];
+        break;
+    }
+}
+
+
 /* expand image by factor n1 along x axis and n2 along y axis */
 long basic_expand(const char *ID_name, const char *ID_name_out, int n1, int n2)
 {
     long ID;
     long ID_out; /* ID for the output image */
-    long ii,jj;
+    long jj;
     long naxes[2], naxes_out[2];
-    int i,j;
 
     ID = image_ID(ID_name);
 
@@ -923,12 +1097,20 @@ long basic_expand(const char *ID_name, const char *ID_name_out, int n1, int n2)
 
     ID_out = create_2Dimage_ID(ID_name_out, naxes_out[0], naxes_out[1]);
 
-
+    // expand each input row once, then copy it to the other n2-1 output rows
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static) if(naxes_out[0]*naxes_out[1] > 16384)
+# endif
     for (jj = 0; jj < naxes[1]; jj++)
-        for (ii = 0; ii < naxes[0]; ii++)
-            for (i = 0; i < n1; i++)
-                for (j = 0; j < n2; j++)
-                    data.image[ID_out].array.F[(jj*n2+j)*naxes_out[0]+ii*n1+i] = data.image[ID].array.F[jj*naxes[0]+ii];
+    {
+        float *outrow = data.image[ID_out].array.F + jj*n2*naxes_out[0];
+        int j;
+
+        basic_expand_row_float(data.image[ID].array.F + jj*naxes[0], outrow, naxes[0], n1);
+        for (j = 1; j < n2; j++)
+            memcpy(outrow + j*naxes_out[0], outrow, sizeof(float)*naxes_out[0]);
+    }
+
     return(ID_out);
 }
 
@@ -938,9 +1120,9 @@ long basic_expand3D(const char *ID_name, const char *ID_name_out, int n1, int n2
 {
     long ID;
     long ID_out; /* ID for the output image */
-    long ii, jj, kk;
+    long jj, kk;
     long naxes[3], naxes_out[3];
-    int i, j, k;
+    long sliceout;
 
     ID = image_ID(ID_name);
 
@@ -960,15 +1142,24 @@ long basic_expand3D(const char *ID_name, const char *ID_name_out, int n1, int n2
     printf(" %ld %ld %ld -> %ld %ld %ld\n", naxes[0], naxes[1], naxes[2], naxes_out[0], naxes_out[1], naxes_out[2]);
     
     ID_out = create_3Dimage_ID(ID_name_out, naxes_out[0], naxes_out[1], naxes_out[2]);
-	list_image_ID();
-
-	for (kk = 0; kk < naxes[2]; kk++)
-	    for (jj = 0; jj < naxes[1]; jj++)
-			for (ii = 0; ii < naxes[0]; ii++)
-				for (i = 0; i < n1; i++)
-					for (j = 0; j < n2; j++)
-						for (k = 0; k < n3; k++)
-							data.image[ID_out].array.F[(kk*n3+k)*naxes_out[0]*naxes_out[1] + (jj*n2+j)*naxes_out[0] + ii*n1+i] = data.image[ID].array.F[kk*naxes[0]*naxes[1]+jj*naxes[0]+ii];
+    sliceout = naxes_out[0]*naxes_out[1];
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for collapse(2) schedule(static) if(sliceout*naxes_out[2] > 16384)
+# endif
+    for (kk = 0; kk < naxes[2]; kk++)
+        for (jj = 0; jj < naxes[1]; jj++)
+        {
+            float *outrow = data.image[ID_out].array.F + kk*n3*sliceout + jj*n2*naxes_out[0];
+            int j, k;
+
+            basic_expand_row_float(data.image[ID].array.F + (kk*naxes[1]+jj)*naxes[0], outrow, naxes[0], n1);
+            for (j = 1; j < n2; j++)
+                memcpy(outrow + j*naxes_out[0], outrow, sizeof(float)*naxes_out[0]);
+            for (k = 1; k < n3; k++)
+                memcpy(outrow + k*sliceout, outrow, sizeof(float)*naxes_out[0]*n2);
+        }
+
     return(ID_out);
 }
 
@@ -978,45 +1169,117 @@ long basic_zoom2(const char *ID_name, const char *ID_name_out)
 {
     long ID;
     long ID_out; /* ID for the output image */
-    long ii,jj;
+    long jj;
     long naxes[2], naxes_out[2];
-    char lstring[SBUFFERSIZE];
-    int n;
-
-    n = snprintf(lstring,SBUFFERSIZE,"%s=%s*1",ID_name_out,ID_name);
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
-
 
-    execute_arith(lstring);
     ID = image_ID(ID_name);
+    copy_image_ID(ID_name, ID_name_out, 0);
     naxes[0] = data.image[ID].md[0].size[0];
     naxes[1] = data.image[ID].md[0].size[1];
     naxes_out[0] = naxes[0];
     naxes_out[1] = naxes[1];
     ID_out = image_ID(ID_name_out);
 
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static)
+# endif
     for (jj = 0; jj < naxes[1]/2; jj++)
+    {
+        const float *r0 = data.image[ID].array.F + (jj+naxes[1]/4)*naxes[0] + naxes[1]/4;
+        const float *r1 = r0 + naxes[0];
+        float *o0 = data.image[ID_out].array.F + (2*jj)*naxes_out[0];
+        float *o1 = o0 + naxes_out[0];
+        long ii;
+
         for (ii = 0; ii < naxes[0]/2; ii++)
         {
-            data.image[ID_out].array.F[(2*jj)*naxes_out[0]+(2*ii)] = data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4)];
-            data.image[ID_out].array.F[(2*jj+1)*naxes_out[0]+(2*ii)] = 0.5*(data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4)]+data.image[ID].array.F[(jj+naxes[1]/4+1)*naxes[0]+(ii+naxes[1]/4)]);
-            data.image[ID_out].array.F[(2*jj)*naxes_out[0]+(2*ii+1)] = 0.5*(data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4)]+data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4+1)]);
-            data.image[ID_out].array.F[(2*jj+1)*naxes_out[0]+(2*ii+1)] = 0.25*(data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4)]+data.image[ID].array.F[(jj+naxes[1]/4)*naxes[0]+(ii+naxes[1]/4+1)]+data.image[ID].array.F[(jj+naxes[1]/4+1)*naxes[0]+(ii+naxes[1]/4)]+data.image[ID].array.F[(jj+naxes[1]/4+1)*naxes[0]+(ii+naxes[1]/4+1)]);
+            o0[2*ii] = r0[ii];
+            o1[2*ii] = 0.5*(r0[ii]+r1[ii]);
+            o0[2*ii+1] = 0.5*(r0[ii]+r0[ii+1]);
+            o1[2*ii+1] = 0.25*(r0[ii]+r0[ii+1]+r1[ii]+r1[ii+1]);
         }
+    }
 
     return(ID_out);
 }
 
 
 
+/*
+ * Row kernels for contraction: out[ii] += sum of n1 consecutive pixels of in, nc components per pixel
+ * (1: real, 2: complex). Factors 2, 3 and 4 on real data have dedicated loops that the compiler
+ * vectorizes with strided loads / horizontal adds.
+ */
+static void basic_contract_row_float(const float *in, float *out, long nout, int n1, int nc)
+{
+    long ii;
+    int i, c;
+
+    if(nc == 1)
+        switch(n1) {
+        case 1:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[ii];
+            return;
+        case 2:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[2*ii] + in[2*ii+1];
+            return;
+        case 3:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[3*ii] + in[3*ii+1] + in[3*ii+2];
+            return;
+        case 4:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += (in[4*ii] + in[4*ii+1]) + (in[4*ii+2] + in[4*ii+3]);
+            return;
+        }
+
+    for(ii=0; ii<nout; ii++)
+        for(i=0; i<n1; i++)
+            for(c=0; c<nc; c++)
+                out[ii*nc+c] += in[(ii*n1+i)*nc+c];
+}
+
+
+static void basic_contract_row_double(const double *in, double *out, long nout, int n1, int nc)
+{
+    long ii;
+    int i, c;
+
+    if(nc == 1)
+        switch(n1) {
+        case 1:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[ii];
+            return;
+        case 2:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[2*ii] + in[2*ii+1];
+            return;
+        case 3:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += in[3*ii] + in[3*ii+1] + in[3*ii+2];
+            return;
+        case 4:
+            for(ii=0; ii<nout; ii++)
+                out[ii] += (in[4*ii] + in[4*ii+1]) + (in[4*ii+2] + in[4*ii+3]);
+            return;
+        }
+
+    for(ii=0; ii<nout; ii++)
+        for(i=0; i<n1; i++)
+            for(c=0; c<nc; c++)
+                out[ii*nc+c] += in[(ii*n1+i)*nc+c];
+}
+
+
 long basic_contract(const char *ID_name, const char *ID_name_out, int n1, int n2)
 {
     long ID;
     long ID_out; /* ID for the output image */
-    long ii,jj;
+    long jj;
     long naxes[2], naxes_out[2];
-    int i,j;
 
     ID = image_ID(ID_name);
     naxes[0] = data.image[ID].md[0].size[0];
@@ -1029,11 +1292,17 @@ long basic_contract(const char *ID_name, const char *ID_name_out, int n1, int n2
     create_2Dimage_ID(ID_name_out,naxes_out[0],naxes_out[1]);
     ID_out = image_ID(ID_name_out);
 
+    // each output row accumulates n2 contiguous input rows
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static) if(naxes[0]*naxes[1] > 16384)
+# endif
     for (jj = 0; jj < naxes_out[1]; jj++)
-        for (ii = 0; ii < naxes_out[0]; ii++)
-            for (i = 0; i < n1; i++)
-                for (j = 0; j < n2; j++)
-                    data.image[ID_out].array.F[jj*naxes_out[0]+ii] += data.image[ID].array.F[(jj*n2+j)*naxes[0]+ii*n1+i];
+    {
+        int j;
+
+        for (j = 0; j < n2; j++)
+            basic_contract_row_float(data.image[ID].array.F + (jj*n2+j)*naxes[0], data.image[ID_out].array.F + jj*naxes_out[0], naxes_out[0], n1, 1);
+    }
 
     return(ID_out);
 }
@@ -1044,17 +1313,21 @@ long basic_contract3D(const char *ID_name, const char *ID_name_out, int n1, int
 {
     long ID;
     long ID_out; /* ID for the output image */
-    long ii,jj,kk;
+    long jj,kk;
     uint32_t naxes[3];
     uint32_t *naxes_out;
-    int i,j,k;
     int atype;
+    int nc = 1;
+    long slicein, sliceout;
 
     ID = image_ID(ID_name);
     atype = data.image[ID].md[0].atype;
     naxes[0] = data.image[ID].md[0].size[0];
     naxes[1] = data.image[ID].md[0].size[1];
-    naxes[2] = data.image[ID].md[0].size[2];
+    if(data.image[ID].md[0].naxis > 2)
+        naxes[2] = data.image[ID].md[0].size[2];
+    else
+        naxes[2] = 1;
 
     naxes_out = (uint32_t*) malloc(sizeof(uint32_t)*3);
     naxes_out[0] = naxes[0] / n1;
@@ -1063,7 +1336,7 @@ long basic_contract3D(const char *ID_name, const char *ID_name_out, int n1, int
 
 
     if(naxes_out[2] == 1)
-        create_2Dimage_ID(ID_name_out,naxes_out[0],naxes_out[1]);
+        create_image_ID(ID_name_out, 2, naxes_out, atype, 0, 0);
     else
     {
         printf("(%ld x %ld x %ld)  ->  (%ld x %ld x %ld)\n", (long) naxes[0], (long) naxes[1], (long) naxes[2], (long) naxes_out[0], (long) naxes_out[1], (long) naxes_out[2]);
@@ -1072,50 +1345,42 @@ long basic_contract3D(const char *ID_name, const char *ID_name_out, int n1, int
 
     ID_out = image_ID(ID_name_out);
 
-    switch(atype) {
-    case _DATATYPE_FLOAT :
-        for (jj = 0; jj < naxes_out[1]; jj++)
-            for (ii = 0; ii < naxes_out[0]; ii++)
-                for (kk = 0; kk < naxes_out[2]; kk++)
-                    for (i = 0; i < n1; i++)
-                        for (j = 0; j < n2; j++)
-                            for (k = 0; k < n3; k++)
-                                data.image[ID_out].array.F[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii] += data.image[ID].array.F[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i];
-        break;
-    case _DATATYPE_DOUBLE :
-        for (jj = 0; jj < naxes_out[1]; jj++)
-            for (ii = 0; ii < naxes_out[0]; ii++)
-                for (kk = 0; kk < naxes_out[2]; kk++)
-                    for (i = 0; i < n1; i++)
-                        for (j = 0; j < n2; j++)
-                            for (k = 0; k < n3; k++)
-                                data.image[ID_out].array.D[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii] += data.image[ID].array.D[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i];
-        break;
-    case _DATATYPE_COMPLEX_FLOAT :
-        for (jj = 0; jj < naxes_out[1]; jj++)
-            for (ii = 0; ii < naxes_out[0]; ii++)
-                for (kk = 0; kk < naxes_out[2]; kk++)
-                    for (i = 0; i < n1; i++)
-                        for (j = 0; j < n2; j++)
-                            for (k = 0; k < n3; k++)
-                            {
-                                data.image[ID_out].array.CF[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii].re += data.image[ID].array.CF[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i].re;
-                                data.image[ID_out].array.CF[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii].im += data.image[ID].array.CF[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i].im;
-                            }
-        break;
-    case _DATATYPE_COMPLEX_DOUBLE :
+    if((atype == _DATATYPE_COMPLEX_FLOAT)||(atype == _DATATYPE_COMPLEX_DOUBLE))
+        nc = 2;
+    slicein = (long) naxes[0]*naxes[1];
+    sliceout = (long) naxes_out[0]*naxes_out[1];
+
+    // output row (kk,jj) accumulates n3 x n2 contiguous input rows
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for collapse(2) schedule(static) if(slicein*naxes[2] > 16384)
+# endif
+    for (kk = 0; kk < naxes_out[2]; kk++)
         for (jj = 0; jj < naxes_out[1]; jj++)
-            for (ii = 0; ii < naxes_out[0]; ii++)
-                for (kk = 0; kk < naxes_out[2]; kk++)
-                    for (i = 0; i < n1; i++)
-                        for (j = 0; j < n2; j++)
-                            for (k = 0; k < n3; k++)
-                            {
-                                data.image[ID_out].array.CD[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii].re += data.image[ID].array.CD[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i].re;
-                                data.image[ID_out].array.CD[kk*naxes_out[0]*naxes_out[1]+jj*naxes_out[0]+ii].im += data.image[ID].array.CD[(kk*n3+k)*naxes[0]*naxes[1]+(jj*n2+j)*naxes[0]+ii*n1+i].im;
-                            }
-        break;
-    }
+        {
+            long offout = kk*sliceout + jj*naxes_out[0];
+            int j, k;
+
+            for (k = 0; k < n3; k++)
+                for (j = 0; j < n2; j++)
+                {
+                    long offin = (kk*n3+k)*slicein + (jj*n2+j)*naxes[0];
+
+                    switch(atype) {
+                    case _DATATYPE_FLOAT :
+                        basic_contract_row_float(data.image[ID].array.F + offin, data.image[ID_out].array.F + offout, naxes_out[0], n1, 1);
+                        break;
+                    case _DATATYPE_DOUBLE :
+                        basic_contract_row_double(data.image[ID].array.D + offin, data.image[ID_out].array.D + offout, naxes_out[0], n1, 1);
+                        break;
+                    case _DATATYPE_COMPLEX_FLOAT :
+                        basic_contract_row_float((float*) (data.image[ID].array.CF + offin), (float*) (data.image[ID_out].array.CF + offout), naxes_out[0], n1, nc);
+                        break;
+                    case _DATATYPE_COMPLEX_DOUBLE :
+                        basic_contract_row_double((double*) (data.image[ID].array.CD + offin), (double*) (data.image[ID_out].array.CD + offout), naxes_out[0], n1, nc);
+                        break;
+                    }
+                }
+        }
 
     free(naxes_out);
 
@@ -1370,26 +1635,259 @@ long basic_renorm_max(const char *ID_name)
 
 
 
+/* =============================================================================================== */
+/*                                      WARP ENGINE                                                  */
+/* =============================================================================================== */
+
+// clamp index to [0,n-1]
+static inline long basic_warp_clamp(long i, long n)
+{
+    return (i < 0) ? 0 : ((i > n-1) ? n-1 : i);
+}
+
+
+/**
+ * @brief Resample one output row
+ *
+ * Source coordinates of output pixel ii are (x0 + ii*dx, y0 + ii*dy), pixel centers on integers.
+ * Taps are clamped to the image and the result zeroed outside it, so the loops are branchless and
+ * vectorize with gathers.
+ * addmode = 1 adds to the output row instead of overwriting it.
+ */
+static void basic_warp_row(const float *in, long xsize, long ysize, float *outrow, long n, double x0, double y0, double dx, double dy, int interp, float scale, int addmode)
+{
+    const float xmax = (float) (xsize-1);
+    const float ymax = (float) (ysize-1);
+    const float fx0 = (float) x0;
+    const float fy0 = (float) y0;
+    const float fdx = (float) dx;
+    const float fdy = (float) dy;
+    long ii;
+
+    switch(interp) {
+
+    case BASIC_INTERP_NEAREST:
+# ifdef HAVE_LIBGOMP
+        #pragma omp simd
+# endif
+        for(ii=0; ii<n; ii++)
+        {
+            float x = fx0 + fdx*ii;
+            float y = fy0 + fdy*ii;
+            long i = (long) floorf(x+0.5f);
+            long j = (long) floorf(y+0.5f);
+            float w = ((i>=0)&&(j>=0)&&(i<xsize)&&(j<ysize)) ? scale : 0.0f;
+            float v = w*in[basic_warp_clamp(j,ysize)*xsize + basic_warp_clamp(i,xsize)];
+
+            outrow[ii] = (addmode ? outrow[ii] : 0.0f) + v;
+        }
+        break;
+
+    case BASIC_INTERP_BILINEAR:
+# ifdef HAVE_LIBGOMP
+        #pragma omp simd
+# endif
+        for(ii=0; ii<n; ii++)
+        {
+            float x = fx0 + fdx*ii;
+            float y = fy0 + fdy*ii;
+            float xf = floorf(x);
+            float yf = floorf(y);
+            float u = x-xf;
+            float t = y-yf;
+            long i0 = basic_warp_clamp((long) xf, xsize);
+            long i1 = basic_warp_clamp((long) xf+1, xsize);
+            long j0 = basic_warp_clamp((long) yf, ysize)*xsize;
+            long j1 = basic_warp_clamp((long) yf+1, ysize)*xsize;
+            float w = ((x>=0.0f)&&(y>=0.0f)&&(x<=xmax)&&(y<=ymax)) ? scale : 0.0f;
+            float v = (1.0f-t)*((1.0f-u)*in[j0+i0] + u*in[j0+i1]) + t*((1.0f-u)*in[j1+i0] + u*in[j1+i1]);
+
+            outrow[ii] = (addmode ? outrow[ii] : 0.0f) + w*v;
+        }
+        break;
+
+    case BASIC_INTERP_BICUBIC:
+# ifdef HAVE_LIBGOMP
+        #pragma omp simd
+# endif
+        for(ii=0; ii<n; ii++)
+        {
+            float x = fx0 + fdx*ii;
+            float y = fy0 + fdy*ii;
+            float xf = floorf(x);
+            float yf = floorf(y);
+            float u = x-xf;
+            float t = y-yf;
+            long i = (long) xf;
+            long j = (long) yf;
+            // Keys cubic convolution, a = -0.5
+            float wx0 = ((-0.5f*u+1.0f)*u-0.5f)*u;
+            float wx1 = (1.5f*u-2.5f)*u*u+1.0f;
+            float wx2 = ((-1.5f*u+2.0f)*u+0.5f)*u;
+            float wx3 = (0.5f*u-0.5f)*u*u;
+            float wy0 = ((-0.5f*t+1.0f)*t-0.5f)*t;
+            float wy1 = (1.5f*t-2.5f)*t*t+1.0f;
+            float wy2 = ((-1.5f*t+2.0f)*t+0.5f)*t;
+            float wy3 = (0.5f*t-0.5f)*t*t;
+            long i0 = basic_warp_clamp(i-1, xsize);
+            long i1 = basic_warp_clamp(i, xsize);
+            long i2 = basic_warp_clamp(i+1, xsize);
+            long i3 = basic_warp_clamp(i+2, xsize);
+            const float *r0 = in + basic_warp_clamp(j-1, ysize)*xsize;
+            const float *r1 = in + basic_warp_clamp(j, ysize)*xsize;
+            const float *r2 = in + basic_warp_clamp(j+1, ysize)*xsize;
+            const float *r3 = in + basic_warp_clamp(j+2, ysize)*xsize;
+            float w = ((x>=0.0f)&&(y>=0.0f)&&(x<=xmax)&&(y<=ymax)) ? scale : 0.0f;
+            float v;
+
+            v  = wy0*(wx0*r0[i0] + wx1*r0[i1] + wx2*r0[i2] + wx3*r0[i3]);
+            v += wy1*(wx0*r1[i0] + wx1*r1[i1] + wx2*r1[i2] + wx3*r1[i3]);
+            v += wy2*(wx0*r2[i0] + wx1*r2[i1] + wx2*r2[i2] + wx3*r2[i3]);
+            v += wy3*(wx0*r3[i0] + wx1*r3[i1] + wx2*r3[i2] + wx3*r3[i3]);
+
+            outrow[ii] = (addmode ? outrow[ii] : 0.0f) + w*v;
+        }
+        break;
+    }
+}
+
+
+/**
+ * @brief Affine resampling of a 2D float array
+ *
+ * out(ii,jj) = scale * in(A[0] + A[1]*ii + A[2]*jj, A[3] + A[4]*ii + A[5]*jj)
+ *
+ * Row start coordinates are computed once per row and advanced by (A[1], A[4]) along the row.
+ * Rows are distributed over threads when parallel = 1; callers already parallel over slices pass 0.
+ */
+int basic_warp_affine(const float *in, long xsize, long ysize, float *out, long xsizeout, long ysizeout, const double *A, int interp, float scale, int addmode, int parallel)
+{
+    long jj;
+
+    if((interp < BASIC_INTERP_NEAREST)||(interp > BASIC_INTERP_BICUBIC))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"unknown interpolation mode");
+        return -1;
+    }
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for if(parallel) schedule(static)
+# endif
+    for(jj=0; jj<ysizeout; jj++)
+        basic_warp_row(in, xsize, ysize, out + jj*xsizeout, xsizeout, A[0]+A[2]*jj, A[3]+A[5]*jj, A[1], A[4], interp, scale, addmode);
+
+    return 0;
+}
+
+
+// source coordinates of a rotation by angle about (cx,cy)
+static void basic_warp_rotation(double *A, double angle, double cx, double cy)
+{
+    double c = cos(angle);
+    double s = sin(angle);
+
+    A[0] = cx - cx*c - cy*s;
+    A[1] = c;
+    A[2] = s;
+    A[3] = cy + cx*s - cy*c;
+    A[4] = -s;
+    A[5] = c;
+}
+
+
 long basic_rotate(const char *ID_name, const char *IDout_name, float angle)
 {
-    int ID, IDout;
-    long ii,jj,iis,jjs;
+    return(basic_rotate_interp(ID_name, IDout_name, angle, BASIC_INTERP_NEAREST));
+}
+
+
+/**
+ * @brief Rotate 2D image about pixel (xsize/2, ysize/2)
+ *
+ * interp : BASIC_INTERP_NEAREST, BASIC_INTERP_BILINEAR or BASIC_INTERP_BICUBIC
+ */
+long basic_rotate_interp(const char *ID_name, const char *IDout_name, float angle, int interp)
+{
+    long ID, IDout;
     long naxes[2];
+    double A[6];
 
     ID = image_ID(ID_name);
     naxes[0] = data.image[ID].md[0].size[0];
     naxes[1] = data.image[ID].md[0].size[1];
-    create_2Dimage_ID(IDout_name,naxes[0],naxes[1]);
-    IDout = image_ID(IDout_name);
+    IDout = create_2Dimage_ID(IDout_name, naxes[0], naxes[1]);
 
-    for (jj = 0; jj < naxes[1]; jj++)
-        for (ii = 0; ii < naxes[0]; ii++)
-        {
-            iis = (long) (naxes[0]/2 + (ii-naxes[0]/2)*cos(angle) + (jj-naxes[1]/2)*sin(angle));
-            jjs = (long) (naxes[1]/2 - (ii-naxes[0]/2)*sin(angle) + (jj-naxes[1]/2)*cos(angle));
-            if ((iis>0)&&(jjs>0)&&(iis<naxes[0])&&(jjs<naxes[1]))
-                data.image[IDout].array.F[jj*naxes[0]+ii] = data.image[ID].array.F[jjs*naxes[0]+iis];
-        }
+    basic_warp_rotation(A, angle, (double) (naxes[0]/2), (double) (naxes[1]/2));
+    basic_warp_affine(data.image[ID].array.F, naxes[0], naxes[1], data.image[IDout].array.F, naxes[0], naxes[1], A, interp, 1.0, 0, 1);
+
+    return(IDout);
+}
+
+
+/**
+ * @brief Sub-pixel translation of 2D image by interpolation
+ *
+ * Content moves by (+xtransl, +ytransl), as with basic_translate; pixels uncovered are set to zero.
+ */
+long basic_translate_interp(const char *ID_name, const char *IDout_name, float xtransl, float ytransl, int interp)
+{
+    long ID, IDout;
+    long naxes[2];
+    double A[6];
+
+    ID = image_ID(ID_name);
+    naxes[0] = data.image[ID].md[0].size[0];
+    naxes[1] = data.image[ID].md[0].size[1];
+    IDout = create_2Dimage_ID(IDout_name, naxes[0], naxes[1]);
+
+    A[0] = -xtransl;
+    A[1] = 1.0;
+    A[2] = 0.0;
+    A[3] = -ytransl;
+    A[4] = 0.0;
+    A[5] = 1.0;
+    basic_warp_affine(data.image[ID].array.F, naxes[0], naxes[1], data.image[IDout].array.F, naxes[0], naxes[1], A, interp, 1.0, 0, 1);
+
+    return(IDout);
+}
+
+
+/**
+ * @brief Rotate each slice of a cube by its own angle
+ *
+ * IDangle_name holds one angle [rad] per slice (e.g. minus the parallactic angle for ADI derotation).
+ * Slices are distributed over threads.
+ */
+long basic_rotate_cube(const char *IDin_name, const char *IDangle_name, const char *IDout_name, int interp)
+{
+    long IDin, IDangle, IDout;
+    long xsize, ysize, zsize;
+    long kk;
+
+    IDin = image_ID(IDin_name);
+    IDangle = image_ID(IDangle_name);
+    xsize = data.image[IDin].md[0].size[0];
+    ysize = data.image[IDin].md[0].size[1];
+    zsize = (data.image[IDin].md[0].naxis > 2) ? data.image[IDin].md[0].size[2] : 1;
+
+    if(data.image[IDangle].md[0].nelement < zsize)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"angle image has fewer elements than cube slices");
+        return(-1);
+    }
+
+    IDout = create_3Dimage_ID(IDout_name, xsize, ysize, zsize);
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic,4)
+# endif
+    for(kk=0; kk<zsize; kk++)
+    {
+        double A[6];
+
+        basic_warp_rotation(A, data.image[IDangle].array.F[kk], (double) (xsize/2), (double) (ysize/2));
+        basic_warp_affine(data.image[IDin].array.F + kk*xsize*ysize, xsize, ysize, data.image[IDout].array.F + kk*xsize*ysize, xsize, ysize, A, interp, 1.0, 0, zsize == 1);
+    }
 
     return(IDout);
 }
@@ -1421,34 +1919,38 @@ int basic_rotate90(const char *ID_name, const char *ID_out_name)
 
 int basic_rotate_int(const char *ID_name, const char *ID_out_name, long nbstep)
 {
-  float angle;
-  int i;
-  int ID,ID_out;
-  long ii,jj,iis,jjs;
+  double angle;
+  long i;
+  long ID,ID_out;
   long naxes[2];
-  
+  double A[6];
+  double cx, cy;
+
   ID = image_ID(ID_name);
   naxes[0] = data.image[ID].md[0].size[0];
-  naxes[1] = data.image[ID].md[0].size[1]; 
-  create_2Dimage_ID(ID_out_name,naxes[0],naxes[1]);
-  ID_out = image_ID(ID_out_name);
-  
-  for(i=0;i<nbstep;i++)
-    {
+  naxes[1] = data.image[ID].md[0].size[1];
+  ID_out = create_2Dimage_ID(ID_out_name,naxes[0],naxes[1]);
+  cx = (double) (naxes[0]/2);
+  cy = (double) (naxes[1]/2);
+
+  // sum of rotations, y axis flipped
+  for(i=0;i<nbstep;i++)
+    {
       angle = M_PI*i/nbstep;
-      for (jj = 0; jj < naxes[1]; jj++) 
-	for (ii = 0; ii < naxes[0]; ii++)   
-	  {
-	    iis = (long) (naxes[0]/2 + (ii-naxes[0]/2)*cos(angle) + (jj-naxes[1]/2)*sin(angle));
-	    jjs = (long) (naxes[1]/2 + (ii-naxes[0]/2)*sin(angle) - (jj-naxes[1]/2)*cos(angle));
-	    if ((iis>0)&&(jjs>0)&&(iis<naxes[0])&&(jjs<naxes[1]))
-	      data.image[ID_out].array.F[jj*naxes[0]+ii] += data.image[ID].array.F[jjs*naxes[0]+iis];
-	  }
-    } 
+      A[0] = cx - cx*cos(angle) - cy*sin(angle);
+      A[1] = cos(angle);
+      A[2] = sin(angle);
+      A[3] = cy - cx*sin(angle) + cy*cos(angle);
+      A[4] = sin(angle);
+      A[5] = -cos(angle);
+      basic_warp_affine(data.image[ID].array.F, naxes[0], naxes[1], data.image[ID_out].array.F, naxes[0], naxes[1], A, BASIC_INTERP_NEAREST, 1.0, 1, 1);
+    }
 
   return(0);
 }
 
+
+
 int basic_translate(const char *ID_name, const char *ID_out, float xtransl, float ytransl)
 {
     int ID;
@@ -2149,13 +2651,23 @@ int basic_rotate3(const char *ID_name_in, const char *ID_name_out, float angle)
   return(0);
 }
 
+// source coordinates of a scaling by coeff about (Xcenter,Ycenter)
+static void basic_warp_scaling(double *A, double coeff, double Xcenter, double Ycenter)
+{
+  A[0] = Xcenter - Xcenter*coeff;
+  A[1] = coeff;
+  A[2] = 0.0;
+  A[3] = Ycenter - Ycenter*coeff;
+  A[4] = 0.0;
+  A[5] = coeff;
+}
+
+
 int basic_stretch(const char *name_in, const char *name_out, float coeff, long Xcenter, long Ycenter)
 {
-  
-  long ii,jj;
   long naxes[2];
   long ID_in, ID_out;
-  long i,j;
+  double A[6];
 
   ID_in = image_ID(name_in);
   naxes[0]=data.image[ID_in].md[0].size[0];
@@ -2163,15 +2675,9 @@ int basic_stretch(const char *name_in, const char *name_out, float coeff, long X
 
   ID_out=create_2Dimage_ID(name_out,naxes[0],naxes[1]);
 
-  for(ii=0;ii<naxes[0];ii++)
-    for(jj=0;jj<naxes[0];jj++)
-      {
-	i = Xcenter + (long) (1.0*(ii-Xcenter)*coeff);
-	j = Ycenter + (long) (1.0*(jj-Ycenter)*coeff);
-	if((i<naxes[0])&&(j<naxes[1])&&(i>-1)&&(j>-1))
-	  data.image[ID_out].array.F[jj*naxes[0]+ii] += data.image[ID_in].array.F[j*naxes[0]+i]/coeff/coeff;
-      }
-  
+  basic_warp_scaling(A, coeff, Xcenter, Ycenter);
+  basic_warp_affine(data.image[ID_in].array.F, naxes[0], naxes[1], data.image[ID_out].array.F, naxes[0], naxes[1], A, BASIC_INTERP_NEAREST, 1.0/coeff/coeff, 0, 1);
+
   arith_image_cstmult_inplace(name_out,arith_image_total(name_in)/arith_image_total(name_out));
 
   return(0);
@@ -2180,16 +2686,14 @@ int basic_stretch(const char *name_in, const char *name_out, float coeff, long X
 int basic_stretch_range(const char *name_in, const char *name_out, float coeff1, float coeff2, long Xcenter, long Ycenter, long NBstep, float ApoCoeff)
 {
   // ApoCoeff should be between 0 and 1
-  long ii,jj;
   long naxes[2];
   long ID_in, ID_out;
-  long i,j;
   float coeff;
   long step;
   float mcoeff;
-  float x,y;
+  float x;
   float eps = 1.0e-5;
-  float u,t,tmp;
+  double A[6];
 
 
   ID_in = image_ID(name_in);
@@ -2218,24 +2722,8 @@ int basic_stretch_range(const char *name_in, const char *name_out, float coeff1,
 	mcoeff = 1.0;
       //      fprintf(stdout,"(%f %f %f %f %f)",coeff,coeff1,coeff2,x,mcoeff);
 
-      for(ii=0;ii<naxes[0];ii++)
-	for(jj=0;jj<naxes[1];jj++)
-	  {
-	    x = (1.0*(ii-Xcenter)*coeff)+Xcenter;
-	    y = (1.0*(jj-Ycenter)*coeff)+Ycenter;
-	    i = (long) x;
-	    j = (long) y;
-	    u = x-i;
-	    t = y-j;
-	    if((i<naxes[0]-1)&&(j<naxes[1]-1)&&(i>-1)&&(j>-1))
-	      {
-		tmp = (1.0-u)*(1.0-t)*data.image[ID_in].array.F[j*naxes[0]+i];
-		tmp += (1.0-u)*t*data.image[ID_in].array.F[(j+1)*naxes[0]+i];
-		tmp += u*(1.0-t)*data.image[ID_in].array.F[j*naxes[0]+i+1];
-		tmp += u*t*data.image[ID_in].array.F[(j+1)*naxes[0]+i+1];
-		data.image[ID_out].array.F[jj*naxes[0]+ii] += mcoeff*tmp/coeff/coeff;
-	      }
-	  }
+      basic_warp_scaling(A, coeff, Xcenter, Ycenter);
+      basic_warp_affine(data.image[ID_in].array.F, naxes[0], naxes[1], data.image[ID_out].array.F, naxes[0], naxes[1], A, BASIC_INTERP_BILINEAR, mcoeff/coeff/coeff, 1, 1);
     }
 
   fprintf(stdout,"\n");
@@ -2247,29 +2735,18 @@ int basic_stretch_range(const char *name_in, const char *name_out, float coeff1,
 
 int basic_stretchc(const char *name_in, const char *name_out, float coeff)
 {
-  
-  long ii,jj;
   long naxes[2];
   long ID_in, ID_out;
-  long i,j;
-  long Xcenter,Ycenter;
+  double A[6];
 
   ID_in = image_ID(name_in);
   naxes[0]=data.image[ID_in].md[0].size[0];
   naxes[1]=data.image[ID_in].md[0].size[1];
-  Xcenter = naxes[0]/2;
-  Ycenter = naxes[1]/2;
 
   ID_out=create_2Dimage_ID(name_out,naxes[0],naxes[1]);
 
-  for(ii=0;ii<naxes[0];ii++)
-    for(jj=0;jj<naxes[0];jj++)
-      {
-	i=Xcenter+(long) (1.0*(ii-Xcenter)*coeff);
-	j=Ycenter+(long) (1.0*(jj-Ycenter)*coeff);
-	if((i<naxes[0])&&(j<naxes[1])&&(i>-1)&&(j>-1))
-	  data.image[ID_out].array.F[jj*naxes[0]+ii] += data.image[ID_in].array.F[j*naxes[0]+i]/coeff/coeff;
-      }
+  basic_warp_scaling(A, coeff, naxes[0]/2, naxes[1]/2);
+  basic_warp_affine(data.image[ID_in].array.F, naxes[0], naxes[1], data.image[ID_out].array.F, naxes[0], naxes[1], A, BASIC_INTERP_NEAREST, 1.0/coeff/coeff, 0, 1);
   
   /*  basic_mult(name_out,arith_image_total(name_in)/arith_image_total(name_out));*/
 
@@ -2459,20 +2936,59 @@ long load_fitsimages(const char *strfilter)
 
 
 
-// load all images matching strfilter + .fits into a data cube
+// file list entry for load_fitsimages_cube_sort
+typedef struct
+{
+    char fname[SBUFFERSIZE];
+    char key[FLEN_VALUE];
+    long index;       // position in file list
+} IMAGE_BASIC_FITSFILE;
+
+
+static int image_basic_fitsfile_cmp(const void *a, const void *b)
+{
+    const IMAGE_BASIC_FITSFILE *fa = (const IMAGE_BASIC_FITSFILE*) a;
+    const IMAGE_BASIC_FITSFILE *fb = (const IMAGE_BASIC_FITSFILE*) b;
+    char *enda, *endb;
+    double va = strtod(fa->key, &enda);
+    double vb = strtod(fb->key, &endb);
+
+    // numerical keys (MJD, exposure counters...), otherwise string order (ISO dates)
+    if((enda != fa->key)&&(endb != fb->key)&&(va != vb))
+        return((va < vb) ? -1 : 1);
+    if((enda == fa->key)||(endb == fb->key))
+    {
+        int c = strcmp(fa->key, fb->key);
+        if(c != 0)
+            return(c);
+    }
+    return((fa->index < fb->index) ? -1 : (fa->index > fb->index));
+}
+
+
+
+// load all images matching strfilter into a data cube
+// slices ordered by file name if sortkey is empty, otherwise by value of header keyword sortkey (e.g. MJD-OBS, DATE-OBS)
+// files are read in parallel directly into their cube slice, with read-ahead of the next files
 // return number of images loaded
-// image name in buffer is same as file name without extension
-long load_fitsimages_cube(const char *strfilter, const char *ID_out_name)
+long load_fitsimages_cube_sort(const char *strfilter, const char *ID_out_name, const char *sortkey)
 {
     long cnt = 0;
+    long NBfile = 0;
+    long NBalloc = 1000;
     char command[SBUFFERSIZE];
     char fname[SBUFFERSIZE];
-    char fname1[SBUFFERSIZE];
     FILE *fp;
-    long xsize,ysize;
-    long ii;
-    long ID,IDout;
+    IMAGE_BASIC_FITSFILE *flist;
+    long naxis;
+    uint32_t naxes[3];
+    long xsize, ysize, xysize;
+    long i;
+    long IDout;
     int n;
+    int sizeerr = 0;
+    int readerr = 0;
+    int usekey = ((sortkey != NULL)&&(sortkey[0] != '\0'));
 
     printf("Filter = %s\n",strfilter);
 
@@ -2488,9 +3004,6 @@ long load_fitsimages_cube(const char *strfilter, const char *ID_out_name)
         exit(0);
     }
 
-    xsize = 0;
-    ysize = 0;
-
     if((fp = fopen("flist.tmp","r"))==NULL)
     {
         C_ERRNO = errno;
@@ -2498,75 +3011,394 @@ long load_fitsimages_cube(const char *strfilter, const char *ID_out_name)
         exit(0);
     }
 
-    while(fgets(fname,200,fp)!=NULL)
+    flist = (IMAGE_BASIC_FITSFILE*) malloc(sizeof(IMAGE_BASIC_FITSFILE)*NBalloc);
+    while(fgets(fname,SBUFFERSIZE,fp)!=NULL)
     {
         fname[strlen(fname)-1] = '\0';
-        if(cnt == 0)
+        if(NBfile == NBalloc)
         {
-            ID = load_fits(fname, "imtmplfc", 1);
-            xsize = data.image[ID].md[0].size[0];
-            ysize = data.image[ID].md[0].size[1];
-            delete_image_ID("imtmplfc");
+            NBalloc *= 2;
+            flist = (IMAGE_BASIC_FITSFILE*) realloc(flist, sizeof(IMAGE_BASIC_FITSFILE)*NBalloc);
         }
-
-        ID = load_fits(fname,"imtmplfc", 1);
-        if((data.image[ID].md[0].size[0] != xsize)||(data.image[ID].md[0].size[1] != ysize))
-        {
-            fprintf(stderr,"ERROR in load_fitsimages_cube: not all images have the same size\n");
-            exit(0);
-        }
-        delete_image_ID("imtmplfc");
-        cnt++;
+        strncpy(flist[NBfile].fname, fname, SBUFFERSIZE-1);
+        flist[NBfile].fname[SBUFFERSIZE-1] = '\0';
+        flist[NBfile].key[0] = '\0';
+        flist[NBfile].index = NBfile;
+        NBfile++;
     }
     fclose(fp);
 
+    if(NBfile == 0)
+    {
+        free(flist);
+        return(0);
+    }
+
+    // headers : size check and sort key
+    if(read_fits_imsize(flist[0].fname, &naxis, naxes, NULL, NULL) != 0)
+    {
+        fprintf(stderr,"ERROR in load_fitsimages_cube: cannot read %s\n", flist[0].fname);
+        exit(0);
+    }
+    xsize = naxes[0];
+    ysize = naxes[1];
+    xysize = xsize*ysize;
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic) private(naxis, naxes)
+# endif
+    for(i=0; i<NBfile; i++)
+    {
+        if(read_fits_imsize(flist[i].fname, &naxis, naxes, usekey ? sortkey : NULL, flist[i].key) != 0)
+            sizeerr = 1;
+        else if((naxes[0] != xsize)||(naxes[1] != ysize)||(naxes[2] != 1))
+            sizeerr = 1;
+    }
+    if(sizeerr == 1)
+    {
+        fprintf(stderr,"ERROR in load_fitsimages_cube: not all images have the same size\n");
+        exit(0);
+    }
+
+    if(usekey)
+        qsort(flist, NBfile, sizeof(IMAGE_BASIC_FITSFILE), image_basic_fitsfile_cmp);
+
     printf("Creating 3D cube ... ");
     fflush(stdout);
-    IDout = create_3Dimage_ID(ID_out_name,xsize,ysize,cnt);
+    IDout = create_3Dimage_ID(ID_out_name,xsize,ysize,NBfile);
     printf("\n");
     fflush(stdout);
 
-    cnt = 0;
-    if((fp = fopen("flist.tmp","r"))==NULL)
+    // data : each file read into its slice
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic)
+# endif
+    for(i=0; i<NBfile; i++)
+    {
+        long ip;
+
+        // read-ahead : files about to be picked up by other threads
+        for(ip=i+1; (ip<i+1+IMAGE_BASIC_FITS_PREFETCH)&&(ip<NBfile); ip++)
+        {
+            int fd = open(flist[ip].fname, O_RDONLY);
+
+            if(fd != -1)
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+
+        if(load_fits_array_float(flist[i].fname, data.image[IDout].array.F + i*xysize, xysize) != 0)
+        {
+            fprintf(stderr,"ERROR in load_fitsimages_cube: cannot read %s\n", flist[i].fname);
+            readerr = 1;
+        }
+    }
+
+    if(readerr == 0)
+        cnt = NBfile;
+    printf("%ld images loaded into cube %s\n", cnt, ID_out_name);
+
+    free(flist);
+
+    return(cnt);
+}
+
+
+
+// load all images matching strfilter into a data cube, ordered by file name
+// return number of images loaded
+long load_fitsimages_cube(const char *strfilter, const char *ID_out_name)
+{
+    return(load_fitsimages_cube_sort(strfilter, ID_out_name, ""));
+}
+
+
+
+/* =============================================================================================== */
+/*                           SLICE STREAMING (cube average, cube center)                            */
+/* =============================================================================================== */
+
+typedef struct
+{
+    FITS_SLICEREADER *rd;
+    long k0;
+    long NBslice;
+    float *buf;
+    int status;
+} BASIC_STREAMREAD;
+
+
+static void *basic_stream_read_thread(void *ptr)
+{
+    BASIC_STREAMREAD *sr = (BASIC_STREAMREAD*) ptr;
+
+    sr->status = fits_slicereader_read(sr->rd, sr->k0, sr->NBslice, sr->buf);
+
+    return NULL;
+}
+
+
+/**
+ * @brief Pass over all slices of a file, one chunk at a time
+ *
+ * process(buf, k0, NBslice, arg) is called for consecutive chunks of at most IMAGE_BASIC_STREAM_CHUNK bytes.
+ * The next chunk is read by a separate thread while the current one is processed, so memory use is
+ * two chunks whatever the cube size.
+ *
+ * @return 0 if OK, -1 on read error
+ */
+static int basic_stream_file(FITS_SLICEREADER *rd, long slicesize, long NBslice, int (*process)(float*, long, long, void*), void *arg)
+{
+    long chunk = IMAGE_BASIC_STREAM_CHUNK/(sizeof(float)*slicesize);
+    float *buf[2];
+    BASIC_STREAMREAD sr[2];
+    pthread_t thread;
+    long k0;
+    int c = 0;
+    int err = 0;
+
+    if(chunk < 1)
+        chunk = 1;
+    if(chunk > NBslice)
+        chunk = NBslice;
+    buf[0] = (float*) malloc(sizeof(float)*slicesize*chunk);
+    buf[1] = (float*) malloc(sizeof(float)*slicesize*chunk);
+    if((buf[0]==NULL)||(buf[1]==NULL))
     {
         C_ERRNO = errno;
-        printERROR(__FILE__,__func__,__LINE__,"fopen() error");
+        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
         exit(0);
     }
 
+    sr[0].rd = rd;
+    sr[0].k0 = 0;
+    sr[0].NBslice = chunk;
+    sr[0].buf = buf[0];
+    basic_stream_read_thread(&sr[0]);
 
-    while(fgets(fname,200,fp)!=NULL)
+    for(k0=0; (k0<NBslice)&&(err==0); k0+=chunk)
     {
-        fname[strlen(fname)-1] = '\0';
-        strncpy(fname1,fname,strlen(fname)-5);
-        fname1[strlen(fname)-5] = '\0';
-        load_fits(fname,fname1, 1);
-        printf("Image %s loaded -> %s\n",fname,fname1);
-        ID = image_ID(fname1);
-        for(ii=0; ii<xsize*ysize; ii++)
-            data.image[IDout].array.F[xsize*ysize*cnt+ii] = data.image[ID].array.F[ii];
-        delete_image_ID(fname1);
-        cnt++;
+        int readahead = 0;
+
+        if(sr[c].status != 0)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"read error");
+            err = -1;
+            break;
+        }
+        if(k0+chunk < NBslice)
+        {
+            sr[1-c].rd = rd;
+            sr[1-c].k0 = k0+chunk;
+            sr[1-c].NBslice = (k0+2*chunk < NBslice) ? chunk : NBslice-k0-chunk;
+            sr[1-c].buf = buf[1-c];
+            if(pthread_create(&thread, NULL, basic_stream_read_thread, &sr[1-c]) == 0)
+                readahead = 1;
+            else
+                basic_stream_read_thread(&sr[1-c]);
+        }
+
+        if(process(buf[c], k0, sr[c].NBslice, arg) != 0)
+            err = -1;
+
+        if(readahead == 1)
+            pthread_join(thread, NULL);
+        c = 1-c;
     }
 
-    fclose(fp);
-  /*  n = snprintf(command,SBUFFERSIZE,"rm flist.tmp");
-    if(n >= SBUFFERSIZE)
-        printERROR(__FILE__,__func__,__LINE__,"Attempted to write string buffer with too many characters");
+    free(buf[0]);
+    free(buf[1]);
 
-    if(system(command)==-1)
+    return(err);
+}
+
+
+
+
+// per-pixel accumulators of cube_average, filled slice-major
+typedef struct
+{
+    long npix;
+    int pass;       // 1 : moments, 2 : clipped sum
+    float alpha;
+    float *ref;     // first slice, pass 1 shift for numerical accuracy
+    double *s1;
+    double *s2;
+    float *ave;
+    float *rms;
+    double *sc;
+    long *cnt;
+} CUBE_AVERAGE_ACC;
+
+
+static int cube_average_chunk(float *buf, long k0, long NBslice, void *arg)
+{
+    CUBE_AVERAGE_ACC *acc = (CUBE_AVERAGE_ACC*) arg;
+    long npix = acc->npix;
+    long NBblock = (npix + IMAGE_BASIC_STREAM_PIXBLOCK - 1)/IMAGE_BASIC_STREAM_PIXBLOCK;
+    long b;
+
+    if((acc->pass == 1)&&(k0 == 0))
+        memcpy(acc->ref, buf, sizeof(float)*npix);
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static)
+# endif
+    for(b=0; b<NBblock; b++)
     {
-        printf("WARNING: system(\"%s\") failed [function: %s  file: %s  line: %d ]\n",command,__func__,__FILE__,__LINE__);
-        //exit(0);
+        long ii0 = b*IMAGE_BASIC_STREAM_PIXBLOCK;
+        long ii1 = (ii0 + IMAGE_BASIC_STREAM_PIXBLOCK < npix) ? ii0 + IMAGE_BASIC_STREAM_PIXBLOCK : npix;
+        long ii, kk;
+
+        for(kk=0; kk<NBslice; kk++)
+        {
+            const float *slice = buf + kk*npix;
+
+            if(acc->pass == 1)
+                for(ii=ii0; ii<ii1; ii++)
+                {
+                    double d = (double) slice[ii] - acc->ref[ii];
+
+                    acc->s1[ii] += d;
+                    acc->s2[ii] += d*d;
+                }
+            else
+                for(ii=ii0; ii<ii1; ii++)
+                    if(fabs((double) slice[ii] - acc->ave[ii]) < acc->alpha*acc->rms[ii])
+                    {
+                        acc->sc[ii] += slice[ii];
+                        acc->cnt[ii]++;
+                    }
+        }
     }
 
-*/
-    printf("%ld images loaded into cube %s\n",cnt,ID_out_name);
+    return(0);
+}
+
 
-    return(cnt);
+static void cube_average_acc_alloc(CUBE_AVERAGE_ACC *acc, long npix, float alpha)
+{
+    acc->npix = npix;
+    acc->alpha = alpha;
+    acc->ref = (float*) malloc(sizeof(float)*npix);
+    acc->s1 = (double*) calloc(npix, sizeof(double));
+    acc->s2 = (double*) calloc(npix, sizeof(double));
+    acc->sc = (double*) calloc(npix, sizeof(double));
+    acc->cnt = (long*) calloc(npix, sizeof(long));
+    if((acc->ref==NULL)||(acc->s1==NULL)||(acc->s2==NULL)||(acc->sc==NULL)||(acc->cnt==NULL))
+    {
+        C_ERRNO = errno;
+        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+        exit(0);
+    }
+}
+
+
+static void cube_average_acc_free(CUBE_AVERAGE_ACC *acc)
+{
+    free(acc->ref);
+    free(acc->s1);
+    free(acc->s2);
+    free(acc->sc);
+    free(acc->cnt);
+}
+
+
+// average and rms from pass 1 sums
+static void cube_average_moments(CUBE_AVERAGE_ACC *acc, long ksize)
+{
+    long ii;
+
+    for(ii=0; ii<acc->npix; ii++)
+    {
+        double m = acc->s1[ii]/ksize;
+        double var = acc->s2[ii]/ksize - m*m;
+
+        acc->ave[ii] = (float) (acc->ref[ii] + m);
+        acc->rms[ii] = (float) sqrt((var > 0.0) ? var : 0.0);
+    }
+    acc->pass = 2;
 }
 
 
+// clipped average from pass 2 sums, returns number of selected values
+static long cube_average_result(CUBE_AVERAGE_ACC *acc)
+{
+    long ii;
+    long cnt1 = 0;
+
+    for(ii=0; ii<acc->npix; ii++)
+    {
+        if(acc->cnt[ii] > 0)
+            acc->ave[ii] = (float) (acc->sc[ii]/acc->cnt[ii]);
+        cnt1 += acc->cnt[ii];
+    }
+
+    return(cnt1);
+}
+
+
+
+
+// photocenter of image
+static void basic_photocenter(const float *im, long xsize, long ysize, double *xc, double *yc)
+{
+    double tot = 0.0;
+    double totii = 0.0;
+    double totjj = 0.0;
+    long ii, jj;
+
+    for(jj=0; jj<ysize; jj++)
+        for(ii=0; ii<xsize; ii++)
+        {
+            double v = im[jj*xsize+ii];
+
+            totii += v*ii;
+            totjj += v*jj;
+            tot += v;
+        }
+    *xc = totii/tot;
+    *yc = totjj/tot;
+}
+
+
+// shift slice by integer offset so that the photocenter (xc,yc) of the reference, plus the slice offset, is centered
+static void basic_cube_center_slice(FFT_REGPLAN *plan, const float *in, float *out, long xsize, long ysize, double xc, double yc)
+{
+    double dx, dy;
+    long tx, ty;
+    long jj, jj1;
+    long ii0, ii1;
+
+    fft_regplan_measure(plan, in, &dx, &dy, NULL);
+
+    tx = ((long) floor(xc+dx+0.5)) - xsize/2;
+    ty = ((long) floor(yc+dy+0.5)) - ysize/2;
+
+    // output pixels ii in [ii0,ii1) map to input ii+tx within the frame
+    ii0 = (tx < 0) ? -tx : 0;
+    ii1 = (tx > 0) ? xsize-tx : xsize;
+    if(ii1 < ii0)
+        ii1 = ii0;
+
+    for(jj=0; jj<ysize; jj++)
+    {
+        float *orow = out + jj*xsize;
+
+        jj1 = jj+ty;
+        if((jj1 < 0)||(jj1 >= ysize)||(ii1 == ii0))
+        {
+            memset(orow, 0, sizeof(float)*xsize);
+            continue;
+        }
+        memset(orow, 0, sizeof(float)*ii0);
+        memcpy(orow+ii0, in + jj1*xsize + ii0 + tx, sizeof(float)*(ii1-ii0));
+        memset(orow+ii1, 0, sizeof(float)*(xsize-ii1));
+    }
+}
+
 
 // recenter cube frames such that the photocenter is on the central pixel
 // images are recentered by integer number of pixels
@@ -2574,77 +3406,178 @@ long basic_cube_center(const char *ID_in_name, const char *ID_out_name)
 {
     long IDin,IDout;
     long xsize,ysize,ksize;
-    long ii,jj,kk,ii1,jj1;
-    double tot,totii,totjj;
-    long index0,index1,index;
-    double v;
-    long *tx = NULL;
-    long *ty = NULL;
+    long ii,kk;
+    double totii,totjj;
+    double *aves = NULL;
+    float *aveim = NULL;
+    FFT_REGPLAN *plan;
 
     IDin = image_ID(ID_in_name);
     xsize = data.image[IDin].md[0].size[0];
     ysize = data.image[IDin].md[0].size[1];
     ksize = data.image[IDin].md[0].size[2];
 
-    tx = (long*) malloc(sizeof(long)*ksize);
-    if(tx==NULL)
+    aves = (double*) calloc(xsize*ysize, sizeof(double));
+    aveim = (float*) malloc(sizeof(float)*xsize*ysize);
+    if((aves==NULL)||(aveim==NULL))
     {
         C_ERRNO = errno;
-        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+        printERROR(__FILE__,__func__,__LINE__,"calloc() error");
         exit(0);
     }
 
-    ty = (long*) malloc(sizeof(long)*ksize);
-    if(ty==NULL)
+
+    // absolute center from photocenter of average frame
+    for(kk=0; kk<ksize; kk++)
+        for(ii=0; ii<xsize*ysize; ii++)
+            aves[ii] += data.image[IDin].array.F[kk*xsize*ysize+ii];
+    for(ii=0; ii<xsize*ysize; ii++)
+        aveim[ii] = (float) (aves[ii]/ksize);
+    free(aves);
+    basic_photocenter(aveim, xsize, ysize, &totii, &totjj);
+
+
+    // per-frame offset relative to average frame by cross-correlation
+    IDout = create_3Dimage_ID(ID_out_name,xsize,ysize,ksize);
+    plan = fft_regplan_create(aveim, xsize, ysize, 1);
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic)
+# endif
+    for(kk=0; kk<ksize; kk++)
+        basic_cube_center_slice(plan, data.image[IDin].array.F + kk*xsize*ysize, data.image[IDout].array.F + kk*xsize*ysize, xsize, ysize, totii, totjj);
+
+    fft_regplan_free(plan);
+    free(aveim);
+
+    return(0);
+}
+
+
+
+
+typedef struct
+{
+    long npix;
+    double *sum;
+    // pass 2
+    FFT_REGPLAN *plan;
+    long xsize;
+    long ysize;
+    double xc;
+    double yc;
+    float *outbuf;
+    FITS_SLICEWRITER *wr;
+} CUBE_CENTER_STREAM;
+
+
+static int basic_cube_center_sum_chunk(float *buf, long k0, long NBslice, void *arg)
+{
+    CUBE_CENTER_STREAM *cs = (CUBE_CENTER_STREAM*) arg;
+    long NBblock = (cs->npix + IMAGE_BASIC_STREAM_PIXBLOCK - 1)/IMAGE_BASIC_STREAM_PIXBLOCK;
+    long b;
+
+    (void) k0;
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(static)
+# endif
+    for(b=0; b<NBblock; b++)
+    {
+        long ii0 = b*IMAGE_BASIC_STREAM_PIXBLOCK;
+        long ii1 = (ii0 + IMAGE_BASIC_STREAM_PIXBLOCK < cs->npix) ? ii0 + IMAGE_BASIC_STREAM_PIXBLOCK : cs->npix;
+        long ii, kk;
+
+        for(kk=0; kk<NBslice; kk++)
+            for(ii=ii0; ii<ii1; ii++)
+                cs->sum[ii] += buf[kk*cs->npix+ii];
+    }
+
+    return(0);
+}
+
+
+static int basic_cube_center_shift_chunk(float *buf, long k0, long NBslice, void *arg)
+{
+    CUBE_CENTER_STREAM *cs = (CUBE_CENTER_STREAM*) arg;
+    long kk;
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic)
+# endif
+    for(kk=0; kk<NBslice; kk++)
+        basic_cube_center_slice(cs->plan, buf + kk*cs->npix, cs->outbuf + kk*cs->npix, cs->xsize, cs->ysize, cs->xc, cs->yc);
+
+    return(fits_slicewriter_write(cs->wr, k0, NBslice, cs->outbuf));
+}
+
+
+/**
+ * @brief basic_cube_center on a FITS cube file, streamed slice by slice to output file
+ *
+ * First pass computes the average frame, second pass registers and shifts each slice.
+ * Memory use is bounded by a few IMAGE_BASIC_STREAM_CHUNK buffers, independent of cube size.
+ *
+ * @return 0 if OK, -1 on error
+ */
+long basic_cube_center_file(const char *file_in, const char *file_out)
+{
+    FITS_SLICEREADER *rd;
+    CUBE_CENTER_STREAM cs;
+    long naxis;
+    uint32_t naxes[3];
+    float *aveim;
+    long ii, chunk;
+    int err;
+
+    if((rd = fits_slicereader_open(file_in, &naxis, naxes)) == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"cannot open input file");
+        return(-1);
+    }
+    cs.xsize = naxes[0];
+    cs.ysize = naxes[1];
+    cs.npix = cs.xsize*cs.ysize;
+
+    cs.sum = (double*) calloc(cs.npix, sizeof(double));
+    aveim = (float*) malloc(sizeof(float)*cs.npix);
+    chunk = IMAGE_BASIC_STREAM_CHUNK/(sizeof(float)*cs.npix);
+    if(chunk < 1)
+        chunk = 1;
+    if(chunk > (long) naxes[2])
+        chunk = naxes[2];
+    cs.outbuf = (float*) malloc(sizeof(float)*cs.npix*chunk);
+    if((cs.sum==NULL)||(aveim==NULL)||(cs.outbuf==NULL))
     {
         C_ERRNO = errno;
         printERROR(__FILE__,__func__,__LINE__,"malloc() error");
         exit(0);
     }
 
-
-    IDout = create_3Dimage_ID(ID_out_name,xsize,ysize,ksize);
-
-    for(kk=0; kk<ksize; kk++)
+    err = basic_stream_file(rd, cs.npix, naxes[2], basic_cube_center_sum_chunk, &cs);
+    if(err == 0)
     {
-        tot = 0.0;
-        totii = 0.0;
-        totjj = 0.0;
-        index0 = kk*xsize*ysize;
+        for(ii=0; ii<cs.npix; ii++)
+            aveim[ii] = (float) (cs.sum[ii]/naxes[2]);
+        basic_photocenter(aveim, cs.xsize, cs.ysize, &cs.xc, &cs.yc);
 
-        for(jj=0; jj<ysize; jj++)
+        cs.plan = fft_regplan_create(aveim, cs.xsize, cs.ysize, 1);
+        if((cs.wr = fits_slicewriter_open(file_out, naxes[0], naxes[1], naxes[2])) == NULL)
+            err = -1;
+        else
         {
-            index1 = index0 + jj*xsize;
-            for(ii=0; ii<xsize; ii++)
-            {
-                index = index1 + ii;
-                v = data.image[IDin].array.F[index];
-                totii += v*ii;
-                totjj += v*jj;
-                tot += v;
-            }
+            err = basic_stream_file(rd, cs.npix, naxes[2], basic_cube_center_shift_chunk, &cs);
+            if(fits_slicewriter_close(cs.wr) != 0)
+                err = -1;
         }
-        totii /= tot;
-        totjj /= tot;
-        tx[kk] = ((long) (totii+0.5)) - xsize/2;
-        ty[kk] = ((long) (totjj+0.5)) - ysize/2;
-
-        for(ii=0; ii<xsize; ii++)
-            for(jj=0; jj<ysize; jj++)
-            {
-                ii1 = ii+tx[kk];
-                jj1 = jj+ty[kk];
-                if((ii1>-1)&&(ii1<xsize)&&(jj1>-1)&&(jj1<ysize))
-                    data.image[IDout].array.F[index0+jj*xsize+ii] = data.image[IDin].array.F[index0+jj1*xsize+ii1];
-                else
-                    data.image[IDout].array.F[index0+jj*xsize+ii] = 0.0;
-            }
+        fft_regplan_free(cs.plan);
     }
 
-    free(tx);
-    free(ty);
+    fits_slicereader_close(rd);
+    free(cs.outbuf);
+    free(aveim);
+    free(cs.sum);
 
-    return(0);
+    return(err);
 }
 
 
@@ -2659,10 +3592,7 @@ long cube_average(const char *ID_in_name, const char *ID_out_name, float alpha)
 {
     long IDin,IDout,IDrms;
     long xsize,ysize,ksize;
-    long ii,kk;
-    double *array = NULL;
-    double ave,ave1,rms;
-    long cnt;
+    CUBE_AVERAGE_ACC acc;
     long cnt1;
 
     IDin = image_ID(ID_in_name);
@@ -2673,53 +3603,67 @@ long cube_average(const char *ID_in_name, const char *ID_out_name, float alpha)
     IDout = create_2Dimage_ID(ID_out_name,xsize,ysize);
     IDrms = create_2Dimage_ID("rmsim",xsize,ysize);
 
-    array = (double*) malloc(sizeof(double)*ksize);
-    if(array==NULL)
-    {
-        C_ERRNO = errno;
-        printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-        exit(0);
-    }
+    // two slice-major passes : moments, then clipped sum
+    cube_average_acc_alloc(&acc, xsize*ysize, alpha);
+    acc.ave = data.image[IDout].array.F;
+    acc.rms = data.image[IDrms].array.F;
+    acc.pass = 1;
+    cube_average_chunk(data.image[IDin].array.F, 0, ksize, &acc);
+    cube_average_moments(&acc, ksize);
+    cube_average_chunk(data.image[IDin].array.F, 0, ksize, &acc);
+    cnt1 = cube_average_result(&acc);
+    cube_average_acc_free(&acc);
 
-    cnt1 = 0;
-    for(ii=0; ii<xsize*ysize; ii++)
-    {
-        for(kk=0; kk<ksize; kk++)
-            array[kk] = (double) data.image[IDin].array.F[kk*xsize*ysize+ii];
+    printf("(alpha = %f) fraction of pixel values selected = %ld/%ld = %.20g\n", alpha, cnt1, xsize*ysize*ksize, (double) (1.0*cnt1/(xsize*ysize*ksize)));
+    printf("RMS written into image rmsim\n");
 
-        ave = 0.0;
-        for(kk=0; kk<ksize; kk++)
-            ave += array[kk];
-        ave /= ksize;
+    return(IDout);
+}
 
-        rms = 0.0;
-        for(kk=0; kk<ksize; kk++)
-            rms += (array[kk]-ave)*(array[kk]-ave);
-        rms = sqrt(rms/ksize);
 
-        data.image[IDrms].array.F[ii] = (float) rms;
+/**
+ * @brief cube_average on a FITS cube file, streamed slice by slice
+ *
+ * Same output as cube_average (average in ID_out_name, RMS in rmsim) with memory use independent of cube size.
+ * The file is read twice, sequentially.
+ */
+long cube_average_file(const char *file_name, const char *ID_out_name, float alpha)
+{
+    FITS_SLICEREADER *rd;
+    long IDout, IDrms;
+    long naxis;
+    uint32_t naxes[3];
+    CUBE_AVERAGE_ACC acc;
+    long ksize, cnt1;
+    long npix;
 
-        ave1 = 0.0;
-        cnt = 0;
-        for(kk=0; kk<ksize; kk++)
-        {
-            if(fabs(array[kk]-ave)<alpha*rms)
-            {
-                ave1 += array[kk];
-                cnt ++;
-            }
-        }
-        if(cnt>0.5)
-            data.image[IDout].array.F[ii] = (float) (ave1/cnt);
-        else
-            data.image[IDout].array.F[ii] = (float) ave;
-        cnt1 += cnt;
+    if((rd = fits_slicereader_open(file_name, &naxis, naxes)) == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"cannot open input file");
+        return(-1);
     }
+    npix = (long) naxes[0]*naxes[1];
+    ksize = naxes[2];
 
-    free(array);
+    IDout = create_2Dimage_ID(ID_out_name, naxes[0], naxes[1]);
+    IDrms = create_2Dimage_ID("rmsim", naxes[0], naxes[1]);
 
-    printf("(alpha = %f) fraction of pixel values selected = %ld/%ld = %.20g\n", alpha, cnt1, xsize*ysize*ksize, (double) (1.0*cnt1/(xsize*ysize*ksize)));
-    printf("RMS written into image rmsim\n");
+    cube_average_acc_alloc(&acc, npix, alpha);
+    acc.ave = data.image[IDout].array.F;
+    acc.rms = data.image[IDrms].array.F;
+    acc.pass = 1;
+    if(basic_stream_file(rd, npix, ksize, cube_average_chunk, &acc) == 0)
+    {
+        cube_average_moments(&acc, ksize);
+        if(basic_stream_file(rd, npix, ksize, cube_average_chunk, &acc) == 0)
+        {
+            cnt1 = cube_average_result(&acc);
+            printf("(alpha = %f) fraction of pixel values selected = %ld/%ld = %.20g\n", alpha, cnt1, npix*ksize, (double) (1.0*cnt1/(npix*ksize)));
+            printf("RMS written into image rmsim\n");
+        }
+    }
+    cube_average_acc_free(&acc);
+    fits_slicereader_close(rd);
 
     return(IDout);
 }
@@ -3130,37 +4074,19 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
 {
   FILE *fp;
   long ID;
-  float x,y;
   long ii,jj;
-  double tot,cnt,cntx,cnty,totx,toty,slx,sly,xave,yave,vave,totsx,totsy;
   long i;
   long NBpts;
   double *xarray = NULL;
   double *yarray = NULL;
   double *varray = NULL;
-  void *ptree = NULL;
-  double buf[2];
-  double pt[2];
-  double radius, radius0;
-  double *pv = NULL;
-  struct kdres *presults = NULL;
-  double dist;
-  double *pos;
+  double *ptpos = NULL;
+  struct kdflat *ptree = NULL;
+  double radius0;
   //  double tmp1;
-  int ok;
   
   long long cnttotal = 0;
   long long cntrejected = 0;
-  double valm,val0,val1;
-
-  // nearest points
-  long NBnpt,NBnptmax;
-  double *pt_x = NULL;
-  double *pt_y = NULL;
-  double *pt_val = NULL;
-  float *pt_val_cp;
-  double *pt_coeff = NULL;
-  double *pt_coeff1 = NULL;
 
   long IDslx,IDsly,IDxerr,IDyerr;
   double xerr,yerr;
@@ -3173,16 +4099,6 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
   printf("kernel size = %f\n",convsize);
   printf("radiusmax = %f\n",radiusmax);
   
-  pos = (double*) malloc(sizeof(double)*2);
-  if(pos==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-  pos[0] = 0.0;
-  pos[1] = 0.0;
-
   // load table into array
   NBpts = file_number_lines(fname);
   xarray = (double*) malloc(sizeof(double)*NBpts);
@@ -3230,16 +4146,25 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
   fflush(stdout);
 
 
-  /* create a k-d tree for 2-dimensional points */
-  ptree = kd_create( 2 );
-  
-  
-  /* add nodes to the tree */
+  /* bulk-load a flat k-d tree for 2-dimensional points */
+  ptpos = (double*) malloc(sizeof(double)*2*NBpts);
+  if(ptpos==NULL)
+    {
+      C_ERRNO = errno;
+      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+      exit(0);
+    }
   for( i=0; i<NBpts; i++ ) {
-    buf[0] = xarray[i];
-    buf[1] = yarray[i];
-    kd_insert( ptree, buf, &varray[i] );
+    ptpos[2*i] = xarray[i];
+    ptpos[2*i+1] = yarray[i];
   }
+  ptree = kd_flat_build( 2, NBpts, ptpos );
+  free(ptpos);
+  if(ptree==NULL)
+    {
+      printERROR(__FILE__,__func__,__LINE__,"kd_flat_build() error");
+      exit(0);
+    }
 
   ID = create_2Dimage_ID(ID_name,xsize,ysize);
 
@@ -3258,111 +4183,73 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
   radius0 = 5.0*convsize/sqrt(1.0*xsize*ysize);
   radius0 *= sqrt((xmax-xmin)*(ymax-ymin));
 
-  NBnpt = 15000;
-  NBnptmax = NBnpt;
-  pt_x = (double*) malloc(sizeof(double)*NBnpt);
-  if(pt_x==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-
-  pt_y = (double*) malloc(sizeof(double)*NBnpt);
-  if(pt_y==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-
-  pt_val = (double*) malloc(sizeof(double)*NBnpt);
-  if(pt_val==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-
-  pt_coeff = (double*) malloc(sizeof(double)*NBnpt);
-  if(pt_coeff==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-
-  pt_coeff1 = (double*) malloc(sizeof(double)*NBnpt);
-  if(pt_coeff1==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-  
-  pt_val_cp = (float*) malloc(sizeof(float)*NBnpt);
-  if(pt_val_cp==NULL)
-    {
-      C_ERRNO = errno;
-      printERROR(__FILE__,__func__,__LINE__,"malloc() error");
-      exit(0);
-    }
-
-
-  pt_x[0] = 0.0;
-  pt_y[0] = 0.0;
-  pt_val[0] = 0.0;
-  pt_coeff[0] = 0.0;
-  pt_coeff1[0] = 0.0;
-  pt_val_cp[0] = 0.0;
-  
-
   printf("radius = %g\n",radius0);
   fflush(stdout);
 
-  printf("\n");
-  for(ii=0;ii<xsize;ii++)
-    {
-      printf("\r[%ld/%ld]   ",ii,xsize);
-      fflush(stdout);
-      for(jj=0;jj<ysize;jj++)
+  // output rows are independent : each thread owns its query result buffer and point arrays
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel private(ii, jj, i) reduction(+:cnttotal, cntrejected)
+# endif
+  {
+    struct kdflat_res *presults;
+    long NBnpt;
+    long NBnptmax = 15000;
+    double *pt_x, *pt_y, *pt_val, *pt_coeff, *pt_coeff1;
+    float *pt_val_cp;
+
+    presults = kd_flat_res_create();
+    pt_x = (double*) malloc(sizeof(double)*NBnptmax);
+    pt_y = (double*) malloc(sizeof(double)*NBnptmax);
+    pt_val = (double*) malloc(sizeof(double)*NBnptmax);
+    pt_coeff = (double*) malloc(sizeof(double)*NBnptmax);
+    pt_coeff1 = (double*) malloc(sizeof(double)*NBnptmax);
+    pt_val_cp = (float*) malloc(sizeof(float)*NBnptmax);
+    if((presults==NULL)||(pt_x==NULL)||(pt_y==NULL)||(pt_val==NULL)||(pt_coeff==NULL)||(pt_coeff1==NULL)||(pt_val_cp==NULL))
+      {
+	C_ERRNO = errno;
+	printERROR(__FILE__,__func__,__LINE__,"malloc() error");
+	exit(0);
+      }
+
+# ifdef HAVE_LIBGOMP
+    #pragma omp for schedule(dynamic)
+# endif
+    for(jj=0;jj<ysize;jj++)
+      for(ii=0;ii<xsize;ii++)
 	{
-	  //	printf("[%ld %ld]\n",ii,jj);
-	  //	fflush(stdout);
+	  float x,y;
+	  double pt[2];
+	  double radius;
+	  double tot,cnt,cntx,cnty,totx,toty,xave,yave,vave,totsx,totsy;
+	  double valm,val0,val1;
+	  double psl_x, psl_y;
+	  int ok;
 
 	  x = (float) (1.0*xmin + 1.0*(xmax-xmin)*ii/xsize);
 	  y = (float) (1.0*ymin + 1.0*(ymax-ymin)*jj/ysize);
-	  
-	  
+
 	  /* find points closest to the origin and within distance radius */
 	  pt[0] = x;
 	  pt[1] = y;
-	  
+
 	  radius = radius0;
 	  ok = 0;
 	  while(ok==0)
 	    {
-	      presults = kd_nearest_range( ptree, pt, radius );
-	      
-	      //presults = kd_nearest( ptree, pt );
-	      
-	      /* print out all the points found in results */
-	      //  printf( "[%g %g] found %d results (radius = %f):\n", x,y, kd_res_size(presults), radius );
-	      if((kd_res_size(presults)<30)&&(radius<radiusmax))
+	      if(kd_flat_nearest_range( ptree, pt, radius, presults )==-1)
 		{
-		  radius *= 1.5;
-		  //	  printf("        radius -> %f\n",radius);
-		  //  fflush(stdout);
+		  printERROR(__FILE__,__func__,__LINE__,"kd_flat_nearest_range() error");
+		  exit(0);
 		}
+	      if((presults->size<30)&&(radius<radiusmax))
+		radius *= 1.5;
 	      else
 		ok = 1;
 	    }
-	  
+
 	  if(radius < 0.99*radiusmax)
 	    {
-	      NBnpt = kd_res_size(presults);
-	      //printf("NBnpt = %ld\n",NBnpt);
-	      //fflush(stdout);
+	      NBnpt = presults->size;
 	      if(NBnpt>NBnptmax)
 		{
 		  pt_x = realloc(pt_x,sizeof(double)*NBnpt);
@@ -3370,34 +4257,23 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
 		  pt_val = realloc(pt_val,sizeof(double)*NBnpt);
 		  pt_coeff = realloc(pt_coeff,sizeof(double)*NBnpt);
 		  pt_coeff1 = realloc(pt_coeff1,sizeof(double)*NBnpt);
+		  pt_val_cp = realloc(pt_val_cp,sizeof(float)*NBnpt);
 		  NBnptmax = NBnpt;
-		  //  printf("Reallocation to %ld points\n",NBnpt);
-		  // fflush(stdout);
 		}
-	      
-	      
-	      i = 0;
-	      while( kd_res_end( presults ) == 0 ) {
-		/* get the data and position of the current result item */
-		pv = (double*) kd_res_item( presults, pos );
-		
-		/* compute the distance of the current result from the pt */
-		dist = sqrt( (pos[0]-pt[0])*(pos[0]-pt[0]) + (pos[1]-pt[1])*(pos[1]-pt[1]));
-		
-		pt_x[i] = pos[0];
-		pt_y[i] = pos[1];
-		pt_val[i] = *pv;
-		pt_val_cp[i] = (float) pt_val[i];
-		pt_coeff[i] = pow( (1.0+cos(M_PI*dist/radius0))/2.0 ,2.0);
-		pt_coeff1[i] = pow(dist/radius0,2.0)*(1.0+cos(M_PI*dist/radius0))/2.0;
-		/* go to the next entry */
-		free(pv);
-		kd_res_next( presults );
-		
-		i++;
-	      }
-	      
-	      
+
+	      for(i=0;i<NBnpt;i++)
+		{
+		  long k = presults->idx[i];
+		  double dist = sqrt(presults->dist_sq[i]);
+
+		  pt_x[i] = xarray[k];
+		  pt_y[i] = yarray[k];
+		  pt_val[i] = varray[k];
+		  pt_val_cp[i] = (float) pt_val[i];
+		  pt_coeff[i] = pow( (1.0+cos(M_PI*dist/radius0))/2.0 ,2.0);
+		  pt_coeff1[i] = pow(dist/radius0,2.0)*(1.0+cos(M_PI*dist/radius0))/2.0;
+		}
+
 	      // reject outliers
 	      // sort values
 	      quick_sort_float(pt_val_cp,NBnpt);
@@ -3414,9 +4290,7 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
 		      cntrejected ++;
 		    }
 		}
-	      
-	      
-	      
+
 	      tot = 0.0;
 	      totx = 0.0;
 	      toty = 0.0;
@@ -3428,16 +4302,16 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
 		  toty += pt_y[i] * pt_coeff[i];
 		  cnt += pt_coeff[i];
 		}
-	      
+
 	      xave = totx/cnt;
 	      yave = toty/cnt;
 	      vave = tot/cnt;
-	      
+
 	      totsx = 0.0;
 	      totsy = 0.0;
 	      cntx = 0.0;
 	      cnty = 0.0;
-	      
+
 	      for(i=0;i<NBnpt;i++)
 		{
 		  if(fabs(pt_x[i]-xave)>0.01*radius0)
@@ -3448,54 +4322,40 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
 		  if(fabs(pt_y[i]-yave)>0.01*radius0)
 		    {
 		      cnty += pt_coeff1[i];
-		      totsy += (pt_val[i]-vave) / (pt_y[i]-yave) * pt_coeff1[i];	    
+		      totsy += (pt_val[i]-vave) / (pt_y[i]-yave) * pt_coeff1[i];
 		    }
 		}
 	      if(cntx<0.0001)
 		cntx = 0.0001;
 	      if(cnty<0.0001)
 		cnty = 0.0001;
-	      slx = totsx / cntx;
-	      sly = totsy / cnty;
-	      
+	      psl_x = totsx / cntx;
+	      psl_y = totsy / cnty;
+
 	      data.image[ID].array.F[jj*xsize+ii] = (float) vave; //vave + (x-xave)*slx + (y-yave)*sly;
-	      
+
 	      data.image[IDxerr].array.F[jj*xsize+ii] = (float) (x-xave);
 	      data.image[IDyerr].array.F[jj*xsize+ii] = (float) (y-yave);
-	      data.image[IDslx].array.F[jj*xsize+ii] = (float) (slx);
-	      data.image[IDsly].array.F[jj*xsize+ii] = (float) (sly);
+	      data.image[IDslx].array.F[jj*xsize+ii] = (float) (psl_x);
+	      data.image[IDsly].array.F[jj*xsize+ii] = (float) (psl_y);
 	    }
 	}
-    }
 
-  free(pos);
-  printf("\n");
+    kd_flat_res_free(presults);
+    free(pt_x);
+    free(pt_y);
+    free(pt_val);
+    free(pt_val_cp);
+    free(pt_coeff);
+    free(pt_coeff1);
+  }
 
   printf("fraction of points rejected = %g\n",(double) (1.0*cntrejected/cnttotal));
 
-  free(pt_x);
-  free(pt_y);
-  free(pt_val);
-  free(pt_val_cp);
-  free(pt_coeff);
-  free(pt_coeff1);
-
   free(xarray);
   free(yarray);
   free(varray);
-  if(presults != NULL)
-    kd_res_free( presults );
-  if(presults != NULL)
-    {
-      printERROR(__FILE__,__func__,__LINE__,"presults was not freed by kd_res_free. Attempting free(presults) and continuing.");
-      free(presults);
-    }
-  kd_free(ptree);
-  if(ptree!=NULL)
-    {
-      printERROR(__FILE__,__func__,__LINE__,"ptree was not freed by kd_free. Attempting free(ptree) and continuing.");
-      free(ptree);
-    }
+  kd_flat_free(ptree);
   save_fl_fits(ID_name,"!tmp2dinterp.fits");
 
   make_gauss("kerg", xsize, ysize, convsize, (float) 1.0); //(long) (10.0*convsize+2.0));
@@ -3521,8 +4381,6 @@ long basic_tableto2Dim(const char *fname, float xmin, float xmax, float ymin, fl
       {						
 	xerr = data.image[IDxerr].array.F[jj*xsize+ii];
 	yerr = data.image[IDyerr].array.F[jj*xsize+ii];
-	slx = data.image[IDslx].array.F[jj*xsize+ii];
-	sly = data.image[IDsly].array.F[jj*xsize+ii];
 	//	data.image[ID].array.F[jj*xsize+ii] += xerr*slx+yerr*sly;
       }
 
@@ -1,6 +1,11 @@
 #ifndef _BASIC_H
 #define _BASIC_H
 
+// interpolation modes of the warp engine
+#define BASIC_INTERP_NEAREST  0
+#define BASIC_INTERP_BILINEAR 1
+#define BASIC_INTERP_BICUBIC  2
+
 
 int_fast8_t init_image_basic();
 
@@ -43,8 +48,16 @@ int basic_median(const char *ID_name, const char *options);
 
 long basic_renorm_max(const char *ID_name);
 
+int basic_warp_affine(const float *in, long xsize, long ysize, float *out, long xsizeout, long ysizeout, const double *A, int interp, float scale, int addmode, int parallel);
+
 long basic_rotate(const char *ID_name, const char *IDout_name, float angle);
 
+long basic_rotate_interp(const char *ID_name, const char *IDout_name, float angle, int interp);
+
+long basic_translate_interp(const char *ID_name, const char *IDout_name, float xtransl, float ytransl, int interp);
+
+long basic_rotate_cube(const char *IDin_name, const char *IDangle_name, const char *IDout_name, int interp);
+
 int basic_rotate90(const char *ID_name, const char *ID_out_name);
 
 int basic_rotate_int(const char *ID_name, const char *ID_out_name, long nbstep);
@@ -71,12 +84,18 @@ int gauss_histo_image(const char *ID_name, const char *ID_out_name, float sigma,
 
 long load_fitsimages(const char *strfilter);
 
+long load_fitsimages_cube_sort(const char *strfilter, const char *ID_out_name, const char *sortkey);
+
 long load_fitsimages_cube(const char *strfilter, const char *ID_out_name);
 
 long basic_cube_center(const char *ID_in_name, const char *ID_out_name);
 
+long basic_cube_center_file(const char *file_in, const char *file_out);
+
 long cube_average(const char *ID_in_name, const char *ID_out_name, float alpha);
 
+long cube_average_file(const char *file_name, const char *ID_out_name, float alpha);
+
 long cube_collapse(const char *ID_in_name, const char *ID_out_name);
 
 long basic_addimagesfiles(const char *strfilter, const char *outname);
@@ -4,6 +4,10 @@
 
 #include <fitsio.h>  /* required by every program that uses CFITSIO  */
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 #include "CLIcore.h"
 #include "00CORE/00CORE.h"
@@ -63,6 +67,32 @@ int_fast8_t fconvolve_cli()
 
 
 
+int_fast8_t filter_CubePercentile_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,1)+CLI_checkarg(3,3)==0)
+    {
+      filter_CubePercentile(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+
+int_fast8_t filter_CubePercentileApprox_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,1)+CLI_checkarg(3,3)==0)
+    {
+      filter_CubePercentileApprox(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numf, data.cmdargtoken[3].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+
 int init_image_filter()
 {
   strcpy(data.module[data.NBmodule].name, __FILE__);
@@ -88,6 +118,26 @@ int init_image_filter()
   strcpy(data.cmd[data.NBcmd].example,"fconv imin kernim imout");
   strcpy(data.cmd[data.NBcmd].Ccall,"long fconvolve(cconst har *ID_in, const char *ID_ke, const char *ID_out)");
   data.NBcmd++;
+
+
+  strcpy(data.cmd[data.NBcmd].key,"cubeperc");
+  strcpy(data.cmd[data.NBcmd].module,__FILE__);
+  data.cmd[data.NBcmd].fp = filter_CubePercentile_cli;
+  strcpy(data.cmd[data.NBcmd].info,"per-pixel percentile along cube z axis");
+  strcpy(data.cmd[data.NBcmd].syntax,"<input cube> <percentile (0-1)> <output image>");
+  strcpy(data.cmd[data.NBcmd].example,"cubeperc darkc 0.5 dark");
+  strcpy(data.cmd[data.NBcmd].Ccall,"long filter_CubePercentile(const char *IDcin_name, float perc, const char *IDout_name)");
+  data.NBcmd++;
+
+
+  strcpy(data.cmd[data.NBcmd].key,"cubepercapprox");
+  strcpy(data.cmd[data.NBcmd].module,__FILE__);
+  data.cmd[data.NBcmd].fp = filter_CubePercentileApprox_cli;
+  strcpy(data.cmd[data.NBcmd].info,"approximate per-pixel percentile along cube z axis, single pass (P2)");
+  strcpy(data.cmd[data.NBcmd].syntax,"<input cube> <percentile (0-1)> <output image>");
+  strcpy(data.cmd[data.NBcmd].example,"cubepercapprox darkc 0.5 dark");
+  strcpy(data.cmd[data.NBcmd].Ccall,"long filter_CubePercentileApprox(const char *IDcin_name, float perc, const char *IDout_name)");
+  data.NBcmd++;
   
    
   // add atexit functions here
@@ -100,44 +150,346 @@ int init_image_filter()
 
 
 
+//
+// Median filter over (2*filter_size+1)^2 boxes, border pixels (within filter_size of edge) are copied
+// from input.
+//  8-bit images   : sliding column histograms (Perreault & Hebert 2007), O(1) per pixel
+//  16-bit images  : sliding two-level box histogram, O(filter_size) per pixel
+//  float, double  : sorted box updated by merging outgoing / incoming columns, O(box) per pixel
+// Rows are distributed between threads.
+//
+
+// order-preserving integer keys for floating point values
+static inline uint64_t median_filter_fkey(float v)
+{
+    uint32_t u;
+
+    memcpy(&u, &v, sizeof(uint32_t));
+    return((u & 0x80000000u) ? (uint64_t) (~u) : (uint64_t) (u | 0x80000000u));
+}
+
+static inline float median_filter_fval(uint64_t k)
+{
+    uint32_t u = (uint32_t) k;
+    float v;
+
+    u = (u & 0x80000000u) ? (u & 0x7fffffffu) : ~u;
+    memcpy(&v, &u, sizeof(float));
+    return(v);
+}
+
+static inline uint64_t median_filter_dkey(double v)
+{
+    uint64_t u;
+
+    memcpy(&u, &v, sizeof(uint64_t));
+    return((u & 0x8000000000000000ul) ? ~u : (u | 0x8000000000000000ul));
+}
+
+static inline double median_filter_dval(uint64_t k)
+{
+    double v;
+
+    k = (k & 0x8000000000000000ul) ? (k & 0x7ffffffffffffffful) : ~k;
+    memcpy(&v, &k, sizeof(double));
+    return(v);
+}
+
+
+static inline uint64_t median_filter_key(long ID, long index)
+{
+    if(data.image[ID].md[0].atype == _DATATYPE_DOUBLE)
+        return(median_filter_dkey(data.image[ID].array.D[index]));
+    else
+        return(median_filter_fkey(data.image[ID].array.F[index]));
+}
+
+
+static void median_filter_sortkeys(uint64_t *a, long n)
+{
+    long i, j;
+    uint64_t tmp;
+
+    for(i=1; i<n; i++)
+    {
+        tmp = a[i];
+        for(j=i; (j>0)&&(a[j-1]>tmp); j--)
+            a[j] = a[j-1];
+        a[j] = tmp;
+    }
+}
+
+
+static int median_filter_cmpkey(const void *p1, const void *p2)
+{
+    uint64_t k1 = *((const uint64_t*) p1);
+    uint64_t k2 = *((const uint64_t*) p2);
+
+    return((k1 > k2) - (k1 < k2));
+}
+
+
+
+// float / double image, row jj
+static void median_filter_row_sorted(long ID, long ID_out, long jj, long xsize, int fsize, uint64_t *box, uint64_t *box1, uint64_t *colout, uint64_t *colin)
+{
+    long w = 2*fsize+1;
+    long NBbox = w*w;
+    long ii, i, j;
+    long ib, ip, iq, n;
+    uint64_t *tmp;
+    int isdouble = (data.image[ID].md[0].atype == _DATATYPE_DOUBLE);
+
+    n = 0;
+    for(j=jj-fsize; j<=jj+fsize; j++)
+        for(i=0; i<w; i++)
+            box[n++] = median_filter_key(ID, j*xsize+i);
+    qsort(box, NBbox, sizeof(uint64_t), median_filter_cmpkey);
+
+    for(ii=fsize; ii<xsize-fsize; ii++)
+    {
+        if(ii > fsize)
+        {
+            for(j=0; j<w; j++)
+            {
+                colout[j] = median_filter_key(ID, (jj-fsize+j)*xsize + ii-fsize-1);
+                colin[j] = median_filter_key(ID, (jj-fsize+j)*xsize + ii+fsize);
+            }
+            median_filter_sortkeys(colout, w);
+            median_filter_sortkeys(colin, w);
+
+            // box1 = box - colout + colin
+            n = 0;
+            ip = 0;
+            iq = 0;
+            for(ib=0; ib<NBbox; ib++)
+            {
+                if((ip < w)&&(box[ib] == colout[ip]))
+                {
+                    ip++;
+                    continue;
+                }
+                while((iq < w)&&(colin[iq] < box[ib]))
+                    box1[n++] = colin[iq++];
+                box1[n++] = box[ib];
+            }
+            while(iq < w)
+                box1[n++] = colin[iq++];
+
+            tmp = box;
+            box = box1;
+            box1 = tmp;
+        }
+
+        if(isdouble)
+            data.image[ID_out].array.D[jj*xsize+ii] = median_filter_dval(box[(NBbox-1)/2]);
+        else
+            data.image[ID_out].array.F[jj*xsize+ii] = median_filter_fval(box[(NBbox-1)/2]);
+    }
+}
+
+
+
+// 16-bit image, row jj : coarse (high byte) and fine histograms of the box
+static void median_filter_row_histo16(long ID, long ID_out, long jj, long xsize, int fsize, uint32_t *hcoarse, uint32_t *hfine)
+{
+    long w = 2*fsize+1;
+    long rank = (w*w-1)/2;
+    long ii, i, j;
+    int issigned = (data.image[ID].md[0].atype == _DATATYPE_INT16);
+    uint16_t v;
+
+#define MF_VAL16(index) (issigned ? (uint16_t) (data.image[ID].array.SI16[index] + 32768) : data.image[ID].array.UI16[index])
+
+    for(j=jj-fsize; j<=jj+fsize; j++)
+        for(i=0; i<w; i++)
+        {
+            v = MF_VAL16(j*xsize+i);
+            hcoarse[v>>8]++;
+            hfine[v]++;
+        }
+
+    for(ii=fsize; ii<xsize-fsize; ii++)
+    {
+        long cum = 0;
+        long c, f;
+
+        if(ii > fsize)
+            for(j=jj-fsize; j<=jj+fsize; j++)
+            {
+                v = MF_VAL16(j*xsize+ii-fsize-1);
+                hcoarse[v>>8]--;
+                hfine[v]--;
+                v = MF_VAL16(j*xsize+ii+fsize);
+                hcoarse[v>>8]++;
+                hfine[v]++;
+            }
+
+        for(c=0; cum+hcoarse[c] <= rank; c++)
+            cum += hcoarse[c];
+        for(f=c<<8; cum+hfine[f] <= rank; f++)
+            cum += hfine[f];
+
+        if(issigned)
+            data.image[ID_out].array.SI16[jj*xsize+ii] = (int16_t) (f - 32768);
+        else
+            data.image[ID_out].array.UI16[jj*xsize+ii] = (uint16_t) f;
+    }
+
+    // empty histograms for next row
+    for(j=jj-fsize; j<=jj+fsize; j++)
+        for(i=xsize-2*fsize-1; i<xsize; i++)
+        {
+            v = MF_VAL16(j*xsize+i);
+            hcoarse[v>>8]--;
+            hfine[v]--;
+        }
+#undef MF_VAL16
+}
+
+
+
+// 8-bit image, rows jj0 to jj1-1 : column histograms slide down, box histogram slides right
+static void median_filter_rows_histo8(long ID, long ID_out, long jj0, long jj1, long xsize, int fsize, uint16_t *hcol)
+{
+    long w = 2*fsize+1;
+    long rank = (w*w-1)/2;
+    uint16_t hbox[256];
+    long ii, jj, j, b;
+    const uint8_t *in = data.image[ID].array.UI8;
+
+    memset(hcol, 0, sizeof(uint16_t)*256*xsize);
+    for(j=jj0-fsize; j<=jj0+fsize; j++)
+        for(ii=0; ii<xsize; ii++)
+            hcol[ii*256+in[j*xsize+ii]]++;
+
+    for(jj=jj0; jj<jj1; jj++)
+    {
+        if(jj > jj0)
+            for(ii=0; ii<xsize; ii++)
+            {
+                hcol[ii*256+in[(jj-fsize-1)*xsize+ii]]--;
+                hcol[ii*256+in[(jj+fsize)*xsize+ii]]++;
+            }
+
+        memset(hbox, 0, sizeof(hbox));
+        for(ii=0; ii<w; ii++)
+            for(b=0; b<256; b++)
+                hbox[b] += hcol[ii*256+b];
+
+        for(ii=fsize; ii<xsize-fsize; ii++)
+        {
+            long cum = 0;
+
+            if(ii > fsize)
+            {
+                const uint16_t *hout = hcol + (ii-fsize-1)*256;
+                const uint16_t *hin = hcol + (ii+fsize)*256;
+
+                for(b=0; b<256; b++)
+                    hbox[b] += hin[b] - hout[b];
+            }
+            for(b=0; cum+hbox[b] <= rank; b++)
+                cum += hbox[b];
+            data.image[ID_out].array.UI8[jj*xsize+ii] = (uint8_t) b;
+        }
+    }
+}
+
+
+
 int median_filter(const char *ID_name, const char *out_name, int filter_size)
 {
     long ID,ID_out;
-    float *array;
     long ii,jj;
     long naxes[2];
-    int i,j;
+    int atype;
+    long w = 2*filter_size+1;
 
-    /*  printf("Median filter...");
-        fflush(stdout);*/
-    save_fl_fits(ID_name,"!mf_in.fits");
-
-    array = (float*) malloc((2*filter_size+1)*(2*filter_size+1)*sizeof(float));
     ID = image_ID(ID_name);
     naxes[0] = data.image[ID].md[0].size[0];
     naxes[1] = data.image[ID].md[0].size[1];
+    atype = data.image[ID].md[0].atype;
     printf("name = %s, ID = %ld, Size = %ld %ld (%d)\n",ID_name,ID,naxes[0],naxes[1],filter_size);
     fflush(stdout);
     copy_image_ID(ID_name, out_name, 0);
     ID_out = image_ID(out_name);
 
-    for (jj = filter_size; jj < naxes[1]-filter_size; jj++)
-        for (ii = filter_size; ii < naxes[0]-filter_size; ii++)
+    if((filter_size < 1)||(naxes[0] < w)||(naxes[1] < w))
+        return(0);
+
+    switch(atype) {
+
+    case _DATATYPE_FLOAT :
+    case _DATATYPE_DOUBLE :
+# ifdef _OPENMP
+        #pragma omp parallel private(ii)
         {
-            for (i=0; i<(2*filter_size+1); i++)
-                for (j=0; j<(2*filter_size+1); j++)
-                {
-                    array[i*(2*filter_size+1)+j] = data.image[ID].array.F[(jj-filter_size+j)*naxes[0]+(ii-filter_size+i)];
-                }
-            quick_sort_float(array,(2*filter_size+1)*(2*filter_size+1));
-            data.image[ID_out].array.F[jj*naxes[0]+ii] = array[((2*filter_size+1)*(2*filter_size+1)-1)/2];
+# endif
+            uint64_t *buff = (uint64_t*) malloc(sizeof(uint64_t)*(2*w*w+2*w));
+
+# ifdef _OPENMP
+            #pragma omp for schedule(dynamic,4)
+# endif
+            for (jj = filter_size; jj < naxes[1]-filter_size; jj++)
+                median_filter_row_sorted(ID, ID_out, jj, naxes[0], filter_size, buff, buff+w*w, buff+2*w*w, buff+2*w*w+w);
+            free(buff);
+# ifdef _OPENMP
         }
-    free(array);
+# endif
+        break;
 
-    save_fl_fits(out_name,"!mf_out.fits");
+    case _DATATYPE_UINT16 :
+    case _DATATYPE_INT16 :
+# ifdef _OPENMP
+        #pragma omp parallel private(ii)
+        {
+# endif
+            uint32_t *hcoarse = (uint32_t*) calloc(256, sizeof(uint32_t));
+            uint32_t *hfine = (uint32_t*) calloc(65536, sizeof(uint32_t));
+
+# ifdef _OPENMP
+            #pragma omp for schedule(dynamic,4)
+# endif
+            for (jj = filter_size; jj < naxes[1]-filter_size; jj++)
+                median_filter_row_histo16(ID, ID_out, jj, naxes[0], filter_size, hcoarse, hfine);
+            free(hcoarse);
+            free(hfine);
+# ifdef _OPENMP
+        }
+# endif
+        break;
 
-    /*  printf("Done\n");
-        fflush(stdout);*/
+    case _DATATYPE_UINT8 :
+    {
+        long NBrow = naxes[1]-2*filter_size;
+
+# ifdef _OPENMP
+        #pragma omp parallel private(ii)
+        {
+            int nth = omp_get_num_threads();
+            int th = omp_get_thread_num();
+# else
+        {
+            int nth = 1;
+            int th = 0;
+# endif
+            // contiguous block of rows per thread
+            long jj0 = filter_size + (NBrow*th)/nth;
+            long jj1 = filter_size + (NBrow*(th+1))/nth;
+            uint16_t *hcol = (uint16_t*) malloc(sizeof(uint16_t)*256*naxes[0]);
+
+            if(jj1 > jj0)
+                median_filter_rows_histo8(ID, ID_out, jj0, jj1, naxes[0], filter_size, hcol);
+            free(hcol);
+        }
+    }
+    break;
+
+    default :
+        printERROR(__FILE__,__func__,__LINE__,"image type not supported");
+        break;
+    }
 
     return(0);
 }
@@ -410,148 +762,184 @@ long FILTER_percentile_interpol(const char *ID_name, const char *IDout_name, dou
 }
 
 
-long gauss_filter(const char *ID_name, const char *out_name, float sigma, int filter_size)
-{
-    int ID,ID_out,ID_tmp;
-    float *array;
-    long ii,jj,kk;
-    long naxes[3];
-    long naxis;
-    long i,j, k;
-    float sum;
-    double tot;
-    long jmax;
-    int filtersizec;
-    
-    // printf("sigma = %f\n",sigma);
-    // printf("filter size = %d\n",filtersizec);
-
-    ID = image_ID(ID_name);
-    naxis = data.image[ID].md[0].naxis;
-    for(kk=0; kk<naxis; kk++)
-        naxes[kk] = data.image[ID].md[0].size[kk];
-
-    filtersizec = filter_size;
-    if(filtersizec > data.image[ID].md[0].size[0]/2-1)
-        filtersizec = data.image[ID].md[0].size[0]/2-1;
-    if(filtersizec > data.image[ID].md[0].size[1]/2-1)
-        filtersizec = data.image[ID].md[0].size[1]/2-1;
+//
+// Gaussian filters are separable : 1D passes along each axis.
+// Passes along a non-contiguous axis process whole rows (contiguous blocks of the other axes) at a time, so
+// that inner loops are contiguous and vectorized without transposing the image.
+// Near edges, the kernel is truncated and renormalized.
+//
 
-    array = (float*) malloc((2*filtersizec+1)*sizeof(float));
- 
-    if(naxis==2)
-        naxes[2] = 1;
-    copy_image_ID(ID_name, out_name, 0);
-    arith_image_zero(out_name);
-    ID_tmp = create_2Dimage_ID("gtmp", naxes[0], naxes[1]);
-    //  copy_image_ID(ID_name,"gtmp", 0);
-    // arith_image_zero("gtmp");
-    // save_fl_fits("gtmp","!gtmp0");
-    // ID_tmp = image_ID("gtmp");
-    ID_out = image_ID(out_name);
+#define GAUSS_FILTER_BLOCK 2048
+#define GAUSS_FILTER_FFT_LIMIT 128   // 2D filter half-size above which FFT convolution is used
 
 
+// normalized kernel exp(-x^2/sigma^2), x = -fsize...fsize
+static void gauss_filter_mkkernel(float sigma, int fsize, float *ker)
+{
+    int i;
+    double sum = 0.0;
 
-    sum=0.0;
-    for (i=0; i<(2*filtersizec+1); i++)
+    for(i=0; i<2*fsize+1; i++)
     {
-        array[i] = exp(-((i-filtersizec)*(i-filtersizec))/sigma/sigma);
-        sum += array[i];
+        ker[i] = exp(-1.0*(i-fsize)*(i-fsize)/sigma/sigma);
+        sum += ker[i];
     }
+    for(i=0; i<2*fsize+1; i++)
+        ker[i] /= sum;
+}
 
 
+// filter along contiguous axis (size nx), nrow rows
+static void gauss_filter_passx(const float *in, float *out, long nx, long nrow, const float *ker, int fsize)
+{
+    long row;
 
-    for (i=0; i<(2*filtersizec+1); i++)
+# ifdef _OPENMP
+    #pragma omp parallel for if (nx*nrow > GAUSS_FILTER_BLOCK)
+# endif
+    for(row=0; row<nrow; row++)
     {
-        array[i] /= sum;
-        //    printf("%ld %f\n",i,array[i]);
-    }
+        const float *src = in + row*nx;
+        float *dst = out + row*nx;
+        long x, xe0, i;
 
-    for(k=0; k<naxes[2]; k++)
-    {
-        for (ii = 0; ii < naxes[0]*naxes[1]; ii++)
-            data.image[ID_tmp].array.F[ii] = 0.0;
+        for(x=fsize; x<nx-fsize; x++)
+            dst[x] = 0.0;
+        for(i=0; i<2*fsize+1; i++)
+        {
+            const float w = ker[i];
+            const float *s = src + i - fsize;
+
+# ifdef _OPENMP
+            #pragma omp simd
+# endif
+            for(x=fsize; x<nx-fsize; x++)
+                dst[x] += w*s[x];
+        }
 
-        for (jj = 0; jj < naxes[1]; jj++)
+        xe0 = (fsize < nx) ? fsize : nx;
+        for(x=0; x<nx; x++)
         {
-            for (ii = 0; ii < naxes[0]-(2*filtersizec+1); ii++)
+            long i0, i1;
+            double val = 0.0;
+            double norm = 0.0;
+
+            if(x == xe0)
             {
-                for (i=0; i<(2*filtersizec+1); i++)
-                    data.image[ID_tmp].array.F[jj*naxes[0]+(ii+filtersizec)] += array[i]*data.image[ID].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+(ii+i)];
+                if(nx-fsize > x)
+                    x = nx-fsize;
+                if(x >= nx)
+                    break;
             }
-            for (ii=0; ii<filtersizec; ii++)
+            i0 = (fsize-x > 0) ? fsize-x : 0;
+            i1 = (nx-1-x+fsize < 2*fsize) ? nx-1-x+fsize : 2*fsize;
+            for(i=i0; i<=i1; i++)
             {
-                tot = 0.0;
-                for(i=filtersizec-ii; i<(2*filtersizec+1); i++)
-                {
-                    data.image[ID_tmp].array.F[jj*naxes[0]+ii] += array[i]*data.image[ID].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+(ii-filtersizec+i)];
-                    tot += array[i];
-                }
-                data.image[ID_tmp].array.F[jj*naxes[0]+ii] /= tot;
+                val += ker[i]*src[x-fsize+i];
+                norm += ker[i];
             }
-            for (ii=naxes[0]-filtersizec-1; ii<naxes[0]; ii++)
+            dst[x] = val/norm;
+        }
+    }
+}
+
+
+// filter along axis of size n and stride stride, for nouter blocks of n*stride elements
+static void gauss_filter_passy(const float *in, float *out, long nouter, long n, long stride, const float *ker, int fsize)
+{
+    long NBblk = (stride + GAUSS_FILTER_BLOCK - 1)/GAUSS_FILTER_BLOCK;
+    long o, y, blk;
+
+# ifdef _OPENMP
+    #pragma omp parallel for collapse(3) if (nouter*n*stride > GAUSS_FILTER_BLOCK)
+# endif
+    for(o=0; o<nouter; o++)
+        for(y=0; y<n; y++)
+            for(blk=0; blk<NBblk; blk++)
             {
-                tot = 0.0;
-                for(i=0; i<(2*filtersizec+1)-(ii-naxes[0]+filtersizec+1); i++)
+                long b0 = blk*GAUSS_FILTER_BLOCK;
+                long len = (stride-b0 < GAUSS_FILTER_BLOCK) ? stride-b0 : GAUSS_FILTER_BLOCK;
+                float *dst = out + (o*n+y)*stride + b0;
+                long i0, i1, i, k;
+                float norm = 0.0;
+
+                i0 = (fsize-y > 0) ? fsize-y : 0;
+                i1 = (n-1-y+fsize < 2*fsize) ? n-1-y+fsize : 2*fsize;
+                for(i=i0; i<=i1; i++)
+                    norm += ker[i];
+
+                for(k=0; k<len; k++)
+                    dst[k] = 0.0;
+                for(i=i0; i<=i1; i++)
                 {
-                    data.image[ID_tmp].array.F[jj*naxes[0]+ii] += array[i]*data.image[ID].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+(ii-filtersizec+i)];
-                    tot += array[i];
+                    const float w = ker[i]/norm;
+                    const float *s = in + (o*n+y-fsize+i)*stride + b0;
+
+# ifdef _OPENMP
+                    #pragma omp simd
+# endif
+                    for(k=0; k<len; k++)
+                        dst[k] += w*s[k];
                 }
-                data.image[ID_tmp].array.F[jj*naxes[0]+ii] /= tot;
             }
+}
 
-        }
 
 
-        for (ii = 0; ii < naxes[0]; ii++)
-        {
-         //   printf("A jj : 0 -> %ld/%ld\n", naxes[1]-(2*filtersizec+1), naxes[1]);
-         //   fflush(stdout);
-            for (jj = 0; jj < naxes[1]-(2*filtersizec+1); jj++)
-            {
-         //       printf("00: %ld/%ld\n", k*naxes[0]*naxes[1]+(jj+filtersizec)*naxes[0]+ii, naxes[0]*naxes[1]*naxes[2]);
-         //       printf("01: %ld/%ld\n", (jj+j)*naxes[0]+ii, naxes[0]*naxes[1]);
-                fflush(stdout);
-                for (j=0; j<(2*filtersizec+1); j++)
-                    data.image[ID_out].array.F[k*naxes[0]*naxes[1]+(jj+filtersizec)*naxes[0]+ii] += array[j]*data.image[ID_tmp].array.F[(jj+j)*naxes[0]+ii];
-            }
+long gauss_filter(const char *ID_name, const char *out_name, float sigma, int filter_size)
+{
+    long ID, ID_out;
+    float *array;
+    float *tmp;
+    long kk;
+    long naxes[3];
+    long naxis;
+    int filtersizec;
 
-        //    printf("B jj : 0 -> %d/%ld\n", filtersizec, naxes[1]);
-        //    fflush(stdout);
-            for (jj=0; jj<filtersizec; jj++)
-            {
-                tot = 0.0;
-                jmax = (2*filtersizec+1);
-                if(jj-filtersizec+jmax > naxes[1])
-                    jmax = naxes[1]-jj+filtersizec;
-                for(j=filtersizec-jj; j<jmax; j++)
-                {
-         //           printf("02: %ld/%ld\n", k*naxes[0]*naxes[1]+jj*naxes[0]+ii, naxes[0]*naxes[1]*naxes[2]);
-         //           printf("03: %ld/%ld\n", (jj-filtersizec+j)*naxes[0]+ii, naxes[0]*naxes[1]);
-                    fflush(stdout);                                              
-                    data.image[ID_out].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+ii] += array[j]*data.image[ID_tmp].array.F[(jj-filtersizec+j)*naxes[0]+ii];
-                    tot += array[j];
-                }
-                data.image[ID_out].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+ii] /= tot;
-            }
+    ID = image_ID(ID_name);
+    naxis = data.image[ID].md[0].naxis;
+    for(kk=0; kk<naxis; kk++)
+        naxes[kk] = data.image[ID].md[0].size[kk];
+    if(naxis==2)
+        naxes[2] = 1;
 
-            for (jj=naxes[1]-filtersizec-1; jj<naxes[1]; jj++)
-            {
-                tot = 0.0;
-                for(j=0; j<(2*filtersizec+1)-(jj-naxes[1]+filtersizec+1); j++)
-                {
-                    data.image[ID_out].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+ii] += array[j]*data.image[ID_tmp].array.F[(jj-filtersizec+j)*naxes[0]+ii];
-                    tot += array[j];
-                }
-                data.image[ID_out].array.F[k*naxes[0]*naxes[1]+jj*naxes[0]+ii] /= tot;
-            }
-        }
+    filtersizec = filter_size;
+    if(filtersizec > data.image[ID].md[0].size[0]/2-1)
+        filtersizec = data.image[ID].md[0].size[0]/2-1;
+    if(filtersizec > data.image[ID].md[0].size[1]/2-1)
+        filtersizec = data.image[ID].md[0].size[1]/2-1;
+    if(filtersizec < 0)
+        filtersizec = 0;
+
+    array = (float*) malloc((2*filtersizec+1)*sizeof(float));
+    gauss_filter_mkkernel(sigma, filtersizec, array);
 
+    // large kernel : padded FFT convolution (fconvolve_padd also normalizes edges)
+    if((naxis==2)&&(filtersizec > GAUSS_FILTER_FFT_LIMIT)&&(naxes[0]%2==0)&&(naxes[1]%2==0))
+    {
+        long IDke;
+        long ii, jj;
+
+        IDke = create_2Dimage_ID("_gausskernel", naxes[0], naxes[1]);
+        for(jj=0; jj<2*filtersizec+1; jj++)
+            for(ii=0; ii<2*filtersizec+1; ii++)
+                data.image[IDke].array.F[(naxes[1]/2-filtersizec+jj)*naxes[0] + naxes[0]/2-filtersizec+ii] = array[ii]*array[jj];
+        if(image_ID(out_name) != -1)
+            delete_image_ID(out_name);
+        ID_out = fconvolve_padd(ID_name, "_gausskernel", filtersizec, out_name);
+        delete_image_ID("_gausskernel");
+        free(array);
+
+        return(ID_out);
     }
-    
 
-    //  save_fl_fits("gtmp","!gtmp");
-    delete_image_ID("gtmp");
+    copy_image_ID(ID_name, out_name, 0);
+    ID_out = image_ID(out_name);
+
+    tmp = (float*) malloc(sizeof(float)*naxes[0]*naxes[1]*naxes[2]);
+    gauss_filter_passx(data.image[ID].array.F, tmp, naxes[0], naxes[1]*naxes[2], array, filtersizec);
+    gauss_filter_passy(tmp, data.image[ID_out].array.F, naxes[2], naxes[1], naxes[0], array, filtersizec);
+    free(tmp);
 
     free(array);
 
@@ -561,68 +949,32 @@ long gauss_filter(const char *ID_name, const char *out_name, float sigma, int fi
 
 int gauss_3Dfilter(const char *ID_name, const char *out_name, float sigma, int filter_size)
 {
-  int ID,ID_out,ID_tmp,ID_tmp1;
-  float *array;
-  long ii,jj,kk;
-  long naxes[3];
-  int i,j,k;
-  float sum;
-  
-  array = (float*) malloc((2*filter_size+1)*sizeof(float));
-  ID = image_ID(ID_name);
-  naxes[0] = data.image[ID].md[0].size[0];
-  naxes[1] = data.image[ID].md[0].size[1]; 
-  naxes[2] = data.image[ID].md[0].size[2]; 
-
-  copy_image_ID(ID_name, out_name, 0);
-  arith_image_zero(out_name);
-  copy_image_ID(ID_name, "gtmp", 0);
-  arith_image_zero("gtmp");
-  copy_image_ID("gtmp", "gtmp1", 0);
-  ID_tmp = image_ID("gtmp");
-  ID_tmp1 = image_ID("gtmp1");  
-  ID_out = image_ID(out_name);  
-
-  sum=0.0;
-  for (i=0;i<(2*filter_size+1);i++)
-    {
-      array[i] = exp(-((i-filter_size)*(i-filter_size))/sigma/sigma);
-      sum+=array[i];
-    }
+    long ID, ID_out;
+    float *array;
+    float *tmp, *tmp1;
+    long naxes[3];
 
-  for (i=0;i<(2*filter_size+1);i++)
-    array[i] /= sum;
-  
-  for(kk = 0; kk < naxes[2]; kk++)
-    for (jj = 0; jj < naxes[1]; jj++) 
-      for (ii = 0; ii < naxes[0]-(2*filter_size+1); ii++)
-	{
-	  for (i=0;i<(2*filter_size+1);i++)
-	    data.image[ID_tmp].array.F[kk*naxes[0]*naxes[1]+jj*naxes[0]+(ii+filter_size)] += array[i]*data.image[ID].array.F[kk*naxes[0]*naxes[1]+jj*naxes[0]+(ii+i)];
-	}
-  
-  for(kk = 0; kk < naxes[2]; kk++)
-    for (ii = 0; ii < naxes[0]; ii++)
-      for (jj = 0; jj < naxes[1]-(2*filter_size+1); jj++) 
-	{
-	  for (j=0;j<(2*filter_size+1);j++)
-	    data.image[ID_tmp1].array.F[kk*naxes[0]*naxes[1]+(jj+filter_size)*naxes[0]+ii] += array[j]*data.image[ID_tmp].array.F[kk*naxes[0]*naxes[1]+(jj+j)*naxes[0]+ii];
-	}
+    array = (float*) malloc((2*filter_size+1)*sizeof(float));
+    ID = image_ID(ID_name);
+    naxes[0] = data.image[ID].md[0].size[0];
+    naxes[1] = data.image[ID].md[0].size[1];
+    naxes[2] = data.image[ID].md[0].size[2];
 
-  for(ii = 0; ii < naxes[0]; ii++)
-    for (jj = 0; jj < naxes[1]; jj++) 
-      for (kk = 0; kk < naxes[2]-(2*filter_size+1); kk++) 
-	{
-	  for (k=0;k<(2*filter_size+1);k++)
-	    data.image[ID_out].array.F[(kk+filter_size)*naxes[0]*naxes[1]+jj*naxes[0]+ii] += array[k]*data.image[ID_tmp1].array.F[(kk+k)*naxes[0]*naxes[1]+jj*naxes[0]+ii];
-	}
-  
+    copy_image_ID(ID_name, out_name, 0);
+    ID_out = image_ID(out_name);
 
-  delete_image_ID("gtmp");
-  delete_image_ID("gtmp1");
+    gauss_filter_mkkernel(sigma, filter_size, array);
 
-  free(array);
-  return(0);
+    tmp = (float*) malloc(sizeof(float)*naxes[0]*naxes[1]*naxes[2]);
+    tmp1 = (float*) malloc(sizeof(float)*naxes[0]*naxes[1]*naxes[2]);
+    gauss_filter_passx(data.image[ID].array.F, tmp, naxes[0], naxes[1]*naxes[2], array, filter_size);
+    gauss_filter_passy(tmp, tmp1, naxes[2], naxes[1], naxes[0], array, filter_size);
+    gauss_filter_passy(tmp1, data.image[ID_out].array.F, 1, naxes[2], naxes[0]*naxes[1], array, filter_size);
+    free(tmp);
+    free(tmp1);
+
+    free(array);
+    return(0);
 }
 
 int f_filter(const char *ID_name, const char *ID_out, float f1, float f2)
@@ -670,11 +1022,127 @@ int f_filter(const char *ID_name, const char *ID_out, float f1, float f2)
 }
 
 
+// convolution plans (kernel spectrum) kept across calls, keyed on kernel image
+#define FCONVOLVE_NBPLAN 8
+
+static struct
+{
+    long IDke;
+    double creation_time;
+    uint64_t cnt0;
+    int mode;
+    long tilesize;
+    FFT_CONVPLAN *plan;
+} fconvolve_plancache[FCONVOLVE_NBPLAN];
+
+static long fconvolve_plancache_next = 0;
+
+
+
+static FFT_CONVPLAN *fconvolve_getplan(long ID_ke, int mode, long tilesize)
+{
+    long k;
+
+    for(k=0; k<FCONVOLVE_NBPLAN; k++)
+        if((fconvolve_plancache[k].plan != NULL)
+                &&(fconvolve_plancache[k].IDke == ID_ke)
+                &&(fconvolve_plancache[k].creation_time == data.image[ID_ke].md[0].creation_time)
+                &&(fconvolve_plancache[k].cnt0 == data.image[ID_ke].md[0].cnt0)
+                &&(fconvolve_plancache[k].mode == mode)
+                &&(fconvolve_plancache[k].tilesize == tilesize))
+            return(fconvolve_plancache[k].plan);
+
+    k = fconvolve_plancache_next;
+    fconvolve_plancache_next = (fconvolve_plancache_next+1) % FCONVOLVE_NBPLAN;
+
+    fft_convplan_free(fconvolve_plancache[k].plan);
+    fconvolve_plancache[k].IDke = ID_ke;
+    fconvolve_plancache[k].creation_time = data.image[ID_ke].md[0].creation_time;
+    fconvolve_plancache[k].cnt0 = data.image[ID_ke].md[0].cnt0;
+    fconvolve_plancache[k].mode = mode;
+    fconvolve_plancache[k].tilesize = tilesize;
+    fconvolve_plancache[k].plan = fft_convplan_create(data.image[ID_ke].array.F, data.image[ID_ke].md[0].size[0], data.image[ID_ke].md[0].size[1], tilesize, mode);
+
+    return(fconvolve_plancache[k].plan);
+}
+
+
+
+// convolves 2D image or each slice of 3D cube by kernel (FLOAT), result written to new FLOAT image name_out
+static long fconvolve_mode(const char *name_in, const char *name_ke, const char *name_out, int mode, long tilesize, int normedge)
+{
+    long ID_in, ID_ke, IDout;
+    FFT_CONVPLAN *plan;
+    uint32_t imsize[3];
+    long naxis, nx, ny, NBslice;
+    long ii, i;
+    float *buf;
+
+
+    ID_in = image_ID(name_in);
+    ID_ke = image_ID(name_ke);
+    if((ID_in == -1)||(ID_ke == -1))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"image or kernel not found");
+        return(-1);
+    }
+    if((data.image[ID_in].md[0].atype != _DATATYPE_FLOAT)||(data.image[ID_ke].md[0].atype != _DATATYPE_FLOAT))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"image and kernel must be FLOAT");
+        return(-1);
+    }
+
+    naxis = data.image[ID_in].md[0].naxis;
+    nx = data.image[ID_in].md[0].size[0];
+    ny = (naxis > 1) ? data.image[ID_in].md[0].size[1] : 1;
+    NBslice = (naxis > 2) ? data.image[ID_in].md[0].size[2] : 1;
+
+    plan = fconvolve_getplan(ID_ke, mode, tilesize);
+
+    // slice 0..NBslice-1 : image, slice NBslice : ones (edge normalization)
+    buf = (float*) malloc(sizeof(float)*nx*ny*(NBslice+normedge)*2);
+    memcpy(buf, data.image[ID_in].array.F, sizeof(float)*nx*ny*NBslice);
+    if(normedge == 1)
+        for(ii=0; ii<nx*ny; ii++)
+            buf[NBslice*nx*ny+ii] = 1.0;
+
+    if(fft_convplan_execute(plan, buf, buf + nx*ny*(NBslice+normedge), nx, ny, NBslice+normedge) != 0)
+    {
+        free(buf);
+        return(-1);
+    }
+
+    for(i=0; i<naxis; i++)
+        imsize[i] = data.image[ID_in].md[0].size[i];
+    if(image_ID(name_out) != -1)
+        delete_image_ID(name_out);
+    IDout = create_image_ID(name_out, naxis, imsize, _DATATYPE_FLOAT, 0, 0);
+
+    if(normedge == 1)
+    {
+        float *norm = buf + nx*ny*(2*NBslice+1);
+        float *res = buf + nx*ny*(NBslice+1);
+
+        for(i=0; i<NBslice; i++)
+            for(ii=0; ii<nx*ny; ii++)
+                data.image[IDout].array.F[i*nx*ny+ii] = res[i*nx*ny+ii]/norm[ii];
+    }
+    else
+        memcpy(data.image[IDout].array.F, buf + nx*ny*NBslice, sizeof(float)*nx*ny*NBslice);
+
+    free(buf);
+
+    return(IDout);
+}
+
+
+
+// circular convolution, kernel centered at (size/2, size/2), same size as image
+// 3D input : each slice convolved
 long fconvolve(const char *name_in, const char *name_ke, const char *name_out)
 {
     long ID_in,ID_ke;
     long naxes[2];
-    long IDout;
 
     ID_in = image_ID(name_in);
     naxes[0]=data.image[ID_in].md[0].size[0];
@@ -685,41 +1153,18 @@ long fconvolve(const char *name_in, const char *name_ke, const char *name_out)
         fprintf(stderr,"ERROR in function fconvolve: image and kernel have different sizes\n");
         exit(0);
     }
-    //  save_fl_fits(name_in,"!test1.fits");
-    // save_fl_fits(name_ke,"!test2.fits");
-
-    do2drfft(name_in,"infft");
-    do2drfft(name_ke,"kefft");
-
-    arith_image_Cmult("infft","kefft","outfft");
-    delete_image_ID("infft");
-    delete_image_ID("kefft");
-    do2dffti("outfft","outfft1");
-    delete_image_ID("outfft");
-    mk_reim_from_complex("outfft1","tmpre","tmpim", 0);
 
-    //  save_fl_fits("tmpre","!tmpre.fits");
-    // save_fl_fits("tmpim","!tmpim.fits");
-
-    delete_image_ID("outfft1");
-    delete_image_ID("tmpim");
-    arith_image_cstmult("tmpre",1.0/naxes[0]/naxes[1],name_out);
-    delete_image_ID("tmpre");
-    permut(name_out);
-
-    IDout = image_ID(name_out);
-
-    return(IDout);
+    return(fconvolve_mode(name_in, name_ke, name_out, FFT_CONV_CIRCULAR, 0, 0));
 }
 
 
 // to avoid edge effects
+// linear convolution normalized by convolution of image support, no wrap-around
+// paddsize is no longer needed (kept for compatibility)
 long fconvolve_padd(const char *name_in, const char *name_ke, long paddsize, const char *name_out)
 {
-    long ID_in,ID_ke,ID1,ID2,ID3,IDout;
+    long ID_in,ID_ke;
     long naxes[2];
-    long naxespadd[2];
-    long ii,jj;
 
     ID_in = image_ID(name_in);
     naxes[0] = data.image[ID_in].md[0].size[0];
@@ -731,50 +1176,7 @@ long fconvolve_padd(const char *name_in, const char *name_ke, long paddsize, con
         exit(0);
     }
 
-    naxespadd[0] = naxes[0]+2*paddsize;
-    naxespadd[1] = naxes[1]+2*paddsize;
-
-    // printf("new axes : %ld %ld\n",naxespadd[0],naxespadd[1]);
-
-    ID1 = create_2Dimage_ID("tmpimpadd",naxespadd[0],naxespadd[1]);
-    ID2 = create_2Dimage_ID("tmpkepadd",naxespadd[0],naxespadd[1]);
-    ID3 = create_2Dimage_ID("tmpim1padd",naxespadd[0],naxespadd[1]);
-
-    for(ii=0; ii<naxes[0]; ii++)
-        for(jj=0; jj<naxes[1]; jj++)
-        {
-            data.image[ID1].array.F[(jj+paddsize)*naxespadd[0]+(ii+paddsize)] = data.image[ID_in].array.F[jj*naxes[0]+ii];
-            data.image[ID2].array.F[(jj+paddsize)*naxespadd[0]+(ii+paddsize)] = data.image[ID_ke].array.F[jj*naxes[0]+ii];
-            data.image[ID3].array.F[(jj+paddsize)*naxespadd[0]+(ii+paddsize)] = 1.0;
-        }
-
-    //  list_image_ID();
-    //  printf("Doing convolutions...");
-    //  fflush(stdout);
-
-    fconvolve("tmpimpadd","tmpkepadd","tmpconv1");
-    fconvolve("tmpim1padd","tmpkepadd","tmpconv2");
-
-    //  printf(" done\n");
-    // fflush(stdout);
-
-    delete_image_ID("tmpimpadd");
-    delete_image_ID("tmpkepadd");
-    delete_image_ID("tmpim1padd");
-
-    ID1 = image_ID("tmpconv1");
-    ID2 = image_ID("tmpconv2");
-    IDout = create_2Dimage_ID(name_out,naxes[0],naxes[1]);
-
-    for(ii=0; ii<naxes[0]; ii++)
-        for(jj=0; jj<naxes[1]; jj++)
-        {
-            data.image[IDout].array.F[jj*naxes[0]+ii] = data.image[ID1].array.F[(jj+paddsize)*naxespadd[0]+(ii+paddsize)]/data.image[ID2].array.F[(jj+paddsize)*naxespadd[0]+(ii+paddsize)];
-        }
-    delete_image_ID("tmpconv1");
-    delete_image_ID("tmpconv2");
-
-    return(IDout);
+    return(fconvolve_mode(name_in, name_ke, name_out, FFT_CONV_LINEAR, 0, 1));
 }
 
 
@@ -806,72 +1208,14 @@ int fconvolve_1(const char *name_in, const char *kefft, const char *name_out)
 }
 
 
-// if blocksize = 512, for images > 512x512, break image in 512x512 overlapping blocks
-// kernel image must be blocksize
+// linear convolution (zero outside image) computed in overlap-save blocks of ~blocksize x blocksize
+// kernel image centered at (size/2, size/2), only its nonzero support is used
 int fconvolveblock(const char *name_in, const char *name_ke, const char *name_out, long blocksize)
 {
-  long IDin,IDout,IDtmp,IDtmpout,IDcnt;
-  long xsize,ysize;
-  long overlap;
-  long ii,jj,ii0,jj0;
-  float gain;
-  float alpha = 4.0;
-
-  overlap = (long) (blocksize/10);
-  IDin = image_ID(name_in);
-  xsize = data.image[IDin].md[0].size[0];
-  ysize = data.image[IDin].md[0].size[1];
-  IDout = create_2Dimage_ID(name_out,xsize,ysize);
-
-  IDtmp = create_2Dimage_ID("tmpblock",blocksize,blocksize);
-
-  IDcnt = create_2Dimage_ID("tmpcnt",xsize,ysize);
-  for(ii=0;ii<xsize*ysize;ii++)
-    data.image[IDcnt].array.F[ii] = 0.0;
+    if(fconvolve_mode(name_in, name_ke, name_out, FFT_CONV_LINEAR, blocksize, 0) == -1)
+        return(-1);
 
-  for(ii0=0;ii0<xsize-overlap;ii0+=blocksize-overlap)
-    for(jj0=0;jj0<ysize-overlap;jj0+=blocksize-overlap)
-      {
-	for(ii=0;ii<blocksize;ii++)
-	  for(jj=0;jj<blocksize;jj++)
-	    {
-	      if((ii0+ii<xsize)&&(jj0+jj<ysize))
-		data.image[IDtmp].array.F[jj*blocksize+ii] = data.image[IDin].array.F[(jj0+jj)*xsize+(ii0+ii)];
-	      else
-		data.image[IDtmp].array.F[jj*blocksize+ii] = 0.0;
-	    }
-	fconvolve("tmpblock",name_ke,"tmpblockc");
-	IDtmpout = image_ID("tmpblockc");
-	for(ii=0;ii<blocksize;ii++)
-	  for(jj=0;jj<blocksize;jj++)
-	    {
-	      if((ii0+ii<xsize)&&(jj0+jj<ysize))
-		{
-		  gain = 1.0;
-		  if(ii<overlap)
-		    gain *= pow(1.0*(1.0*ii/overlap),alpha);
-		  if(jj<overlap)
-		    gain *= pow(1.0*(1.0*jj/overlap),alpha);
-		  if(ii>blocksize-overlap)
-		    gain *= pow(1.0*(1.0*(blocksize-ii)/overlap),alpha);
-		  if(jj>blocksize-overlap)
-		    gain *= pow(1.0*(1.0*(blocksize-jj)/overlap),alpha);
-		  
-		  data.image[IDout].array.F[(jj0+jj)*xsize+(ii0+ii)] += gain*data.image[IDtmpout].array.F[jj*blocksize+ii];
-		  data.image[IDcnt].array.F[(jj0+jj)*xsize+(ii0+ii)] += gain*1.0;
-		}
-	    }
-      }
-  //  save_fl_fits("tmpcnt","!tmpcnt.fits");
-  // exit(0);
-  for(ii=0;ii<xsize*ysize;ii++)
-    data.image[IDout].array.F[ii] /= data.image[IDcnt].array.F[ii]+1.0e-8;
-
-  delete_image_ID("tmpcnt");
-  delete_image_ID("tmpblock");
-  delete_image_ID("tmpblockc");
-
-  return(0);
+    return(0);
 }
 
 
@@ -1438,77 +1782,344 @@ int filter_fit2DcosKernel(const char *IDname, float radius)
   return(0);
 }
 
-long filter_CubePercentile(const char *IDcin_name, float perc, const char *IDout_name)
+//
+// Per-pixel percentiles along z axis.
+// Exact : pixel tiles (full cache lines) are transposed into per-thread column buffers, then
+//         percentile selected in each column. Tiles are distributed between threads.
+// Approximate : P2 estimator (Jain & Chlamtac 1985), one pass over frames, 5 markers per pixel,
+//         for cubes that are read or received frame by frame.
+//
+
+#define CUBEPERC_TILE_MIN 16           // pixels per tile (one cache line of floats)
+#define CUBEPERC_TILE_MAX 256
+#define CUBEPERC_TILE_BYTES 8388608    // target column buffer size per thread
+
+
+// k-th smallest element of array[0..n-1], array partially reordered
+static float filter_select_float(float *array, long n, long k)
 {
-  long IDcin;
-  long IDout;
-  long xsize, ysize, zsize;
-  long ii,kk;
-  float *array;
-  
-  IDcin = image_ID(IDcin_name);
-  xsize = data.image[IDcin].md[0].size[0];
-  ysize = data.image[IDcin].md[0].size[1];
-  zsize = data.image[IDcin].md[0].size[2];
-  array = (float*) malloc(sizeof(float)*xsize*ysize);
+    long l = 0;
+    long r = n-1;
 
-  IDout = create_2Dimage_ID(IDout_name, xsize, ysize);
-  for(ii=0;ii<xsize*ysize;ii++)
+    while(r > l)
     {
-      for(kk=0;kk<zsize;kk++)
-	array[kk] = data.image[IDcin].array.F[kk*xsize*ysize+ii];
-       
-      quick_sort_float(array,zsize);
-      data.image[IDout].array.F[ii] = array[(long) (perc*zsize)];
-    }  
-  
-  free(array);
+        long i, j, m;
+        float pivot, tmp;
+
+        // median of 3 pivot
+        m = l + (r-l)/2;
+        if(array[m] < array[l]) { tmp = array[m]; array[m] = array[l]; array[l] = tmp; }
+        if(array[r] < array[l]) { tmp = array[r]; array[r] = array[l]; array[l] = tmp; }
+        if(array[r] < array[m]) { tmp = array[r]; array[r] = array[m]; array[m] = tmp; }
+        pivot = array[m];
+
+        i = l;
+        j = r;
+        while(i <= j)
+        {
+            while(array[i] < pivot)
+                i++;
+            while(array[j] > pivot)
+                j--;
+            if(i <= j)
+            {
+                tmp = array[i];
+                array[i] = array[j];
+                array[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if(k <= j)
+            r = j;
+        else if(k >= i)
+            l = i;
+        else
+            break;
+    }
 
-  return(IDout);
+    return(array[k]);
 }
 
+
+
+// limit : only values < limit are used, pixels without values are set to limit (uselimit = 1)
+static long filter_CubePercentile_tiled(const char *IDcin_name, float perc, int uselimit, float limit, const char *IDout_name)
+{
+    long IDcin, IDout;
+    long xysize, zsize;
+    long tile, NBtile, t;
+    float *cube;
+
+
+    IDcin = image_ID(IDcin_name);
+    if(IDcin == -1)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"image not found");
+        return(-1);
+    }
+    if((data.image[IDcin].md[0].naxis != 3)||(data.image[IDcin].md[0].atype != _DATATYPE_FLOAT))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"input must be FLOAT 3D image");
+        return(-1);
+    }
+    xysize = data.image[IDcin].md[0].size[0]*data.image[IDcin].md[0].size[1];
+    zsize = data.image[IDcin].md[0].size[2];
+    cube = data.image[IDcin].array.F;
+
+    tile = CUBEPERC_TILE_BYTES/(sizeof(float)*zsize);
+    tile -= tile % CUBEPERC_TILE_MIN;
+    if(tile < CUBEPERC_TILE_MIN)
+        tile = CUBEPERC_TILE_MIN;
+    if(tile > CUBEPERC_TILE_MAX)
+        tile = CUBEPERC_TILE_MAX;
+    NBtile = (xysize + tile - 1)/tile;
+
+    IDout = create_2Dimage_ID(IDout_name, data.image[IDcin].md[0].size[0], data.image[IDcin].md[0].size[1]);
+
+# ifdef _OPENMP
+    #pragma omp parallel if (NBtile > 1)
+    {
+# endif
+        float *col = (float*) malloc(sizeof(float)*tile*zsize);
+        long *cnt = (long*) malloc(sizeof(long)*tile);
+
+# ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+# endif
+        for(t=0; t<NBtile; t++)
+        {
+            long ii0 = t*tile;
+            long np = (ii0 + tile > xysize) ? xysize - ii0 : tile;
+            long ii, kk;
+
+            // transpose : contiguous reads of np pixels per frame
+            for(ii=0; ii<np; ii++)
+                cnt[ii] = 0;
+            for(kk=0; kk<zsize; kk++)
+            {
+                const float *frame = cube + kk*xysize + ii0;
+
+                if(uselimit == 0)
+                    for(ii=0; ii<np; ii++)
+                        col[ii*zsize+kk] = frame[ii];
+                else
+                    for(ii=0; ii<np; ii++)
+                        if(frame[ii] < limit)
+                            col[ii*zsize + cnt[ii]++] = frame[ii];
+            }
+
+            for(ii=0; ii<np; ii++)
+            {
+                long n = (uselimit == 0) ? zsize : cnt[ii];
+                long k = (long) (perc*n);
+
+                if(k > n-1)
+                    k = n-1;
+                if(k < 0)
+                    k = 0;
+                if(n > 0)
+                    data.image[IDout].array.F[ii0+ii] = filter_select_float(col + ii*zsize, n, k);
+                else
+                    data.image[IDout].array.F[ii0+ii] = limit;
+            }
+        }
+
+        free(col);
+        free(cnt);
+# ifdef _OPENMP
+    }
+# endif
+
+    return(IDout);
+}
+
+
+
+long filter_CubePercentile(const char *IDcin_name, float perc, const char *IDout_name)
+{
+    return(filter_CubePercentile_tiled(IDcin_name, perc, 0, 0.0, IDout_name));
+}
+
+
+
 long filter_CubePercentileLimit(const char *IDcin_name, float perc, float limit, const char *IDout_name)
 {
-  long IDcin;
-  long IDout;
-  long xsize, ysize, zsize;
-  long ii,kk;
-  float *array;
-  long cnt;
-  float v1;
+    return(filter_CubePercentile_tiled(IDcin_name, perc, 1, limit, IDout_name));
+}
 
-  IDcin = image_ID(IDcin_name);
-  xsize = data.image[IDcin].md[0].size[0];
-  ysize = data.image[IDcin].md[0].size[1];
-  zsize = data.image[IDcin].md[0].size[2];
-  array = (float*) malloc(sizeof(float)*xsize*ysize);
 
-  IDout = create_2Dimage_ID(IDout_name, xsize, ysize);
-  for(ii=0;ii<xsize*ysize;ii++)
+
+
+FILTER_P2STATE *filter_P2_create(long NBpix, float perc)
+{
+    FILTER_P2STATE *p2;
+
+    p2 = (FILTER_P2STATE*) malloc(sizeof(FILTER_P2STATE));
+    p2->NBpix = NBpix;
+    p2->perc = perc;
+    p2->cnt = 0;
+    p2->q = (double*) malloc(sizeof(double)*5*NBpix);
+    p2->n = (long*) malloc(sizeof(long)*5*NBpix);
+
+    return(p2);
+}
+
+
+
+void filter_P2_free(FILTER_P2STATE *p2)
+{
+    if(p2 == NULL)
+        return;
+    free(p2->q);
+    free(p2->n);
+    free(p2);
+}
+
+
+
+// adds one frame (NBpix values) to estimator
+int filter_P2_update(FILTER_P2STATE *p2, const float *frame)
+{
+    long NBpix = p2->NBpix;
+    double p = p2->perc;
+    long c = p2->cnt;
+    long ii;
+    double np[5];
+
+
+    if(c < 5)
     {
-      cnt = 0;
-      for(kk=0;kk<zsize;kk++)
-	{
-	  v1 = data.image[IDcin].array.F[kk*xsize*ysize+ii];
-	  if(v1<limit)
-	    {
-	      array[cnt] = v1;
-	      cnt ++;
-	    }
-       
-	  if(cnt>0)
-	    {
-	      quick_sort_float(array,zsize);
-	      data.image[IDout].array.F[ii] = array[(long) (perc*cnt)];
-	    }
-	  else
-	    {
-	      data.image[IDout].array.F[ii] = limit;
-	    }
-	}
-    }  
-  
-  free(array);
+        // first 5 frames : keep sorted values
+        for(ii=0; ii<NBpix; ii++)
+        {
+            double *q = p2->q + 5*ii;
+            long i = c;
 
-  return(IDout);
+            while((i > 0)&&(q[i-1] > frame[ii]))
+            {
+                q[i] = q[i-1];
+                i--;
+            }
+            q[i] = frame[ii];
+            p2->n[5*ii+c] = c;
+        }
+        p2->cnt++;
+        return(0);
+    }
+
+    // desired marker positions after this frame
+    np[0] = 0.0;
+    np[1] = c*p/2.0;
+    np[2] = c*p;
+    np[3] = c*(1.0+p)/2.0;
+    np[4] = c;
+
+# ifdef _OPENMP
+    #pragma omp parallel for if (NBpix > 10000)
+# endif
+    for(ii=0; ii<NBpix; ii++)
+    {
+        double *q = p2->q + 5*ii;
+        long *n = p2->n + 5*ii;
+        double x = frame[ii];
+        long i, k;
+
+        if(x < q[0])
+        {
+            q[0] = x;
+            k = 0;
+        }
+        else if(x >= q[4])
+        {
+            q[4] = x;
+            k = 3;
+        }
+        else
+            for(k=0; x >= q[k+1]; k++) {}
+
+        for(i=k+1; i<5; i++)
+            n[i]++;
+
+        // adjust middle markers, piecewise-parabolic (else linear) prediction
+        for(i=1; i<4; i++)
+        {
+            double d = np[i] - n[i];
+
+            if( ((d >= 1.0)&&(n[i+1]-n[i] > 1)) || ((d <= -1.0)&&(n[i-1]-n[i] < -1)) )
+            {
+                int s = (d > 0.0) ? 1 : -1;
+                double qp;
+
+                qp = q[i] + 1.0*s/(n[i+1]-n[i-1]) * ( (n[i]-n[i-1]+s)*(q[i+1]-q[i])/(n[i+1]-n[i]) + (n[i+1]-n[i]-s)*(q[i]-q[i-1])/(n[i]-n[i-1]) );
+                if((qp <= q[i-1])||(qp >= q[i+1]))
+                    qp = q[i] + s*(q[i+s]-q[i])/(n[i+s]-n[i]);
+                q[i] = qp;
+                n[i] += s;
+            }
+        }
+    }
+    p2->cnt++;
+
+    return(0);
+}
+
+
+
+// current percentile estimate for each pixel
+int filter_P2_value(FILTER_P2STATE *p2, float *out)
+{
+    long ii;
+
+    for(ii=0; ii<p2->NBpix; ii++)
+    {
+        if(p2->cnt >= 5)
+            out[ii] = p2->q[5*ii+2];
+        else if(p2->cnt > 0)
+        {
+            long k = (long) (p2->perc*p2->cnt);
+
+            if(k > p2->cnt-1)
+                k = p2->cnt-1;
+            out[ii] = p2->q[5*ii+k];
+        }
+        else
+            out[ii] = 0.0;
+    }
+
+    return(0);
+}
+
+
+
+// approximate per-pixel percentile, single pass over frames
+long filter_CubePercentileApprox(const char *IDcin_name, float perc, const char *IDout_name)
+{
+    long IDcin, IDout;
+    long xysize, kk;
+    FILTER_P2STATE *p2;
+
+
+    IDcin = image_ID(IDcin_name);
+    if(IDcin == -1)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"image not found");
+        return(-1);
+    }
+    if((data.image[IDcin].md[0].naxis != 3)||(data.image[IDcin].md[0].atype != _DATATYPE_FLOAT))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"input must be FLOAT 3D image");
+        return(-1);
+    }
+    xysize = data.image[IDcin].md[0].size[0]*data.image[IDcin].md[0].size[1];
+
+    p2 = filter_P2_create(xysize, perc);
+    for(kk=0; kk<data.image[IDcin].md[0].size[2]; kk++)
+        filter_P2_update(p2, data.image[IDcin].array.F + kk*xysize);
+
+    IDout = create_2Dimage_ID(IDout_name, data.image[IDcin].md[0].size[0], data.image[IDcin].md[0].size[1]);
+    filter_P2_value(p2, data.image[IDout].array.F);
+    filter_P2_free(p2);
+
+    return(IDout);
 }
@@ -1,6 +1,16 @@
 #if !defined(FILTER_H)
 #define FILTER_H
 
+// per-pixel P2 percentile estimator, see filter_P2_create()
+typedef struct
+{
+    long NBpix;
+    float perc;
+    long cnt;          // number of frames added
+    double *q;         // 5 marker heights per pixel
+    long *n;           // 5 marker positions per pixel
+} FILTER_P2STATE;
+
 int init_image_filter();
 
 int median_filter(const char *ID_name, const char *out_name, int filter_size);
@@ -31,4 +41,14 @@ long filter_CubePercentile(const char *IDcin_name, float perc, const char *IDout
 
 long filter_CubePercentileLimit(const char *IDcin_name, float perc, float limit, const char *IDout_name);
 
+FILTER_P2STATE *filter_P2_create(long NBpix, float perc);
+
+void filter_P2_free(FILTER_P2STATE *p2);
+
+int filter_P2_update(FILTER_P2STATE *p2, const float *frame);
+
+int filter_P2_value(FILTER_P2STATE *p2, float *out);
+
+long filter_CubePercentileApprox(const char *IDcin_name, float perc, const char *IDout_name);
+
 #endif
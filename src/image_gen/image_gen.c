@@ -39,6 +39,10 @@
 
 #define PI 3.14159265358979323846264338328
 
+#define IMAGE_GEN_CACHE_NBENTRY 16                      // cached pupil images
+#define IMAGE_GEN_CACHE_MAXBYTES (256L*1024L*1024L)     // total cache size limit
+#define IMAGE_GEN_CACHE_KEYLEN 1024
+
 extern DATA data;
 
 
@@ -184,6 +188,13 @@ int_fast8_t image_gen_im2coord_cli(){
       return 0;}  else    return 1;}
 
 
+int_fast8_t image_gen_cache_free_cli()
+{
+  image_gen_cache_free();
+  return 0;
+}
+
+
 //long make_rnd(const char *ID_name, long l1, long l2, const char *options)
 
 
@@ -322,6 +333,15 @@ strcpy(data.cmd[data.NBcmd].key,"im2coord");
   strcpy(data.cmd[data.NBcmd].example,"im2coord imin 1 imy");
   strcpy(data.cmd[data.NBcmd].Ccall,"long image_gen_im2coord(const char *IDin_name, int axis, const char *IDout_name)");
   data.NBcmd++;
+
+  strcpy(data.cmd[data.NBcmd].key,"imgencachefree");
+  strcpy(data.cmd[data.NBcmd].module,__FILE__);
+  data.cmd[data.NBcmd].fp = image_gen_cache_free_cli;
+  strcpy(data.cmd[data.NBcmd].info,"free cached pupil images");
+  strcpy(data.cmd[data.NBcmd].syntax,"no argument");
+  strcpy(data.cmd[data.NBcmd].example,"imgencachefree");
+  strcpy(data.cmd[data.NBcmd].Ccall,"void image_gen_cache_free()");
+  data.NBcmd++;
   
   
 //long make_rnd(const char *ID_name, long l1, long l2, const char *options)
@@ -338,6 +358,192 @@ strcpy(data.cmd[data.NBcmd].key,"im2coord");
 
 
 
+/* =============================================================================================== */
+/*                                 PUPIL IMAGE CACHE                                               */
+/* =============================================================================================== */
+
+// pupil builders are often called repeatedly with the same arguments; the key string holds the
+// function name and all arguments, a hit returns a fresh copy of the cached pixels
+
+typedef struct
+{
+    char key[IMAGE_GEN_CACHE_KEYLEN];
+    long size[3];
+    float *array;
+    long long lastuse;
+} IMAGE_GEN_CACHE_ENTRY;
+
+static IMAGE_GEN_CACHE_ENTRY image_gen_cache[IMAGE_GEN_CACHE_NBENTRY];
+static long long image_gen_cache_cnt = 0;
+
+
+
+void image_gen_cache_free()
+{
+    int e;
+
+    for(e=0; e<IMAGE_GEN_CACHE_NBENTRY; e++)
+    {
+        free(image_gen_cache[e].array);
+        image_gen_cache[e].array = NULL;
+        image_gen_cache[e].key[0] = '\0';
+    }
+}
+
+
+
+// returns ID of new image IDname filled from cache, -1 if key is not cached
+static long image_gen_cache_get(const char *key, const char *IDname)
+{
+    long ID;
+    int e;
+
+    if(key[0] == '\0')
+        return(-1);
+
+    for(e=0; e<IMAGE_GEN_CACHE_NBENTRY; e++)
+        if((image_gen_cache[e].array != NULL)&&(strcmp(image_gen_cache[e].key, key) == 0))
+        {
+            IMAGE_GEN_CACHE_ENTRY *ce = &image_gen_cache[e];
+
+            if(ce->size[2] > 1)
+                ID = create_3Dimage_ID(IDname, ce->size[0], ce->size[1], ce->size[2]);
+            else
+                ID = create_2Dimage_ID(IDname, ce->size[0], ce->size[1]);
+            memcpy(data.image[ID].array.F, ce->array, sizeof(float)*ce->size[0]*ce->size[1]*ce->size[2]);
+            ce->lastuse = ++image_gen_cache_cnt;
+
+            return(ID);
+        }
+
+    return(-1);
+}
+
+
+
+// store copy of image ID under key, evicting least recently used entries
+static void image_gen_cache_put(const char *key, long ID)
+{
+    long size[3];
+    long nelem;
+    long total = 0;
+    int e, eput = -1;
+
+    if((key[0] == '\0')||(ID == -1)||(data.image[ID].md[0].atype != _DATATYPE_FLOAT))
+        return;
+
+    size[0] = data.image[ID].md[0].size[0];
+    size[1] = (data.image[ID].md[0].naxis > 1) ? data.image[ID].md[0].size[1] : 1;
+    size[2] = (data.image[ID].md[0].naxis > 2) ? data.image[ID].md[0].size[2] : 1;
+    nelem = size[0]*size[1]*size[2];
+    if(sizeof(float)*nelem > IMAGE_GEN_CACHE_MAXBYTES)
+        return;
+
+    for(e=0; e<IMAGE_GEN_CACHE_NBENTRY; e++)
+        if((image_gen_cache[e].array != NULL)&&(strcmp(image_gen_cache[e].key, key) == 0))
+        {
+            free(image_gen_cache[e].array);
+            image_gen_cache[e].array = NULL;
+        }
+
+    for(;;)
+    {
+        long long oldest = -1;
+        int eold = -1;
+
+        total = 0;
+        eput = -1;
+        for(e=0; e<IMAGE_GEN_CACHE_NBENTRY; e++)
+        {
+            IMAGE_GEN_CACHE_ENTRY *ce = &image_gen_cache[e];
+
+            if(ce->array == NULL)
+            {
+                if(eput == -1)
+                    eput = e;
+                continue;
+            }
+            total += sizeof(float)*ce->size[0]*ce->size[1]*ce->size[2];
+            if((eold == -1)||(ce->lastuse < oldest))
+            {
+                oldest = ce->lastuse;
+                eold = e;
+            }
+        }
+        if((eput != -1)&&(total + (long) sizeof(float)*nelem <= IMAGE_GEN_CACHE_MAXBYTES))
+            break;
+        free(image_gen_cache[eold].array);
+        image_gen_cache[eold].array = NULL;
+    }
+
+    image_gen_cache[eput].array = (float*) malloc(sizeof(float)*nelem);
+    if(image_gen_cache[eput].array == NULL)
+        return;
+    memcpy(image_gen_cache[eput].array, data.image[ID].array.F, sizeof(float)*nelem);
+    strcpy(image_gen_cache[eput].key, key);
+    image_gen_cache[eput].size[0] = size[0];
+    image_gen_cache[eput].size[1] = size[1];
+    image_gen_cache[eput].size[2] = size[2];
+    image_gen_cache[eput].lastuse = ++image_gen_cache_cnt;
+}
+
+
+
+
+/* =============================================================================================== */
+/*                                 ANALYTIC EDGE COVERAGE                                          */
+/* =============================================================================================== */
+
+//
+// fraction of the unit pixel on the inside of a straight edge
+// t      : distance from pixel center to edge, > 0 if center is inside
+// nx, ny : unit normal to the edge
+//
+static inline double image_gen_edge_coverage(double t, double nx, double ny)
+{
+    double a = fabs(nx);
+    double b = fabs(ny);
+    double h, l;
+
+    if(b > a)
+    {
+        h = a;
+        a = b;
+        b = h;
+    }
+    h = 0.5*(a+b);  // half-extent of pixel along normal
+    l = 0.5*(a-b);  // half-extent of the linear part
+
+    if(t >= h)
+        return(1.0);
+    if(t <= -h)
+        return(0.0);
+    if(t > l)
+        return(1.0 - (h-t)*(h-t)/(2.0*a*b));
+    if(t < -l)
+        return((h+t)*(h+t)/(2.0*a*b));
+
+    return(0.5 + t/a);
+}
+
+
+
+// bounding box [*i0,*i1) of a centered shape of radius rad, clipped to [0,n)
+static void image_gen_bbox(double c, double rad, long n, long *i0, long *i1)
+{
+    *i0 = (long) floor(c-rad-1.0);
+    *i1 = (long) ceil(c+rad+2.0);
+    if(*i0 < 0)
+        *i0 = 0;
+    if(*i1 > n)
+        *i1 = n;
+    if(*i1 < *i0)
+        *i1 = *i0;
+}
+
+
+
+
 long make_double_star(const char *ID_name, long l1, long l2, double intensity_1, double intensity_2, double separation, double position_angle) /* creates a double star */
 {
   long ID;
@@ -496,184 +702,44 @@ long make_disk(const char *ID_name, long l1, long l2, double x_center, double y_
 long make_subpixdisk(const char *ID_name, long l1, long l2, double x_center, double y_center, double radius) // creates a disk
 {
     long ID;
-    long ii,jj;
-    long naxes[2];
-    int i,j;
-    double r;
-    double tot;
-    int subgrid=55;
-    double grid[55]; // same number of points as subgrid
-    double x,y;
-    long x1,x2,y1,y2;
-    long x1i,x2i,y1i,y2i;
-    double r2,r2ref;
-    double xdiff,ydiff;
-    double subgrid2;
+    long jj;
+    long x1, x2, y1, y2;
+    char key[IMAGE_GEN_CACHE_KEYLEN];
 
-    create_2Dimage_ID(ID_name,l1,l2);
-    ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
+    snprintf(key, IMAGE_GEN_CACHE_KEYLEN, "subpixdisk %ld %ld %.17g %.17g %.17g", l1, l2, x_center, y_center, radius);
+    if((ID = image_gen_cache_get(key, ID_name)) != -1)
+        return(ID);
 
-    x1 = (long) (x_center-radius-2);
-    x2 = (long) (x_center+radius+2);
-    y1 = (long) (y_center-radius-2);
-    y2 = (long) (y_center+radius+2);
-    x1i = (long) (x_center-0.707106781*radius+2);
-    x2i = (long) (x_center+0.707106781*radius-2);
-    y1i = (long) (y_center-0.707106781*radius+2);
-    y2i = (long) (y_center+0.707106781*radius-2);
-
-
-    if(x1<0)
-        x1 = 0;
-    if(x1>naxes[0])
-        x1 = naxes[0];
-    if(x2<0)
-        x2 = 0;
-    if(x2>naxes[0])
-        x2 = naxes[0];
-
-    if(y1<0)
-        y1 = 0;
-    if(y1>naxes[1])
-        y1 = naxes[1];
-    if(y2<0)
-        y2 = 0;
-    if(y2>naxes[1])
-        y2 = naxes[1];
-
-    if(x1i<0)
-        x1i = 0;
-    if(x1i>naxes[0]-1)
-        x1i = naxes[0]-1;
-    if(x2i<0)
-        x2i = 0;
-    if(x2i>naxes[0]-1)
-        x2i = naxes[0]-1;
-
-    if(y1i<0)
-        y1i = 0;
-    if(y1i>naxes[1]-1)
-        y1i = naxes[1]-1;
-    if(y2i<0)
-        y2i = 0;
-    if(y2i>naxes[1]-1)
-        y2i = naxes[1]-1;
-
-
-    r2ref = radius*radius;
-    subgrid2 = subgrid*subgrid;
-
-
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y1i; jj < y2i; jj++)
-            data.image[ID].array.F[jj*naxes[0]+ii] = 1;
-
-    for (i = 0; i < subgrid; i++)
-        grid[i] = (0.5-0.5/subgrid-1.0*i/subgrid);
-
-    for (ii = x1; ii < x1i; ii++)
-        for (jj = y1; jj < y2; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
-            {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        r = x*x+y*y;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
-            }
-        }
+    ID = create_2Dimage_ID(ID_name, l1, l2);
 
+    image_gen_bbox(x_center, radius, l1, &x1, &x2);
+    image_gen_bbox(y_center, radius, l2, &y1, &y2);
 
-    for (ii = x2i; ii < x2; ii++)
-        for (jj = y1; jj < y2; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
-            {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        r = x*x+y*y;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
-            }
-        }
+    // pixels crossed by the edge get their analytic coverage, edge locally straight
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for if ((y2-y1)*(x2-x1) > OMP_NELEMENT_LIMIT/10)
+# endif
+    for(jj = y1; jj < y2; jj++)
+    {
+        float *row = data.image[ID].array.F + jj*l1;
+        double dy = jj - y_center;
+        long ii;
 
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y1; jj < y1i; jj++)
+        #pragma omp simd
+        for(ii = x1; ii < x2; ii++)
         {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
-            {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        r = x*x+y*y;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
-            }
-        }
-
+            double dx = ii - x_center;
+            double r = sqrt(dx*dx + dy*dy);
+            double t = radius - r;
 
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y2i; jj < y2; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
-            {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        r = x*x+y*y;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
-            }
+            if(r < 1.0e-12)
+                row[ii] = image_gen_edge_coverage(t, 1.0, 0.0);
+            else
+                row[ii] = image_gen_edge_coverage(t, dx/r, dy/r);
         }
+    }
+
+    image_gen_cache_put(key, ID);
 
     return(ID);
 }
@@ -686,24 +752,11 @@ long make_subpixdisk(const char *ID_name, long l1, long l2, double x_center, dou
 long make_subpixdisk_perturb(const char *ID_name, long l1, long l2, double x_center, double y_center, double radius, long n, double *ra, double *ka, double *pa)
 {
     long ID;
-    long ii,jj;
-    long naxes[2];
-    int i,j;
-    double r;
-    double tot;
-    int subgrid=55;
-    double grid[55]; // same number of points as subgrid
-    double x,y;
-    long x1,x2,y1,y2;
-    long x1i,x2i,y1i,y2i;
-    double r2,r2ref;
-    double xdiff,ydiff;
-    double subgrid2;
-    double PA;
-    double v0;
-    long k;
-
+    long jj, k;
+    long x1, x2, y1, y2;
     double radius1, radius2;
+    char key[IMAGE_GEN_CACHE_KEYLEN];
+    int keylen;
 
     radius1 = radius;
     radius2 = radius;
@@ -714,219 +767,63 @@ long make_subpixdisk_perturb(const char *ID_name, long l1, long l2, double x_cen
     if(radius2<0.0)
         radius2 = 0.0;
 
-    create_2Dimage_ID(ID_name,l1,l2);
-    ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
+    keylen = snprintf(key, IMAGE_GEN_CACHE_KEYLEN, "subpixdisk_perturb %ld %ld %.17g %.17g %.17g %ld", l1, l2, x_center, y_center, radius, n);
+    for(k=0; (k<n)&&(keylen<IMAGE_GEN_CACHE_KEYLEN); k++)
+        keylen += snprintf(key+keylen, IMAGE_GEN_CACHE_KEYLEN-keylen, " %.17g %.17g %.17g", ra[k], ka[k], pa[k]);
+    if(keylen >= IMAGE_GEN_CACHE_KEYLEN)
+        key[0] = '\0';    // too many terms to cache
+    if((ID = image_gen_cache_get(key, ID_name)) != -1)
+        return(ID);
 
-    x1 = (long) (x_center-radius1-2);
-    x2 = (long) (x_center+radius1+2);
-    y1 = (long) (y_center-radius1-2);
-    y2 = (long) (y_center+radius1+2);
-    x1i = (long) (x_center-0.707106781*radius2+2);
-    x2i = (long) (x_center+0.707106781*radius2-2);
-    y1i = (long) (y_center-0.707106781*radius2+2);
-    y2i = (long) (y_center+0.707106781*radius2-2);
-
-
-    if(x1<0)
-        x1 = 0;
-    if(x1>naxes[0])
-        x1 = naxes[0];
-    if(x2<0)
-        x2 = 0;
-    if(x2>naxes[0])
-        x2 = naxes[0];
-
-    if(y1<0)
-        y1 = 0;
-    if(y1>naxes[1])
-        y1 = naxes[1];
-    if(y2<0)
-        y2 = 0;
-    if(y2>naxes[1])
-        y2 = naxes[1];
-
-    if(x1i<0)
-        x1i = 0;
-    if(x1i>naxes[0]-1)
-        x1i = naxes[0]-1;
-    if(x2i<0)
-        x2i = 0;
-    if(x2i>naxes[0]-1)
-        x2i = naxes[0]-1;
-
-    if(y1i<0)
-        y1i = 0;
-    if(y1i>naxes[1]-1)
-        y1i = naxes[1]-1;
-    if(y2i<0)
-        y2i = 0;
-    if(y2i>naxes[1]-1)
-        y2i = naxes[1]-1;
-
-
-    r2ref = radius*radius;
-    subgrid2 = subgrid*subgrid;
-
-
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y1i; jj < y2i; jj++)
-            data.image[ID].array.F[jj*naxes[0]+ii] = 1;
-
-    for (i = 0; i < subgrid; i++)
-        grid[i] = (0.5-0.5/subgrid-1.0*i/subgrid);
-
-    for (ii = x1; ii < x1i; ii++)
-        for (jj = y1; jj < y2; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            PA = atan2(ydiff, xdiff);
-            r2 = xdiff*xdiff+ydiff*ydiff;
+    ID = create_2Dimage_ID(ID_name, l1, l2);
 
-            v0 = radius;
-            for(k=0; k<n; k++)
-                v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-            r2ref = v0*v0;
-
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
-            {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        PA = atan2(y,x);
-                        r = x*x+y*y;
-
-                        v0 = radius;
-                        for(k=0; k<n; k++)
-                            v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-                        r2ref = v0*v0;
-
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
-            }
-        }
+    image_gen_bbox(x_center, radius1, l1, &x1, &x2);
+    image_gen_bbox(y_center, radius1, l2, &y1, &y2);
 
+    // signed distance to contour r = R(PA), from the gradient of r - R(PA)
+# ifdef HAVE_LIBGOMP
+    #pragma omp parallel for schedule(dynamic) if ((y2-y1)*(x2-x1) > OMP_NELEMENT_LIMIT/100)
+# endif
+    for(jj = y1; jj < y2; jj++)
+    {
+        float *row = data.image[ID].array.F + jj*l1;
+        double ydiff = y_center - jj;
+        long ii, kk;
 
-    for (ii = x2i; ii < x2; ii++)
-        for (jj = y1; jj < y2; jj++)
+        for(ii = x1; ii < x2; ii++)
         {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            PA = atan2(ydiff, xdiff);
-            r2 = xdiff*xdiff+ydiff*ydiff;
+            double xdiff = x_center - ii;
+            double r = sqrt(xdiff*xdiff + ydiff*ydiff);
+            double PA, R, dR, g;
 
-            v0 = radius;
-            for(k=0; k<n; k++)
-                v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-            r2ref = v0*v0;
-
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
+            if(r < radius2-1.0)
             {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        r = x*x+y*y;
-                        PA = atan2(y,x);
-                        v0 = radius;
-                        for(k=0; k<n; k++)
-                            v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-                        r2ref = v0*v0;
-
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
+                row[ii] = 1.0;
+                continue;
             }
-        }
+            if(r > radius1+1.0)
+                continue;
 
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y1; jj < y1i; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            PA = atan2(ydiff,xdiff);
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            v0 = radius;
-            for(k=0; k<n; k++)
-                v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-            r2ref = v0*v0;
-
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
+            PA = atan2(ydiff, xdiff);
+            R = radius;
+            dR = 0.0;
+            for(kk=0; kk<n; kk++)
             {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        PA = atan2(y,x);
-                        r = x*x+y*y;
-                        v0 = radius;
-                        for(k=0; k<n; k++)
-                            v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-                        r2ref = v0*v0;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
+                R += radius*ra[kk]*cos(ka[kk]*PA + pa[kk]);
+                dR -= radius*ra[kk]*ka[kk]*sin(ka[kk]*PA + pa[kk]);
             }
-        }
-
-
-    for (ii = x1i; ii < x2i; ii++)
-        for (jj = y2i; jj < y2; jj++)
-        {
-            xdiff = x_center-ii;
-            ydiff = y_center-jj;
-            PA = atan2(ydiff, xdiff);
-            r2 = xdiff*xdiff+ydiff*ydiff;
-            v0 = radius;
-            for(k=0; k<n; k++)
-                v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-            r2ref = v0*v0;
-
-            if(r2<r2ref)
-                data.image[ID].array.F[jj*naxes[0]+ii] = 1.0;
-            if(fabs(sqrt(r2)-sqrt(r2ref))<1.5)
+            if(r < 1.0e-12)
             {
-                tot = 0;
-                for (j = 0; j < subgrid; j++)
-                    for (i = 0; i < subgrid; i++)
-                    {
-                        x = xdiff+grid[i];
-                        y = ydiff+grid[j];
-                        PA = atan2(y,x);
-                        r = x*x+y*y;
-                        v0 = radius;
-                        for(k=0; k<n; k++)
-                            v0 += radius*ra[k]*cos(ka[k]*PA + pa[k]);
-                        r2ref = v0*v0;
-                        if (r < r2ref)
-                            tot += 1.0;
-                    }
-                tot = tot/subgrid2;
-                data.image[ID].array.F[jj*naxes[0]+ii] = tot;
+                row[ii] = image_gen_edge_coverage(R, 1.0, 0.0);
+                continue;
             }
+            dR /= r;
+            g = sqrt(1.0 + dR*dR);
+            row[ii] = image_gen_edge_coverage((R-r)/g, (xdiff + dR*ydiff)/(r*g), (ydiff - dR*xdiff)/(r*g));
         }
+    }
+
+    image_gen_cache_put(key, ID);
 
     return(ID);
 }
@@ -1039,13 +936,60 @@ long make_lincoordinate(const char *IDname, long l1, long l2, double x_center, d
 }
 
 
+// make_hexagon() pixel value, x y relative to center
+static inline float image_gen_hexagon_pixel(float x, float y, float radius, float radius0sq)
+{
+    float value = 1.0;
+    float r;
+
+    if(x*x+y*y > radius0sq)
+    {
+        r = y;
+        if(fabs(r)>radius)
+            value = 0.0;
+        else
+        {
+            r = cos(PI/6.0)*x + sin(PI/6.0)*y;
+            if(fabs(r)>radius)
+                value = 0.0;
+            else
+            {
+                r = cos(-PI/6.0)*x + sin(-PI/6.0)*y;
+                if(fabs(r)>radius)
+                    value = 0.0;
+            }
+        }
+    }
+
+    return(value);
+}
+
+
+
+// pixel range [*i0,*i1) scanned by make_hexagon()
+static void image_gen_hexagon_bbox(double c, float radius1, long n, long *i0, long *i1)
+{
+    *i0 = (long) (c - radius1 - 1.0);
+    if(*i0<0)
+        *i0 = 0;
+    if(*i0>n-1)
+        *i0 = n-1;
+
+    *i1 = (long) (c + radius1 + 1.0);
+    if(*i1<0)
+        *i1 = 0;
+    if(*i1>n-1)
+        *i1 = n-1;
+}
+
+
+
 long make_hexagon(const char *IDname, long l1, long l2, double x_center, double y_center, double radius)
 {
     long ID;
     long ii,jj;
     long naxes[2];
-    float x, y, r;
-    float value;
+    float x, y;
 
 	long iimin, iimax, jjmin, jjmax;
 	float radius1, radius0sq;
@@ -1060,32 +1004,11 @@ long make_hexagon(const char *IDname, long l1, long l2, double x_center, double
     naxes[0] = data.image[ID].md[0].size[0];
     naxes[1] = data.image[ID].md[0].size[1];
 
-	iimin = (long) (x_center - radius1 - 1.0);
-	if(iimin<0)
-		iimin = 0;
-	if(iimin>l1-1)
-		iimin = l1-1;
-	
-	iimax = (long) (x_center + radius1 + 1.0);
-	if(iimax<0)
-		iimax = 0;
-	if(iimax>l1-1)
-		iimax = l1-1;
-	
-	jjmin = (long) (y_center - radius1 - 1.0);
-	if(jjmin<0)
-		jjmin = 0;
-	if(jjmin>l2-1)
-		jjmin = l2-1;
-	
-	jjmax = (long) (y_center + radius1 + 1.0);
-	if(jjmax<0)
-		jjmax = 0;
-	if(jjmax>l2-1)
-		jjmax = l2-1;
+	image_gen_hexagon_bbox(x_center, radius1, l1, &iimin, &iimax);
+	image_gen_hexagon_bbox(y_center, radius1, l2, &jjmin, &jjmax);
 	
 	# ifdef HAVE_LIBGOMP
-    #pragma omp parallel default(shared) private(ii, jj, value, x, y, r)
+    #pragma omp parallel default(shared) private(ii, jj, x, y)
     {
         #pragma omp for
 # endif
@@ -1094,29 +1017,9 @@ long make_hexagon(const char *IDname, long l1, long l2, double x_center, double
     for (jj = jjmin; jj < jjmax; jj++)
         for (ii = iimin; ii < iimax; ii++)
         {
-            value = 1.0;
             x = 1.0*ii-x_center;
             y = 1.0*jj-y_center;
-
-			if(x*x+y*y > radius0sq)
-			{
-				r = y;
-				if(fabs(r)>radius)
-					value = 0.0;
-				else
-				{
-					r = cos(PI/6.0)*x + sin(PI/6.0)*y;
-					if(fabs(r)>radius)
-						value = 0.0;
-					else
-					{
-						r = cos(-PI/6.0)*x + sin(-PI/6.0)*y;
-						if(fabs(r)>radius)
-							value = 0.0;
-					}
-				}
-			}
-            data.image[ID].array.F[jj*naxes[0]+ii] = value;
+            data.image[ID].array.F[jj*naxes[0]+ii] = image_gen_hexagon_pixel(x, y, radius, radius0sq);
         }
 # ifdef HAVE_LIBGOMP
     }
@@ -1254,10 +1157,15 @@ long IMAGE_gen_segments2WFmodes(const char *prefix, long ndigit, const char *IDo
 
 long make_hexsegpupil(const char *IDname, long size, double radius, double gap, double step)
 {
-    long ID,ID1,IDp;
+    long ID,IDp;
     long x1, y1;
     double x2,y2;
-    long IDdisk;
+    int sub;
+    double diskc, diskr2;
+    double hexrad, hexrad0sq;
+    float hexrad1;
+    char key[IMAGE_GEN_CACHE_KEYLEN];
+    char keyif[IMAGE_GEN_CACHE_KEYLEN+20];
     long ii;
     double tot = 0.0;
     long size2;
@@ -1270,9 +1178,8 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
 
     int mkInfluenceFunctions = 1;
     long IDif;
-    int seg;
+    long seg;
     long kk, jj;
-    float xc, yc, tc;
 
     int WriteCIF = 0;
     FILE *fpmlevel;
@@ -1300,7 +1207,7 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
     int bitindex = 4; // 0 = MSB
 
 
-	double vx, vy, rmsx, rmsy;
+	double vx, vy;
 	
 
 
@@ -1393,102 +1300,48 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
     }
 
 
+    // segment map and influence functions only depend on arguments without piston error
+    key[0] = '\0';
+    if((PISTONerr == 0)&&(WriteCIF == 0))
+        snprintf(key, IMAGE_GEN_CACHE_KEYLEN, "hexsegpupil %ld %.17g %.17g %.17g %d", size, radius, gap, step, mkInfluenceFunctions);
+    if((ID = image_gen_cache_get(key, IDname)) != -1)
+    {
+        sprintf(keyif, "%s hexpupif", key);
+        if((mkInfluenceFunctions == 0)||(image_gen_cache_get(keyif, "hexpupif") != -1))
+        {
+            free(seglevel);
+            free(bitval);
+            return(ID);
+        }
+    }
+
     create_2Dimage_ID(IDname,size,size);
     ID = image_ID(IDname);
     if(PISTONerr == 1)
         IDp = create_2Dimage_ID("hexpupPha",size,size);
 
-    IDdisk = make_disk("_TMPdisk",size,size,size/2,size/2,radius);
-    for(ii=0; ii<size2; ii++)
-        data.image[IDdisk].array.F[ii] = 1.0-data.image[IDdisk].array.F[ii];
+    // disk complement as in make_disk("_TMPdisk", size, size, size/2, size/2, radius)
+    diskc = 1.0*(size/2);
+    diskr2 = radius*radius;
+    hexrad = (step-gap)*(sqrt(3.0)/2.0);
+    hexrad1 = hexrad*2.0/sqrt(3.0);
+    hexrad0sq = hexrad*hexrad;
 
 
     SEGcnt = 0;
     for(x1 = -(long) (2*size/step); x1 < (long) (2*size/step); x1++)
         for(y1 = -(long) (2*size/step); y1 < (long) (2*size/step); y1++)
-        {
-            x2 = step*x1*3;
-            y2 = step*sqrt(3.0)*y1;
-
-            if(sqrt(x2*x2+y2*y2)<radius)
+            for(sub = 0; sub < 2; sub++) // two interleaved hexagon lattices
             {
-                if(errSEGindex==-1)
-                {
-                    piston = pampl*(1.0-2.0*ran1());
-                }
-                else
-                {
-                    if(errSEGindex==SEGcnt)
-                    {
-                        piston = pampl;
-                    }
-                    else
-                        piston = 0.0;
-                }
-                printf("Hexagon %ld: ", SEGcnt);
-                ID1 = make_hexagon("_TMPhex", size, size, 0.5*size+x2, 0.5*size+y2, (step-gap)*(sqrt(3.0)/2.0));
-
-
-
-                tot = 0.0;
-                for(ii=0; ii<size2; ii++)
-                    tot += data.image[ID1].array.F[ii]*data.image[IDdisk].array.F[ii];
-                if(tot<0.1)
-                {
-                    SEGcnt++;
-                    if(WriteCIF==1)
-                    {
-                        ii = (long) (0.5*size1 + x2*(0.5*size1/radius)*mapscalefactor);
-                        jj = (long) (0.5*size1 + y2*(0.5*size1/radius)*mapscalefactor);
-                        index = 0;
-                        if(IDmap1 != -1)
-                            index = data.image[IDmap1].array.UI16[jj*size1+ii];
-
-
-                      //  fprintf(fp, "# hex%03ld     index%03ld   [ %f %f ] -> [ %f %f ]     [%4ld %4ld] %f\n", SEGcnt, index, x2, y2, 0.5*size+x2, 0.5*size+y2, ii, jj, radius);
-                        if(bitval[index-1]==1)
-                        {
-                            fprintf(fp, "L %ld;\n", seglevel[index-1]);
-                        fprintf(fp, "P");
-                        for(pt=0; pt<6; pt++)
-                        {
-                            x = pixscale*(x2 + 1.0*cos(2.0*M_PI*pt/6)*(step-gap));
-                            y = pixscale*(y2 + 1.0*sin(2.0*M_PI*pt/6)*(step-gap));
-                            fprintf(fp, " %ld,%ld", (long) (100.0*x), (long) (100.0*y));
-                            fprintf(fp1, "%ld %ld\n", (long) (100.0*x), (long) (100.0*y));
-
-                        }
-                        fprintf(fp, ";\n");
-                    }
-                    }
-
-                    if(PISTONerr==1)
-                    {
-                        for(ii=0; ii<size2; ii++)
-                            data.image[ID].array.F[ii] += data.image[ID1].array.F[ii];
-                    }
-                    else
-                    {
-                        for(ii=0; ii<size2; ii++)
-                            data.image[ID].array.F[ii] += 1.0*SEGcnt*data.image[ID1].array.F[ii];
-                    }
-
-                    if(PISTONerr == 1)
-                    {
-                        for(ii=0; ii<size2; ii++)
-                            data.image[IDp].array.F[ii] += data.image[ID1].array.F[ii]*piston;
-                    }
-                }
-                delete_image_ID("_TMPhex");
-            }
+                long iimin, iimax, jjmin, jjmax;
+                double hxc, hyc;
 
+                x2 = step*x1*3 + sub*step*1.5;
+                y2 = step*sqrt(3.0)*y1 + sub*step*sqrt(3.0)/2.0;
 
+                if(sqrt(x2*x2+y2*y2) >= radius)
+                    continue;
 
-            x2 += step*1.5;
-            y2 += step*sqrt(3.0)/2.0;
-            if(sqrt(x2*x2+y2*y2)<radius)
-            {
-                // piston = pampl*(1.0-2.0*ran1());
                 if(errSEGindex==-1)
                 {
                     piston = pampl*(1.0-2.0*ran1());
@@ -1503,27 +1356,33 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
                         piston = 0.0;
                 }
                 printf("Hexagon %ld: ", SEGcnt);
-                ID1 = make_hexagon("_TMPhex",size, size, 0.5*size+x2, 0.5*size+y2, (step-gap)*(sqrt(3.0)/2.0));
+                hxc = 0.5*size+x2;
+                hyc = 0.5*size+y2;
+                printf("Making hexagon at %f x %f\n", hxc, hyc);
+
+                // hexagon pixels are only scanned in the hexagon bounding box
+                image_gen_hexagon_bbox(hxc, hexrad1, size, &iimin, &iimax);
+                image_gen_hexagon_bbox(hyc, hexrad1, size, &jjmin, &jjmax);
+
                 tot = 0.0;
-                for(ii=0; ii<size2; ii++)
-                    tot += data.image[ID1].array.F[ii]*data.image[IDdisk].array.F[ii];
-                if(tot<0.1)
+                for(jj=jjmin; jj<jjmax; jj++)
+                    for(ii=iimin; ii<iimax; ii++)
+                        if((ii-diskc)*(ii-diskc)+(jj-diskc)*(jj-diskc) >= diskr2)
+                            tot += image_gen_hexagon_pixel(1.0*ii-hxc, 1.0*jj-hyc, hexrad, hexrad0sq);
+                if(tot >= 0.1)
+                    continue;
+
+                SEGcnt++;
+                if(WriteCIF==1)
                 {
-                    SEGcnt++;
+                    ii = (long) (0.5*size1 + x2*(0.5*size1/radius)*mapscalefactor);
+                    jj = (long) (0.5*size1 + y2*(0.5*size1/radius)*mapscalefactor);
+                    index = 0;
+                    if(IDmap1 != -1)
+                        index = data.image[IDmap1].array.UI16[jj*size1+ii];
 
-                    if(WriteCIF==1)
+                    if(bitval[index-1]==1)
                     {
-                        ii = (long) (0.5*size1 + x2*(0.5*size1/radius)*mapscalefactor);
-                        jj = (long) (0.5*size1 + y2*(0.5*size1/radius)*mapscalefactor);
-                        index = 0;
-                        if(IDmap1 != -1)
-                            index = data.image[IDmap1].array.UI16[jj*size1+ii];
-
-
-                       // fprintf(fp, "# hex%03ld     index%03ld   [ %f %f ] -> [ %f %f ]   [%4ld %4ld] %f\n", SEGcnt, index, x2, y2, 0.5*size+x2, 0.5*size+y2, ii, jj, radius);
-
-                        if(bitval[index-1]==1)
-                        {
                         fprintf(fp, "L %ld;\n", seglevel[index-1]);
                         fprintf(fp, "P");
                         for(pt=0; pt<6; pt++)
@@ -1534,31 +1393,24 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
                             fprintf(fp1, "%ld %ld\n", (long) (100.0*x), (long) (100.0*y));
                         }
                         fprintf(fp, ";\n");
-                        }
                     }
+                }
 
-                    if(PISTONerr==1)
+                for(jj=jjmin; jj<jjmax; jj++)
+                    for(ii=iimin; ii<iimax; ii++)
                     {
-                        for(ii=0; ii<size2; ii++)
-                            data.image[ID].array.F[ii] += data.image[ID1].array.F[ii];
-                    }
-                    else
-                        for(ii=0; ii<size2; ii++)
-                            data.image[ID].array.F[ii] += 1.0*SEGcnt*data.image[ID1].array.F[ii];
+                        float value = image_gen_hexagon_pixel(1.0*ii-hxc, 1.0*jj-hyc, hexrad, hexrad0sq);
 
-                    if(PISTONerr == 1)
-                    {
-                        for(ii=0; ii<size2; ii++)
-                            data.image[IDp].array.F[ii] += data.image[ID1].array.F[ii]*piston;
+                        if(PISTONerr==1)
+                        {
+                            data.image[ID].array.F[jj*size+ii] += value;
+                            data.image[IDp].array.F[jj*size+ii] += value*piston;
+                        }
+                        else
+                            data.image[ID].array.F[jj*size+ii] += 1.0*SEGcnt*value;
                     }
-                }
-                delete_image_ID("_TMPhex");
             }
 
-
-        }
-    delete_image_ID("_TMPdisk");
-    
     printf("%ld segments\n",SEGcnt);
   
 
@@ -1578,56 +1430,74 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
 
     if(mkInfluenceFunctions==1) // TT and focus for each segment
     {
-		
+        // pixels are assigned to segments in a single pass over the map
+        long *pixseg = (long*) malloc(sizeof(long)*size2);
+        double *segxc = (double*) calloc(SEGcnt+1, sizeof(double));
+        double *segyc = (double*) calloc(SEGcnt+1, sizeof(double));
+        double *segtc = (double*) calloc(SEGcnt+1, sizeof(double));
+        double *segrmsx = (double*) calloc(SEGcnt+1, sizeof(double));
+        double *segrmsy = (double*) calloc(SEGcnt+1, sizeof(double));
+
         IDif = create_3Dimage_ID("hexpupif", size, size, 3*SEGcnt);
-        for(seg=0; seg<SEGcnt; seg++)
-        {
-			
-            // piston
-            kk = 3*seg;
-            xc = 0.0;
-            yc = 0.0;
-            tc = 0.0;
+
+        for(jj=0; jj<size; jj++)
             for(ii=0; ii<size; ii++)
-                for(jj=0; jj<size; jj++)
+            {
+                float v = data.image[ID].array.F[jj*size+ii];
+
+                seg = (long) (v+0.5) - 1;
+                if((seg < 0)||(seg >= SEGcnt)||(fabs(v-(seg+1.0)) >= 0.01))
+                    seg = -1;
+                pixseg[jj*size+ii] = seg;
+                if(seg != -1)
                 {
-                    if(fabs(data.image[ID].array.F[jj*size+ii]-(seg+1.0))<0.01)
-                    {
-                        data.image[IDif].array.F[kk*size2+jj*size+ii] = 1.0;
-                        xc += 1.0*ii;
-                        yc += 1.0*jj;
-                        tc += 1.0;
-                    }
+                    segxc[seg] += 1.0*ii;
+                    segyc[seg] += 1.0*jj;
+                    segtc[seg] += 1.0;
                 }
-            xc /= tc;
-            yc /= tc;
-
+            }
+        for(seg=0; seg<SEGcnt; seg++)
+        {
+            segxc[seg] /= segtc[seg];
+            segyc[seg] /= segtc[seg];
+        }
 
-            // tip and tilt
-            rmsx = 0.0;
-            rmsy = 0.0;
+        // piston, tip and tilt
+        for(jj=0; jj<size; jj++)
             for(ii=0; ii<size; ii++)
-                for(jj=0; jj<size; jj++)
+                if((seg = pixseg[jj*size+ii]) != -1)
                 {
-                    if(fabs(data.image[ID].array.F[jj*size+ii]-(seg+1.0))<0.01)
-                    {
-						vx = 1.0*ii-xc;
-                        data.image[IDif].array.F[(kk+1)*size2+jj*size+ii] = vx;
-						rmsx += vx*vx;
-						
-						vy = 1.0*jj-yc;
-                        data.image[IDif].array.F[(kk+2)*size2+jj*size+ii] = vy;
-                        rmsy += vy*vy;
-                    }
+                    kk = 3*seg;
+                    vx = 1.0*ii-segxc[seg];
+                    vy = 1.0*jj-segyc[seg];
+                    data.image[IDif].array.F[kk*size2+jj*size+ii] = 1.0;
+                    data.image[IDif].array.F[(kk+1)*size2+jj*size+ii] = vx;
+                    data.image[IDif].array.F[(kk+2)*size2+jj*size+ii] = vy;
+                    segrmsx[seg] += vx*vx;
+                    segrmsy[seg] += vy*vy;
                 }
-            for(ii=0;ii<size2;ii++)
-			{
-				data.image[IDif].array.F[(kk+1)*size2+ii] *= sqrt(tc/rmsx);
-				data.image[IDif].array.F[(kk+2)*size2+ii] *= sqrt(tc/rmsy);
-			}
-            
+        for(ii=0; ii<size2; ii++)
+            if((seg = pixseg[ii]) != -1)
+            {
+                kk = 3*seg;
+                data.image[IDif].array.F[(kk+1)*size2+ii] *= sqrt(segtc[seg]/segrmsx[seg]);
+                data.image[IDif].array.F[(kk+2)*size2+ii] *= sqrt(segtc[seg]/segrmsy[seg]);
+            }
+
+        free(pixseg);
+        free(segxc);
+        free(segyc);
+        free(segtc);
+        free(segrmsx);
+        free(segrmsy);
+
+        if(key[0] != '\0')
+        {
+            sprintf(keyif, "%s hexpupif", key);
+            image_gen_cache_put(keyif, IDif);
         }
     }
+    image_gen_cache_put(key, ID);
 
     return(ID);
 }
@@ -1640,20 +1510,47 @@ long make_hexsegpupil(const char *IDname, long size, double radius, double gap,
 long make_jacquinot_pupil(const char *ID_name, long l1, long l2, double x_center, double y_center, double width, double height)
 {
   long ID;
-  long ii,jj;
-  long naxes[2];
+  long jj;
+  char key[IMAGE_GEN_CACHE_KEYLEN];
 
-  create_2Dimage_ID(ID_name,l1,l2);
-  ID = image_ID(ID_name);
-  naxes[0] = data.image[ID].md[0].size[0];
-  naxes[1] = data.image[ID].md[0].size[1]; 
-  
-  for (jj = 0; jj < naxes[1]; jj++) 
-    for (ii = 0; ii < naxes[0]; ii++)
-      { 
-	if ((fabs(jj-y_center)/height)<exp(-((ii-x_center)*(ii-x_center)/width/width)))
-	  data.image[ID].array.F[jj*naxes[0]+ii] = 1;
-      } 
+  snprintf(key, IMAGE_GEN_CACHE_KEYLEN, "jacquinot_pupil %ld %ld %.17g %.17g %.17g %.17g", l1, l2, x_center, y_center, width, height);
+  if((ID = image_gen_cache_get(key, ID_name)) != -1)
+    return(ID);
+
+  ID = create_2Dimage_ID(ID_name, l1, l2);
+
+  // |y| < height*exp(-x^2/width^2): exact coverage along y, 4 samples along x
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel for if (l1*l2 > OMP_NELEMENT_LIMIT/10)
+# endif
+  for (jj = 0; jj < l2; jj++)
+    {
+      float *row = data.image[ID].array.F + jj*l1;
+      double dy = jj - y_center;
+      long ii;
+
+      if(fabs(dy)-0.5 >= height)
+        continue;
+
+      #pragma omp simd
+      for (ii = 0; ii < l1; ii++)
+        {
+          double cov = 0.0;
+          int k;
+
+          for(k=0; k<4; k++)
+            {
+              double dx = ii - x_center - 0.375 + 0.25*k;
+              double yedge = height*exp(-dx*dx/width/width);
+              double c = fmin(dy+0.5, yedge) - fmax(dy-0.5, -yedge);
+
+              cov += (c > 0.0) ? c : 0.0;
+            }
+          row[ii] = 0.25*cov;
+        }
+    }
+
+  image_gen_cache_put(key, ID);
 
   return(ID);
 }
@@ -1687,7 +1584,6 @@ long make_sectors(const char *ID_name, long l1, long l2, double x_center, double
 long make_rnd(const char *ID_name, long l1, long l2, const char *options)
 {
   long ID;
-  long ii;
   long naxes[2];
   int distrib;
   long nelement;
@@ -1714,23 +1610,13 @@ long make_rnd(const char *ID_name, long l1, long l2, const char *options)
   nelement=naxes[0]*naxes[1];
  
 
-  // openMP is slow when calling gsl random number generator : do not use openMP here
+  // thread-safe counter-based generators (statistic module)
   if(distrib==0)
-    {
-      for (ii = 0; ii < nelement; ii++) 
-	data.image[ID].array.F[ii] = (double) ran1();
-    }
+    statistic_noise_uniform(data.image[ID].array.F, nelement);
   if(distrib==1)
-    {
-      for (ii = 0; ii < nelement; ii++) 
-      	data.image[ID].array.F[ii] = (double) gauss();
-    }
+    statistic_noise_gauss(data.image[ID].array.F, NULL, nelement, 1.0);
   if(distrib==2)
-    {
-      for (ii = 0; ii < nelement; ii++) {
-		data.image[ID].array.F[ii] = (double) gauss_trc();
-      }
-    }
+    statistic_noise_gauss_trc(data.image[ID].array.F, nelement);
 
   return(ID);
 }
@@ -1773,10 +1659,7 @@ long make_rnd_double(const char *ID_name, long l1, long l2, const char *options)
 	data.image[ID].array.D[ii] = (double) ran1();
     }
   if(distrib==1)
-    {
-      for (ii = 0; ii < nelement; ii++) 
-      	data.image[ID].array.D[ii] = (double) gauss();
-    }
+    statistic_noise_gauss_double(data.image[ID].array.D, NULL, nelement, 1.0);
   if(distrib==2)
     {
       for (ii = 0; ii < nelement; ii++) {
@@ -2398,25 +2281,39 @@ long make_offsetHyperGaussian(long size, double a, double b, long n, char* IDnam
 
 long make_cosapoedgePupil(long size, double a, double b, const char *IDname)
 {  
-  long ii,jj;
+  long jj;
   long ID;
-  double x,y,dist;
+  char key[IMAGE_GEN_CACHE_KEYLEN];
+
+  snprintf(key, IMAGE_GEN_CACHE_KEYLEN, "cosapoedgePupil %ld %.17g %.17g", size, a, b);
+  if((ID = image_gen_cache_get(key, IDname)) != -1)
+    return(ID);
 
   ID = create_2Dimage_ID(IDname,size,size);
-  for(ii=0;ii<size;ii++)
-    for(jj=0;jj<size;jj++)
-      {
-	x = 1.0*ii-size/2;
-	y = 1.0*jj-size/2;
-	dist = sqrt(x*x+y*y);
-	if(dist<a)
-	  data.image[ID].array.F[jj*size+ii] = 1.0;
-	else if(dist>b)
-	  data.image[ID].array.F[jj*size+ii] = 0.0;
-	else
-	  data.image[ID].array.F[jj*size+ii] = 0.5*(cos(PI*(dist-a)/(b-a))+1.0);
-      }
-  return(0);
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel for if (size*size > OMP_NELEMENT_LIMIT/10)
+# endif
+  for(jj=0;jj<size;jj++)
+    {
+      float *row = data.image[ID].array.F + jj*size;
+      double y = 1.0*jj-size/2;
+      long ii;
+
+      #pragma omp simd
+      for(ii=0;ii<size;ii++)
+        {
+          double x = 1.0*ii-size/2;
+          double dist = sqrt(x*x+y*y);
+          double v = 0.5*(cos(PI*(dist-a)/(b-a))+1.0);
+
+          v = (dist > b) ? 0.0 : v;
+          row[ii] = (dist < a) ? 1.0 : v;
+        }
+    }
+
+  image_gen_cache_put(key, ID);
+
+  return(ID);
 }
 
 
@@ -4,6 +4,8 @@
 
 int_fast8_t init_image_gen();
 
+void image_gen_cache_free();
+
 
 
 long make_double_star(const char *ID_name, long l1, long l2, double intensity_1, double intensity_2, double separation, double position_angle);
@@ -63,11 +63,16 @@ int clock_gettime(int clk_id, struct timespec *t){
 #include "00CORE/00CORE.h"
 #include "COREMOD_tools/COREMOD_tools.h"
 #include "COREMOD_memory/COREMOD_memory.h"
+#include "ImageStreamIO/ImageStreamIO.h"
 #include "COREMOD_arith/COREMOD_arith.h"
 #include "fft/fft.h"
 
 #include "info/info.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 #define SWAP(a,b) temp=(a);(a)=(b);(b)=temp;
 
@@ -80,9 +85,17 @@ static int wcol, wrow; // window size
 static long long cntlast;
 static struct timespec tlast;
 
+static INFO_STATS monstats;          // last frame stats for printstatus()
+static long monstats_ID = -1;
+static long long monstats_cnt0 = -1;
+
 
 static int info_image_monitor(const char *ID_name, double frequ);
 
+#define INFO_STATS_BLOCK 256               // values converted and reduced together
+#define INFO_STATS_PARALLEL_LIMIT 1000000  // minimum number of elements for threaded reduction
+#define INFO_MONITOR_SUBBIN 50             // histogram bins per displayed monitor bin
+
 
 
 // CLI commands
@@ -117,6 +130,17 @@ int_fast8_t info_image_monitor_cli()
     return 1;
 }
 
+int_fast8_t info_image_latency_cli()
+{
+  if(CLI_checkarg(1,4)==0)
+    {
+      info_image_latency(data.cmdargtoken[1].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
 int_fast8_t info_image_stats_cli()
 {
   if(CLI_checkarg(1,4)==0)
@@ -142,6 +166,19 @@ int_fast8_t info_cubestats_cli()
 
 
 
+int_fast8_t info_structure_function_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,3)+CLI_checkarg(3,3)+CLI_checkarg(4,3)==0)
+    {
+      info_structure_function(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+
 int_fast8_t info_image_statsf_cli()
 {
   if(CLI_checkarg(1,4)==0)
@@ -182,6 +219,8 @@ int init_info()
 
 	RegisterCLIcommand("imgmon", __FILE__,  info_image_monitor_cli, "image monitor", "<image> <frequ>", "imgmon im1 30", "int info_image_monitor(const char *ID_name, double frequ)");
 
+	RegisterCLIcommand("imlatency", __FILE__,  info_image_latency_cli, "stream reader latency percentiles", "<image>", "imlatency im1", "int info_image_latency(const char *ID_name)");
+
 
 /* =============================================================================================== */
 /*                                                                                                 */
@@ -191,6 +230,8 @@ int init_info()
 
 	RegisterCLIcommand("profile", __FILE__, info_profile_cli, "radial profile", "<image> <output file> <xcenter> <ycenter> <step> <Nbstep>", "profile psf psf.prof 256 256 1.0 100", "int profile(const char *ID_name, const char *outfile, double xcenter, double ycenter, double step, long nb_step)");
 
+	RegisterCLIcommand("strfunc", __FILE__, info_structure_function_cli, "masked structure function (FFT)", "<image> <mask> <output map> <output profile>", "strfunc phase pupmask phase_sf phase_sfprof", "long info_structure_function(const char *ID_name, const char *IDmask_name, const char *ID_out, const char *IDprof_name)");
+
 
     return 0;
 }
@@ -262,6 +303,336 @@ int print_header(const char *str, char c)
 
 
 
+/* =============================================================================================== */
+/*                                   ONE-PASS STATISTICS                                           */
+/* =============================================================================================== */
+
+//
+// NBbin = 0 or hmax <= hmin disables the histogram
+//
+void info_stats_init(INFO_STATS *st, long NBbin, double hmin, double hmax)
+{
+    long h;
+
+    if(NBbin > INFO_STATS_MAXBIN)
+        NBbin = INFO_STATS_MAXBIN;
+    if((NBbin < 0)||!(hmax > hmin))
+        NBbin = 0;
+
+    st->n = 0;
+    st->nnan = 0;
+    st->mean = 0.0;
+    st->m2 = 0.0;
+    st->min = 0.0;
+    st->max = 0.0;
+    st->iimin = -1;
+    st->iimax = -1;
+    st->NBbin = NBbin;
+    st->hmin = hmin;
+    st->hmax = hmax;
+    st->hunder = 0;
+    st->hover = 0;
+    for(h=0; h<NBbin; h++)
+        st->hist[h] = 0;
+}
+
+
+
+// Chan et al. pairwise update; st precedes st1 in element order (ties on min/max keep st)
+void info_stats_merge(INFO_STATS *st, const INFO_STATS *st1)
+{
+    long n = st->n + st1->n;
+    long h;
+
+    if(st1->n > 0)
+    {
+        if(st->n == 0)
+        {
+            st->mean = st1->mean;
+            st->m2 = st1->m2;
+            st->min = st1->min;
+            st->max = st1->max;
+            st->iimin = st1->iimin;
+            st->iimax = st1->iimax;
+        }
+        else
+        {
+            double d = st1->mean - st->mean;
+
+            st->mean += d*st1->n/n;
+            st->m2 += st1->m2 + d*d*st->n*st1->n/n;
+            if(st1->min < st->min)
+            {
+                st->min = st1->min;
+                st->iimin = st1->iimin;
+            }
+            if(st1->max > st->max)
+            {
+                st->max = st1->max;
+                st->iimax = st1->iimax;
+            }
+        }
+        st->n = n;
+    }
+    st->nnan += st1->nnan;
+
+    if((st->NBbin == st1->NBbin)&&(st->hmin == st1->hmin)&&(st->hmax == st1->hmax))
+    {
+        st->hunder += st1->hunder;
+        st->hover += st1->hover;
+        for(h=0; h<st->NBbin; h++)
+            st->hist[h] += st1->hist[h];
+    }
+}
+
+
+
+// reduce n <= INFO_STATS_BLOCK values; element index of v[i] is i0+i, or bidx[i] if bidx != NULL
+static void info_stats_block(INFO_STATS *st, const double *v, long n, long i0, const long *bidx)
+{
+    double sum = 0.0;
+    double vmin = INFINITY;
+    double vmax = -INFINITY;
+    double bn, bmean, bm2;
+    long nfin = 0;
+    long i;
+
+    #pragma omp simd reduction(+:sum,nfin) reduction(min:vmin) reduction(max:vmax)
+    for(i=0; i<n; i++)
+    {
+        int fin = (v[i]-v[i] == 0.0);   // false for NaN and Inf
+
+        sum += fin ? v[i] : 0.0;
+        nfin += fin;
+        vmin = (fin && (v[i] < vmin)) ? v[i] : vmin;
+        vmax = (fin && (v[i] > vmax)) ? v[i] : vmax;
+    }
+    st->nnan += n - nfin;
+    if(nfin == 0)
+        return;
+
+    bn = nfin;
+    bmean = sum/bn;
+    bm2 = 0.0;
+    #pragma omp simd reduction(+:bm2)
+    for(i=0; i<n; i++)
+    {
+        double d = v[i] - bmean;
+
+        bm2 += (v[i]-v[i] == 0.0) ? d*d : 0.0;
+    }
+
+    if((st->n == 0)||(vmin < st->min))
+    {
+        for(i=0; v[i] != vmin; i++) {}
+        st->min = vmin;
+        st->iimin = (bidx == NULL) ? i0 + i : bidx[i];
+    }
+    if((st->n == 0)||(vmax > st->max))
+    {
+        for(i=0; v[i] != vmax; i++) {}
+        st->max = vmax;
+        st->iimax = (bidx == NULL) ? i0 + i : bidx[i];
+    }
+
+    if(st->n == 0)
+    {
+        st->mean = bmean;
+        st->m2 = bm2;
+    }
+    else
+    {
+        double d = bmean - st->mean;
+        double nt = st->n + bn;
+
+        st->mean += d*bn/nt;
+        st->m2 += bm2 + d*d*st->n*bn/nt;
+    }
+    st->n += nfin;
+
+    if(st->NBbin > 0)
+    {
+        double hscale = st->NBbin/(st->hmax - st->hmin);
+
+        for(i=0; i<n; i++)
+            if(v[i]-v[i] == 0.0)
+            {
+                double x = (v[i] - st->hmin)*hscale;
+
+                if(x < 0.0)
+                    st->hunder++;
+                else if(x >= st->NBbin)
+                {
+                    if(v[i] == st->hmax)
+                        st->hist[st->NBbin-1]++;
+                    else
+                        st->hover++;
+                }
+                else
+                    st->hist[(long) x]++;
+            }
+    }
+}
+
+
+
+// elements [k0,k1) of array (or of array[idx[]] if idx != NULL)
+static int info_stats_range(INFO_STATS *st, const void *array, int atype, const long *idx, long k0, long k1)
+{
+    double buf[INFO_STATS_BLOCK];
+    long k, i, n;
+
+    for(k=k0; k<k1; k+=INFO_STATS_BLOCK)
+    {
+        n = k1 - k;
+        if(n > INFO_STATS_BLOCK)
+            n = INFO_STATS_BLOCK;
+
+#define INFO_STATS_LOAD(TYPE) \
+        if(idx == NULL) { \
+            const TYPE *a = (const TYPE *) array + k; \
+            for(i=0; i<n; i++) buf[i] = (double) a[i]; \
+        } else { \
+            const TYPE *a = (const TYPE *) array; \
+            for(i=0; i<n; i++) buf[i] = (double) a[idx[k+i]]; \
+        }
+
+        switch(atype)
+        {
+        case _DATATYPE_FLOAT :
+            INFO_STATS_LOAD(float);
+            break;
+        case _DATATYPE_DOUBLE :
+            INFO_STATS_LOAD(double);
+            break;
+        case _DATATYPE_UINT8 :
+            INFO_STATS_LOAD(uint8_t);
+            break;
+        case _DATATYPE_INT8 :
+            INFO_STATS_LOAD(int8_t);
+            break;
+        case _DATATYPE_UINT16 :
+            INFO_STATS_LOAD(uint16_t);
+            break;
+        case _DATATYPE_INT16 :
+            INFO_STATS_LOAD(int16_t);
+            break;
+        case _DATATYPE_UINT32 :
+            INFO_STATS_LOAD(uint32_t);
+            break;
+        case _DATATYPE_INT32 :
+            INFO_STATS_LOAD(int32_t);
+            break;
+        case _DATATYPE_UINT64 :
+            INFO_STATS_LOAD(uint64_t);
+            break;
+        case _DATATYPE_INT64 :
+            INFO_STATS_LOAD(int64_t);
+            break;
+        default :
+            return(1);
+        }
+#undef INFO_STATS_LOAD
+
+        info_stats_block(st, buf, n, k, (idx == NULL) ? NULL : idx + k);
+    }
+
+    return(0);
+}
+
+
+
+//
+// One pass over nelem values: Welford moments, min/max (first index), NaN/Inf count, histogram
+// st must be initialized (info_stats_init), histogram settings are kept; results are merged into st
+// idx (may be NULL) : element indices, nelem is then the number of indices
+// parallel          : split large arrays between threads; merge order is fixed, results reproducible
+//
+int info_stats_array(INFO_STATS *st, const void *array, int atype, long nelem, const long *idx, int parallel)
+{
+    INFO_STATS *stt;
+    int NBthread = 1;
+    int t;
+    int ret = 0;
+
+    if((atype == _DATATYPE_COMPLEX_FLOAT)||(atype == _DATATYPE_COMPLEX_DOUBLE))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"complex data type not supported");
+        return(1);
+    }
+
+#ifdef _OPENMP
+    if((parallel == 1)&&(nelem > INFO_STATS_PARALLEL_LIMIT)&&(omp_in_parallel() == 0))
+        NBthread = omp_get_max_threads();
+#endif
+    if(NBthread == 1)
+    {
+        INFO_STATS st1;
+
+        info_stats_init(&st1, st->NBbin, st->hmin, st->hmax);
+        ret = info_stats_range(&st1, array, atype, idx, 0, nelem);
+        info_stats_merge(st, &st1);
+        return(ret);
+    }
+
+    stt = (INFO_STATS *) malloc(sizeof(INFO_STATS)*NBthread);
+    if(stt == NULL)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"malloc error");
+        exit(0);
+    }
+
+# ifdef _OPENMP
+    #pragma omp parallel num_threads(NBthread) reduction(|:ret)
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        long k0 = nelem*tid/nt;
+        long k1 = nelem*(tid+1)/nt;
+
+        info_stats_init(&stt[tid], st->NBbin, st->hmin, st->hmax);
+        ret |= info_stats_range(&stt[tid], array, atype, idx, k0, k1);
+        if(tid == 0)
+            NBthread = nt;
+    }
+# endif
+
+    for(t=0; t<NBthread; t++)
+        info_stats_merge(st, &stt[t]);
+    free(stt);
+
+    return(ret);
+}
+
+
+
+// histogram estimate, linear within bins; values outside the histogram range clamp to hmin / hmax
+double info_stats_percentile(const INFO_STATS *st, double p)
+{
+    double target;
+    double cnt;
+    long h;
+
+    if(st->NBbin == 0)
+        return(st->mean);
+
+    target = p*(st->n);
+    cnt = st->hunder;
+    if(target <= cnt)
+        return(st->hmin);
+    for(h=0; h<st->NBbin; h++)
+    {
+        if(cnt + st->hist[h] >= target)
+            return(st->hmin + (st->hmax-st->hmin)*(h + (target-cnt)/st->hist[h])/st->NBbin);
+        cnt += st->hist[h];
+    }
+
+    return(st->hmax);
+}
+
+
+
+
 int printstatus(long ID)
 {
     struct timespec tnow;
@@ -281,13 +652,10 @@ int printstatus(long ID)
 
     float minPV = 60000;
     float maxPV = 0;
-    double average;
-    double imtotal;
 
     int atype;
     char line1[200];
 
-    double tmp;
     double RMS = 0.0;
 
     double RMS01 = 0.0;
@@ -405,10 +773,31 @@ int printstatus(long ID)
 */
 
 
-    average = arith_image_mean(data.image[ID].name);
-    imtotal = arith_image_total(data.image[ID].name);
-    printw("median %12g   ", arith_image_median(data.image[ID].name));
-    printw("average %12g    total = %12g\n", imtotal/data.image[ID].md[0].nelement, imtotal);
+    // stats recomputed only for new frames, in one pass on a single thread
+    // histogram range is taken from the previous frame
+    if((ID != monstats_ID)||(data.image[ID].md[0].cnt0 != monstats_cnt0))
+    {
+        double hmin = monstats.min;
+        double hmax = monstats.max;
+
+        if((ID != monstats_ID)||(monstats.n == 0))
+        {
+            info_stats_init(&monstats, 0, 0.0, 0.0);
+            info_stats_array(&monstats, data.image[ID].array.UI8, atype, data.image[ID].md[0].nelement, NULL, 0);
+            hmin = monstats.min;
+            hmax = monstats.max;
+        }
+        info_stats_init(&monstats, NBhistopt*INFO_MONITOR_SUBBIN, hmin, hmax);
+        info_stats_array(&monstats, data.image[ID].array.UI8, atype, data.image[ID].md[0].nelement, NULL, 0);
+        monstats_ID = ID;
+        monstats_cnt0 = data.image[ID].md[0].cnt0;
+    }
+
+    printw("median %12g   ", info_stats_percentile(&monstats, 0.5));
+    printw("average %12g    total = %12g", monstats.mean, monstats.mean*monstats.n);
+    if(monstats.nnan > 0)
+        printw("    NaN/Inf = %ld", monstats.nnan);
+    printw("\n");
 
     // printw("  RMS var = %g\n", );
 
@@ -469,54 +858,17 @@ int printstatus(long ID)
 
     vcnt = (long*) malloc(sizeof(long)*NBhistopt);
 
-
-
-
-    if(atype==_DATATYPE_FLOAT)
-    {
-        minPV = data.image[ID].array.F[0];
-        maxPV = minPV;
-
-        for(h=0; h<NBhistopt; h++)
-            vcnt[h] = 0;
-        for(ii=0; ii<data.image[ID].md[0].nelement; ii++)
-        {
-            if(data.image[ID].array.F[ii]<minPV)
-                minPV = data.image[ID].array.F[ii];
-            if(data.image[ID].array.F[ii]>maxPV)
-                maxPV = data.image[ID].array.F[ii];
-            tmp = (1.0*data.image[ID].array.F[ii]-average);
-            RMS += tmp*tmp;
-            h = (long) (1.0*NBhistopt*((float) (data.image[ID].array.F[ii]-minPV))/(maxPV-minPV));
-            if((h>-1)&&(h<NBhistopt))
-                vcnt[h]++;
-        }
-    }
-
-    if(atype==_DATATYPE_UINT16)
+    minPV = monstats.min;
+    maxPV = monstats.max;
+    for(h=0; h<NBhistopt; h++)
     {
-        minPV = data.image[ID].array.UI16[0];
-        maxPV = minPV;
-
-        for(h=0; h<NBhistopt; h++)
-            vcnt[h] = 0;
-        for(ii=0; ii<data.image[ID].md[0].nelement; ii++)
-        {
-            if(data.image[ID].array.UI16[ii]<minPV)
-                minPV = data.image[ID].array.UI16[ii];
-            if(data.image[ID].array.UI16[ii]>maxPV)
-                maxPV = data.image[ID].array.UI16[ii];
-            tmp = (1.0*data.image[ID].array.UI16[ii]-average);
-            RMS += tmp*tmp;
-            h = (long) (1.0*NBhistopt*((float) (data.image[ID].array.UI16[ii]-minPV))/(maxPV-minPV));
-            if((h>-1)&&(h<NBhistopt))
-                vcnt[h]++;
-        }
+        vcnt[h] = 0;
+        for(i=0; i<monstats.NBbin/NBhistopt; i++)
+            vcnt[h] += monstats.hist[h*(monstats.NBbin/NBhistopt)+i];
     }
 
-
-
-    RMS = sqrt(RMS/data.image[ID].md[0].nelement);
+    if(monstats.n > 0)
+        RMS = sqrt(monstats.m2/monstats.n);
     RMS01 = 0.9*RMS01 + 0.1*RMS;
 
     printw("RMS = %12.6g     ->  %12.6g\n", RMS, RMS01);
@@ -537,7 +889,7 @@ int printstatus(long ID)
             customcolor = 1;
             if(h==NBhistopt-1)
                 customcolor = 2;
-            sprintf(line1, "[%12.4e - %12.4e] %7ld", (minPV + 1.0*(maxPV-minPV)*h/NBhistopt), (minPV + 1.0*(maxPV-minPV)*(h+1)/NBhistopt), vcnt[h]);
+            sprintf(line1, "[%12.4e - %12.4e] %7ld", (monstats.hmin + 1.0*(monstats.hmax-monstats.hmin)*h/NBhistopt), (monstats.hmin + 1.0*(monstats.hmax-monstats.hmin)*(h+1)/NBhistopt), vcnt[h]);
 
             printw("%s", line1); //(minPV + 1.0*(maxPV-minPV)*h/NBhistopt), (minPV + 1.0*(maxPV-minPV)*(h+1)/NBhistopt), vcnt[h]);
             attron(COLOR_PAIR(customcolor));
@@ -667,6 +1019,49 @@ int info_image_monitor(const char *ID_name, double frequ)
 
 
 
+/**
+ * @brief Print latency percentiles of stream readers
+ * 
+ * Stream must be created with IMAGE_FLAG_LATENCY. For each registered reader, prints p50/p99/p99.9 of:
+ * - wakeup latency: writer post to reader wakeup
+ * - frame age: acquisition time (atime) to reader wakeup
+ */
+int info_image_latency(const char *ID_name)
+{
+    long ID;
+    int r;
+
+    ID = image_ID(ID_name);
+    if(ID == -1)
+        return(-1);
+
+    if(data.image[ID].latency == NULL)
+    {
+        printf("Stream %s has no latency instrumentation (create with flag IMAGE_FLAG_LATENCY)\n", ID_name);
+        return(-1);
+    }
+
+    printf("%-16s %6s %10s   %-28s   %-28s\n", "reader", "pid", "frames", "wakeup p50/p99/p99.9 [us]", "age p50/p99/p99.9 [us]");
+    for(r=0; r<LATENCY_NBREADER_MAX; r++)
+    {
+        IMAGE_LATENCYREADER *reader = &data.image[ID].latency->reader[r];
+
+        if(reader->used == 1)
+            printf("%-16s %6d %10ld   %8.2f %8.2f %8.2f   %8.2f %8.2f %8.2f\n", reader->name, (int) reader->pid, (long) reader->count,
+                   0.001*ImageStreamIO_latency_percentile(reader->wakeup, 0.5),
+                   0.001*ImageStreamIO_latency_percentile(reader->wakeup, 0.99),
+                   0.001*ImageStreamIO_latency_percentile(reader->wakeup, 0.999),
+                   0.001*ImageStreamIO_latency_percentile(reader->age, 0.5),
+                   0.001*ImageStreamIO_latency_percentile(reader->age, 0.99),
+                   0.001*ImageStreamIO_latency_percentile(reader->age, 0.999));
+    }
+
+    return(0);
+}
+
+
+
+
 
 
 long brighter(const char *ID_name, double value) /* number of pixels brighter than value */
@@ -728,67 +1123,21 @@ int img_nbpix_flux(const char *ID_name)
 
 float img_percentile_float(const char *ID_name, float p)
 {
-    int ID;
-    long ii;
-    long naxes[2];
-    float value = 0;
-    float *array;
-    long nelements;
-    long n;
-
-    ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0]*naxes[1];
-
-    array = (float*) malloc(nelements*sizeof(float));
-    for (ii = 0; ii < nelements; ii++)
-        array[ii] = data.image[ID].array.F[ii];
-
-    quick_sort_float(array, nelements);
-
-    n = (long) (p*naxes[1]*naxes[0]);
-    if(n>(nelements-1))
-        n = (nelements-1);
-    if(n<0)
-        n = 0;
-    value = array[n];
-    free(array);
+    double fraction = p;
+    double value = 0.0;
 
-    printf("percentile %f = %f (%ld)\n", p, value, n);
+    arith_image_percentiles(ID_name, &fraction, 1, &value);
+    printf("percentile %f = %f\n", p, value);
 
-    return(value);
+    return((float) value);
 }
 
 
 double img_percentile_double(const char *ID_name, double p)
 {
-    int ID;
-    long ii;
-    long naxes[2];
-    double value = 0;
-    double *array;
-    long nelements;
-    long n;
-
-    ID = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    nelements = naxes[0]*naxes[1];
-
-    array = (double*) malloc(nelements*sizeof(double));
-    for (ii = 0; ii < nelements; ii++)
-        array[ii] = data.image[ID].array.F[ii];
-
-    quick_sort_double(array, nelements);
+    double value = 0.0;
 
-    n = (long) (p*naxes[1]*naxes[0]);
-    if(n>(nelements-1))
-        n = (nelements-1);
-    if(n<0)
-        n = 0;
-    value = array[n];
-    free(array);
+    arith_image_percentiles(ID_name, &p, 1, &value);
 
     return(value);
 }
@@ -984,6 +1333,9 @@ int info_image_stats(const char *ID_name, const char *options)
     double vbx,vby;
     FILE *fp;
     int mode = 0;
+    double percfrac[12] = {0.01, 0.05, 0.1, 0.2, 0.5, 0.8, 0.9, 0.95, 0.99, 0.995, 0.998, 0.999};
+    double percval[12];
+    INFO_STATS st;
 
     // printf("OPTIONS = %s\n",options);
     if (strstr(options,"fileout")!=NULL)
@@ -1037,41 +1389,32 @@ int info_image_stats(const char *ID_name, const char *options)
 
 
 
-        min = data.image[ID].array.F[0];
-        max = data.image[ID].array.F[0];
-
-        iimin = 0;
-        iimax = 0;
-        for (ii = 0; ii < nelements; ii++)
+        // moments, extrema and NaN count in one threaded pass; NaN / Inf pixels are excluded
+        info_stats_init(&st, 0, 0.0, 0.0);
+        if(info_stats_array(&st, data.image[ID].array.UI8, atype, nelements, NULL, 1) != 0)
         {
-            if (min > data.image[ID].array.F[ii])
-            {
-                min = data.image[ID].array.F[ii];
-                iimin = ii;
-            }
-            if (max < data.image[ID].array.F[ii])
-            {
-                max = data.image[ID].array.F[ii];
-                iimax = ii;
-            }
+            if(mode == 1)
+                fclose(fp);
+            return(1);
         }
-
-        array = (double*) malloc(nelements*sizeof(double));
-        tot = 0.0;
-
-        rms = 0.0;
-        for (ii = 0; ii < nelements; ii++)
+        if(st.nnan > 0)
+            printf("%ld NaN/Inf pixels excluded (->vnan)\n", st.nnan);
+        create_variable_ID("vnan", 1.0*st.nnan);
+        nelements = st.n;
+        if(nelements == 0)
         {
-            if(isnan(data.image[ID].array.F[ii])!=0)
-            {
-                printf("element %ld is NAN -> replacing by 0\n", ii);
-                data.image[ID].array.F[ii] = 0.0;
-            }
-            tot += data.image[ID].array.F[ii];
-            rms += data.image[ID].array.F[ii]*data.image[ID].array.F[ii];
-            array[ii] = data.image[ID].array.F[ii];
+            printf("no finite pixel value\n");
+            if(mode == 1)
+                fclose(fp);
+            return(0);
         }
-        rms = sqrt(rms);
+
+        min = st.min;
+        max = st.max;
+        iimin = st.iimin;
+        iimax = st.iimax;
+        tot = st.mean*st.n;
+        rms = sqrt(st.m2 + st.mean*st.mean*st.n);
 
         printf("minimum         (->vmin)     %20.18e [ pix %ld ]\n", min, iimin);
         if(mode == 1)
@@ -1093,22 +1436,27 @@ int info_image_stats(const char *ID_name, const char *options)
         if(mode == 1)
             fprintf(fp,"rms per pixel            %20.18e\n",rms/sqrt(nelements));
         create_variable_ID("vrmsp",rms/sqrt(nelements));
-        printf("rms dev per pix (->vrmsdp)   %20.18e\n",sqrt(rms*rms/nelements - tot*tot/nelements/nelements));
-        create_variable_ID("vrmsdp",sqrt(rms*rms/nelements - tot*tot/nelements/nelements));
+        printf("rms dev per pix (->vrmsdp)   %20.18e\n",sqrt(st.m2/nelements));
+        create_variable_ID("vrmsdp",sqrt(st.m2/nelements));
         printf("mean            (->vmean)    %20.18e\n",tot/nelements);
         if(mode == 1)
             fprintf(fp,"mean                     %20.18e\n",tot/nelements);
         create_variable_ID("vmean",tot/nelements);
 
-        if(data.image[ID].md[0].naxis==2)
+        if((data.image[ID].md[0].naxis==2)&&(atype==_DATATYPE_FLOAT))
         {
             xtot = 0.0;
             ytot = 0.0;
-            for(ii=0; ii<data.image[ID].md[0].size[0]; ii++)
-                for(jj=0; jj<data.image[ID].md[0].size[1]; jj++)
+            for(jj=0; jj<data.image[ID].md[0].size[1]; jj++)
+                for(ii=0; ii<data.image[ID].md[0].size[0]; ii++)
                 {
-                    xtot += data.image[ID].array.F[jj*data.image[ID].md[0].size[0]+ii]*ii;
-                    ytot += data.image[ID].array.F[jj*data.image[ID].md[0].size[0]+ii]*jj;
+                    float v = data.image[ID].array.F[jj*data.image[ID].md[0].size[0]+ii];
+
+                    if(v-v == 0.0)
+                    {
+                        xtot += v*ii;
+                        ytot += v*jj;
+                    }
                 }
             vbx = xtot/tot;
             vby = ytot/tot;
@@ -1122,69 +1470,117 @@ int info_image_stats(const char *ID_name, const char *options)
             create_variable_ID("vby",vby);
         }
 
-        quick_sort_double(array, nelements);
+        // exact percentiles of finite values
+        array = (double*) malloc(nelements*sizeof(double));
+        if(array == NULL)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"malloc error");
+            exit(0);
+        }
+        nelements = 0;
+        for(ii=0; ii<data.image[ID].md[0].nelement; ii++)
+        {
+            double v;
+
+            switch(atype)
+            {
+            case _DATATYPE_FLOAT :
+                v = data.image[ID].array.F[ii];
+                break;
+            case _DATATYPE_DOUBLE :
+                v = data.image[ID].array.D[ii];
+                break;
+            case _DATATYPE_UINT8 :
+                v = data.image[ID].array.UI8[ii];
+                break;
+            case _DATATYPE_INT8 :
+                v = data.image[ID].array.SI8[ii];
+                break;
+            case _DATATYPE_UINT16 :
+                v = data.image[ID].array.UI16[ii];
+                break;
+            case _DATATYPE_INT16 :
+                v = data.image[ID].array.SI16[ii];
+                break;
+            case _DATATYPE_UINT32 :
+                v = data.image[ID].array.UI32[ii];
+                break;
+            case _DATATYPE_INT32 :
+                v = data.image[ID].array.SI32[ii];
+                break;
+            case _DATATYPE_UINT64 :
+                v = data.image[ID].array.UI64[ii];
+                break;
+            default :
+                v = data.image[ID].array.SI64[ii];
+                break;
+            }
+            if(v-v == 0.0)
+                array[nelements++] = v;
+        }
+        arith_array_percentiles(array, nelements, percfrac, 12, percval);
         printf("\n");
         printf("percentile values:\n");
 
-        printf("1  percent      (->vp01)     %20.18e\n",array[(long) (0.01*nelements)]);
+        printf("1  percent      (->vp01)     %20.18e\n",percval[0]);
         if(mode == 1)
-            fprintf(fp,"percentile01             %20.18e\n",array[(long) (0.01*nelements)]);
-        create_variable_ID("vp01",array[(long) (0.01*nelements)]);
+            fprintf(fp,"percentile01             %20.18e\n",percval[0]);
+        create_variable_ID("vp01",percval[0]);
 
-        printf("5  percent      (->vp05)     %20.18e\n",array[(long) (0.05*nelements)]);
+        printf("5  percent      (->vp05)     %20.18e\n",percval[1]);
         if(mode == 1)
-            fprintf(fp,"percentile05             %20.18e\n",array[(long) (0.05*nelements)]);
-        create_variable_ID("vp05",array[(long) (0.05*nelements)]);
+            fprintf(fp,"percentile05             %20.18e\n",percval[1]);
+        create_variable_ID("vp05",percval[1]);
 
-        printf("10 percent      (->vp10)     %20.18e\n",array[(long) (0.1*nelements)]);
+        printf("10 percent      (->vp10)     %20.18e\n",percval[2]);
         if(mode == 1)
-            fprintf(fp,"percentile10             %20.18e\n",array[(long) (0.10*nelements)]);
-        create_variable_ID("vp10",array[(long) (0.1*nelements)]);
+            fprintf(fp,"percentile10             %20.18e\n",percval[2]);
+        create_variable_ID("vp10",percval[2]);
 
-        printf("20 percent      (->vp20)     %20.18e\n",array[(long) (0.2*nelements)]);
+        printf("20 percent      (->vp20)     %20.18e\n",percval[3]);
         if(mode == 1)
-            fprintf(fp,"percentile20             %20.18e\n",array[(long) (0.20*nelements)]);
-        create_variable_ID("vp20",array[(long) (0.2*nelements)]);
+            fprintf(fp,"percentile20             %20.18e\n",percval[3]);
+        create_variable_ID("vp20",percval[3]);
 
-        printf("50 percent      (->vp50)     %20.18e\n",array[(long) (0.5*nelements)]);
+        printf("50 percent      (->vp50)     %20.18e\n",percval[4]);
         if(mode == 1)
-            fprintf(fp,"percentile50             %20.18e\n",array[(long) (0.50*nelements)]);
-        create_variable_ID("vp50",array[(long) (0.5*nelements)]);
+            fprintf(fp,"percentile50             %20.18e\n",percval[4]);
+        create_variable_ID("vp50",percval[4]);
 
-        printf("80 percent      (->vp80)     %20.18e\n",array[(long) (0.8*nelements)]);
+        printf("80 percent      (->vp80)     %20.18e\n",percval[5]);
         if(mode == 1)
-            fprintf(fp,"percentile80             %20.18e\n",array[(long) (0.80*nelements)]);
-        create_variable_ID("vp80",array[(long) (0.8*nelements)]);
+            fprintf(fp,"percentile80             %20.18e\n",percval[5]);
+        create_variable_ID("vp80",percval[5]);
 
-        printf("90 percent      (->vp90)     %20.18e\n",array[(long) (0.9*nelements)]);
+        printf("90 percent      (->vp90)     %20.18e\n",percval[6]);
         if(mode == 1)
-            fprintf(fp,"percentile90             %20.18e\n",array[(long) (0.90*nelements)]);
-        create_variable_ID("vp90",array[(long) (0.9*nelements)]);
+            fprintf(fp,"percentile90             %20.18e\n",percval[6]);
+        create_variable_ID("vp90",percval[6]);
 
-        printf("95 percent      (->vp95)     %20.18e\n",array[(long) (0.95*nelements)]);
+        printf("95 percent      (->vp95)     %20.18e\n",percval[7]);
         if(mode == 1)
-            fprintf(fp,"percentile95             %20.18e\n",array[(long) (0.95*nelements)]);
-        create_variable_ID("vp95",array[(long) (0.95*nelements)]);
+            fprintf(fp,"percentile95             %20.18e\n",percval[7]);
+        create_variable_ID("vp95",percval[7]);
 
-        printf("99 percent      (->vp99)     %20.18e\n",array[(long) (0.99*nelements)]);
+        printf("99 percent      (->vp99)     %20.18e\n",percval[8]);
         if(mode == 1)
-            fprintf(fp,"percentile99             %20.18e\n",array[(long) (0.99*nelements)]);
-        create_variable_ID("vp99",array[(long) (0.99*nelements)]);
+            fprintf(fp,"percentile99             %20.18e\n",percval[8]);
+        create_variable_ID("vp99",percval[8]);
 
-        printf("99.5 percent    (->vp995)    %20.18e\n",array[(long) (0.995*nelements)]);
+        printf("99.5 percent    (->vp995)    %20.18e\n",percval[9]);
         if(mode == 1)
-            fprintf(fp,"percentile995            %20.18e\n",array[(long) (0.995*nelements)]);
-        create_variable_ID("vp995",array[(long) (0.995*nelements)]);
+            fprintf(fp,"percentile995            %20.18e\n",percval[9]);
+        create_variable_ID("vp995",percval[9]);
 
-        printf("99.8 percent    (->vp998)    %20.18e\n",array[(long) (0.998*nelements)]);
+        printf("99.8 percent    (->vp998)    %20.18e\n",percval[10]);
         if(mode == 1)
-            fprintf(fp,"percentile998            %20.18e\n",array[(long) (0.998*nelements)]);
-        create_variable_ID("vp998",array[(long) (0.998*nelements)]);
+            fprintf(fp,"percentile998            %20.18e\n",percval[10]);
+        create_variable_ID("vp998",percval[10]);
 
-        printf("99.9 percent    (->vp999)    %20.18e\n",array[(long) (0.999*nelements)]);
+        printf("99.9 percent    (->vp999)    %20.18e\n",percval[11]);
         if(mode == 1)
-            fprintf(fp,"percentile999            %20.18e\n",array[(long) (0.999*nelements)]);
-        create_variable_ID("vp999",array[(long) (0.999*nelements)]);
+            fprintf(fp,"percentile999            %20.18e\n",percval[11]);
+        create_variable_ID("vp999",percval[11]);
 
         printf("\n");
         free(array);
@@ -1209,18 +1605,19 @@ int info_image_stats(const char *ID_name, const char *options)
 long info_cubestats(const char *ID_name, const char *IDmask_name, const char *outfname)
 {
 	long ID, IDm;
-	long ii, jj, kk;
-	float min, max, tot, tot2;
-	long xysize;
+	long ii, kk;
+	long xysize, zsize;
 	FILE *fp;
-	int init = 0;
 	float mtot;
-	float val;
+	long *mpix;       // pixels in mask
+	long NBmpix;
+	float *fstats;    // min, max, tot, tot2 for each frame
+	double *fnorm;    // sum of squares (double) for each frame
+	double *fvar;     // sum of squared deviations from frame mean
 
 	int COMPUTE_CORR = 1;
 	long kcmax = 100;
-	double valn1, valn2, v1, v2, valxp, vcorr;
-	long k1, k2, kc;
+	long kc;
 	
 	ID = image_ID(ID_name);
 	if(data.image[ID].md[0].naxis != 3)
@@ -1233,38 +1630,47 @@ long info_cubestats(const char *ID_name, const char *IDmask_name, const char *ou
 	
 	
 	xysize = data.image[ID].md[0].size[0]*data.image[ID].md[0].size[1];
+	zsize = data.image[ID].md[0].size[2];
 	
 	mtot = 0.0;
 	for(ii=0;ii<xysize;ii++)
 		mtot += data.image[IDm].array.F[ii];
 	
+	mpix = (long*) malloc(sizeof(long)*xysize);
+	NBmpix = 0;
+	for(ii=0;ii<xysize;ii++)
+		if(data.image[IDm].array.F[ii]>0.5)
+			mpix[NBmpix++] = ii;
+	
+	
+	// frames are independent : distributed between threads, written in order
+	fstats = (float*) malloc(sizeof(float)*4*zsize);
+	fnorm = (double*) malloc(sizeof(double)*zsize);
+	fvar = (double*) malloc(sizeof(double)*zsize);
+	# ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic) if (zsize > 1)
+	# endif
+	for(kk=0; kk<zsize; kk++)
+	{
+		INFO_STATS st;
+		
+		info_stats_init(&st, 0, 0.0, 0.0);
+		info_stats_array(&st, data.image[ID].array.F + kk*xysize, _DATATYPE_FLOAT, NBmpix, mpix, 0);
+		fstats[4*kk] = st.min;
+		fstats[4*kk+1] = st.max;
+		fstats[4*kk+2] = st.mean*st.n;
+		fstats[4*kk+3] = st.m2 + st.mean*st.mean*st.n;
+		fvar[kk] = st.m2;
+		fnorm[kk] = st.m2 + st.mean*st.mean*st.n;
+	}
 	
 	fp = fopen(outfname, "w");
-	for(kk=0; kk<data.image[ID].md[0].size[2]; kk++)
+	for(kk=0; kk<zsize; kk++)
 	{
-		init = 0;
-		tot = 0.0;
-		tot2 = 0.0;
-		for(ii=0;ii<xysize;ii++)
-			{
-				if(data.image[IDm].array.F[ii]>0.5)
-				{
-					val = data.image[ID].array.F[kk*xysize+ii];
-					if(init==0)
-					{
-						init = 1;
-						min = val;
-						max = val;
-					}
-					if(val>max)
-						max = val;
-					if(val<min)
-						min = val;
-					tot += val;
-					tot2 += val*val;
-				}
-			}
-		fprintf(fp, "%5ld  %20f  %20f  %20f  %20f  %20f  %20f\n", kk, min, max, tot, tot/mtot, tot2, sqrt((tot2-tot*tot/mtot)/mtot));
+		float tot = fstats[4*kk+2];
+		float tot2 = fstats[4*kk+3];
+		
+		fprintf(fp, "%5ld  %20f  %20f  %20f  %20f  %20f  %20f\n", kk, fstats[4*kk], fstats[4*kk+1], tot, tot/mtot, tot2, sqrt(fvar[kk]/mtot));
 	}
 	fclose(fp);
     
@@ -1272,35 +1678,34 @@ long info_cubestats(const char *ID_name, const char *IDmask_name, const char *ou
     if(COMPUTE_CORR == 1)
     {
 		fp = fopen("corr.txt", "w");
-		for(kc=1; kc<kcmax; kc++)
+		for(kc=1; (kc<kcmax)&&(kc<zsize); kc++)
 		{
-			vcorr = 0.0;
-			for(kk=0; kk<data.image[ID].md[0].size[2]-kc; kk++)
+			double vcorr = 0.0;
+			
+			# ifdef _OPENMP
+			#pragma omp parallel for reduction(+:vcorr) if (zsize-kc > 1)
+			# endif
+			for(kk=0; kk<zsize-kc; kk++)
 				{
-					k1 = kk;
-					k2 = kk+kc;
-					valn1 = 0.0;
-					valn2 = 0.0;
-					valxp = 0.0;
-					for(ii=0;ii<xysize;ii++)
-						{
-							if(data.image[IDm].array.F[ii]>0.5)
-								{
-									v1 = data.image[ID].array.F[k1*xysize+ii];
-									v2 = data.image[ID].array.F[k2*xysize+ii];
-									valn1 += v1*v1;
-									valn2 += v2*v2;
-									valxp += v1*v2;
-								}
-						}
-					vcorr += valxp/sqrt(valn1*valn2);
+					const float *f1 = data.image[ID].array.F + kk*xysize;
+					const float *f2 = data.image[ID].array.F + (kk+kc)*xysize;
+					double valxp = 0.0;
+					long i;
+					
+					for(i=0;i<NBmpix;i++)
+						valxp += (double) f1[mpix[i]]*f2[mpix[i]];
+					vcorr += valxp/sqrt(fnorm[kk]*fnorm[kk+kc]);
 				}
-			vcorr /= data.image[ID].md[0].size[2]-kc;
+			vcorr /= zsize-kc;
 			fprintf(fp, "%3ld   %g\n", kc, vcorr);
 		}
 		fclose(fp);
 	}
     
+	free(mpix);
+	free(fstats);
+	free(fnorm);
+	free(fvar);
 	
 	return(ID);
 }
@@ -1657,50 +2062,84 @@ int test_structure_function(const char *ID_name, long NBpoints, const char *ID_o
 
 
 
-int full_structure_function(const char *ID_name, long NBpoints, const char *ID_out)
+//
+// masked structure function, all separations, FFT-based (see fft_strfplan_execute)
+// ID_out (nx x ny) : D(|dx|,|dy|), 0 where no pixel pair exists
+// IDprof_name      : azimuthal average, pixel k = separations with round(|r|) = k
+// a missing mask image selects all pixels; a 3D input is averaged over slices
+//
+long info_structure_function(const char *ID_name, const char *IDmask_name, const char *ID_out, const char *IDprof_name)
 {
-  int ID,ID1,ID2;
-  long ii1,ii2,jj1,jj2;
-  long naxes[2];
-  double v1,v2;
-  long i=0;
-  long STEP1=2;
-  long STEP2=3;
+    long ID, IDmask, IDout, IDprof;
+    long nx, ny, nz = 1;
+    long NBbin;
+    long ii;
+    float *im;
+    float *prof;
+    FFT_STRFPLAN *plan;
 
-  ID = image_ID(ID_name);
-  naxes[0] = data.image[ID].md[0].size[0];
-  naxes[1] = data.image[ID].md[0].size[1];    
 
-  ID1=create_2Dimage_ID("tmp1",naxes[0],naxes[1]);
-  ID2=create_2Dimage_ID("tmp2",naxes[0],naxes[1]);
-  
+    ID = image_ID(ID_name);
+    if(ID == -1)
+    {
+        printERROR(__FILE__,__func__,__LINE__,"input image does not exist");
+        return(-1);
+    }
+    nx = data.image[ID].md[0].size[0];
+    ny = data.image[ID].md[0].size[1];
+    if(data.image[ID].md[0].naxis == 3)
+        nz = data.image[ID].md[0].size[2];
 
-  for(ii1=0;ii1<naxes[0];ii1+=STEP1)
+    if(data.image[ID].md[0].atype == _DATATYPE_FLOAT)
+        im = data.image[ID].array.F;
+    else if(data.image[ID].md[0].atype == _DATATYPE_DOUBLE)
     {
-      printf(".");
-      for(jj1=0;jj1<naxes[1];jj1+=STEP1)
-	{
-	  if(i<NBpoints)
-	    {
-	      i++;
-	      fflush(stdout);
-	      for(ii2=0;ii2<naxes[0];ii2+=STEP2)
-		for(jj2=0;jj2<naxes[1];jj2+=STEP2)
-		  if((ii2>ii1)&&(jj2>jj1))
-		    {
-		      v1=data.image[ID].array.F[jj1*naxes[0]+ii1];
-		      v2=data.image[ID].array.F[jj2*naxes[0]+ii2];
-		      data.image[ID1].array.F[(jj2-jj1)*naxes[0]+ii2-ii1] += (v1-v2)*(v1-v2);
-		      data.image[ID2].array.F[(jj2-jj1)*naxes[0]+ii2-ii1] += 1.0;
-		    }
-	    }
-	}
+        im = (float *) malloc(sizeof(float)*nx*ny*nz);
+        for(ii=0; ii<nx*ny*nz; ii++)
+            im[ii] = (float) data.image[ID].array.D[ii];
+    }
+    else
+    {
+        printERROR(__FILE__,__func__,__LINE__,"data type not supported");
+        return(-1);
     }
-  printf("\n");
 
-  arith_image_div("tmp1","tmp2",ID_out);
+    IDmask = image_ID(IDmask_name);
+    if((IDmask != -1)&&((data.image[IDmask].md[0].atype != _DATATYPE_FLOAT)||((long) data.image[IDmask].md[0].nelement < nx*ny)))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"mask must be a float image of input size, ignoring");
+        IDmask = -1;
+    }
 
-  return(0);
+    NBbin = (long) (sqrt((double) (nx*nx+ny*ny))) + 1;
+    prof = (float *) malloc(sizeof(float)*NBbin);
+
+    plan = fft_strfplan_create((IDmask == -1) ? NULL : data.image[IDmask].array.F, nx, ny);
+    IDout = create_2Dimage_ID(ID_out, nx, ny);
+    fft_strfplan_execute(plan, im, nz, data.image[IDout].array.F, prof, NBbin);
+    fft_strfplan_free(plan);
+
+    if(strlen(IDprof_name) > 0)
+    {
+        IDprof = create_2Dimage_ID(IDprof_name, NBbin, 1);
+        memcpy(data.image[IDprof].array.F, prof, sizeof(float)*NBbin);
+    }
+
+    free(prof);
+    if(im != data.image[ID].array.F)
+        free(im);
+
+    return(IDout);
+}
+
+
+
+// NBpoints is ignored: all pixel pairs are used
+int full_structure_function(const char *ID_name, long NBpoints, const char *ID_out)
+{
+    info_structure_function(ID_name, "", ID_out, "");
+
+    return(0);
 }
 
 
@@ -5,6 +5,29 @@
 int init_info();
 
 
+#define INFO_STATS_MAXBIN 1024
+
+// one-pass image statistics, see info_stats_array()
+typedef struct
+{
+    long   n;                // number of finite values
+    long   nnan;             // number of NaN / Inf values
+    double mean;
+    double m2;               // sum of squared deviations from mean
+    double min;
+    double max;
+    long   iimin;            // element index of min
+    long   iimax;            // element index of max
+
+    long   NBbin;            // histogram bins over [hmin, hmax], 0 if no histogram
+    double hmin;
+    double hmax;
+    long   hunder;           // values below hmin
+    long   hover;            // values above hmax
+    long   hist[INFO_STATS_MAXBIN];
+} INFO_STATS;
+
+
 
 int kbdhit(void);
 
@@ -31,8 +54,18 @@ double ssquare(const char *ID_name);
 
 double rms_dev(const char *ID_name);
 
+void info_stats_init(INFO_STATS *st, long NBbin, double hmin, double hmax);
+
+void info_stats_merge(INFO_STATS *st, const INFO_STATS *st1);
+
+int info_stats_array(INFO_STATS *st, const void *array, int atype, long nelem, const long *idx, int parallel);
+
+double info_stats_percentile(const INFO_STATS *st, double p);
+
 int info_image_stats(const char *ID_name, const char *options);
 
+int info_image_latency(const char *ID_name);
+
 long info_cubestats(const char *ID_name, const char *IDmask_name, const char *outfname);
 
 double img_min(const char *ID_name);
@@ -49,6 +82,8 @@ double background_photon_noise(const char *ID_name);
 
 int test_structure_function(const char *ID_name, long NBpoints, const char *fname);
 
+long info_structure_function(const char *ID_name, const char *IDmask_name, const char *ID_out, const char *IDprof_name);
+
 int full_structure_function(const char *ID_name, long NBpoints, const char *ID_out);
 
 int fft_structure_function(const char *ID_in, const char *ID_out);
@@ -829,3 +829,201 @@ static void clear_results(struct kdres *rset)
         rset->rlist->next = 0;
 }
 
+
+
+
+
+/* ---------------------------------------------------------------------- 
+ * 
+ * flat, bulk-loaded kd-tree
+ * 
+ * points are reordered in a single array by recursive median split :
+ * node of [lo, hi) is at mid = lo + (hi-lo)/2, left subtree [lo, mid),
+ * right subtree [mid+1, hi), split axis = depth % dim.
+ * tree is read-only after kd_flat_build, queries are thread-safe as long
+ * as each thread uses its own result buffer.
+ * 
+ * ---------------------------------------------------------------------- */
+
+struct kdflat {
+        int dim;
+        long n;
+        double *pos;                    /* n x dim, tree order */
+        long *idx;                      /* original point index */
+};
+
+
+static void flat_select(long *idx, const double *pos, int dim, int axis, long lo, long hi, long nth)
+{
+        while(hi - lo > 1) {
+                double pivot = pos[idx[lo + (hi-lo)/2] * dim + axis];
+                long i = lo;
+                long j = hi - 1;
+
+                while(i <= j) {
+                        while(pos[idx[i] * dim + axis] < pivot) i++;
+                        while(pos[idx[j] * dim + axis] > pivot) j--;
+                        if(i <= j) {
+                                long tmp = idx[i];
+                                idx[i] = idx[j];
+                                idx[j] = tmp;
+                                i++;
+                                j--;
+                        }
+                }
+                if(nth <= j) {
+                        hi = j + 1;
+                } else if(nth >= i) {
+                        lo = i;
+                } else {
+                        return;
+                }
+        }
+}
+
+static void flat_build_rec(long *idx, const double *pos, int dim, long lo, long hi, int depth)
+{
+        long mid;
+
+        if(hi - lo < 2) return;
+
+        mid = lo + (hi-lo)/2;
+        flat_select(idx, pos, dim, depth % dim, lo, hi, mid);
+        flat_build_rec(idx, pos, dim, lo, mid, depth + 1);
+        flat_build_rec(idx, pos, dim, mid + 1, hi, depth + 1);
+}
+
+struct kdflat *kd_flat_build(int k, long n, const double *pos)
+{
+        struct kdflat *tree;
+        long i;
+
+        if(!(tree = malloc(sizeof *tree))) {
+                return 0;
+        }
+        tree->dim = k;
+        tree->n = n;
+        tree->pos = malloc(n * k * sizeof *tree->pos);
+        tree->idx = malloc(n * sizeof *tree->idx);
+        if(!tree->pos || !tree->idx) {
+                kd_flat_free(tree);
+                return 0;
+        }
+
+        for(i=0; i<n; i++) {
+                tree->idx[i] = i;
+        }
+        flat_build_rec(tree->idx, pos, k, 0, n, 0);
+
+        for(i=0; i<n; i++) {
+                memcpy(tree->pos + i * k, pos + tree->idx[i] * k, k * sizeof *pos);
+        }
+
+        return tree;
+}
+
+void kd_flat_free(struct kdflat *tree)
+{
+        if(tree) {
+                free(tree->pos);
+                free(tree->idx);
+                free(tree);
+        }
+}
+
+struct kdflat_res *kd_flat_res_create(void)
+{
+        struct kdflat_res *res;
+
+        if(!(res = malloc(sizeof *res))) {
+                return 0;
+        }
+        res->size = 0;
+        res->capacity = 0;
+        res->idx = 0;
+        res->dist_sq = 0;
+
+        return res;
+}
+
+void kd_flat_res_free(struct kdflat_res *res)
+{
+        if(res) {
+                free(res->idx);
+                free(res->dist_sq);
+                free(res);
+        }
+}
+
+static int flat_res_push(struct kdflat_res *res, long idx, double dist_sq)
+{
+        if(res->size == res->capacity) {
+                long newcap = res->capacity ? 2 * res->capacity : 256;
+                long *nidx;
+                double *ndist;
+
+                if(!(nidx = realloc(res->idx, newcap * sizeof *nidx))) {
+                        return -1;
+                }
+                res->idx = nidx;
+                if(!(ndist = realloc(res->dist_sq, newcap * sizeof *ndist))) {
+                        return -1;
+                }
+                res->dist_sq = ndist;
+                res->capacity = newcap;
+        }
+        res->idx[res->size] = idx;
+        res->dist_sq[res->size] = dist_sq;
+        res->size++;
+
+        return 0;
+}
+
+static int flat_range_rec(const struct kdflat *tree, long lo, long hi, int depth, const double *pos, double range, struct kdflat_res *res)
+{
+        long mid;
+        int i, axis, dim = tree->dim;
+        const double *npos;
+        double dist_sq, dx;
+
+        if(hi <= lo) return 0;
+
+        mid = lo + (hi-lo)/2;
+        npos = tree->pos + mid * dim;
+        axis = depth % dim;
+
+        dist_sq = 0;
+        for(i=0; i<dim; i++) {
+                dist_sq += SQ(npos[i] - pos[i]);
+        }
+        if(dist_sq <= SQ(range)) {
+                if(flat_res_push(res, tree->idx[mid], dist_sq) == -1) {
+                        return -1;
+                }
+        }
+
+        dx = pos[axis] - npos[axis];
+        if(dx <= 0.0) {
+                if(flat_range_rec(tree, lo, mid, depth + 1, pos, range, res) == -1) return -1;
+                if(fabs(dx) <= range) {
+                        return flat_range_rec(tree, mid + 1, hi, depth + 1, pos, range, res);
+                }
+        } else {
+                if(flat_range_rec(tree, mid + 1, hi, depth + 1, pos, range, res) == -1) return -1;
+                if(fabs(dx) <= range) {
+                        return flat_range_rec(tree, lo, mid, depth + 1, pos, range, res);
+                }
+        }
+
+        return 0;
+}
+
+long kd_flat_nearest_range(const struct kdflat *tree, const double *pos, double range, struct kdflat_res *res)
+{
+        res->size = 0;
+        if(flat_range_rec(tree, 0, tree->n, 0, pos, range, res) == -1) {
+                return -1;
+        }
+
+        return res->size;
+}
@@ -113,6 +113,30 @@ void *kd_res_item3f(struct kdres *set, float *x, float *y, float *z);
 void *kd_res_item_data(struct kdres *set);
 
 
+/* flat kd-tree, built once from n points (pos is n x k, row-major) by
+ * median split. The tree is read-only, so queries from several threads
+ * are safe as long as each thread uses its own result buffer.
+ */
+struct kdflat;
+
+/* result buffer, reused across queries (storage grows as needed) */
+struct kdflat_res {
+        long size;              /* number of results of last query */
+        long capacity;
+        long *idx;              /* index of point in input array */
+        double *dist_sq;        /* squared distance to query point */
+};
+
+struct kdflat *kd_flat_build(int k, long n, const double *pos);
+void kd_flat_free(struct kdflat *tree);
+
+struct kdflat_res *kd_flat_res_create(void);
+void kd_flat_res_free(struct kdflat_res *res);
+
+/* finds all points within range of pos, returns number of points or -1 on error */
+long kd_flat_nearest_range(const struct kdflat *tree, const double *pos, double range, struct kdflat_res *res);
+
+
 #ifdef __cplusplus
 }
 #endif
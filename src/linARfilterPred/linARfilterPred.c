@@ -108,6 +108,28 @@ int_fast8_t LINARFILTERPRED_Build_LinPredictor_cli()
 }
 
 
+int_fast8_t LINARFILTERPRED_Build_LinPredictor_RLS_cli()
+{
+	if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,1)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,1)+CLI_checkarg(7,3)+CLI_checkarg(8,2)==0)
+		LINARFILTERPRED_Build_LinPredictor_RLS(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf, data.cmdargtoken[7].val.string, data.cmdargtoken[8].val.numl);
+	else
+       return 1;
+
+  return(0);
+}
+
+
+int_fast8_t LINARFILTERPRED_ScanPFparam_cli()
+{
+	if(CLI_checkarg(1,4)+CLI_checkarg(2,2)+CLI_checkarg(3,1)+CLI_checkarg(4,1)+CLI_checkarg(5,1)+CLI_checkarg(6,1)+CLI_checkarg(7,1)+CLI_checkarg(8,2)+CLI_checkarg(9,3)==0)
+		LINARFILTERPRED_ScanPFparam(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.numl, data.cmdargtoken[3].val.numf, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.numl, data.cmdargtoken[9].val.string);
+	else
+       return 1;
+
+  return(0);
+}
+
+
 int_fast8_t LINARFILTERPRED_Apply_LinPredictor_cli()
 {
 	if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,1)+CLI_checkarg(4,3)==0)
@@ -194,6 +216,24 @@ int_fast8_t init_linARfilterPred()
     strcpy(data.cmd[data.NBcmd].Ccall,"int LINARFILTERPRED_Build_LinPredictor(const char *IDin_name, long PForder, float PFlag, double SVDeps, double RegLambda, const char *IDoutPF, int outMode, int LOOPmode, float LOOPgain)");
     data.NBcmd++;
 
+    strcpy(data.cmd[data.NBcmd].key,"mkARpfiltRLS");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = LINARFILTERPRED_Build_LinPredictor_RLS_cli;
+    strcpy(data.cmd[data.NBcmd].info,"Online recursive least-squares linear auto-regressive filter");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input stream> <PForder> <PFlag> <semtrig> <forgetting factor> <initial P diag> <output filters> <NBiter>");
+    strcpy(data.cmd[data.NBcmd].example,"mkARpfiltRLS modevalOL 5 2.4 3 0.999 100.0 outPF 0");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long LINARFILTERPRED_Build_LinPredictor_RLS(const char *IDin_name, long PForder, float PFlag, int semtrig, double RLSlambda, double RLSdelta, const char *IDoutPF_name, long NBiter)");
+    data.NBcmd++;
+
+    strcpy(data.cmd[data.NBcmd].key,"scanARpfilt");
+    strcpy(data.cmd[data.NBcmd].module,__FILE__);
+    data.cmd[data.NBcmd].fp = LINARFILTERPRED_ScanPFparam_cli;
+    strcpy(data.cmd[data.NBcmd].info,"Scan linear auto-regressive filter order, lag and regularization from cached covariances");
+    strcpy(data.cmd[data.NBcmd].syntax,"<input data> <max PForder> <PFlag min> <PFlag max> <PFlag step> <reg min> <reg max> <NBreg> <output>");
+    strcpy(data.cmd[data.NBcmd].example,"scanARpfilt indata 10 1.0 3.0 0.2 0.0001 0.1 4 PFscan");
+    strcpy(data.cmd[data.NBcmd].Ccall,"long LINARFILTERPRED_ScanPFparam(const char *IDin_name, long PFordermax, float PFlagmin, float PFlagmax, float PFlagstep, double RegLambdamin, double RegLambdamax, long NBreg, const char *IDout_name)");
+    data.NBcmd++;
+
   /*  strcpy(data.cmd[data.NBcmd].key,"applyPfiltRT");
     strcpy(data.cmd[data.NBcmd].module,__FILE__);
     data.cmd[data.NBcmd].fp = LINARFILTERPRED_Apply_LinPredictor_RT_cli;
@@ -1063,10 +1103,514 @@ long LINARFILTERPRED_Build_LinPredictor(const char *IDin_name, long PForder, flo
 
 
 
+//
+// online recursive least-squares (RLS) predictive filter, exponential forgetting
+//
+// IDin_name     : input stream, one frame of mode values per update (uses inmask / outmask as LINARFILTERPRED_Build_LinPredictor)
+// semtrig       : semaphore trigger index in input
+// RLSlambda     : forgetting factor (0.99 - 0.9999), effective memory = 1/(1-RLSlambda) frames
+// RLSdelta      : initial inverse covariance P = RLSdelta * Id
+// NBiter        : number of updates (<1 : run until USR1 signal)
+//
+// all outputs share the same regressor, so a single inverse covariance is updated per frame : O(n^2) per update, n = NBpixin*PForder
+// output filters are published every update, same layout as LINARFILTERPRED_Build_LinPredictor in LOOPmode
+//
+long LINARFILTERPRED_Build_LinPredictor_RLS(const char *IDin_name, long PForder, float PFlag, int semtrig, double RLSlambda, double RLSdelta, const char *IDoutPF_name, long NBiter)
+{
+    long IDin, IDinmask, IDoutmask;
+    long IDoutPF2D, IDoutPF3D;
+    char IDoutPF_name3D[500];
+    long xsize, ysize, xysize;
+    long NBpixin, NBpixout;
+    long *pixarray_xy;
+    long *outpixarray_xy;
+    long ii, jj, pix, PFpix, dt;
+    long n; // regressor size
+    long lag, NBbuff;
+    float alpha;
+    float *ybuff; // ring buffer of input frames
+    double *xvec, *Pmat, *Px, *kvec, *Wmat;
+    double invlambda;
+    uint32_t *imsizearray;
+    long cnt, iter;
+
+
+    sprintf(IDoutPF_name3D, "%s_3D", IDoutPF_name);
 
+    IDin = image_ID(IDin_name);
+    if(IDin == -1)
+        IDin = read_sharedmem_image(IDin_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: cannot load input stream %s\n", IDin_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].sem <= semtrig)
+    {
+        printf("ERROR: input stream %s has %d semaphores, need > %d\n", IDin_name, (int) data.image[IDin].md[0].sem, semtrig);
+        return(-1);
+    }
+
+    xsize = data.image[IDin].md[0].size[0];
+    if(data.image[IDin].md[0].naxis > 1)
+        ysize = data.image[IDin].md[0].size[1];
+    else
+        ysize = 1;
+    xysize = xsize*ysize;
+
+    pixarray_xy = (long*) malloc(sizeof(long)*xysize);
+    outpixarray_xy = (long*) malloc(sizeof(long)*xysize);
+
+    IDinmask = image_ID("inmask");
+    IDoutmask = image_ID("outmask");
+    NBpixin = 0;
+    NBpixout = 0;
+    for(ii=0; ii<xsize; ii++)
+        for(jj=0; jj<ysize; jj++)
+        {
+            if((IDinmask==-1)||(data.image[IDinmask].array.F[jj*xsize+ii] > 0.5))
+            {
+                pixarray_xy[NBpixin] = jj*xsize+ii;
+                NBpixin ++;
+            }
+            if((IDoutmask==-1)||(data.image[IDoutmask].array.F[jj*xsize+ii] > 0.5))
+            {
+                outpixarray_xy[NBpixout] = jj*xsize+ii;
+                NBpixout ++;
+            }
+        }
+    printf("NBpixin = %ld   NBpixout = %ld\n", NBpixin, NBpixout);
 
+    n = NBpixin*PForder;
 
+    // regressor uses frames k0 ... k0-PForder+1, target is frame k0+PFlag (interpolated)
+    lag = (long) PFlag;
+    alpha = PFlag - lag;
+    NBbuff = PForder + lag + 1;
 
+    ybuff = (float*) calloc(NBbuff*xysize, sizeof(float));
+    xvec = (double*) malloc(sizeof(double)*n);
+    Px = (double*) malloc(sizeof(double)*n);
+    kvec = (double*) malloc(sizeof(double)*n);
+    Pmat = (double*) calloc(n*n, sizeof(double));
+    Wmat = (double*) calloc(NBpixout*n, sizeof(double));
+
+    for(ii=0; ii<n; ii++)
+        Pmat[ii*n+ii] = RLSdelta;
+    invlambda = 1.0/RLSlambda;
+
+
+    // create 2D and 3D filters as shared memory
+    imsizearray = (uint32_t*) malloc(sizeof(uint32_t)*3);
+    imsizearray[0] = n;
+    imsizearray[1] = NBpixout;
+    IDoutPF2D = create_image_ID(IDoutPF_name, 2, imsizearray, _DATATYPE_FLOAT, 1, 1);
+    COREMOD_MEMORY_image_set_semflush(IDoutPF_name, -1);
+
+    imsizearray[0] = xysize;
+    imsizearray[1] = xysize;
+    imsizearray[2] = PForder;
+    IDoutPF3D = create_image_ID(IDoutPF_name3D, 3, imsizearray, _DATATYPE_FLOAT, 1, 1);
+    COREMOD_MEMORY_image_set_semflush(IDoutPF_name3D, -1);
+    free(imsizearray);
+
+
+    COREMOD_MEMORY_image_set_semflush(IDin_name, semtrig);
+
+    cnt = 0; // number of frames received
+    iter = 0;
+    while(((NBiter<1)||(iter<NBiter))&&(data.signal_USR1==0))
+    {
+        long slot, k0;
+        double denom;
+
+        sem_wait(data.image[IDin].semptr[semtrig]);
+
+        slot = cnt % NBbuff;
+        memcpy(ybuff + slot*xysize, data.image[IDin].array.F, sizeof(float)*xysize);
+        cnt++;
+
+        // frame index of newest regressor sample, target frame(s) k0+lag (and k0+lag+1) is the newest frame
+        k0 = cnt - 1 - lag - (alpha > 0.0 ? 1 : 0);
+        if(k0 < PForder-1)
+            continue;
+
+        for(dt=0; dt<PForder; dt++)
+        {
+            float *yframe = ybuff + ((k0-dt) % NBbuff)*xysize;
+
+            for(pix=0; pix<NBpixin; pix++)
+                xvec[dt*NBpixin+pix] = yframe[pixarray_xy[pix]];
+        }
+
+        // gain vector k = P x / (lambda + x' P x)
+        denom = RLSlambda;
+        for(ii=0; ii<n; ii++)
+        {
+            double val = 0.0;
+
+            for(jj=0; jj<n; jj++)
+                val += Pmat[ii*n+jj]*xvec[jj];
+            Px[ii] = val;
+            denom += xvec[ii]*val;
+        }
+        for(ii=0; ii<n; ii++)
+            kvec[ii] = Px[ii]/denom;
+
+        // filter update W <- W + (y - W x) k'
+# ifdef _OPENMP
+        #pragma omp parallel for private(ii)
+# endif
+        for(PFpix=0; PFpix<NBpixout; PFpix++)
+        {
+            double *wvec = Wmat + PFpix*n;
+            float *y0 = ybuff + ((k0+lag) % NBbuff)*xysize;
+            float *y1 = ybuff + ((k0+lag+1) % NBbuff)*xysize;
+            double err;
+
+            err = (1.0-alpha)*y0[outpixarray_xy[PFpix]];
+            if(alpha > 0.0)
+                err += alpha*y1[outpixarray_xy[PFpix]];
+            for(ii=0; ii<n; ii++)
+                err -= wvec[ii]*xvec[ii];
+            for(ii=0; ii<n; ii++)
+                wvec[ii] += err*kvec[ii];
+        }
+
+        // P <- (P - k (Px)') / lambda, upper triangle mirrored to keep P symmetric
+# ifdef _OPENMP
+        #pragma omp parallel for private(jj)
+# endif
+        for(ii=0; ii<n; ii++)
+            for(jj=ii; jj<n; jj++)
+            {
+                double val = (Pmat[ii*n+jj] - kvec[ii]*Px[jj])*invlambda;
+
+                Pmat[ii*n+jj] = val;
+                Pmat[jj*n+ii] = val;
+            }
+
+
+        // publish filters
+        data.image[IDoutPF2D].md[0].write = 1;
+        data.image[IDoutPF3D].md[0].write = 1;
+        for(PFpix=0; PFpix<NBpixout; PFpix++)
+            for(dt=0; dt<PForder; dt++)
+                for(pix=0; pix<NBpixin; pix++)
+                {
+                    float val = (float) Wmat[PFpix*n + dt*NBpixin + pix];
+
+                    data.image[IDoutPF2D].array.F[PFpix*n + dt*NBpixin + pix] = val;
+                    data.image[IDoutPF3D].array.F[dt*xysize*xysize + outpixarray_xy[PFpix]*xysize + pixarray_xy[pix]] = val;
+                }
+        COREMOD_MEMORY_image_set_sempost_byID(IDoutPF2D, -1);
+        data.image[IDoutPF2D].md[0].cnt0++;
+        data.image[IDoutPF2D].md[0].write = 0;
+
+        COREMOD_MEMORY_image_set_sempost_byID(IDoutPF3D, -1);
+        data.image[IDoutPF3D].md[0].cnt0++;
+        data.image[IDoutPF3D].md[0].write = 0;
+
+        iter++;
+    }
+
+    free(ybuff);
+    free(xvec);
+    free(Px);
+    free(kvec);
+    free(Pmat);
+    free(Wmat);
+    free(pixarray_xy);
+    free(outpixarray_xy);
+
+    return(IDoutPF2D);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+//
+// Cholesky factorization of symmetric positive definite matrix (lower triangle, row-major, n x n), in place
+// returns -1 if not positive definite
+//
+static int LINARFILTERPRED_cholesky_decomp(double *A, long n)
+{
+    long i, j, k;
+
+    for(j=0; j<n; j++)
+    {
+        double val = A[j*n+j];
+
+        for(k=0; k<j; k++)
+            val -= A[j*n+k]*A[j*n+k];
+        if(val <= 0.0)
+            return(-1);
+        A[j*n+j] = sqrt(val);
+
+        for(i=j+1; i<n; i++)
+        {
+            val = A[i*n+j];
+            for(k=0; k<j; k++)
+                val -= A[i*n+k]*A[j*n+k];
+            A[i*n+j] = val/A[j*n+j];
+        }
+    }
+    return(0);
+}
+
+
+//
+// solve L L' x = b using the leading n1 x n1 block of Cholesky factor L (leading dimension n), b overwritten by x
+// leading block of L is the Cholesky factor of the leading block of A
+//
+static void LINARFILTERPRED_cholesky_solve(const double *L, long n, long n1, double *b)
+{
+    long i, k;
+
+    for(i=0; i<n1; i++)
+    {
+        for(k=0; k<i; k++)
+            b[i] -= L[i*n+k]*b[k];
+        b[i] /= L[i*n+i];
+    }
+    for(i=n1-1; i>=0; i--)
+    {
+        for(k=i+1; k<n1; k++)
+            b[i] -= L[k*n+i]*b[k];
+        b[i] /= L[i*n+i];
+    }
+}
+
+
+
+
+//
+// fast scan of filter order, lag and regularization
+//
+// lagged covariances R(tau) of input modes are computed once, the regression Gram matrix of the largest order is
+// assembled from them (block-Toeplitz) and factored once per regularization value. Lower orders use the leading
+// block of the factorization, lags only change the right hand side.
+//
+// output is 3D image of residual / input variance ratio, axis 0 : order 1...PFordermax, axis 1 : lag, axis 2 : regularization
+// regularization values are log-spaced between RegLambdamin and RegLambdamax, relative to average mode variance
+// uses inmask if it exists
+// results also written to PFscan.txt
+//
+long LINARFILTERPRED_ScanPFparam(const char *IDin_name, long PFordermax, float PFlagmin, float PFlagmax, float PFlagstep, double RegLambdamin, double RegLambdamax, long NBreg, const char *IDout_name)
+{
+    long IDin, IDinmask, IDout;
+    long xysize, nbspl;
+    long NBpix, n;
+    long *pixarray_xy;
+    double *yarray; // input, average removed, nbspl x NBpix
+    double *Rarray; // lagged covariances, NBtau x NBpix x NBpix
+    double *Gmat, *Lmat;
+    double *cvec, *wvec;
+    long NBtau, NBlag;
+    long ii, pix, tau, pix1, pix2, dt1, dt2;
+    long reg, lagi, order;
+    double var0;
+    double resbest = 1.0e20;
+    long orderbest = 0;
+    float lagbest = 0.0;
+    double regbest = 0.0;
+    FILE *fp;
+
+
+    IDin = image_ID(IDin_name);
+    if(IDin == -1)
+    {
+        printf("ERROR: image %s not found\n", IDin_name);
+        return(-1);
+    }
+    if(data.image[IDin].md[0].naxis == 3)
+    {
+        xysize = data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+        nbspl = data.image[IDin].md[0].size[2];
+    }
+    else
+    {
+        xysize = data.image[IDin].md[0].size[0];
+        nbspl = data.image[IDin].md[0].size[1];
+    }
+
+    if((PFlagstep <= 0.0)||(PFlagmax < PFlagmin))
+        NBlag = 1;
+    else
+        NBlag = (long) ((PFlagmax-PFlagmin)/PFlagstep + 1.0e-6) + 1;
+    if(NBreg < 1)
+        NBreg = 1;
+    NBtau = PFordermax + (long) (PFlagmin + (NBlag-1)*PFlagstep) + 2;
+    if(nbspl < 2*NBtau)
+    {
+        printf("ERROR: not enough samples (%ld) for order %ld and lag %f\n", nbspl, PFordermax, PFlagmax);
+        return(-1);
+    }
+
+    pixarray_xy = (long*) malloc(sizeof(long)*xysize);
+    IDinmask = image_ID("inmask");
+    NBpix = 0;
+    for(ii=0; ii<xysize; ii++)
+        if((IDinmask==-1)||(data.image[IDinmask].array.F[ii] > 0.5))
+        {
+            pixarray_xy[NBpix] = ii;
+            NBpix++;
+        }
+    n = NBpix*PFordermax;
+    printf("NBpix = %ld   max order = %ld   NBlag = %ld   NBreg = %ld\n", NBpix, PFordermax, NBlag, NBreg);
+
+
+    // input, average removed
+    yarray = (double*) malloc(sizeof(double)*nbspl*NBpix);
+    for(pix=0; pix<NBpix; pix++)
+    {
+        double ave = 0.0;
+
+        for(ii=0; ii<nbspl; ii++)
+            ave += data.image[IDin].array.F[ii*xysize + pixarray_xy[pix]];
+        ave /= nbspl;
+        for(ii=0; ii<nbspl; ii++)
+            yarray[ii*NBpix + pix] = data.image[IDin].array.F[ii*xysize + pixarray_xy[pix]] - ave;
+    }
+
+    // R(tau)[pix1][pix2] = < y_pix1(t) y_pix2(t+tau) >
+    Rarray = (double*) malloc(sizeof(double)*NBtau*NBpix*NBpix);
+# ifdef _OPENMP
+    #pragma omp parallel for private(pix1, pix2, ii)
+# endif
+    for(tau=0; tau<NBtau; tau++)
+        for(pix1=0; pix1<NBpix; pix1++)
+            for(pix2=0; pix2<NBpix; pix2++)
+            {
+                double val = 0.0;
+
+                for(ii=0; ii<nbspl-tau; ii++)
+                    val += yarray[ii*NBpix + pix1]*yarray[(ii+tau)*NBpix + pix2];
+                Rarray[(tau*NBpix + pix1)*NBpix + pix2] = val/(nbspl-tau);
+            }
+    free(yarray);
+
+    var0 = 0.0;
+    for(pix=0; pix<NBpix; pix++)
+        var0 += Rarray[pix*NBpix + pix];
+
+
+    // block-Toeplitz Gram matrix, index dt*NBpix + pix
+    Gmat = (double*) malloc(sizeof(double)*n*n);
+    Lmat = (double*) malloc(sizeof(double)*n*n);
+    for(dt1=0; dt1<PFordermax; dt1++)
+        for(dt2=0; dt2<PFordermax; dt2++)
+            for(pix1=0; pix1<NBpix; pix1++)
+                for(pix2=0; pix2<NBpix; pix2++)
+                {
+                    double val;
+
+                    if(dt1 >= dt2)
+                        val = Rarray[((dt1-dt2)*NBpix + pix1)*NBpix + pix2];
+                    else
+                        val = Rarray[((dt2-dt1)*NBpix + pix2)*NBpix + pix1];
+                    Gmat[(dt1*NBpix+pix1)*n + dt2*NBpix+pix2] = val;
+                }
+
+    IDout = create_3Dimage_ID(IDout_name, PFordermax, NBlag, NBreg);
+
+    cvec = (double*) malloc(sizeof(double)*n);
+    wvec = (double*) malloc(sizeof(double)*n);
+
+    fp = fopen("PFscan.txt", "w");
+    fprintf(fp, "# order  lag  regularization  residual/input variance\n");
+
+    for(reg=0; reg<NBreg; reg++)
+    {
+        double RegLambda = RegLambdamin;
+
+        if((NBreg > 1)&&(RegLambdamin > 0.0))
+            RegLambda = RegLambdamin*pow(RegLambdamax/RegLambdamin, 1.0*reg/(NBreg-1));
+
+        memcpy(Lmat, Gmat, sizeof(double)*n*n);
+        for(ii=0; ii<n; ii++)
+            Lmat[ii*n+ii] += RegLambda*var0/NBpix;
+        if(LINARFILTERPRED_cholesky_decomp(Lmat, n) != 0)
+        {
+            printf("WARNING: Gram matrix not positive definite for regularization %g, skipping\n", RegLambda);
+            continue;
+        }
+
+        for(lagi=0; lagi<NBlag; lagi++)
+        {
+            float PFlag = PFlagmin + lagi*PFlagstep;
+            long lag0 = (long) PFlag;
+            double alpha = PFlag - lag0;
+
+            for(order=1; order<=PFordermax; order++)
+            {
+                long n1 = order*NBpix;
+                double res = 0.0;
+                long pixout;
+
+                for(pixout=0; pixout<NBpix; pixout++)
+                {
+                    double tvar, val;
+
+                    // target variance, lag interpolated between lag0 and lag0+1
+                    tvar = ((1.0-alpha)*(1.0-alpha) + alpha*alpha)*Rarray[pixout*NBpix + pixout] + 2.0*alpha*(1.0-alpha)*Rarray[(NBpix + pixout)*NBpix + pixout];
+
+                    // regressor / target covariance
+                    for(dt1=0; dt1<order; dt1++)
+                        for(pix=0; pix<NBpix; pix++)
+                            cvec[dt1*NBpix+pix] = (1.0-alpha)*Rarray[((lag0+dt1)*NBpix + pix)*NBpix + pixout] + alpha*Rarray[((lag0+1+dt1)*NBpix + pix)*NBpix + pixout];
+
+                    memcpy(wvec, cvec, sizeof(double)*n1);
+                    LINARFILTERPRED_cholesky_solve(Lmat, n, n1, wvec);
+
+                    // residual = tvar - 2 w'c + w'Gw
+                    val = tvar;
+                    for(ii=0; ii<n1; ii++)
+                    {
+                        double gw = 0.0;
+
+                        for(pix2=0; pix2<n1; pix2++)
+                            gw += Gmat[ii*n+pix2]*wvec[pix2];
+                        val += wvec[ii]*(gw - 2.0*cvec[ii]);
+                    }
+                    res += val;
+                }
+                res /= var0;
+
+                data.image[IDout].array.F[(reg*NBlag + lagi)*PFordermax + order-1] = (float) res;
+                fprintf(fp, "%3ld  %6.3f  %12g  %12g\n", order, PFlag, RegLambda, res);
+
+                if(res < resbest)
+                {
+                    resbest = res;
+                    orderbest = order;
+                    lagbest = PFlag;
+                    regbest = RegLambda;
+                }
+            }
+        }
+    }
+    fclose(fp);
+
+    printf("best : order = %ld   lag = %f   regularization = %g   residual = %g\n", orderbest, lagbest, regbest, resbest);
+
+    free(cvec);
+    free(wvec);
+    free(Gmat);
+    free(Lmat);
+    free(Rarray);
+    free(pixarray_xy);
+
+    return(IDout);
+}
 
 
 
@@ -1521,7 +2065,6 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	long IDPFM;
 	
 	long IDINbuff;
-	long tstep;
 	long *sizearray;
 	long naxis;
 
@@ -1564,6 +2107,10 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	long IDmasterout;
 	char imname[200];
 	
+	float *histbuff; // circular history, each frame written twice so that the last NBPFstep frames are contiguous
+	float *histvec;
+	long histslot;
+	
 	
 	IDmodevalIN = image_ID(IDmodevalIN_name);
 	NBmodeIN0 = data.image[IDmodevalIN].md[0].size[0];
@@ -1601,7 +2148,7 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 			data.image[IDinmask].array.F[ii] = 1.0;
 		inmaskindex = (long*) malloc(sizeof(long)*NBinmaskpix);
 		for(ii=0;ii<data.image[IDinmask].md[0].size[0];ii++)
-			inmaskindex[NBinmaskpix] = ii;
+			inmaskindex[ii] = ii;
 	}
 	NBmodeIN = NBinmaskpix;
 	
@@ -1651,6 +2198,7 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	
 	
 	IDINbuff = create_2Dimage_ID("INbuffer", NBmodeIN, NBPFstep);
+	histbuff = (float*) calloc(2*NBPFstep*NBmodeIN, sizeof(float));
 	
 	sizearray = (long*) malloc(sizeof(long)*2);
 	sizearray[0] = NBmodeOUT;
@@ -1721,13 +2269,20 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	//	printf("\n");
 	//	fflush(stdout);
 			
-		// fill in buffer
+		// fill in circular buffer : newest frame at histslot, previous frames follow
+		histslot = NBPFstep - 1 - (iter % NBPFstep);
+		histvec = histbuff + histslot*NBmodeIN;
 		for(mode=0; mode<NBmodeIN; mode++)
-			data.image[IDINbuff].array.F[mode] = data.image[IDmodevalIN].array.F[IndexOffset + inmaskindex[mode]];
+		{
+			val = data.image[IDmodevalIN].array.F[IndexOffset + inmaskindex[mode]];
+			histvec[mode] = val;
+			histvec[NBPFstep*NBmodeIN + mode] = val;
+		}
 
 
 		if(nbGPU>0)
 		{
+			memcpy(data.image[IDINbuff].array.F, histvec, sizeof(float)*NBmodeIN*NBPFstep);
 	
 			#ifdef HAVE_CUDA
 			if(iter==0)
@@ -1738,14 +2293,9 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 		}
 		else
 		{
-			// compute output : matrix vector mult
+			// compute output : single matrix vector mult over all time steps
 			data.image[IDPFout].md[0].write = 1;
-			for(mode=0;mode<NBmodeOUT;mode++)
-			{
-				data.image[IDPFout].array.F[mode] = 0.0;
-				for(ii=0;ii<NBmodeIN*NBPFstep;ii++)
-					data.image[IDPFout].array.F[mode] += data.image[IDINbuff].array.F[ii] * data.image[IDPFM].array.F[mode*data.image[IDPFM].md[0].size[0]+ii];
-			}
+			cblas_sgemv(CblasRowMajor, CblasNoTrans, NBmodeOUT, NBmodeIN*NBPFstep, 1.0, data.image[IDPFM].array.F, data.image[IDPFM].md[0].size[0], histvec, 1, 0.0, data.image[IDPFout].array.F, 1);
 			COREMOD_MEMORY_image_set_sempost_byID(IDPFout, -1);
 			data.image[IDPFout].md[0].write = 0;
 			data.image[IDPFout].md[0].cnt0++;
@@ -1820,17 +2370,6 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	
 	
 		iter++;
-	
-		if(iter<NBiter)
-			{				
-				// do this now to save time when semaphore is posted
-				for(tstep=NBPFstep-1; tstep>0; tstep--)
-					{
-						// tstep-1 -> tstep
-						for(mode=0; mode<NBmodeIN; mode++)
-							data.image[IDINbuff].array.F[NBmodeIN*tstep + mode] = data.image[IDINbuff].array.F[NBmodeIN*(tstep-1) + mode];
-					}
-			}
 	}
 	printf("LOOP done\n");
 	fflush(stdout);
@@ -1885,6 +2424,7 @@ long LINARFILTERPRED_PF_RealTimeApply(const char *IDmodevalIN_name, long IndexOf
 	}
 	
 	free(inmaskindex);
+	free(histbuff);
 	
 	
 	
@@ -11,6 +11,10 @@ long LINARFILTERPRED_SelectBlock(const char *IDin_name, const char *IDblknb_name
 
 long LINARFILTERPRED_Build_LinPredictor(const char *IDin_name, long PForder, float PFlag, double SVDeps, double RegLambda, const char *IDoutPF_name, int outMode, int LOOPmode, float LOOPgain);
 
+long LINARFILTERPRED_Build_LinPredictor_RLS(const char *IDin_name, long PForder, float PFlag, int semtrig, double RLSlambda, double RLSdelta, const char *IDoutPF_name, long NBiter);
+
+long LINARFILTERPRED_ScanPFparam(const char *IDin_name, long PFordermax, float PFlagmin, float PFlagmax, float PFlagstep, double RegLambdamin, double RegLambdamax, long NBreg, const char *IDout_name);
+
 long LINARFILTERPRED_Apply_LinPredictor_RT(const char *IDfilt_name, const char *IDin_name, const char *IDout_name);
 
 long LINARFILTERPRED_Apply_LinPredictor(const char *IDfilt_name, const char *IDin_name, float PFlag, const char *IDout_name);
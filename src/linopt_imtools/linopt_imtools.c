@@ -31,6 +31,12 @@
 #include <gsl/gsl_eigen.h>
 #include <gsl/gsl_cblas.h>
 #include <gsl/gsl_blas.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_errno.h>
+
+#ifdef HAVE_LAPACKE
+#include <lapacke.h>
+#endif
 
 #ifdef __MACH__
 #include <mach/mach_time.h>
@@ -68,6 +74,10 @@ static int clock_gettime(int clk_id, struct mach_timespec *t){
 
 extern DATA data;
 
+#define LINOPT_ORTHO_BLOCK 64       // modes per block in linopt_imtools_modes_orthogonalize
+#define LINOPT_ORTHO_REFEPS 1.0e-3  // reference modes with relative residual below this are dependent
+#define LINOPT_LINRM_BLOCK 256      // frames per syrk/gemm update in linopt_linRM_accum_*
+
 
 static long NBPARAM;
 static long double C0;
@@ -79,6 +89,16 @@ static long dfcnt = 0;
 
 int fmInit = 0;
 
+// fit plan : pseudo-inverse cached for (modes, mask, SVDeps)
+static int    fitplan_init = 0;
+static long   fitplan_IDmodes = -1;
+static long   fitplan_IDmask = -1;
+static double fitplan_modes_ctime = 0.0;
+static double fitplan_mask_ctime = 0.0;
+static uint64_t fitplan_modes_cnt0 = 0;
+static uint64_t fitplan_mask_cnt0 = 0;
+static double fitplan_SVDeps = 0.0;
+
 
 
 
@@ -185,6 +205,18 @@ int_fast8_t linopt_imtools_makeCPAmodes_cli()
 }
 
 
+int_fast8_t linopt_imtools_modes_orthogonalize_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,3)+CLI_checkarg(4,3)+CLI_checkarg(5,1)+CLI_checkarg(6,2)==0)
+    {
+      linopt_imtools_modes_orthogonalize(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.string, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
 
 
 
@@ -215,9 +247,9 @@ int_fast8_t linopt_imtools_image_construct_cli()
 
 int_fast8_t linopt_imtools_image_construct_stream_cli()
 {
-  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)==0)
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,2)+CLI_checkarg(5,1)+CLI_checkarg(6,1)==0)
     {
-      linopt_imtools_image_construct_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string);
+      linopt_imtools_image_construct_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numf, data.cmdargtoken[6].val.numf);
       return 0;
     }
   else
@@ -274,6 +306,30 @@ int_fast8_t linopt_imtools_image_fitModes_cli()
 }
 
 
+int_fast8_t linopt_imtools_fitplan_apply_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,1)+CLI_checkarg(5,3)==0)
+    {
+      linopt_imtools_fitplan_apply(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t linopt_imtools_fitplan_stream_cli()
+{
+  if(CLI_checkarg(1,4)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,1)+CLI_checkarg(5,3)==0)
+    {
+      linopt_imtools_fitplan_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numf, data.cmdargtoken[5].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
 
 
 /* =============================================================================================== */
@@ -298,6 +354,66 @@ int_fast8_t linopt_compute_linRM_from_inout_cli()
 }
 
 
+int_fast8_t linopt_linRM_accum_init_cli()
+{
+  if(CLI_checkarg(1,3)+CLI_checkarg(2,4)+CLI_checkarg(3,2)+CLI_checkarg(4,2)==0)
+    {
+      linopt_linRM_accum_init(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numl, data.cmdargtoken[4].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t linopt_linRM_accum_cube_cli()
+{
+  if(CLI_checkarg(1,3)+CLI_checkarg(2,4)+CLI_checkarg(3,4)==0)
+    {
+      linopt_linRM_accum_cube(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t linopt_linRM_accum_file_cli()
+{
+  if(CLI_checkarg(1,3)+CLI_checkarg(2,3)+CLI_checkarg(3,3)==0)
+    {
+      linopt_linRM_accum_file(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t linopt_linRM_accum_stream_cli()
+{
+  if(CLI_checkarg(1,3)+CLI_checkarg(2,4)+CLI_checkarg(3,4)+CLI_checkarg(4,2)+CLI_checkarg(5,2)+CLI_checkarg(6,3)+CLI_checkarg(7,1)+CLI_checkarg(8,2)==0)
+    {
+      linopt_linRM_accum_stream(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.string, data.cmdargtoken[4].val.numl, data.cmdargtoken[5].val.numl, data.cmdargtoken[6].val.string, data.cmdargtoken[7].val.numf, data.cmdargtoken[8].val.numl);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
+int_fast8_t linopt_linRM_accum_solve_cli()
+{
+  if(CLI_checkarg(1,3)+CLI_checkarg(2,3)+CLI_checkarg(3,1)==0)
+    {
+      linopt_linRM_accum_solve(data.cmdargtoken[1].val.string, data.cmdargtoken[2].val.string, data.cmdargtoken[3].val.numf);
+      return 0;
+    }
+  else
+    return 1;
+}
+
+
 
 
 
@@ -358,6 +474,8 @@ int init_linopt_imtools()
 
     RegisterCLIcommand("mkFouriermodes", __FILE__, linopt_imtools_makeCPAmodes_cli, "make basis of Fourier Modes", "<output image name> <image size> <CPAmax float> <deltaCPA float> <beam radius> <overfill factor>", "mkFouriermodes fmodes 256 10.0 0.8 80.0 2.0", "long linopt_imtools_makeCPAmodes(const char *ID_name, long size, float CPAmax, float deltaCPA, float radius, float radfactlim)");
 
+    RegisterCLIcommand("orthomodes", __FILE__, linopt_imtools_modes_orthogonalize_cli, "orthogonalize modes over mask (blocked Gram-Schmidt)", "<input modes> <mask> <reference modes or NULL> <output modes> <rmslim> <mode 0:remove ref span, 1:orthonormalize>", "orthomodes fmodes pupmask NULL fmodeso 0.001 1", "long linopt_imtools_modes_orthogonalize(const char *IDin_name, const char *IDmask_name, const char *IDref_name, const char *IDout_name, float rmslim, int mode)");
+
 
 
 /* =============================================================================================== */
@@ -372,7 +490,7 @@ int init_linopt_imtools()
 
     RegisterCLIcommand("imlinconstruct", __FILE__, linopt_imtools_image_construct_cli, "construct image as linear sum of modes", "<modes> <coeffs> <outim>", "imlinconstruct modes coeffs outim", "long linopt_imtools_image_construct(const char *IDmodes_name, const char *IDcoeff_name, const char *ID_name)");
 
-    RegisterCLIcommand("imlinconstructs", __FILE__, linopt_imtools_image_construct_stream_cli, "construct image as linear sum of modes (stream mode)", "<modes> <coeffs> <outim>", "imlinconstructs modes coeffs outim", "long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name)");
+    RegisterCLIcommand("imlinconstructs", __FILE__, linopt_imtools_image_construct_stream_cli, "construct image as linear sum of modes (stream mode)", "<modes> <coeffs> <outim> <GPU index, -1 for CPU> <coeff limit> <max output freq [Hz], 0 for no limit>", "imlinconstructs modes coeffs outim -1 0.0 100.0", "long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name, int GPUindex, float coefflim, float maxfreq)");
 
     RegisterCLIcommand("imsvd", __FILE__, linopt_compute_SVDdecomp_cli, "Singular values decomposition", "<image cube> <SVD modes> <coeffs>", "imsvd imc svdm coeffs", "long linopt_compute_SVDdecomp(const char *IDin_name, const char *IDout_name, const char *IDcoeff_name)");
 
@@ -383,6 +501,10 @@ int init_linopt_imtools()
 
     RegisterCLIcommand("imfitmodes", __FILE__, linopt_imtools_image_fitModes_cli, "fit image as sum of modes", "<imname> <modes> <mask> <epssvd> <outcoeff>", "imfitmodes im modes mask 0.01 outcim", "long linopt_imtools_image_fitModes(const char *ID_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name, int reuse)");
 
+    RegisterCLIcommand("imfitplan", __FILE__, linopt_imtools_fitplan_apply_cli, "fit image or cube as sum of modes, cached pseudo-inverse", "<imname/cube> <modes> <mask> <epssvd> <outcoeff>", "imfitplan imc modes mask 0.01 outcim", "long linopt_imtools_fitplan_apply(const char *ID_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name)");
+
+    RegisterCLIcommand("imfitplans", __FILE__, linopt_imtools_fitplan_stream_cli, "fit image stream as sum of modes (stream mode)", "<instream> <modes> <mask> <epssvd> <outcoeff stream>", "imfitplans wfs modes mask 0.01 wfscoeff", "long linopt_imtools_fitplan_stream(const char *IDin_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name)");
+
    
 
 /* =============================================================================================== */
@@ -395,6 +517,16 @@ int init_linopt_imtools()
 
  
 	RegisterCLIcommand("lincRMiter", __FILE__, linopt_compute_linRM_from_inout_cli, "estimate response matrix from input and output", "<input cube> <inmask> <output cube> <RM>", "lincRMiter inC inmask outC imRM", "long linopt_compute_linRM_iter(const char *IDinput_name, const char *IDinmask_name, const char *IDoutput_name, const char *IDRM_name)");
+
+    RegisterCLIcommand("linRMinit", __FILE__, linopt_linRM_accum_init_cli, "initialize streaming response matrix accumulator", "<accumulator> <inmask> <output xsize> <output ysize>", "linRMinit RMacc inmask 120 120", "long linopt_linRM_accum_init(const char *IDacc_name, const char *IDinmask_name, long xsizeout, long ysizeout)");
+
+    RegisterCLIcommand("linRMacc", __FILE__, linopt_linRM_accum_cube_cli, "add input/output cubes to response matrix accumulator", "<accumulator> <input cube> <output cube>", "linRMacc RMacc inC outC", "long linopt_linRM_accum_cube(const char *IDacc_name, const char *IDinput_name, const char *IDoutput_name)");
+
+    RegisterCLIcommand("linRMaccf", __FILE__, linopt_linRM_accum_file_cli, "add input/output FITS cubes to response matrix accumulator, chunked read", "<accumulator> <input file> <output file>", "linRMaccf RMacc inC.fits outC.fits", "long linopt_linRM_accum_file(const char *IDacc_name, const char *fnamein, const char *fnameout)");
+
+    RegisterCLIcommand("linRMaccs", __FILE__, linopt_linRM_accum_stream_cli, "add input/output streams to response matrix accumulator", "<accumulator> <input stream> <output stream> <delay [frame]> <NBframe, 0=forever> <RM> <regularization> <solve period [frame]>", "linRMaccs RMacc dmC wfsres 2 100000 imRM 1e-4 10000", "long linopt_linRM_accum_stream(const char *IDacc_name, const char *IDinstream_name, const char *IDoutstream_name, long delay, long NBframe, const char *IDRM_name, double regul, long solveperiod)");
+
+    RegisterCLIcommand("linRMsolve", __FILE__, linopt_linRM_accum_solve_cli, "solve response matrix from accumulator", "<accumulator> <RM> <regularization>", "linRMsolve RMacc imRM 1e-4", "long linopt_linRM_accum_solve(const char *IDacc_name, const char *IDRM_name, double regul)");
     
 
    
@@ -865,6 +997,190 @@ long linopt_imtools_makeCPAmodes(const char *ID_name, long size, float CPAmax, f
 
 
 
+//
+// Blocked Gram-Schmidt over pixels with mask > 0, in coordinates scaled by sqrt(mask)
+// Q : NBq orthonormal rows (N pixels, first Nact active), X : nb rows to process
+// If addQ = 1, rows of X are orthonormalized against each other and appended to Q
+// keep[j] = 0 if residual row j has squared norm <= rmslim2 x its input squared norm
+//
+static void linopt_imtools_ortho_block(double *Q, long *NBq, double *X, long nb, long N, long Nact, double rmslim2, int addQ, int *keep, double *C)
+{
+    long j, i;
+    int pass;
+    long NBq0 = *NBq;
+    double *nrm0;
+
+    nrm0 = (double*) malloc(sizeof(double)*nb);
+    for(j=0; j<nb; j++)
+        nrm0[j] = cblas_ddot(Nact, X+j*N, 1, X+j*N, 1);
+
+    // projection on previous rows, two passes for orthogonality to working precision
+    if(NBq0 > 0)
+        for(pass=0; pass<2; pass++)
+        {
+            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, NBq0, nb, Nact, 1.0, Q, N, X, N, 0.0, C, nb);
+            cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, nb, N, NBq0, -1.0, C, nb, Q, N, 1.0, X, N);
+        }
+
+    for(j=0; j<nb; j++)
+    {
+        double *xj = X+j*N;
+        double nrm;
+
+        if(addQ == 1)
+            for(pass=0; pass<2; pass++)
+                for(i=NBq0; i<*NBq; i++)
+                    cblas_daxpy(N, -cblas_ddot(Nact, Q+i*N, 1, xj, 1), Q+i*N, 1, xj, 1);
+
+        nrm = cblas_ddot(Nact, xj, 1, xj, 1);
+        keep[j] = ((nrm < rmslim2*nrm0[j])||((addQ == 1)&&(nrm <= 0.0))) ? 0 : 1;
+
+        if((addQ == 1)&&(keep[j] == 1))
+        {
+            cblas_dscal(N, 1.0/sqrt(nrm), xj, 1);
+            if(Q+(*NBq)*N != xj)
+                memcpy(Q+(*NBq)*N, xj, sizeof(double)*N);
+            (*NBq)++;
+        }
+    }
+
+    free(nrm0);
+}
+
+
+
+/**
+ * @brief Orthogonalizes modes over mask (blocked Gram-Schmidt, BLAS-3)
+ *
+ * Inner product is the sum over pixels of mask x a x b. Modes of IDref_name (may be "NULL") span a subspace
+ * removed from the input modes; they are orthonormalized internally and not written.\n
+ * mode 0 : input modes minus their projection on IDref span\n
+ * mode 1 : input modes also orthogonalized against each other, in input order, and normalized to RMS = 1 over mask\n
+ * A mode is dropped if its residual RMS over mask is below rmslim x its input RMS (never if rmslim = 0 in mode 0).\n
+ * Blocks of LINOPT_ORTHO_BLOCK modes are projected on previous modes with two DGEMM passes (BCGS2), modified
+ * Gram-Schmidt with reorthogonalization within block. Pixels outside mask follow the same linear combinations.\n
+ * Returns number of modes written to IDout_name (image not created if 0).
+ */
+long linopt_imtools_modes_orthogonalize(const char *IDin_name, const char *IDmask_name, const char *IDref_name, const char *IDout_name, float rmslim, int mode)
+{
+    long IDin, IDmask, IDref = -1, IDout;
+    long N, Nact, NBin, NBref = 0;
+    long ii, p, k, k0, nb;
+    long *perm;
+    double *sw;
+    double *Q;
+    double *X;
+    double *C;
+    int *keep;
+    long NBq = 0;
+    long NBout;
+    double totw = 0.0;
+
+
+    IDin = image_ID(IDin_name);
+    IDmask = image_ID(IDmask_name);
+    if((IDin == -1)||(IDmask == -1))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "input modes or mask missing");
+        return(0);
+    }
+    N = (long) data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+    NBin = (data.image[IDin].md[0].naxis > 2) ? data.image[IDin].md[0].size[2] : 1;
+    if(data.image[IDmask].md[0].nelement != N)
+    {
+        printERROR(__FILE__, __func__, __LINE__, "mask size does not match modes");
+        return(0);
+    }
+    if(strcmp(IDref_name, "NULL") != 0)
+    {
+        IDref = image_ID(IDref_name);
+        if((IDref == -1)||((long) data.image[IDref].md[0].size[0]*data.image[IDref].md[0].size[1] != N))
+        {
+            printERROR(__FILE__, __func__, __LINE__, "reference modes missing or wrong size");
+            return(0);
+        }
+        NBref = (data.image[IDref].md[0].naxis > 2) ? data.image[IDref].md[0].size[2] : 1;
+    }
+
+    // active pixels first, scaled by sqrt(mask)
+    perm = (long*) malloc(sizeof(long)*N);
+    sw = (double*) malloc(sizeof(double)*N);
+    Nact = 0;
+    for(ii=0; ii<N; ii++)
+        if(data.image[IDmask].array.F[ii] > 0.0)
+        {
+            totw += data.image[IDmask].array.F[ii];
+            perm[Nact++] = ii;
+        }
+    p = Nact;
+    for(ii=0; ii<N; ii++)
+        if(!(data.image[IDmask].array.F[ii] > 0.0))
+            perm[p++] = ii;
+    for(p=0; p<N; p++)
+        sw[p] = (p < Nact) ? sqrt(data.image[IDmask].array.F[perm[p]]) : 1.0;
+
+    Q = (double*) malloc(sizeof(double)*(NBref+((mode == 1) ? NBin : 0)+1)*N);
+    X = (double*) malloc(sizeof(double)*NBin*N);
+    C = (double*) malloc(sizeof(double)*(NBref+NBin+1)*LINOPT_ORTHO_BLOCK);
+    keep = (int*) malloc(sizeof(int)*(NBin+LINOPT_ORTHO_BLOCK));
+    if((Q == NULL)||(X == NULL)||(C == NULL)||(keep == NULL))
+    {
+        printERROR(__FILE__, __func__, __LINE__, "malloc error");
+        exit(0);
+    }
+
+    // reference subspace basis, dependent reference modes skipped
+    for(k0=0; k0<NBref; k0+=LINOPT_ORTHO_BLOCK)
+    {
+        nb = (NBref-k0 < LINOPT_ORTHO_BLOCK) ? NBref-k0 : LINOPT_ORTHO_BLOCK;
+        for(k=0; k<nb; k++)
+            for(p=0; p<N; p++)
+                Q[(NBq+k)*N+p] = sw[p]*data.image[IDref].array.F[(k0+k)*N+perm[p]];
+        linopt_imtools_ortho_block(Q, &NBq, Q+NBq*N, nb, N, Nact, LINOPT_ORTHO_REFEPS*LINOPT_ORTHO_REFEPS, 1, keep, C);
+    }
+
+    for(k=0; k<NBin; k++)
+        for(p=0; p<N; p++)
+            X[k*N+p] = sw[p]*data.image[IDin].array.F[k*N+perm[p]];
+
+    for(k0=0; k0<NBin; k0+=LINOPT_ORTHO_BLOCK)
+    {
+        nb = (NBin-k0 < LINOPT_ORTHO_BLOCK) ? NBin-k0 : LINOPT_ORTHO_BLOCK;
+        linopt_imtools_ortho_block(Q, &NBq, X+k0*N, nb, N, Nact, (double) rmslim*rmslim, (mode == 1) ? 1 : 0, keep+k0, C);
+    }
+
+    NBout = 0;
+    for(k=0; k<NBin; k++)
+        NBout += keep[k];
+
+    if(NBout > 0)
+    {
+        double a = (mode == 1) ? sqrt(totw) : 1.0;
+        long k1 = 0;
+
+        IDout = create_3Dimage_ID(IDout_name, data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1], NBout);
+        for(k=0; k<NBin; k++)
+            if(keep[k] == 1)
+            {
+                for(p=0; p<N; p++)
+                    data.image[IDout].array.F[k1*N+perm[p]] = (float) (a*X[k*N+p]/sw[p]);
+                k1++;
+            }
+    }
+
+    free(perm);
+    free(sw);
+    free(Q);
+    free(X);
+    free(C);
+    free(keep);
+
+    return(NBout);
+}
+
+
+
+
 
 
 /* =============================================================================================== */
@@ -1001,73 +1317,145 @@ long linopt_imtools_image_construct(const char *IDmodes_name, const char *IDcoef
 
 
 
+//
 // FLOAT only
-long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name)
+// GPUindex >= 0 : hand over to CUDACOMP_Coeff2Map_Loop (requires CUDA)
+// coefficients with |c| <= coefflim are skipped, if few remain the image is built by saxpy over those modes only, otherwise by sgemv
+// maxfreq > 0 : output published at most maxfreq times per second, last coefficients always published
+//
+long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name, int GPUindex, float coefflim, float maxfreq)
 {
     long IDout;
     long IDmodes;
     long IDcoeff;
-    long ii, jj, kk;
-    long xsize, ysize, zsize;
+    long kk;
+    long zsize;
     long sizexy;
-    int semval;
-    int atype;
     long long cnt = 0;
     int RT_priority = 80; //any number from 0-99
     struct sched_param schedpar;
 	int NOSEM = 1; // ignore input semaphore, use counter
-   
-    
+    long *kkarray;
+    long NBkk;
+    int pending = 0; // coefficient update not yet published
+    double tpublish = 0.0; // minimum time between publications
+    double tnow, tlast = -1.0e10;
+    struct timespec ts;
+    int newframe;
+
+
+    IDmodes = image_ID(IDmodes_name);
+    IDout = image_ID(IDout_name);
+    IDcoeff = image_ID(IDcoeff_name);
+    if((IDmodes==-1)||(IDout==-1)||(IDcoeff==-1))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"missing modes, coefficient or output image");
+        return(-1);
+    }
+
+    if(GPUindex>=0)
+    {
+#ifdef HAVE_CUDA
+        CUDACOMP_Coeff2Map_Loop(IDmodes_name, IDcoeff_name, GPUindex, IDout_name, 0, " ");
+        return(IDout);
+#else
+        printf("No CUDA support, using CPU\n");
+#endif
+    }
+
     schedpar.sched_priority = RT_priority;
     #ifndef __MACH__
     sched_setscheduler(0, SCHED_FIFO, &schedpar); //other option is SCHED_RR, might be faster
     #endif
- 
-  
-  
-    IDmodes = image_ID(IDmodes_name);
-    atype = data.image[IDmodes].md[0].atype;
 
-    xsize = data.image[IDmodes].md[0].size[0];
-    ysize = data.image[IDmodes].md[0].size[1];
     zsize = data.image[IDmodes].md[0].size[2];
-
-    sizexy = xsize*ysize;
+    sizexy = (long) data.image[IDmodes].md[0].size[0]*data.image[IDmodes].md[0].size[1];
 
 	if(variable_ID("NOSEM")!=-1)
 		NOSEM = 1;
 	else
 		NOSEM = 0;
 
-    IDout = image_ID(IDout_name);
-    IDcoeff = image_ID(IDcoeff_name);
+    if(maxfreq>0.0)
+        tpublish = 1.0/maxfreq;
+
+    kkarray = (long*) malloc(sizeof(long)*zsize);
 
     while(1==1)
     {
+        newframe = 0;
         if((data.image[IDcoeff].md[0].sem==0)||(NOSEM==1))
         {
             while(cnt==data.image[IDcoeff].md[0].cnt0) // test if new frame exists
+            {
+                if(pending==1)
+                {
+                    clock_gettime(CLOCK_MONOTONIC, &ts);
+                    if(1.0*ts.tv_sec+1.0e-9*ts.tv_nsec >= tlast+tpublish)
+                        break;
+                }
                 usleep(5);
+            }
+            if(cnt!=data.image[IDcoeff].md[0].cnt0)
+                newframe = 1;
             cnt = data.image[IDcoeff].md[0].cnt0;
         }
+        else if(pending==1)
+        {
+            // wait for next coefficients, at most until pending update is due
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            tnow = 1.0*ts.tv_sec+1.0e-9*ts.tv_nsec;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            if(tlast+tpublish > tnow)
+            {
+                ts.tv_nsec += (long) (1.0e9*(tlast+tpublish-tnow));
+                ts.tv_sec += ts.tv_nsec/1000000000;
+                ts.tv_nsec %= 1000000000;
+            }
+            if(sem_timedwait(data.image[IDcoeff].semptr[0], &ts)==0)
+                newframe = 1;
+        }
         else
+        {
             sem_wait(data.image[IDcoeff].semptr[0]);
+            newframe = 1;
+        }
 
-         for(ii=0; ii<sizexy; ii++)
-            data.image[IDout].array.F[ii] = 0.0;
-                
-        data.image[IDout].md[0].write = 1;
+        if(newframe==1)
+            pending = 1;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        tnow = 1.0*ts.tv_sec+1.0e-9*ts.tv_nsec;
+        if((pending==0)||(tnow < tlast+tpublish))
+            continue;
+
+        NBkk = 0;
         for(kk=0; kk<zsize; kk++)
-            for(ii=0; ii<sizexy; ii++)
-                data.image[IDout].array.F[ii] += data.image[IDcoeff].array.F[kk] * data.image[IDmodes].array.F[kk*sizexy+ii];
-        sem_getvalue(data.image[IDout].semptr[0], &semval);
-        if(semval<SEMAPHORE_MAXVAL)
-            sem_post(data.image[IDout].semptr[0]);
+            if(fabs(data.image[IDcoeff].array.F[kk])>coefflim)
+            {
+                kkarray[NBkk] = kk;
+                NBkk++;
+            }
 
+        data.image[IDout].md[0].write = 1;
+        if(NBkk*4 < zsize)
+        {
+            memset(data.image[IDout].array.F, 0, sizeof(float)*sizexy);
+            for(kk=0; kk<NBkk; kk++)
+                cblas_saxpy(sizexy, data.image[IDcoeff].array.F[kkarray[kk]], data.image[IDmodes].array.F + kkarray[kk]*sizexy, 1, data.image[IDout].array.F, 1);
+        }
+        else
+            cblas_sgemv(CblasRowMajor, CblasTrans, zsize, sizexy, 1.0, data.image[IDmodes].array.F, sizexy, data.image[IDcoeff].array.F, 1, 0.0, data.image[IDout].array.F, 1);
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
         data.image[IDout].md[0].cnt0++;
         data.image[IDout].md[0].write = 0;
+
+        pending = 0;
+        tlast = tnow;
     }
 
+    free(kkarray);
+
     return(IDout);
 }
 
@@ -1199,71 +1587,283 @@ long linopt_compute_SVDdecomp(const char *IDin_name, const char *IDout_name, con
 
 
 
+#ifdef HAVE_LAPACKE
 //
-// Computes control matrix
-// Conventions:
-//   m: number of actuators (= NB_MODES)
-//   n: number of sensors  (= # of pixels)
+// LAPACKE/OpenBLAS implementation of linopt_compute_SVDpseudoInverse (same conventions and outputs)
 //
-// This implementation computes the eigenvalue decomposition of transpose(M) x M, so it is efficient if n>>m, as transpose(M) x M is size m x m
+// transpose(M) x M is computed with threaded syrk (ssyrk on float input, dsyrk on double input),
+// then decomposed in double precision: dsyevd for the full spectrum, or dsyevr restricted to the
+// MaxNBmodes largest eigenvalues if MaxNBmodes < m (truncated solver). Eigenvectors beyond the
+// computed range are written as zero in the VT matrix.
 //
-int linopt_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name) /* works even for m != n */
+static int linopt_compute_SVDpseudoInverse_lapacke(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name)
 {
     FILE *fp;
-    char fname[200];
-    long ii1, jj1, k, ii, jj;
-    gsl_matrix *matrix_D; /* this is the response matrix */
-    gsl_matrix *matrix_Ds; /* this is the pseudo inverse of D */
-    gsl_matrix *matrix_Dtra;
-    gsl_matrix *matrix_DtraD;
-    gsl_matrix *matrix_DtraDinv;
-    gsl_matrix *matrix_DtraD_evec;
-    gsl_matrix *matrix1;
-    gsl_matrix *matrix2;
-    gsl_vector *matrix_DtraD_eval;
-    gsl_eigen_symmv_workspace *w;
-
-    gsl_matrix *matrix_save;
-
-    long m;
-    long n;
     long ID_Rmatrix, ID_Cmatrix, ID_VTmatrix;
-    uint32_t *arraysizetmp;
-    double egvlim;
-    long nbmodesremoved;
-
+    uint32_t arraysizetmp[3];
+    long m, n;
+    long ii, k;
+    long MaxNBmodes1, NBeval, mode;
     int atype;
-
-	long maxMode, MaxNBmodes1, mode;
-	
-	// Timing
-	int timing = 1; 
-	struct timespec t0, t1, t2, t3, t4, t5, t6, t7;
-    double t01d, t12d, t23d, t34d, t45d, t56d, t67d;
-	struct timespec tdiff;
-
-	int testmode = 0;
-	long ID_AtA;
-	long ID;
-
-
+    double *AtA;
+    double *evec;  // column-major m x NBeval, ascending eigenvalues
+    double *eval;
+    double *M2;    // pseudo-inverse of transpose(M) x M
+    double egvlim;
+    lapack_int info;
 
 
-    printf("[CPU (gsl) SVD start]");
+    printf("[CPU (lapacke) SVD start]");
     fflush(stdout);
 
-	if(timing==1)
-		clock_gettime(CLOCK_REALTIME, &t0);
-		
-
-    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
-
-
     ID_Rmatrix = image_ID(ID_Rmatrix_name);
     if(ID_Rmatrix==-1)
-		{
-			printf("ERROR: matrix %s not found in memory\n", ID_Rmatrix_name);
-			exit(0);
+    {
+        printf("ERROR: matrix %s not found in memory\n", ID_Rmatrix_name);
+        exit(0);
+    }
+    atype = data.image[ID_Rmatrix].md[0].atype;
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        n = data.image[ID_Rmatrix].md[0].size[0]*data.image[ID_Rmatrix].md[0].size[1];
+        m = data.image[ID_Rmatrix].md[0].size[2];
+    }
+    else
+    {
+        n = data.image[ID_Rmatrix].md[0].size[0];
+        m = data.image[ID_Rmatrix].md[0].size[1];
+    }
+    printf("m = %ld , n = %ld \n", m, n);
+    fflush(stdout);
+
+    MaxNBmodes1 = MaxNBmodes;
+    if(MaxNBmodes1>m)
+        MaxNBmodes1 = m;
+    if(MaxNBmodes1>n)
+        MaxNBmodes1 = n;
+
+
+    // transpose(M) x M, upper triangle, column-major
+    // M is column-major n x m : element (ii,k) at k*n+ii
+    AtA = (double*) malloc(sizeof(double)*m*m);
+    if(atype==_DATATYPE_FLOAT)
+    {
+        float *AtAf = (float*) malloc(sizeof(float)*m*m);
+
+        cblas_ssyrk(CblasColMajor, CblasUpper, CblasTrans, m, n, 1.0, data.image[ID_Rmatrix].array.F, n, 0.0, AtAf, m);
+        for(ii=0; ii<m*m; ii++)
+            AtA[ii] = AtAf[ii];
+        free(AtAf);
+    }
+    else
+        cblas_dsyrk(CblasColMajor, CblasUpper, CblasTrans, m, n, 1.0, data.image[ID_Rmatrix].array.D, n, 0.0, AtA, m);
+
+
+    // eigen decomposition
+    eval = (double*) malloc(sizeof(double)*m);
+    if(MaxNBmodes1 < m)
+    {
+        lapack_int nfound = 0;
+        lapack_int *isuppz = (lapack_int*) malloc(sizeof(lapack_int)*2*MaxNBmodes1);
+
+        evec = (double*) malloc(sizeof(double)*m*MaxNBmodes1);
+        info = LAPACKE_dsyevr(LAPACK_COL_MAJOR, 'V', 'I', 'U', m, AtA, m, 0.0, 0.0, m-MaxNBmodes1+1, m, 0.0, &nfound, eval, evec, m, isuppz);
+        free(isuppz);
+        NBeval = nfound;
+    }
+    else
+    {
+        info = LAPACKE_dsyevd(LAPACK_COL_MAJOR, 'V', 'U', m, AtA, m, eval);
+        evec = AtA;
+        AtA = NULL;
+        NBeval = m;
+    }
+    if(info != 0)
+    {
+        printf("ERROR: LAPACKE eigen decomposition failed, info = %d\n", (int) info);
+        exit(0);
+    }
+    free(AtA); // no-op if evec took ownership
+
+    // reverse to descending order (evec columns and eval)
+    for(k=0; k<NBeval/2; k++)
+    {
+        long k1 = NBeval-1-k;
+        double tmp = eval[k];
+
+        eval[k] = eval[k1];
+        eval[k1] = tmp;
+        for(ii=0; ii<m; ii++)
+        {
+            tmp = evec[k*m+ii];
+            evec[k*m+ii] = evec[k1*m+ii];
+            evec[k1*m+ii] = tmp;
+        }
+    }
+
+    // Write eigenvalues
+    if((fp=fopen("eigenv.dat", "w"))==NULL)
+    {
+        printf("ERROR: cannot create file \"eigenv.dat\"\n");
+        exit(0);
+    }
+    for(k=0; k<NBeval; k++)
+        fprintf(fp,"%ld %g\n", k, sqrt(fabs(eval[k])));
+    fclose(fp);
+
+    egvlim = SVDeps*SVDeps * eval[0];
+    mode = 0;
+    while( (mode<MaxNBmodes1) && (mode<NBeval) && (eval[mode]>egvlim) )
+        mode++;
+    printf("Keeping %ld modes  (SVDeps = %g-> %g, MaxNBmodes = %ld -> %ld)\n", mode, SVDeps, egvlim, MaxNBmodes, MaxNBmodes1);
+    MaxNBmodes1 = mode;
+
+
+    // Write rotation matrix
+    arraysizetmp[0] = m;
+    arraysizetmp[1] = m;
+    if(atype==_DATATYPE_FLOAT)
+    {
+        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+        for(ii=0; ii<NBeval; ii++) // modes
+            for(k=0; k<m; k++)
+                data.image[ID_VTmatrix].array.F[k*m+ii] = (float) evec[ii*m+k];
+    }
+    else
+    {
+        ID_VTmatrix = create_image_ID(ID_VTmatrix_name, 2, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+        for(ii=0; ii<NBeval; ii++) // modes
+            for(k=0; k<m; k++)
+                data.image[ID_VTmatrix].array.D[k*m+ii] = evec[ii*m+k];
+    }
+
+
+    // pseudo-inverse of transpose(M) x M : M2 = V_k diag(1/eval) V_k^T  (symmetric)
+    {
+        double *Vs = (double*) malloc(sizeof(double)*m*(MaxNBmodes1+1));
+
+        for(k=0; k<MaxNBmodes1; k++)
+            for(ii=0; ii<m; ii++)
+                Vs[k*m+ii] = evec[k*m+ii]/eval[k];
+        M2 = (double*) calloc(m*m, sizeof(double));
+        if(MaxNBmodes1 > 0)
+            cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, m, m, MaxNBmodes1, 1.0, Vs, m, evec, m, 0.0, M2, m);
+        free(Vs);
+    }
+    free(evec);
+    free(eval);
+
+
+    // Control matrix : element (k,ii) at k*n+ii, i.e. column-major n x m = M x M2
+    if(data.image[ID_Rmatrix].md[0].naxis==3)
+    {
+        arraysizetmp[0] = data.image[ID_Rmatrix].md[0].size[0];
+        arraysizetmp[1] = data.image[ID_Rmatrix].md[0].size[1];
+        arraysizetmp[2] = m;
+    }
+    else
+    {
+        arraysizetmp[0] = n;
+        arraysizetmp[1] = m;
+    }
+
+    if(atype==_DATATYPE_FLOAT)
+    {
+        float *M2f = (float*) malloc(sizeof(float)*m*m);
+
+        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_FLOAT, 0, 0);
+        ID_Rmatrix = image_ID(ID_Rmatrix_name);
+        for(ii=0; ii<m*m; ii++)
+            M2f[ii] = (float) M2[ii];
+        cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, n, m, m, 1.0, data.image[ID_Rmatrix].array.F, n, M2f, m, 0.0, data.image[ID_Cmatrix].array.F, n);
+        free(M2f);
+    }
+    else
+    {
+        ID_Cmatrix = create_image_ID(ID_Cmatrix_name, data.image[ID_Rmatrix].md[0].naxis, arraysizetmp, _DATATYPE_DOUBLE, 0, 0);
+        ID_Rmatrix = image_ID(ID_Rmatrix_name);
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, n, m, m, 1.0, data.image[ID_Rmatrix].array.D, n, M2, m, 0.0, data.image[ID_Cmatrix].array.D, n);
+    }
+    free(M2);
+
+    printf("[CPU pseudo-inverse done]\n");
+    fflush(stdout);
+
+    return(ID_Cmatrix);
+}
+#endif
+
+
+
+//
+// Computes control matrix
+// Conventions:
+//   m: number of actuators (= NB_MODES)
+//   n: number of sensors  (= # of pixels)
+//
+// This implementation computes the eigenvalue decomposition of transpose(M) x M, so it is efficient if n>>m, as transpose(M) x M is size m x m
+//
+int linopt_compute_SVDpseudoInverse(const char *ID_Rmatrix_name, const char *ID_Cmatrix_name, double SVDeps, long MaxNBmodes, const char *ID_VTmatrix_name) /* works even for m != n */
+{
+    FILE *fp;
+    char fname[200];
+    long ii1, jj1, k, ii, jj;
+    gsl_matrix *matrix_D; /* this is the response matrix */
+    gsl_matrix *matrix_Ds; /* this is the pseudo inverse of D */
+    gsl_matrix *matrix_Dtra;
+    gsl_matrix *matrix_DtraD;
+    gsl_matrix *matrix_DtraDinv;
+    gsl_matrix *matrix_DtraD_evec;
+    gsl_matrix *matrix1;
+    gsl_matrix *matrix2;
+    gsl_vector *matrix_DtraD_eval;
+    gsl_eigen_symmv_workspace *w;
+
+    gsl_matrix *matrix_save;
+
+    long m;
+    long n;
+    long ID_Rmatrix, ID_Cmatrix, ID_VTmatrix;
+    uint32_t *arraysizetmp;
+    double egvlim;
+    long nbmodesremoved;
+
+    int atype;
+
+	long maxMode, MaxNBmodes1, mode;
+	
+	// Timing
+	int timing = 1; 
+	struct timespec t0, t1, t2, t3, t4, t5, t6, t7;
+    double t01d, t12d, t23d, t34d, t45d, t56d, t67d;
+	struct timespec tdiff;
+
+	int testmode = 0;
+	long ID_AtA;
+	long ID;
+
+
+
+#ifdef HAVE_LAPACKE
+    return(linopt_compute_SVDpseudoInverse_lapacke(ID_Rmatrix_name, ID_Cmatrix_name, SVDeps, MaxNBmodes, ID_VTmatrix_name));
+#endif
+
+
+    printf("[CPU (gsl) SVD start]");
+    fflush(stdout);
+
+	if(timing==1)
+		clock_gettime(CLOCK_REALTIME, &t0);
+		
+
+    arraysizetmp = (uint32_t*) malloc(sizeof(uint32_t)*3);
+
+
+    ID_Rmatrix = image_ID(ID_Rmatrix_name);
+    if(ID_Rmatrix==-1)
+		{
+			printf("ERROR: matrix %s not found in memory\n", ID_Rmatrix_name);
+			exit(0);
 		}
     atype = data.image[ID_Rmatrix].md[0].atype;
     if(data.image[ID_Rmatrix].md[0].naxis==3)
@@ -1781,6 +2381,187 @@ long linopt_imtools_image_fitModes(const char *ID_name, const char *IDmodes_name
 
 
 
+//
+// (re)computes fit plan if modes, mask or SVDeps changed
+// plan images : _fp_pixind, _fp_pixmul, _fp_respm, _fp_recm, _fp_vtmat
+// returns ID of reconstruction matrix _fp_recm
+//
+static long linopt_imtools_fitplan_update(const char *IDmodes_name, const char *IDmask_name, double SVDeps)
+{
+    long IDmodes, IDmask;
+
+    IDmodes = image_ID(IDmodes_name);
+    IDmask = image_ID(IDmask_name);
+    if((IDmodes==-1)||(IDmask==-1))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"modes or mask image missing");
+        return(-1);
+    }
+
+    if((fitplan_init==1)
+            &&(fitplan_IDmodes==IDmodes)&&(fitplan_modes_ctime==data.image[IDmodes].md[0].creation_time)&&(fitplan_modes_cnt0==data.image[IDmodes].md[0].cnt0)
+            &&(fitplan_IDmask==IDmask)&&(fitplan_mask_ctime==data.image[IDmask].md[0].creation_time)&&(fitplan_mask_cnt0==data.image[IDmask].md[0].cnt0)
+            &&(fitplan_SVDeps==SVDeps))
+        return(image_ID("_fp_recm"));
+
+    if(fitplan_init==1)
+    {
+        delete_image_ID("_fp_pixind");
+        delete_image_ID("_fp_pixmul");
+        delete_image_ID("_fp_respm");
+        delete_image_ID("_fp_recm");
+        delete_image_ID("_fp_vtmat");
+    }
+
+    linopt_imtools_mask_to_pixtable(IDmask_name, "_fp_pixind", "_fp_pixmul");
+    linopt_imtools_Image_to_vec(IDmodes_name, "_fp_pixind", "_fp_pixmul", "_fp_respm");
+#ifdef HAVE_MAGMA
+    CUDACOMP_magma_compute_SVDpseudoInverse("_fp_respm", "_fp_recm", SVDeps, 10000, "_fp_vtmat", 0);
+#else
+    linopt_compute_SVDpseudoInverse("_fp_respm", "_fp_recm", SVDeps, 10000, "_fp_vtmat");
+#endif
+
+    fitplan_IDmodes = IDmodes;
+    fitplan_IDmask = IDmask;
+    fitplan_modes_ctime = data.image[IDmodes].md[0].creation_time;
+    fitplan_mask_ctime = data.image[IDmask].md[0].creation_time;
+    fitplan_modes_cnt0 = data.image[IDmodes].md[0].cnt0;
+    fitplan_mask_cnt0 = data.image[IDmask].md[0].cnt0;
+    fitplan_SVDeps = SVDeps;
+    fitplan_init = 1;
+
+    return(image_ID("_fp_recm"));
+}
+
+
+
+
+//
+// fit image or cube of images (ID_name) with modes, using cached fit plan
+// output coefficients : size m x 1 for single image, m x NBframe for cube
+// cube is decomposed with a single GEMM
+//
+long linopt_imtools_fitplan_apply(const char *ID_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name)
+{
+    long ID, IDrecm, IDmvec, IDcoeff;
+    long m, n, NBframe;
+
+    IDrecm = linopt_imtools_fitplan_update(IDmodes_name, IDmask_name, SVDeps);
+    if(IDrecm==-1)
+        return(-1);
+
+    ID = image_ID(ID_name);
+    if((data.image[ID].md[0].naxis==3)&&(data.image[ID].md[0].atype!=_DATATYPE_FLOAT))
+    {
+        printERROR(__FILE__,__func__,__LINE__,"input cube must be float");
+        return(-1);
+    }
+
+    m = data.image[IDrecm].md[0].size[1];
+    n = data.image[IDrecm].md[0].size[0];
+    NBframe = 1;
+    if(data.image[ID].md[0].naxis==3)
+        NBframe = data.image[ID].md[0].size[2];
+
+    linopt_imtools_Image_to_vec(ID_name, "_fp_pixind", "_fp_pixmul", "_fp_measvec");
+    IDmvec = image_ID("_fp_measvec");
+
+    IDcoeff = create_2Dimage_ID(IDcoeff_name, m, NBframe);
+
+    if(NBframe==1)
+        cblas_sgemv (CblasRowMajor, CblasNoTrans, m, n, 1.0, data.image[IDrecm].array.F, n, data.image[IDmvec].array.F, 1, 0.0, data.image[IDcoeff].array.F, 1);
+    else
+        cblas_sgemm (CblasRowMajor, CblasNoTrans, CblasTrans, NBframe, m, n, 1.0, data.image[IDmvec].array.F, n, data.image[IDrecm].array.F, n, 0.0, data.image[IDcoeff].array.F, m);
+
+    delete_image_ID("_fp_measvec");
+
+    return(IDcoeff);
+}
+
+
+
+
+//
+// streaming fit : waits for new frame in IDin_name, writes coefficients to shared memory stream IDcoeff_name
+// fit plan is recomputed automatically if modes, mask change
+//
+long linopt_imtools_fitplan_stream(const char *IDin_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name)
+{
+    long IDin, IDrecm, IDpixind, IDpixmul, IDcoeff;
+    long m, n, k;
+    float *measvec;
+    uint32_t *sizearray;
+    uint64_t cnt = 0;
+    int NOSEM;
+
+    IDrecm = linopt_imtools_fitplan_update(IDmodes_name, IDmask_name, SVDeps);
+    if(IDrecm==-1)
+        return(-1);
+
+    IDin = image_ID(IDin_name);
+    m = data.image[IDrecm].md[0].size[1];
+
+    sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
+    sizearray[0] = m;
+    sizearray[1] = 1;
+    IDcoeff = create_image_ID(IDcoeff_name, 2, sizearray, _DATATYPE_FLOAT, 1, 0);
+    COREMOD_MEMORY_image_set_createsem(IDcoeff_name, 10);
+    free(sizearray);
+
+    if(variable_ID("NOSEM")!=-1)
+        NOSEM = 1;
+    else
+        NOSEM = 0;
+
+    measvec = NULL;
+    n = 0;
+
+    while(1==1)
+    {
+        if((data.image[IDin].md[0].sem==0)||(NOSEM==1))
+        {
+            while(cnt==data.image[IDin].md[0].cnt0) // test if new frame exists
+                usleep(5);
+            cnt = data.image[IDin].md[0].cnt0;
+        }
+        else
+            sem_wait(data.image[IDin].semptr[0]);
+
+        IDrecm = linopt_imtools_fitplan_update(IDmodes_name, IDmask_name, SVDeps);
+        if(IDrecm==-1)
+            break;
+        if(data.image[IDrecm].md[0].size[1]!=m)
+        {
+            printERROR(__FILE__,__func__,__LINE__,"number of modes changed");
+            break;
+        }
+        IDpixind = image_ID("_fp_pixind");
+        IDpixmul = image_ID("_fp_pixmul");
+        if(data.image[IDrecm].md[0].size[0]!=n)
+        {
+            n = data.image[IDrecm].md[0].size[0];
+            free(measvec);
+            measvec = (float*) malloc(sizeof(float)*n);
+        }
+
+        for(k=0; k<n; k++)
+            measvec[k] = data.image[IDpixmul].array.F[k] * data.image[IDin].array.F[data.image[IDpixind].array.SI64[k]];
+
+        data.image[IDcoeff].md[0].write = 1;
+        cblas_sgemv (CblasRowMajor, CblasNoTrans, m, n, 1.0, data.image[IDrecm].array.F, n, measvec, 1, 0.0, data.image[IDcoeff].array.F, 1);
+        COREMOD_MEMORY_image_set_sempost_byID(IDcoeff, -1);
+        data.image[IDcoeff].md[0].cnt0++;
+        data.image[IDcoeff].md[0].write = 0;
+    }
+
+    free(measvec);
+
+    return(IDcoeff);
+}
+
+
+
+
 //
 // match a single image (ID_name) to a linear sum of images within IDref_name
 // result is a 1D array of coefficients in IDsol_name
@@ -2157,59 +2938,41 @@ double linopt_imtools_match(const char *ID_name, const char *IDref_name, const c
 
 //
 // solve for response matrix given a series of input and output
-// initial value of RM should be best guess
 // inmask = 0 over input that are known to produce no response
+// IDRM_name sets the output size, result is written to _respmat
+// telemetry is accumulated in LINOPT_LINRM_BLOCK frame blocks (normal equations), memory does not grow with the number of frames
 //
 long linopt_compute_linRM_from_inout(const char *IDinput_name, const char *IDinmask_name, const char *IDoutput_name, const char *IDRM_name)
 {
 	long IDRM;
 	long IDin;
 	long IDinmask;
-	long IDout;
 	long insize; // number of input
 	long xsizein, ysizein, xsizeout, ysizeout;
-	double fitval;
-	long kk, ii_in, jj_in, ii_out, jj_out;
-	double tot;
-	long IDtmp;
-	double tmpv1;
-	long iter;
-	long IDout1;
-	double alpha = 0.001;
-	
-	uint32_t *sizearray;
-	long IDpokeM; // poke matrix (input)
-	long IDoutM; // outputX
-	double SVDeps = 1.0e-4;
-	
-	long NBact, act;
-	long *inpixarray;
 	long spl; // sample measurement
 	long ii;
 	long ID_rm;
 	int autoMask_MODE = 0; // if 1, automatically measure input mask based on IDinput_name image
-	long IDpinv;
-	int use_magma = 0;
-	
-	int ngpu;
-	
-	ngpu = 0;
-	setenv("CUDA_VISIBLE_DEVICES", "3,4", 1 );
-	
-	
+	double regul = 1.0e-8; // Tikhonov regularization, relative to mean XtX diagonal
+	char inmaskname[200];
+
+
 	IDin = image_ID(IDinput_name);
-	IDout = image_ID(IDoutput_name);
 	IDRM = image_ID(IDRM_name);
-	
-		
+	if((IDin==-1)||(IDRM==-1)||(image_ID(IDoutput_name)==-1))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"missing input, output or RM image");
+		return(-1);
+	}
+
 	insize = data.image[IDin].md[0].size[2];
 	xsizeout = data.image[IDRM].md[0].size[0];
 	ysizeout = data.image[IDRM].md[0].size[1];
 	xsizein = data.image[IDin].md[0].size[0];
 	ysizein = data.image[IDin].md[0].size[1];
-	
+
 	if(autoMask_MODE==0)
-		IDinmask = image_ID(IDinmask_name);
+		strcpy(inmaskname, IDinmask_name);
 	else
 		{
 			IDinmask = create_2Dimage_ID("_RMmask", xsizein, ysizein);
@@ -2217,181 +2980,518 @@ long linopt_compute_linRM_from_inout(const char *IDinput_name, const char *IDinm
 				for(ii=0;ii<xsizein*ysizein;ii++)
 					if(data.image[IDin].array.F[spl*xsizein*ysizein + ii]>0.5)
 						data.image[IDinmask].array.F[ii] = 1.0;
+			strcpy(inmaskname, "_RMmask");
 		}
-		
-	// create pokeM
-	NBact = 0;
-	for(ii=0;ii<xsizein*ysizein;ii++)
-		if(data.image[IDinmask].array.F[ii]>0.5)
-			NBact++;
-			
-	printf("NBact = %ld\n", NBact);
-	
-	inpixarray = (long*) malloc(sizeof(long)*NBact);
-	act = 0;
-	for(ii=0;ii<xsizein*ysizein;ii++)
-		if(data.image[IDinmask].array.F[ii]>0.5)
-			{
-				inpixarray[act] = ii;
-				act++;
-			}
-	
-	
-	
-	sizearray = (uint32_t*) malloc(sizeof(uint32_t)*2);
-	
-	sizearray[0] = NBact;
-	sizearray[1] = insize; // number of measurements
 
-	printf("NBact = %ld\n", NBact);
-	for(act=0;act<10;act++)
-		printf("act %5ld -> pix %5ld\n", act, inpixarray[act]);
-	
-	 
-	IDpokeM = create_2Dimage_ID("pokeM", NBact, insize);
+	if(linopt_linRM_accum_init("_linRMacc", inmaskname, xsizeout, ysizeout)==-1)
+		return(-1);
+	if(linopt_linRM_accum_cube("_linRMacc", IDinput_name, IDoutput_name)==-1)
+		return(-1);
+	ID_rm = linopt_linRM_accum_solve("_linRMacc", "_respmat", regul);
 
-	for(spl=0;spl<insize;spl++)
-		for(act=0;act<NBact;act++)
-			data.image[IDpokeM].array.F[NBact*spl+act] = data.image[IDin].array.F[spl*xsizein*ysizein + inpixarray[act]];
-	save_fits("pokeM", "!_test_pokeM.fits");
+	delete_image_ID("_linRMacc_XtX");
+	delete_image_ID("_linRMacc_XtY");
+	delete_image_ID("_linRMacc_stat");
+	delete_image_ID("_linRMacc_pix");
 
-	// compute pokeM pseudo-inverse
-   	#ifdef HAVE_MAGMA
-		CUDACOMP_magma_compute_SVDpseudoInverse("pokeM", "pokeMinv", SVDeps, insize, "VTmat", 0);
-	#else
-        linopt_compute_SVDpseudoInverse("pokeM", "pokeMinv", SVDeps, insize, "VTmat");
-     #endif   
-        
-	list_image_ID();
-	save_fits("pokeMinv", "!pokeMinv.fits");
-	IDpinv = image_ID("pokeMinv");
-	
-	// multiply measurements by pokeMinv
-	ID_rm = create_3Dimage_ID("_respmat", xsizeout, ysizeout, xsizein*ysizein);
+	return(ID_rm);
+}
 
-	for(act=0;act<NBact;act++)
-		{
-			for(kk=0;kk<insize;kk++)
-				for(ii=0;ii<xsizeout*ysizeout;ii++)
-					data.image[ID_rm].array.F[inpixarray[act]*xsizeout*ysizeout + ii] += data.image[IDout].array.F[kk*xsizeout*ysizeout + ii] * data.image[IDpinv].array.F[kk*NBact+act];
-		}
-	save_fits("_respmat", "!_test_RM.fits");
-//exit(0);
-	
-	
-	// COMPUTE SOLUTION QUALITY
-	
-	IDRM = image_ID("_respmat");
-	
-	
-	IDtmp = create_2Dimage_ID("_tmplicli", xsizeout, ysizeout);
-	IDout1 = create_3Dimage_ID("testout", xsizeout, ysizeout, insize);
-	
-	printf("IDin  = %ld\n", IDin);
-	printf("IDout = %ld\n", IDout);
-	printf("IDinmask = %ld\n", IDinmask);
-	
-	// on iteration 0, compute initial fit value
-	fitval = 0.0;
 
-	
 
-		for(kk=0;kk<insize;kk++)
-		{
-			printf("\r kk = %5ld / %5ld    ", kk, insize);
-			fflush(stdout);
-			
-			for(ii_out=0;ii_out<xsizeout; ii_out++)
-				for(jj_out=0;jj_out<ysizeout; jj_out++)
-					data.image[IDtmp].array.F[jj_out*xsizeout+ii_out] = 0.0;
-					
-					
-			for(ii_in=0;ii_in<xsizein;ii_in++)
-				for(jj_in=0;jj_in<ysizein;jj_in++)
-					{
-						
-								//printf("%ld  pix %ld %ld active\n", kk, ii_in, jj_in);
-								for(ii_out=0;ii_out<xsizeout; ii_out++)
-									for(jj_out=0;jj_out<ysizeout; jj_out++)
-										data.image[IDtmp].array.F[jj_out*xsizeout+ii_out] += data.image[IDin].array.F[kk*xsizein*ysizein + jj_in*xsizein + ii_in]*data.image[IDRM].array.F[(jj_in*xsizein + ii_in)*xsizeout*ysizeout+jj_out*xsizeout+ii_out];							
-							
-					}
-			for(ii_out=0;ii_out<xsizeout; ii_out++)
-				for(jj_out=0;jj_out<ysizeout; jj_out++)
-					{
-						tmpv1 = data.image[IDtmp].array.F[jj_out*xsizeout+ii_out] - data.image[IDout].array.F[kk*xsizeout*ysizeout + jj_out*xsizeout+ii_out];
-						fitval += tmpv1*tmpv1;
-						data.image[IDout1].array.F[kk*xsizeout*ysizeout + jj_out*xsizeout+ii_out] = tmpv1; //data.image[IDtmp].array.F[jj_out*xsizeout+ii_out];
-					}
-		}
-	printf("\n");
-	printf("  %5ld    fitval = %.20f\n", kk, sqrt(fitval/xsizeout/ysizeout));
-	
-	delete_image_ID("_tmplicli");
-		
-	free(sizearray);
-	free(inpixarray);
-	
-	return(IDout);
+
+//
+// streaming least-squares response matrix estimator
+//
+// accumulator <acc> holds the normal equations of  Y = X RM  over all frames added so far :
+//   <acc>_XtX   NBact x NBact double (lower triangle)
+//   <acc>_XtY   xsizeout x ysizeout x NBact double
+//   <acc>_stat  NBframe, sum Y^2, xsizein, ysizein
+//   <acc>_pix   input pixel index of each active input
+// frames can be added from cubes, FITS files or live streams, and the RM solved at any time
+//
+
+static int linopt_linRM_accum_IDs(const char *IDacc_name, long *IDXtX, long *IDXtY, long *IDstat, long *IDpix)
+{
+	char name[200];
+
+	sprintf(name, "%s_XtX", IDacc_name);
+	*IDXtX = image_ID(name);
+	sprintf(name, "%s_XtY", IDacc_name);
+	*IDXtY = image_ID(name);
+	sprintf(name, "%s_stat", IDacc_name);
+	*IDstat = image_ID(name);
+	sprintf(name, "%s_pix", IDacc_name);
+	*IDpix = image_ID(name);
+
+	if((*IDXtX==-1)||(*IDXtY==-1)||(*IDstat==-1)||(*IDpix==-1))
+	{
+		sprintf(name, "accumulator %s not initialized", IDacc_name);
+		printERROR(__FILE__,__func__,__LINE__,name);
+		return(-1);
+	}
+	return(0);
 }
 
 
 
+// adds nfr frames (row-major X: nfr x NBact, Y: nfr x NBout) to accumulator
+static void linopt_linRM_accum_block(long IDXtX, long IDXtY, long IDstat, const double *X, const double *Y, long nfr)
+{
+	long NBact = data.image[IDXtX].md[0].size[0];
+	long NBout = (long) data.image[IDXtY].md[0].size[0]*data.image[IDXtY].md[0].size[1];
 
+	if(nfr==0)
+		return;
 
+	cblas_dsyrk(CblasRowMajor, CblasLower, CblasTrans, NBact, nfr, 1.0, X, NBact, 1.0, data.image[IDXtX].array.D, NBact);
+	cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, NBact, NBout, nfr, 1.0, X, NBact, Y, NBout, 1.0, data.image[IDXtY].array.D, NBout);
+	data.image[IDstat].array.D[0] += nfr;
+	data.image[IDstat].array.D[1] += cblas_ddot(nfr*NBout, Y, 1, Y, 1);
 
+	data.image[IDXtX].md[0].cnt0++;
+}
 
 
 
+long linopt_linRM_accum_init(const char *IDacc_name, const char *IDinmask_name, long xsizeout, long ysizeout)
+{
+	long IDinmask, IDXtX, IDXtY, IDstat, IDpix;
+	long NBact, act, ii, xysizein;
+	uint32_t sizearray[3];
+	char name[200];
 
+	IDinmask = image_ID(IDinmask_name);
+	if(IDinmask==-1)
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input mask not found");
+		return(-1);
+	}
+	xysizein = (long) data.image[IDinmask].md[0].size[0]*data.image[IDinmask].md[0].size[1];
 
+	NBact = 0;
+	for(ii=0;ii<xysizein;ii++)
+		if(data.image[IDinmask].array.F[ii]>0.5)
+			NBact++;
+	if(NBact==0)
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input mask is empty");
+		return(-1);
+	}
+	printf("NBact = %ld\n", NBact);
 
+	sprintf(name, "%s_XtX", IDacc_name);
+	if(image_ID(name)!=-1)
+		delete_image_ID(name);
+	sizearray[0] = NBact;
+	sizearray[1] = NBact;
+	IDXtX = create_image_ID(name, 2, sizearray, _DATATYPE_DOUBLE, 0, 0);
+
+	sprintf(name, "%s_XtY", IDacc_name);
+	if(image_ID(name)!=-1)
+		delete_image_ID(name);
+	sizearray[0] = xsizeout;
+	sizearray[1] = ysizeout;
+	sizearray[2] = NBact;
+	IDXtY = create_image_ID(name, 3, sizearray, _DATATYPE_DOUBLE, 0, 0);
+
+	sprintf(name, "%s_stat", IDacc_name);
+	if(image_ID(name)!=-1)
+		delete_image_ID(name);
+	sizearray[0] = 4;
+	sizearray[1] = 1;
+	IDstat = create_image_ID(name, 2, sizearray, _DATATYPE_DOUBLE, 0, 0);
+	data.image[IDstat].array.D[2] = data.image[IDinmask].md[0].size[0];
+	data.image[IDstat].array.D[3] = data.image[IDinmask].md[0].size[1];
+
+	sprintf(name, "%s_pix", IDacc_name);
+	if(image_ID(name)!=-1)
+		delete_image_ID(name);
+	sizearray[0] = NBact;
+	sizearray[1] = 1;
+	IDpix = create_image_ID(name, 2, sizearray, _DATATYPE_INT64, 0, 0);
+	act = 0;
+	for(ii=0;ii<xysizein;ii++)
+		if(data.image[IDinmask].array.F[ii]>0.5)
+		{
+			data.image[IDpix].array.SI64[act] = ii;
+			act++;
+		}
 
+	memset(data.image[IDXtX].array.D, 0, sizeof(double)*NBact*NBact);
+	memset(data.image[IDXtY].array.D, 0, sizeof(double)*NBact*xsizeout*ysizeout);
 
+	return(IDXtX);
+}
 
 
 
+// checks input / output frame sizes against accumulator
+static int linopt_linRM_accum_checksize(long IDXtY, long IDstat, long xsizein, long ysizein, long xsizeout, long ysizeout)
+{
+	if((xsizein!=(long) data.image[IDstat].array.D[2])||(ysizein!=(long) data.image[IDstat].array.D[3]))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input frame size does not match accumulator mask");
+		return(-1);
+	}
+	if((xsizeout!=data.image[IDXtY].md[0].size[0])||(ysizeout!=data.image[IDXtY].md[0].size[1]))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"output frame size does not match accumulator");
+		return(-1);
+	}
+	return(0);
+}
 
 
 
+// adds all frames of input cube / output cube pair, returns total number of frames in accumulator
+long linopt_linRM_accum_cube(const char *IDacc_name, const char *IDinput_name, const char *IDoutput_name)
+{
+	long IDXtX, IDXtY, IDstat, IDpix, IDin, IDout;
+	long NBact, NBout, xysizein, NBframe;
+	long k0, k, nfr, act, ii;
+	double *X, *Y;
+	float *inptr, *outptr;
 
+	if(linopt_linRM_accum_IDs(IDacc_name, &IDXtX, &IDXtY, &IDstat, &IDpix)==-1)
+		return(-1);
 
+	IDin = image_ID(IDinput_name);
+	IDout = image_ID(IDoutput_name);
+	if((IDin==-1)||(IDout==-1))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input or output cube not found");
+		return(-1);
+	}
+	if(linopt_linRM_accum_checksize(IDXtY, IDstat, data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1], data.image[IDout].md[0].size[0], data.image[IDout].md[0].size[1])==-1)
+		return(-1);
 
+	NBframe = (data.image[IDin].md[0].naxis==3) ? data.image[IDin].md[0].size[2] : 1;
+	if(NBframe != ((data.image[IDout].md[0].naxis==3) ? data.image[IDout].md[0].size[2] : 1))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input and output cubes have different number of frames");
+		return(-1);
+	}
 
+	NBact = data.image[IDXtX].md[0].size[0];
+	xysizein = (long) data.image[IDin].md[0].size[0]*data.image[IDin].md[0].size[1];
+	NBout = (long) data.image[IDout].md[0].size[0]*data.image[IDout].md[0].size[1];
 
+	X = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBact);
+	Y = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBout);
 
+	for(k0=0;k0<NBframe;k0+=LINOPT_LINRM_BLOCK)
+	{
+		nfr = (NBframe-k0 < LINOPT_LINRM_BLOCK) ? NBframe-k0 : LINOPT_LINRM_BLOCK;
+		for(k=0;k<nfr;k++)
+		{
+			inptr = data.image[IDin].array.F + (k0+k)*xysizein;
+			outptr = data.image[IDout].array.F + (k0+k)*NBout;
+			for(act=0;act<NBact;act++)
+				X[k*NBact+act] = inptr[data.image[IDpix].array.SI64[act]];
+			for(ii=0;ii<NBout;ii++)
+				Y[k*NBout+ii] = outptr[ii];
+		}
+		linopt_linRM_accum_block(IDXtX, IDXtY, IDstat, X, Y, nfr);
+	}
 
+	free(X);
+	free(Y);
 
+	return((long) data.image[IDstat].array.D[0]);
+}
 
 
 
+// adds all frames of input / output FITS cubes, read LINOPT_LINRM_BLOCK slices at a time
+long linopt_linRM_accum_file(const char *IDacc_name, const char *fnamein, const char *fnameout)
+{
+	long IDXtX, IDXtY, IDstat, IDpix;
+	FITS_SLICEREADER *rdin, *rdout;
+	long naxisin, naxisout;
+	uint32_t naxesin[3], naxesout[3];
+	long NBact, NBout, xysizein, NBframe;
+	long k0, k, nfr, act, ii;
+	double *X, *Y;
+	float *inbuf, *outbuf;
+	int err = 0;
+
+	if(linopt_linRM_accum_IDs(IDacc_name, &IDXtX, &IDXtY, &IDstat, &IDpix)==-1)
+		return(-1);
+
+	if((rdin = fits_slicereader_open(fnamein, &naxisin, naxesin))==NULL)
+		return(-1);
+	if((rdout = fits_slicereader_open(fnameout, &naxisout, naxesout))==NULL)
+	{
+		fits_slicereader_close(rdin);
+		return(-1);
+	}
+	if(naxisin==2)
+		naxesin[2] = 1;
+	if(naxisout==2)
+		naxesout[2] = 1;
+
+	if(linopt_linRM_accum_checksize(IDXtY, IDstat, naxesin[0], naxesin[1], naxesout[0], naxesout[1])==-1)
+		err = 1;
+	else if(naxesin[2]!=naxesout[2])
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input and output files have different number of frames");
+		err = 1;
+	}
+	if(err==1)
+	{
+		fits_slicereader_close(rdin);
+		fits_slicereader_close(rdout);
+		return(-1);
+	}
 
+	NBframe = naxesin[2];
+	NBact = data.image[IDXtX].md[0].size[0];
+	xysizein = (long) naxesin[0]*naxesin[1];
+	NBout = (long) naxesout[0]*naxesout[1];
 
+	X = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBact);
+	Y = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBout);
+	inbuf = (float*) malloc(sizeof(float)*LINOPT_LINRM_BLOCK*xysizein);
+	outbuf = (float*) malloc(sizeof(float)*LINOPT_LINRM_BLOCK*NBout);
 
+	for(k0=0;k0<NBframe;k0+=LINOPT_LINRM_BLOCK)
+	{
+		nfr = (NBframe-k0 < LINOPT_LINRM_BLOCK) ? NBframe-k0 : LINOPT_LINRM_BLOCK;
+		if((fits_slicereader_read(rdin, k0, nfr, inbuf)!=0)||(fits_slicereader_read(rdout, k0, nfr, outbuf)!=0))
+		{
+			printERROR(__FILE__,__func__,__LINE__,"cannot read telemetry slices");
+			err = 1;
+			break;
+		}
+		for(k=0;k<nfr;k++)
+		{
+			for(act=0;act<NBact;act++)
+				X[k*NBact+act] = inbuf[k*xysizein + data.image[IDpix].array.SI64[act]];
+			for(ii=0;ii<NBout;ii++)
+				Y[k*NBout+ii] = outbuf[k*NBout+ii];
+		}
+		linopt_linRM_accum_block(IDXtX, IDXtY, IDstat, X, Y, nfr);
+		printf("\r  frame %8ld / %8ld   ", k0+nfr, NBframe);
+		fflush(stdout);
+	}
+	printf("\n");
 
+	free(X);
+	free(Y);
+	free(inbuf);
+	free(outbuf);
+	fits_slicereader_close(rdin);
+	fits_slicereader_close(rdout);
 
+	if(err==1)
+		return(-1);
 
+	return((long) data.image[IDstat].array.D[0]);
+}
 
 
 
+//
+// adds frames from live input / output streams
+// each output stream update is paired with the input frame read delay output updates earlier
+// stops after NBframe frames (runs forever if NBframe = 0)
+// if solveperiod > 0, RM is solved into IDRM_name every solveperiod frames
+//
+long linopt_linRM_accum_stream(const char *IDacc_name, const char *IDinstream_name, const char *IDoutstream_name, long delay, long NBframe, const char *IDRM_name, double regul, long solveperiod)
+{
+	long IDXtX, IDXtY, IDstat, IDpix, IDin, IDout;
+	long NBact, NBout;
+	long k, act, ii, nfr, cntframe, cntsolve;
+	long ringslot;
+	double *X, *Y;
+	float *ring;
+	uint64_t cnt = 0;
+	int NOSEM;
+
+	if(linopt_linRM_accum_IDs(IDacc_name, &IDXtX, &IDXtY, &IDstat, &IDpix)==-1)
+		return(-1);
+
+	IDin = image_ID(IDinstream_name);
+	IDout = image_ID(IDoutstream_name);
+	if((IDin==-1)||(IDout==-1))
+	{
+		printERROR(__FILE__,__func__,__LINE__,"input or output stream not found");
+		return(-1);
+	}
+	if(linopt_linRM_accum_checksize(IDXtY, IDstat, data.image[IDin].md[0].size[0], data.image[IDin].md[0].size[1], data.image[IDout].md[0].size[0], data.image[IDout].md[0].size[1])==-1)
+		return(-1);
+	if(delay<0)
+		delay = 0;
 
+	NBact = data.image[IDXtX].md[0].size[0];
+	NBout = (long) data.image[IDout].md[0].size[0]*data.image[IDout].md[0].size[1];
 
+	X = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBact);
+	Y = (double*) malloc(sizeof(double)*LINOPT_LINRM_BLOCK*NBout);
+	ring = (float*) malloc(sizeof(float)*(delay+1)*NBact);
 
+	if(variable_ID("NOSEM")!=-1)
+		NOSEM = 1;
+	else
+		NOSEM = 0;
 
+	cnt = data.image[IDout].md[0].cnt0;
+	nfr = 0;
+	cntframe = 0;
+	cntsolve = 0;
 
+	for(k=0;(NBframe==0)||(cntframe<NBframe);k++)
+	{
+		if((data.image[IDout].md[0].sem==0)||(NOSEM==1))
+		{
+			while(cnt==data.image[IDout].md[0].cnt0) // test if new frame exists
+				usleep(5);
+			cnt = data.image[IDout].md[0].cnt0;
+		}
+		else
+			sem_wait(data.image[IDout].semptr[0]);
 
+		ringslot = k%(delay+1);
+		for(act=0;act<NBact;act++)
+			ring[ringslot*NBact+act] = data.image[IDin].array.F[data.image[IDpix].array.SI64[act]];
+		if(k<delay)
+			continue;
 
+		// input read delay updates ago is in the next ring slot
+		ringslot = (k+1)%(delay+1);
+		for(act=0;act<NBact;act++)
+			X[nfr*NBact+act] = ring[ringslot*NBact+act];
+		for(ii=0;ii<NBout;ii++)
+			Y[nfr*NBout+ii] = data.image[IDout].array.F[ii];
+		nfr++;
+		cntframe++;
+		cntsolve++;
+
+		if((nfr==LINOPT_LINRM_BLOCK)||(cntframe==NBframe)||((solveperiod>0)&&(cntsolve>=solveperiod)))
+		{
+			linopt_linRM_accum_block(IDXtX, IDXtY, IDstat, X, Y, nfr);
+			nfr = 0;
+		}
+		if((solveperiod>0)&&(cntsolve>=solveperiod))
+		{
+			linopt_linRM_accum_solve(IDacc_name, IDRM_name, regul);
+			cntsolve = 0;
+		}
+	}
 
+	free(X);
+	free(Y);
+	free(ring);
 
+	return((long) data.image[IDstat].array.D[0]);
+}
 
 
 
+//
+// solves (XtX + regul * mean(diag XtX) * I) RM = XtY by Cholesky factorization
+// RM is written to IDRM_name (xsizeout x ysizeout x xsizein*ysizein, zero for inactive inputs), updated in place if it exists with the right size
+// prints the rms fit residual per output element and frame
+//
+long linopt_linRM_accum_solve(const char *IDacc_name, const char *IDRM_name, double regul)
+{
+	long IDXtX, IDXtY, IDstat, IDpix, IDRM;
+	long NBact, NBout, xsizeout, ysizeout, xysizein;
+	long act, act1, ii;
+	double *A, *R, *XtXR;
+	double lambda, res;
+	int info;
+	uint32_t sizearray[3];
+
+	if(linopt_linRM_accum_IDs(IDacc_name, &IDXtX, &IDXtY, &IDstat, &IDpix)==-1)
+		return(-1);
+	if(data.image[IDstat].array.D[0]<1.0)
+	{
+		printERROR(__FILE__,__func__,__LINE__,"no frame in accumulator");
+		return(-1);
+	}
 
+	NBact = data.image[IDXtX].md[0].size[0];
+	xsizeout = data.image[IDXtY].md[0].size[0];
+	ysizeout = data.image[IDXtY].md[0].size[1];
+	NBout = xsizeout*ysizeout;
+	xysizein = (long) (data.image[IDstat].array.D[2]*data.image[IDstat].array.D[3]);
 
+	A = (double*) malloc(sizeof(double)*NBact*NBact);
+	R = (double*) malloc(sizeof(double)*NBact*NBout);
+	XtXR = (double*) malloc(sizeof(double)*NBact*NBout);
 
+	// symmetric copy of XtX, regularized
+	lambda = 0.0;
+	for(act=0;act<NBact;act++)
+		lambda += data.image[IDXtX].array.D[act*NBact+act];
+	lambda *= regul/NBact;
+	for(act=0;act<NBact;act++)
+	{
+		for(act1=0;act1<=act;act1++)
+		{
+			A[act*NBact+act1] = data.image[IDXtX].array.D[act*NBact+act1];
+			A[act1*NBact+act] = A[act*NBact+act1];
+		}
+		A[act*NBact+act] += lambda;
+	}
+	memcpy(R, data.image[IDXtY].array.D, sizeof(double)*NBact*NBout);
 
+#ifdef HAVE_LAPACKE
+	info = LAPACKE_dpotrf(LAPACK_ROW_MAJOR, 'L', NBact, A, NBact);
+#else
+	{
+		gsl_matrix_view Av = gsl_matrix_view_array(A, NBact, NBact);
+		gsl_error_handler_t *gslhandler = gsl_set_error_handler_off();
+		info = gsl_linalg_cholesky_decomp(&Av.matrix);
+		gsl_set_error_handler(gslhandler);
+	}
+#endif
+	if(info!=0)
+	{
+		printERROR(__FILE__,__func__,__LINE__,"XtX not positive definite, increase regularization");
+		free(A);
+		free(R);
+		free(XtXR);
+		return(-1);
+	}
+	cblas_dtrsm(CblasRowMajor, CblasLeft, CblasLower, CblasNoTrans, CblasNonUnit, NBact, NBout, 1.0, A, NBact, R, NBout);
+	cblas_dtrsm(CblasRowMajor, CblasLeft, CblasLower, CblasTrans, CblasNonUnit, NBact, NBout, 1.0, A, NBact, R, NBout);
 
+	// |Y - X RM|^2 = sum Y^2 - 2 RM.XtY + RM.(XtX RM)
+	cblas_dsymm(CblasRowMajor, CblasLeft, CblasLower, NBact, NBout, 1.0, data.image[IDXtX].array.D, NBact, R, NBout, 0.0, XtXR, NBout);
+	res = data.image[IDstat].array.D[1] - 2.0*cblas_ddot(NBact*NBout, R, 1, data.image[IDXtY].array.D, 1) + cblas_ddot(NBact*NBout, R, 1, XtXR, 1);
+	if(res<0.0)
+		res = 0.0;
+	printf("  %8ld frames    fitval = %.20f\n", (long) data.image[IDstat].array.D[0], sqrt(res/NBout/data.image[IDstat].array.D[0]));
 
+	IDRM = image_ID(IDRM_name);
+	if((IDRM!=-1)&&((data.image[IDRM].md[0].naxis!=3)||(data.image[IDRM].md[0].size[0]!=xsizeout)||(data.image[IDRM].md[0].size[1]!=ysizeout)||(data.image[IDRM].md[0].size[2]!=xysizein)||(data.image[IDRM].md[0].atype!=_DATATYPE_FLOAT)))
+	{
+		delete_image_ID(IDRM_name);
+		IDRM = -1;
+	}
+	if(IDRM==-1)
+	{
+		sizearray[0] = xsizeout;
+		sizearray[1] = ysizeout;
+		sizearray[2] = xysizein;
+		IDRM = create_image_ID(IDRM_name, 3, sizearray, _DATATYPE_FLOAT, 0, 0);
+	}
 
+	data.image[IDRM].md[0].write = 1;
+	memset(data.image[IDRM].array.F, 0, sizeof(float)*NBout*xysizein);
+	for(act=0;act<NBact;act++)
+		for(ii=0;ii<NBout;ii++)
+			data.image[IDRM].array.F[data.image[IDpix].array.SI64[act]*NBout + ii] = R[act*NBout+ii];
+	COREMOD_MEMORY_image_set_sempost_byID(IDRM, -1);
+	data.image[IDRM].md[0].cnt0++;
+	data.image[IDRM].md[0].write = 0;
 
+	free(A);
+	free(R);
+	free(XtXR);
 
+	return(IDRM);
+}
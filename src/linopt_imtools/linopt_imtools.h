@@ -71,6 +71,9 @@ long linopt_imtools_makeCosRadModes(const char *ID_name, long size, long kmax, f
 
 long linopt_imtools_makeCPAmodes(const char *ID_name, long size, float CPAmax, float deltaCPA, float radius, float radfactlim, int writeMfile);
 
+/// Blocked Gram-Schmidt orthogonalization of modes over mask, optionally against reference modes span
+long linopt_imtools_modes_orthogonalize(const char *IDin_name, const char *IDmask_name, const char *IDref_name, const char *IDout_name, float rmslim, int mode);
+
 ///@}
 
 
@@ -91,7 +94,7 @@ long linopt_imtools_makeCPAmodes(const char *ID_name, long size, float CPAmax, f
 
 long linopt_imtools_image_construct(const char *IDmodes_name, const char *IDcoeff_name, const char *ID_name);
 
-long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name);
+long linopt_imtools_image_construct_stream(const char *IDmodes_name, const char *IDcoeff_name, const char *IDout_name, int GPUindex, float coefflim, float maxfreq);
 
 long linopt_compute_SVDdecomp(const char *IDin_name, const char *IDout_name, const char *IDcoeff_name);
 
@@ -101,6 +104,16 @@ long linopt_compute_1Dfit(const char *fnamein, long NBpt, long MaxOrder, const c
 
 long linopt_imtools_image_fitModes(const char *ID_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name, int reuse);
 
+/**
+ * @brief Fit image or cube with modes, pseudo-inverse cached for (modes, mask, SVDeps)
+ *
+ * Output coefficients are m x NBframe, cube processed as a single GEMM
+ */
+long linopt_imtools_fitplan_apply(const char *ID_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name);
+
+/// Streaming version of linopt_imtools_fitplan_apply, output written to shared memory stream
+long linopt_imtools_fitplan_stream(const char *IDin_name, const char *IDmodes_name, const char *IDmask_name, double SVDeps, const char *IDcoeff_name);
+
 double linopt_imtools_match_slow(const char *ID_name, const char *IDref_name, const char *IDmask_name, const char *IDsol_name, const char *IDout_name);
 
 double linopt_imtools_match(const char *ID_name, const char *IDref_name, const char *IDmask_name, const char *IDsol_name, const char *IDout_name);
@@ -125,12 +138,28 @@ double linopt_imtools_match(const char *ID_name, const char *IDref_name, const c
 /**
  * @brief Solve for response matrix given a series of input and output
  * 
- *  initial value of RM should be best guess
  *  inmask = 0 over input that are known to produce no response
+ *  RM size taken from IDRM_name, solution written to _respmat
  */
 long linopt_compute_linRM_from_inout(const char *IDinput_name, const char *IDinmask_name, const char *IDoutput_name, const char *IDRM_name);
 
 
+/** @brief Creates (resets) least-squares RM accumulator, normal equations stored in <acc>_XtX, <acc>_XtY */
+long linopt_linRM_accum_init(const char *IDacc_name, const char *IDinmask_name, long xsizeout, long ysizeout);
+
+/** @brief Adds input/output cube pair to accumulator */
+long linopt_linRM_accum_cube(const char *IDacc_name, const char *IDinput_name, const char *IDoutput_name);
+
+/** @brief Adds input/output FITS cubes to accumulator, read in blocks of frames */
+long linopt_linRM_accum_file(const char *IDacc_name, const char *fnamein, const char *fnameout);
+
+/** @brief Adds frames from live input/output streams to accumulator, optionally solving every solveperiod frames */
+long linopt_linRM_accum_stream(const char *IDacc_name, const char *IDinstream_name, const char *IDoutstream_name, long delay, long NBframe, const char *IDRM_name, double regul, long solveperiod);
+
+/** @brief Solves regularized normal equations, writes RM */
+long linopt_linRM_accum_solve(const char *IDacc_name, const char *IDRM_name, double regul);
+
+
 ///@}
 
 
@@ -5,6 +5,10 @@
 
 #include <string.h>
 
+# ifdef HAVE_LIBGOMP
+#include <omp.h>
+# endif
+
 #include "CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
@@ -568,48 +572,41 @@ int center_PSF(const char *ID_name, double *xcenter, double *ycenter, long box_s
 
 
 /* finds a PSF center with no a priori position information */
-int fast_center_PSF(const char *ID_name, double *xcenter, double *ycenter, long box_size)
+// iterative centroid in shrinking box, see fast_center_PSF()
+static void PSF_fast_center_array(const float *im, long nx, long ny, long box_size, double *xcenter, double *ycenter)
 {
-  int ID;
   long n3; /* effective box size. =box_size if the star is not at the edge of the image field */
   double centerx,centery;
   double ocenterx,ocentery;
   double total_fl;
   long ii,jj;
-  long naxes[2];
   int k;
   int nbiter = 6;
 
 	long iimin, iimax, jjmin, jjmax;
 
 
-  ID = image_ID(ID_name);
-  naxes[0] = data.image[ID].md[0].size[0];
-  naxes[1] = data.image[ID].md[0].size[1];    
-  
-  centerx = (double) naxes[0]/2;
-  centery = (double) naxes[1]/2;
+  centerx = (double) nx/2;
+  centery = (double) ny/2;
   ocenterx = centerx;
   ocentery = centery;
 
   for (k=0;k<nbiter;k++)
     {
-      n3 = (long) (1.0*naxes[0]/2/(1.0+(0.1*naxes[0]/2*k/(4*nbiter))));
+      n3 = (long) (1.0*nx/2/(1.0+(0.1*nx/2*k/(4*nbiter))));
       if (((long) (0.5+ocenterx) - n3) < 0)
 		n3 = (long) (0.5+ocenterx);
-      if (((long) (0.5+ocenterx) + n3+1) > naxes[0])
-		n3 = naxes[0]-((long) (0.5+ocenterx) +1);
+      if (((long) (0.5+ocenterx) + n3+1) > nx)
+		n3 = nx-((long) (0.5+ocenterx) +1);
       if (((long) (0.5+ocentery) - n3) < 0)
 		n3 = (long) (0.5+ocentery);
-      if (((long) (0.5+ocentery) + n3+1) > naxes[1])
-		n3 = naxes[1]-((long) (0.5+ocentery) +1);
+      if (((long) (0.5+ocentery) + n3+1) > ny)
+		n3 = ny-((long) (0.5+ocentery) +1);
       n3 -= 1;
       
       if(n3<box_size)
 		n3 = box_size;
       
-
-      
       centerx = 0.0;
       centery = 0.0;
       total_fl = 0.0;
@@ -618,47 +615,129 @@ int fast_center_PSF(const char *ID_name, double *xcenter, double *ycenter, long
 		if(iimin < 0)
 			iimin = 0.0;
 		iimax = ((long) (0.5+ocenterx) + n3+1);
-		if( iimax > naxes[0]-1 )
-			iimax = naxes[0]-1;
+		if( iimax > nx-1 )
+			iimax = nx-1;
 	
 		jjmin = ((long) (0.5+ocentery) - n3);
 		if(jjmin < 0)
 			jjmin = 0.0;
 		jjmax = ((long) (0.5+ocentery) + n3+1);
-		if(jjmax > naxes[1]-1 )
-			jjmax = naxes[1]-1;
+		if(jjmax > ny-1 )
+			jjmax = ny-1;
 		
       for (jj = jjmin; jj < jjmax; jj++) 
 		for (ii = iimin; ii < iimax; ii++) 
 		{
-			centerx += 1.0*ii*(data.image[ID].array.F[jj*naxes[0]+ii]);
-			centery += 1.0*jj*(data.image[ID].array.F[jj*naxes[0]+ii]);
-			total_fl += data.image[ID].array.F[jj*naxes[0]+ii];
+			centerx += 1.0*ii*im[jj*nx+ii];
+			centery += 1.0*jj*im[jj*nx+ii];
+			total_fl += im[jj*nx+ii];
 		}
 
-//        printf("effective box size is %ld (%ld) - center is %f %f   [ %3ld %3ld   %3ld %3ld]   ", n3, box_size, ocenterx, ocentery, iimin, iimax, jjmin, jjmax);
-//       fflush(stdout);
-
-
-  //    printf("total_fl is %f\n",total_fl);
       centerx /= total_fl;
       centery /= total_fl;
       
-      //printf("step %d\n",k);
-      //printf("image %s: center is %f %f for %ld by %ld pixels. Total_fl is %f\n",data.image[ID].name,centerx,centery,naxes[0],naxes[1],total_fl);
-      
       ocenterx = centerx;
       ocentery = centery;
     }
 
   xcenter[0] = centerx;
   ycenter[0] = centery;
+}
+
+
+
+int fast_center_PSF(const char *ID_name, double *xcenter, double *ycenter, long box_size)
+{
+  long ID;
+
+  ID = image_ID(ID_name);
+  PSF_fast_center_array(data.image[ID].array.F, data.image[ID].md[0].size[0], data.image[ID].md[0].size[1], box_size, xcenter, ycenter);
 
   return(0);
 }
 
 
 
+/*
+ * PSF metrics of a single image, one centroid pass sequence and one full-frame pass
+ * centroid   : same algorithm as fast_center_PSF()
+ * moments    : flux-weighted second central moments, FWHM estimate assumes gaussian profile
+ * EE50, EE80 : radius enclosing 50% and 80% of flux (1 pix radial bins, linear interpolation)
+ * SRproxy    : peak / total flux (divide by same ratio of ideal PSF to get Strehl ratio)
+ */
+int PSF_metrics_array(const float *im, long xsize, long ysize, long box_size, PSF_METRICS *m)
+{
+  long ii, jj;
+  long NBbin;
+  double *EEprof;
+  double flux = 0.0;
+  double peak = im[0];
+  double sxx = 0.0;
+  double syy = 0.0;
+  double sxy = 0.0;
+  double xc, yc;
+  long k;
+
+
+  PSF_fast_center_array(im, xsize, ysize, box_size, &xc, &yc);
+
+  NBbin = (long) (sqrt(2.0)*(xsize > ysize ? xsize : ysize)) + 2;
+  EEprof = (double*) calloc(NBbin, sizeof(double));
+
+  for(jj=0; jj<ysize; jj++)
+    {
+      double dy = 1.0*jj-yc;
+      for(ii=0; ii<xsize; ii++)
+        {
+          double dx = 1.0*ii-xc;
+          double v = im[jj*xsize+ii];
+          long bin = (long) sqrt(dx*dx+dy*dy);
+
+          flux += v;
+          if(v > peak)
+            peak = v;
+          sxx += v*dx*dx;
+          syy += v*dy*dy;
+          sxy += v*dx*dy;
+          if(bin < NBbin)
+            EEprof[bin] += v;
+        }
+    }
+
+  m->xcenter = xc;
+  m->ycenter = yc;
+  m->flux = flux;
+  m->peak = peak;
+  m->mxx = sxx/flux;
+  m->myy = syy/flux;
+  m->mxy = sxy/flux;
+  m->FWHM = 2.0*sqrt(2.0*log(2.0))*sqrt(0.5*(m->mxx+m->myy));
+  m->SRproxy = peak/flux;
+
+  // encircled energy radii, interpolated within the bin crossing the threshold
+  m->EE50 = -1.0;
+  m->EE80 = -1.0;
+  {
+    double sum = 0.0;
+    for(k=0; k<NBbin; k++)
+      {
+        double sum1 = sum + EEprof[k];
+        if((m->EE50 < 0.0)&&(sum1 >= 0.5*flux)&&(EEprof[k] != 0.0))
+          m->EE50 = k + (0.5*flux-sum)/EEprof[k];
+        if((m->EE80 < 0.0)&&(sum1 >= 0.8*flux)&&(EEprof[k] != 0.0))
+          m->EE80 = k + (0.8*flux-sum)/EEprof[k];
+        sum = sum1;
+      }
+  }
+
+  free(EEprof);
+
+  return(0);
+}
+
+
+
+
 
 
 int center_PSF_alone(const char *ID_name)
@@ -1362,12 +1441,16 @@ long PSF_coaddbest(const char *IDcin_name, const char *IDout_name, float r_pix)
 
   IDmask = make_subpixdisk("tmpMask",xsize,ysize,xsize/2,ysize/2,r_pix);
   
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel for private(ii)
+# endif
   for(kk=0;kk<ksize;kk++)
     {
+      double val = 0.0;
       imgindex[kk] = kk;
-      flux_array[kk] = 0.0;
       for(ii=0;ii<xsize*ysize;ii++)
-	flux_array[kk] -= data.image[IDcin].array.F[kk*xsize*ysize+ii]*data.image[IDmask].array.F[ii];
+	val -= data.image[IDcin].array.F[kk*xsize*ysize+ii]*data.image[IDmask].array.F[ii];
+      flux_array[kk] = val;
     }
   
   delete_image_ID("tmpMask");
@@ -1376,14 +1459,19 @@ long PSF_coaddbest(const char *IDcin_name, const char *IDout_name, float r_pix)
   
   IDout = create_3Dimage_ID(IDout_name,xsize,ysize,ksize);
   
-  for(kk=0;kk<ksize;kk++)
+  // running sum is sequential along kk, parallel over pixels
+# ifdef HAVE_LIBGOMP
+  #pragma omp parallel for private(kk, kk1)
+# endif
+  for(ii=0;ii<xsize*ysize;ii++)
     {
-      kk1 = imgindex[kk];
-      for(ii=0;ii<xsize*ysize;ii++)
-	data.image[IDout].array.F[kk*xsize*ysize+ii] = data.image[IDcin].array.F[kk1*xsize*ysize+ii];      
-      if(kk>0)
-	for(ii=0;ii<xsize*ysize;ii++)
-	  data.image[IDout].array.F[kk*xsize*ysize+ii] += data.image[IDout].array.F[(kk-1)*xsize*ysize+ii];
+      double val = 0.0;
+      for(kk=0;kk<ksize;kk++)
+	{
+	  kk1 = imgindex[kk];
+	  val += data.image[IDcin].array.F[kk1*xsize*ysize+ii];
+	  data.image[IDout].array.F[kk*xsize*ysize+ii] = val;
+	}
     }
   
   free(imgindex);
@@ -1395,29 +1483,23 @@ long PSF_coaddbest(const char *IDcin_name, const char *IDout_name, float r_pix)
 
 
 //
-// if timing file exists, use it for output
 // PSFsizeEst: estimated size of PSF (sigma)
+// slices are measured in parallel with PSF_metrics_array()
+// output columns: index xcenter ycenter flux peak FWHM EE50 EE80 SRproxy
 //
 int PSF_sequence_measure(const char *IDin_name, float PSFsizeEst, const char *outfname)
 {
 	long IDin;
 	long xsize, ysize, xysize, zsize;
 	FILE *fpout;
-	long IDtmp;
-	double *xcenter;
-	double *ycenter;
 	long boxsize;
-	const char *ptr;
 	long kk;
-	char fname[200];
+	PSF_METRICS *metrics;
 	
 	
 	boxsize = (long) (2.0*PSFsizeEst);
 	printf("box size : %f -> %ld\n", PSFsizeEst, boxsize);
 
-	xcenter = (double*) malloc(sizeof(double));
-	ycenter = (double*) malloc(sizeof(double));
-	
 	IDin = image_ID(IDin_name);
 	xsize = data.image[IDin].md[0].size[0];
 	ysize = data.image[IDin].md[0].size[1];
@@ -1427,26 +1509,27 @@ int PSF_sequence_measure(const char *IDin_name, float PSFsizeEst, const char *ou
 	else
 		zsize = 1;
 	
-	IDtmp = create_2Dimage_ID("_tmppsfim", xsize, ysize);
-	
-	fpout = fopen(outfname, "w");
+	metrics = (PSF_METRICS*) malloc(sizeof(PSF_METRICS)*zsize);
+
+# ifdef HAVE_LIBGOMP
+	#pragma omp parallel for schedule(dynamic, 16)
+# endif
 	for(kk=0;kk<zsize;kk++)
-	{
-		ptr = (char*) data.image[IDin].array.F;
-		ptr += sizeof(float)*xysize*kk;
-		memcpy((void*) data.image[IDtmp].array.F, (void*) ptr, sizeof(float)*xysize);
-		fast_center_PSF("_tmppsfim", xcenter, ycenter, boxsize);
-		printf("%5ld   CENTER = %f %f\n", kk, xcenter[0], ycenter[0]);
-		fprintf(fpout, "%ld %20f %20f\n", kk, xcenter[0], ycenter[0]);
+		PSF_metrics_array(data.image[IDin].array.F + kk*xysize, xsize, ysize, boxsize, &metrics[kk]);
 	
-	//	sprintf(fname, "!_tmppsfim_%04ld.fits", kk);
-	//	save_fits("_tmppsfim", fname);
+	if((fpout = fopen(outfname, "w")) == NULL)
+	{
+		printf("ERROR: cannot create file \"%s\"\n", outfname);
+		free(metrics);
+		return(-1);
 	}
+	for(kk=0;kk<zsize;kk++)
+		fprintf(fpout, "%ld %20f %20f %20g %20g %12f %12f %12f %12g\n", kk, metrics[kk].xcenter, metrics[kk].ycenter, metrics[kk].flux, metrics[kk].peak, metrics[kk].FWHM, metrics[kk].EE50, metrics[kk].EE80, metrics[kk].SRproxy);
 	fclose(fpout);
 	
+	printf("%ld frames measured\n", zsize);
 	
-	free(xcenter);
-	free(ycenter);
+	free(metrics);
 	
 	return(0);
 }
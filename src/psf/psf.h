@@ -6,6 +6,23 @@
 int_fast8_t init_psf();
 
 
+// PSF metrics, see PSF_metrics_array()
+typedef struct
+{
+    double xcenter;
+    double ycenter;
+    double flux;
+    double peak;
+    double mxx;       // second central moments [pix^2]
+    double myy;
+    double mxy;
+    double FWHM;      // gaussian equivalent, from moments
+    double EE50;      // 50% encircled energy radius [pix]
+    double EE80;
+    double SRproxy;   // peak / flux
+} PSF_METRICS;
+
+
 
 
 long PSF_makeChromatPSF(const char *amp_name, const char *pha_name, float coeff1, float coeff2, long NBstep, float ApoCoeff, const char *out_name);
@@ -26,6 +43,8 @@ int center_PSF(const char *ID_name, double *xcenter, double *ycenter, long box_s
 
 int fast_center_PSF(const char *ID_name, double *xcenter, double *ycenter, long box_size);
 
+int PSF_metrics_array(const float *im, long xsize, long ysize, long box_size, PSF_METRICS *m);
+
 int center_PSF_alone(const char *ID_name);
 
 int center_star(const char *ID_in_name, double *x_star, double *y_star);
@@ -280,11 +280,371 @@ double better_poisson(double mu) {
 }
 
 
+/* =============================================================================================== */
+/*                         COUNTER-BASED NOISE ENGINE (THREAD-SAFE)                                */
+/* =============================================================================================== */
+//
+// Random numbers are a pure function of (key, counter) : Philox4x32-10 (Salmon et al. 2011).
+// Each fill call reserves a counter range, element i of the call always gets the same numbers
+// whatever the number of threads, so that results are reproducible for a given seed.
+// Key is taken from data.rndgen on first use, or set with statistic_rng_seed().
+//
+//  uniform  : 4 x 32-bit per counter, in (0,1)
+//  gauss    : Box-Muller on uniform pairs
+//  poisson  : inversion for mu < 10, PTRS transformed rejection (Hormann 1993) above
+//
+
+#define STAT_RNG_BLOCK 256                 // elements per inner (vectorized) loop
+#define STAT_RNG_OMP_LIMIT 10000           // threads used above this number of elements
+
+// counter word 3 : stream tag, keeps distributions independent
+#define STAT_RNG_TAG_UNIFORM 0x0
+#define STAT_RNG_TAG_GAUSS   0x1
+#define STAT_RNG_TAG_POISSON 0x2
+#define STAT_RNG_TAG_GAUSSTRC 0x3
+
+static int stat_rng_init = 0;
+static uint32_t stat_rng_key[2];
+static uint64_t stat_rng_counter = 0;
+
+
+
+void statistic_rng_seed(uint64_t seed)
+{
+    stat_rng_key[0] = (uint32_t) seed;
+    stat_rng_key[1] = (uint32_t) (seed >> 32);
+    stat_rng_counter = 0;
+    stat_rng_init = 1;
+}
+
+
+
+// reserves n consecutive counters, returns first
+static uint64_t stat_rng_reserve(uint64_t n)
+{
+    uint64_t c0;
+
+    if(stat_rng_init == 0)
+        statistic_rng_seed(((uint64_t) gsl_rng_get(data.rndgen) << 32) ^ (uint64_t) gsl_rng_get(data.rndgen) ^ (uint64_t) time(NULL));
+
+# ifdef _OPENMP
+    #pragma omp atomic capture
+# endif
+    {
+        c0 = stat_rng_counter;
+        stat_rng_counter += n;
+    }
+
+    return(c0);
+}
+
+
+
+static inline void stat_philox4x32(uint64_t ctr, uint32_t c2, uint32_t c3, uint32_t *out)
+{
+    uint32_t x0 = (uint32_t) ctr;
+    uint32_t x1 = (uint32_t) (ctr >> 32);
+    uint32_t x2 = c2;
+    uint32_t x3 = c3;
+    uint32_t k0 = stat_rng_key[0];
+    uint32_t k1 = stat_rng_key[1];
+    int r;
+
+    for(r=0; r<10; r++)
+    {
+        uint64_t p0 = (uint64_t) 0xD2511F53u * x0;
+        uint64_t p1 = (uint64_t) 0xCD9E8D57u * x2;
+        uint32_t y0 = (uint32_t) (p1 >> 32) ^ x1 ^ k0;
+        uint32_t y2 = (uint32_t) (p0 >> 32) ^ x3 ^ k1;
+
+        x1 = (uint32_t) p1;
+        x3 = (uint32_t) p0;
+        x0 = y0;
+        x2 = y2;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = x0;
+    out[1] = x1;
+    out[2] = x2;
+    out[3] = x3;
+}
+
+
+// 32-bit integer -> (0,1)
+static inline double stat_u01(uint32_t u)
+{
+    return((u + 0.5)*2.3283064365386963e-10);
+}
+
+
+
+// fills u[0..4*NBctr-1] with uniforms from counters c0 .. c0+NBctr-1
+static void stat_rng_uniform_block(uint64_t c0, uint32_t tag, long NBctr, double *u)
+{
+    long c;
+
+# ifdef _OPENMP
+    #pragma omp simd
+# endif
+    for(c=0; c<NBctr; c++)
+    {
+        uint32_t r[4];
+
+        stat_philox4x32(c0+c, 0, tag, r);
+        u[4*c] = stat_u01(r[0]);
+        u[4*c+1] = stat_u01(r[1]);
+        u[4*c+2] = stat_u01(r[2]);
+        u[4*c+3] = stat_u01(r[3]);
+    }
+}
+
+
+
+// Box-Muller, u[0..n-1] (n even) uniforms replaced by N(0,1)
+static void stat_boxmuller(double *u, long n)
+{
+    long i;
+
+# ifdef _OPENMP
+    #pragma omp simd
+# endif
+    for(i=0; i<n; i+=2)
+    {
+        double r = sqrt(-2.0*log(u[i]));
+        double a = 2.0*M_PI*u[i+1];
+
+        u[i] = r*cos(a);
+        u[i+1] = r*sin(a);
+    }
+}
+
+
+
+// Poisson deviate for element counter e
+static double stat_poisson_elem(uint64_t e, double mu)
+{
+    uint32_t r[4];
+    uint32_t j;
+
+    if(!(mu > 0.0))
+        return(0.0);
+
+    if(mu < 10.0)
+    {
+        // inversion
+        double p = exp(-mu);
+        double F = p;
+        double u;
+        long k = 0;
+
+        stat_philox4x32(e, 0, STAT_RNG_TAG_POISSON, r);
+        u = stat_u01(r[0]);
+        while((u > F)&&(k < 1000))
+        {
+            k++;
+            p *= mu/k;
+            F += p;
+        }
+        return((double) k);
+    }
+    else
+    {
+        // PTRS, 2 attempts per counter
+        double slam = sqrt(mu);
+        double loglam = log(mu);
+        double b = 0.931 + 2.53*slam;
+        double a = -0.059 + 0.02483*b;
+        double invalpha = 1.1239 + 1.1328/(b-3.4);
+        double vr = 0.9277 - 3.6224/(b-2.0);
+
+        for(j=0; ; j++)
+        {
+            int t;
+
+            stat_philox4x32(e, j, STAT_RNG_TAG_POISSON, r);
+            for(t=0; t<4; t+=2)
+            {
+                double U = stat_u01(r[t]) - 0.5;
+                double V = stat_u01(r[t+1]);
+                double us = 0.5 - fabs(U);
+                double k = floor((2.0*a/us + b)*U + mu + 0.43);
+
+                if((us >= 0.07)&&(V <= vr))
+                    return(k);
+                if((k < 0.0)||((us < 0.013)&&(V > us)))
+                    continue;
+                if(log(V) + log(invalpha) - log(a/(us*us) + b) <= -mu + k*loglam - lgamma(k+1.0))
+                    return(k);
+            }
+        }
+    }
+}
+
+
+
+
+/** @brief Fills array with uniform deviates in (0,1)
+ */
+int statistic_noise_uniform(float *out, long n)
+{
+    uint64_t c0 = stat_rng_reserve((n+3)/4);
+    long NBblock = (n + STAT_RNG_BLOCK - 1)/STAT_RNG_BLOCK;
+    long b;
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (n > STAT_RNG_OMP_LIMIT)
+# endif
+    for(b=0; b<NBblock; b++)
+    {
+        double u[STAT_RNG_BLOCK];
+        long i0 = b*STAT_RNG_BLOCK;
+        long nb = (i0 + STAT_RNG_BLOCK > n) ? n - i0 : STAT_RNG_BLOCK;
+        long i;
+
+        stat_rng_uniform_block(c0 + i0/4, STAT_RNG_TAG_UNIFORM, (nb+3)/4, u);
+        for(i=0; i<nb; i++)
+            out[i0+i] = u[i];
+    }
+
+    return(0);
+}
+
+
+
+/** @brief out = in + ampl * N(0,1)
+ *
+ * in may be NULL (zero) or equal to out
+ */
+int statistic_noise_gauss(float *out, const float *in, long n, double ampl)
+{
+    uint64_t c0 = stat_rng_reserve((n+3)/4);
+    long NBblock = (n + STAT_RNG_BLOCK - 1)/STAT_RNG_BLOCK;
+    long b;
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (n > STAT_RNG_OMP_LIMIT)
+# endif
+    for(b=0; b<NBblock; b++)
+    {
+        double u[STAT_RNG_BLOCK];
+        long i0 = b*STAT_RNG_BLOCK;
+        long nb = (i0 + STAT_RNG_BLOCK > n) ? n - i0 : STAT_RNG_BLOCK;
+        long i;
+
+        stat_rng_uniform_block(c0 + i0/4, STAT_RNG_TAG_GAUSS, (nb+3)/4, u);
+        stat_boxmuller(u, 4*((nb+3)/4));
+        if(in == NULL)
+            for(i=0; i<nb; i++)
+                out[i0+i] = ampl*u[i];
+        else
+            for(i=0; i<nb; i++)
+                out[i0+i] = in[i0+i] + ampl*u[i];
+    }
+
+    return(0);
+}
+
+
+
+/** @brief Same as statistic_noise_gauss(), double precision output
+ */
+int statistic_noise_gauss_double(double *out, const double *in, long n, double ampl)
+{
+    uint64_t c0 = stat_rng_reserve((n+3)/4);
+    long NBblock = (n + STAT_RNG_BLOCK - 1)/STAT_RNG_BLOCK;
+    long b;
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (n > STAT_RNG_OMP_LIMIT)
+# endif
+    for(b=0; b<NBblock; b++)
+    {
+        double u[STAT_RNG_BLOCK];
+        long i0 = b*STAT_RNG_BLOCK;
+        long nb = (i0 + STAT_RNG_BLOCK > n) ? n - i0 : STAT_RNG_BLOCK;
+        long i;
+
+        stat_rng_uniform_block(c0 + i0/4, STAT_RNG_TAG_GAUSS, (nb+3)/4, u);
+        stat_boxmuller(u, 4*((nb+3)/4));
+        if(in == NULL)
+            for(i=0; i<nb; i++)
+                out[i0+i] = ampl*u[i];
+        else
+            for(i=0; i<nb; i++)
+                out[i0+i] = in[i0+i] + ampl*u[i];
+    }
+
+    return(0);
+}
+
+
+
+/** @brief Truncated (-1/+1) N(0,1), attempt j of element uses counter word 2 = j
+ */
+int statistic_noise_gauss_trc(float *out, long n)
+{
+    uint64_t c0 = stat_rng_reserve(n);
+    long i;
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (n > STAT_RNG_OMP_LIMIT)
+# endif
+    for(i=0; i<n; i++)
+    {
+        uint32_t j;
+        double v = 0.0;
+
+        for(j=0; j<1000; j++)
+        {
+            uint32_t r[4];
+            double u[4];
+            int t;
+
+            stat_philox4x32(c0+i, j, STAT_RNG_TAG_GAUSSTRC, r);
+            for(t=0; t<4; t++)
+                u[t] = stat_u01(r[t]);
+            stat_boxmuller(u, 4);
+            for(t=0; t<4; t++)
+                if(fabs(u[t]) <= 1.0)
+                    break;
+            if(t < 4)
+            {
+                v = u[t];
+                break;
+            }
+        }
+        out[i] = v;
+    }
+
+    return(0);
+}
+
+
+
+/** @brief out = Poisson deviate of mean mu (mu <= 0 gives 0), mu may be equal to out
+ */
+int statistic_noise_poisson(float *out, const float *mu, long n)
+{
+    uint64_t c0 = stat_rng_reserve(n);
+    long i;
+
+# ifdef _OPENMP
+    #pragma omp parallel for schedule(static, STAT_RNG_BLOCK) if (n > STAT_RNG_OMP_LIMIT)
+# endif
+    for(i=0; i<n; i++)
+        out[i] = stat_poisson_elem(c0+i, mu[i]);
+
+    return(0);
+}
+
+
+
+
 long put_poisson_noise(const char *ID_in_name, const char *ID_out_name)
 {
   long ID_in;
   long ID_out;
-  long ii;
   long nelements;
   long naxis;
   long i;
@@ -300,8 +660,7 @@ long put_poisson_noise(const char *ID_in_name, const char *ID_out_name)
   ID_out = image_ID(ID_out_name);
   //  srand(time(NULL));
   
-  for (ii=0; ii < nelements; ii++)
-    data.image[ID_out].array.F[ii] = poisson(data.image[ID_in].array.F[ii]);
+  statistic_noise_poisson(data.image[ID_out].array.F, data.image[ID_in].array.F, nelements);
 
   return(ID_out);
 }
@@ -312,7 +671,6 @@ long put_gauss_noise(const char *ID_in_name, const char *ID_out_name, double amp
 {
   long ID_in;
   long ID_out;
-  long ii;
   long nelements;
   long naxis;
   long i;
@@ -328,8 +686,7 @@ long put_gauss_noise(const char *ID_in_name, const char *ID_out_name, double amp
   ID_out = image_ID(ID_out_name);
   //  srand(time(NULL));
   
-  for (ii=0; ii < nelements; ii++)
-    data.image[ID_out].array.F[ii] = data.image[ID_in].array.F[ii] + ampl*gauss();
+  statistic_noise_gauss(data.image[ID_out].array.F, data.image[ID_in].array.F, nelements, ampl);
 
   return(ID_out);
 }
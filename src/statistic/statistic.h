@@ -59,6 +59,24 @@ double fast_poisson(double mu);
 
 
 
+/** @brief Sets key of counter-based noise generator (resets counter)
+ */
+void statistic_rng_seed(uint64_t seed);
+
+/** @brief Thread-safe vectorized noise generators, reproducible for a given seed
+ */
+int statistic_noise_uniform(float *out, long n);
+
+int statistic_noise_gauss(float *out, const float *in, long n, double ampl);
+
+int statistic_noise_gauss_double(double *out, const double *in, long n, double ampl);
+
+int statistic_noise_gauss_trc(float *out, long n);
+
+int statistic_noise_poisson(float *out, const float *mu, long n);
+
+
+
 /** @brief Apply Poisson noise to image
  */
 long put_poisson_noise(const char *ID_in_name, const char *ID_out_name);